@@ -17,16 +17,21 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
 
 #include <absl/container/flat_hash_map.h>
 #include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_join.h>
 #include <absl/strings/str_split.h>
 #include <absl/strings/strip.h>
@@ -35,10 +40,16 @@
 #include <mujoco/mjvisualize.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/autotune.h"
 #include "mjpc/estimators/include.h"
+#include "mjpc/model_cache.h"
 #include "mjpc/planners/include.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -51,6 +62,11 @@ inline constexpr double kMinTimeStep = 1.0e-4;
 inline constexpr double kMaxTimeStep = 0.1;
 inline constexpr double kMinPlanningHorizon = 1.0e-5;
 inline constexpr double kMaxPlanningHorizon = 2.5;
+// weight of the latest compute time in the latency estimate
+inline constexpr double kLatencyAverage = 0.1;
+
+// longest sleep of the planning thread between checks of its exit request
+inline constexpr std::chrono::milliseconds kPlanIdle(10);
 
 // maximum number of actions to plot
 const int kMaxActionPlots = 25;
@@ -67,11 +83,22 @@ Agent::Agent(const mjModel* model, std::shared_ptr<Task> task)
   PlotReset();
 }
 
+Agent::~Agent() {
+  for (const mjModel* model : residual_models_) UnregisterResidual(model);
+}
+
 // initialize data, settings, planners, state
 void Agent::Initialize(const mjModel* model) {
   // ----- model ----- //
-  if (model_) mj_deleteModel(model_);
-  model_ = mj_copyModel(nullptr, model);  // agent's copy of model
+  if (model_) UnregisterResidualModel(model_);
+  shared_model_ = std::make_unique<SharedModel>(ShareModel(model));
+  model_ = shared_model_->get();  // agent's copy of model
+  RegisterResidualModel(model_);
+
+  // a model with the previous sizes keeps the allocations
+  std::string_view sizes = ModelSizes(model_);
+  compatible_reload_ = !model_sizes_.empty() && sizes == model_sizes_;
+  model_sizes_ = sizes;
 
   // check for limits on all actuators
   int num_missing = 0;
@@ -89,6 +116,23 @@ void Agent::Initialize(const mjModel* model) {
   // planner
   planner_ = GetNumberOrDefault(0, model, "agent_planner");
 
+  // planner portfolio, e.g., <numeric name="agent_portfolio" data="0 2"/>
+  portfolio_.clear();
+  int portfolio_id = mj_name2id(model, mjOBJ_NUMERIC, "agent_portfolio");
+  if (portfolio_id >= 0) {
+    int num_planners = planners_.size();
+    for (int i = 0; i < model->numeric_size[portfolio_id]; i++) {
+      int index =
+          model->numeric_data[model->numeric_adr[portfolio_id] + i];
+      if (index < 0 || index >= num_planners) {
+        mju_error("agent_portfolio: invalid planner index %d\n", index);
+      }
+      if (!InPortfolio(index)) portfolio_.push_back(index);
+    }
+  }
+  portfolio_warm_start_ =
+      GetNumberOrDefault(0, model, "agent_portfolio_warm_start");
+
   // estimator
   estimator_ =
       estimator_enabled ? GetNumberOrDefault(0, model, "estimator") : 0;
@@ -103,15 +147,95 @@ void Agent::Initialize(const mjModel* model) {
   // time step
   timestep_ = GetNumberOrDefault(1.0e-2, model, "agent_timestep");
 
+  // planning budget per iteration (seconds), zero for no deadline
+  planning_budget_ = GetNumberOrDefault(0.0, model, "agent_planning_budget");
+
+  // planning iteration trigger (see PlanTrigger), rate (Hz) and state
+  // tolerance
+  plan_trigger_ = std::clamp(
+      GetNumberOrDefault(0, model, "agent_plan_trigger"), 0,
+      static_cast<int>(PlanTrigger::kFixedRate));
+  plan_rate_ = GetNumberOrDefault(100.0, model, "agent_plan_rate");
+  plan_state_tolerance_ =
+      GetNumberOrDefault(0.0, model, "agent_plan_state_tolerance");
+
+  // plan from the state predicted for the compute latency
+  latency_compensation_ =
+      GetNumberOrDefault(0, model, "agent_latency_compensation");
+
+  // plan cache, its cell size and largest seeding distance
+  // the plans of a model with the same sizes still fit
+  plan_cache_enabled_ = GetNumberOrDefault(0, model, "agent_plan_cache");
+  if (!compatible_reload_) plan_cache_.Clear();
+  double plan_cache_resolution = GetNumberOrDefault(
+      kPlanCacheResolution, model, "agent_plan_cache_resolution");
+  if (plan_cache_resolution != plan_cache_.Resolution()) {
+    plan_cache_.SetResolution(plan_cache_resolution);
+  }
+  plan_cache_.SetMaxDistance(
+      GetNumberOrDefault(std::numeric_limits<double>::infinity(), model,
+                         "agent_plan_cache_distance"));
+  plan_cache_task_ = -1;
+  plan_cache_mode_ = -1;
+
+  // autotuned rollouts (and steps) for a target planning period
+  AutotuneOptions autotune;
+  autotune.period = GetNumberOrDefault(0.0, model, "agent_autotune_period");
+  autotune.min_rollouts = GetNumberOrDefault(autotune.min_rollouts, model,
+                                             "agent_autotune_min_rollouts");
+  autotune.max_rollouts = GetNumberOrDefault(autotune.max_rollouts, model,
+                                             "agent_autotune_max_rollouts");
+  autotune.min_horizon = GetNumberOrDefault(autotune.min_horizon, model,
+                                            "agent_autotune_min_horizon");
+  SetAutotune(autotune);
+
   // planning steps
   steps_ = mju_max(mju_min(horizon_ / timestep_ + 1, kMaxTrajectoryHorizon), 1);
 
-  active_task_id_ = gui_task_id;
+  SetTaskByIndex(gui_task_id);
   ActiveTask()->Reset(model);
 
-  // initialize planner
-  for (const auto& planner : planners_) {
-    planner->Initialize(model_, *ActiveTask());
+  // rollouts evaluate only the sensors read by the residual and traces,
+  // estimators use the full model
+  if (GetNumberOrDefault(1, model, "agent_strip_sensors")) {
+    StripPlanningSensors();
+  }
+
+  // on demand, keep only the selected planner and estimator
+  if (load_on_demand) {
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex_);
+      retired_planners_.clear();
+      retired_estimators_.clear();
+    }
+    for (int i = 0; i < planners_.size(); i++) {
+      if (i != planner_ && !InPortfolio(i)) {
+        planners_[i].reset();
+      } else if (!planners_[i]) {
+        planners_[i] = LoadPlanner(i);
+      }
+    }
+    for (int i = 0; i < estimators_.size(); i++) {
+      if (i != estimator_) {
+        estimators_[i].reset();
+      } else if (!estimators_[i]) {
+        estimators_[i] = LoadEstimator(i);
+        estimators_[i]->SetThreadPool(estimator_pool_);
+        estimators_[i]->SetThreadPoolPriority(estimator_priority_);
+      }
+    }
+  }
+  active_planner_ = planner_;
+  active_estimator_ = estimator_;
+  portfolio_winner_ = portfolio_.empty() ? -1 : portfolio_[0];
+
+  // initialize planner. planners borrow their mjData from one pool, which
+  // keeps the data of a model with the same sizes
+  if (!data_pool_) data_pool_ = std::make_shared<MjDataPool>();
+  for (int i = 0; i < planners_.size(); i++) {
+    if (!planners_[i]) continue;
+    planners_[i]->SetDataPool(data_pool_, DataLane(i));
+    planners_[i]->Initialize(model_, *ActiveTask());
   }
 
   // initialize state
@@ -120,7 +244,8 @@ void Agent::Initialize(const mjModel* model) {
   // initialize estimator
   if (reset_estimator && estimator_enabled) {
     for (const auto& estimator : estimators_) {
-      estimator->Initialize(model_);
+      if (!estimator) continue;
+      estimator->Initialize(shared_model_->base());
       estimator->Reset();
     }
   }
@@ -141,6 +266,8 @@ void Agent::Initialize(const mjModel* model) {
 
   // counter
   count_ = 0;
+  deadline_misses_ = 0;
+  deadline_missed_ = false;
 
   // names
   mju::strcpy_arr(this->planner_names_, kPlannerNames);
@@ -149,21 +276,33 @@ void Agent::Initialize(const mjModel* model) {
   // estimator threads
   estimator_threads_ = estimator_enabled;
 
-  // planner threads
+  // planner threads, the estimator shares the planning pool
   planner_threads_ =
-      std::max(1, NumAvailableHardwareThreads() - 3 - 2 * estimator_threads_);
+      std::max(1, NumAvailableHardwareThreads() - 3 - estimator_threads_);
 }
 
 // allocate memory
-void Agent::Allocate() {
+void Agent::Allocate(ThreadPool* pool) {
   // planner
   for (const auto& planner : planners_) {
+    if (!planner) continue;
+    planner->SetAllocationPool(pool);
     planner->Allocate();
+    planner->SetAllocationPool(nullptr);
   }
 
   // state
   state.Allocate(model_);
 
+  // latency compensation
+  predicted_state_.Allocate(model_);
+  if (compatible_reload_ && prediction_data_ && !model_->nplugin) {
+    mj_resetData(model_, prediction_data_.get());
+  } else {
+    prediction_data_.reset(mj_makeData(model_));
+  }
+  prediction_state_.resize(model_->nq + model_->nv + model_->na);
+
   // set status
   allocate_enabled = false;
 
@@ -172,19 +311,37 @@ void Agent::Allocate() {
 }
 
 // reset data, settings, planners, state
-void Agent::Reset(const double* initial_repeated_action) {
+void Agent::Reset(const double* initial_repeated_action, ThreadPool* pool) {
+  // keep the plan, the next iteration seeds from the plan cache
+  if (plan_cache_enabled_) StorePlan();
+  plan_cache_mode_ = -1;
+
   // planner
   for (const auto& planner : planners_) {
+    if (!planner) continue;
+    planner->SetAllocationPool(pool);
     planner->Reset(kMaxTrajectoryHorizon, initial_repeated_action);
+    planner->SetAllocationPool(nullptr);
   }
 
   // state
   state.Reset();
+  has_prediction_ = false;
+  prediction_error_ = 0.0;
+  prediction_time_error_ = 0.0;
+
+  // autotuner
+  {
+    std::lock_guard<std::mutex> lock(autotune_mutex_);
+    autotuner_.Reset();
+  }
+  autotune_rollouts_ = 0;
+  autotune_steps_ = 0;
 
   // estimator
   if (reset_estimator && estimator_enabled) {
     for (const auto& estimator : estimators_) {
-      estimator->Reset();
+      if (estimator) estimator->Reset();
     }
   }
 
@@ -193,6 +350,8 @@ void Agent::Reset(const double* initial_repeated_action) {
 
   // count
   count_ = 0;
+  deadline_misses_ = 0;
+  deadline_missed_ = false;
 
   // cost
   std::fill(terms_.begin(), terms_.end(), 0.0);
@@ -202,9 +361,36 @@ void Agent::SetState(const mjData* data) {
   state.Set(model_, data);
 }
 
+void Agent::StripPlanningSensors() {
+  // sensors read by the residual or collected as traces, by address
+  const Task* task = ActiveTask();
+  std::vector<int> read_adr = task->trace_sensor_adr;
+  for (int i = 0; i < task->sensors.size(); i++) {
+    read_adr.push_back(task->sensors.Address(i));
+  }
+
+  // the others become user sensors without a stage, which MuJoCo skips and
+  // the residual callback doesn't write (SkippedSensor). sensordata addresses
+  // are unchanged.
+  for (int i = 0; i < model_->nsensor; i++) {
+    int type = model_->sensor_type[i];
+    if (type == mjSENS_USER || type == mjSENS_PLUGIN) continue;
+    if (std::find(read_adr.begin(), read_adr.end(), model_->sensor_adr[i]) !=
+        read_adr.end()) {
+      continue;
+    }
+    shared_model_->MakeMutable(model_->sensor_type);
+    shared_model_->MakeMutable(model_->sensor_needstage);
+    model_->sensor_type[i] = mjSENS_USER;
+    model_->sensor_needstage[i] = mjSTAGE_NONE;
+  }
+}
+
+void Agent::ResetTask() { ActiveTask()->Reset(shared_model_->base()); }
+
 int Agent::GetTaskIdByName(std::string_view name) const {
-  for (int i = 0; i < tasks_.size(); i++) {
-    if (absl::EqualsIgnoreCase(name, tasks_[i]->Name())) {
+  for (int i = 0; i < registered_tasks_.size(); i++) {
+    if (absl::EqualsIgnoreCase(name, registered_tasks_[i].name)) {
       return i;
     }
   }
@@ -221,7 +407,7 @@ Agent::LoadModelResult Agent::LoadModel() const {
     mnew = mj_copyModel(nullptr, model_override_.get());
   } else {
     // otherwise use the task's model
-    std::string filename = tasks_[gui_task_id]->XmlPath();
+    std::string filename = GetTask(gui_task_id)->XmlPath();
     // make sure filename is not empty
     if (filename.empty()) {
       return {};
@@ -233,8 +419,7 @@ Agent::LoadModelResult Agent::LoadModel() const {
         mju::strcpy_arr(load_error, "could not load binary model");
       }
     } else {
-      mnew = mj_loadXML(filename.c_str(), nullptr, load_error,
-                        kErrorLength);
+      mnew = LoadCachedModel(filename, load_error, kErrorLength);
       // remove trailing newline character from load_error
       if (load_error[0]) {
         int error_length = mju::strlen_arr(load_error);
@@ -253,18 +438,95 @@ void Agent::OverrideModel(UniqueMjModel model) {
 }
 
 void Agent::SetTaskList(std::vector<std::shared_ptr<Task>> tasks) {
-  tasks_ = std::move(tasks);
+  std::vector<RegisteredTask> registered_tasks;
+  for (auto& task : tasks) {
+    std::string name = task->Name();
+    registered_tasks.push_back({std::move(name), [task] { return task; }});
+  }
+  SetTaskList(std::move(registered_tasks));
+}
+
+void Agent::SetTaskList(std::vector<RegisteredTask> tasks) {
+  registered_tasks_ = std::move(tasks);
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    tasks_.assign(registered_tasks_.size(), nullptr);
+  }
   std::ostringstream concatenated_task_names;
-  for (const auto& task : tasks_) {
-    concatenated_task_names << task->Name() << '\n';
+  for (const auto& task : registered_tasks_) {
+    concatenated_task_names << task.name << '\n';
   }
   mju::strcpy_arr(task_names_, concatenated_task_names.str().c_str());
+
+  // keep the active task valid
+  if (registered_tasks_.empty()) return;
+  int num_task = registered_tasks_.size();
+  SetTaskByIndex(active_task_id_ < num_task ? active_task_id_ : 0);
+}
+
+void Agent::SetTaskByIndex(int id) {
+  GetTask(id);
+  active_task_id_ = id;
+}
+
+Task* Agent::GetTask(int id) const {
+  std::lock_guard<std::mutex> lock(tasks_mutex_);
+  if (!tasks_[id]) tasks_[id] = registered_tasks_[id].make();
+  return tasks_[id].get();
+}
+
+void Agent::Residual(const mjModel* model, mjData* data) const {
+  // the planning thread and rollout threads don't need synchronization when
+  // using the planning residual. other models (physics, plots) run the task's
+  // residual with a shared lock, safe with changes to weights and parameters.
+  const ResidualFn* residual =
+      IsPlanningModel(model) ? PlanningResidual() : nullptr;
+  if (residual) {
+    residual->Residual(model, data, data->sensordata);
+  } else {
+    ActiveTask()->Residual(model, data, data->sensordata);
+  }
+}
+
+void Agent::RegisterResidualModel(const mjModel* model) {
+  auto residual = [](const void* agent, const mjModel* m, mjData* d) {
+    static_cast<const Agent*>(agent)->Residual(m, d);
+  };
+  if (!RegisterResidual(model, residual, this)) {
+    mju_warning("Residual registry full, model not registered.");
+    return;
+  }
+  if (std::find(residual_models_.begin(), residual_models_.end(), model) ==
+      residual_models_.end()) {
+    residual_models_.push_back(model);
+  }
+}
+
+void Agent::UnregisterResidualModel(const mjModel* model) {
+  auto it = std::find(residual_models_.begin(), residual_models_.end(), model);
+  if (it == residual_models_.end()) return;
+  UnregisterResidual(model);
+  residual_models_.erase(it);
 }
 
-void Agent::PlanIteration(ThreadPool* pool) {
+void Agent::PlanIteration(ThreadPool* pool,
+                          std::chrono::steady_clock::time_point deadline) {
+  MJPC_TRACE_SCOPE("Agent::PlanIteration");
+
   // start agent timer
   auto agent_start = std::chrono::steady_clock::now();
 
+  // planners retired before this iteration are no longer in use. the active
+  // planner is captured once, a switch during the iteration takes effect in
+  // the next one.
+  Planner* active_planner;
+  {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    retired_planners_.clear();
+    active_planner = &ActivePlanner();
+  }
+  Planner& planner = *active_planner;
+
   // set agent time and time step
   model_->opt.timestep = timestep_;
   model_->opt.integrator = integrator_;
@@ -273,78 +535,593 @@ void Agent::PlanIteration(ThreadPool* pool) {
   steps_ =
       mju_max(mju_min(horizon_ / timestep_ + 1, kMaxTrajectoryHorizon), 1);
 
+  // autotuned rollouts and steps of the single planner
+  int nominal_steps = steps_;
+  bool autotune = false;
+  if (!allocate_enabled && plan_enabled && portfolio_.empty()) {
+    std::lock_guard<std::mutex> lock(autotune_mutex_);
+    autotune = autotuner_.Enabled();
+    const AutotuneDecision& decision = autotuner_.decision();
+    if (autotune && decision.rollouts > 0) {
+      steps_ = mju_min(steps_, decision.steps);
+      planner.SetNumRollouts(decision.rollouts);
+    }
+  }
+
   // plan
   if (!allocate_enabled) {
     // set state
-    ActivePlanner().SetState(state);
+    const State& planning_state = PlanningState();
+    if (portfolio_.empty()) {
+      planner.SetState(planning_state);
+    } else {
+      for (int index : portfolio_) planners_[index]->SetState(planning_state);
+    }
+
+    // snapshot of the task's residual function parameters, which remains
+    // constant during planning and doesn't require locking from the rollout
+    // threads. the snapshot is reused while the task is unchanged.
+    residual_fn_ = ActiveTask()->ResidualSnapshot();
 
-    // copy the task's residual function parameters into a new object, which
-    // remains constant during planning and doesn't require locking from the
-    // rollout threads
-    residual_fn_ = ActiveTask()->Residual();
+    // time-only terms of the residual, precomputed for this iteration's
+    // rollouts if the residual has any
+    std::shared_ptr<const ResidualFn> timed_residual_fn =
+        residual_fn_->PrecomputeTimeGrid(
+            {planning_state.time(), timestep_, steps_});
+    if (timed_residual_fn) residual_fn_ = std::move(timed_residual_fn);
 
     if (plan_enabled) {
+      // seed from a cached plan
+      if (plan_cache_enabled_) UpdatePlanCache(planning_state);
+
+      // deadline from the planning budget
+      double budget = planning_budget_.load();
+      std::chrono::steady_clock::time_point budget_deadline;
+      if (budget > 0.0) {
+        budget_deadline = agent_start +
+                          std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::duration<double>(budget));
+      }
+      bool external_deadline =
+          deadline != std::chrono::steady_clock::time_point() &&
+          (budget <= 0.0 || deadline < budget_deadline);
+      std::chrono::steady_clock::time_point planner_deadline =
+          external_deadline ? deadline : budget_deadline;
+
       // planner policy
-      ActivePlanner().OptimizePolicy(steps_, *pool);
+      if (portfolio_.empty()) {
+        planner.SetDeadline(planner_deadline);
+        planner.OptimizePolicy(steps_, *pool);
+      } else {
+        OptimizePortfolio(planner_deadline, *pool);
+      }
 
       // compute time
+      auto agent_end = std::chrono::steady_clock::now();
       agent_compute_time_ =
-          std::chrono::duration_cast<std::chrono::microseconds>(
-              std::chrono::steady_clock::now() - agent_start)
+          std::chrono::duration_cast<std::chrono::microseconds>(agent_end -
+                                                                agent_start)
               .count();
 
+      // deadline miss, the planner overran its budget
+      deadline_missed_ = budget > 0.0 && agent_end > budget_deadline;
+      if (deadline_missed_) deadline_misses_ += 1;
+
+      // metrics
+      plan_latency_.Record(1.0e-6 * agent_compute_time_);
+      double latency = 1.0e-6 * agent_compute_time_;
+      double estimate = latency_estimate_.load();
+      latency_estimate_ =
+          estimate > 0.0 ? estimate + kLatencyAverage * (latency - estimate)
+                         : latency;
+      PlannerCounters counters;
+      if (portfolio_.empty()) {
+        counters = planner.Counters();
+      } else {
+        for (int index : portfolio_) counters += planners_[index]->Counters();
+      }
+      rollouts_ += counters.rollouts;
+      physics_steps_ += counters.steps;
+      residuals_ += counters.residuals;
+      derivatives_ += counters.derivatives;
+      aborted_rollouts_ += counters.aborted;
+      solver_iterations_ += counters.solver_iterations;
+      steps_per_second_ = agent_compute_time_ > 0.0
+                              ? 1.0e6 * counters.steps / agent_compute_time_
+                              : 0.0;
+      last_plan_time_ = agent_end.time_since_epoch().count();
+
+      // autotuner decision for the next iteration
+      if (autotune) {
+        std::lock_guard<std::mutex> lock(autotune_mutex_);
+        const AutotuneDecision& decision = autotuner_.Update(
+            1.0e-6 * agent_compute_time_, counters.steps, pool->NumThreads(),
+            planner.NumRollouts(), nominal_steps);
+        if (decision.rollouts != autotune_rollouts_.load() ||
+            decision.steps != autotune_steps_.load()) {
+          autotune_adjustments_ += 1;
+        }
+        autotune_rollouts_ = decision.rollouts;
+        autotune_steps_ = decision.steps;
+      }
+
+      // plan log
+      LogIteration(planning_state);
+
       // counter
       count_ += 1;
     } else {
       // rollout nominal policy
-      ActivePlanner().NominalTrajectory(steps_, *pool);
+      planner.NominalTrajectory(steps_, *pool);
 
       // set timers
       agent_compute_time_ = 0.0;
     }
 
+    // traces of the new policy for the renderer and scene streams
+    if (visualize_enabled) PublishTraces();
+    if (trace_streams_.load() > 0) PublishStreamedTrace();
+
     // release the planning residual function
     residual_fn_.reset();
   }
 }
 
+std::string Agent::Snapshot() {
+  SnapshotWriter writer;
+  for (const auto& planner : planners_) {
+    if (planner && !allocate_enabled) planner->Snapshot(writer);
+  }
+  if (estimator_enabled) ActiveEstimator().Snapshot(writer);
+  return writer.Bytes();
+}
+
+void Agent::SetPlanCacheEnabled(bool enabled) {
+  plan_cache_enabled_ = enabled;
+  plan_cache_mode_ = -1;
+}
+
+MemoryReport Agent::ReportMemory() const {
+  MemoryReport report;
+  if (shared_model_) {
+    // the base model's arrays may be shared with other agents
+    report.Add("model/base", MjModelBytes(shared_model_->base()));
+    report.Add("model/private", shared_model_->MutableSize());
+  }
+  if (data_pool_) report.Add("data_pool", data_pool_->Bytes());
+  report.Add("prediction_data", MjDataBytes(prediction_data_.get()));
+  std::vector<std::string_view> planner_names =
+      absl::StrSplit(kPlannerNames, '\n', absl::SkipEmpty());
+  for (int i = 0; i < planners_.size() && i < planner_names.size(); i++) {
+    if (!planners_[i]) continue;
+    MemoryReport planner;
+    planners_[i]->ReportMemory(planner);
+    report.Add(absl::StrCat("planner/", planner_names[i]), planner);
+  }
+  std::vector<std::string_view> estimator_names =
+      absl::StrSplit(kEstimatorNames, '\n', absl::SkipEmpty());
+  for (int i = 0; i < estimators_.size() && i < estimator_names.size();
+       i++) {
+    if (!estimators_[i]) continue;
+    MemoryReport estimator;
+    estimators_[i]->ReportMemory(estimator);
+    report.Add(absl::StrCat("estimator/", estimator_names[i]), estimator);
+  }
+  report.Add("plan_cache", plan_cache_.Bytes());
+  report.Add("buffers",
+             VectorBytes(sensor, ctrl, terms_, planned_state_, planned_mocap_,
+                         planned_userdata_, current_state_, current_mocap_,
+                         current_userdata_, prediction_state_,
+                         plan_log_mocap_, plan_log_userdata_,
+                         plan_cache_features_, plan_cache_query_,
+                         plan_cache_userdata_));
+  return report;
+}
+
+std::string Agent::PlannerSnapshot() const {
+  SnapshotWriter writer;
+  if (portfolio_.empty()) {
+    ActivePlanner().Snapshot(writer);
+  } else {
+    for (int index : portfolio_) planners_[index]->Snapshot(writer);
+  }
+  return writer.Bytes();
+}
+
+bool Agent::RestorePlanners(std::string_view snapshot) {
+  SnapshotReader reader;
+  if (!reader.Parse(snapshot)) return false;
+  bool restored = false;
+  if (portfolio_.empty()) {
+    restored = ActivePlanner().Restore(reader);
+  } else {
+    for (int index : portfolio_) {
+      restored = planners_[index]->Restore(reader) || restored;
+    }
+  }
+  return restored;
+}
+
+void Agent::UpdatePlanCache(const State& state) {
+  // features: state and mocap
+  int nstate = state.state().size();
+  plan_cache_query_.resize(nstate + state.mocap().size());
+  plan_cache_userdata_.resize(state.userdata().size());
+  double time;
+  state.CopyTo(plan_cache_query_.data(), plan_cache_query_.data() + nstate,
+               plan_cache_userdata_.data(), &time);
+
+  // a mode switch, or the first iteration after a reset
+  int mode = ActiveTask()->mode;
+  if (mode != plan_cache_mode_ || active_task_id_ != plan_cache_task_) {
+    StorePlan();
+    std::string snapshot;
+    if (plan_cache_.Lookup(active_task_id_, mode, plan_cache_query_.data(),
+                           plan_cache_query_.size(), time, &snapshot) &&
+        RestorePlanners(snapshot)) {
+      plan_cache_seeds_++;
+    }
+    plan_cache_task_ = active_task_id_;
+    plan_cache_mode_ = mode;
+  }
+  plan_cache_features_.swap(plan_cache_query_);
+  plan_cache_time_ = time;
+}
+
+void Agent::StorePlan() {
+  if (plan_cache_mode_ < 0 || plan_cache_task_ != active_task_id_ ||
+      count_.load() == 0) {
+    return;
+  }
+  plan_cache_.Store(plan_cache_task_, plan_cache_mode_,
+                    plan_cache_features_.data(), plan_cache_features_.size(),
+                    plan_cache_time_, PlannerSnapshot());
+}
+
+bool Agent::Restore(std::string_view snapshot) {
+  SnapshotReader reader;
+  if (allocate_enabled || !reader.Parse(snapshot)) return false;
+  bool restored = false;
+  for (const auto& planner : planners_) {
+    if (planner && planner->Restore(reader)) restored = true;
+  }
+  if (estimator_enabled && ActiveEstimator().Restore(reader)) restored = true;
+  return restored;
+}
+
+bool Agent::StartPlanLog(const std::string& path,
+                         const PlanLogOptions& options) {
+  std::lock_guard<std::mutex> lock(plan_log_mutex_);
+  return plan_log_.Open(path, options);
+}
+
+void Agent::StopPlanLog() {
+  std::lock_guard<std::mutex> lock(plan_log_mutex_);
+  plan_log_.Close();
+}
+
+void Agent::LogIteration(const State& state) {
+  std::lock_guard<std::mutex> lock(plan_log_mutex_);
+  if (!plan_log_.IsOpen()) return;
+  PlanLogRecord* record = plan_log_.Acquire();
+  if (!record) return;
+  record->iteration = count_;
+  record->state.resize(state.state().size());
+  plan_log_mocap_.resize(state.mocap().size());
+  plan_log_userdata_.resize(state.userdata().size());
+  state.CopyTo(record->state.data(), plan_log_mocap_.data(),
+               plan_log_userdata_.data(), &record->time);
+  Planner& planner = ActivePlanner();
+  const Trajectory* best = planner.BestTrajectory();
+  record->total_return = best ? best->total_return : 0.0;
+  planner.LogIteration(*record, plan_log_.options().samples);
+  plan_log_.Commit();
+}
+
+AutotuneOptions Agent::Autotune() const {
+  std::lock_guard<std::mutex> lock(autotune_mutex_);
+  return autotuner_.options();
+}
+
+void Agent::SetAutotune(const AutotuneOptions& options) {
+  std::lock_guard<std::mutex> lock(autotune_mutex_);
+  autotuner_.SetOptions(options);
+}
+
+const State& Agent::PlanningState() {
+  if (!latency_compensation_.load() || !plan_enabled || count_ == 0 ||
+      !prediction_data_) {
+    has_prediction_ = false;
+    return state;
+  }
+  mjData* data = prediction_data_.get();
+  int nq = model_->nq, nv = model_->nv, na = model_->na;
+  state.CopyTo(model_, data);
+
+  // error of the previous prediction
+  if (has_prediction_) {
+    const double* predicted = predicted_state_.state().data();
+    double error = 0.0;
+    for (int i = 0; i < nq; i++) {
+      error += mju_pow(data->qpos[i] - predicted[i], 2);
+    }
+    for (int i = 0; i < nv; i++) {
+      error += mju_pow(data->qvel[i] - predicted[nq + i], 2);
+    }
+    for (int i = 0; i < na; i++) {
+      error += mju_pow(data->act[i] - predicted[nq + nv + i], 2);
+    }
+    prediction_error_ = mju_sqrt(error);
+    prediction_time_error_ = data->time - predicted_state_.time();
+  }
+
+  // steps of the latency estimate, at most a planning horizon
+  int steps = mju_min(mju_round(latency_estimate_.load() / timestep_), steps_);
+  if (steps <= 0) {
+    has_prediction_ = false;
+    return state;
+  }
+
+  // forward-simulate the published policy, without residuals
+  ScopedResidualSkip skip;
+  Planner& planner = ActivePlanner();
+  double* x = prediction_state_.data();
+  for (int t = 0; t < steps; t++) {
+    mju_copy(x, data->qpos, nq);
+    mju_copy(x + nq, data->qvel, nv);
+    mju_copy(x + nq + nv, data->act, na);
+    planner.ActionFromPolicy(data->ctrl, x, data->time);
+    mj_step(model_, data);
+  }
+  predicted_state_.Set(model_, data);
+  has_prediction_ = true;
+  return predicted_state_;
+}
+
 // call planner to update nominal policy
 void Agent::Plan(std::atomic<bool>& exitrequest,
-                 std::atomic<int>& uiloadrequest) {
-  // instantiate thread pool
-  ThreadPool pool(planner_threads_);
+                 std::atomic<int>& uiloadrequest, ThreadPool* pool) {
+  // instantiate thread pool, pinned workers of our own or a quota of the
+  // shared pool
+  std::unique_ptr<ThreadPool> owned_pool;
+  int quota = 0;
+  if (!pool && planner_affinity.Enabled()) {
+    owned_pool =
+        std::make_unique<ThreadPool>(planner_threads_, planner_affinity);
+    pool = owned_pool.get();
+  } else if (!pool) {
+    pool = &SharedThreadPool();
+    quota = planner_threads_;
+  }
+  ThreadQuota thread_quota(quota);
 
   // main loop
+  std::uint64_t version = state.Version();
+  auto next_iteration = std::chrono::steady_clock::now();
   while (!exitrequest.load()) {
-    if (model_ && uiloadrequest.load() == 0) {
-      PlanIteration(&pool);
+    auto now = std::chrono::steady_clock::now();
+
+    // nothing to plan, check again later
+    if (!model_ || uiloadrequest.load() != 0) {
+      std::this_thread::sleep_for(kPlanIdle);
+      continue;
+    }
+
+    // wait for the trigger, waking up to check exitrequest
+    PlanTrigger trigger = GetPlanTrigger();
+    bool planning = plan_enabled;
+    bool new_state = state.Version() != version;
+    if (trigger == PlanTrigger::kFixedRate ||
+        (!planning && trigger == PlanTrigger::kContinuous)) {
+      if (now < next_iteration) {
+        std::this_thread::sleep_until(
+            std::min(next_iteration, now + kPlanIdle));
+        continue;
+      }
+      auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::duration<double>(1.0 / std::max(plan_rate_.load(),
+                                                       1.0e-3)));
+      next_iteration = std::max(next_iteration + period, now);
+    } else if (trigger == PlanTrigger::kNewState && !new_state) {
+      state.WaitForUpdate(version, now + kPlanIdle);
+      continue;
+    }
+    version = state.Version();
+
+    // the state hasn't changed, wait for a new one
+    if (planning && plan_state_tolerance_.load() > 0.0 && StateUnchanged()) {
+      skipped_iterations_ += 1;
+      state.WaitForUpdate(version, now + kPlanIdle);
+      continue;
     }
+
+    PlanIteration(pool);
   }  // exitrequest sent -- stop planning
 }
 
-void Agent::RunBeforeStep(StepJob job) {
-  std::lock_guard<std::mutex> lock(step_jobs_mutex_);
-  step_jobs_.push_back(std::move(job));
+bool Agent::StateUnchanged() {
+  current_state_.resize(state.state().size());
+  current_mocap_.resize(state.mocap().size());
+  current_userdata_.resize(state.userdata().size());
+  double time;
+  state.CopyTo(current_state_.data(), current_mocap_.data(),
+               current_userdata_.data(), &time);
+
+  // the planner was reset, or the state allocated, since the last iteration
+  bool unchanged = planned_count_ >= 0 && planned_count_ <= count_.load() &&
+                   planned_state_.size() == current_state_.size() &&
+                   planned_mocap_.size() == current_mocap_.size() &&
+                   planned_userdata_.size() == current_userdata_.size();
+  if (unchanged) {
+    double tolerance = plan_state_tolerance_.load();
+    auto within = [tolerance](const std::vector<double>& a,
+                              const std::vector<double>& b) {
+      return std::equal(a.begin(), a.end(), b.begin(), [&](double x, double y) {
+        return std::abs(x - y) <= tolerance;
+      });
+    };
+    unchanged = within(current_state_, planned_state_) &&
+                within(current_mocap_, planned_mocap_) &&
+                within(current_userdata_, planned_userdata_);
+  }
+  if (!unchanged) {
+    planned_state_.swap(current_state_);
+    planned_mocap_.swap(current_mocap_);
+    planned_userdata_.swap(current_userdata_);
+    planned_count_ = count_.load();
+  }
+  return unchanged;
 }
 
-void Agent::ExecuteAllRunBeforeStepJobs(const mjModel* model, mjData* data) {
-  while (true) {
-      StepJob step_job;
-      {
-        // only hold the lock while reading from the queue and not while
-        // executing the jobs
-        std::lock_guard<std::mutex> lock(step_jobs_mutex_);
-        if (step_jobs_.empty()) {
-          break;
-        }
-        step_job = std::move(step_jobs_.front());
-        step_jobs_.pop_front();
-      }
-      step_job(this, model, data);
+PlannerCounters Agent::Counters() const {
+  PlannerCounters counters;
+  counters.rollouts = rollouts_.load();
+  counters.steps = physics_steps_.load();
+  counters.residuals = residuals_.load();
+  counters.derivatives = derivatives_.load();
+  counters.aborted = aborted_rollouts_.load();
+  counters.solver_iterations = solver_iterations_.load();
+  return counters;
+}
+
+void Agent::SetEstimatorThreadPool(ThreadPool* pool, TaskPriority priority) {
+  estimator_pool_ = pool;
+  estimator_priority_ = priority;
+  for (const auto& estimator : estimators_) {
+    if (!estimator) continue;
+    estimator->SetThreadPool(pool);
+    estimator->SetThreadPoolPriority(priority);
+  }
+}
+
+bool Agent::InPortfolio(int planner) const {
+  return std::find(portfolio_.begin(), portfolio_.end(), planner) !=
+         portfolio_.end();
+}
+
+int Agent::DataLane(int planner) const {
+  // portfolio planners run at the same time, each on its own lanes
+  int lane = 0;
+  for (int index : portfolio_) {
+    if (index == planner) return lane;
+    lane += planners_[index]->NumDataLanes();
+  }
+  return 0;
+}
+
+void Agent::OptimizePortfolio(std::chrono::steady_clock::time_point deadline,
+                              ThreadPool& pool) {
+  // warm start from the previous winner's trajectory
+  int previous = portfolio_winner_.load();
+  const Trajectory* previous_best = planners_[previous]->BestTrajectory();
+  if (portfolio_warm_start_ && previous_best) {
+    for (int index : portfolio_) {
+      if (index != previous) planners_[index]->WarmStart(*previous_best);
+    }
+  }
+
+  // planners share the pool's workers through their parallel loops, the
+  // first one runs on this thread, and borrow mjData from their own lanes
+  for (int index : portfolio_) {
+    planners_[index]->SetDeadline(deadline);
+    planners_[index]->SetDataPool(data_pool_, DataLane(index));
+  }
+  {
+    TaskGroup group(pool);
+    int num_planners = portfolio_.size();
+    for (int i = 1; i < num_planners; i++) {
+      Planner* planner = planners_[portfolio_[i]].get();
+      group.Schedule([planner, steps = steps_, &pool]() {
+        planner->OptimizePolicy(steps, pool);
+      });
     }
+    planners_[portfolio_[0]]->OptimizePolicy(steps_, pool);
+  }
+
+  // lowest total return, from the same state, is published
+  int winner = previous;
+  double best_return = std::numeric_limits<double>::infinity();
+  for (int index : portfolio_) {
+    const Trajectory* best = planners_[index]->BestTrajectory();
+    if (best && best->total_return < best_return) {
+      best_return = best->total_return;
+      winner = index;
+    }
+  }
+  portfolio_winner_ = winner;
 }
 
-int Agent::SetParamByName(std::string_view name, double value) {
+void Agent::SetPlanner(int index) {
+  portfolio_.clear();
+  portfolio_winner_ = -1;
+  planner_ = index;
+  SwitchPlanner();
+}
+
+void Agent::SwitchPlanner() {
+  int previous = active_planner_;
+  if (planner_ == previous || !load_on_demand) {
+    active_planner_ = planner_;
+    return;
+  }
+  if (!planners_[planner_]) {
+    std::unique_ptr<Planner> planner = LoadPlanner(planner_);
+    planner->SetDataPool(data_pool_, DataLane(planner_));
+    planner->Initialize(model_, *ActiveTask());
+    planner->Allocate();
+    planner->Reset(kMaxTrajectoryHorizon);
+    planners_[planner_] = std::move(planner);
+  }
+
+  // the planning thread may still be in an iteration of the previous planner,
+  // it is freed at the start of the next iteration. portfolio planners stay
+  // loaded.
+  std::lock_guard<std::mutex> lock(retired_mutex_);
+  active_planner_ = planner_;
+  if (!InPortfolio(previous)) {
+    retired_planners_.push_back(std::move(planners_[previous]));
+  }
+}
+
+void Agent::SwitchEstimator() {
+  int previous = active_estimator_;
+  if (estimator_ == previous || !load_on_demand) {
+    active_estimator_ = estimator_;
+    return;
+  }
+  if (!estimators_[estimator_]) {
+    std::unique_ptr<Estimator> estimator = LoadEstimator(estimator_);
+    estimator->SetThreadPool(estimator_pool_);
+    estimator->SetThreadPoolPriority(estimator_priority_);
+    if (estimator_enabled) {
+      estimator->Initialize(shared_model_->base());
+      estimator->Reset();
+    }
+    estimators_[estimator_] = std::move(estimator);
+  }
+
+  // an in-flight update may still use the previous estimator, it is freed at
+  // the start of the next update (BeginEstimatorUpdate)
+  std::lock_guard<std::mutex> lock(retired_mutex_);
+  active_estimator_ = estimator_;
+  retired_estimators_.push_back(std::move(estimators_[previous]));
+}
+
+Estimator& Agent::BeginEstimatorUpdate() {
+  std::lock_guard<std::mutex> lock(retired_mutex_);
+  retired_estimators_.clear();
+  return ActiveEstimator();
+}
+
+void Agent::RunBeforeStep(StepJob job) { step_jobs_.Push(std::move(job)); }
+
+void Agent::ExecuteAllRunBeforeStepJobs(const mjModel* model, mjData* data) {
+  // jobs are popped without locking, and jobs added while executing run too
+  step_jobs_.Drain([&](StepJob& job) { job(this, model, data); });
+}
+
+int Agent::AddParamByName(std::string_view name, double value,
+                          ResidualUpdate* update) const {
   if (absl::StartsWith(name, "residual_")) {
     name = absl::StripPrefix(name, "residual_");
   }
@@ -354,57 +1131,67 @@ int Agent::SetParamByName(std::string_view name, double value) {
         "SetSelectionParamByName.");
     return -1;
   }
-  int shift = 0;
-  for (int i = 0; i < model_->nnumeric; i++) {
-    std::string_view numeric_name(model_->names + model_->name_numericadr[i]);
-    if (absl::StartsWith(numeric_name, "residual_")) {
-      if (absl::EqualsIgnoreCase(absl::StripPrefix(numeric_name, "residual_"),
-                                 name)) {
-        ActiveTask()->parameters[shift] = value;
-        return i;
-      } else {
-        shift++;
-      }
-    }
-  }
-  return -1;
+  int index = ActiveTask()->ParameterIndexByName(name);
+  if (index >= 0) update->parameters.emplace_back(index, value);
+  return index;
 }
 
-int Agent::SetSelectionParamByName(std::string_view name,
-                                   std::string_view value) {
+int Agent::AddSelectionParamByName(std::string_view name,
+                                   std::string_view value,
+                                   ResidualUpdate* update) const {
   if (absl::StartsWith(name, "residual_select_")) {
     name = absl::StripPrefix(name, "residual_select_");
   }
   if (absl::StartsWith(name, "selection_")) {
     name = absl::StripPrefix(name, "selection_");
   }
-  int shift = 0;
-  for (int i = 0; i < model_->nnumeric; i++) {
-    std::string_view numeric_name(model_->names + model_->name_numericadr[i]);
-    if (absl::StartsWith(numeric_name, "residual_select_")) {
-      if (absl::EqualsIgnoreCase(
-              absl::StripPrefix(numeric_name, "residual_select_"), name)) {
-        ActiveTask()->parameters[shift] =
-            ResidualParameterFromSelection(model_, name, value);
-        return i;
-      } else {
-        shift++;
-      }
-    }
+  int index = ActiveTask()->SelectionIndexByName(name);
+  if (index >= 0) {
+    update->parameters.emplace_back(
+        index, ResidualParameterFromSelection(model_, name, value));
   }
-  return -1;
+  return index;
 }
 
-int Agent::SetWeightByName(std::string_view name, double value) {
-  for (int i = 0; i < model_->nsensor && model_->sensor_type[i] == mjSENS_USER;
-       i++) {
-    std::string_view sensor_name(model_->names + model_->name_sensoradr[i]);
-    if (absl::EqualsIgnoreCase(sensor_name, name)) {
-      ActiveTask()->weight[i] = value;
-      return i;
-    }
+int Agent::AddWeightByName(std::string_view name, double value,
+                           ResidualUpdate* update) const {
+  int index = ActiveTask()->WeightIndexByName(name);
+  if (index >= 0) update->weights.emplace_back(index, value);
+  return index;
+}
+
+namespace {
+// write the values of update to task, without updating its residual
+void WriteUpdate(Task* task, const ResidualUpdate& update) {
+  for (const auto& [index, value] : update.parameters) {
+    task->parameters[index] = value;
   }
-  return -1;
+  for (const auto& [index, value] : update.weights) {
+    task->weight[index] = value;
+  }
+}
+}  // namespace
+
+int Agent::SetParamByName(std::string_view name, double value) {
+  ResidualUpdate update;
+  int index = AddParamByName(name, value, &update);
+  WriteUpdate(ActiveTask(), update);
+  return index;
+}
+
+int Agent::SetSelectionParamByName(std::string_view name,
+                                   std::string_view value) {
+  ResidualUpdate update;
+  int index = AddSelectionParamByName(name, value, &update);
+  WriteUpdate(ActiveTask(), update);
+  return index;
+}
+
+int Agent::SetWeightByName(std::string_view name, double value) {
+  ResidualUpdate update;
+  int index = AddWeightByName(name, value, &update);
+  WriteUpdate(ActiveTask(), update);
+  return index;
 }
 
 std::vector<std::string> Agent::GetAllModeNames() const {
@@ -463,10 +1250,38 @@ void Agent::ModifyScene(mjvScene* scn) {
     }
   }
 
-  if (!visualize_enabled) {
-    return;
-  }
+  // traces published by the planning thread
+  if (visualize_enabled) trace_geoms_.AppendTo(scn);
+}
+
+void Agent::PublishTraces() {
+  if (!trace_geoms_.Allocated()) trace_geoms_.Allocate(kMaxTraceGeoms);
+  DrawTraces(trace_geoms_.Begin());
+  trace_geoms_.Publish();
+}
+
+void Agent::PublishStreamedTrace() {
+  const Trajectory* winner = ActivePlanner().BestTrajectory();
+  if (!winner) return;
+  int num_trace = ActiveTask()->num_trace;
+  int size = std::min(3 * num_trace * winner->horizon,
+                      static_cast<int>(winner->trace.size()));
+
+  const std::lock_guard<std::mutex> lock(streamed_trace_mutex_);
+  streamed_trace_.assign(winner->trace.begin(), winner->trace.begin() + size);
+  streamed_num_trace_ = num_trace;
+  streamed_trace_sequence_++;
+}
+
+std::uint64_t Agent::StreamedTrace(std::vector<float>* trace,
+                                   int* num_trace) const {
+  const std::lock_guard<std::mutex> lock(streamed_trace_mutex_);
+  trace->assign(streamed_trace_.begin(), streamed_trace_.end());
+  *num_trace = streamed_num_trace_;
+  return streamed_trace_sequence_;
+}
 
+void Agent::DrawTraces(mjvScene* scn) {
   // color
   float color[4];
   color[0] = 1.0;
@@ -692,7 +1507,7 @@ void Agent::TaskEvent(mjuiItem* it, mjData* data,
                       std::atomic<int>& uiloadrequest, int& run) {
   switch (it->itemid) {
     case 0:  // task reset
-      ActiveTask()->Reset(model_);
+      ResetTask();
       ActiveTask()->reset = 0;
       break;
     case 2:  // task switch
@@ -724,6 +1539,8 @@ void Agent::AgentEvent(mjuiItem* it, mjData* data,
       break;
     case 1:  // planner change
       if (model_) {
+        SwitchPlanner();
+
         // reset plots
         this->PlotInitialize();
         this->PlotReset();
@@ -736,10 +1553,13 @@ void Agent::AgentEvent(mjuiItem* it, mjData* data,
       // check for estimators
       if (!GetCustomNumericData(model_, "estimator") || !estimator_enabled) {
         estimator_ = 0;
+        if (model_) SwitchEstimator();
         break;
       }
       // reset
       if (model_) {
+        SwitchEstimator();
+
         // reset plots
         this->PlotInitialize();
         this->PlotReset();
@@ -905,6 +1725,16 @@ void Agent::PlotInitialize() {
       plots_.timer.linergb[j][2] = CostColors[j][2];
     }
   }
+
+  // cost history: total cost and terms
+  std::vector<int> cost_lines = {0};
+  for (int k = 0; k < ActiveTask()->num_term; k++) cost_lines.push_back(4 + k);
+  plots_.cost_history.Allocate(cost_lines, 1000);
+
+  // action history
+  std::vector<int> action_lines(dim_action);
+  for (int j = 0; j < dim_action; j++) action_lines[j] = j;
+  plots_.action_history.Allocate(action_lines, 1000);
 }
 
 // reset plot data to zeros
@@ -919,6 +1749,10 @@ void Agent::PlotReset() {
     PlotResetData(&plots_.action, 1000, j);
   }
 
+  // clear histories
+  plots_.cost_history.Clear();
+  plots_.action_history.Clear();
+
   // compute time reset
   for (int k = 0; k < 20; k++) {
     PlotResetData(&plots_.planner, 100, k);
@@ -970,8 +1804,8 @@ void Agent::Plots(const mjData* data, int shift) {
   // shift data
   if (shift) {
     // return
-    PlotUpdateData(&plots_.cost, cost_bounds, data->time, cost_, 1000, 0, 1, 1,
-                   time_lower_bound);
+    plots_.cost_history.Add(0, data->time, cost_);
+    plots_.cost_history.Bounds(0, time_lower_bound, cost_bounds);
   }
 
   // predicted costs
@@ -991,8 +1825,8 @@ void Agent::Plots(const mjData* data, int shift) {
   for (int k = 0; k < ActiveTask()->num_term; k++) {
     // current residual
     if (shift) {
-      PlotUpdateData(&plots_.cost, cost_bounds, data->time, terms_[k], 1000,
-                     4 + k, 1, 1, time_lower_bound);
+      plots_.cost_history.Add(1 + k, data->time, terms_[k]);
+      plots_.cost_history.Bounds(1 + k, time_lower_bound, cost_bounds);
     }
     // legend
     mju::strcpy_arr(plots_.cost.linename[4 + ActiveTask()->num_term + k],
@@ -1019,8 +1853,8 @@ void Agent::Plots(const mjData* data, int shift) {
   if (shift) {
     // agent history
     for (int j = 0; j < dim_action; j++) {
-      PlotUpdateData(&plots_.action, action_bounds, data->time, data->ctrl[j],
-                     1000, j, 1, 1, time_lower_bound);
+      plots_.action_history.Add(j, data->time, data->ctrl[j]);
+      plots_.action_history.Bounds(j, time_lower_bound, action_bounds);
     }
   }
 
@@ -1100,6 +1934,11 @@ void Agent::PlotShow(mjrRect* rect, mjrContext* con) {
   mjrRect viewport = {rect->left + rect->width - rect->width / num_sections,
                       rect->bottom, rect->width / num_sections,
                       rect->height / num_sections};
+
+  // histories into the figures
+  plots_.cost_history.Write(&plots_.cost);
+  plots_.action_history.Write(&plots_.action);
+
   mjr_figure(viewport, &plots_.timer, con);
   viewport.bottom += rect->height / num_sections;
   mjr_figure(viewport, &plots_.planner, con);
@@ -16,7 +16,8 @@
 #define MJPC_AGENT_H_
 
 #include <atomic>
-#include <deque>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -25,8 +26,17 @@
 
 #include <absl/functional/any_invocable.h>
 #include <mujoco/mujoco.h>
+#include "mjpc/autotune.h"
 #include "mjpc/estimators/include.h"
+#include "mjpc/geom_buffer.h"
+#include "mjpc/memory_report.h"
+#include "mjpc/metrics.h"
+#include "mjpc/mpsc_queue.h"
+#include "mjpc/plan_cache.h"
+#include "mjpc/plan_log.h"
 #include "mjpc/planners/include.h"
+#include "mjpc/plot_history.h"
+#include "mjpc/shared_model.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
@@ -40,8 +50,16 @@ struct AgentPlots {
   mjvFigure cost;
   mjvFigure planner;
   mjvFigure timer;
+
+  // histories of the cost and action figures, written when drawn
+  PlotHistory action_history;
+  PlotHistory cost_history;
 };
 
+// when Agent::Plan starts a planning iteration: back to back, when a new
+// state is published, or at a fixed rate
+enum class PlanTrigger { kContinuous = 0, kNewState, kFixedRate };
+
 class Agent {
  public:
   friend class AgentTest;
@@ -51,27 +69,45 @@ class Agent {
       : planners_(mjpc::LoadPlanners()), estimators_(mjpc::LoadEstimators()) {}
   explicit Agent(const mjModel* model, std::shared_ptr<Task> task);
 
-  // destructor
-  ~Agent() {
-    if (model_) mj_deleteModel(model_);  // we made a copy in Initialize
-  }
+  // destructor, unregisters the agent's residual models
+  ~Agent();
 
   // ----- methods ----- //
 
-  // initialize data, settings, planners, states
+  // initialize data, settings, planners, states. a model with the sizes of
+  // the previous one (e.g., the reloaded task) reuses the planners' mjData
+  // and the plan cache.
   void Initialize(const mjModel* model);
 
-  // allocate memory
-  void Allocate();
+  // the last Initialize had a model with the sizes of the previous one
+  bool CompatibleReload() const { return compatible_reload_; }
+
+  // allocate memory. with a pool, the planners' large buffers are allocated
+  // and zeroed in parallel on it, e.g., the planning pool at startup.
+  void Allocate(ThreadPool* pool = nullptr);
+
+  // reset data, settings, planners, states, zeroing the planners' buffers in
+  // parallel on pool if set
+  void Reset(const double* initial_repeated_action = nullptr,
+             ThreadPool* pool = nullptr);
 
-  // reset data, settings, planners, states
-  void Reset(const double* initial_repeated_action = nullptr);
+  // single planner iteration. planners also stop early at deadline, if set,
+  // e.g., the deadline of a remote call
+  void PlanIteration(ThreadPool* pool,
+                     std::chrono::steady_clock::time_point deadline = {});
 
-  // single planner iteration
-  void PlanIteration(ThreadPool* pool);
+  // call planner to update nominal policy. runs on pool if provided,
+  // otherwise on planner_threads() threads of the shared pool, or of a new
+  // pool if planner_affinity pins them. iterations start as set by
+  // SetPlanTrigger, the thread sleeps in between and while there is no model
+  // or a load is pending.
+  void Plan(std::atomic<bool>& exitrequest, std::atomic<int>& uiloadrequest,
+            ThreadPool* pool = nullptr);
 
-  // call planner to update nominal policy
-  void Plan(std::atomic<bool>& exitrequest, std::atomic<int>& uiloadrequest);
+  // share a thread pool (e.g., the planning pool) with all estimators. their
+  // tasks are queued at priority, below the planner's by default.
+  void SetEstimatorThreadPool(ThreadPool* pool,
+                              TaskPriority priority = TaskPriority::kLow);
 
   using StepJob =
       absl::AnyInvocable<void(Agent*, const mjModel*, mjData*)>;
@@ -83,9 +119,20 @@ class Agent {
   // physics thread
   void ExecuteAllRunBeforeStepJobs(const mjModel* model, mjData* data);
 
-  // modify the scene, e.g. add trace visualization
+  // modify the scene, e.g. add trace visualization. traces are drawn on the
+  // planning thread and published after each iteration, so this doesn't
+  // read the planners.
   void ModifyScene(mjvScene* scn);
 
+  // copies of the active planner's policy trace for scene streams, published
+  // by the planning thread after each iteration while a stream is open
+  void AddTraceStream() { trace_streams_++; }
+  void RemoveTraceStream() { trace_streams_--; }
+
+  // latest streamed policy trace, (steps x num_trace x 3) positions. returns
+  // its sequence number, 0 if none was published.
+  std::uint64_t StreamedTrace(std::vector<float>* trace, int* num_trace) const;
+
   // graphical user interface elements for agent and task
   void GUI(mjUI& ui);
 
@@ -119,7 +166,7 @@ class Agent {
   // returns all task names, joined with '\n' characters
   std::string GetTaskNames() const { return task_names_; }
   int GetTaskIdByName(std::string_view name) const;
-  std::string GetTaskXmlPath(int id) const { return tasks_[id]->XmlPath(); }
+  std::string GetTaskXmlPath(int id) const { return GetTask(id)->XmlPath(); }
 
   // load the latest task model, based on GUI settings
   struct LoadModelResult {
@@ -130,13 +177,134 @@ class Agent {
 
   // Sets a custom model (not from the task), to be returned by the next
   // call to LoadModel. Passing nullptr model clears the override and will
-  // return the normal task's model.
+  // return the normal task's model. SimplifyPlanningModel derives a cheaper
+  // planning model from the task's model.
   void OverrideModel(UniqueMjModel model = {nullptr, mj_deleteModel});
 
-  mjpc::Planner& ActivePlanner() const { return *planners_[planner_]; }
-  mjpc::Estimator& ActiveEstimator() const { return *estimators_[estimator_]; }
-  int ActiveEstimatorIndex() const { return estimator_; }
+  // select the planner by index in kPlannerNames, overriding the model's
+  // agent_planner and portfolio. call after Initialize.
+  void SetPlanner(int index);
+
+  // when all planners and estimators are loaded, the selection takes effect
+  // immediately. on demand, it takes effect in SwitchPlanner/SwitchEstimator.
+  // with a portfolio, the planner with the best trajectory is active.
+  // PlanIteration captures the active planner once per iteration.
+  mjpc::Planner& ActivePlanner() const {
+    int winner = portfolio_winner_.load();
+    if (winner >= 0) return *planners_[winner];
+    return *planners_[load_on_demand ? active_planner_.load() : planner_];
+  }
+  mjpc::Estimator& ActiveEstimator() const {
+    return *estimators_[ActiveEstimatorIndex()];
+  }
+  int ActiveEstimatorIndex() const {
+    return load_on_demand ? active_estimator_.load() : estimator_;
+  }
+
+  // start an estimator update on the estimator thread: frees the estimators
+  // retired before the previous update and returns the active estimator,
+  // which the update uses throughout. while no update runs, retired
+  // estimators are kept until Initialize.
+  mjpc::Estimator& BeginEstimatorUpdate();
+
   double ComputeTime() const { return agent_compute_time_; }
+  // planning budget per iteration (seconds), planners stop early at the
+  // deadline. zero for no deadline.
+  double PlanningBudget() const { return planning_budget_.load(); }
+  void SetPlanningBudget(double budget) { planning_budget_ = budget; }
+  // planning iterations that overran the budget, and whether the last did
+  int DeadlineMisses() const { return deadline_misses_.load(); }
+  bool DeadlineMissed() const { return deadline_missed_.load(); }
+  // trigger of Plan's iterations, and the rate (Hz) of kFixedRate. without
+  // planning, the nominal trajectory is rolled out at most at kFixedRate, or
+  // for a new state.
+  PlanTrigger GetPlanTrigger() const {
+    return static_cast<PlanTrigger>(plan_trigger_.load());
+  }
+  double PlanRate() const { return plan_rate_.load(); }
+  void SetPlanTrigger(PlanTrigger trigger, double rate = 0.0) {
+    plan_trigger_ = static_cast<int>(trigger);
+    if (rate > 0.0) plan_rate_ = rate;
+  }
+  // Plan skips iterations whose state differs from the last planned state by
+  // at most tolerance (max abs of the state, mocap and userdata, time
+  // excluded). zero plans every state.
+  double PlanStateTolerance() const { return plan_state_tolerance_.load(); }
+  void SetPlanStateTolerance(double tolerance) {
+    plan_state_tolerance_ = tolerance;
+  }
+  // iterations skipped for an unchanged state
+  std::uint64_t SkippedIterations() const {
+    return skipped_iterations_.load();
+  }
+  // latency compensation: plan from the state predicted, with the current
+  // policy, for when the new policy is published. the latency estimate is a
+  // moving average of the planning iteration compute time (seconds).
+  bool LatencyCompensation() const { return latency_compensation_.load(); }
+  void SetLatencyCompensation(bool enabled) { latency_compensation_ = enabled; }
+  double LatencyEstimate() const { return latency_estimate_.load(); }
+  // norm of the difference between the last predicted state and the state the
+  // following iteration started from, and the difference of their times
+  double PredictionError() const { return prediction_error_.load(); }
+  double PredictionTimeError() const { return prediction_time_error_.load(); }
+  // planning autotuner: adjusts the active planner's rollouts, and optionally
+  // the planning steps, to a target planning period. not used with a
+  // portfolio.
+  AutotuneOptions Autotune() const;
+  void SetAutotune(const AutotuneOptions& options);
+  // the autotuner's rollouts and steps for the next iteration (0 before its
+  // first update), and how often it changed them
+  int AutotuneRollouts() const { return autotune_rollouts_.load(); }
+  int AutotuneSteps() const { return autotune_steps_.load(); }
+  std::uint64_t AutotuneAdjustments() const {
+    return autotune_adjustments_.load();
+  }
+
+  // snapshot of the loaded planners' policies and, if enabled, the active
+  // estimator (see snapshot.h), e.g., for a standby agent to continue
+  // without a convergence transient. Restore returns false if the snapshot
+  // is invalid or matched no planner or estimator. planning must not run
+  // concurrently.
+  std::string Snapshot();
+  bool Restore(std::string_view snapshot);
+  // bytes of the agent's buffers: the model's private arrays, the planners'
+  // shared mjData, each loaded planner and estimator (nested as planner/name
+  // and estimator/name), the plan cache and the prediction data. buffers
+  // grow while planning, so the report is approximate if planning runs
+  // concurrently.
+  MemoryReport ReportMemory() const;
+  // plan cache (see plan_cache.h): the planners' plan is stored, keyed by
+  // the task, its mode and the planning state and mocap, when the task
+  // switches mode or the agent is reset, and the planners seed from the
+  // nearest plan of the new mode. planning must not run concurrently.
+  bool PlanCacheEnabled() const { return plan_cache_enabled_; }
+  void SetPlanCacheEnabled(bool enabled);
+  PlanCache& GetPlanCache() { return plan_cache_; }
+  // iterations seeded from the plan cache
+  std::uint64_t PlanCacheSeeds() const { return plan_cache_seeds_; }
+  // log planning iterations to path (see plan_log.h), replacing a previous
+  // log: the planning state, the active planner's nominal policy and, for
+  // sample-based planners, the sample returns and optionally states. false if
+  // path can't be created. StopPlanLog writes the queued iterations.
+  bool StartPlanLog(const std::string& path,
+                    const PlanLogOptions& options = {});
+  void StopPlanLog();
+  // iterations written and dropped (the ring was full) by the plan log
+  std::uint64_t PlanLogWritten() const { return plan_log_.Written(); }
+  std::uint64_t PlanLogDropped() const { return plan_log_.Dropped(); }
+  // planning metrics since construction, not cleared by Reset: latencies of
+  // planning iterations, rollouts of those iterations and the time the last
+  // one finished (default time point before the first).
+  const LatencyHistogram& PlanLatency() const { return plan_latency_; }
+  std::uint64_t Rollouts() const { return rollouts_.load(); }
+  // simulation work of all planning iterations, and the rollout steps per
+  // second of the last one
+  PlannerCounters Counters() const;
+  double StepsPerSecond() const { return steps_per_second_.load(); }
+  std::chrono::steady_clock::time_point LastPlanTime() const {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last_plan_time_.load()));
+  }
   Task* ActiveTask() const { return tasks_[active_task_id_].get(); }
   // a residual function that can be used from trajectory rollouts. must only
   // be used from trajectory rollout threads (no locking).
@@ -146,20 +314,43 @@ class Agent {
   bool IsPlanningModel(const mjModel* model) const {
     return model == model_;
   }
+  // residual of the agent's models: the planning residual on the planning
+  // model while planning, the active task's residual otherwise
+  void Residual(const mjModel* model, mjData* data) const;
+  // dispatch the residual of model (e.g., a physics model) to this agent, see
+  // residual_dispatch.h. the planning model is registered by Initialize.
+  void RegisterResidualModel(const mjModel* model);
+  void UnregisterResidualModel(const mjModel* model);
   int PlanSteps() const { return steps_; }
   int GetActionDim() const { return model_->nu; }
   mjModel* GetModel() { return model_; }
   const mjModel* GetModel() const { return model_; }
 
   void SetTaskList(std::vector<std::shared_ptr<Task>> tasks);
+  // tasks are constructed when first selected or asked for their model
+  void SetTaskList(std::vector<RegisteredTask> tasks);
   void SetState(const mjData* data);
-  void SetTaskByIndex(int id) { active_task_id_ = id; }
-  // returns param index, or -1 if not found.
+  void SetTaskByIndex(int id);
+  // reset the active task's parameters and weights from the model given to
+  // Initialize. on the planning model, stripped sensors would read as cost
+  // terms.
+  void ResetTask();
+  // returns param index, or -1 if not found. callers update the task's
+  // residual after their changes.
   int SetParamByName(std::string_view name, double value);
   // returns param index, or -1 if not found.
   int SetSelectionParamByName(std::string_view name, std::string_view value);
   // returns weight index, or -1 if not found.
   int SetWeightByName(std::string_view name, double value);
+  // as the Set*ByName methods, but add the value to update instead of
+  // writing it. names are looked up in the active task's precomputed
+  // indices; the update is applied with ActiveTask()->UpdateResidual(update).
+  int AddParamByName(std::string_view name, double value,
+                     ResidualUpdate* update) const;
+  int AddSelectionParamByName(std::string_view name, std::string_view value,
+                              ResidualUpdate* update) const;
+  int AddWeightByName(std::string_view name, double value,
+                      ResidualUpdate* update) const;
   // returns mode index, or -1 if not found.
   int SetModeByName(std::string_view name);
 
@@ -187,10 +378,24 @@ class Agent {
   bool reset_estimator = true;
   bool estimator_enabled = false;
 
+  // create and allocate only the selected planner and estimator, releasing the
+  // previous one on switch. set before Initialize.
+  bool load_on_demand = false;
+
+  // cpus of the planning pool made by Plan without a pool, and of the apps'
+  // planning pools. unpinned by default.
+  ThreadPoolAffinity planner_affinity;
+
  private:
-  // model
+  // model: shares its arrays with all agents of the same model, only the
+  // options are the agent's own
+  std::unique_ptr<SharedModel> shared_model_;
   mjModel* model_ = nullptr;
 
+  // ModelSizes of the model, and whether the previous model had them
+  std::string model_sizes_;
+  bool compatible_reload_ = false;
+
   UniqueMjModel model_override_ = {nullptr, mj_deleteModel};
 
   // integrator
@@ -205,23 +410,98 @@ class Agent {
   // time step
   double timestep_;
 
-  std::vector<std::shared_ptr<Task>> tasks_;
+  // task list. tasks_[i] is null until registered_tasks_[i] is made, and
+  // tasks_[active_task_id_] is always made.
+  std::vector<RegisteredTask> registered_tasks_;
+  mutable std::vector<std::shared_ptr<Task>> tasks_;
+  mutable std::mutex tasks_mutex_;
   int active_task_id_ = 0;
 
-  // residual function for the active task, updated once per planning iteration
-  std::unique_ptr<ResidualFn> residual_fn_;
+  // task id, constructed if needed
+  Task* GetTask(int id) const;
+
+  // residual function for the active task, held for one planning iteration.
+  // the task shares one snapshot until its residual changes; residuals with
+  // time-only terms are copied with the terms precomputed every iteration.
+  std::shared_ptr<const ResidualFn> residual_fn_;
+
+  // models with residuals dispatched to this agent
+  std::vector<const mjModel*> residual_models_;
+
+  // make the selected planner (planner_) active, loading it if needed
+  void SwitchPlanner();
+
+  // planner is optimized by the portfolio
+  bool InPortfolio(int planner) const;
+
+  // optimize the portfolio's planners concurrently and make the one with the
+  // lowest total return active
+  void OptimizePortfolio(std::chrono::steady_clock::time_point deadline,
+                         ThreadPool& pool);
+
+  // make the selected estimator (estimator_) active, loading it if needed
+  void SwitchEstimator();
+
+  // draw the policy and sample traces into scn
+  void DrawTraces(mjvScene* scn);
 
-  // planners
+  // draw traces for the renderer, on the planning thread
+  void PublishTraces();
+
+  // trace geoms, from the planning thread to the renderer
+  static constexpr int kMaxTraceGeoms = 5000;
+  GeomBuffer trace_geoms_;
+
+  // copy the active planner's policy trace for scene streams
+  void PublishStreamedTrace();
+
+  // open scene streams with traces, and their latest policy trace
+  std::atomic_int trace_streams_ = 0;
+  mutable std::mutex streamed_trace_mutex_;
+  std::vector<float> streamed_trace_;
+  int streamed_num_trace_ = 0;
+  std::uint64_t streamed_trace_sequence_ = 0;
+
+  // planners (null when not loaded)
   std::vector<std::unique_ptr<mjpc::Planner>> planners_;
-  int planner_;
+  int planner_;                         // selected from GUI or model
+  std::atomic_int active_planner_ = 0;  // in use
+
+  // planners optimized concurrently from the same state, from the model's
+  // agent_portfolio numeric. empty for a single planner.
+  std::vector<int> portfolio_;
+  std::atomic_int portfolio_winner_ = -1;  // planner index, -1 without
+  int portfolio_warm_start_ = 0;  // warm start from the previous winner
 
-  // estimators
+  // per-thread mjData, shared by the planners. planners that run at the same
+  // time (the portfolio's) borrow different lanes.
+  std::shared_ptr<MjDataPool> data_pool_;
+
+  // first lane of planner's data in data_pool_
+  int DataLane(int planner) const;
+
+  // turn the planning model's sensors that planning never reads into user
+  // sensors, so rollouts don't compute them
+  void StripPlanningSensors();
+
+  // estimators (null when not loaded)
   std::vector<std::unique_ptr<mjpc::Estimator>> estimators_;
   int estimator_;
-
-  // task queue for RunBeforeStep
-  std::mutex step_jobs_mutex_;
-  std::deque<StepJob> step_jobs_;
+  std::atomic_int active_estimator_ = 0;
+  ThreadPool* estimator_pool_ = nullptr;
+  TaskPriority estimator_priority_ = TaskPriority::kNormal;
+
+  // released on switch. the planning and estimator threads may still be in
+  // an iteration of a retired object: they are freed at the start of the
+  // thread's next iteration, which captures the active object under the
+  // mutex.
+  std::mutex retired_mutex_;
+  std::vector<std::unique_ptr<mjpc::Planner>> retired_planners_;
+  std::vector<std::unique_ptr<mjpc::Estimator>> retired_estimators_;
+
+  // task queue for RunBeforeStep, lock-free so that posting jobs doesn't
+  // contend with the physics step
+  MpscQueue<StepJob> step_jobs_;
 
   // timing
   double agent_compute_time_;
@@ -234,6 +514,93 @@ class Agent {
   // planning iterations counter
   std::atomic_int count_;
 
+  // planning deadline
+  std::atomic<double> planning_budget_ = 0.0;
+  std::atomic_int deadline_misses_ = 0;
+  std::atomic_bool deadline_missed_ = false;
+
+  // plan trigger
+  std::atomic_int plan_trigger_ = 0;
+  std::atomic<double> plan_rate_ = 100.0;
+  std::atomic<double> plan_state_tolerance_ = 0.0;
+  std::atomic<std::uint64_t> skipped_iterations_ = 0;
+
+  // the state of Plan's last iteration, for the state tolerance
+  std::vector<double> planned_state_;
+  std::vector<double> planned_mocap_;
+  std::vector<double> planned_userdata_;
+  std::vector<double> current_state_;     // scratch
+  std::vector<double> current_mocap_;     // scratch
+  std::vector<double> current_userdata_;  // scratch
+  int planned_count_ = -1;
+
+  // whether the state is within the state tolerance of the last planned
+  // state, otherwise it becomes the last planned state
+  bool StateUnchanged();
+
+  // latency compensation
+  std::atomic_bool latency_compensation_ = false;
+  std::atomic<double> latency_estimate_ = 0.0;
+  std::atomic<double> prediction_error_ = 0.0;
+  std::atomic<double> prediction_time_error_ = 0.0;
+  bool has_prediction_ = false;
+  mjpc::State predicted_state_;
+  mjpc::UniqueMjData prediction_data_ = {nullptr, mj_deleteData};
+  std::vector<double> prediction_state_;  // (nq + nv + na)
+
+  // planning autotuner, options set from any thread
+  mutable std::mutex autotune_mutex_;
+  PlanningAutotuner autotuner_;
+  std::atomic_int autotune_rollouts_ = 0;
+  std::atomic_int autotune_steps_ = 0;
+  std::atomic<std::uint64_t> autotune_adjustments_ = 0;
+
+  // plan log, started and stopped from any thread
+  std::mutex plan_log_mutex_;
+  PlanLogger plan_log_;
+  std::vector<double> plan_log_mocap_;     // scratch
+  std::vector<double> plan_log_userdata_;  // scratch
+
+  // add the iteration planned from state to the plan log
+  void LogIteration(const mjpc::State& state);
+
+  // plan cache
+  bool plan_cache_enabled_ = false;
+  PlanCache plan_cache_;
+  std::uint64_t plan_cache_seeds_ = 0;
+  int plan_cache_task_ = -1;  // task and mode of the last iteration, -1 to
+  int plan_cache_mode_ = -1;  // seed the next iteration
+  double plan_cache_time_ = 0.0;
+  std::vector<double> plan_cache_features_;  // of the last iteration's state
+  std::vector<double> plan_cache_query_;     // scratch
+  std::vector<double> plan_cache_userdata_;  // scratch
+
+  // the snapshot of the active or portfolio planners, and restore them
+  std::string PlannerSnapshot() const;
+  bool RestorePlanners(std::string_view snapshot);
+
+  // store the last iteration's plan and, on a mode switch or after a reset,
+  // seed the planners from the plan cache for the iteration from state
+  void UpdatePlanCache(const mjpc::State& state);
+
+  // store the last iteration's plan
+  void StorePlan();
+
+  // the state to plan from: state, or with latency compensation, state
+  // forward-simulated with the current policy for the latency estimate
+  const mjpc::State& PlanningState();
+
+  // planning metrics
+  LatencyHistogram plan_latency_;
+  std::atomic<std::uint64_t> rollouts_ = 0;
+  std::atomic<std::uint64_t> physics_steps_ = 0;
+  std::atomic<std::uint64_t> residuals_ = 0;
+  std::atomic<std::uint64_t> derivatives_ = 0;
+  std::atomic<std::uint64_t> aborted_rollouts_ = 0;
+  std::atomic<std::uint64_t> solver_iterations_ = 0;
+  std::atomic<double> steps_per_second_ = 0.0;
+  std::atomic<std::chrono::steady_clock::rep> last_plan_time_ = 0;
+
   // names
   char task_names_[1024];
   char planner_names_[1024];
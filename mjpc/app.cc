@@ -17,6 +17,8 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -35,7 +37,10 @@
 #include "mjpc/array_safety.h"
 #include "mjpc/agent.h"
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/realtime.h"
+#include "mjpc/residual_dispatch.h"
 #include "mjpc/simulate.h"  // mjpc fork
+#include "mjpc/states/measurement.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
@@ -53,6 +58,22 @@ ABSL_FLAG(bool, show_plot, true,
           "If true, the plots will be visible on startup");
 ABSL_FLAG(bool, show_info, true,
           "If true, the infotext panel will be visible on startup");
+ABSL_FLAG(std::string, planner_cpus, "",
+          "CPUs the planning threads are pinned to, e.g., \"0-15,32-47\". "
+          "Empty means all available CPUs, if other pinning flags are set.");
+ABSL_FLAG(int, planner_numa_node, -1,
+          "If not -1, pin the planning threads to the CPUs of this NUMA node.");
+ABSL_FLAG(std::string, planner_exclude_cpus, "",
+          "CPUs the planning threads are not pinned to, e.g., the cores of "
+          "the physics and estimator threads.");
+ABSL_FLAG(int, rt_control_priority, 0,
+          "If not 0, run the physics thread with SCHED_FIFO at this priority "
+          "(1-99).");
+ABSL_FLAG(bool, rt_lock_memory, false,
+          "If true, lock the process's memory (mlockall) at startup.");
+ABSL_FLAG(int, rt_planner_nice, 0,
+          "Nice value of the planning threads, positive to lower their "
+          "priority below the physics thread.");
 
 
 namespace {
@@ -74,6 +95,35 @@ mjtNum* ctrlnoise = nullptr;
 
 using Seconds = std::chrono::duration<double>;
 
+// measurements from the physics thread to the estimator thread
+mjpc::MeasurementBuffer measurements;
+
+// period of the physics loop iterations, reported in real-time mode
+mjpc::ControlPeriodMonitor physics_period;
+
+// physics steps published to the estimator thread
+struct PhysicsPublication {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::uint64_t sequence = 0;  // number of publications (guarded by mutex)
+  std::chrono::steady_clock::time_point time;  // last publication
+};
+PhysicsPublication physics_publication;
+
+// wake the estimator after new ctrl and sensordata are available. one
+// publication covers the steps of a physics loop iteration.
+void PublishPhysicsSteps() {
+  {
+    std::lock_guard<std::mutex> lock(physics_publication.mutex);
+    physics_publication.sequence += 1;
+    physics_publication.time = std::chrono::steady_clock::now();
+  }
+  physics_publication.cv.notify_all();
+}
+
+// interval between reports of missed estimator deadlines (seconds)
+const double estimatorReportInterval = 1.0;
+
 // --------------------------------- callbacks ---------------------------------
 std::unique_ptr<mj::Simulate> sim;
 
@@ -110,18 +160,13 @@ void sensor(const mjModel* m, mjData* d, int stage);
 
 // sensor callback
 void sensor(const mjModel* model, mjData* data, int stage) {
-  if (stage == mjSTAGE_ACC) {
+  if (stage == mjSTAGE_ACC && !mjpc::ResidualSkipped()) {
     if (!sim->agent->allocate_enabled && sim->uiloadrequest.load() == 0) {
-      if (sim->agent->IsPlanningModel(model)) {
-        // the planning thread and rollout threads don't need
-        // synchronization when using PlanningResidual.
-        const mjpc::ResidualFn* residual = sim->agent->PlanningResidual();
-        residual->Residual(model, data, data->sensordata);
-      } else {
-        // this residual is used by the physics thread and the UI thread (for
-        // plots), and is run with a shared lock, to safely run with changes to
-        // weights and parameters
-        sim->agent->ActiveTask()->Residual(model, data, data->sensordata);
+      // registered models (the agent's planning models) are dispatched to
+      // their agent. the physics, estimator and plot models use the agent's
+      // active task.
+      if (!mjpc::DispatchResidual(model, data)) {
+        sim->agent->Residual(model, data);
       }
     }
   }
@@ -150,59 +195,103 @@ mjModel* LoadModel(const mjpc::Agent* agent, mj::Simulate& sim) {
 }
 
 // estimator in background thread
+// the estimator sleeps until the physics thread publishes its steps. a deadline
+// is missed for each publication made while the previous update was running.
 void EstimatorLoop(mj::Simulate& sim) {
-  // run until asked to exit
-  while (!sim.exitrequest.load()) {
-    if (sim.uiloadrequest.load() == 0) {
-      // estimator
-      int active_estimator = sim.agent->ActiveEstimatorIndex();
-      mjpc::Estimator* estimator = &sim.agent->ActiveEstimator();
-
-      // estimator update
-      if (!active_estimator) {
-        std::this_thread::yield();
-        continue;
-      } else {
-        // start timer
-        auto start = std::chrono::steady_clock::now();
-
-        // set values from GUI
-        estimator->SetGUIData();
-
-        // get simulation state (lock physics thread)
-        {
-          const std::lock_guard<std::mutex> lock(sim.mtx);
-          // copy simulation ctrl
-          mju_copy(sim.agent->ctrl.data(), d->ctrl, m->nu);
-
-          // copy simulation sensor
-          mju_copy(sim.agent->sensor.data(), d->sensordata, m->nsensordata);
-
-          // copy simulation time
-          estimator->Data()->time = d->time;
-
-          // copy simulation mocap
-          mju_copy(estimator->Data()->mocap_pos, d->mocap_pos, 3 * m->nmocap);
-          mju_copy(estimator->Data()->mocap_quat, d->mocap_quat, 4 * m->nmocap);
-
-          // copy simulation userdata
-          mju_copy(estimator->Data()->userdata, d->userdata, m->nuserdata);
-        }
+  std::uint64_t last_sequence = 0;
+  bool tracking = false;  // last_sequence belongs to the running estimator
 
-        // update filter using latest ctrl and sensor copied from physics thread
-        estimator->Update(sim.agent->ctrl.data(), sim.agent->sensor.data());
+  // missed deadlines and worst publication-to-state latency since last report
+  int missed = 0;
+  double max_latency = 0.0;
+  auto report = std::chrono::steady_clock::now();
 
-        // estimator state to planner
-        double* state = estimator->State();
-        sim.agent->state.Set(m, state, state + m->nq, state + m->nq + m->nv,
-                             d->mocap_pos, d->mocap_quat, d->userdata, d->time);
+  // run until asked to exit
+  while (!sim.exitrequest.load()) {
+    // wait for physics, time out to observe exit and estimator changes
+    std::uint64_t sequence;
+    std::chrono::steady_clock::time_point published;
+    {
+      std::unique_lock<std::mutex> lock(physics_publication.mutex);
+      physics_publication.cv.wait_for(
+          lock, std::chrono::milliseconds(10),
+          [&]() { return physics_publication.sequence != last_sequence; });
+      sequence = physics_publication.sequence;
+      published = physics_publication.time;
+    }
+    if (sequence == last_sequence) continue;
+    std::uint64_t publications = sequence - last_sequence;
+    last_sequence = sequence;
+
+    // estimator
+    if (sim.uiloadrequest.load() != 0 || !sim.agent->ActiveEstimatorIndex()) {
+      tracking = false;
+      continue;
+    }
+    mjpc::Estimator* estimator = &sim.agent->BeginEstimatorUpdate();
 
-        // wait (us)
-        // TODO(taylor): confirm valid for slowdown
-        while (mjpc::GetDuration(start) <
-               1.0e6 * estimator->Model()->opt.timestep) {
-        }
+    // publications skipped while the previous update was running
+    if (tracking && publications > 1) {
+      missed += static_cast<int>(publications - 1);
+    }
+    tracking = true;
+
+    // set values from GUI
+    estimator->SetGUIData();
+
+    // latest measurement published by the physics thread
+    const mjpc::Measurement* measurement = measurements.Latest();
+    if (!measurement) continue;
+
+    // copy simulation ctrl
+    mju_copy(sim.agent->ctrl.data(), measurement->ctrl.data(), m->nu);
+
+    // copy simulation sensor
+    mju_copy(sim.agent->sensor.data(), measurement->sensor.data(),
+             m->nsensordata);
+
+    // copy simulation time
+    estimator->Data()->time = measurement->time;
+
+    // copy simulation mocap
+    mju_copy(estimator->Data()->mocap_pos, measurement->mocap_pos.data(),
+             3 * m->nmocap);
+    mju_copy(estimator->Data()->mocap_quat, measurement->mocap_quat.data(),
+             4 * m->nmocap);
+
+    // copy simulation userdata
+    mju_copy(estimator->Data()->userdata, measurement->userdata.data(),
+             m->nuserdata);
+
+    // update filter using latest ctrl and sensor published by physics thread
+    estimator->Update(sim.agent->ctrl.data(), sim.agent->sensor.data());
+
+    // estimator state to planner
+    double* state = estimator->State();
+    sim.agent->state.Set(m, state, state + m->nq, state + m->nq + m->nv,
+                         measurement->mocap_pos.data(),
+                         measurement->mocap_quat.data(),
+                         measurement->userdata.data(), measurement->time);
+
+    // latency (ms)
+    auto now = std::chrono::steady_clock::now();
+    max_latency = std::max(
+        max_latency,
+        std::chrono::duration<double, std::milli>(now - published).count());
+
+    // report
+    if (Seconds(now - report).count() > estimatorReportInterval) {
+      if (missed) {
+        std::printf(
+            "Estimator: %i missed deadlines, max latency %.2f ms, "
+            "measurements overwritten %llu, dropped %llu\n",
+            missed, max_latency,
+            static_cast<unsigned long long>(measurements.overwritten()),
+            static_cast<unsigned long long>(measurements.dropped()));
       }
+      missed = 0;
+      max_latency = 0.0;
+      report = now;
     }
   }
 }
@@ -247,6 +336,7 @@ void PhysicsLoop(mj::Simulate& sim) {
         m = mnew;
         d = dnew;
         mj_forward(m, d);
+        measurements.Allocate(m);
 
         // allocate ctrlnoise
         free(ctrlnoise);
@@ -273,6 +363,14 @@ void PhysicsLoop(mj::Simulate& sim) {
     } else {
       std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    if (sim.run) {
+      physics_period.Tick();
+    } else {
+      physics_period.Restart();
+    }
+
+    // physics steps taken this iteration
+    int steps = 0;
 
     {
       // lock the sim mutex
@@ -330,6 +428,7 @@ void PhysicsLoop(mj::Simulate& sim) {
             // run single step, let next iteration deal with timing
             sim.agent->ExecuteAllRunBeforeStepJobs(m, d);
             mj_step(m, d);
+            steps++;
           } else {  // in-sync: step until ahead of cpu
             bool measured = false;
             mjtNum prevSim = d->time;
@@ -356,6 +455,7 @@ void PhysicsLoop(mj::Simulate& sim) {
               // call mj_step
               sim.agent->ExecuteAllRunBeforeStepJobs(m, d);
               mj_step(m, d);
+              steps++;
 
               // break if reset
               if (d->time < prevSim) {
@@ -375,8 +475,14 @@ void PhysicsLoop(mj::Simulate& sim) {
           sim.speed_changed = true;
         }
       }
+
+      // new ctrl and sensordata for the estimator
+      if (steps) measurements.Publish(m, d);
     }  // release sim.mtx
 
+    // wake the estimator
+    if (steps) PublishPhysicsSteps();
+
     // state
     if (sim.uiloadrequest.load() == 0) {
       // set ground truth state if no active estimator
@@ -445,6 +551,11 @@ MjpcApp::MjpcApp(std::vector<std::shared_ptr<mjpc::Task>> tasks, int task_id) {
 
   // agent
   sim->agent->estimator_enabled = absl::GetFlag(FLAGS_estimator_enabled);
+  sim->agent->planner_affinity.cpus = absl::GetFlag(FLAGS_planner_cpus);
+  sim->agent->planner_affinity.numa_node =
+      absl::GetFlag(FLAGS_planner_numa_node);
+  sim->agent->planner_affinity.exclude =
+      absl::GetFlag(FLAGS_planner_exclude_cpus);
   sim->agent->Initialize(m);
   sim->agent->Allocate();
   sim->agent->Reset();
@@ -492,9 +603,27 @@ void MjpcApp::Start() {
   // one-off preparation:
   sim->InitializeRenderLoop();
 
+  // real-time mode
+  mjpc::RealtimeOptions realtime;
+  realtime.control_priority = absl::GetFlag(FLAGS_rt_control_priority);
+  realtime.lock_memory = absl::GetFlag(FLAGS_rt_lock_memory);
+  realtime.planner_nice = absl::GetFlag(FLAGS_rt_planner_nice);
+  if (realtime.lock_memory) mjpc::LockMemory();
+
+  // pool shared by planning and estimation
+  mjpc::ThreadPool compute_pool(sim->agent->planner_threads(),
+                                sim->agent->planner_affinity);
+  sim->agent->SetEstimatorThreadPool(&compute_pool);
+  if (realtime.planner_nice) {
+    mjpc::SetPoolNice(compute_pool, realtime.planner_nice);
+  }
+
   // start physics thread
   mjpc::ThreadPool physics_pool(1);
-  physics_pool.Schedule([]() { PhysicsLoop(*sim); });
+  physics_pool.Schedule([priority = realtime.control_priority]() {
+    mjpc::ScopedRealtimePriority realtime_priority(priority);
+    PhysicsLoop(*sim);
+  });
 
   // start estimator thread
   mjpc::ThreadPool estimator_pool(1);
@@ -505,14 +634,19 @@ void MjpcApp::Start() {
   {
     // start plan thread
     mjpc::ThreadPool plan_pool(1);
-    plan_pool.Schedule(
-        []() { sim->agent->Plan(sim->exitrequest, sim->uiloadrequest); });
+    plan_pool.Schedule([&compute_pool]() {
+      sim->agent->Plan(sim->exitrequest, sim->uiloadrequest, &compute_pool);
+    });
 
     // now that planning was forked, the main thread can render
 
     // start simulation UI loop (blocking call)
     sim->RenderLoop();
   }
+
+  if (realtime.Enabled()) {
+    printf("%s\n", physics_period.Summary().c_str());
+  }
 }
 
 mj::Simulate* MjpcApp::Sim() {
@@ -0,0 +1,66 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/autotune.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mjpc {
+namespace {
+// counts that fit the budget up to roundoff are kept
+constexpr double kRoundoff = 1.0e-6;
+}  // namespace
+
+const AutotuneDecision& PlanningAutotuner::Update(double compute_time,
+                                                  double physics_steps,
+                                                  int threads, int rollouts,
+                                                  int steps) {
+  int min_rollouts = std::max(options_.min_rollouts, 1);
+  int max_rollouts = std::max(options_.max_rollouts, min_rollouts);
+  rollouts = std::clamp(rollouts, min_rollouts, max_rollouts);
+  steps = std::max(steps, 1);
+  if (!Enabled() || compute_time <= 0.0 || physics_steps <= 0.0) {
+    if (decision_.rollouts == 0) decision_ = {rollouts, steps, 0.0};
+    return decision_;
+  }
+
+  // seconds per rollout step and thread
+  double step_time = compute_time * std::max(threads, 1) / physics_steps;
+  decision_.step_time =
+      decision_.step_time > 0.0
+          ? decision_.step_time + kAverage * (step_time - decision_.step_time)
+          : step_time;
+
+  // rollout steps that fit the period
+  double budget = options_.period * std::max(threads, 1) / decision_.step_time;
+
+  // rollouts of the full horizon, limited change per iteration
+  double target = budget / steps;
+  target = std::clamp(target, rollouts / kMaxChange, rollouts * kMaxChange);
+  int fit = static_cast<int>(std::floor(target + kRoundoff));
+  decision_.rollouts = std::clamp(fit, min_rollouts, max_rollouts);
+
+  // shorter horizon when the fewest rollouts don't fit
+  decision_.steps = steps;
+  if (decision_.rollouts == min_rollouts && options_.min_horizon < 1.0) {
+    int min_steps = std::max(
+        static_cast<int>(std::ceil(options_.min_horizon * steps)), 1);
+    fit = static_cast<int>(std::floor(budget / min_rollouts + kRoundoff));
+    decision_.steps = std::clamp(fit, min_steps, steps);
+  }
+  return decision_;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,69 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MJPC_AUTOTUNE_H_
+#define MJPC_AUTOTUNE_H_
+
+namespace mjpc {
+
+// settings of the planning autotuner
+struct AutotuneOptions {
+  double period = 0.0;      // target planning period (seconds), 0 disables
+  int min_rollouts = 2;     // rollouts per iteration
+  int max_rollouts = 128;   // planners clamp to their maximum
+  double min_horizon = 1.0;  // fraction of the planning steps kept when min
+                             // rollouts don't fit the period, 1 keeps all
+};
+
+// rollouts and planning steps of the next iteration
+struct AutotuneDecision {
+  int rollouts = 0;         // 0 before the first update
+  int steps = 0;
+  double step_time = 0.0;   // estimated seconds per rollout step and thread
+};
+
+// adjusts the rollouts (and optionally the planning steps) of an iteration so
+// its compute time matches a target period. the time of a rollout step is a
+// moving average of the measured iteration time per step and pool thread;
+// rollouts change by at most a factor of kMaxChange per iteration.
+class PlanningAutotuner {
+ public:
+  // weight of the latest measurement in the step time
+  static constexpr double kAverage = 0.2;
+  static constexpr double kMaxChange = 2.0;
+
+  void SetOptions(const AutotuneOptions& options) { options_ = options; }
+  const AutotuneOptions& options() const { return options_; }
+  bool Enabled() const { return options_.period > 0.0; }
+
+  // forget the step time and the decision
+  void Reset() { decision_ = {}; }
+
+  // update with the last iteration: its compute time (seconds), rollout
+  // physics steps and the pool threads. rollouts is the current setting and
+  // steps the planning steps without the autotuner.
+  const AutotuneDecision& Update(double compute_time, double physics_steps,
+                                 int threads, int rollouts, int steps);
+
+  const AutotuneDecision& decision() const { return decision_; }
+
+ private:
+  AutotuneOptions options_;
+  AutotuneDecision decision_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_AUTOTUNE_H_
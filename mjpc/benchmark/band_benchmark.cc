@@ -0,0 +1,146 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the block-band kernels of the direct optimizer and the batch
+// estimator (mjpc/utilities.h), for block sizes of the velocity dimension of
+// a particle (6), a humanoid (27) and a larger model (60).
+
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/utilities.h"
+
+namespace mjpc::benchmarks {
+namespace {
+
+// block sizes (nv)
+const std::vector<int64_t> kBlockSizes = {6, 27, 60};
+
+// blocks in the band (3 configurations per residual) and along the diagonal
+constexpr int kBandBlocks = 3;
+constexpr int kNumBlocks = 16;
+
+// deterministic matrix entries
+std::vector<double> Entries(int n) {
+  std::vector<double> mat(n);
+  for (int i = 0; i < n; i++) mat[i] = 0.01 * (i % 97) - 0.5;
+  return mat;
+}
+
+// symmetric block set in band storage, once per diagonal block
+void BM_SetBlockInBand(benchmark::State& st) {
+  int nv = st.range(0);
+  int nband = kBandBlocks * nv;
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> block = Entries(nband * nband);
+  std::vector<double> band(ntotal * nband);
+  for (auto _ : st) {
+    for (int t = 0; t < kNumBlocks - kBandBlocks + 1; t++) {
+      SetBlockInBand(band.data(), block.data(), 0.5, ntotal, nband, nband,
+                     nv * t);
+    }
+    benchmark::ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations() * (kNumBlocks - kBandBlocks + 1));
+}
+BENCHMARK(BM_SetBlockInBand)->ArgNames({"nv"})->ArgsProduct({kBlockSizes});
+
+// scaled block add into a dense matrix, once per diagonal block
+void BM_AddBlockInMatrix(benchmark::State& st) {
+  int nv = st.range(0);
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> block = Entries(nv * nv);
+  std::vector<double> mat(ntotal * ntotal);
+  for (auto _ : st) {
+    for (int t = 0; t < kNumBlocks; t++) {
+      AddBlockInMatrix(mat.data(), block.data(), 0.5, ntotal, ntotal, nv, nv,
+                       nv * t, nv * t);
+    }
+    benchmark::ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations() * kNumBlocks);
+}
+BENCHMARK(BM_AddBlockInMatrix)->ArgNames({"nv"})->ArgsProduct({kBlockSizes});
+
+// block copy from a dense matrix, once per diagonal block
+void BM_BlockFromMatrix(benchmark::State& st) {
+  int nv = st.range(0);
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> mat = Entries(ntotal * ntotal);
+  std::vector<double> block(nv * nv);
+  for (auto _ : st) {
+    for (int t = 0; t < kNumBlocks; t++) {
+      BlockFromMatrix(block.data(), mat.data(), nv, nv, ntotal, ntotal,
+                      nv * t, nv * t);
+      benchmark::DoNotOptimize(block.data());
+    }
+  }
+  st.SetItemsProcessed(st.iterations() * kNumBlocks);
+}
+BENCHMARK(BM_BlockFromMatrix)->ArgNames({"nv"})->ArgsProduct({kBlockSizes});
+
+// shifted copy of a dense symmetric block-band matrix
+void BM_SymmetricBandMatrixCopy(benchmark::State& st) {
+  int nv = st.range(0);
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> mat = Entries(ntotal * ntotal);
+  DenseToBlockBand(mat.data(), ntotal, nv, kBandBlocks);
+  std::vector<double> res(ntotal * ntotal);
+  std::vector<double> scratch(2 * nv * nv);
+  for (auto _ : st) {
+    SymmetricBandMatrixCopy(res.data(), mat.data(), nv, kBandBlocks, ntotal,
+                            kNumBlocks - 1, 0, 0, 1, 1, scratch.data());
+    benchmark::ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_SymmetricBandMatrixCopy)
+    ->ArgNames({"nv"})
+    ->ArgsProduct({kBlockSizes});
+
+// zero the off-band blocks of a dense matrix
+void BM_DenseToBlockBand(benchmark::State& st) {
+  int nv = st.range(0);
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> mat = Entries(ntotal * ntotal);
+  for (auto _ : st) {
+    DenseToBlockBand(mat.data(), ntotal, nv, kBandBlocks);
+    benchmark::ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_DenseToBlockBand)->ArgNames({"nv"})->ArgsProduct({kBlockSizes});
+
+// symmetric band matrix-vector product
+void BM_BandMulMatVec(benchmark::State& st) {
+  int nv = st.range(0);
+  int nband = kBandBlocks * nv;
+  int ntotal = kNumBlocks * nv;
+  std::vector<double> band = Entries(ntotal * nband);
+  std::vector<double> vec = Entries(ntotal);
+  std::vector<double> res(ntotal);
+  for (auto _ : st) {
+    mju_bandMulMatVec(res.data(), band.data(), vec.data(), ntotal, nband, 0, 1,
+                      true);
+    benchmark::DoNotOptimize(res.data());
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_BandMulMatVec)->ArgNames({"nv"})->ArgsProduct({kBlockSizes});
+
+}  // namespace
+}  // namespace mjpc::benchmarks
@@ -0,0 +1,104 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/benchmark/benchmark_task.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/task.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc::benchmarks {
+
+namespace {
+// task list, shared by all benchmarks
+const std::vector<std::shared_ptr<Task>>& Tasks() {
+  static auto* tasks = new std::vector<std::shared_ptr<Task>>(GetTasks());
+  return *tasks;
+}
+
+// task evaluated by the sensor callback
+Task* active_task = nullptr;
+
+void ResidualCallback(const mjModel* model, mjData* data, int stage) {
+  if (stage == mjSTAGE_ACC && active_task && !ResidualSkipped()) {
+    active_task->Residual(model, data, data->sensordata);
+  }
+}
+}  // namespace
+
+BenchmarkTask::BenchmarkTask(int index) : task(Tasks()[index]) {
+  constexpr int kErrorLength = 1024;
+  char load_error[kErrorLength] = "";
+  model = mj_loadXML(task->XmlPath().c_str(), nullptr, load_error,
+                     kErrorLength);
+  if (!model) {
+    error = load_error;
+    return;
+  }
+
+  // initial state
+  data = mj_makeData(model);
+  int home_id = mj_name2id(model, mjOBJ_KEY, "home");
+  if (home_id >= 0) mj_resetDataKeyframe(model, data, home_id);
+  task->Reset(model);
+  Activate();
+  mj_forward(model, data);
+
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+}
+
+BenchmarkTask::~BenchmarkTask() {
+  if (active_task == task.get()) active_task = nullptr;
+  if (data) mj_deleteData(data);
+  if (model) mj_deleteModel(model);
+}
+
+bool BenchmarkTask::Loaded(benchmark::State& st) const {
+  if (!model) st.SkipWithError(("Failed to load model: " + error).c_str());
+  return model != nullptr;
+}
+
+void BenchmarkTask::Activate() {
+  active_task = task.get();
+  mjcb_sensor = ResidualCallback;
+}
+
+int NumBenchmarkTasks() { return Tasks().size(); }
+
+std::string BenchmarkTaskName(int index) {
+  std::string name = Tasks()[index]->Name();
+  std::replace(name.begin(), name.end(), ' ', '_');
+  return name;
+}
+
+std::vector<int64_t> ThreadCounts() {
+  std::vector<int64_t> threads = {1};
+  int hardware_threads = NumAvailableHardwareThreads();
+  if (hardware_threads > 1) threads.push_back(hardware_threads);
+  return threads;
+}
+
+}  // namespace mjpc::benchmarks
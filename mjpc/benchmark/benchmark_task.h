@@ -0,0 +1,68 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_BENCHMARK_BENCHMARK_TASK_H_
+#define MJPC_BENCHMARK_BENCHMARK_TASK_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+
+namespace mjpc::benchmarks {
+
+// task of GetTasks() with its model and initial state, at the "home"
+// keyframe if the model has one
+class BenchmarkTask {
+ public:
+  explicit BenchmarkTask(int index);
+  ~BenchmarkTask();
+
+  BenchmarkTask(const BenchmarkTask&) = delete;
+  BenchmarkTask& operator=(const BenchmarkTask&) = delete;
+
+  // model loaded; otherwise, the benchmark is skipped with the load error
+  bool Loaded(benchmark::State& st) const;
+
+  // evaluate this task's residual in the sensor callback
+  void Activate();
+
+  std::shared_ptr<Task> task;
+  mjModel* model = nullptr;
+  mjData* data = nullptr;
+  State state;
+  std::string error;
+};
+
+// number of tasks in GetTasks()
+int NumBenchmarkTasks();
+
+// benchmark names use the task name without spaces
+std::string BenchmarkTaskName(int index);
+
+// thread counts: 1 and the available hardware threads
+std::vector<int64_t> ThreadCounts();
+
+// register the per-task benchmarks of each suite
+void RegisterPlannerBenchmarks(int task_index);
+void RegisterEstimatorBenchmarks(int task_index);
+
+}  // namespace mjpc::benchmarks
+
+#endif  // MJPC_BENCHMARK_BENCHMARK_TASK_H_
@@ -0,0 +1,179 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of estimator updates and direct optimization, on measurements
+// of a passive rollout of the task model.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/benchmark/benchmark_task.h"
+#include "mjpc/direct/direct.h"
+#include "mjpc/estimators/batch.h"
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/estimators/kalman.h"
+#include "mjpc/estimators/unscented.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc::benchmarks {
+namespace {
+
+// rollout steps recorded as measurements
+constexpr int kMeasurementSteps = 100;
+
+// measurements of a rollout from the task's initial state with its initial
+// controls
+struct Measurements {
+  Measurements(const mjModel* model, const mjData* initial_data, int T)
+      : steps(T),
+        qpos(model->nq * T),
+        qfrc_actuator(model->nv * T),
+        sensor(model->nsensordata * T),
+        ctrl(model->nu * T) {
+    mjData* data = mj_copyData(nullptr, model, initial_data);
+    for (int t = 0; t < T; t++) {
+      mju_copy(ctrl.data() + t * model->nu, data->ctrl, model->nu);
+      mj_step(model, data);
+      mju_copy(qpos.data() + t * model->nq, data->qpos, model->nq);
+      mju_copy(qfrc_actuator.data() + t * model->nv, data->qfrc_actuator,
+               model->nv);
+      mju_copy(sensor.data() + t * model->nsensordata, data->sensordata,
+               model->nsensordata);
+    }
+    mj_deleteData(data);
+  }
+
+  int steps;
+  std::vector<double> qpos;
+  std::vector<double> qfrc_actuator;
+  std::vector<double> sensor;
+  std::vector<double> ctrl;
+};
+
+// estimator updates, cycling through the measurements
+void RunUpdates(benchmark::State& st, Estimator& estimator,
+                const BenchmarkTask& bt, const Measurements& measurements) {
+  int nu = bt.model->nu;
+  int ns = bt.model->nsensordata;
+  int t = 0;
+  for (auto _ : st) {
+    estimator.Update(measurements.ctrl.data() + t * nu,
+                     measurements.sensor.data() + t * ns);
+    t = (t + 1) % measurements.steps;
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+
+// extended Kalman filter update
+void BM_KalmanUpdate(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  ThreadPool pool(st.range(0));
+  Measurements measurements(bt.model, bt.data, kMeasurementSteps);
+
+  Kalman kalman(bt.model);
+  kalman.SetThreadPool(&pool);
+  kalman.Reset(bt.data);
+  RunUpdates(st, kalman, bt, measurements);
+}
+
+// unscented Kalman filter update
+void BM_UnscentedUpdate(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  ThreadPool pool(st.range(0));
+  Measurements measurements(bt.model, bt.data, kMeasurementSteps);
+
+  Unscented unscented(bt.model);
+  unscented.SetThreadPool(&pool);
+  unscented.Reset(bt.data);
+  RunUpdates(st, unscented, bt, measurements);
+}
+
+// batch filter update over a configuration window
+void BM_BatchUpdate(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  ThreadPool pool(st.range(0));
+  Measurements measurements(bt.model, bt.data, kMeasurementSteps);
+
+  Batch batch(bt.model, st.range(1));
+  batch.SetThreadPool(&pool);
+  batch.Reset(bt.data);
+  RunUpdates(st, batch, bt, measurements);
+}
+
+// direct optimization of a configuration trajectory, from the measured
+// configurations
+void BM_DirectOptimize(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  ThreadPool pool(st.range(0));
+  int T = st.range(1);
+  Measurements measurements(bt.model, bt.data, T);
+  int nq = bt.model->nq, nv = bt.model->nv, ns = bt.model->nsensordata;
+
+  Direct optimizer(bt.model, T);
+  optimizer.SetThreadPool(&pool);
+  mju_copy(optimizer.force_measurement.Data(),
+           measurements.qfrc_actuator.data(), nv * T);
+  mju_copy(optimizer.sensor_measurement.Data(), measurements.sensor.data(),
+           ns * T);
+  for (auto _ : st) {
+    st.PauseTiming();
+    mju_copy(optimizer.configuration.Data(), measurements.qpos.data(),
+             nq * T);
+    mju_copy(optimizer.configuration_previous.Data(),
+             measurements.qpos.data(), nq * T);
+    st.ResumeTiming();
+    optimizer.Optimize();
+  }
+  st.SetItemsProcessed(st.iterations() * T);
+}
+
+}  // namespace
+
+void RegisterEstimatorBenchmarks(int task_index) {
+  std::string name = BenchmarkTaskName(task_index);
+  benchmark::RegisterBenchmark(("BM_KalmanUpdate/" + name).c_str(),
+                               BM_KalmanUpdate, task_index)
+      ->ArgNames({"threads"})
+      ->ArgsProduct({ThreadCounts()})
+      ->Unit(benchmark::kMicrosecond)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark(("BM_UnscentedUpdate/" + name).c_str(),
+                               BM_UnscentedUpdate, task_index)
+      ->ArgNames({"threads"})
+      ->ArgsProduct({ThreadCounts()})
+      ->Unit(benchmark::kMicrosecond)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark(("BM_BatchUpdate/" + name).c_str(),
+                               BM_BatchUpdate, task_index)
+      ->ArgNames({"threads", "length"})
+      ->ArgsProduct({ThreadCounts(), {3, 10}})
+      ->Unit(benchmark::kMicrosecond)
+      ->UseRealTime();
+  benchmark::RegisterBenchmark(("BM_DirectOptimize/" + name).c_str(),
+                               BM_DirectOptimize, task_index)
+      ->ArgNames({"threads", "length"})
+      ->ArgsProduct({ThreadCounts(), {10, 50}})
+      ->Unit(benchmark::kMillisecond)
+      ->UseRealTime();
+}
+
+}  // namespace mjpc::benchmarks
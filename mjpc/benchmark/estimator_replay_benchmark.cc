@@ -0,0 +1,399 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Replay of a measurement log (estimators/measurement_log.h) through the
+// Kalman, unscented Kalman and batch filters, for each thread count and batch
+// configuration length. Reports updates per second, update latency, the
+// estimators' per-phase timers and, for logs with ground truth, the RMS state
+// error. Without --log, a log of the task model driven by smoothed random
+// controls is simulated (and written to --write_log if set).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_join.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/agent.h"
+#include "mjpc/estimators/batch.h"
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/estimators/kalman.h"
+#include "mjpc/estimators/measurement_log.h"
+#include "mjpc/estimators/unscented.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
+
+ABSL_FLAG(std::string, task, "Cartpole", "Task whose model the log is of.");
+ABSL_FLAG(std::string, log, "",
+          "Measurement log to replay, a simulated log of the task if empty.");
+ABSL_FLAG(std::string, write_log, "",
+          "If set, write the simulated log to this file.");
+ABSL_FLAG(int, steps, 2000, "Time steps of the simulated log.");
+ABSL_FLAG(double, sensor_noise, 0.0,
+          "Standard deviation of the simulated sensor noise.");
+ABSL_FLAG(std::vector<std::string>, estimators,
+          std::vector<std::string>({"kalman", "unscented", "batch"}),
+          "Comma-separated estimators: kalman, unscented, batch.");
+ABSL_FLAG(std::vector<std::string>, threads, {},
+          "Comma-separated thread counts, 1 and the hardware threads if "
+          "empty.");
+ABSL_FLAG(std::vector<std::string>, lengths,
+          std::vector<std::string>({"3", "10"}),
+          "Comma-separated batch configuration lengths.");
+ABSL_FLAG(std::string, output_json, "",
+          "If set, write the results of each configuration to this JSON file.");
+
+namespace mjpc {
+namespace {
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+// replay results of an estimator configuration
+struct ReplayResult {
+  std::string estimator;
+  int threads = 1;
+  int length = 0;                 // batch configuration length
+  std::vector<double> latency;    // update wall time (microseconds)
+  double updates_per_second = 0.0;
+  double prediction = kNaN;       // average phase time (ms), NaN if untimed
+  double measurement = kNaN;
+  double optimize = kNaN;
+  double qpos_rmse = kNaN;        // against the ground truth of the log
+  double qvel_rmse = kNaN;
+};
+
+// nearest-rank percentile of sorted values
+double Percentile(const std::vector<double>& sorted, double percent) {
+  if (sorted.empty()) return 0.0;
+  int rank = std::ceil(percent / 100.0 * sorted.size());
+  return sorted[std::clamp(rank - 1, 0, static_cast<int>(sorted.size()) - 1)];
+}
+
+// log of the model from data, with smoothed random controls in the control
+// range and Gaussian sensor noise
+MeasurementLog SimulateLog(const mjModel* model, mjData* data, int steps,
+                           double sensor_noise) {
+  int nu = model->nu, ns = model->nsensordata;
+  int nstate = model->nq + model->nv + model->na;
+  MeasurementLog log;
+  log.nu = nu;
+  log.nsensordata = ns;
+  log.nstate = nstate;
+
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+  std::normal_distribution<double> normal(0.0, 1.0);
+  std::vector<double> state(nstate), sensor(ns);
+  for (int t = 0; t < steps; t++) {
+    for (int i = 0; i < nu; i++) {
+      double lower = -1.0, upper = 1.0;
+      if (model->actuator_ctrllimited[i]) {
+        lower = model->actuator_ctrlrange[2 * i];
+        upper = model->actuator_ctrlrange[2 * i + 1];
+      }
+      double target = 0.5 * (lower + upper) +
+                      0.5 * (upper - lower) * uniform(generator);
+      data->ctrl[i] =
+          std::clamp(0.98 * data->ctrl[i] + 0.02 * target, lower, upper);
+    }
+    mju_copy(state.data(), data->qpos, model->nq);
+    mju_copy(state.data() + model->nq, data->qvel, model->nv);
+    mju_copy(state.data() + model->nq + model->nv, data->act, model->na);
+    double time = data->time;
+
+    // sensors are evaluated at the state before the step
+    mj_step(model, data);
+    for (int i = 0; i < ns; i++) {
+      sensor[i] = data->sensordata[i] + sensor_noise * normal(generator);
+    }
+    log.Append(time, data->ctrl, sensor.data(), state.data());
+  }
+  return log;
+}
+
+// replay the log through an estimator configuration, false if the log
+// doesn't fit the model
+bool Replay(const mjModel* model, const MeasurementLog& log,
+            const std::string& name, int threads, int length,
+            ReplayResult* result) {
+  int nq = model->nq, nv = model->nv, na = model->na;
+  if (log.nu != model->nu || log.nsensordata != model->nsensordata ||
+      (log.nstate != 0 && log.nstate != nq + nv + na) || log.Steps() < 2) {
+    std::cerr << "Log doesn't match the task's model\n";
+    return false;
+  }
+  result->estimator = name;
+  result->threads = threads;
+  result->length = name == "batch" ? length : 0;
+
+  // initial state, the first true state if known
+  mjData* data = mj_makeData(model);
+  if (log.nstate) {
+    mju_copy(data->qpos, log.State(0), nq);
+    mju_copy(data->qvel, log.State(0) + nq, nv);
+    mju_copy(data->act, log.State(0) + nq + nv, na);
+  } else {
+    int home_id = mj_name2id(model, mjOBJ_KEY, "home");
+    if (home_id >= 0) mj_resetDataKeyframe(model, data, home_id);
+  }
+  data->time = log.time[0];
+  mj_forward(model, data);
+
+  ThreadPool pool(threads);
+  std::unique_ptr<Estimator> estimator;
+  Kalman* kalman = nullptr;
+  Batch* batch = nullptr;
+  if (name == "kalman") {
+    estimator = std::make_unique<Kalman>(model);
+    kalman = static_cast<Kalman*>(estimator.get());
+    kalman->settings.parallel_jacobian = threads > 1;
+  } else if (name == "unscented") {
+    // the unscented filter times its update as a whole
+    estimator = std::make_unique<Unscented>(model);
+  } else {
+    estimator = std::make_unique<Batch>(model, length);
+    batch = static_cast<Batch*>(estimator.get());
+  }
+  estimator->SetThreadPool(&pool);
+  estimator->Reset(data);
+  if (batch) {
+    // initial configurations consistent with the initial velocity
+    double* q0 = batch->configuration.Get(0);
+    double* q1 = batch->configuration.Get(1);
+    mju_copy(q1, data->qpos, nq);
+    mju_copy(q0, q1, nq);
+    mj_integratePos(model, q0, data->qvel, -model->opt.timestep);
+  }
+
+  // the estimate after the update of step t is of the state of step t + 1
+  int updates = log.Steps() - 1;
+  double prediction = 0.0, measurement = 0.0, optimize = 0.0;
+  double qpos_error = 0.0, qvel_error = 0.0;
+  std::vector<double> difference(nv);
+  auto replay_start = std::chrono::steady_clock::now();
+  for (int t = 0; t < updates; t++) {
+    auto start = std::chrono::steady_clock::now();
+    estimator->Update(log.Ctrl(t), log.Sensor(t));
+    result->latency.push_back(GetDuration(start));
+
+    if (kalman) {
+      prediction += kalman->TimerPrediction();
+      measurement += kalman->TimerMeasurement();
+    } else if (batch) {
+      prediction += batch->TimerUpdate() - batch->TimerOptimize();
+      optimize += batch->TimerOptimize();
+    }
+    if (log.nstate) {
+      const double* truth = log.State(t + 1);
+      const double* estimate = estimator->State();
+      mj_differentiatePos(model, difference.data(), 1.0, truth, estimate);
+      qpos_error += mju_dot(difference.data(), difference.data(), nv);
+      mju_sub(difference.data(), estimate + nq, truth + nq, nv);
+      qvel_error += mju_dot(difference.data(), difference.data(), nv);
+    }
+  }
+  double duration = 1.0e-6 * GetDuration(replay_start);
+  result->updates_per_second = duration > 0.0 ? updates / duration : 0.0;
+  if (kalman) {
+    result->prediction = prediction / updates;
+    result->measurement = measurement / updates;
+  } else if (batch) {
+    result->prediction = prediction / updates;
+    result->optimize = optimize / updates;
+  }
+  if (log.nstate) {
+    result->qpos_rmse = std::sqrt(qpos_error / updates);
+    result->qvel_rmse = std::sqrt(qvel_error / updates);
+  }
+  std::sort(result->latency.begin(), result->latency.end());
+
+  // the estimator uses the pool until it is destroyed
+  estimator.reset();
+  mj_deleteData(data);
+  return true;
+}
+
+// table entry of a value, "-" if it isn't measured
+std::string Entry(double value, const char* format = "%.4g") {
+  return std::isnan(value) ? "-" : absl::StrFormat(format, value);
+}
+
+// JSON value, null if it isn't measured
+std::string Json(double value) {
+  return std::isnan(value) ? "null" : absl::StrFormat("%.9g", value);
+}
+
+bool WriteJson(const std::string& path, const std::string& task_name,
+               int steps, bool ground_truth,
+               const std::vector<ReplayResult>& results) {
+  std::vector<std::string> records;
+  for (const ReplayResult& result : results) {
+    records.push_back(absl::StrFormat(
+        "    {\"estimator\": \"%s\", \"threads\": %d, \"length\": %d, "
+        "\"updates_per_second\": %.9g, \"latency_us\": {\"p50\": %.9g, "
+        "\"p99\": %.9g}, \"phase_ms\": {\"prediction\": %s, \"measurement\": "
+        "%s, \"optimize\": %s}, \"qpos_rmse\": %s, \"qvel_rmse\": %s}",
+        result.estimator, result.threads, result.length,
+        result.updates_per_second, Percentile(result.latency, 50),
+        Percentile(result.latency, 99), Json(result.prediction),
+        Json(result.measurement), Json(result.optimize),
+        Json(result.qpos_rmse), Json(result.qvel_rmse)));
+  }
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\n"
+       << "  \"task\": \"" << task_name << "\",\n"
+       << "  \"steps\": " << steps << ",\n"
+       << "  \"ground_truth\": " << (ground_truth ? "true" : "false") << ",\n"
+       << "  \"estimators\": [\n"
+       << absl::StrJoin(records, ",\n") << "\n  ]\n"
+       << "}\n";
+  return static_cast<bool>(file);
+}
+
+// positive integers of a flag, false if there is another value
+bool ParseCounts(const std::vector<std::string>& values,
+                 std::vector<int>* counts) {
+  for (const std::string& value : values) {
+    int count;
+    if (!absl::SimpleAtoi(value, &count) || count < 1) return false;
+    counts->push_back(count);
+  }
+  return true;
+}
+
+int EstimatorReplayBenchmark() {
+  std::string task_name = absl::GetFlag(FLAGS_task);
+  Agent agent;
+  agent.SetTaskList(GetRegisteredTasks());
+  int task_id = agent.GetTaskIdByName(task_name);
+  if (task_id == -1) {
+    std::cerr << "Invalid --task flag: '" << task_name
+              << "'. Valid values:\n";
+    std::cerr << agent.GetTaskNames();
+    return 1;
+  }
+  agent.gui_task_id = task_id;
+  auto load_model = agent.LoadModel();
+  UniqueMjModel model = std::move(load_model.model);
+  if (!model) {
+    std::cerr << load_model.error << "\n";
+    return 1;
+  }
+
+  // estimator configurations
+  std::vector<std::string> estimators = absl::GetFlag(FLAGS_estimators);
+  for (const std::string& name : estimators) {
+    if (name != "kalman" && name != "unscented" && name != "batch") {
+      std::cerr << "Invalid --estimators value: '" << name
+                << "'. Valid values: kalman, unscented, batch\n";
+      return 1;
+    }
+  }
+  std::vector<int> thread_counts, lengths;
+  if (!ParseCounts(absl::GetFlag(FLAGS_threads), &thread_counts) ||
+      !ParseCounts(absl::GetFlag(FLAGS_lengths), &lengths)) {
+    std::cerr << "--threads and --lengths are positive integers\n";
+    return 1;
+  }
+  if (thread_counts.empty()) {
+    thread_counts = {1};
+    if (NumAvailableHardwareThreads() > 1) {
+      thread_counts.push_back(NumAvailableHardwareThreads());
+    }
+  }
+
+  // log
+  MeasurementLog log;
+  std::string log_path = absl::GetFlag(FLAGS_log);
+  if (!log_path.empty()) {
+    if (!ReadMeasurementLog(log_path, &log)) {
+      std::cerr << "Invalid --log: '" << log_path << "'\n";
+      return 1;
+    }
+  } else {
+    UniqueMjData data = MakeUniqueMjData(mj_makeData(model.get()));
+    int home_id = mj_name2id(model.get(), mjOBJ_KEY, "home");
+    if (home_id >= 0) mj_resetDataKeyframe(model.get(), data.get(), home_id);
+    log = SimulateLog(model.get(), data.get(), absl::GetFlag(FLAGS_steps),
+                      absl::GetFlag(FLAGS_sensor_noise));
+    std::string write_log = absl::GetFlag(FLAGS_write_log);
+    if (!write_log.empty() && !WriteMeasurementLog(write_log, log)) {
+      std::cerr << "Failed to write " << write_log << "\n";
+      return 1;
+    }
+  }
+
+  std::cout << "Replay " << log.Steps() << " measurements of " << task_name
+            << (log.nstate ? "" : ", without ground truth") << "\n"
+            << absl::StrFormat(
+                   "%-10s %7s %6s %10s %9s %9s %10s %10s %10s %10s %10s\n",
+                   "estimator", "threads", "length", "updates/s", "p50 us",
+                   "p99 us", "predict ms", "measure ms", "optim ms",
+                   "qpos rmse", "qvel rmse");
+  std::vector<ReplayResult> results;
+  for (const std::string& name : estimators) {
+    for (int threads : thread_counts) {
+      for (int length : name == "batch" ? lengths : std::vector<int>{0}) {
+        ReplayResult result;
+        if (!Replay(model.get(), log, name, threads, length, &result)) {
+          return 1;
+        }
+        std::cout << absl::StrFormat(
+            "%-10s %7d %6s %10.1f %9.1f %9.1f %10s %10s %10s %10s %10s\n",
+            result.estimator, result.threads,
+            result.length ? absl::StrFormat("%d", result.length) : "-",
+            result.updates_per_second, Percentile(result.latency, 50),
+            Percentile(result.latency, 99), Entry(result.prediction),
+            Entry(result.measurement), Entry(result.optimize),
+            Entry(result.qpos_rmse), Entry(result.qvel_rmse));
+        results.push_back(std::move(result));
+      }
+    }
+  }
+
+  std::string output_json = absl::GetFlag(FLAGS_output_json);
+  if (!output_json.empty()) {
+    if (!WriteJson(output_json, task_name, log.Steps(), log.nstate > 0,
+                   results)) {
+      std::cerr << "Failed to write " << output_json << "\n";
+      return 1;
+    }
+    std::cout << "Results written to " << output_json << "\n";
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace mjpc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  return mjpc::EstimatorReplayBenchmark();
+}
@@ -0,0 +1,37 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of planner and estimator kernels on the tasks of
+// GetTasks(). Per-task benchmarks are named <kernel>/<task>, e.g.,
+//
+//   mjpc_benchmarks --benchmark_filter='BM_SamplingRollouts/Cartpole'
+//
+// task models are loaded relative to the executable, or from
+// MJPC_TASKS_DIR if set.
+
+#include <benchmark/benchmark.h>
+
+#include "mjpc/benchmark/benchmark_task.h"
+
+int main(int argc, char** argv) {
+  for (int i = 0; i < mjpc::benchmarks::NumBenchmarkTasks(); i++) {
+    mjpc::benchmarks::RegisterPlannerBenchmarks(i);
+    mjpc::benchmarks::RegisterEstimatorBenchmarks(i);
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
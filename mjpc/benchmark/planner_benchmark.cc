@@ -0,0 +1,268 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of planner kernels: rollouts, derivatives, the Riccati step of
+// the iLQG backward pass, norms and spline mappings.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/benchmark/benchmark_task.h"
+#include "mjpc/norm.h"
+#include "mjpc/planners/gradient/spline_mapping.h"
+#include "mjpc/planners/ilqg/planner.h"
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc::benchmarks {
+namespace {
+
+// planning horizons (time steps)
+const std::vector<int64_t> kHorizons = {25, 100};
+
+// planner at the task's initial state, after one iteration
+template <typename T>
+void SetUpPlanner(T& planner, BenchmarkTask& bt, int horizon,
+                  ThreadPool& pool) {
+  planner.Initialize(bt.model, *bt.task);
+  planner.Allocate();
+  planner.Reset(horizon);
+  planner.SetState(bt.state);
+  planner.OptimizePolicy(horizon, pool);
+}
+
+// one rollout of the sampling planner's nominal policy
+void BM_TrajectoryRollout(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  int horizon = st.range(0);
+
+  ThreadPool pool(1);
+  SamplingPlanner planner;
+  SetUpPlanner(planner, bt, horizon, pool);
+
+  Trajectory& trajectory = planner.trajectory[0];
+  for (auto _ : st) {
+    trajectory.Rollout(planner.policy, bt.task.get(), bt.model,
+                       planner.data_[0], planner.state.data(),
+                       planner.time, planner.mocap.data(),
+                       planner.userdata.data(), horizon);
+  }
+  st.SetItemsProcessed(st.iterations() * (horizon - 1));
+}
+
+// noisy rollouts of the sampling planner
+void BM_SamplingRollouts(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  int num_threads = st.range(0);
+  int horizon = st.range(1);
+
+  ThreadPool pool(num_threads);
+  SamplingPlanner planner;
+  SetUpPlanner(planner, bt, horizon, pool);
+
+  int num_trajectory = planner.num_trajectory_;
+  for (auto _ : st) {
+    planner.Rollouts(num_trajectory, horizon, pool);
+  }
+  st.SetItemsProcessed(st.iterations() * num_trajectory * (horizon - 1));
+}
+
+// finite-difference model derivatives along the iLQG nominal trajectory
+void BM_ModelDerivatives(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  int num_threads = st.range(0);
+  int horizon = st.range(1);
+
+  ThreadPool pool(num_threads);
+  iLQGPlanner planner;
+  SetUpPlanner(planner, bt, horizon, pool);
+
+  const Trajectory& nominal = planner.candidate_policy[0].trajectory;
+  for (auto _ : st) {
+    planner.model_derivative.Compute(
+        bt.model, planner.data_, nominal.states.data(),
+        nominal.actions.data(), nominal.times.data(), planner.dim_state,
+        planner.dim_state_derivative, planner.dim_action, planner.dim_sensor,
+        horizon, planner.settings.fd_tolerance, planner.settings.fd_mode,
+        pool, planner.settings.fd_coloring);
+  }
+  st.SetItemsProcessed(st.iterations() * horizon);
+}
+
+// cost derivatives along the iLQG nominal trajectory
+void BM_CostDerivatives(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  int num_threads = st.range(0);
+  int horizon = st.range(1);
+
+  ThreadPool pool(num_threads);
+  iLQGPlanner planner;
+  SetUpPlanner(planner, bt, horizon, pool);
+
+  Trajectory& nominal = planner.candidate_policy[0].trajectory;
+  ModelDerivatives& md = planner.model_derivative;
+  const Task* task = bt.task.get();
+  for (auto _ : st) {
+    planner.cost_derivative.Compute(
+        nominal.residual.data(), md.C.data(), md.D.data(),
+        planner.dim_state_derivative, planner.dim_action, planner.dim_max,
+        planner.dim_sensor, task->num_residual, task->dim_norm_residual.data(),
+        task->num_term, task->weight.data(), task->norm.data(),
+        task->norm_parameter.data(), task->num_norm_parameter.data(),
+        task->risk, horizon, pool);
+  }
+  st.SetItemsProcessed(st.iterations() * horizon);
+}
+
+// Riccati steps of one iLQG backward pass (serial)
+void BM_RiccatiStep(benchmark::State& st, int task_index) {
+  BenchmarkTask bt(task_index);
+  if (!bt.Loaded(st)) return;
+  int horizon = st.range(0);
+
+  ThreadPool pool(1);
+  iLQGPlanner planner;
+  SetUpPlanner(planner, bt, horizon, pool);
+
+  int n = planner.dim_state_derivative;
+  int m = planner.dim_action;
+  iLQGBackwardPass& bp = planner.backward_pass;
+  const ModelDerivatives& md = planner.model_derivative;
+  const CostDerivatives& cd = planner.cost_derivative;
+  iLQGPolicy& policy = planner.candidate_policy[0];
+  for (auto _ : st) {
+    mju_zero(bp.dV, 2);
+    mju_copy(DataAt(bp.Vx, (horizon - 1) * n),
+             DataAt(cd.cx, (horizon - 1) * n), n);
+    mju_copy(DataAt(bp.Vxx, (horizon - 1) * n * n),
+             DataAt(cd.cxx, (horizon - 1) * n * n), n * n);
+    for (int t = horizon - 2; t >= 0; t--) {
+      bp.RiccatiStep(
+          n, m, bp.regularization, DataAt(bp.Vx, (t + 1) * n),
+          DataAt(bp.Vxx, (t + 1) * n * n), DataAt(md.A, t * n * n),
+          DataAt(md.B, t * n * m), DataAt(cd.cx, t * n),
+          DataAt(cd.cu, t * m), DataAt(cd.cxx, t * n * n),
+          DataAt(cd.cxu, t * n * m), DataAt(cd.cuu, t * m * m),
+          DataAt(bp.Vx, t * n), DataAt(bp.Vxx, t * n * n),
+          DataAt(policy.action_improvement, t * m),
+          DataAt(policy.feedback_gain, t * m * n), bp.dV,
+          DataAt(bp.Qx, t * n), DataAt(bp.Qu, t * m),
+          DataAt(bp.Qxx, t * n * n), DataAt(bp.Qxu, t * n * m),
+          DataAt(bp.Quu, t * m * m), bp.Q_scratch.data(), planner.boxqp,
+          DataAt(policy.trajectory.actions, t * m),
+          bt.model->actuator_ctrlrange,
+          planner.settings.regularization_type,
+          planner.settings.action_limits);
+    }
+  }
+  st.SetItemsProcessed(st.iterations() * (horizon - 1));
+}
+
+// norm with gradient and Hessian
+void BM_Norm(benchmark::State& st) {
+  NormType type = static_cast<NormType>(st.range(0));
+  int n = st.range(1);
+  std::vector<double> x(n), g(n), H(n * n);
+  for (int i = 0; i < n; i++) x[i] = 0.1 * (i + 1);
+  double params[2] = {0.1, 2.0};
+  for (auto _ : st) {
+    benchmark::DoNotOptimize(
+        Norm(g.data(), H.data(), x.data(), params, n, type));
+    benchmark::ClobberMemory();
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_Norm)
+    ->ArgNames({"type", "n"})
+    ->ArgsProduct({{NormType::kQuadratic, NormType::kL22, NormType::kL2,
+                    NormType::kCosh, NormType::kPowerLoss,
+                    NormType::kSmoothAbsLoss, NormType::kSmoothAbs2Loss,
+                    NormType::kRectifyLoss},
+                   {3, 12}});
+
+// spline mapping from knots to trajectory times
+void BM_SplineMapping(benchmark::State& st) {
+  std::unique_ptr<SplineMapping> mapping;
+  switch (st.range(0)) {
+    case 0:
+      mapping = std::make_unique<ZeroSplineMapping>();
+      break;
+    case 1:
+      mapping = std::make_unique<LinearSplineMapping>();
+      break;
+    default:
+      mapping = std::make_unique<CubicSplineMapping>();
+      break;
+  }
+  int num_spline_points = st.range(1);
+  int horizon = st.range(2);
+  mapping->Allocate(1);
+
+  std::vector<double> knot_times(num_spline_points);
+  LinearRange(knot_times.data(), (horizon - 1.0) / (num_spline_points - 1),
+              0.0, num_spline_points);
+  std::vector<double> times(horizon);
+  LinearRange(times.data(), 1.0, 0.0, horizon);
+  for (auto _ : st) {
+    mapping->Compute(knot_times, num_spline_points, times.data(), horizon);
+  }
+  st.SetItemsProcessed(st.iterations() * horizon);
+}
+BENCHMARK(BM_SplineMapping)
+    ->ArgNames({"mapping", "points", "horizon"})
+    ->ArgsProduct({{0, 1, 2}, {4, 16}, kHorizons});
+
+}  // namespace
+
+void RegisterPlannerBenchmarks(int task_index) {
+  std::string name = BenchmarkTaskName(task_index);
+  benchmark::RegisterBenchmark(("BM_TrajectoryRollout/" + name).c_str(),
+                               BM_TrajectoryRollout, task_index)
+      ->ArgNames({"horizon"})
+      ->ArgsProduct({kHorizons})
+      ->Unit(benchmark::kMicrosecond);
+  struct ThreadedKernel {
+    const char* name;
+    void (*function)(benchmark::State&, int);
+  };
+  for (const ThreadedKernel& kernel :
+       {ThreadedKernel{"BM_SamplingRollouts/", BM_SamplingRollouts},
+        ThreadedKernel{"BM_ModelDerivatives/", BM_ModelDerivatives},
+        ThreadedKernel{"BM_CostDerivatives/", BM_CostDerivatives}}) {
+    benchmark::RegisterBenchmark((kernel.name + name).c_str(),
+                                 kernel.function, task_index)
+        ->ArgNames({"threads", "horizon"})
+        ->ArgsProduct({ThreadCounts(), kHorizons})
+        ->Unit(benchmark::kMicrosecond)
+        ->UseRealTime();
+  }
+  benchmark::RegisterBenchmark(("BM_RiccatiStep/" + name).c_str(),
+                               BM_RiccatiStep, task_index)
+      ->ArgNames({"horizon"})
+      ->ArgsProduct({kHorizons})
+      ->Unit(benchmark::kMicrosecond);
+}
+
+}  // namespace mjpc::benchmarks
@@ -0,0 +1,236 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replay of recorded planning states (testspeed --record_states): each
+// planner runs PlanIteration from every recorded state in order, without the
+// simulation, and the iteration latency and the return of the resulting plan
+// are reported. Planners are seeded by the task model, so the plans, unlike
+// TestSpeed's simulated trajectories, are the same in every run.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/agent.h"
+#include "mjpc/planners/include.h"
+#include "mjpc/planners/planner.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/state_recording.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
+
+ABSL_FLAG(std::string, task, "Cartpole", "Task of the recording.");
+ABSL_FLAG(std::string, states, "",
+          "Recording of planning states, from testspeed --record_states.");
+ABSL_FLAG(std::vector<std::string>, planners, {},
+          "Comma-separated planner names, all planners if empty.");
+ABSL_FLAG(int, planner_thread, mjpc::NumAvailableHardwareThreads(),
+          "Number of planner threads to use.");
+ABSL_FLAG(int, repeats, 1,
+          "Replays of the recording per planner, each from a reset agent.");
+ABSL_FLAG(std::string, output_json, "",
+          "If set, write the results of each planner to this JSON file.");
+
+namespace mjpc {
+namespace {
+
+// replay results of a planner
+struct ReplayResult {
+  std::string planner;
+  std::vector<double> latency;  // PlanIteration wall time (microseconds)
+  double average_return = 0.0;  // of the best trajectory after an iteration
+  double max_return = 0.0;
+};
+
+// nearest-rank percentile of sorted values
+double Percentile(const std::vector<double>& sorted, double percent) {
+  if (sorted.empty()) return 0.0;
+  int rank = std::ceil(percent / 100.0 * sorted.size());
+  return sorted[std::clamp(rank - 1, 0, static_cast<int>(sorted.size()) - 1)];
+}
+
+// replay the recorded states with planner, false if they don't fit the task
+bool Replay(int task_id, int planner, const std::vector<RecordedState>& states,
+            int planner_thread_count, int repeats, ReplayResult* result) {
+  Agent agent;
+  agent.SetTaskList(GetRegisteredTasks());
+  agent.gui_task_id = task_id;
+  auto load_model = agent.LoadModel();
+  UniqueMjModel model = std::move(load_model.model);
+  if (!model) {
+    std::cerr << load_model.error << "\n";
+    return false;
+  }
+  UniqueMjData data = MakeUniqueMjData(mj_makeData(model.get()));
+  int home_id = mj_name2id(model.get(), mjOBJ_KEY, "home");
+  if (home_id >= 0) mj_resetDataKeyframe(model.get(), data.get(), home_id);
+  mj_forward(model.get(), data.get());
+
+  agent.estimator_enabled = false;
+  SetTracesEnabled(false);
+  agent.Initialize(model.get());
+  agent.SetPlanner(planner);
+  agent.Allocate();
+  agent.plan_enabled = true;
+  agent.RegisterResidualModel(model.get());
+  mjcb_sensor = &ResidualSensorCallback;
+
+  ThreadPool pool(planner_thread_count);
+  bool valid = true;
+  double total_return = 0.0;
+  result->max_return = 0.0;
+  for (int r = 0; r < repeats && valid; r++) {
+    agent.Reset(data->ctrl);
+    for (const RecordedState& state : states) {
+      if (!(valid = state.Restore(model.get(), agent.state,
+                                  *agent.ActiveTask()))) {
+        std::cerr << "Recorded state doesn't match the task's model\n";
+        break;
+      }
+      auto start = std::chrono::steady_clock::now();
+      agent.PlanIteration(&pool);
+      result->latency.push_back(GetDuration(start));
+      double plan_return = agent.ActivePlanner().BestTrajectory()->total_return;
+      total_return += plan_return;
+      result->max_return = std::max(result->max_return, plan_return);
+    }
+  }
+  int iterations = result->latency.size();
+  result->average_return = iterations ? total_return / iterations : 0.0;
+  std::sort(result->latency.begin(), result->latency.end());
+
+  mjcb_sensor = nullptr;
+  agent.UnregisterResidualModel(model.get());
+  return valid;
+}
+
+bool WriteJson(const std::string& path, const std::string& task_name,
+               int planner_thread_count, int num_states,
+               const std::vector<ReplayResult>& results) {
+  std::vector<std::string> records;
+  for (const ReplayResult& result : results) {
+    records.push_back(absl::StrFormat(
+        "    {\"planner\": \"%s\", \"iterations\": %d, \"latency_us\": "
+        "{\"p50\": %.9g, \"p99\": %.9g, \"max\": %.9g}, \"average_return\": "
+        "%.9g, \"max_return\": %.9g}",
+        result.planner, result.latency.size(), Percentile(result.latency, 50),
+        Percentile(result.latency, 99),
+        result.latency.empty() ? 0.0 : result.latency.back(),
+        result.average_return, result.max_return));
+  }
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\n"
+       << "  \"task\": \"" << task_name << "\",\n"
+       << "  \"planner_threads\": " << planner_thread_count << ",\n"
+       << "  \"states\": " << num_states << ",\n"
+       << "  \"planners\": [\n"
+       << absl::StrJoin(records, ",\n") << "\n  ]\n"
+       << "}\n";
+  return static_cast<bool>(file);
+}
+
+int ReplayBenchmark() {
+  std::string task_name = absl::GetFlag(FLAGS_task);
+  int planner_thread_count = absl::GetFlag(FLAGS_planner_thread);
+  int repeats = std::max(absl::GetFlag(FLAGS_repeats), 1);
+
+  std::vector<RecordedState> states;
+  if (!ReadStateRecording(absl::GetFlag(FLAGS_states), &states)) {
+    std::cerr << "Invalid --states recording: '"
+              << absl::GetFlag(FLAGS_states) << "'\n";
+    return 1;
+  }
+
+  Agent agent;
+  agent.SetTaskList(GetRegisteredTasks());
+  int task_id = agent.GetTaskIdByName(task_name);
+  if (task_id == -1) {
+    std::cerr << "Invalid --task flag: '" << task_name
+              << "'. Valid values:\n";
+    std::cerr << agent.GetTaskNames();
+    return 1;
+  }
+
+  // planners by name
+  std::vector<std::string> planner_names =
+      absl::StrSplit(kPlannerNames, '\n', absl::SkipEmpty());
+  std::vector<int> planners;
+  std::vector<std::string> selected = absl::GetFlag(FLAGS_planners);
+  for (int i = 0; i < static_cast<int>(planner_names.size()); i++) {
+    if (selected.empty() || std::find(selected.begin(), selected.end(),
+                                      planner_names[i]) != selected.end()) {
+      planners.push_back(i);
+    }
+  }
+  if (planners.empty()) {
+    std::cerr << "No planner of --planners. Valid values:\n"
+              << kPlannerNames;
+    return 1;
+  }
+
+  std::cout << "Replay " << states.size() << " planning states of "
+            << task_name << ", " << planner_thread_count << " threads\n"
+            << absl::StrFormat("%-16s %10s %10s %10s %12s %12s\n", "planner",
+                               "iterations", "p50 us", "p99 us",
+                               "avg return", "max return");
+  std::vector<ReplayResult> results;
+  for (int planner : planners) {
+    ReplayResult result;
+    result.planner = planner_names[planner];
+    if (!Replay(task_id, planner, states, planner_thread_count, repeats,
+                &result)) {
+      return 1;
+    }
+    std::cout << absl::StrFormat(
+        "%-16s %10d %10.1f %10.1f %12.6g %12.6g\n", result.planner,
+        result.latency.size(), Percentile(result.latency, 50),
+        Percentile(result.latency, 99), result.average_return,
+        result.max_return);
+    results.push_back(std::move(result));
+  }
+
+  std::string output_json = absl::GetFlag(FLAGS_output_json);
+  if (!output_json.empty()) {
+    if (!WriteJson(output_json, task_name, planner_thread_count,
+                   states.size(), results)) {
+      std::cerr << "Failed to write " << output_json << "\n";
+      return 1;
+    }
+    std::cout << "Results written to " << output_json << "\n";
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace mjpc
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  return mjpc::ReplayBenchmark();
+}
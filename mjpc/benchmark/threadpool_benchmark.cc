@@ -0,0 +1,90 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmarks of the thread pool's phase latency: a planning iteration runs
+// short parallel phases separated by serial work on the calling thread, with
+// workers parking in between unless they spin. the spin time (microseconds)
+// and the serial gap between phases (microseconds) are the arguments.
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "mjpc/threadpool.h"
+
+namespace mjpc::benchmarks {
+namespace {
+
+// spin times and serial gaps (microseconds)
+const std::vector<int64_t> kSpinTimes = {0, 10, kDefaultSpinMicroseconds, 200};
+const std::vector<int64_t> kGaps = {0, 20, 100};
+
+// number of workers
+constexpr int kNumThreads = 4;
+
+// busy wait on the calling thread, serial work between phases
+void Serial(int microseconds) {
+  auto end = std::chrono::steady_clock::now() +
+             std::chrono::microseconds(microseconds);
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+// parallel loop with one index per worker after a serial gap
+void BM_ParallelForPhase(benchmark::State& st) {
+  ThreadPool pool(kNumThreads);
+  pool.SetSpinMicroseconds(st.range(0));
+  int gap = st.range(1);
+  std::vector<double> values(kNumThreads, 0.0);
+  for (auto _ : st) {
+    Serial(gap);
+    pool.ParallelFor(0, kNumThreads, 1,
+                     [&values](int i) { values[i] += 1.0; });
+    benchmark::DoNotOptimize(values.data());
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_ParallelForPhase)
+    ->ArgNames({"spin_us", "gap_us"})
+    ->ArgsProduct({kSpinTimes, kGaps})
+    ->UseRealTime();
+
+// task group with one task per worker after a serial gap, waited on by a
+// thread outside the pool
+void BM_TaskGroupPhase(benchmark::State& st) {
+  ThreadPool pool(kNumThreads);
+  pool.SetSpinMicroseconds(st.range(0));
+  int gap = st.range(1);
+  std::vector<double> values(kNumThreads, 0.0);
+  for (auto _ : st) {
+    Serial(gap);
+    TaskGroup group(pool);
+    for (int i = 0; i < kNumThreads; i++) {
+      group.Schedule([&values, i]() { values[i] += 1.0; });
+    }
+    group.Wait();
+    benchmark::DoNotOptimize(values.data());
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK(BM_TaskGroupPhase)
+    ->ArgNames({"spin_us", "gap_us"})
+    ->ArgsProduct({kSpinTimes, kGaps})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace mjpc::benchmarks
@@ -0,0 +1,244 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/direct/band_cholesky.h"
+
+#include <algorithm>
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+// minimum interior length in separator dimensions
+inline constexpr int kMinInteriorSeparators = 4;
+
+// number of partitions
+int ParallelBandCholesky::NumPartitions(int ntotal, int nband,
+                                        int num_threads) {
+  int nsep = nband - 1;
+  if (nsep <= 0 || num_threads < 2) return 1;
+
+  // interiors of at least kMinInteriorSeparators * nsep rows
+  int max_partition = (ntotal + nsep) / ((kMinInteriorSeparators + 1) * nsep);
+  int num_partition = std::min(num_threads, max_partition);
+  return num_partition < 2 ? 1 : num_partition;
+}
+
+// allocate memory
+void ParallelBandCholesky::Allocate(int ntotal, int nband,
+                                    int num_partition) {
+  ntotal_ = ntotal;
+  nband_ = nband;
+  nsep_ = nband - 1;
+  num_partition_ = std::max(num_partition, 1);
+
+  // interior lengths
+  int ninterior = ntotal - (num_partition_ - 1) * nsep_;
+  int base = ninterior / num_partition_;
+  int remainder = ninterior % num_partition_;
+  if (num_partition_ > 1 && base < nsep_) {
+    mju_error("ParallelBandCholesky: interiors smaller than band\n");
+  }
+  start_.resize(num_partition_);
+  length_.resize(num_partition_);
+  adr_.resize(num_partition_);
+  int start = 0, adr = 0;
+  for (int p = 0; p < num_partition_; p++) {
+    start_[p] = start;
+    length_[p] = base + (p < remainder);
+    adr_[p] = adr;
+    start += length_[p] + nsep_;
+    adr += length_[p];
+  }
+
+  // memory
+  int nschur = (num_partition_ - 1) * nsep_;
+  factor_.resize(nband_ * ninterior);
+  coupling_.resize(2 * nsep_ * ninterior);
+  gram_.resize(4 * nsep_ * nsep_ * num_partition_);
+  min_diag_.resize(num_partition_);
+  schur_.resize(nschur * 2 * nsep_);
+  separator_.resize(2 * nschur);
+  contribution_.resize(2 * nsep_ * num_partition_);
+  interior_.resize(ninterior);
+}
+
+// factorize
+double ParallelBandCholesky::Factor(const double* band, double diagadd,
+                                    ThreadPool& pool) {
+  int nband = nband_, nsep = nsep_, ncoupling = 2 * nsep_;
+  int num_partition = num_partition_;
+
+  // interiors: factor, coupling (L \ C)' and its Gram matrix
+  pool.ParallelFor(0, num_partition, 1, [&](int p) {
+    int start = start_[p], m = length_[p];
+    double* factor = factor_.data() + adr_[p] * nband;
+    double* coupling = coupling_.data() + adr_[p] * ncoupling;
+
+    // factorize
+    mju_copy(factor, band + start * nband, m * nband);
+    min_diag_[p] = mju_cholFactorBand(factor, m, nband, 0, diagadd, 0.0);
+    if (min_diag_[p] <= 0.0) return;
+
+    // coupling to left separator columns
+    mju_zero(coupling, ncoupling * m);
+    if (p > 0) {
+      for (int q = 0; q < nsep; q++) {
+        int column = start - nsep + q;
+        for (int j = 0; j <= std::min(q, m - 1); j++) {
+          int row = start + j;
+          coupling[q * m + j] = band[row * nband + nband - 1 - (row - column)];
+        }
+      }
+    }
+
+    // coupling to right separator rows
+    if (p < num_partition - 1) {
+      for (int q = 0; q < nsep; q++) {
+        int row = start + m + q;
+        for (int j = std::max(m + q - nsep, 0); j < m; j++) {
+          int column = start + j;
+          coupling[(nsep + q) * m + j] =
+              band[row * nband + nband - 1 - (row - column)];
+        }
+      }
+    }
+
+    // coupling <- L \ coupling
+    for (int q = 0; q < ncoupling; q++) {
+      BandForwardSubstitution(coupling + q * m, factor, coupling + q * m, m,
+                              nband);
+    }
+
+    // Gram matrix
+    double* gram = gram_.data() + p * ncoupling * ncoupling;
+    for (int q0 = 0; q0 < ncoupling; q0++) {
+      for (int q1 = 0; q1 <= q0; q1++) {
+        gram[q0 * ncoupling + q1] = gram[q1 * ncoupling + q0] =
+            mju_dot(coupling + q0 * m, coupling + q1 * m, m);
+      }
+    }
+  });
+
+  // minimum interior diagonal
+  double min_diag = *std::min_element(min_diag_.begin(), min_diag_.end());
+  if (min_diag <= 0.0) return 0.0;
+
+  // separator Schur complement, band storage with 2 * nsep diagonals
+  int nschur = (num_partition - 1) * nsep;
+  if (nschur == 0) return min_diag;
+  int nband_schur = ncoupling;
+  auto schur = [this, nband_schur](int i, int j) -> double& {
+    return schur_[i * nband_schur + nband_schur - 1 - (i - j)];
+  };
+  mju_zero(schur_.data(), nschur * nband_schur);
+
+  // separator blocks
+  for (int k = 0; k < num_partition - 1; k++) {
+    int start = start_[k] + length_[k];
+    for (int i = 0; i < nsep; i++) {
+      int row = start + i;
+      for (int j = 0; j <= i; j++) {
+        schur(k * nsep + i, k * nsep + j) =
+            band[row * nband + nband - 1 - (i - j)];
+      }
+      schur(k * nsep + i, k * nsep + i) += diagadd;
+    }
+  }
+
+  // subtract interior contributions
+  for (int p = 0; p < num_partition; p++) {
+    const double* gram = gram_.data() + p * ncoupling * ncoupling;
+    for (int a = 0; a < ncoupling; a++) {
+      // left separator (p - 1), right separator (p)
+      if ((a < nsep && p == 0) || (a >= nsep && p == num_partition - 1)) {
+        continue;
+      }
+      int ia = (p - 1) * nsep + a;
+      for (int b = 0; b <= a; b++) {
+        if (b < nsep && p == 0) continue;
+        int ib = (p - 1) * nsep + b;
+        schur(ia, ib) -= gram[a * ncoupling + b];
+      }
+    }
+  }
+
+  // factorize Schur complement
+  double min_schur =
+      mju_cholFactorBand(schur_.data(), nschur, nband_schur, 0, 0.0, 0.0);
+  if (min_schur <= 0.0) return 0.0;
+
+  return std::min(min_diag, min_schur);
+}
+
+// solve
+void ParallelBandCholesky::Solve(double* res, const double* vec,
+                                 ThreadPool& pool) {
+  int nband = nband_, nsep = nsep_, ncoupling = 2 * nsep_;
+  int num_partition = num_partition_;
+  int nschur = (num_partition - 1) * nsep;
+
+  // interiors: y = L \ b, contribution = (L \ C)' * y
+  pool.ParallelFor(0, num_partition, 1, [&](int p) {
+    int start = start_[p], m = length_[p];
+    const double* factor = factor_.data() + adr_[p] * nband;
+    const double* coupling = coupling_.data() + adr_[p] * ncoupling;
+    double* y = interior_.data() + adr_[p];
+    BandForwardSubstitution(y, factor, vec + start, m, nband);
+    for (int q = 0; q < ncoupling; q++) {
+      contribution_[p * ncoupling + q] = mju_dot(coupling + q * m, y, m);
+    }
+  });
+
+  // separators: S \ (b - contributions)
+  double* rhs = separator_.data();
+  double* solution = separator_.data() + nschur;
+  for (int k = 0; k < num_partition - 1; k++) {
+    int start = start_[k] + length_[k];
+    for (int i = 0; i < nsep; i++) {
+      rhs[k * nsep + i] = vec[start + i] -
+                          contribution_[k * ncoupling + nsep + i] -
+                          contribution_[(k + 1) * ncoupling + i];
+    }
+  }
+  if (nschur > 0) {
+    mju_cholSolveBand(solution, schur_.data(), rhs, nschur, ncoupling, 0);
+  }
+  for (int k = 0; k < num_partition - 1; k++) {
+    mju_copy(res + start_[k] + length_[k], solution + k * nsep, nsep);
+  }
+
+  // interiors: x = L' \ (y - (L \ C) * separators)
+  pool.ParallelFor(0, num_partition, 1, [&](int p) {
+    int start = start_[p], m = length_[p];
+    const double* factor = factor_.data() + adr_[p] * nband;
+    const double* coupling = coupling_.data() + adr_[p] * ncoupling;
+    double* y = interior_.data() + adr_[p];
+    for (int q = 0; q < nsep; q++) {
+      if (p > 0) {
+        mju_addToScl(y, coupling + q * m, -solution[(p - 1) * nsep + q], m);
+      }
+      if (p < num_partition - 1) {
+        mju_addToScl(y, coupling + (nsep + q) * m, -solution[p * nsep + q],
+                     m);
+      }
+    }
+    BandBackwardSubstitution(res + start, factor, y, m, nband);
+  });
+}
+
+}  // namespace mjpc
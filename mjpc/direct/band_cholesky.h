@@ -0,0 +1,77 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_DIRECT_BAND_CHOLESKY_H_
+#define MJPC_DIRECT_BAND_CHOLESKY_H_
+
+#include <vector>
+
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+// partitioned band Cholesky factorization
+// the rows of a symmetric band matrix (band storage, no dense rows) are split
+// into interiors separated by nband - 1 separator rows. interiors are
+// decoupled given the separators, so their factorizations, couplings and
+// substitutions run in parallel on a pool. the separator Schur complement is
+// a small band matrix factorized serially.
+class ParallelBandCholesky {
+ public:
+  // constructor
+  ParallelBandCholesky() = default;
+
+  // number of partitions for a parallel factorization of an n x n matrix with
+  // nband diagonals on num_threads threads, 1 if not worthwhile
+  static int NumPartitions(int ntotal, int nband, int num_threads);
+
+  // allocate memory for ntotal x ntotal matrix with num_partition interiors
+  void Allocate(int ntotal, int nband, int num_partition);
+
+  // factorize band matrix with diagadd added to the diagonal. returns
+  // minimum factor diagonal, 0 if not positive definite
+  double Factor(const double* band, double diagadd, ThreadPool& pool);
+
+  // solve mat * res = vec with factorization
+  void Solve(double* res, const double* vec, ThreadPool& pool);
+
+  // number of partitions
+  int NumPartition() const { return num_partition_; }
+
+ private:
+  // dimensions
+  int ntotal_ = 0;
+  int nband_ = 0;
+  int nsep_ = 0;  // separator dimension (nband - 1)
+  int num_partition_ = 0;
+
+  // interior partitions
+  std::vector<int> start_;       // first row, num_partition
+  std::vector<int> length_;      // number of rows, num_partition
+  std::vector<int> adr_;         // offset into per-row memory, num_partition
+  std::vector<double> factor_;   // interior band factors, nband x rows
+  std::vector<double> coupling_;  // (L \ C)' blocks, 2 * nsep x rows
+  std::vector<double> gram_;      // coupling Gram, (2 * nsep)^2 x partitions
+  std::vector<double> min_diag_;  // factor minimum diagonal, num_partition
+
+  // separator Schur complement (band storage, 2 * nsep diagonals)
+  std::vector<double> schur_;
+  std::vector<double> separator_;     // separator values, nsep x separators
+  std::vector<double> contribution_;  // 2 * nsep x num_partition
+  std::vector<double> interior_;      // interior scratch, rows
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_DIRECT_BAND_CHOLESKY_H_
@@ -19,14 +19,23 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include <absl/strings/str_cat.h>
 #include <mujoco/mujoco.h>
 
 #include "mjpc/direct/trajectory.h"
 #include "mjpc/direct/model_parameters.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/norm.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -34,7 +43,8 @@ namespace mjpc {
 // constructor
 Direct::Direct(const mjModel* model, int length, int max_history)
     : model_parameters_(LoadModelParameters()),
-      pool_(NumAvailableHardwareThreads()) {
+      num_threads_(NumAvailableHardwareThreads()),
+      quota_(num_threads_) {
   // set max history length
   this->max_history_ = (max_history == 0 ? length : max_history);
 
@@ -86,20 +96,11 @@ void Direct::Initialize(const mjModel* model) {
     mju_error("nparam > 0 but model_parameter_id is missing\n");
   }
 
-  // perturbation models
-  if (nparam_ > 0) {
-    // clear memory
-    model_perturb_.clear();
-
-    // add model for each time step (need for threaded evaluation)
-    for (int i = 0; i < max_history_; i++) {
-      // add model
-      model_perturb_.push_back(MakeUniqueMjModel(mj_copyModel(nullptr, model)));
-
-      // set discrete inverse dynamics
-      model_perturb_[i].get()->opt.enableflags |= mjENBL_INVDISCRETE;
-    }
-  }
+  // perturbation models, allocated per worker in ParameterJacobian
+  model_perturb_.clear();
+  data_perturb_.clear();
+  overlay_perturb_.clear();
+  parameters_perturb_.clear();
 
   // sensor start index
   sensor_start_ = GetNumberOrDefault(0, model, "estimator_sensor_start");
@@ -108,6 +109,16 @@ void Direct::Initialize(const mjModel* model) {
   nsensor_ =
       GetNumberOrDefault(model->nsensor, model, "estimator_number_sensor");
 
+  // analytic acceleration derivatives: no acceleration sensors and an
+  // integrator whose discrete inverse dynamics are linear in M
+  analytic_acceleration_ = this->model->opt.integrator == mjINT_EULER ||
+                           this->model->opt.integrator == mjINT_RK4;
+  for (int i = 0; i < model->nsensor; i++) {
+    if (model->sensor_needstage[i] == mjSTAGE_ACC) {
+      analytic_acceleration_ = false;
+    }
+  }
+
   // sensor dimension
   nsensordata_ = 0;
   for (int i = 0; i < nsensor_; i++) {
@@ -168,6 +179,8 @@ void Direct::Initialize(const mjModel* model) {
   // residual
   residual_sensor_.resize(nsensor_max);
   residual_force_.resize(nvel_max);
+  residual_sensor_previous_.resize(nsensor_max);
+  residual_force_previous_.resize(nvel_max);
 
   // Jacobian
   jacobian_sensor_.resize(settings.assemble_sensor_jacobian * nsensor_max *
@@ -195,8 +208,12 @@ void Direct::Initialize(const mjModel* model) {
                                                  configuration_length_);
   block_sensor_next_configuration_.Initialize(nsensordata_ * nv,
                                               configuration_length_);
-  block_sensor_configurations_.Initialize(nsensordata_ * nband_,
-                                          configuration_length_);
+  float_blocks_ = settings.float_jacobian_blocks;
+  int nblock_float = float_blocks_ ? 1 : 0;
+  block_sensor_configurations_.Initialize(
+      (1 - nblock_float) * nsensordata_ * nband_, configuration_length_);
+  block_sensor_configurations_float_.Initialize(
+      nblock_float * nsensordata_ * nband_, configuration_length_);
 
   block_sensor_scratch_.Initialize(
       std::max(nv, nsensordata_) * std::max(nv, nsensordata_),
@@ -211,7 +228,16 @@ void Direct::Initialize(const mjModel* model) {
                                                  configuration_length_);
   block_force_current_configuration_.Initialize(nv * nv, configuration_length_);
   block_force_next_configuration_.Initialize(nv * nv, configuration_length_);
-  block_force_configurations_.Initialize(nv * nband_, configuration_length_);
+  block_force_configurations_.Initialize((1 - nblock_float) * nv * nband_,
+                                         configuration_length_);
+  block_force_configurations_float_.Initialize(nblock_float * nv * nband_,
+                                               configuration_length_);
+
+  // single-precision block conversion memory
+  block_store_.resize(nblock_float * std::max(nsensordata_, nv) * nband_ *
+                      std::max(pool_->NumThreads(), 1));
+  block_sensor_load_.resize(nblock_float * nsensordata_ * nband_);
+  block_force_load_.resize(nblock_float * nv * nband_);
 
   block_force_scratch_.Initialize(nv * nv, configuration_length_);
 
@@ -249,6 +275,8 @@ void Direct::Initialize(const mjModel* model) {
                        ntotal_max);
   cost_hessian_band_.resize(nvel_max * nband_ + nparam_ * ntotal_max);
   cost_hessian_band_factor_.resize(nvel_max * nband_ + nparam_ * ntotal_max);
+  cost_hessian_schur_.resize(nparam_ * nparam_);
+  scratch_schur_.resize(nparam_);
 
   // cost norms
   norm_type_sensor.resize(nsensor_);
@@ -272,6 +300,7 @@ void Direct::Initialize(const mjModel* model) {
 
   // norm
   norm_sensor_.resize(nsensor_ * max_history_);
+  norm_weight_sensor_.resize(nsensor_ * max_history_);
   norm_force_.resize(max_history_ - 1);
 
   // norm gradient
@@ -294,6 +323,7 @@ void Direct::Initialize(const mjModel* model) {
   scratch_force_.resize(12 * nv * nv + nparam_ * nband_ + nparam_ * nparam_ +
                         nv * nparam_);
   scratch_expected_.resize(ntotal_max);
+  scratch_broyden_.resize(std::max(nsensordata_, nv));
 
   // copy
   configuration_copy_.Initialize(nq, configuration_length_);
@@ -339,6 +369,10 @@ void Direct::Reset(const mjData* data) {
       GetNumberOrDefault(1.0e-4, model, "estimator_sensor_noise_scale");
   std::fill(noise_sensor.begin(), noise_sensor.end(), noise_sensor_scl);
 
+  // evaluations
+  predictions_current_ = derivatives_current_ = false;
+  reuse_predictions_ = reuse_derivatives_ = false;
+
   // trajectories
   configuration.Reset();
   velocity.Reset();
@@ -376,6 +410,10 @@ void Direct::Reset(const mjData* data) {
   // residual
   std::fill(residual_sensor_.begin(), residual_sensor_.end(), 0.0);
   std::fill(residual_force_.begin(), residual_force_.end(), 0.0);
+  std::fill(residual_sensor_previous_.begin(), residual_sensor_previous_.end(),
+            0.0);
+  std::fill(residual_force_previous_.begin(), residual_force_previous_.end(),
+            0.0);
 
   // Jacobian
   std::fill(jacobian_sensor_.begin(), jacobian_sensor_.end(), 0.0);
@@ -393,6 +431,7 @@ void Direct::Reset(const mjData* data) {
   block_sensor_current_configuration_.Reset();
   block_sensor_next_configuration_.Reset();
   block_sensor_configurations_.Reset();
+  block_sensor_configurations_float_.Reset();
 
   block_sensor_scratch_.Reset();
 
@@ -405,6 +444,7 @@ void Direct::Reset(const mjData* data) {
   block_force_current_configuration_.Reset();
   block_force_next_configuration_.Reset();
   block_force_configurations_.Reset();
+  block_force_configurations_float_.Reset();
 
   block_force_scratch_.Reset();
 
@@ -446,9 +486,12 @@ void Direct::Reset(const mjData* data) {
   std::fill(cost_hessian_band_.begin(), cost_hessian_band_.end(), 0.0);
   std::fill(cost_hessian_band_factor_.begin(), cost_hessian_band_factor_.end(),
             0.0);
+  std::fill(cost_hessian_schur_.begin(), cost_hessian_schur_.end(), 0.0);
+  std::fill(scratch_schur_.begin(), scratch_schur_.end(), 0.0);
 
   // norm
   std::fill(norm_sensor_.begin(), norm_sensor_.end(), 0.0);
+  std::fill(norm_weight_sensor_.begin(), norm_weight_sensor_.end(), 0.0);
   std::fill(norm_force_.begin(), norm_force_.end(), 0.0);
 
   // norm gradient
@@ -492,6 +535,7 @@ void Direct::Reset(const mjData* data) {
   // status
   iterations_smoother_ = 0;
   iterations_search_ = 0;
+  iterations_conjugate_gradient_ = 0;
   cost_count_ = 0;
   solve_status_ = kUnsolved;
 }
@@ -612,7 +656,276 @@ const double* Direct::GetNormHessianForce() {
   return norm_hessian_force_.data();
 }
 
+// compute and return block-sparse sensor Jacobian
+const SparseMatrix& Direct::GetJacobianSensorSparse() {
+  // dimensions
+  int nv = model->nv, ns = nsensordata_;
+  int T = configuration_length_;
+
+  // TODO
+  if (nparam_ > 0) {
+    mju_error("parameter Jacobians not implemented\n");
+  }
+
+  // blocks, same rows as GetJacobianSensor
+  jacobian_sensor_sparse_.Reset(ns * (T - 1), ntotal_);
+  for (int t = 0; t < T - 1; t++) {
+    BlockSensor(t);
+    if (t == 0) {
+      // only position sensors
+      jacobian_sensor_sparse_.AddRows(
+          block_sensor_configuration_.Get(t) + sensor_start_index_ * nv, ns,
+          nv, nv, 0);
+    } else {
+      jacobian_sensor_sparse_.AddRows(LoadSensorBlock(t), ns, nband_, nband_,
+                                      (t - 1) * nv);
+    }
+  }
+
+  return jacobian_sensor_sparse_;
+}
+
+// compute and return block-sparse force Jacobian
+const SparseMatrix& Direct::GetJacobianForceSparse() {
+  // dimensions
+  int nv = model->nv;
+  int T = configuration_length_;
+
+  // TODO
+  if (nparam_ > 0) {
+    mju_error("parameter Jacobians not implemented\n");
+  }
+
+  // blocks
+  jacobian_force_sparse_.Reset(nv * (T - 2), ntotal_);
+  for (int t = 1; t < T - 1; t++) {
+    BlockForce(t);
+    jacobian_force_sparse_.AddRows(LoadForceBlock(t), nv, nband_, nband_,
+                                   (t - 1) * nv);
+  }
+
+  return jacobian_force_sparse_;
+}
+
+// compute and return block-diagonal sensor norm Hessian
+const SparseMatrix& Direct::GetNormHessianSensorSparse() {
+  // dimensions
+  int ns = nsensordata_;
+  int T = configuration_length_;
+
+  // evaluate
+  CostSensor(NULL, NULL);
+
+  // weighted blocks per time step and sensor
+  norm_hessian_sensor_sparse_.Reset(ns * T, ns * T);
+  const double* norm_block = norm_blocks_sensor_.data();
+  for (int t = 0; t < T; t++) {
+    int row = ns * t;
+    for (int i = 0; i < nsensor_; i++) {
+      int nsi = model->sensor_dim[sensor_start_ + i];
+      double weight = norm_weight_sensor_[nsensor_ * t + i];
+      norm_hessian_sensor_sparse_.AddRows(norm_block, nsi, nsi, nsi, row,
+                                          weight);
+      norm_block += nsi * nsi;
+      row += nsi;
+    }
+  }
+
+  return norm_hessian_sensor_sparse_;
+}
+
+// compute and return diagonal force norm Hessian
+const SparseMatrix& Direct::GetNormHessianForceSparse() {
+  // dimensions
+  int nv = model->nv;
+  int nforcetotal = nv * (configuration_length_ - 2);
+
+  // evaluate
+  CostForce(NULL, NULL);
+
+  // diagonal of norm blocks
+  norm_hessian_force_sparse_.Reset(nforcetotal, nforcetotal);
+  for (int t = 1; t < configuration_length_ - 1; t++) {
+    const double* norm_block = norm_blocks_force_.data() + t * nv * nv;
+    for (int i = 0; i < nv; i++) {
+      norm_hessian_force_sparse_.AddRows(norm_block + i * nv + i, 1, 1, 1,
+                                         (t - 1) * nv + i);
+    }
+  }
+
+  return norm_hessian_force_sparse_;
+}
+
 // set configuration length
+namespace {
+
+// the first length elements of a trajectory, in time order
+template <typename T>
+void AddTrajectory(SnapshotWriter& writer, std::string_view name,
+                   const DirectTrajectory<T>& trajectory, int length) {
+  int dim = trajectory.Dimension();
+  std::vector<double> values(dim * length);
+  for (int t = 0; t < length; t++) {
+    const T* element = trajectory.Get(t);
+    for (int i = 0; i < dim; i++) values[t * dim + i] = element[i];
+  }
+  writer.Add(name, values);
+}
+
+// read the first length elements of a trajectory, checked by the caller
+template <typename T>
+void ReadTrajectory(const SnapshotReader& reader, std::string_view name,
+                    DirectTrajectory<T>& trajectory, int length) {
+  int dim = trajectory.Dimension();
+  std::vector<double> values(dim * length);
+  reader.Read(name, values.data(), dim * length);
+  trajectory.ResetHead();
+  for (int t = 0; t < length; t++) {
+    T* element = trajectory.Get(t);
+    for (int i = 0; i < dim; i++) {
+      element[i] = static_cast<T>(values[t * dim + i]);
+    }
+  }
+}
+
+// allocated bytes of trajectories
+template <typename... T>
+std::size_t TrajectoryBytes(const DirectTrajectory<T>&... trajectories) {
+  return (trajectories.Bytes() + ... + 0);
+}
+
+}  // namespace
+
+void Direct::Snapshot(SnapshotWriter& writer, std::string_view name) const {
+  int T = configuration_length_;
+  writer.Add(absl::StrCat(name, ".configuration_length"), T);
+  AddTrajectory(writer, absl::StrCat(name, ".configuration"), configuration,
+                T);
+  AddTrajectory(writer, absl::StrCat(name, ".configuration_previous"),
+                configuration_previous, T);
+  AddTrajectory(writer, absl::StrCat(name, ".act"), act, T);
+  AddTrajectory(writer, absl::StrCat(name, ".times"), times, T);
+  AddTrajectory(writer, absl::StrCat(name, ".sensor_measurement"),
+                sensor_measurement, T);
+  AddTrajectory(writer, absl::StrCat(name, ".sensor_mask"), sensor_mask, T);
+  AddTrajectory(writer, absl::StrCat(name, ".force_measurement"),
+                force_measurement, T);
+  writer.Add(absl::StrCat(name, ".parameters"), parameters.data(), nparam_);
+  writer.Add(absl::StrCat(name, ".parameters_previous"),
+             parameters_previous.data(), nparam_);
+}
+
+bool Direct::Restore(const SnapshotReader& reader, std::string_view name) {
+  int T = reader.Get(absl::StrCat(name, ".configuration_length"), -1);
+  if (T < kMinDirectHistory || T > max_history_) return false;
+
+  // check all sections before changing the window
+  struct Section {
+    std::string name;
+    int size;
+  };
+  const Section sections[] = {
+      {absl::StrCat(name, ".configuration"), configuration.Dimension() * T},
+      {absl::StrCat(name, ".configuration_previous"),
+       configuration_previous.Dimension() * T},
+      {absl::StrCat(name, ".act"), act.Dimension() * T},
+      {absl::StrCat(name, ".times"), times.Dimension() * T},
+      {absl::StrCat(name, ".sensor_measurement"),
+       sensor_measurement.Dimension() * T},
+      {absl::StrCat(name, ".sensor_mask"), sensor_mask.Dimension() * T},
+      {absl::StrCat(name, ".force_measurement"),
+       force_measurement.Dimension() * T},
+      {absl::StrCat(name, ".parameters"), nparam_},
+      {absl::StrCat(name, ".parameters_previous"), nparam_},
+  };
+  for (const Section& section : sections) {
+    if (reader.Size(section.name) != section.size) return false;
+  }
+
+  // invalidates evaluations of the previous window
+  SetConfigurationLength(T);
+  ReadTrajectory(reader, sections[0].name, configuration, T);
+  ReadTrajectory(reader, sections[1].name, configuration_previous, T);
+  ReadTrajectory(reader, sections[2].name, act, T);
+  ReadTrajectory(reader, sections[3].name, times, T);
+  ReadTrajectory(reader, sections[4].name, sensor_measurement, T);
+  ReadTrajectory(reader, sections[5].name, sensor_mask, T);
+  ReadTrajectory(reader, sections[6].name, force_measurement, T);
+  reader.Read(sections[7].name, parameters.data(), nparam_);
+  reader.Read(sections[8].name, parameters_previous.data(), nparam_);
+  return true;
+}
+
+void Direct::ReportMemory(MemoryReport& report) const {
+  report.Add("trajectories",
+             TrajectoryBytes(configuration, configuration_previous, velocity,
+                             acceleration, act, times, sensor_measurement,
+                             sensor_prediction, sensor_mask, force_measurement,
+                             force_prediction, configuration_copy_));
+  report.Add("residuals",
+             VectorBytes(noise_process, noise_sensor, parameters,
+                         parameters_previous, noise_parameter, norm_type_sensor,
+                         norm_parameters_sensor, parameters_perturb_,
+                         residual_sensor_, residual_force_,
+                         residual_sensor_previous_, residual_force_previous_,
+                         parameters_copy_));
+  report.Add("jacobians", VectorBytes(jacobian_sensor_, jacobian_force_,
+                                      block_store_, block_sensor_load_,
+                                      block_force_load_));
+  report.Add("jacobian_blocks",
+             TrajectoryBytes(block_sensor_configuration_,
+                             block_sensor_velocity_, block_sensor_acceleration_,
+                             block_sensor_configurationT_,
+                             block_sensor_velocityT_,
+                             block_sensor_accelerationT_,
+                             block_sensor_previous_configuration_,
+                             block_sensor_current_configuration_,
+                             block_sensor_next_configuration_,
+                             block_sensor_configurations_,
+                             block_sensor_configurations_float_,
+                             block_sensor_scratch_, block_force_configuration_,
+                             block_force_velocity_, block_force_acceleration_,
+                             block_force_previous_configuration_,
+                             block_force_current_configuration_,
+                             block_force_next_configuration_,
+                             block_force_configurations_,
+                             block_force_configurations_float_,
+                             block_force_scratch_, block_sensor_parameters_,
+                             block_sensor_parametersT_, block_force_parameters_,
+                             block_velocity_previous_configuration_,
+                             block_velocity_current_configuration_,
+                             block_acceleration_previous_configuration_,
+                             block_acceleration_current_configuration_,
+                             block_acceleration_next_configuration_));
+  report.Add("norms", VectorBytes(norm_sensor_, norm_force_,
+                                  norm_gradient_sensor_, norm_gradient_force_,
+                                  norm_hessian_sensor_, norm_hessian_force_,
+                                  norm_blocks_sensor_, norm_blocks_force_,
+                                  norm_weight_sensor_));
+  report.Add("cost_hessian",
+             VectorBytes(cost_gradient_sensor_, cost_gradient_force_,
+                         cost_gradient_, cost_hessian_sensor_band_,
+                         cost_hessian_force_band_, cost_hessian_,
+                         cost_hessian_band_, cost_hessian_band_factor_,
+                         cost_hessian_schur_, product_sensor_, product_force_,
+                         preconditioner_, preconditioner_factor_, cost_tile_,
+                         search_direction_, dense_force_parameter_,
+                         dense_sensor_parameter_, dense_parameter_));
+  report.Add("scratch", VectorBytes(data_perturb_, overlay_perturb_, data_,
+                                    scratch_schur_, scratch_product_,
+                                    scratch_conjugate_gradient_, scratch_fused_,
+                                    scratch_sensor_, scratch_force_,
+                                    step_futures_, scratch_expected_,
+                                    scratch_broyden_));
+  std::size_t data = 0;
+  for (const UniqueMjData& d : data_) data += MjDataBytes(d.get());
+  for (const UniqueMjData& d : data_perturb_) data += MjDataBytes(d.get());
+  report.Add("data", data);
+  std::size_t models = 0;
+  for (const auto& m : model_perturb_) models += m->MutableSize();
+  report.Add("perturbed_models", models);
+}
+
 void Direct::SetConfigurationLength(int length) {
   // check length
   if (length > max_history_) {
@@ -624,6 +937,10 @@ void Direct::SetConfigurationLength(int length) {
   nvel_ = model->nv * configuration_length_;
   ntotal_ = nvel_ + nparam_;
 
+  // evaluations no longer correspond to trajectories
+  predictions_current_ = derivatives_current_ = false;
+  reuse_predictions_ = reuse_derivatives_ = false;
+
   // update trajectory lengths
   configuration.SetLength(configuration_length_);
   configuration_copy_.SetLength(configuration_length_);
@@ -653,6 +970,7 @@ void Direct::SetConfigurationLength(int length) {
   block_sensor_current_configuration_.SetLength(configuration_length_);
   block_sensor_next_configuration_.SetLength(configuration_length_);
   block_sensor_configurations_.SetLength(configuration_length_);
+  block_sensor_configurations_float_.SetLength(configuration_length_);
 
   block_sensor_scratch_.SetLength(configuration_length_);
 
@@ -668,6 +986,7 @@ void Direct::SetConfigurationLength(int length) {
   block_force_current_configuration_.SetLength(configuration_length_);
   block_force_next_configuration_.SetLength(configuration_length_);
   block_force_configurations_.SetLength(configuration_length_);
+  block_force_configurations_float_.SetLength(configuration_length_);
 
   block_force_scratch_.SetLength(configuration_length_);
 
@@ -679,6 +998,118 @@ void Direct::SetConfigurationLength(int length) {
   block_acceleration_next_configuration_.SetLength(configuration_length_);
 }
 
+// shift trajectory heads
+void Direct::ShiftTrajectories(int shift) {
+  // retained interior evaluations are valid for a single step shift without
+  // parameters or dense Jacobians
+  bool reuse = shift == 1 && nparam_ == 0 &&
+               !settings.assemble_sensor_jacobian &&
+               !settings.assemble_force_jacobian;
+  reuse_predictions_ = reuse && predictions_current_;
+  reuse_derivatives_ = reuse && derivatives_current_;
+  predictions_current_ = derivatives_current_ = false;
+
+  // shift
+  configuration.Shift(shift);
+  configuration_copy_.Shift(shift);
+
+  velocity.Shift(shift);
+  acceleration.Shift(shift);
+  act.Shift(shift);
+  times.Shift(shift);
+
+  configuration_previous.Shift(shift);
+
+  sensor_measurement.Shift(shift);
+  sensor_prediction.Shift(shift);
+  sensor_mask.Shift(shift);
+
+  force_measurement.Shift(shift);
+  force_prediction.Shift(shift);
+
+  block_sensor_configuration_.Shift(shift);
+  block_sensor_velocity_.Shift(shift);
+  block_sensor_acceleration_.Shift(shift);
+  block_sensor_configurationT_.Shift(shift);
+  block_sensor_velocityT_.Shift(shift);
+  block_sensor_accelerationT_.Shift(shift);
+
+  block_sensor_previous_configuration_.Shift(shift);
+  block_sensor_current_configuration_.Shift(shift);
+  block_sensor_next_configuration_.Shift(shift);
+  block_sensor_configurations_.Shift(shift);
+  block_sensor_configurations_float_.Shift(shift);
+
+  block_sensor_scratch_.Shift(shift);
+
+  block_sensor_parameters_.Shift(shift);
+  block_sensor_parametersT_.Shift(shift);
+  block_force_parameters_.Shift(shift);
+
+  block_force_configuration_.Shift(shift);
+  block_force_velocity_.Shift(shift);
+  block_force_acceleration_.Shift(shift);
+
+  block_force_previous_configuration_.Shift(shift);
+  block_force_current_configuration_.Shift(shift);
+  block_force_next_configuration_.Shift(shift);
+  block_force_configurations_.Shift(shift);
+  block_force_configurations_float_.Shift(shift);
+
+  block_force_scratch_.Shift(shift);
+
+  block_velocity_previous_configuration_.Shift(shift);
+  block_velocity_current_configuration_.Shift(shift);
+
+  block_acceleration_previous_configuration_.Shift(shift);
+  block_acceleration_current_configuration_.Shift(shift);
+  block_acceleration_next_configuration_.Shift(shift);
+}
+
+// append measurement sample
+void Direct::Append(const double* ctrl, const double* sensor, double time) {
+  // dimensions
+  int na = model->na, nu = model->nu;
+
+  // shift window, last time step becomes available
+  ShiftTrajectories(1);
+
+  // data
+  mjData* d = data_[0].get();
+
+  // current time index
+  int t = configuration_length_ - 2;
+
+  // configurations
+  const double* q0 = configuration.Get(t - 1);
+  const double* q1 = configuration.Get(t);
+
+  // set state
+  mju_copy(d->qpos, q1, model->nq);
+  mj_differentiatePos(model, d->qvel, model->opt.timestep, q0, q1);
+  mju_copy(d->act, act.Get(t), na);
+  d->time = time;
+
+  // set ctrl
+  mju_copy(d->ctrl, ctrl, nu);
+
+  // forward step
+  mj_step(model, d);
+
+  // set measurements at current time
+  times.Set(&time, t);
+  sensor_measurement.Set(sensor, t);
+  force_measurement.Set(d->qfrc_actuator, t);
+
+  // set predicted configuration at next time
+  configuration.Set(d->qpos, t + 1);
+  configuration_previous.Set(d->qpos, t + 1);
+  times.Set(&d->time, t + 1);
+
+  // sensor mask carries over
+  sensor_mask.Set(sensor_mask.Get(t), t + 1);
+}
+
 // evaluate configurations
 void Direct::ConfigurationEvaluation() {
   // finite-difference velocities, accelerations
@@ -689,7 +1120,7 @@ void Direct::ConfigurationEvaluation() {
 }
 
 // configurations derivatives
-void Direct::ConfigurationDerivative() {
+void Direct::ConfigurationDerivative(bool blocks) {
   // dimension
   int nv = model->nv;
   int nsen = nsensordata_ * configuration_length_;
@@ -699,50 +1130,92 @@ void Direct::ConfigurationDerivative() {
   int opsensor = settings.sensor_flag * configuration_length_;
   int opforce = settings.force_flag * (configuration_length_ - 2);
 
-  // inverse dynamics derivatives
-  InverseDynamicsDerivatives();
+  // single-precision block conversion memory per worker
+  if (float_blocks_) {
+    block_store_.resize(std::max(nsensordata_, nv) * nband_ *
+                        std::max(pool_->NumThreads(), 1));
+  }
 
-  // velocity, acceleration derivatives
+  // velocity, acceleration derivatives, only depend on configurations
   VelocityAccelerationDerivatives();
 
-  // -- Jacobians -- //
-  auto timer_jacobian_start = std::chrono::steady_clock::now();
-
-  // pool count
-  int count_begin = pool_.GetCount();
+  // blocks evaluated with cost (fused)
+  if (!blocks) {
+    InverseDynamicsDerivatives();
+    derivatives_current_ = true;
+    return;
+  }
 
-  // individual derivatives
-  if (settings.sensor_flag) {
-    if (settings.assemble_sensor_jacobian)
-      mju_zero(jacobian_sensor_.data(), nsen * ntotal_);
-    JacobianSensor();
+  // -- inverse dynamics derivatives and Jacobians -- //
+  TraceSpan span("Direct::InverseDynamicsDerivatives");
+  if (settings.sensor_flag && settings.assemble_sensor_jacobian) {
+    mju_zero(jacobian_sensor_.data(), nsen * ntotal_);
   }
-  if (settings.force_flag) {
-    if (settings.assemble_force_jacobian)
-      mju_zero(jacobian_force_.data(), nforce * ntotal_);
-    JacobianForce();
+  if (settings.force_flag && settings.assemble_force_jacobian) {
+    mju_zero(jacobian_force_.data(), nforce * ntotal_);
   }
 
-  // wait
-  pool_.WaitCount(count_begin + opsensor + opforce);
+  // set parameters
+  if (nparam_ > 0) {
+    model_parameters_[model_parameters_id_]->Set(model, parameters.data(),
+                                                 nparam_);
+  }
 
-  // reset count
-  pool_.ResetCount();
+  // graph of time steps: the sensor and force blocks of a time step start
+  // when its own inverse dynamics derivatives are done, instead of after
+  // those of the slowest time step. skip retained interior time steps.
+  step_futures_.clear();
+  int T = configuration_length_;
+  for (int t = 0; t < T; t++) {
+    if (reuse_derivatives_ && t > 0 && t < T - 2) continue;
+    TaskFuture derivatives = pool_->Async(
+        [this, t]() { InverseDynamicsDerivativesStep(t); }, pool_priority_);
+    step_futures_.push_back(derivatives);
+    if (settings.sensor_flag) {
+      step_futures_.push_back(derivatives.Then(
+          [this, t]() {
+            TraceSpan jacobian_sensor_span("Direct::jacobian_sensor");
+            BlockSensor(t);
+            timer_.sensor_step[t] = jacobian_sensor_span.End();
+          },
+          pool_priority_));
+    }
+    if (settings.force_flag && t > 0 && t < T - 1) {
+      step_futures_.push_back(derivatives.Then(
+          [this, t]() {
+            TraceSpan jacobian_force_span("Direct::jacobian_force");
+            BlockForce(t);
+            timer_.force_step[t] = jacobian_force_span.End();
+          },
+          pool_priority_));
+    }
+  }
+  pool_->WhenAll(step_futures_).Wait();
+  step_futures_.clear();
+
+  // parameters
+  if (nparam_ > 0) {
+    ParameterJacobian();
+  }
 
-  // timers
-  timer_.jacobian_sensor += mju_sum(timer_.sensor_step.data(), opsensor);
-  timer_.jacobian_force += mju_sum(timer_.force_step.data(), opforce);
-  timer_.jacobian_total += GetDuration(timer_jacobian_start);
+  // derivatives correspond to configuration
+  derivatives_current_ = true;
+  reuse_derivatives_ = false;
+
+  // timers, the blocks overlap with the inverse dynamics derivatives whose
+  // timer includes them
+  double jacobian_sensor = mju_sum(timer_.sensor_step.data(), opsensor);
+  double jacobian_force = mju_sum(timer_.force_step.data(), opforce);
+  timer_.jacobian_sensor += jacobian_sensor;
+  timer_.jacobian_force += jacobian_force;
+  timer_.jacobian_total += jacobian_sensor + jacobian_force;
+  timer_.inverse_dynamics_derivatives += span.End();
 }
 
 // sensor cost
 double Direct::CostSensor(double* gradient, double* hessian) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
-
-  // update dimension
-  int nv = model->nv, ns = nsensordata_;
-  int nsen = ns * configuration_length_;
+  TraceSpan span("Direct::CostSensor");
 
   // residual
   if (!cost_skip_) ResidualSensor();
@@ -757,6 +1230,35 @@ double Direct::CostSensor(double* gradient, double* hessian) {
   if (hessian) mju_zero(hessian, nvel_ * nband_ + nparam_ * ntotal_);
   if (nparam_ > 0) mju_zero(dense_sensor_parameter_.data(), nparam_ * ntotal_);
 
+  // loop over predictions
+  for (int t = 0; t < configuration_length_; t++) {
+    cost += CostSensorStep(t, gradient, hessian, scratch_sensor_.data(),
+                           nullptr, &timer_.cost_sensor);
+  }
+
+  // set dense rows in band matrix
+  if (hessian && nparam_ > 0) {
+    mju_copy(hessian + nvel_ * nband_, dense_sensor_parameter_.data(),
+             nparam_ * ntotal_);
+  }
+
+  // stop timer
+  timer_.cost_sensor_derivatives += span.End();
+
+  return cost;
+}
+
+// sensor cost at time step
+double Direct::CostSensorStep(int t, double* gradient, double* hessian,
+                              double* scratch, double* block_buffer,
+                              double* timer) {
+  // update dimension
+  int nv = model->nv, ns = nsensordata_;
+  int nsen = ns * configuration_length_;
+
+  // initialize
+  double cost = 0.0;
+
   // time scaling
   double time_scale = 1.0;
   double time_scale2 = 1.0;
@@ -765,267 +1267,277 @@ double Direct::CostSensor(double* gradient, double* hessian) {
     time_scale2 = time_scale * time_scale;
   }
 
-  // matrix shift
+  // matrix shift: norm blocks of previous time steps
   int shift_matrix = 0;
+  for (int i = 0; i < nsensor_; i++) {
+    int nsi = model->sensor_dim[sensor_start_ + i];
+    shift_matrix += t * nsi * nsi;
+  }
 
-  // loop over predictions
-  for (int t = 0; t < configuration_length_; t++) {
-    // residual
-    double* rt = residual_sensor_.data() + ns * t;
-
-    // mask
-    int* mask = sensor_mask.Get(t);
-
-    // unpack block
-    double* block;
-    int block_columns;
-    if (t == 0) {  // only position sensors
-      block = block_sensor_configuration_.Get(t) + sensor_start_index_ * nv;
-      block_columns = nband_ - 2 * nv;
-    } else if (t == configuration_length_ - 1) {
-      block = block_sensor_configurations_.Get(t);
-      block_columns = nband_ - nv;
-    } else {  // position, velocity, acceleration sensors
-      block = block_sensor_configurations_.Get(t);
-      block_columns = nband_;
-    }
-
-    // shift
-    int shift_sensor = 0;
-
-    // loop over sensors
-    for (int i = 0; i < nsensor_; i++) {
-      // start cost timer
-      auto start_cost = std::chrono::steady_clock::now();
+  // residual
+  double* rt = residual_sensor_.data() + ns * t;
+
+  // mask
+  int* mask = sensor_mask.Get(t);
+
+  // unpack block
+  const double* block = nullptr;
+  int block_columns = nband_;
+  if (t == 0) {  // only position sensors
+    block = block_sensor_configuration_.Get(t) + sensor_start_index_ * nv;
+    block_columns = nband_ - 2 * nv;
+  } else if (gradient || hessian) {
+    block = LoadSensorBlock(t, block_buffer);
+    if (t == configuration_length_ - 1) block_columns = nband_ - nv;
+  }
 
-      // sensor stage
-      int sensor_stage = model->sensor_needstage[sensor_start_ + i];
+  // shift
+  int shift_sensor = 0;
 
-      // time scaling weight
-      double time_weight = 1.0;
-      if (sensor_stage == mjSTAGE_VEL) {
-        time_weight = time_scale;
-      } else if (sensor_stage == mjSTAGE_ACC) {
-        time_weight = time_scale2;
-      }
+  // loop over sensors
+  for (int i = 0; i < nsensor_; i++) {
+    // start cost timer
+    TraceSpan span_cost("Direct::CostSensorStep");
 
-      // dimension
-      int nsi = model->sensor_dim[sensor_start_ + i];
+    // sensor stage
+    int sensor_stage = model->sensor_needstage[sensor_start_ + i];
 
-      // sensor residual
-      double* rti = rt + shift_sensor;
+    // time scaling weight
+    double time_weight = 1.0;
+    if (sensor_stage == mjSTAGE_VEL) {
+      time_weight = time_scale;
+    } else if (sensor_stage == mjSTAGE_ACC) {
+      time_weight = time_scale2;
+    }
 
-      // weight
-      double weight =
-          mask[i] ? time_weight / noise_sensor[i] / nsi / configuration_length_
-                  : 0.0;
+    // dimension
+    int nsi = model->sensor_dim[sensor_start_ + i];
 
-      // first time step
-      if (t == 0) weight *= settings.first_step_position_sensors;
+    // sensor residual
+    double* rti = rt + shift_sensor;
 
-      // last time step
-      if (t == configuration_length_ - 1)
-        weight *= (settings.last_step_position_sensors ||
-                   settings.last_step_velocity_sensors);
+    // weight
+    double weight =
+        mask[i] ? time_weight / noise_sensor[i] / nsi / configuration_length_
+                : 0.0;
 
-      // parameters
-      double* pi = norm_parameters_sensor.data() + kMaxNormParameters * i;
+    // first time step
+    if (t == 0) weight *= settings.first_step_position_sensors;
 
-      // norm
-      NormType normi = norm_type_sensor[i];
+    // last time step
+    if (t == configuration_length_ - 1)
+      weight *= (settings.last_step_position_sensors ||
+                 settings.last_step_velocity_sensors);
 
-      // norm gradient
-      double* norm_gradient =
-          norm_gradient_sensor_.data() + ns * t + shift_sensor;
+    // parameters
+    double* pi = norm_parameters_sensor.data() + kMaxNormParameters * i;
 
-      // norm Hessian
-      double* norm_block = norm_blocks_sensor_.data() + shift_matrix;
+    // norm
+    NormType normi = norm_type_sensor[i];
 
-      // ----- cost ----- //
+    // norm gradient
+    double* norm_gradient =
+        norm_gradient_sensor_.data() + ns * t + shift_sensor;
+
+    // norm Hessian
+    double* norm_block = norm_blocks_sensor_.data() + shift_matrix;
+
+    // masked sensors have no cost, skip their gradient and Hessian blocks
+    if (weight == 0.0) {
+      norm_sensor_[nsensor_ * t + i] = Norm(NULL, NULL, rti, pi, nsi, normi);
+      norm_weight_sensor_[nsensor_ * t + i] = 0.0;
+      if (gradient) mju_zero(norm_gradient, nsi);
+      if (hessian || hessian_skip_) mju_zero(norm_block, nsi * nsi);
+      if (settings.assemble_sensor_norm_hessian && i == 0 && t == 0) {
+        mju_zero(norm_hessian_sensor_.data(), nsen * nsen);
+      }
+      if (timer) *timer += span_cost.End();
+      shift_sensor += nsi;
+      shift_matrix += nsi * nsi;
+      continue;
+    }
 
-      // norm
-      norm_sensor_[nsensor_ * t + i] =
-          Norm(gradient ? norm_gradient : NULL, hessian ? norm_block : NULL,
-               rti, pi, nsi, normi);
+    // ----- cost ----- //
 
-      // weighted norm
-      cost += weight * norm_sensor_[nsensor_ * t + i];
+    // norm
+    norm_sensor_[nsensor_ * t + i] = Norm(
+        gradient ? norm_gradient : NULL,
+        hessian || hessian_skip_ ? norm_block : NULL, rti, pi, nsi, normi);
 
-      // stop cost timer
-      timer_.cost_sensor += GetDuration(start_cost);
+    // weighted norm
+    norm_weight_sensor_[nsensor_ * t + i] = weight;
+    cost += weight * norm_sensor_[nsensor_ * t + i];
 
-      // assemble dense norm Hessian
-      if (settings.assemble_sensor_norm_hessian) {
-        // reset memory
-        if (i == 0 && t == 0)
-          mju_zero(norm_hessian_sensor_.data(), nsen * nsen);
+    // stop cost timer
+    if (timer) *timer += span_cost.End();
 
-        // set norm block
-        SetBlockInMatrix(norm_hessian_sensor_.data(), norm_block, weight, nsen,
-                         nsen, nsi, nsi, ns * t + shift_sensor,
-                         ns * t + shift_sensor);
-      }
+    // assemble dense norm Hessian
+    if (settings.assemble_sensor_norm_hessian) {
+      // reset memory
+      if (i == 0 && t == 0)
+        mju_zero(norm_hessian_sensor_.data(), nsen * nsen);
+
+      // set norm block
+      SetBlockInMatrix(norm_hessian_sensor_.data(), norm_block, weight, nsen,
+                       nsen, nsi, nsi, ns * t + shift_sensor,
+                       ns * t + shift_sensor);
+    }
 
-      // gradient wrt configuration: dsidq012' * dndsi
-      if (gradient) {
-        // sensor block
-        double* blocki = block + block_columns * shift_sensor;
-
-        // scratch = dsidq012' * dndsi
-        mju_mulMatTVec(scratch_sensor_.data(), blocki, norm_gradient, nsi,
-                       block_columns);
-
-        // add
-        mju_addToScl(gradient + nv * std::max(0, t - 1), scratch_sensor_.data(),
-                     weight, block_columns);
-
-        // parameters
-        if (nparam_ > 0) {
-          // tmp = dsidp' dndsi
-          double* dsidp = block_sensor_parameters_.Get(t) +
-                          (sensor_start_index_ + shift_sensor) * nparam_;
-          mju_mulMatTVec(scratch_sensor_.data(), dsidp, norm_gradient, nsi,
-                         nparam_);
-          mju_addToScl(gradient + nvel_, scratch_sensor_.data(), weight,
+    // gradient wrt configuration: dsidq012' * dndsi
+    if (gradient) {
+      // sensor block
+      const double* blocki = block + block_columns * shift_sensor;
+
+      // scratch = dsidq012' * dndsi
+      mju_mulMatTVec(scratch, blocki, norm_gradient, nsi,
+                     block_columns);
+
+      // add
+      mju_addToScl(gradient + nv * std::max(0, t - 1), scratch,
+                   weight, block_columns);
+
+      // parameters
+      if (nparam_ > 0) {
+        // tmp = dsidp' dndsi
+        double* dsidp = block_sensor_parameters_.Get(t) +
+                        (sensor_start_index_ + shift_sensor) * nparam_;
+        mju_mulMatTVec(scratch, dsidp, norm_gradient, nsi,
                        nparam_);
-        }
+        mju_addToScl(gradient + nvel_, scratch, weight,
+                     nparam_);
       }
+    }
 
-      // Hessian (Gauss-Newton): dsidq012' * d2ndsi2 * dsidq
-      if (hessian) {
-        // sensor block
-        double* blocki = block + block_columns * shift_sensor;
-
-        // step 1: tmp0 = d2ndsi2 * dsidq
-        double* tmp0 = scratch_sensor_.data();
-        mju_mulMatMat(tmp0, norm_block, blocki, nsi, nsi, block_columns);
-
-        // step 2: hessian = dsidq' * tmp
-        double* tmp1 = scratch_sensor_.data() + nsensordata_ * nband_;
-        mju_mulMatTMat(tmp1, blocki, tmp0, nsi, block_columns, block_columns);
-
-        // set block in band Hessian
-        SetBlockInBand(hessian, tmp1, weight, ntotal_, nband_, block_columns,
-                       nv * std::max(0, t - 1));
-
-        // parameters
-        if (nparam_ > 0) {
-          // parameter Jacobian
-          double* dsidp = block_sensor_parameters_.Get(t) +
-                          (sensor_start_index_ + shift_sensor) * nparam_;
-
-          // step 1: tmp2 = dsidp' * d2ndsi2
-          double* tmp2 = scratch_sensor_.data();
-          mju_mulMatTMat(tmp2, dsidp, norm_block, nsi, nparam_, nsi);
-
-          // step 2: tmp3 = tmp2 * dsidp = dsidp' d2ndsi2 dsidp
-          double* tmp3 = tmp2 + nparam_ * nsi;
-          mju_mulMatMat(tmp3, tmp2, dsidp, nparam_, nsi, nparam_);
-
-          // add dsidp' d2ndsi2 dsidp in dense rows
-          AddBlockInMatrix(dense_sensor_parameter_.data(), tmp3, weight,
-                           nparam_, ntotal_, nparam_, nparam_, 0, nvel_);
-
-          // step 3: tmp4 = dsidp' * d2ndsi2 * dsidq012
-          double* tmp4 = tmp3 + nparam_ * nparam_;
-          mju_mulMatTMat(tmp4, dsidp, block, nsi, nparam_, block_columns);
-
-          // add dsidp' * d2ndsi2 * dsidq012 in dense rows
-          AddBlockInMatrix(dense_sensor_parameter_.data(), tmp4, weight,
-                           nparam_, ntotal_, nparam_, block_columns, 0,
-                           nv * std::max(0, t - 1));
-        }
-      }
+    // Hessian (Gauss-Newton): dsidq012' * d2ndsi2 * dsidq
+    if (hessian) {
+      // sensor block
+      const double* blocki = block + block_columns * shift_sensor;
 
-      // shift by individual sensor dimension
-      shift_sensor += nsi;
-      shift_matrix += nsi * nsi;
+      // step 1: tmp0 = d2ndsi2 * dsidq
+      double* tmp0 = scratch;
+      mju_mulMatMat(tmp0, norm_block, blocki, nsi, nsi, block_columns);
+
+      // step 2: hessian = dsidq' * tmp
+      double* tmp1 = scratch + nsensordata_ * nband_;
+      mju_mulMatTMat(tmp1, blocki, tmp0, nsi, block_columns, block_columns);
+
+      // set block in band Hessian
+      SetBlockInBand(hessian, tmp1, weight, ntotal_, nband_, block_columns,
+                     nv * std::max(0, t - 1));
+
+      // parameters
+      if (nparam_ > 0) {
+        // parameter Jacobian
+        double* dsidp = block_sensor_parameters_.Get(t) +
+                        (sensor_start_index_ + shift_sensor) * nparam_;
+
+        // step 1: tmp2 = dsidp' * d2ndsi2
+        double* tmp2 = scratch;
+        mju_mulMatTMat(tmp2, dsidp, norm_block, nsi, nparam_, nsi);
+
+        // step 2: tmp3 = tmp2 * dsidp = dsidp' d2ndsi2 dsidp
+        double* tmp3 = tmp2 + nparam_ * nsi;
+        mju_mulMatMat(tmp3, tmp2, dsidp, nparam_, nsi, nparam_);
+
+        // add dsidp' d2ndsi2 dsidp in dense rows
+        AddBlockInMatrix(dense_sensor_parameter_.data(), tmp3, weight,
+                         nparam_, ntotal_, nparam_, nparam_, 0, nvel_);
+
+        // step 3: tmp4 = dsidp' * d2ndsi2 * dsidq012
+        double* tmp4 = tmp3 + nparam_ * nparam_;
+        mju_mulMatTMat(tmp4, dsidp, block, nsi, nparam_, block_columns);
+
+        // add dsidp' * d2ndsi2 * dsidq012 in dense rows
+        AddBlockInMatrix(dense_sensor_parameter_.data(), tmp4, weight,
+                         nparam_, ntotal_, nparam_, block_columns, 0,
+                         nv * std::max(0, t - 1));
+      }
     }
-  }
 
-  // set dense rows in band matrix
-  if (hessian && nparam_ > 0) {
-    mju_copy(hessian + nvel_ * nband_, dense_sensor_parameter_.data(),
-             nparam_ * ntotal_);
+    // shift by individual sensor dimension
+    shift_sensor += nsi;
+    shift_matrix += nsi * nsi;
   }
 
-  // stop timer
-  timer_.cost_sensor_derivatives += GetDuration(start);
-
   return cost;
 }
 
 // sensor residual
 void Direct::ResidualSensor() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::ResidualSensor");
 
   // loop over predictions
   for (int t = 0; t < configuration_length_; t++) {
-    // terms
-    double* rt = residual_sensor_.data() + t * nsensordata_;
-    double* yt_sensor = sensor_measurement.Get(t);
-    double* yt_model = sensor_prediction.Get(t);
+    ResidualSensorStep(t);
+  }
 
-    // sensor difference
-    mju_sub(rt, yt_model, yt_sensor, nsensordata_);
+  // stop timer
+  timer_.residual_sensor += span.End();
+}
 
-    // zero out non-position sensors at first time step
-    if (t == 0) {
-      // loop over position sensors
-      for (int i = 0; i < nsensor_; i++) {
-        // sensor stage
-        int sensor_stage = model->sensor_needstage[sensor_start_ + i];
+// sensor residual at time step
+void Direct::ResidualSensorStep(int t) {
+  // terms
+  double* rt = residual_sensor_.data() + t * nsensordata_;
+  double* yt_sensor = sensor_measurement.Get(t);
+  double* yt_model = sensor_prediction.Get(t);
 
-        // check for position
-        if (sensor_stage == mjSTAGE_POS) continue;
+  // sensor difference
+  mju_sub(rt, yt_model, yt_sensor, nsensordata_);
 
-        // -- zero memory -- //
-        // dimension
-        int sensor_dim = model->sensor_dim[sensor_start_ + i];
+  // zero out non-position sensors at first time step
+  if (t == 0) {
+    // loop over position sensors
+    for (int i = 0; i < nsensor_; i++) {
+      // sensor stage
+      int sensor_stage = model->sensor_needstage[sensor_start_ + i];
 
-        // address
-        int sensor_adr = model->sensor_adr[sensor_start_ + i];
+      // check for position
+      if (sensor_stage == mjSTAGE_POS) continue;
 
-        // copy sensor data
-        mju_zero(rt + sensor_adr - sensor_start_index_, sensor_dim);
-      }
+      // -- zero memory -- //
+      // dimension
+      int sensor_dim = model->sensor_dim[sensor_start_ + i];
+
+      // address
+      int sensor_adr = model->sensor_adr[sensor_start_ + i];
+
+      // copy sensor data
+      mju_zero(rt + sensor_adr - sensor_start_index_, sensor_dim);
     }
+  }
 
-    // zero out acceleration sensors at last time step
-    if (t == configuration_length_ - 1) {
-      // loop over position sensors
-      for (int i = 0; i < nsensor_; i++) {
-        // sensor stage
-        int sensor_stage = model->sensor_needstage[sensor_start_ + i];
+  // zero out acceleration sensors at last time step
+  if (t == configuration_length_ - 1) {
+    // loop over position sensors
+    for (int i = 0; i < nsensor_; i++) {
+      // sensor stage
+      int sensor_stage = model->sensor_needstage[sensor_start_ + i];
 
-        // check for position
-        if (sensor_stage == mjSTAGE_POS &&
-            settings.last_step_position_sensors) {
-          continue;
-        }
+      // check for position
+      if (sensor_stage == mjSTAGE_POS &&
+          settings.last_step_position_sensors) {
+        continue;
+      }
 
-        // check for velocity
-        if (sensor_stage == mjSTAGE_VEL &&
-            settings.last_step_velocity_sensors) {
-          continue;
-        }
+      // check for velocity
+      if (sensor_stage == mjSTAGE_VEL &&
+          settings.last_step_velocity_sensors) {
+        continue;
+      }
 
-        // -- zero memory -- //
-        // dimension
-        int sensor_dim = model->sensor_dim[sensor_start_ + i];
+      // -- zero memory -- //
+      // dimension
+      int sensor_dim = model->sensor_dim[sensor_start_ + i];
 
-        // address
-        int sensor_adr = model->sensor_adr[sensor_start_ + i];
+      // address
+      int sensor_adr = model->sensor_adr[sensor_start_ + i];
 
-        // copy sensor data
-        mju_zero(rt + sensor_adr - sensor_start_index_, sensor_dim);
-      }
+      // copy sensor data
+      mju_zero(rt + sensor_adr - sensor_start_index_, sensor_dim);
     }
   }
-
-  // stop timer
-  timer_.residual_sensor += GetDuration(start);
 }
 
 // sensor Jacobian blocks (dsdq0, dsdq1, dsdq2)
@@ -1042,10 +1554,11 @@ void Direct::BlockSensor(int index) {
     double* block = block_sensor_configuration_.Get(0) + shift;
 
     // unpack
-    double* dsdq012 = block_sensor_configurations_.Get(0);
+    double* dsdq012 = SensorBlock(0);
 
     // set dsdq1
     SetBlockInMatrix(dsdq012, block, 1.0, ns, nband_, ns, nv, 0, nv);
+    StoreSensorBlock(0, dsdq012);
 
     // set block in dense Jacobian
     if (settings.assemble_sensor_jacobian) {
@@ -1089,13 +1602,14 @@ void Direct::BlockSensor(int index) {
     // -- assemble dsdq01 block -- //
 
     // unpack
-    double* dsdq01 = block_sensor_configurations_.Get(index);
+    double* dsdq01 = SensorBlock(index);
 
     // set dfdq0
     SetBlockInMatrix(dsdq01, dsdq0, 1.0, ns, 2 * nv, ns, nv, 0, 0 * nv);
 
     // set dfdq1
     SetBlockInMatrix(dsdq01, dsdq1, 1.0, ns, 2 * nv, ns, nv, 0, 1 * nv);
+    StoreSensorBlock(index, dsdq01);
 
     // assemble dense Jacobian
     if (settings.assemble_sensor_jacobian) {
@@ -1163,7 +1677,7 @@ void Direct::BlockSensor(int index) {
   // -- assemble dsdq012 block -- //
 
   // unpack
-  double* dsdq012 = block_sensor_configurations_.Get(index);
+  double* dsdq012 = SensorBlock(index);
 
   // set dfdq0
   SetBlockInMatrix(dsdq012, dsdq0, 1.0, ns, nband_, ns, nv, 0, 0 * nv);
@@ -1173,6 +1687,7 @@ void Direct::BlockSensor(int index) {
 
   // set dfdq0
   SetBlockInMatrix(dsdq012, dsdq2, 1.0, ns, nband_, ns, nv, 0, 2 * nv);
+  StoreSensorBlock(index, dsdq012);
 
   // assemble dense Jacobian
   if (settings.assemble_sensor_jacobian) {
@@ -1183,33 +1698,42 @@ void Direct::BlockSensor(int index) {
   }
 }
 
-// sensor Jacobian
-// note: pool wait is called outside this function
-void Direct::JacobianSensor() {
-  // loop over predictions
-  for (int t = 0; t < configuration_length_; t++) {
-    // schedule by time step
-    pool_.Schedule([&batch = *this, t]() {
-      // start Jacobian timer
-      auto jacobian_sensor_start = std::chrono::steady_clock::now();
+// sensor Jacobian block memory for assembly
+double* Direct::SensorBlock(int index) {
+  if (!float_blocks_) return block_sensor_configurations_.Get(index);
 
-      // block
-      batch.BlockSensor(t);
+  // per-worker buffer, zeroed for partially filled blocks
+  int nblock = std::max(nsensordata_, model->nv) * nband_;
+  double* block =
+      block_store_.data() + nblock * std::max(ThreadPool::WorkerId(), 0);
+  mju_zero(block, nsensordata_ * nband_);
+  return block;
+}
 
-      // stop Jacobian timer
-      batch.timer_.sensor_step[t] = GetDuration(jacobian_sensor_start);
-    });
+// store sensor Jacobian block
+void Direct::StoreSensorBlock(int index, const double* block) {
+  if (!float_blocks_) return;
+  float* stored = block_sensor_configurations_float_.Get(index);
+  for (int i = 0; i < nsensordata_ * nband_; i++) {
+    stored[i] = static_cast<float>(block[i]);
   }
 }
 
+// double-precision view of stored sensor Jacobian block
+const double* Direct::LoadSensorBlock(int index, double* buffer) {
+  if (!float_blocks_) return block_sensor_configurations_.Get(index);
+  if (!buffer) buffer = block_sensor_load_.data();
+  const float* stored = block_sensor_configurations_float_.Get(index);
+  for (int i = 0; i < nsensordata_ * nband_; i++) {
+    buffer[i] = stored[i];
+  }
+  return buffer;
+}
+
 // force cost
 double Direct::CostForce(double* gradient, double* hessian) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
-
-  // update dimension
-  int nv = model->nv;
-  int nforce = nv * (configuration_length_ - 2);
+  TraceSpan span("Direct::CostForce");
 
   // residual
   if (!cost_skip_) ResidualForce();
@@ -1224,6 +1748,35 @@ double Direct::CostForce(double* gradient, double* hessian) {
   if (hessian) mju_zero(hessian, nvel_ * nband_ + nparam_ * ntotal_);
   if (nparam_ > 0) mju_zero(dense_force_parameter_.data(), nparam_ * ntotal_);
 
+  // loop over predictions
+  for (int t = 1; t < configuration_length_ - 1; t++) {
+    cost += CostForceStep(t, gradient, hessian, scratch_force_.data(), nullptr,
+                          &timer_.cost_force);
+  }
+
+  // set dense rows in band Hessian
+  if (hessian && nparam_ > 0) {
+    mju_copy(hessian + nvel_ * nband_, dense_force_parameter_.data(),
+             nparam_ * ntotal_);
+  }
+
+  // stop timer
+  timer_.cost_force_derivatives += span.End();
+
+  return cost;
+}
+
+// force cost at time step
+double Direct::CostForceStep(int t, double* gradient, double* hessian,
+                             double* scratch, double* block_buffer,
+                             double* timer) {
+  // update dimension
+  int nv = model->nv;
+  int nforce = nv * (configuration_length_ - 2);
+
+  // initialize
+  double cost = 0.0;
+
   // time scaling
   double time_scale2 = 1.0;
   if (settings.time_scaling_force) {
@@ -1231,149 +1784,236 @@ double Direct::CostForce(double* gradient, double* hessian) {
                   model->opt.timestep * model->opt.timestep;
   }
 
-  // loop over predictions
-  for (int t = 1; t < configuration_length_ - 1; t++) {
-    // unpack block
-    double* block = block_force_configurations_.Get(t);
+  // unpack block
+  const double* block =
+      gradient || hessian ? LoadForceBlock(t, block_buffer) : nullptr;
 
-    // start cost timer
-    auto start_cost = std::chrono::steady_clock::now();
+  // start cost timer
+  TraceSpan span_cost("Direct::CostForceStep");
 
-    // residual
-    double* rt = residual_force_.data() + t * nv;
+  // residual
+  double* rt = residual_force_.data() + t * nv;
 
-    // norm gradient
-    double* norm_gradient = norm_gradient_force_.data() + t * nv;
+  // norm gradient
+  double* norm_gradient = norm_gradient_force_.data() + t * nv;
 
-    // norm block
-    double* norm_block = norm_blocks_force_.data() + t * nv * nv;
-    mju_zero(norm_block, nv * nv);
+  // norm block
+  double* norm_block = norm_blocks_force_.data() + t * nv * nv;
+  mju_zero(norm_block, nv * nv);
 
-    // ----- cost ----- //
+  // ----- cost ----- //
 
-    // quadratic cost
-    for (int i = 0; i < nv; i++) {
-      // weight
-      double weight =
-          time_scale2 / noise_process[i] / nv / (configuration_length_ - 2);
+  // quadratic cost
+  for (int i = 0; i < nv; i++) {
+    // weight
+    double weight =
+        time_scale2 / noise_process[i] / nv / (configuration_length_ - 2);
 
-      // gradient
-      norm_gradient[i] = weight * rt[i];
+    // gradient
+    norm_gradient[i] = weight * rt[i];
 
-      // Hessian
-      norm_block[nv * i + i] = weight;
-    }
+    // Hessian
+    norm_block[nv * i + i] = weight;
+  }
 
-    // norm
-    norm_force_[t] = 0.5 * mju_dot(rt, norm_gradient, nv);
+  // norm
+  norm_force_[t] = 0.5 * mju_dot(rt, norm_gradient, nv);
 
-    // weighted norm
-    cost += norm_force_[t];
+  // weighted norm
+  cost += norm_force_[t];
 
-    // stop cost timer
-    timer_.cost_force += GetDuration(start_cost);
+  // stop cost timer
+  if (timer) *timer += span_cost.End();
 
-    // assemble dense norm Hessian
-    if (settings.assemble_force_norm_hessian) {
-      // zero memory
-      if (t == 1) mju_zero(norm_hessian_force_.data(), nforce * nforce);
+  // assemble dense norm Hessian
+  if (settings.assemble_force_norm_hessian) {
+    // zero memory
+    if (t == 1) mju_zero(norm_hessian_force_.data(), nforce * nforce);
 
-      // set block
-      SetBlockInMatrix(norm_hessian_force_.data(), norm_block, 1.0, nforce,
-                       nforce, nv, nv, (t - 1) * nv, (t - 1) * nv);
-    }
+    // set block
+    SetBlockInMatrix(norm_hessian_force_.data(), norm_block, 1.0, nforce,
+                     nforce, nv, nv, (t - 1) * nv, (t - 1) * nv);
+  }
 
-    // gradient wrt configuration: dfdq012' * dndf
-    if (gradient) {
-      // scratch = dfdq012' * dndf
-      mju_mulMatTVec(scratch_force_.data(), block, norm_gradient, nv, nband_);
+  // gradient wrt configuration: dfdq012' * dndf
+  if (gradient) {
+    // scratch = dfdq012' * dndf
+    mju_mulMatTVec(scratch, block, norm_gradient, nv, nband_);
 
-      // add
-      mju_addToScl(gradient + (t - 1) * nv, scratch_force_.data(), 1.0, nband_);
+    // add
+    mju_addToScl(gradient + (t - 1) * nv, scratch, 1.0, nband_);
 
-      // parameters
-      if (nparam_ > 0) {
-        // tmp = dfdp' dndf
-        double* dpdf = block_force_parameters_.Get(t);  // already transposed
-        mju_mulMatVec(scratch_force_.data(), dpdf, norm_gradient, nparam_, nv);
-        mju_addToScl(gradient + nvel_, scratch_force_.data(), 1.0, nparam_);
-      }
+    // parameters
+    if (nparam_ > 0) {
+      // tmp = dfdp' dndf
+      double* dpdf = block_force_parameters_.Get(t);  // already transposed
+      mju_mulMatVec(scratch, dpdf, norm_gradient, nparam_, nv);
+      mju_addToScl(gradient + nvel_, scratch, 1.0, nparam_);
     }
+  }
 
-    // Hessian (Gauss-Newton): drdq012' * d2ndf2 * dfdq012
-    if (hessian) {
-      // step 1: tmp0 = d2ndf2 * dfdq012
-      double* tmp0 = scratch_force_.data();
-      mju_mulMatMat(tmp0, norm_block, block, nv, nv, nband_);
+  // Hessian (Gauss-Newton): drdq012' * d2ndf2 * dfdq012
+  if (hessian) {
+    // step 1: tmp0 = d2ndf2 * dfdq012
+    double* tmp0 = scratch;
+    mju_mulMatMat(tmp0, norm_block, block, nv, nv, nband_);
 
-      // step 2: hessian = dfdq012' * tmp
-      double* tmp1 = tmp0 + nv * nband_;
-      mju_mulMatTMat(tmp1, block, tmp0, nv, nband_, nband_);
+    // step 2: hessian = dfdq012' * tmp
+    double* tmp1 = tmp0 + nv * nband_;
+    mju_mulMatTMat(tmp1, block, tmp0, nv, nband_, nband_);
 
-      // set block in band Hessian
-      SetBlockInBand(hessian, tmp1, 1.0, ntotal_, nband_, nband_, nv * (t - 1));
+    // set block in band Hessian
+    SetBlockInBand(hessian, tmp1, 1.0, ntotal_, nband_, nband_, nv * (t - 1));
 
-      // parameters
-      if (nparam_ > 0) {
-        // parameter Jacobian
-        double* dpdf = block_force_parameters_.Get(t);
+    // parameters
+    if (nparam_ > 0) {
+      // parameter Jacobian
+      double* dpdf = block_force_parameters_.Get(t);
 
-        // step 1: tmp2 = dpdf * d2ndf2
-        double* tmp2 = scratch_force_.data();
-        mju_mulMatMat(tmp2, dpdf, norm_block, nparam_, nv, nv);
+      // step 1: tmp2 = dpdf * d2ndf2
+      double* tmp2 = scratch;
+      mju_mulMatMat(tmp2, dpdf, norm_block, nparam_, nv, nv);
 
-        // step 2: tmp3 = tmp2 * dpdf' = dpdf * d2ndf2 * dpdf'
-        double* tmp3 = tmp2 + nparam_ * nv;
-        mju_mulMatMatT(tmp3, tmp2, dpdf, nparam_, nv, nparam_);
+      // step 2: tmp3 = tmp2 * dpdf' = dpdf * d2ndf2 * dpdf'
+      double* tmp3 = tmp2 + nparam_ * nv;
+      mju_mulMatMatT(tmp3, tmp2, dpdf, nparam_, nv, nparam_);
 
-        // add dpdf * d2ndf2 * dfdp in dense rows
-        AddBlockInMatrix(dense_force_parameter_.data(), tmp3, 1.0, nparam_,
-                         ntotal_, nparam_, nparam_, 0, nvel_);
+      // add dpdf * d2ndf2 * dfdp in dense rows
+      AddBlockInMatrix(dense_force_parameter_.data(), tmp3, 1.0, nparam_,
+                       ntotal_, nparam_, nparam_, 0, nvel_);
 
-        // step 3: tmp4 = dpdf * d2ndf2 * dfdq012
-        double* tmp4 = tmp3 + nparam_ * nparam_;
-        mju_mulMatMat(tmp4, tmp2, block, nparam_, nv, nband_);
+      // step 3: tmp4 = dpdf * d2ndf2 * dfdq012
+      double* tmp4 = tmp3 + nparam_ * nparam_;
+      mju_mulMatMat(tmp4, tmp2, block, nparam_, nv, nband_);
 
-        // add dpdf * d2ndf2 * dfdq012 in dense rows
-        AddBlockInMatrix(dense_force_parameter_.data(), tmp4, 1.0, nparam_,
-                         ntotal_, nparam_, nband_, 0, (t - 1) * nv);
-      }
+      // add dpdf * d2ndf2 * dfdq012 in dense rows
+      AddBlockInMatrix(dense_force_parameter_.data(), tmp4, 1.0, nparam_,
+                       ntotal_, nparam_, nband_, 0, (t - 1) * nv);
     }
   }
 
-  // set dense rows in band Hessian
-  if (hessian && nparam_ > 0) {
-    mju_copy(hessian + nvel_ * nband_, dense_force_parameter_.data(),
-             nparam_ * ntotal_);
+  return cost;
+}
+
+// force residual
+void Direct::ResidualForce() {
+  // start timer
+  TraceSpan span("Direct::ResidualForce");
+
+  // loop over predictions
+  for (int t = 1; t < configuration_length_ - 1; t++) {
+    ResidualForceStep(t);
   }
 
   // stop timer
-  timer_.cost_force_derivatives += GetDuration(start);
+  timer_.residual_force += span.End();
+}
 
-  return cost;
+// fused evaluation is supported
+bool Direct::FusedCost() const {
+  // parameter rows and dense assembly are shared across time steps
+  return settings.fused_cost && nparam_ == 0 &&
+         !settings.assemble_sensor_jacobian &&
+         !settings.assemble_force_jacobian &&
+         !settings.assemble_sensor_norm_hessian &&
+         !settings.assemble_force_norm_hessian;
 }
 
-// force residual
-void Direct::ResidualForce() {
+// fused residuals, Jacobian blocks and cost derivatives per time tile
+void Direct::CostFused(bool gradient, bool hessian, bool blocks,
+                       bool reuse_blocks) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::CostFused");
+
+  // dimensions
+  int nv = model->nv, ns = nsensordata_;
+  int T = configuration_length_;
+
+  // derivative memory
+  double* gradient_sensor = gradient ? cost_gradient_sensor_.data() : NULL;
+  double* gradient_force = gradient ? cost_gradient_force_.data() : NULL;
+  double* hessian_sensor = hessian ? cost_hessian_sensor_band_.data() : NULL;
+  double* hessian_force = hessian ? cost_hessian_force_band_.data() : NULL;
+  if (gradient_sensor) mju_zero(gradient_sensor, ntotal_);
+  if (gradient_force) mju_zero(gradient_force, ntotal_);
+  if (hessian_sensor) mju_zero(hessian_sensor, nvel_ * nband_);
+  if (hessian_force) mju_zero(hessian_force, nvel_ * nband_);
+
+  // tiles, at least two time steps so that tiles of one color do not share
+  // gradient or Hessian rows
+  int tile = std::max(settings.fused_tile, 2);
+  int num_tile = (T + tile - 1) / tile;
+  cost_tile_.resize(2 * num_tile);
+
+  // scratch per worker
+  int nscratch = std::max(scratch_sensor_.size(), scratch_force_.size());
+  int nbuffer = std::max(ns, nv) * nband_;
+  int num_workers = std::max(pool_->NumThreads(), 1);
+  scratch_fused_.resize((nscratch + nbuffer) * num_workers);
+
+  // even tiles, then odd tiles
+  for (int color = 0; color < 2; color++) {
+    int num_color = (num_tile - color + 1) / 2;
+    pool_->ParallelFor(0, num_color, 1, pool_priority_, [&](int k) {
+      int index = 2 * k + color;
+      int id = std::max(ThreadPool::WorkerId(), 0);
+      double* scratch = scratch_fused_.data() + (nscratch + nbuffer) * id;
+      double* block_buffer = scratch + nscratch;
+
+      // time steps
+      double cost_sensor = 0.0, cost_force = 0.0;
+      for (int t = index * tile; t < std::min((index + 1) * tile, T); t++) {
+        bool retained = reuse_blocks && t > 0 && t < T - 2;
+
+        // sensor
+        if (settings.sensor_flag) {
+          if (!cost_skip_) ResidualSensorStep(t);
+          if (blocks && !retained) BlockSensor(t);
+          cost_sensor += CostSensorStep(t, gradient_sensor, hessian_sensor,
+                                        scratch, block_buffer, NULL);
+        }
+
+        // force
+        if (settings.force_flag && t > 0 && t < T - 1) {
+          if (!cost_skip_) ResidualForceStep(t);
+          if (blocks && !retained) BlockForce(t);
+          cost_force += CostForceStep(t, gradient_force, hessian_force,
+                                      scratch, block_buffer, NULL);
+        }
+      }
+      cost_tile_[2 * index] = cost_sensor;
+      cost_tile_[2 * index + 1] = cost_force;
+    });
+  }
+
+  // costs, summed in tile order
+  double cost_sensor = 0.0, cost_force = 0.0;
+  for (int i = 0; i < num_tile; i++) {
+    cost_sensor += cost_tile_[2 * i];
+    cost_force += cost_tile_[2 * i + 1];
+  }
+  if (settings.sensor_flag) cost_sensor_ = cost_sensor;
+  if (settings.force_flag) cost_force_ = cost_force;
+
+  // blocks correspond to configuration
+  if (blocks) reuse_derivatives_ = false;
+
+  // stop timer
+  timer_.cost_fused += span.End();
+}
 
+// force residual at time step
+void Direct::ResidualForceStep(int t) {
   // dimension
   int nv = model->nv;
 
-  // loop over predictions
-  for (int t = 1; t < configuration_length_ - 1; t++) {
-    // terms
-    double* rt = residual_force_.data() + t * nv;
-    double* ft_actuator = force_measurement.Get(t);
-    double* ft_inverse = force_prediction.Get(t);
-
-    // force difference
-    mju_sub(rt, ft_inverse, ft_actuator, nv);
-  }
+  // terms
+  double* rt = residual_force_.data() + t * nv;
+  double* ft_actuator = force_measurement.Get(t);
+  double* ft_inverse = force_prediction.Get(t);
 
-  // stop timer
-  timer_.residual_force += GetDuration(start);
+  // force difference
+  mju_sub(rt, ft_inverse, ft_actuator, nv);
 }
 
 // force Jacobian blocks (dfdq0, dfdq1, dfdq2)
@@ -1435,7 +2075,7 @@ void Direct::BlockForce(int index) {
   // -- assemble dfdq012 block -- //
 
   // unpack
-  double* dfdq012 = block_force_configurations_.Get(index);
+  double* dfdq012 = ForceBlock(index);
 
   // set dfdq0
   SetBlockInMatrix(dfdq012, dfdq0, 1.0, nv, nband_, nv, nv, 0, 0 * nv);
@@ -1445,6 +2085,7 @@ void Direct::BlockForce(int index) {
 
   // set dfdq0
   SetBlockInMatrix(dfdq012, dfdq2, 1.0, nv, nband_, nv, nv, 0, 2 * nv);
+  StoreForceBlock(index, dfdq012);
 
   // assemble dense Jacobian
   if (settings.assemble_force_jacobian) {
@@ -1458,29 +2099,42 @@ void Direct::BlockForce(int index) {
   }
 }
 
-// force Jacobian
-// note: pool wait is called outside this function
-void Direct::JacobianForce() {
-  // loop over predictions
-  for (int t = 1; t < configuration_length_ - 1; t++) {
-    // schedule by time step
-    pool_.Schedule([&batch = *this, t]() {
-      // start Jacobian timer
-      auto jacobian_force_start = std::chrono::steady_clock::now();
+// force Jacobian block memory for assembly
+double* Direct::ForceBlock(int index) {
+  if (!float_blocks_) return block_force_configurations_.Get(index);
 
-      // block
-      batch.BlockForce(t);
+  // per-worker buffer, zeroed for partially filled blocks
+  int nblock = std::max(nsensordata_, model->nv) * nband_;
+  double* block =
+      block_store_.data() + nblock * std::max(ThreadPool::WorkerId(), 0);
+  mju_zero(block, model->nv * nband_);
+  return block;
+}
 
-      // stop Jacobian timer
-      batch.timer_.force_step[t] = GetDuration(jacobian_force_start);
-    });
+// store force Jacobian block
+void Direct::StoreForceBlock(int index, const double* block) {
+  if (!float_blocks_) return;
+  float* stored = block_force_configurations_float_.Get(index);
+  for (int i = 0; i < model->nv * nband_; i++) {
+    stored[i] = static_cast<float>(block[i]);
+  }
+}
+
+// double-precision view of stored force Jacobian block
+const double* Direct::LoadForceBlock(int index, double* buffer) {
+  if (!float_blocks_) return block_force_configurations_.Get(index);
+  if (!buffer) buffer = block_force_load_.data();
+  const float* stored = block_force_configurations_float_.Get(index);
+  for (int i = 0; i < model->nv * nband_; i++) {
+    buffer[i] = stored[i];
   }
+  return buffer;
 }
 
 // compute force
 void Direct::InverseDynamicsPrediction() {
   // compute sensor and force predictions
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::InverseDynamicsPrediction");
 
   // dimension
   int nq = model->nq, nv = model->nv, na = model->na, ns = nsensordata_;
@@ -1491,11 +2145,11 @@ void Direct::InverseDynamicsPrediction() {
                                                  nparam_);
   }
 
-  // pool count
-  int count_before = pool_.GetCount();
+  // tasks
+  TaskGroup group(*pool_, pool_priority_);
 
   // first time step
-  pool_.Schedule([&batch = *this, nq, nv]() {
+  group.Schedule([&batch = *this, nq, nv]() {
     // time index
     int t = 0;
 
@@ -1540,10 +2194,11 @@ void Direct::InverseDynamicsPrediction() {
     }
   });
 
-  // loop over predictions
-  for (int t = 1; t < configuration_length_ - 1; t++) {
+  // loop over predictions, skip retained interior time steps
+  int reuse_end = reuse_predictions_ ? configuration_length_ - 2 : 1;
+  for (int t = reuse_end; t < configuration_length_ - 1; t++) {
     // schedule
-    pool_.Schedule([&batch = *this, nq, nv, na, ns, t]() {
+    group.Schedule([&batch = *this, nq, nv, na, ns, t]() {
       // terms
       double* qt = batch.configuration.Get(t);
       double* vt = batch.velocity.Get(t);
@@ -1575,7 +2230,7 @@ void Direct::InverseDynamicsPrediction() {
   }
 
   // last time step
-  pool_.Schedule([&batch = *this, nq, nv]() {
+  group.Schedule([&batch = *this, nq, nv]() {
     // time index
     int t = batch.ConfigurationLength() - 1;
 
@@ -1629,20 +2284,20 @@ void Direct::InverseDynamicsPrediction() {
   });
 
   // wait
-  pool_.WaitCount(count_before + configuration_length_);
-  pool_.ResetCount();
+  group.Wait();
+
+  // predictions correspond to configuration
+  predictions_current_ = true;
+  reuse_predictions_ = false;
 
   // stop timer
-  timer_.cost_prediction += GetDuration(start);
+  timer_.cost_prediction += span.End();
 }
 
 // compute inverse dynamics derivatives (via finite difference)
 void Direct::InverseDynamicsDerivatives() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
-
-  // dimension
-  int nq = model->nq, nv = model->nv;
+  TraceSpan span("Direct::InverseDynamicsDerivatives");
 
   // set parameters
   if (nparam_ > 0) {
@@ -1650,178 +2305,173 @@ void Direct::InverseDynamicsDerivatives() {
                                                  nparam_);
   }
 
-  // pool count
-  int count_before = pool_.GetCount();
+  // tasks
+  TaskGroup group(*pool_, pool_priority_);
 
-  // first time step
-  pool_.Schedule([&batch = *this, nq, nv]() {
-    // time index
-    int t = 0;
+  // loop over time steps, skip retained interior time steps
+  for (int t = 0; t < configuration_length_; t++) {
+    if (reuse_derivatives_ && t > 0 && t < configuration_length_ - 2) continue;
+    group.Schedule([this, t]() { InverseDynamicsDerivativesStep(t); });
+  }
+
+  // wait
+  group.Wait();
+
+  // parameters
+  if (nparam_ > 0) {
+    ParameterJacobian();
+  }
+
+  // stop timer
+  timer_.inverse_dynamics_derivatives += span.End();
+}
+
+// inverse dynamics derivatives at time step t
+void Direct::InverseDynamicsDerivativesStep(int t) {
+  // dimension
+  int nq = model->nq, nv = model->nv;
 
+  // first time step
+  if (t == 0) {
     // data
-    mjData* d = batch.data_[t].get();
+    mjData* d = data_[t].get();
 
     // terms
-    double* q0 = batch.configuration.Get(t);
-    double* dsdq = batch.block_sensor_configuration_.Get(t);
+    double* q0 = configuration.Get(t);
+    double* dsdq = block_sensor_configuration_.Get(t);
 
     // set data
     mju_copy(d->qpos, q0, nq);
     mju_zero(d->qvel, nv);
     mju_zero(d->qacc, nv);
-    d->time = batch.times.Get(t)[0];
+    d->time = times.Get(t)[0];
 
     // finite-difference derivatives
-    double* dqds = batch.block_sensor_configurationT_.Get(t);
-    mjd_inverseFD(batch.model, d, batch.finite_difference.tolerance,
-                  batch.finite_difference.flg_actuation, NULL, NULL, NULL, dqds,
+    double* dqds = block_sensor_configurationT_.Get(t);
+    mjd_inverseFD(model, d, finite_difference.tolerance,
+                  finite_difference.flg_actuation, NULL, NULL, NULL, dqds,
                   NULL, NULL, NULL);
     // transpose
-    mju_transpose(dsdq, dqds, nv, batch.model->nsensordata);
-
-    // parameters
-    if (batch.nparam_ > 0) {
-      batch.ParameterJacobian(t);
-    }
+    mju_transpose(dsdq, dqds, nv, model->nsensordata);
 
     // loop over position sensors
-    for (int i = 0; i < batch.nsensor_; i++) {
+    for (int i = 0; i < nsensor_; i++) {
       // sensor stage
-      int sensor_stage = batch.model->sensor_needstage[batch.sensor_start_ + i];
+      int sensor_stage = model->sensor_needstage[sensor_start_ + i];
 
       // dimension
-      int sensor_dim = batch.model->sensor_dim[batch.sensor_start_ + i];
+      int sensor_dim = model->sensor_dim[sensor_start_ + i];
 
       // address
-      int sensor_adr = batch.model->sensor_adr[batch.sensor_start_ + i];
+      int sensor_adr = model->sensor_adr[sensor_start_ + i];
 
       // check for position
       if (sensor_stage != mjSTAGE_POS) {
         // zero remaining rows
         mju_zero(dsdq + sensor_adr * nv, sensor_dim * nv);
-
-        // parameter Jacobian
-        if (batch.nparam_) {
-          mju_zero(batch.block_sensor_parameters_.Get(t) +
-                       sensor_adr * batch.nparam_,
-                   sensor_dim * batch.nparam_);
-        }
       }
     }
-  });
-
-  // loop over predictions
-  for (int t = 1; t < configuration_length_ - 1; t++) {
-    // schedule
-    pool_.Schedule([&batch = *this, nq, nv, t]() {
-      // unpack
-      double* q = batch.configuration.Get(t);
-      double* v = batch.velocity.Get(t);
-      double* a = batch.acceleration.Get(t);
-
-      double* dsdq = batch.block_sensor_configuration_.Get(t);
-      double* dsdv = batch.block_sensor_velocity_.Get(t);
-      double* dsda = batch.block_sensor_acceleration_.Get(t);
-      double* dqds = batch.block_sensor_configurationT_.Get(t);
-      double* dvds = batch.block_sensor_velocityT_.Get(t);
-      double* dads = batch.block_sensor_accelerationT_.Get(t);
-      double* dqdf = batch.block_force_configuration_.Get(t);
-      double* dvdf = batch.block_force_velocity_.Get(t);
-      double* dadf = batch.block_force_acceleration_.Get(t);
-      mjData* data = batch.data_[t].get();  // TODO(taylor): WorkerID
-
-      // set state, acceleration
-      mju_copy(data->qpos, q, nq);
-      mju_copy(data->qvel, v, nv);
-      mju_copy(data->qacc, a, nv);
-
-      // finite-difference derivatives
-      mjd_inverseFD(batch.model, data, batch.finite_difference.tolerance,
-                    batch.finite_difference.flg_actuation, dqdf, dvdf, dadf,
-                    dqds, dvds, dads, NULL);
-
-      // transpose
-      mju_transpose(dsdq, dqds, nv, batch.model->nsensordata);
-      mju_transpose(dsdv, dvds, nv, batch.model->nsensordata);
-      mju_transpose(dsda, dads, nv, batch.model->nsensordata);
-
-      // parameters
-      if (batch.nparam_ > 0) {
-        batch.ParameterJacobian(t);
-      }
-    });
+    return;
   }
 
   // last time step
-  pool_.Schedule([&batch = *this, nq, nv]() {
-    // time index
-    int t = batch.ConfigurationLength() - 1;
-
+  if (t == configuration_length_ - 1) {
     // data
-    mjData* d = batch.data_[t].get();
+    mjData* d = data_[t].get();
 
     // terms
-    double* qT = batch.configuration.Get(t);
-    double* vT = batch.velocity.Get(t);
-    double* dsdq = batch.block_sensor_configuration_.Get(t);
-    double* dsdv = batch.block_sensor_velocity_.Get(t);
+    double* qT = configuration.Get(t);
+    double* vT = velocity.Get(t);
+    double* dsdq = block_sensor_configuration_.Get(t);
+    double* dsdv = block_sensor_velocity_.Get(t);
 
     // set data
     mju_copy(d->qpos, qT, nq);
     mju_copy(d->qvel, vT, nv);
     mju_zero(d->qacc, nv);
-    d->time = batch.times.Get(t)[0];
+    d->time = times.Get(t)[0];
 
     // finite-difference derivatives
-    double* dqds = batch.block_sensor_configurationT_.Get(t);
-    double* dvds = batch.block_sensor_velocityT_.Get(t);
-    mjd_inverseFD(batch.model, d, batch.finite_difference.tolerance,
-                  batch.finite_difference.flg_actuation, NULL, NULL, NULL, dqds,
+    double* dqds = block_sensor_configurationT_.Get(t);
+    double* dvds = block_sensor_velocityT_.Get(t);
+    mjd_inverseFD(model, d, finite_difference.tolerance,
+                  finite_difference.flg_actuation, NULL, NULL, NULL, dqds,
                   dvds, NULL, NULL);
     // transpose
-    mju_transpose(dsdq, dqds, nv, batch.model->nsensordata);
-    mju_transpose(dsdv, dvds, nv, batch.model->nsensordata);
-
-    // parameters
-    if (batch.nparam_ > 0) {
-      batch.ParameterJacobian(t);
-    }
+    mju_transpose(dsdq, dqds, nv, model->nsensordata);
+    mju_transpose(dsdv, dvds, nv, model->nsensordata);
 
     // loop over position sensors
-    for (int i = 0; i < batch.nsensor_; i++) {
+    for (int i = 0; i < nsensor_; i++) {
       // sensor stage
-      int sensor_stage = batch.model->sensor_needstage[batch.sensor_start_ + i];
+      int sensor_stage = model->sensor_needstage[sensor_start_ + i];
 
       // dimension
-      int sensor_dim = batch.model->sensor_dim[batch.sensor_start_ + i];
+      int sensor_dim = model->sensor_dim[sensor_start_ + i];
 
       // address
-      int sensor_adr = batch.model->sensor_adr[batch.sensor_start_ + i];
+      int sensor_adr = model->sensor_adr[sensor_start_ + i];
 
       // check for position
       if (sensor_stage == mjSTAGE_ACC) {
         // zero remaining rows
         mju_zero(dsdq + sensor_adr * nv, sensor_dim * nv);
         mju_zero(dsdv + sensor_adr * nv, sensor_dim * nv);
-
-        // parameter Jacobian
-        if (batch.nparam_) {
-          mju_zero(batch.block_sensor_parameters_.Get(t) +
-                       sensor_adr * batch.nparam_,
-                   sensor_dim * batch.nparam_);
-        }
       }
     }
-  });
+    return;
+  }
 
-  // wait
-  pool_.WaitCount(count_before + configuration_length_);
+  // interior time steps
+  // unpack
+  double* q = configuration.Get(t);
+  double* v = velocity.Get(t);
+  double* a = acceleration.Get(t);
+
+  double* dsdq = block_sensor_configuration_.Get(t);
+  double* dsdv = block_sensor_velocity_.Get(t);
+  double* dsda = block_sensor_acceleration_.Get(t);
+  double* dqds = block_sensor_configurationT_.Get(t);
+  double* dvds = block_sensor_velocityT_.Get(t);
+  double* dads = block_sensor_accelerationT_.Get(t);
+  double* dqdf = block_force_configuration_.Get(t);
+  double* dvdf = block_force_velocity_.Get(t);
+  double* dadf = block_force_acceleration_.Get(t);
+  mjData* data = data_[t].get();  // TODO(taylor): WorkerID
+
+  // set state, acceleration
+  mju_copy(data->qpos, q, nq);
+  mju_copy(data->qvel, v, nv);
+  mju_copy(data->qacc, a, nv);
+
+  // analytic acceleration derivatives: unconstrained time steps only
+  bool analytic = settings.analytic_acceleration_derivatives &&
+                  analytic_acceleration_;
+  if (analytic) {
+    mj_fwdPosition(model, data);
+    analytic = data->nefc == 0;
+  }
 
-  // reset pool count
-  pool_.ResetCount();
+  if (analytic) {
+    // force: (discrete) mass matrix, no acceleration sensors
+    AccelerationDerivatives(dadf, data);
+    mju_zero(dads, nv * model->nsensordata);
 
-  // stop timer
-  timer_.inverse_dynamics_derivatives += GetDuration(start);
+    // finite-difference derivatives, skip acceleration perturbations
+    mjd_inverseFD(model, data, finite_difference.tolerance,
+                  finite_difference.flg_actuation, dqdf, dvdf, NULL,
+                  dqds, dvds, NULL, NULL);
+  } else {
+    // finite-difference derivatives
+    mjd_inverseFD(model, data, finite_difference.tolerance,
+                  finite_difference.flg_actuation, dqdf, dvdf, dadf,
+                  dqds, dvds, dads, NULL);
+  }
+
+  // transpose
+  mju_transpose(dsdq, dqds, nv, model->nsensordata);
+  mju_transpose(dsdv, dvds, nv, model->nsensordata);
+  mju_transpose(dsda, dads, nv, model->nsensordata);
 }
 
 // update configuration trajectory
@@ -1830,11 +2480,14 @@ void Direct::UpdateConfiguration(DirectTrajectory<double>& candidate,
                                  const double* search_direction,
                                  double step_size) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::UpdateConfiguration");
 
   // dimension
   int nq = model->nq, nv = model->nv;
 
+  // evaluations no longer correspond to configuration
+  predictions_current_ = derivatives_current_ = false;
+
   // loop over configurations
   for (int t = 0; t < configuration_length_; t++) {
     // unpack
@@ -1852,13 +2505,13 @@ void Direct::UpdateConfiguration(DirectTrajectory<double>& candidate,
   }
 
   // stop timer
-  timer_.configuration_update += GetDuration(start);
+  timer_.configuration_update += span.End();
 }
 
 // convert sequence of configurations to velocities and accelerations
 void Direct::ConfigurationToVelocityAcceleration() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::ConfigurationToVelocityAcceleration");
 
   // dimension
   int nv = model->nv;
@@ -1886,19 +2539,20 @@ void Direct::ConfigurationToVelocityAcceleration() {
   }
 
   // stop time
-  timer_.cost_config_to_velacc += GetDuration(start);
+  timer_.cost_config_to_velacc += span.End();
 }
 
 // compute finite-difference velocity, acceleration derivatives
 void Direct::VelocityAccelerationDerivatives() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::VelocityAccelerationDerivatives");
 
   // dimension
   int nv = model->nv;
 
-  // loop over configurations
-  for (int t = 1; t < configuration_length_; t++) {
+  // loop over configurations, skip retained time steps
+  int reuse_end = reuse_derivatives_ ? configuration_length_ - 1 : 1;
+  for (int t = reuse_end; t < configuration_length_; t++) {
     // unpack
     double* q1 = configuration.Get(t - 1);
     double* q2 = configuration.Get(t);
@@ -1935,55 +2589,65 @@ void Direct::VelocityAccelerationDerivatives() {
   }
 
   // stop timer
-  timer_.velacc_derivatives += GetDuration(start);
+  timer_.velacc_derivatives += span.End();
 }
 
 // compute total cost
 double Direct::Cost(double* gradient, double* hessian) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::Cost");
+  ThreadQuota quota(quota_);
 
   // evaluate configurations
   if (!cost_skip_) ConfigurationEvaluation();
 
+  // fused residuals, Jacobian blocks and cost derivatives
+  bool fused = FusedCost();
+  bool reuse_blocks = reuse_derivatives_;
+
   // derivatives
-  if (gradient || hessian) {
-    ConfigurationDerivative();
+  bool blocks = (gradient || hessian) && !derivative_skip_;
+  if (blocks) {
+    ConfigurationDerivative(!fused);
   }
 
   // start cost derivative timer
-  auto start_cost_derivatives = std::chrono::steady_clock::now();
-
-  // pool count
-  int count_begin = pool_.GetCount();
+  TraceSpan span_cost_derivatives("Direct::cost_derivatives");
 
   bool gradient_flag = (gradient ? true : false);
   bool hessian_flag = (hessian ? true : false);
 
-  // -- individual cost derivatives -- //
+  if (fused) {
+    // -- time tiles -- //
+    CostFused(gradient_flag, hessian_flag, blocks, reuse_blocks);
+  } else {
+    // tasks
+    TaskGroup group(*pool_, pool_priority_);
+
+    // -- individual cost derivatives -- //
+
+    // sensor
+    if (settings.sensor_flag) {
+      group.Schedule([&batch = *this, gradient_flag, hessian_flag]() {
+        batch.cost_sensor_ = batch.CostSensor(
+            gradient_flag ? batch.cost_gradient_sensor_.data() : NULL,
+            hessian_flag ? batch.cost_hessian_sensor_band_.data() : NULL);
+      });
+    }
 
-  // sensor
-  if (settings.sensor_flag) {
-    pool_.Schedule([&batch = *this, gradient_flag, hessian_flag]() {
-      batch.cost_sensor_ = batch.CostSensor(
-          gradient_flag ? batch.cost_gradient_sensor_.data() : NULL,
-          hessian_flag ? batch.cost_hessian_sensor_band_.data() : NULL);
-    });
-  }
+    // force
+    if (settings.force_flag) {
+      group.Schedule([&batch = *this, gradient_flag, hessian_flag]() {
+        batch.cost_force_ = batch.CostForce(
+            gradient_flag ? batch.cost_gradient_force_.data() : NULL,
+            hessian_flag ? batch.cost_hessian_force_band_.data() : NULL);
+      });
+    }
 
-  // force
-  if (settings.force_flag) {
-    pool_.Schedule([&batch = *this, gradient_flag, hessian_flag]() {
-      batch.cost_force_ = batch.CostForce(
-          gradient_flag ? batch.cost_gradient_force_.data() : NULL,
-          hessian_flag ? batch.cost_hessian_force_band_.data() : NULL);
-    });
+    // wait
+    group.Wait();
   }
 
-  // wait
-  pool_.WaitCount(count_begin + settings.sensor_flag + settings.force_flag);
-  pool_.ResetCount();
-
   // total cost
   double cost = cost_sensor_ + cost_force_;
 
@@ -1998,13 +2662,13 @@ double Direct::Cost(double* gradient, double* hessian) {
 
   // cost time
   if (!cost_skip_) {
-    timer_.cost += GetDuration(start);
+    timer_.cost += span.End();
   }
 
   // cost derivative time
   if (gradient || hessian) {
-    timer_.cost_derivatives += GetDuration(start);
-    timer_.cost_total_derivatives += GetDuration(start_cost_derivatives);
+    timer_.cost_derivatives += span.End();
+    timer_.cost_total_derivatives += span_cost_derivatives.End();
   }
 
   // reset skip flag
@@ -2059,7 +2723,7 @@ void Direct::TotalGradient(double* gradient) {
   if (!gradient) return;
 
   // start gradient timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::TotalGradient");
 
   // zero memory
   mju_zero(gradient, ntotal_);
@@ -2073,7 +2737,7 @@ void Direct::TotalGradient(double* gradient) {
   }
 
   // stop gradient timer
-  timer_.cost_gradient += GetDuration(start);
+  timer_.cost_gradient += span.End();
 }
 
 // compute total Hessian
@@ -2081,7 +2745,7 @@ void Direct::TotalHessian(double* hessian) {
   if (!hessian) return;
 
   // start Hessian timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Direct::TotalHessian");
 
   // zero memory
   mju_zero(hessian, nvel_ * nband_ + nparam_ * ntotal_);
@@ -2098,13 +2762,14 @@ void Direct::TotalHessian(double* hessian) {
   }
 
   // stop Hessian timer
-  timer_.cost_hessian += GetDuration(start);
+  timer_.cost_hessian += span.End();
 }
 
 // optimize configuration trajectory
-void Direct::Optimize() {
+void Direct::Optimize(const std::function<bool()>& cancelled) {
   // start timer
-  auto start_optimize = std::chrono::steady_clock::now();
+  TraceSpan span_optimize("Direct::Optimize");
+  ThreadQuota quota(quota_);
 
   // set status
   gradient_norm_ = 0.0;
@@ -2128,23 +2793,66 @@ void Direct::Optimize() {
   // reset
   iterations_smoother_ = 0;
   iterations_search_ = 0;
+  iterations_conjugate_gradient_ = 0;
+  regularization_retries_ = 0;
+  evaluations_avoided_ = 0;
+
+  // Hessian-vector products instead of the band cost Hessian
+  bool matrix_free = MatrixFree();
+
+  // derivative refresh
+  bool quasi_newton = QuasiNewton();
+  bool refresh = true;
+  int iterations_refresh = 0;
+
+  // configurations restored after a failed search, evaluated with the
+  // derivatives
+  bool restored = false;
 
   // iterations
   for (; iterations_smoother_ < settings.max_smoother_iterations;
        iterations_smoother_++) {
-    // evalute cost derivatives
-    cost_skip_ = true;
-    Cost(cost_gradient_.data(), cost_hessian_band_.data());
+    // stop on request, e.g., a cancelled or expired RPC
+    if (cancelled && cancelled()) {
+      timer_.optimize = span_optimize.End();
+      solve_status_ = kCancelled;
+      return;
+    }
+
+    // evalute cost derivatives, Broyden-updated blocks between refreshes
+    cost_skip_ = !restored;
+    derivative_skip_ = !refresh;
+    hessian_skip_ = matrix_free;
+    Cost(cost_gradient_.data(),
+         matrix_free ? nullptr : cost_hessian_band_.data());
+    derivative_skip_ = false;
+    hessian_skip_ = false;
+    hessian_regularization_ = 0.0;
+    restored = false;
+    preconditioner_current_ = false;
+    if (refresh) iterations_refresh = 0;
+
+    // residuals for Broyden update
+    if (quasi_newton) {
+      mju_copy(residual_sensor_previous_.data(), residual_sensor_.data(),
+               nsensordata_ * configuration_length_);
+      mju_copy(residual_force_previous_.data(), residual_force_.data(),
+               model->nv * configuration_length_);
+    }
 
     // start timer
-    auto start_search = std::chrono::steady_clock::now();
+    TraceSpan span_search("Direct::search");
 
     // -- gradient -- //
     double* gradient = cost_gradient_.data();
 
-    // gradient tolerance check
+    // gradient tolerance check, confirmed with refreshed derivatives
     gradient_norm_ = mju_norm(gradient, ntotal_) / ntotal_;
     if (gradient_norm_ < settings.gradient_tolerance) {
+      if (!refresh) {
+        refresh = true;
+        continue;
+      }
       break;
     }
 
@@ -2190,9 +2898,16 @@ void Direct::Optimize() {
     }
 
     // backtracking until cost decrease
+    bool search_failure = false;
     while (cost_candidate >= cost_) {
       // check for max iterations
       if (iteration_search > settings.max_search_iterations) {
+        // retry with refreshed derivatives
+        if (!refresh) {
+          search_failure = true;
+          break;
+        }
+
         // set solve status
         solve_status_ = kMaxIterationsFailure;
 
@@ -2256,6 +2971,17 @@ void Direct::Optimize() {
     // increment
     iterations_search_ += iteration_search;
 
+    // restore configuration, refresh derivatives
+    if (search_failure) {
+      UpdateConfiguration(configuration, configuration_copy_,
+                          search_direction_.data(), 0.0);
+      restored = true;
+      evaluations_avoided_++;
+      refresh = true;
+      timer_.search += span_search.End();
+      continue;
+    }
+
     // update cost
     cost_previous_ = cost_;
     cost_ = cost_candidate;
@@ -2280,9 +3006,13 @@ void Direct::Optimize() {
 
       // tmp = H * d
       double* tmp = scratch_expected_.data();
-      mju_bandMulMatVec(tmp, cost_hessian_band_.data(),
-                        search_direction_.data(), ntotal_, nband_, nparam_, 1,
-                        true);
+      if (matrix_free) {
+        HessianProduct(tmp, search_direction_.data());
+      } else {
+        mju_bandMulMatVec(tmp, cost_hessian_band_.data(),
+                          search_direction_.data(), ntotal_, nband_, nparam_,
+                          1, true);
+      }
 
       // expected += 0.5 d' tmp
       expected_ += 0.5 * mju_dot(search_direction_.data(), tmp, ntotal_);
@@ -2313,15 +3043,29 @@ void Direct::Optimize() {
       }
     }
 
+    // refresh derivatives every derivative_refresh iterations or if the model
+    // of the cost degrades, otherwise Broyden update over the accepted step
+    if (quasi_newton) {
+      bool degraded = settings.search_type == kCurveSearch
+                          ? reduction_ratio_ < settings.refresh_reduction_ratio
+                          : iteration_search > 1;
+      refresh = ++iterations_refresh >= settings.derivative_refresh || degraded;
+      if (!refresh) {
+        double* step = scratch_expected_.data();
+        mju_scl(step, search_direction_.data(), -1.0 * step_size_, nvel_);
+        BroydenUpdate(step);
+      }
+    }
+
     // end timer
-    timer_.search += GetDuration(start_search);
+    timer_.search += span_search.End();
 
     // print cost
     PrintCost();
   }
 
   // stop timer
-  timer_.optimize = GetDuration(start_optimize);
+  timer_.optimize = span_optimize.End();
 
   // set solve status
   if (iterations_smoother_ >= settings.max_smoother_iterations) {
@@ -2337,7 +3081,14 @@ void Direct::Optimize() {
 // search direction
 bool Direct::SearchDirection() {
   // start timer
-  auto search_direction_start = std::chrono::steady_clock::now();
+  TraceSpan search_direction_span("Direct::search_direction");
+
+  // -- Hessian-vector products -- //
+  if (MatrixFree()) {
+    bool success = ConjugateGradient();
+    timer_.search_direction += search_direction_span.End();
+    return success;
+  }
 
   // -- band Hessian -- //
 
@@ -2349,8 +3100,20 @@ bool Direct::SearchDirection() {
 
   // -- linear system solver -- //
 
-  // increase regularization until full rank
+  // partitioned factorization on the pool (no parameters)
+  int num_partition =
+      settings.parallel_factorization && nparam_ == 0
+          ? ParallelBandCholesky::NumPartitions(ntotal_, nband_,
+                                                pool_->NumThreads())
+          : 1;
+  bool parallel = num_partition > 1;
+  if (parallel) band_cholesky_.Allocate(ntotal_, nband_, num_partition);
+
+  // increase regularization until full rank. the band keeps the
+  // regularization of a previous factorization at these derivatives, so
+  // retries only shift its diagonal by the increase
   double min_diag = 0.0;
+  double shift = 0.0;
   while (min_diag <= 0.0) {
     // failure
     if (regularization_ >= kMaxDirectRegularization) {
@@ -2360,13 +3123,21 @@ bool Direct::SearchDirection() {
       return false;
     }
 
-    // copy
-    mju_copy(hessian_band_factor, hessian_band,
-             nvel_ * nband_ + nparam_ * ntotal_);
-
     // factorize
-    min_diag = mju_cholFactorBand(hessian_band_factor, ntotal_, nband_, nparam_,
-                                  regularization_, 0.0);
+    shift = regularization_ - hessian_regularization_;
+    if (parallel) {
+      min_diag = band_cholesky_.Factor(hessian_band, shift, *pool_);
+    } else if (nparam_ > 0) {
+      mju_copy(hessian_band_factor, hessian_band,
+               nvel_ * nband_ + nparam_ * ntotal_);
+      min_diag = CholFactorArrowhead(hessian_band_factor,
+                                     cost_hessian_schur_.data(), ntotal_,
+                                     nband_, nparam_, shift, 0.0);
+    } else {
+      mju_copy(hessian_band_factor, hessian_band, nvel_ * nband_);
+      min_diag = mju_cholFactorBand(hessian_band_factor, ntotal_, nband_, 0,
+                                    shift, 0.0);
+    }
 
     // increase regularization
     if (min_diag <= 0.0) {
@@ -2375,30 +3146,387 @@ bool Direct::SearchDirection() {
   }
 
   // compute search direction
-  mju_cholSolveBand(direction, hessian_band_factor, gradient, ntotal_, nband_,
-                    nparam_);
+  if (parallel) {
+    band_cholesky_.Solve(direction, gradient, *pool_);
+  } else if (nparam_ > 0) {
+    CholSolveArrowhead(direction, hessian_band_factor,
+                       cost_hessian_schur_.data(), gradient,
+                       scratch_schur_.data(), ntotal_, nband_, nparam_);
+  } else {
+    mju_cholSolveBand(direction, hessian_band_factor, gradient, ntotal_, nband_,
+                      0);
+  }
 
   // search direction norm
   search_direction_norm_ = InfinityNorm(direction, ntotal_);
 
   // set regularization
-  if (regularization_ > 0.0) {
+  if (shift != 0.0) {
     // configurations
     for (int i = 0; i < ntotal_; i++) {
-      hessian_band[i * nband_ + nband_ - 1] += regularization_;
+      hessian_band[i * nband_ + nband_ - 1] += shift;
     }
 
     // parameters
     for (int i = 0; i < nparam_; i++) {
-      hessian_band[nvel_ * nband_ + i * ntotal_ + nvel_ + i] += regularization_;
+      hessian_band[nvel_ * nband_ + i * ntotal_ + nvel_ + i] += shift;
     }
   }
+  hessian_regularization_ = regularization_;
 
   // end timer
-  timer_.search_direction += GetDuration(search_direction_start);
+  timer_.search_direction += search_direction_span.End();
+  return true;
+}
+
+// Hessian-vector products are supported
+bool Direct::MatrixFree() const {
+  // parameter rows are only assembled
+  return settings.matrix_free && nparam_ == 0;
+}
+
+// sensor Jacobian block at time step t and its columns, starting at
+// configuration max(0, t - 1)
+const double* Direct::SensorBlockColumns(int t, double* buffer,
+                                         int* columns) {
+  int nv = model->nv;
+  if (t == 0) {
+    *columns = nv;
+    return block_sensor_configuration_.Get(t) + sensor_start_index_ * nv;
+  }
+  *columns = t == configuration_length_ - 1 ? nband_ - nv : nband_;
+  return LoadSensorBlock(t, buffer);
+}
+
+// res = (H + regularization) * vec, H: Gauss-Newton cost Hessian
+void Direct::HessianProduct(double* res, const double* vec) {
+  // dimensions
+  int nv = model->nv, ns = nsensordata_;
+  int T = configuration_length_;
+
+  // per-worker scratch: block, Jacobian-vector product
+  int nblock = std::max(ns, nv) * nband_;
+  int nscratch = nblock + std::max(ns, nv);
+  int num_workers = std::max(pool_->NumThreads(), 1);
+  scratch_product_.resize(nscratch * num_workers);
+  product_sensor_.resize(ns * T);
+  product_force_.resize(nv * T);
+
+  // norm Hessian * Jacobian * vec, per time step
+  pool_->ParallelFor(0, T, 1, pool_priority_, [&](int t) {
+    int id = std::max(ThreadPool::WorkerId(), 0);
+    double* buffer = scratch_product_.data() + nscratch * id;
+    double* y = buffer + nblock;
+
+    // sensor: weighted norm blocks
+    if (settings.sensor_flag) {
+      int columns;
+      const double* block = SensorBlockColumns(t, buffer, &columns);
+      mju_mulMatVec(y, block, vec + nv * std::max(0, t - 1), ns, columns);
+      double* z = product_sensor_.data() + ns * t;
+      int shift_matrix = 0;
+      for (int i = 0; i < nsensor_; i++) {
+        int nsi = model->sensor_dim[sensor_start_ + i];
+        shift_matrix += t * nsi * nsi;
+      }
+      int shift = 0;
+      for (int i = 0; i < nsensor_; i++) {
+        int nsi = model->sensor_dim[sensor_start_ + i];
+        double weight = norm_weight_sensor_[nsensor_ * t + i];
+        if (weight == 0.0) {
+          mju_zero(z + shift, nsi);
+        } else {
+          mju_mulMatVec(z + shift, norm_blocks_sensor_.data() + shift_matrix,
+                        y + shift, nsi, nsi);
+          mju_scl(z + shift, z + shift, weight, nsi);
+        }
+        shift += nsi;
+        shift_matrix += nsi * nsi;
+      }
+    }
+
+    // force
+    if (settings.force_flag && t > 0 && t < T - 1) {
+      const double* block = LoadForceBlock(t, buffer);
+      mju_mulMatVec(y, block, vec + nv * (t - 1), nv, nband_);
+      mju_mulMatVec(product_force_.data() + nv * t,
+                    norm_blocks_force_.data() + t * nv * nv, y, nv, nv);
+    }
+  });
+
+  // Jacobian' * products, per configuration: the time steps with blocks in
+  // its columns
+  pool_->ParallelFor(0, T, 1, pool_priority_, [&](int k) {
+    int id = std::max(ThreadPool::WorkerId(), 0);
+    double* buffer = scratch_product_.data() + nscratch * id;
+    double* rk = res + nv * k;
+    mju_scl(rk, vec + nv * k, regularization_, nv);
+
+    for (int t = std::max(0, k - 1); t <= std::min(T - 1, k + 1); t++) {
+      // sensor
+      int column = k - std::max(0, t - 1);
+      if (settings.sensor_flag) {
+        int columns;
+        const double* block = SensorBlockColumns(t, buffer, &columns);
+        if (nv * column < columns) {
+          const double* z = product_sensor_.data() + ns * t;
+          for (int r = 0; r < ns; r++) {
+            mju_addToScl(rk, block + r * columns + nv * column, z[r], nv);
+          }
+        }
+      }
+
+      // force
+      if (settings.force_flag && t > 0 && t < T - 1) {
+        const double* block = LoadForceBlock(t, buffer);
+        const double* z = product_force_.data() + nv * t;
+        for (int r = 0; r < nv; r++) {
+          mju_addToScl(rk, block + r * nband_ + nv * column, z[r], nv);
+        }
+      }
+    }
+  });
+}
+
+// diagonal blocks of the Gauss-Newton cost Hessian
+void Direct::PreconditionerBlocks() {
+  // dimensions
+  int nv = model->nv, ns = nsensordata_;
+  int T = configuration_length_;
+
+  // per-worker scratch: block, block columns, norm * columns, block product
+  int nblock = std::max(ns, nv) * nband_;
+  int ncolumn = std::max(ns, nv) * nv;
+  int nscratch = nblock + 2 * ncolumn + nv * nv;
+  int num_workers = std::max(pool_->NumThreads(), 1);
+  scratch_product_.resize(std::max(static_cast<int>(scratch_product_.size()),
+                                   nscratch * num_workers));
+  preconditioner_.resize(nv * nv * T);
+
+  pool_->ParallelFor(0, T, 1, pool_priority_, [&](int k) {
+    int id = std::max(ThreadPool::WorkerId(), 0);
+    double* buffer = scratch_product_.data() + nscratch * id;
+    double* block_column = buffer + nblock;
+    double* tmp = block_column + ncolumn;
+    double* product = tmp + ncolumn;
+    double* dk = preconditioner_.data() + nv * nv * k;
+    mju_zero(dk, nv * nv);
+
+    for (int t = std::max(0, k - 1); t <= std::min(T - 1, k + 1); t++) {
+      int column = k - std::max(0, t - 1);
+
+      // sensor: w * J' * N * J, per sensor
+      if (settings.sensor_flag) {
+        int columns;
+        const double* block = SensorBlockColumns(t, buffer, &columns);
+        if (nv * column < columns) {
+          for (int r = 0; r < ns; r++) {
+            mju_copy(block_column + r * nv, block + r * columns + nv * column,
+                     nv);
+          }
+          int shift_matrix = 0;
+          for (int i = 0; i < nsensor_; i++) {
+            int nsi = model->sensor_dim[sensor_start_ + i];
+            shift_matrix += t * nsi * nsi;
+          }
+          int shift = 0;
+          for (int i = 0; i < nsensor_; i++) {
+            int nsi = model->sensor_dim[sensor_start_ + i];
+            double weight = norm_weight_sensor_[nsensor_ * t + i];
+            if (weight != 0.0) {
+              const double* ji = block_column + shift * nv;
+              mju_mulMatMat(tmp, norm_blocks_sensor_.data() + shift_matrix, ji,
+                            nsi, nsi, nv);
+              mju_mulMatTMat(product, ji, tmp, nsi, nv, nv);
+              mju_addToScl(dk, product, weight, nv * nv);
+            }
+            shift += nsi;
+            shift_matrix += nsi * nsi;
+          }
+        }
+      }
+
+      // force: J' * N * J
+      if (settings.force_flag && t > 0 && t < T - 1) {
+        const double* block = LoadForceBlock(t, buffer);
+        for (int r = 0; r < nv; r++) {
+          mju_copy(block_column + r * nv, block + r * nband_ + nv * column,
+                   nv);
+        }
+        mju_mulMatMat(tmp, norm_blocks_force_.data() + t * nv * nv,
+                      block_column, nv, nv, nv);
+        mju_mulMatTMat(product, block_column, tmp, nv, nv, nv);
+        mju_addTo(dk, product, nv * nv);
+      }
+    }
+  });
+
+  preconditioner_current_ = true;
+}
+
+// search direction by block-Jacobi preconditioned conjugate gradient
+bool Direct::ConjugateGradient() {
+  // dimensions
+  int nv = model->nv;
+  int T = configuration_length_;
+
+  // diagonal blocks of the cost Hessian
+  if (!preconditioner_current_) PreconditionerBlocks();
+  preconditioner_factor_.resize(nv * nv * T);
+  scratch_conjugate_gradient_.resize(4 * ntotal_);
+
+  // unpack
+  double* direction = search_direction_.data();
+  const double* gradient = cost_gradient_.data();
+  double* residual = scratch_conjugate_gradient_.data();
+  double* preconditioned = residual + ntotal_;
+  double* conjugate = preconditioned + ntotal_;
+  double* product = conjugate + ntotal_;
+
+  // precondition: res = blockdiag(H + regularization)^-1 vec
+  auto precondition = [&](double* res, const double* vec) {
+    pool_->ParallelFor(0, T, 1, pool_priority_, [&](int k) {
+      mju_cholSolve(res + nv * k, preconditioner_factor_.data() + nv * nv * k,
+                    vec + nv * k, nv);
+    });
+  };
+
+  // increase regularization until the curvature is positive
+  double gradient_norm = mju_norm(gradient, ntotal_);
+  while (true) {
+    // failure
+    if (regularization_ >= kMaxDirectRegularization) {
+      printf("conjugate gradient failure: MAX REGULARIZATION\n");
+      solve_status_ = kMaxRegularizationFailure;
+      return false;
+    }
+
+    // factorize regularized diagonal blocks
+    pool_->ParallelFor(0, T, 1, pool_priority_, [&](int k) {
+      double* factor = preconditioner_factor_.data() + nv * nv * k;
+      mju_copy(factor, preconditioner_.data() + nv * nv * k, nv * nv);
+      for (int i = 0; i < nv; i++) factor[i * nv + i] += regularization_;
+      mju_cholFactor(factor, nv, mjMINVAL);
+    });
+
+    // direction = 0, residual = gradient
+    mju_zero(direction, ntotal_);
+    mju_copy(residual, gradient, ntotal_);
+    precondition(preconditioned, residual);
+    mju_copy(conjugate, preconditioned, ntotal_);
+    double rz = mju_dot(residual, preconditioned, ntotal_);
+
+    bool positive_curvature = true;
+    for (int i = 0; i < settings.max_conjugate_gradient_iterations; i++) {
+      if (mju_norm(residual, ntotal_) <=
+          settings.conjugate_gradient_tolerance * gradient_norm) {
+        break;
+      }
+      iterations_conjugate_gradient_++;
+
+      // step along conjugate direction
+      HessianProduct(product, conjugate);
+      double curvature = mju_dot(conjugate, product, ntotal_);
+      if (curvature <= 0.0) {
+        positive_curvature = false;
+        break;
+      }
+      double alpha = rz / curvature;
+      mju_addToScl(direction, conjugate, alpha, ntotal_);
+      mju_addToScl(residual, product, -alpha, ntotal_);
+
+      // next conjugate direction
+      precondition(preconditioned, residual);
+      double rz_next = mju_dot(residual, preconditioned, ntotal_);
+      mju_scl(conjugate, conjugate, rz_next / rz, ntotal_);
+      mju_addTo(conjugate, preconditioned, ntotal_);
+      rz = rz_next;
+    }
+    if (positive_curvature) break;
+    IncreaseRegularization();
+  }
+
+  // search direction norm
+  search_direction_norm_ = InfinityNorm(direction, ntotal_);
   return true;
 }
 
+// Broyden updates of Jacobian blocks are supported
+bool Direct::QuasiNewton() const {
+  // parameter blocks and assembled dense Jacobians are not updated
+  return settings.derivative_refresh > 1 && nparam_ == 0 &&
+         !settings.assemble_sensor_jacobian &&
+         !settings.assemble_force_jacobian &&
+         !settings.assemble_sensor_norm_hessian &&
+         !settings.assemble_force_norm_hessian;
+}
+
+// rank-one update of Jacobian blocks: J += (dr - J dq) dq' / dq' dq
+void Direct::BroydenUpdate(const double* step) {
+  // dimensions
+  int nv = model->nv, ns = nsensordata_;
+  int T = configuration_length_;
+  double* y = scratch_broyden_.data();
+
+  // update block (rows x columns) with step dq and residual change dr
+  auto update = [y](double* block, const double* dq, const double* r,
+                    const double* r_previous, int rows, int columns) {
+    double dq2 = mju_dot(dq, dq, columns);
+    if (dq2 < 1.0e-24) return;
+
+    // y = (dr - J dq) / dq' dq
+    mju_mulMatVec(y, block, dq, rows, columns);
+    for (int i = 0; i < rows; i++) {
+      y[i] = (r[i] - r_previous[i] - y[i]) / dq2;
+    }
+
+    // J += y dq'
+    for (int i = 0; i < rows; i++) {
+      mju_addToScl(block + i * columns, dq, y[i], columns);
+    }
+  };
+
+  // sensor
+  if (settings.sensor_flag) {
+    for (int t = 0; t < T; t++) {
+      const double* rt = residual_sensor_.data() + ns * t;
+      const double* rt_previous = residual_sensor_previous_.data() + ns * t;
+      const double* dq = step + nv * std::max(0, t - 1);
+
+      // first time step, only position sensors
+      if (t == 0) {
+        update(block_sensor_configuration_.Get(0) + sensor_start_index_ * nv,
+               dq, rt, rt_previous, ns, nv);
+        continue;
+      }
+
+      // block (dsdq01 at last time step)
+      int columns = t == T - 1 ? nband_ - nv : nband_;
+      double* block = block_sensor_configurations_.Get(t);
+      if (float_blocks_) {
+        block = block_sensor_load_.data();
+        LoadSensorBlock(t, block);
+      }
+      update(block, dq, rt, rt_previous, ns, columns);
+      StoreSensorBlock(t, block);
+    }
+  }
+
+  // force
+  if (settings.force_flag) {
+    for (int t = 1; t < T - 1; t++) {
+      double* block = block_force_configurations_.Get(t);
+      if (float_blocks_) {
+        block = block_force_load_.data();
+        LoadForceBlock(t, block);
+      }
+      update(block, step + nv * (t - 1), residual_force_.data() + nv * t,
+             residual_force_previous_.data() + nv * t, nv, nband_);
+      StoreForceBlock(t, block);
+    }
+  }
+}
+
 // print Optimize status
 void Direct::PrintOptimize() {
   if (!settings.verbose_optimize) return;
@@ -2428,6 +3556,8 @@ void Direct::PrintOptimize() {
          1.0e-3 * timer_.cost_derivatives);
   printf("    - inverse dynamics derivatives: %.3f (ms) \n",
          1.0e-3 * timer_.inverse_dynamics_derivatives);
+  printf("      < parameters: %.3f (ms) \n",
+         1.0e-3 * timer_.parameter_jacobian);
   printf("    - vel., acc. derivatives: %.3f (ms) \n",
          1.0e-3 * timer_.velacc_derivatives);
   printf("    - jacobian [total]: %.3f (ms) \n",
@@ -2436,6 +3566,7 @@ void Direct::PrintOptimize() {
   printf("      < force: %.3f (ms) \n", 1.0e-3 * timer_.jacobian_force);
   printf("    - gradient, hessian [total]: %.3f (ms) \n",
          1.0e-3 * timer_.cost_total_derivatives);
+  printf("      < fused: %.3f (ms) \n", 1.0e-3 * timer_.cost_fused);
   printf("      < sensor: %.3f (ms) \n",
          1.0e-3 * timer_.cost_sensor_derivatives);
   printf("      < force: %.3f (ms) \n", 1.0e-3 * timer_.cost_force_derivatives);
@@ -2479,6 +3610,8 @@ void Direct::PrintOptimize() {
   printf("  cost difference: %.6f\n", cost_difference_);
   printf("  solve status: %s\n", StatusString(solve_status_).c_str());
   printf("  cost count: %i\n", cost_count_);
+  printf("  regularization retries: %i\n", regularization_retries_);
+  printf("  cost evaluations avoided: %i\n", evaluations_avoided_);
   printf("\n");
 
   // cost
@@ -2506,6 +3639,7 @@ void Direct::PrintCost() {
 // reset timers
 void Direct::ResetTimers() {
   timer_.inverse_dynamics_derivatives = 0.0;
+  timer_.parameter_jacobian = 0.0;
   timer_.velacc_derivatives = 0.0;
   timer_.jacobian_sensor = 0.0;
   timer_.jacobian_force = 0.0;
@@ -2513,6 +3647,7 @@ void Direct::ResetTimers() {
   timer_.cost_sensor_derivatives = 0.0;
   timer_.cost_force_derivatives = 0.0;
   timer_.cost_total_derivatives = 0.0;
+  timer_.cost_fused = 0.0;
   timer_.cost_gradient = 0.0;
   timer_.cost_hessian = 0.0;
   timer_.cost_derivatives = 0.0;
@@ -2549,6 +3684,8 @@ std::string StatusString(int code) {
       return "EXPECTED_DECREASE_FAILURE";
     case kSolved:
       return "SOLVED";
+    case kCancelled:
+      return "CANCELLED";
     default:
       return "STATUS_CODE_ERROR";
   }
@@ -2558,52 +3695,184 @@ std::string StatusString(int code) {
 void Direct::IncreaseRegularization() {
   regularization_ = mju_min(kMaxDirectRegularization,
                             regularization_ * settings.regularization_scaling);
+  regularization_retries_++;
 }
 
 // derivatives of sensor model wrt parameters
-void Direct::ParameterJacobian(int index) {
-  // unpack
-  mjModel* model_perturb = model_perturb_[index].get();
-  mjData* data = data_[index].get();
-  double* dsdp = block_sensor_parameters_.Get(index);
-  double* dpds = block_sensor_parametersT_.Get(index);
-  double* dpdf = block_force_parameters_.Get(index);
-  double* param = parameters_copy_.data() + index * nparam_;
-  mju_copy(param, parameters.data(), nparam_);
-
-  // loop over parameters
-  for (int i = 0; i < nparam_; i++) {
+void Direct::ParameterJacobian() {
+  // start timer
+  TraceSpan span("Direct::ParameterJacobian");
+
+  // dimension
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+  int T = configuration_length_;
+
+  // perturbation memory per worker
+  int num_workers = std::max(pool_->NumThreads(), 1);
+  while (static_cast<int>(model_perturb_.size()) < num_workers) {
+    // private copies of the parameter fields only, or of the whole model if
+    // the fields are unknown or span several arrays
+    auto model_perturb = std::make_unique<SharedModel>(model);
+    std::vector<ModelParameterField> fields =
+        model_parameters_[model_parameters_id_]->Fields(model_perturb->get());
+    bool shared = !fields.empty();
+    for (const ModelParameterField& field : fields) {
+      char* begin =
+          static_cast<char*>(model_perturb->MakeMutable(field.address));
+      if (!begin || model_perturb->MakeMutable(begin + field.size - 1) !=
+                        begin + field.size - 1) {
+        shared = false;
+        break;
+      }
+    }
+    if (!shared) {
+      model_perturb = std::make_unique<SharedModel>(model);
+      model_perturb->MakeAllMutable();
+    }
+    model_perturb_.push_back(std::move(model_perturb));
+    data_perturb_.push_back(MakeUniqueMjData(mj_makeData(model)));
+    overlay_perturb_.emplace_back();
+    overlay_perturb_.back().Initialize(*model_parameters_[model_parameters_id_],
+                                       model_perturb_.back()->get());
+  }
+  parameters_perturb_.resize(nparam_ * num_workers);
+
+  // finite-difference stencil: offsets (in tolerance) and weights
+  const double* offset;
+  const double* weight;
+  int npoint;
+  static constexpr double kForwardOffset[] = {1.0};
+  static constexpr double kForwardWeight[] = {1.0};
+  static constexpr double kCentralOffset[] = {1.0, -1.0};
+  static constexpr double kCentralWeight[] = {0.5, -0.5};
+  static constexpr double kCentral4Offset[] = {2.0, 1.0, -1.0, -2.0};
+  static constexpr double kCentral4Weight[] = {-1.0 / 12.0, 8.0 / 12.0,
+                                               -8.0 / 12.0, 1.0 / 12.0};
+  switch (finite_difference.parameter_difference) {
+    case kCentralDifference:
+      offset = kCentralOffset;
+      weight = kCentralWeight;
+      npoint = 2;
+      break;
+    case kCentralDifference4:
+      offset = kCentral4Offset;
+      weight = kCentral4Weight;
+      npoint = 4;
+      break;
+    default:
+      offset = kForwardOffset;
+      weight = kForwardWeight;
+      npoint = 1;
+  }
+  bool forward = npoint == 1;
+
+  // tiles of (time step, parameter group)
+  int group = std::max(finite_difference.parameter_group, 1);
+  int ngroup = (nparam_ + group - 1) / group;
+
+  // finite difference each tile
+  int ntile = T * ngroup;
+  pool_->ParallelFor(0, ntile, 1, pool_priority_, [&, nq, nv, ns, T](int k) {
+    int t = k / ngroup;
+    int begin = (k % ngroup) * group;
+    int end = std::min(begin + group, nparam_);
+    int id = std::max(ThreadPool::WorkerId(), 0);
+    double h = finite_difference.tolerance;
+
     // unpack
-    double* dpids = dpds + i * model->nsensordata;
-    double* dpidf = dpdf + i * model->nv;
+    mjModel* model_perturb = model_perturb_[id]->get();
+    mjData* data = data_perturb_[id].get();
+    ModelParameterOverlay& overlay = overlay_perturb_[id];
+    double* param = parameters_perturb_.data() + id * nparam_;
+    mju_copy(param, parameters.data(), nparam_);
+
+    // state (zero velocity at first, zero acceleration at first and last)
+    mju_copy(data->qpos, configuration.Get(t), nq);
+    if (t == 0) {
+      mju_zero(data->qvel, nv);
+    } else {
+      mju_copy(data->qvel, velocity.Get(t), nv);
+    }
+    if (t == 0 || t == T - 1) {
+      mju_zero(data->qacc, nv);
+    } else {
+      mju_copy(data->qacc, acceleration.Get(t), nv);
+    }
+    data->time = times.Get(t)[0];
+
+    // loop over parameters in group
+    for (int i = begin; i < end; i++) {
+      double* dpids = block_sensor_parametersT_.Get(t) + i * ns;
+      double* dpidf = block_force_parameters_.Get(t) + i * nv;
+
+      // nominal
+      if (forward) {
+        mju_scl(dpids, sensor_prediction.Get(t), -1.0 / h, ns);
+        mju_scl(dpidf, force_prediction.Get(t), -1.0 / h, nv);
+      } else {
+        mju_zero(dpids, ns);
+        mju_zero(dpidf, nv);
+      }
 
-    // nudge
-    param[i] += finite_difference.tolerance;
+      // stencil points
+      for (int j = 0; j < npoint; j++) {
+        // nudge
+        param[i] = parameters[i] + offset[j] * h;
 
-    // set parameters
-    model_parameters_[model_parameters_id_]->Set(model_perturb, param, nparam_);
+        // set parameters
+        overlay.Patch(*model_parameters_[model_parameters_id_], param,
+                      nparam_);
 
-    // inverse dynamics
-    mj_inverse(model_perturb, data);
+        // inverse dynamics
+        mj_inverse(model_perturb, data);
 
-    // sensor difference
-    mju_sub(dpids, data->sensordata, sensor_prediction.Get(index),
-            model->nsensordata);
+        // weighted sensor and force differences
+        mju_addToScl(dpids, data->sensordata, weight[j] / h, ns);
+        mju_addToScl(dpidf, data->qfrc_inverse, weight[j] / h, nv);
+      }
 
-    // force difference
-    mju_sub(dpidf, data->qfrc_inverse, force_prediction.Get(index), model->nv);
+      // restore
+      param[i] = parameters[i];
+    }
 
-    // scale
-    mju_scl(dpids, dpids, 1.0 / finite_difference.tolerance,
-            model->nsensordata);
-    mju_scl(dpidf, dpidf, 1.0 / finite_difference.tolerance, model->nv);
+    // restore patched model fields
+    overlay.Restore();
+  });
 
-    // restore
-    param[i] -= finite_difference.tolerance;
+  // transpose
+  for (int t = 0; t < T; t++) {
+    double* dsdp = block_sensor_parameters_.Get(t);
+    mju_transpose(dsdp, block_sensor_parametersT_.Get(t), nparam_, ns);
+
+    // first and last time steps only measure position (and velocity) sensors
+    if (t > 0 && t < T - 1) continue;
+    for (int j = 0; j < nsensor_; j++) {
+      int stage = model->sensor_needstage[sensor_start_ + j];
+      if (stage == mjSTAGE_ACC || (t == 0 && stage != mjSTAGE_POS)) {
+        int adr = model->sensor_adr[sensor_start_ + j];
+        int dim = model->sensor_dim[sensor_start_ + j];
+        mju_zero(dsdp + adr * nparam_, dim * nparam_);
+      }
+    }
   }
 
-  // transpose
-  mju_transpose(dsdp, dpds, nparam_, model->nsensordata);
+  // stop timer
+  timer_.parameter_jacobian += span.End();
+}
+
+// derivative of inverse dynamics force wrt acceleration (requires position
+// stage): mass matrix, plus timestep-scaled damping for the discrete Euler
+// inverse
+void Direct::AccelerationDerivatives(double* dadf, const mjData* data) const {
+  int nv = model->nv;
+  mj_fullM(model, dadf, data->qM);
+  if (model->opt.integrator == mjINT_EULER &&
+      !(model->opt.disableflags & mjDSBL_EULERDAMP) &&
+      !(model->opt.disableflags & mjDSBL_DAMPER)) {
+    for (int i = 0; i < nv; i++) {
+      dadf[i * nv + i] += model->opt.timestep * model->dof_damping[i];
+    }
+  }
 }
 
 }  // namespace mjpc
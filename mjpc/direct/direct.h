@@ -15,15 +15,21 @@
 #ifndef MJPC_DIRECT_DIRECT_H_
 #define MJPC_DIRECT_DIRECT_H_
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <mujoco/mujoco.h>
 
+#include "mjpc/direct/band_cholesky.h"
 #include "mjpc/direct/model_parameters.h"
 #include "mjpc/direct/trajectory.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/norm.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
@@ -43,6 +49,7 @@ enum DirectStatus : int {
   kCostDifferenceFailure,
   kExpectedDecreaseFailure,
   kSolved,
+  kCancelled,
 };
 
 // search type for update
@@ -52,6 +59,45 @@ enum SearchType : int {
   kNumSearch,
 };
 
+// finite-difference scheme for parameter derivatives
+enum ParameterDifference : int {
+  kForwardDifference = 0,  // one evaluation, first order
+  kCentralDifference,      // two evaluations, second order
+  kCentralDifference4,     // four evaluations, fourth order
+  kNumParameterDifference,
+};
+
+// compressed sparse row matrix
+struct SparseMatrix {
+  int rows = 0;
+  int cols = 0;
+  std::vector<int> row_start;  // rows + 1
+  std::vector<int> column;     // number of nonzeros
+  std::vector<double> value;   // number of nonzeros
+
+  // clear entries and set dimensions
+  void Reset(int num_rows, int num_cols) {
+    rows = num_rows;
+    cols = num_cols;
+    row_start.assign(1, 0);
+    column.clear();
+    value.clear();
+  }
+
+  // append nrow rows from a row-major block (given row stride) with ncol
+  // entries starting at column col. rows are appended in order.
+  void AddRows(const double* block, int nrow, int ncol, int stride, int col,
+               double scale = 1.0) {
+    for (int i = 0; i < nrow; i++) {
+      for (int j = 0; j < ncol; j++) {
+        column.push_back(col + j);
+        value.push_back(scale * block[i * stride + j]);
+      }
+      row_start.push_back(static_cast<int>(column.size()));
+    }
+  }
+};
+
 // maximum / minimum regularization
 inline constexpr double kMaxDirectRegularization = 1.0e12;
 inline constexpr double kMinDirectRegularization = 1.0e-12;
@@ -59,9 +105,12 @@ inline constexpr double kMinDirectRegularization = 1.0e-12;
 // ----- direct optimization with MuJoCo inverse dynamics ----- //
 class Direct {
  public:
-  // constructor
+  // constructor, parallel work uses at most num_threads threads of the
+  // shared pool
   explicit Direct(int num_threads = NumAvailableHardwareThreads())
-      : model_parameters_(LoadModelParameters()), pool_(num_threads) {}
+      : model_parameters_(LoadModelParameters()),
+        num_threads_(num_threads),
+        quota_(num_threads) {}
 
   // constructor
   explicit Direct(const mjModel* model, int length = 3, int max_history = 0);
@@ -83,9 +132,28 @@ class Direct {
   // get max history
   int GetMaxHistory() { return max_history_; }
 
+  // use an external thread pool for parallel work, without a thread quota
+  // (nullptr restores the shared pool). the pool must outlive its use by
+  // this object.
+  void SetThreadPool(ThreadPool* pool) {
+    pool_ = pool ? pool : &SharedThreadPool();
+    quota_ = pool ? 0 : num_threads_;
+  }
+
+  // priority lane of the parallel work's tasks
+  void SetThreadPoolPriority(TaskPriority priority) {
+    pool_priority_ = priority;
+  }
+
   // set configuration length
   void SetConfigurationLength(int length);
 
+  // append a measurement sample (ctrl: nu, sensor: ns) at time, shifting the
+  // window by one time step. the new last configuration is predicted from the
+  // previous two with ctrl. evaluations of the retained time steps are reused
+  // if the window was not modified since the last optimization.
+  void Append(const double* ctrl, const double* sensor, double time);
+
   // evaluate configurations
   void ConfigurationEvaluation();
 
@@ -93,8 +161,21 @@ class Direct {
   // virtual function so derived classes can add most cost terms
   virtual double Cost(double* gradient, double* hessian);
 
-  // optimize trajectory estimate
-  void Optimize();
+  // optimize trajectory estimate. cancelled, if given, is polled before each
+  // smoother iteration and stops the optimization when it returns true
+  void Optimize(const std::function<bool()>& cancelled = nullptr);
+
+  // write the window (configurations, times, measurements and masks) and
+  // parameters as sections name.*, and restore them. Restore returns false,
+  // leaving the optimizer unchanged, if they don't match its dimensions or
+  // history; a restored window is evaluated by the next optimization.
+  void Snapshot(SnapshotWriter& writer,
+                std::string_view name = "direct") const;
+  bool Restore(const SnapshotReader& reader, std::string_view name = "direct");
+
+  // add the bytes of the window, Jacobian, cost and scratch buffers and the
+  // mjData to report
+  virtual void ReportMemory(MemoryReport& report) const;
 
   // cost
   double GetCost() { return cost_; }
@@ -116,6 +197,12 @@ class Direct {
   const double* GetNormHessianSensor();
   const double* GetNormHessianForce();
 
+  // cost internals, block-sparse (no dense assembly)
+  const SparseMatrix& GetJacobianSensorSparse();
+  const SparseMatrix& GetJacobianForceSparse();
+  const SparseMatrix& GetNormHessianSensorSparse();
+  const SparseMatrix& GetNormHessianForceSparse();
+
   // get configuration length
   int ConfigurationLength() const { return configuration_length_; }
 
@@ -131,9 +218,17 @@ class Direct {
   // get number of parameters
   int NumberParameters() const { return nparam_; }
 
+  // get cost Hessian band dimension
+  int BandDimension() const { return nband_; }
+
   // get status
   int IterationsSmoother() const { return iterations_smoother_; }
   int IterationsSearch() const { return iterations_search_; }
+  int IterationsConjugateGradient() const {
+    return iterations_conjugate_gradient_;
+  }
+  int RegularizationRetries() const { return regularization_retries_; }
+  int EvaluationsAvoided() const { return evaluations_avoided_; }
   double GradientNorm() const { return gradient_norm_; }
   double Regularization() const { return regularization_; }
   double StepSize() const { return step_size_; }
@@ -212,12 +307,36 @@ class Direct {
     bool last_step_velocity_sensors =
         false;  // evaluate velocity sensors at last time step
     bool assemble_cost_hessian = false;  // assemble dense cost Hessian
+    bool analytic_acceleration_derivatives =
+        false;  // mass matrix instead of finite differences for qacc
+    bool parallel_factorization =
+        true;  // partitioned cost Hessian factorization on the pool
+    bool float_jacobian_blocks =
+        false;  // single-precision sensor and force Jacobian blocks
+    bool fused_cost =
+        false;  // residuals, blocks and cost derivatives per time tile
+    int fused_tile = 8;  // time steps per fused cost task
+    int derivative_refresh =
+        1;  // iterations between finite-difference derivatives, Broyden
+            // updates of the Jacobian blocks in between (1: every iteration)
+    double refresh_reduction_ratio =
+        0.25;  // refresh derivatives if reduction ratio falls below
+    bool matrix_free =
+        false;  // conjugate-gradient search direction from Hessian-vector
+                // products, without assembling the band cost Hessian
+    int max_conjugate_gradient_iterations =
+        100;  // conjugate-gradient iterations per search direction
+    double conjugate_gradient_tolerance =
+        1.0e-8;  // conjugate-gradient residual relative to the gradient
   } settings;
 
   // finite-difference settings
   struct FiniteDifferenceSettings {
     double tolerance = 1.0e-7;
     bool flg_actuation = 1;
+    ParameterDifference parameter_difference =
+        kForwardDifference;   // scheme for parameter derivatives
+    int parameter_group = 4;  // parameters per pool task
   } finite_difference;
 
  protected:
@@ -233,34 +352,63 @@ class Direct {
   // compute inverse dynamics derivatives (via finite difference)
   void InverseDynamicsDerivatives();
 
-  // evaluate configurations derivatives
-  void ConfigurationDerivative();
+  // inverse dynamics derivatives at time step t
+  void InverseDynamicsDerivativesStep(int t);
+
+  // evaluate configurations derivatives, optionally without Jacobian blocks
+  void ConfigurationDerivative(bool blocks = true);
 
   // ----- sensor ----- //
   // cost
   double CostSensor(double* gradient, double* hessian);
 
+  // cost at time step t, derivatives added to gradient and band Hessian
+  double CostSensorStep(int t, double* gradient, double* hessian,
+                        double* scratch, double* block_buffer, double* timer);
+
   // residual
   void ResidualSensor();
+  void ResidualSensorStep(int t);
 
   // Jacobian blocks (dsdq0, dsdq1, dsdq2)
   void BlockSensor(int index);
 
-  // Jacobian
-  void JacobianSensor();
+  // Jacobian block memory: assembly buffer, conversion to storage precision
+  // and double-precision view of stored block (converted in buffer, default
+  // shared memory)
+  double* SensorBlock(int index);
+  void StoreSensorBlock(int index, const double* block);
+  const double* LoadSensorBlock(int index, double* buffer = nullptr);
 
   // ----- force ----- //
   // cost
   double CostForce(double* gradient, double* hessian);
 
+  // cost at time step t, derivatives added to gradient and band Hessian
+  double CostForceStep(int t, double* gradient, double* hessian,
+                       double* scratch, double* block_buffer, double* timer);
+
   // residual
   void ResidualForce();
+  void ResidualForceStep(int t);
+
+  // ----- fused ----- //
+  // fused evaluation is supported
+  bool FusedCost() const;
+
+  // residuals, Jacobian blocks (if blocks) and cost derivatives per time tile,
+  // blocks of retained interior time steps are skipped if reuse_blocks
+  void CostFused(bool gradient, bool hessian, bool blocks, bool reuse_blocks);
 
   // Jacobian blocks (dfdq0, dfdq1, dfdq2)
   void BlockForce(int index);
 
-  // Jacobian
-  void JacobianForce();
+  // Jacobian block memory: assembly buffer, conversion to storage precision
+  // and double-precision view of stored block (converted in buffer, default
+  // shared memory)
+  double* ForceBlock(int index);
+  void StoreForceBlock(int index, const double* block);
+  const double* LoadForceBlock(int index, double* buffer = nullptr);
 
   // compute total gradient
   void TotalGradient(double* gradient);
@@ -271,6 +419,33 @@ class Direct {
   // search direction, returns false if regularization maxes out
   bool SearchDirection();
 
+  // ----- quasi-Newton ----- //
+  // Broyden updates of Jacobian blocks are supported
+  bool QuasiNewton() const;
+
+  // rank-one update of each sensor and force block with the residual change
+  // over an accepted step (nvel)
+  void BroydenUpdate(const double* step);
+
+  // ----- matrix-free ----- //
+  // search directions from Hessian-vector products, without parameters.
+  // the band cost Hessian is not assembled.
+  virtual bool MatrixFree() const;
+
+  // sensor Jacobian block at time step t with its number of columns
+  const double* SensorBlockColumns(int t, double* buffer, int* columns);
+
+  // res = (H + regularization) * vec for the Gauss-Newton cost Hessian H
+  // of the current Jacobian and norm blocks
+  void HessianProduct(double* res, const double* vec);
+
+  // diagonal (nv x nv) blocks of the Gauss-Newton cost Hessian
+  void PreconditionerBlocks();
+
+  // search direction by block-Jacobi preconditioned conjugate gradient,
+  // returns false on failure
+  bool ConjugateGradient();
+
   // update configuration trajectory
   void UpdateConfiguration(DirectTrajectory<double>& candidate,
                            const DirectTrajectory<double>& configuration,
@@ -288,8 +463,12 @@ class Direct {
   // increase regularization
   void IncreaseRegularization();
 
-  // derivatives of force and sensor model wrt parameters
-  void ParameterJacobian(int index);
+  // derivative of inverse dynamics force wrt acceleration (mass matrix)
+  void AccelerationDerivatives(double* dadf, const mjData* data) const;
+
+  // derivatives of force and sensor model wrt parameters, all time steps.
+  // (time step, parameter) pairs are evaluated in parallel on the pool
+  void ParameterJacobian();
 
   // dimensions
   int nstate_;
@@ -302,12 +481,31 @@ class Direct {
   int nparam_;  // number of parameter variable (ndense)
   int nband_;   // cost Hessian band dimension
 
+  // acceleration derivatives can be evaluated analytically
+  bool analytic_acceleration_;
+
+  // shift trajectory heads, evaluations of retained time steps are reused
+  // for a single step shift
+  void ShiftTrajectories(int shift);
+
+  // predictions and derivatives correspond to configuration
+  bool predictions_current_ = false;
+  bool derivatives_current_ = false;
+
+  // skip interior time steps retained from the previous window
+  bool reuse_predictions_ = false;
+  bool reuse_derivatives_ = false;
+
   // sensor indexing
   int sensor_start_;
   int sensor_start_index_;
 
-  // perturbed models (for parameter estimation)
-  std::vector<UniqueMjModel> model_perturb_;
+  // perturbed models and data (for parameter estimation), one per worker.
+  // the models share model's arrays except those written by the parameters.
+  std::vector<std::unique_ptr<SharedModel>> model_perturb_;
+  std::vector<UniqueMjData> data_perturb_;
+  std::vector<ModelParameterOverlay> overlay_perturb_;
+  std::vector<double> parameters_perturb_;  // nparam x workers
 
   // data
   std::vector<UniqueMjData> data_;
@@ -330,6 +528,10 @@ class Direct {
   std::vector<double> residual_sensor_;  // ns x (T - 1)
   std::vector<double> residual_force_;   // nv x (T - 2)
 
+  // residual at last derivative evaluation (Broyden updates)
+  std::vector<double> residual_sensor_previous_;  // ns x (T - 1)
+  std::vector<double> residual_force_previous_;   // nv x (T - 2)
+
   // Jacobian
   std::vector<double> jacobian_sensor_;  // (ns * (T - 1)) * (nv * T + nparam)
   std::vector<double> jacobian_force_;   // (nv * (T - 2)) * (nv * T + nparam)
@@ -352,6 +554,8 @@ class Direct {
       block_sensor_current_configuration_;                    // (ns * nv) x T
   DirectTrajectory<double> block_sensor_next_configuration_;  // (ns * nv) x T
   DirectTrajectory<double> block_sensor_configurations_;  // (ns * 3 * nv) x T
+  DirectTrajectory<float>
+      block_sensor_configurations_float_;  // (ns * 3 * nv) x T
 
   DirectTrajectory<double> block_sensor_scratch_;  // max(nv, ns) x T
 
@@ -365,6 +569,14 @@ class Direct {
   DirectTrajectory<double> block_force_current_configuration_;  // (nv * nv) x T
   DirectTrajectory<double> block_force_next_configuration_;     // (nv * nv) x T
   DirectTrajectory<double> block_force_configurations_;  // (nv * 3 * nv) x T
+  DirectTrajectory<float>
+      block_force_configurations_float_;  // (nv * 3 * nv) x T
+
+  // single-precision Jacobian block conversion
+  bool float_blocks_ = false;
+  std::vector<double> block_store_;         // (max(ns, nv) * 3 * nv) x workers
+  std::vector<double> block_sensor_load_;   // ns * 3 * nv
+  std::vector<double> block_force_load_;    // nv * 3 * nv
 
   DirectTrajectory<double> block_force_scratch_;  // (nv * nv) x T
 
@@ -405,6 +617,13 @@ class Direct {
       norm_hessian_force_;  // (nv * max_history_) * (nv * max_history_)
   std::vector<double> norm_blocks_sensor_;  // (ns * ns) x max_history_
   std::vector<double> norm_blocks_force_;   // (nv * nv) x max_history_
+  std::vector<double> norm_weight_sensor_;  // nsensor x max_history_
+
+  // sparse Jacobians, norm Hessians
+  SparseMatrix jacobian_sensor_sparse_;
+  SparseMatrix jacobian_force_sparse_;
+  SparseMatrix norm_hessian_sensor_sparse_;
+  SparseMatrix norm_hessian_force_sparse_;
 
   // cost gradient
   std::vector<double> cost_gradient_sensor_;  // nv * max_history_ + nparam
@@ -425,13 +644,33 @@ class Direct {
   std::vector<double>
       cost_hessian_band_factor_;  // (nv * max_history_) * (3 * nv) + nparam *
                                   // (nv * max_history_)
+  std::vector<double> cost_hessian_schur_;  // nparam * nparam
+  ParallelBandCholesky band_cholesky_;
+  std::vector<double> scratch_schur_;       // nparam
+
+  // matrix-free search direction memory, allocated on first use
+  std::vector<double> product_sensor_;   // ns x T
+  std::vector<double> product_force_;    // nv x T
+  std::vector<double> preconditioner_;         // (nv * nv) x T
+  std::vector<double> preconditioner_factor_;  // (nv * nv) x T
+  std::vector<double> scratch_product_;  // (blocks + products) x workers
+  std::vector<double> scratch_conjugate_gradient_;  // 4 * ntotal
+  bool preconditioner_current_ = false;
+
+  // fused cost memory
+  std::vector<double> scratch_fused_;  // (cost scratch + block) x workers
+  std::vector<double> cost_tile_;      // (sensor, force) x tiles
 
   // cost scratch
   std::vector<double>
       scratch_sensor_;  // 3 * nv + nsensor_data * 3 * nv + 9 * nv * nv
   std::vector<double> scratch_force_;  // 12 * nv * nv
+
+  // futures of the per-time-step derivative and Jacobian block graph
+  std::vector<TaskFuture> step_futures_;
   std::vector<double>
       scratch_expected_;  // nv * max_history_ + nparam * (nv * max_history_)
+  std::vector<double> scratch_broyden_;  // max(ns, nv)
 
   // search direction
   std::vector<double>
@@ -452,10 +691,19 @@ class Direct {
   // status (internal)
   int cost_count_;          // number of cost evaluations
   bool cost_skip_ = false;  // flag for only evaluating cost derivatives
+  bool derivative_skip_ = false;  // flag for reusing Jacobian blocks
+  bool hessian_skip_ = false;  // flag for norm blocks without cost Hessian
+  double hessian_regularization_ = 0.0;  // regularization in the band Hessian
 
   // status (external)
   int iterations_smoother_;       // total smoother iterations after Optimize
   int iterations_search_;         // total line search iterations
+  int iterations_conjugate_gradient_ = 0;  // total conjugate-gradient
+                                           // iterations after Optimize
+  int regularization_retries_ = 0;  // regularization increases at unchanged
+                                    // derivatives after Optimize
+  int evaluations_avoided_ = 0;     // cost evaluations merged with derivative
+                                    // evaluations after Optimize
   double gradient_norm_;          // norm of cost gradient
   double regularization_;         // regularization
   double step_size_;              // step size for line search
@@ -470,6 +718,7 @@ class Direct {
   // timers
   struct DirectTimers {
     double inverse_dynamics_derivatives;
+    double parameter_jacobian;
     double velacc_derivatives;
     double jacobian_sensor;
     double jacobian_force;
@@ -477,6 +726,7 @@ class Direct {
     double cost_sensor_derivatives;
     double cost_force_derivatives;
     double cost_total_derivatives;
+    double cost_fused;
     double cost_gradient;
     double cost_hessian;
     double cost_derivatives;
@@ -500,8 +750,12 @@ class Direct {
   // max history
   int max_history_ = 3;
 
-  // threadpool
-  ThreadPool pool_;
+  // threadpool, the shared pool with a quota of num_threads_ unless an
+  // external pool is set
+  int num_threads_;
+  ThreadPool* pool_ = &SharedThreadPool();
+  int quota_;
+  TaskPriority pool_priority_ = TaskPriority::kNormal;
 };
 
 // optimizer status string
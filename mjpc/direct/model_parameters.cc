@@ -14,11 +14,48 @@
 
 #include "mjpc/direct/model_parameters.h"
 
+#include <cstring>
 #include <memory>
 #include <vector>
 
+#include <mujoco/mujoco.h>
+
 namespace mjpc {
 
+// record fields touched by parameters
+void ModelParameterOverlay::Initialize(const ModelParameters& parameters,
+                                       mjModel* model) {
+  model_ = model;
+  fields_ = parameters.Fields(model);
+
+  // backup
+  std::size_t size = 0;
+  for (const auto& field : fields_) size += field.size;
+  backup_.resize(size);
+  char* backup = backup_.data();
+  for (const auto& field : fields_) {
+    std::memcpy(backup, field.address, field.size);
+    backup += field.size;
+  }
+}
+
+// set parameters on model
+void ModelParameterOverlay::Patch(ModelParameters& parameters,
+                                  const double* values, int dim) {
+  parameters.Set(model_, values, dim);
+}
+
+// restore recorded values
+bool ModelParameterOverlay::Restore() {
+  if (fields_.empty()) return false;
+  const char* backup = backup_.data();
+  for (const auto& field : fields_) {
+    std::memcpy(field.address, backup, field.size);
+    backup += field.size;
+  }
+  return true;
+}
+
 // Loads all available ModelParameters
 std::vector<std::unique_ptr<mjpc::ModelParameters>> LoadModelParameters() {
   // model parameters
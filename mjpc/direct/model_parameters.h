@@ -15,6 +15,7 @@
 #ifndef MJPC_DIRECT_MODEL_PARAMETERS_H_
 #define MJPC_DIRECT_MODEL_PARAMETERS_H_
 
+#include <cstddef>
 #include <memory>
 #include <vector>
 
@@ -22,6 +23,12 @@
 
 namespace mjpc {
 
+// contiguous model memory written by ModelParameters::Set
+struct ModelParameterField {
+  void* address;
+  std::size_t size;  // bytes
+};
+
 // virtual class for setting model parameters
 class ModelParameters {
  public:
@@ -30,6 +37,30 @@ class ModelParameters {
 
   // set parameters
   virtual void Set(mjModel* model, const double* parameters, int dim) = 0;
+
+  // model fields written by Set (empty if unknown)
+  virtual std::vector<ModelParameterField> Fields(mjModel* model) const {
+    return {};
+  }
+};
+
+// patch parameters on a model and restore the fields they touch, so one
+// model per thread can be shared by all parameter perturbations
+class ModelParameterOverlay {
+ public:
+  // record fields of model touched by parameters and their current values
+  void Initialize(const ModelParameters& parameters, mjModel* model);
+
+  // set parameters on the recorded model
+  void Patch(ModelParameters& parameters, const double* values, int dim);
+
+  // restore recorded values, returns false if the fields are unknown
+  bool Restore();
+
+ private:
+  mjModel* model_ = nullptr;
+  std::vector<ModelParameterField> fields_;
+  std::vector<char> backup_;
 };
 
 // model parameter class for 1D particle w/ damping
@@ -46,6 +77,11 @@ class Particle1DDampedParameters : public ModelParameters {
     // set damping value
     model->dof_damping[0] = parameters[0];
   }
+
+  // fields
+  std::vector<ModelParameterField> Fields(mjModel* model) const override {
+    return {{model->dof_damping, sizeof(mjtNum)}};
+  }
 };
 
 // model parameter class for 1D particle w/ damping
@@ -73,6 +109,12 @@ class Particle1DFramePosParameters : public ModelParameters {
     model->site_pos[3 + 1] = parameters[3 + 1];
     model->site_pos[3 + 2] = parameters[3 + 2];
   }
+
+  // fields
+  std::vector<ModelParameterField> Fields(mjModel* model) const override {
+    return {{model->site_sameframe, 2 * sizeof(mjtByte)},
+            {model->site_pos, 6 * sizeof(mjtNum)}};
+  }
 };
 
 // Loads all available ModelParameters
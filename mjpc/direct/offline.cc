@@ -0,0 +1,212 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/direct/offline.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/direct/direct.h"
+#include "mjpc/direct/trajectory.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
+
+namespace mjpc {
+
+// create contexts
+void DirectOffline::Initialize(const mjModel* model, ThreadPool* pool) {
+  pool_ = pool;
+  settings.window =
+      std::clamp(settings.window, kMinDirectHistory, kMaxDirectTrajectory);
+
+  // one context per concurrent window, a calling worker also runs windows
+  int num_contexts = pool_ ? pool_->NumThreads() + 1 : 1;
+  contexts_.clear();
+  free_contexts_.clear();
+  for (int i = 0; i < num_contexts; i++) {
+    // the contexts' own pools have no workers, work runs on pool
+    auto direct = std::make_unique<Direct>(0);
+    direct->SetMaxHistory(settings.window);
+    direct->Initialize(model);
+    direct->SetConfigurationLength(settings.window);
+    direct->Reset();
+    if (pool_) direct->SetThreadPool(pool_);
+    free_contexts_.push_back(direct.get());
+    contexts_.push_back(std::move(direct));
+  }
+
+  // dimensions
+  nq_ = model->nq;
+  nparam_ = contexts_[0]->NumberParameters();
+  parameters = contexts_[0]->parameters;
+  mask_on_.assign(contexts_[0]->NumberSensors(), 1);
+}
+
+// smooth log
+void DirectOffline::Optimize(DirectLog* log) {
+  // start timer
+  TraceSpan span("DirectOffline::Optimize");
+
+  // -- windows -- //
+  int length = log->length;
+  if (length < kMinDirectHistory) return;
+  int window = std::min({settings.window, contexts_[0]->GetMaxHistory(),
+                         length});
+  int overlap = std::clamp(settings.overlap, 0, window - kMinDirectHistory);
+  int stride = std::max(window - overlap, 1);
+  window_start_.clear();
+  for (int start = 0;; start = std::min(start + stride, length - window)) {
+    window_start_.push_back(start);
+    if (start + window >= length) break;
+  }
+  int num_windows = window_start_.size();
+  window_length_.assign(num_windows, window);
+
+  // stored time steps, overlaps are split in the middle
+  window_begin_.resize(num_windows);
+  window_end_.resize(num_windows);
+  for (int i = 0; i < num_windows; i++) {
+    window_begin_[i] =
+        i == 0 ? 0
+               : (window_start_[i] + window_start_[i - 1] + window) / 2;
+    if (i > 0) window_end_[i - 1] = window_begin_[i];
+  }
+  window_end_[num_windows - 1] = length;
+
+  // -- consensus -- //
+  configuration_ = log->configuration;
+  stitched_.resize(configuration_.size());
+  window_parameters_.resize(num_windows * nparam_);
+  window_dual_.assign(num_windows * nparam_, 0.0);
+  window_cost_.resize(num_windows);
+  for (int i = 0; i < num_windows; i++) {
+    mju_copy(window_parameters_.data() + i * nparam_, parameters.data(),
+             nparam_);
+  }
+
+  iterations_ = 0;
+  consensus_residual_ = 0.0;
+  int max_iterations = nparam_ > 0 ? std::max(settings.consensus_iterations, 1)
+                                   : 1;
+  for (int k = 0; k < max_iterations; k++) {
+    // optimize windows
+    auto optimize = [&](int i) { OptimizeWindow(*log, i); };
+    if (pool_) {
+      pool_->ParallelFor(0, num_windows, 1, optimize);
+    } else {
+      for (int i = 0; i < num_windows; i++) optimize(i);
+    }
+    configuration_.swap(stitched_);
+    iterations_++;
+
+    // consensus: mean of window parameters and duals
+    if (nparam_ == 0) break;
+    mju_zero(parameters.data(), nparam_);
+    for (int i = 0; i < num_windows; i++) {
+      mju_addTo(parameters.data(), window_parameters_.data() + i * nparam_,
+                nparam_);
+      mju_addTo(parameters.data(), window_dual_.data() + i * nparam_,
+                nparam_);
+    }
+    mju_scl(parameters.data(), parameters.data(), 1.0 / num_windows, nparam_);
+
+    // dual update, residual
+    consensus_residual_ = 0.0;
+    for (int i = 0; i < num_windows; i++) {
+      const double* pi = window_parameters_.data() + i * nparam_;
+      double* ui = window_dual_.data() + i * nparam_;
+      for (int j = 0; j < nparam_; j++) {
+        double residual = pi[j] - parameters[j];
+        ui[j] += residual;
+        consensus_residual_ =
+            std::max(consensus_residual_, mju_abs(residual));
+      }
+    }
+    if (consensus_residual_ < settings.consensus_tolerance) break;
+  }
+
+  // total cost of the windows
+  cost_ = 0.0;
+  for (int i = 0; i < num_windows; i++) cost_ += window_cost_[i];
+
+  // stitched configurations
+  log->configuration = configuration_;
+}
+
+// optimize window
+void DirectOffline::OptimizeWindow(const DirectLog& log, int window) {
+  // free context
+  Direct* direct;
+  {
+    std::lock_guard<std::mutex> lock(contexts_mutex_);
+    direct = free_contexts_.back();
+    free_contexts_.pop_back();
+  }
+
+  // dimensions
+  int nv = direct->model->nv;
+  int ns = direct->DimensionSensor();
+  int num_sensor = direct->NumberSensors();
+  int start = window_start_[window];
+  int length = window_length_[window];
+
+  // window trajectories, warm started from the last pass
+  direct->SetConfigurationLength(length);
+  for (int t = 0; t < length; t++) {
+    int i = start + t;
+    const double* qi = configuration_.data() + nq_ * i;
+    direct->configuration.Set(qi, t);
+    direct->configuration_previous.Set(qi, t);
+    direct->times.Set(log.times.data() + i, t);
+    direct->sensor_measurement.Set(log.sensor_measurement.data() + ns * i, t);
+    direct->sensor_mask.Set(log.sensor_mask.empty()
+                                ? mask_on_.data()
+                                : log.sensor_mask.data() + num_sensor * i,
+                            t);
+    direct->force_measurement.Set(log.force_measurement.data() + nv * i, t);
+  }
+
+  // parameters: 0.5 * penalty * || p - (consensus - dual) ||^2
+  double* pw = window_parameters_.data() + window * nparam_;
+  if (nparam_ > 0) {
+    mju_copy(direct->parameters.data(), pw, nparam_);
+    mju_sub(direct->parameters_previous.data(), parameters.data(),
+            window_dual_.data() + window * nparam_, nparam_);
+    std::fill(direct->noise_parameter.begin(), direct->noise_parameter.end(),
+              1.0 / (settings.consensus_penalty * nparam_));
+  }
+
+  // optimize
+  direct->Optimize();
+
+  // store time steps of the window and parameters
+  int begin = window_begin_[window];
+  int end = window_end_[window];
+  for (int i = begin; i < end; i++) {
+    mju_copy(stitched_.data() + nq_ * i, direct->configuration.Get(i - start),
+             nq_);
+  }
+  mju_copy(pw, direct->parameters.data(), nparam_);
+  window_cost_[window] = direct->GetCost();
+
+  // release context
+  std::lock_guard<std::mutex> lock(contexts_mutex_);
+  free_contexts_.push_back(direct);
+}
+
+}  // namespace mjpc
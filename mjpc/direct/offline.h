@@ -0,0 +1,129 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_DIRECT_OFFLINE_H_
+#define MJPC_DIRECT_OFFLINE_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/direct/direct.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+// measurement log of any length for offline smoothing, one row per time step
+struct DirectLog {
+  int length = 0;
+  std::vector<double> configuration;       // length x nq, initial guess
+  std::vector<double> times;               // length
+  std::vector<double> sensor_measurement;  // length x ns
+  std::vector<int> sensor_mask;            // length x num_sensor, empty: on
+  std::vector<double> force_measurement;   // length x nv
+};
+
+// ----- offline smoothing of long logs with overlapping windows ----- //
+// the log is partitioned into overlapping windows that are optimized
+// concurrently on a shared pool, each by one of a fixed number of Direct
+// contexts. each window keeps the configurations up to the middle of its
+// overlaps. the windows share the model parameters, which agree by consensus
+// (ADMM): a window's parameter prior is the consensus, shifted by its scaled
+// dual, and replaces the contexts' parameter noise.
+class DirectOffline {
+ public:
+  // constructor
+  DirectOffline() = default;
+
+  // create the contexts for windows of settings.window time steps, one per
+  // concurrent window of pool (serial without pool). the pool must outlive
+  // its use by this object.
+  void Initialize(const mjModel* model, ThreadPool* pool);
+
+  // smooth log, the stitched configurations replace log->configuration. the
+  // initial parameters are given by parameters, which hold the consensus
+  // afterwards.
+  void Optimize(DirectLog* log);
+
+  // contexts, for noise, norm and solver settings (all alike)
+  int NumContexts() const { return contexts_.size(); }
+  Direct& Context(int i) { return *contexts_[i]; }
+
+  // windows of the last optimization
+  int NumWindows() const { return window_start_.size(); }
+  int WindowStart(int i) const { return window_start_[i]; }
+  int WindowLength(int i) const { return window_length_[i]; }
+
+  // status of the last optimization
+  int Iterations() const { return iterations_; }
+  double ConsensusResidual() const { return consensus_residual_; }
+  double Cost() const { return cost_; }
+
+  // parameters (nparam)
+  std::vector<double> parameters;
+
+  // settings
+  struct Settings {
+    int window = 256;  // time steps per window (<= kMaxDirectTrajectory)
+    int overlap = 32;  // time steps shared by neighboring windows
+    int consensus_iterations = 20;   // maximum window optimization passes
+    double consensus_penalty = 1.0;  // weight of the parameter consensus
+    double consensus_tolerance =
+        1.0e-6;  // stop when window parameters are this close (max norm)
+  } settings;
+
+ private:
+  // optimize window with a free context, store its configurations and
+  // parameters
+  void OptimizeWindow(const DirectLog& log, int window);
+
+  // worker contexts
+  ThreadPool* pool_ = nullptr;
+  std::vector<std::unique_ptr<Direct>> contexts_;
+  std::vector<Direct*> free_contexts_;
+  std::mutex contexts_mutex_;
+
+  // dimensions
+  int nq_ = 0;
+  int nparam_ = 0;
+
+  // windows: first time step, length and stored time steps [begin, end)
+  std::vector<int> window_start_;
+  std::vector<int> window_length_;
+  std::vector<int> window_begin_;
+  std::vector<int> window_end_;
+
+  // window parameters (num_windows x nparam) and scaled duals
+  std::vector<double> window_parameters_;
+  std::vector<double> window_dual_;
+  std::vector<double> window_cost_;
+
+  // configurations of the last pass and the pass in progress (length x nq)
+  std::vector<double> configuration_;
+  std::vector<double> stitched_;
+
+  // all sensors on (num_sensor)
+  std::vector<int> mask_on_;
+
+  // status
+  int iterations_ = 0;
+  double consensus_residual_ = 0.0;
+  double cost_ = 0.0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_DIRECT_OFFLINE_H_
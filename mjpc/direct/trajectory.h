@@ -16,6 +16,7 @@
 #define MJPC_DIRECT_TRAJECTORY_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <vector>
 
@@ -99,6 +100,9 @@ class DirectTrajectory {
   // get trajectory length
   int Length() const { return length_; }
 
+  // allocated bytes
+  std::size_t Bytes() const { return data_.capacity() * sizeof(T); }
+
   // set trajectory length
   void SetLength(int length) {
     // set
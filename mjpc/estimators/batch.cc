@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstddef>
+#include <memory>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -24,7 +25,9 @@
 #include "mjpc/array_safety.h"
 #include "mjpc/estimators/estimator.h"
 #include "mjpc/direct/direct.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -89,24 +92,25 @@ void Batch::Initialize(const mjModel* model) {
   cost_gradient_prior_.resize(ntotal_max);
 
   // cost Hessian
-  cost_hessian_.resize(ntotal_max * ntotal_max);
   cost_hessian_prior_band_.resize(nvel_max * nband_ + nparam_ * ntotal_max);
 
   // prior weights
   scale_prior = GetNumberOrDefault(1.0, model, "batch_scale_prior");
-  weight_prior_.resize(ntotal_max * ntotal_max);
-  weight_prior_band_.resize(nvel_max * nband_ + nparam_ * ntotal_max);
+  weight_prior_.resize(nvel_max * nband_);
 
   // scratch
-  scratch_prior_.resize(ntotal_max + 12 * nv * nv);
-
-  // conditioned matrix
-  mat00_.resize(ntotal_max * ntotal_max);
-  mat10_.resize(ntotal_max * ntotal_max);
-  mat11_.resize(ntotal_max * ntotal_max);
-  condmat_.resize(ntotal_max * ntotal_max);
-  scratch0_condmat_.resize(ntotal_max * ntotal_max);
-  scratch1_condmat_.resize(ntotal_max * ntotal_max);
+  scratch_prior_.resize(ntotal_max);
+  scratch_prior_block_.resize(3 * nv * nv * max_history_);
+
+  // conditioned matrix: the departing configuration couples to the next
+  // nband_ - 1 rows only
+  int ncoupled = nband_ - 1;
+  mat00_.resize(nv * nv);
+  mat10_.resize(ncoupled * nv);
+  mat11_.resize(ncoupled * ncoupled);
+  condmat_.resize((nv + ncoupled) * (nv + ncoupled));
+  scratch0_condmat_.resize(ncoupled * nv);
+  scratch1_condmat_.resize(ncoupled * ncoupled);
 
   // timer
   filter_timer_.prior_step.resize(max_history_);
@@ -126,6 +130,10 @@ void Batch::Initialize(const mjModel* model) {
   sensor_prediction_cache_.Initialize(nsensordata_, max_history_);
   sensor_mask_cache_.Initialize(nsensor_, max_history_);
 
+  // masked update
+  sensor_available_.resize(nsensor_);
+  sensor_time_.resize(nsensor_);
+
   // force
   force_measurement_cache_.Initialize(nv, max_history_);
   force_prediction_cache_.Initialize(nv, max_history_);
@@ -212,10 +220,10 @@ void Batch::Reset(const mjData* data) {
 
   // weight
   std::fill(weight_prior_.begin(), weight_prior_.end(), 0.0);
-  std::fill(weight_prior_band_.begin(), weight_prior_band_.end(), 0.0);
 
   // scratch
   std::fill(scratch_prior_.begin(), scratch_prior_.end(), 0.0);
+  std::fill(scratch_prior_block_.begin(), scratch_prior_block_.end(), 0.0);
 
   // conditioned matrix
   std::fill(mat00_.begin(), mat00_.end(), 0.0);
@@ -250,6 +258,13 @@ void Batch::Reset(const mjData* data) {
   for (int i = 0; i < nsensor_ * configuration_length_; i++) {
     sensor_mask_cache_.Data()[i] = 1;  // sensor on
   }
+  std::fill(sensor_available_.begin(), sensor_available_.end(), 1);
+  std::fill(sensor_time_.begin(), sensor_time_.end(), -mjMAXVAL);
+
+  // warm start, the filter is recreated with the current noise
+  warm_start_.reset();
+  num_updates_ = 0;
+  total_smoother_iterations_ = 0;
 
   // force
   force_measurement_cache_.Reset();
@@ -282,9 +297,11 @@ void Batch::Reset(const mjData* data) {
 }
 
 // update
-void Batch::Update(const double* ctrl, const double* sensor) {
+void Batch::UpdateMasked(const double* ctrl, const double* sensor,
+                         const int* available, const double* sensor_times) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Batch::Update");
+  ThreadQuota quota(quota_);
 
   // dimensions
   int nq = model->nq, nv = model->nv, na = model->na, nu = model->nu;
@@ -317,11 +334,19 @@ void Batch::Update(const double* ctrl, const double* sensor) {
   configuration.Set(d->qpos, t + 1);
   configuration_previous.Set(d->qpos, t + 1);
 
+  // warm start with the filtered prediction instead
+  if (filter_settings.kalman_warm_start) {
+    KalmanWarmStart(ctrl, sensor, available, sensor_times, t);
+  }
+
   // set next time
   times.Set(&d->time, t + 1);
 
-  // set sensor
+  // set sensor, sensors without a new measurement are masked
   sensor_measurement.Set(sensor + sensor_start_index_, t);
+  AvailableSensors(sensor_available_.data(), sensor_time_.data(), available,
+                   sensor_times, nsensor_);
+  sensor_mask.Set(sensor_available_.data(), t);
 
   // set force measurement
   force_measurement.Set(d->qfrc_actuator, t);
@@ -341,6 +366,8 @@ void Batch::Update(const double* ctrl, const double* sensor) {
 
   // optimize measurement corrected state
   Optimize();
+  num_updates_++;
+  total_smoother_iterations_ += IterationsSmoother();
 
   // update state
   mju_copy(state.data(), configuration.Get(t + 1), nq);
@@ -359,55 +386,34 @@ void Batch::Update(const double* ctrl, const double* sensor) {
     // condition dimension
     int ncondition = nvel_ - nv;
 
-    // band to dense cost Hessian
-    mju_band2Dense(cost_hessian_.data(), cost_hessian_band_.data(), ntotal_,
-                   nband_, nparam_, 1);
-
-    // compute conditioned matrix
-    double* condmat = condmat_.data();
-    ConditionMatrix(condmat, cost_hessian_.data(), mat00_.data(), mat10_.data(),
-                    mat11_.data(), scratch0_condmat_.data(),
-                    scratch1_condmat_.data(), ntotal_, nv, ncondition);
-
-    // zero memory
-    mju_zero(weights, ntotal_ * ntotal_);
-
-    // set conditioned matrix in prior weights
-    SetBlockInMatrix(weights, condmat, 1.0, ntotal_, ntotal_, ncondition,
-                     ncondition, 0, 0);
+    // marginalize the departing configuration, only the configurations in
+    // its band are coupled to it (band prior weights, ncondition rows)
+    ConditionBandToBand(weights, cost_hessian_band_.data(), condmat_.data(),
+                        mat00_.data(), mat10_.data(), mat11_.data(),
+                        scratch0_condmat_.data(), scratch1_condmat_.data(),
+                        nband_, nv, ncondition);
 
     // set bottom right to scale_prior * I
-    for (int i = ncondition; i < ntotal_; i++) {
-      weights[ntotal_ * i + i] = scale_prior;
+    mju_zero(weights + ncondition * nband_, (nvel_ - ncondition) * nband_);
+    for (int i = ncondition; i < nvel_; i++) {
+      weights[nband_ * i + nband_ - 1] = scale_prior;
     }
 
     // make block band
-    DenseToBlockBand(weights, ntotal_, nv, 3);
+    BandToBlockBand(weights, nvel_, nband_, nv, 3);
   } else {
     // dimension
-    int nvar_new = ntotal_;
+    int nvel_new = nvel_;
     if (current_time_index_ < configuration_length_ - 2) {
-      nvar_new += nv;
+      nvel_new += nv;
     }
 
-    // check same size
-    if (ntotal_ != nvar_new) {
-      // get previous weights
-      double* previous_weights = scratch0_condmat_.data();
-      mju_copy(previous_weights, weights, ntotal_ * ntotal_);
-
-      // set previous in new weights (dimension may have increased)
-      mju_zero(weights, nvar_new * nvar_new);
-      SetBlockInMatrix(weights, previous_weights, 1.0, nvar_new, nvar_new,
-                       ntotal_, ntotal_, 0, 0);
-
-      // scale_prior * I
-      for (int i = ntotal_; i < nvar_new; i++) {
-        weights[nvar_new * i + i] = scale_prior;
+    // new rows: scale_prior * I, previous rows are unchanged in band storage
+    if (nvel_ != nvel_new) {
+      mju_zero(weights + nvel_ * nband_, (nvel_new - nvel_) * nband_);
+      for (int i = nvel_; i < nvel_new; i++) {
+        weights[nband_ * i + nband_ - 1] = scale_prior;
       }
-
-      // make block band
-      DenseToBlockBand(weights, nvar_new, nv, 3);
     }
   }
 
@@ -428,7 +434,75 @@ void Batch::Update(const double* ctrl, const double* sensor) {
   }
 
   // stop timer
-  timer_.update = 1.0e-3 * GetDuration(start);
+  timer_.update = 1.0e-3 * span.End();
+}
+
+// Kalman warm start
+void Batch::KalmanWarmStart(const double* ctrl, const double* sensor,
+                            const int* available, const double* sensor_times,
+                            int t) {
+  int nq = model->nq, nv = model->nv, na = model->na;
+
+  // filter with the estimator's noise
+  if (!warm_start_) {
+    warm_start_ = std::make_unique<Kalman>(model);
+    Kalman& kalman = *warm_start_;
+    if (kalman.DimensionSensor() != nsensordata_) {
+      warm_start_.reset();
+      filter_settings.kalman_warm_start = false;
+      return;
+    }
+    kalman.SetCovariance(covariance.data());
+    mju_copy(kalman.noise_process.data(), noise_process.data(), ndstate_);
+    int shift = 0;
+    for (int i = 0; i < nsensor_; i++) {
+      int dim = model->sensor_dim[sensor_start_ + i];
+      mju_fill(kalman.noise_sensor.data() + shift, noise_sensor[i], dim);
+      shift += dim;
+    }
+  }
+  Kalman& kalman = *warm_start_;
+
+  // correct the current state, the filter covariance carries over
+  mju_copy(kalman.state.data(), state.data(), nq + nv + na);
+  kalman.UpdateMeasurement(ctrl, sensor, available, sensor_times);
+  configuration.Set(kalman.state.data(), t);
+
+  // predict the new configuration
+  kalman.UpdatePrediction();
+  configuration.Set(kalman.state.data(), t + 1);
+  configuration_previous.Set(kalman.state.data(), t + 1);
+}
+
+// insert delayed measurement
+bool Batch::InsertMeasurement(const double* sensor, const int* available,
+                              double time) {
+  // updated time step nearest time, the current time step is set by the next
+  // update
+  int index = -1;
+  double nearest = 0.5 * model->opt.timestep;
+  for (int t = 0; t < current_time_index_; t++) {
+    double difference = mju_abs(times.Get(t)[0] - time);
+    if (difference <= nearest) {
+      nearest = difference;
+      index = t;
+    }
+  }
+  if (index < 0) return false;
+
+  // measurements of the flagged sensors
+  double* measurement = sensor_measurement.Get(index);
+  int* mask = sensor_mask.Get(index);
+  int shift = 0;
+  for (int i = 0; i < nsensor_; i++) {
+    int dim = model->sensor_dim[sensor_start_ + i];
+    if (!available || available[i]) {
+      mju_copy(measurement + shift, sensor + sensor_start_index_ + shift, dim);
+      mask[i] = 1;
+    }
+    shift += dim;
+  }
+  return true;
 }
 
 // set state
@@ -492,18 +566,13 @@ void Batch::SetPriorWeights(const double* weights, double scale) {
   int nv = model->nv;
 
   // allocate memory
-  weight_prior_.resize(nvel_ * nvel_);
-  weight_prior_band_.resize(nvel_ * nband_);
-
-  // set weights
-  mju_copy(weight_prior_.data(), weights, nvel_ * nvel_);
-
-  // make block band
-  DenseToBlockBand(weight_prior_.data(), nvel_, nv, 3);
+  if (static_cast<int>(weight_prior_.size()) < nvel_ * nband_) {
+    weight_prior_.resize(nvel_ * nband_);
+  }
 
-  // dense to band
-  mju_dense2Band(weight_prior_band_.data(), weight_prior_.data(), nvel_, nband_,
-                 0);
+  // dense to block band
+  mju_dense2Band(weight_prior_.data(), weights, nvel_, nband_, 0);
+  BandToBlockBand(weight_prior_.data(), nvel_, nband_, nv, 3);
 
   // set scaling
   scale_prior = scale;
@@ -511,29 +580,14 @@ void Batch::SetPriorWeights(const double* weights, double scale) {
 
 // shift trajectory heads
 void Batch::Shift(int shift) {
-  // update trajectory lengths
-  configuration.Shift(shift);
-  configuration_copy_.Shift(shift);
-
-  velocity.Shift(shift);
-  acceleration.Shift(shift);
-  act.Shift(shift);
-  times.Shift(shift);
-
-  configuration_previous.Shift(shift);
-
-  sensor_measurement.Shift(shift);
-  sensor_prediction.Shift(shift);
-  sensor_mask.Shift(shift);
-
-  force_measurement.Shift(shift);
-  force_prediction.Shift(shift);
+  // direct trajectories, retained evaluations are reused by the next update
+  ShiftTrajectories(shift);
 }
 
 // prior cost
 double Batch::CostPrior(double* gradient, double* hessian) {
   // start timer
-  auto start_cost = std::chrono::steady_clock::now();
+  TraceSpan span_cost("Batch::CostPrior");
 
   // total scaling
   double scale = scale_prior / ntotal_;
@@ -552,91 +606,79 @@ double Batch::CostPrior(double* gradient, double* hessian) {
   // initial cost
   double cost = 0.0;
 
-  // dense2band
-  mju_dense2Band(weight_prior_band_.data(), weight_prior_.data(), nvel_, nband_,
-                 0);
-
   // compute cost
   if (!cost_skip_) {
     // residual
     ResidualPrior();
 
     // multiply: tmp = P * r
-    mju_bandMulMatVec(tmp, weight_prior_band_.data(), r, nvel_, nband_, 0, 1,
+    mju_bandMulMatVec(tmp, weight_prior_.data(), r, nvel_, nband_, 0, 1,
                       true);
 
     // weighted quadratic: 0.5 * w * r' * tmp
     cost = 0.5 * scale * mju_dot(r, tmp, nvel_);
 
     // stop cost timer
-    filter_timer_.cost_prior += GetDuration(start_cost);
+    filter_timer_.cost_prior += span_cost.End();
   }
 
   // derivatives
   if (!gradient && !hessian) return cost;
 
-  auto start_derivatives = std::chrono::steady_clock::now();
+  TraceSpan span_derivatives("Batch::cost_prior_derivatives");
 
-  // loop over configurations
-  for (int t = 0; t < configuration_length_; t++) {
+  // configurations in parallel: gradient block t and Hessian block row t.
+  // the prior Jacobian is block diagonal, so the Hessian blocks are
+  // bdt' * btj * bdj for the weight blocks btj within the band (j >= t - 2).
+  pool_->ParallelFor(0, configuration_length_, 1, pool_priority_, [&](int t) {
     // cost gradient wrt configuration
+    const double* bdt = block_prior_current_configuration_.Get(t);
     if (gradient) {
       // unpack
       double* gt = gradient + t * nv;
-      double* block = block_prior_current_configuration_.Get(t);
 
       // compute
-      mju_mulMatTVec(gt, block, tmp + t * nv, nv, nv);
+      mju_mulMatTVec(gt, bdt, tmp + t * nv, nv, nv);
 
       // scale gradient: w * drdq' * scratch
       mju_scl(gt, gt, scale, nv);
     }
 
-    // cost Hessian wrt configuration (sparse)
+    // cost Hessian wrt configuration (block band)
     if (hessian) {
-      // TODO(taylor): skip terms for efficiency
-      if (t < configuration_length_ - 2) {
-        // mat
-        double* mat = tmp + ntotal_;
-        mju_zero(mat, nband_ * nband_);
-
-        for (int i = 0; i < 3; i++) {
-          for (int j = 0; j < 3; j++) {
-            if (j <= i) {
-              // unpack
-              double* bbij = mat + nband_ * nband_;
-              double* tmp0 = bbij + nv * nv;
-              double* tmp1 = tmp0 + nv * nv;
-
-              // get matrices
-              BlockFromMatrix(bbij, weight_prior_.data(), nv, nv, nvel_, nvel_,
-                              (i + t) * nv, (j + t) * nv);
-              const double* bdi = block_prior_current_configuration_.Get(i + t);
-              const double* bdj = block_prior_current_configuration_.Get(j + t);
-
-              // -- bdi' * bbij * bdj -- //
-
-              // tmp0 = bbij * bdj
-              mju_mulMatMat(tmp0, bbij, bdj, nv, nv, nv);
-
-              // tmp1 = bdi' * tmp0
-              mju_mulMatTMat(tmp1, bdi, tmp0, nv, nv, nv);
-
-              // set scaled block in matrix
-              SetBlockInMatrix(mat, tmp1, scale, nband_, nband_, nv, nv, i * nv,
-                               j * nv);
-            }
-          }
+      // unpack
+      double* btj = scratch_prior_block_.data() + 3 * nv * nv * t;
+      double* tmp0 = btj + nv * nv;
+      double* tmp1 = tmp0 + nv * nv;
+
+      for (int j = std::max(0, t - 2); j <= t; j++) {
+        // get matrices
+        BlockFromBand(btj, weight_prior_.data(), nband_, nv, nv, t * nv,
+                      j * nv);
+        const double* bdj = block_prior_current_configuration_.Get(j);
+
+        // -- bdt' * btj * bdj -- //
+
+        // tmp0 = btj * bdj
+        mju_mulMatMat(tmp0, btj, bdj, nv, nv, nv);
+
+        // tmp1 = bdt' * tmp0
+        mju_mulMatTMat(tmp1, bdt, tmp0, nv, nv, nv);
+
+        // set scaled block in band rows of configuration t, lower triangle
+        for (int a = 0; a < nv; a++) {
+          int row = t * nv + a;
+          int width = j < t ? nv : a + 1;
+          double* band_row =
+              hessian + row * nband_ + nband_ - 1 - (row - j * nv);
+          mju_scl(band_row, tmp1 + a * nv, scale, width);
         }
-        // set mat in band Hessian
-        SetBlockInBand(hessian, mat, 1.0, nvel_, nband_, nband_, t * nv, 0,
-                       false);
       }
     }
-  }
+  });
 
   // stop derivatives timer
-  filter_timer_.cost_prior_derivatives += GetDuration(start_derivatives);
+  filter_timer_.cost_prior_derivatives += span_derivatives.End();
 
   return cost;
 }
@@ -644,13 +686,13 @@ double Batch::CostPrior(double* gradient, double* hessian) {
 // prior residual
 void Batch::ResidualPrior() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Batch::ResidualPrior");
 
   // dimension
   int nv = model->nv;
 
   // loop over configurations
-  for (int t = 0; t < configuration_length_; t++) {
+  pool_->ParallelFor(0, configuration_length_, 4, pool_priority_, [&](int t) {
     // terms
     double* rt = residual_prior_.data() + t * nv;
     double* qt_prior = configuration_previous.Get(t);
@@ -658,10 +700,10 @@ void Batch::ResidualPrior() {
 
     // configuration difference
     mj_differentiatePos(model, rt, 1.0, qt_prior, qt);
-  }
+  });
 
   // stop timer
-  filter_timer_.residual_prior += GetDuration(start);
+  filter_timer_.residual_prior += span.End();
 }
 
 // prior Jacobian blocks
@@ -686,20 +728,20 @@ void Batch::BlockPrior(int index) {
 }
 
 // prior Jacobian
-// note: pool wait is called outside this function
-void Batch::JacobianPrior() {
+// note: group wait is called outside this function
+void Batch::JacobianPrior(TaskGroup& group) {
   // loop over predictions
   for (int t = 0; t < configuration_length_; t++) {
     // schedule by time step
-    pool_.Schedule([&batch = *this, t]() {
+    group.Schedule([&batch = *this, t]() {
       // start Jacobian timer
-      auto jacobian_prior_start = std::chrono::steady_clock::now();
+      TraceSpan jacobian_prior_span("Batch::jacobian_prior");
 
       // block
       batch.BlockPrior(t);
 
       // stop Jacobian timer
-      batch.filter_timer_.prior_step[t] = GetDuration(jacobian_prior_start);
+      batch.filter_timer_.prior_step[t] = jacobian_prior_span.End();
     });
   }
 }
@@ -792,8 +834,8 @@ void Batch::InitializeFilter() {
   }
 
   // prior weight
-  for (int i = 0; i < ntotal_; i++) {
-    weight_prior_[ntotal_ * i + i] = scale_prior;
+  for (int i = 0; i < nvel_; i++) {
+    weight_prior_[nband_ * i + nband_ - 1] = scale_prior;
   }
 }
 
@@ -865,35 +907,34 @@ void Batch::ShiftResizeTrajectory(int new_head, int new_length) {
 
 // compute total cost
 double Batch::Cost(double* gradient, double* hessian) {
+  ThreadQuota quota(quota_);
+
   // base method
   double cost = Direct::Cost(gradient, hessian);
 
   // prior Jacobian derivatives
   if (gradient || hessian) {
     // start timer for prior Jacobian
-    auto timer_jacobian_start = std::chrono::steady_clock::now();
+    TraceSpan timer_jacobian_span("Batch::jacobian");
 
     // individual derivatives
     if (filter_settings.assemble_prior_jacobian) {
       mju_zero(jacobian_prior_.data(), ntotal_ * ntotal_);
     }
 
-    // pool count
-    int count_begin = pool_.GetCount();
+    // tasks
+    TaskGroup group(*pool_, pool_priority_);
 
     // compute Jacobian of prior cost
-    JacobianPrior();
+    JacobianPrior(group);
 
     // wait
-    pool_.WaitCount(count_begin + configuration_length_);
-
-    // reset count
-    pool_.ResetCount();
+    group.Wait();
 
     // timers
     filter_timer_.jacobian_prior +=
         mju_sum(filter_timer_.prior_step.data(), configuration_length_);
-    timer_.jacobian_total += GetDuration(timer_jacobian_start);
+    timer_.jacobian_total += timer_jacobian_span.End();
   }
 
   // prior cost
@@ -906,25 +947,25 @@ double Batch::Cost(double* gradient, double* hessian) {
   // total gradient, hessian
   if (gradient) {
     // start gradient timer
-    auto start = std::chrono::steady_clock::now();
+    TraceSpan span("Batch::cost_gradient");
 
     // add prior gradient
     mju_addTo(gradient, cost_gradient_prior_.data(), ntotal_);
 
     // stop gradient timer
-    timer_.cost_gradient += GetDuration(start);
+    timer_.cost_gradient += span.End();
   }
 
   if (hessian) {
     // start Hessian timer
-    auto start = std::chrono::steady_clock::now();
+    TraceSpan span("Batch::cost_hessian");
 
     // add prior Hessian
     mju_addTo(hessian, cost_hessian_prior_band_.data(),
               nvel_ * nband_ + nparam_ * ntotal_);
 
     // stop Hessian timer
-    timer_.cost_hessian += GetDuration(start);
+    timer_.cost_hessian += span.End();
   }
 
   // total cost
@@ -1140,21 +1181,13 @@ void Batch::SetGUIData() {
   // changing horizon cases
   if (horizon > configuration_length_) {  // increase horizon
     // -- prior weights resize -- //
-    int ntotal_new = model->nv * horizon;
+    int nvel_new = model->nv * horizon;
 
-    // get previous weights
+    // new rows: scale_prior * I, previous rows are unchanged in band storage
     double* weights = weight_prior_.data();
-    double* previous_weights = scratch0_condmat_.data();
-    mju_copy(previous_weights, weights, ntotal_ * ntotal_);
-
-    // set previous in new weights (dimension may have increased)
-    mju_zero(weights, ntotal_new * ntotal_new);
-    SetBlockInMatrix(weights, previous_weights, 1.0, ntotal_new, ntotal_new,
-                     ntotal_, ntotal_, 0, 0);
-
-    // scale_prior * I
-    for (int i = ntotal_; i < ntotal_new; i++) {
-      weights[ntotal_new * i + i] = scale_prior;
+    mju_zero(weights + nvel_ * nband_, (nvel_new - nvel_) * nband_);
+    for (int i = nvel_; i < nvel_new; i++) {
+      weights[nband_ * i + nband_ - 1] = scale_prior;
     }
 
     // modify trajectories
@@ -1166,17 +1199,11 @@ void Batch::SetGUIData() {
     ntotal_ = nvel_ + nparam_;
   } else if (horizon < configuration_length_) {  // decrease horizon
     // -- prior weights resize -- //
-    int ntotal_new = model->nv * horizon;
-
-    // get previous weights
-    double* weights = weight_prior_.data();
-    double* previous_weights = scratch0_condmat_.data();
-    BlockFromMatrix(previous_weights, weights, ntotal_new, ntotal_new, ntotal_,
-                    ntotal_, 0, 0);
+    int nvel_new = model->nv * horizon;
 
-    // set previous in new weights (dimension may have increased)
-    mju_zero(weights, ntotal_ * ntotal_);
-    mju_copy(weights, previous_weights, ntotal_new * ntotal_new);
+    // keep the leading rows
+    mju_zero(weight_prior_.data() + nvel_new * nband_,
+             (nvel_ - nvel_new) * nband_);
 
     // compute difference in estimation horizons
     int horizon_diff = configuration_length_ - horizon;
@@ -1192,6 +1219,32 @@ void Batch::SetGUIData() {
   }
 }
 
+void Batch::ReportMemory(MemoryReport& report) const {
+  Direct::ReportMemory(report);
+  report.Add("prior",
+             VectorBytes(state, covariance, residual_prior_, jacobian_prior_,
+                         cost_gradient_prior_, cost_hessian_prior_band_,
+                         scratch_prior_, scratch_prior_block_, weight_prior_,
+                         mat00_, mat10_, mat11_, condmat_, scratch0_condmat_,
+                         scratch1_condmat_, sensor_available_, sensor_time_) +
+                 block_prior_current_configuration_.Bytes());
+  report.Add("cache",
+             configuration_cache_.Bytes() +
+                 configuration_previous_cache_.Bytes() +
+                 velocity_cache_.Bytes() + acceleration_cache_.Bytes() +
+                 act_cache_.Bytes() + times_cache_.Bytes() +
+                 sensor_measurement_cache_.Bytes() +
+                 sensor_prediction_cache_.Bytes() +
+                 sensor_mask_cache_.Bytes() +
+                 force_measurement_cache_.Bytes() +
+                 force_prediction_cache_.Bytes());
+  if (warm_start_) {
+    MemoryReport warm_start;
+    warm_start_->ReportMemory(warm_start);
+    report.Add("warm_start", warm_start);
+  }
+}
+
 // estimator-specific plots
 void Batch::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                   int planner_shift, int timer_shift, int planning,
@@ -23,6 +23,7 @@
 #include <mujoco/mujoco.h>
 
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/estimators/kalman.h"
 #include "mjpc/direct/direct.h"
 #include "mjpc/direct/trajectory.h"
 #include "mjpc/norm.h"
@@ -51,6 +52,14 @@ class Batch : public Direct, public Estimator {
   // total cost
   double Cost(double* gradient, double* hessian) override;
 
+  // use an external thread pool
+  void SetThreadPool(ThreadPool* pool) override {
+    Direct::SetThreadPool(pool);
+  }
+  void SetThreadPoolPriority(TaskPriority priority) override {
+    Direct::SetThreadPoolPriority(priority);
+  }
+
   // initialize
   void Initialize(const mjModel* model) override;
 
@@ -58,7 +67,22 @@ class Batch : public Direct, public Estimator {
   void Reset(const mjData* data = nullptr) override;
 
   // update
-  void Update(const double* ctrl, const double* sensor) override;
+  void Update(const double* ctrl, const double* sensor) override {
+    UpdateMasked(ctrl, sensor, nullptr, nullptr);
+  }
+
+  // update with the sensors that have a new measurement, the others are
+  // masked at the current time
+  void UpdateMasked(const double* ctrl, const double* sensor,
+                    const int* available, const double* sensor_times) override;
+
+  // insert a delayed measurement of the sensors flagged by available
+  // (nsensor_, nullptr: all) at the updated time step of the window within
+  // half a time step of time, returns false if there is none. the next update
+  // optimizes with it, predictions and Jacobian blocks don't depend on
+  // measurements and are reused.
+  bool InsertMeasurement(const double* sensor, const int* available,
+                         double time);
 
   // get state
   double* State() override { return state.data(); };
@@ -113,6 +137,9 @@ class Batch : public Direct, public Estimator {
   // set GUI data
   void SetGUIData() override;
 
+  // bytes of the smoother, prior and cache buffers, and the warm start filter
+  void ReportMemory(MemoryReport& report) const override;
+
   // estimator-specific plots
   void Plots(mjvFigure* fig_planner, mjvFigure* fig_timer, int planner_shift,
              int timer_shift, int planning, int* shift) override;
@@ -136,7 +163,7 @@ class Batch : public Direct, public Estimator {
   // set prior weights
   void SetPriorWeights(const double* weights, double scale = 1.0);
 
-  // get prior weights
+  // get prior weights, (nv * configuration_length_) x (3 * nv) band storage
   const double* PriorWeights() { return weight_prior_.data(); }
 
   // state (nstate_)
@@ -154,9 +181,26 @@ class Batch : public Direct, public Estimator {
     bool verbose_prior = false;  // flag for printing prior weight update status
     bool assemble_prior_jacobian = false;   // assemble dense prior Jacobian
     bool recursive_prior_update = false;  // recursively update prior matrix
+    bool kalman_warm_start = false;  // new configurations from a Kalman filter
   } filter_settings;
 
+  // get update timer (ms)
+  double TimerUpdate() const { return timer_.update; }
+
+  // get timer (ms) of the update's optimization
+  double TimerOptimize() const { return 1.0e-3 * timer_.optimize; }
+
+  // smoother iterations per update since reset, fewer with a warm start
+  double SmootherIterationsPerUpdate() const {
+    return num_updates_ > 0
+               ? static_cast<double>(total_smoother_iterations_) / num_updates_
+               : 0.0;
+  }
+
  private:
+  // the prior cost Hessian is only assembled in band storage
+  bool MatrixFree() const override { return false; }
+
   // ----- prior ----- //
   // cost
   double CostPrior(double* gradient, double* hessian);
@@ -168,7 +212,7 @@ class Batch : public Direct, public Estimator {
   void BlockPrior(int index);
 
   // Jacobian
-  void JacobianPrior();
+  void JacobianPrior(TaskGroup& group);
 
   // initialize filter mode
   void InitializeFilter();
@@ -201,16 +245,13 @@ class Batch : public Direct, public Estimator {
                                  // (nv * max_history_)
 
   // cost scratch
-  std::vector<double> scratch_prior_;  // nv * max_history_ + 12 * nv * nv +
-                                       // nparam * (nv * max_history_)
+  std::vector<double> scratch_prior_;        // nv * max_history_ + nparam
+  std::vector<double> scratch_prior_block_;  // 3 * nv * nv * max_history_
 
-  // prior weights
-  std::vector<double> weight_prior_;  // (nv * max_history_ + nparam) * (nv *
-                                      // max_history_ + nparam)
-  std::vector<double> weight_prior_band_;  // (nv * max_history_ + nparam) * (nv
-                                           // * max_history_ + nparam)
+  // prior weights, block band (3 blocks) in band storage
+  std::vector<double> weight_prior_;  // (nv * max_history_) * (3 * nv)
 
-  // conditioned matrix
+  // conditioned matrix, leading (4 * nv - 1) block
   std::vector<double> mat00_;
   std::vector<double> mat10_;
   std::vector<double> mat11_;
@@ -221,6 +262,24 @@ class Batch : public Direct, public Estimator {
   // filter mode status
   int current_time_index_;
 
+  // warm start the current and new configurations with a Kalman filter
+  // synchronized with the state, from the measurement at time step t
+  void KalmanWarmStart(const double* ctrl, const double* sensor,
+                       const int* available, const double* sensor_times,
+                       int t);
+
+  // Kalman filter for warm starts, created by the first update that uses it
+  std::unique_ptr<Kalman> warm_start_;
+
+  // smoother iterations since reset
+  int num_updates_ = 0;
+  int total_smoother_iterations_ = 0;
+
+  // sensors measured at the current time (nsensor_) and their last
+  // measurement times (nsensor_)
+  std::vector<int> sensor_available_;
+  std::vector<double> sensor_time_;
+
   // timers
   struct FilterTimers {
     double cost_prior_derivatives;
@@ -0,0 +1,67 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/estimators/estimator.h"
+
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/snapshot.h"
+
+namespace mjpc {
+
+int AvailableSensors(int* flags, double* last_time, const int* available,
+                     const double* times, int nsensor) {
+  int num_available = 0;
+  for (int i = 0; i < nsensor; i++) {
+    flags[i] = !available || available[i];
+    if (flags[i] && times) {
+      // stale measurements were already used
+      flags[i] = times[i] > last_time[i];
+      if (flags[i]) last_time[i] = times[i];
+    }
+    num_available += flags[i];
+  }
+  return num_available;
+}
+
+void Estimator::Snapshot(SnapshotWriter& writer) {
+  const mjModel* model = Model();
+  int nstate = model->nq + model->nv + model->na;
+  int ndstate = DimensionProcess();
+  writer.Add("estimator.state", State(), nstate);
+  writer.Add("estimator.covariance", Covariance(), ndstate * ndstate);
+  writer.Add("estimator.time", Time());
+}
+
+bool Estimator::Restore(const SnapshotReader& reader) {
+  const mjModel* model = Model();
+  int nstate = model->nq + model->nv + model->na;
+  int ndstate = DimensionProcess();
+  std::vector<double> state(nstate);
+  std::vector<double> covariance(ndstate * ndstate);
+  double time;
+  if (!reader.Read("estimator.state", state.data(), nstate) ||
+      !reader.Read("estimator.covariance", covariance.data(),
+                   ndstate * ndstate) ||
+      !reader.Read("estimator.time", &time, 1)) {
+    return false;
+  }
+  SetState(state.data());
+  SetCovariance(covariance.data());
+  SetTime(time);
+  return true;
+}
+
+}  // namespace mjpc
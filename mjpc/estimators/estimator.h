@@ -15,12 +15,17 @@
 #ifndef MJPC_ESTIMATORS_ESTIMATOR_H_
 #define MJPC_ESTIMATORS_ESTIMATOR_H_
 
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
 #include <mujoco/mujoco.h>
 
+#include "mjpc/memory_report.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/snapshot.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -29,6 +34,13 @@ namespace mjpc {
 inline constexpr int kMaxProcessNoise = 1028;
 inline constexpr int kMaxSensorNoise = 1028;
 
+// flags (nsensor) of the sensors used by a masked update from available and
+// times (both optional, see Estimator::UpdateMasked). last_time (nsensor)
+// holds the measurement times last used and is advanced for flagged sensors.
+// returns the number of flagged sensors.
+int AvailableSensors(int* flags, double* last_time, const int* available,
+                     const double* times, int nsensor);
+
 // virtual estimator class
 class Estimator {
  public:
@@ -45,6 +57,17 @@ class Estimator {
   // update
   virtual void Update(const double* ctrl, const double* sensor) = 0;
 
+  // update with the sensors that have a new measurement, for sensors
+  // sampled at different rates. available (nsensor, the estimator's sensors
+  // in model order) flags sensors measured in sensor, nullptr: all. times
+  // (nsensor, optional) are the sensors' measurement times, a sensor whose
+  // time didn't advance since it was last used is skipped. estimators
+  // without masked updates use all sensors.
+  virtual void UpdateMasked(const double* ctrl, const double* sensor,
+                            const int* available, const double* times) {
+    Update(ctrl, sensor);
+  }
+
   // get state
   virtual double* State() = 0;
 
@@ -94,6 +117,23 @@ class Estimator {
   virtual void Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                      int planner_shift, int timer_shift, int planning,
                      int* shift) = 0;
+
+  // use an external thread pool for parallel work (nullptr restores the
+  // estimator's own). estimators without parallel work ignore it.
+  virtual void SetThreadPool(ThreadPool* pool) {}
+
+  // priority lane of the estimator's tasks on its pool, e.g., low when the
+  // pool is shared with the planner
+  virtual void SetThreadPoolPriority(TaskPriority priority) {}
+
+  // write the state, covariance and time to a snapshot as sections
+  // estimator.*, and restore them. Restore returns false, leaving the
+  // estimator unchanged, if the dimensions don't match.
+  virtual void Snapshot(SnapshotWriter& writer);
+  virtual bool Restore(const SnapshotReader& reader);
+
+  // add the bytes of the estimator's buffers and mjData to report
+  virtual void ReportMemory(MemoryReport& report) const {}
 };
 
 // ground truth estimator
@@ -109,14 +149,13 @@ class GroundTruth : public Estimator {
   // destructor
   ~GroundTruth() override {
     if (data_) mj_deleteData(data_);
-    if (model) mj_deleteModel(model);
   }
 
   // initialize
   void Initialize(const mjModel* model) override {
     // model
-    if (this->model) mj_deleteModel(this->model);
-    this->model = mj_copyModel(nullptr, model);
+    shared_model_ = std::make_unique<SharedModel>(ShareModel(model));
+    this->model = shared_model_->get();
 
     // data
     if (data_) mj_deleteData(data_);
@@ -278,6 +317,9 @@ class GroundTruth : public Estimator {
   std::vector<double> noise_sensor;
 
  private:
+  // owner of model, sharing its arrays with other users of the model
+  std::unique_ptr<SharedModel> shared_model_;
+
   // data
   mjData* data_ = nullptr;
 
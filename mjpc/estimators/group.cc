@@ -0,0 +1,86 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/estimators/group.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
+
+namespace mjpc {
+
+int EstimatorGroup::Add(Estimator* estimator) {
+  estimator->SetThreadPool(pool_);
+  members_.push_back(estimator);
+  update_time_.push_back(0.0);
+  return members_.size() - 1;
+}
+
+void EstimatorGroup::Clear() {
+  members_.clear();
+  update_time_.clear();
+  primary_ = 0;
+}
+
+void EstimatorGroup::SetThreadPool(ThreadPool* pool) {
+  pool_ = pool;
+  for (Estimator* estimator : members_) estimator->SetThreadPool(pool);
+}
+
+void EstimatorGroup::SetData(double time, const double* mocap_pos,
+                             const double* mocap_quat,
+                             const double* userdata) {
+  for (Estimator* estimator : members_) {
+    const mjModel* model = estimator->Model();
+    mjData* data = estimator->Data();
+    data->time = time;
+    mju_copy(data->mocap_pos, mocap_pos, 3 * model->nmocap);
+    mju_copy(data->mocap_quat, mocap_quat, 4 * model->nmocap);
+    mju_copy(data->userdata, userdata, model->nuserdata);
+  }
+}
+
+void EstimatorGroup::Update(const double* ctrl, const double* sensor,
+                            const int* available, const double* times) {
+  // start timer
+  TraceSpan span("EstimatorGroup::Update");
+
+  // members are independent, each on one task
+  auto update = [&](int i) {
+    auto start = std::chrono::steady_clock::now();
+    members_[i]->UpdateMasked(ctrl, sensor, available, times);
+    update_time_[i] = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  };
+  if (pool_ && pool_->NumThreads() > 0) {
+    pool_->ParallelFor(0, members_.size(), 1, update);
+  } else {
+    for (int i = 0; i < members_.size(); i++) update(i);
+  }
+
+  // stop timer (ms)
+  total_update_time_ = 1.0e-3 * span.End();
+}
+
+void EstimatorGroup::SetPrimary(int i) {
+  primary_ = std::clamp(i, 0, std::max(Size() - 1, 0));
+}
+
+}  // namespace mjpc
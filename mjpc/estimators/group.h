@@ -0,0 +1,81 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_ESTIMATORS_GROUP_H_
+#define MJPC_ESTIMATORS_GROUP_H_
+
+#include <atomic>
+#include <vector>
+
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+// estimators tracking one sensor stream, e.g., for fault detection. an update
+// is fanned out to all members concurrently on a pool. the primary member's
+// state is the group's estimate and can be switched at any time.
+class EstimatorGroup {
+ public:
+  // add an estimator (not owned, must outlive the group), returns its index
+  int Add(Estimator* estimator);
+
+  // remove all members
+  void Clear();
+
+  // update members concurrently on pool (serially without one). the pool is
+  // also used by the members for their own parallel work, it must outlive
+  // its use by this object.
+  void SetThreadPool(ThreadPool* pool);
+
+  // copy the measurement time, mocap and userdata of the model into the
+  // members' data, before an update
+  void SetData(double time, const double* mocap_pos, const double* mocap_quat,
+               const double* userdata);
+
+  // update all members with the same measurement, see
+  // Estimator::UpdateMasked
+  void Update(const double* ctrl, const double* sensor,
+              const int* available = nullptr, const double* times = nullptr);
+
+  // members
+  int Size() const { return members_.size(); }
+  Estimator& Member(int i) { return *members_[i]; }
+
+  // member state and covariance
+  double* State(int i) { return members_[i]->State(); }
+  double* Covariance(int i) { return members_[i]->Covariance(); }
+
+  // member update time of the last update (ms)
+  double UpdateTime(int i) const { return update_time_[i]; }
+
+  // wall time of the last update (ms)
+  double TotalUpdateTime() const { return total_update_time_; }
+
+  // primary member, switched between updates (safe from other threads)
+  void SetPrimary(int i);
+  int Primary() const { return primary_.load(); }
+  Estimator& PrimaryEstimator() { return *members_[primary_.load()]; }
+
+ private:
+  std::vector<Estimator*> members_;
+  std::vector<double> update_time_;
+  double total_update_time_ = 0.0;
+  ThreadPool* pool_ = nullptr;
+  std::atomic<int> primary_ = 0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_ESTIMATORS_GROUP_H_
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <memory>
+#include <utility>
 #include <vector>
 #include "mjpc/estimators/batch.h"
 #include "mjpc/estimators/estimator.h"
@@ -26,17 +27,29 @@ const char kEstimatorNames[] =
     "Unscented\n"
     "Batch";
 
+// load estimator by index, order matches kEstimatorNames
+std::unique_ptr<mjpc::Estimator> LoadEstimator(int index) {
+  switch (index) {
+    case 0:
+      return std::make_unique<mjpc::GroundTruth>();  // ground truth state
+    case 1:
+      return std::make_unique<mjpc::Kalman>();  // extended Kalman filter
+    case 2:
+      return std::make_unique<mjpc::Unscented>();  // unscented Kalman filter
+    case 3:
+      return std::make_unique<mjpc::Batch>();  // recursive batch filter
+    default:
+      return nullptr;
+  }
+}
+
 // load all available estimators
 std::vector<std::unique_ptr<mjpc::Estimator>> LoadEstimators() {
-  // planners
+  // estimators
   std::vector<std::unique_ptr<mjpc::Estimator>> estimators;
-
-  // add estimators
-  estimators.emplace_back(new mjpc::GroundTruth());  // ground truth state
-  estimators.emplace_back(new mjpc::Kalman());       // extended Kalman filter
-  estimators.emplace_back(new mjpc::Unscented());    // unscented Kalman filter
-  estimators.emplace_back(new mjpc::Batch());       // recursive batch filter
-
+  while (auto estimator = LoadEstimator(estimators.size())) {
+    estimators.push_back(std::move(estimator));
+  }
   return estimators;
 }
 
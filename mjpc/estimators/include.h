@@ -27,6 +27,9 @@ namespace mjpc {
 // Estimator names, separated by '\n'.
 extern const char kEstimatorNames[];
 
+// Loads estimator at index in kEstimatorNames, nullptr if out of range
+std::unique_ptr<mjpc::Estimator> LoadEstimator(int index);
+
 // Loads all available estimators
 std::vector<std::unique_ptr<mjpc::Estimator>> LoadEstimators();
 
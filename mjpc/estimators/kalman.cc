@@ -15,6 +15,8 @@
 #include "mjpc/estimators/kalman.h"
 
 #include <chrono>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -22,6 +24,10 @@
 
 #include "mjpc/array_safety.h"
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/memory_report.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -30,17 +36,27 @@ namespace mju = ::mujoco::util_mjpc;
 // initialize
 void Kalman::Initialize(const mjModel* model) {
   // model
-  if (this->model) mj_deleteModel(this->model);
-  this->model = mj_copyModel(nullptr, model);
+  shared_model_ = std::make_unique<SharedModel>(ShareModel(model));
+  this->model = shared_model_->get();
 
   // data
   if (this->data_) mj_deleteData(this->data_);
   data_ = mj_makeData(model);
+  worker_data_.clear();
 
   // timestep
   this->model->opt.timestep = GetNumberOrDefault(this->model->opt.timestep,
                                                  model, "estimator_timestep");
 
+  // sequential measurement update
+  settings.sequential = GetNumberOrDefault(0, model, "kalman_sequential");
+
+  // Jacobian settings
+  settings.parallel_jacobian =
+      GetNumberOrDefault(0, model, "kalman_parallel_jacobian");
+  settings.reuse_tolerance =
+      GetNumberOrDefault(0.0, model, "kalman_reuse_tolerance");
+
   // dimension
   nstate_ = model->nq + model->nv + model->na;
   ndstate_ = 2 * model->nv + model->na;
@@ -82,9 +98,23 @@ void Kalman::Initialize(const mjModel* model) {
   // sensor Jacobian
   sensor_jacobian_.resize(model->nsensordata * ndstate_);
 
+  // sequential update
+  innovation_.resize(nsensordata_);
+  sensor_support_.resize(ndstate_);
+
+  // nominal Jacobian evaluation
+  nominal_state_.resize(nstate_);
+  nominal_sensor_.resize(model->nsensordata);
+
   // sensor error
   sensor_error_.resize(nsensordata_);
 
+  // masked update
+  sensor_available_.resize(nsensor_);
+  sensor_time_.resize(nsensor_);
+  available_jacobian_.resize(nsensordata_ * ndstate_);
+  available_noise_.resize(nsensordata_);
+
   // correction
   correction_.resize(ndstate_);
 
@@ -158,6 +188,13 @@ void Kalman::Reset(const mjData* data) {
   // sensor error
   mju_zero(sensor_error_.data(), nsensordata_);
 
+  // masked update
+  std::fill(sensor_available_.begin(), sensor_available_.end(), 1);
+  std::fill(sensor_time_.begin(), sensor_time_.end(), -mjMAXVAL);
+
+  // Jacobian reuse
+  dynamics_from_measurement_ = false;
+
   // correction
   mju_zero(correction_.data(), ndstate_);
 
@@ -185,9 +222,21 @@ void Kalman::Reset(const mjData* data) {
 }
 
 // update measurement
-void Kalman::UpdateMeasurement(const double* ctrl, const double* sensor) {
+void Kalman::UpdateMeasurement(const double* ctrl, const double* sensor,
+                               const int* available, const double* times) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Kalman::UpdateMeasurement");
+
+  // sensors with a new measurement, no correction without any
+  int num_available = AvailableSensors(sensor_available_.data(),
+                                       sensor_time_.data(), available, times,
+                                       nsensor_);
+  if (num_available == 0) {
+    mju_zero(correction_.data(), ndstate_);
+    dynamics_from_measurement_ = false;
+    timer_measurement_ = 1.0e-3 * span.End();
+    return;
+  }
 
   // dimensions
   int nq = model->nq, nv = model->nv, na = model->na, nu = model->nu;
@@ -206,79 +255,103 @@ void Kalman::UpdateMeasurement(const double* ctrl, const double* sensor) {
   mju_sub(sensor_error_.data(), sensor + sensor_start_index_,
           data_->sensordata + sensor_start_index_, nsensordata_);
 
-  // -- Kalman gain: P * C' (C * P * C' + R)^-1 -- //
-
-  // sensor Jacobian
-  mjd_transitionFD(model, data_, settings.epsilon, settings.flg_centered, NULL,
-                   NULL, sensor_jacobian_.data(), NULL);
+  // sensor Jacobian, with the dynamics Jacobian from the same perturbations
+  // if the prediction may reuse it
+  dynamics_from_measurement_ = settings.reuse_tolerance > 0.0;
+  Jacobians(dynamics_from_measurement_ ? dynamics_jacobian_.data() : NULL,
+            sensor_jacobian_.data());
 
   // grab rows
   double* C = sensor_jacobian_.data() + sensor_start_index_ * ndstate_;
 
-  // P * C' = tmp0
-  mju_mulMatMatT(tmp0_.data(), covariance.data(), C, ndstate_, ndstate_,
-                 nsensordata_);
+  if (settings.sequential) {
+    // correction and covariance update one sensor at a time
+    SequentialUpdate(C);
+  } else {
+    // rows of the available sensors, the error is compacted in place
+    int nsensordata = nsensordata_;
+    const double* R = noise_sensor.data();
+    if (num_available < nsensor_) {
+      nsensordata = 0;
+      int row = 0;
+      for (int i = 0; i < nsensor_; i++) {
+        int dim = model->sensor_dim[sensor_start_ + i];
+        if (sensor_available_[i]) {
+          mju_copy(available_jacobian_.data() + nsensordata * ndstate_,
+                   C + row * ndstate_, dim * ndstate_);
+          mju_copy(available_noise_.data() + nsensordata,
+                   noise_sensor.data() + row, dim);
+          for (int r = 0; r < dim; r++) {
+            sensor_error_[nsensordata + r] = sensor_error_[row + r];
+          }
+          nsensordata += dim;
+        }
+        row += dim;
+      }
+      C = available_jacobian_.data();
+      R = available_noise_.data();
+    }
 
-  // C * P * C' = C * tmp0 = tmp1
-  mju_mulMatMat(tmp1_.data(), C, tmp0_.data(), nsensordata_, ndstate_,
-                nsensordata_);
+    // -- Kalman gain: P * C' (C * P * C' + R)^-1 -- //
 
-  // C * P * C' + R
-  for (int i = 0; i < nsensordata_; i++) {
-    tmp1_[nsensordata_ * i + i] += noise_sensor[i];
-  }
+    // P * C' = tmp0
+    mju_mulMatMatT(tmp0_.data(), covariance.data(), C, ndstate_, ndstate_,
+                   nsensordata);
 
-  // factorize: C * P * C' + R
-  int rank = mju_cholFactor(tmp1_.data(), nsensordata_, 0.0);
-  if (rank < nsensordata_) {
-    // TODO(taylor): remove and return status
-    mju_error("measurement update rank: (%i / %i)\n", rank, nsensordata_);
-  }
+    // C * P * C' = C * tmp0 = tmp1
+    mju_mulMatMat(tmp1_.data(), C, tmp0_.data(), nsensordata, ndstate_,
+                  nsensordata);
 
-  // -- correction: (P * C') * (C * P * C' + R)^-1 * sensor_error -- //
+    // C * P * C' + R
+    for (int i = 0; i < nsensordata; i++) {
+      tmp1_[nsensordata * i + i] += R[i];
+    }
 
-  // tmp2 = (C * P * C' + R) \ sensor_error
-  mju_cholSolve(tmp2_.data(), tmp1_.data(), sensor_error_.data(), nsensordata_);
+    // factorize: C * P * C' + R
+    int rank = mju_cholFactor(tmp1_.data(), nsensordata, 0.0);
+    if (rank < nsensordata) {
+      // TODO(taylor): remove and return status
+      mju_error("measurement update rank: (%i / %i)\n", rank, nsensordata);
+    }
 
-  // correction = (P * C') * (C * P * C' + R) \ sensor_error = tmp0 * tmp2
-  mju_mulMatVec(correction_.data(), tmp0_.data(), tmp2_.data(), ndstate_,
-                nsensordata_);
+    // -- correction: (P * C') * (C * P * C' + R)^-1 * sensor_error -- //
 
-  // -- state update -- //
+    // tmp2 = (C * P * C' + R) \ sensor_error
+    mju_cholSolve(tmp2_.data(), tmp1_.data(), sensor_error_.data(),
+                  nsensordata);
 
-  // configuration
-  mj_integratePos(model, state.data(), correction_.data(), 1.0);
+    // correction = (P * C') * (C * P * C' + R) \ sensor_error = tmp0 * tmp2
+    mju_mulMatVec(correction_.data(), tmp0_.data(), tmp2_.data(), ndstate_,
+                  nsensordata);
 
-  // velocity + act
-  mju_addTo(state.data() + nq, correction_.data() + nv, nv + na);
+    // -- covariance update: P -= W' * W, W = L^-1 * C * P -- //
 
-  // -- covariance update -- //
-  // TODO(taylor): Joseph form update ?
+    // tmp2 = L^-1 * (C * P) = L \ tmp0', with C * P * C' + R = L * L'
+    mju_transpose(tmp2_.data(), tmp0_.data(), ndstate_, nsensordata);
+    CholForwardSubstitution(tmp2_.data(), tmp1_.data(), tmp2_.data(),
+                            nsensordata, ndstate_);
 
-  // tmp2 = (C * P * C' + R)^-1 (C * P) = tmp1 \ tmp0'
-  for (int i = 0; i < ndstate_; i++) {
-    mju_cholSolve(tmp2_.data() + nsensordata_ * i, tmp1_.data(),
-                  tmp0_.data() + nsensordata_ * i, nsensordata_);
+    // covariance -= tmp2' * tmp2, lower triangle
+    SubLowerGram(covariance.data(), tmp2_.data(), nsensordata, ndstate_);
+    MirrorLower(covariance.data(), ndstate_);
   }
 
-  // tmp3 = (P * C') * (C * P * C' + R)^-1 (C * P) = tmp0 * tmp2'
-  mju_mulMatMatT(tmp3_.data(), tmp0_.data(), tmp2_.data(), ndstate_,
-                 nsensordata_, ndstate_);
+  // -- state update -- //
 
-  // covariance -= tmp3
-  mju_subFrom(covariance.data(), tmp3_.data(), ndstate_ * ndstate_);
+  // configuration
+  mj_integratePos(model, state.data(), correction_.data(), 1.0);
 
-  // symmetrize
-  mju_symmetrize(covariance.data(), covariance.data(), ndstate_);
+  // velocity + act
+  mju_addTo(state.data() + nq, correction_.data() + nv, nv + na);
 
   // stop timer (ms)
-  timer_measurement_ = 1.0e-3 * GetDuration(start);
+  timer_measurement_ = 1.0e-3 * span.End();
 }
 
 // update time
 void Kalman::UpdatePrediction() {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Kalman::UpdatePrediction");
 
   // dimensions
   int nq = model->nq, nv = model->nv, na = model->na;
@@ -288,9 +361,18 @@ void Kalman::UpdatePrediction() {
   mju_copy(data_->qvel, state.data() + nq, nv);
   mju_copy(data_->act, state.data() + nq + nv, na);
 
-  // dynamics Jacobian
-  mjd_transitionFD(model, data_, settings.epsilon, settings.flg_centered,
-                   dynamics_jacobian_.data(), NULL, NULL, NULL);
+  // dynamics Jacobian, reused from the measurement update if the correction
+  // was small
+  bool reuse = false;
+  if (dynamics_from_measurement_) {
+    double correction_norm = 0.0;
+    for (int i = 0; i < ndstate_; i++) {
+      correction_norm = mju_max(correction_norm, mju_abs(correction_[i]));
+    }
+    reuse = correction_norm <= settings.reuse_tolerance;
+    dynamics_from_measurement_ = false;
+  }
+  if (!reuse) Jacobians(dynamics_jacobian_.data(), NULL);
 
   // integrate state
   mj_step(model, data_);
@@ -301,25 +383,218 @@ void Kalman::UpdatePrediction() {
   mju_copy(state.data() + nq + nv, data_->act, na);
 
   // -- update covariance: P = A * P * A' -- //
-
-  //  tmp = P * A'
-  mju_mulMatMatT(tmp3_.data(), covariance.data(), dynamics_jacobian_.data(),
-                 ndstate_, ndstate_, ndstate_);
-
-  // P = A * tmp
-  mju_mulMatMat(covariance.data(), dynamics_jacobian_.data(), tmp3_.data(),
-                ndstate_, ndstate_, ndstate_);
+  SymmetricTransform(covariance.data(), dynamics_jacobian_.data(),
+                     covariance.data(), tmp3_.data(), ndstate_);
 
   // process noise
   for (int i = 0; i < ndstate_; i++) {
     covariance[ndstate_ * i + i] += noise_process[i];
   }
 
-  // symmetrize
-  mju_symmetrize(covariance.data(), covariance.data(), ndstate_);
-
   // stop timer
-  timer_prediction_ = 1.0e-3 * GetDuration(start);
+  timer_prediction_ = 1.0e-3 * span.End();
+}
+
+// sequential measurement update
+void Kalman::SequentialUpdate(const double* C) {
+  // unpack
+  double* P = covariance.data();
+  double* PCt = tmp0_.data();
+  double* S = tmp1_.data();
+  double* G = tmp2_.data();
+  double* innovation = innovation_.data();
+  int* support = sensor_support_.data();
+  int n = ndstate_;
+
+  // correction accumulated over sensors
+  mju_zero(correction_.data(), n);
+
+  int row = 0;
+  for (int k = sensor_start_; k < sensor_start_ + nsensor_; k++) {
+    int dim = model->sensor_dim[k];
+    const double* Ck = C + row * n;
+
+    // sensor without a new measurement
+    if (!sensor_available_[k - sensor_start_]) {
+      row += dim;
+      continue;
+    }
+
+    // state coordinates the sensor depends on
+    int num_support = 0;
+    for (int j = 0; j < n; j++) {
+      for (int r = 0; r < dim; r++) {
+        if (Ck[r * n + j]) {
+          support[num_support++] = j;
+          break;
+        }
+      }
+    }
+
+    // sensor carries no information
+    if (num_support == 0) {
+      row += dim;
+      continue;
+    }
+
+    // P * Ck' (n x dim), from the lower triangle of P
+    for (int i = 0; i < n; i++) {
+      for (int r = 0; r < dim; r++) {
+        double sum = 0.0;
+        for (int s = 0; s < num_support; s++) {
+          int j = support[s];
+          double Pij = j <= i ? P[i * n + j] : P[j * n + i];
+          sum += Pij * Ck[r * n + j];
+        }
+        PCt[i * dim + r] = sum;
+      }
+    }
+
+    // Ck * P * Ck' + Rk (dim x dim)
+    for (int r = 0; r < dim; r++) {
+      for (int c = 0; c < dim; c++) {
+        double sum = 0.0;
+        for (int s = 0; s < num_support; s++) {
+          sum += Ck[r * n + support[s]] * PCt[support[s] * dim + c];
+        }
+        S[r * dim + c] = sum;
+      }
+      S[r * dim + r] += noise_sensor[row + r];
+    }
+
+    // factorize
+    int rank = mju_cholFactor(S, dim, 0.0);
+    if (rank < dim) {
+      // TODO(taylor): remove and return status
+      mju_error("measurement update rank: (%i / %i)\n", rank, dim);
+    }
+
+    // innovation, linearized at the state before the correction
+    for (int r = 0; r < dim; r++) {
+      double sum = 0.0;
+      for (int s = 0; s < num_support; s++) {
+        sum += Ck[r * n + support[s]] * correction_[support[s]];
+      }
+      innovation[r] = sensor_error_[row + r] - sum;
+    }
+
+    // correction += P * Ck' * Sk^-1 * innovation
+    mju_cholSolve(innovation, S, innovation, dim);
+    mju_mulMatVec(G, PCt, innovation, n, dim);
+    mju_addTo(correction_.data(), G, n);
+
+    // P -= W' * W, W = Lk^-1 * Ck * P, lower triangle
+    mju_transpose(G, PCt, n, dim);
+    CholForwardSubstitution(G, S, G, dim, n);
+    SubLowerGram(P, G, dim, n);
+
+    row += dim;
+  }
+
+  // upper triangle of the updates
+  MirrorLower(P, n);
+}
+
+// finite-difference Jacobians
+void Kalman::Jacobians(double* A, double* C) {
+  // serial
+  if (!settings.parallel_jacobian || !pool_ || pool_->NumThreads() == 0) {
+    mjd_transitionFD(model, data_, settings.epsilon, settings.flg_centered, A,
+                     NULL, C, NULL);
+    return;
+  }
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, na = model->na;
+  int ns = model->nsensordata;
+  double eps = settings.epsilon;
+  bool centered = settings.flg_centered;
+
+  // per-worker copies of data_ (ctrl, mocap, userdata, ...)
+  int num_threads = pool_->NumThreads();
+  while (worker_data_.size() < num_threads) {
+    worker_data_.push_back(MakeUniqueMjData(mj_makeData(model)));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    mj_copyData(worker_data_[i].get(), model, data_);
+  }
+
+  // step d from the state in data_ perturbed by h along coordinate i (none
+  // if i < 0), record next state and sensors
+  auto step = [&](mjData* d, int i, double h, double* next, double* sensor) {
+    mju_copy(d->qpos, data_->qpos, nq);
+    mju_copy(d->qvel, data_->qvel, nv);
+    mju_copy(d->act, data_->act, na);
+    mju_copy(d->qacc_warmstart, data_->qacc_warmstart, nv);
+    d->time = data_->time;
+
+    // perturb
+    if (i >= 0 && i < nv) {
+      mj_markStack(d);
+      mjtNum* dq = mj_stackAllocNum(d, nv);
+      mju_zero(dq, nv);
+      dq[i] = 1.0;
+      mj_integratePos(model, d->qpos, dq, h);
+      mj_freeStack(d);
+    } else if (i >= nv && i < 2 * nv) {
+      d->qvel[i - nv] += h;
+    } else if (i >= 2 * nv) {
+      d->act[i - 2 * nv] += h;
+    }
+
+    // step
+    mj_step(model, d);
+
+    mju_copy(next, d->qpos, nq);
+    mju_copy(next + nq, d->qvel, nv);
+    mju_copy(next + nq + nv, d->act, na);
+    mju_copy(sensor, d->sensordata, ns);
+  };
+
+  // nominal for forward differences
+  if (!centered) {
+    step(worker_data_[0].get(), -1, 0.0, nominal_state_.data(),
+         nominal_sensor_.data());
+  }
+
+  // one state coordinate per column
+  pool_->ParallelFor(0, ndstate_, 1, pool_priority_, [&](int i) {
+    mjData* d = worker_data_[ThreadPool::WorkerId()].get();
+    mj_markStack(d);
+    mjtNum* next_plus = mj_stackAllocNum(d, nstate_);
+    mjtNum* sensor_plus = mj_stackAllocNum(d, ns);
+    mjtNum* next_minus = nominal_state_.data();
+    mjtNum* sensor_minus = nominal_sensor_.data();
+    double scale = eps;
+
+    step(d, i, eps, next_plus, sensor_plus);
+    if (centered) {
+      next_minus = mj_stackAllocNum(d, nstate_);
+      sensor_minus = mj_stackAllocNum(d, ns);
+      step(d, i, -eps, next_minus, sensor_minus);
+      scale = 2.0 * eps;
+    }
+
+    // dynamics column
+    if (A) {
+      mjtNum* ds = mj_stackAllocNum(d, ndstate_);
+      mj_differentiatePos(model, ds, scale, next_minus, next_plus);
+      for (int j = nv; j < ndstate_; j++) {
+        ds[j] = (next_plus[nq + j - nv] - next_minus[nq + j - nv]) / scale;
+      }
+      for (int j = 0; j < ndstate_; j++) {
+        A[j * ndstate_ + i] = ds[j];
+      }
+    }
+
+    // sensor column
+    if (C) {
+      for (int j = 0; j < ns; j++) {
+        C[j * ndstate_ + i] = (sensor_plus[j] - sensor_minus[j]) / scale;
+      }
+    }
+    mj_freeStack(d);
+  });
 }
 
 // estimator-specific GUI elements
@@ -554,6 +829,20 @@ void Kalman::SetGUIData() {
   model->opt.integrator = gui_integrator_;
 }
 
+void Kalman::ReportMemory(MemoryReport& report) const {
+  report.Add("filter",
+             VectorBytes(state, covariance, noise_process, noise_sensor,
+                         nominal_state_, nominal_sensor_, innovation_,
+                         sensor_support_, sensor_available_, sensor_time_,
+                         available_jacobian_, available_noise_, correction_,
+                         sensor_jacobian_, dynamics_jacobian_, sensor_error_,
+                         tmp0_, tmp1_, tmp2_, tmp3_));
+  std::size_t data = MjDataBytes(data_);
+  for (const UniqueMjData& d : worker_data_) data += MjDataBytes(d.get());
+  report.Add("data", data);
+  if (shared_model_) report.Add("model", shared_model_->MutableSize());
+}
+
 // estimator-specific plots
 void Kalman::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                    int planner_shift, int timer_shift, int planning,
@@ -15,12 +15,15 @@
 #ifndef MJPC_ESTIMATORS_KALMAN_H_
 #define MJPC_ESTIMATORS_KALMAN_H_
 
+#include <memory>
 #include <mutex>
 #include <vector>
 
 #include <mujoco/mujoco.h>
 
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -38,7 +41,6 @@ class Kalman : public Estimator {
   // destructor
   ~Kalman() override {
     if (data_) mj_deleteData(data_);
-    if (model) mj_deleteModel(model);
   }
 
   // initialize
@@ -47,16 +49,32 @@ class Kalman : public Estimator {
   // reset memory
   void Reset(const mjData* data = nullptr) override;
 
-  // update measurement
-  void UpdateMeasurement(const double* ctrl, const double* sensor);
+  // update measurement, with the sensors flagged by available and times
+  // (see Estimator::UpdateMasked)
+  void UpdateMeasurement(const double* ctrl, const double* sensor,
+                         const int* available = nullptr,
+                         const double* times = nullptr);
 
   // update time
   void UpdatePrediction();
 
+  // use a thread pool for parallel Jacobians (nullptr computes them
+  // serially). the pool must outlive its use by this object.
+  void SetThreadPool(ThreadPool* pool) override { pool_ = pool; }
+  void SetThreadPoolPriority(TaskPriority priority) override {
+    pool_priority_ = priority;
+  }
+
   // update
   void Update(const double* ctrl, const double* sensor) override {
+    UpdateMasked(ctrl, sensor, nullptr, nullptr);
+  }
+
+  // update with the sensors that have a new measurement
+  void UpdateMasked(const double* ctrl, const double* sensor,
+                    const int* available, const double* times) override {
     // correct state with latest measurement
-    UpdateMeasurement(ctrl, sensor);
+    UpdateMeasurement(ctrl, sensor, available, times);
 
     // propagate state forward in time with model
     UpdatePrediction();
@@ -120,6 +138,9 @@ class Kalman : public Estimator {
   // set GUI data
   void SetGUIData() override;
 
+  // bytes of the filter buffers and mjData
+  void ReportMemory(MemoryReport& report) const override;
+
   // estimator-specific plots
   void Plots(mjvFigure* fig_planner, mjvFigure* fig_timer, int planner_shift,
              int timer_shift, int planning, int* shift) override;
@@ -144,9 +165,17 @@ class Kalman : public Estimator {
   struct Settings {
     double epsilon = 1.0e-6;
     bool flg_centered = false;
+    int sequential = 0;            // measurement update one sensor at a time
+    int parallel_jacobian = 0;     // split perturbations across the pool
+    double reuse_tolerance = 0.0;  // prediction reuses the measurement
+                                   // dynamics Jacobian if the correction
+                                   // (max norm) is below this
   } settings;
 
  private:
+  // owner of model, sharing its arrays with other users of the model
+  std::unique_ptr<SharedModel> shared_model_;
+
   // dimensions
   int nstate_;
   int ndstate_;
@@ -160,6 +189,34 @@ class Kalman : public Estimator {
   // data
   mjData* data_ = nullptr;
 
+  // thread pool and per-worker data for Jacobians
+  ThreadPool* pool_ = nullptr;
+  TaskPriority pool_priority_ = TaskPriority::kNormal;
+  std::vector<UniqueMjData> worker_data_;
+
+  // nominal next state (nstate_) and sensors (nsensordata) for parallel
+  // Jacobians
+  std::vector<double> nominal_state_;
+  std::vector<double> nominal_sensor_;
+
+  // sequential update scratch, innovation (nsensordata_) and state
+  // coordinates a sensor depends on (ndstate_)
+  std::vector<double> innovation_;
+  std::vector<int> sensor_support_;
+
+  // sensors used by the measurement update (nsensor_) and their last
+  // measurement times (nsensor_)
+  std::vector<int> sensor_available_;
+  std::vector<double> sensor_time_;
+
+  // rows of the available sensors: Jacobian (nsensordata_ x ndstate_) and
+  // noise (nsensordata_)
+  std::vector<double> available_jacobian_;
+  std::vector<double> available_noise_;
+
+  // dynamics_jacobian_ was computed by the last measurement update
+  bool dynamics_from_measurement_ = false;
+
   // correction (ndstate_)
   std::vector<double> correction_;
 
@@ -182,6 +239,17 @@ class Kalman : public Estimator {
   std::vector<double> tmp2_;
   std::vector<double> tmp3_;
 
+  // measurement update of correction_ and covariance with each sensor in
+  // turn, C is the sensor Jacobian (nsensordata_ x ndstate_). with diagonal
+  // sensor noise this matches the joint update, with a dim x dim solve per
+  // sensor instead of one nsensordata_ x nsensordata_ solve.
+  void SequentialUpdate(const double* C);
+
+  // finite-difference dynamics (ndstate_ x ndstate_) and sensor
+  // (nsensordata x ndstate_) Jacobians at the state and ctrl in data_, either
+  // may be null
+  void Jacobians(double* A, double* C);
+
   // -- GUI data -- //
 
   // time step
@@ -0,0 +1,117 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/estimators/measurement_log.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mjpc {
+
+namespace {
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t nu;
+  std::uint32_t nsensordata;
+  std::uint32_t nstate;
+  std::uint32_t pad[2];
+};
+static_assert(sizeof(Header) % 8 == 0);
+}  // namespace
+
+void MeasurementLog::Append(double time, const double* ctrl,
+                            const double* sensor, const double* state) {
+  this->time.push_back(time);
+  this->ctrl.insert(this->ctrl.end(), ctrl, ctrl + nu);
+  this->sensor.insert(this->sensor.end(), sensor, sensor + nsensordata);
+  if (nstate > 0) {
+    this->state.insert(this->state.end(), state, state + nstate);
+  }
+}
+
+bool WriteMeasurementLog(const std::string& path, const MeasurementLog& log) {
+  int steps = log.Steps();
+  if (log.ctrl.size() != static_cast<std::size_t>(log.nu) * steps ||
+      log.sensor.size() != static_cast<std::size_t>(log.nsensordata) * steps ||
+      log.state.size() != static_cast<std::size_t>(log.nstate) * steps) {
+    return false;
+  }
+  Header header = {};
+  std::memcpy(header.magic, kMeasurementLogMagic, sizeof(header.magic));
+  header.version = kMeasurementLogVersion;
+  header.nu = log.nu;
+  header.nsensordata = log.nsensordata;
+  header.nstate = log.nstate;
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) return false;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (int t = 0; t < steps; t++) {
+    file.write(reinterpret_cast<const char*>(&log.time[t]), 8);
+    file.write(reinterpret_cast<const char*>(log.Ctrl(t)), 8 * log.nu);
+    file.write(reinterpret_cast<const char*>(log.Sensor(t)),
+               8 * log.nsensordata);
+    file.write(reinterpret_cast<const char*>(log.State(t)), 8 * log.nstate);
+  }
+  return static_cast<bool>(file);
+}
+
+bool ReadMeasurementLog(const std::string& path, MeasurementLog* log) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  Header header;
+  if (bytes.size() < sizeof(header)) return false;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMeasurementLogMagic,
+                  sizeof(header.magic)) != 0 ||
+      header.version != kMeasurementLogVersion) {
+    return false;
+  }
+  std::size_t size = 8 * (1 + header.nu + header.nsensordata + header.nstate);
+  if ((bytes.size() - sizeof(header)) % size != 0) return false;
+  int steps = (bytes.size() - sizeof(header)) / size;
+
+  *log = MeasurementLog();
+  log->nu = header.nu;
+  log->nsensordata = header.nsensordata;
+  log->nstate = header.nstate;
+  log->time.resize(steps);
+  log->ctrl.resize(static_cast<std::size_t>(log->nu) * steps);
+  log->sensor.resize(static_cast<std::size_t>(log->nsensordata) * steps);
+  log->state.resize(static_cast<std::size_t>(log->nstate) * steps);
+  const char* data = bytes.data() + sizeof(header);
+  for (int t = 0; t < steps; t++) {
+    for (auto [values, dim] :
+         {std::pair(log->time.data() + t, 1),
+          std::pair(log->ctrl.data() + t * log->nu, log->nu),
+          std::pair(log->sensor.data() + t * log->nsensordata,
+                    log->nsensordata),
+          std::pair(log->state.data() + t * log->nstate, log->nstate)}) {
+      std::memcpy(values, data, 8 * dim);
+      data += 8 * dim;
+    }
+  }
+  return true;
+}
+
+}  // namespace mjpc
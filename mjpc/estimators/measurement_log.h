@@ -0,0 +1,68 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Log of estimator inputs, the controls and sensor measurements of each
+// time step, with the true states when they are known (simulated logs), for
+// replays through estimators (benchmark/estimator_replay_benchmark.cc).
+// Layout of the file, in native byte order:
+//   header: magic "MJPCELOG" (8 bytes), version (uint32), then as uint32:
+//           ctrl size, sensor size, state size (0: no ground truth), pad
+//   records: time, ctrl, sensor and the state before the step (doubles)
+
+#ifndef MJPC_ESTIMATORS_MEASUREMENT_LOG_H_
+#define MJPC_ESTIMATORS_MEASUREMENT_LOG_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mjpc {
+
+inline constexpr char kMeasurementLogMagic[8] = {'M', 'J', 'P', 'C',
+                                                 'E', 'L', 'O', 'G'};
+inline constexpr std::uint32_t kMeasurementLogVersion = 1;
+
+// estimator inputs of consecutive time steps
+struct MeasurementLog {
+  int nu = 0;
+  int nsensordata = 0;
+  int nstate = 0;  // (nq + nv + na) of the ground truth, 0 if unknown
+
+  std::vector<double> time;    // steps
+  std::vector<double> ctrl;    // nu x steps
+  std::vector<double> sensor;  // nsensordata x steps
+  std::vector<double> state;   // nstate x steps
+
+  int Steps() const { return time.size(); }
+
+  // append a time step, state is ignored without ground truth
+  void Append(double time, const double* ctrl, const double* sensor,
+              const double* state);
+
+  const double* Ctrl(int t) const { return ctrl.data() + t * nu; }
+  const double* Sensor(int t) const {
+    return sensor.data() + t * nsensordata;
+  }
+  const double* State(int t) const { return state.data() + t * nstate; }
+};
+
+// write log to path, false on error
+bool WriteMeasurementLog(const std::string& path, const MeasurementLog& log);
+
+// read the log of path, false if it isn't a measurement log
+bool ReadMeasurementLog(const std::string& path, MeasurementLog* log);
+
+}  // namespace mjpc
+
+#endif  // MJPC_ESTIMATORS_MEASUREMENT_LOG_H_
@@ -14,7 +14,10 @@
 
 #include "mjpc/estimators/unscented.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -22,6 +25,10 @@
 
 #include "mjpc/array_safety.h"
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/memory_report.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -30,16 +37,23 @@ namespace mju = ::mujoco::util_mjpc;
 // initialize
 void Unscented::Initialize(const mjModel* model) {
   // model
-  if (this->model) mj_deleteModel(this->model);
-  this->model = mj_copyModel(nullptr, model);
+  shared_model_ = std::make_unique<SharedModel>(ShareModel(model));
+  this->model = shared_model_->get();
 
   // data
   if (this->data_) mj_deleteData(this->data_);
   data_ = mj_makeData(model);
+  worker_data_.clear();
 
   // settings
   settings.alpha = GetNumberOrDefault(1.0, model, "unscented_alpha");
   settings.beta = GetNumberOrDefault(2.0, model, "unscented_beta");
+  settings.square_root =
+      GetNumberOrDefault(0, model, "unscented_square_root");
+  settings.sigma_points = GetNumberOrDefault(kSymmetricSigmaPoints, model,
+                                             "unscented_sigma_points");
+  settings.simplex_weight0 =
+      GetNumberOrDefault(0.0, model, "unscented_simplex_weight0");
 
   // timestep
   this->model->opt.timestep = GetNumberOrDefault(this->model->opt.timestep,
@@ -49,7 +63,7 @@ void Unscented::Initialize(const mjModel* model) {
   int nq = model->nq, nv = model->nv, na = model->na;
   nstate_ = nq + nv + na;
   ndstate_ = 2 * nv + na;
-  nsigma_ = 2 * ndstate_ + 1;
+  int max_sigma = 2 * ndstate_ + 1;
 
   // sensor start index
   sensor_start_ = GetNumberOrDefault(0, model, "estimator_sensor_start");
@@ -83,13 +97,13 @@ void Unscented::Initialize(const mjModel* model) {
   noise_sensor.resize(nsensordata_);
 
   // sigma points (nstate x (2 * ndstate_ + 1))
-  sigma_.resize(nstate_ * nsigma_);
+  sigma_.resize(nstate_ * max_sigma);
 
   // states (nstate x (2 * ndstate_ + 1))
-  states_.resize(nstate_ * nsigma_);
+  states_.resize(nstate_ * max_sigma);
 
   // sensors (nsensordata x (2 * ndstate + 1))
-  sensors_.resize(nsensordata_ * nsigma_);
+  sensors_.resize(nsensordata_ * max_sigma);
 
   // state mean (nstate)
   state_mean_.resize(nstate_);
@@ -104,10 +118,10 @@ void Unscented::Initialize(const mjModel* model) {
   factor_column_.resize(ndstate_);
 
   // state difference (ndstate x nsigma_)
-  state_difference_.resize(ndstate_ * nsigma_);
+  state_difference_.resize(ndstate_ * max_sigma);
 
   // sensor difference (nsensordata_ x nsigma_)
-  sensor_difference_.resize(nsensordata_ * nsigma_);
+  sensor_difference_.resize(nsensordata_ * max_sigma);
 
   // covariance sensor (nsensordata_ x nsensordata_)
   covariance_sensor_.resize(nsensordata_ * nsensordata_);
@@ -118,33 +132,26 @@ void Unscented::Initialize(const mjModel* model) {
   // covariance state state (ndstate_ x ndstate_)
   covariance_state_state_.resize(ndstate_ * ndstate_);
 
-  // sensor difference outer product
-  sensor_difference_outer_product_.resize(nsensordata_ * nsensordata_);
-
-  // state sensor difference outer product
-  state_sensor_difference_outer_product_.resize(ndstate_ * nsensordata_);
-
-  // state state difference outer product
-  state_state_difference_outer_product_.resize(ndstate_ * ndstate_);
-
   // covariance sensor factor
   covariance_sensor_factor_.resize(nsensordata_ * nsensordata_);
 
-  // lambda
-  double lambda = ndstate_ * (settings.alpha * settings.alpha - 1.0);
+  // square-root mode
+  covariance_synced_.resize(ndstate_ * ndstate_);
+  square_root_scratch_.resize(std::max(
+      3 * ndstate_ * ndstate_,
+      nsensordata_ * (2 * ndstate_ + nsensordata_)));
 
-  // sigma step
-  sigma_step = mju_sqrt(ndstate_ + lambda);
-
-  // weights
-  weight_mean0 = lambda / (ndstate_ + lambda);
-  weight_covariance0 =
-      weight_mean0 + 1.0 - settings.alpha * settings.alpha + settings.beta;
-  weight_sigma = 1.0 / (2.0 * (ndstate_ + lambda));
+  // sigma point set
+  SigmaWeights();
 
   // sensor error
   sensor_error_.resize(nsensordata_);
 
+  // masked update
+  sensor_available_.resize(nsensor_);
+  sensor_time_.resize(nsensor_);
+  measured_noise_.resize(nsensordata_);
+
   // correction
   correction_.resize(ndstate_);
 
@@ -245,25 +252,22 @@ void Unscented::Reset(const mjData* data) {
   std::fill(covariance_state_state_.begin(), covariance_state_state_.end(),
             0.0);
 
-  // sensor difference outer product
-  std::fill(sensor_difference_outer_product_.begin(),
-            sensor_difference_outer_product_.end(), 0.0);
-
-  // state sensor difference outer product
-  std::fill(state_sensor_difference_outer_product_.begin(),
-            state_sensor_difference_outer_product_.end(), 0.0);
-
-  // state state difference outer product
-  std::fill(state_state_difference_outer_product_.begin(),
-            state_state_difference_outer_product_.end(), 0.0);
-
   // covariance sensor factor
   std::fill(covariance_sensor_factor_.begin(), covariance_sensor_factor_.end(),
             0.0);
 
+  // square-root mode
+  factor_valid_ = false;
+  covariance_stale_ = false;
+
   // sensor error
   mju_zero(sensor_error_.data(), nsensordata_);
 
+  // masked update
+  std::fill(sensor_available_.begin(), sensor_available_.end(), 1);
+  std::fill(sensor_time_.begin(), sensor_time_.end(), -mjMAXVAL);
+  nmeasured_ = nsensordata_;
+
   // correction
   mju_zero(correction_.data(), ndstate_);
 
@@ -289,19 +293,73 @@ void Unscented::Reset(const mjData* data) {
   std::fill(gui_sensor_noise_.begin(), gui_sensor_noise_.end(), noise_sensor_scl);
 }
 
+// number of sigma points, weights and sigma step
+void Unscented::SigmaWeights() {
+  sigma_points_ = settings.sigma_points;
+  if (sigma_points_ == kSimplexSigmaPoints) {
+    // "Reduced Sigma Point Filters for the Propagation of Means and
+    // Covariances Through Nonlinear Transformations", Julier 2002
+    nsigma_ = ndstate_ + 2;
+    weight_mean0 = std::clamp(settings.simplex_weight0, 0.0, 1.0 - mjMINVAL);
+    weight_covariance0 = weight_mean0;
+    weight_sigma = (1.0 - weight_mean0) / (ndstate_ + 1);
+    sigma_step = 1.0 / mju_sqrt(weight_sigma);
+    return;
+  }
+
+  // symmetric set
+  nsigma_ = 2 * ndstate_ + 1;
+
+  // lambda
+  double lambda = ndstate_ * (settings.alpha * settings.alpha - 1.0);
+
+  // sigma step
+  sigma_step = mju_sqrt(ndstate_ + lambda);
+
+  // weights
+  weight_mean0 = lambda / (ndstate_ + lambda);
+  weight_covariance0 =
+      weight_mean0 + 1.0 - settings.alpha * settings.alpha + settings.beta;
+  weight_sigma = 1.0 / (2.0 * (ndstate_ + lambda));
+}
+
 // compute sigma points
 void Unscented::SigmaPoints() {
   // dimensions
   int nq = model->nq, nv = model->nv, na = model->na;
 
-  // factorize covariance
-  mju_copy(covariance_factor_.data(), covariance.data(), ndstate_ * ndstate_);
-  int rank = mju_cholFactor(covariance_factor_.data(), ndstate_, 0.0);
+  // square-root mode reuses the propagated factor unless the covariance was
+  // changed since it was last synchronized
+  bool reuse_factor =
+      square_root_ && factor_valid_ &&
+      (covariance_stale_ ||
+       std::equal(covariance.begin(), covariance.end(),
+                  covariance_synced_.begin()));
+
+  if (!reuse_factor) {
+    // factorize covariance
+    mju_copy(covariance_factor_.data(), covariance.data(),
+             ndstate_ * ndstate_);
+    int rank = mju_cholFactor(covariance_factor_.data(), ndstate_, 0.0);
+
+    // check failure
+    if (rank < ndstate_) {
+      // TODO(taylor): remove and return status
+      mju_error("covariance factorization failure: (%i / %i)\n", rank,
+                ndstate_);
+    }
 
-  // check failure
-  if (rank < ndstate_) {
-    // TODO(taylor): remove and return status
-    mju_error("covariance factorization failure: (%i / %i)\n", rank, ndstate_);
+    // lower triangle only, for rank-one updates
+    if (square_root_) {
+      for (int i = 0; i < ndstate_; i++) {
+        mju_zero(covariance_factor_.data() + i * ndstate_ + i + 1,
+                 ndstate_ - i - 1);
+      }
+      mju_copy(covariance_synced_.data(), covariance.data(),
+               ndstate_ * ndstate_);
+      covariance_stale_ = false;
+    }
+    factor_valid_ = square_root_;
   }
 
   // -- loop over points -- //
@@ -312,6 +370,35 @@ void Unscented::SigmaPoints() {
   // unpack
   double* column = factor_column_.data();
 
+  // spherical simplex: point p is state + sigma_step * L * z_p, where z_p
+  // has zero mean and unit covariance over the ndstate_ + 1 points.
+  // coordinate c of z_p is -a_c for p <= c, (c + 1) a_c for p = c + 1 and 0
+  // otherwise, a_c = 1 / sqrt((c + 1) (c + 2)).
+  if (sigma_points_ == kSimplexSigmaPoints) {
+    for (int p = 0; p <= ndstate_; p++) {
+      // column = L * z_p, lower triangle of the factor
+      int start = mju_max(p - 1, 0);
+      mju_zero(column, ndstate_);
+      for (int c = start; c < ndstate_; c++) {
+        double a = 1.0 / mju_sqrt((c + 1.0) * (c + 2.0));
+        double z = sigma_step * (p <= c ? -a : (c + 1) * a);
+        for (int r = c; r < ndstate_; r++) {
+          column[r] += covariance_factor_[r * ndstate_ + c] * z;
+        }
+      }
+
+      double* sigma = sigma_.data() + p * nstate_;
+      mju_copy(sigma, state.data(), nstate_);
+
+      // qpos
+      mj_integratePos(model, sigma, column, 1.0);
+
+      // qvel & qact
+      mju_addTo(sigma + nq, column + nv, nv + na);
+    }
+    return;
+  }
+
   // loop over sigma points
   // TODO(taylor): thread?
   for (int i = 0; i < ndstate_; i++) {
@@ -349,7 +436,6 @@ void Unscented::SigmaPoints() {
 }
 
 // evaluate sigma points
-// TODO(taylor): thread?
 void Unscented::EvaluateSigmaPoints() {
   // dimensions
   int nq = model->nq, nv = model->nv, na = model->na;
@@ -361,32 +447,57 @@ void Unscented::EvaluateSigmaPoints() {
   // time cache
   double time_cache = data_->time;
 
-  // loop over sigma points
-  for (int i = 0; i < nsigma_; i++) {
+  // step sigma point i with d, starting from the warmstart in data_
+  auto evaluate = [&](int i, mjData* d) {
     // set state
     double* sigma = sigma_.data() + i * nstate_;
-    mju_copy(data_->qpos, sigma, nq);
-    mju_copy(data_->qvel, sigma + nq, nv);
-    mju_copy(data_->act, sigma + nq + nv, na);
-    data_->time = time_cache;
+    mju_copy(d->qpos, sigma, nq);
+    mju_copy(d->qvel, sigma + nq, nv);
+    mju_copy(d->act, sigma + nq + nv, na);
+    mju_copy(d->qacc_warmstart, data_->qacc_warmstart, nv);
+    d->time = time_cache;
 
     // step
-    mj_step(model, data_);
+    mj_step(model, d);
 
     // get state
     double* s = states_.data() + i * nstate_;
-    mju_copy(s, data_->qpos, nq);
-    mju_copy(s + nq, data_->qvel, nv);
-    mju_copy(s + nq + nv, data_->act, na);
+    mju_copy(s, d->qpos, nq);
+    mju_copy(s + nq, d->qvel, nv);
+    mju_copy(s + nq + nv, d->act, na);
 
     // get sensor
     double* y = sensors_.data() + i * nsensordata_;
-    mju_copy(y, data_->sensordata + sensor_start_index_, nsensordata_);
+    mju_copy(y, d->sensordata + sensor_start_index_, nsensordata_);
+  };
+
+  // perturbed sigma points, nominal is last and steps data_ itself
+  if (pool_ && pool_->NumThreads() > 0) {
+    // per-worker copies of data_ (ctrl, mocap, userdata, ...)
+    int num_threads = pool_->NumThreads();
+    while (worker_data_.size() < num_threads) {
+      worker_data_.push_back(MakeUniqueMjData(mj_makeData(model)));
+    }
+    for (int i = 0; i < num_threads; i++) {
+      mj_copyData(worker_data_[i].get(), model, data_);
+    }
+    pool_->ParallelFor(0, nsigma_ - 1, 1, pool_priority_, [&](int i) {
+      evaluate(i, worker_data_[ThreadPool::WorkerId()].get());
+    });
+  } else {
+    for (int i = 0; i < nsigma_ - 1; i++) {
+      evaluate(i, data_);
+    }
+  }
+  evaluate(nsigma_ - 1, data_);
 
-    // update means
+  // update means
+  for (int i = 0; i < nsigma_; i++) {
     double weight = (i == nsigma_ - 1 ? weight_mean0 : weight_sigma);
-    mju_addToScl(state_mean_.data(), s, weight, nstate_);
-    mju_addToScl(sensor_mean_.data(), y, weight, nsensordata_);
+    mju_addToScl(state_mean_.data(), states_.data() + i * nstate_, weight,
+                 nstate_);
+    mju_addToScl(sensor_mean_.data(), sensors_.data() + i * nsensordata_,
+                 weight, nsensordata_);
   }
 
   // compute correct quaternion means
@@ -423,25 +534,24 @@ void Unscented::SigmaPointDifferences() {
 
 // compute sigma covariances
 void Unscented::SigmaCovariances() {
-  // unpack
-  double* dydy = sensor_difference_outer_product_.data();
-  double* dsdy = state_sensor_difference_outer_product_.data();
-  double* dsds = state_state_difference_outer_product_.data();
+  // sensor data dimension of the update
+  int nsensordata = nmeasured_;
 
+  // unpack
   double* cov_yy = covariance_sensor_.data();
   double* cov_sy = covariance_state_sensor_.data();
   double* cov_ss = covariance_state_state_.data();
 
   // zero memory
-  mju_zero(cov_yy, nsensordata_ * nsensordata_);
-  mju_zero(cov_sy, ndstate_ * nsensordata_);
+  mju_zero(cov_yy, nsensordata * nsensordata);
+  mju_zero(cov_sy, ndstate_ * nsensordata);
   mju_zero(cov_ss, ndstate_ * ndstate_);
 
   // -- set noise -- //
 
   // sensor
-  for (int i = 0; i < nsensordata_; i++) {
-    cov_yy[nsensordata_ * i + i] = noise_sensor[i];
+  for (int i = 0; i < nsensordata; i++) {
+    cov_yy[nsensordata * i + i] = measured_noise_[i];
   }
 
   // process
@@ -449,41 +559,251 @@ void Unscented::SigmaCovariances() {
     cov_ss[ndstate_ * i + i] = noise_process[i];
   }
 
-  // loop over sigma points
-  for (int i = 0; i < nsigma_; i++) {
-    // unpack
-    double* dy = sensor_difference_.data() + i * nsensordata_;
-    double* ds = state_difference_.data() + i * ndstate_;
+  // accumulate weighted outer products, one covariance row at a time. rows
+  // are independent, so they are reduced in parallel over sigma points in a
+  // fixed order.
+  auto row = [&](int r) {
+    // row of cov_yy, cov_sy, or cov_ss
+    double* cov;
+    const double* difference;
+    const double* column;
+    int dim_row, dim_column;
+    if (r < nsensordata) {
+      cov = cov_yy + r * nsensordata;
+      difference = sensor_difference_.data();
+      column = sensor_difference_.data();
+      dim_row = nsensordata;
+      dim_column = nsensordata;
+    } else if (r < nsensordata + ndstate_) {
+      r -= nsensordata;
+      cov = cov_sy + r * nsensordata;
+      difference = state_difference_.data();
+      column = sensor_difference_.data();
+      dim_row = ndstate_;
+      dim_column = nsensordata;
+    } else {
+      r -= nsensordata + ndstate_;
+      cov = cov_ss + r * ndstate_;
+      difference = state_difference_.data();
+      column = state_difference_.data();
+      dim_row = ndstate_;
+      dim_column = ndstate_;
+    }
+
+    // loop over sigma points
+    for (int i = 0; i < nsigma_; i++) {
+      double weight = (i == nsigma_ - 1 ? weight_covariance0 : weight_sigma);
+      mju_addToScl(cov, column + i * dim_column,
+                   weight * difference[i * dim_row + r], dim_column);
+    }
+  };
+
+  auto rows = [&](int begin, int end) {
+    if (pool_ && pool_->NumThreads() > 0) {
+      pool_->ParallelFor(begin, end, 4, pool_priority_, row);
+    } else {
+      for (int r = begin; r < end; r++) row(r);
+    }
+  };
+
+  // square-root mode only needs the state sensor covariance
+  if (square_root_) {
+    rows(nsensordata, nsensordata + ndstate_);
+    if (SquareRootFactors()) return;
+
+    // fall back to dense covariances for this update
+    square_root_ = false;
+    factor_valid_ = false;
+    rows(0, nsensordata);
+    rows(nsensordata + ndstate_, nsensordata + 2 * ndstate_);
+    return;
+  }
+
+  rows(0, nsensordata + 2 * ndstate_);
+}
+
+// lower-triangular factor of M * M' by Householder reflections from the right
+void Unscented::LQFactor(double* L, double* M, int n, int m) {
+  for (int k = 0; k < n; k++) {
+    // reflect row k onto its k-th element
+    double* v = M + k * m + k;
+    double norm = mju_norm(v, m - k);
+    if (norm == 0.0) continue;
+    double alpha = v[0] > 0.0 ? -norm : norm;
+    v[0] -= alpha;
+    double vv = mju_dot(v, v, m - k);
+
+    // apply to remaining rows
+    for (int i = k + 1; i < n; i++) {
+      double* row = M + i * m + k;
+      mju_addToScl(row, v, -2.0 * mju_dot(row, v, m - k) / vv, m - k);
+    }
+    v[0] = alpha;
+  }
+
+  // lower triangle, columns signed for a positive diagonal
+  mju_zero(L, n * n);
+  for (int k = 0; k < n; k++) {
+    double sign = M[k * m + k] < 0.0 ? -1.0 : 1.0;
+    for (int i = k; i < n; i++) {
+      L[i * n + k] = sign * M[i * m + k];
+    }
+  }
+}
 
-    // sensor difference outer product
-    mju_mulMatMatT(dydy, dy, dy, nsensordata_, 1, nsensordata_);
+// predicted covariance factors
+bool Unscented::SquareRootFactors() {
+  // sensor data dimension of the update
+  int nsensordata = nmeasured_;
+
+  // perturbed sigma points, nominal is last
+  int num_point = nsigma_ - 1;
+  double scale = mju_sqrt(weight_sigma);
+  double scale0 = mju_sqrt(mju_abs(weight_covariance0));
+  int flg_plus = weight_covariance0 > 0.0;
+  double* M = square_root_scratch_.data();
+  double* x = factor_column_.data();
+
+  // -- state: [sqrt(w) ds_i, sqrt(process noise)] -- //
+  int m = num_point + ndstate_;
+  for (int r = 0; r < ndstate_; r++) {
+    double* row = M + r * m;
+    for (int i = 0; i < num_point; i++) {
+      row[i] = scale * state_difference_[i * ndstate_ + r];
+    }
+    mju_zero(row + num_point, ndstate_);
+    row[num_point + r] = mju_sqrt(noise_process[r]);
+  }
+  LQFactor(covariance_factor_.data(), M, ndstate_, m);
+
+  // nominal point
+  mju_scl(x, state_difference_.data() + num_point * ndstate_, scale0,
+          ndstate_);
+  if (mju_cholUpdate(covariance_factor_.data(), x, ndstate_, flg_plus) <
+      ndstate_) {
+    return false;
+  }
 
-    // state sensor difference outer product
-    mju_mulMatMatT(dsdy, ds, dy, ndstate_, 1, nsensordata_);
+  // -- sensor: [sqrt(w) dy_i, sqrt(sensor noise)] -- //
+  m = num_point + nsensordata;
+  for (int r = 0; r < nsensordata; r++) {
+    double* row = M + r * m;
+    for (int i = 0; i < num_point; i++) {
+      row[i] = scale * sensor_difference_[i * nsensordata + r];
+    }
+    mju_zero(row + num_point, nsensordata);
+    row[num_point + r] = mju_sqrt(measured_noise_[r]);
+  }
+  double* factor = covariance_sensor_factor_.data();
+  LQFactor(factor, M, nsensordata, m);
 
-    // state state difference outer product
-    mju_mulMatMatT(dsds, ds, ds, ndstate_, 1, ndstate_);
+  // nominal point, scratch is free again
+  mju_scl(M, sensor_difference_.data() + num_point * nsensordata, scale0,
+          nsensordata);
+  return mju_cholUpdate(factor, M, nsensordata, flg_plus) == nsensordata;
+}
 
-    // -- update -- //
+// measurement update of the covariance factor
+bool Unscented::SquareRootCovarianceUpdate() {
+  // sensor data dimension of the update
+  int nsensordata = nmeasured_;
 
-    // weight
-    double weight = (i == nsigma_ - 1 ? weight_covariance0 : weight_sigma);
+  const double* factor = covariance_sensor_factor_.data();
+  const double* cov_sy = covariance_state_sensor_.data();
+  double* L = covariance_factor_.data();
 
-    // covariance sensor
-    mju_addScl(cov_yy, cov_yy, dydy, weight, nsensordata_ * nsensordata_);
+  // U = covariance_state_sensor * factor^-T, rows by forward substitution
+  double* U = tmp0_.data();
+  for (int i = 0; i < ndstate_; i++) {
+    const double* p = cov_sy + i * nsensordata;
+    double* u = U + i * nsensordata;
+    for (int j = 0; j < nsensordata; j++) {
+      const double* f = factor + j * nsensordata;
+      u[j] = (p[j] - mju_dot(f, u, j)) / f[j];
+    }
+  }
 
-    // covariance state sensor
-    mju_addScl(cov_sy, cov_sy, dsdy, weight, ndstate_ * nsensordata_);
+  // keep predicted factor
+  mju_copy(tmp1_.data(), L, ndstate_ * ndstate_);
 
-    // covariance state state
-    mju_addScl(cov_ss, cov_ss, dsds, weight, ndstate_ * ndstate_);
+  // covariance = L * L' - U * U', one column of U at a time
+  double* x = factor_column_.data();
+  for (int j = 0; j < nsensordata; j++) {
+    for (int i = 0; i < ndstate_; i++) {
+      x[i] = U[i * nsensordata + j];
+    }
+    if (mju_cholUpdate(L, x, ndstate_, 0) < ndstate_) {
+      // predicted covariance for the dense update
+      mju_mulMatMatT(covariance_state_state_.data(), tmp1_.data(),
+                     tmp1_.data(), ndstate_, ndstate_, ndstate_);
+      return false;
+    }
   }
+  return true;
+}
+
+// covariance from factor
+void Unscented::SynchronizeCovariance() {
+  mju_mulMatMatT(covariance.data(), covariance_factor_.data(),
+                 covariance_factor_.data(), ndstate_, ndstate_, ndstate_);
+  mju_copy(covariance_synced_.data(), covariance.data(), ndstate_ * ndstate_);
+  covariance_stale_ = false;
 }
 
 // unscented filter update
-void Unscented::Update(const double* ctrl, const double* sensor) {
+// sensor error and differences of the available sensors
+int Unscented::MeasuredSensors(const double* sensor, const int* available,
+                               const double* times) {
+  mju_sub(sensor_error_.data(), sensor + sensor_start_index_,
+          sensor_mean_.data(), nsensordata_);
+  int num_available =
+      AvailableSensors(sensor_available_.data(), sensor_time_.data(),
+                       available, times, nsensor_);
+
+  // all sensors
+  if (num_available == nsensor_) {
+    mju_copy(measured_noise_.data(), noise_sensor.data(), nsensordata_);
+    nmeasured_ = nsensordata_;
+    return nmeasured_;
+  }
+
+  // compact rows in place, they only move up
+  nmeasured_ = 0;
+  int row = 0;
+  for (int i = 0; i < nsensor_; i++) {
+    int dim = model->sensor_dim[sensor_start_ + i];
+    if (sensor_available_[i]) {
+      for (int r = 0; r < dim; r++) {
+        sensor_error_[nmeasured_ + r] = sensor_error_[row + r];
+        measured_noise_[nmeasured_ + r] = noise_sensor[row + r];
+      }
+      nmeasured_ += dim;
+    }
+    row += dim;
+  }
+
+  // sensor differences with stride nmeasured_
+  for (int j = 0; j < nsigma_; j++) {
+    const double* dy = sensor_difference_.data() + j * nsensordata_;
+    double* measured = sensor_difference_.data() + j * nmeasured_;
+    int shift = 0;
+    row = 0;
+    for (int i = 0; i < nsensor_; i++) {
+      int dim = model->sensor_dim[sensor_start_ + i];
+      if (sensor_available_[i]) {
+        for (int r = 0; r < dim; r++) measured[shift + r] = dy[row + r];
+        shift += dim;
+      }
+      row += dim;
+    }
+  }
+  return nmeasured_;
+}
+
+void Unscented::UpdateMasked(const double* ctrl, const double* sensor,
+                             const int* available, const double* times) {
   // start timer
-  auto start = std::chrono::steady_clock::now();
+  TraceSpan span("Unscented::Update");
 
   // time cache
   double time_cache = data_->time;
@@ -494,6 +814,10 @@ void Unscented::Update(const double* ctrl, const double* sensor) {
   // set ctrl
   mju_copy(data_->ctrl, ctrl, model->nu);
 
+  // covariance mode and sigma point set for this update
+  square_root_ = settings.square_root;
+  SigmaWeights();
+
   // compute sigma points
   SigmaPoints();
 
@@ -503,34 +827,35 @@ void Unscented::Update(const double* ctrl, const double* sensor) {
   // compute sigma point difference
   SigmaPointDifferences();
 
+  // sensor error and differences of the sensors with a new measurement
+  int nsensordata = MeasuredSensors(sensor, available, times);
+
   // compute sigma covariances
   SigmaCovariances();
 
-  // factorize covariance sensor
+  // factorize covariance sensor, square-root mode already has the factor
   double* factor = covariance_sensor_factor_.data();
-  mju_copy(factor, covariance_sensor_.data(), nsensordata_ * nsensordata_);
-  int rank = mju_cholFactor(factor, nsensordata_, 0.0);
-
-  // check failure
-  if (rank < nsensordata_) {
-    // TODO(taylor): remove and return status
-    mju_error("covariance sensor factorization failure (%i / %i)\n", rank,
-              nsensordata_);
+  if (!square_root_) {
+    mju_copy(factor, covariance_sensor_.data(), nsensordata * nsensordata);
+    int rank = mju_cholFactor(factor, nsensordata, 0.0);
+
+    // check failure
+    if (rank < nsensordata) {
+      // TODO(taylor): remove and return status
+      mju_error("covariance sensor factorization failure (%i / %i)\n", rank,
+                nsensordata);
+    }
   }
 
   // -- correction -- //
 
-  // sensor error
-  mju_sub(sensor_error_.data(), sensor + sensor_start_index_,
-          sensor_mean_.data(), nsensordata_);
-
   // tmp0 = covariance_sensor \ sensor_error
-  mju_cholSolve(tmp0_.data(), factor, sensor_error_.data(), nsensordata_);
+  mju_cholSolve(tmp0_.data(), factor, sensor_error_.data(), nsensordata);
 
   // correction = covariance_state_sensor * covariance_sensor \ sensor_error =
   // covariance_state_sensor * tmp0
   mju_mulMatVec(correction_.data(), covariance_state_sensor_.data(),
-                tmp0_.data(), ndstate_, nsensordata_);
+                tmp0_.data(), ndstate_, nsensordata);
 
   // -- state update -- //
 
@@ -545,32 +870,39 @@ void Unscented::Update(const double* ctrl, const double* sensor) {
 
   // -- covariance update -- //
 
-  mju_copy(covariance.data(), covariance_state_state_.data(),
-           ndstate_ * ndstate_);
+  if (square_root_ && SquareRootCovarianceUpdate()) {
+    covariance_stale_ = true;
+  } else {
+    mju_copy(covariance.data(), covariance_state_state_.data(),
+             ndstate_ * ndstate_);
+
+    // tmp0 = covariance_sensor^-1 covariance_state_sensor'
+    for (int i = 0; i < ndstate_; i++) {
+      mju_cholSolve(tmp0_.data() + nsensordata * i, factor,
+                    covariance_state_sensor_.data() + nsensordata * i,
+                    nsensordata);
+    }
 
-  // tmp0 = covariance_sensor^-1 covariance_state_sensor'
-  for (int i = 0; i < ndstate_; i++) {
-    mju_cholSolve(tmp0_.data() + nsensordata_ * i, factor,
-                  covariance_state_sensor_.data() + nsensordata_ * i,
-                  nsensordata_);
-  }
+    // tmp1 = covariance_state_sensor * (covariance_sensor)^-1
+    // covariance_state_sensor' = covariance_state_sensor * tmp0'
+    mju_mulMatMatT(tmp1_.data(), covariance_state_sensor_.data(),
+                   tmp0_.data(), ndstate_, nsensordata, ndstate_);
 
-  // tmp1 = covariance_state_sensor * (covariance_sensor)^-1
-  // covariance_state_sensor' = covariance_state_sensor * tmp0'
-  mju_mulMatMatT(tmp1_.data(), covariance_state_sensor_.data(), tmp0_.data(),
-                 ndstate_, nsensordata_, ndstate_);
+    // covariance -= tmp1
+    mju_subFrom(covariance.data(), tmp1_.data(), ndstate_ * ndstate_);
 
-  // covariance -= tmp1
-  mju_subFrom(covariance.data(), tmp1_.data(), ndstate_ * ndstate_);
+    // symmetrize
+    mju_symmetrize(covariance.data(), covariance.data(), ndstate_);
 
-  // symmetrize
-  mju_symmetrize(covariance.data(), covariance.data(), ndstate_);
+    factor_valid_ = false;
+    covariance_stale_ = false;
+  }
 
   // update time
   time = time_cache + model->opt.timestep;
 
   // stop timer (ms)
-  timer_update_ = 1.0e-3 * GetDuration(start);
+  timer_update_ = 1.0e-3 * span.End();
 }
 
 // quaternion means
@@ -635,6 +967,9 @@ void Unscented::GUI(mjUI& ui) {
       {mjITEM_SLIDERNUM, "Timestep", 2, &gui_timestep_, "1.0e-3 0.1"},
       {mjITEM_SELECT, "Integrator", 2, &gui_integrator_,
        "Euler\nRK4\nImplicit\nFastImplicit"},
+      {mjITEM_CHECKINT, "Square Root", 2, &settings.square_root, ""},
+      {mjITEM_SELECT, "Sigma Points", 2, &settings.sigma_points,
+       "Symmetric\nSimplex"},
       {mjITEM_END}};
 
   // add estimator
@@ -857,6 +1192,23 @@ void Unscented::SetGUIData() {
   model->opt.integrator = gui_integrator_;
 }
 
+void Unscented::ReportMemory(MemoryReport& report) const {
+  report.Add("filter",
+             VectorBytes(state, covariance, noise_process, noise_sensor,
+                         correction_, sensor_error_, sigma_, states_, sensors_,
+                         state_mean_, sensor_mean_, covariance_factor_,
+                         factor_column_, state_difference_, sensor_difference_,
+                         covariance_sensor_, covariance_state_sensor_,
+                         covariance_state_state_, covariance_sensor_factor_,
+                         sensor_available_, sensor_time_, measured_noise_,
+                         covariance_synced_, square_root_scratch_, tmp0_,
+                         tmp1_));
+  std::size_t data = MjDataBytes(data_);
+  for (const UniqueMjData& d : worker_data_) data += MjDataBytes(d.get());
+  report.Add("data", data);
+  if (shared_model_) report.Add("model", shared_model_->MutableSize());
+}
+
 // estimator-specific plots
 void Unscented::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                       int planner_shift, int timer_shift, int planning,
@@ -864,8 +1216,12 @@ void Unscented::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   // Unscented info
   double estimator_bounds[2] = {-6, 6};
 
-  // covariance trace
-  double trace = Trace(covariance.data(), DimensionProcess());
+  // covariance trace, from the factor if the covariance lags it
+  double trace = covariance_stale_
+                     ? mju_dot(covariance_factor_.data(),
+                               covariance_factor_.data(),
+                               DimensionProcess() * DimensionProcess())
+                     : Trace(covariance.data(), DimensionProcess());
   mjpc::PlotUpdateData(fig_planner, estimator_bounds,
                        fig_planner->linedata[planner_shift + 0][0] + 1,
                        mju_log10(trace), 100, planner_shift + 0, 0, 1, -100);
@@ -17,14 +17,23 @@
 
 #include <mujoco/mujoco.h>
 
+#include <memory>
 #include <mutex>
 #include <vector>
 
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 
+// sigma point sets
+enum UnscentedSigmaPoints : int {
+  kSymmetricSigmaPoints = 0,  // 2 * ndstate + 1 points
+  kSimplexSigmaPoints,        // spherical simplex, ndstate + 2 points
+};
+
 // Unscented Filtering and Nonlinear Estimation
 // https://www.cs.ubc.ca/~murphyk/Papers/Julier_Uhlmann_mar04.pdf
 class Unscented : public Estimator {
@@ -39,7 +48,6 @@ class Unscented : public Estimator {
   // destructor
   ~Unscented() override {
     if (data_) mj_deleteData(data_);
-    if (model) mj_deleteModel(model);
   }
 
   // initialize
@@ -61,7 +69,20 @@ class Unscented : public Estimator {
   void SigmaCovariances();
 
   // update
-  void Update(const double* ctrl, const double* sensor) override;
+  void Update(const double* ctrl, const double* sensor) override {
+    UpdateMasked(ctrl, sensor, nullptr, nullptr);
+  }
+
+  // update with the sensors that have a new measurement
+  void UpdateMasked(const double* ctrl, const double* sensor,
+                    const int* available, const double* times) override;
+
+  // use a thread pool to evaluate sigma points and covariances (nullptr
+  // evaluates serially). the pool must outlive its use by this object.
+  void SetThreadPool(ThreadPool* pool) override { pool_ = pool; }
+  void SetThreadPoolPriority(TaskPriority priority) override {
+    pool_priority_ = priority;
+  }
 
   // quaternion means
   void QuaternionMeans();
@@ -70,7 +91,10 @@ class Unscented : public Estimator {
   double* State() override { return state.data(); };
 
   // get covariance
-  double* Covariance() override { return covariance.data(); };
+  double* Covariance() override {
+    if (covariance_stale_) SynchronizeCovariance();
+    return covariance.data();
+  };
 
   // get time
   double& Time() override { return time; };
@@ -109,17 +133,25 @@ class Unscented : public Estimator {
   // set covariance
   void SetCovariance(const double* covariance) override {
     mju_copy(this->covariance.data(), covariance, ndstate_ * ndstate_);
+    covariance_stale_ = false;
+    factor_valid_ = false;
   };
 
   // get update timer (ms)
   double TimerUpdate() const { return timer_update_; }
 
+  // number of sigma points of the last update, nominal included
+  int NumSigmaPoints() const { return nsigma_; }
+
   // estimator-specific GUI elements
   void GUI(mjUI& ui) override;
 
   // set GUI data
   void SetGUIData() override;
 
+  // bytes of the filter buffers and mjData
+  void ReportMemory(MemoryReport& report) const override;
+
   // estimator-specific plots
   void Plots(mjvFigure* fig_planner, mjvFigure* fig_timer, int planner_shift,
              int timer_shift, int planning, int* shift) override;
@@ -131,7 +163,9 @@ class Unscented : public Estimator {
   std::vector<double> state;
   double time;
 
-  // covariance (ndstate_ x ndstate_)
+  // covariance (ndstate_ x ndstate_). in square-root mode it is updated
+  // from the factor by Covariance(); write it through Covariance() or
+  // SetCovariance() after the first update.
   std::vector<double> covariance;
 
   // process noise (ndstate_)
@@ -152,9 +186,15 @@ class Unscented : public Estimator {
   struct Settings {
     double alpha = 1.0;
     double beta = 2.0;
+    int square_root = 0;  // propagate the covariance factor
+    int sigma_points = kSymmetricSigmaPoints;  // UnscentedSigmaPoints
+    double simplex_weight0 = 0.0;  // nominal weight of the simplex set, [0, 1)
   } settings;
 
  private:
+  // owner of model, sharing its arrays with other users of the model
+  std::unique_ptr<SharedModel> shared_model_;
+
   // dimensions
   int nstate_;
   int ndstate_;
@@ -162,6 +202,9 @@ class Unscented : public Estimator {
   int nsensor_;
   int nsigma_;
 
+  // settings.sigma_points, fixed for one update
+  int sigma_points_ = kSymmetricSigmaPoints;
+
   // sensor indexing
   int sensor_start_;
   int sensor_start_index_;
@@ -169,19 +212,24 @@ class Unscented : public Estimator {
   // data
   mjData* data_ = nullptr;
 
+  // thread pool and per-worker data for sigma points
+  ThreadPool* pool_ = nullptr;
+  TaskPriority pool_priority_ = TaskPriority::kNormal;
+  std::vector<UniqueMjData> worker_data_;
+
   // correction (ndstate_)
   std::vector<double> correction_;
 
   // sensor error (nsensordata_)
   std::vector<double> sensor_error_;
 
-  // sigma points (nstate x (2 * ndstate_ + 1))
+  // sigma points (nstate x nsigma_), allocated for the symmetric set
   std::vector<double> sigma_;
 
-  // states (nstate x (2 * ndstate_ + 1))
+  // states (nstate x nsigma_)
   std::vector<double> states_;
 
-  // sensors (nsensordata_ x (2 * ndstate + 1))
+  // sensors (nsensordata_ x nsigma_)
   std::vector<double> sensors_;
 
   // state mean (nstate_)
@@ -211,17 +259,40 @@ class Unscented : public Estimator {
   // covariance state state (ndstate_ x ndstate_)
   std::vector<double> covariance_state_state_;
 
-  // sensor difference outer product
-  std::vector<double> sensor_difference_outer_product_;
+  // covariance sensor factor (nsensordata_ x nsensordata_)
+  std::vector<double> covariance_sensor_factor_;
 
-  // state sensor difference outer product
-  std::vector<double> state_sensor_difference_outer_product_;
+  // -- masked update -- //
 
-  // state state difference outer product
-  std::vector<double> state_state_difference_outer_product_;
+  // sensors used by the update (nsensor_) and their last measurement times
+  // (nsensor_)
+  std::vector<int> sensor_available_;
+  std::vector<double> sensor_time_;
 
-  // covariance sensor factor (nsensordata_ x nsensordata_)
-  std::vector<double> covariance_sensor_factor_;
+  // sensor data dimension of the update; sensor_error_, sensor_difference_
+  // and the sensor covariances only have the rows of the available sensors
+  int nmeasured_;
+
+  // noise of the available sensors (nsensordata_)
+  std::vector<double> measured_noise_;
+
+  // -- square-root mode -- //
+
+  // settings.square_root, fixed for one update
+  bool square_root_ = false;
+
+  // covariance_factor_ holds the factor of the current covariance
+  bool factor_valid_ = false;
+
+  // covariance lags covariance_factor_
+  bool covariance_stale_ = false;
+
+  // covariance when last factorized or synchronized (ndstate_ x ndstate_)
+  std::vector<double> covariance_synced_;
+
+  // factor arguments (max(ndstate_ x 3 ndstate_,
+  //                       nsensordata_ x (2 ndstate_ + nsensordata_)))
+  std::vector<double> square_root_scratch_;
 
   // timer (ms)
   double timer_update_;
@@ -230,6 +301,29 @@ class Unscented : public Estimator {
   std::vector<double> tmp0_;
   std::vector<double> tmp1_;
 
+  // number of sigma points, weights and sigma step of settings.sigma_points
+  void SigmaWeights();
+
+  // sensor error and differences of the available sensors, returns their
+  // sensor data dimension
+  int MeasuredSensors(const double* sensor, const int* available,
+                      const double* times);
+
+  // lower-triangular L (n x n) with L * L' = M * M' for M (n x m), m >= n.
+  // M is overwritten.
+  static void LQFactor(double* L, double* M, int n, int m);
+
+  // predicted state and sensor covariance factors from sigma point
+  // differences, returns false if a factor is not positive definite
+  bool SquareRootFactors();
+
+  // downdate covariance_factor_ with the measurement update, returns false
+  // (and sets the predicted covariance_state_state_) on failure
+  bool SquareRootCovarianceUpdate();
+
+  // covariance = covariance_factor_ * covariance_factor_'
+  void SynchronizeCovariance();
+
   // -- GUI data -- //
 
   // time step
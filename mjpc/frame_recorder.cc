@@ -0,0 +1,307 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/frame_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <GLFW/glfw3.h>
+#include "lodepng.h"
+#include <absl/strings/str_format.h>
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+namespace {
+
+// pipe of binary data to command
+std::FILE* OpenPipe(const std::string& command) {
+#ifdef _WIN32
+  return _popen(command.c_str(), "wb");
+#else
+  return popen(command.c_str(), "w");
+#endif
+}
+
+void ClosePipe(std::FILE* pipe) {
+#ifdef _WIN32
+  _pclose(pipe);
+#else
+  pclose(pipe);
+#endif
+}
+
+// buffer object constants and functions of OpenGL 1.5, which the system
+// headers don't necessarily declare
+constexpr GLenum kPixelPackBuffer = 0x88EB;
+constexpr GLenum kStreamRead = 0x88E1;
+constexpr GLenum kReadOnly = 0x88B8;
+
+struct BufferFunctions {
+  void (*gen)(GLsizei, GLuint*) = nullptr;
+  void (*del)(GLsizei, const GLuint*) = nullptr;
+  void (*bind)(GLenum, GLuint) = nullptr;
+  void (*data)(GLenum, std::ptrdiff_t, const void*, GLenum) = nullptr;
+  void* (*map)(GLenum, GLenum) = nullptr;
+  GLboolean (*unmap)(GLenum) = nullptr;
+
+  bool Valid() const { return gen && del && bind && data && map && unmap; }
+};
+
+// the functions of the current context
+const BufferFunctions& GetBufferFunctions() {
+  static BufferFunctions functions = [] {
+    BufferFunctions f;
+    auto load = [](auto& function, const char* name) {
+      function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(
+          glfwGetProcAddress(name));
+    };
+    load(f.gen, "glGenBuffers");
+    load(f.del, "glDeleteBuffers");
+    load(f.bind, "glBindBuffer");
+    load(f.data, "glBufferData");
+    load(f.map, "glMapBuffer");
+    load(f.unmap, "glUnmapBuffer");
+    return f;
+  }();
+  return functions;
+}
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}  // namespace
+
+FrameRecorder::~FrameRecorder() {
+  if (!recording_) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  encoder_.join();
+  CloseSink();
+}
+
+bool FrameRecorder::Start(const std::string& path, double fps) {
+  if (recording_) Stop();
+  if (!GetBufferFunctions().Valid() || fps <= 0.0) return false;
+
+  path_ = path;
+  period_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / fps));
+  next_frame_ = std::chrono::steady_clock::now();
+  frames_ = 0;
+  dropped_ = 0;
+  stop_ = false;
+  index_ = 0;
+  pending_[0] = pending_[1] = false;
+  recording_ = true;
+  encoder_ = std::thread(&FrameRecorder::EncodeLoop, this);
+  return true;
+}
+
+void FrameRecorder::Capture(const mjrRect& viewport, const mjrContext* con) {
+  if (!recording_ || viewport.width <= 0 || viewport.height <= 0) return;
+
+  // frame rate
+  auto now = std::chrono::steady_clock::now();
+  if (now < next_frame_) return;
+  next_frame_ += period_;
+  if (next_frame_ < now) next_frame_ = now + period_;
+
+  // the previous frames are read back before the buffers are resized
+  const BufferFunctions& gl = GetBufferFunctions();
+  if (viewport.width != buffer_width_ || viewport.height != buffer_height_) {
+    for (int i = 0; i < 2; i++) {
+      int index = (index_ + 1 + i) % 2;
+      if (pending_[index]) QueueBuffer(index);
+    }
+    AllocateBuffers(viewport.width, viewport.height);
+  }
+
+  // queue the readback of this frame, rows of RGB bytes without padding
+  mjr_setBuffer(mjFB_WINDOW, const_cast<mjrContext*>(con));
+  glReadBuffer(con->windowDoublebuffer ? GL_BACK : GL_FRONT);
+  GLint alignment;
+  glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  gl.bind(kPixelPackBuffer, buffers_[index_]);
+  glReadPixels(viewport.left, viewport.bottom, viewport.width,
+               viewport.height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  gl.bind(kPixelPackBuffer, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+  pending_[index_] = true;
+
+  // the other buffer's readback was queued a frame ago and is done
+  index_ = 1 - index_;
+  if (pending_[index_]) QueueBuffer(index_);
+}
+
+void FrameRecorder::Stop() {
+  if (!recording_) return;
+  for (int i = 0; i < 2; i++) {
+    int index = (index_ + 1 + i) % 2;
+    if (pending_[index]) QueueBuffer(index);
+  }
+  ReleaseBuffers();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  encoder_.join();
+  CloseSink();
+  recording_ = false;
+}
+
+void FrameRecorder::AllocateBuffers(int width, int height) {
+  const BufferFunctions& gl = GetBufferFunctions();
+  ReleaseBuffers();
+  gl.gen(2, buffers_);
+  for (unsigned int buffer : buffers_) {
+    gl.bind(kPixelPackBuffer, buffer);
+    gl.data(kPixelPackBuffer, static_cast<std::ptrdiff_t>(3) * width * height,
+            nullptr, kStreamRead);
+  }
+  gl.bind(kPixelPackBuffer, 0);
+  buffer_width_ = width;
+  buffer_height_ = height;
+}
+
+void FrameRecorder::ReleaseBuffers() {
+  if (buffers_[0]) GetBufferFunctions().del(2, buffers_);
+  buffers_[0] = buffers_[1] = 0;
+  pending_[0] = pending_[1] = false;
+  buffer_width_ = buffer_height_ = 0;
+}
+
+void FrameRecorder::QueueBuffer(int index) {
+  pending_[index] = false;
+
+  // frame memory, none while the encoder is behind
+  Frame frame;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frames_in_use_ >= kMaxQueuedFrames) {
+      dropped_ += 1;
+      return;
+    }
+    frames_in_use_ += 1;
+    if (!free_.empty()) {
+      frame = std::move(free_.back());
+      free_.pop_back();
+    }
+  }
+
+  const BufferFunctions& gl = GetBufferFunctions();
+  int size = 3 * buffer_width_ * buffer_height_;
+  frame.rgb.resize(size);
+  frame.width = buffer_width_;
+  frame.height = buffer_height_;
+  gl.bind(kPixelPackBuffer, buffers_[index]);
+  const void* pixels = gl.map(kPixelPackBuffer, kReadOnly);
+  if (pixels) {
+    std::copy_n(static_cast<const unsigned char*>(pixels), size,
+                frame.rgb.begin());
+    gl.unmap(kPixelPackBuffer);
+  }
+  gl.bind(kPixelPackBuffer, 0);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pixels) {
+      queue_.push_back(std::move(frame));
+    } else {
+      dropped_ += 1;
+      free_.push_back(std::move(frame));
+      frames_in_use_ -= 1;
+    }
+  }
+  cv_.notify_one();
+}
+
+void FrameRecorder::EncodeLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) return;
+    Frame frame = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+
+    if (Write(frame)) {
+      frames_ += 1;
+    } else {
+      dropped_ += 1;
+    }
+
+    lock.lock();
+    free_.push_back(std::move(frame));
+    frames_in_use_ -= 1;
+  }
+}
+
+bool FrameRecorder::Write(Frame& frame) {
+  // flip up-down
+  int stride = 3 * frame.width;
+  for (int r = 0; r < frame.height / 2; r++) {
+    unsigned char* top_row = frame.rgb.data() + stride * r;
+    unsigned char* bottom_row =
+        frame.rgb.data() + stride * (frame.height - 1 - r);
+    std::swap_ranges(top_row, top_row + stride, bottom_row);
+  }
+
+  // PNG sequence
+  if (EndsWith(path_, ".png")) {
+    std::string file = absl::StrFormat(
+        "%s_%06d.png", path_.substr(0, path_.size() - 4), frames_.load());
+    return lodepng::encode(file, frame.rgb.data(), frame.width, frame.height,
+                           LCT_RGB) == 0;
+  }
+
+  // video of the first frame's size, even for the encoder's chroma format
+  if (!pipe_) {
+    sink_width_ = frame.width;
+    sink_height_ = frame.height;
+    std::string command = absl::StrFormat(
+        "ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgb24 -s %dx%d "
+        "-r %f -i - -vf pad=ceil(iw/2)*2:ceil(ih/2)*2 -pix_fmt yuv420p "
+        "\"%s\"",
+        sink_width_, sink_height_,
+        1.0 / std::chrono::duration<double>(period_).count(), path_);
+    pipe_ = OpenPipe(command);
+    if (!pipe_) return false;
+  }
+  if (frame.width != sink_width_ || frame.height != sink_height_) return false;
+  return std::fwrite(frame.rgb.data(), 1, frame.rgb.size(), pipe_) ==
+         frame.rgb.size();
+}
+
+void FrameRecorder::CloseSink() {
+  if (pipe_) ClosePipe(pipe_);
+  pipe_ = nullptr;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,128 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef MJPC_FRAME_RECORDER_H_
+#define MJPC_FRAME_RECORDER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// default capture rate of a recording (frames per second)
+inline constexpr double kRecordingFps = 60.0;
+
+// frames read back but not yet written, newer frames are dropped while the
+// encoder is this far behind
+inline constexpr int kMaxQueuedFrames = 8;
+
+// offscreen recording of the rendered window. Capture queues the GPU
+// readback of a frame into one of two pixel buffer objects and copies the
+// other's frame, queued at the previous capture, without waiting for the GPU.
+// a background thread flips and writes the frames: to a PNG sequence if the
+// path ends with ".png" (stem_000000.png, ...), otherwise as raw RGB to an
+// ffmpeg process encoding path. Start, Capture and Stop are called on the
+// thread of the OpenGL context.
+class FrameRecorder {
+ public:
+  FrameRecorder() = default;
+
+  // the encoder is joined, GPU buffers of a running recording are leaked
+  // since there may be no current context
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+  // start recording to path at fps frames per second of wall time, false if
+  // the OpenGL buffer functions are unavailable
+  bool Start(const std::string& path, double fps = kRecordingFps);
+
+  // capture viewport of the current window framebuffer, if a frame is due.
+  // call after drawing and before swapping buffers.
+  void Capture(const mjrRect& viewport, const mjrContext* con);
+
+  // write the pending frames and stop recording
+  void Stop();
+
+  bool Recording() const { return recording_; }
+  const std::string& Path() const { return path_; }
+
+  // frames written, and dropped since the encoder fell behind (or, for
+  // ffmpeg, the window was resized)
+  int Frames() const { return frames_.load(); }
+  int DroppedFrames() const { return dropped_.load(); }
+
+ private:
+  struct Frame {
+    std::vector<unsigned char> rgb;  // bottom-up rows
+    int width = 0;
+    int height = 0;
+  };
+
+  // (re)allocate the pixel buffer objects for width x height frames
+  void AllocateBuffers(int width, int height);
+  void ReleaseBuffers();
+
+  // queue the frame read back into pixel buffer object index
+  void QueueBuffer(int index);
+
+  // encoder thread: write queued frames until stopped and drained
+  void EncodeLoop();
+  bool Write(Frame& frame);
+  void CloseSink();
+
+  bool recording_ = false;
+  std::string path_;
+  std::chrono::steady_clock::duration period_{};
+  std::chrono::steady_clock::time_point next_frame_;
+
+  // double-buffered readback
+  unsigned int buffers_[2] = {0, 0};
+  bool pending_[2] = {false, false};
+  int buffer_width_ = 0;
+  int buffer_height_ = 0;
+  int index_ = 0;
+
+  // frames to the encoder, and recycled frame memory
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Frame> queue_;
+  std::vector<Frame> free_;
+  int frames_in_use_ = 0;
+  bool stop_ = false;
+  std::thread encoder_;
+
+  // encoder sink
+  std::FILE* pipe_ = nullptr;
+  int sink_width_ = 0;
+  int sink_height_ = 0;
+
+  std::atomic_int frames_ = 0;
+  std::atomic_int dropped_ = 0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_FRAME_RECORDER_H_
@@ -0,0 +1,68 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/geom_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// allocate memory
+void GeomBuffer::Allocate(int capacity) {
+  for (int i = 0; i < 3; i++) {
+    geoms_[i].resize(capacity);
+    ngeom_[i] = 0;
+  }
+  capacity_ = capacity;
+  write_ = 0;
+  read_ = 1;
+  middle_.store(2);
+}
+
+// clear the producer buffer and point the scene at it
+mjvScene* GeomBuffer::Begin() {
+  scene_.geoms = geoms_[write_].data();
+  scene_.maxgeom = capacity_;
+  scene_.ngeom = 0;
+  return &scene_;
+}
+
+// swap producer buffer with middle buffer
+void GeomBuffer::Publish() {
+  ngeom_[write_] = scene_.ngeom;
+
+  // release the writes, acquire the consumer's last writes to the old middle
+  int previous = middle_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+  write_ = previous & ~kFresh;
+}
+
+// swap consumer buffer with middle buffer if it is newer, and copy
+void GeomBuffer::AppendTo(mjvScene* scn) {
+  if (!Allocated()) return;
+  if (middle_.load(std::memory_order_relaxed) & kFresh) {
+    int previous = middle_.exchange(read_, std::memory_order_acq_rel);
+    read_ = previous & ~kFresh;
+  }
+  int n = std::min(ngeom_[read_], scn->maxgeom - scn->ngeom);
+  if (n <= 0) return;
+  std::memcpy(scn->geoms + scn->ngeom, geoms_[read_].data(),
+              sizeof(mjvGeom) * n);
+  scn->ngeom += n;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,70 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_GEOM_BUFFER_H_
+#define MJPC_GEOM_BUFFER_H_
+
+#include <atomic>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// single-producer single-consumer triple buffer of scene geoms
+// the producer (planning thread) draws into a private buffer and swaps it
+// with the shared middle buffer, the renderer swaps its buffer with the
+// middle one when it is newer, as in MeasurementBuffer. neither side blocks
+// the other.
+class GeomBuffer {
+ public:
+  // constructor
+  GeomBuffer() = default;
+
+  // destructor
+  ~GeomBuffer() = default;
+
+  // ----- methods ----- //
+
+  // allocate capacity geoms per buffer and clear, not safe while in use
+  void Allocate(int capacity);
+  bool Allocated() const { return capacity_ > 0; }
+
+  // empty scene drawing into the producer buffer (producer). only geoms,
+  // ngeom and maxgeom are set.
+  mjvScene* Begin();
+
+  // make the geoms drawn since Begin the latest (producer)
+  void Publish();
+
+  // append the latest published geoms to scn, as many as fit (consumer).
+  // the same geoms are appended until newer ones are published.
+  void AppendTo(mjvScene* scn);
+
+ private:
+  // middle_ holds a buffer index and this flag when it is unread
+  static constexpr int kFresh = 4;
+
+  std::vector<mjvGeom> geoms_[3];
+  int ngeom_[3] = {0, 0, 0};
+  int capacity_ = 0;
+  mjvScene scene_ = {};  // producer scene
+  int write_ = 0;               // producer buffer
+  int read_ = 1;                // consumer buffer
+  std::atomic<int> middle_{2};  // shared buffer
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_GEOM_BUFFER_H_
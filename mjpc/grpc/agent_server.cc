@@ -17,28 +17,85 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include <absl/flags/flag.h>
 #include <absl/flags/parse.h>
 #include <absl/log/log.h>
 #include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
 // DEEPMIND INTERNAL IMPORT
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 #include <grpcpp/server_context.h>
 
 #include "mjpc/grpc/agent_service.h"
+#include "mjpc/grpc/rollout_client.h"
+#include "mjpc/perf_counters.h"
+#include "mjpc/plan_log.h"
+#include "mjpc/planners/sampling/remote.h"
+#include "mjpc/realtime.h"
+#include "mjpc/task.h"
 #include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
 
 ABSL_FLAG(int32_t, mjpc_port, 10000, "port to listen on");
 ABSL_FLAG(int32_t, mjpc_workers, -1,
           "number of worker threads for MJPC planning. -1 means use the number "
           "of available hardware threads.");
+ABSL_FLAG(std::string, mjpc_worker_cpus, "",
+          "CPUs the worker threads are pinned to, e.g., \"0-15,32-47\". "
+          "Empty means all available CPUs, if other pinning flags are set.");
+ABSL_FLAG(int32_t, mjpc_worker_numa_node, -1,
+          "If not -1, pin the worker threads to the CPUs of this NUMA node.");
+ABSL_FLAG(std::string, mjpc_worker_exclude_cpus, "",
+          "CPUs the worker threads are not pinned to.");
+ABSL_FLAG(int32_t, mjpc_rt_control_priority, 0,
+          "If not 0, run Control streams with SCHED_FIFO at this priority "
+          "(1-99).");
+ABSL_FLAG(bool, mjpc_rt_lock_memory, false,
+          "If true, lock the process's memory (mlockall) at startup.");
+ABSL_FLAG(int32_t, mjpc_rt_worker_nice, 0,
+          "Nice value of the worker threads, positive to lower their "
+          "priority below the control thread.");
+ABSL_FLAG(double, mjpc_rt_control_period, 1.0e-3,
+          "Target period of the control loop (seconds); longer periods are "
+          "counted as missed ticks in GetMetrics.");
+ABSL_FLAG(std::string, mjpc_rollout_workers, "",
+          "Comma-separated addresses of rollout_server workers, e.g., "
+          "\"node1:10001,node2:10001\". The sampling planner evaluates "
+          "additional samples on them.");
+ABSL_FLAG(int32_t, mjpc_rollout_samples, 64,
+          "Samples per rollout worker and planning iteration.");
+ABSL_FLAG(double, mjpc_rollout_timeout, 1.0,
+          "Deadline of remote rollouts (seconds) for iterations without a "
+          "planning deadline.");
+
+ABSL_FLAG(std::string, mjpc_plan_log, "",
+          "Path of a binary log of the planning iterations, see "
+          "python/mujoco_mpc/plan_log.py for a reader. Empty for none.");
+ABSL_FLAG(bool, mjpc_plan_log_samples, false,
+          "Log the states of all samples of sampling planners.");
+ABSL_FLAG(bool, mjpc_perf_counters, false,
+          "Sample hardware performance counters of the planner and estimator "
+          "phases, reported by GetMetrics. Requires building with "
+          "MJPC_ENABLE_PERF_COUNTERS.");
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
   int port = absl::GetFlag(FLAGS_mjpc_port);
 
+  // rollouts are not drawn
+  mjpc::SetTracesEnabled(false);
+
+  if (absl::GetFlag(FLAGS_mjpc_perf_counters) &&
+      !mjpc::StartPerfCounters()) {
+    LOG(WARNING) << "Performance counters are unavailable, build with "
+                    "MJPC_ENABLE_PERF_COUNTERS on Linux and check "
+                    "/proc/sys/kernel/perf_event_paranoid";
+  }
+
   std::string server_address = absl::StrCat("[::]:", port);
 
   std::shared_ptr<grpc::ServerCredentials> server_credentials =
@@ -46,8 +103,41 @@ int main(int argc, char** argv) {
   grpc::ServerBuilder builder;
   builder.AddListeningPort(server_address, server_credentials);
 
-  mjpc::agent_grpc::AgentService service(mjpc::GetTasks(),
-                                         absl::GetFlag(FLAGS_mjpc_workers));
+  mjpc::ThreadPoolAffinity affinity;
+  affinity.cpus = absl::GetFlag(FLAGS_mjpc_worker_cpus);
+  affinity.numa_node = absl::GetFlag(FLAGS_mjpc_worker_numa_node);
+  affinity.exclude = absl::GetFlag(FLAGS_mjpc_worker_exclude_cpus);
+  mjpc::agent_grpc::AgentService service(mjpc::GetRegisteredTasks(),
+                                         absl::GetFlag(FLAGS_mjpc_workers),
+                                         mjpc::GetRegisteredTasks, affinity);
+  mjpc::RealtimeOptions realtime;
+  realtime.control_priority = absl::GetFlag(FLAGS_mjpc_rt_control_priority);
+  realtime.lock_memory = absl::GetFlag(FLAGS_mjpc_rt_lock_memory);
+  realtime.planner_nice = absl::GetFlag(FLAGS_mjpc_rt_worker_nice);
+  realtime.control_period = absl::GetFlag(FLAGS_mjpc_rt_control_period);
+  service.SetRealtime(realtime);
+
+  mjpc::PlanLogOptions plan_log;
+  plan_log.samples = absl::GetFlag(FLAGS_mjpc_plan_log_samples);
+  service.SetPlanLog(absl::GetFlag(FLAGS_mjpc_plan_log), plan_log);
+
+  rollout_grpc::RolloutClientOptions rollout_options;
+  rollout_options.addresses =
+      absl::StrSplit(absl::GetFlag(FLAGS_mjpc_rollout_workers), ',',
+                     absl::SkipEmpty());
+  rollout_options.samples_per_worker =
+      absl::GetFlag(FLAGS_mjpc_rollout_samples);
+  rollout_options.timeout = absl::GetFlag(FLAGS_mjpc_rollout_timeout);
+  if (!rollout_options.addresses.empty()) {
+    service.SetRemoteRollouts(
+        [rollout_options](const mjModel* model, std::string_view task_id)
+            -> std::shared_ptr<mjpc::RemoteRollouts> {
+          auto client =
+              std::make_shared<rollout_grpc::RolloutClient>(rollout_options);
+          if (client->Init(model, task_id) == 0) return nullptr;
+          return client;
+        });
+  }
   builder.SetMaxReceiveMessageSize(40 * 1024 * 1024);
   builder.RegisterService(&service);
 
@@ -0,0 +1,324 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load generator for `Agent` servers. Concurrent clients, each with its own
+// agent, run control ticks (SetState, PlannerStep and GetAction, or one
+// Control stream message) at a fixed rate or back to back, and the latency
+// percentiles and sustained rates of the RPCs are reported.
+//
+// Without --mjpc_bench_targets, each client gets an in-process server, for
+// each planner thread count of --mjpc_bench_workers.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/log/check.h>
+#include <absl/log/log.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_split.h>
+// DEEPMIND INTERNAL IMPORT
+#include <grpcpp/channel.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/support/channel_arguments.h>
+#include <grpcpp/support/status.h>
+
+#include "mjpc/grpc/agent.grpc.pb.h"
+#include "mjpc/grpc/agent.pb.h"
+#include "mjpc/grpc/agent_service.h"
+#include "mjpc/tasks/tasks.h"
+
+ABSL_FLAG(std::string, mjpc_bench_targets, "",
+          "Comma-separated addresses of running agent servers, assigned to "
+          "the clients round robin. Empty for in-process servers.");
+ABSL_FLAG(std::string, mjpc_bench_workers, "4",
+          "Comma-separated planner thread counts of the in-process servers, "
+          "one run each.");
+ABSL_FLAG(int32_t, mjpc_bench_clients, 4, "number of concurrent clients");
+ABSL_FLAG(double, mjpc_bench_rate, 0.0,
+          "Control ticks per second of each client, 0 for back to back.");
+ABSL_FLAG(double, mjpc_bench_duration, 10.0, "duration of a run (seconds)");
+ABSL_FLAG(std::string, mjpc_bench_task, "Cartpole", "task of the agents");
+ABSL_FLAG(std::string, mjpc_bench_mode, "unary",
+          "unary: SetState, PlannerStep and GetAction per tick. control: "
+          "one Control stream message per tick, planning in the background.");
+ABSL_FLAG(double, mjpc_bench_planning_budget, 0.0,
+          "Planning budget of PlannerStep (seconds), 0 for none.");
+
+namespace {
+
+using ::agent::grpc_gen::Agent;
+using Clock = std::chrono::steady_clock;
+
+// options of a run
+struct BenchOptions {
+  std::string task;
+  std::string mode;
+  double rate;
+  double duration;
+  double planning_budget;
+};
+
+// latencies (seconds) of a client's RPCs and ticks
+struct Latencies {
+  std::vector<double> set_state;
+  std::vector<double> planner_step;
+  std::vector<double> get_action;
+  std::vector<double> control;
+  std::vector<double> tick;
+  int errors = 0;
+
+  void Append(const Latencies& other) {
+    for (auto [dst, src] :
+         {std::pair(&set_state, &other.set_state),
+          std::pair(&planner_step, &other.planner_step),
+          std::pair(&get_action, &other.get_action),
+          std::pair(&control, &other.control), std::pair(&tick, &other.tick)}) {
+      dst->insert(dst->end(), src->begin(), src->end());
+    }
+    errors += other.errors;
+  }
+};
+
+double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// p-th quantile of sorted values, nearest rank
+double Quantile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  int rank = std::ceil(p * sorted.size());
+  return sorted[std::clamp(rank - 1, 0, static_cast<int>(sorted.size()) - 1)];
+}
+
+// ticks at a fixed rate, or back to back. with a rate, tick latencies are
+// measured from the scheduled start, so that a slow server isn't hidden by
+// ticks starting late.
+class TickSchedule {
+ public:
+  TickSchedule(double rate, double duration)
+      : start_(Clock::now()),
+        end_(start_ + std::chrono::duration_cast<Clock::duration>(
+                          std::chrono::duration<double>(duration))),
+        rate_(rate) {}
+
+  // waits for the next tick, returns false at the end of the run
+  bool Next(Clock::time_point* scheduled) {
+    if (rate_ > 0) {
+      *scheduled = start_ + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>(ticks_ / rate_));
+      if (*scheduled >= end_) return false;
+      std::this_thread::sleep_until(*scheduled);
+    } else {
+      *scheduled = Clock::now();
+      if (*scheduled >= end_) return false;
+    }
+    ticks_++;
+    return true;
+  }
+
+  // simulation time of the current tick
+  double Time() const { return ticks_ * (rate_ > 0 ? 1.0 / rate_ : 0.01); }
+
+ private:
+  Clock::time_point start_;
+  Clock::time_point end_;
+  double rate_;
+  int64_t ticks_ = 0;
+};
+
+// a unary call, returns its latency, counting failures as errors
+template <class Req, class Res>
+double Call(Agent::Stub* stub,
+            grpc::Status (Agent::Stub::*method)(grpc::ClientContext*,
+                                                const Req&, Res*),
+            const Req& request, Latencies* latencies) {
+  grpc::ClientContext context;
+  Res response;
+  Clock::time_point start = Clock::now();
+  grpc::Status status = (stub->*method)(&context, request, &response);
+  if (!status.ok()) {
+    latencies->errors++;
+    LOG_EVERY_N_SEC(WARNING, 1) << status.error_message();
+  }
+  return Seconds(Clock::now() - start);
+}
+
+// one client: initialize the agent, then run control ticks
+void RunClient(Agent::Stub* stub, const BenchOptions& options,
+               Latencies* latencies) {
+  agent::InitRequest init;
+  init.set_task_id(options.task);
+  Call(stub, &Agent::Stub::Init, init, latencies);
+  grpc::ClientContext state_context;
+  agent::GetStateResponse state;
+  CHECK(stub->GetState(&state_context, agent::GetStateRequest(), &state).ok());
+
+  agent::SetStateRequest set_state;
+  *set_state.mutable_state() = state.state();
+  agent::PlannerStepRequest planner_step;
+  if (options.planning_budget > 0) {
+    planner_step.set_planning_budget(options.planning_budget);
+  }
+  agent::GetActionRequest get_action;
+
+  TickSchedule schedule(options.rate, options.duration);
+  Clock::time_point scheduled;
+  if (options.mode == "control") {
+    grpc::ClientContext context;
+    auto stream = stub->Control(&context);
+    agent::ControlRequest request;
+    *request.mutable_state() = state.state();
+    agent::ControlResponse response;
+    while (schedule.Next(&scheduled)) {
+      request.mutable_state()->set_time(schedule.Time());
+      Clock::time_point start = Clock::now();
+      if (!stream->Write(request) || !stream->Read(&response)) {
+        latencies->errors++;
+        break;
+      }
+      Clock::time_point end = Clock::now();
+      latencies->control.push_back(Seconds(end - start));
+      latencies->tick.push_back(Seconds(end - scheduled));
+    }
+    stream->WritesDone();
+    grpc::Status status = stream->Finish();
+    if (!status.ok()) LOG(WARNING) << status.error_message();
+    return;
+  }
+
+  while (schedule.Next(&scheduled)) {
+    set_state.mutable_state()->set_time(schedule.Time());
+    get_action.set_time(schedule.Time());
+    latencies->set_state.push_back(
+        Call(stub, &Agent::Stub::SetState, set_state, latencies));
+    latencies->planner_step.push_back(
+        Call(stub, &Agent::Stub::PlannerStep, planner_step, latencies));
+    latencies->get_action.push_back(
+        Call(stub, &Agent::Stub::GetAction, get_action, latencies));
+    latencies->tick.push_back(Seconds(Clock::now() - scheduled));
+  }
+}
+
+// runs the clients concurrently, one stub each, and returns their latencies
+Latencies RunClients(const std::vector<std::unique_ptr<Agent::Stub>>& stubs,
+                     const BenchOptions& options) {
+  int num_clients = stubs.size();
+  std::vector<Latencies> latencies(num_clients);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_clients; i++) {
+    threads.emplace_back(RunClient, stubs[i].get(), std::cref(options),
+                         &latencies[i]);
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  Latencies merged;
+  for (const Latencies& client : latencies) merged.Append(client);
+  return merged;
+}
+
+void Report(std::string_view label, int num_clients, double duration,
+            Latencies& latencies) {
+  absl::PrintF("%s, %d clients, %d errors\n", label, num_clients,
+               latencies.errors);
+  absl::PrintF("  %-14s %9s %9s %9s %9s %10s\n", "rpc", "count", "p50 ms",
+               "p99 ms", "p999 ms", "per second");
+  for (auto [name, values] :
+       {std::pair("SetState", &latencies.set_state),
+        std::pair("PlannerStep", &latencies.planner_step),
+        std::pair("GetAction", &latencies.get_action),
+        std::pair("Control", &latencies.control),
+        std::pair("tick", &latencies.tick)}) {
+    if (values->empty()) continue;
+    std::sort(values->begin(), values->end());
+    absl::PrintF("  %-14s %9d %9.3f %9.3f %9.3f %10.1f\n", name,
+                 values->size(), 1.0e3 * Quantile(*values, 0.5),
+                 1.0e3 * Quantile(*values, 0.99),
+                 1.0e3 * Quantile(*values, 0.999), values->size() / duration);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  BenchOptions options;
+  options.task = absl::GetFlag(FLAGS_mjpc_bench_task);
+  options.mode = absl::GetFlag(FLAGS_mjpc_bench_mode);
+  options.rate = absl::GetFlag(FLAGS_mjpc_bench_rate);
+  options.duration = absl::GetFlag(FLAGS_mjpc_bench_duration);
+  options.planning_budget = absl::GetFlag(FLAGS_mjpc_bench_planning_budget);
+  int num_clients = absl::GetFlag(FLAGS_mjpc_bench_clients);
+  CHECK(options.mode == "unary" || options.mode == "control")
+      << "Unknown mode: " << options.mode;
+  CHECK_GT(num_clients, 0);
+
+  // running servers
+  std::vector<std::string> targets =
+      absl::StrSplit(absl::GetFlag(FLAGS_mjpc_bench_targets), ',',
+                     absl::SkipEmpty());
+  if (!targets.empty()) {
+    std::vector<std::unique_ptr<Agent::Stub>> stubs;
+    for (int i = 0; i < num_clients; i++) {
+      stubs.push_back(Agent::NewStub(grpc::CreateChannel(
+          targets[i % targets.size()],
+          grpc::experimental::LocalCredentials(LOCAL_TCP))));
+    }
+    Latencies latencies = RunClients(stubs, options);
+    Report(absl::StrFormat("%d servers, %s", targets.size(), options.mode),
+           num_clients, options.duration, latencies);
+    return 0;
+  }
+
+  // in-process servers, one per client, for each planner thread count
+  for (std::string_view workers_flag :
+       absl::StrSplit(absl::GetFlag(FLAGS_mjpc_bench_workers), ',',
+                      absl::SkipEmpty())) {
+    int workers;
+    CHECK(absl::SimpleAtoi(workers_flag, &workers))
+        << "Invalid thread count: " << workers_flag;
+    std::vector<std::unique_ptr<mjpc::agent_grpc::AgentService>> services;
+    std::vector<std::unique_ptr<grpc::Server>> servers;
+    std::vector<std::unique_ptr<Agent::Stub>> stubs;
+    for (int i = 0; i < num_clients; i++) {
+      services.push_back(std::make_unique<mjpc::agent_grpc::AgentService>(
+          mjpc::GetRegisteredTasks(), workers, mjpc::GetRegisteredTasks));
+      grpc::ServerBuilder builder;
+      builder.RegisterService(services.back().get());
+      servers.push_back(builder.BuildAndStart());
+      stubs.push_back(Agent::NewStub(
+          servers.back()->InProcessChannel(grpc::ChannelArguments())));
+    }
+    Latencies latencies = RunClients(stubs, options);
+    Report(absl::StrFormat("%d planner threads, %s", workers, options.mode),
+           num_clients, options.duration, latencies);
+    for (std::unique_ptr<grpc::Server>& server : servers) server->Shutdown();
+  }
+  return 0;
+}
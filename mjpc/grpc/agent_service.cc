@@ -14,21 +14,59 @@
 
 #include "mjpc/grpc/agent_service.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <absl/container/flat_hash_set.h>
 #include <absl/log/check.h>
 #include <absl/strings/str_format.h>
+#include <grpc/compression.h>
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
+#include <grpcpp/support/sync_stream.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/grpc/agent.pb.h"
 #include "mjpc/grpc/grpc_agent_util.h"
+#include "mjpc/memory_report.h"
+#include "mjpc/metrics.h"
+#include "mjpc/perf_counters.h"
+#include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy.h"
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/residual_dispatch.h"
 #include "mjpc/task.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc::agent_grpc {
 
+using ::agent::BatchGetActionRequest;
+using ::agent::BatchGetActionResponse;
+using ::agent::BatchPlannerStepRequest;
+using ::agent::BatchPlannerStepResponse;
+using ::agent::BatchSetStateRequest;
+using ::agent::BatchSetStateResponse;
+using ::agent::ControlRequest;
+using ::agent::ControlResponse;
+using ::agent::CreateSessionRequest;
+using ::agent::CreateSessionResponse;
+using ::agent::DeleteSessionRequest;
+using ::agent::DeleteSessionResponse;
+using ::agent::EvaluateRolloutsRequest;
+using ::agent::EvaluateRolloutsResponse;
 using ::agent::GetActionRequest;
 using ::agent::GetActionResponse;
 using ::agent::GetAllModesRequest;
@@ -37,14 +75,21 @@ using ::agent::GetBestTrajectoryRequest;
 using ::agent::GetBestTrajectoryResponse;
 using ::agent::GetCostValuesAndWeightsRequest;
 using ::agent::GetCostValuesAndWeightsResponse;
+using ::agent::GetMetricsRequest;
+using ::agent::GetMetricsResponse;
 using ::agent::GetModeRequest;
 using ::agent::GetModeResponse;
+using ::agent::GetPolicyRequest;
+using ::agent::GetPolicyResponse;
+using ::agent::GetSnapshotRequest;
+using ::agent::GetSnapshotResponse;
 using ::agent::GetStateRequest;
 using ::agent::GetStateResponse;
 using ::agent::GetTaskParametersRequest;
 using ::agent::GetTaskParametersResponse;
 using ::agent::InitRequest;
 using ::agent::InitResponse;
+using ::agent::PerfPhaseCounters;
 using ::agent::PlannerStepRequest;
 using ::agent::PlannerStepResponse;
 using ::agent::ResetRequest;
@@ -55,6 +100,8 @@ using ::agent::SetCostWeightsRequest;
 using ::agent::SetCostWeightsResponse;
 using ::agent::SetModeRequest;
 using ::agent::SetModeResponse;
+using ::agent::SetSnapshotRequest;
+using ::agent::SetSnapshotResponse;
 using ::agent::SetStateRequest;
 using ::agent::SetStateResponse;
 using ::agent::SetTaskParametersRequest;
@@ -71,42 +118,73 @@ mjModel* model = nullptr;
 // model used for planning, owned by the Agent instance.
 mjModel* agent_model = nullptr;
 
-void residual_sensor_callback(const mjModel* m, mjData* d, int stage) {
-  // with the `m == model` guard in place, no need to clear the callback.
-  if (m == agent_model || m == model) {
-    if (stage == mjSTAGE_ACC) {
-      task->Residual(m, d, d->sensordata);
-    }
-  }
+namespace {
+// status of requests that plan, step or modify the agent while a Control
+// stream plans in the background, which they would race with
+grpc::Status ControlStreamOpen() {
+  return {grpc::StatusCode::FAILED_PRECONDITION,
+          "A Control stream is planning."};
 }
 
-grpc::Status AgentService::Init(grpc::ServerContext* context,
-                                const InitRequest* request,
-                                InitResponse* response) {
-  agent_.SetTaskList(tasks_);
-  grpc::Status status = grpc_agent_util::InitAgent(&agent_, request);
+// selects the requested task and initializes the agent with its model
+grpc::Status LoadAgent(mjpc::Agent* agent,
+                       std::vector<mjpc::RegisteredTask> tasks,
+                       const InitRequest* request) {
+  agent->SetTaskList(std::move(tasks));
+  grpc::Status status = grpc_agent_util::InitAgent(agent, request);
   if (!status.ok()) {
     return status;
   }
-  agent_.SetTaskList(tasks_);
   std::string_view task_id = request->task_id();
-  int task_index = agent_.GetTaskIdByName(task_id);
+  int task_index = agent->GetTaskIdByName(task_id);
   if (task_index == -1) {
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                         absl::StrFormat("Invalid task_id: '%s'", task_id));
   }
-  agent_.SetTaskByIndex(task_index);
+  agent->SetTaskByIndex(task_index);
 
-  auto load_model = agent_.LoadModel();
+  auto load_model = agent->LoadModel();
   if (!load_model.model) {
     return grpc::Status(
         grpc::StatusCode::INTERNAL,
         absl::StrCat("Failed to load model: ", load_model.error));
   }
 
-  agent_.Initialize(load_model.model.get());
-  agent_.Allocate();
-  agent_.Reset();
+  // the service only runs the planner selected by the model
+  agent->load_on_demand = true;
+  agent->Initialize(load_model.model.get());
+  agent->Allocate();
+  agent->Reset();
+  return grpc::Status::OK;
+}
+
+// the call's deadline on the steady clock, unset if it has none
+std::chrono::steady_clock::time_point Deadline(
+    const grpc::ServerContext* context) {
+  std::chrono::system_clock::time_point deadline = context->deadline();
+  if (deadline == std::chrono::system_clock::time_point::max()) return {};
+  return std::chrono::steady_clock::now() +
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+             deadline - std::chrono::system_clock::now());
+}
+
+// first error of a batch, OK otherwise
+grpc::Status FirstError(const std::vector<grpc::Status>& statuses) {
+  for (const grpc::Status& status : statuses) {
+    if (!status.ok()) return status;
+  }
+  return grpc::Status::OK;
+}
+}  // namespace
+
+grpc::Status AgentService::Init(grpc::ServerContext* context,
+                                const InitRequest* request,
+                                InitResponse* response) {
+  if (controlling_.load()) return ControlStreamOpen();
+  grpc::Status status = LoadAgent(&agent_, tasks_, request);
+  if (!status.ok()) {
+    return status;
+  }
 
   task = agent_.ActiveTask();
   CHECK_EQ(agent_model, nullptr)
@@ -123,24 +201,53 @@ grpc::Status AgentService::Init(grpc::ServerContext* context,
     mj_resetDataKeyframe(model, data_, home_id);
     mj_resetDataKeyframe(model, rollout_data_.get(), home_id);
   }
-  mjcb_sensor = residual_sensor_callback;
+  // residuals of the planning and physics models are dispatched to the agent
+  agent_.RegisterResidualModel(model);
+  mjcb_sensor = mjpc::ResidualSensorCallback;
+
+  // remote samples of the sampling planner
+  if (remote_rollouts_) {
+    if (auto* sampling =
+            dynamic_cast<mjpc::SamplingPlanner*>(&agent_.ActivePlanner())) {
+      sampling->SetRemoteRollouts(
+          remote_rollouts_(agent_model, request->task_id()));
+    }
+  }
+
+  // planning iteration log
+  if (!plan_log_path_.empty() &&
+      !agent_.StartPlanLog(plan_log_path_, plan_log_options_)) {
+    return {grpc::StatusCode::INTERNAL,
+            absl::StrCat("Failed to open plan log: ", plan_log_path_)};
+  }
 
   agent_.SetState(data_);
+  average_request_.reset();
+  average_cache_.reset();
 
   agent_.plan_enabled = true;
   agent_.action_enabled = true;
 
+  // shared-memory state and action exchange
+  if (request->shared_memory()) {
+    status = shared_memory_.Create(model);
+    if (!status.ok()) return status;
+    response->set_shared_memory_name(shared_memory_.Name());
+    response->set_shared_memory_size(shared_memory_.Size());
+  }
+
   return grpc::Status::OK;
 }
 
 AgentService::~AgentService() {
   if (data_) mj_deleteData(data_);
+  // the dispatch callback remains installed for other agents in the process
+  agent_.UnregisterResidualModel(model);
   if (model) mj_deleteModel(model);
   model = nullptr;
   // no need to delete agent_model and task, since they're owned by agent_.
   agent_model = nullptr;
   task = nullptr;
-  mjcb_sensor = nullptr;
 }
 
 grpc::Status AgentService::GetState(grpc::ServerContext* context,
@@ -159,14 +266,18 @@ grpc::Status AgentService::SetState(grpc::ServerContext* context,
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
+  if (controlling_.load()) return ControlStreamOpen();
   grpc::Status status =
-      grpc_agent_util::SetState(request, &agent_, model, data_);
+      request->shared_memory()
+          ? shared_memory_.ReadState(model, data_)
+          : grpc_agent_util::SetState(request, &agent_, model, data_);
   if (!status.ok()) return status;
 
   mj_forward(model, data_);
   // Further update the state by calling task's Transition function.
   task->Transition(model, data_);
   agent_.SetState(data_);
+  average_cache_.reset();
 
   return grpc::Status::OK;
 }
@@ -177,8 +288,54 @@ grpc::Status AgentService::GetAction(grpc::ServerContext* context,
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
-  return grpc_agent_util::GetAction(
-      request, &agent_, model, rollout_data_.get(), &rollout_state_, response);
+  double time = request->has_time() ? request->time() : agent_.state.time();
+  grpc::Status status = grpc::Status::OK;
+  if (request->averaging_duration() > 0) {
+    // precompute this request after the next PlannerStep
+    average_request_ = *request;
+    average_request_->clear_time();
+    average_request_->clear_shared_memory();
+  }
+  if (request->averaging_duration() > 0 && average_cache_ &&
+      average_cache_->time == time &&
+      average_cache_->averaging_duration == request->averaging_duration() &&
+      average_cache_->nominal_action == request->nominal_action()) {
+    *response = average_cache_->response;
+  } else {
+    status = grpc_agent_util::GetAction(request, &agent_, model,
+                                        rollout_data_.get(), &rollout_state_,
+                                        response);
+  }
+  if (!status.ok()) return status;
+  RecordPolicyStaleness();
+  RecordControlPeriod();
+  if (!request->shared_memory()) return status;
+
+  // action to shared memory
+  if (!shared_memory_.IsOpen()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "Shared memory not requested in Init."};
+  }
+  shared_memory_.WriteAction(response->action().data(),
+                             response->action_size(), time);
+  response->clear_action();
+  return grpc::Status::OK;
+}
+
+void AgentService::CacheAverageAction() {
+  average_cache_.reset();
+  if (!average_request_) return;
+
+  // the rollouts run here rather than in GetAction, which returns the cached
+  // action while the state and policy are unchanged
+  AverageActionCache cache;
+  cache.time = agent_.state.time();
+  cache.averaging_duration = average_request_->averaging_duration();
+  cache.nominal_action = average_request_->nominal_action();
+  grpc::Status status = grpc_agent_util::GetAction(
+      &*average_request_, &agent_, model, rollout_data_.get(),
+      &rollout_state_, &cache.response);
+  if (status.ok()) average_cache_ = std::move(cache);
 }
 
 grpc::Status AgentService::GetCostValuesAndWeights(
@@ -197,9 +354,22 @@ grpc::Status AgentService::PlannerStep(grpc::ServerContext* context,
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
+  if (controlling_.load()) return ControlStreamOpen();
+  if (request->has_planning_budget()) {
+    agent_.SetPlanningBudget(request->planning_budget());
+  }
+  if (context->IsCancelled()) {
+    return {grpc::StatusCode::CANCELLED, "PlannerStep cancelled."};
+  }
   agent_.plan_enabled = true;
-  agent_.PlanIteration(&thread_pool_);
+  agent_.PlanIteration(&thread_pool_, Deadline(context));
+  CacheAverageAction();
 
+  response->set_deadline_missed(agent_.DeadlineMissed());
+  response->set_deadline_misses(agent_.DeadlineMisses());
+  response->set_autotune_rollouts(agent_.AutotuneRollouts());
+  response->set_autotune_steps(agent_.AutotuneSteps());
+  response->set_autotune_adjustments(agent_.AutotuneAdjustments());
   return grpc::Status::OK;
 }
 
@@ -209,6 +379,7 @@ grpc::Status AgentService::Step(grpc::ServerContext* context,
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
+  if (controlling_.load()) return ControlStreamOpen();
   mjpc::State& state = agent_.state;
   state.CopyTo(model, data_);
   // mj_forward is needed because Transition might access properties from
@@ -222,6 +393,7 @@ grpc::Status AgentService::Step(grpc::ServerContext* context,
                                           request->use_previous_policy());
   mj_step(model, data_);
   state.Set(model, data_);
+  average_cache_.reset();
   return grpc::Status::OK;
 }
 
@@ -231,10 +403,12 @@ grpc::Status AgentService::Reset(grpc::ServerContext* context,
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
+  if (controlling_.load()) return ControlStreamOpen();
 
   grpc::Status status =
       grpc_agent_util::Reset(&agent_, agent_.GetModel(), data_);
   rollout_data_.reset(mj_makeData(model));
+  average_cache_.reset();
   return status;
 }
 
@@ -299,6 +473,29 @@ grpc::Status AgentService::GetBestTrajectory(
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
 
+  // selected state components, (start, size) in the state
+  std::vector<std::pair<int, int>> components;
+  if (request->state_components().empty()) {
+    components.emplace_back(0, model->nq + model->nv + model->na);
+  } else {
+    absl::flat_hash_set<std::string_view> names(
+        request->state_components().begin(),
+        request->state_components().end());
+    for (std::string_view name : names) {
+      if (name != "qpos" && name != "qvel" && name != "act") {
+        return {grpc::StatusCode::INVALID_ARGUMENT,
+                absl::StrFormat("Invalid state component: '%s'", name)};
+      }
+    }
+    if (names.contains("qpos")) components.emplace_back(0, model->nq);
+    if (names.contains("qvel")) components.emplace_back(model->nq, model->nv);
+    if (names.contains("act")) {
+      components.emplace_back(model->nq + model->nv, model->na);
+    }
+  }
+  int state_dim = 0;
+  for (const auto& [start, size] : components) state_dim += size;
+
   // get best trajectory
   const Trajectory* trajectory = agent_.ActivePlanner().BestTrajectory();
 
@@ -308,23 +505,63 @@ grpc::Status AgentService::GetBestTrajectory(
 
   // plan steps
   int steps = agent_.PlanSteps();
-  response->set_steps(steps);
+  int stride = std::max(request->stride(), 1);
 
   // loop over plan steps
-  for (int t = 0; t < steps; t++) {
+  std::vector<double> states, actions;
+  int num_step = 0;
+  for (int t = 0; t < steps; t += stride) {
     // states
-    for (int i = 0; i < num_state; i++) {
-      response->add_states(trajectory->states[t * num_state + i]);
+    for (const auto& [start, size] : components) {
+      const double* state = trajectory->states.data() + t * num_state + start;
+      states.insert(states.end(), state, state + size);
     }
 
     // times
     response->add_times(trajectory->times[t]);
+    num_step++;
 
     // actions
     if (t >= steps - 1) continue;
-    for (int i = 0; i < num_action; i++) {
-      response->add_actions(trajectory->actions[t * num_action + i]);
+    const double* action = trajectory->actions.data() + t * num_action;
+    actions.insert(actions.end(), action, action + num_action);
+  }
+  response->set_steps(num_step);
+  response->set_state_dim(state_dim);
+
+  // differences from the values the client reconstructed from the last
+  // response, which include its rounding to float
+  bool delta = request->has_delta_base() &&
+               request->delta_base() == trajectory_sequence_ &&
+               states.size() == trajectory_states_.size() &&
+               actions.size() == trajectory_actions_.size();
+  response->set_delta(delta);
+  auto encode = [&](const std::vector<double>& values,
+                    std::vector<double>* sent,
+                    google::protobuf::RepeatedField<double>* out,
+                    google::protobuf::RepeatedField<float>* out_float) {
+    int size = values.size();
+    if (!delta) sent->assign(size, 0.0);
+    for (int i = 0; i < size; i++) {
+      double value = values[i] - (*sent)[i];
+      if (request->float32()) {
+        float value_float = value;
+        out_float->Add(value_float);
+        (*sent)[i] += value_float;
+      } else {
+        out->Add(value);
+        (*sent)[i] += value;
+      }
     }
+  };
+  encode(states, &trajectory_states_, response->mutable_states(),
+         response->mutable_states_float());
+  encode(actions, &trajectory_actions_, response->mutable_actions(),
+         response->mutable_actions_float());
+  response->set_sequence(++trajectory_sequence_);
+
+  if (request->compress()) {
+    context->set_compression_algorithm(GRPC_COMPRESS_GZIP);
   }
 
   // TODO(taylor): improve return status
@@ -338,7 +575,532 @@ grpc::Status AgentService::SetAnything(
   if (!Initialized()) {
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
+  average_cache_.reset();
   return grpc_agent_util::SetAnything(request, &agent_, agent_.GetModel(),
                                       data_, response);
 }
+
+grpc::Status AgentService::Control(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<ControlResponse, ControlRequest>* stream) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  if (controlling_.exchange(true)) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "Control stream already open."};
+  }
+
+  // plan in the background until the stream closes. the planner reads the
+  // state and a snapshot of the task each iteration, as in the app.
+  std::atomic<bool> exit_request = false;
+  std::atomic<int> iterations = 0;
+  agent_.plan_enabled = true;
+  average_cache_.reset();
+  std::thread plan_thread([this, &exit_request, &iterations]() {
+    while (!exit_request.load()) {
+      agent_.PlanIteration(&thread_pool_);
+      iterations++;
+    }
+  });
+
+  // the stream's thread runs the control loop
+  mjpc::ScopedRealtimePriority realtime_priority(realtime_.control_priority);
+  {
+    std::lock_guard<std::mutex> lock(control_period_mutex_);
+    control_period_.Restart();
+  }
+
+  grpc::Status status = grpc::Status::OK;
+  ControlRequest request;
+  while (stream->Read(&request)) {
+    // inputs
+    status =
+        grpc_agent_util::SetControlInputs(&request, &agent_, model, data_);
+    if (!status.ok()) break;
+    if (request.has_state()) {
+      mj_forward(model, data_);
+      task->Transition(model, data_);
+      agent_.SetState(data_);
+    }
+
+    // action from the latest policy
+    GetActionResponse action;
+    status = grpc_agent_util::GetAction(&request.action(), &agent_, model,
+                                        rollout_data_.get(), &rollout_state_,
+                                        &action);
+    if (!status.ok()) break;
+    RecordPolicyStaleness();
+    RecordControlPeriod();
+
+    ControlResponse response;
+    *response.mutable_action() = std::move(*action.mutable_action());
+    response.set_planning_iterations(iterations.exchange(0));
+    response.set_deadline_misses(agent_.DeadlineMisses());
+    if (!stream->Write(response)) break;
+  }
+
+  exit_request = true;
+  plan_thread.join();
+  controlling_ = false;
+  return status;
+}
+
+AgentService::Session::~Session() {
+  agent.UnregisterResidualModel(model);
+  if (data) mj_deleteData(data);
+  if (model) mj_deleteModel(model);
+}
+
+grpc::Status AgentService::FindSessions(
+    const std::vector<int>& ids,
+    std::vector<std::shared_ptr<Session>>* sessions) {
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  absl::flat_hash_set<int> unique_ids;
+  sessions->clear();
+  for (int id : ids) {
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+      return {grpc::StatusCode::NOT_FOUND,
+              absl::StrFormat("Unknown session: %d", id)};
+    }
+    if (!unique_ids.insert(id).second) {
+      return {grpc::StatusCode::INVALID_ARGUMENT,
+              absl::StrFormat("Duplicate session: %d", id)};
+    }
+    sessions->push_back(it->second);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::CreateSession(grpc::ServerContext* context,
+                                         const CreateSessionRequest* request,
+                                         CreateSessionResponse* response) {
+  if (!session_tasks_) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "Sessions need a task factory."};
+  }
+  auto session = std::make_shared<Session>();
+  mjpc::Agent& agent = session->agent;
+  grpc::Status status = LoadAgent(&agent, session_tasks_(), &request->init());
+  if (!status.ok()) {
+    return status;
+  }
+
+  // physics model, copied before the agent model's timestep and integrator
+  // are updated
+  session->model = mj_copyModel(nullptr, agent.GetModel());
+  session->data = mj_makeData(session->model);
+  session->rollout_data.reset(mj_makeData(session->model));
+  int home_id = mj_name2id(session->model, mjOBJ_KEY, "home");
+  if (home_id >= 0) {
+    mj_resetDataKeyframe(session->model, session->data, home_id);
+    mj_resetDataKeyframe(session->model, session->rollout_data.get(), home_id);
+  }
+  agent.RegisterResidualModel(session->model);
+  mjcb_sensor = mjpc::ResidualSensorCallback;
+
+  agent.SetState(session->data);
+  agent.plan_enabled = true;
+  agent.action_enabled = true;
+
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  int id = next_session_id_++;
+  sessions_[id] = std::move(session);
+  response->set_session_id(id);
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::DeleteSession(grpc::ServerContext* context,
+                                         const DeleteSessionRequest* request,
+                                         DeleteSessionResponse* response) {
+  // in-flight batch calls keep the session until they return
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  if (!sessions_.erase(request->session_id())) {
+    return {grpc::StatusCode::NOT_FOUND,
+            absl::StrFormat("Unknown session: %d", request->session_id())};
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::BatchSetState(grpc::ServerContext* context,
+                                         const BatchSetStateRequest* request,
+                                         BatchSetStateResponse* response) {
+  int num_request = request->requests_size();
+  std::vector<int> ids(num_request);
+  for (int i = 0; i < num_request; i++) {
+    ids[i] = request->requests(i).session_id();
+  }
+  std::vector<std::shared_ptr<Session>> sessions;
+  grpc::Status status = FindSessions(ids, &sessions);
+  if (!status.ok()) return status;
+
+  // set states in parallel on the shared pool
+  std::vector<grpc::Status> statuses(num_request);
+  thread_pool_.ParallelFor(0, num_request, 1, [&](int i) {
+    Session& session = *sessions[i];
+    statuses[i] = grpc_agent_util::SetState(&request->requests(i).request(),
+                                            &session.agent, session.model,
+                                            session.data);
+    if (!statuses[i].ok()) return;
+    mj_forward(session.model, session.data);
+    session.agent.ActiveTask()->Transition(session.model, session.data);
+    session.agent.SetState(session.data);
+  });
+  return FirstError(statuses);
+}
+
+grpc::Status AgentService::BatchPlannerStep(
+    grpc::ServerContext* context, const BatchPlannerStepRequest* request,
+    BatchPlannerStepResponse* response) {
+  // requested sessions, all sessions in ID order if none
+  std::vector<int> ids(request->session_ids().begin(),
+                       request->session_ids().end());
+  if (ids.empty()) {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (const auto& [id, session] : sessions_) ids.push_back(id);
+    std::sort(ids.begin(), ids.end());
+  }
+  std::vector<std::shared_ptr<Session>> sessions;
+  grpc::Status status = FindSessions(ids, &sessions);
+  if (!status.ok()) return status;
+
+  // one task per session. the planners' rollouts are scheduled on the same
+  // pool, whose workers steal across sessions. sessions not started when the
+  // call is cancelled are skipped.
+  std::chrono::steady_clock::time_point deadline = Deadline(context);
+  {
+    TaskGroup group(thread_pool_);
+    for (const std::shared_ptr<Session>& session : sessions) {
+      group.Schedule([this, context, deadline, request,
+                      agent = &session->agent]() {
+        if (context->IsCancelled()) return;
+        if (request->has_planning_budget()) {
+          agent->SetPlanningBudget(request->planning_budget());
+        }
+        agent->plan_enabled = true;
+        agent->PlanIteration(&thread_pool_, deadline);
+      });
+    }
+    group.Wait();
+  }
+  if (context->IsCancelled()) {
+    return {grpc::StatusCode::CANCELLED, "BatchPlannerStep cancelled."};
+  }
+
+  int num_session = sessions.size();
+  for (int i = 0; i < num_session; i++) {
+    const mjpc::Agent& agent = sessions[i]->agent;
+    agent::PlannerStepResponse* step = response->add_responses();
+    step->set_deadline_missed(agent.DeadlineMissed());
+    step->set_deadline_misses(agent.DeadlineMisses());
+    response->add_session_ids(ids[i]);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::BatchGetAction(grpc::ServerContext* context,
+                                          const BatchGetActionRequest* request,
+                                          BatchGetActionResponse* response) {
+  int num_request = request->requests_size();
+  std::vector<int> ids(num_request);
+  for (int i = 0; i < num_request; i++) {
+    ids[i] = request->requests(i).session_id();
+    response->add_responses();
+  }
+  std::vector<std::shared_ptr<Session>> sessions;
+  grpc::Status status = FindSessions(ids, &sessions);
+  if (!status.ok()) return status;
+
+  // actions (and averaging rollouts) in parallel on the shared pool
+  std::vector<grpc::Status> statuses(num_request);
+  thread_pool_.ParallelFor(0, num_request, 1, [&](int i) {
+    Session& session = *sessions[i];
+    statuses[i] = grpc_agent_util::GetAction(
+        &request->requests(i).request(), &session.agent, session.model,
+        session.rollout_data.get(), &session.rollout_state,
+        response->mutable_responses(i));
+  });
+  return FirstError(statuses);
+}
+
+void AgentService::RecordPolicyStaleness() {
+  std::chrono::steady_clock::time_point last_plan = agent_.LastPlanTime();
+  if (last_plan == std::chrono::steady_clock::time_point()) return;
+  policy_staleness_.Record(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - last_plan)
+                               .count());
+}
+
+void AgentService::RecordControlPeriod() {
+  std::lock_guard<std::mutex> lock(control_period_mutex_);
+  control_period_.Tick();
+}
+
+void AgentService::SetRealtime(const mjpc::RealtimeOptions& options) {
+  realtime_ = options;
+  if (options.lock_memory) mjpc::LockMemory();
+  if (options.planner_nice) {
+    mjpc::SetPoolNice(thread_pool_, options.planner_nice);
+  }
+  std::lock_guard<std::mutex> lock(control_period_mutex_);
+  control_period_.Reset(options.control_period, 0.5 * options.control_period);
+}
+
+grpc::Status AgentService::GetMetrics(grpc::ServerContext* context,
+                                      const GetMetricsRequest* request,
+                                      GetMetricsResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  auto now = std::chrono::steady_clock::now();
+  response->set_uptime(
+      std::chrono::duration<double>(now - start_time_).count());
+
+  // planning iterations
+  mjpc::LatencyHistogram::Snapshot latency = agent_.PlanLatency().Read();
+  grpc_agent_util::HistogramToProto(latency,
+                                    response->mutable_planning_latency());
+  response->set_planning_latency_p50(latency.Quantile(0.5));
+  response->set_planning_latency_p99(latency.Quantile(0.99));
+  response->set_planning_iterations(latency.count);
+  mjpc::PlannerCounters counters = agent_.Counters();
+  std::uint64_t rollouts = counters.rollouts;
+  response->set_rollouts(rollouts);
+  response->set_physics_steps(counters.steps);
+  response->set_residual_evaluations(counters.residuals);
+  response->set_derivative_evaluations(counters.derivatives);
+  response->set_aborted_rollouts(counters.aborted);
+  response->set_deadline_misses(agent_.DeadlineMisses());
+
+  // thread pool
+  response->set_pool_threads(thread_pool_.NumThreads());
+  response->set_pool_queue_depth(thread_pool_.QueueDepth());
+  double busy_time = thread_pool_.BusyTime();
+  response->set_pool_busy_time(busy_time);
+
+  // rates since the previous call
+  {
+    std::lock_guard<std::mutex> lock(metrics_mutex_);
+    MetricsSample sample = {now, latency.count, rollouts, counters.steps,
+                            busy_time};
+    double interval =
+        std::chrono::duration<double>(now - metrics_sample_.time).count();
+    if (interval > 0.0) {
+      response->set_iterations_per_second(
+          (sample.iterations - metrics_sample_.iterations) / interval);
+      response->set_rollouts_per_second(
+          (sample.rollouts - metrics_sample_.rollouts) / interval);
+      response->set_steps_per_second(
+          (sample.steps - metrics_sample_.steps) / interval);
+      if (thread_pool_.NumThreads() > 0) {
+        response->set_pool_utilization(
+            (sample.busy_time - metrics_sample_.busy_time) /
+            (interval * thread_pool_.NumThreads()));
+      }
+    }
+    metrics_sample_ = sample;
+  }
+
+  // policy
+  std::chrono::steady_clock::time_point last_plan = agent_.LastPlanTime();
+  response->set_policy_age(
+      last_plan == std::chrono::steady_clock::time_point()
+          ? -1.0
+          : std::chrono::duration<double>(now - last_plan).count());
+  grpc_agent_util::HistogramToProto(policy_staleness_.Read(),
+                                    response->mutable_policy_staleness());
+  grpc_agent_util::HistogramToProto(control_period_.periods().Read(),
+                                    response->mutable_control_period());
+  response->set_control_period_max(control_period_.max());
+  response->set_control_missed_ticks(control_period_.missed());
+  for (const mjpc::PhaseTime& phase : agent_.ActivePlanner().PhaseTimes()) {
+    (*response->mutable_planner_phase_times())[phase.name] = phase.time;
+  }
+  for (const mjpc::PerfPhaseCounts& phase : mjpc::PerfCounterTotals()) {
+    PerfPhaseCounters* counters = response->add_perf_counters();
+    counters->set_phase(phase.phase);
+    counters->set_thread(phase.thread);
+    counters->set_thread_id(phase.thread_id);
+    counters->set_samples(phase.samples);
+    counters->set_cycles(phase.counts.cycles);
+    counters->set_instructions(phase.counts.instructions);
+    counters->set_llc_misses(phase.counts.llc_misses);
+    counters->set_branch_misses(phase.counts.branch_misses);
+  }
+  // the planners' buffers are resized by PlanIteration, which a Control
+  // stream runs continuously
+  if (request->memory_report() && !controlling_.load()) {
+    mjpc::MemoryReport memory = agent_.ReportMemory();
+    for (const mjpc::MemoryReport::Entry& entry : memory.Entries()) {
+      (*response->mutable_memory_bytes())[entry.name] = entry.bytes;
+    }
+    response->set_memory_total_bytes(memory.Total());
+  }
+
+  if (request->prometheus_text()) {
+    response->set_prometheus_text(grpc_agent_util::PrometheusText(*response));
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::GetSnapshot(grpc::ServerContext* context,
+                                       const GetSnapshotRequest* request,
+                                       GetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  if (controlling_.load()) return ControlStreamOpen();
+  response->set_snapshot(agent_.Snapshot());
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::SetSnapshot(grpc::ServerContext* context,
+                                       const SetSnapshotRequest* request,
+                                       SetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  if (controlling_.load()) return ControlStreamOpen();
+  if (!agent_.Restore(request->snapshot())) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "Snapshot doesn't match the agent's planners or estimator."};
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::GetPolicy(grpc::ServerContext* context,
+                                     const GetPolicyRequest* request,
+                                     GetPolicyResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  ExportedPolicy policy;
+  if (!agent_.ActivePlanner().ExportPolicy(policy)) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "The planner has no published policy to export."};
+  }
+  response->set_version(policy.version);
+  if (!request->has_version() || request->version() != policy.version) {
+    response->set_policy(SerializePolicy(policy));
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status AgentService::EvaluateRollouts(
+    grpc::ServerContext* context, const EvaluateRolloutsRequest* request,
+    EvaluateRolloutsResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  if (controlling_.load()) return ControlStreamOpen();
+  const mjModel* model = agent_.GetModel();
+  const mjpc::Task* task = agent_.ActiveTask();
+  int nu = model->nu;
+  int dim_state = model->nq + model->nv + model->na;
+  int num_knot = request->spline_times_size();
+  int steps = request->steps() > 0 ? request->steps() : agent_.PlanSteps();
+
+  // sizes of the batch
+  if (request->states_size() % dim_state) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("states size %d is not a multiple of the state "
+                            "dimension %d.",
+                            request->states_size(), dim_state)};
+  }
+  int num_rollout = request->states_size() / dim_state;
+  if (request->times_size() && request->times_size() != num_rollout) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("Expected %d times, got %d.", num_rollout,
+                            request->times_size())};
+  }
+  if (num_knot < 1 || num_knot > mjpc::kMaxTrajectoryHorizon) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("Expected 1 to %d spline times, got %d.",
+                            mjpc::kMaxTrajectoryHorizon, num_knot)};
+  }
+  if (request->parameters_size() != num_rollout * num_knot * nu) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("Expected %d parameters, got %d.",
+                            num_rollout * num_knot * nu,
+                            request->parameters_size())};
+  }
+  if (steps > mjpc::kMaxTrajectoryHorizon) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("At most %d steps.", mjpc::kMaxTrajectoryHorizon)};
+  }
+  if (request->representation() < mjpc::PolicyRepresentation::kZeroSpline ||
+      request->representation() > mjpc::PolicyRepresentation::kCubicSpline) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("Unknown representation %d.",
+                            request->representation())};
+  }
+
+  // mocap and userdata of the agent's state, shared by all rollouts
+  std::vector<double> state(dim_state);
+  std::vector<double> mocap(7 * model->nmocap);
+  std::vector<double> userdata(model->nuserdata);
+  double agent_time;
+  agent_.state.CopyTo(state.data(), mocap.data(), userdata.data(),
+                      &agent_time);
+
+  // rollout data, trajectory and policy of each worker
+  struct Rollout {
+    mjpc::UniqueMjData data = {nullptr, mj_deleteData};
+    mjpc::Trajectory trajectory;
+    mjpc::SamplingPolicy policy;
+  };
+  std::vector<Rollout> rollouts(thread_pool_.NumThreads());
+  for (Rollout& rollout : rollouts) {
+    rollout.data = mjpc::MakeUniqueMjData(mj_makeData(model));
+    rollout.trajectory.Initialize(dim_state, nu, task->num_residual,
+                                  task->num_trace, steps);
+    rollout.trajectory.Allocate(steps);
+    rollout.policy.Allocate(model, *task, steps);
+    rollout.policy.num_spline_points = num_knot;
+    rollout.policy.representation =
+        static_cast<mjpc::PolicyRepresentation>(request->representation());
+  }
+
+  int num_term = task->num_term;
+  response->mutable_total_return()->Resize(num_rollout, 0.0);
+  response->mutable_failure()->Resize(num_rollout, false);
+  if (request->cost_terms()) {
+    response->mutable_cost_terms()->Resize(num_rollout * num_term, 0.0);
+  }
+  thread_pool_.ParallelFor(0, num_rollout, 1, [&](int i) {
+    Rollout& rollout = rollouts[mjpc::ThreadPool::WorkerId()];
+    mjpc::Trajectory& trajectory = rollout.trajectory;
+    mjpc::SamplingPolicy& policy = rollout.policy;
+
+    // absolute knot times
+    double time = request->times_size() ? request->times(i) : agent_time;
+    for (int k = 0; k < num_knot; k++) {
+      policy.times[k] = time + request->spline_times(k);
+    }
+    mju_copy(policy.parameters.data(),
+             request->parameters().data() + i * num_knot * nu, num_knot * nu);
+
+    trajectory.Rollout(policy, task, model, rollout.data.get(),
+                       request->states().data() + i * dim_state, time,
+                       mocap.data(), userdata.data(), steps);
+    response->set_total_return(i, trajectory.total_return);
+    response->set_failure(i, trajectory.failure);
+    if (!request->cost_terms() || trajectory.failure) return;
+
+    // terms weighted as the return
+    double* costs = response->mutable_cost_terms()->mutable_data() +
+                    i * num_term;
+    double terms[mjpc::kMaxCostTerms];
+    for (int t = 0; t < steps; t++) {
+      task->CostTerms(terms, trajectory.residual.data() +
+                                 t * trajectory.dim_residual);
+      mju_addToScl(costs, terms, trajectory.schedule.Weight(t, steps),
+                   num_term);
+    }
+    mju_scl(costs, costs,
+            1.0 / mju_max(trajectory.schedule.TotalWeight(steps), 1), num_term);
+  });
+  return grpc::Status::OK;
+}
 }  // namespace mjpc::agent_grpc
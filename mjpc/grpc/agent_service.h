@@ -17,16 +17,33 @@
 #ifndef MJPC_MJPC_GRPC_AGENT_SERVICE_H_
 #define MJPC_MJPC_GRPC_AGENT_SERVICE_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include <absl/container/flat_hash_map.h>
+
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
+#include <grpcpp/support/sync_stream.h>
 #include <mujoco/mujoco.h>
 
 #include <mjpc/grpc/agent.grpc.pb.h>
 #include <mjpc/grpc/agent.pb.h>
+#include <mjpc/grpc/shared_memory.h>
 #include <mjpc/agent.h>
+#include <mjpc/metrics.h>
+#include <mjpc/plan_log.h>
+#include <mjpc/planners/sampling/remote.h>
+#include <mjpc/realtime.h>
 #include <mjpc/task.h>
 #include <mjpc/threadpool.h>
 #include <mjpc/utilities.h>
@@ -35,13 +52,47 @@ namespace mjpc::agent_grpc {
 
 class AgentService final : public agent::Agent::Service {
  public:
-  explicit AgentService(std::vector<std::shared_ptr<mjpc::Task>> tasks,
-                        int num_workers = -1)
+  // makes a new list of tasks, for each agent session. only the task selected
+  // by a session is constructed.
+  using TaskFactory = std::function<std::vector<mjpc::RegisteredTask>()>;
+
+  // makes the remote rollouts of a planning model and task, nullptr for none
+  using RemoteRolloutsFactory =
+      std::function<std::shared_ptr<mjpc::RemoteRollouts>(
+          const mjModel* model, std::string_view task_id)>;
+
+  // planning workers are pinned to the cpus of affinity
+  explicit AgentService(std::vector<mjpc::RegisteredTask> tasks,
+                        int num_workers = -1,
+                        TaskFactory session_tasks = nullptr,
+                        const mjpc::ThreadPoolAffinity& affinity = {})
       : thread_pool_(num_workers == -1 ? mjpc::NumAvailableHardwareThreads()
-                                       : num_workers),
+                                       : num_workers,
+                     affinity),
         tasks_(std::move(tasks)),
+        session_tasks_(std::move(session_tasks)),
         rollout_data_(nullptr, mj_deleteData) {}
   ~AgentService();
+
+  // real-time mode: Control streams run at options.control_priority, the
+  // workers at options.planner_nice, and the period of GetAction calls and
+  // Control messages is compared to options.control_period. call before
+  // serving.
+  void SetRealtime(const mjpc::RealtimeOptions& options);
+
+  // the sampling planner of the agent loaded by Init evaluates additional
+  // samples on remote workers. call before serving.
+  void SetRemoteRollouts(RemoteRolloutsFactory factory) {
+    remote_rollouts_ = std::move(factory);
+  }
+
+  // the agent loaded by Init logs its planning iterations to path (see
+  // plan_log.h), replacing the log of a previous Init. call before serving.
+  void SetPlanLog(std::string path, const mjpc::PlanLogOptions& options) {
+    plan_log_path_ = std::move(path);
+    plan_log_options_ = options;
+  }
+
   grpc::Status Init(grpc::ServerContext* context,
                     const agent::InitRequest* request,
                     agent::InitResponse* response) override;
@@ -113,17 +164,139 @@ class AgentService final : public agent::Agent::Service {
                            const agent::SetAnythingRequest* request,
                            agent::SetAnythingResponse* response) override;
 
+  grpc::Status Control(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<agent::ControlResponse, agent::ControlRequest>*
+          stream) override;
+
+  grpc::Status CreateSession(grpc::ServerContext* context,
+                             const agent::CreateSessionRequest* request,
+                             agent::CreateSessionResponse* response) override;
+
+  grpc::Status DeleteSession(grpc::ServerContext* context,
+                             const agent::DeleteSessionRequest* request,
+                             agent::DeleteSessionResponse* response) override;
+
+  grpc::Status BatchSetState(grpc::ServerContext* context,
+                             const agent::BatchSetStateRequest* request,
+                             agent::BatchSetStateResponse* response) override;
+
+  grpc::Status BatchPlannerStep(
+      grpc::ServerContext* context,
+      const agent::BatchPlannerStepRequest* request,
+      agent::BatchPlannerStepResponse* response) override;
+
+  grpc::Status BatchGetAction(grpc::ServerContext* context,
+                              const agent::BatchGetActionRequest* request,
+                              agent::BatchGetActionResponse* response) override;
+
+  grpc::Status GetMetrics(grpc::ServerContext* context,
+                          const agent::GetMetricsRequest* request,
+                          agent::GetMetricsResponse* response) override;
+
+  grpc::Status GetSnapshot(grpc::ServerContext* context,
+                           const agent::GetSnapshotRequest* request,
+                           agent::GetSnapshotResponse* response) override;
+
+  grpc::Status SetSnapshot(grpc::ServerContext* context,
+                           const agent::SetSnapshotRequest* request,
+                           agent::SetSnapshotResponse* response) override;
+
+  grpc::Status GetPolicy(grpc::ServerContext* context,
+                         const agent::GetPolicyRequest* request,
+                         agent::GetPolicyResponse* response) override;
+
+  grpc::Status EvaluateRollouts(
+      grpc::ServerContext* context,
+      const agent::EvaluateRolloutsRequest* request,
+      agent::EvaluateRolloutsResponse* response) override;
+
  private:
   bool Initialized() const { return data_ != nullptr; }
 
+  // precompute the averaged action of the last averaged GetAction request at
+  // the current state, after planning
+  void CacheAverageAction();
+
+  // record the age of the policy an action is computed from
+  void RecordPolicyStaleness();
+
+  // record the period since the previous GetAction call or Control message
+  void RecordControlPeriod();
+
+  // an independent agent with its own physics model and data
+  struct Session {
+    Session() : rollout_data(nullptr, mj_deleteData) {}
+    ~Session();
+    mjpc::Agent agent;
+    mjModel* model = nullptr;
+    mjData* data = nullptr;
+    mjpc::UniqueMjData rollout_data;
+    mjpc::State rollout_state;
+  };
+
+  // returns the sessions with the given IDs, or an error for unknown IDs
+  grpc::Status FindSessions(const std::vector<int>& ids,
+                            std::vector<std::shared_ptr<Session>>* sessions);
+
   mjpc::ThreadPool thread_pool_;
   mjpc::Agent agent_;
-  std::vector<std::shared_ptr<mjpc::Task>> tasks_;
+  std::vector<mjpc::RegisteredTask> tasks_;
+  TaskFactory session_tasks_;
+  RemoteRolloutsFactory remote_rollouts_;
+  std::string plan_log_path_;
+  mjpc::PlanLogOptions plan_log_options_;
   mjData* data_ = nullptr;
 
   // an mjData instance used for rollouts for action averaging
   mjpc::UniqueMjData rollout_data_;
   mjpc::State rollout_state_;
+
+  // GetBestTrajectory delta encoding: the states and actions of the last
+  // response, as reconstructed by the client, and its sequence number
+  std::vector<double> trajectory_states_;
+  std::vector<double> trajectory_actions_;
+  std::uint64_t trajectory_sequence_ = 0;
+
+  // averaged action at a state time, precomputed after PlannerStep
+  struct AverageActionCache {
+    double time;
+    double averaging_duration;
+    bool nominal_action;
+    agent::GetActionResponse response;
+  };
+  std::optional<agent::GetActionRequest> average_request_;
+  std::optional<AverageActionCache> average_cache_;
+
+  // state and action exchange with a local client, if requested in Init
+  SharedMemory shared_memory_;
+
+  // a Control stream is open, planning in the background
+  std::atomic<bool> controlling_ = false;
+
+  // agent sessions by ID
+  std::mutex sessions_mutex_;
+  absl::flat_hash_map<int, std::shared_ptr<Session>> sessions_;
+  int next_session_id_ = 0;  // (guarded by sessions_mutex_)
+
+  // metrics: policy age at GetAction, and the counters at the previous
+  // GetMetrics call, for rates
+  std::chrono::steady_clock::time_point start_time_ =
+      std::chrono::steady_clock::now();
+  mjpc::LatencyHistogram policy_staleness_;
+  mjpc::RealtimeOptions realtime_;
+  std::mutex control_period_mutex_;
+  mjpc::ControlPeriodMonitor control_period_;  // (ticked with the mutex)
+  struct MetricsSample {
+    std::chrono::steady_clock::time_point time;
+    std::uint64_t iterations;
+    std::uint64_t rollouts;
+    std::uint64_t steps;
+    double busy_time;
+  };
+  std::mutex metrics_mutex_;
+  // (guarded by metrics_mutex_)
+  MetricsSample metrics_sample_ = {start_time_, 0, 0, 0, 0.0};
 };
 
 }  // namespace mjpc::agent_grpc
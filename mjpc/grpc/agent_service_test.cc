@@ -42,7 +42,9 @@ using agent::grpc_gen::Agent;
 class AgentServiceTest : public ::testing::Test {
  protected:
   void SetUp() override {
-    agent_service = std::make_unique<AgentService>(mjpc::GetTasks());
+    agent_service = std::make_unique<AgentService>(
+        mjpc::GetRegisteredTasks(), /*num_workers=*/-1,
+        mjpc::GetRegisteredTasks);
     grpc::ServerBuilder builder;
     builder.RegisterService(agent_service.get());
     server = builder.BuildAndStart();
@@ -182,6 +184,28 @@ TEST_F(AgentServiceTest, ActionAveragingGivesDifferentResult) {
   EXPECT_NE(action_with_averaging, action_without_averaging);
 }
 
+TEST_F(AgentServiceTest, ActionAveragingCachedAfterPlannerStep) {
+  RunAndCheckInit("Cartpole", nullptr);
+
+  agent::GetActionRequest request;
+  request.set_averaging_duration(1.0);
+  SendRequest(&Agent::Stub::GetAction, request);
+
+  // precomputes the averaged action of the last request
+  SendRequest(&Agent::Stub::PlannerStep);
+  agent::GetActionResponse cached =
+      SendRequest(&Agent::Stub::GetAction, request);
+
+  // an unchanged state invalidates the cache, the action is recomputed
+  SendRequest(&Agent::Stub::SetState);
+  agent::GetActionResponse computed =
+      SendRequest(&Agent::Stub::GetAction, request);
+
+  ASSERT_EQ(cached.action().size(), 1);
+  ASSERT_EQ(computed.action().size(), 1);
+  EXPECT_NEAR(cached.action()[0], computed.action()[0], 1.0e-6);
+}
+
 TEST_F(AgentServiceTest, NominalActionIndependentOfState) {
   // Pick a task that uses iLQG, where there is normally a feedback term on the
   // policy.
@@ -242,6 +266,43 @@ TEST_F(AgentServiceTest, NominalActionIndependentOfState) {
       << "feedback action should be different from the nominal";
 }
 
+TEST_F(AgentServiceTest, GetBestTrajectory_Encodings) {
+  RunAndCheckInit("Cartpole", nullptr);
+  SendRequest(&Agent::Stub::PlannerStep);
+
+  agent::GetBestTrajectoryResponse full =
+      SendRequest(&Agent::Stub::GetBestTrajectory);
+  ASSERT_GT(full.steps(), 2);
+  EXPECT_FALSE(full.delta());
+
+  // every other step, qpos only, as floats
+  agent::GetBestTrajectoryRequest request;
+  request.set_float32(true);
+  request.set_stride(2);
+  request.add_state_components("qpos");
+  agent::GetBestTrajectoryResponse reduced =
+      SendRequest(&Agent::Stub::GetBestTrajectory, request);
+  static constexpr int kCartpoleDofs = 2;
+  EXPECT_EQ(reduced.steps(), (full.steps() + 1) / 2);
+  EXPECT_EQ(reduced.state_dim(), kCartpoleDofs);
+  EXPECT_EQ(reduced.states_size(), 0);
+  ASSERT_EQ(reduced.states_float_size(), reduced.steps() * kCartpoleDofs);
+  EXPECT_FLOAT_EQ(reduced.states_float(kCartpoleDofs),
+                  full.states(2 * full.state_dim()));
+
+  // the trajectory is unchanged, differences are zero
+  request.set_delta_base(reduced.sequence());
+  agent::GetBestTrajectoryResponse delta =
+      SendRequest(&Agent::Stub::GetBestTrajectory, request);
+  EXPECT_TRUE(delta.delta());
+  for (float value : delta.states_float()) EXPECT_EQ(value, 0.0f);
+  for (float value : delta.actions_float()) EXPECT_EQ(value, 0.0f);
+
+  // a stale base returns full values
+  request.set_delta_base(reduced.sequence());
+  EXPECT_FALSE(SendRequest(&Agent::Stub::GetBestTrajectory, request).delta());
+}
+
 TEST_F(AgentServiceTest, Step_AdvancesTime) {
   RunAndCheckInit("Cartpole", nullptr);
 
@@ -360,4 +421,235 @@ TEST_F(AgentServiceTest, GetAllModes_Works) {
   EXPECT_EQ(response.mode_names()[0], "default_mode");
 }
 
+TEST_F(AgentServiceTest, Control_ReturnsActions) {
+  RunAndCheckInit("Cartpole", nullptr);
+
+  grpc::ClientContext context;
+  auto stream = stub->Control(&context);
+
+  // states with a task parameter on the first message
+  for (int i = 0; i < 3; i++) {
+    agent::ControlRequest request;
+    request.mutable_state()->set_time(0.01 * i);
+    if (i == 0) (*request.mutable_parameters())["Goal"].set_numeric(-1.0);
+    ASSERT_TRUE(stream->Write(request));
+
+    agent::ControlResponse response;
+    ASSERT_TRUE(stream->Read(&response));
+    EXPECT_EQ(response.action().size(), 1);
+  }
+  stream->WritesDone();
+  grpc::Status status = stream->Finish();
+  EXPECT_TRUE(status.ok()) << status.error_message();
+}
+
+TEST_F(AgentServiceTest, Control_RejectsInvalidParameter) {
+  RunAndCheckInit("Cartpole", nullptr);
+
+  grpc::ClientContext context;
+  auto stream = stub->Control(&context);
+
+  agent::ControlRequest request;
+  (*request.mutable_parameters())["NotAParameter"].set_numeric(1.0);
+  stream->Write(request);
+  stream->WritesDone();
+
+  agent::ControlResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST_F(AgentServiceTest, Control_RejectsConcurrentRequests) {
+  RunAndCheckInit("Cartpole", nullptr);
+
+  grpc::ClientContext context;
+  auto stream = stub->Control(&context);
+  agent::ControlRequest request;
+  request.mutable_state()->set_time(0.0);
+  ASSERT_TRUE(stream->Write(request));
+  agent::ControlResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+
+  // requests that plan, step or modify the agent race with the plan thread
+  auto expect_rejected = [](grpc::Status status) {
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::FAILED_PRECONDITION);
+  };
+  {
+    grpc::ClientContext request_context;
+    agent::PlannerStepResponse planner_step;
+    expect_rejected(stub->PlannerStep(&request_context,
+                                      agent::PlannerStepRequest(),
+                                      &planner_step));
+  }
+  {
+    grpc::ClientContext request_context;
+    agent::StepResponse step;
+    expect_rejected(
+        stub->Step(&request_context, agent::StepRequest(), &step));
+  }
+  {
+    grpc::ClientContext request_context;
+    agent::ResetResponse reset;
+    expect_rejected(
+        stub->Reset(&request_context, agent::ResetRequest(), &reset));
+  }
+  {
+    grpc::ClientContext request_context;
+    agent::SetStateRequest set_state_request;
+    set_state_request.mutable_state()->set_time(0.0);
+    agent::SetStateResponse set_state;
+    expect_rejected(
+        stub->SetState(&request_context, set_state_request, &set_state));
+  }
+  {
+    grpc::ClientContext request_context;
+    agent::InitRequest init_request;
+    init_request.set_task_id("Cartpole");
+    agent::InitResponse init;
+    expect_rejected(stub->Init(&request_context, init_request, &init));
+  }
+
+  stream->WritesDone();
+  grpc::Status status = stream->Finish();
+  EXPECT_TRUE(status.ok()) << status.error_message();
+
+  // accepted once the stream is closed
+  SendRequest(&Agent::Stub::PlannerStep, agent::PlannerStepRequest());
+}
+
+TEST_F(AgentServiceTest, BatchSessions_PlanAndAct) {
+  // sessions
+  int ids[2];
+  for (int i = 0; i < 2; i++) {
+    agent::CreateSessionRequest request;
+    request.mutable_init()->set_task_id("Cartpole");
+    ids[i] = SendRequest(&Agent::Stub::CreateSession, request).session_id();
+  }
+  EXPECT_NE(ids[0], ids[1]);
+
+  // states
+  {
+    agent::BatchSetStateRequest request;
+    for (int id : ids) {
+      agent::SessionSetStateRequest* session = request.add_requests();
+      session->set_session_id(id);
+      session->mutable_request()->mutable_state()->set_time(0.0);
+    }
+    SendRequest(&Agent::Stub::BatchSetState, request);
+  }
+
+  // plan all sessions
+  {
+    agent::BatchPlannerStepResponse response =
+        SendRequest(&Agent::Stub::BatchPlannerStep);
+    EXPECT_EQ(response.responses_size(), 2);
+    EXPECT_EQ(response.session_ids_size(), 2);
+  }
+
+  // actions, in request order
+  {
+    agent::BatchGetActionRequest request;
+    request.add_requests()->set_session_id(ids[1]);
+    request.add_requests()->set_session_id(ids[0]);
+    agent::BatchGetActionResponse response =
+        SendRequest(&Agent::Stub::BatchGetAction, request);
+    ASSERT_EQ(response.responses_size(), 2);
+    for (const agent::GetActionResponse& action : response.responses()) {
+      EXPECT_EQ(action.action().size(), 1);
+    }
+  }
+}
+
+TEST_F(AgentServiceTest, BatchSessions_RejectsUnknownSession) {
+  agent::CreateSessionRequest create_request;
+  create_request.mutable_init()->set_task_id("Cartpole");
+  int id =
+      SendRequest(&Agent::Stub::CreateSession, create_request).session_id();
+
+  agent::DeleteSessionRequest delete_request;
+  delete_request.set_session_id(id);
+  SendRequest(&Agent::Stub::DeleteSession, delete_request);
+
+  grpc::ClientContext context;
+  agent::BatchGetActionRequest request;
+  request.add_requests()->set_session_id(id);
+  agent::BatchGetActionResponse response;
+  grpc::Status status = stub->BatchGetAction(&context, request, &response);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST_F(AgentServiceTest, GetMetrics_CountsPlanning) {
+  RunAndCheckInit("Cartpole", nullptr);
+
+  constexpr int kSteps = 3;
+  for (int i = 0; i < kSteps; i++) SendRequest(&Agent::Stub::PlannerStep);
+  SendRequest(&Agent::Stub::GetAction);
+
+  agent::GetMetricsRequest request;
+  request.set_prometheus_text(true);
+  agent::GetMetricsResponse response =
+      SendRequest(&Agent::Stub::GetMetrics, request);
+  EXPECT_EQ(response.planning_iterations(), kSteps);
+  EXPECT_EQ(response.planning_latency().count(), kSteps);
+  EXPECT_EQ(response.planning_latency().counts_size(),
+            response.planning_latency().upper_bounds_size() + 1);
+  EXPECT_GT(response.rollouts(), 0);
+  EXPECT_GT(response.iterations_per_second(), 0.0);
+  EXPECT_GE(response.policy_age(), 0.0);
+  EXPECT_EQ(response.policy_staleness().count(), 1);
+  EXPECT_GT(response.pool_threads(), 0);
+  EXPECT_FALSE(response.planner_phase_times().empty());
+  // performance counters aren't sampled
+  EXPECT_TRUE(response.perf_counters().empty());
+  EXPECT_THAT(response.prometheus_text(),
+              testing::HasSubstr("mjpc_planning_iteration_seconds_count 3"));
+}
+
+TEST_F(AgentServiceTest, EvaluateRollouts_Batched) {
+  RunAndCheckInit("Cartpole", nullptr);
+  agent::GetStateResponse state = SendRequest(&Agent::Stub::GetState);
+
+  // three rollouts from the same state, the first two with the same actions
+  constexpr int kRollouts = 3;
+  agent::EvaluateRolloutsRequest request;
+  for (int i = 0; i < kRollouts; i++) {
+    for (double q : state.state().qpos()) request.add_states(q);
+    for (double v : state.state().qvel()) request.add_states(v);
+    for (double a : state.state().act()) request.add_states(a);
+  }
+  request.add_spline_times(0.0);
+  request.add_spline_times(0.5);
+  for (double action : {0.5, -0.5, 0.5, -0.5, -1.0, 1.0}) {
+    request.add_parameters(action);
+  }
+  request.set_steps(50);
+  request.set_representation(1);
+  request.set_cost_terms(true);
+  agent::EvaluateRolloutsResponse response =
+      SendRequest(&Agent::Stub::EvaluateRollouts, request);
+
+  ASSERT_EQ(response.total_return_size(), kRollouts);
+  ASSERT_EQ(response.cost_terms_size() % kRollouts, 0);
+  int num_term = response.cost_terms_size() / kRollouts;
+  EXPECT_GT(num_term, 0);
+  EXPECT_EQ(response.total_return(0), response.total_return(1));
+  EXPECT_NE(response.total_return(0), response.total_return(2));
+  for (int i = 0; i < kRollouts; i++) {
+    EXPECT_FALSE(response.failure(i));
+    double sum = 0.0;
+    for (int j = 0; j < num_term; j++) {
+      sum += response.cost_terms(i * num_term + j);
+    }
+    EXPECT_NEAR(sum, response.total_return(i), 1.0e-9);
+  }
+
+  // parameters of a different number of rollouts
+  request.add_parameters(0.0);
+  grpc::ClientContext context;
+  grpc::Status status =
+      stub->EvaluateRollouts(&context, request, &response);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+}
+
 }  // namespace mjpc::agent_grpc
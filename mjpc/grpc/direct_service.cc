@@ -29,6 +29,7 @@
 
 #include "mjpc/grpc/direct.pb.h"
 #include "mjpc/direct/direct.h"
+#include "mjpc/snapshot.h"
 
 namespace mjpc::direct_grpc {
 
@@ -43,6 +44,52 @@ absl::Status CheckSize(std::string_view name, int model_size, int vector_size) {
   }
   return absl::OkStatus();
 }
+
+// copy sparse matrix to message
+void SetSparseMatrix(direct::SparseMatrix* output, const SparseMatrix& input) {
+  output->set_rows(input.rows);
+  output->set_cols(input.cols);
+  output->mutable_row_start()->Assign(input.row_start.begin(),
+                                      input.row_start.end());
+  output->mutable_column()->Assign(input.column.begin(), input.column.end());
+  output->mutable_value()->Assign(input.value.begin(), input.value.end());
+}
+
+// copy optimizer status to message
+void SetStatus(direct::Status* status, mjpc::Direct& optimizer) {
+  // search iterations
+  status->set_search_iterations(optimizer.IterationsSearch());
+
+  // smoother iterations
+  status->set_smoother_iterations(optimizer.IterationsSmoother());
+
+  // step size
+  status->set_step_size(optimizer.StepSize());
+
+  // regularization
+  status->set_regularization(optimizer.Regularization());
+
+  // gradient norm
+  status->set_gradient_norm(optimizer.GradientNorm());
+
+  // search direction norm
+  status->set_search_direction_norm(optimizer.SearchDirectionNorm());
+
+  // solve status
+  status->set_solve_status(static_cast<int>(optimizer.SolveStatus()));
+
+  // cost difference
+  status->set_cost_difference(optimizer.CostDifference());
+
+  // improvement
+  status->set_improvement(optimizer.Improvement());
+
+  // expected
+  status->set_expected(optimizer.Expected());
+
+  // reduction ratio
+  status->set_reduction_ratio(optimizer.ReductionRatio());
+}
 }  // namespace
 
 #define CHECK_SIZE(name, n1, n2)                              \
@@ -532,16 +579,23 @@ grpc::Status DirectService::Cost(grpc::ServerContext* context,
     // dimension
     int nvar = optimizer_.model->nv * optimizer_.ConfigurationLength();
 
-    // unpack
+    // set gradient
     double* gradient = optimizer_.GetCostGradient();
-    double* hessian = optimizer_.GetCostHessian();
-
-    // set gradient, Hessian
-    for (int i = 0; i < nvar; i++) {
-      response->add_gradient(gradient[i]);
-      for (int j = 0; j < nvar; j++) {
-        response->add_hessian(hessian[i * nvar + j]);
-      }
+    response->mutable_gradient()->Assign(gradient, gradient + nvar);
+
+    // set Hessian, the dense matrix only if requested
+    if (request->band()) {
+      int nband = optimizer_.BandDimension();
+      int nparam = optimizer_.NumberParameters();
+      int ntotal = nvar + nparam;
+      const double* hessian_band = optimizer_.GetCostHessianBand();
+      response->mutable_hessian_band()->Assign(
+          hessian_band, hessian_band + nvar * nband + nparam * ntotal);
+      response->set_nband(nband);
+      response->set_nparam(nparam);
+    } else {
+      double* hessian = optimizer_.GetCostHessian();
+      response->mutable_hessian()->Assign(hessian, hessian + nvar * nvar);
     }
   }
 
@@ -560,59 +614,58 @@ grpc::Status DirectService::Cost(grpc::ServerContext* context,
   if (request->internals()) {
     // residual sensor
     const double* residual_sensor = optimizer_.GetResidualSensor();
-    for (int i = 0; i < nsensor_; i++) {
-      response->add_residual_sensor(residual_sensor[i]);
-    }
+    response->mutable_residual_sensor()->Assign(residual_sensor,
+                                                residual_sensor + nsensor_);
 
     // residual force
     const double* residual_force = optimizer_.GetResidualForce();
-    for (int i = 0; i < nforce; i++) {
-      response->add_residual_force(residual_force[i]);
-    }
-
-    // Jacobian sensor
-    const double* jacobian_sensor = optimizer_.GetJacobianSensor();
-    for (int i = 0; i < nsensor_; i++) {
-      for (int j = 0; j < nvar; j++) {
-        response->add_jacobian_sensor(jacobian_sensor[i * nvar + j]);
-      }
-    }
-
-    // Jacobian force
-    const double* jacobian_force = optimizer_.GetJacobianForce();
-    for (int i = 0; i < nforce; i++) {
-      for (int j = 0; j < nvar; j++) {
-        response->add_jacobian_force(jacobian_force[i * nvar + j]);
-      }
+    response->mutable_residual_force()->Assign(residual_force,
+                                               residual_force + nforce);
+
+    // Jacobians
+    if (request->sparse()) {
+      SetSparseMatrix(response->mutable_jacobian_sensor_sparse(),
+                      optimizer_.GetJacobianSensorSparse());
+      SetSparseMatrix(response->mutable_jacobian_force_sparse(),
+                      optimizer_.GetJacobianForceSparse());
+    } else {
+      // Jacobian sensor
+      const double* jacobian_sensor = optimizer_.GetJacobianSensor();
+      response->mutable_jacobian_sensor()->Assign(
+          jacobian_sensor, jacobian_sensor + nsensor_ * nvar);
+
+      // Jacobian force
+      const double* jacobian_force = optimizer_.GetJacobianForce();
+      response->mutable_jacobian_force()->Assign(
+          jacobian_force, jacobian_force + nforce * nvar);
     }
 
     // norm gradient sensor
     const double* norm_gradient_sensor = optimizer_.GetNormGradientSensor();
-    for (int i = 0; i < nsensor_; i++) {
-      response->add_norm_gradient_sensor(norm_gradient_sensor[i]);
-    }
+    response->mutable_norm_gradient_sensor()->Assign(
+        norm_gradient_sensor, norm_gradient_sensor + nsensor_);
 
     // norm gradient force
     const double* norm_gradient_force = optimizer_.GetNormGradientForce();
-    for (int i = 0; i < nforce; i++) {
-      response->add_norm_gradient_force(norm_gradient_force[i]);
-    }
-
-    // norm Hessian sensor
-    const double* norm_hessian_sensor = optimizer_.GetNormHessianSensor();
-    for (int i = 0; i < nsensor_; i++) {
-      for (int j = 0; j < nsensor_; j++) {
-        response->add_norm_hessian_sensor(
-            norm_hessian_sensor[i * nsensor_ + j]);
-      }
-    }
-
-    // norm Hessian force
-    const double* norm_hessian_force = optimizer_.GetNormHessianForce();
-    for (int i = 0; i < nforce; i++) {
-      for (int j = 0; j < nforce; j++) {
-        response->add_norm_hessian_force(norm_hessian_force[i * nforce + j]);
-      }
+    response->mutable_norm_gradient_force()->Assign(
+        norm_gradient_force, norm_gradient_force + nforce);
+
+    // norm Hessians
+    if (request->sparse()) {
+      SetSparseMatrix(response->mutable_norm_hessian_sensor_sparse(),
+                      optimizer_.GetNormHessianSensorSparse());
+      SetSparseMatrix(response->mutable_norm_hessian_force_sparse(),
+                      optimizer_.GetNormHessianForceSparse());
+    } else {
+      // norm Hessian sensor
+      const double* norm_hessian_sensor = optimizer_.GetNormHessianSensor();
+      response->mutable_norm_hessian_sensor()->Assign(
+          norm_hessian_sensor, norm_hessian_sensor + nsensor_ * nsensor_);
+
+      // norm Hessian force
+      const double* norm_hessian_force = optimizer_.GetNormHessianForce();
+      response->mutable_norm_hessian_force()->Assign(
+          norm_hessian_force, norm_hessian_force + nforce * nforce);
     }
   }
 
@@ -688,8 +741,11 @@ grpc::Status DirectService::Optimize(grpc::ServerContext* context,
     return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
   }
 
-  // optimize
-  optimizer_.Optimize();
+  // optimize, until the call is cancelled or its deadline expires
+  optimizer_.Optimize([context]() { return context->IsCancelled(); });
+  if (optimizer_.SolveStatus() == mjpc::kCancelled) {
+    return {grpc::StatusCode::CANCELLED, "Optimize cancelled."};
+  }
 
   return grpc::Status::OK;
 }
@@ -702,40 +758,7 @@ grpc::Status DirectService::Status(grpc::ServerContext* context,
   }
 
   // status
-  direct::Status* status = response->mutable_status();
-
-  // search iterations
-  status->set_search_iterations(optimizer_.IterationsSearch());
-
-  // smoother iterations
-  status->set_smoother_iterations(optimizer_.IterationsSmoother());
-
-  // step size
-  status->set_step_size(optimizer_.StepSize());
-
-  // regularization
-  status->set_regularization(optimizer_.Regularization());
-
-  // gradient norm
-  status->set_gradient_norm(optimizer_.GradientNorm());
-
-  // search direction norm
-  status->set_search_direction_norm(optimizer_.SearchDirectionNorm());
-
-  // solve status
-  status->set_solve_status(static_cast<int>(optimizer_.SolveStatus()));
-
-  // cost difference
-  status->set_cost_difference(optimizer_.CostDifference());
-
-  // improvement
-  status->set_improvement(optimizer_.Improvement());
-
-  // expected
-  status->set_expected(optimizer_.Expected());
-
-  // reduction ratio
-  status->set_reduction_ratio(optimizer_.ReductionRatio());
+  SetStatus(response->mutable_status(), optimizer_);
 
   return grpc::Status::OK;
 }
@@ -759,6 +782,78 @@ grpc::Status DirectService::SensorInfo(grpc::ServerContext* context,
   return grpc::Status::OK;
 }
 
+grpc::Status DirectService::Stream(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<direct::StreamResponse, direct::StreamRequest>*
+        stream) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+
+  // dimensions
+  int nq = optimizer_.model->nq;
+  int nv = optimizer_.model->nv;
+  int nu = optimizer_.model->nu;
+  int ns = optimizer_.DimensionSensor();
+
+  // samples
+  direct::StreamRequest request;
+  while (stream->Read(&request)) {
+    CHECK_SIZE("ctrl", nu, request.ctrl_size());
+    CHECK_SIZE("sensor_measurement", ns, request.sensor_measurement_size());
+
+    // append sample to window
+    optimizer_.Append(request.ctrl().data(),
+                      request.sensor_measurement().data(), request.time());
+
+    // optimize
+    if (!request.has_optimize() || request.optimize()) {
+      optimizer_.Optimize([context]() { return context->IsCancelled(); });
+    }
+
+    // estimate at last time step
+    direct::StreamResponse response;
+    int t = optimizer_.ConfigurationLength() - 1;
+    double* configuration = optimizer_.configuration.Get(t);
+    response.mutable_configuration()->Assign(configuration, configuration + nq);
+    double* velocity = optimizer_.velocity.Get(t);
+    response.mutable_velocity()->Assign(velocity, velocity + nv);
+    response.set_time(optimizer_.times.Get(t)[0]);
+    response.set_cost(optimizer_.GetCost());
+    SetStatus(response.mutable_status(), optimizer_);
+
+    if (!stream->Write(response)) break;
+  }
+
+  return grpc::Status::OK;
+}
+
+grpc::Status DirectService::GetSnapshot(
+    grpc::ServerContext* context, const direct::GetSnapshotRequest* request,
+    direct::GetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  mjpc::SnapshotWriter writer;
+  optimizer_.Snapshot(writer);
+  response->set_snapshot(writer.Bytes());
+  return grpc::Status::OK;
+}
+
+grpc::Status DirectService::SetSnapshot(
+    grpc::ServerContext* context, const direct::SetSnapshotRequest* request,
+    direct::SetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  mjpc::SnapshotReader reader;
+  if (!reader.Parse(request->snapshot()) || !optimizer_.Restore(reader)) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "Snapshot doesn't match the optimizer."};
+  }
+  return grpc::Status::OK;
+}
+
 #undef CHECK_SIZE
 
 }  // namespace mjpc::direct_grpc
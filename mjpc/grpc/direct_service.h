@@ -22,6 +22,7 @@
 
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
+#include <grpcpp/support/sync_stream.h>
 #include <mujoco/mujoco.h>
 
 #include "mjpc/grpc/direct.grpc.pb.h"
@@ -72,6 +73,19 @@ class DirectService final : public direct::Direct::Service {
                           const direct::SensorInfoRequest* request,
                           direct::SensorInfoResponse* response) override;
 
+  grpc::Status Stream(grpc::ServerContext* context,
+                      grpc::ServerReaderWriter<direct::StreamResponse,
+                                               direct::StreamRequest>* stream)
+      override;
+
+  grpc::Status GetSnapshot(grpc::ServerContext* context,
+                           const direct::GetSnapshotRequest* request,
+                           direct::GetSnapshotResponse* response) override;
+
+  grpc::Status SetSnapshot(grpc::ServerContext* context,
+                           const direct::SetSnapshotRequest* request,
+                           direct::SetSnapshotResponse* response) override;
+
  private:
   bool Initialized() const {
     return optimizer_.model && optimizer_.ConfigurationLength() >= 3;
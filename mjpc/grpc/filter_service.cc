@@ -29,6 +29,8 @@
 
 #include "mjpc/grpc/filter.pb.h"
 #include "mjpc/estimators/estimator.h"
+#include "mjpc/estimators/unscented.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/utilities.h"
 
 namespace filter_grpc {
@@ -44,28 +46,13 @@ absl::Status CheckSize(std::string_view name, int model_size, int vector_size) {
   }
   return absl::OkStatus();
 }
-}  // namespace
-
-#define CHECK_SIZE(name, n1, n2)                              \
-  {                                                           \
-    auto expr = (CheckSize(name, n1, n2));                    \
-    if (!(expr).ok()) {                                       \
-      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, \
-                          (expr).ToString());                 \
-    }                                                         \
-  }
-
-FilterService::~FilterService() {}
-
-grpc::Status FilterService::Init(grpc::ServerContext* context,
-                                 const filter::InitRequest* request,
-                                 filter::InitResponse* response) {
-  // ----- initialize with model ----- //
+// load model from message, nullptr on failure
+mjpc::UniqueMjModel LoadModel(const filter::MjModel& message) {
   mjpc::UniqueMjModel tmp_model = {nullptr, mj_deleteModel};
 
   // convert message
-  if (request->has_model() && request->model().has_mjb()) {
-    std::string_view mjb = request->model().mjb();
+  if (message.has_mjb()) {
+    std::string_view mjb = message.mjb();
     static constexpr char file[] = "temporary-filename.mjb";
     // mjVFS structs need to be allocated on the heap, because it's ~2MB
     auto vfs = std::make_unique<mjVFS>();
@@ -75,8 +62,8 @@ grpc::Status FilterService::Init(grpc::ServerContext* context,
     memcpy(vfs->filedata[file_idx], mjb.data(), mjb.size());
     tmp_model = {mj_loadModel(file, vfs.get()), mj_deleteModel};
     mj_deleteFileVFS(vfs.get(), file);
-  } else if (request->has_model() && request->model().has_xml()) {
-    std::string_view model_xml = request->model().xml();
+  } else if (message.has_xml()) {
+    std::string_view model_xml = message.xml();
     char load_error[1024] = "";
 
     // TODO(taylor): utilize grpc_agent_util method
@@ -90,6 +77,40 @@ grpc::Status FilterService::Init(grpc::ServerContext* context,
     tmp_model = {mj_loadXML(file, vfs.get(), load_error, sizeof(load_error)),
                  mj_deleteModel};
     mj_deleteFileVFS(vfs.get(), file);
+  }
+  return tmp_model;
+}
+
+// set the sigma point set of an unscented filter, after Initialize
+void SetSigmaPoints(mjpc::Estimator* filter, filter::SigmaPoints sigma_points) {
+  auto* unscented = dynamic_cast<mjpc::Unscented*>(filter);
+  if (!unscented || sigma_points == filter::SIGMA_POINTS_MODEL) return;
+  unscented->settings.sigma_points =
+      sigma_points == filter::SIGMA_POINTS_SIMPLEX
+          ? mjpc::kSimplexSigmaPoints
+          : mjpc::kSymmetricSigmaPoints;
+}
+}  // namespace
+
+#define CHECK_SIZE(name, n1, n2)                              \
+  {                                                           \
+    auto expr = (CheckSize(name, n1, n2));                    \
+    if (!(expr).ok()) {                                       \
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, \
+                          (expr).ToString());                 \
+    }                                                         \
+  }
+
+FilterService::~FilterService() {}
+
+grpc::Status FilterService::Init(grpc::ServerContext* context,
+                                 const filter::InitRequest* request,
+                                 filter::InitResponse* response) {
+  // ----- initialize with model ----- //
+  mjpc::UniqueMjModel tmp_model = {nullptr, mj_deleteModel};
+  if (request->has_model() &&
+      (request->model().has_mjb() || request->model().has_xml())) {
+    tmp_model = LoadModel(request->model());
   } else {
     mju_error("Failed to create mjModel.");
   }
@@ -102,6 +123,7 @@ grpc::Status FilterService::Init(grpc::ServerContext* context,
   filter_ = mjpc::GetNumberOrDefault(0, model, "estimator");
   for (const auto& filter : filters_) {
     filter->Initialize(model);
+    SetSigmaPoints(filter.get(), request->sigma_points());
     filter->Reset();
   }
 
@@ -268,6 +290,126 @@ grpc::Status FilterService::Noise(grpc::ServerContext* context,
   return grpc::Status::OK;
 }
 
+grpc::Status FilterService::BatchInit(grpc::ServerContext* context,
+                                      const filter::BatchInitRequest* request,
+                                      filter::BatchInitResponse* response) {
+  if (request->num_filters() < 1) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "num_filters must be positive."};
+  }
+  mjpc::UniqueMjModel model = {nullptr, mj_deleteModel};
+  if (request->has_model()) model = LoadModel(request->model());
+  if (!model) {
+    return {grpc::StatusCode::INVALID_ARGUMENT, "Failed to create mjModel."};
+  }
+
+  // filters of the model's estimator type
+  int type = mjpc::GetNumberOrDefault(0, model.get(), "estimator");
+  batch_filters_.clear();
+  for (int i = 0; i < request->num_filters(); i++) {
+    std::unique_ptr<mjpc::Estimator> filter = mjpc::LoadEstimator(type);
+    if (!filter) {
+      batch_filters_.clear();
+      return {grpc::StatusCode::INVALID_ARGUMENT, "Invalid estimator."};
+    }
+    batch_filters_.push_back(std::move(filter));
+  }
+  batch_model_ = std::move(model);
+
+  // initialize in parallel, batch filters share the pool
+  int num_filters = batch_filters_.size();
+  thread_pool_.ParallelFor(0, num_filters, 1, [this, request](int i) {
+    batch_filters_[i]->Initialize(batch_model_.get());
+    SetSigmaPoints(batch_filters_[i].get(), request->sigma_points());
+    batch_filters_[i]->SetThreadPool(&thread_pool_);
+    batch_filters_[i]->Reset();
+  });
+
+  return grpc::Status::OK;
+}
+
+grpc::Status FilterService::BatchUpdate(
+    grpc::ServerContext* context, const filter::BatchUpdateRequest* request,
+    filter::BatchUpdateResponse* response) {
+  if (batch_filters_.empty()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "BatchInit not called."};
+  }
+
+  // dimensions
+  mjModel* model = batch_filters_[0]->Model();
+  int num_filters = batch_filters_.size();
+  int nu = model->nu;
+  int nsensor = model->nsensordata;
+  int nstate = model->nq + model->nv + model->na;
+  int ncovariance = batch_filters_[0]->DimensionProcess();
+  CHECK_SIZE("ctrl", num_filters * nu, request->ctrl_size());
+  CHECK_SIZE("sensor", num_filters * nsensor, request->sensor_size());
+  for (int i : request->reset()) {
+    if (i < 0 || i >= num_filters) {
+      return {grpc::StatusCode::INVALID_ARGUMENT, "Invalid reset filter."};
+    }
+  }
+
+  // contiguous outputs, each filter writes its own rows
+  response->set_state_dimension(nstate);
+  response->set_covariance_dimension(ncovariance);
+  response->mutable_state()->Resize(num_filters * nstate, 0.0);
+  response->mutable_time()->Resize(num_filters, 0.0);
+  if (request->covariance()) {
+    response->mutable_covariance()->Resize(
+        num_filters * ncovariance * ncovariance, 0.0);
+  }
+
+  // resets
+  for (int i : request->reset()) batch_filters_[i]->Reset();
+
+  // measurement updates
+  const double* ctrl = request->ctrl().data();
+  const double* sensor = request->sensor().data();
+  double* state = response->mutable_state()->mutable_data();
+  double* time = response->mutable_time()->mutable_data();
+  double* covariance = response->mutable_covariance()->mutable_data();
+  thread_pool_.ParallelFor(0, num_filters, 1, [&](int i) {
+    mjpc::Estimator* filter = batch_filters_[i].get();
+    filter->Update(ctrl + i * nu, sensor + i * nsensor);
+    mju_copy(state + i * nstate, filter->State(), nstate);
+    time[i] = filter->Time();
+    if (request->covariance()) {
+      int size = ncovariance * ncovariance;
+      mju_copy(covariance + i * size, filter->Covariance(), size);
+    }
+  });
+
+  return grpc::Status::OK;
+}
+
+grpc::Status FilterService::GetSnapshot(
+    grpc::ServerContext* context, const filter::GetSnapshotRequest* request,
+    filter::GetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  mjpc::SnapshotWriter writer;
+  filters_[filter_]->Snapshot(writer);
+  response->set_snapshot(writer.Bytes());
+  return grpc::Status::OK;
+}
+
+grpc::Status FilterService::SetSnapshot(
+    grpc::ServerContext* context, const filter::SetSnapshotRequest* request,
+    filter::SetSnapshotResponse* response) {
+  if (!Initialized()) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  mjpc::SnapshotReader reader;
+  if (!reader.Parse(request->snapshot()) ||
+      !filters_[filter_]->Restore(reader)) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "Snapshot doesn't match the filter."};
+  }
+  return grpc::Status::OK;
+}
+
 #undef CHECK_SIZE
 
 }  // namespace filter_grpc
@@ -27,12 +27,17 @@
 #include "mjpc/grpc/filter.grpc.pb.h"
 #include "mjpc/grpc/filter.pb.h"
 #include "mjpc/estimators/include.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
 
 namespace filter_grpc {
 
 class FilterService final : public filter::StateEstimation::Service {
  public:
-  explicit FilterService() : filters_(mjpc::LoadEstimators()) {}
+  explicit FilterService(int num_workers = -1)
+      : filters_(mjpc::LoadEstimators()),
+        thread_pool_(num_workers == -1 ? mjpc::NumAvailableHardwareThreads()
+                                       : num_workers) {}
   ~FilterService();
 
   grpc::Status Init(grpc::ServerContext* context,
@@ -59,6 +64,22 @@ class FilterService final : public filter::StateEstimation::Service {
                      const filter::NoiseRequest* request,
                      filter::NoiseResponse* response) override;
 
+  grpc::Status BatchInit(grpc::ServerContext* context,
+                         const filter::BatchInitRequest* request,
+                         filter::BatchInitResponse* response) override;
+
+  grpc::Status BatchUpdate(grpc::ServerContext* context,
+                           const filter::BatchUpdateRequest* request,
+                           filter::BatchUpdateResponse* response) override;
+
+  grpc::Status GetSnapshot(grpc::ServerContext* context,
+                           const filter::GetSnapshotRequest* request,
+                           filter::GetSnapshotResponse* response) override;
+
+  grpc::Status SetSnapshot(grpc::ServerContext* context,
+                           const filter::SetSnapshotRequest* request,
+                           filter::SetSnapshotResponse* response) override;
+
  private:
   bool Initialized() const { return filters_[filter_]->Model(); }
 
@@ -68,6 +89,11 @@ class FilterService final : public filter::StateEstimation::Service {
 
   // model
   mjpc::UniqueMjModel model_override_ = {nullptr, mj_deleteModel};
+
+  // batch of filters for the same model, updated in parallel on the pool
+  std::vector<std::unique_ptr<mjpc::Estimator>> batch_filters_;
+  mjpc::UniqueMjModel batch_model_ = {nullptr, mj_deleteModel};
+  mjpc::ThreadPool thread_pool_;
 };
 
 }  // namespace filter_grpc
@@ -14,17 +14,25 @@
 
 #include "mjpc/grpc/grpc_agent_util.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include <absl/container/flat_hash_map.h>
+#include <absl/functional/function_ref.h>
 #include <absl/log/check.h>
 #include <absl/status/status.h>
 #include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
 #include <absl/strings/strip.h>
 #include <grpcpp/support/status.h>
@@ -34,12 +42,14 @@
 
 #include "mjpc/grpc/agent.pb.h"
 #include "mjpc/agent.h"
+#include "mjpc/metrics.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/utilities.h"
 
 namespace grpc_agent_util {
 
+using ::agent::ControlRequest;
 using ::agent::GetActionRequest;
 using ::agent::GetActionResponse;
 using ::agent::GetAllModesRequest;
@@ -159,21 +169,23 @@ grpc::Status SetState(const SetStateRequest* request, mjpc::Agent* agent,
 #undef CHECK_SIZE
 
 namespace {
+// average action over averaging_duration, written to ret (nu). the ctrl of
+// rollout_data is the scratch action, so that no buffers are allocated.
 // TODO(nimrod): make planner a const reference
-std::vector<double> AverageAction(mjpc::Planner& planner, const mjModel* model,
-                                  bool nominal_action, mjData* rollout_data,
-                                  mjpc::State* rollout_state, double time,
-                                  double averaging_duration) {
+void AverageAction(double* ret, mjpc::Planner& planner, const mjModel* model,
+                   bool nominal_action, mjData* rollout_data,
+                   mjpc::State* rollout_state, double time,
+                   double averaging_duration) {
   int nu = model->nu;
-  std::vector<double> ret(nu, 0);
+  mju_zero(ret, nu);
   int nactions = 0;
   double end_time = time + averaging_duration;
 
   if (nominal_action) {
-    std::vector<double> action(nu, 0);
+    double* action = rollout_data->ctrl;
     while (time < end_time) {
-      planner.ActionFromPolicy(action.data(), /*state=*/nullptr, time);
-      mju_addTo(ret.data(), action.data(), nu);
+      planner.ActionFromPolicy(action, /*state=*/nullptr, time);
+      mju_addTo(ret, action, nu);
       time += model->opt.timestep;
       nactions++;
     }
@@ -184,13 +196,12 @@ std::vector<double> AverageAction(mjpc::Planner& planner, const mjModel* model,
       const double* state = rollout_state->state().data();
       planner.ActionFromPolicy(rollout_data->ctrl, state,
                                               rollout_data->time);
-      mju_addTo(ret.data(), rollout_data->ctrl, nu);
+      mju_addTo(ret, rollout_data->ctrl, nu);
       mj_step(model, rollout_data);
       nactions++;
     }
   }
-  mju_scl(ret.data(), ret.data(), 1.0 / nactions, nu);
-  return ret;
+  mju_scl(ret, ret, 1.0 / nactions, nu);
 }
 
 }  // namespace
@@ -202,25 +213,24 @@ grpc::Status GetAction(const GetActionRequest* request,
   double time =
       request->has_time() ? request->time() : agent->state.time();
 
+  // actions are written to the response directly, zero without a policy
+  response->mutable_action()->Clear();
+  response->mutable_action()->Resize(model->nu, 0.0);
+  double* action = response->mutable_action()->mutable_data();
+
   if (request->averaging_duration() > 0) {
-    if (request->nominal_action()) {
-      rollout_data = nullptr;
-      rollout_state = nullptr;
-    } else {
+    if (!request->nominal_action()) {
       agent->state.CopyTo(model, rollout_data);
       rollout_state->Set(model, rollout_data);
     }
-    std::vector<double> ret = AverageAction(agent->ActivePlanner(), model,
-                        request->nominal_action(), rollout_data, rollout_state,
-                        time, request->averaging_duration());
-    response->mutable_action()->Assign(ret.begin(), ret.end());
+    AverageAction(action, agent->ActivePlanner(), model,
+                  request->nominal_action(), rollout_data, rollout_state, time,
+                  request->averaging_duration());
   } else {
-    std::vector<double> ret(model->nu, 0);
     const double* state = request->nominal_action()
                               ? nullptr
                               : agent->state.state().data();
-    agent->ActivePlanner().ActionFromPolicy(ret.data(), state, time);
-    response->mutable_action()->Assign(ret.begin(), ret.end());
+    agent->ActivePlanner().ActionFromPolicy(action, state, time);
   }
 
   return grpc::Status::OK;
@@ -261,12 +271,16 @@ grpc::Status Reset(mjpc::Agent* agent, const mjModel* model, mjData* data) {
   return grpc::Status::OK;
 }
 
-grpc::Status SetTaskParameters(const SetTaskParametersRequest* request,
-                               mjpc::Agent* agent) {
-  for (const auto& [name, value] : request->parameters()) {
+namespace {
+// add parameters to update, without changing the task
+grpc::Status AddTaskParameters(
+    const ::google::protobuf::Map<std::string, agent::TaskParameterValue>&
+        parameters,
+    const mjpc::Agent* agent, mjpc::ResidualUpdate* update) {
+  for (const auto& [name, value] : parameters) {
     switch (value.value_case()) {
       case agent::TaskParameterValue::kNumeric:
-        if (agent->SetParamByName(name, value.numeric()) == -1) {
+        if (agent->AddParamByName(name, value.numeric(), update) == -1) {
           std::ostringstream error_string;
           error_string << "Parameter " << name
                        << " not found in task.  Available names are:\n";
@@ -285,7 +299,8 @@ grpc::Status SetTaskParameters(const SetTaskParametersRequest* request,
         }
         break;
       case agent::TaskParameterValue::kSelection:
-        if (agent->SetSelectionParamByName(name, value.selection()) == -1) {
+        if (agent->AddSelectionParamByName(name, value.selection(), update) ==
+            -1) {
           std::ostringstream error_string;
           error_string << "Parameter " << name
                        << " not found in task.  Available names are:\n";
@@ -308,11 +323,59 @@ grpc::Status SetTaskParameters(const SetTaskParametersRequest* request,
                             absl::StrCat("Missing value for parameter ", name));
     }
   }
-  agent->ActiveTask()->UpdateResidual();
+  return grpc::Status::OK;
+}
 
+// add cost weights to update, without changing the task
+grpc::Status AddCostWeights(
+    const ::google::protobuf::Map<std::string, double>& cost_weights,
+    const mjpc::Agent* agent, mjpc::ResidualUpdate* update) {
+  for (const auto& [name, weight] : cost_weights) {
+    if (agent->AddWeightByName(name, weight, update) == -1) {
+      std::ostringstream error_string;
+      error_string << "Weight '" << name
+                   << "' not found in task. Available names are:\n";
+      // cost terms are the leading user sensors of the task's model, the
+      // planning model's stripped sensors are user sensors too
+      auto* agent_model = agent->GetModel();
+      for (int i = 0; i < agent->ActiveTask()->num_term; i++) {
+        std::string_view sensor_name(agent_model->names +
+                                     agent_model->name_sensoradr[i]);
+        error_string << "  " << sensor_name << "\n";
+      }
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                          error_string.str());
+    }
+  }
   return grpc::Status::OK;
 }
 
+// parameters and weights, applied together with one residual update if all
+// names are found, otherwise none is applied
+grpc::Status SetTaskParametersAndWeights(
+    const ::google::protobuf::Map<std::string, agent::TaskParameterValue>*
+        parameters,
+    const ::google::protobuf::Map<std::string, double>* cost_weights,
+    mjpc::Agent* agent) {
+  mjpc::ResidualUpdate update;
+  if (parameters) {
+    grpc::Status status = AddTaskParameters(*parameters, agent, &update);
+    if (!status.ok()) return status;
+  }
+  if (cost_weights) {
+    grpc::Status status = AddCostWeights(*cost_weights, agent, &update);
+    if (!status.ok()) return status;
+  }
+  if (!update.empty()) agent->ActiveTask()->UpdateResidual(update);
+  return grpc::Status::OK;
+}
+}  // namespace
+
+grpc::Status SetTaskParameters(const SetTaskParametersRequest* request,
+                               mjpc::Agent* agent) {
+  return SetTaskParametersAndWeights(&request->parameters(), nullptr, agent);
+}
+
 grpc::Status GetTaskParameters(const GetTaskParametersRequest* request,
                                mjpc::Agent* agent,
                                GetTaskParametersResponse* response) {
@@ -339,36 +402,12 @@ grpc::Status GetTaskParameters(const GetTaskParametersRequest* request,
   return grpc::Status::OK;
 }
 
-grpc::Status SetCostWeights(
-    const ::google::protobuf::Map<std::string, double>& cost_weights,
-    mjpc::Agent* agent) {
-  for (const auto& [name, weight] : cost_weights) {
-    if (agent->SetWeightByName(name, weight) == -1) {
-      std::ostringstream error_string;
-      error_string << "Weight '" << name
-                   << "' not found in task. Available names are:\n";
-      auto* agent_model = agent->GetModel();
-      for (int i = 0; i < agent_model->nsensor &&
-                      agent_model->sensor_type[i] == mjSENS_USER;
-           i++) {
-        std::string_view sensor_name(agent_model->names +
-                                     agent_model->name_sensoradr[i]);
-        error_string << "  " << sensor_name << "\n";
-      }
-      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
-                          error_string.str());
-    }
-  }
-  return grpc::Status::OK;
-}
-
 grpc::Status SetCostWeights(const SetCostWeightsRequest* request,
                             mjpc::Agent* agent) {
   if (request->reset_to_defaults()) {
-    agent->ActiveTask()->Reset(agent->GetModel());
+    agent->ResetTask();
   }
-  auto cost_weights = request->cost_weights();
-  return SetCostWeights(cost_weights, agent);
+  return SetTaskParametersAndWeights(nullptr, &request->cost_weights(), agent);
 }
 
 
@@ -464,7 +503,8 @@ grpc::Status SetAnything(const SetAnythingRequest* request, mjpc::Agent* agent,
     }
   }
   if (request->cost_weights_size() > 0) {
-    grpc::Status status = SetCostWeights(request->cost_weights(), agent);
+    grpc::Status status =
+        SetTaskParametersAndWeights(nullptr, &request->cost_weights(), agent);
     if (!status.ok()) {
       return status;
     }
@@ -484,6 +524,32 @@ grpc::Status SetAnything(const SetAnythingRequest* request, mjpc::Agent* agent,
   return grpc::Status::OK;
 }
 
+grpc::Status SetControlInputs(const ControlRequest* request,
+                              mjpc::Agent* agent, const mjModel* model,
+                              mjData* data) {
+  if (request->has_state()) {
+    grpc::Status status = SetState(request->state(), agent, model, data);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  // parameters and weights as one residual version
+  if (request->parameters_size() > 0 || request->cost_weights_size() > 0) {
+    grpc::Status status = SetTaskParametersAndWeights(
+        &request->parameters(), &request->cost_weights(), agent);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (request->mocap_size() > 0) {
+    grpc::Status status = SetMocap(request->mocap(), agent, model, data);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return grpc::Status::OK;
+}
+
 mjpc::UniqueMjModel LoadModelFromString(std::string_view xml, char* error,
                              int error_size) {
   static constexpr char file[] = "temporary-filename.xml";
@@ -512,6 +578,44 @@ mjpc::UniqueMjModel LoadModelFromBytes(std::string_view mjb) {
   return m;
 }
 
+namespace {
+// number of compiled models kept by CachedModel
+constexpr std::size_t kModelCacheSize = 16;
+
+// returns a copy of the compiled model for key, loading and caching it on a
+// miss. models that fail to load are not cached.
+mjpc::UniqueMjModel CachedModel(
+    const std::string& key, absl::FunctionRef<mjpc::UniqueMjModel()> load) {
+  static std::mutex mutex;
+  static auto* models =
+      new absl::flat_hash_map<std::string, mjpc::UniqueMjModel>();
+  static auto* order = new std::deque<std::string>();  // oldest first
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = models->find(key);
+    if (it != models->end()) {
+      return {mj_copyModel(nullptr, it->second.get()), mj_deleteModel};
+    }
+  }
+
+  // compile outside the lock
+  mjpc::UniqueMjModel model = load();
+  if (!model) return model;
+  mjpc::UniqueMjModel copy = {mj_copyModel(nullptr, model.get()),
+                              mj_deleteModel};
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (models->try_emplace(key, std::move(model)).second) {
+    order->push_back(key);
+    if (order->size() > kModelCacheSize) {
+      models->erase(order->front());
+      order->pop_front();
+    }
+  }
+  return copy;
+}
+}  // namespace
+
 grpc::Status InitAgent(mjpc::Agent* agent, const agent::InitRequest* request) {
   std::string_view task_id = request->task_id();
   int task_index = agent->GetTaskIdByName(task_id);
@@ -524,15 +628,232 @@ grpc::Status InitAgent(mjpc::Agent* agent, const agent::InitRequest* request) {
   mjpc::UniqueMjModel tmp_model = {nullptr, mj_deleteModel};
   char load_error[1024] = "";
 
+  // compiled models are cached by task and model content, so agents
+  // initialized repeatedly with the same model are not recompiled
   if (request->has_model() && request->model().has_mjb()) {
     std::string_view model_mjb_bytes = request->model().mjb();
     // TODO(khartikainen): Add error handling for mjb loading.
-    tmp_model = LoadModelFromBytes(model_mjb_bytes);
+    tmp_model = CachedModel(
+        absl::StrCat("mjb:", task_id, ":", model_mjb_bytes),
+        [&]() { return LoadModelFromBytes(model_mjb_bytes); });
   } else if (request->has_model() && request->model().has_xml()) {
     std::string_view model_xml = request->model().xml();
-    tmp_model = LoadModelFromString(model_xml, load_error, sizeof(load_error));
+    tmp_model = CachedModel(
+        absl::StrCat("xml:", task_id, ":", model_xml), [&]() {
+          return LoadModelFromString(model_xml, load_error,
+                                     sizeof(load_error));
+        });
+  } else {
+    // the task's model file
+    agent->OverrideModel();
+    tmp_model =
+        CachedModel(absl::StrCat("file:", agent->GetTaskXmlPath(task_index)),
+                    [&]() { return agent->LoadModel().model; });
   }
   agent->OverrideModel(std::move(tmp_model));
   return grpc::Status::OK;
 }
+
+void HistogramToProto(const mjpc::LatencyHistogram::Snapshot& histogram,
+                      agent::Histogram* proto) {
+  proto->mutable_upper_bounds()->Assign(histogram.upper_bounds.begin(),
+                                        histogram.upper_bounds.end());
+  proto->mutable_counts()->Assign(histogram.counts.begin(),
+                                  histogram.counts.end());
+  proto->set_count(histogram.count);
+  proto->set_sum(histogram.sum);
+}
+
+namespace {
+void AppendMetric(std::string* text, std::string_view name,
+                  std::string_view type, std::string_view help, double value) {
+  absl::StrAppend(text, "# HELP ", name, " ", help, "\n# TYPE ", name, " ",
+                  type, "\n", name, " ", value, "\n");
+}
+
+void AppendHistogram(std::string* text, std::string_view name,
+                     std::string_view help, const agent::Histogram& histogram) {
+  absl::StrAppend(text, "# HELP ", name, " ", help, "\n# TYPE ", name,
+                  " histogram\n");
+  // cumulative buckets
+  std::uint64_t count = 0;
+  for (int i = 0; i < histogram.counts_size(); i++) {
+    count += histogram.counts(i);
+    std::string bound = i < histogram.upper_bounds_size()
+                            ? absl::StrCat(histogram.upper_bounds(i))
+                            : "+Inf";
+    absl::StrAppend(text, name, "_bucket{le=\"", bound, "\"} ", count, "\n");
+  }
+  absl::StrAppend(text, name, "_sum ", histogram.sum(), "\n", name, "_count ",
+                  histogram.count(), "\n");
+}
+}  // namespace
+
+std::string PrometheusText(const agent::GetMetricsResponse& metrics) {
+  std::string text;
+  AppendMetric(&text, "mjpc_uptime_seconds", "counter",
+               "Seconds since the service started.", metrics.uptime());
+  AppendHistogram(&text, "mjpc_planning_iteration_seconds",
+                  "Planning iteration latency.", metrics.planning_latency());
+  AppendMetric(&text, "mjpc_rollouts_total", "counter",
+               "Trajectory rollouts of planning iterations.",
+               metrics.rollouts());
+  AppendMetric(&text, "mjpc_physics_steps_total", "counter",
+               "Physics steps of planning rollouts.", metrics.physics_steps());
+  AppendMetric(&text, "mjpc_residual_evaluations_total", "counter",
+               "Residual evaluations of planning rollouts.",
+               metrics.residual_evaluations());
+  AppendMetric(&text, "mjpc_derivative_evaluations_total", "counter",
+               "Time steps differentiated by planners.",
+               metrics.derivative_evaluations());
+  AppendMetric(&text, "mjpc_aborted_rollouts_total", "counter",
+               "Planning rollouts stopped early by a failure.",
+               metrics.aborted_rollouts());
+  AppendMetric(&text, "mjpc_deadline_misses", "gauge",
+               "Planning iterations that overran the budget since reset.",
+               metrics.deadline_misses());
+  AppendMetric(&text, "mjpc_autotune_rollouts", "gauge",
+               "Rollouts of the next planning iteration set by the autotuner.",
+               metrics.autotune_rollouts());
+  AppendMetric(&text, "mjpc_autotune_steps", "gauge",
+               "Planning steps of the next iteration set by the autotuner.",
+               metrics.autotune_steps());
+  AppendMetric(&text, "mjpc_autotune_adjustments_total", "counter",
+               "Changes of the autotuner's rollouts or planning steps.",
+               metrics.autotune_adjustments());
+  AppendMetric(&text, "mjpc_thread_pool_threads", "gauge",
+               "Thread pool worker threads.", metrics.pool_threads());
+  AppendMetric(&text, "mjpc_thread_pool_queue_depth", "gauge",
+               "Thread pool tasks waiting for a worker.",
+               metrics.pool_queue_depth());
+  AppendMetric(&text, "mjpc_thread_pool_busy_seconds_total", "counter",
+               "Time thread pool workers spent running tasks.",
+               metrics.pool_busy_time());
+  AppendMetric(&text, "mjpc_policy_age_seconds", "gauge",
+               "Seconds since the latest planning iteration finished.",
+               metrics.policy_age());
+  AppendHistogram(&text, "mjpc_policy_staleness_seconds",
+                  "Policy age at GetAction calls and Control messages.",
+                  metrics.policy_staleness());
+  AppendHistogram(&text, "mjpc_control_period_seconds",
+                  "Time between GetAction calls and Control messages.",
+                  metrics.control_period());
+  AppendMetric(&text, "mjpc_control_period_max_seconds", "gauge",
+               "Longest time between GetAction calls and Control messages.",
+               metrics.control_period_max());
+  AppendMetric(&text, "mjpc_control_missed_ticks_total", "counter",
+               "Control periods longer than 1.5 times the target period.",
+               metrics.control_missed_ticks());
+
+  // phases in name order
+  std::vector<std::pair<std::string, double>> phases(
+      metrics.planner_phase_times().begin(),
+      metrics.planner_phase_times().end());
+  std::sort(phases.begin(), phases.end());
+  absl::StrAppend(&text,
+                  "# HELP mjpc_planner_phase_seconds Phase time of the "
+                  "planner's last iteration.\n"
+                  "# TYPE mjpc_planner_phase_seconds gauge\n");
+  for (const auto& [phase, time] : phases) {
+    absl::StrAppend(&text, "mjpc_planner_phase_seconds{phase=\"", phase,
+                    "\"} ", 1.0e-6 * time, "\n");
+  }
+
+  // buffer bytes in name order, if reported
+  if (metrics.memory_bytes_size() > 0) {
+    std::vector<std::pair<std::string, std::uint64_t>> buffers(
+        metrics.memory_bytes().begin(), metrics.memory_bytes().end());
+    std::sort(buffers.begin(), buffers.end());
+    absl::StrAppend(&text,
+                    "# HELP mjpc_memory_bytes Bytes of the agent's buffers.\n"
+                    "# TYPE mjpc_memory_bytes gauge\n");
+    for (const auto& [buffer, bytes] : buffers) {
+      absl::StrAppend(&text, "mjpc_memory_bytes{buffer=\"", buffer, "\"} ",
+                      bytes, "\n");
+    }
+    AppendMetric(&text, "mjpc_memory_total_bytes", "gauge",
+                 "Total bytes of the agent's buffers.",
+                 metrics.memory_total_bytes());
+  }
+
+  // performance counters by phase and thread
+  if (metrics.perf_counters_size() > 0) {
+    struct Counter {
+      const char* name;
+      const char* help;
+      std::uint64_t (*value)(const agent::PerfPhaseCounters&);
+    };
+    using Phase = agent::PerfPhaseCounters;
+    for (const Counter& counter :
+         {Counter{"mjpc_perf_cycles_total", "CPU cycles of a phase.",
+                  [](const Phase& p) -> std::uint64_t { return p.cycles(); }},
+          Counter{"mjpc_perf_instructions_total",
+                  "Instructions retired in a phase.",
+                  [](const Phase& p) -> std::uint64_t {
+                    return p.instructions();
+                  }},
+          Counter{"mjpc_perf_llc_misses_total",
+                  "Last-level cache misses of a phase.",
+                  [](const Phase& p) -> std::uint64_t {
+                    return p.llc_misses();
+                  }},
+          Counter{"mjpc_perf_branch_misses_total",
+                  "Mispredicted branches of a phase.",
+                  [](const Phase& p) -> std::uint64_t {
+                    return p.branch_misses();
+                  }}}) {
+      absl::StrAppend(&text, "# HELP ", counter.name, " ", counter.help,
+                      "\n# TYPE ", counter.name, " counter\n");
+      for (const agent::PerfPhaseCounters& phase : metrics.perf_counters()) {
+        absl::StrAppend(&text, counter.name, "{phase=\"", phase.phase(),
+                        "\",thread=\"", phase.thread_id(), "\"} ",
+                        counter.value(phase), "\n");
+      }
+    }
+  }
+  return text;
+}
+
+SceneEncoder::SceneEncoder(const agent::StreamSceneRequest& request)
+    : float32_(request.float32()),
+      keyframe_interval_(request.keyframe_interval() > 0
+                             ? request.keyframe_interval()
+                             : 60) {}
+
+void SceneEncoder::Encode(double time, int nq, int nmocap,
+                          const std::vector<double>& values,
+                          std::uint64_t trace_sequence,
+                          const std::vector<float>& trace, int num_trace,
+                          agent::SceneFrame* frame) {
+  bool key = sequence_ % keyframe_interval_ == 0 ||
+             values.size() != sent_.size();
+  frame->set_time(time);
+  frame->set_delta(!key);
+  if (key) {
+    sent_.assign(values.size(), 0.0);
+    frame->set_nq(nq);
+    frame->set_nmocap(nmocap);
+  }
+  int size = values.size();
+  for (int i = 0; i < size; i++) {
+    double value = values[i] - sent_[i];
+    if (float32_) {
+      float value_float = value;
+      frame->add_values_float(value_float);
+      sent_[i] += value_float;
+    } else {
+      frame->add_values(value);
+      sent_[i] += value;
+    }
+  }
+
+  // traces change once per planning iteration, less often than frames
+  if (trace_sequence != 0 && (key || trace_sequence != trace_sequence_)) {
+    frame->mutable_trace()->Add(trace.begin(), trace.end());
+    frame->set_num_trace(num_trace);
+    frame->set_trace_updated(true);
+    trace_sequence_ = trace_sequence;
+  }
+  frame->set_sequence(++sequence_);
+}
 }  // namespace grpc_agent_util
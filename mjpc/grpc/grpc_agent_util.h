@@ -15,12 +15,16 @@
 #ifndef MJPC_MJPC_GRPC_GRPC_AGENT_UTIL_H_
 #define MJPC_MJPC_GRPC_GRPC_AGENT_UTIL_H_
 
+#include <cstdint>
+#include <string>
 #include <string_view>
+#include <vector>
 #include <grpcpp/support/status.h>
 #include <mujoco/mujoco.h>
 
 #include "mjpc/grpc/agent.pb.h"
 #include "mjpc/agent.h"
+#include "mjpc/metrics.h"
 #include "mjpc/states/state.h"
 #include "mjpc/utilities.h"
 
@@ -56,6 +60,11 @@ grpc::Status GetAllModes(const agent::GetAllModesRequest* request,
 grpc::Status SetAnything(const agent::SetAnythingRequest* request,
                          mjpc::Agent* agent, const mjModel* model, mjData* data,
                          agent::SetAnythingResponse* response);
+// sets the inputs of a Control stream message: state, task parameters, cost
+// weights and mocap poses.
+grpc::Status SetControlInputs(const agent::ControlRequest* request,
+                              mjpc::Agent* agent, const mjModel* model,
+                              mjData* data);
 
 mjpc::UniqueMjModel LoadModelFromString(std::string_view xml, char* error,
                              int error_size);
@@ -64,6 +73,33 @@ mjpc::UniqueMjModel LoadModelFromBytes(std::string_view mjb);
 // set up the task and model on the agent so that the next call to
 // agent.LoadModel returns any custom model, or the relevant task model.
 grpc::Status InitAgent(mjpc::Agent* agent, const agent::InitRequest* request);
+
+void HistogramToProto(const mjpc::LatencyHistogram::Snapshot& histogram,
+                      agent::Histogram* proto);
+// metrics in the Prometheus text exposition format, names prefixed "mjpc_"
+std::string PrometheusText(const agent::GetMetricsResponse& metrics);
+
+// frames of a StreamScene stream. values are differences from the values the
+// client reconstructed from the previous frame, which include its rounding to
+// float, and full values in key frames and after a change of dimensions.
+class SceneEncoder {
+ public:
+  explicit SceneEncoder(const agent::StreamSceneRequest& request);
+
+  // scene state [qpos, mocap_pos, mocap_quat] of a model's dimensions, and
+  // the policy trace with its sequence number (0: none), sent when it changed
+  void Encode(double time, int nq, int nmocap,
+              const std::vector<double>& values, std::uint64_t trace_sequence,
+              const std::vector<float>& trace, int num_trace,
+              agent::SceneFrame* frame);
+
+ private:
+  bool float32_;
+  int keyframe_interval_;
+  std::vector<double> sent_;
+  std::uint64_t sequence_ = 0;
+  std::uint64_t trace_sequence_ = 0;
+};
 }  // namespace grpc_agent_util
 
 #endif  // MJPC_MJPC_GRPC_GRPC_AGENT_UTIL_H_
@@ -0,0 +1,194 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/grpc/rollout_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/log/log.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/grpc/rollout.grpc.pb.h"
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/grpc/rollout_util.h"
+#include "mjpc/planners/sampling/remote.h"
+
+namespace rollout_grpc {
+
+namespace {
+
+std::chrono::steady_clock::duration Seconds(double seconds) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(seconds));
+}
+
+// steady clock time point on the system clock, for gRPC deadlines
+std::chrono::system_clock::time_point SystemTime(
+    std::chrono::steady_clock::time_point time) {
+  return std::chrono::system_clock::now() +
+         std::chrono::duration_cast<std::chrono::system_clock::duration>(
+             time - std::chrono::steady_clock::now());
+}
+
+}  // namespace
+
+RolloutClient::RolloutClient(const RolloutClientOptions& options)
+    : options_(options) {
+  // workers run on other nodes of a trusted cluster network
+  for (const std::string& address : options_.addresses) {
+    stubs_.push_back(rollout::RolloutWorker::NewStub(
+        grpc::CreateChannel(address, grpc::InsecureChannelCredentials())));
+  }
+  active_.assign(stubs_.size(), false);
+  calls_.resize(stubs_.size());
+}
+
+RolloutClient::~RolloutClient() {
+  // cancel and drain outstanding calls before the queue is destroyed
+  for (Call& call : calls_) {
+    if (call.context) call.context->TryCancel();
+  }
+  while (pending_ > 0) {
+    void* tag;
+    bool ok;
+    if (!queue_.Next(&tag, &ok)) break;
+    pending_--;
+  }
+  queue_.Shutdown();
+  void* tag;
+  bool ok;
+  while (queue_.Next(&tag, &ok)) {
+  }
+}
+
+int RolloutClient::Init(const mjModel* model, std::string_view task_id) {
+  int size = mj_sizeModel(model);
+  std::string mjb(size, '\0');
+  mj_saveModel(model, nullptr, mjb.data(), size);
+
+  rollout::InitRequest request;
+  request.set_task_id(std::string(task_id));
+  request.set_mjb(std::move(mjb));
+  int num_active = 0;
+  for (int i = 0; i < static_cast<int>(stubs_.size()); i++) {
+    grpc::ClientContext context;
+    context.set_deadline(SystemTime(std::chrono::steady_clock::now() +
+                                    Seconds(options_.init_timeout)));
+    rollout::InitResponse response;
+    grpc::Status status = stubs_[i]->Init(&context, request, &response);
+    active_[i] = status.ok();
+    if (status.ok()) {
+      num_active++;
+    } else {
+      LOG(WARNING) << "Rollout worker " << options_.addresses[i]
+                   << " failed to initialize: " << status.error_message();
+    }
+  }
+  return num_active;
+}
+
+int RolloutClient::NumSamples() const {
+  int num_active = std::count(active_.begin(), active_.end(), true);
+  return num_active * options_.samples_per_worker;
+}
+
+void RolloutClient::Start(const mjpc::RemoteSampleBatch& batch,
+                          std::chrono::steady_clock::time_point deadline) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (deadline == std::chrono::steady_clock::time_point()) {
+    deadline = now + Seconds(options_.timeout);
+  }
+
+  // workers stop starting samples in time to respond by the deadline
+  double budget = std::chrono::duration<double>(deadline - now).count() -
+                  options_.response_margin;
+
+  ToRequest(batch, &request_);
+  request_.set_budget(std::max(budget, 1.0e-6));
+  begin_ = batch.begin;
+  end_ = batch.end;
+
+  int begin = batch.begin;
+  int num_workers = stubs_.size();
+  for (int i = 0; i < num_workers && begin < batch.end; i++) {
+    if (!active_[i]) continue;
+    int end = std::min(begin + options_.samples_per_worker, batch.end);
+    request_.set_begin(begin);
+    request_.set_end(end);
+
+    Call& call = calls_[i];
+    call.context = std::make_unique<grpc::ClientContext>();
+    call.context->set_deadline(SystemTime(deadline));
+    call.begin = begin;
+    call.reader = stubs_[i]->AsyncRollouts(call.context.get(), request_,
+                                           &queue_);
+    call.reader->Finish(&call.response, &call.status,
+                        reinterpret_cast<void*>(static_cast<intptr_t>(i)));
+    pending_++;
+    begin = end;
+  }
+}
+
+bool RolloutClient::Wait(mjpc::RemoteSampleResult* result) {
+  total_return_.assign(std::max(end_ - begin_, 0),
+                       std::numeric_limits<double>::infinity());
+  int best_call = -1;
+  double best_return = std::numeric_limits<double>::infinity();
+  bool evaluated = false;
+  while (pending_ > 0) {
+    void* tag;
+    bool ok;
+    if (!queue_.Next(&tag, &ok)) break;
+    pending_--;
+    int i = static_cast<int>(reinterpret_cast<intptr_t>(tag));
+    Call& call = calls_[i];
+    if (!ok || !call.status.ok()) continue;
+
+    // returns of the worker's range
+    const rollout::RolloutsResponse& response = call.response;
+    int offset = call.begin - begin_;
+    int n = std::min(response.total_return_size(),
+                     static_cast<int>(total_return_.size()) - offset);
+    std::copy_n(response.total_return().begin(), std::max(n, 0),
+                total_return_.begin() + offset);
+    evaluated = evaluated || n > 0;
+    if (response.best() >= 0 && response.best_return() < best_return) {
+      best_return = response.best_return();
+      best_call = i;
+    }
+  }
+
+  // the best worker's rollout and the merged returns
+  if (best_call >= 0) {
+    FromResponse(calls_[best_call].response, result);
+  } else {
+    result->best = -1;
+    result->best_return = std::numeric_limits<double>::infinity();
+  }
+  result->total_return.swap(total_return_);
+  return evaluated;
+}
+
+}  // namespace rollout_grpc
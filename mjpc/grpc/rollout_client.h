@@ -0,0 +1,97 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Remote rollouts of a sampling planner on `RolloutWorker` servers. Each
+// iteration's remote samples are split into contiguous ranges, one per
+// worker, and requested concurrently; workers that miss the deadline are
+// dropped from the iteration.
+
+#ifndef MJPC_MJPC_GRPC_ROLLOUT_CLIENT_H_
+#define MJPC_MJPC_GRPC_ROLLOUT_CLIENT_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <grpcpp/client_context.h>
+#include <grpcpp/completion_queue.h>
+#include <grpcpp/support/async_unary_call.h>
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/grpc/rollout.grpc.pb.h"
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/planners/sampling/remote.h"
+
+namespace rollout_grpc {
+
+struct RolloutClientOptions {
+  // worker addresses, e.g., "host:port"
+  std::vector<std::string> addresses;
+
+  // samples per worker and iteration
+  int samples_per_worker = 64;
+
+  // deadline of iterations without a planner deadline (seconds)
+  double timeout = 1.0;
+
+  // time reserved for the response after a worker's last sample (seconds)
+  double response_margin = 2.0e-3;
+
+  // deadline of loading the model on a worker (seconds)
+  double init_timeout = 30.0;
+};
+
+class RolloutClient final : public mjpc::RemoteRollouts {
+ public:
+  explicit RolloutClient(const RolloutClientOptions& options);
+  ~RolloutClient() override;
+
+  // load model and task on all workers. workers that fail are not used.
+  // returns the number of workers in use.
+  int Init(const mjModel* model, std::string_view task_id);
+
+  int NumSamples() const override;
+  void Start(const mjpc::RemoteSampleBatch& batch,
+             std::chrono::steady_clock::time_point deadline) override;
+  bool Wait(mjpc::RemoteSampleResult* result) override;
+
+ private:
+  // a worker's request of the current iteration
+  struct Call {
+    std::unique_ptr<grpc::ClientContext> context;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<rollout::RolloutsResponse>>
+        reader;
+    rollout::RolloutsResponse response;
+    grpc::Status status;
+    int begin = 0;
+  };
+
+  RolloutClientOptions options_;
+  std::vector<std::unique_ptr<rollout::RolloutWorker::Stub>> stubs_;
+  std::vector<bool> active_;  // workers that loaded the model
+  grpc::CompletionQueue queue_;
+  std::vector<Call> calls_;
+  rollout::RolloutsRequest request_;
+  std::vector<double> total_return_;  // merged returns of the iteration
+  int begin_ = 0;
+  int end_ = 0;
+  int pending_ = 0;
+};
+
+}  // namespace rollout_grpc
+
+#endif  // MJPC_MJPC_GRPC_ROLLOUT_CLIENT_H_
@@ -0,0 +1,75 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Serves remote rollouts of sampling planners, see rollout_client.h.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/log/log.h>
+#include <absl/strings/str_cat.h>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server_context.h>
+
+#include "mjpc/grpc/rollout_service.h"
+#include "mjpc/task.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
+
+ABSL_FLAG(int32_t, mjpc_port, 10001, "port to listen on");
+ABSL_FLAG(int32_t, mjpc_workers, -1,
+          "number of worker threads for rollouts. -1 means use the number of "
+          "available hardware threads.");
+ABSL_FLAG(std::string, mjpc_worker_cpus, "",
+          "CPUs the worker threads are pinned to, e.g., \"0-15,32-47\".");
+ABSL_FLAG(int32_t, mjpc_worker_numa_node, -1,
+          "If not -1, pin the worker threads to the CPUs of this NUMA node.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  int port = absl::GetFlag(FLAGS_mjpc_port);
+
+  // rollouts are not drawn
+  mjpc::SetTracesEnabled(false);
+
+  std::string server_address = absl::StrCat("[::]:", port);
+
+  // planners on other nodes of a trusted cluster network connect
+  std::shared_ptr<grpc::ServerCredentials> server_credentials =
+      grpc::InsecureServerCredentials();
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort(server_address, server_credentials);
+
+  mjpc::ThreadPoolAffinity affinity;
+  affinity.cpus = absl::GetFlag(FLAGS_mjpc_worker_cpus);
+  affinity.numa_node = absl::GetFlag(FLAGS_mjpc_worker_numa_node);
+  rollout_grpc::RolloutService service(mjpc::GetRegisteredTasks(),
+                                       absl::GetFlag(FLAGS_mjpc_workers),
+                                       affinity);
+  builder.SetMaxReceiveMessageSize(40 * 1024 * 1024);
+  builder.RegisterService(&service);
+
+  std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+  LOG(INFO) << "Server listening on " << server_address;
+
+  // Keep the program running until the server shuts down.
+  server->Wait();
+
+  return 0;
+}
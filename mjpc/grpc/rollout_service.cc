@@ -0,0 +1,154 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/grpc/rollout_service.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <absl/log/check.h>
+#include <absl/strings/str_format.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/grpc/rollout_util.h"
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/planners/sampling/remote.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+
+namespace rollout_grpc {
+
+namespace {
+
+// load a model saved by mj_saveModel, nullptr on failure
+mjpc::UniqueMjModel LoadModel(std::string_view mjb) {
+  static constexpr char file[] = "temporary-filename.mjb";
+  // mjVFS structs need to be allocated on the heap, because it's ~2MB
+  auto vfs = std::make_unique<mjVFS>();
+  mj_defaultVFS(vfs.get());
+  mj_makeEmptyFileVFS(vfs.get(), file, mjb.size());
+  int file_idx = mj_findFileVFS(vfs.get(), file);
+  memcpy(vfs->filedata[file_idx], mjb.data(), mjb.size());
+  mjpc::UniqueMjModel loaded = {mj_loadModel(file, vfs.get()), mj_deleteModel};
+  mj_deleteFileVFS(vfs.get(), file);
+  return loaded;
+}
+
+}  // namespace
+
+RolloutService::~RolloutService() { UnregisterModels(); }
+
+void RolloutService::UnregisterModels() {
+  if (model_) mjpc::UnregisterResidual(model_.get());
+  if (planner_) {
+    mjpc::UnregisterResidual(&planner_->coarse_model_);
+    for (mjModel& solver_model : planner_->solver_model_) {
+      mjpc::UnregisterResidual(&solver_model);
+    }
+  }
+}
+
+grpc::Status RolloutService::Init(grpc::ServerContext* context,
+                                  const rollout::InitRequest* request,
+                                  rollout::InitResponse* response) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  mjpc::UniqueMjModel loaded = LoadModel(request->mjb());
+  if (!loaded) {
+    return {grpc::StatusCode::INVALID_ARGUMENT, "Failed to load mjModel."};
+  }
+  std::shared_ptr<mjpc::Task> loaded_task;
+  for (const mjpc::RegisteredTask& registered : tasks_) {
+    if (registered.name == request->task_id()) loaded_task = registered.make();
+  }
+  if (!loaded_task) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrFormat("Invalid task_id: '%s'", request->task_id())};
+  }
+
+  UnregisterModels();
+  planner_ = std::make_unique<mjpc::SamplingPlanner>();
+  task_ = std::move(loaded_task);
+  model_ = std::move(loaded);
+  task_->Reset(model_.get());
+  planner_->Initialize(model_.get(), *task_);
+  planner_->Allocate();
+  planner_->Reset(mjpc::kMaxTrajectoryHorizon);
+
+  // task residuals of the planning models, dispatched by model
+  mjpc::RegisterTaskResidual(model_.get(), task_.get());
+  mjpc::RegisterTaskResidual(&planner_->coarse_model_, task_.get());
+  for (mjModel& solver_model : planner_->solver_model_) {
+    mjpc::RegisterTaskResidual(&solver_model, task_.get());
+  }
+  mjcb_sensor = mjpc::ResidualSensorCallback;
+  return grpc::Status::OK;
+}
+
+grpc::Status RolloutService::Rollouts(grpc::ServerContext* context,
+                                      const rollout::RolloutsRequest* request,
+                                      rollout::RolloutsResponse* response) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (!planner_) {
+    return {grpc::StatusCode::FAILED_PRECONDITION, "Init not called."};
+  }
+  FromRequest(*request, &batch_);
+
+  // the batch must match the loaded model and task
+  auto size = [](const std::vector<double>& v) {
+    return static_cast<int>(v.size());
+  };
+  int num_spline_points = batch_.num_spline_points;
+  if (size(batch_.state) != model_->nq + model_->nv + model_->na ||
+      size(batch_.mocap) != 7 * model_->nmocap ||
+      size(batch_.userdata) != model_->nuserdata ||
+      num_spline_points < mjpc::MinSamplingSplinePoints ||
+      num_spline_points > mjpc::kMaxTrajectoryHorizon ||
+      size(batch_.parameters) != num_spline_points * model_->nu ||
+      size(batch_.times) != num_spline_points ||
+      size(batch_.task_parameters) != size(task_->parameters) ||
+      size(batch_.weights) != size(task_->weight) || batch_.horizon < 1 ||
+      batch_.horizon > mjpc::kMaxTrajectoryHorizon || batch_.begin < 1 ||
+      batch_.end < batch_.begin) {
+    return {grpc::StatusCode::INVALID_ARGUMENT,
+            "Batch doesn't match the model and task."};
+  }
+
+  // task of the planner's iteration
+  task_->parameters = batch_.task_parameters;
+  task_->weight = batch_.weights;
+  task_->UpdateResidual();
+
+  // stop starting samples after the budget
+  double budget = request->budget();
+  planner_->SetDeadline(
+      budget > 0.0 ? std::chrono::steady_clock::now() +
+                         std::chrono::duration_cast<
+                             std::chrono::steady_clock::duration>(
+                             std::chrono::duration<double>(budget))
+                   : std::chrono::steady_clock::time_point());
+
+  planner_->EvaluateRemoteSamples(batch_, thread_pool_, &result_);
+  ToResponse(result_, response);
+  return grpc::Status::OK;
+}
+
+}  // namespace rollout_grpc
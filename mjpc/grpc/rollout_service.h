@@ -0,0 +1,76 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An implementation of the `RolloutWorker` gRPC service: evaluates samples of
+// a remote sampling planner.
+
+#ifndef MJPC_MJPC_GRPC_ROLLOUT_SERVICE_H_
+#define MJPC_MJPC_GRPC_ROLLOUT_SERVICE_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/grpc/rollout.grpc.pb.h"
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/planners/sampling/remote.h"
+#include "mjpc/task.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
+
+namespace rollout_grpc {
+
+class RolloutService final : public rollout::RolloutWorker::Service {
+ public:
+  explicit RolloutService(std::vector<mjpc::RegisteredTask> tasks,
+                          int num_workers = -1,
+                          const mjpc::ThreadPoolAffinity& affinity = {})
+      : tasks_(std::move(tasks)),
+        thread_pool_(num_workers == -1 ? mjpc::NumAvailableHardwareThreads()
+                                       : num_workers,
+                     affinity) {}
+  ~RolloutService();
+
+  grpc::Status Init(grpc::ServerContext* context,
+                    const rollout::InitRequest* request,
+                    rollout::InitResponse* response) override;
+
+  grpc::Status Rollouts(grpc::ServerContext* context,
+                        const rollout::RolloutsRequest* request,
+                        rollout::RolloutsResponse* response) override;
+
+ private:
+  // remove the residuals of the loaded planning models from the dispatch
+  void UnregisterModels();
+
+  std::vector<mjpc::RegisteredTask> tasks_;
+
+  // one batch at a time, on all workers of the pool
+  std::mutex mutex_;
+  mjpc::UniqueMjModel model_ = {nullptr, mj_deleteModel};
+  std::shared_ptr<mjpc::Task> task_;
+  std::unique_ptr<mjpc::SamplingPlanner> planner_;
+  mjpc::RemoteSampleBatch batch_;
+  mjpc::RemoteSampleResult result_;
+  mjpc::ThreadPool thread_pool_;
+};
+
+}  // namespace rollout_grpc
+
+#endif  // MJPC_MJPC_GRPC_ROLLOUT_SERVICE_H_
@@ -0,0 +1,126 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/grpc/rollout_util.h"
+
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/planners/sampling/remote.h"
+
+namespace rollout_grpc {
+
+namespace {
+
+using google::protobuf::RepeatedField;
+
+void Set(RepeatedField<double>* field, const std::vector<double>& values) {
+  field->Assign(values.begin(), values.end());
+}
+
+void Get(std::vector<double>* values, const RepeatedField<double>& field) {
+  values->assign(field.begin(), field.end());
+}
+
+}  // namespace
+
+void ToRequest(const mjpc::RemoteSampleBatch& batch,
+               rollout::RolloutsRequest* request) {
+  Set(request->mutable_state(), batch.state);
+  Set(request->mutable_mocap(), batch.mocap);
+  Set(request->mutable_userdata(), batch.userdata);
+  request->set_time(batch.time);
+  request->set_timestep(batch.timestep);
+  request->set_integrator(batch.integrator);
+  request->set_horizon(batch.horizon);
+  request->set_fine_steps(batch.fine_steps);
+  request->set_coarse_factor(batch.coarse_factor);
+  request->set_representation(batch.representation);
+  request->set_num_spline_points(batch.num_spline_points);
+  Set(request->mutable_parameters(), batch.parameters);
+  Set(request->mutable_times(), batch.times);
+  Set(request->mutable_task_parameters(), batch.task_parameters);
+  Set(request->mutable_weights(), batch.weights);
+  request->set_noise_exploration(batch.noise_exploration);
+  request->set_noise_correlation(batch.noise_correlation);
+  request->set_noise_sampling(batch.noise_sampling);
+  Set(request->mutable_synergies(), batch.synergies);
+  request->set_shared_prefix(batch.shared_prefix);
+  request->set_noise_seed(batch.noise_seed);
+  request->set_noise_iteration(batch.noise_iteration);
+  request->set_pruning(batch.pruning);
+  request->set_begin(batch.begin);
+  request->set_end(batch.end);
+}
+
+void FromRequest(const rollout::RolloutsRequest& request,
+                 mjpc::RemoteSampleBatch* batch) {
+  Get(&batch->state, request.state());
+  Get(&batch->mocap, request.mocap());
+  Get(&batch->userdata, request.userdata());
+  batch->time = request.time();
+  batch->timestep = request.timestep();
+  batch->integrator = request.integrator();
+  batch->horizon = request.horizon();
+  batch->fine_steps = request.fine_steps();
+  batch->coarse_factor = request.coarse_factor();
+  batch->representation = request.representation();
+  batch->num_spline_points = request.num_spline_points();
+  Get(&batch->parameters, request.parameters());
+  Get(&batch->times, request.times());
+  Get(&batch->task_parameters, request.task_parameters());
+  Get(&batch->weights, request.weights());
+  batch->noise_exploration = request.noise_exploration();
+  batch->noise_correlation = request.noise_correlation();
+  batch->noise_sampling = request.noise_sampling();
+  Get(&batch->synergies, request.synergies());
+  batch->shared_prefix = request.shared_prefix();
+  batch->noise_seed = request.noise_seed();
+  batch->noise_iteration = request.noise_iteration();
+  batch->pruning = request.pruning();
+  batch->begin = request.begin();
+  batch->end = request.end();
+}
+
+void ToResponse(const mjpc::RemoteSampleResult& result,
+                rollout::RolloutsResponse* response) {
+  Set(response->mutable_total_return(), result.total_return);
+  response->set_best(result.best);
+  response->set_best_return(result.best_return);
+  response->set_horizon(result.horizon);
+  Set(response->mutable_states(), result.states);
+  Set(response->mutable_actions(), result.actions);
+  Set(response->mutable_times(), result.times);
+  Set(response->mutable_residual(), result.residual);
+  Set(response->mutable_costs(), result.costs);
+  Set(response->mutable_trace(), result.trace);
+}
+
+void FromResponse(const rollout::RolloutsResponse& response,
+                  mjpc::RemoteSampleResult* result) {
+  Get(&result->total_return, response.total_return());
+  result->best = response.best();
+  result->best_return = response.best_return();
+  result->horizon = response.horizon();
+  Get(&result->states, response.states());
+  Get(&result->actions, response.actions());
+  Get(&result->times, response.times());
+  Get(&result->residual, response.residual());
+  Get(&result->costs, response.costs());
+  Get(&result->trace, response.trace());
+}
+
+}  // namespace rollout_grpc
@@ -0,0 +1,35 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_MJPC_GRPC_ROLLOUT_UTIL_H_
+#define MJPC_MJPC_GRPC_ROLLOUT_UTIL_H_
+
+#include "mjpc/grpc/rollout.pb.h"
+#include "mjpc/planners/sampling/remote.h"
+
+namespace rollout_grpc {
+
+// conversions between remote sample batches and results and their messages
+void ToRequest(const mjpc::RemoteSampleBatch& batch,
+               rollout::RolloutsRequest* request);
+void FromRequest(const rollout::RolloutsRequest& request,
+                 mjpc::RemoteSampleBatch* batch);
+void ToResponse(const mjpc::RemoteSampleResult& result,
+                rollout::RolloutsResponse* response);
+void FromResponse(const rollout::RolloutsResponse& response,
+                  mjpc::RemoteSampleResult* result);
+
+}  // namespace rollout_grpc
+
+#endif  // MJPC_MJPC_GRPC_ROLLOUT_UTIL_H_
@@ -0,0 +1,175 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/grpc/shared_memory.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <absl/strings/str_format.h>
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace mjpc::agent_grpc {
+
+namespace {
+// attempts to read a consistent state slot while the client writes it
+constexpr int kMaxReadAttempts = 10000;
+
+// state slot dimension
+int StateSize(const mjModel* model) {
+  return 1 + model->nq + model->nv + model->na + 3 * model->nmocap +
+         4 * model->nmocap + model->nuserdata;
+}
+}  // namespace
+
+grpc::Status SharedMemory::Create(const mjModel* model) {
+#if defined(_WIN32)
+  return {grpc::StatusCode::UNIMPLEMENTED,
+          "Shared memory is not supported on this platform."};
+#else
+  Close();
+
+  // unique name per server process and segment
+  static std::atomic<int> counter = 0;
+  std::string name = absl::StrFormat("mjpc_agent_%d_%d", getpid(), counter++);
+
+  // layout
+  state_size_ = StateSize(model);
+  std::size_t size = sizeof(SharedMemoryHeader) +
+                     sizeof(double) * (state_size_ + 1 + model->nu);
+
+  // segment
+  std::string path = "/" + name;
+  int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return {grpc::StatusCode::INTERNAL,
+            absl::StrFormat("Failed to create shared memory '%s'.", name)};
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(path.c_str());
+    return {grpc::StatusCode::INTERNAL,
+            absl::StrFormat("Failed to size shared memory '%s'.", name)};
+  }
+  void* memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(path.c_str());
+    return {grpc::StatusCode::INTERNAL,
+            absl::StrFormat("Failed to map shared memory '%s'.", name)};
+  }
+
+  // zero-filled by ftruncate
+  name_ = name;
+  size_ = size;
+  header_ = new (memory) SharedMemoryHeader();
+  header_->nq = model->nq;
+  header_->nv = model->nv;
+  header_->na = model->na;
+  header_->nmocap = model->nmocap;
+  header_->nuserdata = model->nuserdata;
+  header_->nu = model->nu;
+  state_ = reinterpret_cast<double*>(header_ + 1);
+  action_ = state_ + state_size_;
+  state_copy_.resize(state_size_);
+  return grpc::Status::OK;
+#endif
+}
+
+void SharedMemory::Close() {
+#if !defined(_WIN32)
+  if (!header_) return;
+  munmap(header_, size_);
+  shm_unlink(("/" + name_).c_str());
+  header_ = nullptr;
+  state_ = action_ = nullptr;
+  name_.clear();
+  size_ = 0;
+#endif
+}
+
+grpc::Status SharedMemory::ReadState(const mjModel* model, mjData* data) {
+  if (!header_) {
+    return {grpc::StatusCode::FAILED_PRECONDITION,
+            "Shared memory not requested in Init."};
+  }
+
+  // consistent copy of the state slot (sequence lock)
+  std::uint64_t fields = 0;
+  int attempt = 0;
+  for (; attempt < kMaxReadAttempts; attempt++) {
+    std::uint64_t sequence =
+        header_->state_sequence.load(std::memory_order_acquire);
+    if (sequence & 1) continue;
+    fields = header_->state_fields;
+    std::memcpy(state_copy_.data(), state_, sizeof(double) * state_size_);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->state_sequence.load(std::memory_order_relaxed) == sequence) {
+      break;
+    }
+  }
+  if (attempt == kMaxReadAttempts) {
+    return {grpc::StatusCode::UNAVAILABLE,
+            "Shared memory state is being written."};
+  }
+
+  // set fields
+  const double* state = state_copy_.data();
+  if (fields & kSharedTime) data->time = state[0];
+  state += 1;
+  if (fields & kSharedQpos) mju_copy(data->qpos, state, model->nq);
+  state += model->nq;
+  if (fields & kSharedQvel) mju_copy(data->qvel, state, model->nv);
+  state += model->nv;
+  if (fields & kSharedAct) mju_copy(data->act, state, model->na);
+  state += model->na;
+  if (fields & kSharedMocapPos) {
+    mju_copy(data->mocap_pos, state, 3 * model->nmocap);
+  }
+  state += 3 * model->nmocap;
+  if (fields & kSharedMocapQuat) {
+    mju_copy(data->mocap_quat, state, 4 * model->nmocap);
+  }
+  state += 4 * model->nmocap;
+  if (fields & kSharedUserdata) {
+    mju_copy(data->userdata, state, model->nuserdata);
+  }
+  return grpc::Status::OK;
+}
+
+void SharedMemory::WriteAction(const float* action, int nu, double time) {
+  if (!header_) return;
+  std::uint64_t sequence =
+      header_->action_sequence.load(std::memory_order_relaxed);
+  header_->action_sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  action_[0] = time;
+  for (int i = 0; i < nu; i++) {
+    action_[1 + i] = action[i];
+  }
+  header_->action_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+}  // namespace mjpc::agent_grpc
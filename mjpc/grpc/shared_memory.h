@@ -0,0 +1,97 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Shared-memory exchange of states and actions with a local client.
+
+#ifndef MJPC_MJPC_GRPC_SHARED_MEMORY_H_
+#define MJPC_MJPC_GRPC_SHARED_MEMORY_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <grpcpp/support/status.h>
+#include <mujoco/mujoco.h>
+
+namespace mjpc::agent_grpc {
+
+// state fields, bits of SharedMemoryHeader::state_fields
+enum SharedStateField : std::uint64_t {
+  kSharedTime = 1 << 0,
+  kSharedQpos = 1 << 1,
+  kSharedQvel = 1 << 2,
+  kSharedAct = 1 << 3,
+  kSharedMocapPos = 1 << 4,
+  kSharedMocapQuat = 1 << 5,
+  kSharedUserdata = 1 << 6,
+};
+
+// segment header (64 bytes), followed by the state slot
+// [time, qpos, qvel, act, mocap_pos, mocap_quat, userdata] and the action
+// slot [time, ctrl] as doubles. each slot is guarded by a sequence counter
+// that is odd while its writer (client: state, server: action) updates it.
+struct SharedMemoryHeader {
+  std::atomic<std::uint64_t> state_sequence;
+  std::atomic<std::uint64_t> action_sequence;
+  std::uint64_t state_fields;  // fields set by the last state write
+  std::int32_t nq, nv, na, nmocap, nuserdata, nu;  // slot dimensions
+  std::uint64_t reserved[2];
+};
+static_assert(sizeof(SharedMemoryHeader) == 64);
+
+// POSIX shared-memory segment owned by the server
+class SharedMemory {
+ public:
+  SharedMemory() = default;
+  ~SharedMemory() { Close(); }
+
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+
+  // create a segment for the model's state and action
+  grpc::Status Create(const mjModel* model);
+
+  // unmap and unlink segment
+  void Close();
+
+  // segment is open
+  bool IsOpen() const { return header_ != nullptr; }
+
+  // segment name, without the leading slash
+  const std::string& Name() const { return name_; }
+
+  // segment size (bytes)
+  std::size_t Size() const { return size_; }
+
+  // set the fields the client wrote in the state slot on data
+  grpc::Status ReadState(const mjModel* model, mjData* data);
+
+  // write action slot
+  void WriteAction(const float* action, int nu, double time);
+
+ private:
+  std::string name_;
+  std::size_t size_ = 0;
+  SharedMemoryHeader* header_ = nullptr;
+  double* state_ = nullptr;   // state slot
+  double* action_ = nullptr;  // action slot
+  int state_size_ = 0;
+  std::vector<double> state_copy_;  // consistent copy of state slot
+};
+
+}  // namespace mjpc::agent_grpc
+
+#endif  // MJPC_MJPC_GRPC_SHARED_MEMORY_H_
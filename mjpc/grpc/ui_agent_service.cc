@@ -14,14 +14,18 @@
 
 #include "mjpc/grpc/ui_agent_service.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <string_view>
 #include <vector>
 
 #include <absl/synchronization/notification.h>
+#include <absl/time/clock.h>
 #include <absl/time/time.h>
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
+#include <grpcpp/support/sync_stream.h>
 #include <mujoco/mjmodel.h>
 #include <mujoco/mjui.h>
 #include <mujoco/mujoco.h>
@@ -49,6 +53,7 @@ using ::agent::PlannerStepRequest;
 using ::agent::PlannerStepResponse;
 using ::agent::ResetRequest;
 using ::agent::ResetResponse;
+using ::agent::SceneFrame;
 using ::agent::SetAnythingRequest;
 using ::agent::SetAnythingResponse;
 using ::agent::SetCostWeightsRequest;
@@ -61,6 +66,7 @@ using ::agent::SetTaskParametersRequest;
 using ::agent::SetTaskParametersResponse;
 using ::agent::StepRequest;
 using ::agent::StepResponse;
+using ::agent::StreamSceneRequest;
 using ::mjpc::UniqueMjModel;
 
 grpc::Status UiAgentService::Init(grpc::ServerContext* context,
@@ -141,7 +147,12 @@ grpc::Status UiAgentService::PlannerStep(grpc::ServerContext* context,
                                          PlannerStepResponse* response) {
   // in this setup, the planner is async so this RPC doesn't need to do a
   // planning step. instead, enable the planner if it's not on already.
+  if (request->has_planning_budget()) {
+    sim_->agent->SetPlanningBudget(request->planning_budget());
+  }
   sim_->agent->plan_enabled = true;
+  response->set_deadline_missed(sim_->agent->DeadlineMissed());
+  response->set_deadline_misses(sim_->agent->DeadlineMisses());
   return grpc::Status::OK;
 }
 
@@ -218,6 +229,57 @@ grpc::Status UiAgentService::SetAnything(grpc::ServerContext* context,
   });
 }
 
+grpc::Status UiAgentService::StreamScene(
+    grpc::ServerContext* context, const StreamSceneRequest* request,
+    grpc::ServerWriter<SceneFrame>* writer) {
+  absl::Duration period =
+      absl::Seconds(1.0 / (request->rate() > 0 ? request->rate() : 30.0));
+  if (request->compress()) {
+    context->set_compression_algorithm(GRPC_COMPRESS_GZIP);
+  }
+  if (request->traces()) sim_->agent->AddTraceStream();
+
+  grpc_agent_util::SceneEncoder encoder(*request);
+  std::vector<double> values;
+  std::vector<float> trace;
+  int num_trace = 0;
+  double time = 0.0;
+  int nq = 0, nmocap = 0;
+  grpc::Status status = grpc::Status::OK;
+  absl::Time next_frame = absl::Now();
+  while (!context->IsCancelled()) {
+    // scene state: [qpos, mocap_pos, mocap_quat]
+    status = RunBeforeStep(
+        context, [&](mjpc::Agent* agent, const mjModel* model, mjData* data) {
+          nq = model->nq;
+          nmocap = model->nmocap;
+          time = data->time;
+          values.assign(data->qpos, data->qpos + model->nq);
+          values.insert(values.end(), data->mocap_pos,
+                        data->mocap_pos + 3 * model->nmocap);
+          values.insert(values.end(), data->mocap_quat,
+                        data->mocap_quat + 4 * model->nmocap);
+          return grpc::Status::OK;
+        });
+    if (!status.ok()) break;
+
+    // encode and write, the trace is published by the planning thread
+    std::uint64_t trace_sequence =
+        request->traces() ? sim_->agent->StreamedTrace(&trace, &num_trace) : 0;
+    SceneFrame frame;
+    encoder.Encode(time, nq, nmocap, values, trace_sequence, trace, num_trace,
+                   &frame);
+    if (!writer->Write(frame)) break;
+
+    // next frame at the rate, without catching up with late frames
+    next_frame = std::max(next_frame + period, absl::Now());
+    absl::SleepFor(next_frame - absl::Now());
+  }
+
+  if (request->traces()) sim_->agent->RemoveTraceStream();
+  return status;
+}
+
 namespace {
 bool WaitUntilDeadline(const absl::Notification& notification,
                        const grpc::ServerContext* context) {
@@ -17,6 +17,7 @@
 
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
+#include <grpcpp/support/sync_stream.h>
 #include <mujoco/mujoco.h>
 
 #include <mjpc/grpc/agent.grpc.pb.h>
@@ -94,6 +95,12 @@ class UiAgentService final : public agent::Agent::Service {
                            const agent::SetAnythingRequest* request,
                            agent::SetAnythingResponse* response) override;
 
+  // streams scene frames until the client cancels. the state is copied on the
+  // physics thread, frames are encoded and written on the RPC's thread.
+  grpc::Status StreamScene(
+      grpc::ServerContext* context, const agent::StreamSceneRequest* request,
+      grpc::ServerWriter<agent::SceneFrame>* writer) override;
+
  private:
   using StatusStepJob =
       absl::AnyInvocable<grpc::Status(mjpc::Agent*, const mjModel*, mjData*)>;
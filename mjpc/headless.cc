@@ -0,0 +1,265 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/headless.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/agent.h"
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/states/measurement.h"
+#include "mjpc/task.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+// agent evaluated by the sensor callback
+Agent* headless_agent = nullptr;
+
+void ResidualCallback(const mjModel* model, mjData* data, int stage) {
+  if (stage != mjSTAGE_ACC || headless_agent->allocate_enabled ||
+      ResidualSkipped()) {
+    return;
+  }
+  // the planning and rollout threads use the snapshot of the task, see
+  // residual_dispatch.h for the agent's registered models
+  if (!DispatchResidual(model, data)) headless_agent->Residual(model, data);
+}
+
+// sleep until an absolute time. on Linux, clock_nanosleep with an absolute
+// CLOCK_MONOTONIC deadline (the steady clock) avoids accumulating the error
+// of relative sleeps.
+void SleepUntil(std::chrono::steady_clock::time_point time) {
+#if defined(__linux__)
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                time.time_since_epoch())
+                .count();
+  timespec deadline;
+  deadline.tv_sec = ns / 1000000000;
+  deadline.tv_nsec = ns % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                         nullptr) == EINTR) {
+  }
+#else
+  std::this_thread::sleep_until(time);
+#endif
+}
+
+// physics steps published to the estimator thread
+struct Publication {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::uint64_t step = 0;  // (guarded by mutex)
+};
+
+// update the estimator with each published measurement and set the agent
+// state from its estimate, until exit is set
+int EstimatorLoop(Agent& agent, const mjModel* model,
+                  MeasurementBuffer& measurements, Publication& publication,
+                  const std::atomic<bool>& exit) {
+  int updates = 0;
+  std::uint64_t last_step = 0;
+  Estimator& estimator = agent.ActiveEstimator();
+  while (!exit.load()) {
+    {
+      std::unique_lock<std::mutex> lock(publication.mutex);
+      publication.cv.wait_for(lock, std::chrono::milliseconds(10), [&]() {
+        return publication.step != last_step || exit.load();
+      });
+      if (publication.step == last_step) continue;
+      last_step = publication.step;
+    }
+    const Measurement* measurement = measurements.Latest();
+    if (!measurement) continue;
+
+    // measurement to estimator
+    mju_copy(agent.ctrl.data(), measurement->ctrl.data(), model->nu);
+    mju_copy(agent.sensor.data(), measurement->sensor.data(),
+             model->nsensordata);
+    mjData* estimator_data = estimator.Data();
+    estimator_data->time = measurement->time;
+    mju_copy(estimator_data->mocap_pos, measurement->mocap_pos.data(),
+             3 * model->nmocap);
+    mju_copy(estimator_data->mocap_quat, measurement->mocap_quat.data(),
+             4 * model->nmocap);
+    mju_copy(estimator_data->userdata, measurement->userdata.data(),
+             model->nuserdata);
+    estimator.Update(agent.ctrl.data(), agent.sensor.data());
+    updates++;
+
+    // estimator state to planner
+    double* state = estimator.State();
+    agent.state.Set(model, state, state + model->nq,
+                    state + model->nq + model->nv,
+                    measurement->mocap_pos.data(),
+                    measurement->mocap_quat.data(),
+                    measurement->userdata.data(), measurement->time);
+  }
+  return updates;
+}
+}  // namespace
+
+int RunHeadless(const HeadlessOptions& options, HeadlessResult* result) {
+  Agent agent;
+  agent.SetTaskList(GetRegisteredTasks());
+  int task_id = agent.GetTaskIdByName(options.task_name);
+  if (task_id == -1) {
+    std::cerr << "Invalid task: '" << options.task_name
+              << "'. Valid values:\n";
+    std::cerr << agent.GetTaskNames();
+    return -1;
+  }
+  agent.gui_task_id = task_id;
+  auto load_model = agent.LoadModel();
+  mjModel* model = load_model.model.release();
+  if (!model) {
+    std::cerr << load_model.error << "\n";
+    return 1;
+  }
+  mjData* data = mj_makeData(model);
+  int home_id = mj_name2id(model, mjOBJ_KEY, "home");
+  if (home_id >= 0) mj_resetDataKeyframe(model, data, home_id);
+  mj_forward(model, data);
+
+  agent.estimator_enabled = options.estimator_enabled;
+  SetTracesEnabled(false);  // rollouts are not drawn
+  agent.Initialize(model);
+  agent.Allocate();
+  agent.Reset(data->ctrl);
+  agent.state.Set(model, data);
+  agent.plan_enabled = true;
+  bool estimating =
+      options.estimator_enabled && agent.ActiveEstimatorIndex() != 0;
+  if (options.estimator_enabled && !estimating && options.verbose) {
+    std::cout << "No estimator set in the model, using the simulation state\n";
+  }
+
+  headless_agent = &agent;
+  mjcb_sensor = ResidualCallback;
+
+  // planning: Agent::Plan on a dedicated thread with its own pool
+  ThreadPool planner_pool(options.planner_threads);
+  ThreadPool estimator_pool(options.estimator_threads);
+  agent.SetEstimatorThreadPool(&estimator_pool);
+  std::atomic<bool> exit_request = false;
+  std::atomic<int> load_request = 0;
+  std::thread plan_thread(
+      [&]() { agent.Plan(exit_request, load_request, &planner_pool); });
+
+  // estimation: on a dedicated thread, fed by the physics loop
+  MeasurementBuffer measurements;
+  Publication publication;
+  int estimator_updates = 0;
+  std::thread estimator_thread;
+  if (estimating) {
+    measurements.Allocate(model);
+    estimator_thread = std::thread([&]() {
+      estimator_updates = EstimatorLoop(agent, model, measurements,
+                                        publication, exit_request);
+    });
+  }
+
+  // physics
+  std::int64_t total_steps = std::ceil(options.total_time /
+                                       model->opt.timestep);
+  bool paced = options.real_time_factor > 0.0;
+  auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Seconds(model->opt.timestep / std::max(options.real_time_factor, 1e-9)));
+  std::int64_t late_steps = 0;
+  double max_lateness = 0.0;
+  double total_cost = 0.0;
+  int report_time = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::int64_t i = 0; i < total_steps; i++) {
+    if (paced) {
+      auto deadline = start + i * period;
+      auto now = std::chrono::steady_clock::now();
+      if (now < deadline) {
+        SleepUntil(deadline);
+      } else {
+        if (now - deadline > period) late_steps++;
+        max_lateness = std::max(max_lateness, Seconds(now - deadline).count());
+      }
+    }
+
+    agent.ActiveTask()->Transition(model, data);
+    if (!estimating) agent.state.Set(model, data);
+    agent.ActivePlanner().ActionFromPolicy(data->ctrl,
+                                           agent.state.state().data(),
+                                           agent.state.time());
+    mj_step(model, data);
+    double cost = agent.ActiveTask()->CostValue(data->sensordata);
+    total_cost += cost;
+
+    // new ctrl and sensordata for the estimator
+    if (estimating) {
+      measurements.Publish(model, data);
+      {
+        std::lock_guard<std::mutex> lock(publication.mutex);
+        publication.step++;
+      }
+      publication.cv.notify_one();
+    }
+
+    if (options.verbose && std::floor(data->time) > report_time) {
+      report_time++;
+      std::cout << "sim time: " << report_time << ", cost: " << cost
+                << ", planning iterations: " << agent.PlanLatency().Read().count
+                << "\n";
+    }
+  }
+  double wall_time = Seconds(std::chrono::steady_clock::now() - start).count();
+
+  exit_request = true;
+  plan_thread.join();
+  if (estimator_thread.joinable()) estimator_thread.join();
+  mjcb_sensor = nullptr;
+  headless_agent = nullptr;
+
+  if (result) {
+    result->wall_time = wall_time;
+    result->steps = total_steps;
+    result->planning_iterations = agent.PlanLatency().Read().count;
+    result->estimator_updates = estimator_updates;
+    result->average_cost = total_steps ? total_cost / total_steps : 0.0;
+    result->late_steps = late_steps;
+    result->max_lateness = max_lateness;
+  }
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  return 0;
+}
+
+}  // namespace mjpc
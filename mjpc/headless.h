@@ -0,0 +1,61 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Headless simulation: physics on the calling thread, the agent planning
+// asynchronously (Agent::Plan) on its own pool and, optionally, the estimator
+// in its own thread and pool, as in the app but without rendering.
+
+#ifndef MJPC_HEADLESS_H_
+#define MJPC_HEADLESS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace mjpc {
+
+struct HeadlessOptions {
+  std::string task_name;
+  double total_time = 10.0;  // simulation time (seconds)
+
+  // simulation seconds per wall-clock second. physics steps are paced at
+  // absolute deadlines. zero or negative: step as fast as possible.
+  double real_time_factor = 1.0;
+
+  int planner_threads = 1;
+  bool estimator_enabled = false;  // run the model's estimator, if any
+  int estimator_threads = 1;
+
+  bool verbose = true;  // print progress once per simulation second
+};
+
+struct HeadlessResult {
+  double wall_time = 0.0;  // seconds
+  std::int64_t steps = 0;
+  int planning_iterations = 0;
+  int estimator_updates = 0;
+  double average_cost = 0.0;
+
+  // paced runs: steps started more than one step period after their
+  // deadline, and the largest delay (seconds)
+  std::int64_t late_steps = 0;
+  double max_lateness = 0.0;
+};
+
+// simulate the task with asynchronous planning for options.total_time.
+// returns 0 on success.
+int RunHeadless(const HeadlessOptions& options, HeadlessResult* result);
+
+}  // namespace mjpc
+
+#endif  // MJPC_HEADLESS_H_
@@ -0,0 +1,64 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+
+#include "mjpc/headless.h"
+#include "mjpc/utilities.h"
+
+ABSL_FLAG(std::string, task, "Cartpole", "Which model to load on startup.");
+ABSL_FLAG(double, total_time, 10, "Total time to simulate (seconds).");
+ABSL_FLAG(double, real_time_factor, 1.0,
+          "Simulation seconds per wall-clock second. Zero steps physics as "
+          "fast as possible.");
+ABSL_FLAG(int, planner_threads, mjpc::NumAvailableHardwareThreads() - 3,
+          "Number of planner threads to use.");
+ABSL_FLAG(bool, estimator_enabled, false,
+          "If true, run the model's estimator and plan from its estimate.");
+ABSL_FLAG(int, estimator_threads, 1, "Number of estimator threads to use.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  mjpc::HeadlessOptions options;
+  options.task_name = absl::GetFlag(FLAGS_task);
+  options.total_time = absl::GetFlag(FLAGS_total_time);
+  options.real_time_factor = absl::GetFlag(FLAGS_real_time_factor);
+  options.planner_threads = std::max(absl::GetFlag(FLAGS_planner_threads), 1);
+  options.estimator_enabled = absl::GetFlag(FLAGS_estimator_enabled);
+  options.estimator_threads =
+      std::max(absl::GetFlag(FLAGS_estimator_threads), 1);
+
+  mjpc::HeadlessResult result;
+  if (int status = mjpc::RunHeadless(options, &result)) return status;
+
+  std::cout << "Wall time: " << result.wall_time << " s ("
+            << options.total_time / result.wall_time << "x realtime)\n"
+            << "Physics steps: " << result.steps << "\n"
+            << "Planning iterations: " << result.planning_iterations << "\n";
+  if (options.estimator_enabled) {
+    std::cout << "Estimator updates: " << result.estimator_updates << "\n";
+  }
+  if (options.real_time_factor > 0.0) {
+    std::cout << "Late steps: " << result.late_steps << " (max "
+              << 1.0e3 * result.max_lateness << " ms behind)\n";
+  }
+  std::cout << "Average cost per step (lower is better): "
+            << result.average_cost << "\n";
+  return 0;
+}
@@ -52,12 +52,7 @@ void AgentRunner::Step(mjData* data) {
 }
 
 void AgentRunner::Residual(const mjModel* model, mjData* data) {
-  if (agent_.IsPlanningModel(model)) {
-    const mjpc::ResidualFn* residual = agent_.PlanningResidual();
-    residual->Residual(model, data, data->sensordata);
-  } else {
-    agent_.ActiveTask()->Residual(model, data, data->sensordata);
-  }
+  agent_.Residual(model, data);
 }
 }  // namespace mjpc
 
@@ -68,7 +63,7 @@ std::shared_ptr<mjpc::Task> task_;
 // not exposed to Unity, "extern C" is for MuJoco's callback assignment:
 extern "C" void residual_sensor_callback(const mjModel* model, mjData* data,
                                           int stage) {
-  if (stage == mjSTAGE_ACC) {
+  if (stage == mjSTAGE_ACC && !mjpc::ResidualSkipped()) {
     runner->Residual(model, data);
   }
 }
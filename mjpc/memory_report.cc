@@ -0,0 +1,73 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/memory_report.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+void MemoryReport::Add(std::string_view name, std::size_t bytes) {
+  for (Entry& entry : entries_) {
+    if (entry.name == name) {
+      entry.bytes += bytes;
+      return;
+    }
+  }
+  entries_.push_back({std::string(name), bytes});
+}
+
+void MemoryReport::Add(std::string_view name, const MemoryReport& report) {
+  for (const Entry& entry : report.entries_) {
+    Add(absl::StrCat(name, "/", entry.name), entry.bytes);
+  }
+}
+
+std::size_t MemoryReport::Total() const {
+  std::size_t total = 0;
+  for (const Entry& entry : entries_) total += entry.bytes;
+  return total;
+}
+
+std::string MemoryReport::ToString() const {
+  std::vector<Entry> entries = entries_;
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const Entry& a, const Entry& b) {
+                     return a.bytes > b.bytes;
+                   });
+  std::string text;
+  for (const Entry& entry : entries) {
+    absl::StrAppendFormat(&text, "%-48s %12d\n", entry.name, entry.bytes);
+  }
+  absl::StrAppendFormat(&text, "%-48s %12d\n", "total", Total());
+  return text;
+}
+
+std::size_t MjDataBytes(const mjData* data) {
+  return data ? data->nbuffer + data->narena : 0;
+}
+
+std::size_t MjModelBytes(const mjModel* model) {
+  return model ? model->nbuffer : 0;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,77 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Allocated bytes of the buffers of agents, planners and estimators, for
+// sizing deployments. Components add their buffers by name; reports of
+// components are nested into their owner's report, with names joined by '/',
+// e.g., "planner/Sampling/trajectories".
+
+#ifndef MJPC_MEMORY_REPORT_H_
+#define MJPC_MEMORY_REPORT_H_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+class MemoryReport {
+ public:
+  struct Entry {
+    std::string name;
+    std::size_t bytes = 0;
+  };
+
+  // add the bytes of buffer name, adding to an entry of the same name
+  void Add(std::string_view name, std::size_t bytes);
+
+  // add the capacity of a vector
+  template <typename T>
+  void Add(std::string_view name, const std::vector<T>& buffer) {
+    Add(name, buffer.capacity() * sizeof(T));
+  }
+
+  // add the entries of report under name
+  void Add(std::string_view name, const MemoryReport& report);
+
+  const std::vector<Entry>& Entries() const { return entries_; }
+
+  // bytes of all entries
+  std::size_t Total() const;
+
+  // one "name bytes" line per entry, largest first, then the total
+  std::string ToString() const;
+
+ private:
+  std::vector<Entry> entries_;
+};
+
+// bytes of the capacities of buffers
+template <typename... T>
+std::size_t VectorBytes(const std::vector<T>&... buffers) {
+  return (std::size_t{0} + ... + (buffers.capacity() * sizeof(T)));
+}
+
+// bytes of the buffer and arena of data
+std::size_t MjDataBytes(const mjData* data);
+
+// bytes of the buffer of model
+std::size_t MjModelBytes(const mjModel* model);
+
+}  // namespace mjpc
+
+#endif  // MJPC_MEMORY_REPORT_H_
@@ -0,0 +1,72 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+void LatencyHistogram::Record(double seconds) {
+  int bucket = 0;
+  while (bucket < kNumBounds && seconds > UpperBound(bucket)) bucket++;
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  IncrementAtomic(sum_, seconds);
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& count : counts_) count = 0;
+  sum_ = 0.0;
+}
+
+double LatencyHistogram::UpperBound(int i) const {
+  return std::ldexp(smallest_bound_, i);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Read() const {
+  Snapshot snapshot;
+  snapshot.upper_bounds.resize(kNumBounds);
+  for (int i = 0; i < kNumBounds; i++) snapshot.upper_bounds[i] = UpperBound(i);
+  snapshot.counts.resize(kNumBuckets);
+  for (int i = 0; i < kNumBuckets; i++) {
+    snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.counts[i];
+  }
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+double LatencyHistogram::Snapshot::Quantile(double q) const {
+  if (count == 0) return 0.0;
+  double rank = std::clamp(q, 0.0, 1.0) * count;
+  std::uint64_t below = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    if (counts[i] == 0 || below + counts[i] < rank) {
+      below += counts[i];
+      continue;
+    }
+    // overflow bucket: report its lower bound
+    if (i == kNumBounds) return upper_bounds.back();
+    double lower = i == 0 ? 0.0 : upper_bounds[i - 1];
+    double fraction = (rank - below) / counts[i];
+    return lower + fraction * (upper_bounds[i] - lower);
+  }
+  return upper_bounds.back();
+}
+
+}  // namespace mjpc
@@ -0,0 +1,70 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_METRICS_H_
+#define MJPC_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace mjpc {
+
+// histogram of latencies (seconds), safe to record from any thread.
+// bucket i counts latencies in (UpperBound(i - 1), UpperBound(i)], the last
+// bucket counts latencies above all bounds.
+class LatencyHistogram {
+ public:
+  // bucket upper bounds: smallest_bound * 2^i, by default 100 us to ~6.6 s
+  static constexpr int kNumBounds = 17;
+  static constexpr int kNumBuckets = kNumBounds + 1;
+  static constexpr double kSmallestBound = 1.0e-4;
+
+  explicit LatencyHistogram(double smallest_bound = kSmallestBound)
+      : smallest_bound_(smallest_bound) {
+    Reset();
+  }
+
+  // add a latency
+  void Record(double seconds);
+
+  // remove all latencies
+  void Reset();
+
+  // upper bound of bucket i < kNumBounds
+  double UpperBound(int i) const;
+
+  // point-in-time copy
+  struct Snapshot {
+    std::vector<double> upper_bounds;  // kNumBounds
+    std::vector<std::uint64_t> counts;  // kNumBuckets, not cumulative
+    std::uint64_t count = 0;
+    double sum = 0.0;
+
+    // latency below which a fraction q of the latencies lie, interpolated
+    // within the bucket. 0 if empty.
+    double Quantile(double q) const;
+  };
+  Snapshot Read() const;
+
+ private:
+  double smallest_bound_;
+  std::array<std::atomic<std::uint64_t>, kNumBuckets> counts_;
+  std::atomic<double> sum_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_METRICS_H_
@@ -0,0 +1,168 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/model_cache.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <mujoco/mujoco.h>
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+namespace {
+namespace fs = std::filesystem;
+
+// 64-bit FNV-1a, stable across runs and platforms
+class Fnv1a {
+ public:
+  void Add(std::string_view bytes) {
+    for (unsigned char c : bytes) {
+      hash_ = (hash_ ^ c) * 0x100000001b3;
+    }
+  }
+  std::uint64_t Hash() const { return hash_; }
+
+ private:
+  std::uint64_t hash_ = 0xcbf29ce484222325;
+};
+
+// contents of path, false if it can't be read
+bool ReadFile(const fs::path& path, std::string* contents) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  contents->assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+  return static_cast<bool>(file) || file.eof();
+}
+
+// values of attribute name="..." in xml
+std::vector<std::string> AttributeValues(std::string_view xml,
+                                         std::string_view name) {
+  std::vector<std::string> values;
+  std::string pattern = std::string(name) + "=\"";
+  for (std::size_t pos = xml.find(pattern); pos != std::string_view::npos;
+       pos = xml.find(pattern, pos + 1)) {
+    // whole attribute names only, e.g., not "profile"
+    if (pos > 0 && !std::isspace(static_cast<unsigned char>(xml[pos - 1]))) {
+      continue;
+    }
+    std::size_t begin = pos + pattern.size();
+    std::size_t end = xml.find('"', begin);
+    if (end == std::string_view::npos) break;
+    values.emplace_back(xml.substr(begin, end - begin));
+  }
+  return values;
+}
+
+// adds path and contents of xml_path and every file it references
+void HashReferences(const fs::path& xml_path, const fs::path& model_dir,
+                    std::vector<fs::path>* asset_dirs,
+                    std::set<fs::path>* visited, Fnv1a* hash) {
+  std::string xml;
+  if (!visited->insert(xml_path).second || !ReadFile(xml_path, &xml)) return;
+
+  for (const char* dir_name : {"meshdir", "texturedir", "assetdir"}) {
+    for (const std::string& dir : AttributeValues(xml, dir_name)) {
+      asset_dirs->push_back(model_dir / dir);
+    }
+  }
+
+  for (const std::string& file : AttributeValues(xml, "file")) {
+    std::vector<fs::path> candidates = {xml_path.parent_path() / file,
+                                        model_dir / file};
+    for (const fs::path& dir : *asset_dirs) candidates.push_back(dir / file);
+    for (const fs::path& candidate : candidates) {
+      std::error_code ec;
+      if (!fs::is_regular_file(candidate, ec)) continue;
+      fs::path normal = candidate.lexically_normal();
+      if (normal.extension() == ".xml") {
+        HashReferences(normal, model_dir, asset_dirs, visited, hash);
+      } else if (visited->insert(normal).second) {
+        std::string contents;
+        ReadFile(normal, &contents);
+        hash->Add(normal.lexically_relative(model_dir).generic_string());
+        hash->Add(contents);
+      }
+    }
+  }
+
+  hash->Add(xml_path.lexically_relative(model_dir).generic_string());
+  hash->Add(xml);
+}
+}  // namespace
+
+std::string ModelCacheDir() {
+  if (const char* dir = std::getenv("MJPC_MODEL_CACHE_DIR")) return dir;
+  return GetModelPath("../model_cache");
+}
+
+std::string ModelCacheKey(const std::string& xml_path) {
+  fs::path path = fs::path(xml_path).lexically_normal();
+  std::error_code ec;
+  if (!fs::is_regular_file(path, ec)) return "";
+
+  Fnv1a hash;
+  hash.Add(mj_versionString());
+  std::vector<fs::path> asset_dirs;
+  std::set<fs::path> visited;
+  HashReferences(path, path.parent_path(), &asset_dirs, &visited, &hash);
+  return absl::StrFormat("%016x", hash.Hash());
+}
+
+mjModel* LoadCachedModel(const std::string& xml_path, char* error,
+                         int error_sz) {
+  std::string dir = ModelCacheDir();
+  std::string key = dir.empty() ? "" : ModelCacheKey(xml_path);
+  if (key.empty()) {
+    return mj_loadXML(xml_path.c_str(), nullptr, error, error_sz);
+  }
+
+  // cached model
+  fs::path cached = fs::path(dir) /
+      absl::StrCat(fs::path(xml_path).stem().string(), "-", key, ".mjb");
+  std::error_code ec;
+  if (fs::is_regular_file(cached, ec)) {
+    if (mjModel* model = mj_loadModel(cached.string().c_str(), nullptr)) {
+      return model;
+    }
+  }
+
+  // compile and store. the model is written to a unique file and renamed, so
+  // concurrent loads never read a partial model.
+  mjModel* model = mj_loadXML(xml_path.c_str(), nullptr, error, error_sz);
+  if (!model) return nullptr;
+  fs::create_directories(dir, ec);
+  fs::path temporary = cached;
+  temporary += absl::StrCat(".", std::random_device()(), ".tmp");
+  mj_saveModel(model, temporary.string().c_str(), nullptr, 0);
+  fs::rename(temporary, cached, ec);
+  if (ec) fs::remove(temporary, ec);
+  return model;
+}
+
+}  // namespace mjpc
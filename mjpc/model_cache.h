@@ -0,0 +1,46 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// On-disk cache of compiled task models. An XML model is compiled once and
+// saved as MJB, keyed by the contents of the XML, the files it references
+// (includes, meshes, textures, ...) and the MuJoCo version. Later loads read
+// the MJB instead of compiling.
+
+#ifndef MJPC_MODEL_CACHE_H_
+#define MJPC_MODEL_CACHE_H_
+
+#include <string>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// cache directory: $MJPC_MODEL_CACHE_DIR if set, else model_cache next to
+// the tasks directory. an empty $MJPC_MODEL_CACHE_DIR disables the cache.
+std::string ModelCacheDir();
+
+// hex key of the model at xml_path and the files it references, empty if
+// xml_path can't be read. references are found by scanning file attributes,
+// resolved against the referencing file, the model directory and the
+// model's meshdir, texturedir and assetdir.
+std::string ModelCacheKey(const std::string& xml_path);
+
+// mj_loadXML(xml_path), through the cache in ModelCacheDir(). compiles and
+// stores the model on a miss; cache failures fall back to compiling.
+mjModel* LoadCachedModel(const std::string& xml_path, char* error,
+                         int error_sz);
+
+}  // namespace mjpc
+
+#endif  // MJPC_MODEL_CACHE_H_
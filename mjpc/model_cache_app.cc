@@ -0,0 +1,48 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compiles the models of all bundled tasks into the model cache.
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/model_cache.h"
+#include "mjpc/task.h"
+#include "mjpc/tasks/tasks.h"
+
+int main(int argc, char** argv) {
+  if (mjpc::ModelCacheDir().empty()) {
+    std::cerr << "Model cache disabled (MJPC_MODEL_CACHE_DIR is empty).\n";
+    return 1;
+  }
+
+  int failures = 0;
+  for (const mjpc::RegisteredTask& registered : mjpc::GetRegisteredTasks()) {
+    std::shared_ptr<mjpc::Task> task = registered.make();
+    std::string path = task->XmlPath();
+    char error[1024] = "";
+    mjModel* model = mjpc::LoadCachedModel(path, error, sizeof(error));
+    if (!model) {
+      std::cerr << registered.name << ": " << error << "\n";
+      failures++;
+      continue;
+    }
+    mj_deleteModel(model);
+    std::cout << registered.name << ": " << mjpc::ModelCacheKey(path) << "\n";
+  }
+  std::cout << "Model cache: " << mjpc::ModelCacheDir() << "\n";
+  return failures ? 1 : 0;
+}
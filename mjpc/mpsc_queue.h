@@ -0,0 +1,162 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_MPSC_QUEUE_H_
+#define MJPC_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace mjpc {
+
+// default number of preallocated nodes
+inline constexpr int kMpscQueueCapacity = 256;
+
+// lock-free multi-producer, single-consumer FIFO queue. values are pushed
+// from any thread and popped by one consumer thread. nodes come from an
+// arena allocated up front; when all are in use, pushes fall back to the heap
+// (counted by Overflows) rather than block or drop values.
+//
+// the queue is linked as in Vyukov's intrusive MPSC queue: a push is one
+// exchange of the tail, a pop reads the head's successor. a push that has
+// exchanged the tail but not yet linked its node is seen by the consumer on
+// its next pop. free arena nodes form a stack with a tagged top, popped by
+// producers and pushed by the consumer.
+template <typename T>
+class MpscQueue {
+ public:
+  explicit MpscQueue(int capacity = kMpscQueueCapacity)
+      : capacity_(capacity > 0 ? capacity : 1),
+        arena_(new Node[capacity_ + 1]) {
+    // the first node is the initial stub, the rest are free
+    for (int i = 0; i < capacity_ + 1; i++) arena_[i].pooled = true;
+    for (int i = 1; i < capacity_; i++) arena_[i].free_next = i + 2;
+    arena_[capacity_].free_next = 0;
+    free_.store(2, std::memory_order_relaxed);
+    head_ = &arena_[0];
+    tail_.store(head_, std::memory_order_relaxed);
+  }
+
+  // pending values are destroyed
+  ~MpscQueue() {
+    while (Pop()) {
+    }
+    if (!head_->pooled) delete head_;
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // add value, from any thread
+  void Push(T value) {
+    Node* node = Allocate();
+    node->value.emplace(std::move(value));
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* previous = tail_.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // remove the oldest value, from the consumer thread. empty if there is
+  // none.
+  std::optional<T> Pop() {
+    Node* head = head_;
+    Node* next = head->next.load(std::memory_order_acquire);
+    if (!next) return std::nullopt;
+    std::optional<T> value = std::move(next->value);
+    next->value.reset();
+    head_ = next;
+    Free(head);
+    return value;
+  }
+
+  // pop and run fn on all values, including values pushed by fn, from the
+  // consumer thread. returns the number of values.
+  template <typename F>
+  int Drain(F&& fn) {
+    int count = 0;
+    while (std::optional<T> value = Pop()) {
+      fn(*value);
+      count++;
+    }
+    return count;
+  }
+
+  // pushes that didn't fit in the arena
+  std::uint64_t Overflows() const {
+    return overflows_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next = nullptr;
+    std::optional<T> value;
+    // free stack: arena index + 1 of the next free node, 0 for none
+    std::atomic<std::uint32_t> free_next = 0;
+    bool pooled = false;
+  };
+
+  // free stack top: tag in the high bits, arena index + 1 in the low bits.
+  // the tag changes on every update, so that a stale top fails to swap.
+  static std::uint64_t Top(std::uint64_t tag, std::uint32_t index) {
+    return (tag << 32) | index;
+  }
+
+  // arena node, or a heap node if the arena is exhausted
+  Node* Allocate() {
+    std::uint64_t top = free_.load(std::memory_order_acquire);
+    while (std::uint32_t index = top & 0xffffffff) {
+      Node* node = &arena_[index - 1];
+      std::uint32_t next = node->free_next.load(std::memory_order_relaxed);
+      if (free_.compare_exchange_weak(top, Top((top >> 32) + 1, next),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return node;
+      }
+    }
+    overflows_.fetch_add(1, std::memory_order_relaxed);
+    return new Node;
+  }
+
+  // return a node, from the consumer thread
+  void Free(Node* node) {
+    if (!node->pooled) {
+      delete node;
+      return;
+    }
+    std::uint32_t index = node - arena_.get() + 1;
+    std::uint64_t top = free_.load(std::memory_order_relaxed);
+    do {
+      node->free_next.store(top & 0xffffffff, std::memory_order_relaxed);
+    } while (!free_.compare_exchange_weak(top, Top((top >> 32) + 1, index),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  int capacity_;
+  std::unique_ptr<Node[]> arena_;
+  std::atomic<std::uint64_t> free_;
+  std::atomic<std::uint64_t> overflows_ = 0;
+
+  // producers swap the tail, the consumer owns the head (a stub whose value
+  // has been popped)
+  std::atomic<Node*> tail_;
+  Node* head_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_MPSC_QUEUE_H_
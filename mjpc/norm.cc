@@ -209,4 +209,75 @@ double Norm(double* g, double* H, const double* x, const double* params, int n,
   return y;
 }
 
+// evaluate norm at T points
+void NormBatch(double* y, double* g, double* H, const double* x,
+               const double* params, int n, int T, int x_stride, int g_stride,
+               int H_stride, NormType type) {
+  // derivatives, per point
+  if (g) {
+    for (int t = 0; t < T; t++) {
+      y[t] = Norm(g + t * g_stride, H ? H + t * H_stride : nullptr,
+                  x + t * x_stride, params, n, type);
+    }
+    return;
+  }
+
+  double p = params ? params[0] : 0;
+  switch (type) {
+    case NormType::kQuadratic: {  // y = 0.5 * x' * x
+      for (int t = 0; t < T; t++) {
+        const double* xt = x + t * x_stride;
+        double c = 0.0;
+        for (int i = 0; i < n; i++) {
+          c += xt[i] * xt[i];
+        }
+        y[t] = 0.5 * c;
+      }
+      break;
+    }
+
+    case NormType::kL2: {  // y = sqrt(x*x' + p^2) - p
+      for (int t = 0; t < T; t++) {
+        const double* xt = x + t * x_stride;
+        double c = 0.0;
+        for (int i = 0; i < n; i++) {
+          c += xt[i] * xt[i];
+        }
+        y[t] = mju_sqrt(c + p * p) - p;
+      }
+      break;
+    }
+
+    case NormType::kCosh: {  // y = p^2 * (cosh(x / p) - 1)
+      for (int t = 0; t < T; t++) {
+        const double* xt = x + t * x_stride;
+        double c = 0.0;
+        for (int i = 0; i < n; i++) {
+          c += std::cosh(xt[i] / p) - 1.0;
+        }
+        y[t] = p * p * c;
+      }
+      break;
+    }
+
+    case NormType::kSmoothAbsLoss: {  // y = sqrt(x^2 + p^2) - p
+      for (int t = 0; t < T; t++) {
+        const double* xt = x + t * x_stride;
+        double c = 0.0;
+        for (int i = 0; i < n; i++) {
+          c += mju_sqrt(xt[i] * xt[i] + p * p) - p;
+        }
+        y[t] = c;
+      }
+      break;
+    }
+
+    default: {  // remaining norms, per point
+      for (int t = 0; t < T; t++) {
+        y[t] = Norm(nullptr, nullptr, x + t * x_stride, params, n, type);
+      }
+    }
+  }
+}
+
 }  // namespace mjpc
@@ -41,6 +41,13 @@ int NormParameterDimension(int type);
 double Norm(double *g, double *H, const double *x, const double *params, int n,
             NormType type);
 
+// evaluate norm at T points x + t * x_stride, values in y (T). optionally,
+// gradients at g + t * g_stride and Hessians at H + t * H_stride. the type
+// is dispatched once and value loops run over all points.
+void NormBatch(double *y, double *g, double *H, const double *x,
+               const double *params, int n, int T, int x_stride, int g_stride,
+               int H_stride, NormType type);
+
 }  // namespace mjpc
 
 #endif  // MJPC_NORM_H_
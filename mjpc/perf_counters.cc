@@ -0,0 +1,253 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/perf_counters.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#if defined(MJPC_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define MJPC_PERF_EVENTS
+#endif
+
+namespace mjpc {
+
+namespace internal {
+std::atomic<bool> perf_recording = false;
+}  // namespace internal
+
+namespace {
+constexpr int kNumEvents = 4;
+
+// counts of a phase
+struct PhaseTotal {
+  const char* phase;
+  std::uint64_t samples;
+  PerfCounts counts;
+};
+
+// totals of one thread, kept after the thread exits
+struct ThreadTotals {
+  int id;
+  std::mutex mutex;  // uncontended, except while starting or reading
+  std::string name;
+  std::vector<PhaseTotal> phases;
+};
+
+struct PerfRegistry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadTotals>> threads;
+};
+
+PerfRegistry& Registry() {
+  static auto* registry = new PerfRegistry();
+  return *registry;
+}
+
+// totals of the calling thread, registered on first use
+ThreadTotals& CurrentThread() {
+  thread_local std::shared_ptr<ThreadTotals> thread = [] {
+    auto totals = std::make_shared<ThreadTotals>();
+    PerfRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    totals->id = registry.threads.size();
+    registry.threads.push_back(totals);
+    return totals;
+  }();
+  return *thread;
+}
+
+thread_local const char* current_phase = nullptr;
+
+#ifdef MJPC_PERF_EVENTS
+// hardware events by PerfCounts member
+constexpr std::uint64_t kEvents[kNumEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+int OpenEvent(std::uint64_t config, int group_fd) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1, group_fd,
+                 /*flags=*/0);
+}
+
+// event group of the calling thread, the cycles counter leads and events the
+// PMU doesn't support are left out
+class ThreadEvents {
+ public:
+  ThreadEvents() {
+    leader_ = OpenEvent(kEvents[0], -1);
+    if (leader_ < 0) return;
+    slots_[0] = num_events_++;
+    for (int i = 1; i < kNumEvents; i++) {
+      int fd = OpenEvent(kEvents[i], leader_);
+      if (fd < 0) continue;
+      fds_.push_back(fd);
+      slots_[i] = num_events_++;
+    }
+  }
+  ~ThreadEvents() {
+    for (int fd : fds_) close(fd);
+    if (leader_ >= 0) close(leader_);
+  }
+
+  bool Read(PerfCounts* counts) const {
+    if (leader_ < 0) return false;
+    std::uint64_t values[1 + kNumEvents];
+    std::size_t size = sizeof(std::uint64_t) * (1 + num_events_);
+    if (read(leader_, values, size) != static_cast<ssize_t>(size)) {
+      return false;
+    }
+    std::uint64_t* members[kNumEvents] = {
+        &counts->cycles, &counts->instructions, &counts->llc_misses,
+        &counts->branch_misses};
+    for (int i = 0; i < kNumEvents; i++) {
+      *members[i] = slots_[i] >= 0 ? values[1 + slots_[i]] : 0;
+    }
+    return true;
+  }
+
+ private:
+  int leader_ = -1;
+  std::vector<int> fds_;
+  int slots_[kNumEvents] = {-1, -1, -1, -1};
+  int num_events_ = 0;
+};
+
+// counts of the calling thread, opened on first use
+bool ReadThreadCounts(PerfCounts* counts) {
+  thread_local ThreadEvents events;
+  return events.Read(counts);
+}
+#else
+bool ReadThreadCounts(PerfCounts* counts) { return false; }
+#endif
+
+// difference a - b of counters that only increase
+PerfCounts Difference(const PerfCounts& a, const PerfCounts& b) {
+  PerfCounts difference;
+  difference.cycles = a.cycles - b.cycles;
+  difference.instructions = a.instructions - b.instructions;
+  difference.llc_misses = a.llc_misses - b.llc_misses;
+  difference.branch_misses = a.branch_misses - b.branch_misses;
+  return difference;
+}
+}  // namespace
+
+bool PerfCountersAvailable() {
+#ifdef MJPC_PERF_EVENTS
+  static const bool available = [] {
+    int fd = OpenEvent(kEvents[0], -1);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+  }();
+  return available;
+#else
+  return false;
+#endif
+}
+
+bool StartPerfCounters() {
+  if (!PerfCountersAvailable()) return false;
+  PerfRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    thread->phases.clear();
+  }
+  internal::perf_recording = true;
+  return true;
+}
+
+void StopPerfCounters() { internal::perf_recording = false; }
+
+std::vector<PerfPhaseCounts> PerfCounterTotals() {
+  std::vector<PerfPhaseCounts> totals;
+  PerfRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    for (const PhaseTotal& phase : thread->phases) {
+      totals.push_back({phase.phase, thread->name, thread->id, phase.samples,
+                        phase.counts});
+    }
+  }
+  std::sort(totals.begin(), totals.end(),
+            [](const PerfPhaseCounts& a, const PerfPhaseCounts& b) {
+              return std::tie(a.phase, a.thread_id) <
+                     std::tie(b.phase, b.thread_id);
+            });
+  return totals;
+}
+
+void SetPerfThreadName(const std::string& name) {
+  ThreadTotals& thread = CurrentThread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  thread.name = name;
+}
+
+const char* CurrentPerfPhase() { return current_phase; }
+
+void PerfPhase::BeginSample(const char* name) {
+  if (name_ || !ReadThreadCounts(&start_)) return;
+  name_ = name;
+  previous_ = current_phase;
+  current_phase = name;
+}
+
+void PerfPhase::EndSample() {
+  PerfCounts end;
+  bool read = ReadThreadCounts(&end);
+  current_phase = previous_;
+  const char* name = name_;
+  name_ = nullptr;
+  if (!read || !internal::perf_recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  // phases are string literals, equal names may have different addresses
+  ThreadTotals& thread = CurrentThread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  auto phase = std::find_if(
+      thread.phases.begin(), thread.phases.end(), [&](const PhaseTotal& p) {
+        return p.phase == name || std::strcmp(p.phase, name) == 0;
+      });
+  if (phase == thread.phases.end()) {
+    thread.phases.push_back({name, 0, PerfCounts()});
+    phase = thread.phases.end() - 1;
+  }
+  phase->samples++;
+  phase->counts += Difference(end, start_);
+}
+
+}  // namespace mjpc
@@ -0,0 +1,119 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Hardware performance counters (cycles, instructions, last-level cache
+// misses and branch misses) of the phases timed by TraceSpan, aggregated per
+// thread. counters are sampled only if MJPC_PERF_COUNTERS is defined (CMake
+// option MJPC_ENABLE_PERF_COUNTERS, Linux perf_event_open) and between
+// StartPerfCounters and StopPerfCounters. a phase counts the events of its
+// own thread and of the thread pool tasks scheduled while it is the thread's
+// innermost phase, on the workers that run them. phases include the phases
+// nested in them. reading the counters takes a system call, so phases are
+// sampled at a cost of about a microsecond.
+
+#ifndef MJPC_PERF_COUNTERS_H_
+#define MJPC_PERF_COUNTERS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mjpc {
+
+// hardware event counts
+struct PerfCounts {
+  std::uint64_t cycles = 0;
+  std::uint64_t instructions = 0;
+  std::uint64_t llc_misses = 0;
+  std::uint64_t branch_misses = 0;
+
+  PerfCounts& operator+=(const PerfCounts& other) {
+    cycles += other.cycles;
+    instructions += other.instructions;
+    llc_misses += other.llc_misses;
+    branch_misses += other.branch_misses;
+    return *this;
+  }
+};
+
+// counts of a phase on a thread since StartPerfCounters
+struct PerfPhaseCounts {
+  std::string phase;
+  std::string thread;      // thread name, empty if unnamed
+  int thread_id = 0;       // order in which threads were first sampled
+  std::uint64_t samples = 0;  // phases and pool tasks counted
+  PerfCounts counts;
+};
+
+// true if built with MJPC_PERF_COUNTERS and the counters can be opened,
+// e.g., perf_event_paranoid allows it
+bool PerfCountersAvailable();
+
+// discard previous counts and start sampling, false if not available
+bool StartPerfCounters();
+
+// stop sampling
+void StopPerfCounters();
+
+// counts since StartPerfCounters, by phase and thread
+std::vector<PerfPhaseCounts> PerfCounterTotals();
+
+// name the calling thread in PerfCounterTotals
+void SetPerfThreadName(const std::string& name);
+
+// innermost phase of the calling thread, nullptr if none
+const char* CurrentPerfPhase();
+
+namespace internal {
+extern std::atomic<bool> perf_recording;
+}  // namespace internal
+
+// counters of a phase on the calling thread, sampled from Begin to End or
+// destruction. while it is the thread's innermost phase, thread pool tasks
+// scheduled from the thread are counted as the phase.
+class PerfPhase {
+ public:
+  PerfPhase() = default;
+  ~PerfPhase() { End(); }
+
+  PerfPhase(const PerfPhase&) = delete;
+  PerfPhase& operator=(const PerfPhase&) = delete;
+
+  // begin phase name (a string literal), nothing if name is nullptr or
+  // counters aren't sampled
+  void Begin(const char* name) {
+    if (name && internal::perf_recording.load(std::memory_order_relaxed)) {
+      BeginSample(name);
+    }
+  }
+
+  // add the counts since Begin to the phase, once
+  void End() {
+    if (name_) EndSample();
+  }
+
+ private:
+  void BeginSample(const char* name);
+  void EndSample();
+
+  const char* name_ = nullptr;
+  const char* previous_ = nullptr;  // enclosing phase
+  PerfCounts start_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PERF_COUNTERS_H_
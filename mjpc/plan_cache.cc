@@ -0,0 +1,125 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/plan_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mjpc/memory_report.h"
+#include "mjpc/snapshot.h"
+
+namespace mjpc {
+
+PlanCache::PlanCache(int capacity, double resolution)
+    : capacity_(std::max(capacity, 1)),
+      resolution_(resolution > 0.0 ? resolution : kPlanCacheResolution),
+      max_distance_(std::numeric_limits<double>::infinity()) {}
+
+void PlanCache::SetResolution(double resolution) {
+  if (resolution <= 0.0 || resolution == resolution_) return;
+  resolution_ = resolution;
+  Clear();
+}
+
+void PlanCache::Store(int task, int mode, const double* features, int size,
+                      double time, std::string snapshot) {
+  Key key = MakeKey(task, mode, features, size);
+  auto it = entries_.find(key);
+
+  // evict the least recently used entry for a new one
+  if (it == entries_.end() && Size() >= capacity_) {
+    auto oldest = std::min_element(
+        entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+          return a.second.last_use < b.second.last_use;
+        });
+    entries_.erase(oldest);
+  }
+
+  Entry& entry = entries_[std::move(key)];
+  entry.features.assign(features, features + size);
+  entry.time = time;
+  entry.snapshot = std::move(snapshot);
+  entry.last_use = ++clock_;
+}
+
+bool PlanCache::Lookup(int task, int mode, const double* features, int size,
+                       double time, std::string* snapshot) {
+  // the same cell, else the nearest entry of the mode
+  Entry* nearest = nullptr;
+  auto it = entries_.find(MakeKey(task, mode, features, size));
+  if (it != entries_.end()) {
+    nearest = &it->second;
+  } else {
+    double nearest_distance = std::numeric_limits<double>::infinity();
+    for (auto& [key, entry] : entries_) {
+      if (key.task != task || key.mode != mode ||
+          static_cast<int>(entry.features.size()) != size) {
+        continue;
+      }
+      double distance = 0.0;
+      for (int i = 0; i < size; i++) {
+        double difference = entry.features[i] - features[i];
+        distance += difference * difference;
+      }
+      if (distance < nearest_distance) {
+        nearest_distance = distance;
+        nearest = &entry;
+      }
+    }
+    if (nearest && std::sqrt(nearest_distance) > max_distance_) {
+      nearest = nullptr;
+    }
+  }
+  if (!nearest) {
+    misses_++;
+    return false;
+  }
+
+  hits_++;
+  nearest->last_use = ++clock_;
+  *snapshot = nearest->snapshot;
+  ShiftSnapshotTimes(*snapshot, time - nearest->time);
+  return true;
+}
+
+void PlanCache::Clear() { entries_.clear(); }
+
+std::size_t PlanCache::Bytes() const {
+  std::size_t bytes = 0;
+  for (const auto& [key, entry] : entries_) {
+    bytes += sizeof(Key) + sizeof(Entry) + VectorBytes(key.cell) +
+             VectorBytes(entry.features) + entry.snapshot.capacity();
+  }
+  return bytes;
+}
+
+PlanCache::Key PlanCache::MakeKey(int task, int mode, const double* features,
+                                  int size) const {
+  Key key{task, mode, std::vector<std::int64_t>(size)};
+  for (int i = 0; i < size; i++) {
+    key.cell[i] = static_cast<std::int64_t>(std::floor(features[i] /
+                                                       resolution_));
+  }
+  return key;
+}
+
+}  // namespace mjpc
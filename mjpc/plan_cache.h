@@ -0,0 +1,109 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// In-memory cache of converged plans, as planner snapshots (see snapshot.h),
+// keyed by the task, its mode and the planning state discretized into cells.
+// A planner that switches mode or is reset seeds from the entry of the mode
+// nearest to its state rather than from defaults or an unrelated policy.
+
+#ifndef MJPC_PLAN_CACHE_H_
+#define MJPC_PLAN_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+namespace mjpc {
+
+// default number of entries, the least recently used are evicted
+inline constexpr int kPlanCacheCapacity = 64;
+
+// default cell size of the state features
+inline constexpr double kPlanCacheResolution = 0.1;
+
+class PlanCache {
+ public:
+  explicit PlanCache(int capacity = kPlanCacheCapacity,
+                     double resolution = kPlanCacheResolution);
+
+  // cell size, and the largest distance of a seeding entry's features from
+  // the state (infinite by default). changing the resolution clears the
+  // cache.
+  void SetResolution(double resolution);
+  double Resolution() const { return resolution_; }
+  void SetMaxDistance(double distance) { max_distance_ = distance; }
+  double MaxDistance() const { return max_distance_; }
+
+  // store the snapshot of the plan of task in mode from features (size) at
+  // time, replacing the entry of the features' cell
+  void Store(int task, int mode, const double* features, int size,
+             double time, std::string snapshot);
+
+  // the snapshot of the entry of task in mode with the features nearest to
+  // features, with its times shifted to time. false if there is none within
+  // the max distance.
+  bool Lookup(int task, int mode, const double* features, int size,
+              double time, std::string* snapshot);
+
+  void Clear();
+  int Size() const { return entries_.size(); }
+
+  // bytes of the entries' keys, features and snapshots
+  std::size_t Bytes() const;
+
+  // lookups that found an entry, and that didn't
+  std::uint64_t Hits() const { return hits_; }
+  std::uint64_t Misses() const { return misses_; }
+
+ private:
+  struct Key {
+    int task;
+    int mode;
+    std::vector<std::int64_t> cell;
+
+    bool operator==(const Key& other) const {
+      return task == other.task && mode == other.mode && cell == other.cell;
+    }
+    template <typename H>
+    friend H AbslHashValue(H h, const Key& key) {
+      return H::combine(std::move(h), key.task, key.mode, key.cell);
+    }
+  };
+
+  struct Entry {
+    std::vector<double> features;
+    double time;
+    std::string snapshot;
+    std::uint64_t last_use;
+  };
+
+  Key MakeKey(int task, int mode, const double* features, int size) const;
+
+  int capacity_;
+  double resolution_;
+  double max_distance_;
+  absl::flat_hash_map<Key, Entry> entries_;
+  std::uint64_t clock_ = 0;
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLAN_CACHE_H_
@@ -0,0 +1,269 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/plan_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mjpc {
+
+namespace {
+// writer thread polling period while the ring is empty
+constexpr std::chrono::milliseconds kPollPeriod(2);
+
+// partial chunks are written after the ring was empty for this long
+constexpr std::chrono::milliseconds kFlushPeriod(100);
+
+struct ChunkHeader {
+  char magic[4];
+  std::uint32_t records;
+  std::uint32_t dim_state;
+  std::uint32_t num_parameters;
+  std::uint32_t num_samples;
+  std::uint32_t sample_horizon;
+  std::uint32_t dim_sample_state;
+  std::uint32_t pad;
+};
+static_assert(sizeof(ChunkHeader) % 8 == 0);
+
+ChunkHeader Header(const PlanLogRecord& record) {
+  ChunkHeader header = {};
+  std::memcpy(header.magic, kPlanLogChunkMagic, sizeof(header.magic));
+  header.dim_state = record.state.size();
+  header.num_parameters = record.parameters.size();
+  header.num_samples = record.returns.size();
+  header.sample_horizon = record.sample_horizon;
+  header.dim_sample_state = record.dim_sample_state;
+  return header;
+}
+
+// true if the records go in one chunk
+bool SameSizes(const PlanLogRecord& a, const PlanLogRecord& b) {
+  return a.state.size() == b.state.size() &&
+         a.parameters.size() == b.parameters.size() &&
+         a.returns.size() == b.returns.size() &&
+         a.sample_horizon == b.sample_horizon &&
+         a.dim_sample_state == b.dim_sample_state;
+}
+
+// values of a sample state column entry
+std::size_t SampleStateSize(const ChunkHeader& header) {
+  return static_cast<std::size_t>(header.num_samples) *
+         header.sample_horizon * header.dim_sample_state;
+}
+}  // namespace
+
+void PlanLogRecord::Clear() {
+  iteration = 0;
+  time = 0.0;
+  total_return = 0.0;
+  state.clear();
+  parameters.clear();
+  returns.clear();
+  sample_horizon = 0;
+  dim_sample_state = 0;
+  sample_states.clear();
+}
+
+PlanLogger::~PlanLogger() { Close(); }
+
+bool PlanLogger::Open(const std::string& path, const PlanLogOptions& options) {
+  Close();
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file) return false;
+  std::uint32_t version[2] = {kPlanLogVersion, 0};
+  if (std::fwrite(kPlanLogMagic, sizeof(kPlanLogMagic), 1, file) != 1 ||
+      std::fwrite(version, sizeof(version), 1, file) != 1) {
+    std::fclose(file);
+    return false;
+  }
+
+  options_ = options;
+  options_.capacity = std::max(options_.capacity, 2);
+  options_.chunk_records = std::max(options_.chunk_records, 1);
+  ring_.assign(options_.capacity, PlanLogRecord());
+  chunk_.assign(options_.chunk_records, PlanLogRecord());
+  chunk_size_ = 0;
+  head_ = 0;
+  tail_ = 0;
+  written_ = 0;
+  dropped_ = 0;
+  stop_ = false;
+  file_ = file;
+  writer_ = std::thread(&PlanLogger::Run, this);
+  return true;
+}
+
+void PlanLogger::Close() {
+  if (!file_) return;
+  stop_ = true;
+  writer_.join();
+  std::fclose(file_);
+  file_ = nullptr;
+}
+
+PlanLogRecord* PlanLogger::Acquire() {
+  std::uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) >= ring_.size()) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  PlanLogRecord* record = &ring_[head % ring_.size()];
+  record->Clear();
+  return record;
+}
+
+void PlanLogger::Commit() {
+  head_.store(head_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+void PlanLogger::Run() {
+  auto last_record = std::chrono::steady_clock::now();
+  while (true) {
+    std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      // queued records are written before stopping
+      bool stop = stop_.load();
+      if (chunk_size_ > 0 &&
+          (stop || std::chrono::steady_clock::now() - last_record >
+                       kFlushPeriod)) {
+        WriteChunk();
+      }
+      if (stop && tail == head_.load(std::memory_order_acquire)) break;
+      std::this_thread::sleep_for(kPollPeriod);
+      continue;
+    }
+
+    // a chunk holds records of the same sizes
+    PlanLogRecord& record = ring_[tail % ring_.size()];
+    if (chunk_size_ > 0 && !SameSizes(chunk_[0], record)) WriteChunk();
+
+    // swap instead of copying, the slot keeps the chunk record's memory
+    std::swap(chunk_[chunk_size_++], record);
+    tail_.store(tail + 1, std::memory_order_release);
+    last_record = std::chrono::steady_clock::now();
+    if (chunk_size_ == options_.chunk_records) WriteChunk();
+  }
+  std::fflush(file_);
+}
+
+bool PlanLogger::WriteChunk() {
+  int records = chunk_size_;
+  chunk_size_ = 0;
+  ChunkHeader header = Header(chunk_[0]);
+  header.records = records;
+  bool ok = std::fwrite(&header, sizeof(header), 1, file_) == 1;
+
+  // column of one value per record
+  auto scalars = [&](auto value) {
+    for (int i = 0; i < records && ok; i++) {
+      auto v = value(chunk_[i]);
+      ok = std::fwrite(&v, sizeof(v), 1, file_) == 1;
+    }
+  };
+  // column of size values per record, zero-padded
+  auto vectors = [&](std::vector<double> PlanLogRecord::*member,
+                     std::size_t size) {
+    for (int i = 0; i < records && ok; i++) {
+      const std::vector<double>& values = chunk_[i].*member;
+      std::size_t n = std::min(size, values.size());
+      ok = std::fwrite(values.data(), sizeof(double), n, file_) == n;
+      for (std::size_t j = n; j < size && ok; j++) {
+        double zero = 0.0;
+        ok = std::fwrite(&zero, sizeof(zero), 1, file_) == 1;
+      }
+    }
+  };
+  scalars([](const PlanLogRecord& r) { return r.iteration; });
+  scalars([](const PlanLogRecord& r) { return r.time; });
+  scalars([](const PlanLogRecord& r) { return r.total_return; });
+  vectors(&PlanLogRecord::state, header.dim_state);
+  vectors(&PlanLogRecord::parameters, header.num_parameters);
+  vectors(&PlanLogRecord::returns, header.num_samples);
+  vectors(&PlanLogRecord::sample_states, SampleStateSize(header));
+  if (ok) written_.fetch_add(records, std::memory_order_relaxed);
+  return ok;
+}
+
+bool ReadPlanLog(const std::string& path, std::vector<PlanLogRecord>* records) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  std::uint32_t version;
+  if (bytes.size() < 16 ||
+      std::memcmp(bytes.data(), kPlanLogMagic, sizeof(kPlanLogMagic)) != 0) {
+    return false;
+  }
+  std::memcpy(&version, bytes.data() + 8, sizeof(version));
+  if (version != kPlanLogVersion) return false;
+
+  records->clear();
+  std::size_t offset = 16;
+  while (offset + sizeof(ChunkHeader) <= bytes.size()) {
+    ChunkHeader header;
+    std::memcpy(&header, bytes.data() + offset, sizeof(header));
+    if (std::memcmp(header.magic, kPlanLogChunkMagic, 4) != 0) return false;
+    std::size_t n = header.records;
+    std::size_t size = 3 + header.dim_state + header.num_parameters +
+                       header.num_samples + SampleStateSize(header);
+    // a truncated last chunk, e.g., of a log being written, is skipped
+    if (offset + sizeof(header) + 8 * n * size > bytes.size()) break;
+    const char* column = bytes.data() + offset + sizeof(header);
+
+    std::size_t first = records->size();
+    records->resize(first + n);
+    auto scalars = [&](auto PlanLogRecord::*member) {
+      for (std::size_t i = 0; i < n; i++) {
+        std::memcpy(&((*records)[first + i].*member), column, 8);
+        column += 8;
+      }
+    };
+    auto vectors = [&](std::vector<double> PlanLogRecord::*member,
+                       std::size_t size) {
+      for (std::size_t i = 0; i < n; i++) {
+        std::vector<double>& values = (*records)[first + i].*member;
+        values.resize(size);
+        std::memcpy(values.data(), column, 8 * size);
+        column += 8 * size;
+      }
+    };
+    scalars(&PlanLogRecord::iteration);
+    scalars(&PlanLogRecord::time);
+    scalars(&PlanLogRecord::total_return);
+    vectors(&PlanLogRecord::state, header.dim_state);
+    vectors(&PlanLogRecord::parameters, header.num_parameters);
+    vectors(&PlanLogRecord::returns, header.num_samples);
+    vectors(&PlanLogRecord::sample_states, SampleStateSize(header));
+    for (std::size_t i = 0; i < n; i++) {
+      (*records)[first + i].sample_horizon = header.sample_horizon;
+      (*records)[first + i].dim_sample_state = header.dim_sample_state;
+    }
+    offset += sizeof(header) + 8 * n * size;
+  }
+  return true;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,131 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Binary log of planning iterations. The planning thread copies each
+// iteration into a preallocated slot of a lock-free single-producer ring; a
+// background thread appends the records to a columnar file. Iterations are
+// dropped, not waited for, when the ring is full. Layout of the file, in
+// native byte order, with every field 8-byte aligned so that a mapped file
+// can be read in place (python/mujoco_mpc/plan_log.py):
+//   header: magic "MJPCPLOG" (8 bytes), version (uint32), pad (uint32)
+//   chunk:  magic "CHNK" (4 bytes), then as uint32: records, state size,
+//           parameters, samples, sample horizon, sample state size, pad;
+//           then the columns of the chunk's records: iteration (int64), time,
+//           total return, state, parameters, sample returns and sample
+//           states (doubles)
+// records of a chunk have the same sizes; a chunk ends when they change.
+
+#ifndef MJPC_PLAN_LOG_H_
+#define MJPC_PLAN_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mjpc {
+
+inline constexpr char kPlanLogMagic[8] = {'M', 'J', 'P', 'C',
+                                          'P', 'L', 'O', 'G'};
+inline constexpr char kPlanLogChunkMagic[4] = {'C', 'H', 'N', 'K'};
+inline constexpr std::uint32_t kPlanLogVersion = 1;
+
+// a planning iteration
+struct PlanLogRecord {
+  std::int64_t iteration = 0;
+  double time = 0.0;          // planning start time
+  double total_return = 0.0;  // of the best trajectory
+
+  std::vector<double> state;       // planning start state (nq + nv + na)
+  std::vector<double> parameters;  // nominal policy after the iteration
+
+  // samples of sampling planners, empty otherwise
+  std::vector<double> returns;  // total return of each sample
+  int sample_horizon = 0;       // 0 without sample states
+  int dim_sample_state = 0;
+  std::vector<double> sample_states;  // (samples x horizon x state)
+
+  // clear the sizes, keeping the memory
+  void Clear();
+};
+
+struct PlanLogOptions {
+  int capacity = 256;     // ring slots
+  int chunk_records = 64;  // records per chunk, at most
+  bool samples = false;    // log the states of all samples
+};
+
+// appends planning iterations to a file
+class PlanLogger {
+ public:
+  PlanLogger() = default;
+  ~PlanLogger();
+
+  PlanLogger(const PlanLogger&) = delete;
+  PlanLogger& operator=(const PlanLogger&) = delete;
+
+  // create path and start the writer thread. false if it can't be opened.
+  bool Open(const std::string& path, const PlanLogOptions& options = {});
+
+  // write the queued records and close the file
+  void Close();
+
+  bool IsOpen() const { return file_ != nullptr; }
+  const PlanLogOptions& options() const { return options_; }
+
+  // ----- producer, one thread ----- //
+
+  // a free slot to fill, nullptr if the ring is full (the record is dropped)
+  PlanLogRecord* Acquire();
+
+  // queue the acquired slot
+  void Commit();
+
+  // records written and dropped since Open
+  std::uint64_t Written() const { return written_.load(); }
+  std::uint64_t Dropped() const { return dropped_.load(); }
+
+ private:
+  void Run();
+
+  // append the records of the chunk, false on a write error
+  bool WriteChunk();
+
+  PlanLogOptions options_;
+  std::FILE* file_ = nullptr;
+  std::thread writer_;
+  std::atomic_bool stop_ = false;
+
+  // slots [tail_, head_) are queued, head_ - tail_ < slots
+  std::vector<PlanLogRecord> ring_;
+  alignas(64) std::atomic<std::uint64_t> head_ = 0;
+  alignas(64) std::atomic<std::uint64_t> tail_ = 0;
+
+  // records of the current chunk, owned by the writer thread
+  std::vector<PlanLogRecord> chunk_;
+  int chunk_size_ = 0;
+
+  std::atomic<std::uint64_t> written_ = 0;
+  std::atomic<std::uint64_t> dropped_ = 0;
+};
+
+// read all complete chunks of a log, false if path isn't a plan log
+bool ReadPlanLog(const std::string& path, std::vector<PlanLogRecord>* records);
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLAN_LOG_H_
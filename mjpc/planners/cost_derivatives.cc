@@ -17,6 +17,7 @@
 #include <algorithm>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/norm.h"
 #include "mjpc/task.h"
 #include "mjpc/utilities.h"
@@ -46,6 +47,13 @@ void CostDerivatives::Allocate(int dim_state_derivative, int dim_action,
   cxx_scratch_.resize(T * dim_state_derivative * dim_state_derivative);
   cuu_scratch_.resize(T * dim_action * dim_action);
   cxu_scratch_.resize(T * dim_state_derivative * dim_action);
+  support_.resize(T * (dim_state_derivative + dim_action));
+}
+
+std::size_t CostDerivatives::Bytes() const {
+  return VectorBytes(cr, crr, cx, cu, cxx, cuu, cxu, c_scratch_, cx_scratch_,
+                     cu_scratch_, cxx_scratch_, cuu_scratch_, cxu_scratch_,
+                     norm_value_, term_shift_, support_);
 }
 
 // reset memory to zeros
@@ -83,6 +91,21 @@ double CostDerivatives::DerivativeStep(
   // norm derivatives
   double C = Norm(Cr, Crr, r, p, nr, type);
 
+  // Gauss-Newton terms
+  DenseProducts(Cx, Cu, Cxx, Cuu, Cxu, Cr, Crr, C_scratch, Cx_scratch,
+                Cu_scratch, Cxx_scratch, Cuu_scratch, Cxu_scratch, rx, ru, nr,
+                nx, dim_action, weight);
+
+  return weight * C;
+}
+
+// Gauss-Newton terms of one cost term
+void CostDerivatives::DenseProducts(
+    double* Cx, double* Cu, double* Cxx, double* Cuu, double* Cxu,
+    const double* Cr, const double* Crr, double* C_scratch, double* Cx_scratch,
+    double* Cu_scratch, double* Cxx_scratch, double* Cuu_scratch,
+    double* Cxu_scratch, const double* rx, const double* ru, int nr, int nx,
+    int dim_action, double weight) {
   // cx
   mju_mulMatTVec(Cx_scratch, rx, Cr, nr, nx);
   mju_addToScl(Cx, Cx_scratch, weight, nx);
@@ -104,8 +127,86 @@ double CostDerivatives::DerivativeStep(
   mju_mulMatMat(C_scratch, Crr, ru, nr, nr, dim_action);
   mju_mulMatTMat(Cuu_scratch, C_scratch, ru, nr, dim_action, dim_action);
   mju_addToScl(Cuu, Cuu_scratch, weight, dim_action * dim_action);
+}
 
-  return weight * C;
+// Gauss-Newton terms of one cost term over nonzero Jacobian columns
+void CostDerivatives::SparseProducts(
+    double* Cx, double* Cu, double* Cxx, double* Cuu, double* Cxu,
+    const double* Cr, const double* Crr, double* C_scratch, const double* rx,
+    const double* ru, int nr, int nx, int dim_action, const int* sx, int nsx,
+    const int* su, int nsu, double weight) {
+  // cx
+  for (int a = 0; a < nsx; a++) {
+    double value = 0.0;
+    for (int k = 0; k < nr; k++) {
+      value += rx[k * nx + sx[a]] * Cr[k];
+    }
+    Cx[sx[a]] += weight * value;
+  }
+
+  // cu
+  for (int a = 0; a < nsu; a++) {
+    double value = 0.0;
+    for (int k = 0; k < nr; k++) {
+      value += ru[k * dim_action + su[a]] * Cr[k];
+    }
+    Cu[su[a]] += weight * value;
+  }
+
+  // Crr * rx, over support (nr x nsx)
+  for (int k = 0; k < nr; k++) {
+    for (int a = 0; a < nsx; a++) {
+      double value = 0.0;
+      for (int l = 0; l < nr; l++) {
+        value += Crr[k * nr + l] * rx[l * nx + sx[a]];
+      }
+      C_scratch[k * nsx + a] = value;
+    }
+  }
+
+  // cxx
+  for (int a = 0; a < nsx; a++) {
+    for (int b = 0; b < nsx; b++) {
+      double value = 0.0;
+      for (int k = 0; k < nr; k++) {
+        value += C_scratch[k * nsx + a] * rx[k * nx + sx[b]];
+      }
+      Cxx[sx[a] * nx + sx[b]] += weight * value;
+    }
+  }
+
+  // cxu
+  for (int a = 0; a < nsx; a++) {
+    for (int b = 0; b < nsu; b++) {
+      double value = 0.0;
+      for (int k = 0; k < nr; k++) {
+        value += C_scratch[k * nsx + a] * ru[k * dim_action + su[b]];
+      }
+      Cxu[sx[a] * dim_action + su[b]] += weight * value;
+    }
+  }
+
+  // Crr * ru, over support (nr x nsu)
+  for (int k = 0; k < nr; k++) {
+    for (int a = 0; a < nsu; a++) {
+      double value = 0.0;
+      for (int l = 0; l < nr; l++) {
+        value += Crr[k * nr + l] * ru[l * dim_action + su[a]];
+      }
+      C_scratch[k * nsu + a] = value;
+    }
+  }
+
+  // cuu
+  for (int a = 0; a < nsu; a++) {
+    for (int b = 0; b < nsu; b++) {
+      double value = 0.0;
+      for (int k = 0; k < nr; k++) {
+        value += C_scratch[k * nsu + a] * ru[k * dim_action + su[b]];
+      }
+      Cuu[su[a] * dim_action + su[b]] += weight * value;
+    }
+  }
 }
 
 // compute derivatives at all time steps
@@ -119,114 +220,245 @@ void CostDerivatives::Compute(double* r, double* rx, double* ru,
                               int T, ThreadPool& pool) {
   // reset
   this->Reset(dim_state_derivative, dim_action, num_residual, T);
-  {
-    int count_before = pool.GetCount();
-    for (int t = 0; t < T; t++) {
-      pool.Schedule([&cd = *this, &r, &rx, &ru, num_term, num_residual,
-                     &dim_norm_residual, &weights, &norms, &parameters,
-                     &num_norm_parameter, risk, num_sensors,
-                     dim_state_derivative, dim_action, dim_max, t, T]() {
-        // ----- term derivatives ----- //
-        int f_shift = 0;
-        int p_shift = 0;
-        double c = 0.0;
-        for (int i = 0; i < num_term; i++) {
-          c += cd.DerivativeStep(
-              DataAt(cd.cx, t * dim_state_derivative),
-              DataAt(cd.cu, t * dim_action),
-              DataAt(cd.cxx, t * dim_state_derivative * dim_state_derivative),
-              DataAt(cd.cuu, t * dim_action * dim_action),
-              DataAt(cd.cxu, t * dim_state_derivative * dim_action),
-              DataAt(cd.cr, t * num_residual),
-              DataAt(cd.crr, t * num_residual * num_residual),
-              DataAt(cd.c_scratch_, t * dim_max * dim_max),
-              DataAt(cd.cx_scratch_, t * dim_state_derivative),
-              DataAt(cd.cu_scratch_, t * dim_action),
-              DataAt(cd.cxx_scratch_,
-                     t * dim_state_derivative * dim_state_derivative),
-              DataAt(cd.cuu_scratch_, t * dim_action * dim_action),
-              DataAt(cd.cxu_scratch_, t * dim_state_derivative * dim_action),
-              r + t * num_residual + f_shift,
-              rx + t * num_sensors * dim_state_derivative +
-                  f_shift * dim_state_derivative,
-              ru + t * num_sensors * dim_action + f_shift * dim_action,
-              dim_norm_residual[i], dim_state_derivative, dim_action,
-              weights[i] / T, parameters + p_shift, norms[i]);
-
-          f_shift += dim_norm_residual[i];
-          p_shift += num_norm_parameter[i];
-        }
 
-        // ----- risk transformation ----- //
-        if (mju_abs(risk) < kRiskNeutralTolerance) {
-          return;
+  // term offsets into residual, parameters, and norm Hessians
+  term_shift_.resize(3 * num_term);
+  int f_shift = 0;
+  int p_shift = 0;
+  int h_shift = 0;
+  for (int i = 0; i < num_term; i++) {
+    term_shift_[3 * i] = f_shift;
+    term_shift_[3 * i + 1] = p_shift;
+    term_shift_[3 * i + 2] = h_shift;
+    f_shift += dim_norm_residual[i];
+    p_shift += num_norm_parameter[i];
+    h_shift += dim_norm_residual[i] * dim_norm_residual[i];
+  }
+
+  // norm derivatives, batched over time steps per term
+  norm_value_.resize(num_term * T);
+  pool.ParallelFor(0, num_term, 1, [&](int i) {
+    int f = term_shift_[3 * i];
+    if (weights[i] == 0.0) {
+      std::fill_n(DataAt(norm_value_, i * T), T, 0.0);
+      return;
+    }
+    NormBatch(DataAt(norm_value_, i * T), DataAt(cr, f),
+              DataAt(crr, term_shift_[3 * i + 2]), r + f,
+              parameters + term_shift_[3 * i + 1], dim_norm_residual[i], T,
+              num_residual, num_residual, num_residual * num_residual,
+              norms[i]);
+  });
+
+  // Gauss-Newton terms
+  pool.ParallelFor(0, T, 1, [&](int t) {
+    TermDerivatives(rx, ru, dim_state_derivative, dim_action, dim_max,
+                    num_sensors, num_residual, dim_norm_residual, num_term,
+                    weights, DataAt(norm_value_, t), T, risk, T, t);
+  });
+}
+
+// compute derivatives at one time step
+void CostDerivatives::ComputeStep(double* r, double* rx, double* ru,
+                                  int dim_state_derivative, int dim_action,
+                                  int dim_max, int num_sensors,
+                                  int num_residual,
+                                  const int* dim_norm_residual, int num_term,
+                                  const double* weights, const NormType* norms,
+                                  const double* parameters,
+                                  const int* num_norm_parameter, double risk,
+                                  int T, int t) {
+  int slot = Slot(t);
+
+  // a reused slot accumulates from zero
+  if (window > 0) {
+    mju_zero(DataAt(cx, slot * dim_state_derivative), dim_state_derivative);
+    mju_zero(DataAt(cu, slot * dim_action), dim_action);
+    mju_zero(DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+             dim_state_derivative * dim_state_derivative);
+    mju_zero(DataAt(cuu, slot * dim_action * dim_action),
+             dim_action * dim_action);
+    mju_zero(DataAt(cxu, slot * dim_state_derivative * dim_action),
+             dim_state_derivative * dim_action);
+  }
+
+  // norm derivatives
+  double values[kMaxCostTerms];
+  int f_shift = 0;
+  int p_shift = 0;
+  int h_shift = 0;
+  for (int i = 0; i < num_term; i++) {
+    int nr = dim_norm_residual[i];
+    double* Cr = DataAt(cr, slot * num_residual + f_shift);
+    double* Crr = DataAt(crr, slot * num_residual * num_residual + h_shift);
+    if (weights[i] == 0.0) {
+      // inactive term
+      values[i] = 0.0;
+      mju_zero(Cr, nr);
+      mju_zero(Crr, nr * nr);
+    } else {
+      values[i] = Norm(Cr, Crr, r + t * num_residual + f_shift,
+                       parameters + p_shift, nr, norms[i]);
+    }
+    f_shift += nr;
+    p_shift += num_norm_parameter[i];
+    h_shift += nr * nr;
+  }
+
+  // Gauss-Newton terms
+  TermDerivatives(rx, ru, dim_state_derivative, dim_action, dim_max,
+                  num_sensors, num_residual, dim_norm_residual, num_term,
+                  weights, values, 1, risk, T, slot);
+}
+
+// Gauss-Newton terms and risk transformation at one time step
+void CostDerivatives::TermDerivatives(
+    const double* rx, const double* ru, int dim_state_derivative,
+    int dim_action, int dim_max, int num_sensors, int num_residual,
+    const int* dim_norm_residual, int num_term, const double* weights,
+    const double* values, int value_stride, double risk, int T, int slot) {
+  // ----- term derivatives ----- //
+  int f_shift = 0;
+  int h_shift = 0;
+  double c = 0.0;
+  int* sx = DataAt(support_, slot * (dim_state_derivative + dim_action));
+  int* su = sx + dim_state_derivative;
+  for (int i = 0; i < num_term; i++) {
+    int nr = dim_norm_residual[i];
+    double weight = weights[i] / T;
+
+    // inactive terms (zero weight) add nothing, their Jacobian rows may not
+    // be computed
+    if (weight == 0.0) {
+      f_shift += nr;
+      h_shift += nr * nr;
+      continue;
+    }
+    const double* Cr = DataAt(cr, slot * num_residual + f_shift);
+    const double* Crr =
+        DataAt(crr, slot * num_residual * num_residual + h_shift);
+    const double* rxi = rx + slot * num_sensors * dim_state_derivative +
+                        f_shift * dim_state_derivative;
+    const double* rui =
+        ru + slot * num_sensors * dim_action + f_shift * dim_action;
+
+    // nonzero columns of the term's residual Jacobians
+    int nsx = 0;
+    for (int j = 0; j < dim_state_derivative; j++) {
+      for (int k = 0; k < nr; k++) {
+        if (rxi[k * dim_state_derivative + j] != 0.0) {
+          sx[nsx++] = j;
+          break;
         }
+      }
+    }
+    int nsu = 0;
+    for (int j = 0; j < dim_action; j++) {
+      for (int k = 0; k < nr; k++) {
+        if (rui[k * dim_action + j] != 0.0) {
+          su[nsu++] = j;
+          break;
+        }
+      }
+    }
 
-        double s = mju_exp(risk * c);
-
-        // cx
-        mju_scl(DataAt(cd.cx, t * dim_state_derivative),
-                DataAt(cd.cx, t * dim_state_derivative), s,
-                dim_state_derivative);
-
-        // cu
-        mju_scl(DataAt(cd.cu, t * dim_action), DataAt(cd.cu, t * dim_action), s,
-                dim_action);
-
-        // cxx
-        mju_scl(DataAt(cd.cxx, t * dim_state_derivative * dim_state_derivative),
-                DataAt(cd.cxx, t * dim_state_derivative * dim_state_derivative),
-                s, dim_state_derivative * dim_state_derivative);
-        mju_mulMatMat(DataAt(cd.cxx_scratch_,
-                             t * dim_state_derivative * dim_state_derivative),
-                      DataAt(cd.cx, t * dim_state_derivative),
-                      DataAt(cd.cx, t * dim_state_derivative),
-                      dim_state_derivative, 1, dim_state_derivative);
-        mju_scl(DataAt(cd.cxx_scratch_,
-                       t * dim_state_derivative * dim_state_derivative),
-                DataAt(cd.cxx_scratch_,
-                       t * dim_state_derivative * dim_state_derivative),
-                risk * s, dim_state_derivative * dim_state_derivative);
-        mju_addTo(
-            DataAt(cd.cxx, t * dim_state_derivative * dim_state_derivative),
-            DataAt(cd.cxx_scratch_,
-                   t * dim_state_derivative * dim_state_derivative),
-            dim_state_derivative * dim_state_derivative);
-
-        // cxu
-        mju_scl(DataAt(cd.cxu, t * dim_state_derivative * dim_action),
-                DataAt(cd.cxu, t * dim_state_derivative * dim_action), s,
-                dim_state_derivative * dim_action);
-        mju_mulMatMat(
-            DataAt(cd.cxu_scratch_, t * dim_state_derivative * dim_action),
-            DataAt(cd.cx, t * dim_state_derivative),
-            DataAt(cd.cu, t * dim_action), dim_state_derivative, 1, dim_action);
-        mju_scl(DataAt(cd.cxu_scratch_, t * dim_state_derivative * dim_action),
-                DataAt(cd.cxu_scratch_, t * dim_state_derivative * dim_action),
-                risk * s, dim_state_derivative * dim_action);
-        mju_addTo(
-            DataAt(cd.cxu, t * dim_state_derivative * dim_action),
-            DataAt(cd.cxu_scratch_, t * dim_state_derivative * dim_action),
-            dim_state_derivative * dim_action);
-
-        // cuu
-        mju_scl(DataAt(cd.cuu, t * dim_action * dim_action),
-                DataAt(cd.cuu, t * dim_action * dim_action), s,
-                dim_action * dim_action);
-        mju_mulMatMat(DataAt(cd.cuu_scratch_, t * dim_action * dim_action),
-                      DataAt(cd.cu, t * dim_action),
-                      DataAt(cd.cu, t * dim_action), dim_action, 1, dim_action);
-        mju_scl(DataAt(cd.cuu_scratch_, t * dim_action * dim_action),
-                DataAt(cd.cuu_scratch_, t * dim_action * dim_action), risk * s,
-                dim_action * dim_action);
-        mju_addTo(DataAt(cd.cuu, t * dim_action * dim_action),
-                  DataAt(cd.cuu_scratch_, t * dim_action * dim_action),
-                  dim_action * dim_action);
-      });
+    // Gauss-Newton terms over supported columns only
+    if (nsx < dim_state_derivative || nsu < dim_action) {
+      SparseProducts(
+          DataAt(cx, slot * dim_state_derivative),
+          DataAt(cu, slot * dim_action),
+          DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cuu, slot * dim_action * dim_action),
+          DataAt(cxu, slot * dim_state_derivative * dim_action), Cr, Crr,
+          DataAt(c_scratch_, slot * dim_max * dim_max), rxi, rui, nr,
+          dim_state_derivative, dim_action, sx, nsx, su, nsu, weight);
+    } else {
+      DenseProducts(
+          DataAt(cx, slot * dim_state_derivative),
+          DataAt(cu, slot * dim_action),
+          DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cuu, slot * dim_action * dim_action),
+          DataAt(cxu, slot * dim_state_derivative * dim_action), Cr, Crr,
+          DataAt(c_scratch_, slot * dim_max * dim_max),
+          DataAt(cx_scratch_, slot * dim_state_derivative),
+          DataAt(cu_scratch_, slot * dim_action),
+          DataAt(cxx_scratch_,
+                 slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cuu_scratch_, slot * dim_action * dim_action),
+          DataAt(cxu_scratch_, slot * dim_state_derivative * dim_action), rxi,
+          rui, nr, dim_state_derivative, dim_action, weight);
     }
-    pool.WaitCount(count_before + T);
+    c += weight * values[i * value_stride];
+
+    f_shift += nr;
+    h_shift += nr * nr;
   }
-  pool.ResetCount();
+
+  // ----- risk transformation ----- //
+  if (mju_abs(risk) < kRiskNeutralTolerance) {
+    return;
+  }
+
+  double s = mju_exp(risk * c);
+
+  // cx
+  mju_scl(DataAt(cx, slot * dim_state_derivative),
+          DataAt(cx, slot * dim_state_derivative), s,
+          dim_state_derivative);
+
+  // cu
+  mju_scl(DataAt(cu, slot * dim_action), DataAt(cu, slot * dim_action), s,
+          dim_action);
+
+  // cxx
+  mju_scl(DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+          s, dim_state_derivative * dim_state_derivative);
+  mju_mulMatMat(DataAt(cxx_scratch_,
+                       slot * dim_state_derivative * dim_state_derivative),
+                DataAt(cx, slot * dim_state_derivative),
+                DataAt(cx, slot * dim_state_derivative),
+                dim_state_derivative, 1, dim_state_derivative);
+  mju_scl(DataAt(cxx_scratch_,
+                 slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cxx_scratch_,
+                 slot * dim_state_derivative * dim_state_derivative),
+          risk * s, dim_state_derivative * dim_state_derivative);
+  mju_addTo(
+      DataAt(cxx, slot * dim_state_derivative * dim_state_derivative),
+      DataAt(cxx_scratch_,
+             slot * dim_state_derivative * dim_state_derivative),
+      dim_state_derivative * dim_state_derivative);
+
+  // cxu
+  mju_scl(DataAt(cxu, slot * dim_state_derivative * dim_action),
+          DataAt(cxu, slot * dim_state_derivative * dim_action), s,
+          dim_state_derivative * dim_action);
+  mju_mulMatMat(
+      DataAt(cxu_scratch_, slot * dim_state_derivative * dim_action),
+      DataAt(cx, slot * dim_state_derivative),
+      DataAt(cu, slot * dim_action), dim_state_derivative, 1, dim_action);
+  mju_scl(DataAt(cxu_scratch_, slot * dim_state_derivative * dim_action),
+          DataAt(cxu_scratch_, slot * dim_state_derivative * dim_action),
+          risk * s, dim_state_derivative * dim_action);
+  mju_addTo(
+      DataAt(cxu, slot * dim_state_derivative * dim_action),
+      DataAt(cxu_scratch_, slot * dim_state_derivative * dim_action),
+      dim_state_derivative * dim_action);
+
+  // cuu
+  mju_scl(DataAt(cuu, slot * dim_action * dim_action),
+          DataAt(cuu, slot * dim_action * dim_action), s,
+          dim_action * dim_action);
+  mju_mulMatMat(DataAt(cuu_scratch_, slot * dim_action * dim_action),
+                DataAt(cu, slot * dim_action),
+                DataAt(cu, slot * dim_action), dim_action, 1, dim_action);
+  mju_scl(DataAt(cuu_scratch_, slot * dim_action * dim_action),
+          DataAt(cuu_scratch_, slot * dim_action * dim_action), risk * s,
+          dim_action * dim_action);
+  mju_addTo(DataAt(cuu, slot * dim_action * dim_action),
+            DataAt(cuu_scratch_, slot * dim_action * dim_action),
+            dim_action * dim_action);
 }
 
 }  // namespace mjpc
@@ -15,6 +15,7 @@
 #ifndef MJPC_PLANNERS_COST_DERIVATIVES_H_
 #define MJPC_PLANNERS_COST_DERIVATIVES_H_
 
+#include <cstddef>
 #include <vector>
 
 #include "mjpc/norm.h"
@@ -37,6 +38,9 @@ class CostDerivatives {
   void Allocate(int dim_state_derivative, int dim_action, int dim_residual,
                 int T, int dim_max);
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int dim_state_derivative, int dim_action, int dim_residual, int T);
 
@@ -49,7 +53,8 @@ class CostDerivatives {
                         const double* ru, int nr, int nx, int dim_action,
                         double weight, const double* p, NormType type);
 
-  // compute derivatives at all time steps
+  // compute derivatives at all time steps. terms with zero weight are
+  // skipped, their rows of rx and ru are not read.
   void Compute(double* r, double* rx, double* ru, int dim_state_derivative,
                int dim_action, int dim_max, int num_sensors, int num_residual,
                const int* dim_norm_residual, int num_term,
@@ -57,9 +62,28 @@ class CostDerivatives {
                const double* parameters, const int* num_norm_parameter,
                double risk, int T, ThreadPool& pool);
 
+  // compute derivatives at time step t with the arguments of Compute. memory
+  // must be reset first, unless window > 0. steps can be computed
+  // concurrently. rx and ru are read and the derivatives are stored at
+  // Slot(t).
+  void ComputeStep(double* r, double* rx, double* ru, int dim_state_derivative,
+                   int dim_action, int dim_max, int num_sensors,
+                   int num_residual, const int* dim_norm_residual,
+                   int num_term, const double* weights, const NormType* norms,
+                   const double* parameters, const int* num_norm_parameter,
+                   double risk, int T, int t);
+
+  // storage index of time step t
+  int Slot(int t) const { return window > 0 ? t % window : t; }
+
+  // with window > 0, ComputeStep stores the derivatives of time step t at
+  // t % window, zeroed before they are computed, like the model Jacobians of
+  // ModelDerivatives::window. Compute requires window = 0.
+  int window = 0;
+
   std::vector<double> cr;   // norm gradient wrt residual
                             //   (T * dim_residual)
-  std::vector<double> crr;  // norm Hessian wrt residual
+  std::vector<double> crr;  // norm Hessian wrt residual, term blocks packed
                             //   (T * dim_residual * dim_residual)
   std::vector<double> cx;   // cost gradient wrt state
                             //   (T * dim_state_derivative)
@@ -74,6 +98,32 @@ class CostDerivatives {
                             //   ((T - 1) * dim_state_derivative * dim_action)
 
  private:
+  // Gauss-Newton terms of one cost term, given the norm gradient Cr and
+  // Hessian Crr
+  void DenseProducts(double* Cx, double* Cu, double* Cxx, double* Cuu,
+                     double* Cxu, const double* Cr, const double* Crr,
+                     double* C_scratch, double* Cx_scratch, double* Cu_scratch,
+                     double* Cxx_scratch, double* Cuu_scratch,
+                     double* Cxu_scratch, const double* rx, const double* ru,
+                     int nr, int nx, int dim_action, double weight);
+
+  // DenseProducts over the nonzero columns sx of rx and su of ru, used when
+  // the residual Jacobians have zero columns
+  void SparseProducts(double* Cx, double* Cu, double* Cxx, double* Cuu,
+                      double* Cxu, const double* Cr, const double* Crr,
+                      double* C_scratch, const double* rx, const double* ru,
+                      int nr, int nx, int dim_action, const int* sx, int nsx,
+                      const int* su, int nsu, double weight);
+
+  // derivatives at storage index slot from norm derivatives in cr and crr,
+  // term i's norm value at values[i * value_stride]
+  void TermDerivatives(const double* rx, const double* ru,
+                       int dim_state_derivative, int dim_action, int dim_max,
+                       int num_sensors, int num_residual,
+                       const int* dim_norm_residual, int num_term,
+                       const double* weights, const double* values,
+                       int value_stride, double risk, int T, int slot);
+
   // scratch spaces
   std::vector<double> c_scratch_;    // (T * dim_max * dim_max)
   std::vector<double> cx_scratch_;   // (T * dim_state_derivative)
@@ -82,6 +132,12 @@ class CostDerivatives {
                                      //  dim_state_derivative)
   std::vector<double> cuu_scratch_;  // (T * dim_action * dim_action)
   std::vector<double> cxu_scratch_;  // (T * dim_state_derivative * dim_action)
+  std::vector<double> norm_value_;   // (num_term * T)
+  std::vector<int> term_shift_;      // residual, parameter, and norm Hessian
+                                     //   offsets (3 * num_term)
+  std::vector<int> support_;         // nonzero residual Jacobian columns
+                                     //   (T * (dim_state_derivative +
+                                     //    dim_action))
 };
 
 }  // namespace mjpc
@@ -17,16 +17,20 @@
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <limits>
 #include <shared_mutex>
 
-#include <absl/random/random.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/rollout_backend.h"
 #include "mjpc/planners/sampling/planner.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -54,6 +58,27 @@ void CrossEntropyPlanner::Initialize(mjModel* model, const Task& task) {
                          "sampling_exploration");        // initial variance
   std_min_ = GetNumberOrDefault(0.1, model, "std_min");  // minimum variance
 
+  // noise seed
+  noise_seed = GetNumberOrDefault(0, model, "sampling_seed");
+
+  // noise sampling mode and correlation across spline points
+  noise_sampling_ = std::clamp(
+      static_cast<int>(GetNumberOrDefault(0, model, "sampling_noise")),
+      static_cast<int>(kIndependentNoise), static_cast<int>(kSobolNoise));
+  noise_correlation_ = std::clamp(
+      GetNumberOrDefault(0.0, model, "sampling_noise_correlation"), 0.0, 1.0);
+  noise_iteration_ = 0;
+
+  // stop rollouts that cannot become elite
+  pruning_ = GetNumberOrDefault(0, model, "sampling_pruning");
+
+  // successive halving of the samples at checkpoints of the horizon
+  halving_ = GetNumberOrDefault(0, model, "cross_entropy_halving");
+  halving_rungs_ = std::max(
+      GetNumberOrDefault(2, model, "cross_entropy_halving_rungs"), 1);
+  halving_keep_ = std::clamp(
+      GetNumberOrDefault(0.5, model, "cross_entropy_halving_keep"), 0.0, 1.0);
+
   // set number of trajectories to rollout
   num_trajectory_ = GetNumberOrDefault(10, model, "sampling_trajectories");
 
@@ -65,6 +90,10 @@ void CrossEntropyPlanner::Initialize(mjModel* model, const Task& task) {
     mju_error_i("Too many trajectories, %d is the maximum allowed.",
                 kMaxTrajectory);
   }
+
+  // trajectories are allocated on demand
+  num_allocated_trajectory_ = 0;
+  allocated_horizon_ = 0;
 }
 
 // allocate memory
@@ -87,25 +116,18 @@ void CrossEntropyPlanner::Allocate() {
   parameters_scratch.resize(num_max_parameter);
   times_scratch.resize(kMaxTrajectoryHorizon);
 
-  // noise
-  noise.resize(kMaxTrajectory * (model->nu * kMaxTrajectoryHorizon));
-
   // variance
   variance.resize(model->nu * kMaxTrajectoryHorizon);  // (nu * horizon)
 
   // need to initialize an arbitrary order of the trajectories
   trajectory_order.resize(kMaxTrajectory);
+  trajectory_return.resize(kMaxTrajectory);
   for (int i = 0; i < kMaxTrajectory; i++) {
     trajectory_order[i] = i;
   }
 
-  // trajectories and parameters
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Initialize(num_state, model->nu, task->num_residual,
-                             task->num_trace, kMaxTrajectoryHorizon);
-    trajectory[i].Allocate(kMaxTrajectoryHorizon);
-    candidate_policy[i].Allocate(model, *task, kMaxTrajectoryHorizon);
-  }
+  // trajectories, parameters, and noise are allocated when first rolled out
+  ResizeTrajectories(0, 1);
 
   // elite average trajectory
   elite_avg.Initialize(num_state, model->nu, task->num_residual,
@@ -113,6 +135,14 @@ void CrossEntropyPlanner::Allocate() {
   elite_avg.Allocate(kMaxTrajectoryHorizon);
 }
 
+// grow trajectories, candidate policies, and noise to cover num_trajectory
+// rollouts of horizon steps. storage is never shrunk.
+void CrossEntropyPlanner::ResizeTrajectories(int num_trajectory, int horizon) {
+  GrowSampledTrajectories(model, *task, num_trajectory, horizon, trajectory,
+                          candidate_policy, &noise, &num_allocated_trajectory_,
+                          &allocated_horizon_, trajectory_mtx_);
+}
+
 // reset memory to zeros
 void CrossEntropyPlanner::Reset(int horizon,
                                 const double* initial_repeated_action) {
@@ -126,6 +156,7 @@ void CrossEntropyPlanner::Reset(int horizon,
   policy.Reset(horizon, initial_repeated_action);
   resampled_policy.Reset(horizon, initial_repeated_action);
   previous_policy.Reset(horizon, initial_repeated_action);
+  published_policy_.Publish(policy, previous_policy);
 
   // scratch
   std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
@@ -133,22 +164,21 @@ void CrossEntropyPlanner::Reset(int horizon,
 
   // noise
   std::fill(noise.begin(), noise.end(), 0.0);
+  for (int i = 0; i < kMaxTrajectory; i++) {
+    noise_stream[i].Seed(noise_seed, i);
+  }
 
   // variance
   double var = std_initial_ * std_initial_;
   std::fill(variance.begin(), variance.end(), var);
 
-  // trajectory samples
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Reset(kMaxTrajectoryHorizon);
+  // trajectory samples, allocated only
+  ForEachAllocation(num_allocated_trajectory_, [&](int i) {
+    trajectory[i].Reset(allocated_horizon_);
     candidate_policy[i].Reset(horizon);
-  }
+  });
   elite_avg.Reset(kMaxTrajectoryHorizon);
 
-  for (const auto& d : data_) {
-    mju_zero(d->ctrl, model->nu);
-  }
-
   // improvement
   improvement = 0.0;
 }
@@ -159,11 +189,72 @@ void CrossEntropyPlanner::SetState(const State& state) {
                &this->time);
 }
 
+// warm start the nominal policy from another planner's trajectory
+void CrossEntropyPlanner::WarmStart(const Trajectory& trajectory) {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.SetFromTrajectory(trajectory);
+}
+
+void CrossEntropyPlanner::Snapshot(SnapshotWriter& writer) const {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.Snapshot(writer, "cross_entropy.policy");
+  writer.Add("cross_entropy.variance", variance.data(),
+             policy.num_spline_points * model->nu);
+}
+
+bool CrossEntropyPlanner::Restore(const SnapshotReader& reader) {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    if (!policy.Restore(reader, "cross_entropy.policy")) return false;
+    previous_policy = policy;
+  }
+  published_policy_.Publish(policy, previous_policy);
+
+  // sampling variance, if it matches the knots
+  reader.Read("cross_entropy.variance", variance.data(),
+              policy.num_spline_points * model->nu);
+  return true;
+}
+
+void CrossEntropyPlanner::LogIteration(PlanLogRecord& record, bool samples) const {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    record.parameters.assign(
+        policy.parameters.begin(),
+        policy.parameters.begin() + policy.num_spline_points * model->nu);
+  }
+  const std::shared_lock<std::shared_mutex> lock(trajectory_mtx_);
+  LogSamples(record, trajectory,
+             std::min(num_trajectory_, num_allocated_trajectory_), samples);
+}
+
+void CrossEntropyPlanner::ReportMemory(MemoryReport& report) const {
+  std::size_t trajectories = elite_avg.Bytes();
+  std::size_t policies = policy.Bytes() + resampled_policy.Bytes() +
+                         previous_policy.Bytes() +
+                         VectorBytes(parameters_scratch, times_scratch);
+  std::size_t checkpoints = VectorBytes(running_);
+  for (int i = 0; i < kMaxTrajectory; i++) {
+    trajectories += trajectory[i].Bytes();
+    policies += candidate_policy[i].Bytes();
+    checkpoints += VectorBytes(checkpoint_[i]);
+  }
+  report.Add("trajectories", trajectories);
+  report.Add("policies", policies);
+  report.Add("checkpoints", checkpoints);
+  report.Add("noise", VectorBytes(noise, variance));
+  report.Add("scratch", VectorBytes(state, mocap, userdata, trajectory_order,
+                                    trajectory_return));
+}
+
 // optimize nominal policy using random sampling
 void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
+  counters_.Reset();
+
   // check horizon
   if (horizon != elite_avg.horizon) {
     NominalTrajectory(horizon, pool);
+    counters_.AddRollout(elite_avg);
   }
 
   // if num_trajectory_ has changed, use it in this new iteration.
@@ -176,7 +267,8 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   int n_elite = std::min(n_elite_, num_trajectory);
 
   // resize number of mjData
-  ResizeMjData(model, pool.NumThreads());
+  ResizeMjData(model, pool.NumThreads(), &pool);
+  ResizeTrajectories(num_trajectory, horizon);
 
   // copy nominal policy
   policy.num_parameters = model->nu * policy.num_spline_points;
@@ -190,39 +282,26 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 
   // ----- rollout noisy policies ----- //
   // start timer
-  auto rollouts_start = std::chrono::steady_clock::now();
+  TraceSpan rollouts_span("CrossEntropyPlanner::rollouts");
 
-  // simulate noisy policies
+  // simulate noisy policies, pruning against the n_elite-th best
+  return_bound_.Reset(n_elite);
   this->Rollouts(num_trajectory, horizon, pool);
 
-  // sort candidate policies and trajectories by score
-  for (int i = 0; i < num_trajectory; i++) {
-    trajectory_order[i] = i;
-  }
-
-  // sort so that the first ncandidates elements are the best candidates, and
-  // the rest are in an unspecified order
-  std::partial_sort(
-      trajectory_order.begin(), trajectory_order.begin() + num_trajectory,
-      trajectory_order.begin() + num_trajectory,
-      [&trajectory = trajectory](int a, int b) {
-        return trajectory[a].total_return < trajectory[b].total_return;
-      });
+  // select elite candidate policies and trajectories, best first
+  SelectTrajectories(trajectory_order.data(), trajectory_return.data(),
+                     trajectory, num_trajectory, n_elite);
 
   // stop timer
-  rollouts_compute_time = GetDuration(rollouts_start);
+  rollouts_compute_time = rollouts_span.End();
 
   // ----- update policy ----- //
   // start timer
-  auto policy_update_start = std::chrono::steady_clock::now();
+  TraceSpan policy_update_span("CrossEntropyPlanner::policy_update");
 
   // dimensions
-  int num_spline_points = resampled_policy.num_spline_points;
   int num_parameters = resampled_policy.num_parameters;
 
-  // reset parameters scratch to zero
-  std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
-
   // reset elite average
   elite_avg.Reset(horizon);
 
@@ -234,10 +313,6 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   // best elite
   int idx = trajectory_order[0];
 
-  // add parameters
-  mju_copy(parameters_scratch.data(), candidate_policy[idx].parameters.data(),
-           num_parameters);
-
   // copy first elite trajectory
   mju_copy(elite_avg.actions.data(), trajectory[idx].actions.data(),
            model->nu * (horizon - 1));
@@ -253,10 +328,6 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
     // ordered trajectory index
     int idx = trajectory_order[i];
 
-    // add parameters
-    mju_addTo(parameters_scratch.data(),
-              candidate_policy[idx].parameters.data(), num_parameters);
-
     // add elite trajectory
     mju_addTo(elite_avg.actions.data(), trajectory[idx].actions.data(),
               model->nu * (horizon - 1));
@@ -269,8 +340,6 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   }
 
   // normalize
-  mju_scl(parameters_scratch.data(), parameters_scratch.data(), 1.0 / n_elite,
-          num_parameters);
   mju_scl(elite_avg.actions.data(), elite_avg.actions.data(), 1.0 / n_elite,
           model->nu * (horizon - 1));
   mju_scl(elite_avg.trace.data(), elite_avg.trace.data(), 1.0 / n_elite,
@@ -281,27 +350,30 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
           horizon);
   elite_avg.total_return /= n_elite;
 
-  // loop over elites to compute variance
-  std::fill(variance.begin(), variance.end(), 0.0);  // reset variance to zero
-  for (int t = 0; t < num_spline_points; t++) {
-    for (int j = 0; j < model->nu; j++) {
-      // average
-      double p_avg = parameters_scratch[t * model->nu + j];
-      for (int i = 0; i < n_elite; i++) {
-        // candidate parameter
-        double pi =
-            candidate_policy[trajectory_order[i]].parameters[t * model->nu + j];
-        double diff = pi - p_avg;
-        variance[t * model->nu + j] += diff * diff / (n_elite - 1);
-      }
+  // elite parameter mean and variance in one pass (Welford)
+  std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
+  std::fill(variance.begin(), variance.end(), 0.0);
+  double* mean = parameters_scratch.data();
+  double* m2 = variance.data();
+  for (int i = 0; i < n_elite; i++) {
+    const double* p = candidate_policy[trajectory_order[i]].parameters.data();
+    double weight = 1.0 / (i + 1);
+    for (int k = 0; k < num_parameters; k++) {
+      double diff = p[k] - mean[k];
+      mean[k] += weight * diff;
+      m2[k] += diff * (p[k] - mean[k]);
     }
   }
+  if (n_elite > 1) {
+    mju_scl(m2, m2, 1.0 / (n_elite - 1), num_parameters);
+  }
 
   // update
   {
     const std::shared_lock<std::shared_mutex> lock(mtx_);
     policy.CopyParametersFrom(parameters_scratch, times_scratch);
   }
+  published_policy_.Publish(policy, previous_policy);
 
   // improvement: compare nominal to elite average
   improvement = mju_max(
@@ -309,33 +381,40 @@ void CrossEntropyPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
       0.0);
 
   // stop timer
-  policy_update_compute_time = GetDuration(policy_update_start);
+  policy_update_compute_time = policy_update_span.End();
 }
 
 // compute trajectory using nominal policy
 void CrossEntropyPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
-  // set policy
-  auto nominal_policy = [&cp = resampled_policy](
-                            double* action, const double* state, double time) {
-    cp.Action(action, state, time);
-  };
+  // keep sample traces at least as long as the nominal
+  ResizeTrajectories(0, horizon);
 
   // rollout nominal policy
-  elite_avg.Rollout(nominal_policy, task, model, data_[0].get(), state.data(),
-                    time, mocap.data(), userdata.data(), horizon);
+  elite_avg.Rollout(resampled_policy, task, model, data_[0],
+                    state.data(), time, mocap.data(), userdata.data(),
+                    horizon);
 }
 
 // set action from policy
 void CrossEntropyPlanner::ActionFromPolicy(double* action, const double* state,
                                            double time, bool use_previous) {
-  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  auto published = published_policy_.Latest();
+  if (!published) return;
   if (use_previous) {
-    previous_policy.Action(action, state, time);
+    published->previous_policy.Action(action, state, time);
   } else {
-    policy.Action(action, state, time);
+    published->policy.Action(action, state, time);
   }
 }
 
+bool CrossEntropyPlanner::ExportPolicy(ExportedPolicy& policy) const {
+  auto published = published_policy_.Latest();
+  if (!published) return false;
+  published->policy.Export(policy);
+  policy.version = published->version;
+  return true;
+}
+
 // update policy via resampling
 void CrossEntropyPlanner::ResamplePolicy(int horizon) {
   // dimensions
@@ -350,10 +429,10 @@ void CrossEntropyPlanner::ResamplePolicy(int horizon) {
   // get spline points
   for (int t = 0; t < num_spline_points; t++) {
     times_scratch[t] = nominal_time;
-    resampled_policy.Action(DataAt(parameters_scratch, t * model->nu), nullptr,
-                            nominal_time);
     nominal_time += time_shift;
   }
+  resampled_policy.Actions(parameters_scratch.data(), times_scratch.data(),
+                            num_spline_points);
 
   // copy resampled policy parameters
   mju_copy(resampled_policy.parameters.data(), parameters_scratch.data(),
@@ -368,15 +447,12 @@ void CrossEntropyPlanner::ResamplePolicy(int horizon) {
 // add random noise to nominal policy
 void CrossEntropyPlanner::AddNoiseToPolicy(int i, double std_min) {
   // start timer
-  auto noise_start = std::chrono::steady_clock::now();
+  TraceSpan noise_span("CrossEntropyPlanner::noise");
 
   // dimensions
   int num_spline_points = candidate_policy[i].num_spline_points;
   int num_parameters = candidate_policy[i].num_parameters;
 
-  // sampling token
-  absl::BitGen gen_;
-
   // shift index
   int shift = i * (model->nu * kMaxTrajectoryHorizon);
 
@@ -384,9 +460,13 @@ void CrossEntropyPlanner::AddNoiseToPolicy(int i, double std_min) {
   // variance[k] is the standard deviation for the k^th control parameter over
   // the elite samples we draw a bunch of control actions from this distribution
   // (which i indexes) - the noise is stored in `noise`.
+  // every candidate is perturbed, so batch samples start at 1
+  double* sample = DataAt(noise, shift);
+  BatchGaussian(sample, num_parameters, 1.0, noise_sampling_, i + 1,
+                noise_seed, noise_iteration_, noise_stream[i]);
+  CorrelateRows(sample, num_spline_points, model->nu, noise_correlation_);
   for (int k = 0; k < num_parameters; k++) {
-    noise[k + shift] = absl::Gaussian<double>(
-        gen_, 0.0, std::max(std::sqrt(variance[k]), std_min));
+    sample[k] *= std::max(std::sqrt(variance[k]), std_min);
   }
 
   // add noise
@@ -400,7 +480,7 @@ void CrossEntropyPlanner::AddNoiseToPolicy(int i, double std_min) {
   }
 
   // end timer
-  IncrementAtomic(noise_compute_time, GetDuration(noise_start));
+  IncrementAtomic(noise_compute_time, noise_span.End());
 }
 
 // compute candidate trajectories
@@ -409,45 +489,108 @@ void CrossEntropyPlanner::Rollouts(int num_trajectory, int horizon,
   // reset noise compute time
   noise_compute_time = 0.0;
 
+  // new noise for antithetic and Sobol sampling
+  noise_iteration_++;
+
   // lock std_min
   double std_min = std_min_;
 
+  // copy nominal policy and sample noise
+  auto sample_policy = [&, &s = *this](int i) {
+    const std::shared_lock<std::shared_mutex> lock(s.mtx_);
+    s.candidate_policy[i].CopyFrom(s.resampled_policy,
+                                   s.resampled_policy.num_spline_points);
+    s.candidate_policy[i].representation = s.resampled_policy.representation;
+    s.AddNoiseToPolicy(i, std_min);
+    return true;
+  };
+
   // random search
-  int count_before = pool.GetCount();
+  Trajectory* trajectories[kMaxTrajectory];
+  const SamplingPolicy* policies[kMaxTrajectory];
   for (int i = 0; i < num_trajectory; i++) {
-    pool.Schedule([&s = *this, &model = this->model, &task = this->task,
-                   &state = this->state, &time = this->time,
-                   &mocap = this->mocap, &userdata = this->userdata, horizon,
-                   std_min, i]() {
-      // copy nominal policy and sample noise
-      {
-        const std::shared_lock<std::shared_mutex> lock(s.mtx_);
-        s.candidate_policy[i].CopyFrom(s.resampled_policy,
-                                       s.resampled_policy.num_spline_points);
-        s.candidate_policy[i].representation =
-            s.resampled_policy.representation;
-
-        // sample noise
-        s.AddNoiseToPolicy(i, std_min);
-      }
-
-      // ----- rollout sample policy ----- //
+    trajectories[i] = &trajectory[i];
+    policies[i] = &candidate_policy[i];
+  }
+  if (halving_) {
+    HalvingRollouts(num_trajectory, horizon, sample_policy, pool);
+    return;
+  }
 
-      // policy
-      auto sample_policy_i = [&candidate_policy = s.candidate_policy, &i](
-                                 double* action, const double* state,
-                                 double time) {
-        candidate_policy[i].Action(action, state, time);
-      };
+  RolloutBatch batch;
+  batch.task = task;
+  batch.model = model;
+  batch.state = state.data();
+  batch.mocap = mocap.data();
+  batch.userdata = userdata.data();
+  batch.time = time;
+  batch.steps = horizon;
+  batch.num_rollouts = num_trajectory;
+  batch.policies = policies;
+  batch.trajectories = trajectories;
+  batch.bound = pruning_ ? &return_bound_ : nullptr;
+  batch.counters = &counters_;
+  batch.data = data_.data();
+  Backend().Rollouts(batch, sample_policy, pool);
+}
 
-      // policy rollout
-      s.trajectory[i].Rollout(
-          sample_policy_i, task, model, s.data_[ThreadPool::WorkerId()].get(),
-          state.data(), time, mocap.data(), userdata.data(), horizon);
+void CrossEntropyPlanner::HalvingRollouts(
+    int num_trajectory, int horizon,
+    absl::FunctionRef<bool(int)> sample_policy, ThreadPool& pool) {
+  ReturnBound* bound = pruning_ ? &return_bound_ : nullptr;
+  int n_elite = std::min(n_elite_, num_trajectory);
+  int rungs = halving_rungs_;
+  running_.resize(num_trajectory);
+  for (int i = 0; i < num_trajectory; i++) running_[i] = i;
+
+  int begin = 0;
+  for (int rung = 0; rung <= rungs; rung++) {
+    // the last segment finishes the rollouts
+    int end = rung == rungs ? horizon - 1
+                            : (rung + 1) * (horizon - 1) / (rungs + 1);
+    if (end <= begin) continue;
+    pool.ParallelFor(0, static_cast<int>(running_.size()), 1, [&](int j) {
+      int i = running_[j];
+      if (begin == 0) sample_policy(i);
+      Trajectory& sample = trajectory[i];
+      sample.RolloutSegment(candidate_policy[i], task, model,
+                            data_[ThreadPool::WorkerId()], state.data(), time,
+                            mocap.data(), userdata.data(), horizon, begin,
+                            end, checkpoint_[i], bound);
+      if (end == horizon - 1 || sample.failure || sample.pruned) {
+        counters_.AddRollout(sample);
+      }
     });
+    if (end == horizon - 1) break;
+
+    // samples that failed or were pruned are finished
+    running_.erase(std::remove_if(running_.begin(), running_.end(),
+                                  [&](int i) {
+                                    return trajectory[i].failure ||
+                                           trajectory[i].pruned;
+                                  }),
+                   running_.end());
+
+    // continue the best, drop the others
+    int num_running = running_.size();
+    int keep = std::min(
+        num_running,
+        std::max(n_elite, static_cast<int>(
+                              std::ceil(halving_keep_ * num_running))));
+    auto partial_return = [&](int a, int b) {
+      return trajectory[a].PartialReturn() < trajectory[b].PartialReturn();
+    };
+    std::nth_element(running_.begin(), running_.begin() + keep,
+                     running_.end(), partial_return);
+    for (int j = keep; j < num_running; j++) {
+      Trajectory& sample = trajectory[running_[j]];
+      sample.pruned = true;
+      sample.total_return = std::numeric_limits<double>::infinity();
+      counters_.AddRollout(sample);
+    }
+    running_.resize(keep);
+    begin = end;
   }
-  pool.WaitCount(count_before + num_trajectory);
-  pool.ResetCount();
 }
 
 // returns the nominal trajectory (this is the purple trace)
@@ -465,39 +608,21 @@ void CrossEntropyPlanner::Traces(mjvScene* scn) {
   // width of a sample trace, in pixels
   double width = GetNumberOrDefault(3, model, "agent_sample_width");
 
-  // scratch
-  double zero3[3] = {0};
-  double zero9[9] = {0};
-
   // best
   auto best = this->BestTrajectory();
 
-  // sample traces
-  int n_elite = n_elite_;
-  for (int k = 0; k < n_elite; k++) {
-    // plot sample
-    for (int i = 0; i < best->horizon - 1; i++) {
-      if (scn->ngeom + task->num_trace > scn->maxgeom) break;
-      for (int j = 0; j < task->num_trace; j++) {
-        // initialize geometry
-        mjv_initGeom(&scn->geoms[scn->ngeom], mjGEOM_LINE, zero3, zero3, zero9,
-                     color);
-
-        // elite index
-        int idx = trajectory_order[k];
-        // make geometry
-        mjv_makeConnector(
-            &scn->geoms[scn->ngeom], mjGEOM_LINE, width,
-            trajectory[idx].trace[3 * task->num_trace * i + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * i + 1 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * i + 2 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 1 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 2 + 3 * j]);
-
-        // increment number of geometries
-        scn->ngeom += 1;
-      }
+  // elite traces, ordered by return
+  const std::shared_lock<std::shared_mutex> lock(trajectory_mtx_);
+  int n_elite = std::min(n_elite_, static_cast<int>(trajectory_order.size()));
+  int num_samples = std::min(n_elite, trace_options_.max_samples);
+  for (int k = 0; k < num_samples; k++) {
+    // skip samples that have not been allocated
+    int idx = trajectory_order[k];
+    if (idx >= num_allocated_trajectory_) continue;
+
+    if (!AddTraceLines(scn, trajectory[idx], task->num_trace, best->horizon,
+                       trace_options_.stride, width, color)) {
+      break;
     }
   }
 }
@@ -512,6 +637,14 @@ void CrossEntropyPlanner::GUI(mjUI& ui) {
       {mjITEM_SLIDERNUM, "Init. Std", 2, &std_initial_, "0 1"},
       {mjITEM_SLIDERNUM, "Min. Std", 2, &std_min_, "0.01 0.5"},
       {mjITEM_SLIDERINT, "Elite", 2, &n_elite_, "2 128"},
+      {mjITEM_CHECKINT, "Pruning", 2, &pruning_, ""},
+      {mjITEM_CHECKINT, "Halving", 2, &halving_, ""},
+      {mjITEM_SELECT, "Noise", 2, &noise_sampling_,
+       "Independent\nAntithetic\nSobol"},
+      {mjITEM_SLIDERNUM, "Noise Corr.", 2, &noise_correlation_, "0 1"},
+      {mjITEM_SLIDERINT, "Trace Stride", 2, &trace_options_.stride, "1 10"},
+      {mjITEM_SLIDERINT, "Trace Samples", 2, &trace_options_.max_samples,
+       "0 128"},
       {mjITEM_END}};
 
   // set number of trajectory slider limits
@@ -579,4 +712,11 @@ void CrossEntropyPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   shift[1] += 3;
 }
 
+// compute times of the last iteration's phases
+std::vector<PhaseTime> CrossEntropyPlanner::PhaseTimes() const {
+  return {{"noise", noise_compute_time.load()},
+          {"rollouts", rollouts_compute_time},
+          {"policy_update", policy_update_compute_time}};
+}
+
 }  // namespace mjpc
@@ -15,13 +15,18 @@
 #ifndef MJPC_PLANNERS_CROSS_ENTROPY_PLANNER_H_
 #define MJPC_PLANNERS_CROSS_ENTROPY_PLANNER_H_
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <shared_mutex>
 #include <vector>
 
+#include <absl/functional/function_ref.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy_buffer.h"
 #include "mjpc/planners/sampling/policy.h"
+#include "mjpc/random.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
@@ -71,6 +76,18 @@ class CrossEntropyPlanner : public Planner {
   // compute candidate trajectories
   void Rollouts(int num_trajectory, int horizon, ThreadPool& pool);
 
+  // successive halving: every sample is rolled out to the first of
+  // halving_rungs_ checkpoints, evenly spaced in the horizon, where all but
+  // the best halving_keep_ of the running samples (at least n_elite) are
+  // dropped. the others continue from their checkpoint state to the next,
+  // until the end of the horizon. dropped samples have an infinite return.
+  void HalvingRollouts(int num_trajectory, int horizon,
+                       absl::FunctionRef<bool(int)> sample_policy,
+                       ThreadPool& pool);
+
+  // grow trajectory storage for num_trajectory rollouts of horizon steps
+  void ResizeTrajectories(int num_trajectory, int horizon);
+
   // return trajectory with best total return
   const Trajectory* BestTrajectory() override;
 
@@ -89,6 +106,31 @@ class CrossEntropyPlanner : public Planner {
     return policy.num_spline_points * policy.model->nu;
   };
 
+  // compute times of the last iteration's phases
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // rollouts of an iteration
+  int NumRollouts() const override { return num_trajectory_; }
+  void SetNumRollouts(int num_rollouts) override {
+    num_trajectory_ = std::clamp(num_rollouts, 2, kMaxTrajectory);
+  }
+
+  // warm start the nominal policy from another planner's trajectory
+  void WarmStart(const Trajectory& trajectory) override;
+
+  // snapshot of the nominal policy
+  void Snapshot(SnapshotWriter& writer) const override;
+  bool Restore(const SnapshotReader& reader) override;
+
+  // export the published policy
+  bool ExportPolicy(ExportedPolicy& policy) const override;
+
+  // nominal policy parameters and samples of the last iteration
+  void LogIteration(PlanLogRecord& record, bool samples) const override;
+
+  // bytes of the trajectories, policies and sampling buffers
+  void ReportMemory(MemoryReport& report) const override;
+
   // ----- members ----- //
   mjModel* model;
   const Task* task;
@@ -115,14 +157,25 @@ class CrossEntropyPlanner : public Planner {
 
   // order of indices of rolled out trajectories, ordered by total return
   std::vector<int> trajectory_order;
+  std::vector<double> trajectory_return;  // packed returns for ranking
 
   // ----- noise ----- //
   double std_initial_;  // standard deviation for sampling normal: N(0,
                         // std)
   double std_min_;      // the minimum allowable std
   std::vector<double> noise;
+
+  // noise streams, one per candidate
+  RandomStream noise_stream[kMaxTrajectory];
+  int noise_seed;
   std::vector<double> variance;
 
+  // noise sampling (NoiseSampling) and AR(1) correlation across spline
+  // points
+  int noise_sampling_;
+  double noise_correlation_;
+  std::uint64_t noise_iteration_;  // rollout batches, keys batch noise
+
   // number of elite samples
   int n_elite_;
 
@@ -139,6 +192,25 @@ class CrossEntropyPlanner : public Planner {
 
   int num_trajectory_;
   mutable std::shared_mutex mtx_;
+
+  // policies published to ActionFromPolicy
+  PolicyBuffer<SamplingPolicy> published_policy_;
+
+  // rollout pruning
+  int pruning_;
+  ReturnBound return_bound_;
+
+  // successive halving, see HalvingRollouts
+  int halving_;
+  int halving_rungs_;
+  double halving_keep_;
+  std::vector<double> checkpoint_[kMaxTrajectory];  // simulation states
+  std::vector<int> running_;                        // scratch
+
+  // allocated trajectory storage (resized under trajectory_mtx_)
+  int num_allocated_trajectory_;
+  int allocated_horizon_;
+  mutable std::shared_mutex trajectory_mtx_;
 };
 
 }  // namespace mjpc
@@ -16,10 +16,13 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <shared_mutex>
+#include <vector>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/cost_derivatives.h"
 #include "mjpc/planners/gradient/gradient.h"
 #include "mjpc/planners/gradient/policy.h"
@@ -30,6 +33,7 @@
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -54,11 +58,30 @@ void GradientPlanner::Initialize(mjModel* model, const Task& task) {
   dim_state_derivative =
       2 * model->nv + model->na;    // state derivative dimension
   dim_action = model->nu;           // action dimension
-  dim_sensor = model->nsensordata;  // number of sensor values
   dim_max =
       mju_max(mju_max(mju_max(dim_state, dim_state_derivative), dim_action),
               model->nuser_sensor);
   num_trajectory = GetNumberOrDefault(32, model, "gradient_num_trajectory");
+  settings.fd_coloring =
+      GetNumberOrDefault(settings.fd_coloring, model, "gradient_fd_coloring");
+  settings.derivative_backend =
+      std::clamp(GetNumberOrDefault(settings.derivative_backend, model,
+                                    "gradient_derivative_backend"),
+                 0, kNumDerivativeBackend - 1);
+  model_derivative.backend = settings.derivative_backend;
+  settings.gradient_mode =
+      GetNumberOrDefault(settings.gradient_mode, model, "gradient_mode");
+  settings.residual_sensor_rows = GetNumberOrDefault(
+      settings.residual_sensor_rows, model, "gradient_residual_sensor_rows");
+
+  // differentiated sensor values, the cost only reads the residuals
+  dim_sensor = settings.residual_sensor_rows && task.num_residual > 0
+                   ? task.num_residual
+                   : model->nsensordata;
+
+  // per-worker scratch is allocated for the pool in ParameterGradient
+  fd_policy_.clear();
+  fd_trajectory_.clear();
 }
 
 // allocate memory
@@ -70,11 +93,11 @@ void GradientPlanner::Allocate() {
 
   // candidate trajectories
   winner = -1;
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
     trajectory[i].Initialize(dim_state, dim_action, task->num_residual,
                              task->num_trace, kMaxTrajectoryHorizon);
     trajectory[i].Allocate(kMaxTrajectoryHorizon);
-  }
+  });
 
   // model derivatives
   model_derivative.Allocate(dim_state_derivative, dim_action, dim_sensor,
@@ -93,9 +116,9 @@ void GradientPlanner::Allocate() {
   }
 
   // policy
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
     candidate_policy[i].Allocate(model, *task, kMaxTrajectoryHorizon);
-  }
+  });
   policy.Allocate(model, *task, kMaxTrajectoryHorizon);
   previous_policy.Allocate(model, *task, kMaxTrajectoryHorizon);
 
@@ -124,20 +147,20 @@ void GradientPlanner::Reset(int horizon,
   gradient.Reset(dim_state_derivative, dim_action, horizon);
 
   // policy
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
     candidate_policy[i].Reset(horizon, initial_repeated_action);
-  }
+  });
   policy.Reset(horizon, initial_repeated_action);
   previous_policy.Reset(horizon, initial_repeated_action);
+  published_policy_.Publish(policy, previous_policy);
 
   // scratch
   std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
   std::fill(times_scratch.begin(), times_scratch.end(), 0.0);
 
   // candidate trajectories
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Reset(horizon);
-  }
+  ForEachAllocation(kMaxTrajectory,
+                    [&](int i) { trajectory[i].Reset(horizon); });
 
   // values
   action_step = 0.0;
@@ -154,7 +177,8 @@ void GradientPlanner::SetState(const State& state) {
 
 // optimize nominal policy via gradient descent
 void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
-  ResizeMjData(model, pool.NumThreads());
+  ResizeMjData(model, pool.NumThreads(), &pool);
+  counters_.Reset();
   // timers
   double nominal_time = 0.0;
   double model_derivative_time = 0.0;
@@ -168,7 +192,7 @@ void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 
   // ---- nominal rollout ----- //
   // start timer
-  auto nominal_start = std::chrono::steady_clock::now();
+  TraceSpan nominal_span("GradientPlanner::nominal");
 
   // copy nominal policy
   policy.num_parameters = model->nu * policy.num_spline_points;
@@ -182,75 +206,88 @@ void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 
   // rollout nominal trajectory
   this->NominalTrajectory(horizon, pool);
+  counters_.AddRollout(trajectory[0]);
 
   // previous best cost
   double c_prev = trajectory[0].total_return;
 
   // stop timer
-  nominal_time = GetDuration(nominal_start);
+  nominal_time = nominal_span.End();
 
   // update policy
   double c_best = c_prev;
   for (int i = 0; i < settings.max_rollout; i++) {
-    // ----- model derivatives ----- //
-    // start timer
-    auto model_derivative_start = std::chrono::steady_clock::now();
-
-    // compute model and sensor Jacobians
-    model_derivative.Compute(
-        model, data_, trajectory[0].states.data(), trajectory[0].actions.data(),
-        trajectory[0].times.data(), dim_state, dim_state_derivative, dim_action,
-        dim_sensor, horizon, settings.fd_tolerance, settings.fd_mode, pool);
-
-    // stop timer
-    model_derivative_time += GetDuration(model_derivative_start);
-
-    // -----cost derivatives ----- //
-    // start timer
-    auto cost_derivative_start = std::chrono::steady_clock::now();
-
-    // compute cost derivatives
-    cost_derivative.Compute(
-        trajectory[0].residual.data(), model_derivative.C.data(),
-        model_derivative.D.data(), dim_state_derivative, dim_action, dim_max,
-        dim_sensor, task->num_residual, task->dim_norm_residual.data(),
-        task->num_term, task->weight.data(), task->norm.data(),
-        task->norm_parameter.data(), task->num_norm_parameter.data(),
-        task->risk, horizon, pool);
-
-    // stop timer
-    cost_derivative_time += GetDuration(cost_derivative_start);
-
-    // ----- gradient descent ----- //
-    // start timer
-    auto gradient_start = std::chrono::steady_clock::now();
-
-    // compute action derivatives
-    int gd_status = gradient.Compute(&candidate_policy[0], &model_derivative,
-                                     &cost_derivative, dim_state_derivative,
-                                     dim_action, horizon);
-
-    // compute spline mapping linear operator
-    mappings[policy.representation]->Compute(
-        candidate_policy[0].times, candidate_policy[0].num_spline_points,
-        trajectory[0].times.data(), trajectory[0].horizon - 1);
-
-    // compute total derivatives
-    mju_mulMatTVec(candidate_policy[0].parameter_update.data(),
-                   mappings[policy.representation]->Get(),
-                   candidate_policy[0].k.data(),
-                   model->nu * (trajectory[0].horizon - 1),
-                   model->nu * candidate_policy[0].num_spline_points);
-
-    // stop timer
-    gradient_time += GetDuration(gradient_start);
-
-    // check for failure
-    if (gd_status != 0) return;
+    if (UseParameterGradient()) {
+      // ----- parameter gradient ----- //
+      // start timer
+      TraceSpan gradient_span("GradientPlanner::gradient");
+
+      // finite differences of rollouts
+      this->ParameterGradient(horizon, pool);
+
+      // stop timer
+      gradient_time += gradient_span.End();
+    } else {
+      // ----- model derivatives ----- //
+      // start timer
+      TraceSpan model_derivative_span("GradientPlanner::model_derivative");
+
+      // compute model and sensor Jacobians
+      model_derivative.Compute(
+          model, data_, trajectory[0].states.data(),
+          trajectory[0].actions.data(), trajectory[0].times.data(), dim_state,
+          dim_state_derivative, dim_action, dim_sensor, horizon,
+          settings.fd_tolerance, settings.fd_mode, pool, settings.fd_coloring);
+      counters_.AddDerivatives(model_derivative.num_evaluated);
+
+      // stop timer
+      model_derivative_time += model_derivative_span.End();
+
+      // -----cost derivatives ----- //
+      // start timer
+      TraceSpan cost_derivative_span("GradientPlanner::cost_derivative");
+
+      // compute cost derivatives
+      cost_derivative.Compute(
+          trajectory[0].residual.data(), model_derivative.C.data(),
+          model_derivative.D.data(), dim_state_derivative, dim_action, dim_max,
+          dim_sensor, task->num_residual, task->dim_norm_residual.data(),
+          task->num_term, task->weight.data(), task->norm.data(),
+          task->norm_parameter.data(), task->num_norm_parameter.data(),
+          task->risk, horizon, pool);
+
+      // stop timer
+      cost_derivative_time += cost_derivative_span.End();
+
+      // ----- gradient descent ----- //
+      // start timer
+      TraceSpan gradient_span("GradientPlanner::gradient");
+
+      // compute action derivatives
+      int gd_status = gradient.Compute(&candidate_policy[0], &model_derivative,
+                                       &cost_derivative, dim_state_derivative,
+                                       dim_action, horizon);
+
+      // compute spline mapping linear operator
+      mappings[policy.representation]->Compute(
+          candidate_policy[0].times, candidate_policy[0].num_spline_points,
+          trajectory[0].times.data(), trajectory[0].horizon - 1);
+
+      // compute total derivatives
+      mappings[policy.representation]->ApplyTranspose(
+          candidate_policy[0].parameter_update.data(),
+          candidate_policy[0].k.data());
+
+      // stop timer
+      gradient_time += gradient_span.End();
+
+      // check for failure
+      if (gd_status != 0) return;
+    }
 
     // ----- rollout policy ----- //
     // start timer
-    auto rollouts_start = std::chrono::steady_clock::now();
+    TraceSpan rollouts_span("GradientPlanner::rollouts");
 
     // copy policy
     for (int i = 1; i < num_trajectory; i++) {
@@ -291,11 +328,11 @@ void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
     surprise = mju_min(mju_max(0, improvement / expected), 2);
 
     // stop timer
-    rollouts_time += GetDuration(rollouts_start);
+    rollouts_time += rollouts_span.End();
   }
 
   // update nominal policy
-  auto policy_update_start = std::chrono::steady_clock::now();
+  TraceSpan policy_update_span("GradientPlanner::policy_update");
 
   // check for improvement
   if (c_best >= c_prev) {
@@ -308,9 +345,10 @@ void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
     policy.CopyParametersFrom(candidate_policy[winner].parameters,
                               candidate_policy[winner].times);
   }
+  published_policy_.Publish(policy, previous_policy);
 
   // stop timer
-  policy_update_time += GetDuration(policy_update_start);
+  policy_update_time += policy_update_span.End();
 
   // set timers
   nominal_compute_time = nominal_time;
@@ -324,13 +362,14 @@ void GradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 // compute trajectory using nominal policy
 void GradientPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
   // nominal policy
+  candidate_policy[0].UpdateSpline();
   auto nominal_policy = [&cp = candidate_policy[0]](
                             double* action, const double* state, double time) {
-    cp.Action(action, state, time);
+    cp.SplineAction(action, time);
   };
 
   // nominal policy rollout
-  trajectory[0].Rollout(nominal_policy, task, model, data_[0].get(),
+  trajectory[0].Rollout(nominal_policy, task, model, data_[0],
                         state.data(), time, mocap.data(), userdata.data(),
                         horizon);
 }
@@ -338,14 +377,43 @@ void GradientPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
 // compute action from policy
 void GradientPlanner::ActionFromPolicy(double* action, const double* state,
                                        double time, bool use_previous) {
-  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  auto published = published_policy_.Latest();
+  if (!published) return;
   if (use_previous) {
-    previous_policy.Action(action, state, time);
+    published->previous_policy.Action(action, state, time);
   } else {
-    policy.Action(action, state, time);
+    published->policy.Action(action, state, time);
   }
 }
 
+bool GradientPlanner::ExportPolicy(ExportedPolicy& policy) const {
+  auto published = published_policy_.Latest();
+  if (!published) return false;
+  published->policy.Export(policy);
+  policy.version = published->version;
+  return true;
+}
+
+void GradientPlanner::ReportMemory(MemoryReport& report) const {
+  std::size_t trajectories = VectorBytes(fd_trajectory_);
+  std::size_t policies = policy.Bytes() + previous_policy.Bytes() +
+                         VectorBytes(parameters_scratch, times_scratch,
+                                     fd_policy_);
+  for (int i = 0; i < kMaxTrajectory; i++) {
+    trajectories += trajectory[i].Bytes();
+    policies += candidate_policy[i].Bytes();
+  }
+  for (const Trajectory& t : fd_trajectory_) trajectories += t.Bytes();
+  for (const GradientPolicy& p : fd_policy_) policies += p.Bytes();
+  report.Add("trajectories", trajectories);
+  report.Add("policies", policies);
+  report.Add("model_derivatives", model_derivative.Bytes());
+  report.Add("cost_derivatives", cost_derivative.Bytes());
+  report.Add("gradient", VectorBytes(gradient.Vx, gradient.Qx, gradient.Qu,
+                                     fd_return_, fd_failure_));
+  report.Add("scratch", VectorBytes(state, mocap, userdata));
+}
+
 // update policy for current time
 void GradientPlanner::ResamplePolicy(int horizon) {
   // dimensions
@@ -377,36 +445,98 @@ void GradientPlanner::ResamplePolicy(int horizon) {
 
 // compute candidate trajectories
 void GradientPlanner::Rollouts(int horizon, ThreadPool& pool) {
-  int count_before = pool.GetCount();
-  for (int i = 0; i < num_trajectory; i++) {
-    pool.Schedule([&data = data_, &trajectory = trajectory,
-                   &candidate_policy = candidate_policy,
-                   &linesearch_steps = linesearch_steps, &model = this->model,
-                   &task = this->task, &state = this->state, &time = this->time,
-                   &mocap = this->mocap, horizon, &userdata = this->userdata,
-                   i]() {
-      // scale improvement
-      mju_addScl(candidate_policy[i].parameters.data(),
-                 candidate_policy[i].parameters.data(),
-                 candidate_policy[i].parameter_update.data(),
-                 linesearch_steps[i],
-                 model->nu * candidate_policy[i].num_spline_points);
-
-      // policy
-      auto feedback_policy = [&candidate_policy = candidate_policy, i](
-                                 double* action, const double* state,
-                                 double time) {
-        candidate_policy[i].Action(action, state, time);
-      };
-
-      // policy rollout
-      trajectory[i].Rollout(feedback_policy, task, model,
-                            data[ThreadPool::WorkerId()].get(), state.data(),
-                            time, mocap.data(), userdata.data(), horizon);
-    });
+  pool.ParallelFor(0, num_trajectory, 1, [&, &data = data_](int i) {
+    // scale improvement
+    mju_addScl(candidate_policy[i].parameters.data(),
+               candidate_policy[i].parameters.data(),
+               candidate_policy[i].parameter_update.data(),
+               linesearch_steps[i],
+               model->nu * candidate_policy[i].num_spline_points);
+    candidate_policy[i].UpdateSpline();
+
+    // policy
+    auto feedback_policy = [&candidate_policy = candidate_policy, i](
+                               double* action, const double* state,
+                               double time) {
+      candidate_policy[i].SplineAction(action, time);
+    };
+
+    // policy rollout
+    trajectory[i].Rollout(feedback_policy, task, model,
+                          data[ThreadPool::WorkerId()], state.data(),
+                          time, mocap.data(), userdata.data(), horizon);
+    counters_.AddRollout(trajectory[i]);
+  });
+}
+
+// parameter gradient if cheaper than model derivatives
+bool GradientPlanner::UseParameterGradient() const {
+  if (settings.gradient_mode == 1) return false;
+  if (settings.gradient_mode == 2) return true;
+
+  // per time step, rollouts for each parameter vs. perturbations for each
+  // state and action
+  int num_parameters = model->nu * candidate_policy[0].num_spline_points;
+  return num_parameters < dim_state_derivative + dim_action;
+}
+
+// parameter gradient from finite differences of rollouts
+void GradientPlanner::ParameterGradient(int horizon, ThreadPool& pool) {
+  GradientPolicy& nominal = candidate_policy[0];
+  int num_parameters = model->nu * nominal.num_spline_points;
+  bool centered = settings.fd_mode == 1;
+  int num_rollouts = (centered ? 2 : 1) * num_parameters;
+  double eps = settings.fd_tolerance;
+
+  // per-worker scratch
+  int num_threads = pool.NumThreads();
+  for (int i = fd_policy_.size(); i < num_threads; i++) {
+    fd_policy_.emplace_back().Allocate(model, *task, kMaxTrajectoryHorizon);
+    Trajectory& rollout = fd_trajectory_.emplace_back();
+    rollout.Initialize(dim_state, dim_action, task->num_residual,
+                       task->num_trace, kMaxTrajectoryHorizon);
+    rollout.Allocate(kMaxTrajectoryHorizon);
   }
-  pool.WaitCount(count_before + num_trajectory);
-  pool.ResetCount();
+  fd_return_.resize(num_rollouts);
+  fd_failure_.resize(num_rollouts);
+
+  // perturbed rollouts: +eps, then -eps for the centered difference
+  pool.ParallelFor(0, num_rollouts, 1, [&](int j) {
+    int id = ThreadPool::WorkerId();
+    GradientPolicy& perturbed = fd_policy_[id];
+    perturbed.CopyFrom(nominal, nominal.num_spline_points);
+    perturbed.parameters[j % num_parameters] +=
+        j < num_parameters ? eps : -eps;
+    perturbed.UpdateSpline();
+
+    Trajectory& rollout = fd_trajectory_[id];
+    rollout.Rollout(
+        [&perturbed](double* action, const double* x, double t) {
+          perturbed.SplineAction(action, t);
+        },
+        task, model, data_[id], state.data(), time, mocap.data(),
+        userdata.data(), horizon);
+    fd_return_[j] = rollout.total_return;
+    fd_failure_[j] = rollout.failure;
+    counters_.AddRollout(rollout);
+  });
+
+  // gradient of the summed costs (the return is normalized by the horizon),
+  // as from the adjoint. parameters with a failed rollout are not updated.
+  double scale = trajectory[0].horizon;
+  double dV = 0.0;
+  for (int i = 0; i < num_parameters; i++) {
+    double slope = 0.0;
+    if (centered && !fd_failure_[i] && !fd_failure_[num_parameters + i]) {
+      slope = (fd_return_[i] - fd_return_[num_parameters + i]) / (2.0 * eps);
+    } else if (!centered && !fd_failure_[i]) {
+      slope = (fd_return_[i] - trajectory[0].total_return) / eps;
+    }
+    double g = scale * slope;
+    nominal.parameter_update[i] = -g;
+    dV -= g * g;
+  }
+  gradient.dV[0] = dV;
 }
 
 // return trajectory with best total return
@@ -426,35 +556,18 @@ void GradientPlanner::Traces(mjvScene* scn) {
   // width of a sample trace, in pixels
   double width = GetNumberOrDefault(3, model, "agent_sample_width");
 
-  // scratch
-  double zero3[3] = {0};
-  double zero9[9] = {0};
-
   // best
   auto best = this->BestTrajectory();
-
-  for (int k = 0; k < num_trajectory; k++) {
-    // plot sample
-    for (int i = 0; i < best->horizon - 1; i++) {
-      if (scn->ngeom + task->num_trace > scn->maxgeom) break;
-      for (int j = 0; j < task->num_trace; j++) {
-        // initialize geometry
-        mjv_initGeom(&scn->geoms[scn->ngeom], mjGEOM_LINE, zero3, zero3, zero9,
-                     color);
-
-        // make geometry
-        mjv_makeConnector(
-            &scn->geoms[scn->ngeom], mjGEOM_LINE, width,
-            trajectory[k].trace[3 * task->num_trace * i + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * i + 1 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * i + 2 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 1 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 2 + 3 * j]);
-
-        // increment number of geometries
-        scn->ngeom += 1;
-      }
+  if (!best) return;
+
+  // sample traces, lowest return first
+  std::vector<int> samples(num_trajectory);
+  for (int k = 0; k < num_trajectory; k++) samples[k] = k;
+  SelectTraceSamples(samples, trajectory, trace_options_.max_samples);
+  for (int k : samples) {
+    if (!AddTraceLines(scn, trajectory[k], task->num_trace, best->horizon,
+                       trace_options_.stride, width, color)) {
+      break;
     }
   }
 }
@@ -468,6 +581,11 @@ void GradientPlanner::GUI(mjUI& ui) {
       {mjITEM_SELECT, "Spline", 2, &policy.representation,
        "Zero\nLinear\nCubic"},
       {mjITEM_SLIDERINT, "Spline Pts", 2, &policy.num_spline_points, "0 1"},
+      {mjITEM_SELECT, "Gradient", 2, &settings.gradient_mode,
+       "Auto\nAdjoint\nParameter FD"},
+      {mjITEM_SLIDERINT, "Trace Stride", 2, &trace_options_.stride, "1 10"},
+      {mjITEM_SLIDERINT, "Trace Samples", 2, &trace_options_.max_samples,
+       "0 128"},
       {mjITEM_END}};
 
   // set number of trajectory slider limits
@@ -572,4 +690,14 @@ void GradientPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   shift[1] += 6;
 }
 
+// compute times of the last iteration's phases
+std::vector<PhaseTime> GradientPlanner::PhaseTimes() const {
+  return {{"nominal", nominal_compute_time},
+          {"model_derivative", model_derivative_compute_time},
+          {"cost_derivative", cost_derivative_compute_time},
+          {"rollouts", rollouts_compute_time},
+          {"gradient", gradient_compute_time},
+          {"policy_update", policy_update_compute_time}};
+}
+
 }  // namespace mjpc
@@ -27,6 +27,7 @@
 #include "mjpc/planners/gradient/spline_mapping.h"
 #include "mjpc/planners/model_derivatives.h"
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy_buffer.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
@@ -69,12 +70,28 @@ class GradientPlanner : public Planner {
   void ActionFromPolicy(double* action, const double* state, double time,
                         bool use_previous = false) override;
 
+  // export the published policy
+  bool ExportPolicy(ExportedPolicy& policy) const override;
+
+  // bytes of the trajectories, policies, derivatives and gradient
+  void ReportMemory(MemoryReport& report) const override;
+
   // resample nominal policy for current time
   void ResamplePolicy(int horizon);
 
   // compute candidate trajectories
   void Rollouts(int horizon, ThreadPool& pool);
 
+  // true if the parameter gradient is used instead of the adjoint gradient,
+  // i.e., if there are fewer spline parameters than state and action
+  // perturbations per time step in the model derivatives
+  bool UseParameterGradient() const;
+
+  // gradient with respect to the spline parameters from finite differences
+  // of rollouts (parallel), one (or two, centered) per parameter. sets the
+  // nominal parameter update.
+  void ParameterGradient(int horizon, ThreadPool& pool);
+
   // return trajectory with best total return
   const Trajectory* BestTrajectory() override;
 
@@ -93,6 +110,12 @@ class GradientPlanner : public Planner {
     return policy.num_spline_points * policy.model->nu;
   };
 
+  // compute times of the last iteration's phases
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // rollouts of an iteration
+  int NumRollouts() const override { return num_trajectory; }
+
   // ----- members ----- //
   mjModel* model;
   const Task* task;
@@ -160,6 +183,15 @@ class GradientPlanner : public Planner {
 
  private:
   mutable std::shared_mutex mtx_;
+
+  // policies published to ActionFromPolicy
+  PolicyBuffer<GradientPolicy> published_policy_;
+
+  // parameter gradient scratch, policy and trajectory per worker
+  std::vector<GradientPolicy> fd_policy_;
+  std::vector<Trajectory> fd_trajectory_;
+  std::vector<double> fd_return_;  // perturbed returns
+  std::vector<int> fd_failure_;    // perturbed rollout failed
 };
 
 }  // namespace mjpc
@@ -17,8 +17,10 @@
 #include <algorithm>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/gradient/spline_mapping.h"
 #include "mjpc/planners/policy.h"
+#include "mjpc/policy_export.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -52,6 +54,10 @@ void GradientPolicy::Allocate(const mjModel* model, const Task& task,
                                       model, "gradient_representation");
 }
 
+std::size_t GradientPolicy::Bytes() const {
+  return VectorBytes(k, parameters, parameter_update, times);
+}
+
 // reset memory to zeros
 void GradientPolicy::Reset(int horizon, const double* initial_repeated_action) {
   std::fill(k.begin(), k.begin() + horizon * model->nu, 0.0);
@@ -98,6 +104,24 @@ void GradientPolicy::Action(double* action, const double* state,
   Clamp(action, model->actuator_ctrlrange, model->nu);
 }
 
+// precompute the cubic spline of the current knots for SplineAction
+void GradientPolicy::UpdateSpline() {
+  if (representation != PolicyRepresentation::kCubicSpline) return;
+  spline_.Compute(times, parameters.data(), model->nu, num_spline_points);
+}
+
+// action from the knots of the last UpdateSpline
+void GradientPolicy::SplineAction(double* action, double time) const {
+  if (representation != PolicyRepresentation::kCubicSpline) {
+    Action(action, nullptr, time);
+    return;
+  }
+  spline_.Interpolate(action, time);
+
+  // Clamp controls
+  Clamp(action, model->actuator_ctrlrange, model->nu);
+}
+
 // copy policy
 void GradientPolicy::CopyFrom(const GradientPolicy& policy, int horizon) {
   // action improvement
@@ -127,4 +151,17 @@ void GradientPolicy::CopyParametersFrom(
   mju_copy(times.data(), src_times.data(), num_spline_points);
 }
 
+void GradientPolicy::Export(ExportedPolicy& exported) const {
+  SetExportedModel(exported, model);
+  exported.kind = ExportedPolicyKind::kSpline;
+  exported.representation = representation;
+  exported.times.assign(times.begin(), times.begin() + num_spline_points);
+  exported.actions.assign(parameters.begin(),
+                          parameters.begin() + num_spline_points * model->nu);
+  exported.states.clear();
+  exported.gains.clear();
+  exported.joints.clear();
+  exported.feedback_scaling = 1.0;
+}
+
 }  // namespace mjpc
@@ -15,11 +15,14 @@
 #ifndef MJPC_PLANNERS_GRADIENT_POLICY_H_
 #define MJPC_PLANNERS_GRADIENT_POLICY_H_
 
+#include <cstddef>
 #include <vector>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/planners/policy.h"
+#include "mjpc/policy_export.h"
 #include "mjpc/task.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 
@@ -37,6 +40,9 @@ class GradientPolicy : public Policy {
   // allocate memory
   void Allocate(const mjModel* model, const Task& task, int horizon) override;
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int horizon,
              const double* initial_repeated_action = nullptr) override;
@@ -45,6 +51,14 @@ class GradientPolicy : public Policy {
   // state is not used
   void Action(double* action, const double* state, double time) const override;
 
+  // precompute the cubic spline of the current knots for SplineAction, once
+  // after the parameters are set, e.g., at the start of a rollout
+  void UpdateSpline();
+
+  // action from the knots of the last UpdateSpline, matches Action if they
+  // haven't changed
+  void SplineAction(double* action, double time) const;
+
   // copy policy
   void CopyFrom(const GradientPolicy& policy, int horizon);
 
@@ -52,6 +66,9 @@ class GradientPolicy : public Policy {
   void CopyParametersFrom(const std::vector<double>& src_parameters,
                           const std::vector<double>& src_times);
 
+  // set the knots of an exported spline policy
+  void Export(ExportedPolicy& exported) const;
+
   // ----- members ----- //
   const mjModel* model;
 
@@ -63,6 +80,10 @@ class GradientPolicy : public Policy {
   int num_parameters;
   int num_spline_points;
   PolicyRepresentation representation;
+
+ private:
+  // cubic spline of the knots, set by UpdateSpline
+  CubicSpline spline_;
 };
 
 }  // namespace mjpc
@@ -23,6 +23,11 @@ struct GradientPlannerSettings {
   double min_linesearch_step = 1.0e-8;    // minimum step size for line search
   double fd_tolerance = 1.0e-5;  // finite-difference tolerance
   double fd_mode = 0;  // type of finite difference; 0: one-side, 1: centered
+  int fd_coloring = 0;  // flag, perturb independent kinematic trees together
+  int derivative_backend = 0;  // action Jacobians; 0: finite differences,
+                               // 1: smooth, 2: hybrid (see DerivativeBackend)
+  int residual_sensor_rows = 1;  // flag, differentiate residual sensors only
+  int gradient_mode = 0;  // 0: automatic, 1: adjoint, 2: parameter fd
   int action_limits = 1;  // flag
 };
 
@@ -17,192 +17,210 @@
 #include <algorithm>
 #include <vector>
 
+#include <mujoco/mujoco.h>
+
 #include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 
+// regularization of the normal matrix, for spline points without samples
+inline constexpr double kSplineMappingRegularization = 1.0e-10;
+
 // allocate memory
-void ZeroSplineMapping::Allocate(int dim) {
+void SplineMapping::Allocate(int dim) {
   // dimensions
   this->dim = dim;
+  num_input = 0;
+  num_output = 0;
 
   // allocate
-  mapping.resize((dim * kMaxTrajectoryHorizon) *
-                 (dim * kMaxGradientSplinePoints));
+  coefficients.resize(kMaxTrajectoryHorizon * kSplineMappingWidth);
+  columns.resize(kMaxTrajectoryHorizon);
+  normal_.resize(kMaxGradientSplinePoints * kSplineMappingWidth);
+  scratch_.resize(2 * kMaxGradientSplinePoints);
+  factorized_ = false;
+}
+
+// values = A * parameters
+void SplineMapping::Apply(double* values, const double* parameters) const {
+  int width = std::min(kSplineMappingWidth, num_input);
+  mju_zero(values, dim * num_output);
+  for (int i = 0; i < num_output; i++) {
+    const double* c = coefficients.data() + i * kSplineMappingWidth;
+    for (int a = 0; a < width; a++) {
+      if (c[a] == 0.0) continue;
+      mju_addToScl(values + dim * i, parameters + dim * (columns[i] + a), c[a],
+                   dim);
+    }
+  }
+}
+
+// parameters = A' * values
+void SplineMapping::ApplyTranspose(double* parameters,
+                                   const double* values) const {
+  int width = std::min(kSplineMappingWidth, num_input);
+  mju_zero(parameters, dim * num_input);
+  for (int i = 0; i < num_output; i++) {
+    const double* c = coefficients.data() + i * kSplineMappingWidth;
+    for (int a = 0; a < width; a++) {
+      if (c[a] == 0.0) continue;
+      mju_addToScl(parameters + dim * (columns[i] + a), values + dim * i, c[a],
+                   dim);
+    }
+  }
+}
+
+// least-squares parameters: (A' A) parameters = A' values
+void SplineMapping::Fit(double* parameters, const double* values) {
+  if (!factorized_) FactorNormal();
+
+  // A' A = (T' T) (x) I_dim, solve per parameter
+  int nband = std::min(kSplineMappingWidth, num_input);
+  ApplyTranspose(parameters, values);
+  double* rhs = scratch_.data();
+  double* solution = scratch_.data() + num_input;
+  for (int j = 0; j < dim; j++) {
+    for (int k = 0; k < num_input; k++) rhs[k] = parameters[dim * k + j];
+    mju_cholSolveBand(solution, normal_.data(), rhs, num_input, nband, 0);
+    for (int k = 0; k < num_input; k++) parameters[dim * k + j] = solution[k];
+  }
+}
+
+// dense mapping A, (dim*num_output) x (dim*num_input)
+void SplineMapping::Dense(double* mapping) const {
+  int width = std::min(kSplineMappingWidth, num_input);
+  int num_column = dim * num_input;
+  mju_zero(mapping, (dim * num_output) * num_column);
+  for (int i = 0; i < num_output; i++) {
+    const double* c = coefficients.data() + i * kSplineMappingWidth;
+    for (int a = 0; a < width; a++) {
+      for (int j = 0; j < dim; j++) {
+        int row = dim * i + j;
+        int col = dim * (columns[i] + a) + j;
+        mapping[row * num_column + col] = c[a];
+      }
+    }
+  }
+}
+
+// set dimensions of a new mapping
+void SplineMapping::SetDimensions(int num_input, int num_output) {
+  this->num_input = num_input;
+  this->num_output = num_output;
+  factorized_ = false;
+}
+
+// start row i of T at a column that fits all its nonzeros
+void SplineMapping::StartRow(int i, int bound) {
+  columns[i] = std::clamp(bound - 1, 0,
+                          std::max(num_input - kSplineMappingWidth, 0));
+  std::fill_n(coefficients.begin() + i * kSplineMappingWidth,
+              kSplineMappingWidth, 0.0);
+}
+
+// add value to T(i, column)
+void SplineMapping::AddCoefficient(int i, int column, double value) {
+  coefficients[i * kSplineMappingWidth + column - columns[i]] += value;
+}
+
+// band Cholesky factor of T' T
+void SplineMapping::FactorNormal() {
+  int nband = std::min(kSplineMappingWidth, num_input);
+  mju_zero(normal_.data(), num_input * nband);
+  for (int i = 0; i < num_output; i++) {
+    const double* c = coefficients.data() + i * kSplineMappingWidth;
+    for (int a = 0; a < nband; a++) {
+      int k = columns[i] + a;
+      for (int b = 0; b <= a; b++) {
+        normal_[k * nband + nband - 1 - (a - b)] += c[a] * c[b];
+      }
+    }
+  }
+  mju_cholFactorBand(normal_.data(), num_input, nband, 0,
+                     kSplineMappingRegularization, 0.0);
+  factorized_ = true;
 }
 
 // compute zero-order-hold mapping
 void ZeroSplineMapping::Compute(const std::vector<double>& input_times,
                                 int num_input, const double* output_times,
                                 int num_output) {
-  // set zeros
-  std::fill(mapping.begin(),
-            mapping.begin() + (dim * num_output) * (dim * num_input), 0.0);
-
-  // compute
-  int row, col;
+  SetDimensions(num_input, num_output);
   int bounds[2];
   for (int i = 0; i < num_output; i++) {
     FindInterval(bounds, input_times, output_times[i], num_input);
-    for (int j = 0; j < dim; j++) {
-      // p0
-      row = dim * num_input * (dim * i + j);
-      col = dim * bounds[0] + j;
-      mapping[row + col] = 1.0;
-    }
-  }
-}
+    StartRow(i, bounds[0]);
 
-// allocate memory
-void LinearSplineMapping::Allocate(int dim) {
-  // dimensions
-  this->dim = dim;
-
-  // allocate
-  mapping.resize((dim * kMaxTrajectoryHorizon) *
-                 (dim * kMaxGradientSplinePoints));
+    // p0
+    AddCoefficient(i, bounds[0], 1.0);
+  }
 }
 
 // compute linear-interpolation mapping
 void LinearSplineMapping::Compute(const std::vector<double>& input_times,
                                   int num_input, const double* output_times,
                                   int num_output) {
-  // set zeros
-  std::fill(mapping.begin(),
-            mapping.begin() + (dim * num_output) * (dim * num_input), 0.0);
-  // compute
-  int row, col;
+  SetDimensions(num_input, num_output);
   int bounds[2];
   for (int i = 0; i < num_output; i++) {
     FindInterval(bounds, input_times, output_times[i], num_input);
-    for (int j = 0; j < dim; j++) {
-      if (bounds[0] == bounds[1]) {
-        // p1
-        row = dim * num_input * (dim * i + j);
-        col = dim * bounds[0] + j;
-        mapping[row + col] = 1.0;
-      } else {
-        // normalized time
-        double a = (output_times[i] - input_times[bounds[0]]) /
-                   (input_times[bounds[1]] - input_times[bounds[0]]);
-
-        // p0
-        row = dim * num_input * (dim * i + j);
-        col = dim * bounds[0] + j;
-        mapping[row + col] = 1.0 - a;
-
-        // p1
-        row = dim * num_input * (dim * i + j);
-        col = dim * bounds[1] + j;
-        mapping[row + col] = a;
-      }
-    }
-  }
-}
+    StartRow(i, bounds[0]);
+    if (bounds[0] == bounds[1]) {
+      // p1
+      AddCoefficient(i, bounds[0], 1.0);
+    } else {
+      // normalized time
+      double a = (output_times[i] - input_times[bounds[0]]) /
+                 (input_times[bounds[1]] - input_times[bounds[0]]);
 
-// allocate memory
-void CubicSplineMapping::Allocate(int dim) {
-  // dimensions
-  this->dim = dim;
+      // p0
+      AddCoefficient(i, bounds[0], 1.0 - a);
 
-  // allocate
-  mapping.resize((dim * kMaxTrajectoryHorizon) *
-                 (dim * kMaxGradientSplinePoints));
-  point_slope_mapping.resize((2 * dim * kMaxGradientSplinePoints) *
-                             (dim * kMaxGradientSplinePoints));
-  output_mapping.resize((dim * kMaxTrajectoryHorizon) *
-                        (2 * dim * kMaxGradientSplinePoints));
+      // p1
+      AddCoefficient(i, bounds[1], a);
+    }
+  }
 }
 
 // compute cubic-interpolation mapping
 void CubicSplineMapping::Compute(const std::vector<double>& input_times,
                                  int num_input, const double* output_times,
                                  int num_output) {
-  // FiniteDifferenceSlope matrix
-  std::fill(
-      point_slope_mapping.begin(),
-      point_slope_mapping.begin() + (2 * dim * num_input) * (dim * num_input),
-      0.0);
-  int row, col;
-  // point-to-point mapping
-  for (int i = 0; i < num_input; i++) {
-    for (int j = 0; j < dim; j++) {
-      row = dim * num_input * (dim * i + j);
-      col = dim * i + j;
-      point_slope_mapping[row + col] = 1.0;
-    }
-  }
+  SetDimensions(num_input, num_output);
 
-  // point-to-FiniteDifferenceSlope mapping
-  int shift = (dim * num_input) * (dim * num_input);
-  for (int i = 0; i < num_input; i++) {
-    double dt1 = (i > 0 ? 1.0 / (input_times[i] - input_times[i - 1]) : 0.0);
+  // T(i, :) += scale * FiniteDifferenceSlope(k)
+  auto add_slope = [&](int i, int k, double scale) {
+    double dt1 = (k > 0 ? 1.0 / (input_times[k] - input_times[k - 1]) : 0.0);
     double dt2 =
-        (i < num_input - 1 ? 1.0 / (input_times[i + 1] - input_times[i]) : 0.0);
-    if (i > 0 && i < num_input - 1) {
+        (k < num_input - 1 ? 1.0 / (input_times[k + 1] - input_times[k])
+                           : 0.0);
+    if (k > 0 && k < num_input - 1) {
       dt1 *= 0.5;
       dt2 *= 0.5;
     }
-    for (int j = 0; j < dim; j++) {
-      // i - 1
-      if (i - 1 >= 0) {
-        row = dim * num_input * (dim * i + j);
-        col = dim * (i - 1) + j;
-        point_slope_mapping[shift + row + col] = -dt1;
-      }
+    if (k - 1 >= 0) AddCoefficient(i, k - 1, -scale * dt1);
+    AddCoefficient(i, k, scale * (dt1 - dt2));
+    if (k + 1 <= num_input - 1) AddCoefficient(i, k + 1, scale * dt2);
+  };
 
-      // i
-      row = dim * num_input * (dim * i + j);
-      col = dim * i + j;
-      point_slope_mapping[shift + row + col] = dt1 - dt2;
-
-      // i + 1
-      if (i + 1 <= num_input - 1) {
-        row = dim * num_input * (dim * i + j);
-        col = dim * (i + 1) + j;
-        point_slope_mapping[shift + row + col] = dt2;
-      }
-    }
-  }
-
-  // output matrix
-  std::fill(output_mapping.begin(),
-            output_mapping.begin() + (dim * num_output) * (2 * dim * num_input),
-            0.0);
   int bounds[2];
-  double coefficients[4];
+  double cubic[4];
   for (int i = 0; i < num_output; i++) {
     FindInterval(bounds, input_times, output_times[i], num_input);
-    CubicCoefficients(coefficients, output_times[i], input_times, num_input);
-    for (int j = 0; j < dim; j++) {
-      // p0
-      row = 2 * dim * num_input * (dim * i + j);
-      col = dim * bounds[0] + j;
-      output_mapping[row + col] = coefficients[0];
-
-      // m0
-      row = 2 * dim * num_input * (dim * i + j);
-      col = dim * num_input + dim * bounds[0] + j;
-      output_mapping[row + col] = coefficients[1];
-
-      if (bounds[0] != bounds[1]) {
-        // p1
-        row = 2 * dim * num_input * (dim * i + j);
-        col = dim * bounds[1] + j;
-        output_mapping[row + col] = coefficients[2];
-
-        // m1
-        row = 2 * dim * num_input * (dim * i + j);
-        col = dim * num_input + dim * bounds[1] + j;
-        output_mapping[row + col] = coefficients[3];
-      }
+    CubicCoefficients(cubic, output_times[i], input_times, num_input);
+    StartRow(i, bounds[0]);
+
+    // p0, m0
+    AddCoefficient(i, bounds[0], cubic[0]);
+    add_slope(i, bounds[0], cubic[1]);
+
+    if (bounds[0] != bounds[1]) {
+      // p1, m1
+      AddCoefficient(i, bounds[1], cubic[2]);
+      add_slope(i, bounds[1], cubic[3]);
     }
   }
-
-  // mapping
-  mju_mulMatMat(mapping.data(), output_mapping.data(),
-                point_slope_mapping.data(), dim * num_output,
-                2 * dim * num_input, dim * num_input);
 }
 
 }  // namespace mjpc
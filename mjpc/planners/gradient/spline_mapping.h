@@ -26,6 +26,9 @@ namespace mjpc {
 inline constexpr int kMinGradientSplinePoints = 1;
 inline constexpr int kMaxGradientSplinePoints = 25;
 
+// nonzeros per row of the time mapping (cubic: p0 - 1, ..., p1 + 1)
+inline constexpr int kSplineMappingWidth = 4;
+
 // matrix representation for mapping between spline points and interpolated time
 // series.
 // A spline is made of num_input points, and each has one associated time, and
@@ -46,6 +49,11 @@ inline constexpr int kMaxGradientSplinePoints = 25;
 // flattened so that the parameters for each spline point are next to each
 // other, A*v gives the corresponding interpolated values, sampled at
 // output_times.
+//
+// Each value only depends on the same parameter of nearby spline points, so
+// A = T (x) I_dim, where the time mapping T (num_output x num_input) has at
+// most kSplineMappingWidth consecutive nonzeros per row. Only T is stored and
+// A is applied without forming it.
 class SplineMapping {
  public:
   // constructor
@@ -57,14 +65,48 @@ class SplineMapping {
   // ----- methods ----- //
 
   // allocate memory
-  virtual void Allocate(int dim) = 0;
+  void Allocate(int dim);
 
   // compute mapping
   virtual void Compute(const std::vector<double>& input_times, int num_input,
                        const double* output_times, int num_output) = 0;
 
-  // return mapping
-  virtual double* Get() = 0;
+  // values = A * parameters
+  void Apply(double* values, const double* parameters) const;
+
+  // parameters = A' * values
+  void ApplyTranspose(double* parameters, const double* values) const;
+
+  // least-squares parameters: (A' A) parameters = A' values
+  void Fit(double* parameters, const double* values);
+
+  // dense mapping A, (dim*num_output) x (dim*num_input)
+  void Dense(double* mapping) const;
+
+  // ----- members ----- //
+  int dim;
+  int num_input;
+  int num_output;
+  std::vector<double> coefficients;  // num_output x kSplineMappingWidth
+  std::vector<int> columns;          // first column of each row of T
+
+ protected:
+  // set dimensions of a new mapping
+  void SetDimensions(int num_input, int num_output);
+
+  // start row i of T at a column that fits all its nonzeros
+  void StartRow(int i, int bound);
+
+  // add value to T(i, column)
+  void AddCoefficient(int i, int column, double value);
+
+ private:
+  // band Cholesky factor of T' T
+  void FactorNormal();
+
+  std::vector<double> normal_;    // num_input x band
+  std::vector<double> scratch_;   // 2 * num_input
+  bool factorized_ = false;
 };
 
 // zero-order-hold mapping
@@ -77,19 +119,10 @@ class ZeroSplineMapping : public SplineMapping {
   ~ZeroSplineMapping() {}
 
   // ----- methods ----- //
-  // allocate memory
-  void Allocate(int dim);
 
   // compute mapping
   void Compute(const std::vector<double>& input_times, int num_input,
-               const double* output_times, int num_output);
-
-  // return mapping
-  double* Get() { return mapping.data(); }
-
-  // ----- members ----- //
-  std::vector<double> mapping;
-  int dim;
+               const double* output_times, int num_output) override;
 };
 
 // linear-interpolation mapping
@@ -103,19 +136,9 @@ class LinearSplineMapping : public SplineMapping {
 
   // ----- methods ----- //
 
-  // allocate memory
-  void Allocate(int dim);
-
   // compute mapping
   void Compute(const std::vector<double>& input_times, int num_input,
-               const double* output_times, int num_output);
-
-  // return mapping
-  double* Get() { return mapping.data(); }
-
-  // ----- members ----- //
-  std::vector<double> mapping;
-  int dim;
+               const double* output_times, int num_output) override;
 };
 
 // cubic-interpolation mapping
@@ -129,21 +152,9 @@ class CubicSplineMapping : public SplineMapping {
 
   // ----- methods ----- //
 
-  // allocate memory
-  void Allocate(int dim);
-
   // compute mapping
   void Compute(const std::vector<double>& input_times, int num_input,
-               const double* output_times, int num_output);
-
-  // return mapping
-  double* Get() { return mapping.data(); }
-
-  // ----- members ----- //
-  std::vector<double> mapping;
-  std::vector<double> point_slope_mapping;
-  std::vector<double> output_mapping;
-  int dim;
+               const double* output_times, int num_output) override;
 };
 
 }  // namespace mjpc
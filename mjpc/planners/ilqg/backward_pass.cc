@@ -15,17 +15,133 @@
 #include "mjpc/planners/ilqg/backward_pass.h"
 
 #include <algorithm>
+#include <array>
+#include <utility>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/cost_derivatives.h"
 #include "mjpc/planners/ilqg/boxqp.h"
 #include "mjpc/planners/ilqg/policy.h"
 #include "mjpc/planners/ilqg/settings.h"
 #include "mjpc/planners/model_derivatives.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 
+// cost-to-go expanded through the dynamics, fused over J = [A B]
+void ValueExpansion(double *Q, double *q, const double *A, const double *B,
+                    const double *Wxx, const double *Wx, int n, int m,
+                    double *scratch) {
+  int k = n + m;
+  double *J = scratch;
+  double *WJ = scratch + n * k;
+
+  // J = [A B], rows contiguous
+  for (int i = 0; i < n; i++) {
+    mju_copy(J + i * k, A + i * n, n);
+    mju_copy(J + i * k + n, B + i * m, m);
+  }
+
+  // WJ = Wxx * J, q = J' * Wx. inner loops run over contiguous rows of J so
+  // they vectorize as fused multiply-adds
+  mju_zero(WJ, n * k);
+  mju_zero(q, k);
+  for (int i = 0; i < n; i++) {
+    double *wj = WJ + i * k;
+    const double *w = Wxx + i * n;
+    for (int l = 0; l < n; l++) {
+      double s = w[l];
+      const double *j = J + l * k;
+      for (int c = 0; c < k; c++) wj[c] += s * j[c];
+    }
+    double s = Wx[i];
+    const double *j = J + i * k;
+    for (int c = 0; c < k; c++) q[c] += s * j[c];
+  }
+
+  // Q = J' * WJ, upper triangle
+  mju_zero(Q, k * k);
+  for (int i = 0; i < n; i++) {
+    const double *j = J + i * k;
+    const double *wj = WJ + i * k;
+    for (int r = 0; r < k; r++) {
+      double s = j[r];
+      double *row = Q + r * k;
+      for (int c = r; c < k; c++) row[c] += s * wj[c];
+    }
+  }
+
+  // lower triangle
+  for (int r = 1; r < k; r++) {
+    for (int c = 0; c < r; c++) Q[r * k + c] = Q[c * k + r];
+  }
+}
+
+namespace {
+// ValueExpansion with compile-time dimensions, the loops are unrolled and J,
+// WJ live on the stack
+template <int N, int M>
+void FixedExpansion(double *Q, double *q, const double *A, const double *B,
+                    const double *Wxx, const double *Wx, int n, int m,
+                    double *scratch) {
+  constexpr int K = N + M;
+  double J[N * K];
+  double WJ[N * K] = {};
+
+  // J = [A B]
+  for (int i = 0; i < N; i++) {
+    for (int c = 0; c < N; c++) J[i * K + c] = A[i * N + c];
+    for (int c = 0; c < M; c++) J[i * K + N + c] = B[i * M + c];
+  }
+
+  // WJ = Wxx * J, q = J' * Wx
+  for (int c = 0; c < K; c++) q[c] = 0.0;
+  for (int i = 0; i < N; i++) {
+    for (int l = 0; l < N; l++) {
+      double s = Wxx[i * N + l];
+      for (int c = 0; c < K; c++) WJ[i * K + c] += s * J[l * K + c];
+    }
+    for (int c = 0; c < K; c++) q[c] += Wx[i] * J[i * K + c];
+  }
+
+  // Q = J' * WJ, upper triangle, then lower
+  for (int r = 0; r < K; r++) {
+    for (int c = r; c < K; c++) {
+      double s = 0.0;
+      for (int i = 0; i < N; i++) s += J[i * K + r] * WJ[i * K + c];
+      Q[r * K + c] = s;
+    }
+  }
+  for (int r = 1; r < K; r++) {
+    for (int c = 0; c < r; c++) Q[r * K + c] = Q[c * K + r];
+  }
+}
+
+// FixedExpansion for n in [1, kFixedExpansionMaxState] and m in
+// [1, kFixedExpansionMaxAction], at (n - 1) * kFixedExpansionMaxAction + m - 1
+template <int... I>
+constexpr std::array<ValueExpansionFunction, sizeof...(I)> FixedExpansions(
+    std::integer_sequence<int, I...>) {
+  return {&FixedExpansion<I / kFixedExpansionMaxAction + 1,
+                          I % kFixedExpansionMaxAction + 1>...};
+}
+
+constexpr auto kFixedExpansions = FixedExpansions(
+    std::make_integer_sequence<int, kFixedExpansionMaxState *
+                                        kFixedExpansionMaxAction>());
+}  // namespace
+
+// compiled ValueExpansion for dimensions n, m
+ValueExpansionFunction FixedValueExpansion(int n, int m) {
+  if (n < 1 || n > kFixedExpansionMaxState || m < 1 ||
+      m > kFixedExpansionMaxAction) {
+    return ValueExpansion;
+  }
+  return kFixedExpansions[(n - 1) * kFixedExpansionMaxAction + m - 1];
+}
+
 // allocate memory
 void iLQGBackwardPass::Allocate(int dim_dstate, int dim_action, int T) {
   Vx.resize(dim_dstate * T);
@@ -35,15 +151,31 @@ void iLQGBackwardPass::Allocate(int dim_dstate, int dim_action, int T) {
   Qxx.resize(dim_dstate * dim_dstate * (T - 1));
   Qxu.resize(dim_dstate * dim_action * (T - 1));
   Quu.resize(dim_action * dim_action * (T - 1));
+  boxqp_solution.assign(dim_action * (T - 1), 0.0);
+  boxqp_free.assign(dim_action * (T - 1), -1);
+  int dim_joint = dim_dstate + dim_action;
   Q_scratch.resize(10 * (dim_dstate * dim_dstate + 7 * dim_action +
                          2 * dim_action * dim_action + dim_dstate * dim_action +
                          3 * mju_max(dim_action, dim_dstate) *
-                             mju_max(dim_action, dim_dstate)));
+                             mju_max(dim_action, dim_dstate)) +
+                   dim_joint * (2 * dim_dstate + dim_joint + 1));
 
   // regularization
   regularization = 1.0;
   regularization_rate = 1.0;
   regularization_factor = 2.0;
+
+  // kernels for the dimensions
+  value_expansion = FixedValueExpansion(dim_dstate, dim_action);
+}
+
+std::size_t iLQGBackwardPass::Bytes() const {
+  std::size_t bytes = VectorBytes(Vx, Vxx, Qx, Qu, Qxx, Qxu, Quu, Q_scratch,
+                                  boxqp_solution, boxqp_free, segments);
+  for (const iLQGBackwardPassSegment& segment : segments) {
+    bytes += VectorBytes(segment.Wx, segment.Wxx, segment.scratch);
+  }
+  return bytes;
 }
 
 // reset memory to zeros
@@ -56,6 +188,8 @@ void iLQGBackwardPass::Reset(int dim_dstate, int dim_action, int T) {
   std::fill(Qxx.begin(), Qxx.end(), 0.0);
   std::fill(Qxu.begin(), Qxu.end(), 0.0);
   std::fill(Quu.begin(), Quu.end(), 0.0);
+  std::fill(boxqp_solution.begin(), boxqp_solution.end(), 0.0);
+  std::fill(boxqp_free.begin(), boxqp_free.end(), -1);
   regularization = 1.0;
   regularization_rate = 1.0;
   regularization_factor = 2.0;
@@ -69,13 +203,16 @@ int iLQGBackwardPass::RiccatiStep(
     double *Vxxt, double *dut, double *Kt, double *dV, double *Qxt, double *Qut,
     double *Qxxt, double *Qxut, double *Quut, double *scratch, BoxQP &boxqp,
     const double *action, const double *action_limits, int reg_type,
-    int limits) {
-  int i, mmn = mju_max(m, n);
-  mjtNum *Vxx_reg, *Quu_reg, *Qxu_reg, *tmp, *tmp2, *tmp3;
+    int limits, double *boxqp_solution, int *boxqp_free,
+    const double *defect) {
+  int i, mmn = mju_max(m, n), k = n + m;
+  mjtNum *Quu_reg, *Qxu_reg, *tmp, *tmp2, *tmp3, *Q, *q;
 
   // allocate workspace variables
-  Vxx_reg = scratch;
-  scratch += n * n;
+  Q = scratch;
+  scratch += k * k;
+  q = scratch;
+  scratch += k;
   Qxu_reg = scratch;
   scratch += n * m;
   Quu_reg = scratch;
@@ -87,51 +224,38 @@ int iLQGBackwardPass::RiccatiStep(
   tmp3 = scratch;
   scratch += mmn * mmn;
 
-  //----- compute Qut,Qxut,Quut,Qxt,Qxxt ----- //
-  //    tmp  = At'*Wxx
-  mju_mulMatTMat(tmp, At, Wxx, n, n, n);
-
-  //    Qxt = cxt + At'*Wx
-  mju_mulMatTVec(Qxt, At, Wx, n, n);
-  mju_addTo(Qxt, cxt, n);
-
-  //    Qxxt = cxxt + tmp*At
-  mju_mulMatMat(Qxxt, tmp, At, n, n, n);
-  mju_addTo(Qxxt, cxxt, n * n);
-
-  //    Qut  = cut + Bt'*Wx;
-  mju_mulMatTVec(Qut, Bt, Wx, n, m);
-  mju_addTo(Qut, cut, m);
-
-  //    Qxut = cxut  + tmp*Bt;
-  mju_mulMatMat(Qxut, tmp, Bt, n, n, m);
-  mju_addTo(Qxut, cxut, n * m);
+  // cost-to-go gradient at the simulated next state, Wx + Wxx * defect
+  if (defect) {
+    double *Wd = scratch;
+    scratch += n;
+    mju_mulMatVec(Wd, Wxx, defect, n, n);
+    mju_addTo(Wd, Wx, n);
+    Wx = Wd;
+  }
 
-  //    Quut = cuut + Bt'*Wxx*Bt;
-  mju_mulMatTMat(tmp2, Bt, Wxx, n, m, n);
-  mju_mulMatMat(Quut, tmp2, Bt, m, n, m);
-  mju_addTo(Quut, cuut, m * m);
+  //----- compute Qut,Qxut,Quut,Qxt,Qxxt ----- //
+  //    [Qxxt Qxut; . Quut] = [cxxt cxut; . cuut] + [At Bt]'*Wxx*[At Bt]
+  //    [Qxt; Qut] = [cxt; cut] + [At Bt]'*Wx
+  value_expansion(Q, q, At, Bt, Wxx, Wx, n, m, scratch);
+  for (int i = 0; i < n; i++) {
+    mju_add(Qxxt + i * n, Q + i * k, cxxt + i * n, n);
+    mju_add(Qxut + i * m, Q + i * k + n, cxut + i * m, m);
+  }
+  for (int i = 0; i < m; i++) {
+    mju_add(Quut + i * m, Q + (n + i) * k + n, cuut + i * m, m);
+  }
+  mju_add(Qxt, q, cxt, n);
+  mju_add(Qut, q + n, cut, m);
 
   //----- regularize ----- //
   if (reg_type == kValueRegularization) {
-    // regularize cost-to-go
-    mju_copy(Vxx_reg, Wxx, n * n);
-    for (int i = 0; i < n; i++) {
-      Vxx_reg[n * i + i] += mu;
-    }
-
-    // Qxu_reg = cxut + At'*Vxx_reg*Bt
-    //    tmp  = At'*Vxx_reg
-    mju_mulMatTMat(tmp, At, Vxx_reg, n, n, n);
-    //    Qxu_reg = cxut  + tmp*Bt;
-    mju_mulMatMat(Qxu_reg, tmp, Bt, n, n, m);
-    mju_addTo(Qxu_reg, cxut, n * m);
-
-    // Quu_reg = cuut + Bt'*Vxx_reg*Bt;
-    //    tmp = Bt'*Vxx_reg
-    mju_mulMatTMat(tmp2, Bt, Vxx_reg, n, m, n);
-    mju_mulMatMat(Quu_reg, tmp2, Bt, m, n, m);
-    mju_addTo(Quu_reg, cuut, m * m);
+    // Wxx + mu*eye(n) adds mu*At'*Bt to Qxut and mu*Bt'*Bt to Quut
+    mju_mulMatTMat(tmp, At, Bt, n, n, m);
+    mju_scl(tmp, tmp, mu, n * m);
+    mju_add(Qxu_reg, Qxut, tmp, n * m);
+    mju_mulMatTMat(tmp, Bt, Bt, n, m, m);
+    mju_scl(tmp, tmp, mu, m * m);
+    mju_add(Quu_reg, Quut, tmp, m * m);
   } else {
     mju_copy(Qxu_reg, Qxut, n * m);
     mju_copy(Quu_reg, Quut, m * m);
@@ -165,6 +289,16 @@ int iLQGBackwardPass::RiccatiStep(
       boxqp.upper[i] = action_limits[2 * i + 1] - action[i];
     }
 
+    // warm start from the previous solution at this time step, the active
+    // set rarely changes between iterations
+    bool warm = boxqp_solution && boxqp_free[0] >= 0;
+    if (warm) {
+      for (int i = 0; i < m; i++) {
+        boxqp.res[i] =
+            mju_clip(boxqp_solution[i], boxqp.lower[i], boxqp.upper[i]);
+      }
+    }
+
     // solve constrained quadratic program
     int mFree = mju_boxQP(boxqp.res.data(), boxqp.R.data(), boxqp.index.data(),
                           boxqp.H.data(), boxqp.g.data(), m, boxqp.lower.data(),
@@ -173,6 +307,23 @@ int iLQGBackwardPass::RiccatiStep(
       return 0;
     }
 
+    // active set changes and solution for the next backward pass
+    if (boxqp_solution) {
+      if (warm) {
+        int num_free = 0;
+        bool changed = false;
+        for (int i = 0; i < m; i++) num_free += boxqp_free[i];
+        for (int i = 0; i < mFree && !changed; i++) {
+          changed = !boxqp_free[boxqp.index[i]];
+        }
+        boxqp.num_solve++;
+        boxqp.num_change += changed || num_free != mFree;
+      }
+      mju_copy(boxqp_solution, boxqp.res.data(), m);
+      for (int i = 0; i < m; i++) boxqp_free[i] = 0;
+      for (int i = 0; i < mFree; i++) boxqp_free[boxqp.index[i]] = 1;
+    }
+
     // tmp = compress_free(Qxut)
     for (int i = 0; i < mFree; i++) {
       for (int j = 0; j < n; j++) {
@@ -323,6 +474,141 @@ int iLQGBackwardPass::Riccati(iLQGPolicy *p, const ModelDerivatives *md,
   return time_index;
 }
 
+// partitioned backward pass
+int iLQGBackwardPass::RiccatiPartitioned(
+    iLQGPolicy *p, const ModelDerivatives *md, const CostDerivatives *cd,
+    int dim_dstate, int dim_action, int T, double reg, const double *actions,
+    const double *action_limits, int reg_type, int limits, int num_segment,
+    double tolerance, ThreadPool &pool, const double *defects) {
+  int n = dim_dstate, m = dim_action, nn = n * n;
+  int num_step = T - 1;
+  num_segment = std::clamp(num_segment, 1, num_step);
+
+  // segments, memory allocated on first use
+  if (static_cast<int>(segments.size()) < num_segment) segments.resize(num_segment);
+  for (int s = 0; s < num_segment; s++) {
+    iLQGBackwardPassSegment &segment = segments[s];
+    segment.begin = s * num_step / num_segment;
+    segment.end = (s + 1) * num_step / num_segment;
+    if (static_cast<int>(segment.Wx.size()) < n) {
+      segment.Wx.resize(n);
+      segment.Wxx.resize(nn);
+    }
+    if (segment.scratch.size() < Q_scratch.size()) {
+      segment.scratch.resize(Q_scratch.size());
+    }
+    if (static_cast<int>(segment.boxqp.res.size()) != m) segment.boxqp.Allocate(m);
+  }
+
+  // final cost-to-go
+  mju_copy(DataAt(Vx, num_step * n), DataAt(cd->cx, num_step * n), n);
+  mju_copy(DataAt(Vxx, num_step * nn), DataAt(cd->cxx, num_step * nn), nn);
+
+  // initial guesses, the cost-to-go at the segment ends from the previous
+  // backward pass
+  for (int s = 0; s < num_segment; s++) {
+    iLQGBackwardPassSegment &segment = segments[s];
+    mju_copy(segment.Wx.data(), DataAt(Vx, segment.end * n), n);
+    mju_copy(segment.Wxx.data(), DataAt(Vxx, segment.end * nn), nn);
+    segment.run = 1;
+    segment.accepted = 0;
+  }
+
+  // Riccati over the steps of a segment
+  auto solve = [&](int s) {
+    iLQGBackwardPassSegment &segment = segments[s];
+    if (!segment.run) return;
+    mju_zero(segment.dV, 2);
+    segment.status = 1;
+    for (int t = segment.end - 1; t >= segment.begin; t--) {
+      bool last = t == segment.end - 1;
+      segment.status = RiccatiStep(
+          n, m, reg, last ? segment.Wx.data() : DataAt(Vx, (t + 1) * n),
+          last ? segment.Wxx.data() : DataAt(Vxx, (t + 1) * nn),
+          DataAt(md->A, t * nn), DataAt(md->B, t * n * m),
+          DataAt(cd->cx, t * n), DataAt(cd->cu, t * m),
+          DataAt(cd->cxx, t * nn), DataAt(cd->cxu, t * n * m),
+          DataAt(cd->cuu, t * m * m), DataAt(Vx, t * n), DataAt(Vxx, t * nn),
+          DataAt(p->action_improvement, t * m),
+          DataAt(p->feedback_gain, t * m * n), segment.dV,
+          DataAt(Qx, t * n), DataAt(Qu, t * m), DataAt(Qxx, t * nn),
+          DataAt(Qxu, t * n * m), DataAt(Quu, t * m * m),
+          segment.scratch.data(), segment.boxqp, actions + t * m,
+          action_limits, reg_type, limits, DataAt(boxqp_solution, t * m),
+          DataAt(boxqp_free, t * m),
+          defects ? defects + (t + 1) * n : nullptr);
+      if (!segment.status) return;
+    }
+  };
+
+  // sweeps, each accepts at least the highest segment not accepted yet
+  for (int sweep = 1; sweep <= num_segment; sweep++) {
+    pool.ParallelFor(0, num_segment, 1, solve);
+    for (int s = 0; s < num_segment; s++) {
+      if (segments[s].run && !segments[s].status) return 0;
+    }
+
+    // the last segment's guess is the final cost-to-go, accept if the guesses
+    // of the segments below agree with the cost-to-go computed above them
+    bool complete = true;
+    for (int s = num_segment - 1; s >= 0; s--) {
+      iLQGBackwardPassSegment &segment = segments[s];
+      if (segment.accepted) continue;
+      const double *vx = DataAt(Vx, segment.end * n);
+      const double *vxx = DataAt(Vxx, segment.end * nn);
+      double error = 0.0, scale = 1.0;
+      for (int i = 0; i < n; i++) {
+        error = mju_max(error, mju_abs(segment.Wx[i] - vx[i]));
+        scale = mju_max(scale, mju_abs(vx[i]));
+      }
+      for (int i = 0; i < nn; i++) {
+        error = mju_max(error, mju_abs(segment.Wxx[i] - vxx[i]));
+        scale = mju_max(scale, mju_abs(vxx[i]));
+      }
+      bool above = s == num_segment - 1 || segments[s + 1].accepted;
+      if (above && error <= tolerance * scale) {
+        segment.accepted = 1;
+        segment.run = 0;
+      } else {
+        mju_copy(segment.Wx.data(), vx, n);
+        mju_copy(segment.Wxx.data(), vxx, nn);
+        segment.run = 1;
+        complete = false;
+      }
+    }
+    if (!complete) continue;
+
+    // cost-to-go error and final time step
+    mju_zero(dV, 2);
+    for (int s = 0; s < num_segment; s++) {
+      mju_addTo(dV, segments[s].dV, 2);
+    }
+    mju_copy(DataAt(p->feedback_gain, num_step * m * n),
+             DataAt(p->feedback_gain, (num_step - 1) * m * n), m * n);
+    mju_copy(DataAt(p->action_improvement, num_step * m),
+             DataAt(p->action_improvement, (num_step - 1) * m), m);
+    return sweep;
+  }
+  return 0;
+}
+
+// align boxQP solutions with an advanced horizon
+void iLQGBackwardPass::ShiftBoxQP(int shift, int dim_action) {
+  int T = boxqp_free.size() / mju_max(dim_action, 1);
+  if (shift == 0 || T == 0) return;
+  if (shift < 0 || shift >= T) {
+    std::fill(boxqp_free.begin(), boxqp_free.end(), -1);
+    return;
+  }
+
+  // move steps [shift, T) to [0, T - shift), later steps are new
+  std::copy(boxqp_solution.begin() + shift * dim_action, boxqp_solution.end(),
+            boxqp_solution.begin());
+  std::copy(boxqp_free.begin() + shift * dim_action, boxqp_free.end(),
+            boxqp_free.begin());
+  std::fill(boxqp_free.end() - shift * dim_action, boxqp_free.end(), -1);
+}
+
 // scale backward pass regularization
 void iLQGBackwardPass::ScaleRegularization(double factor, double reg_min,
                                            double reg_max) {
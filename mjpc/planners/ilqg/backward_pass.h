@@ -15,6 +15,7 @@
 #ifndef MJPC_PLANNERS_ILQG_BACKWARD_PASS_H_
 #define MJPC_PLANNERS_ILQG_BACKWARD_PASS_H_
 
+#include <cstddef>
 #include <vector>
 
 #include "mjpc/planners/cost_derivatives.h"
@@ -22,6 +23,7 @@
 #include "mjpc/planners/ilqg/policy.h"
 #include "mjpc/planners/ilqg/settings.h"
 #include "mjpc/planners/model_derivatives.h"
+#include "mjpc/threadpool.h"
 
 namespace mjpc {
 
@@ -31,6 +33,43 @@ enum BackwardPassRegularization : int {
   kValueRegularization
 };
 
+// cost-to-go expanded through the dynamics, fused over J = [A B]:
+//   Q = J' * Wxx * J  ((n + m) x (n + m), symmetric)
+//   q = J' * Wx       (n + m)
+// A (n x n), B (n x m), scratch (2 * n * (n + m))
+void ValueExpansion(double *Q, double *q, const double *A, const double *B,
+                    const double *Wxx, const double *Wx, int n, int m,
+                    double *scratch);
+
+using ValueExpansionFunction = void (*)(double *Q, double *q, const double *A,
+                                        const double *B, const double *Wxx,
+                                        const double *Wx, int n, int m,
+                                        double *scratch);
+
+// largest dimensions with a compiled ValueExpansion, e.g., particle, cartpole
+// and acrobot models
+inline constexpr int kFixedExpansionMaxState = 16;
+inline constexpr int kFixedExpansionMaxAction = 4;
+
+// ValueExpansion with n and m fixed at compile time, unrolled and without
+// scratch, if n and m are within the compiled sizes. ValueExpansion otherwise.
+ValueExpansionFunction FixedValueExpansion(int n, int m);
+
+// steps [begin, end) of a partitioned backward pass, solved from a guess
+// (Wx, Wxx) of the cost-to-go at end
+struct iLQGBackwardPassSegment {
+  int begin;
+  int end;
+  int run;       // flag, solve in the next sweep
+  int accepted;  // flag, guess agrees with the segment above
+  int status;    // Riccati step status of the last solve
+  double dV[2];
+  std::vector<double> Wx;
+  std::vector<double> Wxx;
+  std::vector<double> scratch;
+  BoxQP boxqp;
+};
+
 // data and methods to compute iLQG backward pass
 class iLQGBackwardPass {
  public:
@@ -44,10 +83,18 @@ class iLQGBackwardPass {
   // allocate memory
   void Allocate(int dim_dstate, int dim_action, int T);
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int dim_dstate, int dim_action, int T);
 
-  // Riccati at one time step
+  // Riccati at one time step. with boxqp_solution and boxqp_free (m), the
+  // boxQP is warm-started from the solution of the previous backward pass at
+  // this time step and both are replaced with the new solution. with defect
+  // (n), the gap between the simulated and the nominal next state of a
+  // multiple-shooting nominal, the cost-to-go is expanded at the simulated
+  // state.
   int RiccatiStep(int n, int m, double mu, const double *Wx, const double *Wxx,
                   const double *At, const double *Bt, const double *cxt,
                   const double *cut, const double *cxxt, const double *cxut,
@@ -55,7 +102,9 @@ class iLQGBackwardPass {
                   double *Kt, double *dV, double *Qxt, double *Qut,
                   double *Qxxt, double *Qxut, double *Quut, double *scratch,
                   BoxQP &boxqp, const double *action,
-                  const double *action_limits, int reg_type, int limits);
+                  const double *action_limits, int reg_type, int limits,
+                  double *boxqp_solution = nullptr, int *boxqp_free = nullptr,
+                  const double *defect = nullptr);
 
   // compute backward pass using Riccati
   int Riccati(iLQGPolicy *p, const ModelDerivatives *md,
@@ -63,6 +112,24 @@ class iLQGBackwardPass {
               double reg, BoxQP &boxqp, const double *actions,
               const double *action_limits, const iLQGSettings &settings);
 
+  // partitioned backward pass: segments of the horizon are solved in parallel
+  // from guesses of the cost-to-go at their ends, initially the previous
+  // solution, and solved again from the cost-to-go of the segment above until
+  // the guesses agree within tolerance (relative). defects (T * dim_dstate)
+  // are those of a multiple-shooting nominal, see RiccatiStep. returns the
+  // number of sweeps, or 0 after a step failure.
+  int RiccatiPartitioned(iLQGPolicy *p, const ModelDerivatives *md,
+                         const CostDerivatives *cd, int dim_dstate,
+                         int dim_action, int T, double reg,
+                         const double *actions, const double *action_limits,
+                         int reg_type, int limits, int num_segment,
+                         double tolerance, ThreadPool &pool,
+                         const double *defects = nullptr);
+
+  // align boxQP solutions of the previous backward pass with a horizon that
+  // advanced shift time steps, shift < 0 discards them
+  void ShiftBoxQP(int shift, int dim_action);
+
   // scale backward pass regularization
   void ScaleRegularization(double factor, double reg_min, double reg_max);
 
@@ -83,9 +150,15 @@ class iLQGBackwardPass {
   std::vector<double>
       Quu;  // Q action Hessian       ((T - 1) * dim_action * dim_action)
   std::vector<double> Q_scratch;  // scratch
+  std::vector<double> boxqp_solution;  // boxQP solutions ((T - 1) * dim_action)
+  std::vector<int> boxqp_free;  // free actions of boxqp_solution, flags;
+                                // -1: no solution ((T - 1) * dim_action)
   double regularization;          // regularization
   double regularization_rate;     // regularization_rate
   double regularization_factor;   // regularization_factor
+  ValueExpansionFunction value_expansion =
+      ValueExpansion;  // selected for the dimensions by Allocate
+  std::vector<iLQGBackwardPassSegment> segments;  // partitioned backward pass
 };
 
 }  // namespace mjpc
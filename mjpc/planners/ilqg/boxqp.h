@@ -46,6 +46,8 @@ class BoxQP {
 
     // reset for warmstart
     mju_zero(res.data(), n);
+    num_solve = 0;
+    num_change = 0;
   }
 
   // ----- members ----- //
@@ -56,6 +58,8 @@ class BoxQP {
   std::vector<double> g;      // bias
   std::vector<double> lower;  // lower bounds
   std::vector<double> upper;  // upper bounds
+  int num_solve = 0;   // warm-started solves
+  int num_change = 0;  // warm-started solves that changed the active set
 };
 
 }  // namespace mjpc
@@ -15,14 +15,19 @@
 #include "mjpc/planners/ilqg/planner.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <iostream>
 #include <shared_mutex>
+#include <thread>
+#include <utility>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/ilqg/backward_pass.h"
 #include "mjpc/planners/ilqg/policy.h"
 #include "mjpc/planners/ilqg/settings.h"
@@ -30,12 +35,21 @@
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace mju = ::mujoco::util_mjpc;
 
+namespace {
+// minimum time steps per segment of a partitioned backward pass
+constexpr int kMinPartitionSteps = 8;
+
+// minimum time steps per segment of a multiple-shooting nominal
+constexpr int kMinShootingSteps = 8;
+}  // namespace
+
 // initialize data and settings
 void iLQGPlanner::Initialize(mjModel* model, const Task& task) {
   // delete mjData instances since model might have changed.
@@ -55,13 +69,63 @@ void iLQGPlanner::Initialize(mjModel* model, const Task& task) {
   dim_state_derivative =
       2 * model->nv + model->na;    // state derivative dimension
   dim_action = model->nu;           // action dimension
-  dim_sensor = model->nsensordata;  // number of sensor values
   dim_max =
       mju_max(mju_max(mju_max(dim_state, dim_state_derivative), dim_action),
               model->nuser_sensor);
   num_rollouts_gui_ = GetNumberOrDefault(10, model, "ilqg_num_rollouts");
   settings.regularization_type = GetNumberOrDefault(
       settings.regularization_type, model, "ilqg_regularization_type");
+  settings.fd_coloring =
+      GetNumberOrDefault(settings.fd_coloring, model, "ilqg_fd_coloring");
+  settings.fd_skip_tolerance = GetNumberOrDefault(
+      settings.fd_skip_tolerance, model, "ilqg_fd_skip_tolerance");
+  settings.derivative_backend =
+      std::clamp(GetNumberOrDefault(settings.derivative_backend, model,
+                                    "ilqg_derivative_backend"),
+                 0, kNumDerivativeBackend - 1);
+  model_derivative.backend = settings.derivative_backend;
+  settings.derivative_warmstart = GetNumberOrDefault(
+      settings.derivative_warmstart, model, "ilqg_derivative_warmstart");
+  settings.pipeline =
+      GetNumberOrDefault(settings.pipeline, model, "ilqg_pipeline");
+  settings.compact_gains =
+      GetNumberOrDefault(settings.compact_gains, model, "ilqg_compact_gains");
+  settings.derivative_window = GetNumberOrDefault(
+      settings.derivative_window, model, "ilqg_derivative_window");
+  settings.shooting_segments =
+      std::clamp(GetNumberOrDefault(settings.shooting_segments, model,
+                                    "ilqg_shooting_segments"),
+                 1, kMaxTrajectory);
+  settings.adaptive_linesearch = GetNumberOrDefault(
+      settings.adaptive_linesearch, model, "ilqg_adaptive_linesearch");
+  settings.sufficient_decrease = GetNumberOrDefault(
+      settings.sufficient_decrease, model, "ilqg_sufficient_decrease");
+  settings.residual_sensor_rows = GetNumberOrDefault(
+      settings.residual_sensor_rows, model, "ilqg_residual_sensor_rows");
+  settings.partition_threshold = GetNumberOrDefault(
+      settings.partition_threshold, model, "ilqg_partition_threshold");
+  settings.partition_tolerance = GetNumberOrDefault(
+      settings.partition_tolerance, model, "ilqg_partition_tolerance");
+
+  // differentiated sensor values, the cost only reads the residuals
+  dim_sensor = settings.residual_sensor_rows && task.num_residual > 0
+                   ? task.num_residual
+                   : model->nsensordata;
+  derivative_sensor_rows_ = dim_sensor;
+}
+
+// differentiated sensor rows
+int iLQGPlanner::DerivativeSensorRows() const {
+  if (!settings.residual_sensor_rows || task->num_residual == 0) {
+    return dim_sensor;
+  }
+  int rows = 0;
+  int shift = 0;
+  for (int k = 0; k < task->num_term; k++) {
+    shift += task->dim_norm_residual[k];
+    if (task->weight[k] != 0.0) rows = shift;
+  }
+  return rows;
 }
 
 // allocate memory
@@ -72,19 +136,32 @@ void iLQGPlanner::Allocate() {
   userdata.resize(model->nuserdata);
 
   // candidate trajectories
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
     trajectory[i].Initialize(dim_state, dim_action, task->num_residual,
                              task->num_trace, kMaxTrajectoryHorizon);
     trajectory[i].Allocate(kMaxTrajectoryHorizon);
+  });
+
+  // multiple-shooting segments
+  segment_trajectory_.resize(
+      settings.shooting_segments > 1 ? settings.shooting_segments : 0);
+  for (Trajectory& segment : segment_trajectory_) {
+    segment.Initialize(dim_state, dim_action, task->num_residual,
+                       task->num_trace, kMaxTrajectoryHorizon);
+    segment.Allocate(kMaxTrajectoryHorizon);
   }
+  defects_.resize(kMaxTrajectoryHorizon * dim_state_derivative);
 
-  // model derivatives
+  // model and cost derivatives, of the streamed window only
+  derivative_window_ =
+      std::clamp(settings.derivative_window, 0, kMaxTrajectoryHorizon);
+  int derivative_steps = DerivativeSteps(kMaxTrajectoryHorizon);
   model_derivative.Allocate(dim_state_derivative, dim_action, dim_sensor,
-                            kMaxTrajectoryHorizon);
-
-  // costs derivatives
+                            derivative_steps);
+  model_derivative.window = derivative_window_;
   cost_derivative.Allocate(dim_state_derivative, dim_action, task->num_residual,
-                           kMaxTrajectoryHorizon, dim_max);
+                           derivative_steps, dim_max);
+  cost_derivative.window = derivative_window_;
 
   // backward pass
   backward_pass.Allocate(dim_state_derivative, dim_action,
@@ -93,9 +170,9 @@ void iLQGPlanner::Allocate() {
   // policy
   policy.Allocate(model, *task, kMaxTrajectoryHorizon);
   previous_policy.Allocate(model, *task, kMaxTrajectoryHorizon);
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
     candidate_policy[i].Allocate(model, *task, kMaxTrajectoryHorizon);
-  }
+  });
 
   // ----- boxQP ----- //
   boxqp.Allocate(dim_action);
@@ -110,11 +187,12 @@ void iLQGPlanner::Reset(int horizon, const double* initial_repeated_action) {
   time = 0.0;
 
   // model derivatives
-  model_derivative.Reset(dim_state_derivative, dim_action, dim_sensor, horizon);
+  model_derivative.Reset(dim_state_derivative, dim_action, dim_sensor,
+                         DerivativeSteps(horizon));
 
   // cost derivatives
   cost_derivative.Reset(dim_state_derivative, dim_action, task->num_residual,
-                        horizon);
+                        DerivativeSteps(horizon));
 
   // backward pass
   backward_pass.Reset(dim_state_derivative, dim_action, horizon);
@@ -122,19 +200,19 @@ void iLQGPlanner::Reset(int horizon, const double* initial_repeated_action) {
   // policy
   policy.Reset(horizon, initial_repeated_action);
   previous_policy.Reset(horizon, initial_repeated_action);
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    candidate_policy[i].Reset(horizon, initial_repeated_action);
-  }
+  PublishPolicy();
 
-  // candidate trajectories
-  for (int i = 0; i < kMaxTrajectory; i++) {
+  // candidate policies and trajectories
+  ForEachAllocation(kMaxTrajectory, [&](int i) {
+    candidate_policy[i].Reset(horizon, initial_repeated_action);
     trajectory[i].Reset(horizon, initial_repeated_action);
-  }
+  });
 
   // values
   action_step = 0.0;
   feedback_scaling = 0.0;
   improvement = 0.0;
+  active_set_change_ratio = 0.0;
   expected = 0.0;
   surprise = 0.0;
 }
@@ -145,14 +223,135 @@ void iLQGPlanner::SetState(const State& state) {
                &this->time);
 }
 
+// warm start the nominal policy from another planner's trajectory
+void iLQGPlanner::WarmStart(const Trajectory& trajectory) {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.trajectory = trajectory;
+  std::fill(policy.feedback_gain.begin(), policy.feedback_gain.end(), 0.0);
+  std::fill(policy.action_improvement.begin(), policy.action_improvement.end(),
+            0.0);
+}
+
+void iLQGPlanner::Snapshot(SnapshotWriter& writer) const {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.Snapshot(writer, "ilqg.policy");
+  writer.Add("ilqg.regularization", backward_pass.regularization);
+}
+
+bool iLQGPlanner::Restore(const SnapshotReader& reader) {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    if (!policy.Restore(reader, "ilqg.policy")) return false;
+    previous_policy.CopyFrom(policy, policy.trajectory.horizon);
+  }
+  PublishPolicy();
+  backward_pass.regularization =
+      reader.Get("ilqg.regularization", backward_pass.regularization);
+  return true;
+}
+
+
+// publish policy and previous_policy, copying the horizon only
+void iLQGPlanner::PublishPolicy() {
+  bool compact = settings.compact_gains;
+  published_policy_.Publish(
+      policy, previous_policy,
+      [compact](iLQGPolicy& published, const iLQGPolicy& source) {
+        published.PublishFrom(source, compact);
+      });
+}
+
 void iLQGPlanner::UpdateNumTrajectoriesFromGUI() {
   num_trajectory_ = mju_min(num_rollouts_gui_, kMaxTrajectory);
 }
 
+// rollout nominal in parallel segments
+bool iLQGPlanner::MultipleShootingNominal(int horizon, int num_segment,
+                                          ThreadPool& pool) {
+  const Trajectory& previous = candidate_policy[0].trajectory;
+  double timestep = model->opt.timestep;
+  int num_step = horizon - 1;
+
+  // previous nominal time index at the start of segment k, -1 if not aligned
+  auto start_index = [&](int k) {
+    double start = time + (k * num_step / num_segment) * timestep;
+    int index = std::lround((start - previous.times[0]) / timestep);
+    if (index < 0 || index >= horizon ||
+        mju_abs(previous.times[index] - start) > 1.0e-3 * timestep) {
+      return -1;
+    }
+    return index;
+  };
+  for (int k = 1; k < num_segment; k++) {
+    if (start_index(k) < 0) return false;
+  }
+
+  // segment rollouts (parallel)
+  pool.ParallelFor(0, num_segment, 1, [&, &data = data_](int k) {
+    int begin = k * num_step / num_segment;
+    int end = (k + 1) * num_step / num_segment;
+    candidate_policy[k].feedback_scaling = linesearch_steps[0];
+
+    // policy
+    auto feedback_policy =
+        [&candidate_policy = candidate_policy[k], &settings = settings](
+            double* action, const double* state, double time) {
+          candidate_policy.Action(
+              action, settings.nominal_feedback_scaling ? state : NULL, time);
+        };
+
+    // the first segment starts at the current state
+    int index = k == 0 ? 0 : start_index(k);
+    const double* start =
+        k == 0 ? state.data() : DataAt(previous.states, index * dim_state);
+    double start_time = k == 0 ? time : previous.times[index];
+    segment_trajectory_[k].Rollout(feedback_policy, task, model,
+                                   data[ThreadPool::WorkerId()], start,
+                                   start_time, mocap.data(), userdata.data(),
+                                   end - begin + 1);
+    counters_.AddRollout(segment_trajectory_[k]);
+  });
+
+  // assemble nominal, the last segment includes the final state
+  Trajectory& nominal = trajectory[0];
+  std::fill(defects_.begin(), defects_.begin() + horizon * dim_state_derivative,
+            0.0);
+  for (int k = 0; k < num_segment; k++) {
+    const Trajectory& segment = segment_trajectory_[k];
+    if (segment.failure) return false;
+    int begin = k * num_step / num_segment;
+    int end = (k + 1) * num_step / num_segment;
+    int n = end - begin + (k == num_segment - 1);
+    mju_copy(DataAt(nominal.states, begin * dim_state), segment.states.data(),
+             n * dim_state);
+    mju_copy(DataAt(nominal.actions, begin * dim_action),
+             segment.actions.data(), n * dim_action);
+    mju_copy(DataAt(nominal.times, begin), segment.times.data(), n);
+    mju_copy(DataAt(nominal.residual, begin * nominal.dim_residual),
+             segment.residual.data(), n * nominal.dim_residual);
+    mju_copy(DataAt(nominal.trace, begin * nominal.dim_trace),
+             segment.trace.data(), n * nominal.dim_trace);
+
+    // defect between the previous segment's final state and this start
+    if (k > 0) {
+      const Trajectory& above = segment_trajectory_[k - 1];
+      StateDiff(model, DataAt(defects_, begin * dim_state_derivative),
+                segment.states.data(),
+                DataAt(above.states, (above.horizon - 1) * dim_state), 1.0);
+    }
+  }
+  nominal.failure = false;
+  nominal.pruned = false;
+  nominal.Evaluate(task, horizon);
+  return true;
+}
+
 // optimize nominal policy using iLQG
 void iLQGPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   // freeze the GUI value once per optimization step.
   UpdateNumTrajectoriesFromGUI();
+  counters_.Reset();
+
   // get nominal trajectory
   this->NominalTrajectory(horizon, pool);
 
@@ -169,7 +368,8 @@ void iLQGPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
   policy.trajectory.horizon = horizon;
 
   // resize data for rollouts
-  ResizeMjData(model, pool.NumThreads());
+  // with one extra for the planning thread in pipelined derivatives
+  ResizeMjData(model, pool.NumThreads() + 1, &pool);
 
   // step sizes (log scaling)
   LogScale(linesearch_steps, 1.0, settings.min_linesearch_step,
@@ -178,18 +378,37 @@ void iLQGPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
 
   // ----- nominal rollout ----- //
   // start timer
-  auto nominal_start = std::chrono::steady_clock::now();
+  TraceSpan nominal_span("iLQGPlanner::nominal");
+
+  // segments of a multiple-shooting nominal, each with its own policy copy
+  int num_segment =
+      mju_min(static_cast<int>(segment_trajectory_.size()),
+              (horizon - 1) / kMinShootingSteps);
 
   // no one else should be writing, but we lock just in case:
   {
     const std::shared_lock<std::shared_mutex> lock(mtx_);
-    for (int i = 0; i < num_trajectory_; i++) {
+    for (int i = 0; i < mju_max(num_trajectory_, num_segment); i++) {
       candidate_policy[i].CopyFrom(policy, horizon);
       candidate_policy[i].representation = policy.representation;
     }
   }
 
-  // feedback rollouts (parallel)
+  // multiple-shooting nominal
+  multiple_shooting_ =
+      num_segment > 1 && MultipleShootingNominal(horizon, num_segment, pool);
+  if (multiple_shooting_) {
+    candidate_policy[0].trajectory = trajectory[0];
+    feedback_scaling = linesearch_steps[0];
+    nominal_compute_time = nominal_span.End();
+    return;
+  }
+
+  // feedback rollouts (parallel), recording solver warm starts for the
+  // derivatives of the winner
+  for (int i = 0; i < num_trajectory_; i++) {
+    trajectory[i].record_warmstart = settings.derivative_warmstart;
+  }
   this->FeedbackRollouts(horizon, pool);
 
   // evaluate rollouts
@@ -216,18 +435,44 @@ void iLQGPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
   }
 
   // end timer
-  nominal_compute_time = GetDuration(nominal_start);
+  nominal_compute_time = nominal_span.End();
 }
 
 // set action from policy
 void iLQGPlanner::ActionFromPolicy(double* action, const double* state,
                                    double time, bool use_previous) {
-  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  // published policies aren't modified, their actions can be cached
+  auto published = published_policy_.Latest();
+  if (!published) return;
   if (use_previous) {
-    previous_policy.Action(action, state, time);
+    published->previous_policy.CachedAction(action, state, time);
   } else {
-    policy.Action(action, state, time);
+    published->policy.CachedAction(action, state, time);
+  }
+}
+
+bool iLQGPlanner::ExportPolicy(ExportedPolicy& policy) const {
+  auto published = published_policy_.Latest();
+  if (!published) return false;
+  published->policy.Export(policy);
+  policy.version = published->version;
+  return true;
+}
+
+void iLQGPlanner::ReportMemory(MemoryReport& report) const {
+  std::size_t trajectories = VectorBytes(segment_trajectory_, defects_);
+  std::size_t policies = policy.Bytes() + previous_policy.Bytes();
+  for (int i = 0; i < kMaxTrajectory; i++) {
+    trajectories += trajectory[i].Bytes();
+    policies += candidate_policy[i].Bytes();
   }
+  for (const Trajectory& t : segment_trajectory_) trajectories += t.Bytes();
+  report.Add("trajectories", trajectories);
+  report.Add("policies", policies);
+  report.Add("model_derivatives", model_derivative.Bytes());
+  report.Add("cost_derivatives", cost_derivative.Bytes());
+  report.Add("backward_pass", backward_pass.Bytes());
+  report.Add("scratch", VectorBytes(state, mocap, userdata));
 }
 
 // return trajectory with best total return
@@ -248,6 +493,8 @@ void iLQGPlanner::GUI(mjUI& ui) {
        "Zero\nLinear\nCubic"},
       {mjITEM_SELECT, "Reg. Type", 2, &settings.regularization_type,
        "Control\nFeedback\nValue\nNone"},
+      {mjITEM_CHECKINT, "Adaptive LS", 2, &settings.adaptive_linesearch, ""},
+      {mjITEM_CHECKINT, "Pipeline", 2, &settings.pipeline, ""},
       {mjITEM_CHECKINT, "Terminal Print", 2, &settings.verbose, ""},
       {mjITEM_END}};
 
@@ -285,6 +532,20 @@ void iLQGPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                        mju_log10(mju_max(feedback_scaling, 1.0e-6)), 100,
                        2 + planner_shift, 0, 1, -100);
 
+  // derivative skip ratio
+  mjpc::PlotUpdateData(
+      fig_planner, planner_bounds,
+      fig_planner->linedata[3 + planner_shift][0] + 1,
+      mju_log10(mju_max(model_derivative.skip_ratio, 1.0e-6)), 100,
+      3 + planner_shift, 0, 1, -100);
+
+  // boxQP active set changes
+  mjpc::PlotUpdateData(
+      fig_planner, planner_bounds,
+      fig_planner->linedata[4 + planner_shift][0] + 1,
+      mju_log10(mju_max(active_set_change_ratio, 1.0e-6)), 100,
+      4 + planner_shift, 0, 1, -100);
+
   // improvement
   // mjpc::PlotUpdateData(
   //     fig_planner, planner_bounds, fig_planner->linedata[3 +
@@ -307,6 +568,8 @@ void iLQGPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   mju::strcpy_arr(fig_planner->linename[0 + planner_shift], "Regularization");
   mju::strcpy_arr(fig_planner->linename[1 + planner_shift], "Action Step");
   mju::strcpy_arr(fig_planner->linename[2 + planner_shift], "Feedback Scaling");
+  mju::strcpy_arr(fig_planner->linename[3 + planner_shift], "Derivative Skip");
+  mju::strcpy_arr(fig_planner->linename[4 + planner_shift], "Active Set Chg.");
   // mju::strcpy_arr(fig_planner->linename[3 + planner_shift], "Improvement");
   // mju::strcpy_arr(fig_planner->linename[4 + planner_shift], "Expected");
   // mju::strcpy_arr(fig_planner->linename[5 + planner_shift], "Surprise");
@@ -363,7 +626,7 @@ void iLQGPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   fig_timer->range[1][1] = timer_bounds[1];
 
   // planner shift
-  shift[0] += 3;
+  shift[0] += 5;
 
   // timer shift
   shift[1] += 6;
@@ -376,83 +639,212 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
 
   // ----- setup ----- //
   // resize data for rollouts
-  ResizeMjData(model, pool.NumThreads());
-
-  // step sizes (log scaling)
-  LogScale(linesearch_steps, 1.0, settings.min_linesearch_step,
-           num_trajectory_ - 1);
-  linesearch_steps[num_trajectory_ - 1] = 0.0;
-
-  // ----- model derivatives ----- //
-  // start timer
-  auto model_derivative_start = std::chrono::steady_clock::now();
-
-  // compute model and sensor Jacobians
-  model_derivative.Compute(
-      model, data_, candidate_policy[0].trajectory.states.data(),
-      candidate_policy[0].trajectory.actions.data(),
-      candidate_policy[0].trajectory.times.data(), dim_state,
-      dim_state_derivative, dim_action, dim_sensor, horizon,
-      settings.fd_tolerance, settings.fd_mode, pool);
-
-  // stop timer
-  double model_derivative_time = GetDuration(model_derivative_start);
-
-  // ----- cost derivatives ----- //
-  // start timer
-  auto cost_derivative_start = std::chrono::steady_clock::now();
-
-  // cost derivatives
-  cost_derivative.Compute(
-      candidate_policy[0].trajectory.residual.data(), model_derivative.C.data(),
-      model_derivative.D.data(), dim_state_derivative, dim_action, dim_max,
-      dim_sensor, task->num_residual, task->dim_norm_residual.data(),
-      task->num_term, task->weight.data(), task->norm.data(),
-      task->norm_parameter.data(), task->num_norm_parameter.data(), task->risk,
-      horizon, pool);
-
-  // end timer
-  double cost_derivative_time = GetDuration(cost_derivative_start);
+  // with one extra for the planning thread in pipelined derivatives
+  ResizeMjData(model, pool.NumThreads() + 1, &pool);
+
+  // step sizes
+  LinesearchSteps();
+
+  // streamed derivatives aren't kept for skipping
+  bool streaming = derivative_window_ > 0;
+  double skip_tolerance = streaming ? 0.0 : settings.fd_skip_tolerance;
+
+  // warm start, align derivatives from the previous iteration with the
+  // advanced horizon so that skipping compares the same time steps
+  int shift = WarmStartShift(time, model->opt.timestep);
+
+  // zero-weight terms after the last active one aren't differentiated, the
+  // stored derivatives of other rows can't be compared for skipping
+  int sensor_rows = DerivativeSensorRows();
+  if (sensor_rows != derivative_sensor_rows_) {
+    model_derivative.Shift(-1, dim_state, dim_state_derivative, dim_action,
+                           derivative_sensor_rows_);
+    derivative_sensor_rows_ = sensor_rows;
+  }
+  if (skip_tolerance > 0.0) {
+    model_derivative.Shift(shift, dim_state, dim_state_derivative, dim_action,
+                           derivative_sensor_rows_);
+  }
+  backward_pass.ShiftBoxQP(shift, dim_action);
+
+  // ----- pipelined derivatives ----- //
+  // the pool computes model and cost derivatives from the last time step down
+  // while the backward pass below consumes them, in the pool's high priority
+  // lane since the backward pass waits on them. their time is included in
+  // the backward pass time. streamed derivatives are stored in a window of
+  // derivative_window_ time steps, a step waits for the backward pass to
+  // consume the step derivative_window_ later that shares its storage.
+  bool pipeline = settings.pipeline || streaming;
+  TaskGroup derivatives(pool, TaskPriority::kHigh);
+  int pipeline_id = pool.NumThreads();
+  auto start_derivatives = [&]() {
+    next_derivative_.store(0);
+    consumed_derivative_.store(horizon, std::memory_order_relaxed);
+    stop_derivative_.store(false, std::memory_order_relaxed);
+    for (int t = 0; t < horizon; t++) {
+      derivative_ready_[t].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < pool.NumThreads(); i++) {
+      derivatives.Schedule([this, horizon]() {
+        while (next_derivative_.load() < horizon &&
+               !stop_derivative_.load(std::memory_order_acquire)) {
+          if (!PipelineDerivative(horizon, ThreadPool::WorkerId())) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+  };
+  auto stop_derivatives = [&]() {
+    stop_derivative_.store(true, std::memory_order_release);
+    derivatives.Wait();
+  };
+  auto consume_derivative = [&](int t) {
+    if (streaming) consumed_derivative_.store(t, std::memory_order_release);
+  };
+  auto wait_derivative = [&](int t) {
+    while (!derivative_ready_[t].load(std::memory_order_acquire)) {
+      // help with the next step instead of waiting
+      if (!PipelineDerivative(horizon, pipeline_id)) {
+        std::this_thread::yield();
+      }
+    }
+  };
+  double model_derivative_time = 0.0;
+  double cost_derivative_time = 0.0;
+
+  // solver warm starts of the nominal rollout, not recorded by segments
+  const Trajectory& nominal = candidate_policy[0].trajectory;
+  bool nominal_warmstart =
+      settings.derivative_warmstart && !multiple_shooting_ &&
+      nominal.record_warmstart &&
+      static_cast<int>(nominal.warmstart.size()) >= horizon * model->nv;
+  model_derivative.warmstart =
+      nominal_warmstart ? nominal.warmstart.data() : nullptr;
+
+  if (pipeline) {
+    model_derivative.Prepare(model, data_.size(),
+                             candidate_policy[0].trajectory.states.data(),
+                             candidate_policy[0].trajectory.actions.data(),
+                             dim_state, dim_action, derivative_sensor_rows_,
+                             horizon, settings.fd_coloring, skip_tolerance);
+    cost_derivative.Reset(dim_state_derivative, dim_action, task->num_residual,
+                          DerivativeSteps(horizon));
+    start_derivatives();
+  } else {
+    // ----- model derivatives ----- //
+    // start timer
+    TraceSpan model_derivative_span("iLQGPlanner::model_derivative");
+
+    // compute model and sensor Jacobians
+    model_derivative.Compute(
+        model, data_, candidate_policy[0].trajectory.states.data(),
+        candidate_policy[0].trajectory.actions.data(),
+        candidate_policy[0].trajectory.times.data(), dim_state,
+        dim_state_derivative, dim_action, derivative_sensor_rows_, horizon,
+        settings.fd_tolerance, settings.fd_mode, pool, settings.fd_coloring,
+        settings.fd_skip_tolerance);
+
+    // stop timer
+    model_derivative_time = model_derivative_span.End();
+
+    // ----- cost derivatives ----- //
+    // start timer
+    TraceSpan cost_derivative_span("iLQGPlanner::cost_derivative");
+
+    // cost derivatives
+    cost_derivative.Compute(
+        candidate_policy[0].trajectory.residual.data(),
+        model_derivative.C.data(), model_derivative.D.data(),
+        dim_state_derivative, dim_action, dim_max, derivative_sensor_rows_,
+        task->num_residual, task->dim_norm_residual.data(), task->num_term,
+        task->weight.data(), task->norm.data(), task->norm_parameter.data(),
+        task->num_norm_parameter.data(), task->risk, horizon, pool);
+
+    // end timer
+    cost_derivative_time = cost_derivative_span.End();
+  }
 
   // ----- backward pass ----- //
   // start timer
-  auto backward_pass_start = std::chrono::steady_clock::now();
+  TraceSpan backward_pass_span("iLQGPlanner::backward_pass");
 
   // initialize backward pass
+  boxqp.num_solve = boxqp.num_change = 0;
+  for (iLQGBackwardPassSegment& segment : backward_pass.segments) {
+    segment.boxqp.num_solve = segment.boxqp.num_change = 0;
+  }
   int regularization_iteration = 0;
   int backward_pass_status = 0;
+  int derivative_passes = 1;
   int t;
+
+  // partitioned over the pool for long horizons and large states, the
+  // sequential recursion below handles its failures with regularization
+  int num_partition =
+      mju_min(pool.NumThreads(), (horizon - 1) / kMinPartitionSteps);
+  double backward_pass_size = static_cast<double>(horizon) *
+                              dim_state_derivative * dim_state_derivative *
+                              dim_state_derivative;
+  if (!pipeline && num_partition > 1 && settings.partition_threshold > 0.0 &&
+      backward_pass_size > settings.partition_threshold) {
+    int sweeps = backward_pass.RiccatiPartitioned(
+        &candidate_policy[0], &model_derivative, &cost_derivative,
+        dim_state_derivative, dim_action, horizon,
+        backward_pass.regularization,
+        candidate_policy[0].trajectory.actions.data(),
+        model->actuator_ctrlrange, settings.regularization_type,
+        settings.action_limits, num_partition, settings.partition_tolerance,
+        pool, multiple_shooting_ ? defects_.data() : nullptr);
+    backward_pass_status = sweeps > 0;
+    if (settings.verbose) {
+      printf("Partitioned Backward Pass: %i partitions, %i sweeps\n",
+             num_partition, sweeps);
+    }
+  }
   while (regularization_iteration < settings.max_regularization_iterations &&
          backward_pass_status == 0) {
     // reset cost-to-go approximation difference
     mju_zero(backward_pass.dV, 2);
 
+    // the failed pass consumed the streamed derivatives, compute them again
+    if (streaming && regularization_iteration > 0) {
+      stop_derivatives();
+      start_derivatives();
+      derivative_passes++;
+    }
+
     // terminal time step cost-to-go
+    if (pipeline) wait_derivative(horizon - 1);
+    int terminal = cost_derivative.Slot(horizon - 1);
     mju_copy(DataAt(backward_pass.Vx, (horizon - 1) * dim_state_derivative),
-             DataAt(cost_derivative.cx, (horizon - 1) * dim_state_derivative),
+             DataAt(cost_derivative.cx, terminal * dim_state_derivative),
              dim_state_derivative);
     mju_copy(DataAt(backward_pass.Vxx, (horizon - 1) * dim_state_derivative *
                                            dim_state_derivative),
-             DataAt(cost_derivative.cxx, (horizon - 1) * dim_state_derivative *
-                                             dim_state_derivative),
+             DataAt(cost_derivative.cxx,
+                    terminal * dim_state_derivative * dim_state_derivative),
              dim_state_derivative * dim_state_derivative);
+    consume_derivative(horizon - 1);
 
     // backward recursion
     for (t = horizon - 2; t >= 0; t--) {
+      if (pipeline) wait_derivative(t);
+      int slot = cost_derivative.Slot(t);
       int status = backward_pass.RiccatiStep(
           dim_state_derivative, dim_action, backward_pass.regularization,
           DataAt(backward_pass.Vx, (t + 1) * dim_state_derivative),
           DataAt(backward_pass.Vxx,
                  (t + 1) * dim_state_derivative * dim_state_derivative),
           DataAt(model_derivative.A,
-                 t * dim_state_derivative * dim_state_derivative),
-          DataAt(model_derivative.B, t * dim_state_derivative * dim_action),
-          DataAt(cost_derivative.cx, t * dim_state_derivative),
-          DataAt(cost_derivative.cu, t * dim_action),
+                 slot * dim_state_derivative * dim_state_derivative),
+          DataAt(model_derivative.B, slot * dim_state_derivative * dim_action),
+          DataAt(cost_derivative.cx, slot * dim_state_derivative),
+          DataAt(cost_derivative.cu, slot * dim_action),
           DataAt(cost_derivative.cxx,
-                 t * dim_state_derivative * dim_state_derivative),
-          DataAt(cost_derivative.cxu, t * dim_state_derivative * dim_action),
-          DataAt(cost_derivative.cuu, t * dim_action * dim_action),
+                 slot * dim_state_derivative * dim_state_derivative),
+          DataAt(cost_derivative.cxu, slot * dim_state_derivative * dim_action),
+          DataAt(cost_derivative.cuu, slot * dim_action * dim_action),
           DataAt(backward_pass.Vx, t * dim_state_derivative),
           DataAt(backward_pass.Vxx,
                  t * dim_state_derivative * dim_state_derivative),
@@ -468,7 +860,13 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
           backward_pass.Q_scratch.data(), boxqp,
           DataAt(candidate_policy[0].trajectory.actions, t * dim_action),
           model->actuator_ctrlrange, settings.regularization_type,
-          settings.action_limits);
+          settings.action_limits,
+          DataAt(backward_pass.boxqp_solution, t * dim_action),
+          DataAt(backward_pass.boxqp_free, t * dim_action),
+          multiple_shooting_
+              ? DataAt(defects_, (t + 1) * dim_state_derivative)
+              : nullptr);
+      consume_derivative(t);
 
       // failure
       if (!status) {
@@ -515,8 +913,26 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
     }
   }
 
+  // remaining pipelined derivatives, if the backward pass failed early.
+  // streamed steps would wait for slots that are no longer consumed.
+  if (streaming) {
+    stop_derivatives();
+  } else {
+    derivatives.Wait();
+  }
+  counters_.AddDerivatives(derivative_passes * model_derivative.num_evaluated);
+
+  // warm-started boxQP solves whose active set changed
+  int boxqp_solve = boxqp.num_solve, boxqp_change = boxqp.num_change;
+  for (const iLQGBackwardPassSegment& segment : backward_pass.segments) {
+    boxqp_solve += segment.boxqp.num_solve;
+    boxqp_change += segment.boxqp.num_change;
+  }
+  active_set_change_ratio =
+      boxqp_solve > 0 ? static_cast<double>(boxqp_change) / boxqp_solve : 0.0;
+
   // end timer
-  double backward_pass_time = GetDuration(backward_pass_start);
+  double backward_pass_time = backward_pass_span.End();
 
   // terminate early if backward pass failure
   if (backward_pass_status == 0) {
@@ -530,16 +946,16 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
   }
 
   // ----- rollout policy ----- //
-  auto rollouts_start = std::chrono::steady_clock::now();
+  TraceSpan rollouts_span("iLQGPlanner::rollouts");
 
-  // copy policy
+  // copy policy, the candidates share the gains of candidate_policy[0]
   for (int j = 1; j < num_trajectory_; j++) {
-    candidate_policy[j].CopyFrom(candidate_policy[0], horizon);
+    candidate_policy[j].CopyReferenceFrom(candidate_policy[0], horizon);
     candidate_policy[j].representation = candidate_policy[0].representation;
   }
 
   // feedback rollouts (parallel)
-  this->ActionRollouts(horizon, pool);
+  this->ActionRollouts(horizon, previous_return, pool);
 
   // ----- evaluate rollouts ----- //
 
@@ -584,23 +1000,28 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
   }
 
   // stop timer
-  double rollouts_time = GetDuration(rollouts_start);
+  double rollouts_time = rollouts_span.End();
 
   // ----- policy update ----- //
   // start timer
-  auto policy_update_start = std::chrono::steady_clock::now();
+  TraceSpan policy_update_span("iLQGPlanner::policy_update");
   {
     const std::shared_lock<std::shared_mutex> lock(mtx_);
-    // improvement
-    previous_policy = policy;
-    policy.CopyFrom(candidate_policy[winner], horizon);
+    // improvement, the previous policy's storage is reused for the new one
+    std::swap(previous_policy, policy);
+    policy.CopyReferenceFrom(candidate_policy[winner], horizon);
+    mju_copy(policy.feedback_gain.data(),
+             candidate_policy[0].feedback_gain.data(),
+             horizon * dim_action * dim_state_derivative);
+    policy.representation = previous_policy.representation;
 
     // feedback scaling
     policy.feedback_scaling = 1.0;
   }
+  PublishPolicy();
 
   // stop timer
-  double policy_update_time = GetDuration(policy_update_start);
+  double policy_update_time = policy_update_span.End();
 
   // set timers
   model_derivative_compute_time = model_derivative_time;
@@ -611,100 +1032,118 @@ void iLQGPlanner::Iteration(int horizon, ThreadPool& pool) {
 }
 
 // compute candidate trajectories
-void iLQGPlanner::ActionRollouts(int horizon, ThreadPool& pool) {
-  int count_before = pool.GetCount();
-  for (int i = 0; i < num_trajectory_; i++) {
-    pool.Schedule([&data = data_, &trajectory = trajectory,
-                   &candidate_policy = candidate_policy,
-                   &linesearch_steps = linesearch_steps, &model = this->model,
-                   &task = this->task, &state = this->state, &time = this->time,
-                   &mocap = this->mocap, horizon, &userdata = this->userdata,
-                   i]() {
-      // scale improvement
-      mju_addScl(candidate_policy[i].trajectory.actions.data(),
-                 candidate_policy[i].trajectory.actions.data(),
-                 candidate_policy[i].action_improvement.data(),
-                 linesearch_steps[i], model->nu * horizon);
-
-      // policy
-      auto feedback_policy = [&candidate_policy = candidate_policy, model, i](
-                                 double* action, const double* state,
-                                 int index) {
-        // dimensions
-        int dim_state = model->nq + model->nv + model->na;
-        int dim_state_derivative = 2 * model->nv + model->na;
-        int dim_action = model->nu;
-
-        // set improved action
-        mju_copy(
-            action,
-            DataAt(candidate_policy[i].trajectory.actions, index * dim_action),
-            dim_action);
-
-        // ----- feedback ----- //
-
-        // difference between current state and nominal state
-        StateDiff(
-            model, candidate_policy[i].state_scratch.data(),
-            DataAt(candidate_policy[i].trajectory.states, index * dim_state),
-            state, 1.0);
-
-        // compute feedback term
-        mju_mulMatVec(candidate_policy[i].action_scratch.data(),
-                      DataAt(candidate_policy[i].feedback_gain,
-                             index * dim_action * dim_state_derivative),
-                      candidate_policy[i].state_scratch.data(), dim_action,
-                      dim_state_derivative);
-
-        // add feedback
-        mju_addTo(action, candidate_policy[i].action_scratch.data(),
-                  dim_action);
-
-        // clamp controls
-        Clamp(action, model->actuator_ctrlrange, dim_action);
-      };
-
-      // policy rollout (discrete time)
-      trajectory[i].RolloutDiscrete(
-          feedback_policy, task, model, data[ThreadPool::WorkerId()].get(),
-          state.data(), time, mocap.data(), userdata.data(), horizon);
-    });
-  }
-  pool.WaitCount(count_before + num_trajectory_);
+void iLQGPlanner::ActionRollouts(int horizon, double previous_return,
+                                 ThreadPool& pool) {
+  // steps are claimed largest first (the zero step last). accepted is the
+  // first claim position whose step passed the sufficient decrease test.
+  std::atomic<int> accepted(num_trajectory_);
+  bool adaptive = settings.adaptive_linesearch;
+  if (adaptive) linesearch_bound_.Reset(1);
+
+  pool.ParallelFor(0, num_trajectory_, 1, [&, &data = data_](int k) {
+    int i = k < num_trajectory_ - 1 ? num_trajectory_ - 2 - k : k;
+
+    // a larger step was already accepted
+    if (adaptive && k > accepted.load(std::memory_order_relaxed)) {
+      trajectory[i].pruned = true;
+      return;
+    }
+
+    // past the deadline, truncate the line search. the largest step and the
+    // zero step still run so the nominal remains a candidate.
+    if (k > 0 && k < num_trajectory_ - 1 && DeadlinePassed()) {
+      trajectory[i].pruned = true;
+      return;
+    }
 
-  pool.ResetCount();
+    // scale improvement
+    mju_addScl(candidate_policy[i].trajectory.actions.data(),
+               candidate_policy[i].trajectory.actions.data(),
+               candidate_policy[i].action_improvement.data(),
+               linesearch_steps[i], model->nu * horizon);
+
+    // policy
+    auto feedback_policy = [this, i](double* action, const double* state,
+                                     int index) {
+      // dimensions
+      int dim_state = model->nq + model->nv + model->na;
+      int dim_state_derivative = 2 * model->nv + model->na;
+      int dim_action = model->nu;
+
+      // set improved action
+      mju_copy(
+          action,
+          DataAt(candidate_policy[i].trajectory.actions, index * dim_action),
+          dim_action);
+
+      // ----- feedback ----- //
+
+      // difference between current state and nominal state
+      StateDiff(
+          model, candidate_policy[i].state_scratch.data(),
+          DataAt(candidate_policy[i].trajectory.states, index * dim_state),
+          state, 1.0);
+
+      // compute feedback term
+      mju_mulMatVec(candidate_policy[i].action_scratch.data(),
+                    DataAt(candidate_policy[0].feedback_gain,
+                           index * dim_action * dim_state_derivative),
+                    candidate_policy[i].state_scratch.data(), dim_action,
+                    dim_state_derivative);
+
+      // add feedback
+      mju_addTo(action, candidate_policy[i].action_scratch.data(),
+                dim_action);
+
+      // clamp controls
+      Clamp(action, model->actuator_ctrlrange, dim_action);
+    };
+
+    // policy rollout (discrete time)
+    trajectory[i].RolloutDiscrete(
+        feedback_policy, task, model, data[ThreadPool::WorkerId()],
+        state.data(), time, mocap.data(), userdata.data(), horizon,
+        adaptive ? &linesearch_bound_ : nullptr);
+    counters_.AddRollout(trajectory[i]);
+
+    // sufficient decrease test
+    double step = linesearch_steps[i];
+    if (!adaptive || step <= 0.0 || trajectory[i].failure ||
+        trajectory[i].pruned) {
+      return;
+    }
+    double expected_decrease =
+        -1.0 * step * (backward_pass.dV[0] + step * backward_pass.dV[1]);
+    double decrease = previous_return - trajectory[i].total_return;
+    if (expected_decrease > 0.0 &&
+        decrease >= settings.sufficient_decrease * expected_decrease) {
+      int current = accepted.load(std::memory_order_relaxed);
+      while (k < current && !accepted.compare_exchange_weak(current, k)) {
+      }
+    }
+  });
 }
 
 // compute candidate trajectories searching over feedback scaling
 void iLQGPlanner::FeedbackRollouts(int horizon, ThreadPool& pool) {
-  int count_before = pool.GetCount();
-  for (int i = 0; i < num_trajectory_; i++) {
-    pool.Schedule([&data = data_, &trajectory = trajectory,
-                   &candidate_policy = candidate_policy,
-                   &linesearch_steps = linesearch_steps, &model = this->model,
-                   &task = this->task, &state = this->state, &time = this->time,
-                   &mocap = this->mocap, horizon, &userdata = this->userdata,
-                   &settings = this->settings, i]() {
-      // feedback scaling
-      candidate_policy[i].feedback_scaling = linesearch_steps[i];
-
-      // policy
-      auto feedback_policy =
-          [&candidate_policy = candidate_policy[i], &settings = settings](
-              double* action, const double* state, double time) {
-            candidate_policy.Action(
-                action, settings.nominal_feedback_scaling ? state : NULL, time);
-          };
-
-      // policy rollout
-      trajectory[i].Rollout(feedback_policy, task, model,
-                            data[ThreadPool::WorkerId()].get(), state.data(),
-                            time, mocap.data(), userdata.data(), horizon);
-    });
-  }
-  pool.WaitCount(count_before + num_trajectory_);
-
-  pool.ResetCount();
+  pool.ParallelFor(0, num_trajectory_, 1, [&, &data = data_](int i) {
+    // feedback scaling
+    candidate_policy[i].feedback_scaling = linesearch_steps[i];
+
+    // policy
+    auto feedback_policy =
+        [&candidate_policy = candidate_policy[i], &settings = settings](
+            double* action, const double* state, double time) {
+          candidate_policy.Action(
+              action, settings.nominal_feedback_scaling ? state : NULL, time);
+        };
+
+    // policy rollout
+    trajectory[i].Rollout(feedback_policy, task, model,
+                          data[ThreadPool::WorkerId()], state.data(),
+                          time, mocap.data(), userdata.data(), horizon);
+    counters_.AddRollout(trajectory[i]);
+  });
 }
 
 // return index of trajectory with best rollout
@@ -713,7 +1152,7 @@ int iLQGPlanner::BestRollout() {
   int best_rollout = -1;
 
   for (int j = num_trajectory_ - 1; j >= 0; j--) {
-    if (trajectory[j].failure) continue;
+    if (trajectory[j].failure || trajectory[j].pruned) continue;
     double rollout_return = trajectory[j].total_return;
     if (best_rollout == -1 || rollout_return < best_return) {
       best_return = rollout_return;
@@ -723,4 +1162,70 @@ int iLQGPlanner::BestRollout() {
   return best_rollout;
 }
 
+// set line search step sizes
+void iLQGPlanner::LinesearchSteps() {
+  // log scaling over the full range
+  double max_step = 1.0;
+  double min_step = settings.min_linesearch_step;
+
+  // concentrate around the last accepted step
+  if (settings.adaptive_linesearch && action_step > 0.0) {
+    max_step = mju_min(1.0, action_step * 10.0);
+    min_step = mju_max(min_step, action_step * 0.1);
+    if (min_step >= max_step) min_step = settings.min_linesearch_step;
+  }
+
+  LogScale(linesearch_steps, max_step, min_step, num_trajectory_ - 1);
+  linesearch_steps[num_trajectory_ - 1] = 0.0;
+}
+
+// compute derivatives at the next time step
+bool iLQGPlanner::PipelineDerivative(int horizon, int id) {
+  // claim the next step if its slot in the derivative window is free, i.e.,
+  // the backward pass consumed the step derivative_window_ later
+  int k = next_derivative_.load();
+  int t;
+  do {
+    if (k >= horizon || stop_derivative_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    t = horizon - 1 - k;
+    if (derivative_window_ > 0 &&
+        consumed_derivative_.load(std::memory_order_acquire) >
+            t + derivative_window_) {
+      return false;
+    }
+  } while (!next_derivative_.compare_exchange_weak(k, k + 1));
+  Trajectory& nominal = candidate_policy[0].trajectory;
+
+  // model and sensor Jacobians
+  model_derivative.ComputeStep(
+      model, data_[id], id, nominal.states.data(),
+      nominal.actions.data(), nominal.times.data(), dim_state,
+      dim_state_derivative, dim_action, derivative_sensor_rows_, horizon,
+      settings.fd_tolerance, settings.fd_mode, t);
+
+  // cost derivatives
+  cost_derivative.ComputeStep(
+      nominal.residual.data(), model_derivative.C.data(),
+      model_derivative.D.data(), dim_state_derivative, dim_action, dim_max,
+      derivative_sensor_rows_, task->num_residual,
+      task->dim_norm_residual.data(), task->num_term, task->weight.data(),
+      task->norm.data(), task->norm_parameter.data(),
+      task->num_norm_parameter.data(), task->risk, horizon, t);
+
+  derivative_ready_[t].store(1, std::memory_order_release);
+  return true;
+}
+
+// compute times of the last iteration's phases
+std::vector<PhaseTime> iLQGPlanner::PhaseTimes() const {
+  return {{"nominal", nominal_compute_time},
+          {"model_derivative", model_derivative_compute_time},
+          {"cost_derivative", cost_derivative_compute_time},
+          {"backward_pass", backward_pass_compute_time},
+          {"rollouts", rollouts_compute_time},
+          {"policy_update", policy_update_compute_time}};
+}
+
 }  // namespace mjpc
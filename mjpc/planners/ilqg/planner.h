@@ -15,6 +15,9 @@
 #ifndef MJPC_PLANNERS_ILQG_PLANNER_H_
 #define MJPC_PLANNERS_ILQG_PLANNER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <shared_mutex>
 #include <vector>
 
@@ -23,6 +26,7 @@
 #include "mjpc/planners/ilqg/policy.h"
 #include "mjpc/planners/ilqg/settings.h"
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy_buffer.h"
 #include "mjpc/states/state.h"
 #include "mjpc/trajectory.h"
 
@@ -76,11 +80,44 @@ class iLQGPlanner : public Planner {
     return policy.trajectory.dim_action * (policy.trajectory.horizon - 1);
   };
 
+  // compute times of the last iteration's phases
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // rollouts of an iteration
+  int NumRollouts() const override { return num_trajectory_; }
+  void SetNumRollouts(int num_rollouts) override {
+    num_rollouts_gui_ = std::clamp(num_rollouts, 1, kMaxTrajectory);
+  }
+
+  // warm start the nominal policy from another planner's trajectory
+  void WarmStart(const Trajectory& trajectory) override;
+
+  // snapshot of the nominal policy
+  void Snapshot(SnapshotWriter& writer) const override;
+  bool Restore(const SnapshotReader& reader) override;
+
+  // export the published policy
+  bool ExportPolicy(ExportedPolicy& policy) const override;
+
+  // bytes of the trajectories, policies, derivatives and backward pass
+  void ReportMemory(MemoryReport& report) const override;
+
+  // publications of the policy
+  std::uint64_t PolicyVersion() const {
+    auto published = published_policy_.Latest();
+    return published ? published->version : 0;
+  }
+
   // single iLQG iteration
   void Iteration(int horizon, ThreadPool& pool);
 
-  // linesearch over action improvement
-  void ActionRollouts(int horizon, ThreadPool& pool);
+  // reset the counters, for callers of Iteration (OptimizePolicy resets them)
+  void ResetCounters() { counters_.Reset(); }
+
+  // linesearch over action improvement. with adaptive line search, rollouts
+  // with steps smaller than an accepted step are skipped and rollouts that
+  // cannot beat the best completed return are stopped early.
+  void ActionRollouts(int horizon, double previous_return, ThreadPool& pool);
 
   // linesearch over feedback scaling
   void FeedbackRollouts(int horizon, ThreadPool& pool);
@@ -88,6 +125,18 @@ class iLQGPlanner : public Planner {
   // return index of trajectory with best rollout
   int BestRollout();
 
+  // set line search step sizes, with a final zero step
+  void LinesearchSteps();
+
+  // compute model and cost derivatives at the next unclaimed time step (from
+  // the last step down) using mjData slot id. returns false if no steps are
+  // left, the pipeline is stopped, or the step's storage slot in the
+  // derivative window is still in use.
+  bool PipelineDerivative(int horizon, int id);
+
+  // publish policy and previous_policy
+  void PublishPolicy();
+
   void UpdateNumTrajectoriesFromGUI();
 
   // ----- members ----- //
@@ -142,6 +191,8 @@ class iLQGPlanner : public Planner {
   double improvement;
   double expected;
   double surprise;
+  double active_set_change_ratio;  // warm-started boxQP solves that changed
+                                   // the active set
 
   // compute time
   double nominal_compute_time;
@@ -154,7 +205,49 @@ class iLQGPlanner : public Planner {
   // mutex
   mutable std::shared_mutex mtx_;
 
+  // policies published to ActionFromPolicy
+  PolicyBuffer<iLQGPolicy> published_policy_;
+
  private:
+  // best completed line search return, bounds the remaining rollouts
+  ReturnBound linesearch_bound_;
+
+  // pipelined derivatives, next time step to claim and per-step completion
+  std::atomic<int> next_derivative_{0};
+  std::atomic<int> derivative_ready_[kMaxTrajectoryHorizon];
+
+  // streamed derivatives: time steps stored by the derivatives (0: all, as
+  // allocated), the last time step the backward pass consumed, whose storage
+  // slot can be reused, and a flag that stops the remaining steps
+  int derivative_window_ = 0;
+  std::atomic<int> consumed_derivative_{0};
+  std::atomic<bool> stop_derivative_{false};
+
+  // time steps of derivatives stored for horizon
+  int DerivativeSteps(int horizon) const {
+    return derivative_window_ > 0 ? mju_min(horizon, derivative_window_)
+                                  : horizon;
+  }
+
+  // differentiated sensor rows, with residual sensor rows those up to the
+  // last term with nonzero weight, and the rows the previous iteration used
+  int DerivativeSensorRows() const;
+  int derivative_sensor_rows_ = 0;
+
+  // rollout the nominal in num_segment segments in parallel, segments after
+  // the first start at the previous nominal's states. returns false, leaving
+  // a single-shooting nominal to the caller, if the previous nominal isn't
+  // aligned with the horizon or a segment failed.
+  bool MultipleShootingNominal(int horizon, int num_segment, ThreadPool& pool);
+
+  // multiple-shooting nominal: segment rollouts, and the defects between
+  // simulated and nominal states at the segment starts
+  // (kMaxTrajectoryHorizon * dim_state_derivative), used by the backward pass
+  // if multiple_shooting_
+  std::vector<Trajectory> segment_trajectory_;
+  std::vector<double> defects_;
+  bool multiple_shooting_ = false;
+
   int num_trajectory_ = 1;
   int num_rollouts_gui_ = 1;
 };
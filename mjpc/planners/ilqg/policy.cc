@@ -15,8 +15,14 @@
 #include "mjpc/planners/ilqg/policy.h"
 
 #include <algorithm>
+#include <string_view>
+
+#include <absl/strings/str_cat.h>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/task.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
@@ -45,17 +51,26 @@ void iLQGPolicy::Allocate(const mjModel* model, const Task& task, int horizon) {
   state_scratch.resize(model->nq + model->nv + model->na);
   action_scratch.resize(model->nu);
 
-  // interpolation
-  // feedback gains ((T - 1) * dim_action * dim_state_derivative)
-  feedback_gain_scratch.resize(model->nu * (2 * model->nv + model->na));
-
   // state interpolation (dim_state_derivative)
   state_interp.resize(model->nq + model->nv + model->na);
 
+  // knot slopes of cubic interpolation
+  action_cache.action_slopes.resize(2 * model->nu);
+  action_cache.state_slopes.resize(2 * (model->nq + model->nv + model->na));
+  action_cache.gain_slopes.resize(2 * model->nu *
+                                  (2 * model->nv + model->na));
+  action_cache.Invalidate();
+
   // representation
   representation = GetNumberOrDefault(1, model, "ilqg_representation");
 }
 
+std::size_t iLQGPolicy::Bytes() const {
+  return trajectory.Bytes() +
+         VectorBytes(feedback_gain, action_improvement, compact_gain,
+                     state_scratch, action_scratch, state_interp, gain_knots);
+}
+
 // reset memory to zeros
 void iLQGPolicy::Reset(int horizon, const double* initial_repeated_action) {
   trajectory.Reset(horizon, initial_repeated_action);
@@ -68,91 +83,239 @@ void iLQGPolicy::Reset(int horizon, const double* initial_repeated_action) {
   std::fill(state_scratch.begin(),
             state_scratch.begin() + model->nq + model->nv + model->na, 0.0);
   std::fill(action_scratch.begin(), action_scratch.begin() + model->nu, 0.0);
-  std::fill(
-      feedback_gain_scratch.begin(),
-      feedback_gain_scratch.begin() + model->nu * (2 * model->nv + model->na),
-      0.0);
   std::fill(state_interp.begin(),
             state_interp.begin() + model->nq + model->nv + model->na, 0.0);
 
   feedback_scaling = 1.0;
+  action_cache.Invalidate();
+}
+
+iLQGActionCache& iLQGActionCache::operator=(const iLQGActionCache& other) {
+  // keep the memory, not the slopes
+  action_slopes.resize(other.action_slopes.size());
+  state_slopes.resize(other.state_slopes.size());
+  gain_slopes.resize(other.gain_slopes.size());
+  upper = 0;
+  Invalidate();
+  return *this;
 }
 
+namespace {
+// bounds of FindInterval(sequence, value, length) from the upper bound of
+// value in a longer sequence
+void IntervalBounds(int* bounds, int upper, int length) {
+  upper = std::min(upper, length);
+  if (upper < 1) {
+    bounds[0] = 0;
+    bounds[1] = 0;
+  } else {
+    bounds[0] = upper - 1;
+    bounds[1] = std::min(upper, length - 1);
+  }
+}
+
+// slopes at knots k and k + 1 of dim values, cached unless cache is false
+template <typename T>
+void IntervalSlopes(double* slopes, int* slope_knot,
+                    const std::vector<double>& times, const T* values,
+                    int dim, int length, int k, bool cache) {
+  if (cache && *slope_knot == k) return;
+  KnotSlopes(slopes, times, values, dim, length, k);
+  KnotSlopes(slopes + dim, times, values, dim, length, k + 1);
+  *slope_knot = cache ? k : -1;
+}
+
+// weights of the points and slopes at bounds for cubic interpolation at x,
+// like CubicCoefficients
+void CubicWeights(double* weights, double x, const std::vector<double>& xs,
+                  const int* bounds) {
+  double dx = xs[bounds[1]] - xs[bounds[0]];
+  double t = (x - xs[bounds[0]]) / dx;
+  weights[0] = 2.0 * t * t * t - 3.0 * t * t + 1.0;
+  weights[1] = (t * t * t - 2.0 * t * t + t) * dx;
+  weights[2] = -2.0 * t * t * t + 3 * t * t;
+  weights[3] = (t * t * t - t * t) * dx;
+}
+
+// cubic interpolation of dim values in the interval bounds, with the slopes
+// at its knots, like CubicInterpolation
+void CubicInInterval(double* output, double x, const std::vector<double>& xs,
+                     const double* ys, const double* slopes, int dim,
+                     const int* bounds) {
+  double c[4];
+  CubicWeights(c, x, xs, bounds);
+  const double* p0 = ys + bounds[0] * dim;
+  const double* p1 = ys + bounds[1] * dim;
+  for (int i = 0; i < dim; i++) {
+    output[i] =
+        c[0] * p0[i] + c[1] * slopes[i] + c[2] * p1[i] + c[3] * slopes[dim + i];
+  }
+}
+}  // namespace
+
 // set action from policy
 void iLQGPolicy::Action(double* action, const double* state,
                         double time) const {
+  Evaluate(action, state, time, false);
+}
+
+void iLQGPolicy::CachedAction(double* action, const double* state,
+                              double time) const {
+  Evaluate(action, state, time, true);
+}
+
+void iLQGPolicy::Evaluate(double* action, const double* state, double time,
+                          bool cached) const {
   // dimension
   int dim_state = model->nq + model->nv + model->na;
   int dim_state_derivative = 2 * model->nv + model->na;
   int dim_action = model->nu;
+  int dim_gain = dim_action * dim_state_derivative;
+  int horizon = trajectory.horizon;
+  const std::vector<double>& times = trajectory.times;
+
+  // upper bound of time, searched from the previous query's interval first
+  iLQGActionCache& cache = action_cache;
+  if (cache.horizon != horizon) {
+    cache.horizon = horizon;
+    cache.upper = 0;
+    cache.Invalidate();
+  }
+  int upper = cache.upper;
+  auto is_upper = [&](int u) {
+    return u >= 0 && u <= horizon && (u == 0 || times[u - 1] <= time) &&
+           (u == horizon || time < times[u]);
+  };
+  if (!is_upper(upper)) {
+    upper = is_upper(upper + 1)
+                ? upper + 1
+                : std::upper_bound(times.begin(), times.begin() + horizon,
+                                   time) -
+                      times.begin();
+    cache.upper = upper;
+  }
 
-  // find times bounds
+  // intervals of the states (horizon knots) and of the actions and gains
+  // (horizon - 1 knots), like FindInterval
   int bounds[2];
-  FindInterval(bounds, trajectory.times, time, trajectory.horizon);
+  int action_bounds[2];
+  IntervalBounds(bounds, upper, horizon);
+  IntervalBounds(action_bounds, upper, horizon - 1);
+  bool interval = action_bounds[0] != action_bounds[1];
 
-  // interpolate
-  if (bounds[0] == bounds[1] || representation == 0) {
-    // action reference
-    ZeroInterpolation(action, time, trajectory.times, trajectory.actions.data(),
-                      model->nu, trajectory.horizon - 1);
+  // gain at knot k, of compact policies decoded into slot of gain_knots
+  auto gain = [&](int k, int slot) -> const double* {
+    if (!compact) return DataAt(feedback_gain, k * dim_gain);
+    double* decoded = gain_knots.data() + slot * dim_gain;
+    const float* stored = compact_gain.data() + k * dim_gain;
+    for (int i = 0; i < dim_gain; i++) decoded[i] = stored[i];
+    return decoded;
+  };
 
-    if (state) {
-      // state reference
-      ZeroInterpolation(state_interp.data(), time, trajectory.times,
-                        trajectory.states.data(), dim_state,
-                        trajectory.horizon);
+  // reference state and the gain as a weighted sum of matrices
+  const double* reference = nullptr;
+  const double* gains[4];
+  double weights[4];
+  int num_gains = 1;
+  if (state) gains[0] = gain(action_bounds[0], 0);
+  weights[0] = 1.0;
 
-      // gains
-      ZeroInterpolation(feedback_gain_scratch.data(), time, trajectory.times,
-                        feedback_gain.data(), dim_action * dim_state_derivative,
-                        trajectory.horizon - 1);
-    }
+  // interpolate
+  if (bounds[0] == bounds[1] || representation == 0) {
+    mju_copy(action, DataAt(trajectory.actions, action_bounds[0] * dim_action),
+             dim_action);
+    reference = DataAt(trajectory.states, bounds[0] * dim_state);
   } else if (representation == 1) {
     // action
-    LinearInterpolation(action, time, trajectory.times,
-                        trajectory.actions.data(), model->nu,
-                        trajectory.horizon - 1);
+    const double* a0 =
+        DataAt(trajectory.actions, action_bounds[0] * dim_action);
+    double t = 0.0;
+    if (interval) {
+      t = (time - times[action_bounds[0]]) /
+          (times[action_bounds[1]] - times[action_bounds[0]]);
+      mju_scl(action, a0, 1.0 - t, dim_action);
+      mju_addToScl(action,
+                   DataAt(trajectory.actions, action_bounds[1] * dim_action), t,
+                   dim_action);
+    } else {
+      mju_copy(action, a0, dim_action);
+    }
 
     if (state) {
       // state
-      LinearInterpolation(state_interp.data(), time, trajectory.times,
-                          trajectory.states.data(), dim_state,
-                          trajectory.horizon);
+      double s =
+          (time - times[bounds[0]]) / (times[bounds[1]] - times[bounds[0]]);
+      mju_scl(state_interp.data(),
+              DataAt(trajectory.states, bounds[0] * dim_state), 1.0 - s,
+              dim_state);
+      mju_addToScl(state_interp.data(),
+                   DataAt(trajectory.states, bounds[1] * dim_state), s,
+                   dim_state);
 
       // normalize quaternions
       mj_normalizeQuat(model, state_interp.data());
+      reference = state_interp.data();
 
-      LinearInterpolation(feedback_gain_scratch.data(), time, trajectory.times,
-                          feedback_gain.data(),
-                          dim_action * dim_state_derivative,
-                          trajectory.horizon - 1);
+      // gains
+      if (interval) {
+        gains[1] = gain(action_bounds[1], 1);
+        weights[0] = 1.0 - t;
+        weights[1] = t;
+        num_gains = 2;
+      }
     }
   } else if (representation == 2) {
     // action
-    CubicInterpolation(action, time, trajectory.times,
-                       trajectory.actions.data(), model->nu,
-                       trajectory.horizon - 1);
+    if (interval) {
+      IntervalSlopes(cache.action_slopes.data(), &cache.action_knot, times,
+                     trajectory.actions.data(), dim_action, horizon - 1,
+                     action_bounds[0], cached);
+      CubicInInterval(action, time, times, trajectory.actions.data(),
+                      cache.action_slopes.data(), dim_action, action_bounds);
+    } else {
+      mju_copy(action,
+               DataAt(trajectory.actions, action_bounds[0] * dim_action),
+               dim_action);
+    }
 
     if (state) {
       // state
-      CubicInterpolation(state_interp.data(), time, trajectory.times,
-                         trajectory.states.data(), dim_state,
-                         trajectory.horizon);
+      IntervalSlopes(cache.state_slopes.data(), &cache.state_knot, times,
+                     trajectory.states.data(), dim_state, horizon, bounds[0],
+                     cached);
+      CubicInInterval(state_interp.data(), time, times,
+                      trajectory.states.data(), cache.state_slopes.data(),
+                      dim_state, bounds);
 
       // normalize quaternions
       mj_normalizeQuat(model, state_interp.data());
+      reference = state_interp.data();
 
-      CubicInterpolation(feedback_gain_scratch.data(), time, trajectory.times,
-                        feedback_gain.data(), dim_action * dim_state_derivative,
-                        trajectory.horizon - 1);
+      // gains, the cubic of the knot gains and their slopes
+      if (interval) {
+        if (compact) {
+          IntervalSlopes(cache.gain_slopes.data(), &cache.gain_knot, times,
+                         compact_gain.data(), dim_gain, horizon - 1,
+                         action_bounds[0], cached);
+        } else {
+          IntervalSlopes(cache.gain_slopes.data(), &cache.gain_knot, times,
+                         feedback_gain.data(), dim_gain, horizon - 1,
+                         action_bounds[0], cached);
+        }
+        CubicWeights(weights, time, times, action_bounds);
+        gains[1] = cache.gain_slopes.data();
+        gains[2] = gain(action_bounds[1], 1);
+        gains[3] = cache.gain_slopes.data() + dim_gain;
+        num_gains = 4;
+      }
     }
   }
 
   // add feedback
   if (state) {
-    StateDiff(model, state_scratch.data(), state_interp.data(), state, 1.0);
-    mju_mulMatVec(action_scratch.data(), feedback_gain_scratch.data(),
-                  state_scratch.data(), dim_action, dim_state_derivative);
+    StateDiff(model, state_scratch.data(), reference, state, 1.0);
+    MulMatVecSum(action_scratch.data(), gains, weights, num_gains,
+                 state_scratch.data(), dim_action, dim_state_derivative);
     mju_addToScl(action, action_scratch.data(), feedback_scaling, dim_action);
   }
 
@@ -162,16 +325,134 @@ void iLQGPolicy::Action(double* action, const double* state,
 
 // copy policy
 void iLQGPolicy::CopyFrom(const iLQGPolicy& policy, int horizon) {
-  // reference
-  trajectory = policy.trajectory;
+  CopyReferenceFrom(policy, horizon);
 
   // feedback gains
   mju_copy(feedback_gain.data(), policy.feedback_gain.data(),
            horizon * model->nu * (2 * model->nv + model->na));
+}
+
+// copy reference and action improvement
+void iLQGPolicy::CopyReferenceFrom(const iLQGPolicy& policy, int horizon) {
+  // reference
+  trajectory.CopyFrom(policy.trajectory);
 
   // action improvement
   mju_copy(action_improvement.data(), policy.action_improvement.data(),
            horizon * model->nu);
+
+  // the knot slopes were of the previous trajectory
+  action_cache.Invalidate();
+}
+
+// copy for publication
+void iLQGPolicy::PublishFrom(const iLQGPolicy& policy, bool compact) {
+  model = policy.model;
+  int horizon = policy.trajectory.horizon;
+  int dim_gain = model->nu * (2 * model->nv + model->na);
+  int num_gain = horizon * dim_gain;
+  int num_improvement = horizon * model->nu;
+
+  // reference
+  trajectory.CopyFrom(policy.trajectory);
+
+  // feedback gains of the horizon
+  const double* source = policy.compact ? nullptr : policy.feedback_gain.data();
+  this->compact = compact;
+  if (compact) {
+    compact_gain.resize(num_gain);
+    gain_knots.resize(2 * dim_gain);
+    if (source) {
+      std::copy(source, source + num_gain, compact_gain.begin());
+    } else {
+      std::copy(policy.compact_gain.begin(),
+                policy.compact_gain.begin() + num_gain, compact_gain.begin());
+    }
+  } else {
+    feedback_gain.resize(num_gain);
+    if (source) {
+      mju_copy(feedback_gain.data(), source, num_gain);
+    } else {
+      std::copy(policy.compact_gain.begin(),
+                policy.compact_gain.begin() + num_gain, feedback_gain.begin());
+    }
+  }
+
+  // action improvement
+  action_improvement.resize(num_improvement);
+  mju_copy(action_improvement.data(), policy.action_improvement.data(),
+           num_improvement);
+
+  // scratch and interpolation
+  state_scratch.resize(policy.state_scratch.size());
+  action_scratch.resize(policy.action_scratch.size());
+  state_interp.resize(policy.state_interp.size());
+  action_cache = policy.action_cache;
+  representation = policy.representation;
+  feedback_scaling = policy.feedback_scaling;
+}
+
+void iLQGPolicy::Snapshot(SnapshotWriter& writer,
+                          std::string_view name) const {
+  int horizon = trajectory.horizon;
+  int nu = model->nu;
+  int dim_state_derivative = 2 * model->nv + model->na;
+  trajectory.Snapshot(writer, absl::StrCat(name, ".trajectory"));
+  writer.Add(absl::StrCat(name, ".feedback_gain"), feedback_gain.data(),
+             horizon * nu * dim_state_derivative);
+  writer.Add(absl::StrCat(name, ".action_improvement"),
+             action_improvement.data(), horizon * nu);
+  writer.Add(absl::StrCat(name, ".representation"), representation);
+  writer.Add(absl::StrCat(name, ".feedback_scaling"), feedback_scaling);
+}
+
+bool iLQGPolicy::Restore(const SnapshotReader& reader, std::string_view name) {
+  int nu = model->nu;
+  int dim_state_derivative = 2 * model->nv + model->na;
+  int horizon = reader.Get(absl::StrCat(name, ".trajectory.horizon"), -1);
+  if (reader.Size(absl::StrCat(name, ".feedback_gain")) !=
+          horizon * nu * dim_state_derivative ||
+      reader.Size(absl::StrCat(name, ".action_improvement")) != horizon * nu ||
+      !trajectory.Restore(reader, absl::StrCat(name, ".trajectory"))) {
+    return false;
+  }
+  reader.Read(absl::StrCat(name, ".feedback_gain"), feedback_gain.data(),
+              horizon * nu * dim_state_derivative);
+  reader.Read(absl::StrCat(name, ".action_improvement"),
+              action_improvement.data(), horizon * nu);
+  representation =
+      reader.Get(absl::StrCat(name, ".representation"), representation);
+  feedback_scaling =
+      reader.Get(absl::StrCat(name, ".feedback_scaling"), feedback_scaling);
+  action_cache.Invalidate();
+  return true;
+}
+
+void iLQGPolicy::Export(ExportedPolicy& exported) const {
+  int horizon = trajectory.horizon;
+  int dim_state = model->nq + model->nv + model->na;
+  int dim_gain = model->nu * (2 * model->nv + model->na);
+
+  // actions and gains at the first horizon - 1 times
+  int num_action = std::max(horizon - 1, 1);
+  SetExportedModel(exported, model);
+  exported.kind = ExportedPolicyKind::kFeedback;
+  exported.representation = representation;
+  exported.times.assign(trajectory.times.begin(),
+                        trajectory.times.begin() + horizon);
+  exported.states.assign(trajectory.states.begin(),
+                         trajectory.states.begin() + horizon * dim_state);
+  exported.actions.assign(
+      trajectory.actions.begin(),
+      trajectory.actions.begin() + num_action * model->nu);
+  if (compact) {
+    exported.gains.assign(compact_gain.begin(),
+                          compact_gain.begin() + num_action * dim_gain);
+  } else {
+    exported.gains.assign(feedback_gain.begin(),
+                          feedback_gain.begin() + num_action * dim_gain);
+  }
+  exported.feedback_scaling = feedback_scaling;
 }
 
 }  // namespace mjpc
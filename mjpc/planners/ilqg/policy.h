@@ -15,20 +15,53 @@
 #ifndef MJPC_PLANNERS_ILQG_POLICY_H_
 #define MJPC_PLANNERS_ILQG_POLICY_H_
 
+#include <cstddef>
+#include <string_view>
 #include <vector>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/planners/policy.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/task.h"
 #include "mjpc/trajectory.h"
 
 namespace mjpc {
 
+// knot interval of the last iLQGPolicy::Action query and, for cubic
+// interpolation, the slopes at the knots of the interval. copies start
+// invalid, so that a policy never reuses the slopes of another trajectory.
+struct iLQGActionCache {
+  iLQGActionCache() = default;
+  iLQGActionCache(const iLQGActionCache& other) { *this = other; }
+  iLQGActionCache& operator=(const iLQGActionCache& other);
+
+  // forget the knot slopes, e.g., after the trajectory changed
+  void Invalidate() {
+    action_knot = -1;
+    state_knot = -1;
+    gain_knot = -1;
+  }
+
+  int upper = 0;        // upper bound of the last time in trajectory.times
+  int horizon = 0;      // trajectory horizon of the slopes
+  int action_knot = -1;  // lower knot of action_slopes
+  int state_knot = -1;   // lower knot of state_slopes
+  int gain_knot = -1;    // lower knot of gain_slopes
+  std::vector<double> action_slopes;  // (2 x dim_action)
+  std::vector<double> state_slopes;   // (2 x dim_state)
+  std::vector<double> gain_slopes;    // (2 x dim_action x dim_state_derivative)
+};
+
 // iLQG policy
 class iLQGPolicy : public Policy {
  public:
-  // constructor
+  // constructor, moves swap the storage (e.g., of published policies)
   iLQGPolicy() = default;
+  iLQGPolicy(const iLQGPolicy& other) = default;
+  iLQGPolicy& operator=(const iLQGPolicy& other) = default;
+  iLQGPolicy(iLQGPolicy&& other) = default;
+  iLQGPolicy& operator=(iLQGPolicy&& other) = default;
 
   // destructor
   ~iLQGPolicy() override = default;
@@ -36,6 +69,9 @@ class iLQGPolicy : public Policy {
   // allocate memory
   void Allocate(const mjModel* model, const Task& task, int horizon) override;
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int horizon,
              const double* initial_repeated_action = nullptr) override;
@@ -44,9 +80,38 @@ class iLQGPolicy : public Policy {
   // if state == nullptr, return the nominal action without a feedback term
   void Action(double* action, const double* state, double time) const override;
 
+  // Action for high-rate queries of a policy that isn't modified between
+  // them, e.g., a published policy: with cubic interpolation, the slopes of
+  // the knot interval are reused while time stays in it
+  void CachedAction(double* action, const double* state, double time) const;
+
   // copy policy
   void CopyFrom(const iLQGPolicy& policy, int horizon);
 
+  // copy the reference trajectory and action improvement, not the gains
+  void CopyReferenceFrom(const iLQGPolicy& policy, int horizon);
+
+  // copy of policy for publication, e.g., into a PolicyBuffer: only the
+  // horizon of the gains and action improvement is copied, into storage
+  // grown to fit it. with compact, the gains are stored as float32 in
+  // compact_gain, with half the memory and copy bandwidth, and feedback_gain
+  // is not used.
+  void PublishFrom(const iLQGPolicy& policy, bool compact);
+
+  // write the reference trajectory, gains and action improvement as sections
+  // name.*. Restore returns false, leaving the policy unchanged, if they
+  // don't match the model or allocation.
+  void Snapshot(SnapshotWriter& writer, std::string_view name) const;
+  bool Restore(const SnapshotReader& reader, std::string_view name);
+
+  // set the reference trajectory and gains of an exported feedback policy
+  void Export(ExportedPolicy& exported) const;
+
+ private:
+  // Action, reusing the knot slopes of action_cache if cached
+  void Evaluate(double* action, const double* state, double time,
+                bool cached) const;
+
  public:
   // ----- members ----- //
   const mjModel* model;
@@ -55,13 +120,19 @@ class iLQGPolicy : public Policy {
   std::vector<double> feedback_gain;  // (T * dim_action * dim_state_derivative)
   std::vector<double> action_improvement;  // (T * dim_action)
 
+  // float32 gains of compact published copies (see PublishFrom)
+  bool compact = false;
+  std::vector<float> compact_gain;  // (T * dim_action * dim_state_derivative)
+
   // scratch space
   mutable std::vector<double> state_scratch;       // dim_state
   mutable std::vector<double> action_scratch;      // dim_action
 
   // interpolation
-  mutable std::vector<double> feedback_gain_scratch;
   mutable std::vector<double> state_interp;
+  mutable std::vector<double> gain_knots;  // decoded compact gains of the
+                                           // interval (2 x dim_gain)
+  mutable iLQGActionCache action_cache;
   int representation;
   double feedback_scaling;
 };
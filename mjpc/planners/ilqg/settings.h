@@ -20,13 +20,38 @@ namespace mjpc {
 // iLQG settings
 struct iLQGSettings {
   double min_linesearch_step = 1.0e-3;  // minimum step size for line search
+  int adaptive_linesearch = 0;  // flag, center steps on the last accepted step
+                                // and stop at the first sufficient decrease
+  double sufficient_decrease = 0.1;  // fraction of expected improvement that
+                                     // accepts a step (adaptive line search)
   double fd_tolerance = 1.0e-6;   // finite difference tolerance
   double fd_mode = 0;  // type of finite difference; 0: one-sided, 1: centered
+  int fd_coloring = 0;  // flag, perturb independent kinematic trees together
+  int derivative_backend = 0;  // action Jacobians; 0: finite differences,
+                               // 1: smooth, 2: hybrid (see DerivativeBackend)
+  int derivative_warmstart = 0;  // flag, start the derivatives' solver from
+                                 // the nominal rollout's warm starts
+  double fd_skip_tolerance = 0.0;  // reuse derivatives at time steps that
+                                   // moved less (max norm); 0: off
+  int residual_sensor_rows = 1;  // flag, differentiate residual sensors only
   double min_regularization = 1.0e-6;  // minimum regularization value
   double max_regularization = 1.0e6;   // maximum regularization value
   int regularization_type = 0;  // 0: control; 1: feedback; 2: value; 3: none
+  int pipeline = 0;  // flag, overlap derivatives with the backward pass
+  int derivative_window = 0;  // time steps of derivatives in memory, streamed
+                              // from the last step by the pipeline (read by
+                              // Allocate); 0: all
+  int shooting_segments = 1;  // segments of the nominal rollout simulated in
+                              // parallel from the previous nominal states;
+                              // 1: single shooting
+  double partition_threshold =
+      2.0e7;  // horizon * dim_dstate^3 above which the backward pass is
+              // partitioned over the thread pool; 0: off
+  double partition_tolerance =
+      1.0e-6;  // relative cost-to-go mismatch accepted between partitions
   int max_regularization_iterations =
       5;  // maximum number of regularization updates per iteration
+  int compact_gains = 0;  // flag, publish float32 feedback gains
   int action_limits = 1;  // flag
   int nominal_feedback_scaling = 1;  // flag
   int verbose = 0;        // print optimizer info
@@ -14,13 +14,21 @@
 
 #include "mjpc/planners/ilqs/planner.h"
 
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/ilqg/planner.h"
+#include "mjpc/planners/policy.h"
 #include "mjpc/planners/sampling/planner.h"
 #include "mjpc/states/state.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -29,11 +37,16 @@ namespace mju = ::mujoco::util_mjpc;
 
 // initialize data and settings
 void iLQSPlanner::Initialize(mjModel* model, const Task& task) {
-  // Sampling
+  // Sampling, with uniform time steps since its trajectories are handed to
+  // iLQG
   sampling.Initialize(model, task);
+  sampling.schedule = RolloutSchedule();
 
   // iLQG
   ilqg.Initialize(model, task);
+
+  // concurrent branches
+  concurrent_ = GetNumberOrDefault(0, model, "ilqs_concurrent");
 }
 
 // allocate memory
@@ -45,14 +58,9 @@ void iLQSPlanner::Allocate() {
   ilqg.Allocate();
 
   // ----- policy conversion ----- //
-  // spline mapping
-  for (auto& mapping : mappings) {
-    mapping->Allocate(sampling.model->nu);
-  }
-
-  // mapping dimensions
-  dim_actions = 0;
-  dim_parameters = 0;
+  // spline mappings, for the model's action dimension
+  mapping_cache.clear();
+  mapping_cache.reserve(kiLQSMappingCacheSize);
 }
 
 // reset memory to zeros
@@ -66,10 +74,6 @@ void iLQSPlanner::Reset(int horizon, const double* initial_repeated_action) {
   // active_policy
   active_policy = kSampling;
   previous_active_policy = kSampling;
-
-  // mapping dimensions
-  dim_actions = 0;
-  dim_parameters = 0;
 }
 
 // set state
@@ -81,83 +85,113 @@ void iLQSPlanner::SetState(const State& state) {
   ilqg.SetState(state);
 }
 
-// optimize nominal policy using iLQS
-void iLQSPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
-  previous_active_policy = active_policy;
-  ilqg.UpdateNumTrajectoriesFromGUI();
-  if (previous_active_policy == kiLQG) {
-    // In order to optimize via sampling, we first convert the traj-based policy
-    // representation of iLQG (the previous winner) to a spline representation.
+// spline mapping for policy conversion, computed on cache miss
+SplineMapping* iLQSPlanner::Mapping(int representation, int num_spline_points,
+                                    int horizon) {
+  double timestep = sampling.model->opt.timestep;
+
+  // knots and trajectory are uniform from the same time, so the mapping only
+  // depends on the key
+  int num_cached = mapping_cache.size();
+  for (int i = 0; i < num_cached; i++) {
+    CachedMapping& entry = mapping_cache[i];
+    if (entry.representation == representation &&
+        entry.num_spline_points == num_spline_points &&
+        entry.horizon == horizon && entry.timestep == timestep) {
+      std::rotate(mapping_cache.begin(), mapping_cache.begin() + i,
+                  mapping_cache.begin() + i + 1);
+      return mapping_cache.front().mapping.get();
+    }
+  }
 
-    ilqg.NominalTrajectory(horizon, pool);
+  // evict least recently used
+  if (num_cached == kiLQSMappingCacheSize) {
+    mapping_cache.pop_back();
+  }
 
-    // ----- spline parameters from trajectory ----- //
-    // get number of spline points
-    int num_spline_points = sampling.policy.num_spline_points;
+  // new mapping
+  std::unique_ptr<SplineMapping> mapping;
+  switch (representation) {
+    case kZeroSpline:
+      mapping = std::make_unique<ZeroSplineMapping>();
+      break;
+    case kLinearSpline:
+      mapping = std::make_unique<LinearSplineMapping>();
+      break;
+    default:
+      mapping = std::make_unique<CubicSplineMapping>();
+      break;
+  }
+  mapping->Allocate(sampling.model->nu);
+
+  // relative knot and trajectory times, as in OptimizePolicy
+  double time_shift =
+      mju_max((horizon - 1) * timestep / (num_spline_points - 1), 1.0e-5);
+  std::vector<double> knot_times(num_spline_points);
+  LinearRange(knot_times.data(), time_shift, 0.0, num_spline_points);
+  std::vector<double> trajectory_times(horizon - 1);
+  LinearRange(trajectory_times.data(), timestep, 0.0, horizon - 1);
+  mapping->Compute(knot_times, num_spline_points, trajectory_times.data(),
+                   horizon - 1);
+
+  mapping_cache.insert(mapping_cache.begin(),
+                       {representation, num_spline_points, horizon, timestep,
+                        std::move(mapping)});
+  return mapping_cache.front().mapping.get();
+}
 
-    // get times for spline parameters
-    double nominal_time = sampling.time;
-    double time_shift = mju_max(
-        (horizon - 1) * sampling.model->opt.timestep / (num_spline_points - 1),
-        1.0e-5);
+// convert the iLQG policy to the sampling policy
+void iLQSPlanner::SamplingPolicyFromiLQG(int horizon, ThreadPool& pool) {
+  ilqg.NominalTrajectory(horizon, pool);
 
-    // get spline points
-    for (int t = 0; t < num_spline_points; t++) {
-      sampling.policy.times[t] = nominal_time;
-      nominal_time += time_shift;
-    }
+  // ----- spline parameters from trajectory ----- //
+  // get number of spline points
+  int num_spline_points = sampling.policy.num_spline_points;
 
-    LinearRange(sampling.policy.times.data(), time_shift,
-                sampling.policy.times[0], num_spline_points);
-
-    // linear system solve
-    if (dim_actions != sampling.model->nu * (horizon - 1) ||
-        dim_parameters != sampling.model->nu * num_spline_points) {
-      // dimension
-      dim_parameters = sampling.model->nu * num_spline_points;
-      dim_actions = sampling.model->nu * (horizon - 1);
-
-      // compute parameter to action mapping
-      mappings[sampling.policy.representation]->Compute(
-          sampling.policy.times, num_spline_points,
-          ilqg.candidate_policy[0].trajectory.times.data(), horizon - 1);
-
-      // ----- compute inverse mapping ----- //
-      // resize
-      inversemapping_cache.resize(dim_parameters * dim_parameters);
-      inversemapping.resize(dim_parameters * dim_actions);
-      inversemappingT.resize(dim_actions * dim_parameters);
-
-      // M = A' A
-      double* mapping = mappings[sampling.policy.representation]->Get();
-      mju_mulMatTMat(inversemapping_cache.data(), mapping, mapping, dim_actions,
-                     dim_parameters, dim_parameters);
-
-      // cholesky(M)
-      mju_cholFactor(inversemapping_cache.data(), dim_parameters, 0.0);
-
-      // M \ A'
-      for (int i = 0; i < dim_actions; i++) {
-        mju_cholSolve(inversemappingT.data() + i * dim_parameters,
-                      inversemapping_cache.data(), mapping + i * dim_parameters,
-                      dim_parameters);
-      }
+  // get times for spline parameters
+  double nominal_time = sampling.time;
+  double time_shift = mju_max(
+      (horizon - 1) * sampling.model->opt.timestep / (num_spline_points - 1),
+      1.0e-5);
 
-      // transpose
-      mju_transpose(inversemapping.data(), inversemappingT.data(), dim_actions,
-                    dim_parameters);
-    }
+  // get spline points
+  for (int t = 0; t < num_spline_points; t++) {
+    sampling.policy.times[t] = nominal_time;
+    nominal_time += time_shift;
+  }
 
-    // compute parameters from actions via inverse mapping
-    mju_mulMatVec(sampling.policy.parameters.data(), inversemapping.data(),
-                  ilqg.candidate_policy[0].trajectory.actions.data(),
-                  dim_parameters, dim_actions);
+  LinearRange(sampling.policy.times.data(), time_shift,
+              sampling.policy.times[0], num_spline_points);
 
-    // clamp parameters
-    for (int t = 0; t < num_spline_points; t++) {
-      Clamp(DataAt(sampling.policy.parameters, t * sampling.model->nu),
-            sampling.model->actuator_ctrlrange, sampling.model->nu);
-    }
+  // compute parameters from actions via least squares
+  SplineMapping* mapping = Mapping(sampling.policy.representation,
+                                   num_spline_points, horizon);
+  mapping->Fit(sampling.policy.parameters.data(),
+               ilqg.candidate_policy[0].trajectory.actions.data());
+
+  // clamp parameters
+  for (int t = 0; t < num_spline_points; t++) {
+    Clamp(DataAt(sampling.policy.parameters, t * sampling.model->nu),
+          sampling.model->actuator_ctrlrange, sampling.model->nu);
+  }
+}
+
+// optimize nominal policy using iLQS
+void iLQSPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
+  MJPC_TRACE_SCOPE("iLQSPlanner::OptimizePolicy");
+  previous_active_policy = active_policy;
+  ilqg.UpdateNumTrajectoriesFromGUI();
+  ilqg.ResetCounters();
+  if (previous_active_policy == kiLQG) {
+    // In order to optimize via sampling, we first convert the traj-based policy
+    // representation of iLQG (the previous winner) to a spline representation.
+    SamplingPolicyFromiLQG(horizon, pool);
+  }
+
+  // both branches at once
+  if (concurrent_) {
+    OptimizeConcurrent(horizon, pool);
+    return;
   }
 
   // try sampling
@@ -204,6 +238,38 @@ void iLQSPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   // active_policy is not.
 }
 
+// run sampling and iLQG at once, the better result becomes active
+void iLQSPlanner::OptimizeConcurrent(int horizon, ThreadPool& pool) {
+  if (previous_active_policy == kSampling) {
+    // iLQG starts from the sampling policy resampled to the current time
+    sampling.UpdateNominalPolicy(horizon);
+    sampling.candidate_policy[0].CopyFrom(sampling.policy,
+                                          sampling.policy.num_spline_points);
+    sampling.candidate_policy[0].representation =
+        sampling.policy.representation;
+    sampling.NominalTrajectory(horizon, pool);
+    ilqg.candidate_policy[0].trajectory = sampling.trajectory[0];
+  }
+
+  // sampling runs on a worker and iLQG on this thread, the parallel loops of
+  // both branches share the pool's workers
+  {
+    TaskGroup branches(pool);
+    branches.Schedule(
+        [this, horizon, &pool]() { sampling.OptimizePolicy(horizon, pool); });
+    ilqg.Iteration(horizon, pool);
+  }
+
+  // comparison for new active policy, ties keep the previous policy
+  double sampling_return = sampling.trajectory[sampling.winner].total_return;
+  double ilqg_return = ilqg.trajectory[ilqg.winner].total_return;
+  if (sampling_return < ilqg_return) {
+    active_policy = kSampling;
+  } else if (ilqg_return < sampling_return) {
+    active_policy = kiLQG;
+  }
+}
+
 // compute trajectory using nominal policy
 void iLQSPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
   if (active_policy == kSampling) {
@@ -263,6 +329,9 @@ void iLQSPlanner::Traces(mjvScene* scn) {
 void iLQSPlanner::GUI(mjUI& ui) {
   // Sampling
   mju::sprintf_arr(ui.sect[5].item[10].name, "Sampling Settings");
+  mjuiDef defiLQS[] = {{mjITEM_CHECKINT, "Concurrent", 2, &concurrent_, ""},
+                       {mjITEM_END}};
+  mjui_add(&ui, defiLQS);
   sampling.GUI(ui);
 
   // iLQG
@@ -281,16 +350,18 @@ void iLQSPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                  shift);
 
   // iLQG
-  ilqg.Plots(fig_planner, fig_timer, planner_shift + 1, timer_shift + 4,
+  ilqg.Plots(fig_planner, fig_timer, planner_shift + 2, timer_shift + 4,
              planning, shift);
 
   // ----- re-label ----- //
   // planner plots
   mju::strcpy_arr(fig_planner->linename[0 + planner_shift], "Improve. (S)");
-  mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 1], "Reg. (LQ)");
-  mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 2],
-                  "Action Step (LQ)");
+  mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 1],
+                  "Fidelity Error (S)");
+  mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 2], "Reg. (LQ)");
   mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 3],
+                  "Action Step (LQ)");
+  mju::strcpy_arr(fig_planner->linename[0 + planner_shift + 4],
                   "Feedback Scaling (LQ)");
 
   // timer plots
@@ -308,4 +379,24 @@ void iLQSPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                   "Policy Update (LQ)");
 }
 
+// compute times of the last iteration's phases of both planners
+std::vector<PhaseTime> iLQSPlanner::PhaseTimes() const {
+  std::vector<PhaseTime> times;
+  for (const PhaseTime& phase : sampling.PhaseTimes()) {
+    times.push_back({"sampling_" + phase.name, phase.time});
+  }
+  for (const PhaseTime& phase : ilqg.PhaseTimes()) {
+    times.push_back({"ilqg_" + phase.name, phase.time});
+  }
+  return times;
+}
+
+void iLQSPlanner::ReportMemory(MemoryReport& report) const {
+  MemoryReport sampling_report, ilqg_report;
+  sampling.ReportMemory(sampling_report);
+  ilqg.ReportMemory(ilqg_report);
+  report.Add("sampling", sampling_report);
+  report.Add("ilqg", ilqg_report);
+}
+
 }  // namespace mjpc
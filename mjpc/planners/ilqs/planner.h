@@ -17,8 +17,10 @@
 
 #include <mujoco/mujoco.h>
 
+#include <chrono>
 #include <memory>
 #include <shared_mutex>
+#include <utility>
 #include <vector>
 
 #include "mjpc/planners/gradient/spline_mapping.h"
@@ -35,16 +37,14 @@ enum iLQSPlanners : int {
   kiLQG,
 };
 
+// number of factored spline mappings kept for policy conversion
+inline constexpr int kiLQSMappingCacheSize = 8;
+
 // planner for iLQS
 class iLQSPlanner : public Planner {
  public:
   // constructor
-  iLQSPlanner() {
-    // spline mapping linear operators for policy conversion
-    mappings.emplace_back(new ZeroSplineMapping);
-    mappings.emplace_back(new LinearSplineMapping);
-    mappings.emplace_back(new CubicSplineMapping);
-  }
+  iLQSPlanner() = default;
 
   // initialize data and settings
   void Initialize(mjModel* model, const Task& task) override;
@@ -56,12 +56,22 @@ class iLQSPlanner : public Planner {
   void Reset(int horizon,
              const double* initial_repeated_action = nullptr) override;
 
+  // convert the iLQG policy to the sampling policy
+  void SamplingPolicyFromiLQG(int horizon, ThreadPool& pool);
+
+  // spline mapping for policy conversion, computed on cache miss
+  SplineMapping* Mapping(int representation, int num_spline_points,
+                         int horizon);
+
   // set state
   void SetState(const State& state) override;
 
   // optimize nominal policy using iLQS
   void OptimizePolicy(int horizon, ThreadPool& pool) override;
 
+  // run sampling and iLQG at once, the better result becomes active
+  void OptimizeConcurrent(int horizon, ThreadPool& pool);
+
   // compute trajectory using nominal policy
   void NominalTrajectory(int horizon, ThreadPool& pool) override;
 
@@ -87,26 +97,99 @@ class iLQSPlanner : public Planner {
     return sampling.NumParameters() + ilqg.NumParameters();
   };
 
+  // compute times of the last iteration's phases of both planners
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // memory of both planners, as sampling/ and ilqg/
+  void ReportMemory(MemoryReport& report) const override;
+
+  // rollouts of an iteration of both planners
+  int NumRollouts() const override {
+    return sampling.NumRollouts() + ilqg.NumRollouts();
+  }
+
+  // the sampling planner's rollouts, iLQG keeps its line search
+  void SetNumRollouts(int num_rollouts) override {
+    sampling.SetNumRollouts(num_rollouts - ilqg.NumRollouts());
+  }
+
+  // simulation work of both planners
+  PlannerCounters Counters() const override {
+    PlannerCounters counters = sampling.Counters();
+    counters += ilqg.Counters();
+    return counters;
+  }
+
+  // warm start both planners from another planner's trajectory
+  void WarmStart(const Trajectory& trajectory) override {
+    sampling.WarmStart(trajectory);
+    ilqg.WarmStart(trajectory);
+  }
+
+  // snapshots of both planners
+  void Snapshot(SnapshotWriter& writer) const override {
+    sampling.Snapshot(writer);
+    ilqg.Snapshot(writer);
+  }
+  bool Restore(const SnapshotReader& reader) override {
+    bool restored = sampling.Restore(reader);
+    return ilqg.Restore(reader) || restored;
+  }
+
+  // export the active planner's policy, like ActionFromPolicy. the version
+  // counts the publications of both planners, so that it also changes when
+  // the active planner does.
+  bool ExportPolicy(ExportedPolicy& policy) const override {
+    bool exported = active_policy == kSampling ? sampling.ExportPolicy(policy)
+                                               : ilqg.ExportPolicy(policy);
+    policy.version = sampling.PolicyVersion() + ilqg.PolicyVersion();
+    return exported;
+  }
+
+  // deadline for both planners
+  void SetDeadline(std::chrono::steady_clock::time_point deadline) override {
+    deadline_ = deadline;
+    sampling.SetDeadline(deadline);
+    ilqg.SetDeadline(deadline);
+  }
+
+  // the planners run at the same time, each on its own lane
+  void SetDataPool(std::shared_ptr<MjDataPool> pool, int lane) override {
+    sampling.SetDataPool(pool, lane);
+    ilqg.SetDataPool(pool, lane + 1);
+    Planner::SetDataPool(std::move(pool), lane);
+  }
+  int NumDataLanes() const override { return 2; }
+  void SetAllocationPool(ThreadPool* pool) override {
+    sampling.SetAllocationPool(pool);
+    ilqg.SetAllocationPool(pool);
+    Planner::SetAllocationPool(pool);
+  }
+
   // ----- planners ----- //
   SamplingPlanner sampling;
   iLQGPlanner ilqg;
 
   // ----- policy conversion ----- //
-  // spline mapping
-  std::vector<std::unique_ptr<SplineMapping>> mappings;
-
-  // inverse mapping
-  std::vector<double> inversemapping_cache;
-  std::vector<double> inversemappingT;
-  std::vector<double> inversemapping;
+  // spline mapping from relative knot times to relative trajectory times,
+  // determined by its key
+  struct CachedMapping {
+    int representation;
+    int num_spline_points;
+    int horizon;
+    double timestep;
+    std::unique_ptr<SplineMapping> mapping;
+  };
 
-  // mapping dimensions
-  int dim_actions;
-  int dim_parameters;
+  // factored spline mappings, most recently used first
+  std::vector<CachedMapping> mapping_cache;
 
   // online policy for returning actions
   int active_policy;
   int previous_active_policy;
+
+ private:
+  int concurrent_ = 0;  // run both branches every iteration
 };
 
 }  // namespace mjpc
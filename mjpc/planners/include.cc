@@ -15,12 +15,14 @@
 #include "mjpc/planners/include.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "mjpc/planners/cross_entropy/planner.h"
 #include "mjpc/planners/gradient/planner.h"
 #include "mjpc/planners/ilqg/planner.h"
 #include "mjpc/planners/ilqs/planner.h"
+#include "mjpc/planners/mppi/planner.h"
 #include "mjpc/planners/planner.h"
 #include "mjpc/planners/robust/robust_planner.h"
 #include "mjpc/planners/sample_gradient/planner.h"
@@ -34,21 +36,41 @@ const char kPlannerNames[] =
     "iLQS\n"
     "Robust Sampling\n"
     "Cross Entropy\n"
-    "Sample Gradient";
+    "Sample Gradient\n"
+    "MPPI";
+
+// load planner by index, order matches kPlannerNames
+std::unique_ptr<mjpc::Planner> LoadPlanner(int index) {
+  switch (index) {
+    case 0:
+      return std::make_unique<mjpc::SamplingPlanner>();
+    case 1:
+      return std::make_unique<mjpc::GradientPlanner>();
+    case 2:
+      return std::make_unique<mjpc::iLQGPlanner>();
+    case 3:
+      return std::make_unique<mjpc::iLQSPlanner>();
+    case 4:
+      return std::make_unique<mjpc::RobustPlanner>(
+          std::make_unique<mjpc::SamplingPlanner>());
+    case 5:
+      return std::make_unique<mjpc::CrossEntropyPlanner>();
+    case 6:
+      return std::make_unique<mjpc::SampleGradientPlanner>();
+    case 7:
+      return std::make_unique<mjpc::MPPIPlanner>();
+    default:
+      return nullptr;
+  }
+}
 
 // load all available planners
 std::vector<std::unique_ptr<mjpc::Planner>> LoadPlanners() {
   // planners
   std::vector<std::unique_ptr<mjpc::Planner>> planners;
-
-  planners.emplace_back(new mjpc::SamplingPlanner);
-  planners.emplace_back(new mjpc::GradientPlanner);
-  planners.emplace_back(new mjpc::iLQGPlanner);
-  planners.emplace_back(new mjpc::iLQSPlanner);
-  planners.emplace_back(
-      new RobustPlanner(std::make_unique<mjpc::SamplingPlanner>()));
-  planners.emplace_back(new mjpc::CrossEntropyPlanner);
-  planners.emplace_back(new mjpc::SampleGradientPlanner);
+  while (auto planner = LoadPlanner(planners.size())) {
+    planners.push_back(std::move(planner));
+  }
   return planners;
 }
 
@@ -25,6 +25,9 @@ namespace mjpc {
 // Planner names, separated by '\n'.
 extern const char kPlannerNames[];
 
+// Loads planner at index in kPlannerNames, nullptr if out of range
+std::unique_ptr<mjpc::Planner> LoadPlanner(int index);
+
 // Loads all available planners
 std::vector<std::unique_ptr<mjpc::Planner>> LoadPlanners();
 
@@ -15,13 +15,126 @@
 #include "mjpc/planners/model_derivatives.h"
 
 #include <algorithm>
+#include <vector>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 
+namespace {
+
+// representative of the kinematic tree containing body
+int FindTree(std::vector<int>& tree, const mjModel* m, int body) {
+  int i = m->body_rootid[body];
+  while (tree[i] != i) {
+    tree[i] = tree[tree[i]];
+    i = tree[i];
+  }
+  return i;
+}
+
+// couple the kinematic trees of two bodies, the world couples nothing
+void CoupleTrees(std::vector<int>& tree, const mjModel* m, int body1,
+                 int body2) {
+  if (body1 < 0 || body2 < 0) return;
+  int i = FindTree(tree, m, body1);
+  int j = FindTree(tree, m, body2);
+  if (i != 0 && j != 0 && i != j) tree[i] = j;
+}
+
+// body of a tendon wrap object, -1 if none
+int WrapBody(const mjModel* m, int wrap) {
+  int id = m->wrap_objid[wrap];
+  switch (m->wrap_type[wrap]) {
+    case mjWRAP_JOINT:
+      return m->jnt_bodyid[id];
+    case mjWRAP_SITE:
+      return m->site_bodyid[id];
+    case mjWRAP_SPHERE:
+    case mjWRAP_CYLINDER:
+      return m->geom_bodyid[id];
+    default:
+      return -1;
+  }
+}
+
+// a body spanned by a tendon, -1 if none
+int TendonBody(const mjModel* m, int tendon) {
+  int adr = m->tendon_adr[tendon];
+  for (int w = adr; w < adr + m->tendon_num[tendon]; w++) {
+    int body = WrapBody(m, w);
+    if (body >= 0) return body;
+  }
+  return -1;
+}
+
+// body of an actuator transmission, -1 if unknown
+int ActuatorBody(const mjModel* m, int actuator) {
+  int id = m->actuator_trnid[2 * actuator];
+  switch (m->actuator_trntype[actuator]) {
+    case mjTRN_JOINT:
+    case mjTRN_JOINTINPARENT:
+      return m->jnt_bodyid[id];
+    case mjTRN_SLIDERCRANK:
+    case mjTRN_SITE:
+      return m->site_bodyid[id];
+    case mjTRN_TENDON:
+      return TendonBody(m, id);
+    case mjTRN_BODY:
+      return id;
+    default:
+      return -1;
+  }
+}
+
+// body of a model object, -1 if unknown
+int ObjectBody(const mjModel* m, int type, int id) {
+  switch (type) {
+    case mjOBJ_BODY:
+    case mjOBJ_XBODY:
+      return id;
+    case mjOBJ_GEOM:
+      return m->geom_bodyid[id];
+    case mjOBJ_SITE:
+      return m->site_bodyid[id];
+    case mjOBJ_JOINT:
+      return m->jnt_bodyid[id];
+    case mjOBJ_CAMERA:
+      return m->cam_bodyid[id];
+    case mjOBJ_ACTUATOR:
+      return ActuatorBody(m, id);
+    case mjOBJ_TENDON:
+      return TendonBody(m, id);
+    default:
+      return -1;
+  }
+}
+
+// copy next state and sensors
+void RecordNext(const mjModel* m, const mjData* d, double* next) {
+  mju_copy(next, d->qpos, m->nq);
+  mju_copy(next + m->nq, d->qvel, m->nv);
+  mju_copy(next + m->nq + m->nv, d->act, m->na);
+  mju_copy(next + m->nq + m->nv + m->na, d->sensordata, m->nsensordata);
+}
+
+// restore state, controls, warmstart, and time
+void RestoreCenter(const mjModel* m, mjData* d, const double* center,
+                   double time) {
+  int nq = m->nq, nv = m->nv, na = m->na, nu = m->nu;
+  mju_copy(d->qpos, center, nq);
+  mju_copy(d->qvel, center + nq, nv);
+  mju_copy(d->act, center + nq + nv, na);
+  mju_copy(d->ctrl, center + nq + nv + na, nu);
+  mju_copy(d->qacc_warmstart, center + nq + nv + na + nu, nv);
+  d->time = time;
+}
+
+}  // namespace
+
 // allocate memory
 void ModelDerivatives::Allocate(int dim_state_derivative, int dim_action,
                                 int dim_sensor, int T) {
@@ -31,6 +144,20 @@ void ModelDerivatives::Allocate(int dim_state_derivative, int dim_action,
   D.resize(dim_sensor * dim_action * T);
 }
 
+std::size_t ModelDerivatives::Bytes() const {
+  std::size_t bytes =
+      VectorBytes(A, B, C, D, linearized_state_, linearized_action_,
+                  evaluate_, linearized_, static_tree_, sensor_body_, scratch_);
+  for (const ColoringScratch& s : scratch_) {
+    bytes += VectorBytes(s.tree, s.column_group, s.column_color,
+                         s.sensor_group, s.group_count, s.center,
+                         s.center_next, s.plus_next, s.minus_next,
+                         s.perturbation, s.dpos, s.difference,
+                         s.qacc_constraint);
+  }
+  return bytes;
+}
+
 // reset memory to zeros
 void ModelDerivatives::Reset(int dim_state_derivative, int dim_action,
                              int dim_sensor, int T) {
@@ -39,50 +166,558 @@ void ModelDerivatives::Reset(int dim_state_derivative, int dim_action,
   std::fill(B.begin(), B.begin() + T * dim_state_derivative * dim_action, 0.0);
   std::fill(C.begin(), C.begin() + T * dim_sensor * dim_state_derivative, 0.0);
   std::fill(D.begin(), D.begin() + T * dim_sensor * dim_action, 0.0);
+  num_linearized_ = 0;
+  skip_ratio = 0.0;
+  num_evaluated = 0;
 }
 
 // compute derivatives at all time steps
+void ModelDerivatives::Compute(const mjModel* m,
+                               const std::vector<mjData*>& data,
+                               const double* x, const double* u,
+                               const double* h, int dim_state,
+                               int dim_state_derivative, int dim_action,
+                               int dim_sensor, int T, double tol, int mode,
+                               ThreadPool& pool, bool colored,
+                               double skip_tolerance) {
+  Prepare(m, data.size(), x, u, dim_state, dim_action, dim_sensor, T, colored,
+          skip_tolerance);
+  pool.ParallelFor(0, T, 1, [&](int t) {
+    int id = ThreadPool::WorkerId();
+    ComputeStep(m, data[id], id, x, u, h, dim_state, dim_state_derivative,
+                dim_action, dim_sensor, T, tol, mode, t);
+  });
+}
+
 void ModelDerivatives::Compute(const mjModel* m,
                                const std::vector<UniqueMjData>& data,
                                const double* x, const double* u,
                                const double* h, int dim_state,
                                int dim_state_derivative, int dim_action,
                                int dim_sensor, int T, double tol, int mode,
-                               ThreadPool& pool) {
-  {
-    int count_before = pool.GetCount();
-    for (int t = 0; t < T; t++) {
-      pool.Schedule([&m, &data, &A = A, &B = B, &C = C, &D = D, &x, &u, &h,
-                     dim_state, dim_state_derivative, dim_action, dim_sensor,
-                     tol, mode, t, T]() {
-        mjData* d = data[ThreadPool::WorkerId()].get();
-        // set state
-        SetState(m, d, x + t * dim_state);
-        d->time = h[t];
-
-        // set action
-        mju_copy(d->ctrl, u + t * dim_action, dim_action);
-
-        // Jacobians
-        if (t == T - 1) {
-          // Jacobians
-          mjd_transitionFD(m, d, tol, mode, nullptr, nullptr,
-                           DataAt(C, t * (dim_sensor * dim_state_derivative)),
-                           nullptr);
-        } else {
-          // derivatives
-          mjd_transitionFD(
-              m, d, tol, mode,
-              DataAt(A, t * (dim_state_derivative * dim_state_derivative)),
-              DataAt(B, t * (dim_state_derivative * dim_action)),
-              DataAt(C, t * (dim_sensor * dim_state_derivative)),
-              DataAt(D, t * (dim_sensor * dim_action)));
+                               ThreadPool& pool, bool colored,
+                               double skip_tolerance) {
+  std::vector<mjData*> pointers;
+  for (const UniqueMjData& d : data) pointers.push_back(d.get());
+  Compute(m, pointers, x, u, h, dim_state, dim_state_derivative, dim_action,
+          dim_sensor, T, tol, mode, pool, colored, skip_tolerance);
+}
+
+// select time steps to evaluate
+void ModelDerivatives::Prepare(const mjModel* m, int num_data, const double* x,
+                               const double* u, int dim_state, int dim_action,
+                               int dim_sensor, int T, bool colored,
+                               double skip_tolerance) {
+  // model that evaluates the leading sensors only. the header shares the
+  // arrays of m, sensors are computed in order up to nsensor.
+  sensor_model_ = *m;
+  int nsensor = 0;
+  while (nsensor < m->nsensor &&
+         m->sensor_adr[nsensor] + m->sensor_dim[nsensor] <= dim_sensor) {
+    nsensor++;
+  }
+  int nsensordata =
+      nsensor ? m->sensor_adr[nsensor - 1] + m->sensor_dim[nsensor - 1] : 0;
+  if (nsensordata != dim_sensor) {
+    mju_error("dim_sensor (%d) does not end on a sensor", dim_sensor);
+  }
+  sensor_model_.nsensor = nsensor;
+  sensor_model_.nsensordata = nsensordata;
+
+  // colored differences require resolved coupling between trees
+  coloring_ = colored && StaticTreeCoupling(&sensor_model_);
+  smooth_ = backend != kFiniteDifferenceDerivatives &&
+            m->opt.integrator == mjINT_EULER;
+  if (coloring_ || smooth_) scratch_.resize(num_data);
+  skip_tolerance_ = skip_tolerance;
+
+  // time steps to evaluate, all unless the stored points cover this horizon
+  evaluate_.assign(T, 1);
+  int num_skipped = 0;
+  if (skip_tolerance > 0.0) {
+    if (num_linearized_ == T) {
+      for (int t = 0; t < T; t++) {
+        if (!linearized_[t]) continue;
+        const double* xt = x + t * dim_state;
+        const double* ut = u + t * dim_action;
+        const double* xl = DataAt(linearized_state_, t * dim_state);
+        const double* ul = DataAt(linearized_action_, t * dim_action);
+        bool moved = false;
+        for (int i = 0; i < dim_state && !moved; i++) {
+          moved = mju_abs(xt[i] - xl[i]) > skip_tolerance;
+        }
+        for (int i = 0; i < dim_action && !moved && t < T - 1; i++) {
+          moved = mju_abs(ut[i] - ul[i]) > skip_tolerance;
         }
-      });
+        evaluate_[t] = moved;
+        num_skipped += !moved;
+      }
     }
-    pool.WaitCount(count_before + T);
+    linearized_state_.resize(T * dim_state);
+    linearized_action_.resize(T * dim_action);
+    linearized_.assign(T, 1);
+    num_linearized_ = T;
+  } else {
+    num_linearized_ = 0;
+  }
+  skip_ratio = static_cast<double>(num_skipped) / mju_max(T, 1);
+  num_evaluated = T - num_skipped;
+}
+
+// shift stored derivatives to an advanced horizon
+void ModelDerivatives::Shift(int shift, int dim_state,
+                             int dim_state_derivative, int dim_action,
+                             int dim_sensor) {
+  int T = num_linearized_;
+  if (shift == 0 || T == 0) return;
+  if (shift < 0 || shift >= T) {
+    num_linearized_ = 0;
+    return;
+  }
+
+  // move rows [shift, T) to [0, T - shift)
+  auto move = [shift, T](auto& values, int dim) {
+    std::copy(values.begin() + shift * dim, values.begin() + T * dim,
+              values.begin());
+  };
+  move(A, dim_state_derivative * dim_state_derivative);
+  move(B, dim_state_derivative * dim_action);
+  move(C, dim_sensor * dim_state_derivative);
+  move(D, dim_sensor * dim_action);
+  move(linearized_state_, dim_state);
+  move(linearized_action_, dim_action);
+  move(linearized_, 1);
+
+  // the previous last step has no transition Jacobians, later steps are new
+  std::fill(linearized_.begin() + T - shift - 1, linearized_.end(), 0);
+}
+
+// compute derivatives at one time step
+void ModelDerivatives::ComputeStep(const mjModel* m, mjData* d, int id,
+                                   const double* x, const double* u,
+                                   const double* h, int dim_state,
+                                   int dim_state_derivative, int dim_action,
+                                   int dim_sensor, int T, double tol, int mode,
+                                   int t) {
+  if (!evaluate_[t]) return;
+
+  // record linearization point
+  if (skip_tolerance_ > 0.0) {
+    mju_copy(DataAt(linearized_state_, t * dim_state), x + t * dim_state,
+             dim_state);
+    mju_copy(DataAt(linearized_action_, t * dim_action), u + t * dim_action,
+             dim_action);
+  }
+
+  // set state
+  SetState(m, d, x + t * dim_state);
+  d->time = h[t];
+
+  // set action
+  mju_copy(d->ctrl, u + t * dim_action, dim_action);
+
+  // set solver warm start
+  if (warmstart) {
+    mju_copy(d->qacc_warmstart, warmstart + t * m->nv, m->nv);
+  }
+
+  // Jacobians, only sensor Jacobians wrt state at the last time step
+  int slot = Slot(t);
+  double* At = nullptr;
+  double* Bt = nullptr;
+  double* Ct = DataAt(C, slot * (dim_sensor * dim_state_derivative));
+  double* Dt = nullptr;
+  if (t < T - 1) {
+    At = DataAt(A, slot * (dim_state_derivative * dim_state_derivative));
+    Bt = DataAt(B, slot * (dim_state_derivative * dim_action));
+    Dt = DataAt(D, slot * (dim_sensor * dim_action));
+  } else if (window > 0) {
+    // the last step has no action Jacobian, clear the slot's previous one
+    mju_zero(DataAt(D, slot * (dim_sensor * dim_action)),
+             dim_sensor * dim_action);
+  }
+
+  // derivatives, of the sensors in sensor_model_ only
+  const mjModel* ms = &sensor_model_;
+
+  // action Jacobians from the smooth dynamics, then the state Jacobians
+  if (smooth_ && (Bt || Dt) &&
+      SmoothActionFD(ms, d, tol, mode, backend == kHybridDerivatives, Bt, Dt,
+                     scratch_[id])) {
+    Bt = nullptr;
+    Dt = nullptr;
+  }
+  if (!coloring_ ||
+      !ColoredTransitionFD(ms, d, tol, mode, At, Bt, Ct, Dt, scratch_[id])) {
+    mjd_transitionFD(ms, d, tol, mode, At, Bt, Ct, Dt);
+  }
+}
+
+// coupling between kinematic trees that does not depend on the state
+bool ModelDerivatives::StaticTreeCoupling(const mjModel* m) {
+  static_tree_.resize(m->nbody);
+  for (int i = 0; i < m->nbody; i++) {
+    static_tree_[i] = i;
   }
-  pool.ResetCount();
+
+  // tendons
+  for (int i = 0; i < m->ntendon; i++) {
+    int body = TendonBody(m, i);
+    int adr = m->tendon_adr[i];
+    for (int w = adr; w < adr + m->tendon_num[i]; w++) {
+      CoupleTrees(static_tree_, m, body, WrapBody(m, w));
+    }
+  }
+
+  // actuators
+  for (int i = 0; i < m->nu; i++) {
+    int body = ActuatorBody(m, i);
+    if (body < 0) return false;
+    int type = m->actuator_trntype[i];
+    int id = m->actuator_trnid[2 * i + 1];
+    if ((type == mjTRN_SLIDERCRANK || type == mjTRN_SITE) && id >= 0) {
+      CoupleTrees(static_tree_, m, body, m->site_bodyid[id]);
+    }
+  }
+
+  // equality constraints
+  for (int i = 0; i < m->neq; i++) {
+    int id1 = m->eq_obj1id[i];
+    int id2 = m->eq_obj2id[i];
+    switch (m->eq_type[i]) {
+      case mjEQ_CONNECT:
+      case mjEQ_WELD:
+        CoupleTrees(static_tree_, m, id1, id2);
+        break;
+      case mjEQ_JOINT:
+        if (id2 >= 0) {
+          CoupleTrees(static_tree_, m, m->jnt_bodyid[id1], m->jnt_bodyid[id2]);
+        }
+        break;
+      case mjEQ_TENDON:
+        if (id2 >= 0) {
+          CoupleTrees(static_tree_, m, TendonBody(m, id1), TendonBody(m, id2));
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+
+  // sensors, user sensors (e.g., task residuals) can depend on anything
+  sensor_body_.resize(m->nsensor);
+  for (int i = 0; i < m->nsensor; i++) {
+    int type = m->sensor_type[i];
+    if (type == mjSENS_USER || type == mjSENS_RANGEFINDER ||
+        type == mjSENS_PLUGIN) {
+      return false;
+    }
+    int body = ObjectBody(m, m->sensor_objtype[i], m->sensor_objid[i]);
+    if (body < 0) return false;
+    if (m->sensor_reftype[i] != mjOBJ_UNKNOWN) {
+      int ref = ObjectBody(m, m->sensor_reftype[i], m->sensor_refid[i]);
+      if (ref < 0) return false;
+      if (m->body_rootid[body] == 0) {
+        body = ref;
+      } else {
+        CoupleTrees(static_tree_, m, body, ref);
+      }
+    }
+    sensor_body_[i] = body;
+  }
+
+  return true;
+}
+
+// finite-difference transition derivatives with colored perturbations
+bool ModelDerivatives::ColoredTransitionFD(const mjModel* m, mjData* d,
+                                           double eps, bool centered,
+                                           double* A, double* B, double* C,
+                                           double* D,
+                                           ColoringScratch& s) const {
+  // dimensions
+  int nq = m->nq, nv = m->nv, na = m->na, nu = m->nu;
+  int nsensor = m->nsensor, ns = m->nsensordata;
+  int ndx = 2 * nv + na;
+  int ncol = ndx + (B || D ? nu : 0);
+  int nnext = nq + nv + na + ns;
+
+  // save center
+  s.center.resize(nq + nv + na + nu + nv);
+  mju_copy(s.center.data(), d->qpos, nq);
+  mju_copy(s.center.data() + nq, d->qvel, nv);
+  mju_copy(s.center.data() + nq + nv, d->act, na);
+  mju_copy(s.center.data() + nq + nv + na, d->ctrl, nu);
+  mju_copy(s.center.data() + nq + nv + na + nu, d->qacc_warmstart, nv);
+  double time = d->time;
+  const double* ctrl = s.center.data() + nq + nv + na;
+
+  // nominal step, also detects contacts at the center
+  s.center_next.resize(nnext);
+  mj_step(m, d);
+  RecordNext(m, d, s.center_next.data());
+
+  // couple trees in contact
+  s.tree = static_tree_;
+  for (int i = 0; i < d->ncon; i++) {
+    int geom1 = d->contact[i].geom1;
+    int geom2 = d->contact[i].geom2;
+    if (geom1 < 0 || geom2 < 0) {
+      RestoreCenter(m, d, s.center.data(), time);
+      return false;
+    }
+    CoupleTrees(s.tree, m, m->geom_bodyid[geom1], m->geom_bodyid[geom2]);
+  }
+
+  // groups: degrees of freedom, then activations and controls by actuator
+  s.column_group.resize(ncol);
+  for (int j = 0; j < nv; j++) {
+    int group = FindTree(s.tree, m, m->dof_bodyid[j]);
+    s.column_group[j] = group;
+    s.column_group[nv + j] = group;
+  }
+  for (int i = 0; i < nu; i++) {
+    int group = FindTree(s.tree, m, ActuatorBody(m, i));
+    for (int k = 0; k < m->actuator_actnum[i]; k++) {
+      s.column_group[2 * nv + m->actuator_actadr[i] + k] = group;
+    }
+    if (ncol > ndx) s.column_group[ndx + i] = group;
+  }
+  s.sensor_group.resize(nsensor);
+  for (int i = 0; i < nsensor; i++) {
+    s.sensor_group[i] = FindTree(s.tree, m, sensor_body_[i]);
+  }
+
+  // colors: coordinates of distinct groups share a perturbation
+  s.group_count.assign(m->nbody, 0);
+  s.column_color.resize(ncol);
+  int num_color = 0;
+  for (int j = 0; j < ncol; j++) {
+    int color = s.group_count[s.column_group[j]]++;
+    s.column_color[j] = color;
+    num_color = std::max(num_color, color + 1);
+  }
+
+  // all coordinates coupled
+  if (num_color == ncol) {
+    RestoreCenter(m, d, s.center.data(), time);
+    return false;
+  }
+
+  // entries between groups are zero
+  if (A) mju_zero(A, ndx * ndx);
+  if (B) mju_zero(B, ndx * nu);
+  if (C) mju_zero(C, ns * ndx);
+  if (D) mju_zero(D, ns * nu);
+
+  s.perturbation.resize(2 * ncol);
+  s.dpos.resize(nv);
+  s.plus_next.resize(nnext);
+  s.minus_next.resize(nnext);
+  s.difference.resize(ndx);
+  double* plus = s.perturbation.data();
+  double* minus = s.perturbation.data() + ncol;
+
+  // perturb coordinates by step and simulate
+  auto perturbed_step = [&](const double* step, double* next) {
+    RestoreCenter(m, d, s.center.data(), time);
+    mju_zero(s.dpos.data(), nv);
+    for (int j = 0; j < ncol; j++) {
+      if (step[j] == 0.0) continue;
+      if (j < nv) {
+        s.dpos[j] = step[j];
+      } else if (j < 2 * nv) {
+        d->qvel[j - nv] += step[j];
+      } else if (j < ndx) {
+        d->act[j - 2 * nv] += step[j];
+      } else {
+        d->ctrl[j - ndx] += step[j];
+      }
+    }
+    mj_integratePos(m, d->qpos, s.dpos.data(), 1);
+    mj_step(m, d);
+    RecordNext(m, d, next);
+  };
+
+  for (int c = 0; c < num_color; c++) {
+    // steps, one-sided for controls at their limits
+    bool has_minus = false;
+    for (int j = 0; j < ncol; j++) {
+      plus[j] = minus[j] = 0.0;
+      if (s.column_color[j] != c) continue;
+      bool forward = true, backward = true;
+      if (j >= ndx && m->actuator_ctrllimited[j - ndx]) {
+        const double* range = m->actuator_ctrlrange + 2 * (j - ndx);
+        forward = ctrl[j - ndx] + eps <= range[1];
+        backward = ctrl[j - ndx] - eps >= range[0];
+      }
+      if (centered) {
+        plus[j] = forward ? eps : 0.0;
+        minus[j] = backward ? -eps : 0.0;
+      } else {
+        plus[j] = forward || !backward ? eps : -eps;
+      }
+      has_minus |= minus[j] != 0.0;
+    }
+
+    // simulate
+    perturbed_step(plus, s.plus_next.data());
+    if (has_minus) perturbed_step(minus, s.minus_next.data());
+
+    // recover columns of this color
+    for (int j = 0; j < ncol; j++) {
+      double step = plus[j] - minus[j];
+      if (s.column_color[j] != c || step == 0.0) continue;
+      int group = s.column_group[j];
+      const double* next1 =
+          plus[j] != 0.0 ? s.plus_next.data() : s.center_next.data();
+      const double* next0 =
+          minus[j] != 0.0 ? s.minus_next.data() : s.center_next.data();
+
+      // state
+      double* difference = s.difference.data();
+      mj_differentiatePos(m, difference, step, next0, next1);
+      for (int i = nv; i < ndx; i++) {
+        difference[i] = (next1[nq + i - nv] - next0[nq + i - nv]) / step;
+      }
+      double* jac = j < ndx ? A : B;
+      int cols = j < ndx ? ndx : nu;
+      int col = j < ndx ? j : j - ndx;
+      if (jac) {
+        for (int i = 0; i < ndx; i++) {
+          if (s.column_group[i] == group) jac[i * cols + col] = difference[i];
+        }
+      }
+
+      // sensors
+      jac = j < ndx ? C : D;
+      if (!jac) continue;
+      for (int k = 0; k < nsensor; k++) {
+        if (s.sensor_group[k] != group) continue;
+        int adr = m->sensor_adr[k];
+        for (int i = adr; i < adr + m->sensor_dim[k]; i++) {
+          int e = nq + nv + na + i;
+          jac[i * cols + col] = (next1[e] - next0[e]) / step;
+        }
+      }
+    }
+  }
+
+  // restore center
+  RestoreCenter(m, d, s.center.data(), time);
+  return true;
+}
+
+// action Jacobians of the smooth dynamics
+bool ModelDerivatives::SmoothActionFD(const mjModel* m, mjData* d, double eps,
+                                      bool centered, bool contact_free,
+                                      double* B, double* D,
+                                      ColoringScratch& s) const {
+  // dimensions
+  int nq = m->nq, nv = m->nv, na = m->na, nu = m->nu;
+  int ns = m->nsensordata;
+  int ndx = 2 * nv + na;
+  int nnext = nq + nv + na + ns;
+
+  // save center
+  s.center.resize(nq + nv + na + nu + nv);
+  mju_copy(s.center.data(), d->qpos, nq);
+  mju_copy(s.center.data() + nq, d->qvel, nv);
+  mju_copy(s.center.data() + nq + nv, d->act, na);
+  mju_copy(s.center.data() + nq + nv + na, d->ctrl, nu);
+  mju_copy(s.center.data() + nq + nv + na + nu, d->qacc_warmstart, nv);
+  double time = d->time;
+  const double* ctrl = s.center.data() + nq + nv + na;
+
+  // position and velocity stages, kept for all perturbations
+  mj_forward(m, d);
+  if (contact_free && d->nefc > 0) {
+    RestoreCenter(m, d, s.center.data(), time);
+    return false;
+  }
+  s.qacc_constraint.resize(nv);
+  mju_sub(s.qacc_constraint.data(), d->qacc, d->qacc_smooth, nv);
+
+  // actuation, acceleration and acceleration sensors, then an Euler step
+  auto smooth_step = [&](double* next) {
+    mju_copy(d->qpos, s.center.data(), nq);
+    mju_copy(d->qvel, s.center.data() + nq, nv);
+    mju_copy(d->act, s.center.data() + nq + nv, na);
+    d->time = time;
+    mj_fwdActuation(m, d);
+    mj_fwdAcceleration(m, d);
+    mju_add(d->qacc, d->qacc_smooth, s.qacc_constraint.data(), nv);
+    mj_sensorAcc(m, d);
+    mj_Euler(m, d);
+    RecordNext(m, d, next);
+  };
+
+  s.center_next.resize(nnext);
+  s.plus_next.resize(nnext);
+  s.minus_next.resize(nnext);
+  s.difference.resize(ndx);
+  smooth_step(s.center_next.data());
+
+  for (int i = 0; i < nu; i++) {
+    // steps, one-sided for controls at their limits and for affine actuators,
+    // whose smooth dynamics are linear in the control
+    bool forward = true, backward = true;
+    if (m->actuator_ctrllimited[i]) {
+      const double* range = m->actuator_ctrlrange + 2 * i;
+      forward = ctrl[i] + eps <= range[1];
+      backward = ctrl[i] - eps >= range[0];
+    }
+    bool affine = m->actuator_dyntype[i] == mjDYN_NONE &&
+                  m->actuator_gaintype[i] == mjGAIN_FIXED &&
+                  (m->actuator_biastype[i] == mjBIAS_NONE ||
+                   m->actuator_biastype[i] == mjBIAS_AFFINE) &&
+                  !m->actuator_forcelimited[i];
+    double plus = 0.0, minus = 0.0;
+    if (centered && !(affine && forward)) {
+      plus = forward ? eps : 0.0;
+      minus = backward ? -eps : 0.0;
+    } else {
+      plus = forward || !backward ? eps : -eps;
+    }
+
+    // simulate
+    mju_copy(d->ctrl, ctrl, nu);
+    d->ctrl[i] += plus;
+    smooth_step(s.plus_next.data());
+    if (minus != 0.0) {
+      mju_copy(d->ctrl, ctrl, nu);
+      d->ctrl[i] += minus;
+      smooth_step(s.minus_next.data());
+    }
+    double step = plus - minus;
+    if (step == 0.0) continue;
+    const double* next1 =
+        plus != 0.0 ? s.plus_next.data() : s.center_next.data();
+    const double* next0 =
+        minus != 0.0 ? s.minus_next.data() : s.center_next.data();
+
+    // state
+    if (B) {
+      double* difference = s.difference.data();
+      mj_differentiatePos(m, difference, step, next0, next1);
+      for (int j = nv; j < ndx; j++) {
+        difference[j] = (next1[nq + j - nv] - next0[nq + j - nv]) / step;
+      }
+      for (int j = 0; j < ndx; j++) B[j * nu + i] = difference[j];
+    }
+
+    // sensors
+    if (D) {
+      for (int j = 0; j < ns; j++) {
+        int e = nq + nv + na + j;
+        D[j * nu + i] = (next1[e] - next0[e]) / step;
+      }
+    }
+  }
+
+  // restore center
+  RestoreCenter(m, d, s.center.data(), time);
+  return true;
 }
 
 }  // namespace mjpc
@@ -17,6 +17,7 @@
 
 #include <mujoco/mujoco.h>
 
+#include <cstddef>
 #include <cstdlib>
 #include <vector>
 
@@ -25,6 +26,17 @@
 
 namespace mjpc {
 
+// source of the transition and sensor Jacobians wrt action
+enum DerivativeBackend : int {
+  kFiniteDifferenceDerivatives = 0,  // finite differences of mj_step
+  kSmoothDerivatives,  // differences of the actuation and acceleration stages
+                       // at the center's positions and velocities, with the
+                       // constraint forces of the center held fixed
+  kHybridDerivatives,  // smooth at time steps without active constraints,
+                       // finite differences of mj_step at the others
+  kNumDerivativeBackend,
+};
+
 // data and methods for model derivatives
 class ModelDerivatives {
  public:
@@ -38,14 +50,74 @@ class ModelDerivatives {
   void Allocate(int dim_state_derivative, int dim_action, int dim_sensor,
                 int T);
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int dim_state_derivative, int dim_action, int dim_sensor, int T);
 
-  // compute derivatives at all time steps
+  // compute derivatives at all time steps. only the leading sensors whose
+  // dimensions sum to dim_sensor (<= nsensordata) are evaluated, e.g.,
+  // dim_sensor = num_residual for the residual rows of C and D; dim_sensor
+  // must end on a sensor boundary. with colored, coordinates of independent
+  // kinematic trees are perturbed together. with skip_tolerance > 0, time
+  // steps whose state and action moved less than skip_tolerance (max norm)
+  // since their last evaluation keep their derivatives.
+  void Compute(const mjModel* m, const std::vector<mjData*>& data,
+               const double* x, const double* u, const double* h, int dim_state,
+               int dim_state_derivative, int dim_action, int dim_sensor, int T,
+               double tol, int mode, ThreadPool& pool, bool colored = false,
+               double skip_tolerance = 0.0);
   void Compute(const mjModel* m, const std::vector<UniqueMjData>& data,
                const double* x, const double* u, const double* h, int dim_state,
                int dim_state_derivative, int dim_action, int dim_sensor, int T,
-               double tol, int mode, ThreadPool& pool);
+               double tol, int mode, ThreadPool& pool, bool colored = false,
+               double skip_tolerance = 0.0);
+
+  // select the time steps to evaluate and set up coloring for ComputeStep,
+  // with the arguments of Compute. num_data is the number of mjData (and
+  // scratch) slots that ComputeStep may be called with.
+  void Prepare(const mjModel* m, int num_data, const double* x,
+               const double* u, int dim_state, int dim_action, int dim_sensor,
+               int T, bool colored = false, double skip_tolerance = 0.0);
+
+  // move stored derivatives and linearization points shift time steps
+  // earlier, so that a receding horizon that advanced by shift steps can
+  // reuse them with skip_tolerance. steps without a stored point are
+  // evaluated in the next Prepare. shift < 0 drops all stored points.
+  void Shift(int shift, int dim_state, int dim_state_derivative,
+             int dim_action, int dim_sensor);
+
+  // compute derivatives at time step t using d and scratch slot id, after
+  // Prepare. steps can be computed concurrently with distinct d and id. the
+  // Jacobians are stored at Slot(t).
+  void ComputeStep(const mjModel* m, mjData* d, int id, const double* x,
+                   const double* u, const double* h, int dim_state,
+                   int dim_state_derivative, int dim_action, int dim_sensor,
+                   int T, double tol, int mode, int t);
+
+  // storage index of time step t
+  int Slot(int t) const { return window > 0 ? t % window : t; }
+
+  // with window > 0, ComputeStep stores the Jacobians of time step t at
+  // t % window, so that they take window steps of memory. Compute and
+  // skipping require window = 0.
+  int window = 0;
+
+  // source of B and D (read by Prepare). the smooth backends require the
+  // Euler integrator, with others the finite differences of mj_step are used.
+  // A and C are finite differences of mj_step with every backend. smooth
+  // action Jacobians skip the position and velocity stages, and the
+  // collision and constraint solver, of the action perturbations, with one
+  // perturbation per affine actuator also for centered differences.
+  int backend = kFiniteDifferenceDerivatives;
+
+  // constraint solver warm starts of the time steps (T x nv), e.g., recorded
+  // by the rollout of x and u (Trajectory::record_warmstart); nullptr: the
+  // warm start left in the mjData. ComputeStep sets the step's row before
+  // differencing, so that the center reproduces the rollout's solve and the
+  // perturbed solves start from its accelerations.
+  const double* warmstart = nullptr;
 
   // Jacobians
   std::vector<double> A;  // model Jacobians wrt state
@@ -56,6 +128,65 @@ class ModelDerivatives {
                           //   (T * dim_sensor * dim_state_derivative)
   std::vector<double> D;  // output Jacobians wrt action
                           //   (T * dim_sensor * dim_action)
+
+  // fraction of time steps that reused derivatives in the last Compute
+  double skip_ratio = 0.0;
+
+  // time steps differentiated in the last Compute
+  int num_evaluated = 0;
+
+ private:
+  // per-thread memory for colored and smooth finite differences
+  struct ColoringScratch {
+    std::vector<int> tree;          // union-find over kinematic trees (nbody)
+    std::vector<int> column_group;  // group of each perturbed coordinate,
+                                    // also of each state derivative row
+    std::vector<int> column_color;  // color of each perturbed coordinate
+    std::vector<int> sensor_group;  // group of each sensor
+    std::vector<int> group_count;   // coordinates assigned per group
+    std::vector<double> center;     // (qpos, qvel, act, ctrl, warmstart)
+    std::vector<double> center_next;   // (qpos, qvel, act, sensordata)
+    std::vector<double> plus_next;     // (qpos, qvel, act, sensordata)
+    std::vector<double> minus_next;    // (qpos, qvel, act, sensordata)
+    std::vector<double> perturbation;  // plus and minus step per coordinate
+    std::vector<double> dpos;          // (nv)
+    std::vector<double> difference;    // (dim_state_derivative)
+    std::vector<double> qacc_constraint;  // of the center (nv)
+  };
+
+  // coupling between kinematic trees that does not depend on the state
+  // (tendons, actuators, equality constraints, sensors). returns false if a
+  // coupling cannot be resolved and coloring does not apply.
+  bool StaticTreeCoupling(const mjModel* m);
+
+  // finite-difference transition derivatives with colored perturbations.
+  // returns false, with d unchanged, if all coordinates are coupled.
+  bool ColoredTransitionFD(const mjModel* m, mjData* d, double eps,
+                           bool centered, double* A, double* B, double* C,
+                           double* D, ColoringScratch& s) const;
+
+  // action Jacobians B and D (nullptr: skipped) from the smooth dynamics at
+  // the state of d. with contact_free, returns false, with d unchanged, if
+  // the center has active constraints.
+  bool SmoothActionFD(const mjModel* m, mjData* d, double eps, bool centered,
+                      bool contact_free, double* B, double* D,
+                      ColoringScratch& s) const;
+
+  // linearization points of the current derivatives, for skipping
+  std::vector<double> linearized_state_;   // (T * dim_state)
+  std::vector<double> linearized_action_;  // (T * dim_action)
+  std::vector<int> evaluate_;              // (T)
+  std::vector<int> linearized_;            // (T) stored point is valid
+  int num_linearized_ = 0;                 // T of the stored points
+
+  bool coloring_ = false;          // colored differences in ComputeStep
+  bool smooth_ = false;            // smooth action Jacobians in ComputeStep
+  double skip_tolerance_ = 0.0;    // tolerance of the last Prepare
+
+  std::vector<int> static_tree_;  // tree union-find after static coupling
+  std::vector<int> sensor_body_;  // body each sensor depends on (nsensor)
+  mjModel sensor_model_;  // header of the model, truncated to dim_sensor
+  std::vector<ColoringScratch> scratch_;
 };
 
 }  // namespace mjpc
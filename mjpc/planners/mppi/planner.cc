@@ -0,0 +1,194 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/mppi/planner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <shared_mutex>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/task.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+// temperature scaling per iteration
+inline constexpr double kMPPITemperatureRate = 1.1;
+
+// initialize data and settings
+void MPPIPlanner::Initialize(mjModel* model, const Task& task) {
+  SamplingPlanner::Initialize(model, task);
+
+  // temperature, in units of total return
+  temperature_initial = GetNumberOrDefault(1.0, model, "mppi_temperature");
+
+  // target effective samples, fraction of rollouts
+  effective_fraction =
+      GetNumberOrDefault(0.1, model, "mppi_effective_fraction");
+}
+
+// reset memory to zeros
+void MPPIPlanner::Reset(int horizon, const double* initial_repeated_action) {
+  SamplingPlanner::Reset(horizon, initial_repeated_action);
+  temperature = temperature_initial;
+  effective_samples = 0.0;
+}
+
+// normalized sample weights from total returns
+double MPPIPlanner::SampleWeights(double* weights, const double* returns,
+                                  int n, double temperature) {
+  double min_return = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < n; i++) {
+    if (std::isfinite(returns[i])) {
+      min_return = std::min(min_return, returns[i]);
+    }
+  }
+
+  // no finished samples: keep the nominal
+  if (!std::isfinite(min_return)) {
+    mju_zero(weights, n);
+    if (n > 0) weights[0] = 1.0;
+    return 1.0;
+  }
+
+  // exponential weights, shifted by the best return
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    weights[i] = std::isfinite(returns[i])
+                     ? std::exp(-(returns[i] - min_return) / temperature)
+                     : 0.0;
+    sum += weights[i];
+  }
+
+  // normalize, effective number of samples
+  double sum_squares = 0.0;
+  for (int i = 0; i < n; i++) {
+    weights[i] /= sum;
+    sum_squares += weights[i] * weights[i];
+  }
+  return 1.0 / sum_squares;
+}
+
+// optimize nominal policy using weighted samples
+void MPPIPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
+  // resample the weighted nominal policy to current time
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    candidate_policy[0] = policy;
+  }
+  winner = 0;
+  this->UpdateNominalPolicy(horizon);
+
+  // if num_trajectory_ has changed, use it in this new iteration.
+  // num_trajectory_ might change while this function runs. Keep it constant
+  // for the duration of this function.
+  int num_trajectory = num_trajectory_;
+
+  // lockstep groups need one mjData per sample in the group
+  int lockstep = lockstep_;
+  ResizeMjData(model, pool.NumThreads() * std::max(lockstep, 1), &pool,
+               std::max(lockstep, 1));
+  int steps = ScheduleSteps(horizon);
+  ResizeTrajectories(num_trajectory, steps);
+
+  // ----- rollout noisy policies ----- //
+  // start timer
+  TraceSpan rollouts_span("MPPIPlanner::rollouts");
+
+  // every sample is weighted, the bound is only known once all finish
+  return_bound_.Reset(num_trajectory);
+  this->Rollouts(num_trajectory, steps, pool, lockstep);
+
+  // packed returns
+  trajectory_return.resize(num_trajectory);
+  for (int i = 0; i < num_trajectory; i++) {
+    trajectory_return[i] = trajectory[i].total_return;
+  }
+
+  // stop timer
+  rollouts_compute_time = rollouts_span.End();
+
+  // ----- update policy ----- //
+  // start timer
+  TraceSpan policy_update_span("MPPIPlanner::policy_update");
+
+  // sample weights
+  weights.resize(num_trajectory);
+  effective_samples = SampleWeights(weights.data(), trajectory_return.data(),
+                                    num_trajectory, temperature);
+
+  // adapt temperature toward the target effective number of samples
+  if (effective_samples < effective_fraction * num_trajectory) {
+    temperature *= kMPPITemperatureRate;
+  } else {
+    temperature /= kMPPITemperatureRate;
+  }
+  temperature =
+      std::clamp(temperature, MinMPPITemperature, MaxMPPITemperature);
+
+  // best sample, for the best trajectory and traces
+  winner = std::min_element(trajectory_return.begin(),
+                            trajectory_return.end()) -
+           trajectory_return.begin();
+  RecordWinner();
+
+  // weighted average of clamped sample parameters
+  int num_parameters = candidate_policy[0].num_parameters;
+  mju_zero(parameters_scratch.data(), num_parameters);
+  for (int i = 0; i < num_trajectory; i++) {
+    if (weights[i] == 0.0) continue;
+    mju_addToScl(parameters_scratch.data(),
+                 candidate_policy[i].parameters.data(), weights[i],
+                 num_parameters);
+  }
+
+  // update
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    previous_policy = policy;
+    mju_copy(policy.parameters.data(), parameters_scratch.data(),
+             num_parameters);
+  }
+  published_policy_.Publish(policy, previous_policy);
+
+  // improvement: compare nominal to best sample
+  improvement = mju_max(
+      trajectory[0].total_return - trajectory[winner].total_return, 0.0);
+
+  // stop timer
+  policy_update_compute_time = policy_update_span.End();
+}
+
+// planner-specific GUI elements
+void MPPIPlanner::GUI(mjUI& ui) {
+  SamplingPlanner::GUI(ui);
+  mjuiDef defMPPI[] = {
+      {mjITEM_SLIDERNUM, "Eff. Samples", 2, &effective_fraction, "0.01 1"},
+      {mjITEM_END}};
+  mjui_add(&ui, defMPPI);
+}
+
+void MPPIPlanner::ReportMemory(MemoryReport& report) const {
+  SamplingPlanner::ReportMemory(report);
+  report.Add("weights", weights);
+}
+
+}  // namespace mjpc
@@ -0,0 +1,76 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_PLANNERS_MPPI_PLANNER_H_
+#define MJPC_PLANNERS_MPPI_PLANNER_H_
+
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/sampling/planner.h"
+#include "mjpc/task.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+// mppi planner limits
+inline constexpr double MinMPPITemperature = 1.0e-6;
+inline constexpr double MaxMPPITemperature = 1.0e6;
+
+// model predictive path integral: the nominal policy is the exponentially
+// weighted average of all samples, w_i ~ exp(-(R_i - R_min) / temperature).
+// the temperature adapts so that the effective number of samples,
+// (sum w)^2 / sum w^2, tracks a fraction of the rollouts.
+class MPPIPlanner : public SamplingPlanner {
+ public:
+  // constructor
+  MPPIPlanner() = default;
+
+  // destructor
+  ~MPPIPlanner() override = default;
+
+  // ----- methods ----- //
+
+  // initialize data and settings
+  void Initialize(mjModel* model, const Task& task) override;
+
+  // reset memory to zeros
+  void Reset(int horizon,
+             const double* initial_repeated_action = nullptr) override;
+
+  // optimize nominal policy using weighted samples
+  void OptimizePolicy(int horizon, ThreadPool& pool) override;
+
+  // planner-specific GUI elements
+  void GUI(mjUI& ui) override;
+
+  // sampling planner buffers and the sample weights
+  void ReportMemory(MemoryReport& report) const override;
+
+  // normalized sample weights from total returns, returns the effective
+  // number of samples. unfinished samples (infinite return) get zero weight.
+  static double SampleWeights(double* weights, const double* returns, int n,
+                              double temperature);
+
+  // ----- members ----- //
+  double temperature;
+  double temperature_initial;
+  double effective_fraction;  // target effective samples / rollouts
+  double effective_samples;   // last iteration
+  std::vector<double> weights;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLANNERS_MPPI_PLANNER_H_
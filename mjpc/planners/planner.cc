@@ -15,20 +15,219 @@
 #include "mjpc/planners/planner.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
+#include "mjpc/shared_model.h"
+#include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
-void Planner::ResizeMjData(const mjModel* model, int num_threads) {
-  int new_size = std::max(1, num_threads);
-  if (data_.size() > new_size) {
-    data_.erase(data_.begin() + new_size, data_.end());
+PlannerCounters& PlannerCounters::operator+=(const PlannerCounters& other) {
+  rollouts += other.rollouts;
+  steps += other.steps;
+  residuals += other.residuals;
+  derivatives += other.derivatives;
+  aborted += other.aborted;
+  solver_iterations += other.solver_iterations;
+  return *this;
+}
+
+void CounterAccumulator::Reset() {
+  rollouts_ = 0;
+  steps_ = 0;
+  residuals_ = 0;
+  derivatives_ = 0;
+  aborted_ = 0;
+  solver_iterations_ = 0;
+}
+
+void CounterAccumulator::AddRollout(const Trajectory& trajectory) {
+  rollouts_.fetch_add(1, std::memory_order_relaxed);
+  if (trajectory.failure) aborted_.fetch_add(1, std::memory_order_relaxed);
+  AddSteps(trajectory);
+}
+
+void CounterAccumulator::AddSteps(const Trajectory& trajectory) {
+  steps_.fetch_add(trajectory.num_steps, std::memory_order_relaxed);
+  residuals_.fetch_add(trajectory.num_residuals, std::memory_order_relaxed);
+  solver_iterations_.fetch_add(trajectory.num_solver_iterations,
+                               std::memory_order_relaxed);
+}
+
+void CounterAccumulator::AddDerivatives(int steps) {
+  derivatives_.fetch_add(steps, std::memory_order_relaxed);
+}
+
+PlannerCounters CounterAccumulator::Read() const {
+  PlannerCounters counters;
+  counters.rollouts = rollouts_.load(std::memory_order_relaxed);
+  counters.steps = steps_.load(std::memory_order_relaxed);
+  counters.residuals = residuals_.load(std::memory_order_relaxed);
+  counters.derivatives = derivatives_.load(std::memory_order_relaxed);
+  counters.aborted = aborted_.load(std::memory_order_relaxed);
+  counters.solver_iterations =
+      solver_iterations_.load(std::memory_order_relaxed);
+  return counters;
+}
+
+void LogSamples(PlanLogRecord& record, const Trajectory* trajectory,
+                int num_trajectory, bool states) {
+  record.returns.resize(num_trajectory);
+  for (int i = 0; i < num_trajectory; i++) {
+    record.returns[i] = trajectory[i].total_return;
+  }
+  if (!states || num_trajectory == 0) return;
+
+  // samples share the horizon of the iteration, pruned ones are zero-padded
+  // and lean ones zero
+  int horizon = trajectory[0].horizon;
+  int dim_state = trajectory[0].dim_state;
+  int size = horizon * dim_state;
+  record.sample_horizon = horizon;
+  record.dim_sample_state = dim_state;
+  record.sample_states.resize(num_trajectory * size);
+  for (int i = 0; i < num_trajectory; i++) {
+    int n = trajectory[i].lean
+                ? 0
+                : std::min(trajectory[i].horizon, horizon) * dim_state;
+    double* dst = record.sample_states.data() + i * size;
+    mju_copy(dst, trajectory[i].states.data(), n);
+    mju_zero(dst + n, size - n);
+  }
+}
+
+void SelectTraceSamples(std::vector<int>& samples, const Trajectory* trajectory,
+                        int max_samples) {
+  int num_samples =
+      std::clamp(max_samples, 0, static_cast<int>(samples.size()));
+  std::partial_sort(samples.begin(), samples.begin() + num_samples,
+                    samples.end(), [trajectory](int a, int b) {
+                      return trajectory[a].total_return <
+                             trajectory[b].total_return;
+                    });
+  samples.resize(num_samples);
+}
+
+bool AddTraceLines(mjvScene* scn, const Trajectory& trajectory, int num_trace,
+                   int horizon, int stride, double width, const float rgba[4]) {
+  if (horizon < 2 || num_trace < 1) return true;
+  stride = std::max(stride, 1);
+
+  // segments: (horizon - 1) / stride, rounded up
+  int num_segment = (horizon - 2) / stride + 1;
+  if (scn->ngeom + num_segment * num_trace > scn->maxgeom) return false;
+
+  // lines differ only in their endpoints, initialize once and copy
+  mjvGeom line;
+  mjv_initGeom(&line, mjGEOM_LINE, nullptr, nullptr, nullptr, rgba);
+
+  const double* trace = trajectory.trace.data();
+  for (int s = 0; s < num_segment; s++) {
+    int from = s * stride;
+    int to = std::min(from + stride, horizon - 1);
+    for (int j = 0; j < num_trace; j++) {
+      const double* p0 = trace + 3 * (num_trace * from + j);
+      const double* p1 = trace + 3 * (num_trace * to + j);
+      mjvGeom* geom = scn->geoms + scn->ngeom++;
+      *geom = line;
+      mjv_makeConnector(geom, mjGEOM_LINE, width, p0[0], p0[1], p0[2], p1[0],
+                        p1[1], p1[2]);
+    }
+  }
+  return true;
+}
+
+void MjDataPool::Borrow(const mjModel* model, int lane, int num_data,
+                        std::vector<mjData*>* data, ThreadPool* pool,
+                        int per_worker) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string_view sizes = ModelSizes(model);
+  if (model != model_ || sizes != sizes_) {
+    // plugins keep per-data state made for their model
+    if (sizes == sizes_ && !model->nplugin) {
+      for (auto& lane_data : lanes_) {
+        for (auto& lane_datum : lane_data) {
+          if (lane_datum) mj_resetData(model, lane_datum.get());
+        }
+      }
+    } else {
+      lanes_.clear();
+    }
+    model_ = model;
+    sizes_ = sizes;
+  }
+  if (static_cast<int>(lanes_.size()) <= lane) lanes_.resize(lane + 1);
+  std::vector<UniqueMjData>& lane_data = lanes_[lane];
+  int begin = lane_data.size();
+  while (static_cast<int>(lane_data.size()) < num_data) {
+    lane_data.push_back(MakeUniqueMjData(nullptr));
+  }
+
+  // first touch by the using worker. workers of pool make their own, since
+  // waiting on other workers from a worker could deadlock.
+  if (pool && pool->NumThreads() > 0 && !pool->IsWorker() &&
+      begin < num_data) {
+    TaskGroup group(*pool);
+    for (int i = begin; i < num_data; i++) {
+      group.ScheduleOnWorker(i / std::max(per_worker, 1), [&, i]() {
+        lane_data[i] = MakeUniqueMjData(mj_makeData(model));
+      });
+    }
   } else {
-    data_.reserve(new_size);
-    while (data_.size() < new_size) {
-      data_.push_back(MakeUniqueMjData(mj_makeData(model)));
+    for (int i = begin; i < num_data; i++) {
+      lane_data[i] = MakeUniqueMjData(mj_makeData(model));
     }
   }
+  data->resize(num_data);
+  for (int i = 0; i < num_data; i++) (*data)[i] = lane_data[i].get();
+}
+
+int MjDataPool::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int size = 0;
+  for (const auto& lane_data : lanes_) size += lane_data.size();
+  return size;
+}
+
+std::size_t MjDataPool::Bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t bytes = 0;
+  for (const auto& lane_data : lanes_) {
+    for (const UniqueMjData& data : lane_data) bytes += MjDataBytes(data.get());
+  }
+  return bytes;
+}
+
+void Planner::ForEachAllocation(int n,
+                                absl::FunctionRef<void(int)> fn) const {
+  if (allocation_pool_ && allocation_pool_->NumThreads() > 1) {
+    allocation_pool_->ParallelFor(0, n, 1, fn);
+  } else {
+    for (int i = 0; i < n; i++) fn(i);
+  }
+}
+
+void Planner::ResizeMjData(const mjModel* model, int num_threads,
+                           ThreadPool* pool, int per_worker) {
+  if (!data_pool_) data_pool_ = std::make_shared<MjDataPool>();
+  data_pool_->Borrow(model, data_lane_, std::max(1, num_threads), &data_,
+                     pool, per_worker);
+}
+
+int Planner::WarmStartShift(double time, double timestep) {
+  bool valid = warm_start_valid_ && time >= warm_start_time_;
+  double elapsed = time - warm_start_time_;
+  warm_start_time_ = time;
+  warm_start_valid_ = true;
+  if (!valid) return -1;
+  return static_cast<int>(std::round(elapsed / timestep));
 }
 }  // namespace mjpc
@@ -15,8 +15,24 @@
 #ifndef MJPC_PLANNERS_PLANNER_H_
 #define MJPC_PLANNERS_PLANNER_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <absl/functional/function_ref.h>
 #include <mujoco/mujoco.h>
 
+#include "mjpc/memory_report.h"
+#include "mjpc/plan_log.h"
+#include "mjpc/planners/rollout_backend.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
@@ -28,6 +44,102 @@ namespace mjpc {
 inline constexpr int kMaxTrajectory = 128;
 inline constexpr int kMaxTrajectoryLarge = 1028;
 
+// mjData shared by the planners of an agent. a lane is a list of mjData,
+// indexed like a planner's data_ (e.g., by ThreadPool::WorkerId()). planners
+// that never run at the same time borrow the same lane, so memory scales
+// with the number of threads instead of threads x planners.
+class MjDataPool {
+ public:
+  // point data at the first num_data mjData of lane, made for model as
+  // needed. borrowing for another model drops the data of all lanes, which
+  // previous borrowers must borrow again, unless the models have the same
+  // sizes: then the data is reset for the new model and kept. with a pool,
+  // mjData i is made by worker i / per_worker (mod the pool's threads), which
+  // touches its memory first, so that it is local to the worker's NUMA node.
+  void Borrow(const mjModel* model, int lane, int num_data,
+              std::vector<mjData*>* data, ThreadPool* pool = nullptr,
+              int per_worker = 1);
+
+  // number of mjData made
+  int Size() const;
+
+  // bytes of the mjData made
+  std::size_t Bytes() const;
+
+ private:
+  mutable std::mutex mutex_;
+  const mjModel* model_ = nullptr;
+  std::string sizes_;  // ModelSizes of model_
+  std::vector<std::vector<UniqueMjData>> lanes_;
+};
+
+// compute time (microseconds) of a phase of a planning iteration
+struct PhaseTime {
+  std::string name;
+  double time;
+};
+
+// simulation work of a planning iteration
+struct PlannerCounters {
+  std::uint64_t rollouts = 0;     // trajectories simulated
+  std::uint64_t steps = 0;        // mj_step calls in rollouts
+  std::uint64_t residuals = 0;    // residual evaluations in rollouts
+  std::uint64_t derivatives = 0;  // time steps differentiated (finite
+                                  // difference transition Jacobians)
+  std::uint64_t aborted = 0;      // rollouts stopped early by a failure
+  std::uint64_t solver_iterations = 0;  // constraint solver iterations of
+                                        // rollout steps
+
+  PlannerCounters& operator+=(const PlannerCounters& other);
+};
+
+// accumulates PlannerCounters, safe to add to from the pool's threads
+class CounterAccumulator {
+ public:
+  void Reset();
+
+  // add a completed rollout (one rollout and its steps), aborted if it
+  // failed
+  void AddRollout(const Trajectory& trajectory);
+
+  // add the steps of a partial rollout, e.g., a shared prefix
+  void AddSteps(const Trajectory& trajectory);
+
+  // add time steps differentiated by ModelDerivatives::Compute
+  void AddDerivatives(int steps);
+
+  PlannerCounters Read() const;
+
+ private:
+  std::atomic<std::uint64_t> rollouts_ = 0;
+  std::atomic<std::uint64_t> steps_ = 0;
+  std::atomic<std::uint64_t> residuals_ = 0;
+  std::atomic<std::uint64_t> derivatives_ = 0;
+  std::atomic<std::uint64_t> aborted_ = 0;
+  std::atomic<std::uint64_t> solver_iterations_ = 0;
+};
+
+// display of sample traces, set from the planner GUI
+struct TraceOptions {
+  int stride = 1;                    // draw every stride-th step
+  int max_samples = kMaxTrajectory;  // draw the samples with lowest return
+};
+
+// keep the (at most) max_samples samples with the lowest total return
+void SelectTraceSamples(std::vector<int>& samples, const Trajectory* trajectory,
+                        int max_samples);
+
+// add the traces of trajectory to the scene, one line per stride steps and a
+// final line to the last step. a trajectory that doesn't fit entirely is
+// skipped. returns false if the scene is full.
+bool AddTraceLines(mjvScene* scn, const Trajectory& trajectory, int num_trace,
+                   int horizon, int stride, double width, const float rgba[4]);
+
+// set the sample returns of record to those of the first num_trajectory
+// trajectories and, with states, their states
+void LogSamples(PlanLogRecord& record, const Trajectory* trajectory,
+                int num_trajectory, bool states);
+
 // virtual planner
 class Planner {
  public:
@@ -75,8 +187,115 @@ class Planner {
   // return number of parameters optimized by planner
   virtual int NumParameters() = 0;
 
-  std::vector<UniqueMjData> data_;
-  void ResizeMjData(const mjModel* model, int num_threads);
+  // compute times of the last iteration's phases, the timers shown by Plots
+  virtual std::vector<PhaseTime> PhaseTimes() const { return {}; }
+
+  // rollouts of an iteration, an upper bound if rollouts can be skipped
+  virtual int NumRollouts() const { return 0; }
+
+  // set the rollouts of the next iterations, e.g., from an autotuner, like
+  // the GUI's setting. planners without a rollout setting ignore it.
+  virtual void SetNumRollouts(int num_rollouts) {}
+
+  // simulation work of the last (or current) planning iteration
+  virtual PlannerCounters Counters() const { return counters_.Read(); }
+
+  // warm start the nominal policy from another planner's trajectory, e.g.,
+  // the winner of a portfolio. planners without a conversion ignore it.
+  virtual void WarmStart(const Trajectory& trajectory) {}
+
+  // write what the planner continues from, e.g., its nominal policy, to a
+  // snapshot, and restore it. Restore returns false, leaving the planner
+  // unchanged, without matching sections. planners without state to keep
+  // ignore both.
+  virtual void Snapshot(SnapshotWriter& writer) const {}
+  virtual bool Restore(const SnapshotReader& reader) { return false; }
+
+  // export the latest published policy, for evaluation without the model
+  // with a PolicyEvaluator, e.g., by a client between GetPolicy calls.
+  // returns false before the first publication and for planners without an
+  // exported policy kind.
+  virtual bool ExportPolicy(ExportedPolicy& policy) const { return false; }
+
+  // add the nominal policy's parameters and, for sample-based planners, the
+  // samples of the last iteration to a plan log record. called from the
+  // planning thread after OptimizePolicy.
+  virtual void LogIteration(PlanLogRecord& record, bool samples) const {}
+
+  // add the bytes of the planner's buffers to report, without the mjData
+  // borrowed from the data pool. called between planning iterations.
+  virtual void ReportMemory(MemoryReport& report) const {}
+
+  // set the deadline for the next OptimizePolicy. planners that honor it stop
+  // optimizing once the deadline has passed and update the policy with the
+  // best result so far. a default time point means no deadline.
+  virtual void SetDeadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_ = deadline;
+  }
+
+  // returns true if a deadline is set and has passed
+  bool DeadlinePassed() const {
+    return deadline_ != std::chrono::steady_clock::time_point() &&
+           std::chrono::steady_clock::now() >= deadline_;
+  }
+
+  // share the mjData of pool's lane, and lanes up to lane + NumDataLanes() - 1
+  // for planners that run sub-planners at the same time. without a pool, the
+  // planner makes its own.
+  virtual void SetDataPool(std::shared_ptr<MjDataPool> pool, int lane) {
+    data_pool_ = std::move(pool);
+    data_lane_ = lane;
+  }
+  virtual int NumDataLanes() const { return 1; }
+
+  // rollouts of sample-based planners, the pool backend if nullptr. planners
+  // with sub-planners forward it.
+  virtual void SetRolloutBackend(std::shared_ptr<RolloutBackend> backend) {
+    rollout_backend_ = std::move(backend);
+  }
+
+  // pool for the allocation and first-touch zeroing of Allocate and Reset,
+  // e.g., the planning pool at startup. nullptr: the calling thread. planners
+  // with sub-planners forward it.
+  virtual void SetAllocationPool(ThreadPool* pool) { allocation_pool_ = pool; }
+
+  // borrowed from data_pool_, valid until the next ResizeMjData. with a
+  // pool, data_[i] is made by the worker that uses it, i / per_worker.
+  std::vector<mjData*> data_;
+  void ResizeMjData(const mjModel* model, int num_threads,
+                    ThreadPool* pool = nullptr, int per_worker = 1);
+
+  // whole time steps the planning start time advanced since the previous
+  // call, for shifting time-indexed warm starts onto the new horizon. returns
+  // -1 on the first call or when time went backwards (e.g., after a reset).
+  int WarmStartShift(double time, double timestep);
+
+ protected:
+  std::chrono::steady_clock::time_point deadline_;
+
+  // planning start time of the previous WarmStartShift
+  double warm_start_time_ = 0.0;
+  bool warm_start_valid_ = false;
+
+  // sample trace display
+  TraceOptions trace_options_;
+
+  // reset in OptimizePolicy, added to by the rollouts
+  CounterAccumulator counters_;
+
+  std::shared_ptr<MjDataPool> data_pool_;
+  int data_lane_ = 0;
+
+  // rollout backend, DefaultRolloutBackend if not set
+  RolloutBackend& Backend() const {
+    return rollout_backend_ ? *rollout_backend_ : DefaultRolloutBackend();
+  }
+  std::shared_ptr<RolloutBackend> rollout_backend_;
+
+  // fn(i) for i in [0, n), in parallel on the allocation pool if set, e.g.,
+  // Allocate and Reset of the candidate trajectories and policies
+  void ForEachAllocation(int n, absl::FunctionRef<void(int)> fn) const;
+  ThreadPool* allocation_pool_ = nullptr;
 };
 
 // additional optional interface for planners that can produce several policy
@@ -0,0 +1,102 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_PLANNERS_POLICY_BUFFER_H_
+#define MJPC_PLANNERS_POLICY_BUFFER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace mjpc {
+
+// double buffer of published (policy, previous policy) pairs
+// the planner copies its policies into the back buffer and swaps it with the
+// front under a mutex held only for the pointer copy, so readers (e.g., the
+// physics thread in ActionFromPolicy) never wait on a policy update. the
+// planner waits for readers to release the back buffer before overwriting it.
+// the buffers are reused, publishing and reading don't allocate.
+template <typename T>
+class PolicyBuffer {
+ public:
+  // published policies
+  struct Policies {
+    T policy;
+    T previous_policy;
+    std::uint64_t version = 0;  // publications up to and including this one
+  };
+
+  // constructor
+  PolicyBuffer()
+      : buffers_{std::make_shared<Policies>(), std::make_shared<Policies>()} {}
+
+  // copy policies into the back buffer and make it the front
+  void Publish(const T& policy, const T& previous_policy) {
+    Publish(policy, previous_policy,
+            [](T& published, const T& source) { published = source; });
+  }
+
+  // Publish with copy(published, source), e.g., a copy of the used part of
+  // the source's storage into the back buffer's memory
+  template <typename Copy>
+  void Publish(const T& policy, const T& previous_policy, Copy copy) {
+    const std::lock_guard<std::mutex> lock(publish_mutex_);
+
+    // only writers assign front_, it is read here without front_mutex_
+    std::shared_ptr<Policies>& back = buffers_[buffers_[0] == front_];
+
+    // wait for readers of the previous front, which hold it for an action
+    // evaluation: yield first, then sleep
+    for (int i = 0; back.use_count() > 1; i++) {
+      if (i < kYields) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(kReaderWait);
+      }
+    }
+
+    copy(back->policy, policy);
+    copy(back->previous_policy, previous_policy);
+    back->version = ++version_;
+    std::shared_ptr<const Policies> published = back;
+    {
+      const std::lock_guard<std::mutex> front_lock(front_mutex_);
+      front_.swap(published);
+    }
+  }
+
+  // latest published policies, nullptr before the first publication. the
+  // buffer is not reused while the returned pointer is held.
+  std::shared_ptr<const Policies> Latest() const {
+    const std::lock_guard<std::mutex> lock(front_mutex_);
+    return front_;
+  }
+
+ private:
+  // waits for readers of the back buffer
+  static constexpr int kYields = 64;
+  static constexpr std::chrono::microseconds kReaderWait{20};
+
+  std::shared_ptr<Policies> buffers_[2];
+  std::shared_ptr<const Policies> front_;  // (guarded by front_mutex_)
+  mutable std::mutex front_mutex_;
+  std::mutex publish_mutex_;  // serializes writers
+  std::uint64_t version_ = 0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLANNERS_POLICY_BUFFER_H_
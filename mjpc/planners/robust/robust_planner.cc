@@ -14,13 +14,19 @@
 
 #include "mjpc/planners/robust/robust_planner.h"
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/planner.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -36,6 +42,7 @@ void RobustPlanner::Initialize(mjModel* model, const Task& task) {
   ResizeMjData(model, 1);
 
   trajectories_.clear();
+  allocated_horizon_ = 0;
 
   // model
   model_ = model;
@@ -55,6 +62,14 @@ void RobustPlanner::Initialize(mjModel* model, const Task& task) {
 
   xfrc_std_ = GetNumberOrDefault(0.1, model, "robust_xfrc");
   xfrc_rate_ = GetNumberOrDefault(0.1, model, "robust_xfrc_rate");
+  noise_seed_ = GetNumberOrDefault(0, model, "sampling_seed");
+  common_noise_ = GetNumberOrDefault(1, model, "robust_common_noise");
+  racing_ = GetNumberOrDefault(0, model, "robust_racing");
+  racing_round_ =
+      std::max(GetNumberOrDefault(2, model, "robust_racing_round"), 1);
+  racing_confidence_ =
+      GetNumberOrDefault(2.0, model, "robust_racing_confidence");
+  iteration_ = 0;
 }
 
 void RobustPlanner::Allocate() {
@@ -67,7 +82,7 @@ void RobustPlanner::Allocate() {
   mocap_.resize(7 * model_->nmocap);
   userdata_.resize(model_->nuserdata);
 
-  ResizeTrajectories(ncandidates_ * nrepetitions_);
+  ResizeTrajectories(ncandidates_ * std::max(nrepetitions_ - 1, 0), 1);
 }
 
 void RobustPlanner::Reset(int horizon, const double* initial_repeated_action) {
@@ -78,8 +93,9 @@ void RobustPlanner::Reset(int horizon, const double* initial_repeated_action) {
   std::fill(userdata_.begin(), userdata_.end(), 0.0);
   time_ = 0.0;
 
-  for (auto& trajectory : trajectories_) {
-    trajectory.Reset(kMaxTrajectoryHorizon);
+  for (int i = 0; i < trajectories_.size(); i++) {
+    trajectories_[i].Reset(allocated_horizon_);
+    trajectories_[i].noise_stream.Seed(noise_seed_, i);
   }
 }
 
@@ -89,6 +105,9 @@ void RobustPlanner::SetState(const State& state) {
 }
 
 void RobustPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
+  MJPC_TRACE_SCOPE("RobustPlanner::OptimizePolicy");
+  counters_.Reset();
+
   // get the best N candidates
   int ncandidates =
       delegate_->OptimizePolicyCandidates(ncandidates_, horizon, pool);
@@ -103,46 +122,59 @@ void RobustPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 
   // For each candidate, roll out several trajectories with force perturbations
   // TODO(nimrod): Add domain randomization to the model for these rollouts
-  ResizeMjData(model_, pool.NumThreads());
-
-  int repetitions = nrepetitions_;
-  ResizeTrajectories(ncandidates * repetitions);
-
-  int count_before = pool.GetCount();
-  for (int i = 0; i < ncandidates; i++) {
-    for (int j = 0; j < repetitions; j++) {
-      Trajectory* trajectory = &trajectories_[repetitions*i + j];
-      pool.Schedule([&, delegate = delegate_.get(), candidate = i,
-                     trajectory]() {
-        auto sample_policy_i = [delegate, candidate](double* action,
-                                                     const double* state,
-                                                     double time) {
-          delegate->ActionFromCandidatePolicy(action, candidate, state, time);
-        };
-        trajectory->NoisyRollout(
-            sample_policy_i, task_, model_, data_[ThreadPool::WorkerId()].get(),
-            state_.data(), time_, mocap_.data(), userdata_.data(),
-            /*xfrc_std=*/xfrc_std_, /*xfrc_rate=*/xfrc_rate_, horizon);
-      });
-    }
+  ResizeMjData(model_, pool.NumThreads(), &pool);
+
+  // with common random numbers, repetition j of every candidate sees the same
+  // perturbations, which are new in every iteration
+  iteration_++;
+
+  int best_candidate = racing_
+                           ? RaceCandidates(ncandidates, horizon, pool)
+                           : EvaluateCandidates(ncandidates, horizon, pool);
+  delegate_->CopyCandidateToPolicy(best_candidate);
+}
+
+void RobustPlanner::PerturbedRollout(Trajectory& trajectory, int candidate,
+                                     int repetition, int horizon) {
+  if (common_noise_) {
+    trajectory.noise_stream.Seed(noise_seed_, repetition);
+    trajectory.noise_stream.SetCounter(iteration_ << 32);
   }
-  pool.WaitCount(count_before + ncandidates * repetitions);
-  pool.ResetCount();
+  auto sample_policy_i = [delegate = delegate_.get(), candidate](
+                             double* action, const double* state,
+                             double time) {
+    delegate->ActionFromCandidatePolicy(action, candidate, state, time);
+  };
+  trajectory.NoisyRollout(
+      sample_policy_i, task_, model_, data_[ThreadPool::WorkerId()],
+      state_.data(), time_, mocap_.data(), userdata_.data(),
+      /*xfrc_std=*/xfrc_std_, /*xfrc_rate=*/xfrc_rate_, horizon);
+  counters_.AddRollout(trajectory);
+}
+
+int RobustPlanner::EvaluateCandidates(int ncandidates, int horizon,
+                                      ThreadPool& pool) {
+  // the delegate's rollout of each candidate is its first repetition
+  int noisy = std::max(nrepetitions_, 1) - 1;
+  ResizeTrajectories(ncandidates * noisy, horizon);
+
+  pool.ParallelFor(0, ncandidates * noisy, 1, [&](int k) {
+    PerturbedRollout(trajectories_[k], k / noisy, k % noisy, horizon);
+  });
 
-  // for each candidate find the worst performing rollout. pick the
-  // candidate with the best worst performing rollout.
+  // for each candidate find the mean return over the delegate's rollout and
+  // the perturbed rollouts. pick the candidate with the best mean.
   int best_candidate = -1;
   double best_score = 0;
   for (int candidate = 0; candidate < ncandidates; candidate++) {
     double mean_return = delegate_->CandidateScore(candidate);
-    int valid_rollouts = 0;
-    for (int j = 0; j < repetitions; j++) {
+    int valid_rollouts = 1;
+    for (int j = 0; j < noisy; j++) {
       // if a rollout fails, don't affect the candidate's score
-      if (trajectories_[repetitions * candidate + j].failure) {
+      if (trajectories_[noisy * candidate + j].failure) {
         continue;
       }
-      double total_return =
-          trajectories_[repetitions * candidate + j].total_return;
+      double total_return = trajectories_[noisy * candidate + j].total_return;
       mean_return =
           (valid_rollouts * mean_return + total_return) / (valid_rollouts + 1);
       valid_rollouts++;
@@ -152,8 +184,92 @@ void RobustPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
       best_score = mean_return;
     }
   }
+  return best_candidate;
+}
 
-  delegate_->CopyCandidateToPolicy(best_candidate);
+int RobustPlanner::RaceCandidates(int ncandidates, int horizon,
+                                  ThreadPool& pool) {
+  MJPC_TRACE_SCOPE("RobustPlanner::RaceCandidates");
+  // the same budget of perturbed rollouts as the evaluation of every
+  // candidate, spent in rounds on the candidates still in the race
+  int budget = ncandidates * (std::max(nrepetitions_, 1) - 1);
+  ResizeTrajectories(budget, horizon);
+
+  // the delegate's rollout of each candidate is its first return
+  race_.resize(ncandidates);
+  race_alive_.clear();
+  for (int candidate = 0; candidate < ncandidates; candidate++) {
+    double score = delegate_->CandidateScore(candidate);
+    race_[candidate] = {score, score * score, 1, 0};
+    race_alive_.push_back(candidate);
+  }
+
+  double z = racing_confidence_;
+  auto bound = [&race = race_, z](int candidate, double sign) {
+    const RaceEntry& entry = race[candidate];
+    double mean = entry.sum / entry.count;
+    // no interval from a single return
+    if (entry.count < 2) {
+      return sign * std::numeric_limits<double>::infinity();
+    }
+    double variance =
+        std::max(entry.sum_squared - entry.sum * mean, 0.0) / (entry.count - 1);
+    return mean + sign * z * std::sqrt(variance / entry.count);
+  };
+
+  int used = 0;
+  while (race_alive_.size() > 1) {
+    int alive = race_alive_.size();
+    int round = std::min(racing_round_, (budget - used) / alive);
+    if (round <= 0) break;
+
+    race_jobs_.clear();
+    for (int candidate : race_alive_) {
+      for (int i = 0; i < round; i++) {
+        race_jobs_.emplace_back(candidate, race_[candidate].repetitions++);
+      }
+    }
+    int first = used;
+    int jobs = race_jobs_.size();
+    pool.ParallelFor(0, jobs, 1, [&](int k) {
+      auto [candidate, repetition] = race_jobs_[k];
+      PerturbedRollout(trajectories_[first + k], candidate, repetition,
+                       horizon);
+    });
+    used += jobs;
+
+    for (int k = 0; k < jobs; k++) {
+      const Trajectory& trajectory = trajectories_[first + k];
+      // if a rollout fails, don't affect the candidate's score
+      if (trajectory.failure) continue;
+      RaceEntry& entry = race_[race_jobs_[k].first];
+      entry.sum += trajectory.total_return;
+      entry.sum_squared += trajectory.total_return * trajectory.total_return;
+      entry.count++;
+    }
+
+    // eliminate the candidates whose lower bound is above the best upper
+    // bound, their remaining repetitions go to the others
+    double best_upper = std::numeric_limits<double>::infinity();
+    for (int candidate : race_alive_) {
+      best_upper = std::min(best_upper, bound(candidate, 1.0));
+    }
+    std::erase_if(race_alive_, [&](int candidate) {
+      return bound(candidate, -1.0) > best_upper;
+    });
+  }
+
+  // the best mean of the remaining candidates
+  int best_candidate = -1;
+  double best_score = 0;
+  for (int candidate : race_alive_) {
+    double mean_return = race_[candidate].sum / race_[candidate].count;
+    if (best_candidate == -1 || mean_return < best_score) {
+      best_candidate = candidate;
+      best_score = mean_return;
+    }
+  }
+  return best_candidate;
 }
 
 void RobustPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
@@ -174,6 +290,8 @@ void RobustPlanner::GUI(mjUI& ui) {
       {mjITEM_SLIDERINT, "R Rollouts", 2, &nrepetitions_, "1 10"},
       {mjITEM_SLIDERNUM, "R XFRC Std", 2, &xfrc_std_, "0 1"},
       {mjITEM_SLIDERNUM, "R XFRC Rate", 2, &xfrc_rate_, "0 1"},
+      {mjITEM_CHECKINT, "R Common Noise", 2, &common_noise_, ""},
+      {mjITEM_CHECKINT, "R Racing", 2, &racing_, ""},
       {mjITEM_END}};
 
   // set number of candidates slider limits
@@ -182,6 +300,15 @@ void RobustPlanner::GUI(mjUI& ui) {
   // add robust planner
   mjui_add(&ui, defRobust);
 }
+
+void RobustPlanner::ReportMemory(MemoryReport& report) const {
+  delegate_->ReportMemory(report);
+  std::size_t trajectories = VectorBytes(trajectories_);
+  for (const Trajectory& t : trajectories_) trajectories += t.Bytes();
+  report.Add("robust_trajectories", trajectories);
+  report.Add("robust_scratch", VectorBytes(state_, mocap_, userdata_, race_,
+                                           race_alive_, race_jobs_));
+}
 void RobustPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                           int planner_shift, int timer_shift, int planning,
                           int* shift) {
@@ -189,7 +316,7 @@ void RobustPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                    shift);
 }
 
-void RobustPlanner::ResizeTrajectories(int ntrajectories) {
+void RobustPlanner::ResizeTrajectories(int ntrajectories, int horizon) {
   int size_before = trajectories_.size();
   if (size_before < ntrajectories) {
     trajectories_.resize(ntrajectories);
@@ -197,8 +324,15 @@ void RobustPlanner::ResizeTrajectories(int ntrajectories) {
     for (int i = size_before; i < ntrajectories; i++) {
       Trajectory& trajectory = trajectories_[i];
       trajectory.Initialize(num_state, model_->nu, task_->num_residual,
-                              task_->num_trace, kMaxTrajectoryHorizon);
-      trajectory.Allocate(kMaxTrajectoryHorizon);
+                              task_->num_trace, allocated_horizon_);
+      trajectory.Allocate(allocated_horizon_);
+      trajectory.noise_stream.Seed(noise_seed_, i);
+    }
+  }
+  if (allocated_horizon_ < horizon) {
+    allocated_horizon_ = horizon;
+    for (auto& trajectory : trajectories_) {
+      trajectory.Allocate(allocated_horizon_);
     }
   }
 }
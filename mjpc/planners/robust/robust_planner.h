@@ -21,6 +21,8 @@
 #ifndef MJPC_MJPC_PLANNERS_ROBUST_ROBUST_PLANNER_H_
 #define MJPC_MJPC_PLANNERS_ROBUST_ROBUST_PLANNER_H_
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -55,9 +57,71 @@ class RobustPlanner : public Planner {
   void Plots(mjvFigure* fig_planner, mjvFigure* fig_timer, int planner_shift,
              int timer_shift, int planning, int* shift) override;
   int NumParameters() override { return delegate_->NumParameters(); };
+  std::vector<PhaseTime> PhaseTimes() const override {
+    return delegate_->PhaseTimes();
+  }
+  int NumRollouts() const override {
+    return delegate_->NumRollouts() + ncandidates_ * nrepetitions_;
+  }
+  void SetNumRollouts(int num_rollouts) override {
+    delegate_->SetNumRollouts(num_rollouts - ncandidates_ * nrepetitions_);
+  }
+  void Snapshot(SnapshotWriter& writer) const override {
+    delegate_->Snapshot(writer);
+  }
+  bool Restore(const SnapshotReader& reader) override {
+    return delegate_->Restore(reader);
+  }
+  bool ExportPolicy(ExportedPolicy& policy) const override {
+    return delegate_->ExportPolicy(policy);
+  }
+  void ReportMemory(MemoryReport& report) const override;
+  PlannerCounters Counters() const override {
+    PlannerCounters counters = delegate_->Counters();
+    counters += counters_.Read();
+    return counters;
+  }
+  void SetDeadline(std::chrono::steady_clock::time_point deadline) override {
+    deadline_ = deadline;
+    delegate_->SetDeadline(deadline);
+  }
+
+  // the perturbed rollouts run after the delegate, on its lane
+  void SetDataPool(std::shared_ptr<MjDataPool> pool, int lane) override {
+    delegate_->SetDataPool(pool, lane);
+    Planner::SetDataPool(std::move(pool), lane);
+  }
+  int NumDataLanes() const override { return delegate_->NumDataLanes(); }
+  void SetAllocationPool(ThreadPool* pool) override {
+    delegate_->SetAllocationPool(pool);
+    Planner::SetAllocationPool(pool);
+  }
+
+  // the delegate's samples use the backend; the perturbed repetitions roll
+  // out delegate policies with force noise on the pool
+  void SetRolloutBackend(std::shared_ptr<RolloutBackend> backend) override {
+    delegate_->SetRolloutBackend(backend);
+    Planner::SetRolloutBackend(std::move(backend));
+  }
+
+  // race the candidates: evaluate them in rounds and stop evaluating those
+  // whose confidence interval of the mean return is above that of the best
+  void SetRacing(bool racing) { racing_ = racing; }
+  bool Racing() const { return racing_; }
 
  private:
-  void ResizeTrajectories(int ntrajectories);
+  // grow trajectories to ntrajectories rollouts of horizon steps
+  void ResizeTrajectories(int ntrajectories, int horizon);
+
+  // roll out repetition of candidate with force perturbations
+  void PerturbedRollout(Trajectory& trajectory, int candidate, int repetition,
+                        int horizon);
+
+  // the candidate with the best mean return over all repetitions
+  int EvaluateCandidates(int ncandidates, int horizon, ThreadPool& pool);
+
+  // the best candidate of a race with the repetitions' budget
+  int RaceCandidates(int ncandidates, int horizon, ThreadPool& pool);
 
   const mjModel* model_;
   const Task* task_;
@@ -70,8 +134,29 @@ class RobustPlanner : public Planner {
   // standard deviation of gaussian noise force perturbations
   double xfrc_std_ = 0.1;
   double xfrc_rate_ = 0.1;
+  int noise_seed_ = 0;
+  // same perturbations for every candidate (common random numbers)
+  int common_noise_ = 1;
+  // racing: repetitions of each candidate per round and the confidence
+  // interval's half-width, in standard errors
+  int racing_ = 0;
+  int racing_round_ = 2;
+  double racing_confidence_ = 2.0;
+
+  // running sums of a candidate's valid returns in a race
+  struct RaceEntry {
+    double sum;
+    double sum_squared;
+    int count;
+    int repetitions;  // perturbed rollouts started
+  };
+  std::vector<RaceEntry> race_;
+  std::vector<int> race_alive_;
+  std::vector<std::pair<int, int>> race_jobs_;  // (candidate, repetition)
+  std::uint64_t iteration_ = 0;
 
   std::vector<Trajectory> trajectories_;
+  int allocated_horizon_ = 0;
 
   // state
   std::vector<double> state_;
@@ -0,0 +1,47 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/rollout_backend.h"
+
+#include <absl/functional/function_ref.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/planners/planner.h"
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
+
+namespace mjpc {
+
+void PoolRolloutBackend::Rollouts(const RolloutBatch& batch,
+                                  absl::FunctionRef<bool(int)> prepare,
+                                  ThreadPool& pool) {
+  if (!batch.data) mju_error("PoolRolloutBackend: per-worker mjData required");
+  pool.ParallelFor(0, batch.num_rollouts, 1, [&](int i) {
+    if (!prepare(i)) return;
+    Trajectory* trajectory = batch.trajectories[i];
+    trajectory->Rollout(*batch.policies[i], batch.task, batch.model,
+                        batch.data[ThreadPool::WorkerId()], batch.state,
+                        batch.time, batch.mocap, batch.userdata, batch.steps,
+                        batch.bound);
+    if (batch.counters) batch.counters->AddRollout(*trajectory);
+  });
+}
+
+RolloutBackend& DefaultRolloutBackend() {
+  static PoolRolloutBackend* backend = new PoolRolloutBackend;
+  return *backend;
+}
+
+}  // namespace mjpc
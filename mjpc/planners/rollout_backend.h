@@ -0,0 +1,94 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Batched rollouts of spline policies for sample-based planners. The default
+// backend simulates each rollout with mj_step on the thread pool; other
+// simulators, e.g., on an accelerator, implement RolloutBackend and are set
+// on the planner with Planner::SetRolloutBackend.
+
+#ifndef MJPC_PLANNERS_ROLLOUT_BACKEND_H_
+#define MJPC_PLANNERS_ROLLOUT_BACKEND_H_
+
+#include <absl/functional/function_ref.h>
+#include <mujoco/mujoco.h>
+
+#include "mjpc/task.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
+
+namespace mjpc {
+
+class CounterAccumulator;
+class SamplingPolicy;
+
+// rollouts of num_rollouts policies from one start
+struct RolloutBatch {
+  const Task* task = nullptr;
+  const mjModel* model = nullptr;
+
+  // start of the rollouts
+  const double* state = nullptr;
+  const double* mocap = nullptr;
+  const double* userdata = nullptr;
+  double time = 0.0;
+
+  // rollout steps, with the schedule of each trajectory
+  int steps = 0;
+
+  // policies[i] is rolled out into trajectories[i]
+  int num_rollouts = 0;
+  const SamplingPolicy* const* policies = nullptr;
+  Trajectory* const* trajectories = nullptr;
+
+  // optional: stop rollouts that cannot beat the bound
+  ReturnBound* bound = nullptr;
+
+  // optional: completed rollouts are added to counters
+  CounterAccumulator* counters = nullptr;
+
+  // one mjData per pool worker, for backends that simulate on the pool
+  mjData* const* data = nullptr;
+};
+
+class RolloutBackend {
+ public:
+  virtual ~RolloutBackend() = default;
+
+  // roll out the batch. prepare(i) sets policies[i] before its rollout and
+  // returns false to skip it; it is called once per rollout, on any thread
+  // of pool, so it can sample the policy's noise in parallel.
+  virtual void Rollouts(const RolloutBatch& batch,
+                        absl::FunctionRef<bool(int)> prepare,
+                        ThreadPool& pool) = 0;
+
+  // true if rollouts record the full trajectory (states, actions, costs,
+  // traces). otherwise only total_return, failure and pruned are set, and
+  // planners that need trajectories, e.g., for their traces, show none.
+  virtual bool RecordsTrajectories() const { return true; }
+};
+
+// rollouts with mj_step, one per task of pool on the worker's mjData
+class PoolRolloutBackend : public RolloutBackend {
+ public:
+  void Rollouts(const RolloutBatch& batch,
+                absl::FunctionRef<bool(int)> prepare,
+                ThreadPool& pool) override;
+};
+
+// the shared pool backend
+RolloutBackend& DefaultRolloutBackend();
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLANNERS_ROLLOUT_BACKEND_H_
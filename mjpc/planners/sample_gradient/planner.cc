@@ -14,18 +14,21 @@
 
 #include "mjpc/planners/sample_gradient/planner.h"
 
-#include <absl/random/random.h>
 #include <mujoco/mujoco.h>
 
 #include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <mutex>
 #include <shared_mutex>
 
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/policy.h"
+#include "mjpc/planners/rollout_backend.h"
 #include "mjpc/states/state.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -53,6 +56,9 @@ void SampleGradientPlanner::Initialize(mjModel* model, const Task& task) {
   // exploration noise
   noise_exploration = GetNumberOrDefault(0.1, model, "sampling_exploration");
 
+  // noise seed
+  noise_seed = GetNumberOrDefault(0, model, "sampling_seed");
+
   // set number of trajectories to rollout
   num_trajectory_ = GetNumberOrDefault(10, model, "sampling_trajectories");
 
@@ -62,10 +68,20 @@ void SampleGradientPlanner::Initialize(mjModel* model, const Task& task) {
   // gradient filter
   gradient_filter_ = GetNumberOrDefault(1.0, model, "sample_gradient_filter");
 
+  // zeroth-order gradient from the noisy samples
+  zeroth_order_ =
+      GetNumberOrDefault(0, model, "sample_gradient_zeroth_order");
+  zeroth_order_step_ =
+      GetNumberOrDefault(0.1, model, "sample_gradient_zeroth_order_step");
+
   if (num_trajectory_ > kMaxTrajectory) {
     mju_error_i("Too many trajectories, %d is the maximum allowed.",
                 kMaxTrajectory);
   }
+
+  // trajectories are allocated on demand
+  num_allocated_trajectory_ = 0;
+  allocated_horizon_ = 0;
 }
 
 // allocate memory
@@ -83,36 +99,39 @@ void SampleGradientPlanner::Allocate() {
   policy.Allocate(model, *task, kMaxTrajectoryHorizon);
   resampled_policy.Allocate(model, *task, kMaxTrajectoryHorizon);
   previous_policy.Allocate(model, *task, kMaxTrajectoryHorizon);
+  search_policy_.Allocate(model, *task, kMaxTrajectoryHorizon);
 
   // scratch
   parameters_scratch.resize(num_max_parameter);
   times_scratch.resize(kMaxTrajectoryHorizon);
 
-  // noise
-  noise.resize(kMaxTrajectory * (model->nu * kMaxTrajectoryHorizon));
-
   // need to initialize an arbitrary order of the trajectories
   trajectory_order.resize(kMaxTrajectory);
+  trajectory_return.resize(kMaxTrajectory);
   for (int i = 0; i < kMaxTrajectory; i++) {
     trajectory_order[i] = i;
   }
 
-  // trajectories and parameters are resized and initialized in OptimizePolicy
+  // trajectories, parameters, and noise are grown in OptimizePolicy
   // need to allocate at least one for NominalTrajectory
   trajectory.resize(kMaxTrajectory);
   candidate_policy.resize(kMaxTrajectory);
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Initialize(state.size(), model->nu, task->num_residual,
-                             task->num_trace, kMaxTrajectoryHorizon);
-    trajectory[i].Allocate(kMaxTrajectoryHorizon);
-    candidate_policy[i].Allocate(model, *task, kMaxTrajectoryHorizon);
-  }
+  ResizeTrajectories(1, 1);
 
   // gradient
   gradient.resize(num_max_parameter);
   gradient_previous.resize(num_max_parameter);
 }
 
+// grow trajectories, candidate policies, and noise to cover num_trajectory
+// rollouts of horizon steps. storage is never shrunk.
+void SampleGradientPlanner::ResizeTrajectories(int num_trajectory, int horizon) {
+  GrowSampledTrajectories(model, *task, num_trajectory, horizon,
+                          trajectory.data(), candidate_policy.data(), &noise,
+                          &num_allocated_trajectory_, &allocated_horizon_,
+                          trajectory_mtx_);
+}
+
 // reset memory to zeros
 void SampleGradientPlanner::Reset(int horizon,
                                   const double* initial_repeated_action) {
@@ -126,6 +145,9 @@ void SampleGradientPlanner::Reset(int horizon,
   policy.Reset(horizon, initial_repeated_action);
   resampled_policy.Reset(horizon, initial_repeated_action);
   previous_policy.Reset(horizon, initial_repeated_action);
+  search_policy_.Reset(horizon, initial_repeated_action);
+  search_policy_valid_ = false;
+  published_policy_.Publish(policy, previous_policy);
 
   // scratch
   std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
@@ -133,16 +155,14 @@ void SampleGradientPlanner::Reset(int horizon,
 
   // noise
   std::fill(noise.begin(), noise.end(), 0.0);
-
-  // trajectory samples
   for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Reset(kMaxTrajectoryHorizon);
-    candidate_policy[i].Reset(horizon);
+    noise_stream[i].Seed(noise_seed, i);
   }
 
-  // ctrl
-  for (const auto& d : data_) {
-    mju_zero(d->ctrl, model->nu);
+  // trajectory samples, allocated only
+  for (int i = 0; i < num_allocated_trajectory_; i++) {
+    trajectory[i].Reset(allocated_horizon_);
+    candidate_policy[i].Reset(horizon);
   }
 
   // improvement
@@ -162,22 +182,43 @@ void SampleGradientPlanner::SetState(const State& state) {
                &this->time);
 }
 
+void SampleGradientPlanner::Snapshot(SnapshotWriter& writer) const {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.Snapshot(writer, "sample_gradient.policy");
+}
+
+bool SampleGradientPlanner::Restore(const SnapshotReader& reader) {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    if (!policy.Restore(reader, "sample_gradient.policy")) return false;
+    previous_policy = policy;
+  }
+  published_policy_.Publish(policy, previous_policy);
+  return true;
+}
+
 // optimize nominal policy using random sampling and gradient search
 void SampleGradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
+  counters_.Reset();
+
   // if num_trajectory_ has changed, use it in this new iteration.
   // num_trajectory_ might change while this function runs. Keep it constant
   // for the duration of this function.
   int num_trajectory = num_trajectory_;
 
-  // clamp num_gradient
+  // clamp num_gradient, the zeroth-order mode has no gradient candidates
   num_gradient_ = std::min(num_gradient_, num_trajectory - 1);
-  int num_gradient = num_gradient_;
+  bool zeroth_order = zeroth_order_;
+  int num_gradient = zeroth_order ? 0 : num_gradient_;
+  num_gradient_rollouts_ = num_gradient;
+  bool search = zeroth_order && search_policy_valid_;
 
   // number of noisy policies
   int num_noisy = num_trajectory - num_gradient;
 
   // resize number of mjData
-  ResizeMjData(model, pool.NumThreads());
+  ResizeMjData(model, pool.NumThreads(), &pool);
+  ResizeTrajectories(num_trajectory, horizon);
 
   // copy nominal policy
   int num_spline_points = policy.num_spline_points;
@@ -199,33 +240,30 @@ void SampleGradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
     this->ResamplePolicy(candidate_policy[num_noisy + i], horizon,
                          num_spline_points, representation);
   }
+  if (search) {
+    this->ResamplePolicy(search_policy_, horizon, num_spline_points,
+                         representation);
+  }
 
   // ----- roll out noisy policies ----- //
   // start timer
-  auto perturb_rollouts_start = std::chrono::steady_clock::now();
+  TraceSpan perturb_rollouts_span("SampleGradientPlanner::perturb_rollouts");
 
-  // roll out perturbed policies: p + s * N(0, 1)
+  // roll out perturbed policies: p + s * N(0, 1), centered on the search
+  // policy in the zeroth-order mode
+  search_policy_valid_ = search;
   this->Rollouts(num_trajectory, num_gradient, horizon, pool);
 
   // stop timer
-  rollouts_compute_time = GetDuration(perturb_rollouts_start);
+  rollouts_compute_time = perturb_rollouts_span.End();
 
   // ----- update policy ----- //
   // start timer
-  auto policy_update_start = std::chrono::steady_clock::now();
-
-  // initial order for partial sort
-  for (int i = 0; i < num_trajectory; i++) {
-    trajectory_order[i] = i;
-  }
+  TraceSpan policy_update_span("SampleGradientPlanner::policy_update");
 
   // sort lowest to highest total return
-  std::partial_sort(
-      trajectory_order.begin(), trajectory_order.begin() + num_trajectory,
-      trajectory_order.begin() + num_trajectory,
-      [&trajectory = trajectory](int a, int b) {
-        return trajectory[a].total_return < trajectory[b].total_return;
-      });
+  RankTrajectories(trajectory_order.data(), trajectory_return.data(),
+                   trajectory.data(), num_trajectory, num_trajectory);
 
   // set winner
   if (trajectory[trajectory_order[0]].total_return <
@@ -252,6 +290,7 @@ void SampleGradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
     policy.CopyParametersFrom(candidate_policy[winner].parameters,
                               times_scratch);
   }
+  published_policy_.Publish(policy, previous_policy);
 
   // improvement: compare nominal to winner
   improvement = mju_max(
@@ -259,45 +298,72 @@ void SampleGradientPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
       0.0);
 
   // stop timer
-  policy_update_compute_time = GetDuration(policy_update_start);
+  policy_update_compute_time = policy_update_span.End();
 
   // ----- compute gradient candidate policies ----- //
   // start timer
-  auto gradient_start = std::chrono::steady_clock::now();
+  TraceSpan gradient_span("SampleGradientPlanner::gradient");
 
-  // candidate policies
-  this->GradientCandidates(num_trajectory, num_gradient, horizon, pool);
+  // candidate policies, or the zeroth-order step of the sample center
+  if (zeroth_order) {
+    this->ZerothOrderStep(num_trajectory);
+  } else {
+    search_policy_valid_ = false;
+    this->GradientCandidates(num_trajectory, num_gradient, horizon, pool);
+  }
 
   // stop timer
-  gradient_candidates_compute_time = GetDuration(gradient_start);
+  gradient_candidates_compute_time = gradient_span.End();
 }
 
 // compute trajectory using nominal policy
 void SampleGradientPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
-  // set policy
-  auto nominal_policy = [&cp = resampled_policy](
-                            double* action, const double* state, double time) {
-    cp.Action(action, state, time);
-  };
+  ResizeTrajectories(1, horizon);
 
   // rollout nominal policy
-  trajectory[idx_nominal].Rollout(nominal_policy, task, model, data_[0].get(),
-                                  state.data(), time, mocap.data(),
-                                  userdata.data(), horizon);
+  trajectory[idx_nominal].Rollout(resampled_policy, task, model,
+                                  data_[0], state.data(), time,
+                                  mocap.data(), userdata.data(), horizon);
 }
 
 // set action from policy
 void SampleGradientPlanner::ActionFromPolicy(double* action,
                                              const double* state, double time,
                                              bool use_previous) {
-  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  auto published = published_policy_.Latest();
+  if (!published) return;
   if (use_previous) {
-    previous_policy.Action(action, state, time);
+    published->previous_policy.Action(action, state, time);
   } else {
-    policy.Action(action, state, time);
+    published->policy.Action(action, state, time);
   }
 }
 
+bool SampleGradientPlanner::ExportPolicy(ExportedPolicy& policy) const {
+  auto published = published_policy_.Latest();
+  if (!published) return false;
+  published->policy.Export(policy);
+  policy.version = published->version;
+  return true;
+}
+
+void SampleGradientPlanner::ReportMemory(MemoryReport& report) const {
+  std::size_t trajectories = VectorBytes(trajectory);
+  std::size_t policies = policy.Bytes() + resampled_policy.Bytes() +
+                         previous_policy.Bytes() + search_policy_.Bytes() +
+                         VectorBytes(parameters_scratch, times_scratch,
+                                     candidate_policy);
+  for (const Trajectory& t : trajectory) trajectories += t.Bytes();
+  for (const SamplingPolicy& p : candidate_policy) policies += p.Bytes();
+  report.Add("trajectories", trajectories);
+  report.Add("policies", policies);
+  report.Add("noise", noise);
+  report.Add("gradient", VectorBytes(gradient, gradient_previous, step_size_,
+                                     return_weight_));
+  report.Add("scratch", VectorBytes(state, mocap, userdata, trajectory_order,
+                                    trajectory_return));
+}
+
 // update policy via resampling
 void SampleGradientPlanner::ResamplePolicy(
     SamplingPolicy& policy, int horizon, int num_spline_points,
@@ -313,10 +379,10 @@ void SampleGradientPlanner::ResamplePolicy(
   // get spline points
   for (int t = 0; t < num_spline_points; t++) {
     times_scratch[t] = nominal_time;
-    policy.Action(DataAt(parameters_scratch, t * model->nu), nullptr,
-                  nominal_time);
     nominal_time += time_shift;
   }
+  policy.Actions(parameters_scratch.data(), times_scratch.data(),
+                  num_spline_points);
 
   // copy resampled policy parameters
   mju_copy(policy.parameters.data(), parameters_scratch.data(),
@@ -339,22 +405,17 @@ void SampleGradientPlanner::ResamplePolicy(
 // add random noise to nominal policy
 void SampleGradientPlanner::AddNoiseToPolicy(int i) {
   // start timer
-  auto noise_start = std::chrono::steady_clock::now();
+  TraceSpan noise_span("SampleGradientPlanner::noise");
 
   // dimensions
   int num_spline_points = candidate_policy[i].num_spline_points;
   int num_parameters = candidate_policy[i].num_parameters;
 
-  // sampling token
-  absl::BitGen gen_;
-
   // shift index
   int shift = i * (model->nu * kMaxTrajectoryHorizon);
 
   // sample noise
-  for (int k = 0; k < num_parameters; k++) {
-    noise[k + shift] = absl::Gaussian<double>(gen_, 0.0, 1.0);
-  }
+  noise_stream[i].Gaussian(DataAt(noise, shift), num_parameters);
 
   // add noise
   mju_addToScl(candidate_policy[i].parameters.data(), DataAt(noise, shift),
@@ -367,7 +428,7 @@ void SampleGradientPlanner::AddNoiseToPolicy(int i) {
   }
 
   // end timer
-  IncrementAtomic(noise_compute_time, GetDuration(noise_start));
+  IncrementAtomic(noise_compute_time, noise_span.End());
 }
 
 // rollout candidate policies
@@ -376,62 +437,53 @@ void SampleGradientPlanner::Rollouts(int num_trajectory, int num_gradient,
   // reset perturbation compute time
   noise_compute_time = 0.0;
 
+  // nominal and noisy policies, gradient candidates are set. noisy policies
+  // are centered on the search policy if it is valid.
+  auto sample_policy = [&, &s = *this](int i) {
+    if (i < num_trajectory - num_gradient) {
+      // copy nominal policy
+      const SamplingPolicy& center =
+          i > idx_nominal && s.search_policy_valid_ ? s.search_policy_
+                                                    : s.resampled_policy;
+      s.candidate_policy[i].CopyFrom(center, center.num_spline_points);
+      s.candidate_policy[i].representation =
+          s.resampled_policy.representation;
+
+      // noisy nominal policy
+      if (i > idx_nominal) s.AddNoiseToPolicy(i);
+    }
+    return true;
+  };
+
   // search
-  int count_before = pool.GetCount();
+  Trajectory* trajectories[kMaxTrajectory];
+  const SamplingPolicy* policies[kMaxTrajectory];
   for (int i = 0; i < num_trajectory; i++) {
-    pool.Schedule([&s = *this, &model = this->model, &task = this->task,
-                   &state = this->state, &time = this->time,
-                   &mocap = this->mocap, &userdata = this->userdata, horizon,
-                   idx_nominal = this->idx_nominal, num_trajectory,
-                   num_gradient, i]() {
-      // nominal and noisy policies
-      if (i < num_trajectory - num_gradient) {
-        // copy nominal policy
-        s.candidate_policy[i].CopyFrom(s.resampled_policy,
-                                       s.resampled_policy.num_spline_points);
-        s.candidate_policy[i].representation =
-            s.resampled_policy.representation;
-
-        // noisy nominal policy
-        if (i > idx_nominal) s.AddNoiseToPolicy(i);
-      }
-
-      // ----- rollout sample policy ----- //
-
-      // policy
-      auto sample_policy_i = [&candidate_policy = s.candidate_policy, &i](
-                                 double* action, const double* state,
-                                 double time) {
-        candidate_policy[i].Action(action, state, time);
-      };
-
-      // policy rollout
-      s.trajectory[i].Rollout(
-          sample_policy_i, task, model, s.data_[ThreadPool::WorkerId()].get(),
-          state.data(), time, mocap.data(), userdata.data(), horizon);
-    });
+    trajectories[i] = &trajectory[i];
+    policies[i] = &candidate_policy[i];
   }
-  pool.WaitCount(count_before + num_trajectory);
-  pool.ResetCount();
+  RolloutBatch batch;
+  batch.task = task;
+  batch.model = model;
+  batch.state = state.data();
+  batch.mocap = mocap.data();
+  batch.userdata = userdata.data();
+  batch.time = time;
+  batch.steps = horizon;
+  batch.num_rollouts = num_trajectory;
+  batch.policies = policies;
+  batch.trajectories = trajectories;
+  batch.counters = &counters_;
+  batch.data = data_.data();
+  Backend().Rollouts(batch, sample_policy, pool);
 }
 
-// compute candidate trajectories
-void SampleGradientPlanner::GradientCandidates(int num_trajectory,
-                                               int num_gradient, int horizon,
-                                               ThreadPool& pool) {
-  if (num_gradient < 1) return;
-
-  // number of parameters
-  int num_parameters = resampled_policy.num_parameters;
-  int num_spline_points = resampled_policy.num_spline_points;
-
+// approximate gradient from the first num_noisy samples
+void SampleGradientPlanner::EstimateGradient(int num_noisy,
+                                             int num_parameters) {
   // cache old gradient
   mju_copy(gradient_previous.data(), gradient.data(), num_parameters);
 
-  // -- compute approximate gradient -- //
-  // average return
-  int num_noisy = num_trajectory - num_gradient;
-
   // fitness shaping
   // https://www.jmlr.org/papers/volume15/wierstra14a/wierstra14a.pdf
   if (return_weight_.size() != num_noisy) {
@@ -439,18 +491,8 @@ void SampleGradientPlanner::GradientCandidates(int num_trajectory,
     return_weight_.resize(num_noisy);
 
     // -- sort noisy samples only (exclude gradient samples) -- //
-    // initial order for partial sort
-    for (int i = 0; i < num_noisy; i++) {
-      trajectory_order[i] = i;
-    }
-
-    // sort lowest to highest total return
-    std::partial_sort(
-        trajectory_order.begin(), trajectory_order.begin() + num_noisy,
-        trajectory_order.begin() + num_noisy,
-        [&trajectory = trajectory](int a, int b) {
-          return trajectory[a].total_return < trajectory[b].total_return;
-        });
+    RankTrajectories(trajectory_order.data(), trajectory_return.data(),
+                     trajectory.data(), num_noisy, num_noisy);
 
     // compute normalization
     double f0 = std::log(0.5 * num_noisy + 1.0);
@@ -475,6 +517,21 @@ void SampleGradientPlanner::GradientCandidates(int num_trajectory,
     mju_addToScl(gradient.data(), noisei, return_weight_[i] / num_noisy,
                  num_parameters);
   }
+}
+
+// compute candidate trajectories
+void SampleGradientPlanner::GradientCandidates(int num_trajectory,
+                                               int num_gradient, int horizon,
+                                               ThreadPool& pool) {
+  if (num_gradient < 1) return;
+
+  // number of parameters
+  int num_parameters = resampled_policy.num_parameters;
+  int num_spline_points = resampled_policy.num_spline_points;
+
+  // -- compute approximate gradient -- //
+  int num_noisy = num_trajectory - num_gradient;
+  EstimateGradient(num_noisy, num_parameters);
 
   // compute step sizes for gradient direction
   if (step_size_.size() != num_gradient) {
@@ -513,6 +570,36 @@ void SampleGradientPlanner::GradientCandidates(int num_trajectory,
   }
 }
 
+// zeroth-order step of the noisy samples' center
+void SampleGradientPlanner::ZerothOrderStep(int num_trajectory) {
+  // number of parameters
+  int num_parameters = resampled_policy.num_parameters;
+  int num_spline_points = resampled_policy.num_spline_points;
+
+  // approximate gradient from all samples
+  EstimateGradient(num_trajectory, num_parameters);
+
+  // gradient filter gf * grad + (1 - gf) * grad_prev
+  double gradient_filter = gradient_filter_;
+  double scaling = zeroth_order_step_ / noise_exploration;
+
+  // center the next iteration's samples on the winner's gradient step, the
+  // nominal sample stays the winner so the published policy is evaluated
+  search_policy_.CopyFrom(candidate_policy[winner], num_spline_points);
+  search_policy_.representation = candidate_policy[winner].representation;
+  mju_addToScl(search_policy_.parameters.data(), gradient.data(),
+               -scaling * gradient_filter, num_parameters);
+  mju_addToScl(search_policy_.parameters.data(), gradient_previous.data(),
+               -scaling * (1.0 - gradient_filter), num_parameters);
+
+  // clamp parameters
+  for (int t = 0; t < num_spline_points; t++) {
+    Clamp(DataAt(search_policy_.parameters, t * model->nu),
+          model->actuator_ctrlrange, model->nu);
+  }
+  search_policy_valid_ = true;
+}
+
 // returns the nominal trajectory (this is the purple trace)
 const Trajectory* SampleGradientPlanner::BestTrajectory() {
   return &trajectory[winner];
@@ -537,44 +624,28 @@ void SampleGradientPlanner::Traces(mjvScene* scn) {
   // width of a sample trace, in pixels
   double width = GetNumberOrDefault(3, model, "agent_sample_width");
 
-  // scratch
-  double zero3[3] = {0};
-  double zero9[9] = {0};
-
   // best
   auto best = this->BestTrajectory();
 
   // check sizes
-  int num_trajectory = num_trajectory_;
-  int num_gradient = num_gradient_;
-  int num_noisy = num_trajectory - num_gradient;
-
-  // traces between Newton and Cauchy points
-  for (int k = 1; k < num_trajectory; k++) {
-    // plot sample
-    for (int i = 0; i < best->horizon - 1; i++) {
-      if (scn->ngeom + task->num_trace > scn->maxgeom) break;
-      for (int j = 0; j < task->num_trace; j++) {
-        // index
-        int idx = trajectory_order[k];
-
-        // initialize geometry
-        mjv_initGeom(&scn->geoms[scn->ngeom], mjGEOM_LINE, zero3, zero3, zero9,
-                     idx < num_noisy ? white : orange);
-
-        // make geometry
-        mjv_makeConnector(
-            &scn->geoms[scn->ngeom], mjGEOM_LINE, width,
-            trajectory[idx].trace[3 * task->num_trace * i + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * i + 1 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * i + 2 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 1 + 3 * j],
-            trajectory[idx].trace[3 * task->num_trace * (i + 1) + 2 + 3 * j]);
-
-        // increment number of geometries
-        scn->ngeom += 1;
-      }
+  const std::shared_lock<std::shared_mutex> lock(trajectory_mtx_);
+  int num_trajectory = std::min(num_trajectory_, num_allocated_trajectory_);
+  num_trajectory =
+      std::min(num_trajectory, static_cast<int>(trajectory_order.size()));
+  int num_gradient = num_gradient_rollouts_;
+  int num_noisy = num_trajectory_ - num_gradient;
+
+  // traces between Newton and Cauchy points, ordered by return
+  int num_samples = std::min(num_trajectory, trace_options_.max_samples + 1);
+  for (int k = 1; k < num_samples; k++) {
+    // skip samples that have not been allocated
+    int idx = trajectory_order[k];
+    if (idx >= num_allocated_trajectory_) continue;
+
+    if (!AddTraceLines(scn, trajectory[idx], task->num_trace, best->horizon,
+                       trace_options_.stride, width,
+                       idx < num_noisy ? white : orange)) {
+      break;
     }
   }
 }
@@ -589,6 +660,11 @@ void SampleGradientPlanner::GUI(mjUI& ui) {
       {mjITEM_SLIDERNUM, "Noise Std.", 2, &noise_exploration, "0 1"},
       {mjITEM_SLIDERINT, "Grad. Rollouts", 2, &num_gradient_, "0 1"},
       {mjITEM_SLIDERNUM, "Grad. Filter", 2, &gradient_filter_, "0 1"},
+      {mjITEM_CHECKINT, "Zeroth Order", 2, &zeroth_order_, ""},
+      {mjITEM_SLIDERNUM, "Zeroth Step", 2, &zeroth_order_step_, "0 1"},
+      {mjITEM_SLIDERINT, "Trace Stride", 2, &trace_options_.stride, "1 10"},
+      {mjITEM_SLIDERINT, "Trace Samples", 2, &trace_options_.max_samples,
+       "0 128"},
       {mjITEM_END}};
 
   // set number of trajectory slider limits
@@ -627,8 +703,8 @@ void SampleGradientPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   if (winner_type_ == kPerturb) {
     winner_plot_val = -6.0;
   } else if (winner_type_ == kGradient) {
-    int num_noisy = num_trajectory_ - num_gradient_;
-    winner_plot_val = 6.0 * (winner - num_noisy) / num_gradient_;
+    int num_noisy = num_trajectory_ - num_gradient_rollouts_;
+    winner_plot_val = 6.0 * (winner - num_noisy) / num_gradient_rollouts_;
   }
 
   mjpc::PlotUpdateData(fig_planner, planner_bounds,
@@ -680,4 +756,12 @@ void SampleGradientPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   shift[1] += 4;
 }
 
+// compute times of the last iteration's phases
+std::vector<PhaseTime> SampleGradientPlanner::PhaseTimes() const {
+  return {{"noise", noise_compute_time.load()},
+          {"rollouts", rollouts_compute_time},
+          {"gradient_candidates", gradient_candidates_compute_time},
+          {"policy_update", policy_update_compute_time}};
+}
+
 }  // namespace mjpc
@@ -17,13 +17,16 @@
 
 #include <mujoco/mujoco.h>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <shared_mutex>
 #include <vector>
 
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy_buffer.h"
 #include "mjpc/planners/sampling/planner.h"
+#include "mjpc/random.h"
 #include "mjpc/states/state.h"
 #include "mjpc/trajectory.h"
 
@@ -74,10 +77,22 @@ class SampleGradientPlanner : public Planner {
   void Rollouts(int num_trajectory, int num_gradient, int horizon,
                 ThreadPool& pool);
 
+  // grow trajectory storage for num_trajectory rollouts of horizon steps
+  void ResizeTrajectories(int num_trajectory, int horizon);
+
   // compute candidate trajectories along approximate gradient direction
   void GradientCandidates(int num_trajectory, int num_gradient, int horizon,
                           ThreadPool& pool);
 
+  // approximate gradient from the returns and noise of the first num_noisy
+  // samples, with fitness shaping
+  void EstimateGradient(int num_noisy, int num_parameters);
+
+  // zeroth-order mode: center the next iteration's noisy samples on the
+  // winner moved along the approximate gradient of this iteration's samples,
+  // instead of rolling out gradient candidates
+  void ZerothOrderStep(int num_trajectory);
+
   // return trajectory with best total return
   const Trajectory* BestTrajectory() override;
 
@@ -96,6 +111,25 @@ class SampleGradientPlanner : public Planner {
     return policy.num_spline_points * policy.model->nu;
   };
 
+  // compute times of the last iteration's phases
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // rollouts of an iteration
+  int NumRollouts() const override { return num_trajectory_; }
+  void SetNumRollouts(int num_rollouts) override {
+    num_trajectory_ = std::clamp(num_rollouts, 2, kMaxTrajectory);
+  }
+
+  // snapshot of the nominal policy
+  void Snapshot(SnapshotWriter& writer) const override;
+  bool Restore(const SnapshotReader& reader) override;
+
+  // export the published policy
+  bool ExportPolicy(ExportedPolicy& policy) const override;
+
+  // bytes of the trajectories, policies and sampling buffers
+  void ReportMemory(MemoryReport& report) const override;
+
   // ----- members ----- //
   mjModel* model;
   const Task* task;
@@ -121,6 +155,7 @@ class SampleGradientPlanner : public Planner {
 
   // order of indices of rolled out trajectories, ordered by total return
   std::vector<int> trajectory_order;
+  std::vector<double> trajectory_return;  // packed returns for ranking
 
   // rollout parameters
   double timestep_power;
@@ -129,6 +164,10 @@ class SampleGradientPlanner : public Planner {
   double noise_exploration;
   std::vector<double> noise;
 
+  // noise streams, one per candidate
+  RandomStream noise_stream[kMaxTrajectory];
+  int noise_seed;
+
   // improvement
   double improvement;
 
@@ -146,8 +185,17 @@ class SampleGradientPlanner : public Planner {
 
   int num_trajectory_;
   int num_gradient_;  // number of gradient candidates
+  int num_gradient_rollouts_ = 0;  // gradient candidates of the last iteration
   mutable std::shared_mutex mtx_;
 
+  // policies published to ActionFromPolicy
+  PolicyBuffer<SamplingPolicy> published_policy_;
+
+  // allocated trajectory storage (resized under trajectory_mtx_)
+  int num_allocated_trajectory_;
+  int allocated_horizon_;
+  mutable std::shared_mutex trajectory_mtx_;
+
   // approximate gradient
   std::vector<double> gradient;
   std::vector<double> gradient_previous;
@@ -158,6 +206,14 @@ class SampleGradientPlanner : public Planner {
   double gradient_max_step_size = 2.0;
   double gradient_min_step_size = 1.0e-3;
 
+  // zeroth-order mode, the gradient of the noisy samples moves their center
+  // by zeroth_order_step_ (in units of noise_exploration) and all rollouts
+  // are noisy samples
+  int zeroth_order_ = 0;
+  double zeroth_order_step_ = 0.1;
+  SamplingPolicy search_policy_;  // center of the noisy samples
+  bool search_policy_valid_ = false;
+
   // return weight
   std::vector<double> return_weight_;
 
@@ -15,17 +15,29 @@
 #include "mjpc/planners/sampling/planner.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <utility>
+#include <vector>
 
-#include <absl/random/random.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/array_safety.h"
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/rollout_backend.h"
 #include "mjpc/planners/sampling/policy.h"
+#include "mjpc/planners/sampling/remote.h"
+#include "mjpc/residual_dispatch.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
 
@@ -33,8 +45,21 @@ namespace mjpc {
 
 namespace mju = ::mujoco::util_mjpc;
 
+SamplingPlanner::~SamplingPlanner() { UnregisterModels(); }
+
+// unregister the residuals of the schedule's models
+void SamplingPlanner::UnregisterModels() {
+  UnregisterResidual(&coarse_model_);
+  for (mjModel& solver_model : solver_model_) {
+    UnregisterResidual(&solver_model);
+  }
+}
+
 // initialize data and settings
 void SamplingPlanner::Initialize(mjModel* model, const Task& task) {
+  // the schedule's models are registered again for the new model
+  UnregisterModels();
+
   // delete mjData instances since model might have changed.
   data_.clear();
   // allocate one mjData for nominal.
@@ -49,6 +74,64 @@ void SamplingPlanner::Initialize(mjModel* model, const Task& task) {
   // sampling noise
   noise_exploration = GetNumberOrDefault(0.1, model, "sampling_exploration");
 
+  // noise seed
+  noise_seed = GetNumberOrDefault(0, model, "sampling_seed");
+
+  // noise sampling mode and correlation across spline points
+  noise_sampling_ = std::clamp(
+      static_cast<int>(GetNumberOrDefault(0, model, "sampling_noise")),
+      static_cast<int>(kIndependentNoise), static_cast<int>(kSobolNoise));
+  noise_correlation_ = std::clamp(
+      GetNumberOrDefault(0.0, model, "sampling_noise_correlation"), 0.0, 1.0);
+  noise_iteration_ = 0;
+
+  // stop rollouts that cannot beat the best candidates
+  pruning_ = GetNumberOrDefault(0, model, "sampling_pruning");
+
+  // samples only compute their returns, the winner is re-simulated
+  lean_rollouts_ = GetNumberOrDefault(0, model, "sampling_lean_rollouts");
+
+  // solver warm starts of the samples from the previous nominal rollout
+  warmstart_ = std::clamp(
+      static_cast<int>(GetNumberOrDefault(0, model, "sampling_warmstart")),
+      static_cast<int>(kNoWarmStart), static_cast<int>(kEveryStepWarmStart));
+  nominal_warmstart_.clear();
+
+  // spline points shared by all samples, simulated once
+  shared_prefix_ = GetNumberOrDefault(0, model, "sampling_shared_prefix");
+  prefix_data_.reset();
+
+  // coarse time steps after the first sampling_fine_steps rollout steps
+  schedule.fine_steps = GetNumberOrDefault(0, model, "sampling_fine_steps");
+  schedule.coarse_factor = std::max(
+      GetNumberOrDefault(1, model, "sampling_coarse_factor"), 1);
+  schedule.coarse_model = &coarse_model_;
+
+  // reduced solver fidelity after the first sampling_full_solver_steps
+  // rollout steps, sampling_solver_levels levels of
+  // sampling_solver_level_steps steps
+  schedule.full_solver_steps =
+      std::max(GetNumberOrDefault(0, model, "sampling_full_solver_steps"), 0);
+  schedule.solver_level_steps = std::max(
+      GetNumberOrDefault(10, model, "sampling_solver_level_steps"), 1);
+  schedule.num_solver_levels =
+      std::clamp(GetNumberOrDefault(0, model, "sampling_solver_levels"), 0,
+                 kMaxSolverLevels);
+  solver_tolerance_factor_ = std::max(
+      GetNumberOrDefault(10.0, model, "sampling_solver_tolerance_factor"),
+      1.0);
+  schedule.solver_models = solver_models_;
+  solver_fidelity_error = 0.0;
+
+  // fraction of samples that completes an iteration, 0 or 1 to wait for all
+  streaming_ = std::clamp(GetNumberOrDefault(0.0, model, "sampling_streaming"),
+                          0.0, 1.0);
+
+  // samples simulated in lockstep by each worker
+  lockstep_ = std::clamp(
+      static_cast<int>(GetNumberOrDefault(0, model, "sampling_lockstep")), 0,
+      MaxSamplingLockstep);
+
   // set number of trajectories to rollout
   num_trajectory_ = GetNumberOrDefault(10, model, "sampling_trajectories");
 
@@ -57,6 +140,20 @@ void SamplingPlanner::Initialize(mjModel* model, const Task& task) {
                 kMaxTrajectory);
   }
 
+  // trajectories are allocated on demand
+  num_allocated_trajectory_ = 0;
+  allocated_horizon_ = 0;
+
+  // noise in the span of action synergies, sampling_synergies holds their
+  // rows
+  int synergies_id = mj_name2id(model, mjOBJ_NUMERIC, "sampling_synergies");
+  if (synergies_id >= 0 && model->nu > 0) {
+    SetSynergies(model->numeric_data + model->numeric_adr[synergies_id],
+                 model->numeric_size[synergies_id] / model->nu);
+  } else {
+    SetSynergies(nullptr, 0);
+  }
+
   winner = 0;
 }
 
@@ -79,17 +176,34 @@ void SamplingPlanner::Allocate() {
   parameters_scratch.resize(num_max_parameter);
   times_scratch.resize(kMaxTrajectoryHorizon);
 
-  // noise
-  noise.resize(kMaxTrajectory * (model->nu * kMaxTrajectoryHorizon));
-
-  // trajectory and parameters
+  // trajectory, parameters, and noise: nominal only, the rest are allocated
+  // when first rolled out
   winner = -1;
-  for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Initialize(num_state, model->nu, task->num_residual,
-                             task->num_trace, kMaxTrajectoryHorizon);
-    trajectory[i].Allocate(kMaxTrajectoryHorizon);
-    candidate_policy[i].Allocate(model, *task, kMaxTrajectoryHorizon);
-  }
+  ResizeTrajectories(1, 1);
+
+  // shared prefix
+  prefix_trajectory_.Initialize(num_state, model->nu, task->num_residual,
+                                task->num_trace, kMaxTrajectoryHorizon);
+  prefix_trajectory_.Allocate(kMaxTrajectoryHorizon);
+
+  // full solver fidelity winner
+  fidelity_trajectory_.Initialize(num_state, model->nu, task->num_residual,
+                                  task->num_trace, kMaxTrajectoryHorizon);
+  fidelity_trajectory_.Allocate(kMaxTrajectoryHorizon);
+}
+
+// grow trajectories, candidate policies, and noise to cover num_trajectory
+// rollouts of horizon steps. storage is never shrunk.
+void SamplingPlanner::ResizeTrajectories(int num_trajectory, int horizon) {
+  GrowSampledTrajectories(
+      model, *task, num_trajectory, horizon, trajectory, candidate_policy,
+      &noise, &num_allocated_trajectory_, &allocated_horizon_, trajectory_mtx_,
+      [this](int num_allocated) {
+        if (num_synergies_) {
+          synergy_noise_.resize(num_allocated *
+                                (num_synergies_ * kMaxTrajectoryHorizon));
+        }
+      });
 }
 
 // reset memory to zeros
@@ -104,6 +218,7 @@ void SamplingPlanner::Reset(int horizon,
   // policy parameters
   policy.Reset(horizon, initial_repeated_action);
   previous_policy.Reset(horizon, initial_repeated_action);
+  published_policy_.Publish(policy, previous_policy);
 
   // scratch
   std::fill(parameters_scratch.begin(), parameters_scratch.end(), 0.0);
@@ -111,20 +226,15 @@ void SamplingPlanner::Reset(int horizon,
 
   // noise
   std::fill(noise.begin(), noise.end(), 0.0);
-
-  // trajectory samples
   for (int i = 0; i < kMaxTrajectory; i++) {
-    trajectory[i].Reset(kMaxTrajectoryHorizon);
-    candidate_policy[i].Reset(horizon, initial_repeated_action);
+    noise_stream[i].Seed(noise_seed, i);
   }
 
-  for (const auto& d : data_) {
-    if (initial_repeated_action) {
-      mju_copy(d->ctrl, initial_repeated_action, model->nu);
-    } else {
-      mju_zero(d->ctrl, model->nu);
-    }
-  }
+  // trajectory samples, allocated only
+  ForEachAllocation(num_allocated_trajectory_, [&](int i) {
+    trajectory[i].Reset(allocated_horizon_);
+    candidate_policy[i].Reset(horizon, initial_repeated_action);
+  });
 
   // improvement
   improvement = 0.0;
@@ -139,6 +249,66 @@ void SamplingPlanner::SetState(const State& state) {
                &this->time);
 }
 
+// warm start the nominal policy from another planner's trajectory
+void SamplingPlanner::WarmStart(const Trajectory& trajectory) {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    policy.SetFromTrajectory(trajectory);
+  }
+
+  // the next iteration resamples the winner
+  candidate_policy[winner].CopyFrom(policy, policy.num_spline_points);
+  candidate_policy[winner].representation = policy.representation;
+}
+
+void SamplingPlanner::Snapshot(SnapshotWriter& writer) const {
+  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  policy.Snapshot(writer, "sampling.policy");
+}
+
+bool SamplingPlanner::Restore(const SnapshotReader& reader) {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    if (!policy.Restore(reader, "sampling.policy")) return false;
+    previous_policy = policy;
+  }
+  published_policy_.Publish(policy, previous_policy);
+
+  // the next iteration resamples the winner
+  candidate_policy[winner].CopyFrom(policy, policy.num_spline_points);
+  candidate_policy[winner].representation = policy.representation;
+  return true;
+}
+
+void SamplingPlanner::LogIteration(PlanLogRecord& record, bool samples) const {
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    record.parameters.assign(
+        policy.parameters.begin(),
+        policy.parameters.begin() + policy.num_spline_points * model->nu);
+  }
+  const std::shared_lock<std::shared_mutex> lock(trajectory_mtx_);
+  LogSamples(record, trajectory,
+             std::min(num_trajectory_, num_allocated_trajectory_), samples);
+}
+
+void SamplingPlanner::ReportMemory(MemoryReport& report) const {
+  std::size_t trajectories =
+      prefix_trajectory_.Bytes() + fidelity_trajectory_.Bytes();
+  std::size_t policies = policy.Bytes() + previous_policy.Bytes() +
+                         VectorBytes(parameters_scratch, times_scratch);
+  for (int i = 0; i < kMaxTrajectory; i++) {
+    trajectories += trajectory[i].Bytes();
+    policies += candidate_policy[i].Bytes();
+  }
+  report.Add("trajectories", trajectories);
+  report.Add("policies", policies);
+  report.Add("noise", VectorBytes(noise, synergies_, synergy_noise_));
+  report.Add("scratch",
+             VectorBytes(state, mocap, userdata, trajectory_order,
+                         trajectory_return, nominal_warmstart_));
+}
+
 int SamplingPlanner::OptimizePolicyCandidates(int ncandidates, int horizon,
                                               ThreadPool& pool) {
   // if num_trajectory_ has changed, use it in this new iteration.
@@ -146,32 +316,53 @@ int SamplingPlanner::OptimizePolicyCandidates(int ncandidates, int horizon,
   // for the duration of this function.
   int num_trajectory = num_trajectory_;
   ncandidates = std::min(ncandidates, num_trajectory);
-  ResizeMjData(model, pool.NumThreads());
+
+  // lockstep groups need one mjData per sample in the group
+  int lockstep = lockstep_;
+  ResizeMjData(model, pool.NumThreads() * std::max(lockstep, 1), &pool,
+               std::max(lockstep, 1));
+  int steps = ScheduleSteps(horizon);
+  ResizeTrajectories(num_trajectory, steps);
 
   // ----- rollout noisy policies ----- //
   // start timer
-  auto rollouts_start = std::chrono::steady_clock::now();
-
-  // simulate noisy policies
-  this->Rollouts(num_trajectory, horizon, pool);
+  TraceSpan rollouts_span("SamplingPlanner::rollouts");
 
-  // sort candidate policies and trajectories by score
-  trajectory_order.clear();
-  trajectory_order.reserve(num_trajectory);
-  for (int i = 0; i < num_trajectory; i++) {
-    trajectory_order.push_back(i);
+  // remote samples roll out on their workers while the local ones run
+  std::shared_ptr<RemoteRollouts> remote;
+  {
+    const std::lock_guard<std::mutex> lock(remote_mtx_);
+    remote = remote_rollouts_;
+  }
+  if (remote && (remote->NumSamples() <= 0 || num_trajectory < 2)) {
+    remote.reset();
+  }
+  if (remote) {
+    StartRemoteBatch(num_trajectory, horizon, remote->NumSamples());
+    remote->Start(remote_batch_, deadline_);
   }
 
-  // sort so that the first ncandidates elements are the best candidates, and
-  // the rest are in an unspecified order
-  std::partial_sort(
-      trajectory_order.begin(), trajectory_order.begin() + ncandidates,
-      trajectory_order.end(), [trajectory = trajectory](int a, int b) {
-        return trajectory[a].total_return < trajectory[b].total_return;
-      });
+  // simulate noisy policies, pruning against the ncandidates-th best
+  return_bound_.Reset(ncandidates);
+  this->Rollouts(num_trajectory, steps, pool, lockstep);
+
+  // sort candidate policies and trajectories by score so that the first
+  // ncandidates elements are the best candidates, and the rest are in an
+  // unspecified order
+  trajectory_order.resize(num_trajectory);
+  trajectory_return.resize(num_trajectory);
+  RankTrajectories(trajectory_order.data(), trajectory_return.data(),
+                   trajectory, num_trajectory, ncandidates);
+
+  // a better remote sample replaces the worst local one
+  if (remote && remote->Wait(&remote_result_) &&
+      AdoptRemoteBest(num_trajectory, steps)) {
+    RankTrajectories(trajectory_order.data(), trajectory_return.data(),
+                     trajectory, num_trajectory, ncandidates);
+  }
 
   // stop timer
-  rollouts_compute_time = GetDuration(rollouts_start);
+  rollouts_compute_time = rollouts_span.End();
 
   return ncandidates;
 }
@@ -185,7 +376,7 @@ void SamplingPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
 
   // ----- update policy ----- //
   // start timer
-  auto policy_update_start = std::chrono::steady_clock::now();
+  TraceSpan policy_update_span("SamplingPlanner::policy_update");
 
   CopyCandidateToPolicy(0);
 
@@ -193,35 +384,91 @@ void SamplingPlanner::OptimizePolicy(int horizon, ThreadPool& pool) {
   double best_return = trajectory[0].total_return;
   improvement = mju_max(best_return - trajectory[winner].total_return, 0.0);
 
+  // cost of the reduced solver fidelity: the winner at full fidelity
+  if (schedule.num_solver_levels > 0) {
+    const Trajectory& best = trajectory[winner];
+    fidelity_trajectory_.schedule = schedule;
+    fidelity_trajectory_.schedule.num_solver_levels = 0;
+    fidelity_trajectory_.Rollout(candidate_policy[winner], task, model,
+                                 data_[0], state.data(), time,
+                                 mocap.data(), userdata.data(), best.horizon);
+    counters_.AddRollout(fidelity_trajectory_);
+    solver_fidelity_error =
+        fidelity_trajectory_.total_return - best.total_return;
+  } else {
+    solver_fidelity_error = 0.0;
+  }
+
   // stop timer
-  policy_update_compute_time = GetDuration(policy_update_start);
+  policy_update_compute_time = policy_update_span.End();
 }
 
 // compute trajectory using nominal policy
 void SamplingPlanner::NominalTrajectory(int horizon, ThreadPool& pool) {
-  // set policy
-  auto nominal_policy = [&cp = candidate_policy[0]](
-                            double* action, const double* state, double time) {
-    cp.Action(action, state, time);
-  };
+  int steps = ScheduleSteps(horizon);
+  ResizeTrajectories(1, steps);
 
   // rollout nominal policy
-  trajectory[0].Rollout(nominal_policy, task, model, data_[0].get(),
+  trajectory[0].schedule = schedule;
+  trajectory[0].Rollout(candidate_policy[0], task, model, data_[0],
                         state.data(), time, mocap.data(), userdata.data(),
-                        horizon);
+                        steps);
+}
+
+// rollout steps of the schedule
+int SamplingPlanner::ScheduleSteps(int horizon) {
+  if (!schedule.Uniform()) {
+    coarse_model_ = *model;
+    coarse_model_.opt.timestep *= schedule.coarse_factor;
+
+    // the coarse model's residual is the planning model's
+    if (!HasResidual(&coarse_model_)) {
+      RegisterResidualAlias(&coarse_model_, model);
+    }
+
+    // the reduced solver fidelity starts with the coarse steps
+    schedule.full_solver_steps =
+        std::max(schedule.full_solver_steps, schedule.fine_steps);
+  }
+
+  // reduced solver fidelity levels
+  const mjModel* base = schedule.Uniform() ? model : &coarse_model_;
+  double tolerance = base->opt.tolerance;
+  int iterations = base->opt.iterations;
+  for (int i = 0; i < schedule.num_solver_levels; i++) {
+    tolerance *= solver_tolerance_factor_;
+    iterations = std::max(iterations / 2, 1);
+    solver_model_[i] = *base;
+    solver_model_[i].opt.tolerance = tolerance;
+    solver_model_[i].opt.iterations = iterations;
+    solver_models_[i] = &solver_model_[i];
+    if (!HasResidual(&solver_model_[i])) {
+      RegisterResidualAlias(&solver_model_[i], model);
+    }
+  }
+  return schedule.Uniform() ? horizon : schedule.Steps(horizon);
 }
 
 // set action from policy
 void SamplingPlanner::ActionFromPolicy(double* action, const double* state,
                                        double time, bool use_previous) {
-  const std::shared_lock<std::shared_mutex> lock(mtx_);
+  auto published = published_policy_.Latest();
+  if (!published) return;
   if (use_previous) {
-    previous_policy.Action(action, state, time);
+    published->previous_policy.Action(action, state, time);
   } else {
-    policy.Action(action, state, time);
+    published->policy.Action(action, state, time);
   }
 }
 
+bool SamplingPlanner::ExportPolicy(ExportedPolicy& policy) const {
+  auto published = published_policy_.Latest();
+  if (!published) return false;
+  published->policy.Export(policy);
+  policy.version = published->version;
+  return true;
+}
+
 // update policy via resampling
 void SamplingPlanner::UpdateNominalPolicy(int horizon) {
   // dimensions
@@ -235,10 +482,10 @@ void SamplingPlanner::UpdateNominalPolicy(int horizon) {
   // get spline points
   for (int t = 0; t < num_spline_points; t++) {
     times_scratch[t] = nominal_time;
-    candidate_policy[winner].Action(DataAt(parameters_scratch, t * model->nu),
-                               nullptr, nominal_time);
     nominal_time += time_shift;
   }
+  candidate_policy[winner].Actions(parameters_scratch.data(),
+                                   times_scratch.data(), num_spline_points);
 
   // update
   {
@@ -251,82 +498,266 @@ void SamplingPlanner::UpdateNominalPolicy(int horizon) {
   }
 }
 
+void SamplingPlanner::SetSynergies(const double* basis, int num_synergies) {
+  int nu = model->nu;
+  num_synergies_ = 0;
+  synergies_.clear();
+  if (!basis || num_synergies <= 0 || num_synergies >= nu) return;
+  synergies_.assign(basis, basis + num_synergies * nu);
+  int rank = OrthonormalizeRows(synergies_.data(), num_synergies, nu);
+  synergies_.resize(rank * nu);
+  num_synergies_ = rank;
+  synergy_noise_.resize(num_allocated_trajectory_ *
+                        (num_synergies_ * kMaxTrajectoryHorizon));
+}
+
 // add random noise to nominal policy
 void SamplingPlanner::AddNoiseToPolicy(int i) {
   // start timer
-  auto noise_start = std::chrono::steady_clock::now();
+  TraceSpan noise_span("SamplingPlanner::noise");
 
   // dimensions
   int num_spline_points = candidate_policy[i].num_spline_points;
   int num_parameters = candidate_policy[i].num_parameters;
 
-  // sampling token
-  absl::BitGen gen_;
-
   // shift index
   int shift = i * (model->nu * kMaxTrajectoryHorizon);
 
-  // sample noise
-  for (int k = 0; k < num_parameters; k++) {
-    noise[k + shift] = absl::Gaussian<double>(gen_, 0.0, noise_exploration);
+  // sample noise, correlated across spline points
+  if (num_synergies_) {
+    // coordinates in the span of the synergies
+    double* coordinates =
+        DataAt(synergy_noise_, i * (num_synergies_ * kMaxTrajectoryHorizon));
+    BatchGaussian(coordinates, num_spline_points * num_synergies_,
+                  noise_exploration, noise_sampling_, i, noise_seed,
+                  noise_iteration_, noise_stream[i]);
+    CorrelateRows(coordinates, num_spline_points, num_synergies_,
+                  noise_correlation_);
+    ExpandRows(DataAt(noise, shift), coordinates, synergies_.data(),
+               num_spline_points, num_synergies_, model->nu);
+  } else {
+    BatchGaussian(DataAt(noise, shift), num_parameters, noise_exploration,
+                  noise_sampling_, i, noise_seed, noise_iteration_,
+                  noise_stream[i]);
+    CorrelateRows(DataAt(noise, shift), num_spline_points, model->nu,
+                  noise_correlation_);
   }
 
+  // keep shared spline points at the nominal
+  int num_shared = std::min(shared_prefix_, num_spline_points);
+  mju_zero(DataAt(noise, shift), model->nu * num_shared);
+
   // add noise
   mju_addTo(candidate_policy[i].parameters.data(), DataAt(noise, shift),
             num_parameters);
 
   // clamp parameters
-  for (int t = 0; t < num_spline_points; t++) {
+  for (int t = num_shared; t < num_spline_points; t++) {
     Clamp(DataAt(candidate_policy[i].parameters, t * model->nu),
           model->actuator_ctrlrange, model->nu);
   }
 
   // end timer
-  IncrementAtomic(noise_compute_time, GetDuration(noise_start));
+  IncrementAtomic(noise_compute_time, noise_span.End());
 }
 
 // compute candidate trajectories
 void SamplingPlanner::Rollouts(int num_trajectory, int horizon,
-                               ThreadPool& pool) {
+                               ThreadPool& pool, int lockstep) {
   // reset noise compute time
   noise_compute_time = 0.0;
 
+  // the rollouts are the simulation work of an iteration
+  counters_.Reset();
+
+  // new noise for antithetic and Sobol sampling
+  noise_iteration_++;
+
   policy.num_parameters = model->nu * policy.num_spline_points;
 
-  // random search
-  int count_before = pool.GetCount();
+  // rollout time steps and recording
   for (int i = 0; i < num_trajectory; i++) {
-    pool.Schedule([&s = *this, &model = this->model, &task = this->task,
-                   &state = this->state, &time = this->time,
-                   &mocap = this->mocap, &userdata = this->userdata, horizon,
-                   i]() {
-      // copy nominal policy
-      {
-        const std::shared_lock<std::shared_mutex> lock(s.mtx_);
-        s.candidate_policy[i].CopyFrom(s.policy, s.policy.num_spline_points);
-        s.candidate_policy[i].representation = s.policy.representation;
-      }
+    trajectory[i].schedule = schedule;
+    trajectory[i].lean = lean_rollouts_;
+  }
+  UpdateWarmStart(num_trajectory);
+  prefix_trajectory_.schedule = schedule;
+
+  // shared prefixes and lockstep groups simulate on the pool, other backends
+  // roll out every sample from the start
+  bool pool_backend = rollout_backend_ == nullptr;
+
+  // simulate the prefix shared by all samples once
+  int prefix_steps = 0;
+  if (shared_prefix_ > 0 && pool_backend) {
+    {
+      const std::shared_lock<std::shared_mutex> lock(mtx_);
+      candidate_policy[0].CopyFrom(policy, policy.num_spline_points);
+      candidate_policy[0].representation = policy.representation;
+    }
+    prefix_steps = SharedPrefixSteps(candidate_policy[0], horizon);
+    if (prefix_steps > 0) {
+      if (!prefix_data_) prefix_data_ = MakeUniqueMjData(mj_makeData(model));
+      prefix_trajectory_.RolloutPrefix(
+          candidate_policy[0], task, model, prefix_data_.get(), state.data(),
+          time, mocap.data(), userdata.data(), horizon, prefix_steps);
+      counters_.AddSteps(prefix_trajectory_);
+    }
+  }
 
-      // sample noise policy
-      if (i != 0) s.AddNoiseToPolicy(i);
+  // copy nominal policy and sample noise policy
+  auto sample_policy = [&s = *this](int i) {
+    {
+      const std::shared_lock<std::shared_mutex> lock(s.mtx_);
+      s.candidate_policy[i].CopyFrom(s.policy, s.policy.num_spline_points);
+      s.candidate_policy[i].representation = s.policy.representation;
+    }
+    if (i != 0) s.AddNoiseToPolicy(i);
+  };
+  ReturnBound* bound = pruning_ ? &return_bound_ : nullptr;
+
+  // past the deadline, samples that have not started are skipped. the nominal
+  // sample always runs.
+  auto skip = [&s = *this](int i) {
+    if (i == 0 || !s.DeadlinePassed()) return false;
+    s.trajectory[i].pruned = true;
+    s.trajectory[i].total_return = std::numeric_limits<double>::infinity();
+    return true;
+  };
 
-      // ----- rollout sample policy ----- //
+  // lockstep groups, samples branching from a shared prefix run
+  // independently
+  if (lockstep > 1 && prefix_steps == 0 && pool_backend) {
+    int num_group = (num_trajectory + lockstep - 1) / lockstep;
+    pool.ParallelFor(0, num_group, 1, [&, &s = *this](int g) {
+      int begin = g * lockstep;
+      int n = std::min(lockstep, num_trajectory - begin);
+      if (g > 0 && s.DeadlinePassed()) {
+        for (int j = 0; j < n; j++) skip(begin + j);
+        return;
+      }
+      Trajectory* trajectories[MaxSamplingLockstep];
+      const SamplingPolicy* policies[MaxSamplingLockstep];
+      mjData* data[MaxSamplingLockstep];
+      for (int j = 0; j < n; j++) {
+        sample_policy(begin + j);
+        trajectories[j] = &s.trajectory[begin + j];
+        policies[j] = &s.candidate_policy[begin + j];
+        data[j] = s.data_[ThreadPool::WorkerId() * lockstep + j];
+      }
+      Trajectory::RolloutLockstep(trajectories, policies, n, task, model,
+                                  data, state.data(), time, mocap.data(),
+                                  userdata.data(), horizon, bound);
+      for (int j = 0; j < n; j++) s.counters_.AddRollout(*trajectories[j]);
+    });
+    return;
+  }
 
-      // policy
-      auto sample_policy_i = [&candidate_policy = s.candidate_policy, &i](
-                                 double* action, const double* state,
-                                 double time) {
-        candidate_policy[i].Action(action, state, time);
-      };
+  // random search, branching from the shared prefix
+  if (prefix_steps > 0) {
+    pool.ParallelFor(0, num_trajectory, 1, [&, &s = *this](int i) {
+      if (skip(i)) return;
+      sample_policy(i);
+      s.trajectory[i].RolloutFrom(s.candidate_policy[i], s.prefix_trajectory_,
+                                  prefix_steps, s.prefix_data_.get(), task,
+                                  model, s.data_[ThreadPool::WorkerId()],
+                                  bound);
+      s.counters_.AddRollout(s.trajectory[i]);
+    });
+    return;
+  }
 
-      // policy rollout
+  // streaming random search: once the quota of samples has completed, the
+  // iteration ends. samples that haven't started are skipped, running ones
+  // stop at their next step, and both are discarded. the nominal always
+  // completes.
+  int quota = std::ceil(streaming_ * num_trajectory);
+  if (pool_backend && quota > 0 && quota < num_trajectory) {
+    ReturnBound* stream_bound = bound;
+    if (!stream_bound) {
+      // never tightens, only cancelled
+      stream_bound_.Reset(kMaxTrajectory);
+      stream_bound = &stream_bound_;
+    }
+    std::atomic<int> completed = 0;
+    pool.ParallelFor(0, num_trajectory, 1, [&, &s = *this](int i) {
+      if (i != 0 && completed.load(std::memory_order_relaxed) >= quota) {
+        s.trajectory[i].pruned = true;
+        s.trajectory[i].total_return = std::numeric_limits<double>::infinity();
+        return;
+      }
+      if (skip(i)) return;
+      sample_policy(i);
       s.trajectory[i].Rollout(
-          sample_policy_i, task, model, s.data_[ThreadPool::WorkerId()].get(),
-          state.data(), time, mocap.data(), userdata.data(), horizon);
+          s.candidate_policy[i], task, model,
+          s.data_[ThreadPool::WorkerId()], state.data(), time,
+          mocap.data(), userdata.data(), horizon,
+          i == 0 ? nullptr : stream_bound);
+      s.counters_.AddRollout(s.trajectory[i]);
+
+      // pruned returns are lower bounds, which a stopped sample could win with
+      if (s.trajectory[i].pruned) {
+        s.trajectory[i].total_return = std::numeric_limits<double>::infinity();
+      }
+      if (completed.fetch_add(1) + 1 == quota) stream_bound->Cancel();
     });
+    return;
+  }
+
+  // random search
+  Trajectory* trajectories[kMaxTrajectory];
+  const SamplingPolicy* policies[kMaxTrajectory];
+  for (int i = 0; i < num_trajectory; i++) {
+    trajectories[i] = &trajectory[i];
+    policies[i] = &candidate_policy[i];
   }
-  pool.WaitCount(count_before + num_trajectory);
-  pool.ResetCount();
+  RolloutBatch batch;
+  batch.task = task;
+  batch.model = model;
+  batch.state = state.data();
+  batch.mocap = mocap.data();
+  batch.userdata = userdata.data();
+  batch.time = time;
+  batch.steps = horizon;
+  batch.num_rollouts = num_trajectory;
+  batch.policies = policies;
+  batch.trajectories = trajectories;
+  batch.bound = bound;
+  batch.counters = &counters_;
+  batch.data = data_.data();
+  Backend().Rollouts(
+      batch,
+      [&](int i) {
+        if (skip(i)) return false;
+        sample_policy(i);
+        return true;
+      },
+      pool);
+}
+
+// number of rollout steps on which every sample matches the nominal policy
+int SamplingPlanner::SharedPrefixSteps(const SamplingPolicy& nominal,
+                                       int horizon) const {
+  int num_spline_points = nominal.num_spline_points;
+  int num_shared = std::min(shared_prefix_, num_spline_points);
+  if (num_shared == num_spline_points) return horizon - 1;
+
+  // spline points beyond an interval's left end that its actions depend on
+  int lookahead = 2;
+  if (nominal.representation == PolicyRepresentation::kZeroSpline) {
+    lookahead = 0;
+  } else if (nominal.representation == PolicyRepresentation::kLinearSpline) {
+    lookahead = 1;
+  }
+
+  // actions before this spline point only depend on shared points
+  int last = num_shared - lookahead;
+  if (last <= 0) return 0;
+
+  // steps before the spline point, with one step of margin for the
+  // accumulated simulation time
+  int steps = std::floor((nominal.times[last] - time) / model->opt.timestep);
+  return std::clamp(schedule.StepsBefore(steps) - 1, 0, horizon - 1);
 }
 
 // return trajectory with best total return
@@ -346,39 +777,23 @@ void SamplingPlanner::Traces(mjvScene* scn) {
   // width of a sample trace, in pixels
   double width = GetNumberOrDefault(3, model, "agent_sample_width");
 
-  // scratch
-  double zero3[3] = {0};
-  double zero9[9] = {0};
-
   // best
   auto best = this->BestTrajectory();
-
-  // sample traces
-  for (int k = 0; k < num_trajectory_; k++) {
-    // skip winner
-    if (k == winner) continue;
-
-    // plot sample
-    for (int i = 0; i < best->horizon - 1; i++) {
-      if (scn->ngeom + task->num_trace > scn->maxgeom) break;
-      for (int j = 0; j < task->num_trace; j++) {
-        // initialize geometry
-        mjv_initGeom(&scn->geoms[scn->ngeom], mjGEOM_LINE, zero3, zero3, zero9,
-                     color);
-
-        // make geometry
-        mjv_makeConnector(
-            &scn->geoms[scn->ngeom], mjGEOM_LINE, width,
-            trajectory[k].trace[3 * task->num_trace * i + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * i + 1 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * i + 2 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 1 + 3 * j],
-            trajectory[k].trace[3 * task->num_trace * (i + 1) + 2 + 3 * j]);
-
-        // increment number of geometries
-        scn->ngeom += 1;
-      }
+  if (!best) return;
+
+  // sample traces, lowest return first
+  const std::shared_lock<std::shared_mutex> lock(trajectory_mtx_);
+  int num_trajectory = std::min(num_trajectory_, num_allocated_trajectory_);
+  std::vector<int> samples;
+  for (int k = 0; k < num_trajectory; k++) {
+    // skip winner and lean samples without traces
+    if (k != winner && !trajectory[k].lean) samples.push_back(k);
+  }
+  SelectTraceSamples(samples, trajectory, trace_options_.max_samples);
+  for (int k : samples) {
+    if (!AddTraceLines(scn, trajectory[k], task->num_trace, best->horizon,
+                       trace_options_.stride, width, color)) {
+      break;
     }
   }
 }
@@ -391,6 +806,18 @@ void SamplingPlanner::GUI(mjUI& ui) {
        "Zero\nLinear\nCubic"},
       {mjITEM_SLIDERINT, "Spline Pts", 2, &policy.num_spline_points, "0 1"},
       {mjITEM_SLIDERNUM, "Noise Std", 2, &noise_exploration, "0 1"},
+      {mjITEM_CHECKINT, "Pruning", 2, &pruning_, ""},
+      {mjITEM_SLIDERINT, "Shared Pts", 2, &shared_prefix_, "0 1"},
+      {mjITEM_SLIDERINT, "Lockstep", 2, &lockstep_, "0 1"},
+      {mjITEM_SELECT, "Noise", 2, &noise_sampling_,
+       "Independent\nAntithetic\nSobol"},
+      {mjITEM_SLIDERNUM, "Noise Corr.", 2, &noise_correlation_, "0 1"},
+      {mjITEM_CHECKINT, "Lean Rollouts", 2, &lean_rollouts_, ""},
+      {mjITEM_SELECT, "Warm Start", 2, &warmstart_,
+       "Off\nInitial\nEvery Step"},
+      {mjITEM_SLIDERINT, "Trace Stride", 2, &trace_options_.stride, "1 10"},
+      {mjITEM_SLIDERINT, "Trace Samples", 2, &trace_options_.max_samples,
+       "0 128"},
       {mjITEM_END}};
 
   // set number of trajectory slider limits
@@ -404,6 +831,12 @@ void SamplingPlanner::GUI(mjUI& ui) {
   mju::sprintf_arr(defSampling[3].other, "%f %f", MinNoiseStdDev,
                    MaxNoiseStdDev);
 
+  // set shared spline point limits
+  mju::sprintf_arr(defSampling[5].other, "%i %i", 0, MaxSamplingSplinePoints);
+
+  // set lockstep group limits
+  mju::sprintf_arr(defSampling[6].other, "%i %i", 0, MaxSamplingLockstep);
+
   // add sampling planner
   mjui_add(&ui, defSampling);
 }
@@ -421,8 +854,16 @@ void SamplingPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
                        mju_log10(mju_max(improvement, 1.0e-6)), 100,
                        0 + planner_shift, 0, 1, -100);
 
+  // full solver fidelity return error
+  mjpc::PlotUpdateData(fig_planner, planner_bounds,
+                       fig_planner->linedata[1 + planner_shift][0] + 1,
+                       mju_log10(mju_max(mju_abs(solver_fidelity_error),
+                                         1.0e-6)),
+                       100, 1 + planner_shift, 0, 1, -100);
+
   // legend
   mju::strcpy_arr(fig_planner->linename[0 + planner_shift], "Improvement");
+  mju::strcpy_arr(fig_planner->linename[1 + planner_shift], "Fidelity Error");
 
   fig_planner->range[1][0] = planner_bounds[0];
   fig_planner->range[1][1] = planner_bounds[1];
@@ -453,7 +894,7 @@ void SamplingPlanner::Plots(mjvFigure* fig_planner, mjvFigure* fig_timer,
   mju::strcpy_arr(fig_timer->linename[2 + timer_shift], "Policy Update");
 
   // planner shift
-  shift[0] += 1;
+  shift[0] += 2;
 
   // timer shift
   shift[1] += 3;
@@ -473,11 +914,202 @@ void SamplingPlanner::ActionFromCandidatePolicy(double* action, int candidate,
 void SamplingPlanner::CopyCandidateToPolicy(int candidate) {
   // set winner
   winner = trajectory_order[candidate];
+  RecordWinner();
 
   {
     const std::shared_lock<std::shared_mutex> lock(mtx_);
     previous_policy = policy;
     policy = candidate_policy[winner];
   }
+  published_policy_.Publish(policy, previous_policy);
 }
+
+// solver warm starts of the samples from the nominal rollout of the previous
+// iteration, which is recorded in trajectory[0], shifted to the current time
+void SamplingPlanner::UpdateWarmStart(int num_trajectory) {
+  WarmStartSource source;
+  Trajectory& nominal = trajectory[0];
+  int nv = model->nv;
+  if (warmstart_ != kNoWarmStart && nominal.record_warmstart &&
+      !nominal.failure && !nominal.pruned &&
+      static_cast<int>(nominal.warmstart.size()) >= nominal.horizon * nv) {
+    nominal_warmstart_.swap(nominal.warmstart);
+    int shift = std::round((time - nominal.times[0]) / model->opt.timestep);
+    if (schedule.Uniform() && shift >= 0 && shift < nominal.horizon) {
+      source.qacc = nominal_warmstart_.data();
+      source.steps = nominal.horizon;
+      source.shift = shift;
+      source.every_step = warmstart_ == kEveryStepWarmStart;
+    }
+  }
+  for (int i = 0; i < num_trajectory; i++) {
+    trajectory[i].warmstart_source = source;
+    trajectory[i].record_warmstart = false;
+  }
+  prefix_trajectory_.warmstart_source = source;
+
+  // the nominal and the shared prefix it starts with are recorded
+  trajectory[0].record_warmstart = warmstart_ != kNoWarmStart;
+  prefix_trajectory_.record_warmstart = warmstart_ != kNoWarmStart;
+}
+
+// re-simulate a lean winner to record its trajectory. the rollout is
+// deterministic given the sample's policy, so it recovers the sample.
+void SamplingPlanner::RecordWinner() {
+  Trajectory& best = trajectory[winner];
+  if (!best.lean || best.failure) return;
+  best.lean = false;
+  best.Rollout(candidate_policy[winner], task, model, data_[0], state.data(),
+               time, mocap.data(), userdata.data(), best.horizon);
+  counters_.AddRollout(best);
+}
+
+void SamplingPlanner::SetRemoteRollouts(
+    std::shared_ptr<RemoteRollouts> remote) {
+  const std::lock_guard<std::mutex> lock(remote_mtx_);
+  remote_rollouts_ = std::move(remote);
+}
+
+// describe remote samples of the iteration
+void SamplingPlanner::StartRemoteBatch(int num_trajectory, int horizon,
+                                       int num_remote) {
+  RemoteSampleBatch& batch = remote_batch_;
+  batch.state = state;
+  batch.mocap = mocap;
+  batch.userdata = userdata;
+  batch.time = time;
+  batch.timestep = model->opt.timestep;
+  batch.integrator = model->opt.integrator;
+  batch.horizon = horizon;
+  batch.fine_steps = schedule.fine_steps;
+  batch.coarse_factor = schedule.coarse_factor;
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    int num_spline_points = policy.num_spline_points;
+    batch.representation = static_cast<int>(policy.representation);
+    batch.num_spline_points = num_spline_points;
+    batch.parameters.assign(
+        policy.parameters.begin(),
+        policy.parameters.begin() + num_spline_points * model->nu);
+    batch.times.assign(policy.times.begin(),
+                       policy.times.begin() + num_spline_points);
+  }
+  batch.task_parameters = task->parameters;
+  batch.weights = task->weight;
+  batch.noise_exploration = noise_exploration;
+  batch.noise_correlation = noise_correlation_;
+  batch.noise_sampling = noise_sampling_;
+  batch.synergies = synergies_;
+  batch.shared_prefix = shared_prefix_;
+  batch.noise_seed = noise_seed;
+  // Rollouts advances the iteration before sampling
+  batch.noise_iteration = noise_iteration_ + 1;
+  batch.pruning = pruning_;
+  batch.begin = num_trajectory;
+  batch.end = num_trajectory + num_remote;
+}
+
+// adopt a better remote winner
+bool SamplingPlanner::AdoptRemoteBest(int num_trajectory, int steps) {
+  const RemoteSampleResult& result = remote_result_;
+  if (result.best < 0 || result.horizon != steps) return false;
+  if (result.best_return >= trajectory[trajectory_order[0]].total_return) {
+    return false;
+  }
+
+  // worst sample other than the nominal
+  int worst = -1;
+  for (int i = 1; i < num_trajectory; i++) {
+    if (worst < 0 || trajectory[i].total_return >
+                         trajectory[worst].total_return) {
+      worst = i;
+    }
+  }
+
+  // reproduce the winner's policy
+  {
+    const std::shared_lock<std::shared_mutex> lock(mtx_);
+    RemoteSamplePolicy(
+        &candidate_policy[worst], policy, remote_batch_, result.best,
+        DataAt(noise, worst * (model->nu * kMaxTrajectoryHorizon)));
+  }
+  GetRemoteBest(&trajectory[worst], result);
+  trajectory[worst].lean = false;
+  return true;
+}
+
+// evaluate the samples of a remote planner's batch
+void SamplingPlanner::EvaluateRemoteSamples(const RemoteSampleBatch& batch,
+                                            ThreadPool& pool,
+                                            RemoteSampleResult* result) {
+  int num_sample = std::max(batch.end - batch.begin, 0);
+  result->total_return.assign(num_sample,
+                              std::numeric_limits<double>::infinity());
+  result->best = -1;
+  result->best_return = std::numeric_limits<double>::infinity();
+
+  // start of the rollouts and planning model settings
+  state = batch.state;
+  mocap = batch.mocap;
+  userdata = batch.userdata;
+  time = batch.time;
+  model->opt.timestep = batch.timestep;
+  model->opt.integrator = batch.integrator;
+  schedule.fine_steps = batch.fine_steps;
+  schedule.coarse_factor = std::max(batch.coarse_factor, 1);
+  int steps = ScheduleSteps(batch.horizon);
+
+  // nominal policy
+  {
+    const std::unique_lock<std::shared_mutex> lock(mtx_);
+    policy.representation =
+        static_cast<PolicyRepresentation>(batch.representation);
+    policy.num_spline_points = batch.num_spline_points;
+    policy.num_parameters = model->nu * batch.num_spline_points;
+    std::copy(batch.parameters.begin(), batch.parameters.end(),
+              policy.parameters.begin());
+    std::copy(batch.times.begin(), batch.times.end(), policy.times.begin());
+  }
+
+  // samples in chunks of the local trajectory storage
+  ResizeMjData(model, pool.NumThreads());
+  ResizeTrajectories(kMaxTrajectory, steps);
+  for (int begin = 0; begin < num_sample; begin += kMaxTrajectory) {
+    int n = std::min(kMaxTrajectory, num_sample - begin);
+    return_bound_.Reset(1);
+    ReturnBound* bound = batch.pruning ? &return_bound_ : nullptr;
+    pool.ParallelFor(0, n, 1, [&, &s = *this](int j) {
+      if (s.DeadlinePassed()) return;
+      int sample = batch.begin + begin + j;
+      RemoteSamplePolicy(
+          &s.candidate_policy[j], s.policy, batch, sample,
+          DataAt(s.noise, j * (s.model->nu * kMaxTrajectoryHorizon)));
+      s.trajectory[j].schedule = s.schedule;
+      s.trajectory[j].lean = false;
+      s.trajectory[j].record_warmstart = false;
+      s.trajectory[j].warmstart_source = WarmStartSource();
+      s.trajectory[j].Rollout(s.candidate_policy[j], s.task, s.model,
+                              s.data_[std::max(ThreadPool::WorkerId(), 0)],
+                              s.state.data(), s.time, s.mocap.data(),
+                              s.userdata.data(), steps, bound);
+      result->total_return[begin + j] = s.trajectory[j].total_return;
+    });
+
+    // best of the chunk, skipped samples have infinite returns
+    for (int j = 0; j < n; j++) {
+      if (!trajectory[j].pruned &&
+          result->total_return[begin + j] < result->best_return) {
+        SetRemoteBest(result, batch.begin + begin + j, trajectory[j]);
+      }
+    }
+  }
+}
+
+// compute times of the last iteration's phases
+std::vector<PhaseTime> SamplingPlanner::PhaseTimes() const {
+  return {{"noise", noise_compute_time.load()},
+          {"rollouts", rollouts_compute_time},
+          {"policy_update", policy_update_compute_time}};
+}
+
 }  // namespace mjpc
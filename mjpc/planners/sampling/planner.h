@@ -17,12 +17,19 @@
 
 #include <mujoco/mujoco.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <vector>
 
 #include "mjpc/planners/planner.h"
+#include "mjpc/planners/policy_buffer.h"
 #include "mjpc/planners/sampling/policy.h"
+#include "mjpc/planners/sampling/remote.h"
+#include "mjpc/random.h"
 #include "mjpc/states/state.h"
 #include "mjpc/trajectory.h"
 
@@ -33,6 +40,14 @@ inline constexpr int MinSamplingSplinePoints = 1;
 inline constexpr int MaxSamplingSplinePoints = 36;
 inline constexpr double MinNoiseStdDev = 0.0;
 inline constexpr double MaxNoiseStdDev = 1.0;
+inline constexpr int MaxSamplingLockstep = 16;
+
+// solver warm starts of the samples, from the previous nominal rollout
+enum SamplingWarmStart : int {
+  kNoWarmStart = 0,     // each sample's data keeps its accelerations
+  kInitialWarmStart,    // the first step of each sample
+  kEveryStepWarmStart,  // every step of each sample
+};
 
 class SamplingPlanner : public RankedPlanner {
  public:
@@ -40,7 +55,7 @@ class SamplingPlanner : public RankedPlanner {
   SamplingPlanner() = default;
 
   // destructor
-  ~SamplingPlanner() override = default;
+  ~SamplingPlanner() override;
 
   // ----- methods ----- //
 
@@ -73,8 +88,44 @@ class SamplingPlanner : public RankedPlanner {
   // add noise to nominal policy
   void AddNoiseToPolicy(int i);
 
-  // compute candidate trajectories
-  void Rollouts(int num_trajectory, int horizon, ThreadPool& pool);
+  // sample noise in the span of num_synergies action directions (rows of
+  // basis, num_synergies x nu), e.g., principal components of logged plans.
+  // the rows are orthonormalized, no basis or a full-rank one samples every
+  // actuator. not while planning.
+  void SetSynergies(const double* basis, int num_synergies);
+  int NumSynergies() const { return num_synergies_; }
+
+  // compute candidate trajectories. with lockstep > 1, each worker advances
+  // groups of lockstep samples one time step at a time.
+  void Rollouts(int num_trajectory, int horizon, ThreadPool& pool,
+                int lockstep = 0);
+
+  // describe samples [num_trajectory, num_trajectory + num_remote) of an
+  // iteration of horizon uniform steps for remote workers
+  void StartRemoteBatch(int num_trajectory, int horizon, int num_remote);
+
+  // replace the worst local sample with the remote winner if it beats the
+  // best local sample. returns true if replaced.
+  bool AdoptRemoteBest(int num_trajectory, int steps);
+
+  // set the solver warm starts of the rollouts of an iteration
+  void UpdateWarmStart(int num_trajectory);
+
+  // re-simulate the winner if it is lean, so that BestTrajectory is complete
+  void RecordWinner();
+
+  // number of rollout steps on which every sample matches the nominal policy
+  int SharedPrefixSteps(const SamplingPolicy& nominal, int horizon) const;
+
+  // grow trajectory storage for num_trajectory rollouts of horizon steps
+  void ResizeTrajectories(int num_trajectory, int horizon);
+
+  // rollout steps of schedule that cover horizon uniform steps, and update
+  // the schedule's coarse and solver fidelity models to the current model
+  int ScheduleSteps(int horizon);
+
+  // unregister the residuals of the schedule's models
+  void UnregisterModels();
 
   // return trajectory with best total return
   const Trajectory* BestTrajectory() override;
@@ -94,6 +145,37 @@ class SamplingPlanner : public RankedPlanner {
     return policy.num_spline_points * policy.model->nu;
   };
 
+  // compute times of the last iteration's phases
+  std::vector<PhaseTime> PhaseTimes() const override;
+
+  // rollouts of an iteration
+  int NumRollouts() const override { return num_trajectory_; }
+  void SetNumRollouts(int num_rollouts) override {
+    num_trajectory_ = std::clamp(num_rollouts, 2, kMaxTrajectory);
+  }
+
+  // warm start the nominal policy from another planner's trajectory
+  void WarmStart(const Trajectory& trajectory) override;
+
+  // snapshot of the nominal policy
+  void Snapshot(SnapshotWriter& writer) const override;
+  bool Restore(const SnapshotReader& reader) override;
+
+  // export the published policy
+  bool ExportPolicy(ExportedPolicy& policy) const override;
+
+  // publications of the policy
+  std::uint64_t PolicyVersion() const {
+    auto published = published_policy_.Latest();
+    return published ? published->version : 0;
+  }
+
+  // nominal policy parameters and samples of the last iteration
+  void LogIteration(PlanLogRecord& record, bool samples) const override;
+
+  // bytes of the trajectories, policies and sampling buffers
+  void ReportMemory(MemoryReport& report) const override;
+
   // optimizes policies, but rather than picking the best, generate up to
   // ncandidates. returns number of candidates created.
   int OptimizePolicyCandidates(int ncandidates, int horizon,
@@ -108,6 +190,15 @@ class SamplingPlanner : public RankedPlanner {
 
   void CopyCandidateToPolicy(int candidate) override;
 
+  // evaluate remote samples in addition to num_trajectory_ local ones,
+  // nullptr to stop
+  void SetRemoteRollouts(std::shared_ptr<RemoteRollouts> remote);
+
+  // evaluate the samples of a remote planner's batch, for workers. the task
+  // parameters and weights of batch are applied by the caller.
+  void EvaluateRemoteSamples(const RemoteSampleBatch& batch, ThreadPool& pool,
+                             RemoteSampleResult* result);
+
   // ----- members ----- //
   mjModel* model;
   const Task* task;
@@ -130,20 +221,45 @@ class SamplingPlanner : public RankedPlanner {
   // trajectories
   Trajectory trajectory[kMaxTrajectory];
 
+  // rollout time steps, fine for sampling_fine_steps steps and
+  // sampling_coarse_factor times longer after
+  RolloutSchedule schedule;
+
   // order of indices of rolled out trajectories, ordered by total return
   std::vector<int> trajectory_order;
+  std::vector<double> trajectory_return;  // packed returns for ranking
 
   // ----- noise ----- //
   double noise_exploration;  // standard deviation for sampling normal: N(0,
                              // exploration)
   std::vector<double> noise;
 
+  // noise streams, one per candidate
+  RandomStream noise_stream[kMaxTrajectory];
+  int noise_seed;
+
+  // noise sampling (NoiseSampling) and AR(1) correlation across spline
+  // points
+  int noise_sampling_;
+  double noise_correlation_;
+  std::uint64_t noise_iteration_;  // rollout batches, keys batch noise
+
+  // orthonormal action synergies (num_synergies_ x nu), noise coordinates in
+  // their span per sample (num_spline_points x num_synergies_)
+  std::vector<double> synergies_;
+  int num_synergies_ = 0;
+  std::vector<double> synergy_noise_;
+
   // best trajectory
   int winner;
 
   // improvement
   double improvement;
 
+  // return of the winner simulated at full solver fidelity minus its
+  // return with the schedule's reduced fidelity, 0 without reduced levels
+  double solver_fidelity_error = 0.0;
+
   // flags
   int processed_noise_status;
 
@@ -154,6 +270,60 @@ class SamplingPlanner : public RankedPlanner {
 
   int num_trajectory_;
   mutable std::shared_mutex mtx_;
+
+  // policies published to ActionFromPolicy
+  PolicyBuffer<SamplingPolicy> published_policy_;
+
+  // rollout pruning
+  int pruning_;
+  ReturnBound return_bound_;
+
+  // samples record only their returns, see Trajectory::lean
+  int lean_rollouts_;
+
+  // solver warm starts of the samples (SamplingWarmStart), from the
+  // previous iteration's nominal rollout
+  int warmstart_;
+  std::vector<double> nominal_warmstart_;  // (horizon x nv)
+
+  // samples per lockstep rollout group, 0 or 1 for independent rollouts
+  int lockstep_;
+
+  // streaming iterations end once this fraction of the samples completed,
+  // 0 to wait for all. stragglers are stopped and discarded.
+  double streaming_;
+  ReturnBound stream_bound_;  // cancels stragglers without pruning
+
+  // model with the coarse time step of schedule (header copy of model)
+  mjModel coarse_model_;
+
+  // models of the schedule's reduced solver fidelity levels (header copies
+  // of model, or coarse_model_ with coarse steps), each level with half the
+  // solver iterations and solver_tolerance_factor_ times the tolerance of
+  // the previous
+  mjModel solver_model_[kMaxSolverLevels];
+  const mjModel* solver_models_[kMaxSolverLevels];
+  double solver_tolerance_factor_;
+
+  // the winner re-simulated at full solver fidelity
+  Trajectory fidelity_trajectory_;
+
+  // shared rollout prefix, samples branch from it
+  int shared_prefix_;  // leading spline points without noise
+  Trajectory prefix_trajectory_;
+  UniqueMjData prefix_data_ = MakeUniqueMjData(nullptr);
+
+  // remote samples of an iteration
+  // (Guarded by remote_mtx_)
+  std::shared_ptr<RemoteRollouts> remote_rollouts_;
+  std::mutex remote_mtx_;
+  RemoteSampleBatch remote_batch_;
+  RemoteSampleResult remote_result_;
+
+  // allocated trajectory storage (resized under trajectory_mtx_)
+  int num_allocated_trajectory_;
+  int allocated_horizon_;
+  mutable std::shared_mutex trajectory_mtx_;
 };
 
 }  // namespace mjpc
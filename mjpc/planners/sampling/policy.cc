@@ -15,10 +15,16 @@
 #include "mjpc/planners/sampling/policy.h"
 
 #include <algorithm>
+#include <string_view>
 #include <vector>
 
+#include <absl/strings/str_cat.h>
+
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/policy.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/task.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
@@ -49,6 +55,10 @@ void SamplingPolicy::Allocate(const mjModel* model, const Task& task,
                                       "sampling_representation");
 }
 
+std::size_t SamplingPolicy::Bytes() const {
+  return VectorBytes(parameters, times);
+}
+
 // reset memory to zeros
 void SamplingPolicy::Reset(int horizon, const double* initial_repeated_action) {
   // parameters
@@ -65,31 +75,6 @@ void SamplingPolicy::Reset(int horizon, const double* initial_repeated_action) {
   std::fill(times.begin(), times.begin() + horizon, 0.0);
 }
 
-// set action from policy
-void SamplingPolicy::Action(double* action, const double* state,
-                            double time) const {
-  // find times bounds
-  int bounds[2];
-  FindInterval(bounds, times, time, num_spline_points);
-
-  // ----- get action ----- //
-
-  if (bounds[0] == bounds[1] ||
-      representation == PolicyRepresentation::kZeroSpline) {
-    ZeroInterpolation(action, time, times, parameters.data(), model->nu,
-                      num_spline_points);
-  } else if (representation == PolicyRepresentation::kLinearSpline) {
-    LinearInterpolation(action, time, times, parameters.data(), model->nu,
-                        num_spline_points);
-  } else if (representation == PolicyRepresentation::kCubicSpline) {
-    CubicInterpolation(action, time, times, parameters.data(), model->nu,
-                       num_spline_points);
-  }
-
-  // Clamp controls
-  Clamp(action, model->actuator_ctrlrange, model->nu);
-}
-
 // copy policy
 void SamplingPolicy::CopyFrom(const SamplingPolicy& policy, int horizon) {
   mju_copy(parameters.data(), policy.parameters.data(), policy.num_parameters);
@@ -107,4 +92,96 @@ void SamplingPolicy::CopyParametersFrom(
   mju_copy(times.data(), src_times.data(), num_spline_points);
 }
 
+// set actions from policy at action_times
+void SamplingPolicy::Actions(double* actions, const double* action_times,
+                             int n) const {
+  SamplingPolicyEvaluator evaluator(*this);
+  for (int i = 0; i < n; i++) {
+    evaluator.Action(actions + i * model->nu, action_times[i]);
+  }
+}
+
+// set knots to the trajectory's actions, spaced uniformly over its horizon
+void SamplingPolicy::SetFromTrajectory(const Trajectory& trajectory) {
+  int num_action = trajectory.horizon - 1;
+  if (num_action < 1) return;
+  double time_shift =
+      mju_max(num_action * model->opt.timestep / (num_spline_points - 1),
+              1.0e-5);
+  LinearRange(times.data(), time_shift, trajectory.times[0],
+              num_spline_points);
+  for (int t = 0; t < num_spline_points; t++) {
+    ZeroInterpolation(DataAt(parameters, t * model->nu), times[t],
+                      trajectory.times, trajectory.actions.data(), model->nu,
+                      num_action);
+  }
+}
+
+SamplingPolicyEvaluator::SamplingPolicyEvaluator(
+    const SamplingPolicy& policy)
+    : policy_(policy) {
+  if (policy.representation == PolicyRepresentation::kCubicSpline) {
+    slopes_.resize(2 * policy.model->nu);
+  }
+}
+
+// cache slopes at knots lower and lower + 1
+void SamplingPolicyEvaluator::UpdateSlopes(int lower) {
+  const std::vector<double>& times = policy_.times;
+  const double* parameters = policy_.parameters.data();
+  int num_spline_points = policy_.num_spline_points;
+  int nu = policy_.model->nu;
+
+  // the next interval shares a knot with the cached one
+  if (lower == slopes_lower_ + 1 && slopes_lower_ >= 0) {
+    mju_copy(slopes_.data(), slopes_.data() + nu, nu);
+  } else {
+    KnotSlopes(slopes_.data(), times, parameters, nu, num_spline_points,
+               lower);
+  }
+  KnotSlopes(slopes_.data() + nu, times, parameters, nu, num_spline_points,
+             lower + 1);
+  slopes_lower_ = lower;
+}
+
+void SamplingPolicy::Snapshot(SnapshotWriter& writer,
+                              std::string_view name) const {
+  writer.Add(absl::StrCat(name, ".representation"),
+             static_cast<double>(representation));
+  writer.Add(absl::StrCat(name, ".num_spline_points"), num_spline_points);
+  writer.Add(absl::StrCat(name, ".parameters"), parameters.data(),
+             num_spline_points * model->nu);
+  writer.Add(absl::StrCat(name, ".times"), times.data(), num_spline_points);
+}
+
+bool SamplingPolicy::Restore(const SnapshotReader& reader,
+                             std::string_view name) {
+  int n = reader.Get(absl::StrCat(name, ".num_spline_points"), -1);
+  int nu = model->nu;
+  if (n < 1 || n > static_cast<int>(times.size()) ||
+      reader.Size(absl::StrCat(name, ".parameters")) != n * nu ||
+      reader.Size(absl::StrCat(name, ".times")) != n) {
+    return false;
+  }
+  num_spline_points = n;
+  representation = static_cast<PolicyRepresentation>(
+      reader.Get(absl::StrCat(name, ".representation"), representation));
+  reader.Read(absl::StrCat(name, ".parameters"), parameters.data(), n * nu);
+  reader.Read(absl::StrCat(name, ".times"), times.data(), n);
+  return true;
+}
+
+void SamplingPolicy::Export(ExportedPolicy& exported) const {
+  SetExportedModel(exported, model);
+  exported.kind = ExportedPolicyKind::kSpline;
+  exported.representation = representation;
+  exported.times.assign(times.begin(), times.begin() + num_spline_points);
+  exported.actions.assign(parameters.begin(),
+                          parameters.begin() + num_spline_points * model->nu);
+  exported.states.clear();
+  exported.gains.clear();
+  exported.joints.clear();
+  exported.feedback_scaling = 1.0;
+}
+
 }  // namespace mjpc
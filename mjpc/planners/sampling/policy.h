@@ -15,17 +15,25 @@
 #ifndef MJPC_PLANNERS_SAMPLING_POLICY_H_
 #define MJPC_PLANNERS_SAMPLING_POLICY_H_
 
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
 #include <vector>
 
+#include <absl/container/inlined_vector.h>
 #include <absl/random/distributions.h>
 #include <absl/random/random.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/planners/policy.h"
+#include "mjpc/policy_export.h"
+#include "mjpc/snapshot.h"
+#include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 
 // policy for sampling planner
-class SamplingPolicy : public Policy {
+class SamplingPolicy final : public Policy {
  public:
   // constructor
   SamplingPolicy() = default;
@@ -38,13 +46,21 @@ class SamplingPolicy : public Policy {
   // allocate memory
   void Allocate(const mjModel* model, const Task& task, int horizon) override;
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros
   void Reset(int horizon,
              const double* initial_repeated_action = nullptr) override;
 
-  // set action from policy
+  // set action from policy. defined inline so that rollouts taking a
+  // SamplingPolicy evaluate it without an indirect call.
   void Action(double* action, const double* state, double time) const override;
 
+  // set actions (n x nu) from policy at action_times (n). nondecreasing times
+  // are evaluated incrementally with a SamplingPolicyEvaluator.
+  void Actions(double* actions, const double* action_times, int n) const;
+
   // copy policy
   void CopyFrom(const SamplingPolicy& policy, int horizon);
 
@@ -52,6 +68,17 @@ class SamplingPolicy : public Policy {
   void CopyParametersFrom(const std::vector<double>& src_parameters,
                           const std::vector<double>& src_times);
 
+  // set knots to the trajectory's actions, spaced uniformly over its horizon
+  void SetFromTrajectory(const Trajectory& trajectory);
+
+  // write the representation and knots as sections name.*. Restore returns
+  // false, leaving the policy unchanged, if they don't fit the allocation.
+  void Snapshot(SnapshotWriter& writer, std::string_view name) const;
+  bool Restore(const SnapshotReader& reader, std::string_view name);
+
+  // set the knots of an exported spline policy
+  void Export(ExportedPolicy& exported) const;
+
   // ----- members ----- //
   const mjModel* model;
   std::vector<double> parameters;
@@ -61,6 +88,120 @@ class SamplingPolicy : public Policy {
   PolicyRepresentation representation;
 };
 
+// set action from policy
+inline void SamplingPolicy::Action(double* action, const double* state,
+                                   double time) const {
+  // find times bounds
+  int bounds[2];
+  FindInterval(bounds, times, time, num_spline_points);
+
+  // ----- get action ----- //
+
+  if (bounds[0] == bounds[1] ||
+      representation == PolicyRepresentation::kZeroSpline) {
+    ZeroInterpolation(action, time, times, parameters.data(), model->nu,
+                      num_spline_points);
+  } else if (representation == PolicyRepresentation::kLinearSpline) {
+    LinearInterpolation(action, time, times, parameters.data(), model->nu,
+                        num_spline_points);
+  } else if (representation == PolicyRepresentation::kCubicSpline) {
+    CubicInterpolation(action, time, times, parameters.data(), model->nu,
+                       num_spline_points);
+  }
+
+  // Clamp controls
+  Clamp(action, model->actuator_ctrlrange, model->nu);
+}
+
+// evaluates a policy at nondecreasing times, e.g., along a rollout. the
+// current knot interval and, for cubic splines, the slopes at its knots are
+// cached and advanced incrementally instead of searched at every call.
+// actions match SamplingPolicy::Action, earlier times fall back to a search.
+// the policy must not change while evaluated.
+class SamplingPolicyEvaluator {
+ public:
+  // slopes of up to this many actions are cached without allocating
+  static constexpr int kInlineActions = 32;
+
+  explicit SamplingPolicyEvaluator(const SamplingPolicy& policy);
+
+  // set action from policy at time
+  void Action(double* action, double time);
+
+ private:
+  // cache slopes at knots lower and lower + 1
+  void UpdateSlopes(int lower);
+
+  const SamplingPolicy& policy_;
+  int lower_ = -1;      // last knot at or before time, -1 before the first
+  bool found_ = false;  // lower_ is set
+  int slopes_lower_ = -1;  // lower knot of cached slopes, -1 for none
+  // (2 x nu) slopes at the interval's knots
+  absl::InlinedVector<double, 2 * kInlineActions> slopes_;
+};
+
+// set action from policy at time
+inline void SamplingPolicyEvaluator::Action(double* action, double time) {
+  const std::vector<double>& times = policy_.times;
+  const double* parameters = policy_.parameters.data();
+  int num_spline_points = policy_.num_spline_points;
+  int nu = policy_.model->nu;
+
+  // advance interval, search after a step back in time
+  if (!found_ || (lower_ >= 0 && time < times[lower_])) {
+    lower_ = std::upper_bound(times.begin(),
+                              times.begin() + num_spline_points, time) -
+             times.begin() - 1;
+    found_ = true;
+  } else {
+    while (lower_ + 1 < num_spline_points && times[lower_ + 1] <= time) {
+      lower_++;
+    }
+  }
+
+  // bounds, as in FindInterval
+  int bounds[2];
+  if (lower_ < 0) {
+    bounds[0] = bounds[1] = 0;
+  } else if (lower_ >= num_spline_points - 1) {
+    bounds[0] = bounds[1] = num_spline_points - 1;
+  } else {
+    bounds[0] = lower_;
+    bounds[1] = lower_ + 1;
+  }
+
+  // ----- get action ----- //
+
+  if (bounds[0] == bounds[1] ||
+      policy_.representation == PolicyRepresentation::kZeroSpline) {
+    mju_copy(action, parameters + nu * bounds[0], nu);
+  } else if (policy_.representation == PolicyRepresentation::kLinearSpline) {
+    double t =
+        (time - times[bounds[0]]) / (times[bounds[1]] - times[bounds[0]]);
+    mju_scl(action, parameters + nu * bounds[0], 1.0 - t, nu);
+    mju_addScl(action, action, parameters + nu * bounds[1], t, nu);
+  } else if (policy_.representation == PolicyRepresentation::kCubicSpline) {
+    if (slopes_lower_ != bounds[0]) UpdateSlopes(bounds[0]);
+
+    // coefficients, as in CubicCoefficients
+    double dt = times[bounds[1]] - times[bounds[0]];
+    double t = (time - times[bounds[0]]) / dt;
+    double c0 = 2.0 * t * t * t - 3.0 * t * t + 1.0;
+    double c1 = (t * t * t - 2.0 * t * t + t) * dt;
+    double c2 = -2.0 * t * t * t + 3 * t * t;
+    double c3 = (t * t * t - t * t) * dt;
+    const double* p0 = parameters + nu * bounds[0];
+    const double* p1 = parameters + nu * bounds[1];
+    for (int i = 0; i < nu; i++) {
+      action[i] = c0 * p0[i] + c1 * slopes_[i] + c2 * p1[i] +
+                  c3 * slopes_[nu + i];
+    }
+  }
+
+  // Clamp controls
+  Clamp(action, policy_.model->actuator_ctrlrange, nu);
+}
+
 }  // namespace mjpc
 
 #endif  // MJPC_PLANNERS_SAMPLING_POLICY_H_
@@ -0,0 +1,104 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/sampling/remote.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/random.h"
+#include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+void RemoteSamplePolicy(SamplingPolicy* candidate,
+                        const SamplingPolicy& nominal,
+                        const RemoteSampleBatch& batch, int sample,
+                        double* noise) {
+  const mjModel* model = candidate->model;
+  int nu = model->nu;
+  candidate->CopyFrom(nominal, nominal.num_spline_points);
+  candidate->representation = nominal.representation;
+  int num_spline_points = candidate->num_spline_points;
+  int num_parameters = nu * num_spline_points;
+
+  // a stream per sample and iteration, independent of the planner's streams
+  RandomStream stream(batch.noise_seed, sample);
+  stream.SetCounter(batch.noise_iteration << 32);
+  int num_synergies = batch.synergies.size() / nu;
+  if (num_synergies) {
+    // coordinates in the span of the planner's synergies
+    std::vector<double> coordinates(num_spline_points * num_synergies);
+    BatchGaussian(coordinates.data(), coordinates.size(),
+                  batch.noise_exploration, batch.noise_sampling, sample,
+                  batch.noise_seed, batch.noise_iteration, stream);
+    CorrelateRows(coordinates.data(), num_spline_points, num_synergies,
+                  batch.noise_correlation);
+    ExpandRows(noise, coordinates.data(), batch.synergies.data(),
+               num_spline_points, num_synergies, nu);
+  } else {
+    BatchGaussian(noise, num_parameters, batch.noise_exploration,
+                  batch.noise_sampling, sample, batch.noise_seed,
+                  batch.noise_iteration, stream);
+    CorrelateRows(noise, num_spline_points, nu, batch.noise_correlation);
+  }
+
+  // keep shared spline points at the nominal
+  int num_shared = std::min(batch.shared_prefix, num_spline_points);
+  mju_zero(noise, nu * num_shared);
+  mju_addTo(candidate->parameters.data(), noise, num_parameters);
+  for (int t = num_shared; t < num_spline_points; t++) {
+    Clamp(DataAt(candidate->parameters, t * nu), model->actuator_ctrlrange,
+          nu);
+  }
+}
+
+void SetRemoteBest(RemoteSampleResult* result, int sample,
+                   const Trajectory& trajectory) {
+  int horizon = trajectory.horizon;
+  result->best = sample;
+  result->best_return = trajectory.total_return;
+  result->horizon = horizon;
+  auto copy = [](std::vector<double>& dst, const std::vector<double>& src,
+                 int n) { dst.assign(src.begin(), src.begin() + n); };
+  copy(result->states, trajectory.states, horizon * trajectory.dim_state);
+  copy(result->actions, trajectory.actions, horizon * trajectory.dim_action);
+  copy(result->times, trajectory.times, horizon);
+  copy(result->residual, trajectory.residual,
+       horizon * trajectory.dim_residual);
+  copy(result->costs, trajectory.costs, horizon);
+  copy(result->trace, trajectory.trace, horizon * trajectory.dim_trace);
+}
+
+void GetRemoteBest(Trajectory* trajectory, const RemoteSampleResult& result) {
+  trajectory->horizon = result.horizon;
+  auto copy = [](std::vector<double>& dst, const std::vector<double>& src) {
+    std::copy_n(src.begin(), std::min(src.size(), dst.size()), dst.begin());
+  };
+  copy(trajectory->states, result.states);
+  copy(trajectory->actions, result.actions);
+  copy(trajectory->times, result.times);
+  copy(trajectory->residual, result.residual);
+  copy(trajectory->costs, result.costs);
+  copy(trajectory->trace, result.trace);
+  trajectory->total_return = result.best_return;
+  trajectory->failure = false;
+  trajectory->pruned = false;
+}
+
+}  // namespace mjpc
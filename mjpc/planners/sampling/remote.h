@@ -0,0 +1,130 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Sampling planner rollouts on remote workers. A worker holds the same
+// planning model and task as the planner and evaluates samples of an
+// iteration from a compact description: the start state, the nominal policy
+// and the noise seed. The noise of a remote sample only depends on
+// (seed, iteration, sample), so the planner reproduces the policy of a remote
+// winner instead of receiving it.
+
+#ifndef MJPC_PLANNERS_SAMPLING_REMOTE_H_
+#define MJPC_PLANNERS_SAMPLING_REMOTE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/trajectory.h"
+
+namespace mjpc {
+
+// samples [begin, end) of a sampling planner iteration
+struct RemoteSampleBatch {
+  // start of the rollouts
+  std::vector<double> state;  // (nq + nv + na)
+  std::vector<double> mocap;  // (7 x nmocap)
+  std::vector<double> userdata;
+  double time = 0.0;
+
+  // planning model settings of the iteration
+  double timestep = 0.0;
+  int integrator = 0;
+
+  // rollouts cover horizon uniform steps with the schedule
+  int horizon = 0;
+  int fine_steps = 0;
+  int coarse_factor = 1;
+
+  // nominal policy
+  int representation = 0;
+  int num_spline_points = 0;
+  std::vector<double> parameters;  // (num_spline_points x nu)
+  std::vector<double> times;       // (num_spline_points)
+
+  // task
+  std::vector<double> task_parameters;
+  std::vector<double> weights;
+
+  // noise
+  double noise_exploration = 0.0;
+  double noise_correlation = 0.0;
+  int noise_sampling = 0;
+  std::vector<double> synergies;  // (synergies x nu), empty for all actuators
+  int shared_prefix = 0;
+  std::uint64_t noise_seed = 0;
+  std::uint64_t noise_iteration = 0;
+
+  // stop rollouts that cannot beat the best sample
+  bool pruning = false;
+
+  // sample indices, begin >= 1
+  int begin = 0;
+  int end = 0;
+};
+
+// returns of a batch and the rollout of its best sample
+struct RemoteSampleResult {
+  std::vector<double> total_return;  // (end - begin), infinite if not run
+  int best = -1;                     // best sample index, -1 for none
+  double best_return = std::numeric_limits<double>::infinity();
+
+  // rollout of the best sample
+  int horizon = 0;
+  std::vector<double> states;
+  std::vector<double> actions;
+  std::vector<double> times;
+  std::vector<double> residual;
+  std::vector<double> costs;
+  std::vector<double> trace;
+};
+
+// set candidate to the nominal policy plus the noise of sample. noise is
+// scratch for the sample's parameters.
+void RemoteSamplePolicy(SamplingPolicy* candidate,
+                        const SamplingPolicy& nominal,
+                        const RemoteSampleBatch& batch, int sample,
+                        double* noise);
+
+// record the rollout of sample as the best
+void SetRemoteBest(RemoteSampleResult* result, int sample,
+                   const Trajectory& trajectory);
+
+// copy the rollout of the best sample into trajectory, which is allocated
+// for at least result.horizon steps
+void GetRemoteBest(Trajectory* trajectory, const RemoteSampleResult& result);
+
+// a backend that evaluates samples on remote workers
+class RemoteRollouts {
+ public:
+  virtual ~RemoteRollouts() = default;
+
+  // samples per iteration, 0 to disable
+  virtual int NumSamples() const = 0;
+
+  // start evaluating batch and return. rollouts that haven't finished by
+  // deadline are dropped; a default time point means the backend's timeout.
+  virtual void Start(const RemoteSampleBatch& batch,
+                     std::chrono::steady_clock::time_point deadline) = 0;
+
+  // wait for the started batch and merge the results of all workers. false
+  // if no sample was evaluated.
+  virtual bool Wait(RemoteSampleResult* result) = 0;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLANNERS_SAMPLING_REMOTE_H_
@@ -0,0 +1,241 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planning_model.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_format.h>
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+namespace {
+
+// replace a mesh geom by the box bounding its vertices
+void MeshToBox(mjModel* m, int geom) {
+  int mesh = m->geom_dataid[geom];
+  int adr = m->mesh_vertadr[mesh];
+  int num = m->mesh_vertnum[mesh];
+  if (num == 0) return;
+
+  // bounds of the vertices, in the geom frame
+  double lower[3], upper[3];
+  for (int k = 0; k < 3; k++) {
+    lower[k] = upper[k] = m->mesh_vert[3 * adr + k];
+  }
+  for (int i = 1; i < num; i++) {
+    for (int k = 0; k < 3; k++) {
+      double v = m->mesh_vert[3 * (adr + i) + k];
+      lower[k] = std::min(lower[k], v);
+      upper[k] = std::max(upper[k], v);
+    }
+  }
+
+  // box centered on the bounds
+  double center[3], offset[3];
+  for (int k = 0; k < 3; k++) {
+    center[k] = 0.5 * (lower[k] + upper[k]);
+    double half = 0.5 * (upper[k] - lower[k]);
+    m->geom_size[3 * geom + k] = mju_max(half, mjMINVAL);
+  }
+  mju_rotVecQuat(offset, center, m->geom_quat + 4 * geom);
+  mju_addTo3(m->geom_pos + 3 * geom, offset);
+  m->geom_type[geom] = mjGEOM_BOX;
+  m->geom_dataid[geom] = -1;
+  m->geom_rbound[geom] = mju_norm3(m->geom_size + 3 * geom);
+}
+
+// set the first value of numeric name, if the model has it
+void SetNumeric(mjModel* m, const char* name, double value) {
+  int id = mj_name2id(m, mjOBJ_NUMERIC, name);
+  if (id >= 0 && m->numeric_size[id] > 0) {
+    m->numeric_data[m->numeric_adr[id]] = value;
+  }
+}
+
+// result of the rollouts of one model
+struct Rollout {
+  int steps = 0;
+  double cost = 0.0;
+  double step_time = 0.0;  // microseconds
+  std::vector<double> qpos;
+};
+
+// roll out policy from state, with the agent's time step and integrator
+Rollout RollOut(const mjModel* model, const ResidualFn& residual_fn,
+                int num_residual, const State& state,
+                const PlanningPolicy& policy, double horizon, int num_repeat) {
+  mjModel m = *model;
+  m.opt.timestep = GetNumberOrDefault(1.0e-2, model, "agent_timestep");
+  m.opt.integrator =
+      GetNumberOrDefault(model->opt.integrator, model, "agent_integrator");
+  UniqueMjData data = MakeUniqueMjData(mj_makeData(&m));
+  mjData* d = data.get();
+
+  Rollout rollout;
+  rollout.steps = mju_max(std::round(horizon / m.opt.timestep), 1);
+  std::vector<double> residual(num_residual);
+  std::vector<double> x(m.nq + m.nv + m.na);
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < num_repeat; r++) {
+    state.CopyTo(&m, d);
+    rollout.cost = 0.0;
+    for (int t = 0; t < rollout.steps; t++) {
+      mj_forward(&m, d);
+      residual_fn.Residual(&m, d, residual.data());
+      rollout.cost += residual_fn.CostValue(residual.data());
+
+      // action
+      mju_copy(x.data(), d->qpos, m.nq);
+      mju_copy(x.data() + m.nq, d->qvel, m.nv);
+      mju_copy(x.data() + m.nq + m.nv, d->act, m.na);
+      policy(d->ctrl, x.data(), d->time);
+
+      mj_step(&m, d);
+    }
+  }
+  rollout.step_time = GetDuration(start) / (num_repeat * rollout.steps);
+  rollout.cost /= rollout.steps;
+  rollout.qpos.assign(d->qpos, d->qpos + m.nq);
+  return rollout;
+}
+
+}  // namespace
+
+bool PlanningModelOptions::Enabled() const {
+  return mesh_geoms != kMeshKeep || drop_visual_geoms ||
+         solver_iterations > 0 || solver_tolerance > 0.0 || integrator >= 0 ||
+         timestep_scale != 1.0;
+}
+
+PlanningModelOptions PlanningModelOptionsFromModel(const mjModel* model) {
+  PlanningModelOptions options;
+  options.mesh_geoms =
+      GetNumberOrDefault(options.mesh_geoms, model, "planning_mesh_geoms");
+  options.drop_visual_geoms = GetNumberOrDefault(
+      options.drop_visual_geoms, model, "planning_drop_visual_geoms");
+  options.visual_group =
+      GetNumberOrDefault(options.visual_group, model, "planning_visual_group");
+  options.solver_iterations = GetNumberOrDefault(
+      options.solver_iterations, model, "planning_solver_iterations");
+  options.solver_tolerance = GetNumberOrDefault(
+      options.solver_tolerance, model, "planning_solver_tolerance");
+  options.integrator =
+      GetNumberOrDefault(options.integrator, model, "planning_integrator");
+  options.timestep_scale = GetNumberOrDefault(
+      options.timestep_scale, model, "planning_timestep_scale");
+  return options;
+}
+
+UniqueMjModel SimplifyPlanningModel(const mjModel* model,
+                                    const PlanningModelOptions& options) {
+  mjModel* m = mj_copyModel(nullptr, model);
+
+  // geoms
+  for (int i = 0; i < m->ngeom; i++) {
+    bool collides = m->geom_contype[i] || m->geom_conaffinity[i];
+    bool visual = m->geom_group[i] == options.visual_group;
+    if (options.drop_visual_geoms && visual) {
+      m->geom_contype[i] = 0;
+      m->geom_conaffinity[i] = 0;
+      collides = false;
+    }
+    // visual meshes are kept for rendering
+    if (options.mesh_geoms == PlanningModelOptions::kMeshBox && collides &&
+        m->geom_type[i] == mjGEOM_MESH && m->geom_dataid[i] >= 0) {
+      MeshToBox(m, i);
+    }
+  }
+
+  // solver
+  if (options.solver_iterations > 0) {
+    m->opt.iterations = options.solver_iterations;
+  }
+  if (options.solver_tolerance > 0.0) {
+    m->opt.tolerance = options.solver_tolerance;
+  }
+
+  // integrator, also of the agent
+  if (options.integrator >= 0) {
+    m->opt.integrator = options.integrator;
+    SetNumeric(m, "agent_integrator", options.integrator);
+  }
+
+  // time step, also of the agent
+  if (options.timestep_scale != 1.0) {
+    m->opt.timestep *= options.timestep_scale;
+    SetNumeric(m, "agent_timestep",
+               options.timestep_scale *
+                   GetNumberOrDefault(1.0e-2, model, "agent_timestep"));
+  }
+
+  return {m, mj_deleteModel};
+}
+
+std::string PlanningModelReport::ToString() const {
+  return absl::StrFormat(
+      "horizon: %g s (%d full, %d simplified steps)\n"
+      "cost: %g full, %g simplified (relative error %.3g)\n"
+      "final position error: %g\n"
+      "step time: %.3g us full, %.3g us simplified\n"
+      "rollout speedup: %.3gx\n",
+      horizon, full_steps, simplified_steps, full_cost, simplified_cost,
+      cost_error, state_error, full_step_time, simplified_step_time, speedup);
+}
+
+PlanningModelReport CalibratePlanningModel(const mjModel* full,
+                                           const mjModel* simplified,
+                                           const Task& task,
+                                           const State& state,
+                                           const PlanningPolicy& policy,
+                                           double horizon, int num_repeat) {
+  std::unique_ptr<ResidualFn> residual_fn = task.Residual();
+  num_repeat = mju_max(num_repeat, 1);
+  Rollout a = RollOut(full, *residual_fn, task.num_residual, state, policy,
+                      horizon, num_repeat);
+  Rollout b = RollOut(simplified, *residual_fn, task.num_residual, state,
+                      policy, horizon, num_repeat);
+
+  PlanningModelReport report;
+  report.horizon = horizon;
+  report.full_steps = a.steps;
+  report.simplified_steps = b.steps;
+  report.full_cost = a.cost;
+  report.simplified_cost = b.cost;
+  report.cost_error =
+      mju_abs(b.cost - a.cost) / mju_max(mju_abs(a.cost), mjMINVAL);
+  std::vector<double> difference(full->nv);
+  mj_differentiatePos(full, difference.data(), 1.0, a.qpos.data(),
+                      b.qpos.data());
+  for (double value : difference) {
+    report.state_error = mju_max(report.state_error, mju_abs(value));
+  }
+  report.full_step_time = a.step_time;
+  report.simplified_step_time = b.step_time;
+  double full_time = a.step_time * a.steps;
+  double simplified_time = b.step_time * b.steps;
+  report.speedup = full_time / mju_max(simplified_time, mjMINVAL);
+  return report;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,104 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cheaper planning models derived from a task model. The simplified model
+// keeps the sizes, names and sensors of the task model, so it can be passed
+// to Agent::OverrideModel or Agent::Initialize while the full model is
+// simulated. CalibratePlanningModel reports how much the simplification
+// changes the cost of a policy on the task.
+
+#ifndef MJPC_PLANNING_MODEL_H_
+#define MJPC_PLANNING_MODEL_H_
+
+#include <functional>
+#include <string>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+
+// simplifications of a planning model, the defaults keep the model unchanged
+struct PlanningModelOptions {
+  // collision geometry of mesh geoms
+  enum MeshGeoms {
+    kMeshKeep = 0,  // convex hull of the mesh (MuJoCo's mesh collisions)
+    kMeshBox = 1,   // box bounding the mesh vertices in the geom frame
+  };
+  int mesh_geoms = kMeshKeep;
+
+  // exclude geoms of visual_group from collisions, e.g., visual meshes that
+  // collide by default. geoms that never collide are visual-only already.
+  int drop_visual_geoms = 0;  // flag
+  int visual_group = 2;
+
+  int solver_iterations = 0;      // opt.iterations, 0: keep
+  double solver_tolerance = 0.0;  // opt.tolerance, 0: keep
+  // integrator and time step, also written to the agent_integrator and
+  // agent_timestep numerics if the model has them
+  int integrator = -1;            // opt.integrator, -1: keep
+  double timestep_scale = 1.0;    // scale of opt.timestep
+
+  // true if any option changes the model
+  bool Enabled() const;
+};
+
+// options from the model's numerics (planning_mesh_geoms,
+// planning_drop_visual_geoms, planning_visual_group,
+// planning_solver_iterations, planning_solver_tolerance,
+// planning_integrator, planning_timestep_scale), defaults otherwise
+PlanningModelOptions PlanningModelOptionsFromModel(const mjModel* model);
+
+// copy of model with options applied
+UniqueMjModel SimplifyPlanningModel(const mjModel* model,
+                                    const PlanningModelOptions& options);
+
+// action for state (qpos, qvel, act) at time
+using PlanningPolicy =
+    std::function<void(double* action, const double* state, double time)>;
+
+// rollout costs of a policy with the full and simplified models
+struct PlanningModelReport {
+  double horizon = 0.0;            // rollout duration (seconds)
+  int full_steps = 0;              // rollout steps of each model
+  int simplified_steps = 0;
+  double full_cost = 0.0;          // time-averaged cost over the horizon
+  double simplified_cost = 0.0;
+  double cost_error = 0.0;         // |simplified - full| / max(|full|, eps)
+  double state_error = 0.0;        // max norm of the final position difference
+  double full_step_time = 0.0;     // wall time per rollout step (microseconds)
+  double simplified_step_time = 0.0;
+  double speedup = 0.0;            // full / simplified rollout wall time
+
+  // human-readable summary, one value per line
+  std::string ToString() const;
+};
+
+// roll out policy from state for horizon seconds with each model, at the
+// models' agent_timestep and agent_integrator, and compare the costs of the
+// task's residual. the task must be reset with a model with the same
+// sensors. rollouts are repeated num_repeat times for timing.
+PlanningModelReport CalibratePlanningModel(const mjModel* full,
+                                           const mjModel* simplified,
+                                           const Task& task,
+                                           const State& state,
+                                           const PlanningPolicy& policy,
+                                           double horizon,
+                                           int num_repeat = 1);
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLANNING_MODEL_H_
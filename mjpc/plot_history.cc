@@ -0,0 +1,79 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/plot_history.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+void PlotHistory::Allocate(const std::vector<int>& lines, int capacity) {
+  lines_ = lines;
+  capacity_ = std::clamp(capacity, 1, mjMAXLINEPNT);
+  points_.assign(2 * lines_.size() * capacity_, 0.0f);
+  head_.assign(lines_.size(), -1);
+  size_.assign(lines_.size(), 0);
+}
+
+void PlotHistory::Clear() {
+  std::fill(head_.begin(), head_.end(), -1);
+  std::fill(size_.begin(), size_.end(), 0);
+}
+
+void PlotHistory::Add(int i, double x, double y) {
+  head_[i] = (head_[i] + 1) % capacity_;
+  float* point = points_.data() + 2 * (i * capacity_ + head_[i]);
+  point[0] = x;
+  point[1] = y;
+  size_[i] = std::min(size_[i] + 1, capacity_);
+}
+
+void PlotHistory::Bounds(int i, double x_lower, double bounds[2]) const {
+  const float* points = points_.data() + 2 * i * capacity_;
+  for (int p = 0, index = head_[i]; p < size_[i]; p++) {
+    const float* point = points + 2 * index;
+    if (point[0] <= x_lower) break;
+    bounds[0] = std::min(bounds[0], static_cast<double>(point[1]));
+    bounds[1] = std::max(bounds[1], static_cast<double>(point[1]));
+    index = index > 0 ? index - 1 : capacity_ - 1;
+  }
+}
+
+void PlotHistory::Write(mjvFigure* fig) const {
+  int num_lines = lines_.size();
+  for (int i = 0; i < num_lines; i++) {
+    int line = lines_[i];
+    if (line < 0 || line >= mjMAXLINE) continue;
+    const float* points = points_.data() + 2 * i * capacity_;
+    float* data = fig->linedata[line];
+
+    // newest to the first point of the buffer, then the wrapped points
+    int newest = std::min(head_[i] + 1, size_[i]);
+    for (int p = 0; p < newest; p++) {
+      data[2 * p] = points[2 * (head_[i] - p)];
+      data[2 * p + 1] = points[2 * (head_[i] - p) + 1];
+    }
+    for (int p = newest; p < size_[i]; p++) {
+      int index = capacity_ + head_[i] - p;
+      data[2 * p] = points[2 * index];
+      data[2 * p + 1] = points[2 * index + 1];
+    }
+    fig->linepnt[line] = size_[i];
+  }
+}
+
+}  // namespace mjpc
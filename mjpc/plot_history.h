@@ -0,0 +1,58 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_PLOT_HISTORY_H_
+#define MJPC_PLOT_HISTORY_H_
+
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// ring buffers with the latest points of figure lines. adding a point is
+// O(1), unlike PlotUpdateData which shifts the whole line. the lines are
+// copied into the figure by Write, when it is drawn.
+class PlotHistory {
+ public:
+  // histories for the figure lines, capacity points each, cleared
+  void Allocate(const std::vector<int>& lines, int capacity);
+
+  // remove all points
+  void Clear();
+
+  // add the newest point to the i-th history
+  void Add(int i, double x, double y);
+
+  // extend bounds (y lower, y upper) with the points of the i-th history with
+  // x > x_lower. points are added with increasing x, the scan stops at the
+  // first point outside.
+  void Bounds(int i, double x_lower, double bounds[2]) const;
+
+  // write the histories into their figure lines, newest point first
+  void Write(mjvFigure* fig) const;
+
+  int Size(int i) const { return size_[i]; }
+
+ private:
+  std::vector<int> lines_;    // figure line of each history
+  int capacity_ = 0;
+  std::vector<float> points_;  // (x, y) (lines x capacity)
+  std::vector<int> head_;      // newest point
+  std::vector<int> size_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_PLOT_HISTORY_H_
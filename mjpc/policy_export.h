@@ -0,0 +1,480 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compact exports of a published policy, evaluated without MuJoCo, e.g., by
+// a robot's controller between GetPolicy calls. This header depends only on
+// the standard library, python/mujoco_mpc/policy.py is a Python evaluator.
+// Layout, in native byte order, 8 bytes per field:
+//   header: magic "MJPCPLCY", format version, policy version, kind,
+//           representation, dim_action, nq, nv, na (uint64)
+//   arrays: times, actions, states, gains, ctrlrange (size (uint64), doubles)
+//           joints (size (uint64), int64)
+//   footer: feedback_scaling (double)
+
+#ifndef MJPC_POLICY_EXPORT_H_
+#define MJPC_POLICY_EXPORT_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mjpc {
+
+inline constexpr char kPolicyExportMagic[8] = {'M', 'J', 'P', 'C',
+                                               'P', 'L', 'C', 'Y'};
+inline constexpr std::uint64_t kPolicyExportVersion = 1;
+
+// exported joint types, as mjtJoint
+inline constexpr int kExportFreeJoint = 0;
+inline constexpr int kExportBallJoint = 1;
+
+// policy kinds
+enum class ExportedPolicyKind : int {
+  // action spline: actions at knot times
+  kSpline = 0,
+  // nominal trajectory with feedback: states at horizon times, actions and
+  // gains at the first horizon - 1 times
+  kFeedback = 1,
+};
+
+// a policy's parameters, for SamplingPolicy, GradientPolicy and iLQGPolicy
+struct ExportedPolicy {
+  std::uint64_t version = 0;  // increases with every published policy
+  ExportedPolicyKind kind = ExportedPolicyKind::kSpline;
+  int representation = 0;  // 0: zero, 1: linear, 2: cubic interpolation
+  int dim_action = 0;
+  int nq = 0, nv = 0, na = 0;  // state dimensions, for feedback
+
+  std::vector<double> times;      // knots
+  std::vector<double> actions;    // (knots x dim_action)
+  std::vector<double> states;     // feedback (horizon x (nq + nv + na))
+  std::vector<double> gains;      // feedback (knots x dim_action x
+                                  //   (2 nv + na))
+  std::vector<double> ctrlrange;  // (dim_action x 2)
+  std::vector<std::int64_t> joints;  // (joints x 3): type, qpos and dof
+                                     //   address, for feedback
+  double feedback_scaling = 1.0;
+
+  int DimensionState() const { return nq + nv + na; }
+  int DimensionStateDerivative() const { return 2 * nv + na; }
+};
+
+namespace policy_export_internal {
+
+template <typename T>
+void Append(std::string& bytes, const T& value) {
+  bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void AppendArray(std::string& bytes, const std::vector<T>& values) {
+  Append(bytes, static_cast<std::uint64_t>(values.size()));
+  bytes.append(reinterpret_cast<const char*>(values.data()),
+               values.size() * sizeof(T));
+}
+
+// reads values from bytes, false once truncated
+class Reader {
+ public:
+  explicit Reader(std::string_view bytes) : bytes_(bytes) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (bytes_.size() - offset_ < sizeof(T)) return false;
+    std::memcpy(value, bytes_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  template <typename T>
+  bool ReadArray(std::vector<T>* values) {
+    std::uint64_t size;
+    if (!Read(&size) || (bytes_.size() - offset_) / sizeof(T) < size) {
+      return false;
+    }
+    values->resize(size);
+    std::memcpy(values->data(), bytes_.data() + offset_, size * sizeof(T));
+    offset_ += size * sizeof(T);
+    return true;
+  }
+
+ private:
+  std::string_view bytes_;
+  std::size_t offset_ = 0;
+};
+
+// knot interval of x in the first length xs, like FindInterval
+inline void Interval(int* bounds, const std::vector<double>& xs, double x,
+                     int length) {
+  int upper = std::upper_bound(xs.begin(), xs.begin() + std::max(length, 0),
+                               x) -
+              xs.begin();
+  if (upper < 1) {
+    bounds[0] = 0;
+    bounds[1] = 0;
+  } else {
+    bounds[0] = upper - 1;
+    bounds[1] = std::min(upper, length - 1);
+  }
+}
+
+// slopes of dim values at knot k, like KnotSlopes
+inline void Slopes(double* slopes, const std::vector<double>& xs,
+                   const double* ys, int dim, int length, int k) {
+  for (int i = 0; i < dim; i++) {
+    if (length < 2 || (k == length - 1 && length == 2)) {
+      slopes[i] = 0.0;
+    } else if (k == length - 1) {
+      slopes[i] = (ys[dim * k + i] - ys[dim * (k - 1) + i]) /
+                  (xs[k] - xs[k - 1]);
+    } else if (k == 0) {
+      slopes[i] = (ys[dim * (k + 1) + i] - ys[dim * k + i]) /
+                  (xs[k + 1] - xs[k]);
+    } else {
+      slopes[i] = 0.5 * (ys[dim * (k + 1) + i] - ys[dim * k + i]) /
+                      (xs[k + 1] - xs[k]) +
+                  0.5 * (ys[dim * k + i] - ys[dim * (k - 1) + i]) /
+                      (xs[k] - xs[k - 1]);
+    }
+  }
+}
+
+// weights of the points and slopes at bounds, like CubicCoefficients
+inline void CubicWeights(double* weights, double x,
+                         const std::vector<double>& xs, const int* bounds) {
+  double dx = xs[bounds[1]] - xs[bounds[0]];
+  double t = (x - xs[bounds[0]]) / dx;
+  weights[0] = 2.0 * t * t * t - 3.0 * t * t + 1.0;
+  weights[1] = (t * t * t - 2.0 * t * t + t) * dx;
+  weights[2] = -2.0 * t * t * t + 3 * t * t;
+  weights[3] = (t * t * t - t * t) * dx;
+}
+
+// interpolate dim values of length knots at x, like ZeroInterpolation,
+// LinearInterpolation and CubicInterpolation. slopes has 2 x dim scratch.
+inline void Interpolate(double* output, double* slopes, double x,
+                        const std::vector<double>& xs, const double* ys,
+                        int dim, int length, int representation) {
+  int bounds[2];
+  Interval(bounds, xs, x, length);
+  const double* y0 = ys + dim * bounds[0];
+  const double* y1 = ys + dim * bounds[1];
+  if (bounds[0] == bounds[1] || representation == 0) {
+    std::copy(y0, y0 + dim, output);
+  } else if (representation == 1) {
+    double t = (x - xs[bounds[0]]) / (xs[bounds[1]] - xs[bounds[0]]);
+    for (int i = 0; i < dim; i++) output[i] = y0[i] * (1.0 - t) + y1[i] * t;
+  } else {
+    double c[4];
+    CubicWeights(c, x, xs, bounds);
+    Slopes(slopes, xs, ys, dim, length, bounds[0]);
+    Slopes(slopes + dim, xs, ys, dim, length, bounds[1]);
+    for (int i = 0; i < dim; i++) {
+      output[i] = c[0] * y0[i] + c[1] * slopes[i] + c[2] * y1[i] +
+                  c[3] * slopes[dim + i];
+    }
+  }
+}
+
+// normalize a quaternion, like mju_normalize4
+inline void NormalizeQuat(double* quat) {
+  double norm = std::sqrt(quat[0] * quat[0] + quat[1] * quat[1] +
+                          quat[2] * quat[2] + quat[3] * quat[3]);
+  if (norm < 1.0e-15) {
+    quat[0] = 1.0;
+    quat[1] = quat[2] = quat[3] = 0.0;
+  } else if (std::abs(norm - 1.0) > 1.0e-15) {
+    for (int i = 0; i < 4; i++) quat[i] /= norm;
+  }
+}
+
+// 3D velocity res with qb * quat(res) = qa, like mju_subQuat
+inline void SubQuat(double* res, const double* qa, const double* qb) {
+  // qdif = neg(qb) * qa
+  double q[4] = {
+      qb[0] * qa[0] + qb[1] * qa[1] + qb[2] * qa[2] + qb[3] * qa[3],
+      qb[0] * qa[1] - qb[1] * qa[0] - qb[2] * qa[3] + qb[3] * qa[2],
+      qb[0] * qa[2] + qb[1] * qa[3] - qb[2] * qa[0] - qb[3] * qa[1],
+      qb[0] * qa[3] - qb[1] * qa[2] + qb[2] * qa[1] - qb[3] * qa[0]};
+
+  // axis-angle, like mju_quat2Vel
+  double axis[3] = {q[1], q[2], q[3]};
+  double sin_a_2 =
+      std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (sin_a_2 < 1.0e-15) {
+    axis[0] = 1.0;
+    axis[1] = axis[2] = 0.0;
+  } else {
+    for (int i = 0; i < 3; i++) axis[i] /= sin_a_2;
+  }
+  constexpr double kPi = 3.14159265358979323846;
+  double speed = 2.0 * std::atan2(sin_a_2, q[0]);
+  if (speed > kPi) speed -= 2.0 * kPi;
+  for (int i = 0; i < 3; i++) res[i] = axis[i] * speed;
+}
+
+}  // namespace policy_export_internal
+
+// policy as bytes
+inline std::string SerializePolicy(const ExportedPolicy& policy) {
+  using policy_export_internal::Append;
+  using policy_export_internal::AppendArray;
+  std::string bytes(kPolicyExportMagic, sizeof(kPolicyExportMagic));
+  Append(bytes, kPolicyExportVersion);
+  Append(bytes, policy.version);
+  for (int value : {static_cast<int>(policy.kind), policy.representation,
+                    policy.dim_action, policy.nq, policy.nv, policy.na}) {
+    Append(bytes, static_cast<std::uint64_t>(value));
+  }
+  AppendArray(bytes, policy.times);
+  AppendArray(bytes, policy.actions);
+  AppendArray(bytes, policy.states);
+  AppendArray(bytes, policy.gains);
+  AppendArray(bytes, policy.ctrlrange);
+  AppendArray(bytes, policy.joints);
+  Append(bytes, policy.feedback_scaling);
+  return bytes;
+}
+
+// policy from bytes. false, leaving policy unspecified, if bytes aren't a
+// policy of kPolicyExportVersion or its arrays don't match its dimensions.
+inline bool ParsePolicy(std::string_view bytes, ExportedPolicy* policy) {
+  policy_export_internal::Reader reader(bytes);
+  char magic[sizeof(kPolicyExportMagic)];
+  std::uint64_t format, fields[6];
+  if (!reader.Read(&magic) ||
+      std::memcmp(magic, kPolicyExportMagic, sizeof(magic)) != 0 ||
+      !reader.Read(&format) || format != kPolicyExportVersion ||
+      !reader.Read(&policy->version)) {
+    return false;
+  }
+  for (std::uint64_t& field : fields) {
+    if (!reader.Read(&field) || field > (1 << 24)) return false;
+  }
+  policy->kind = static_cast<ExportedPolicyKind>(fields[0]);
+  policy->representation = fields[1];
+  policy->dim_action = fields[2];
+  policy->nq = fields[3];
+  policy->nv = fields[4];
+  policy->na = fields[5];
+  if (!reader.ReadArray(&policy->times) ||
+      !reader.ReadArray(&policy->actions) ||
+      !reader.ReadArray(&policy->states) ||
+      !reader.ReadArray(&policy->gains) ||
+      !reader.ReadArray(&policy->ctrlrange) ||
+      !reader.ReadArray(&policy->joints) ||
+      !reader.Read(&policy->feedback_scaling)) {
+    return false;
+  }
+
+  // dimensions
+  std::size_t knots = policy->times.size();
+  std::size_t nu = policy->dim_action;
+  if (knots == 0 || policy->ctrlrange.size() != 2 * nu ||
+      policy->joints.size() % 3 != 0) {
+    return false;
+  }
+  if (policy->kind == ExportedPolicyKind::kSpline) {
+    return policy->actions.size() == knots * nu;
+  }
+  if (policy->kind != ExportedPolicyKind::kFeedback) return false;
+  std::size_t action_knots = std::max<std::size_t>(knots - 1, 1);
+  if (policy->actions.size() != action_knots * nu ||
+      policy->states.size() != knots * policy->DimensionState() ||
+      policy->gains.size() !=
+          action_knots * nu * policy->DimensionStateDerivative()) {
+    return false;
+  }
+  for (std::size_t j = 0; j < policy->joints.size(); j += 3) {
+    std::int64_t type = policy->joints[j];
+    std::int64_t size = type == kExportFreeJoint   ? 7
+                        : type == kExportBallJoint ? 4
+                                                   : 1;
+    std::int64_t dofs = type == kExportFreeJoint   ? 6
+                        : type == kExportBallJoint ? 3
+                                                   : 1;
+    std::int64_t qpos = policy->joints[j + 1];
+    std::int64_t dof = policy->joints[j + 2];
+    if (qpos < 0 || qpos + size > policy->nq || dof < 0 ||
+        dof + dofs > policy->nv) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// evaluates an exported policy like the policy it was exported from:
+// Action matches SamplingPolicy::Action, GradientPolicy::Action and
+// iLQGPolicy::Action. not thread-safe, Action uses the evaluator's scratch.
+class PolicyEvaluator {
+ public:
+  explicit PolicyEvaluator(ExportedPolicy policy)
+      : policy_(std::move(policy)),
+        slopes_(2 * std::max(policy_.DimensionState(),
+                             policy_.dim_action *
+                                 policy_.DimensionStateDerivative()) +
+                2 * policy_.dim_action),
+        reference_(policy_.DimensionState()),
+        difference_(policy_.DimensionStateDerivative()),
+        gain_(policy_.dim_action * policy_.DimensionStateDerivative()) {}
+
+  // set action (dim_action) at time. for feedback policies, state
+  // (nq + nv + na) adds the feedback term, nullptr returns the nominal
+  // action.
+  void Action(double* action, const double* state, double time) {
+    using policy_export_internal::Interpolate;
+    int nu = policy_.dim_action;
+    int knots = policy_.times.size();
+    const std::vector<double>& times = policy_.times;
+
+    if (policy_.kind == ExportedPolicyKind::kSpline) {
+      Interpolate(action, slopes_.data(), time, times, policy_.actions.data(),
+                  nu, knots, policy_.representation);
+    } else {
+      Feedback(action, state, time);
+    }
+
+    // clamp controls
+    for (int i = 0; i < nu; i++) {
+      double lower = policy_.ctrlrange[2 * i];
+      double upper = policy_.ctrlrange[2 * i + 1];
+      action[i] = action[i] < lower   ? lower
+                  : action[i] > upper ? upper
+                                      : action[i];
+    }
+  }
+
+  const ExportedPolicy& Exported() const { return policy_; }
+
+ private:
+  // nominal action plus feedback, like iLQGPolicy::Action
+  void Feedback(double* action, const double* state, double time) {
+    using policy_export_internal::CubicWeights;
+    using policy_export_internal::Interpolate;
+    using policy_export_internal::Interval;
+    using policy_export_internal::Slopes;
+    int nu = policy_.dim_action;
+    int nq = policy_.nq, nv = policy_.nv;
+    int dim_state = policy_.DimensionState();
+    int dim_derivative = policy_.DimensionStateDerivative();
+    int dim_gain = nu * dim_derivative;
+    int horizon = policy_.times.size();
+    int num_joints = policy_.joints.size();
+    int representation = policy_.representation;
+    const std::vector<double>& times = policy_.times;
+
+    // intervals of the states and of the actions and gains
+    int bounds[2], action_bounds[2];
+    Interval(bounds, times, time, horizon);
+    Interval(action_bounds, times, time, horizon - 1);
+    bool interval = action_bounds[0] != action_bounds[1];
+    if (bounds[0] == bounds[1]) representation = 0;
+
+    // nominal action and reference state
+    const double* reference = policy_.states.data() + bounds[0] * dim_state;
+    Interpolate(action, slopes_.data(), time, times, policy_.actions.data(),
+                nu, horizon - 1, representation);
+    if (!state) return;
+    if (representation != 0) {
+      Interpolate(reference_.data(), slopes_.data(), time, times,
+                  policy_.states.data(), dim_state, horizon, representation);
+      for (int j = 0; j < num_joints; j += 3) {
+        int type = policy_.joints[j];
+        int adr = policy_.joints[j + 1];
+        if (type == kExportFreeJoint) {
+          policy_export_internal::NormalizeQuat(reference_.data() + adr + 3);
+        } else if (type == kExportBallJoint) {
+          policy_export_internal::NormalizeQuat(reference_.data() + adr);
+        }
+      }
+      reference = reference_.data();
+    }
+
+    // gain
+    const double* g0 = policy_.gains.data() + action_bounds[0] * dim_gain;
+    const double* g1 = policy_.gains.data() + action_bounds[1] * dim_gain;
+    if (!interval || representation == 0) {
+      std::copy(g0, g0 + dim_gain, gain_.data());
+    } else if (representation == 1) {
+      double t = (time - times[action_bounds[0]]) /
+                 (times[action_bounds[1]] - times[action_bounds[0]]);
+      for (int i = 0; i < dim_gain; i++) {
+        gain_[i] = (1.0 - t) * g0[i] + t * g1[i];
+      }
+    } else {
+      double c[4];
+      double* slopes = slopes_.data();
+      CubicWeights(c, time, times, action_bounds);
+      Slopes(slopes, times, policy_.gains.data(), dim_gain, horizon - 1,
+             action_bounds[0]);
+      Slopes(slopes + dim_gain, times, policy_.gains.data(), dim_gain,
+             horizon - 1, action_bounds[1]);
+      for (int i = 0; i < dim_gain; i++) {
+        gain_[i] = c[0] * g0[i] + c[1] * slopes[i] + c[2] * g1[i] +
+                   c[3] * slopes[dim_gain + i];
+      }
+    }
+
+    // state difference, like StateDiff
+    double* ds = difference_.data();
+    if (nq == nv) {
+      for (int i = 0; i < nv; i++) ds[i] = state[i] - reference[i];
+    } else {
+      for (int j = 0; j < num_joints; j += 3) {
+        int type = policy_.joints[j];
+        int qadr = policy_.joints[j + 1];
+        int dadr = policy_.joints[j + 2];
+        if (type == kExportFreeJoint) {
+          for (int i = 0; i < 3; i++) {
+            ds[dadr + i] = state[qadr + i] - reference[qadr + i];
+          }
+          policy_export_internal::SubQuat(ds + dadr + 3, state + qadr + 3,
+                                          reference + qadr + 3);
+        } else if (type == kExportBallJoint) {
+          policy_export_internal::SubQuat(ds + dadr, state + qadr,
+                                          reference + qadr);
+        } else {
+          ds[dadr] = state[qadr] - reference[qadr];
+        }
+      }
+    }
+    for (int i = nv; i < dim_derivative; i++) {
+      ds[i] = state[nq - nv + i] - reference[nq - nv + i];
+    }
+
+    // feedback
+    for (int i = 0; i < nu; i++) {
+      double sum = 0.0;
+      for (int j = 0; j < dim_derivative; j++) {
+        sum += gain_[i * dim_derivative + j] * ds[j];
+      }
+      action[i] += policy_.feedback_scaling * sum;
+    }
+  }
+
+  ExportedPolicy policy_;
+  std::vector<double> slopes_;
+  std::vector<double> reference_;
+  std::vector<double> difference_;
+  std::vector<double> gain_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_POLICY_EXPORT_H_
@@ -0,0 +1,178 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// In-process Python bindings for `mjpc::Agent`. Models and data of the
+// `mujoco` package are accessed through their addresses, without copies, so
+// MuJoCo and the `mujoco` package must be the same version.
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "mjpc/agent.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/task.h"
+#include "mjpc/tasks/tasks.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc::python {
+namespace {
+
+namespace py = ::pybind11;
+
+// mjModel and mjData of `mujoco.MjModel` and `mujoco.MjData` instances
+const mjModel* ModelPointer(const py::object& model) {
+  return reinterpret_cast<const mjModel*>(
+      model.attr("_address").cast<std::uintptr_t>());
+}
+mjData* DataPointer(const py::object& data) {
+  return reinterpret_cast<mjData*>(
+      data.attr("_address").cast<std::uintptr_t>());
+}
+
+}  // namespace
+
+// agent owned by a Python object
+class PyAgent {
+ public:
+  PyAgent(const std::string& task_id, const py::object& model,
+          int num_threads)
+      : pool_(num_threads == -1 ? NumAvailableHardwareThreads()
+                                : num_threads) {
+    agent_.SetTaskList(GetRegisteredTasks());
+    int task_index = agent_.GetTaskIdByName(task_id);
+    if (task_index == -1) {
+      throw py::value_error("Invalid task_id: '" + task_id + "'");
+    }
+    agent_.gui_task_id = task_index;
+    if (!model.is_none()) {
+      agent_.OverrideModel(
+          {mj_copyModel(nullptr, ModelPointer(model)), mj_deleteModel});
+    }
+    agent_.SetTaskByIndex(task_index);
+
+    auto load_model = agent_.LoadModel();
+    if (!load_model.model) {
+      throw std::runtime_error("Failed to load model: " + load_model.error);
+    }
+
+    // only the planner selected by the model is used
+    agent_.load_on_demand = true;
+    agent_.Initialize(load_model.model.get());
+    agent_.Allocate();
+    agent_.Reset();
+    agent_.plan_enabled = true;
+    agent_.action_enabled = true;
+
+    // residual sensors of the agent's planning model, which is registered by
+    // the agent. other models, e.g., the caller's simulation, are left
+    // untouched.
+    mjcb_sensor = ResidualSensorCallback;
+  }
+
+  PyAgent(const PyAgent&) = delete;
+  PyAgent& operator=(const PyAgent&) = delete;
+
+  // set the planner's state from data of the agent's model
+  void SetState(const py::object& data) {
+    agent_.SetState(DataPointer(data));
+  }
+
+  // one planning iteration, without the GIL
+  void PlanIteration(std::optional<double> planning_budget) {
+    if (planning_budget) agent_.SetPlanningBudget(*planning_budget);
+    py::gil_scoped_release release;
+    agent_.PlanIteration(&pool_);
+  }
+
+  // action from policy at the planner's state
+  py::array_t<double> GetAction(std::optional<double> time,
+                                bool nominal_action) {
+    py::array_t<double> action(agent_.GetActionDim());
+    ActionFromPolicy(action.mutable_data(), time, nominal_action);
+    return action;
+  }
+
+  // action from policy written to data.ctrl, e.g., of a simulation
+  void SetCtrl(const py::object& data, std::optional<double> time,
+               bool nominal_action) {
+    ActionFromPolicy(DataPointer(data)->ctrl, time, nominal_action);
+  }
+
+  // copy of the best trajectory, changed by the next planning iteration
+  py::dict BestTrajectory() {
+    const Trajectory* trajectory = agent_.ActivePlanner().BestTrajectory();
+    if (!trajectory) throw std::runtime_error("No planning iteration.");
+    int steps = agent_.PlanSteps();
+    int num_state = trajectory->dim_state;
+    int num_action = trajectory->dim_action;
+    py::dict result;
+    result["states"] = py::array_t<double>(
+        {steps, num_state}, trajectory->states.data());
+    result["actions"] = py::array_t<double>(
+        {std::max(steps - 1, 0), num_action}, trajectory->actions.data());
+    result["times"] = py::array_t<double>(steps, trajectory->times.data());
+    return result;
+  }
+
+ private:
+  void ActionFromPolicy(double* action, std::optional<double> time,
+                        bool nominal_action) {
+    const double* state =
+        nominal_action ? nullptr : agent_.state.state().data();
+    agent_.ActivePlanner().ActionFromPolicy(
+        action, state, time ? *time : agent_.state.time());
+  }
+
+  Agent agent_;
+  ThreadPool pool_;
+};
+
+}  // namespace mjpc::python
+
+PYBIND11_MODULE(agent_bindings, m) {
+  namespace py = ::pybind11;
+  using ::mjpc::python::PyAgent;
+  m.doc() = "In-process bindings for the MJPC agent.";
+  py::class_<PyAgent>(m, "Agent")
+      .def(py::init<const std::string&, const py::object&, int>(),
+           py::arg("task_id"), py::arg("model") = py::none(),
+           py::arg("num_threads") = -1,
+           "Creates an agent for task_id, with a copy of model (a "
+           "mujoco.MjModel) if given, and the task's model otherwise.")
+      .def("set_state", &PyAgent::SetState, py::arg("data"),
+           "Sets the planner's state from a mujoco.MjData of the agent's "
+           "model.")
+      .def("plan_iteration", &PyAgent::PlanIteration,
+           py::arg("planning_budget") = py::none(),
+           "Runs one planning iteration, releasing the GIL.")
+      .def("get_action", &PyAgent::GetAction, py::arg("time") = py::none(),
+           py::arg("nominal_action") = false,
+           "Returns the policy's action at the planner's state.")
+      .def("set_ctrl", &PyAgent::SetCtrl, py::arg("data"),
+           py::arg("time") = py::none(), py::arg("nominal_action") = false,
+           "Writes the policy's action to data.ctrl, without copies.")
+      .def("best_trajectory", &PyAgent::BestTrajectory,
+           "Returns a copy of the planner's best trajectory.");
+}
@@ -0,0 +1,231 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace mjpc {
+
+namespace {
+// golden ratio increment
+inline constexpr std::uint64_t kGolden = 0x9e3779b97f4a7c15ULL;
+
+// Box-Muller pairs per block
+inline constexpr int kGaussianBlock = 64;
+
+// SplitMix64 finalizer
+std::uint64_t Hash(std::uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// reverse bits of 32-bit value
+std::uint32_t ReverseBits(std::uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// hash-based Owen scrambling of a bit-reversed value (Laine-Karras)
+std::uint32_t LaineKarras(std::uint32_t x, std::uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// nested uniform scramble of a 32-bit value
+std::uint32_t NestedUniformScramble(std::uint32_t x, std::uint32_t seed) {
+  return ReverseBits(LaineKarras(ReverseBits(x), seed));
+}
+
+// inverse of the standard normal CDF, p in (0, 1) (Acklam, rel. error 1e-9)
+double InverseNormal(double p) {
+  constexpr double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                           -2.759285104469687e+02, 1.383577518672690e+02,
+                           -3.066479806614716e+01, 2.506628277459239e+00};
+  constexpr double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                           -1.556989798598866e+02, 6.680131188771972e+01,
+                           -1.328068155288572e+01};
+  constexpr double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                           -2.400758277161838e+00, -2.549732539343734e+00,
+                           4.374664141464968e+00,  2.938163982698783e+00};
+  constexpr double d[4] = {7.784695709041462e-03, 3.224671290700398e-01,
+                           2.445134137142996e+00, 3.754408661907416e+00};
+  constexpr double kLow = 0.02425;
+  if (p < kLow || p > 1.0 - kLow) {
+    double q = std::sqrt(-2.0 * std::log(p < kLow ? p : 1.0 - p));
+    double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+                c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    return p < kLow ? x : -x;
+  }
+  double q = p - 0.5;
+  double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r +
+          a[5]) *
+         q /
+         (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
+}  // namespace
+
+// set key from seed and stream index, reset counter
+void RandomStream::Seed(std::uint64_t seed, std::uint64_t stream) {
+  // distinct odd increments keep streams from being shifted copies
+  increment_ = Mix(stream * kGolden + kGolden) | 1;
+  key_ = Mix(seed + kGolden) ^ Mix(stream);
+  counter_ = 0;
+}
+
+// bulk normal samples
+void RandomStream::Gaussian(double* x, int n, double scale) {
+  // uniforms: u1 in (0, 1] for the log, u2 in [0, 1) for the angle
+  constexpr double kUnit = 1.0 / 9007199254740992.0;  // 2^-53
+  constexpr double kTwoPi = 6.283185307179586;
+  double radius[kGaussianBlock];
+  double angle[kGaussianBlock];
+
+  for (int start = 0; start < n; start += 2 * kGaussianBlock) {
+    int pairs = std::min(kGaussianBlock, (n - start + 1) / 2);
+
+    // hash counters
+    for (int k = 0; k < pairs; k++) {
+      std::uint64_t c = counter_ + 2 * k;
+      radius[k] = ((Mix(key_ + increment_ * (c + 1)) >> 11) + 1) * kUnit;
+      angle[k] = (Mix(key_ + increment_ * (c + 2)) >> 11) * kUnit;
+    }
+    counter_ += 2 * pairs;
+
+    // transform
+    for (int k = 0; k < pairs; k++) {
+      radius[k] = scale * std::sqrt(-2.0 * std::log(radius[k]));
+      angle[k] *= kTwoPi;
+    }
+
+    // write, last pair may be truncated
+    double* block = x + start;
+    int count = std::min(2 * pairs, n - start);
+    for (int k = 0; k < count / 2; k++) {
+      block[2 * k] = radius[k] * std::cos(angle[k]);
+      block[2 * k + 1] = radius[k] * std::sin(angle[k]);
+    }
+    if (count % 2) {
+      block[count - 1] = radius[pairs - 1] * std::cos(angle[pairs - 1]);
+    }
+  }
+}
+
+// batch noise for one sample
+void BatchGaussian(double* x, int n, double scale, int mode, int sample,
+                   std::uint64_t seed, std::uint64_t iteration,
+                   RandomStream& stream) {
+  // per-iteration key, independent of the sample streams
+  std::uint64_t key = Hash(seed + kGolden * (iteration + 1));
+  switch (mode) {
+    case kAntitheticNoise: {
+      // pairs (1, 2), (3, 4), ... draw from the same stream
+      int pair = (sample + 1) / 2;
+      RandomStream pair_stream(key, pair);
+      pair_stream.Gaussian(x, n, sample % 2 ? scale : -scale);
+      break;
+    }
+    case kSobolNoise:
+      SobolGaussian(x, n, sample - 1, key, scale);
+      break;
+    default:
+      stream.Gaussian(x, n, scale);
+      break;
+  }
+}
+
+// low-discrepancy normal samples
+void SobolGaussian(double* x, int n, std::uint64_t index, std::uint64_t seed,
+                   double scale) {
+  constexpr double kUnit = 1.0 / 4294967296.0;  // 2^-32
+  for (int k = 0; k < n; k++) {
+    std::uint64_t h = Hash(seed ^ Hash(k + 1));
+    std::uint32_t shuffle = h & 0xffffffffu;
+    std::uint32_t scramble = h >> 32;
+
+    // shuffled point, van der Corput coordinate, Owen scrambled
+    std::uint32_t point = NestedUniformScramble(
+        static_cast<std::uint32_t>(index), shuffle);
+    std::uint32_t u = NestedUniformScramble(ReverseBits(point), scramble);
+
+    // cell midpoint, in (0, 1)
+    x[k] = scale * InverseNormal((u + 0.5) * kUnit);
+  }
+}
+
+// AR(1) correlation across rows
+void CorrelateRows(double* x, int rows, int cols, double correlation) {
+  if (correlation == 0.0) return;
+  double innovation = std::sqrt(std::max(1.0 - correlation * correlation, 0.0));
+  for (int t = 1; t < rows; t++) {
+    double* row = x + t * cols;
+    const double* previous = row - cols;
+    for (int j = 0; j < cols; j++) {
+      row[j] = correlation * previous[j] + innovation * row[j];
+    }
+  }
+}
+
+int OrthonormalizeRows(double* basis, int rows, int cols) {
+  // relative norm below which a row is in the span of the previous rows
+  constexpr double kDependent = 1.0e-8;
+  int rank = 0;
+  for (int i = 0; i < rows; i++) {
+    double* row = basis + rank * cols;
+    if (rank != i) std::copy_n(basis + i * cols, cols, row);
+    double norm = 0.0;
+    for (int j = 0; j < cols; j++) norm += row[j] * row[j];
+    norm = std::sqrt(norm);
+    for (int k = 0; k < rank; k++) {
+      const double* previous = basis + k * cols;
+      double dot = 0.0;
+      for (int j = 0; j < cols; j++) dot += row[j] * previous[j];
+      for (int j = 0; j < cols; j++) row[j] -= dot * previous[j];
+    }
+    double residual = 0.0;
+    for (int j = 0; j < cols; j++) residual += row[j] * row[j];
+    residual = std::sqrt(residual);
+    if (residual <= kDependent * norm || residual == 0.0) continue;
+    for (int j = 0; j < cols; j++) row[j] /= residual;
+    rank++;
+  }
+  return rank;
+}
+
+void ExpandRows(double* y, const double* x, const double* basis, int rows,
+                int dim, int cols) {
+  for (int t = 0; t < rows; t++) {
+    double* row = y + t * cols;
+    const double* coordinates = x + t * dim;
+    std::fill_n(row, cols, 0.0);
+    for (int k = 0; k < dim; k++) {
+      const double* direction = basis + k * cols;
+      for (int j = 0; j < cols; j++) row[j] += coordinates[k] * direction[j];
+    }
+  }
+}
+
+}  // namespace mjpc
@@ -0,0 +1,112 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_RANDOM_H_
+#define MJPC_RANDOM_H_
+
+#include <cstdint>
+
+namespace mjpc {
+
+// counter-based random bit generator
+// the n-th value of a stream is a hash of (seed, stream, n), so streams are
+// cheap to create, never touch OS entropy, and are reproducible. satisfies
+// UniformRandomBitGenerator for use with absl (or std) distributions.
+class RandomStream {
+ public:
+  using result_type = std::uint64_t;
+
+  // constructor
+  RandomStream() { Seed(0, 0); }
+  RandomStream(std::uint64_t seed, std::uint64_t stream) {
+    Seed(seed, stream);
+  }
+
+  // ----- methods ----- //
+
+  // set key from seed and stream index, reset counter
+  void Seed(std::uint64_t seed, std::uint64_t stream);
+
+  // next value
+  result_type operator()() { return Mix(key_ + increment_ * ++counter_); }
+
+  // fill x with n samples from N(0, scale^2). values are hashed from
+  // independent counters and transformed with Box-Muller in blocks, so both
+  // loops vectorize. advances the counter by n rounded up to even.
+  void Gaussian(double* x, int n, double scale = 1.0);
+
+  // number of values drawn since seeding
+  std::uint64_t Counter() const { return counter_; }
+
+  // jump to position in stream
+  void SetCounter(std::uint64_t counter) { counter_ = counter; }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type(0); }
+
+ private:
+  // SplitMix64 finalizer
+  static result_type Mix(result_type z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // ----- members ----- //
+  std::uint64_t key_;
+  std::uint64_t increment_;  // odd, per stream
+  std::uint64_t counter_;
+};
+
+// noise sampling for batches of samples
+enum NoiseSampling : int {
+  kIndependentNoise = 0,  // i.i.d., continues each sample's stream
+  kAntitheticNoise,       // samples 2k - 1 and 2k share a draw, opposite signs
+  kSobolNoise,            // scrambled Sobol points mapped to normals
+};
+
+// fill x with n samples from N(0, scale^2) for sample (>= 1) of a batch.
+// independent noise is drawn from stream. antithetic and Sobol noise only
+// depend on (seed, iteration, sample), so samples can be drawn in any order
+// or skipped.
+void BatchGaussian(double* x, int n, double scale, int mode, int sample,
+                   std::uint64_t seed, std::uint64_t iteration,
+                   RandomStream& stream);
+
+// coordinate k < n of point `index` of a low-discrepancy sequence, as
+// N(0, scale^2) samples. each coordinate is an Owen-scrambled van der Corput
+// sequence with its own scrambled point order (padded Sobol), so every
+// marginal is stratified.
+void SobolGaussian(double* x, int n, std::uint64_t index, std::uint64_t seed,
+                   double scale = 1.0);
+
+// correlate consecutive rows of x (rows x cols) with AR(1) coefficient,
+// x[t] <- correlation * x[t - 1] + sqrt(1 - correlation^2) * x[t], which
+// keeps the marginal variance
+void CorrelateRows(double* x, int rows, int cols, double correlation);
+
+// orthonormalize the rows of basis (rows x cols) with modified Gram-Schmidt.
+// rows that depend on the rows before them are dropped, returns the number
+// of rows kept at the front of basis.
+int OrthonormalizeRows(double* basis, int rows, int cols);
+
+// map the rows of x (rows x dim), coordinates in the orthonormal rows of
+// basis (dim x cols), to y (rows x cols): y[t] = x[t] * basis. x and y don't
+// overlap.
+void ExpandRows(double* y, const double* x, const double* basis, int rows,
+                int dim, int cols);
+
+}  // namespace mjpc
+
+#endif  // MJPC_RANDOM_H_
@@ -0,0 +1,155 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/realtime.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <absl/strings/str_format.h>
+#include "mjpc/metrics.h"
+#include "mjpc/threadpool.h"
+
+#ifdef __linux__
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mjpc {
+
+namespace {
+
+// touch stack_bytes of stack below the caller, so that later use of that
+// stack doesn't page fault
+#ifdef __linux__
+__attribute__((noinline)) void PrefaultStack(std::size_t stack_bytes) {
+  volatile unsigned char* stack =
+      static_cast<volatile unsigned char*>(alloca(stack_bytes));
+  long page = sysconf(_SC_PAGESIZE);
+  for (std::size_t i = 0; i < stack_bytes; i += page) stack[i] = 0;
+}
+#endif
+
+}  // namespace
+
+bool LockMemory(std::size_t stack_bytes) {
+#ifdef __linux__
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    std::fprintf(stderr, "LockMemory: mlockall failed: %s\n",
+                 std::strerror(errno));
+    return false;
+  }
+  PrefaultStack(stack_bytes);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool SetThreadNice(int nice) {
+#ifdef __linux__
+  // on Linux, nice values are per thread
+  pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+  if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+    std::fprintf(stderr, "SetThreadNice: setpriority(%d) failed: %s\n", nice,
+                 std::strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void SetPoolNice(ThreadPool& pool, int nice) {
+  TaskGroup group(pool);
+  for (int i = 0; i < pool.NumThreads(); i++) {
+    group.ScheduleOnWorker(i, [nice]() { SetThreadNice(nice); });
+  }
+}
+
+ScopedRealtimePriority::ScopedRealtimePriority(int priority) {
+#ifdef __linux__
+  if (priority <= 0) return;
+  sched_param param;
+  if (pthread_getschedparam(pthread_self(), &policy_, &param) != 0) return;
+  priority_ = param.sched_priority;
+  param.sched_priority = priority;
+  int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (error != 0) {
+    std::fprintf(stderr,
+                 "ScopedRealtimePriority: SCHED_FIFO priority %d failed: %s\n",
+                 priority, std::strerror(error));
+    return;
+  }
+  active_ = true;
+#endif
+}
+
+ScopedRealtimePriority::~ScopedRealtimePriority() {
+#ifdef __linux__
+  if (!active_) return;
+  sched_param param;
+  param.sched_priority = priority_;
+  pthread_setschedparam(pthread_self(), policy_, &param);
+#endif
+}
+
+ControlPeriodMonitor::ControlPeriodMonitor(double target, double tolerance)
+    : target_(target), tolerance_(tolerance), periods_(1.0e-6) {}
+
+void ControlPeriodMonitor::Tick(std::chrono::steady_clock::time_point now) {
+  if (previous_ != std::chrono::steady_clock::time_point()) {
+    double period = std::chrono::duration<double>(now - previous_).count();
+    periods_.Record(period);
+    if (period > target_ + tolerance_) {
+      missed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (period > max_.load(std::memory_order_relaxed)) {
+      max_.store(period, std::memory_order_relaxed);
+    }
+  }
+  previous_ = now;
+}
+
+void ControlPeriodMonitor::Reset(double target, double tolerance) {
+  target_ = target;
+  tolerance_ = tolerance;
+  previous_ = {};
+  periods_.Reset();
+  missed_ = 0;
+  max_ = 0.0;
+}
+
+std::string ControlPeriodMonitor::Summary() const {
+  LatencyHistogram::Snapshot snapshot = periods_.Read();
+  return absl::StrFormat(
+      "control period: %d ticks, p50 %.1f us, p99 %.1f us, max %.1f us, "
+      "%d missed (> %.1f us)",
+      snapshot.count, 1.0e6 * snapshot.Quantile(0.5),
+      1.0e6 * snapshot.Quantile(0.99), 1.0e6 * max(), missed(),
+      1.0e6 * (target_ + tolerance_));
+}
+
+}  // namespace mjpc
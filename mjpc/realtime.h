@@ -0,0 +1,117 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Opt-in real-time scheduling of the control path: a SCHED_FIFO control
+// thread, locked memory, planning workers at a lower priority, and a
+// histogram of the control loop period. Linux only, no-ops elsewhere.
+// Raising the priority needs CAP_SYS_NICE or an rtprio rlimit, and locking
+// memory CAP_IPC_LOCK or a memlock rlimit; failures are reported on stderr.
+
+#ifndef MJPC_REALTIME_H_
+#define MJPC_REALTIME_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mjpc/metrics.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+
+// real-time settings, the defaults change nothing
+struct RealtimeOptions {
+  int control_priority = 0;        // SCHED_FIFO priority (1-99), 0: default
+  bool lock_memory = false;        // mlockall current and future pages
+  int planner_nice = 0;            // nice of planning workers, > 0: lower
+  double control_period = 1.0e-3;  // target control loop period (seconds)
+
+  bool Enabled() const {
+    return control_priority > 0 || lock_memory || planner_nice != 0;
+  }
+};
+
+// lock all current and future pages of the process in memory and prefault
+// stack_bytes of the calling thread's stack. false on failure.
+bool LockMemory(std::size_t stack_bytes = 1 << 19);
+
+// set the nice value of the calling thread. false on failure.
+bool SetThreadNice(int nice);
+
+// set the nice value of every worker of pool, waits until all are set
+void SetPoolNice(ThreadPool& pool, int nice);
+
+// runs the calling thread with SCHED_FIFO at priority while in scope and
+// restores its previous policy. priority 0 does nothing.
+class ScopedRealtimePriority {
+ public:
+  explicit ScopedRealtimePriority(int priority);
+  ~ScopedRealtimePriority();
+
+  ScopedRealtimePriority(const ScopedRealtimePriority&) = delete;
+  ScopedRealtimePriority& operator=(const ScopedRealtimePriority&) = delete;
+
+  // true if the priority was raised
+  bool active() const { return active_; }
+
+ private:
+  bool active_ = false;
+  int policy_ = 0;
+  int priority_ = 0;
+};
+
+// period of a control loop. Tick is called once per iteration; periods are
+// recorded in a histogram from 1 us, and periods longer than the target by
+// more than tolerance count as missed ticks. safe to read from any thread.
+class ControlPeriodMonitor {
+ public:
+  // target period and tolerance in seconds
+  explicit ControlPeriodMonitor(double target = 1.0e-3,
+                                double tolerance = 0.5e-3);
+
+  // record the period since the previous tick
+  void Tick(std::chrono::steady_clock::time_point now =
+                std::chrono::steady_clock::now());
+
+  // forget the previous tick, e.g., after a pause
+  void Restart() { previous_ = {}; }
+
+  // clear the recorded periods and set the target, not concurrently with
+  // Tick
+  void Reset(double target, double tolerance);
+
+  const LatencyHistogram& periods() const { return periods_; }
+  std::uint64_t missed() const { return missed_.load(); }
+  double target() const { return target_; }
+
+  // max period (seconds)
+  double max() const { return max_.load(); }
+
+  // one-line summary: ticks, period quantiles, max and missed ticks
+  std::string Summary() const;
+
+ private:
+  double target_;
+  double tolerance_;
+  std::chrono::steady_clock::time_point previous_;  // ticking thread only
+  LatencyHistogram periods_;
+  std::atomic<std::uint64_t> missed_{0};
+  std::atomic<double> max_{0.0};
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_REALTIME_H_
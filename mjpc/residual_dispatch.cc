@@ -0,0 +1,120 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/residual_dispatch.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <mujoco/mujoco.h>
+
+#include "mjpc/task.h"
+
+namespace mjpc {
+
+namespace {
+
+// a registered model. the residual and context are written before the model
+// is published (release), and read after it is found (acquire).
+struct ResidualSlot {
+  std::atomic<const mjModel*> model = nullptr;
+  std::atomic<ResidualDispatchFn> residual = nullptr;
+  std::atomic<const void*> context = nullptr;
+};
+
+ResidualSlot slots[kMaxResidualModels];
+
+// slots that have been used, lookups scan only these
+std::atomic<int> num_slots = 0;
+
+// serializes registration
+std::mutex registration_mutex;
+
+// slot of model, or null
+ResidualSlot* FindSlot(const mjModel* model) {
+  if (!model) return nullptr;
+  int n = num_slots.load(std::memory_order_acquire);
+  for (int i = 0; i < n; i++) {
+    if (slots[i].model.load(std::memory_order_acquire) == model) {
+      return &slots[i];
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+bool RegisterResidual(const mjModel* model, ResidualDispatchFn residual,
+                      const void* context) {
+  if (!model || !residual) return false;
+  std::lock_guard<std::mutex> lock(registration_mutex);
+
+  // previous registration: unpublish before replacing residual and context
+  ResidualSlot* slot = FindSlot(model);
+  if (slot) slot->model.store(nullptr, std::memory_order_release);
+
+  // free slot
+  int n = num_slots.load(std::memory_order_relaxed);
+  for (int i = 0; !slot && i < n; i++) {
+    if (!slots[i].model.load(std::memory_order_relaxed)) slot = &slots[i];
+  }
+  if (!slot) {
+    if (n == kMaxResidualModels) return false;
+    slot = &slots[n];
+    num_slots.store(n + 1, std::memory_order_release);
+  }
+
+  // publish
+  slot->residual.store(residual, std::memory_order_relaxed);
+  slot->context.store(context, std::memory_order_relaxed);
+  slot->model.store(model, std::memory_order_release);
+  return true;
+}
+
+bool RegisterTaskResidual(const mjModel* model, const Task* task) {
+  auto residual = [](const void* task, const mjModel* m, mjData* d) {
+    static_cast<const Task*>(task)->Residual(m, d, d->sensordata);
+  };
+  return RegisterResidual(model, residual, task);
+}
+
+bool RegisterResidualAlias(const mjModel* alias, const mjModel* model) {
+  ResidualSlot* slot = FindSlot(model);
+  if (!slot) return false;
+  return RegisterResidual(alias, slot->residual.load(std::memory_order_relaxed),
+                          slot->context.load(std::memory_order_relaxed));
+}
+
+void UnregisterResidual(const mjModel* model) {
+  std::lock_guard<std::mutex> lock(registration_mutex);
+  ResidualSlot* slot = FindSlot(model);
+  if (slot) slot->model.store(nullptr, std::memory_order_release);
+}
+
+bool HasResidual(const mjModel* model) { return FindSlot(model) != nullptr; }
+
+bool DispatchResidual(const mjModel* model, mjData* data) {
+  ResidualSlot* slot = FindSlot(model);
+  if (!slot) return false;
+  ResidualDispatchFn residual = slot->residual.load(std::memory_order_relaxed);
+  residual(slot->context.load(std::memory_order_relaxed), model, data);
+  return true;
+}
+
+void ResidualSensorCallback(const mjModel* model, mjData* data, int stage) {
+  if (stage != mjSTAGE_ACC || ResidualSkipped()) return;
+  DispatchResidual(model, data);
+}
+
+}  // namespace mjpc
@@ -0,0 +1,66 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_RESIDUAL_DISPATCH_H_
+#define MJPC_RESIDUAL_DISPATCH_H_
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+class Task;
+
+// maximum number of models with a registered residual
+inline constexpr int kMaxResidualModels = 256;
+
+// residual of a registered model, writes data->sensordata. context is the
+// pointer given at registration.
+using ResidualDispatchFn = void (*)(const void* context, const mjModel* model,
+                                    mjData* data);
+
+// residuals keyed by model, so that agents with different tasks share one
+// process and one mjcb_sensor. lookups are lock-free and can run on any
+// number of threads; registration is serialized internally. a model must be
+// unregistered before its context is destroyed, and not while it is being
+// stepped.
+//
+// register the residual of model, replacing a previous registration. returns
+// false if the registry is full.
+bool RegisterResidual(const mjModel* model, ResidualDispatchFn residual,
+                      const void* context);
+
+// register the residual of task (see Task::Residual) for model
+bool RegisterTaskResidual(const mjModel* model, const Task* task);
+
+// register the residual of model for alias, e.g., a copy of model with other
+// options. returns false if model has no residual or the registry is full.
+bool RegisterResidualAlias(const mjModel* alias, const mjModel* model);
+
+// remove the registration of model, if any
+void UnregisterResidual(const mjModel* model);
+
+// true if model has a registered residual
+bool HasResidual(const mjModel* model);
+
+// evaluate the registered residual of model, returns false if there is none
+bool DispatchResidual(const mjModel* model, mjData* data);
+
+// mjcb_sensor callback evaluating registered residuals at mjSTAGE_ACC,
+// unless the residual is skipped on this thread (see ScopedResidualSkip).
+// sensordata of unregistered models is left unchanged.
+void ResidualSensorCallback(const mjModel* model, mjData* data, int stage);
+
+}  // namespace mjpc
+
+#endif  // MJPC_RESIDUAL_DISPATCH_H_
@@ -0,0 +1,213 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/shared_model.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <mujoco/mjxmacro.h>
+#include <mujoco/mujoco.h>
+#include "mjpc/model_cache.h"
+
+namespace mjpc {
+
+namespace {
+// mjModel fields before mjOption are sizes
+constexpr std::size_t kSizesBytes = offsetof(mjModel, opt);
+
+void DeleteModel(const mjModel* model) {
+  mj_deleteModel(const_cast<mjModel*>(model));
+}
+
+bool Contains(const void* begin, std::size_t size, const void* address) {
+  auto b = reinterpret_cast<std::uintptr_t>(begin);
+  auto a = reinterpret_cast<std::uintptr_t>(address);
+  return a >= b && a < b + size;
+}
+
+// hash of the sizes and array contents
+std::size_t ContentHash(const mjModel* m) {
+  std::hash<std::string_view> hash;
+  std::size_t h = hash(
+      std::string_view(reinterpret_cast<const char*>(m), kSizesBytes));
+  MJMODEL_POINTERS_PREAMBLE(m)
+#define X(type, name, nr, nc)                                                 \
+  h = 31 * h + hash(std::string_view(                                         \
+                   reinterpret_cast<const char*>(m->name),                    \
+                   m->name ? sizeof(type) * m->nr * nc : 0));
+#define XMJV X
+  MJMODEL_POINTERS
+#undef XMJV
+#undef X
+  return h;
+}
+
+// same sizes and array contents
+bool SameContent(const mjModel* a, const mjModel* b) {
+  if (std::memcmp(a, b, kSizesBytes)) return false;
+  const mjModel* m = a;
+  MJMODEL_POINTERS_PREAMBLE(m)
+#define X(type, name, nr, nc)                                                 \
+  if (m->nr * nc != 0 && a->name != b->name &&                                \
+      std::memcmp(a->name, b->name, sizeof(type) * m->nr * nc)) {             \
+    return false;                                                             \
+  }
+#define XMJV X
+  MJMODEL_POINTERS
+#undef XMJV
+#undef X
+  return true;
+}
+
+// deep copy of model, including arrays outside its buffer (SharedModel)
+mjModel* CopyModel(const mjModel* model) {
+  mjModel* copy = mj_copyModel(nullptr, model);
+  const mjModel* m = model;
+  MJMODEL_POINTERS_PREAMBLE(m)
+#define X(type, name, nr, nc)                                                 \
+  if (m->nr * nc != 0 && !Contains(m->buffer, m->nbuffer, m->name)) {         \
+    std::memcpy(copy->name, m->name, sizeof(type) * m->nr * nc);              \
+  }
+#define XMJV X
+  MJMODEL_POINTERS
+#undef XMJV
+#undef X
+  return copy;
+}
+}  // namespace
+
+std::shared_ptr<const mjModel> ShareModel(const mjModel* model) {
+  static std::mutex mutex;
+  static auto* models =
+      new std::multimap<std::size_t, std::weak_ptr<const mjModel>>();
+
+  std::size_t hash = ContentHash(model);
+  std::lock_guard<std::mutex> lock(mutex);
+  auto [begin, end] = models->equal_range(hash);
+  for (auto it = begin; it != end;) {
+    std::shared_ptr<const mjModel> shared = it->second.lock();
+    if (!shared) {
+      it = models->erase(it);
+      continue;
+    }
+    if (SameContent(shared.get(), model)) return shared;
+    ++it;
+  }
+  std::shared_ptr<const mjModel> shared(CopyModel(model), DeleteModel);
+  models->emplace(hash, shared);
+  return shared;
+}
+
+std::string_view ModelSizes(const mjModel* model) {
+  return std::string_view(reinterpret_cast<const char*>(model), kSizesBytes);
+}
+
+std::shared_ptr<const mjModel> LoadSharedModel(const std::string& path,
+                                               std::string* error) {
+  static std::mutex mutex;
+  static auto* models =
+      new std::map<std::string, std::weak_ptr<const mjModel>>();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (auto shared = (*models)[path].lock()) return shared;
+  constexpr int kErrorLength = 1024;
+  char load_error[kErrorLength] = "";
+  mjModel* model = LoadCachedModel(path, load_error, kErrorLength);
+  if (!model) {
+    *error = load_error;
+    return nullptr;
+  }
+  std::shared_ptr<const mjModel> shared(model, DeleteModel);
+  (*models)[path] = shared;
+  return shared;
+}
+
+SharedModel::SharedModel(std::shared_ptr<const mjModel> base)
+    : SharedModel(base.get()) {
+  owner_ = std::move(base);
+}
+
+SharedModel::SharedModel(const mjModel* base) : base_(base) {
+  std::memcpy(&model_, base, sizeof(mjModel));
+}
+
+void* SharedModel::MakeMutable(const void* address) {
+  for (std::size_t i = 0; i < copies_.size(); i++) {
+    if (Contains(copies_[i].get(), copy_sizes_[i], address)) {
+      return const_cast<void*>(address);
+    }
+  }
+
+  // copy the array containing address
+  mjModel* m = &model_;
+  MJMODEL_POINTERS_PREAMBLE(m)
+#define X(type, name, nr, nc)                                                 \
+  {                                                                           \
+    std::size_t size = sizeof(type) * m->nr * nc;                             \
+    if (size && Contains(m->name, size, address)) {                           \
+      const char* array = reinterpret_cast<const char*>(m->name);             \
+      copies_.emplace_back(new char[size]);                                   \
+      copy_sizes_.push_back(size);                                            \
+      std::memcpy(copies_.back().get(), array, size);                         \
+      m->name = reinterpret_cast<type*>(copies_.back().get());                \
+      return copies_.back().get() +                                           \
+             (static_cast<const char*>(address) - array);                     \
+    }                                                                         \
+  }
+#define XMJV X
+  MJMODEL_POINTERS
+#undef XMJV
+#undef X
+  return nullptr;
+}
+
+void SharedModel::MakeAllMutable() {
+  // one copy of the buffer, keeping the layout of its arrays
+  mjModel* m = &model_;
+  const char* buffer = static_cast<const char*>(m->buffer);
+  std::size_t size = m->nbuffer;
+  copies_.emplace_back(new char[size]);
+  copy_sizes_.push_back(size);
+  char* copy = copies_.back().get();
+  std::memcpy(copy, buffer, size);
+  MJMODEL_POINTERS_PREAMBLE(m)
+#define X(type, name, nr, nc)                                                 \
+  if (Contains(buffer, size, m->name)) {                                      \
+    m->name = reinterpret_cast<type*>(                                        \
+        copy + (reinterpret_cast<const char*>(m->name) - buffer));            \
+  }
+#define XMJV X
+  MJMODEL_POINTERS
+#undef XMJV
+#undef X
+  m->buffer = copy;
+}
+
+std::size_t SharedModel::MutableSize() const {
+  std::size_t size = 0;
+  for (std::size_t copy_size : copy_sizes_) size += copy_size;
+  return size;
+}
+
+}  // namespace mjpc
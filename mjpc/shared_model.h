@@ -0,0 +1,89 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Models shared read-only by agents, estimators and tasks. The arrays of a
+// model (meshes, height fields, textures and all other mjModel arrays) are
+// stored once per process; each consumer gets a SharedModel with its own
+// mjModel header (sizes, mjOption, mjVisual, mjStatistic) and private
+// copies of only the arrays it writes.
+
+#ifndef MJPC_SHARED_MODEL_H_
+#define MJPC_SHARED_MODEL_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// an immutable copy of model, shared with all live copies of the same model
+// (same sizes and array contents). models are compared once, here.
+std::shared_ptr<const mjModel> ShareModel(const mjModel* model);
+
+// the compiled model at path, shared with all users of the path. nullptr
+// with error set on failure.
+std::shared_ptr<const mjModel> LoadSharedModel(const std::string& path,
+                                               std::string* error);
+
+// the sizes of model (its header fields before mjOption), which determine the
+// layout of its mjData. mjData made for a model fits models with the same
+// sizes.
+std::string_view ModelSizes(const mjModel* model);
+
+// mjModel whose arrays are read from a base model until made mutable.
+//   options and other header fields can be written freely. arrays must be
+//   made mutable with MakeMutable before writing.
+//   get() must not be passed to mj_deleteModel, and mj_copyModel of it copies
+//   the base arrays, not the private copies.
+class SharedModel {
+ public:
+  // share base, kept alive by this model
+  explicit SharedModel(std::shared_ptr<const mjModel> base);
+
+  // share base, which must outlive this model
+  explicit SharedModel(const mjModel* base);
+
+  SharedModel(const SharedModel&) = delete;
+  SharedModel& operator=(const SharedModel&) = delete;
+
+  mjModel* get() { return &model_; }
+  const mjModel* get() const { return &model_; }
+  const mjModel* base() const { return base_; }
+
+  // give this model a private copy of the array containing address and return
+  // the same element in the copy. addresses in private copies are returned
+  // unchanged. nullptr if address is not in a model array.
+  void* MakeMutable(const void* address);
+
+  // private copies of all arrays, i.e., a full copy
+  void MakeAllMutable();
+
+  // bytes of the private copies
+  std::size_t MutableSize() const;
+
+ private:
+  std::shared_ptr<const mjModel> owner_;
+  const mjModel* base_;
+  mjModel model_;
+  std::vector<std::unique_ptr<char[]>> copies_;
+  std::vector<std::size_t> copy_sizes_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_SHARED_MODEL_H_
@@ -89,6 +89,7 @@ const mjuiDef defFile[] = {
   {mjITEM_BUTTON,    "Print data",    2, nullptr,                    "CD"},
   {mjITEM_BUTTON,    "Quit",          1, nullptr,                    "CQ"},
   {mjITEM_BUTTON,    "Screenshot",    2, nullptr,                    "CP"},
+  {mjITEM_BUTTON,    "Record",        2, nullptr,                    "CV"},
   {mjITEM_END}
 };
 
@@ -526,15 +527,18 @@ void UpdateInfoText(mj::Simulate* sim,
   solerr = mju_log10(mju_max(mjMINVAL, solerr));
 
   // prepare info text
-  mju::strcpy_arr(title, "Objective\nDoFs\nControls\nParameters\nTime\nMemory");
+  mju::strcpy_arr(title,
+                  "Objective\nDoFs\nControls\nParameters\nTime\nMemory\n"
+                  "Steps/s");
   const mjpc::Trajectory* best_trajectory =
       sim->agent->ActivePlanner().BestTrajectory();
   if (best_trajectory) {
     int nparam = sim->agent->ActivePlanner().NumParameters();
-    mju::sprintf_arr(content, "%.3f\n%d\n%d\n%d\n%-9.3f\n%.2g of %s",
+    mju::sprintf_arr(content, "%.3f\n%d\n%d\n%d\n%-9.3f\n%.2g of %s\n%.3g",
                      best_trajectory->total_return, m->nv, m->nu, nparam,
                      d->time, d->maxuse_arena / (double)(d->narena),
-                     mju_writeNumBytes(d->narena));
+                     mju_writeNumBytes(d->narena),
+                     sim->agent->StepsPerSecond());
   }
 
   // add Energy if enabled
@@ -1162,6 +1166,10 @@ void UiEvent(mjuiState* state) {
       case 5:             // Screenshot
         sim->screenshotrequest.store(true);
         break;
+
+      case 6:             // Record
+        sim->recordrequest.store(true);
+        break;
       }
     }
 
@@ -1684,6 +1692,13 @@ void Simulate::LoadOnRenderThread() {
   this->m = this->mnew;
   this->d = this->dnew;
 
+  // render copy of the new data
+  if (this->d_render) {
+    mj_deleteData(this->d_render);
+  }
+  this->d_render = mj_makeData(this->m);
+  mj_copyData(this->d_render, this->m, this->d);
+
   // re-create scene and context
   mjv_makeScene(this->m, &this->scn, maxgeom);
   if (!this->platform_ui->IsGPUAccelerated()) {
@@ -1750,8 +1765,8 @@ void Simulate::PrepareScene() {
     return;
   }
 
-  // update scene
-  mjv_updateScene(this->m, this->d, &this->opt, &this->pert, &this->cam, mjCAT_ALL, &this->scn);
+  // copy data for rendering, the scene is updated after the lock is released
+  mj_copyData(this->d_render, this->m, this->d);
 
   // update watch
   if (this->ui0_enable && this->ui0.sect[SECT_WATCH].state) {
@@ -1856,11 +1871,17 @@ void Simulate::Render() {
     return;
   }
 
+  // update scene from the copy made by PrepareScene. camera, perturbation
+  // and options are only changed on this thread.
+  mjv_updateScene(this->m, this->d_render, &this->opt, &this->pert, &this->cam,
+                  mjCAT_ALL, &this->scn);
+
   // visualization
   if (this->uiloadrequest.load() == 0) {
     // task-specific
     if (this->agent->ActiveTask()->visualize) {
-      this->agent->ActiveTask()->ModifyScene(this->m, this->d, &this->scn);
+      this->agent->ActiveTask()->ModifyScene(this->m, this->d_render,
+                                             &this->scn);
     }
     // common to all tasks
     this->agent->ModifyScene(&this->scn);
@@ -1948,6 +1969,26 @@ void Simulate::Render() {
     this->agent->PlotShow(&smallrect, &this->platform_ui->mjr_context());
   }
 
+  // start or stop recording, capture a frame without waiting for the GPU
+  if (this->recordrequest.exchange(false)) {
+    if (this->recorder.Recording()) {
+      this->recorder.Stop();
+      std::printf("saved recording: %s (%d frames, %d dropped)\n",
+                  this->recorder.Path().c_str(), this->recorder.Frames(),
+                  this->recorder.DroppedFrames());
+    } else {
+      const std::string path = GetSavePath("recording.mp4");
+      if (!path.empty()) {
+        if (this->recorder.Start(path, this->record_fps)) {
+          std::printf("recording: %s\n", path.c_str());
+        } else {
+          std::printf("could not start recording\n");
+        }
+      }
+    }
+  }
+  this->recorder.Capture(uistate.rect[0], &this->platform_ui->mjr_context());
+
   // take screenshot, save to file
   if (this->screenshotrequest.exchange(false)) {
     const unsigned int h = uistate.rect[0].height;
@@ -2076,7 +2117,14 @@ void Simulate::RenderLoop() {
 
   this->exitrequest.store(true);
 
+  // finish a recording while the context is current
+  this->recorder.Stop();
+
   mjv_freeScene(&this->scn);
+  if (this->d_render) {
+    mj_deleteData(this->d_render);
+    this->d_render = nullptr;
+  }
 }
 
 }  // namespace mujoco
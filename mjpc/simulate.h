@@ -27,6 +27,7 @@
 #include <mujoco/mujoco.h>
 #include <platform_ui_adapter.h>
 #include "mjpc/agent.h"
+#include "mjpc/frame_recorder.h"
 
 #ifdef MJSIMULATE_STATIC
   // static library
@@ -92,6 +93,10 @@ class MJSIMULATEAPI Simulate {
   mjModel* m = nullptr;
   mjData* d = nullptr;
   std::mutex mtx;
+
+  // copy of d taken under mtx, the scene is made and rendered from it after
+  // mtx is released
+  mjData* d_render = nullptr;
   std::condition_variable cond_loadrequest;
 
   // options
@@ -118,6 +123,7 @@ class MJSIMULATEAPI Simulate {
   std::atomic_bool exitrequest = false;
   std::atomic_bool droploadrequest = false;
   std::atomic_bool screenshotrequest = false;
+  std::atomic_bool recordrequest = false;
   std::atomic_int uiloadrequest = 0;
 
   // loadrequest
@@ -178,6 +184,10 @@ class MJSIMULATEAPI Simulate {
   std::unique_ptr<PlatformUIAdapter> platform_ui;
   mjuiState& uistate;
 
+  // offscreen recording of the window (File > Record), frames per second
+  double record_fps = mjpc::kRecordingFps;
+  mjpc::FrameRecorder recorder;
+
   // agent
   std::shared_ptr<mjpc::Agent> agent;
 
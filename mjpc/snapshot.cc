@@ -0,0 +1,130 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace mjpc {
+namespace {
+
+constexpr int kHeaderSize = 16;
+
+// size rounded up to a multiple of 8 bytes
+std::size_t Pad(std::size_t size) { return (size + 7) / 8 * 8; }
+
+template <typename T>
+void Append(std::string& bytes, const T& value) {
+  bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T Load(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter() {
+  bytes_.append(kSnapshotMagic, sizeof(kSnapshotMagic));
+  Append(bytes_, kSnapshotVersion);
+  Append(bytes_, num_sections_);
+}
+
+void SnapshotWriter::Add(std::string_view name, const double* values,
+                         int size) {
+  Append(bytes_, static_cast<std::uint32_t>(name.size()));
+  Append(bytes_, std::uint32_t{0});
+  bytes_.append(name);
+  bytes_.resize(Pad(bytes_.size()), '\0');
+  Append(bytes_, static_cast<std::uint64_t>(size));
+  bytes_.append(reinterpret_cast<const char*>(values), size * sizeof(double));
+
+  // section count in the header
+  num_sections_++;
+  std::memcpy(bytes_.data() + 12, &num_sections_, sizeof(num_sections_));
+}
+
+bool SnapshotReader::Parse(std::string_view bytes) {
+  sections_.clear();
+  if (bytes.size() < kHeaderSize ||
+      std::memcmp(bytes.data(), kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+      Load<std::uint32_t>(bytes.data() + 8) != kSnapshotVersion) {
+    return false;
+  }
+  std::uint32_t num_sections = Load<std::uint32_t>(bytes.data() + 12);
+  std::size_t offset = kHeaderSize;
+  for (std::uint32_t i = 0; i < num_sections; i++) {
+    if (bytes.size() < offset + 8) return false;
+    std::size_t name_size = Load<std::uint32_t>(bytes.data() + offset);
+    std::size_t name_offset = offset + 8;
+    std::size_t size_offset = name_offset + Pad(name_size);
+    if (bytes.size() < size_offset + 8) return false;
+    std::uint64_t size = Load<std::uint64_t>(bytes.data() + size_offset);
+    std::size_t data_offset = size_offset + 8;
+    if ((bytes.size() - data_offset) / sizeof(double) < size) return false;
+    sections_[std::string(bytes.substr(name_offset, name_size))] = {
+        bytes.data() + data_offset, static_cast<int>(size)};
+    offset = data_offset + size * sizeof(double);
+  }
+  return true;
+}
+
+int SnapshotReader::Size(std::string_view name) const {
+  auto it = sections_.find(name);
+  return it == sections_.end() ? -1 : it->second.size;
+}
+
+bool SnapshotReader::Read(std::string_view name, double* values,
+                          int size) const {
+  auto it = sections_.find(name);
+  if (it == sections_.end() || it->second.size != size) return false;
+  std::memcpy(values, it->second.data, size * sizeof(double));
+  return true;
+}
+
+double SnapshotReader::Get(std::string_view name, double default_value) const {
+  double value;
+  return Read(name, &value, 1) ? value : default_value;
+}
+
+const char* SnapshotReader::Data(std::string_view name) const {
+  auto it = sections_.find(name);
+  return it == sections_.end() ? nullptr : it->second.data;
+}
+
+bool ShiftSnapshotTimes(std::string& snapshot, double offset) {
+  SnapshotReader reader;
+  if (!reader.Parse(snapshot)) return false;
+  for (const auto& [name, section] : reader.sections_) {
+    std::string_view view = name;
+    if (view != "times" &&
+        !(view.size() > 6 && view.substr(view.size() - 6) == ".times")) {
+      continue;
+    }
+    char* data = snapshot.data() + (section.data - snapshot.data());
+    for (int i = 0; i < section.size; i++) {
+      double time = Load<double>(data + i * sizeof(double)) + offset;
+      std::memcpy(data + i * sizeof(double), &time, sizeof(double));
+    }
+  }
+  return true;
+}
+
+}  // namespace mjpc
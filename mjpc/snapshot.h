@@ -0,0 +1,95 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Versioned flat binary snapshots of planner and estimator state, e.g., for
+// a standby server to continue from a primary's policy. Layout, in native
+// byte order, with every field 8-byte aligned so that a mapped file can be
+// read in place:
+//   header:  magic "MJPCSNAP" (8 bytes), version (uint32), sections (uint32)
+//   section: name size (uint32), pad (uint32), name (padded to 8 bytes),
+//            values (uint64), values (doubles)
+
+#ifndef MJPC_SNAPSHOT_H_
+#define MJPC_SNAPSHOT_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+namespace mjpc {
+
+inline constexpr char kSnapshotMagic[8] = {'M', 'J', 'P', 'C',
+                                           'S', 'N', 'A', 'P'};
+inline constexpr std::uint32_t kSnapshotVersion = 1;
+
+// writes named sections of doubles
+class SnapshotWriter {
+ public:
+  SnapshotWriter();
+
+  // add a section of size values. names are unique.
+  void Add(std::string_view name, const double* values, int size);
+  void Add(std::string_view name, const std::vector<double>& values) {
+    Add(name, values.data(), values.size());
+  }
+  void Add(std::string_view name, double value) { Add(name, &value, 1); }
+
+  // the snapshot
+  const std::string& Bytes() const { return bytes_; }
+
+ private:
+  std::string bytes_;
+  std::uint32_t num_sections_ = 0;
+};
+
+// reads the sections of a snapshot. the bytes must outlive the reader.
+class SnapshotReader {
+ public:
+  // false if bytes isn't a snapshot of kSnapshotVersion or is truncated
+  bool Parse(std::string_view bytes);
+
+  // values of a section, -1 if missing
+  int Size(std::string_view name) const;
+
+  // copy the values of a section of exactly size values, false otherwise
+  bool Read(std::string_view name, double* values, int size) const;
+
+  // value of a single-value section, or default_value
+  double Get(std::string_view name, double default_value) const;
+
+  // the values of a section, in place. 8-byte aligned if bytes are.
+  const char* Data(std::string_view name) const;
+
+ private:
+  struct Section {
+    const char* data;
+    int size;
+  };
+  absl::flat_hash_map<std::string, Section> sections_;
+
+  friend bool ShiftSnapshotTimes(std::string& snapshot, double offset);
+};
+
+// add offset to the values of the sections named "times" or "*.times", e.g.,
+// the knot times of a policy snapshot, for another start time. false if
+// snapshot isn't a snapshot of kSnapshotVersion.
+bool ShiftSnapshotTimes(std::string& snapshot, double offset);
+
+}  // namespace mjpc
+
+#endif  // MJPC_SNAPSHOT_H_
@@ -0,0 +1,156 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/state_recording.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+
+namespace mjpc {
+
+namespace {
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t dim_state;
+  std::uint32_t dim_mocap;
+  std::uint32_t dim_userdata;
+  std::uint32_t num_parameters;
+  std::uint32_t pad;
+};
+static_assert(sizeof(Header) % 8 == 0);
+
+// doubles of a record
+std::size_t RecordSize(const Header& header) {
+  return 1 + header.dim_state + header.dim_mocap + header.dim_userdata +
+         header.num_parameters;
+}
+}  // namespace
+
+RecordedState RecordedState::From(const State& state, const Task& task) {
+  RecordedState record;
+  record.time = state.time();
+  record.state = state.state();
+  record.mocap = state.mocap();
+  record.userdata = state.userdata();
+  record.parameters = task.parameters;
+  return record;
+}
+
+bool RecordedState::Restore(const mjModel* model, State& state,
+                            Task& task) const {
+  std::size_t dim_state = model->nq + model->nv + model->na;
+  std::size_t dim_mocap = 7 * model->nmocap;
+  std::size_t dim_userdata = model->nuserdata;
+  if (this->state.size() != dim_state || mocap.size() != dim_mocap ||
+      userdata.size() != dim_userdata ||
+      parameters.size() != task.parameters.size()) {
+    return false;
+  }
+
+  // mocap poses are interleaved in the state
+  std::vector<double> mocap_pos(3 * model->nmocap);
+  std::vector<double> mocap_quat(4 * model->nmocap);
+  for (int i = 0; i < model->nmocap; i++) {
+    mju_copy(mocap_pos.data() + 3 * i, mocap.data() + 7 * i, 3);
+    mju_copy(mocap_quat.data() + 4 * i, mocap.data() + 7 * i + 3, 4);
+  }
+  const double* qpos = this->state.data();
+  state.Set(model, qpos, qpos + model->nq, qpos + model->nq + model->nv,
+            mocap_pos.data(), mocap_quat.data(), userdata.data(), time);
+
+  task.parameters = parameters;
+  task.UpdateResidual();
+  return true;
+}
+
+bool WriteStateRecording(const std::string& path,
+                         const std::vector<RecordedState>& records) {
+  Header header = {};
+  std::memcpy(header.magic, kStateRecordingMagic, sizeof(header.magic));
+  header.version = kStateRecordingVersion;
+  if (!records.empty()) {
+    header.dim_state = records[0].state.size();
+    header.dim_mocap = records[0].mocap.size();
+    header.dim_userdata = records[0].userdata.size();
+    header.num_parameters = records[0].parameters.size();
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) return false;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const RecordedState& record : records) {
+    if (record.state.size() != header.dim_state ||
+        record.mocap.size() != header.dim_mocap ||
+        record.userdata.size() != header.dim_userdata ||
+        record.parameters.size() != header.num_parameters) {
+      return false;
+    }
+    file.write(reinterpret_cast<const char*>(&record.time), 8);
+    for (const std::vector<double>* values :
+         {&record.state, &record.mocap, &record.userdata,
+          &record.parameters}) {
+      file.write(reinterpret_cast<const char*>(values->data()),
+                 8 * values->size());
+    }
+  }
+  return static_cast<bool>(file);
+}
+
+bool ReadStateRecording(const std::string& path,
+                        std::vector<RecordedState>* records) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  Header header;
+  if (bytes.size() < sizeof(header)) return false;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (std::memcmp(header.magic, kStateRecordingMagic,
+                  sizeof(header.magic)) != 0 ||
+      header.version != kStateRecordingVersion) {
+    return false;
+  }
+  std::size_t size = 8 * RecordSize(header);
+  if ((bytes.size() - sizeof(header)) % size != 0) return false;
+
+  records->clear();
+  records->resize((bytes.size() - sizeof(header)) / size);
+  const char* data = bytes.data() + sizeof(header);
+  for (RecordedState& record : *records) {
+    std::memcpy(&record.time, data, 8);
+    data += 8;
+    for (auto [values, dim] :
+         {std::pair(&record.state, header.dim_state),
+          std::pair(&record.mocap, header.dim_mocap),
+          std::pair(&record.userdata, header.dim_userdata),
+          std::pair(&record.parameters, header.num_parameters)}) {
+      values->resize(dim);
+      std::memcpy(values->data(), data, 8 * dim);
+      data += 8 * dim;
+    }
+  }
+  return true;
+}
+
+}  // namespace mjpc
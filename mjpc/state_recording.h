@@ -0,0 +1,66 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Recording of the states planning iterations start from, to replay the
+// iterations without the simulation (benchmark/replay_benchmark.cc). Layout
+// of the file, in native byte order:
+//   header: magic "MJPCSREC" (8 bytes), version (uint32), then as uint32:
+//           state size, mocap size, userdata size, parameters, pad
+//   records: time, state, mocap, userdata and task parameters (doubles)
+// all records have the same sizes.
+
+#ifndef MJPC_STATE_RECORDING_H_
+#define MJPC_STATE_RECORDING_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+
+namespace mjpc {
+
+inline constexpr char kStateRecordingMagic[8] = {'M', 'J', 'P', 'C',
+                                                 'S', 'R', 'E', 'C'};
+inline constexpr std::uint32_t kStateRecordingVersion = 1;
+
+// a planning start point
+struct RecordedState {
+  double time = 0.0;
+  std::vector<double> state;       // (nq + nv + na)
+  std::vector<double> mocap;       // (7 nmocap) positions and quaternions
+  std::vector<double> userdata;    // (nuserdata)
+  std::vector<double> parameters;  // task residual parameters
+
+  // the agent's state and the task's parameters
+  static RecordedState From(const State& state, const Task& task);
+
+  // set state to the record, with model's dimensions. the task's parameters
+  // are set and its residual updated, false if the sizes don't match.
+  bool Restore(const mjModel* model, State& state, Task& task) const;
+};
+
+// write records to path, false on error or records of different sizes
+bool WriteStateRecording(const std::string& path,
+                         const std::vector<RecordedState>& records);
+
+// read the records of path, false if it isn't a state recording
+bool ReadStateRecording(const std::string& path,
+                        std::vector<RecordedState>* records);
+
+}  // namespace mjpc
+
+#endif  // MJPC_STATE_RECORDING_H_
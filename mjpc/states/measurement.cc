@@ -0,0 +1,67 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/states/measurement.h"
+
+#include <atomic>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// allocate memory
+void MeasurementBuffer::Allocate(const mjModel* model) {
+  for (Measurement& measurement : buffers_) {
+    measurement.ctrl.assign(model->nu, 0.0);
+    measurement.sensor.assign(model->nsensordata, 0.0);
+    measurement.mocap_pos.assign(3 * model->nmocap, 0.0);
+    measurement.mocap_quat.assign(4 * model->nmocap, 0.0);
+    measurement.userdata.assign(model->nuserdata, 0.0);
+    measurement.time = 0.0;
+  }
+  write_ = 0;
+  read_ = 1;
+  middle_.store(2);
+  overwritten_.store(0);
+  dropped_.store(0);
+}
+
+// copy measurement from data and swap with middle buffer
+void MeasurementBuffer::Publish(const mjModel* model, const mjData* data) {
+  Measurement& measurement = buffers_[write_];
+  mju_copy(measurement.ctrl.data(), data->ctrl, model->nu);
+  mju_copy(measurement.sensor.data(), data->sensordata, model->nsensordata);
+  mju_copy(measurement.mocap_pos.data(), data->mocap_pos, 3 * model->nmocap);
+  mju_copy(measurement.mocap_quat.data(), data->mocap_quat, 4 * model->nmocap);
+  mju_copy(measurement.userdata.data(), data->userdata, model->nuserdata);
+  measurement.time = data->time;
+
+  // release the writes, acquire the consumer's last writes to the old middle
+  int previous = middle_.exchange(write_ | kFresh, std::memory_order_acq_rel);
+  if (previous & kFresh) overwritten_.fetch_add(1);
+  write_ = previous & ~kFresh;
+}
+
+// swap consumer buffer with middle buffer if it is newer
+const Measurement* MeasurementBuffer::Latest() {
+  if (!(middle_.load(std::memory_order_relaxed) & kFresh)) {
+    dropped_.fetch_add(1);
+    return nullptr;
+  }
+  int previous = middle_.exchange(read_, std::memory_order_acq_rel);
+  read_ = previous & ~kFresh;
+  return &buffers_[read_];
+}
+
+}  // namespace mjpc
@@ -0,0 +1,80 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MJPC_STATES_MEASUREMENT_H_
+#define MJPC_STATES_MEASUREMENT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+// simulation quantities consumed by an estimator
+struct Measurement {
+  std::vector<double> ctrl;        // (nu x 1)
+  std::vector<double> sensor;      // (nsensordata x 1)
+  std::vector<double> mocap_pos;   // (3 * nmocap x 1)
+  std::vector<double> mocap_quat;  // (4 * nmocap x 1)
+  std::vector<double> userdata;    // (nuserdata x 1)
+  double time = 0.0;
+};
+
+// single-producer single-consumer triple buffer of measurements
+// the producer writes a private buffer and swaps it with the shared middle
+// buffer, the consumer swaps its buffer with the middle one when it is newer.
+// neither side blocks the other.
+class MeasurementBuffer {
+ public:
+  // constructor
+  MeasurementBuffer() = default;
+
+  // destructor
+  ~MeasurementBuffer() = default;
+
+  // ----- methods ----- //
+
+  // allocate memory and clear the buffers, not safe while in use
+  void Allocate(const mjModel* model);
+
+  // copy measurement from data and make it the latest (producer)
+  void Publish(const mjModel* model, const mjData* data);
+
+  // latest measurement if one was published since the previous call,
+  // otherwise nullptr (consumer). valid until the next call.
+  const Measurement* Latest();
+
+  // published measurements replaced before the consumer read them
+  std::uint64_t overwritten() const { return overwritten_.load(); }
+
+  // calls to Latest without a new measurement
+  std::uint64_t dropped() const { return dropped_.load(); }
+
+ private:
+  // middle_ holds a buffer index and this flag when it is unread
+  static constexpr int kFresh = 4;
+
+  Measurement buffers_[3];
+  int write_ = 0;                // producer buffer
+  int read_ = 1;                 // consumer buffer
+  std::atomic<int> middle_{2};   // shared buffer
+  std::atomic<std::uint64_t> overwritten_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_STATES_MEASUREMENT_H_
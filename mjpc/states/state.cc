@@ -15,6 +15,8 @@
 #include "mjpc/states/state.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
 #include <shared_mutex>
 
@@ -33,17 +35,20 @@ void State::Allocate(const mjModel* model) {
 
 // reset memory to zeros
 void State::Reset() {
-  const std::unique_lock<std::shared_mutex> lock(mtx_);
-  std::fill(state_.begin(), state_.end(), (double)0.0);
-  std::fill(mocap_.begin(), mocap_.end(), 0.0);
-  std::fill(userdata_.begin(), userdata_.end(), 0.0);
-  time_ = 0.0;
+  {
+    const std::unique_lock<std::shared_mutex> lock(mtx_);
+    std::fill(state_.begin(), state_.end(), (double)0.0);
+    std::fill(mocap_.begin(), mocap_.end(), 0.0);
+    std::fill(userdata_.begin(), userdata_.end(), 0.0);
+    time_ = 0.0;
+  }
+  Publish();
 }
 
 // set state from data
 void State::Set(const mjModel* model, const mjData* data) {
   if (model && data) {
-    const std::unique_lock<std::shared_mutex> lock(mtx_);
+    std::unique_lock<std::shared_mutex> lock(mtx_);
 
     state_.resize(model->nq + model->nv + model->na);
     mocap_.resize(7 * model->nmocap);
@@ -61,6 +66,9 @@ void State::Set(const mjModel* model, const mjData* data) {
 
     // time
     SetTime(model, data->time);
+
+    lock.unlock();
+    Publish();
   }
 }
 
@@ -68,7 +76,7 @@ void State::Set(const mjModel* model, const double* qpos, const double* qvel,
                 const double* act, const double* mocap_pos,
                 const double* mocap_quat, const double* userdata, double time) {
   // lock
-  const std::unique_lock<std::shared_mutex> lock(mtx_);
+  std::unique_lock<std::shared_mutex> lock(mtx_);
 
   state_.resize(model->nq + model->nv + model->na);
   mocap_.resize(7 * model->nmocap);
@@ -86,6 +94,25 @@ void State::Set(const mjModel* model, const double* qpos, const double* qvel,
 
   // time
   SetTime(model, time);
+
+  lock.unlock();
+  Publish();
+}
+
+void State::Publish() {
+  {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    version_.fetch_add(1);
+  }
+  update_cv_.notify_all();
+}
+
+bool State::WaitForUpdate(
+    std::uint64_t version,
+    std::chrono::steady_clock::time_point deadline) const {
+  std::unique_lock<std::mutex> lock(update_mutex_);
+  return update_cv_.wait_until(lock, deadline,
+                               [&] { return version_.load() != version; });
 }
 
 // TODO: make all these "Set*" functions thread-safe, or change their name.
@@ -15,6 +15,11 @@
 #ifndef MJPC_STATES_STATE_H_
 #define MJPC_STATES_STATE_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <shared_mutex>
 #include <vector>
 
@@ -79,12 +84,27 @@ class State {
   const std::vector<double>& userdata() const { return userdata_; }
   double time() const { return time_; }
 
+  // number of times the state was set or reset, e.g., for a planner to tell
+  // whether a new state was published since its last iteration
+  std::uint64_t Version() const { return version_.load(); }
+
+  // wait until the state is set or reset after version, or until deadline.
+  // returns true if it was.
+  bool WaitForUpdate(std::uint64_t version,
+                     std::chrono::steady_clock::time_point deadline) const;
+
  private:
+  // increment the version and wake the threads waiting for an update
+  void Publish();
+
   std::vector<double> state_;  // (state dimension x 1)
   std::vector<double> mocap_;  // (mocap dimension x 1)
   std::vector<double> userdata_;  // (nuserdata x 1)
   double time_;
   mutable std::shared_mutex mtx_;
+  std::atomic<std::uint64_t> version_ = 0;
+  mutable std::mutex update_mutex_;
+  mutable std::condition_variable update_cv_;
 };
 
 }  // namespace mjpc
@@ -14,11 +14,23 @@
 
 #include "mjpc/task.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstring>
+#include <iostream>
 #include <mutex>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include <absl/container/flat_hash_map.h>
+#include <absl/strings/ascii.h>
 #include <absl/strings/match.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/strip.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/norm.h"
 #include "mjpc/utilities.h"
@@ -34,6 +46,35 @@ void MissingParameterError(const mjModel* m, int sensorid) {
 }
 }  // namespace
 
+namespace {
+thread_local bool residual_skipped = false;
+}  // namespace
+
+bool ResidualSkipped() { return residual_skipped; }
+
+namespace {
+std::atomic<bool> traces_enabled = true;
+}  // namespace
+
+void SetTracesEnabled(bool enabled) { traces_enabled = enabled; }
+
+bool TracesEnabled() { return traces_enabled; }
+
+ScopedResidualSkip::ScopedResidualSkip(bool skip)
+    : previous_(residual_skipped) {
+  residual_skipped = previous_ || skip;
+}
+
+ScopedResidualSkip::~ScopedResidualSkip() { residual_skipped = previous_; }
+
+int TimeGrid::Index(double t) const {
+  if (timestep <= 0.0) return -1;
+  double index = (t - time) / timestep;
+  if (!(index > -0.5 && index < steps - 0.5)) return -1;
+  int i = std::lround(index);
+  return std::abs(index - i) < 1.0e-6 ? i : -1;
+}
+
 // initial residual parameters from model
 void Task::SetFeatureParameters(const mjModel* model) {
   // set counter
@@ -63,6 +104,94 @@ void Task::SetFeatureParameters(const mjModel* model) {
   }
 }
 
+void Task::SetNameIndices(const mjModel* model) {
+  parameter_index_.clear();
+  selection_index_.clear();
+  weight_index_.clear();
+
+  // parameters are ordered as the model's "residual_" numerics
+  int shift = 0;
+  for (int i = 0; i < model->nnumeric; i++) {
+    std::string_view name(model->names + model->name_numericadr[i]);
+    if (!absl::StartsWith(name, "residual_")) continue;
+    if (absl::StartsWith(name, "residual_select_")) {
+      selection_index_[absl::AsciiStrToLower(
+          absl::StripPrefix(name, "residual_select_"))] = shift;
+    }
+    parameter_index_[absl::AsciiStrToLower(
+        absl::StripPrefix(name, "residual_"))] = shift;
+    shift++;
+  }
+
+  // weights of the leading user sensors
+  for (int i = 0; i < model->nsensor && model->sensor_type[i] == mjSENS_USER &&
+                  !SkippedSensor(model, i);
+       i++) {
+    weight_index_[absl::AsciiStrToLower(
+        model->names + model->name_sensoradr[i])] = i;
+  }
+}
+
+namespace {
+// index of name in a map of lowercase names, -1 if not found
+int NameIndex(const absl::flat_hash_map<std::string, int>& index,
+              std::string_view name) {
+  auto it = index.find(absl::AsciiStrToLower(name));
+  return it == index.end() ? -1 : it->second;
+}
+}  // namespace
+
+int Task::ParameterIndexByName(std::string_view name) const {
+  return NameIndex(parameter_index_, name);
+}
+
+int Task::SelectionIndexByName(std::string_view name) const {
+  return NameIndex(selection_index_, name);
+}
+
+int Task::WeightIndexByName(std::string_view name) const {
+  return NameIndex(weight_index_, name);
+}
+
+void SensorTable::Resolve(const mjModel* model,
+                          const std::vector<std::string>& names) {
+  adr_.resize(names.size());
+  dim_.resize(names.size());
+  for (int i = 0; i < names.size(); i++) {
+    int id = mj_name2id(model, mjOBJ_SENSOR, names[i].c_str());
+    if (id == -1) {
+      std::cerr << "sensor \"" << names[i] << "\" not found.\n";
+      adr_[i] = -1;
+      dim_[i] = -1;
+    } else {
+      adr_[i] = model->sensor_adr[id];
+      dim_[i] = model->sensor_dim[id];
+    }
+  }
+}
+
+double* SensorTable::Data(const mjModel* model, const mjData* data,
+                          int handle) const {
+  if (handle < 0 || handle >= size() || adr_[handle] < 0 ||
+      adr_[handle] + dim_[handle] > model->nsensordata) {
+    mju_error("sensor handle %d is not resolved for this model", handle);
+    return nullptr;
+  }
+  return data->sensordata + adr_[handle];
+}
+
+int SensorTable::Dim(int handle) const {
+  return handle >= 0 && handle < size() ? dim_[handle] : -1;
+}
+
+void ResidualFn::ResidualBatch(const mjModel* model,
+                               const mjData* const* data,
+                               double* const* residual, int n) const {
+  for (int i = 0; i < n; i++) {
+    Residual(model, data[i], residual[i]);
+  }
+}
+
 BaseResidualFn::BaseResidualFn(const Task* task) : task_(task) {
   Update();
 }
@@ -74,10 +203,14 @@ void BaseResidualFn::CostTerms(double* terms, const double* residual,
   int p_shift = 0;
   for (int k = 0; k < num_term_; k++) {
     // running cost
-    terms[k] =
-        (weighted ? weight_[k] : 1) * Norm(nullptr, nullptr, residual + f_shift,
-                                           DataAt(norm_parameter_, p_shift),
-                                           dim_norm_residual_[k], norm_[k]);
+    if (weighted && !TermActive(k)) {
+      terms[k] = 0.0;
+    } else {
+      terms[k] = (weighted ? weight_[k] : 1) *
+                 Norm(nullptr, nullptr, residual + f_shift,
+                      DataAt(norm_parameter_, p_shift), dim_norm_residual_[k],
+                      norm_[k]);
+    }
 
     // shift residual
     f_shift += dim_norm_residual_[k];
@@ -109,6 +242,44 @@ double BaseResidualFn::CostValue(const double* residual) const {
   }
 }
 
+// compute weighted costs of T residuals, one norm batch per term
+void BaseResidualFn::CostValues(double* costs, const double* residual,
+                                int T) const {
+  // term values, in chunks of time steps
+  constexpr int kChunk = 64;
+  double values[kChunk];
+
+  for (int begin = 0; begin < T; begin += kChunk) {
+    int n = std::min(kChunk, T - begin);
+    double* c = costs + begin;
+    const double* r = residual + begin * num_residual_;
+    std::fill(c, c + n, 0.0);
+
+    // summation of cost terms
+    int f_shift = 0;
+    int p_shift = 0;
+    for (int k = 0; k < num_term_; k++) {
+      if (TermActive(k)) {
+        NormBatch(values, nullptr, nullptr, r + f_shift,
+                  DataAt(norm_parameter_, p_shift), dim_norm_residual_[k], n,
+                  num_residual_, 0, 0, norm_[k]);
+        for (int t = 0; t < n; t++) {
+          c[t] += weight_[k] * values[t];
+        }
+      }
+      f_shift += dim_norm_residual_[k];
+      p_shift += num_norm_parameter_[k];
+    }
+
+    // exponential risk transformation
+    if (mju_abs(risk_) >= kRiskNeutralTolerance) {
+      for (int t = 0; t < n; t++) {
+        c[t] = (mju_exp(risk_ * c[t]) - 1.0) / risk_;
+      }
+    }
+  }
+}
+
 void BaseResidualFn::Update() {
   num_residual_ = task_->num_residual;
   num_term_ = task_->num_term;
@@ -120,6 +291,7 @@ void BaseResidualFn::Update() {
   norm_parameter_ = task_->norm_parameter;
   risk_ = task_->risk;
   parameters_ = task_->parameters;
+  sensors_ = task_->sensors;
 }
 
 std::unique_ptr<ResidualFn> Task::Residual() const {
@@ -127,6 +299,28 @@ std::unique_ptr<ResidualFn> Task::Residual() const {
   return ResidualLocked();
 }
 
+std::shared_ptr<const ResidualFn> Task::ResidualSnapshot() const {
+  // current snapshot
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+  if (!snapshot || snapshot->version != ResidualVersion()) {
+    // the version only changes with mutex_ held
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::uint64_t version = ResidualVersion();
+    snapshot = std::atomic_load(&snapshot_);
+    if (!snapshot || snapshot->version != version) {
+      auto fresh = std::make_shared<Snapshot>();
+      fresh->version = version;
+      fresh->residual = ResidualLocked();
+      fresh->residual->SelectMode();
+      snapshot = std::move(fresh);
+      std::atomic_store(&snapshot_, snapshot);
+    }
+  }
+
+  // share ownership of the snapshot
+  return std::shared_ptr<const ResidualFn>(snapshot, snapshot->residual.get());
+}
+
 void Task::Residual(const mjModel* model, const mjData* data,
                               double* residual) const {
   std::lock_guard<std::mutex> lock(mutex_);
@@ -136,12 +330,26 @@ void Task::Residual(const mjModel* model, const mjData* data,
 void Task::UpdateResidual() {
   std::lock_guard<std::mutex> lock(mutex_);
   InternalResidual()->Update();
+  BumpResidualVersion();
+}
+
+void Task::UpdateResidual(const ResidualUpdate& update) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& [index, value] : update.parameters) {
+    if (index >= 0 && index < parameters.size()) parameters[index] = value;
+  }
+  for (const auto& [index, value] : update.weights) {
+    if (index >= 0 && index < weight.size()) weight[index] = value;
+  }
+  InternalResidual()->Update();
+  BumpResidualVersion();
 }
 
 void Task::Transition(mjModel* model, mjData* data) {
   std::lock_guard<std::mutex> lock(mutex_);
   TransitionLocked(model, data);
   InternalResidual()->Update();
+  BumpResidualVersion();
 }
 
 void Task::Reset(const mjModel* model) {
@@ -155,8 +363,17 @@ void Task::Reset(const mjModel* model) {
   // risk value
   risk = GetNumberOrDefault(0.0, model, "task_risk");
 
+  // residual evaluation stride
+  residual_stride =
+      std::max(GetNumberOrDefault(1, model, "task_residual_stride"), 1);
+
+  // early stopped rollouts
+  termination = false;
+  failure_cost = GetNumberOrDefault(1.0e6, model, "task_failure_cost");
+
   // set residual parameters
   this->SetFeatureParameters(model);
+  SetNameIndices(model);
 
   // ----- set costs ----- //
   num_term = 0;
@@ -177,8 +394,11 @@ void Task::Reset(const mjModel* model) {
         "specified first and sequentially\n");
   }
 
+  // cost terms end at the first sensor that isn't a user sensor, or is one
+  // skipped on a planning model
   for (int i = 1; true; i++) {
-    if (i == model->nsensor || model->sensor_type[i] != mjSENS_USER) {
+    if (i == model->nsensor || model->sensor_type[i] != mjSENS_USER ||
+        SkippedSensor(model, i)) {
       num_term = i;
       break;
     }
@@ -199,6 +419,15 @@ void Task::Reset(const mjModel* model) {
   if (num_trace > kMaxTraces) {
     mju_error("Number of traces should be less than 100\n");
   }
+  if (!TracesEnabled()) num_trace = 0;
+
+  // trace sensor addresses, looked up once instead of at every rollout step
+  trace_sensor_adr.resize(num_trace);
+  for (int i = 0; i < num_trace; i++) {
+    std::string name = absl::StrCat("trace", i);
+    int id = mj_name2id(model, mjOBJ_SENSOR, name.c_str());
+    trace_sensor_adr[i] = id == -1 ? -1 : model->sensor_adr[id];
+  }
 
   // loop over sensors
   int parameter_shift = 0;
@@ -242,6 +471,7 @@ void Task::Reset(const mjModel* model) {
 
   ResetLocked(model);
   InternalResidual()->Update();
+  BumpResidualVersion();
 }
 
 void Task::CostTerms(double* terms, const double* residual) const {
@@ -260,4 +490,30 @@ double Task::CostValue(const double* residual) const {
   return InternalResidual()->CostValue(residual);
 }
 
+void Task::CostValues(double* costs, const double* residual, int T) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InternalResidual()->CostValues(costs, residual, T);
+}
+
+bool Task::Terminated(const mjModel* model, const mjData* data) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return InternalResidual()->Terminated(model, data);
+}
+
+void Task::SetTerminalValue(std::shared_ptr<const TerminalValueFn> value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  terminal_value_ = std::move(value);
+}
+
+double Task::TerminalValue(const double* state) const {
+  // evaluated outside the lock, so that rollouts on different threads don't
+  // wait on an expensive approximator
+  std::shared_ptr<const TerminalValueFn> value;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    value = terminal_value_;
+  }
+  return value ? value->Value(state) : 0.0;
+}
+
 }  // namespace mjpc
@@ -15,13 +15,22 @@
 #ifndef MJPC_TASK_H_
 #define MJPC_TASK_H_
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include <absl/container/flat_hash_map.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/norm.h"
+#include "mjpc/terminal_value.h"
 
 namespace mjpc {
 
@@ -33,6 +42,68 @@ inline constexpr int kMaxCostTerms = 128;
 
 class Task;
 
+// true on a thread while a ScopedResidualSkip is set. the residual sensor
+// callbacks leave sensordata unchanged, e.g., on rollout steps between
+// residual strides.
+bool ResidualSkipped();
+
+// rollouts record traces only while enabled (default). applications that do
+// not draw rollouts disable them before their tasks are reset: the tasks then
+// have num_trace = 0 and trajectories allocate no trace storage.
+void SetTracesEnabled(bool enabled);
+bool TracesEnabled();
+
+class ScopedResidualSkip {
+ public:
+  explicit ScopedResidualSkip(bool skip = true);
+  ~ScopedResidualSkip();
+
+  ScopedResidualSkip(const ScopedResidualSkip&) = delete;
+  ScopedResidualSkip& operator=(const ScopedResidualSkip&) = delete;
+
+ private:
+  bool previous_;
+};
+
+// sensordata addresses of the sensors a residual reads, resolved by name once
+// per model (in Task::ResetLocked) rather than at every evaluation. a handle
+// is the position of the sensor's name in the resolved list.
+class SensorTable {
+ public:
+  // resolve names in order, replacing previous handles. missing sensors are
+  // reported and fail when accessed.
+  void Resolve(const mjModel* model, const std::vector<std::string>& names);
+  template <std::size_t N>
+  void Resolve(const mjModel* model, const char* const (&names)[N]) {
+    Resolve(model, std::vector<std::string>(names, names + N));
+  }
+
+  // sensordata of the sensor with the given handle. checked: the handle must
+  // be resolved and lie within the model's sensordata.
+  double* Data(const mjModel* model, const mjData* data, int handle) const;
+
+  // sensordata address and dimension of the sensor with the given handle,
+  // -1 if missing
+  int Address(int handle) const { return adr_[handle]; }
+  int Dim(int handle) const;
+
+  int size() const { return adr_.size(); }
+
+ private:
+  std::vector<int> adr_;  // -1 for missing sensors
+  std::vector<int> dim_;
+};
+
+// planning time grid: the times time + i * timestep, i < steps
+struct TimeGrid {
+  double time = 0.0;
+  double timestep = 0.0;
+  int steps = 0;
+
+  // index of the grid time equal to t, -1 if t is not on the grid
+  int Index(double t) const;
+};
+
 // abstract class for a residual function
 class ResidualFn {
  public:
@@ -40,10 +111,49 @@ class ResidualFn {
 
   virtual void Residual(const mjModel* model, const mjData* data,
                         double* residual) const = 0;
+
+  // residuals of n data at the same time step, residual[i] for data[i].
+  // the default calls Residual for each sample; tasks can override this to
+  // hoist work shared across samples.
+  virtual void ResidualBatch(const mjModel* model, const mjData* const* data,
+                             double* const* residual, int n) const;
+
+  // a copy of this residual function with its time-only terms (e.g., gait
+  // schedules or reference trajectories) precomputed on the planning time
+  // grid. called once per planning iteration; rollouts at grid times look
+  // the values up instead of recomputing them in every sample. nullptr if the
+  // residual has no time-only terms.
+  virtual std::unique_ptr<ResidualFn> PrecomputeTimeGrid(
+      const TimeGrid& grid) const {
+    return nullptr;
+  }
+
+  // true if the state in data is terminal, e.g., a fallen robot. rollouts of
+  // tasks with Task::termination stop at terminal states with the task's
+  // failure cost, checked at residual evaluations.
+  virtual bool Terminated(const mjModel* model, const mjData* data) const {
+    return false;
+  }
+
+  // specializes this residual function for its current mode, e.g., to skip
+  // the terms of other modes. called once when a planning snapshot is taken;
+  // snapshots keep their mode. the default does nothing.
+  virtual void SelectMode() {}
+
+  // true if cost term k has a nonzero weight. the weighted costs and the
+  // cost derivatives skip inactive terms, so that Residual may skip their
+  // residuals.
+  virtual bool TermActive(int k) const { return true; }
+
+  // with weighted, inactive terms are zero without evaluating their norms
   virtual void CostTerms(double* terms, const double* residual,
                          bool weighted) const = 0;
   virtual double CostValue(const double* residual) const = 0;
 
+  // cost values of T residuals with stride num_residual
+  virtual void CostValues(double* costs, const double* residual,
+                          int T) const = 0;
+
   // copies weights and parameters from the Task instance. This should be
   // called from the Task class.
   virtual void Update() = 0;
@@ -55,12 +165,32 @@ class BaseResidualFn : public ResidualFn {
   explicit BaseResidualFn(const Task* task);
   virtual ~BaseResidualFn() = default;
 
+  bool TermActive(int k) const override { return weight_[k] != 0.0; }
   void CostTerms(double* terms, const double* residual,
                  bool weighted) const override;
   double CostValue(const double* residual) const override;
+  void CostValues(double* costs, const double* residual,
+                  int T) const override;
   void Update() override;
 
  protected:
+  // residual of one mode, e.g., a template instance with the mode as a
+  // constant, so that other modes' terms and the branches on the mode are
+  // compiled out
+  using ModeResidualFn = void (*)(const BaseResidualFn* residual_fn,
+                                  const mjModel* model, const mjData* data,
+                                  double* residual);
+
+  // table of T::ModeResidual<mode>, mode < kNumMode, for tasks that dispatch
+  // on their mode. T befriends BaseResidualFn if ModeResidual is private.
+  template <typename T, int kNumMode>
+  static constexpr std::array<ModeResidualFn, kNumMode> ModeResidualTable() {
+    return ModeResidualTable<T>(std::make_integer_sequence<int, kNumMode>());
+  }
+
+  // the mode residual selected by SelectMode, nullptr if none is selected
+  ModeResidualFn mode_residual_ = nullptr;
+
   int num_residual_;
   int num_term_;
   int num_trace_;
@@ -71,7 +201,31 @@ class BaseResidualFn : public ResidualFn {
   std::vector<double> norm_parameter_;
   double risk_;
   std::vector<double> parameters_;
+  SensorTable sensors_;
   const Task* task_;
+
+ private:
+  template <typename T, int kMode>
+  static void CallModeResidual(const BaseResidualFn* residual_fn,
+                               const mjModel* model, const mjData* data,
+                               double* residual) {
+    static_cast<const T*>(residual_fn)
+        ->template ModeResidual<kMode>(model, data, residual);
+  }
+  template <typename T, int... kModes>
+  static constexpr std::array<ModeResidualFn, sizeof...(kModes)>
+  ModeResidualTable(std::integer_sequence<int, kModes...>) {
+    return {&CallModeResidual<T, kModes>...};
+  }
+};
+
+// residual parameter and cost weight values, by index, applied together by
+// Task::UpdateResidual
+struct ResidualUpdate {
+  std::vector<std::pair<int, double>> parameters;
+  std::vector<std::pair<int, double>> weights;
+
+  bool empty() const { return parameters.empty() && weights.empty(); }
 };
 
 // Thread-safe interface for classes that implement MJPC task specifications
@@ -84,6 +238,17 @@ class Task {
   // delegates to ResidualLocked, while holding a lock
   std::unique_ptr<ResidualFn> Residual() const;
 
+  // returns an immutable copy of the residual function, shared until the next
+  // change to InternalResidual. while the version is unchanged this neither
+  // locks nor allocates.
+  std::shared_ptr<const ResidualFn> ResidualSnapshot() const;
+
+  // incremented on every change to InternalResidual (Reset, Transition,
+  // UpdateResidual)
+  std::uint64_t ResidualVersion() const {
+    return residual_version_.load(std::memory_order_acquire);
+  }
+
   // ----- methods ----- //
   // calls Residual on the pointer returned from InternalResidual(), while
   // holding a lock
@@ -95,6 +260,19 @@ class Task {
   // Calls InternalResidual()->Update() with a lock.
   void UpdateResidual();
 
+  // writes the values of update and updates the residual under one lock, so
+  // that residuals and snapshots see all or none of the values, as one
+  // version. indices out of range are ignored.
+  void UpdateResidual(const ResidualUpdate& update);
+
+  // index of a residual parameter, "residual_<name>" numeric (this includes
+  // "select_<name>" selections), of a selection parameter,
+  // "residual_select_<name>", or of the weight of a user sensor. names are
+  // case-insensitive and indexed by Reset. -1 if not found.
+  int ParameterIndexByName(std::string_view name) const;
+  int SelectionIndexByName(std::string_view name) const;
+  int WeightIndexByName(std::string_view name) const;
+
   // Changes to data will affect the planner at the next set_state.  Changes to
   // model will only affect the physics and render threads, and will not affect
   // the planner. This is useful for studying planning under model discrepancy,
@@ -118,6 +296,21 @@ class Task {
   // holding a lock
   double CostValue(const double* residual) const;
 
+  // calls CostValues on the pointer returned from InternalResidual(), while
+  // holding a lock
+  void CostValues(double* costs, const double* residual, int T) const;
+
+  // calls Terminated on the pointer returned from InternalResidual(), while
+  // holding a lock
+  bool Terminated(const mjModel* model, const mjData* data) const;
+
+  // terminal value of rollouts, added to the return at their final state.
+  // nullptr (default) for none. kept across Reset.
+  void SetTerminalValue(std::shared_ptr<const TerminalValueFn> value);
+
+  // terminal value of state (qpos, qvel, act), 0 without a terminal value
+  double TerminalValue(const double* state) const;
+
   virtual void ModifyScene(const mjModel* model, const mjData* data,
                            mjvScene* scene) const {}
 
@@ -135,6 +328,7 @@ class Task {
   int num_residual;
   int num_term;
   int num_trace;
+  std::vector<int> trace_sensor_adr;  // sensordata of "trace<i>", -1: none
   std::vector<int> dim_norm_residual;
   std::vector<int> num_norm_parameter;
   std::vector<NormType> norm;
@@ -142,9 +336,26 @@ class Task {
   std::vector<double> norm_parameter;
   double risk;
 
+  // rollouts evaluate the residual every residual_stride physics steps and
+  // hold it in between, so each evaluation is weighted by the stride. from
+  // the model's "task_residual_stride" numeric.
+  int residual_stride = 1;
+
+  // rollouts check Terminated at residual evaluations, set by the
+  // ResetLocked of tasks with terminal states
+  bool termination = false;
+
+  // return of rollouts that stop early, at simulation warnings, bad
+  // residuals or terminal states. from the model's "task_failure_cost"
+  // numeric.
+  double failure_cost = 1.0e6;
+
   // residual parameters
   std::vector<double> parameters;
 
+  // sensors read by the residual, copied to residual functions
+  SensorTable sensors;
+
  protected:
   // returns a pointer to the ResidualFn instance that's used for physics
   // stepping and plotting, and is internal to the class
@@ -167,8 +378,37 @@ class Task {
   mutable std::mutex mutex_;
 
  private:
+  // residual function copy and the version it was made from
+  struct Snapshot {
+    std::uint64_t version;
+    std::unique_ptr<ResidualFn> residual;
+  };
+
   // initial residual parameters from model
   void SetFeatureParameters(const mjModel* model);
+
+  // lowercase parameter, selection and weight names of model, to indices
+  void SetNameIndices(const mjModel* model);
+  absl::flat_hash_map<std::string, int> parameter_index_;
+  absl::flat_hash_map<std::string, int> selection_index_;
+  absl::flat_hash_map<std::string, int> weight_index_;
+
+  // mark InternalResidual as changed, with mutex_ held
+  void BumpResidualVersion() {
+    residual_version_.fetch_add(1, std::memory_order_release);
+  }
+
+  std::atomic<std::uint64_t> residual_version_{0};
+  // guarded by mutex_
+  std::shared_ptr<const TerminalValueFn> terminal_value_;
+  // latest snapshot, accessed with std::atomic_load and std::atomic_store
+  mutable std::shared_ptr<const Snapshot> snapshot_;
+};
+
+// a task by name, constructed on first use. name must equal make()->Name().
+struct RegisteredTask {
+  std::string name;
+  std::function<std::shared_ptr<Task>()> make;
 };
 
 }  // namespace mjpc
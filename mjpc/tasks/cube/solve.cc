@@ -15,40 +15,48 @@
 #include "mjpc/tasks/cube/solve.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <random>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/shared_model.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace {
   constexpr static double kResetHeight = -0.1;  // cube height to reset
+
+  // names of ResidualFn::Sensor
+  constexpr const char* kSensorNames[] = {
+      "palm_position", "cube_position", "cube_goal_orientation",
+      "cube_orientation", "cube_linear_velocity",
+  };
+  static_assert(std::size(kSensorNames) == CubeSolve::ResidualFn::kNumSensor);
+
+  constexpr int kTurnSteps = 2000;         // transition steps per face turn
+  constexpr int kMaxTurnCacheSize = 4096;  // cached turn sequences
 }  // namespace
 
 std::string CubeSolve::XmlPath() const { return GetModelPath("cube/task.xml"); }
 std::string CubeSolve::Name() const { return "Cube Solving"; }
 
 CubeSolve::CubeSolve() : residual_(this) {
-  // path to transition model xml
-  std::string path = GetModelPath("cube/transition_model.xml");
-
-  // load transition model
-  constexpr int kErrorLength = 1024;
-  char load_error[kErrorLength] = "";
-  transition_model_ =
-      mj_loadXML(path.c_str(), nullptr, load_error, kErrorLength);
-  transition_data_ = mj_makeData(transition_model_);
-
   // goal cache
   goal_cache_.resize(6 * 10);
   std::fill(goal_cache_.begin(), goal_cache_.end(), 0.0);
 }
 
 CubeSolve::~CubeSolve() {
+  // the pending scramble uses the transition model
+  if (scramble_.valid()) scramble_.wait();
   if (transition_data_) mj_deleteData(transition_data_);
-  if (transition_model_) mj_deleteModel(transition_model_);
 }
 
 // ---------- Residuals for cube solving manipulation task ----
@@ -56,18 +64,38 @@ CubeSolve::~CubeSolve() {
 // ------------------------------------------------------------
 void CubeSolve::ResidualFn::Residual(const mjModel* model, const mjData* data,
                                      double* residual) const {
+  ModeResidualFn mode_residual =
+      mode_residual_ ? mode_residual_ : CurrentModeResidual();
+  mode_residual(this, model, data, residual);
+}
+
+void CubeSolve::ResidualFn::SelectMode() {
+  mode_residual_ = CurrentModeResidual();
+}
+
+CubeSolve::ResidualFn::ModeResidualFn
+CubeSolve::ResidualFn::CurrentModeResidual() const {
+  static constexpr auto kModeResiduals =
+      ModeResidualTable<ResidualFn, kNumMode>();
+  return kModeResiduals[current_mode_];
+}
+
+template <int kMode>
+void CubeSolve::ResidualFn::ModeResidual(const mjModel* model,
+                                         const mjData* data,
+                                         double* residual) const {
   // initialize counter
   int counter = 0;
 
-  // lock current mode
-  int mode = current_mode_;
+  // mode, constant in each instance
+  constexpr int mode = kMode;
 
   // ---------- Residual (0) ----------
   // goal position
-  double* goal_position = SensorByName(model, data, "palm_position");
+  double* goal_position = sensors_.Data(model, data, kPalmPosition);
 
   // system's position
-  double* position = SensorByName(model, data, "cube_position");
+  double* position = sensors_.Data(model, data, kCubePosition);
 
   // position error
   mju_sub3(residual + counter, position, goal_position);
@@ -75,10 +103,11 @@ void CubeSolve::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // ---------- Residual (1) ----------
   // goal orientation
-  double* goal_orientation = SensorByName(model, data, "cube_goal_orientation");
+  double* goal_orientation =
+      sensors_.Data(model, data, kCubeGoalOrientation);
 
   // system's orientation
-  double* orientation = SensorByName(model, data, "cube_orientation");
+  double* orientation = sensors_.Data(model, data, kCubeOrientation);
   mju_normalize4(goal_orientation);
 
   // orientation error
@@ -87,7 +116,7 @@ void CubeSolve::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // ---------- Residual (2) ----------
   double* cube_linear_velocity =
-      SensorByName(model, data, "cube_linear_velocity");
+      sensors_.Data(model, data, kCubeLinearVelocity);
   mju_copy(residual + counter, cube_linear_velocity, 3);
   counter += 3;
 
@@ -131,71 +160,155 @@ void CubeSolve::ResidualFn::Residual(const mjModel* model, const mjData* data,
   CheckSensorDim(model, counter);
 }
 
+void CubeSolve::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+
+  // load transition model on first use, once for all instances. tasks that
+  // are never selected don't load it.
+  if (!transition_model_) {
+    std::string load_error;
+    transition_model_ = LoadSharedModel(
+        GetModelPath("cube/transition_model.xml"), &load_error);
+    if (transition_model_) {
+      transition_data_ = mj_makeData(transition_model_.get());
+    } else {
+      std::cerr << load_error << "\n";
+    }
+  }
+
+  // scramble generator
+  int seed = GetNumberOrDefault(0, model, "scramble_seed");
+  scramble_rng_.seed(seed ? static_cast<std::uint32_t>(seed)
+                          : std::random_device()());
+}
+
+CubeSolve::Scramble CubeSolve::SimulateScramble(std::vector<int> face,
+                                                std::vector<int> direction) {
+  int num_scramble = face.size();
+  int nq = transition_model_->nq;
+  int nv = transition_model_->nv;
+  int nu = transition_model_->nu;
+
+  // longest cached prefix of the turns. the cache holds every prefix of its
+  // sequences, so it is only cleared here.
+  if (turn_cache_.size() >= kMaxTurnCacheSize) turn_cache_.clear();
+  std::vector<int> turns(num_scramble);
+  for (int i = 0; i < num_scramble; i++) {
+    turns[i] = 2 * face[i] + (direction[i] > 0);
+  }
+  mj_resetData(transition_model_.get(), transition_data_);
+  int cached = num_scramble;
+  for (; cached > 0; cached--) {
+    auto entry = turn_cache_.find(
+        std::vector<int>(turns.begin(), turns.begin() + cached));
+    if (entry != turn_cache_.end()) {
+      const std::vector<double>& state = entry->second;
+      mju_copy(transition_data_->qpos, state.data(), nq);
+      mju_copy(transition_data_->qvel, state.data() + nq, nv);
+      mju_copy(transition_data_->ctrl, state.data() + nq + nv, nu);
+      break;
+    }
+  }
+
+  Scramble scramble;
+  scramble.goal_cache.resize(6 * num_scramble);
+  for (int i = 0; i < num_scramble; i++) {
+    if (i >= cached) {
+      // goal face orientations, then the turn
+      mju_copy(scramble.goal_cache.data() + i * 6, transition_data_->qpos, 6);
+      for (int t = 0; t < kTurnSteps; t++) {
+        transition_data_->ctrl[face[i]] =
+            direction[i] * 1.57 * t / kTurnSteps;
+        mj_step(transition_model_.get(), transition_data_);
+      }
+
+      // cache the state after the turn
+      std::vector<double>& state = turn_cache_[std::vector<int>(
+          turns.begin(), turns.begin() + i + 1)];
+      state.resize(nq + nv + nu);
+      mju_copy(state.data(), transition_data_->qpos, nq);
+      mju_copy(state.data() + nq, transition_data_->qvel, nv);
+      mju_copy(state.data() + nq + nv, transition_data_->ctrl, nu);
+    } else {
+      // goal: the cached state before this turn
+      if (i == 0) {
+        mju_copy(scramble.goal_cache.data(), transition_model_->qpos0, 6);
+      } else {
+        mju_copy(scramble.goal_cache.data() + i * 6,
+                 turn_cache_
+                     .at(std::vector<int>(turns.begin(), turns.begin() + i))
+                     .data(),
+                 6);
+      }
+    }
+
+    // zero out noise
+    for (int j = 0; j < 6; j++) {
+      double val = scramble.goal_cache[i * 6 + j];
+      if (mju_abs(val) < 1.0e-4) {
+        scramble.goal_cache[i * 6 + j] = 0.0;
+      }
+      if (val < 0.5 * mjPI * 1.1 && val > 0.5 * mjPI * 0.9) {
+        scramble.goal_cache[i * 6 + j] = 0.5 * mjPI;
+      }
+      if (val < -0.5 * mjPI * 1.1 && val > -0.5 * mjPI * 0.9) {
+        scramble.goal_cache[i * 6 + j] = 0.5 * mjPI;
+      }
+    }
+  }
+  scramble.qpos.assign(transition_data_->qpos, transition_data_->qpos + 86);
+  scramble.face = std::move(face);
+  scramble.direction = std::move(direction);
+  return scramble;
+}
+
 // ----- Transition for cube solving manipulation task -----
 //   If cube is within tolerance or floor ->
 //   reset cube into hand.
 // ---------------------------------------------------------
 void CubeSolve::TransitionLocked(mjModel* model, mjData* data) {
+  // a scramble finished after the mode was changed is dropped
+  bool scramble_ready =
+      scramble_.valid() && scramble_.wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready;
+  if (scramble_ready && mode != kModeScramble) {
+    scramble_.get();
+    scramble_ready = false;
+  }
+
   if (transition_model_) {
     if (mode == kModeWait) {
       weight[11] = .01;  // add penalty on joint movement
       // wait
-    } else if (mode == kModeScramble) {  // scramble
+    } else if (mode == kModeScramble && !scramble_.valid()) {  // scramble
       double scramble_param = parameters[6];
       int num_scramble = ReinterpretAsInt(scramble_param) + 1;
 
-      // reset
-      mju_copy(data->qpos, model->qpos0, model->nq);
-      mj_resetData(transition_model_, transition_data_);
-
-      // resize
-      face_.resize(num_scramble);
-      direction_.resize(num_scramble);
-      goal_cache_.resize(6 * num_scramble);
-
-      // set transition model
+      // random face + direction
+      std::uniform_int_distribution<int> uni_face(0, 5);
+      std::uniform_int_distribution<int> uni_direction(0, 1);
+      std::vector<int> face(num_scramble);
+      std::vector<int> direction(num_scramble);
       for (int i = 0; i < num_scramble; i++) {
-        // copy goal face orientations
-        mju_copy(goal_cache_.data() + i * 6, transition_data_->qpos, 6);
-
-        // zero out noise
-        for (int j = 0; j < 6; j++) {
-          double val = goal_cache_[i * 6 + j];
-          if (mju_abs(val) < 1.0e-4) {
-            goal_cache_[i * 6 + j] = 0.0;
-          }
-          if (val < 0.5 * mjPI * 1.1 && val > 0.5 * mjPI * 0.9) {
-            goal_cache_[i * 6 + j] = 0.5 * mjPI;
-          }
-          if (val < -0.5 * mjPI * 1.1 && val > -0.5 * mjPI * 0.9) {
-            goal_cache_[i * 6 + j] = 0.5 * mjPI;
-          }
-        }
-
-        // random face + direction
-        std::random_device rd;  // Only used once to initialise (seed) engine
-        std::mt19937 rng(
-            rd());  // Random-number engine used (Mersenne-Twister in this case)
-
-        std::uniform_int_distribution<int> uni_face(0,
-                                                    5);  // Guaranteed unbiased
-        face_[i] = uni_face(rng);
-
-        std::uniform_int_distribution<int> uni_direction(
-            0, 1);  // Guaranteed unbiased
-        direction_[i] = uni_direction(rng);
-        if (direction_[i] == 0) {
-          direction_[i] = -1;
-        }
-
-        // set
-        for (int t = 0; t < 2000; t++) {
-          transition_data_->ctrl[face_[i]] = direction_[i] * 1.57 * t / 2000;
-          mj_step(transition_model_, transition_data_);
-          mju_copy(data->qpos + 11, transition_data_->qpos, 86);
-        }
+        face[i] = uni_face(scramble_rng_);
+        direction[i] = uni_direction(scramble_rng_) == 0 ? -1 : 1;
       }
 
+      // simulate the turns without holding the task lock
+      scramble_ = std::async(std::launch::async,
+                             &CubeSolve::SimulateScramble, this,
+                             std::move(face), std::move(direction));
+    } else if (mode == kModeScramble && scramble_ready) {
+      Scramble scramble = scramble_.get();
+      int num_scramble = scramble.face.size();
+      face_ = std::move(scramble.face);
+      direction_ = std::move(scramble.direction);
+      goal_cache_ = std::move(scramble.goal_cache);
+
+      // reset, with the scrambled cube
+      mju_copy(data->qpos, model->qpos0, model->nq);
+      mju_copy(data->qpos + 11, scramble.qpos.data(), 86);
+
       // set face goal index
       goal_index_ = num_scramble - 1;
       std::cout << "rotations required: " << num_scramble << "\n";
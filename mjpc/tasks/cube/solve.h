@@ -16,7 +16,10 @@
 #define MJPC_TASKS_CUBE_SOLVE_H_
 
 #include <algorithm>
+#include <future>
+#include <map>
 #include <memory>
+#include <random>
 #include <vector>
 #include <string>
 #include <mujoco/mujoco.h>
@@ -39,11 +42,31 @@ class CubeSolve : public Task {
           goal_index_(goal_index) {}
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+    void SelectMode() override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kPalmPosition = 0,
+      kCubePosition,
+      kCubeGoalOrientation,
+      kCubeOrientation,
+      kCubeLinearVelocity,
+      kNumSensor,
+    };
 
    private:
     friend class CubeSolve;
+    friend class BaseResidualFn;  // calls ModeResidual
     int current_mode_ = 0;
     int goal_index_ = 0;
+
+    // residual of one mode
+    template <int kMode>
+    void ModeResidual(const mjModel* model, const mjData* data,
+                      double* residual) const;
+
+    // ModeResidual of current_mode_
+    ModeResidualFn CurrentModeResidual() const;
   };
 
   CubeSolve();
@@ -57,9 +80,11 @@ class CubeSolve : public Task {
     kModeSolve,
     kModeWait,
     kModeManual,
+    kNumMode,
   };
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this, residual_.current_mode_,
                                         residual_.goal_index_);
@@ -67,13 +92,35 @@ class CubeSolve : public Task {
   ResidualFn* InternalResidual() override { return &residual_; }
 
  private:
+  // face goals and cube configuration after a sequence of face turns
+  struct Scramble {
+    std::vector<int> face;
+    std::vector<int> direction;
+    std::vector<double> goal_cache;  // 6 face angles before each turn
+    std::vector<double> qpos;        // transition model qpos after the turns
+  };
+
+  // simulate the turns with the transition model, starting from the longest
+  // cached prefix of the sequence. runs off the task lock, on its own thread.
+  Scramble SimulateScramble(std::vector<int> face,
+                            std::vector<int> direction);
+
   ResidualFn residual_;
-  mjModel* transition_model_ = nullptr;
-  mjData* transition_data_ = nullptr;
+  std::shared_ptr<const mjModel> transition_model_;  // shared by all tasks
+  mjData* transition_data_ = nullptr;  // (used by SimulateScramble only)
   std::vector<int> face_;
   std::vector<int> direction_;
   std::vector<double> goal_cache_;
   int goal_index_;
+
+  // scramble moves, seeded by the model's "scramble_seed" (0: random).
+  // reseeding reproduces the scramble sequence.
+  std::mt19937 scramble_rng_;
+  std::future<Scramble> scramble_;  // pending scramble, if valid
+
+  // transition state (qpos, qvel, ctrl) after a sequence of turns, each
+  // encoded as 2 * face + (direction > 0). (used by SimulateScramble only)
+  std::map<std::vector<int>, std::vector<double>> turn_cache_;
 };
 
 }  // namespace mjpc
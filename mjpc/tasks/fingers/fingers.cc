@@ -14,6 +14,7 @@
 
 #include "mjpc/tasks/fingers/fingers.h"
 
+#include <iterator>
 #include <string>
 
 #include <absl/random/random.h>
@@ -22,6 +23,14 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "finger_a", "object", "finger_b", "0", "1", "2", "0t", "1t", "2t",
+};
+static_assert(std::size(kSensorNames) == Fingers::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Fingers::XmlPath() const {
   return GetModelPath("fingers/task.xml");
 }
@@ -32,19 +41,18 @@ void Fingers::ResidualFn::Residual(const mjModel* model, const mjData* data,
   int counter = 0;
 
   // reach
-  double* finger_a = SensorByName(model, data, "finger_a");
-  double* box = SensorByName(model, data, "object");
+  double* finger_a = sensors_.Data(model, data, kFingerA);
+  double* box = sensors_.Data(model, data, kObject);
   mju_sub3(residual + counter, finger_a, box);
   counter += 3;
-  double* finger_b = SensorByName(model, data, "finger_b");
+  double* finger_b = sensors_.Data(model, data, kFingerB);
   mju_sub3(residual + counter, finger_b, box);
   counter += 3;
 
   // bring
   for (int i=0; i < 3; i++) {
-    double* object = SensorByName(model, data, std::to_string(i).c_str());
-    double* target = SensorByName(model, data,
-                                        (std::to_string(i) + "t").c_str());
+    double* object = sensors_.Data(model, data, kPoint + i);
+    double* target = sensors_.Data(model, data, kTarget + i);
     residual[counter++] = mju_dist3(object, target);
   }
 
@@ -55,4 +63,8 @@ void Fingers::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   CheckSensorDim(model, counter);
 }
+
+void Fingers::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
 }  // namespace mjpc
@@ -30,10 +30,22 @@ class Fingers : public Task {
     explicit ResidualFn(const Fingers* task) : mjpc::BaseResidualFn(task) {}
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked. kPoint + i and
+    // kTarget + i are object point i and its target.
+    enum Sensor {
+      kFingerA = 0,
+      kObject,
+      kFingerB,
+      kPoint,
+      kTarget = kPoint + 3,
+      kNumSensor = kTarget + 3,
+    };
   };
   Fingers() : residual_(this) {}
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
@@ -23,6 +23,15 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "palm_position", "cube_position", "cube_goal_orientation",
+    "cube_orientation", "cube_linear_velocity",
+};
+static_assert(std::size(kSensorNames) == Hand::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Hand::XmlPath() const {
   return GetModelPath("hand/task.xml");
 }
@@ -42,10 +51,10 @@ void Hand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   int counter = 0;
   // ---------- Residual (0) ----------
   // goal position
-  double* goal_position = SensorByName(model, data, "palm_position");
+  double* goal_position = sensors_.Data(model, data, kPalmPosition);
 
   // system's position
-  double* position = SensorByName(model, data, "cube_position");
+  double* position = sensors_.Data(model, data, kCubePosition);
 
   // position error
   mju_sub3(residual + counter, position, goal_position);
@@ -53,10 +62,11 @@ void Hand::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // ---------- Residual (1) ----------
   // goal orientation
-  double* goal_orientation = SensorByName(model, data, "cube_goal_orientation");
+  double* goal_orientation =
+      sensors_.Data(model, data, kCubeGoalOrientation);
 
   // system's orientation
-  double* orientation = SensorByName(model, data, "cube_orientation");
+  double* orientation = sensors_.Data(model, data, kCubeOrientation);
   mju_normalize4(goal_orientation);
 
   // orientation error
@@ -65,7 +75,7 @@ void Hand::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // ---------- Residual (2) ----------
   double* cube_linear_velocity =
-      SensorByName(model, data, "cube_linear_velocity");
+      sensors_.Data(model, data, kCubeLinearVelocity);
   mju_copy(residual + counter, cube_linear_velocity, 3);
   counter += 3;
 
@@ -85,6 +95,10 @@ void Hand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   CheckSensorDim(model, counter);
 }
 
+void Hand::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 // ----- Transition for in-hand manipulation task -----
 //   If cube is within tolerance or floor ->
 //   reset cube into hand.
@@ -104,7 +118,8 @@ void Hand::TransitionLocked(mjModel* model, mjData* data) {
     }
   }
 
-  double* cube_lin_vel = SensorByName(model, data, "cube_linear_velocity");
+  double* cube_lin_vel =
+      sensors.Data(model, data, ResidualFn::kCubeLinearVelocity);
   if (on_floor && mju_norm3(cube_lin_vel) < .001) {
     // reset box pose, adding a little height
     int cube_body = mj_name2id(model, mjOBJ_BODY, "cube");
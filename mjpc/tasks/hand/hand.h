@@ -28,6 +28,16 @@ class Hand : public Task {
    public:
     explicit ResidualFn(const Hand* task) : BaseResidualFn(task) {}
 
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kPalmPosition = 0,
+      kCubePosition,
+      kCubeGoalOrientation,
+      kCubeOrientation,
+      kCubeLinearVelocity,
+      kNumSensor,
+    };
+
   // ---------- Residuals for in-hand manipulation task ---------
   //   Number of residuals: 5
   //     Residual (0): cube_position - palm_position
@@ -48,6 +58,7 @@ class Hand : public Task {
   void TransitionLocked(mjModel* model, mjData* data) override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
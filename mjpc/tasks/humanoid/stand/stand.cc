@@ -14,6 +14,7 @@
 
 #include "mjpc/tasks/humanoid/stand/stand.h"
 
+#include <iterator>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -22,6 +23,15 @@
 
 
 namespace mjpc::humanoid {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "sp0", "sp1", "sp2", "sp3", "head_position", "torso_subtreecom",
+    "torso_subtreelinvel",
+};
+static_assert(std::size(kSensorNames) == Stand::ResidualFn::kNumSensor);
+}  // namespace
+
 
 std::string Stand::XmlPath() const {
   return GetModelPath("humanoid/stand/task.xml");
@@ -45,11 +55,11 @@ void Stand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   // ----- Height: head feet vertical error ----- //
 
   // feet sensor positions
-  double* f1_position = SensorByName(model, data, "sp0");
-  double* f2_position = SensorByName(model, data, "sp1");
-  double* f3_position = SensorByName(model, data, "sp2");
-  double* f4_position = SensorByName(model, data, "sp3");
-  double* head_position = SensorByName(model, data, "head_position");
+  double* f1_position = sensors_.Data(model, data, kSp0);
+  double* f2_position = sensors_.Data(model, data, kSp1);
+  double* f3_position = sensors_.Data(model, data, kSp2);
+  double* f4_position = sensors_.Data(model, data, kSp3);
+  double* head_position = sensors_.Data(model, data, kHeadPosition);
   double head_feet_error =
       head_position[2] - 0.25 * (f1_position[2] + f2_position[2] +
                                  f3_position[2] + f4_position[2]);
@@ -58,8 +68,8 @@ void Stand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   // ----- Balance: CoM-feet xy error ----- //
 
   // capture point
-  double* com_position = SensorByName(model, data, "torso_subtreecom");
-  double* com_velocity = SensorByName(model, data, "torso_subtreelinvel");
+  double* com_position = sensors_.Data(model, data, kTorsoSubtreecom);
+  double* com_velocity = sensors_.Data(model, data, kTorsoSubtreelinvel);
   double kFallTime = 0.2;
   double capture_point[3] = {com_position[0], com_position[1], com_position[2]};
   mju_addToScl3(capture_point, com_velocity, kFallTime);
@@ -92,7 +102,7 @@ void Stand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   // TODO: use this pattern everywhere and make this a utility function
   int user_sensor_dim = 0;
   for (int i = 0; i < model->nsensor; i++) {
-    if (model->sensor_type[i] == mjSENS_USER) {
+    if (model->sensor_type[i] == mjSENS_USER && !SkippedSensor(model, i)) {
       user_sensor_dim += model->sensor_dim[i];
     }
   }
@@ -104,4 +114,8 @@ void Stand::ResidualFn::Residual(const mjModel* model, const mjData* data,
   }
 }
 
+void Stand::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc::humanoid
@@ -42,6 +42,18 @@ class Stand : public Task {
     // ----------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kSp0 = 0,
+      kSp1,
+      kSp2,
+      kSp3,
+      kHeadPosition,
+      kTorsoSubtreecom,
+      kTorsoSubtreelinvel,
+      kNumSensor,
+    };
   };
 
   Stand() : residual_(this) {}
@@ -50,6 +62,7 @@ class Stand : public Task {
   std::string XmlPath() const override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
@@ -0,0 +1,202 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/tasks/humanoid/tracking/motion_clips.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mjpc::humanoid {
+
+namespace {
+// instances by path, alive while a user holds them
+std::mutex registry_mutex;
+std::map<std::string, std::weak_ptr<const MotionClips>>& Registry() {
+  static auto* registry =
+      new std::map<std::string, std::weak_ptr<const MotionClips>>();
+  return *registry;
+}
+
+// bytes of a file with the header's dimensions, -1 if invalid
+std::int64_t FileSize(const MotionClipsHeader& header) {
+  if (header.num_marker < 0 || header.num_clip < 0 || header.nq < 0 ||
+      header.nv < 0 || header.num_frame < 0) {
+    return -1;
+  }
+  return sizeof(MotionClipsHeader) +
+         2 * sizeof(std::int64_t) * header.num_clip +
+         sizeof(double) * header.num_clip * (header.nq + header.nv) +
+         sizeof(float) * header.num_frame * header.num_marker * 3;
+}
+}  // namespace
+
+bool WriteMotionClips(const std::string& path, const MotionClipsData& data) {
+  MotionClipsHeader header;
+  std::memcpy(header.magic, kMotionClipsMagic, sizeof(header.magic));
+  header.num_marker = data.num_marker;
+  header.num_clip = data.clip_length.size();
+  header.nq = data.nq;
+  header.nv = data.nv;
+  header.fps = data.fps;
+  header.num_frame = 0;
+  for (std::int64_t length : data.clip_length) header.num_frame += length;
+  if (static_cast<std::int64_t>(data.initial_state.size()) !=
+          header.num_clip * (header.nq + header.nv) ||
+      static_cast<std::int64_t>(data.frames.size()) !=
+          header.num_frame * header.num_marker * 3) {
+    return false;
+  }
+
+  std::vector<std::int64_t> clip_start;
+  std::int64_t start = 0;
+  for (std::int64_t length : data.clip_length) {
+    clip_start.push_back(start);
+    start += length;
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) return false;
+  auto write = [&file](const void* values, std::size_t size) {
+    file.write(static_cast<const char*>(values), size);
+  };
+  write(&header, sizeof(header));
+  write(clip_start.data(), sizeof(std::int64_t) * clip_start.size());
+  write(data.clip_length.data(),
+        sizeof(std::int64_t) * data.clip_length.size());
+  write(data.initial_state.data(),
+        sizeof(double) * data.initial_state.size());
+  write(data.frames.data(), sizeof(float) * data.frames.size());
+  return static_cast<bool>(file);
+}
+
+MotionClips::~MotionClips() {
+#if !defined(_WIN32)
+  if (mapping_) munmap(mapping_, size_);
+#endif
+}
+
+std::shared_ptr<const MotionClips> MotionClips::Open(const std::string& path,
+                                                     std::string* error) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto& registry = Registry();
+  if (auto clips = registry[path].lock()) return clips;
+
+  std::shared_ptr<MotionClips> clips(new MotionClips());
+  const char* bytes = nullptr;
+#if !defined(_WIN32)
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = absl::StrCat("Failed to open motion clips '", path, "'.");
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size == 0) {
+    close(fd);
+    *error = absl::StrCat("Motion clips '", path, "' are empty.");
+    return nullptr;
+  }
+  clips->size_ = status.st_size;
+  void* mapping =
+      mmap(nullptr, clips->size_, PROT_READ, MAP_SHARED, fd, /*offset=*/0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    *error = absl::StrCat("Failed to map motion clips '", path, "'.");
+    return nullptr;
+  }
+  clips->mapping_ = mapping;
+  bytes = static_cast<const char*>(mapping);
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    *error = absl::StrCat("Failed to open motion clips '", path, "'.");
+    return nullptr;
+  }
+  clips->contents_.assign(std::istreambuf_iterator<char>(file),
+                          std::istreambuf_iterator<char>());
+  clips->size_ = clips->contents_.size();
+  bytes = clips->contents_.data();
+#endif
+
+  // layout
+  const auto* header = reinterpret_cast<const MotionClipsHeader*>(bytes);
+  if (clips->size_ < sizeof(MotionClipsHeader) ||
+      std::memcmp(header->magic, kMotionClipsMagic, sizeof(header->magic))) {
+    *error = absl::StrCat("'", path, "' is not a motion clips file.");
+    return nullptr;
+  }
+  if (FileSize(*header) != static_cast<std::int64_t>(clips->size_) ||
+      !(header->fps > 0.0)) {
+    *error = absl::StrCat("Motion clips '", path, "' are malformed.");
+    return nullptr;
+  }
+  clips->header_ = header;
+  clips->clip_start_ = reinterpret_cast<const std::int64_t*>(header + 1);
+  clips->clip_length_ = clips->clip_start_ + header->num_clip;
+  clips->initial_state_ = reinterpret_cast<const double*>(
+      clips->clip_length_ + header->num_clip);
+  clips->frames_ = reinterpret_cast<const float*>(
+      clips->initial_state_ + header->num_clip * (header->nq + header->nv));
+  for (int i = 0; i < header->num_clip; i++) {
+    if (clips->clip_length_[i] < 1 || clips->clip_start_[i] < 0 ||
+        clips->clip_start_[i] + clips->clip_length_[i] > header->num_frame) {
+      *error = absl::StrCat("Motion clips '", path, "' have invalid clip ", i,
+                            ".");
+      return nullptr;
+    }
+  }
+
+  registry[path] = clips;
+  return clips;
+}
+
+const double* MotionClips::InitialState(int clip) const {
+  return initial_state_ + clip * (header_->nq + header_->nv);
+}
+
+MotionClips::Sample MotionClips::At(int clip, double time) const {
+  std::int64_t last = clip_length_[clip] - 1;
+  double index = std::clamp(time * header_->fps, 0.0,
+                            static_cast<double>(last));
+  std::int64_t index_0 = std::floor(index);
+  std::int64_t index_1 = std::min(index_0 + 1, last);
+  const float* frames =
+      frames_ + clip_start_[clip] * 3 * header_->num_marker;
+  Sample sample;
+  sample.frame_0 = frames + index_0 * 3 * header_->num_marker;
+  sample.frame_1 = frames + index_1 * 3 * header_->num_marker;
+  sample.weight_1 = index - index_0;
+  sample.weight_0 = 1.0 - sample.weight_1;
+  return sample;
+}
+
+}  // namespace mjpc::humanoid
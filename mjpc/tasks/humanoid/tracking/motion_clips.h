@@ -0,0 +1,113 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reference motion clips for tracking, read from a compact binary file
+// instead of model keyframes.
+
+#ifndef MJPC_TASKS_HUMANOID_TRACKING_MOTION_CLIPS_H_
+#define MJPC_TASKS_HUMANOID_TRACKING_MOTION_CLIPS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mjpc::humanoid {
+
+// file header, followed by
+//   std::int64_t clip_start[num_clip], clip_length[num_clip]  (frames)
+//   double initial_state[num_clip][nq + nv]  (qpos, qvel at the clip start)
+//   float frames[num_frame][num_marker][3]   (marker positions)
+struct MotionClipsHeader {
+  char magic[8];  // kMotionClipsMagic
+  std::int32_t num_marker;
+  std::int32_t num_clip;
+  std::int32_t nq;
+  std::int32_t nv;
+  double fps;
+  std::int64_t num_frame;
+};
+static_assert(sizeof(MotionClipsHeader) == 40);
+
+inline constexpr char kMotionClipsMagic[8] = {'M', 'J', 'P', 'C',
+                                              'M', 'O', 'T', '1'};
+
+// contents of a motion clips file
+struct MotionClipsData {
+  int num_marker = 0;
+  int nq = 0;
+  int nv = 0;
+  double fps = 30.0;
+  std::vector<std::int64_t> clip_length;  // frames per clip
+  std::vector<double> initial_state;      // num_clip x (nq + nv)
+  std::vector<float> frames;             // all clips, num_marker x 3 each
+};
+
+// write data to path. returns false on failure.
+bool WriteMotionClips(const std::string& path, const MotionClipsData& data);
+
+// motion clips file, memory-mapped read-only. instances are shared by all
+// users of the same path, e.g., the tasks of several agents.
+class MotionClips {
+ public:
+  ~MotionClips();
+
+  MotionClips(const MotionClips&) = delete;
+  MotionClips& operator=(const MotionClips&) = delete;
+
+  // the shared instance for path, nullptr with error set if the file is
+  // missing or malformed
+  static std::shared_ptr<const MotionClips> Open(const std::string& path,
+                                                 std::string* error);
+
+  int NumClips() const { return header_->num_clip; }
+  int NumMarkers() const { return header_->num_marker; }
+  int Nq() const { return header_->nq; }
+  int Nv() const { return header_->nv; }
+  double Fps() const { return header_->fps; }
+  std::int64_t ClipLength(int clip) const { return clip_length_[clip]; }
+
+  // qpos and qvel at the start of clip
+  const double* InitialState(int clip) const;
+
+  // the two frames around a time and their interpolation weights
+  struct Sample {
+    const float* frame_0;  // num_marker x 3 marker positions
+    const float* frame_1;  // the next frame, frame_0 at the last frame
+    double weight_0;
+    double weight_1;
+  };
+
+  // frames at time (seconds since the clip start), clamped to the clip. O(1)
+  Sample At(int clip, double time) const;
+
+ private:
+  MotionClips() = default;
+
+  const MotionClipsHeader* header_ = nullptr;
+  const std::int64_t* clip_start_ = nullptr;
+  const std::int64_t* clip_length_ = nullptr;
+  const double* initial_state_ = nullptr;
+  const float* frames_ = nullptr;
+
+  // mapping, or the file contents where mapping is unsupported
+  void* mapping_ = nullptr;
+  std::size_t size_ = 0;
+  std::vector<char> contents_;
+};
+
+}  // namespace mjpc::humanoid
+
+#endif  // MJPC_TASKS_HUMANOID_TRACKING_MOTION_CLIPS_H_
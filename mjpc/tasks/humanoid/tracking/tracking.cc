@@ -18,10 +18,14 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <iostream>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include <mujoco/mujoco.h>
+#include "mjpc/tasks/humanoid/tracking/motion_clips.h"
 #include "mjpc/utilities.h"
 
 namespace {
@@ -71,6 +75,8 @@ const std::array<std::string, 16> body_names = {
     "lknee",     "rknee",     "lhand", "rhand", "lelbow", "relbow",
     "lshoulder", "rshoulder", "lhip",  "rhip",
 };
+static_assert(std::tuple_size_v<decltype(body_names)> ==
+              mjpc::humanoid::Tracking::ResidualFn::kNumBody);
 
 }  // namespace
 
@@ -93,22 +99,87 @@ std::string Tracking::Name() const { return "Humanoid Track"; }
 // ----------------------------------------------------------------
 void Tracking::ResidualFn::Residual(const mjModel *model, const mjData *data,
                                   double *residual) const {
-  // ----- get mocap frames ----- //
-  // get motion start index
-  int start = MotionStartIndex(current_mode_);
-  // get motion trajectory length
-  int length = MotionLength(current_mode_);
-  double current_index = (data->time - reference_time_) * kFps + start;
-  int last_key_index = start + length - 1;
+  ResidualBatch(model, &data, &residual, 1);
+}
 
+void Tracking::ResidualFn::ResidualBatch(const mjModel *model,
+                                         const mjData *const *data,
+                                         double *const *residual,
+                                         int n) const {
+  // the reference is shared by samples at the same time
+  Reference reference;
+  for (int i = 0; i < n; i++) {
+    if (i == 0 || data[i]->time != data[i - 1]->time) {
+      ComputeReference(model, data[i]->time, &reference);
+    }
+    ResidualFromReference(model, data[i], reference, residual[i]);
+  }
+}
+
+void Tracking::ResidualFn::ComputeReference(const mjModel *model, double time,
+                                            Reference *reference) const {
+  // ----- get mocap frames ----- //
   // Positions:
   // We interpolate linearly between two consecutive key frames in order to
   // provide smoother signal for tracking.
-  int key_index_0, key_index_1;
-  double weight_0, weight_1;
-  std::tie(key_index_0, key_index_1, weight_0, weight_1) =
-      ComputeInterpolationValues(current_index, last_key_index);
+  const double *key_mpos_0 = nullptr;
+  const double *key_mpos_1 = nullptr;
+  MotionClips::Sample sample;
+  double fps = kFps;
+  if (clips_) {
+    sample = clips_->At(Clip(), time - reference_time_);
+    fps = clips_->Fps();
+  } else {
+    // get motion start index
+    int start = MotionStartIndex(current_mode_);
+    // get motion trajectory length
+    int length = MotionLength(current_mode_);
+    double current_index = (time - reference_time_) * kFps + start;
+    int last_key_index = start + length - 1;
+
+    int key_index_0, key_index_1;
+    std::tie(key_index_0, key_index_1, sample.weight_0, sample.weight_1) =
+        ComputeInterpolationValues(current_index, last_key_index);
+    key_mpos_0 = model->key_mpos + model->nmocap * 3 * key_index_0;
+    key_mpos_1 = model->key_mpos + model->nmocap * 3 * key_index_1;
+  }
+
+  // interpolated frame and its average
+  mju_zero3(reference->average);
+  for (int body = 0; body < kNumBody; body++) {
+    int body_mocapid = body_mocapid_[body];
+    assert(0 <= body_mocapid);
+    double mpos_0[3], mpos_1[3];
+    for (int i = 0; i < 3; i++) {
+      mpos_0[i] = clips_ ? sample.frame_0[3 * body_mocapid + i]
+                         : key_mpos_0[3 * body_mocapid + i];
+      mpos_1[i] = clips_ ? sample.frame_1[3 * body_mocapid + i]
+                         : key_mpos_1[3 * body_mocapid + i];
+    }
+    double *position = reference->position + 3 * body;
+    double *velocity = reference->velocity + 3 * body;
+
+    // current frame, plus next frame
+    mju_scl3(position, mpos_0, sample.weight_0);
+    mju_addToScl3(position, mpos_1, sample.weight_1);
+    mju_addTo3(reference->average, position);
+
+    // finite-difference velocity
+    mju_sub3(velocity, mpos_1, mpos_0);
+    mju_scl3(velocity, velocity, fps);
+  }
+  mju_scl3(reference->average, reference->average, 1.0 / kNumBody);
+
+  // positions relative to the average
+  for (int body = 0; body < kNumBody; body++) {
+    mju_subFrom3(reference->position + 3 * body, reference->average);
+  }
+}
 
+void Tracking::ResidualFn::ResidualFromReference(const mjModel *model,
+                                                 const mjData *data,
+                                                 const Reference &reference,
+                                                 double *residual) const {
   // ----- residual ----- //
   int counter = 0;
 
@@ -121,110 +192,56 @@ void Tracking::ResidualFn::Residual(const mjModel *model, const mjData *data,
   counter += model->nu;
 
   // ----- position ----- //
-  // Compute interpolated frame.
-  auto get_body_mpos = [&](const std::string &body_name, double result[3]) {
-    std::string mocap_body_name = "mocap[" + body_name + "]";
-    int mocap_body_id = mj_name2id(model, mjOBJ_BODY, mocap_body_name.c_str());
-    assert(0 <= mocap_body_id);
-    int body_mocapid = model->body_mocapid[mocap_body_id];
-    assert(0 <= body_mocapid);
-
-    // current frame
-    mju_scl3(
-        result,
-        model->key_mpos + model->nmocap * 3 * key_index_0 + 3 * body_mocapid,
-        weight_0);
-
-    // next frame
-    mju_addToScl3(
-        result,
-        model->key_mpos + model->nmocap * 3 * key_index_1 + 3 * body_mocapid,
-        weight_1);
-  };
-
-  auto get_body_sensor_pos = [&](const std::string &body_name,
-                                 double result[3]) {
-    std::string pos_sensor_name = "tracking_pos[" + body_name + "]";
-    double *sensor_pos = SensorByName(model, data, pos_sensor_name.c_str());
-    mju_copy3(result, sensor_pos);
-  };
-
-  // compute marker and sensor averages
-  double avg_mpos[3] = {0};
+  // sensor average
   double avg_sensor_pos[3] = {0};
-  int num_body = 0;
-  for (const auto &body_name : body_names) {
-    double body_mpos[3];
-    double body_sensor_pos[3];
-    get_body_mpos(body_name, body_mpos);
-    mju_addTo3(avg_mpos, body_mpos);
-    get_body_sensor_pos(body_name, body_sensor_pos);
-    mju_addTo3(avg_sensor_pos, body_sensor_pos);
-    num_body++;
+  for (int body = 0; body < kNumBody; body++) {
+    mju_addTo3(avg_sensor_pos,
+               sensors_.Data(model, data, kTrackingPos + body));
   }
-  mju_scl3(avg_mpos, avg_mpos, 1.0/num_body);
-  mju_scl3(avg_sensor_pos, avg_sensor_pos, 1.0/num_body);
+  mju_scl3(avg_sensor_pos, avg_sensor_pos, 1.0 / kNumBody);
 
   // residual for averages
-  mju_sub3(&residual[counter], avg_mpos, avg_sensor_pos);
+  mju_sub3(&residual[counter], reference.average, avg_sensor_pos);
   counter += 3;
 
-  for (const auto &body_name : body_names) {
-    double body_mpos[3];
-    get_body_mpos(body_name, body_mpos);
-
-    // current position
+  for (int body = 0; body < kNumBody; body++) {
+    // current position, relative to the average
     double body_sensor_pos[3];
-    get_body_sensor_pos(body_name, body_sensor_pos);
-
-    mju_subFrom3(body_mpos, avg_mpos);
-    mju_subFrom3(body_sensor_pos, avg_sensor_pos);
+    mju_sub3(body_sensor_pos, sensors_.Data(model, data, kTrackingPos + body),
+             avg_sensor_pos);
 
-    mju_sub3(&residual[counter], body_mpos, body_sensor_pos);
+    mju_sub3(&residual[counter], reference.position + 3 * body,
+             body_sensor_pos);
 
     counter += 3;
   }
 
   // ----- velocity ----- //
-  for (const auto &body_name : body_names) {
-    std::string mocap_body_name = "mocap[" + body_name + "]";
-    std::string linvel_sensor_name = "tracking_linvel[" + body_name + "]";
-    int mocap_body_id = mj_name2id(model, mjOBJ_BODY, mocap_body_name.c_str());
-    assert(0 <= mocap_body_id);
-    int body_mocapid = model->body_mocapid[mocap_body_id];
-    assert(0 <= body_mocapid);
-
-    // compute finite-difference velocity
-    mju_copy3(
-        &residual[counter],
-        model->key_mpos + model->nmocap * 3 * key_index_1 + 3 * body_mocapid);
-    mju_subFrom3(
-        &residual[counter],
-        model->key_mpos + model->nmocap * 3 * key_index_0 + 3 * body_mocapid);
-    mju_scl3(&residual[counter], &residual[counter], kFps);
-
+  for (int body = 0; body < kNumBody; body++) {
     // subtract current velocity
     double *sensor_linvel =
-        SensorByName(model, data, linvel_sensor_name.c_str());
-    mju_subFrom3(&residual[counter], sensor_linvel);
+        sensors_.Data(model, data, kTrackingLinvel + body);
+    mju_sub3(&residual[counter], reference.velocity + 3 * body,
+             sensor_linvel);
 
     counter += 3;
   }
 
-
   CheckSensorDim(model, counter);
 }
 
 // --------------------- Transition for humanoid task -------------------------
 //   Set `data->mocap_pos` based on `data->time` to move the mocap sites.
 //   Linearly interpolate between two consecutive key frames in order to
-//   smooth the transitions between keyframes.
+//   smooth the transitions between keyframes. With motion clips, the frames
+//   are read from the clip file instead.
 // ----------------------------------------------------------------------------
 void Tracking::TransitionLocked(mjModel *model, mjData *d) {
   // get motion start index
   int start = MotionStartIndex(mode);
   // get motion trajectory length
   int length = MotionLength(mode);
+  const MotionClips *clips = residual_.clips_.get();
 
   // check for motion switch
   if (residual_.current_mode_ != mode || d->time == 0.0) {
@@ -232,8 +249,24 @@ void Tracking::TransitionLocked(mjModel *model, mjData *d) {
     residual_.reference_time_ = d->time;  // set reference time
 
     // set initial state
-    mju_copy(d->qpos, model->key_qpos + model->nq * start, model->nq);
-    mju_copy(d->qvel, model->key_qvel + model->nv * start, model->nv);
+    if (clips && clips->Nq() == model->nq && clips->Nv() == model->nv) {
+      const double *state = clips->InitialState(residual_.Clip());
+      mju_copy(d->qpos, state, model->nq);
+      mju_copy(d->qvel, state + model->nq, model->nv);
+    } else {
+      mju_copy(d->qpos, model->key_qpos + model->nq * start, model->nq);
+      mju_copy(d->qvel, model->key_qvel + model->nv * start, model->nv);
+    }
+  }
+
+  if (clips) {
+    MotionClips::Sample sample =
+        clips->At(residual_.Clip(), d->time - residual_.reference_time_);
+    for (int i = 0; i < 3 * model->nmocap; i++) {
+      d->mocap_pos[i] = sample.weight_0 * sample.frame_0[i] +
+                        sample.weight_1 * sample.frame_1[i];
+    }
+    return;
   }
 
   // indices
@@ -266,4 +299,44 @@ void Tracking::TransitionLocked(mjModel *model, mjData *d) {
   mj_freeStack(d);
 }
 
+void Tracking::ResetLocked(const mjModel *model) {
+  std::vector<std::string> names;
+  for (const auto &body_name : body_names) {
+    names.push_back("tracking_pos[" + body_name + "]");
+  }
+  for (const auto &body_name : body_names) {
+    names.push_back("tracking_linvel[" + body_name + "]");
+  }
+  sensors.Resolve(model, names);
+
+  // mocap markers of the bodies
+  residual_.body_mocapid_.clear();
+  for (const auto &body_name : body_names) {
+    std::string mocap_body_name = "mocap[" + body_name + "]";
+    int mocap_body_id = mj_name2id(model, mjOBJ_BODY, mocap_body_name.c_str());
+    residual_.body_mocapid_.push_back(
+        mocap_body_id < 0 ? -1 : model->body_mocapid[mocap_body_id]);
+  }
+
+  // optional motion clips file, absolute or relative to the models directory
+  residual_.clips_ = nullptr;
+  if (const char *path = GetCustomTextData(model, "tracking_clips")) {
+    std::string clips_path =
+        path[0] == '/' ? std::string(path) : GetModelPath(path);
+    std::string error;
+    auto clips = MotionClips::Open(clips_path, &error);
+    if (!clips) {
+      std::cerr << error << " Using the model keyframes.\n";
+    } else if (clips->NumMarkers() != model->nmocap ||
+               clips->NumClips() == 0) {
+      std::cerr << "Motion clips '" << clips_path << "' have "
+                << clips->NumMarkers() << " markers, the model has "
+                << model->nmocap << " mocap bodies. Using the model "
+                << "keyframes.\n";
+    } else {
+      residual_.clips_ = std::move(clips);
+    }
+  }
+}
+
 }  // namespace mjpc::humanoid
@@ -15,8 +15,14 @@
 #ifndef MJPC_TASKS_HUMANOID_TRACKING_TASK_H_
 #define MJPC_TASKS_HUMANOID_TRACKING_TASK_H_
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <mujoco/mujoco.h>
 #include "mjpc/task.h"
+#include "mjpc/tasks/humanoid/tracking/motion_clips.h"
 
 namespace mjpc {
 namespace humanoid {
@@ -43,10 +49,50 @@ class Tracking : public Task {
     // ----------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // the interpolated reference is computed once for samples at the same
+    // time
+    void ResidualBatch(const mjModel* model, const mjData* const* data,
+                       double* const* residual, int n) const override;
+
+    // tracked bodies
+    static constexpr int kNumBody = 16;
+
+    // sensors read by Residual, resolved in ResetLocked. kTrackingPos + i
+    // and kTrackingLinvel + i are the position and velocity of body i.
+    enum Sensor {
+      kTrackingPos = 0,
+      kTrackingLinvel = kTrackingPos + kNumBody,
+      kNumSensor = kTrackingLinvel + kNumBody,
+    };
+
    private:
     friend class Tracking;
+
+    // mocap reference of the tracked bodies at one time
+    struct Reference {
+      double average[3];              // average marker position
+      double position[3 * kNumBody];  // marker positions minus the average
+      double velocity[3 * kNumBody];  // finite-difference marker velocities
+    };
+    void ComputeReference(const mjModel* model, double time,
+                          Reference* reference) const;
+    void ResidualFromReference(const mjModel* model, const mjData* data,
+                               const Reference& reference,
+                               double* residual) const;
+
+    // clip of the current mode
+    int Clip() const {
+      return std::min(current_mode_, clips_->NumClips() - 1);
+    }
+
     int current_mode_;
     double reference_time_;
+    std::vector<int> body_mocapid_;  // mocap index of each body's marker
+
+    // reference motions from the model's "tracking_clips" file, shared
+    // read-only by all copies. nullptr: the model keyframes are used.
+    std::shared_ptr<const MotionClips> clips_;
   };
 
   Tracking() : residual_(this) {}
@@ -54,7 +100,8 @@ class Tracking : public Task {
   // --------------------- Transition for humanoid task ------------------------
   //   Set `data->mocap_pos` based on `data->time` to move the mocap sites.
   //   Linearly interpolate between two consecutive key frames in order to
-  //   smooth the transitions between keyframes.
+  //   smooth the transitions between keyframes. With motion clips, the frames
+  //   are read from the clip file instead.
   // ---------------------------------------------------------------------------
   void TransitionLocked(mjModel* model, mjData* data) override;
 
@@ -62,9 +109,9 @@ class Tracking : public Task {
   std::string XmlPath() const override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
-    return std::make_unique<ResidualFn>(this, residual_.current_mode_,
-                                        residual_.reference_time_);
+    return std::make_unique<ResidualFn>(residual_);
   }
   ResidualFn* InternalResidual() override { return &residual_; }
 
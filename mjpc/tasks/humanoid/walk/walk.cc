@@ -15,6 +15,7 @@
 #include "mjpc/tasks/humanoid/walk/walk.h"
 
 #include <iostream>
+#include <iterator>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -22,6 +23,18 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc::humanoid {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "torso_position", "foot_right", "foot_left", "pelvis_position",
+    "torso_subcom", "torso_subcomvel", "torso_up", "pelvis_up",
+    "foot_right_up", "foot_left_up", "torso_forward", "pelvis_forward",
+    "foot_right_forward", "foot_left_forward", "waist_lower_subcomvel",
+    "torso_velocity", "foot_right_velocity", "foot_left_velocity",
+};
+static_assert(std::size(kSensorNames) == Walk::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Walk::XmlPath() const {
   return GetModelPath("humanoid/walk/task.xml");
 }
@@ -46,20 +59,20 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
   int counter = 0;
 
   // ----- torso height ----- //
-  double torso_height = SensorByName(model, data, "torso_position")[2];
+  double torso_height = sensors_.Data(model, data, kTorsoPosition)[2];
   residual[counter++] = torso_height - parameters_[0];
 
   // ----- pelvis / feet ----- //
-  double* foot_right = SensorByName(model, data, "foot_right");
-  double* foot_left = SensorByName(model, data, "foot_left");
-  double pelvis_height = SensorByName(model, data, "pelvis_position")[2];
+  double* foot_right = sensors_.Data(model, data, kFootRight);
+  double* foot_left = sensors_.Data(model, data, kFootLeft);
+  double pelvis_height = sensors_.Data(model, data, kPelvisPosition)[2];
   residual[counter++] =
       0.5 * (foot_left[2] + foot_right[2]) - pelvis_height - 0.2;
 
   // ----- balance ----- //
   // capture point
-  double* subcom = SensorByName(model, data, "torso_subcom");
-  double* subcomvel = SensorByName(model, data, "torso_subcomvel");
+  double* subcom = sensors_.Data(model, data, kTorsoSubcom);
+  double* subcomvel = sensors_.Data(model, data, kTorsoSubcomvel);
 
   double capture_point[3];
   mju_addScl(capture_point, subcom, subcomvel, 0.3, 3);
@@ -97,10 +110,10 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
   counter += 2;
 
   // ----- upright ----- //
-  double* torso_up = SensorByName(model, data, "torso_up");
-  double* pelvis_up = SensorByName(model, data, "pelvis_up");
-  double* foot_right_up = SensorByName(model, data, "foot_right_up");
-  double* foot_left_up = SensorByName(model, data, "foot_left_up");
+  double* torso_up = sensors_.Data(model, data, kTorsoUp);
+  double* pelvis_up = sensors_.Data(model, data, kPelvisUp);
+  double* foot_right_up = sensors_.Data(model, data, kFootRightUp);
+  double* foot_left_up = sensors_.Data(model, data, kFootLeftUp);
   double z_ref[3] = {0.0, 0.0, 1.0};
 
   // torso
@@ -123,10 +136,10 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
   counter += model->nq - 7;
 
   // ----- walk ----- //
-  double* torso_forward = SensorByName(model, data, "torso_forward");
-  double* pelvis_forward = SensorByName(model, data, "pelvis_forward");
-  double* foot_right_forward = SensorByName(model, data, "foot_right_forward");
-  double* foot_left_forward = SensorByName(model, data, "foot_left_forward");
+  double* torso_forward = sensors_.Data(model, data, kTorsoForward);
+  double* pelvis_forward = sensors_.Data(model, data, kPelvisForward);
+  double* foot_right_forward = sensors_.Data(model, data, kFootRightForward);
+  double* foot_left_forward = sensors_.Data(model, data, kFootLeftForward);
 
   double forward[2];
   mju_copy(forward, torso_forward, 2);
@@ -137,8 +150,8 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // com vel
   double* waist_lower_subcomvel =
-      SensorByName(model, data, "waist_lower_subcomvel");
-  double* torso_velocity = SensorByName(model, data, "torso_velocity");
+      sensors_.Data(model, data, kWaistLowerSubcomvel);
+  double* torso_velocity = sensors_.Data(model, data, kTorsoVelocity);
   double com_vel[2];
   mju_add(com_vel, waist_lower_subcomvel, torso_velocity, 2);
   mju_scl(com_vel, com_vel, 0.5, 2);
@@ -148,8 +161,8 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
       standing * (mju_dot(com_vel, forward, 2) - parameters_[1]);
 
   // ----- move feet ----- //
-  double* foot_right_vel = SensorByName(model, data, "foot_right_velocity");
-  double* foot_left_vel = SensorByName(model, data, "foot_left_velocity");
+  double* foot_right_vel = sensors_.Data(model, data, kFootRightVelocity);
+  double* foot_left_vel = sensors_.Data(model, data, kFootLeftVelocity);
   double move_feet[2];
   mju_copy(move_feet, com_vel, 2);
   mju_addToScl(move_feet, foot_right_vel, -0.5, 2);
@@ -167,7 +180,7 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
   // TODO: use this pattern everywhere and make this a utility function
   int user_sensor_dim = 0;
   for (int i = 0; i < model->nsensor; i++) {
-    if (model->sensor_type[i] == mjSENS_USER) {
+    if (model->sensor_type[i] == mjSENS_USER && !SkippedSensor(model, i)) {
       user_sensor_dim += model->sensor_dim[i];
     }
   }
@@ -179,4 +192,8 @@ void Walk::ResidualFn::Residual(const mjModel* model, const mjData* data,
   }
 }
 
+void Walk::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc::humanoid
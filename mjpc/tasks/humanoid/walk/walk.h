@@ -43,6 +43,29 @@ class Walk : public Task {
     // ----------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kTorsoPosition = 0,
+      kFootRight,
+      kFootLeft,
+      kPelvisPosition,
+      kTorsoSubcom,
+      kTorsoSubcomvel,
+      kTorsoUp,
+      kPelvisUp,
+      kFootRightUp,
+      kFootLeftUp,
+      kTorsoForward,
+      kPelvisForward,
+      kFootRightForward,
+      kFootLeftForward,
+      kWaistLowerSubcomvel,
+      kTorsoVelocity,
+      kFootRightVelocity,
+      kFootLeftVelocity,
+      kNumSensor,
+    };
   };
 
   Walk() : residual_(this) {}
@@ -51,6 +74,7 @@ class Walk : public Task {
   std::string XmlPath() const override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
@@ -20,17 +20,25 @@
 
 namespace mjpc::manipulation {
 namespace {
-struct GraspState {
-  bool correct_object;
-  // maximum distance from a gripper pad to the body, in units of gripper
-  // span. populated if correct_object == true
-  double gripper_object_distance = 0;
-};
+// distance along the unit ray (pnt, vec) to geom, -1 if it misses
+double RayGeom(const mjModel* m, const mjData* d, int geom, const double* pnt,
+               const double* vec) {
+  switch (m->geom_type[geom]) {
+    case mjGEOM_MESH:
+      return mj_rayMesh(m, d, geom, pnt, vec);
+    case mjGEOM_HFIELD:
+      return mj_rayHfield(m, d, geom, pnt, vec);
+    default:
+      return mju_rayGeom(d->geom_xpos + 3 * geom, d->geom_xmat + 9 * geom,
+                         m->geom_size + 3 * geom, pnt, vec,
+                         m->geom_type[geom]);
+  }
+}
 
 GraspState GetGraspState(const mjModel* m, const mjData* d,
                          const ModelValues& model_vals, int body_id) {
   // cast a ray from one finger to the other to decide if the right body is in
-  // the gripper
+  // the gripper, and one going the opposite way to see if it's the only body
   const double* left_finger =
       d->geom_xpos + 3 * model_vals.left_finger_pad_geom_id;
   const double* right_finger =
@@ -38,13 +46,36 @@ GraspState GetGraspState(const mjModel* m, const mjData* d,
   double direction[3];
   mju_sub3(direction, left_finger, right_finger);
   double finger_distance = mju_normalize3(direction);
+  double opposite[3];
+  mju_scl3(opposite, direction, -1);
 
-  // ignore geoms belonging to the robot
-  mjtByte geomgroup[mjNGROUP] = {0};
-  geomgroup[kGroupCollisionScene] = 1;
-  int ray_geom_id;
-  double ray_distance =
-      mj_ray(m, d, right_finger, direction, geomgroup, 0, -1, &ray_geom_id);
+  // both rays in one pass over the candidates (the geoms mj_ray would test
+  // with the scene collision group), skipping those whose bounding sphere
+  // misses the segment between the fingers. planes and height fields have no
+  // bounding sphere.
+  double ray_distance = -1, ray_distance2 = -1;
+  int ray_geom_id = -1, ray_geom_id2 = -1;
+  for (int geom : model_vals.grasp_candidate_geoms) {
+    double rbound = m->geom_rbound[geom];
+    if (rbound > 0) {
+      double offset[3];
+      mju_sub3(offset, d->geom_xpos + 3 * geom, right_finger);
+      double along =
+          mju_clip(mju_dot3(offset, direction), 0, finger_distance);
+      mju_addToScl3(offset, direction, -along);
+      if (mju_dot3(offset, offset) > rbound * rbound) continue;
+    }
+    double distance = RayGeom(m, d, geom, right_finger, direction);
+    if (distance >= 0 && (ray_distance < 0 || distance < ray_distance)) {
+      ray_distance = distance;
+      ray_geom_id = geom;
+    }
+    distance = RayGeom(m, d, geom, left_finger, opposite);
+    if (distance >= 0 && (ray_distance2 < 0 || distance < ray_distance2)) {
+      ray_distance2 = distance;
+      ray_geom_id2 = geom;
+    }
+  }
 
   if (ray_distance == -1 || ray_distance > finger_distance) {
     // nothing in the gripper
@@ -56,12 +87,9 @@ GraspState GetGraspState(const mjModel* m, const mjData* d,
     return {.correct_object = false};
   }
 
-  // the right object is in the gripper. cast a ray going the opposite way,
-  // to see if it's the only object
-  mju_scl3(direction, direction, -1);
-  double ray_distance2 =
-      mj_ray(m, d, left_finger, direction, geomgroup, 0, -1, &ray_geom_id);
-  ray_body_id = m->body_weldid[m->geom_bodyid[ray_geom_id]];
+  // the right object is in the gripper, check that it's the only object
+  if (ray_geom_id2 < 0) return {.correct_object = false};
+  ray_body_id = m->body_weldid[m->geom_bodyid[ray_geom_id2]];
   if (ray_body_id != body_id) {
     // there's another object in the gripper
     return {.correct_object = false};
@@ -114,6 +142,19 @@ ModelValues ModelValues::FromModel(const mjModel* model) {
     // this mocap body isn't present in all manipulation models
     values.target_mocap_body = model->body_mocapid[target_mocap_body_id];
   }
+  values.object_body_id = mj_name2id(model, mjOBJ_BODY, "object");
+
+  // grasp ray candidates, as selected by mj_ray: in the scene collision
+  // group, visible and not static
+  for (int i = 0; i < model->ngeom; i++) {
+    int material = model->geom_matid[i];
+    double alpha = material < 0 ? model->geom_rgba[4 * i + 3]
+                                : model->mat_rgba[4 * material + 3];
+    if (model->geom_group[i] == kGroupCollisionScene && alpha != 0 &&
+        model->body_weldid[model->geom_bodyid[i]] != 0) {
+      values.grasp_candidate_geoms.push_back(i);
+    }
+  }
   return values;
 }
 
@@ -192,11 +233,23 @@ double BlockedCost(const mjModel* model, const mjData* data,
 }
 
 double GraspQualityCost(const mjModel* m, const mjData* d,
-                    const ModelValues& model_vals, int body_id, bool release) {
+                        const ModelValues& model_vals, int body_id,
+                        bool release, GraspCache* cache) {
   if (release) {
     return GripperCost(m, d, model_vals, /*open=*/true);
   }
-  GraspState grasp = GetGraspState(m, d, model_vals, body_id);
+  GraspState grasp;
+  if (cache && cache->period > 0 && cache->body_id == body_id &&
+      d->time >= cache->time && d->time < cache->time + cache->period) {
+    grasp = cache->state;
+  } else {
+    grasp = GetGraspState(m, d, model_vals, body_id);
+    if (cache) {
+      cache->time = d->time;
+      cache->body_id = body_id;
+      cache->state = grasp;
+    }
+  }
   constexpr double kEmptyCost = 1;
   if (!grasp.correct_object) {
     // nothing in the gripper, or the wrong object
@@ -51,6 +51,30 @@ struct ModelValues {
 
   // mocapid for a body that shows where the target is
   int target_mocap_body = -1;
+
+  // the body named "object", if present
+  int object_body_id = -1;
+
+  // geoms hit by the grasp rays: visible, non-static scene collision geoms
+  std::vector<int> grasp_candidate_geoms;
+};
+
+// result of the grasp ray checks
+struct GraspState {
+  bool correct_object;
+  // maximum distance from a gripper pad to the body, in units of gripper
+  // span. populated if correct_object == true
+  double gripper_object_distance = 0;
+};
+
+// grasp state of a sequence of evaluations at increasing times, e.g., the
+// steps of one rollout. the rays are cast at most once per period (seconds),
+// e.g., the planner's timestep, and reused in between. one per thread.
+struct GraspCache {
+  double period = 0;  // 0: cast on every evaluation
+  double time = 0;
+  int body_id = -1;   // -1: empty
+  GraspState state = {.correct_object = false};
 };
 
 // computes a control cost and writes it to residual, returns the number of
@@ -76,9 +100,12 @@ double BlockedCost(const mjModel* model, const mjData* data,
                    const ModelValues& model_vals, const double* pos,
                    const double* object, int exclude_body_id);
 
+// returns a cost that is low if body_id, and only body_id, is between the
+// gripper pads and the gripper is closed around it. with a cache, the
+// grasp rays are reused within cache->period.
 double GraspQualityCost(const mjModel* m, const mjData* d,
                         const ModelValues& model_vals, int body_id,
-                        bool release);
+                        bool release, GraspCache* cache = nullptr);
 
 // returns a cost term that is high if there are large forces between the robot
 // and bodies that aren't object_body_id
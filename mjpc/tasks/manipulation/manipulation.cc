@@ -15,9 +15,10 @@
 #include "mjpc/tasks/manipulation/manipulation.h"
 
 #include <string>
+#include <vector>
 
 #include <absl/container/flat_hash_map.h>
-#include <absl/random/random.h>
+#include <absl/random/distributions.h>
 #include <mujoco/mjmodel.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/task.h"
@@ -39,21 +40,20 @@ void manipulation::Bring::ResidualFn::Residual(const mjModel* model,
   double hand[3] = {0};
   ComputeRobotiqHandPos(model, data, model_vals_, hand);
 
-  double* object = SensorByName(model, data, "object");
+  double* object = sensors_.Data(model, data, kObject);
   mju_sub3(residual + counter, hand, object);
   counter += 3;
 
   // bring
   for (int i=0; i < 8; i++) {
-    double* object = SensorByName(model, data, std::to_string(i).c_str());
-    double* target = SensorByName(model, data,
-                                        (std::to_string(i) + "t").c_str());
+    double* object = sensors_.Data(model, data, kPoint + i);
+    double* target = sensors_.Data(model, data, kTarget + i);
     residual[counter++] = mju_dist3(object, target);
   }
 
   // careful
-  int object_id = mj_name2id(model, mjOBJ_BODY, "object");
-  residual[counter++] = CarefulCost(model, data, model_vals_, object_id);
+  residual[counter++] =
+      CarefulCost(model, data, model_vals_, model_vals_.object_body_id);
 
   // away
   residual[counter++] = mju_min(0, hand[2] - 0.6);
@@ -82,16 +82,15 @@ void manipulation::Bring::TransitionLocked(mjModel* model, mjData* data) {
     weight[0] = 1;  // enable reach
     weight[3] = 0;  // disable away
 
-    absl::BitGen gen_;
 
     // initialise target:
     data->qpos[7+0] = 0.45;
     data->qpos[7+1] = 0;
     data->qpos[7+2] = 0.15;
-    data->qpos[7+3] = absl::Uniform<double>(gen_, -1, 1);
-    data->qpos[7+4] = absl::Uniform<double>(gen_, -1, 1);
-    data->qpos[7+5] = absl::Uniform<double>(gen_, -1, 1);
-    data->qpos[7+6] = absl::Uniform<double>(gen_, -1, 1);
+    data->qpos[7+3] = absl::Uniform<double>(rng_, -1, 1);
+    data->qpos[7+4] = absl::Uniform<double>(rng_, -1, 1);
+    data->qpos[7+5] = absl::Uniform<double>(rng_, -1, 1);
+    data->qpos[7+6] = absl::Uniform<double>(rng_, -1, 1);
     mju_normalize4(data->qpos + 13);
 
     // return stage: bring
@@ -101,5 +100,11 @@ void manipulation::Bring::TransitionLocked(mjModel* model, mjData* data) {
 
 void manipulation::Bring::ResetLocked(const mjModel* model) {
   residual_.model_vals_ = ModelValues::FromModel(model);
+
+  // object, object points 0-7 and their targets 0t-7t
+  std::vector<std::string> names = {"object"};
+  for (int i = 0; i < 8; i++) names.push_back(std::to_string(i));
+  for (int i = 0; i < 8; i++) names.push_back(std::to_string(i) + "t");
+  sensors.Resolve(model, names);
 }
 }  // namespace mjpc
@@ -17,6 +17,7 @@
 
 
 #include <mujoco/mujoco.h>
+#include "mjpc/random.h"
 #include "mjpc/task.h"
 #include "mjpc/tasks/manipulation/common.h"
 
@@ -32,6 +33,16 @@ class Bring : public Task {
 
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked. kPoint + i and
+    // kTarget + i are object point i and its target.
+    enum Sensor {
+      kObject = 0,
+      kPoint,
+      kTarget = kPoint + 8,
+      kNumSensor = kTarget + 8,
+    };
+
    private:
     friend class Bring;
     ModelValues model_vals_;
@@ -49,6 +60,7 @@ class Bring : public Task {
 
  private:
   ResidualFn residual_;
+  RandomStream rng_;  // goal sampling
 };
 }  // namespace mjpc::manipulation
 
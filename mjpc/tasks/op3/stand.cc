@@ -14,12 +14,24 @@
 
 #include "mjpc/tasks/op3/stand.h"
 
+#include <iterator>
 #include <string>
 
 #include <mujoco/mujoco.h>
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "head_position", "left_foot_position", "right_foot_position",
+    "left_hand_position", "right_hand_position", "torso_up", "hand_right_up",
+    "hand_left_up", "foot_right_up", "foot_left_up", "body_subtreecom",
+    "body_subtreelinvel",
+};
+static_assert(std::size(kSensorNames) == OP3::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string OP3::XmlPath() const { return GetModelPath("op3/task.xml"); }
 std::string OP3::Name() const { return "OP3"; }
 
@@ -33,27 +45,43 @@ std::string OP3::Name() const { return "OP3"; }
 // -------------------------------------------
 void OP3::ResidualFn::Residual(const mjModel* model, const mjData* data,
                                double* residual) const {
+  ModeResidualFn mode_residual =
+      mode_residual_ ? mode_residual_ : CurrentModeResidual();
+  mode_residual(this, model, data, residual);
+}
+
+void OP3::ResidualFn::SelectMode() { mode_residual_ = CurrentModeResidual(); }
+
+OP3::ResidualFn::ModeResidualFn OP3::ResidualFn::CurrentModeResidual() const {
+  static constexpr auto kModeResiduals =
+      ModeResidualTable<ResidualFn, kNumMode>();
+  return kModeResiduals[current_mode_];
+}
+
+template <int kMode>
+void OP3::ResidualFn::ModeResidual(const mjModel* model, const mjData* data,
+                                   double* residual) const {
   // start counter
   int counter = 0;
 
-  // get mode
-  int mode = current_mode_;
+  // mode, constant in each instance
+  constexpr int mode = kMode;
 
   // ----- sensors ------ //
-  double* head_position = SensorByName(model, data, "head_position");
-  double* left_foot_position = SensorByName(model, data, "left_foot_position");
+  double* head_position = sensors_.Data(model, data, kHeadPosition);
+  double* left_foot_position = sensors_.Data(model, data, kLeftFootPosition);
   double* right_foot_position =
-      SensorByName(model, data, "right_foot_position");
-  double* left_hand_position = SensorByName(model, data, "left_hand_position");
+      sensors_.Data(model, data, kRightFootPosition);
+  double* left_hand_position = sensors_.Data(model, data, kLeftHandPosition);
   double* right_hand_position =
-      SensorByName(model, data, "right_hand_position");
-  double* torso_up = SensorByName(model, data, "torso_up");
-  double* hand_right_up = SensorByName(model, data, "hand_right_up");
-  double* hand_left_up = SensorByName(model, data, "hand_left_up");
-  double* foot_right_up = SensorByName(model, data, "foot_right_up");
-  double* foot_left_up = SensorByName(model, data, "foot_left_up");
-  double* com_position = SensorByName(model, data, "body_subtreecom");
-  double* com_velocity = SensorByName(model, data, "body_subtreelinvel");
+      sensors_.Data(model, data, kRightHandPosition);
+  double* torso_up = sensors_.Data(model, data, kTorsoUp);
+  double* hand_right_up = sensors_.Data(model, data, kHandRightUp);
+  double* hand_left_up = sensors_.Data(model, data, kHandLeftUp);
+  double* foot_right_up = sensors_.Data(model, data, kFootRightUp);
+  double* foot_left_up = sensors_.Data(model, data, kFootLeftUp);
+  double* com_position = sensors_.Data(model, data, kBodySubtreecom);
+  double* com_velocity = sensors_.Data(model, data, kBodySubtreelinvel);
 
   // ----- Height ----- //
   if (mode == kModeStand) {
@@ -162,4 +190,8 @@ void OP3::TransitionLocked(mjModel* model, mjData* d) {
   }
 }
 
+void OP3::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc
@@ -42,16 +42,44 @@ class OP3 : public Task {
     // -------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+    void SelectMode() override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kHeadPosition = 0,
+      kLeftFootPosition,
+      kRightFootPosition,
+      kLeftHandPosition,
+      kRightHandPosition,
+      kTorsoUp,
+      kHandRightUp,
+      kHandLeftUp,
+      kFootRightUp,
+      kFootLeftUp,
+      kBodySubtreecom,
+      kBodySubtreelinvel,
+      kNumSensor,
+    };
 
    private:
     friend class OP3;
+    friend class BaseResidualFn;  // calls ModeResidual
     int current_mode_;
 
     // modes
     enum OP3Mode {
       kModeStand = 0,
       kModeHandstand,
+      kNumMode,
     };
+
+    // residual of one mode
+    template <int kMode>
+    void ModeResidual(const mjModel* model, const mjData* data,
+                      double* residual) const;
+
+    // ModeResidual of current_mode_
+    ModeResidualFn CurrentModeResidual() const;
   };
 
   OP3() : residual_(this) {}
@@ -61,6 +89,7 @@ class OP3 : public Task {
   constexpr static double kModeHeight[2] = {0.38, 0.57};
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this, residual_.current_mode_);
   }
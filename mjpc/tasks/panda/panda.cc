@@ -14,14 +14,23 @@
 
 #include "mjpc/tasks/panda/panda.h"
 
+#include <iterator>
 #include <string>
 
-#include <absl/random/random.h>
+#include <absl/random/distributions.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/task.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "hand", "box", "box1", "target1", "box2", "target2",
+};
+static_assert(std::size(kSensorNames) == Panda::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Panda::XmlPath() const {
   return GetModelPath("panda/task.xml");
 }
@@ -40,18 +49,18 @@ void Panda::ResidualFn::Residual(const mjModel* model, const mjData* data,
   int counter = 0;
 
   // reach
-  double* hand = SensorByName(model, data, "hand");
-  double* box = SensorByName(model, data, "box");
+  double* hand = sensors_.Data(model, data, kHand);
+  double* box = sensors_.Data(model, data, kBox);
   mju_sub3(residual + counter, hand, box);
   counter += 3;
 
   // bring
-  double* box1 = SensorByName(model, data, "box1");
-  double* target1 = SensorByName(model, data, "target1");
+  double* box1 = sensors_.Data(model, data, kBox1);
+  double* target1 = sensors_.Data(model, data, kTarget1);
   mju_sub3(residual + counter, box1, target1);
   counter += 3;
-  double* box2 = SensorByName(model, data, "box2");
-  double* target2 = SensorByName(model, data, "target2");
+  double* box2 = sensors_.Data(model, data, kBox2);
+  double* target2 = sensors_.Data(model, data, kTarget2);
   mju_sub3(residual + counter, box2, target2);
   counter += 3;
 
@@ -59,7 +68,7 @@ void Panda::ResidualFn::Residual(const mjModel* model, const mjData* data,
   // TODO: use this pattern everywhere and make this a utility function
   int user_sensor_dim = 0;
   for (int i = 0; i < model->nsensor; i++) {
-    if (model->sensor_type[i] == mjSENS_USER) {
+    if (model->sensor_type[i] == mjSENS_USER && !SkippedSensor(model, i)) {
       user_sensor_dim += model->sensor_dim[i];
     }
   }
@@ -79,20 +88,23 @@ void Panda::TransitionLocked(mjModel* model, mjData* data) {
   // reset:
   if (data->time > 0 && bring_dist < .015) {
     // box:
-    absl::BitGen gen_;
-    data->qpos[0] = absl::Uniform<double>(gen_, -.5, .5);
-    data->qpos[1] = absl::Uniform<double>(gen_, -.5, .5);
+    data->qpos[0] = absl::Uniform<double>(rng_, -.5, .5);
+    data->qpos[1] = absl::Uniform<double>(rng_, -.5, .5);
     data->qpos[2] = .05;
 
     // target:
-    data->mocap_pos[0] = absl::Uniform<double>(gen_, -.5, .5);
-    data->mocap_pos[1] = absl::Uniform<double>(gen_, -.5, .5);
-    data->mocap_pos[2] = absl::Uniform<double>(gen_, .03, 1);
-    data->mocap_quat[0] = absl::Uniform<double>(gen_, -1, 1);
-    data->mocap_quat[1] = absl::Uniform<double>(gen_, -1, 1);
-    data->mocap_quat[2] = absl::Uniform<double>(gen_, -1, 1);
-    data->mocap_quat[3] = absl::Uniform<double>(gen_, -1, 1);
+    data->mocap_pos[0] = absl::Uniform<double>(rng_, -.5, .5);
+    data->mocap_pos[1] = absl::Uniform<double>(rng_, -.5, .5);
+    data->mocap_pos[2] = absl::Uniform<double>(rng_, .03, 1);
+    data->mocap_quat[0] = absl::Uniform<double>(rng_, -1, 1);
+    data->mocap_quat[1] = absl::Uniform<double>(rng_, -1, 1);
+    data->mocap_quat[2] = absl::Uniform<double>(rng_, -1, 1);
+    data->mocap_quat[3] = absl::Uniform<double>(rng_, -1, 1);
     mju_normalize4(data->mocap_quat);
   }
 }
+void Panda::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc
@@ -17,6 +17,7 @@
 
 #include <string>
 #include <mujoco/mujoco.h>
+#include "mjpc/random.h"
 #include "mjpc/task.h"
 
 namespace mjpc {
@@ -29,11 +30,23 @@ class Panda : public Task {
     explicit ResidualFn(const Panda* task) : mjpc::BaseResidualFn(task) {}
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kHand = 0,
+      kBox,
+      kBox1,
+      kTarget1,
+      kBox2,
+      kTarget2,
+      kNumSensor,
+    };
   };
   Panda() : residual_(this) {}
   void TransitionLocked(mjModel* model, mjData* data) override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
@@ -41,6 +54,7 @@ class Panda : public Task {
 
  private:
   ResidualFn residual_;
+  RandomStream rng_;  // goal sampling
 };
 }  // namespace mjpc
 
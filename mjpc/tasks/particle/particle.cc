@@ -33,14 +33,22 @@ std::string Particle::Name() const { return "Particle"; }
 //     Residual (2): control
 // --------------------------------------------
 namespace {
+// sensors read by ResidualImpl, resolved in ResetLocked
+enum Sensor {
+  kPosition = 0,
+  kVelocity,
+};
+constexpr const char* kSensorNames[] = {"position", "velocity"};
+
 void ResidualImpl(const mjModel* model, const mjData* data,
-                  const double goal[2], double* residual) {
+                  const SensorTable& sensors, const double goal[2],
+                  double* residual) {
   // ----- residual (0) ----- //
-  double* position = SensorByName(model, data, "position");
+  double* position = sensors.Data(model, data, kPosition);
   mju_sub(residual, position, goal, model->nq);
 
   // ----- residual (1) ----- //
-  double* velocity = SensorByName(model, data, "velocity");
+  double* velocity = sensors.Data(model, data, kVelocity);
   mju_copy(residual + 2, velocity, model->nv);
 
   // ----- residual (2) ----- //
@@ -52,7 +60,7 @@ void Particle::ResidualFn::Residual(const mjModel* model, const mjData* data,
                                     double* residual) const {
   // some Lissajous curve
   double goal[2]{0.25 * mju_sin(data->time), 0.25 * mju_cos(data->time / mjPI)};
-  ResidualImpl(model, data, goal, residual);
+  ResidualImpl(model, data, sensors_, goal, residual);
 }
 
 void Particle::TransitionLocked(mjModel* model, mjData* data) {
@@ -64,6 +72,10 @@ void Particle::TransitionLocked(mjModel* model, mjData* data) {
   data->mocap_pos[1] = goal[1];
 }
 
+void Particle::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 std::string ParticleFixed::XmlPath() const {
   return GetModelPath("particle/task_timevarying.xml");
 }
@@ -73,7 +85,11 @@ void ParticleFixed::ResidualFn::Residual(const mjModel* model,
                                          const mjData* data,
                                          double* residual) const {
   double goal[2]{data->mocap_pos[0], data->mocap_pos[1]};
-  ResidualImpl(model, data, goal, residual);
+  ResidualImpl(model, data, sensors_, goal, residual);
+}
+
+void ParticleFixed::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
 }
 
 }  // namespace mjpc
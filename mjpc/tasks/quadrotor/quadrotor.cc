@@ -14,6 +14,7 @@
 
 #include "mjpc/tasks/quadrotor/quadrotor.h"
 
+#include <iterator>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -21,6 +22,14 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "position", "linear_velocity", "angular_velocity",
+};
+static_assert(std::size(kSensorNames) == Quadrotor::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Quadrotor::XmlPath() const {
   return GetModelPath("quadrotor/task.xml");
 }
@@ -37,15 +46,15 @@ std::string Quadrotor::Name() const { return "Quadrotor"; }
 void Quadrotor::ResidualFn::Residual(const mjModel* model, const mjData* data,
                                      double* residuals) const {
   // ---------- Residual (0) ----------
-  double* position = SensorByName(model, data, "position");
+  double* position = sensors_.Data(model, data, kPosition);
   mju_sub(residuals, position, data->mocap_pos, 3);
 
   // ---------- Residual (1) ----------
-  double* linear_velocity = SensorByName(model, data, "linear_velocity");
+  double* linear_velocity = sensors_.Data(model, data, kLinearVelocity);
   mju_copy(residuals + 3, linear_velocity, 3);
 
   // ---------- Residual (2) ----------
-  double* angular_velocity = SensorByName(model, data, "angular_velocity");
+  double* angular_velocity = sensors_.Data(model, data, kAngularVelocity);
   mju_copy(residuals + 6, angular_velocity, 3);
 
   // ---------- Residual (3) ----------
@@ -66,7 +75,7 @@ void Quadrotor::TransitionLocked(mjModel* model, mjData* data) {
     const double* goal_position = data->mocap_pos;
 
     // system's position
-    double* position = SensorByName(model, data, "position");
+    double* position = sensors.Data(model, data, ResidualFn::kPosition);
 
     // position error
     double position_error[3];
@@ -87,4 +96,8 @@ void Quadrotor::TransitionLocked(mjModel* model, mjData* data) {
   mju_copy4(data->mocap_quat, model->key_mquat + 4 * current_mode_);
 }
 
+void Quadrotor::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc
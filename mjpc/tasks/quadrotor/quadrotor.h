@@ -39,12 +39,21 @@ class Quadrotor : public Task {
     // ------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kPosition = 0,
+      kLinearVelocity,
+      kAngularVelocity,
+      kNumSensor,
+    };
   };
 
   Quadrotor() : residual_(this) {}
   void TransitionLocked(mjModel* model, mjData* data) override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
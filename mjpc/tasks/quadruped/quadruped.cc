@@ -14,6 +14,9 @@
 
 #include "mjpc/tasks/quadruped/quadruped.h"
 
+#include <algorithm>
+#include <iterator>
+#include <memory>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -21,6 +24,22 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of QuadrupedFlat::ResidualFn::Sensor
+constexpr const char* kFlatSensorNames[] = {
+    "torso_subtreecom", "torso_subtreelinvel", "torso_angmom",
+};
+static_assert(std::size(kFlatSensorNames) ==
+              QuadrupedFlat::ResidualFn::kNumSensor);
+
+// names of QuadrupedHill::ResidualFn::Sensor
+constexpr const char* kHillSensorNames[] = {
+    "position", "orientation", "FR", "FL", "RR", "RL",
+};
+static_assert(std::size(kHillSensorNames) ==
+              QuadrupedHill::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string QuadrupedHill::XmlPath() const {
   return GetModelPath("quadruped/task_hill.xml");
 }
@@ -33,6 +52,38 @@ std::string QuadrupedFlat::Name() const { return "Quadruped Flat"; }
 void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
                                          const mjData* data,
                                          double* residual) const {
+  ModeResidualFn mode_residual =
+      mode_residual_ ? mode_residual_ : CurrentModeResidual();
+  mode_residual(this, model, data, residual);
+}
+
+void QuadrupedFlat::ResidualFn::SelectMode() {
+  mode_residual_ = CurrentModeResidual();
+}
+
+bool QuadrupedFlat::ResidualFn::Terminated(const mjModel* model,
+                                           const mjData* data) const {
+  if (current_mode_ != kModeQuadruped && current_mode_ != kModeWalk) {
+    return false;
+  }
+  // torso z-axis pointing down
+  return data->xmat[9 * torso_body_id_ + 8] < 0;
+}
+
+QuadrupedFlat::ResidualFn::ModeResidualFn
+QuadrupedFlat::ResidualFn::CurrentModeResidual() const {
+  static constexpr auto kModeResiduals =
+      ModeResidualTable<ResidualFn, kNumMode>();
+  return kModeResiduals[current_mode_];
+}
+
+template <int kMode>
+void QuadrupedFlat::ResidualFn::ModeResidual(const mjModel* model,
+                                             const mjData* data,
+                                             double* residual) const {
+  // mode, constant in each instance
+  constexpr A1Mode mode = static_cast<A1Mode>(kMode);
+
   // start counter
   int counter = 0;
 
@@ -41,18 +92,21 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   for (A1Foot foot : kFootAll)
     foot_pos[foot] = data->geom_xpos + 3 * foot_geom_id_[foot];
 
+  // precomputed time-only terms, if data->time is on the planning time grid
+  int grid_index = grid_.Index(data->time);
+
   // average foot position
   double avg_foot_pos[3];
   AverageFootPos(avg_foot_pos, foot_pos);
 
   double* torso_xmat = data->xmat + 9*torso_body_id_;
   double* goal_pos = data->mocap_pos + 3*goal_mocap_id_;
-  double* compos = SensorByName(model, data, "torso_subtreecom");
+  double* compos = sensors_.Data(model, data, kTorsoSubtreecom);
 
 
   // ---------- Upright ----------
-  if (current_mode_ != kModeFlip) {
-    if (current_mode_ == kModeBiped) {
+  if (mode != kModeFlip) {
+    if (mode == kModeBiped) {
       double biped_type = parameters_[biped_type_param_id_];
       int handstand = ReinterpretAsInt(biped_type) ? -1 : 1;
       residual[counter++] = torso_xmat[6] - handstand;
@@ -63,9 +117,12 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
     residual[counter++] = 0;
   } else {
     // special handling of flip orientation
-    double flip_time = data->time - mode_start_time_;
     double quat[4];
-    FlipQuat(quat, flip_time);
+    if (grid_index >= 0) {
+      mju_copy4(quat, grid_flip_quat_.data() + 4 * grid_index);
+    } else {
+      FlipQuat(quat, data->time - mode_start_time_);
+    }
     double* torso_xquat = data->xquat + 4*torso_body_id_;
     mju_subQuat(residual + counter, torso_xquat, quat);
     counter += 3;
@@ -75,15 +132,17 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   // ---------- Height ----------
   // quadrupedal or bipedal height of torso over feet
   double* torso_pos = data->xipos + 3*torso_body_id_;
-  bool is_biped = current_mode_ == kModeBiped;
+  bool is_biped = mode == kModeBiped;
   double height_goal = is_biped ? kHeightBiped : kHeightQuadruped;
-  if (current_mode_ == kModeScramble) {
+  if (mode == kModeScramble) {
     // disable height term in Scramble
     residual[counter++] = 0;
-  } else if (current_mode_ == kModeFlip) {
+  } else if (mode == kModeFlip) {
     // height target for Backflip
-    double flip_time = data->time - mode_start_time_;
-    residual[counter++] = torso_pos[2] - FlipHeight(flip_time);
+    double flip_height = grid_index >= 0
+                             ? grid_flip_height_[grid_index]
+                             : FlipHeight(data->time - mode_start_time_);
+    residual[counter++] = torso_pos[2] - flip_height;
   } else {
     residual[counter++] = (torso_pos[2] - avg_foot_pos[2]) - height_goal;
   }
@@ -92,10 +151,14 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   // ---------- Position ----------
   double* head = data->site_xpos + 3*head_site_id_;
   double target[3];
-  if (current_mode_ == kModeWalk) {
+  if (mode == kModeWalk) {
     // follow prescribed Walk trajectory
-    double mode_time = data->time - mode_start_time_;
-    Walk(target, mode_time);
+    if (grid_index >= 0) {
+      target[0] = grid_walk_[2 * grid_index];
+      target[1] = grid_walk_[2 * grid_index + 1];
+    } else {
+      Walk(target, data->time - mode_start_time_);
+    }
   } else {
     // go to the goal mocap body
     target[0] = goal_pos[0];
@@ -105,12 +168,16 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   residual[counter++] = head[0] - target[0];
   residual[counter++] = head[1] - target[1];
   residual[counter++] =
-      current_mode_ == kModeScramble ? 2 * (head[2] - target[2]) : 0;
+      mode == kModeScramble ? 2 * (head[2] - target[2]) : 0;
 
   // ---------- Gait ----------
   A1Gait gait = GetGait();
   double step[kNumFoot];
-  FootStep(step, GetPhase(data->time), gait);
+  if (grid_index >= 0) {
+    mju_copy(step, grid_step_.data() + kNumFoot * grid_index, kNumFoot);
+  } else {
+    FootStep(step, GetPhase(data->time), gait);
+  }
   for (A1Foot foot : kFootAll) {
     if (is_biped) {
       // ignore "hands" in biped mode
@@ -124,7 +191,7 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
     }
     double query[3] = {foot_pos[foot][0], foot_pos[foot][1], foot_pos[foot][2]};
 
-    if (current_mode_ == kModeScramble) {
+    if (mode == kModeScramble) {
       double torso_to_goal[3];
       double* goal = data->mocap_pos + 3*goal_mocap_id_;
       mju_sub3(torso_to_goal, goal, torso_pos);
@@ -138,7 +205,7 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
     double ground_height = Ground(model, data, query);
     double height_target = ground_height + kFootRadius + step[foot];
     double height_difference = foot_pos[foot][2] - height_target;
-    if (current_mode_ == kModeScramble) {
+    if (mode == kModeScramble) {
       // in Scramble, foot higher than target is not penalized
       height_difference = mju_min(0, height_difference);
     }
@@ -147,7 +214,7 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
 
 
   // ---------- Balance ----------
-  double* comvel = SensorByName(model, data, "torso_subtreelinvel");
+  double* comvel = sensors_.Data(model, data, kTorsoSubtreelinvel);
   double capture_point[3];
   double fall_time = mju_sqrt(2*height_goal / 9.81);
   mju_addScl3(capture_point, compos, comvel, fall_time);
@@ -163,7 +230,7 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   // ---------- Posture ----------
   double* home = KeyQPosByName(model, data, "home");
   mju_sub(residual + counter, data->qpos + 7, home + 7, model->nu);
-  if (current_mode_ == kModeFlip) {
+  if (mode == kModeFlip) {
     double flip_time = data->time - mode_start_time_;
     if (flip_time < crouch_time_) {
       double* crouch = KeyQPosByName(model, data, "crouch");
@@ -179,7 +246,7 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
       residual[counter + 3*foot + joint] *= kJointPostureGain[joint];
     }
   }
-  if (current_mode_ == kModeBiped) {
+  if (mode == kModeBiped) {
     // loosen the "hands" in Biped mode
     bool handstand = ReinterpretAsInt(parameters_[biped_type_param_id_]);
     if (handstand) {
@@ -199,20 +266,20 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
 
   // ---------- Yaw ----------
   double torso_heading[2] = {torso_xmat[0], torso_xmat[3]};
-  if (current_mode_ == kModeBiped) {
+  if (mode == kModeBiped) {
     int handstand =
         ReinterpretAsInt(parameters_[biped_type_param_id_]) ? 1 : -1;
     torso_heading[0] = handstand * torso_xmat[2];
     torso_heading[1] = handstand * torso_xmat[5];
   }
   mju_normalize(torso_heading, 2);
-  double heading_goal = parameters_[ParameterIndex(model, "Heading")];
+  double heading_goal = parameters_[heading_param_id_];
   residual[counter++] = torso_heading[0] - mju_cos(heading_goal);
   residual[counter++] = torso_heading[1] - mju_sin(heading_goal);
 
 
   // ---------- Angular momentum ----------
-  mju_copy3(residual + counter, SensorByName(model, data, "torso_angmom"));
+  mju_copy3(residual + counter, sensors_.Data(model, data, kTorsoAngmom));
   counter +=3;
 
 
@@ -220,6 +287,33 @@ void QuadrupedFlat::ResidualFn::Residual(const mjModel* model,
   CheckSensorDim(model, counter);
 }
 
+std::unique_ptr<mjpc::ResidualFn>
+QuadrupedFlat::ResidualFn::PrecomputeTimeGrid(const TimeGrid& grid) const {
+  auto residual = std::make_unique<ResidualFn>(*this);
+  residual->grid_ = grid;
+  int steps = std::max(grid.steps, 0);
+  residual->grid_step_.resize(kNumFoot * steps);
+  if (current_mode_ == kModeWalk) residual->grid_walk_.resize(2 * steps);
+  if (current_mode_ == kModeFlip) {
+    residual->grid_flip_quat_.resize(4 * steps);
+    residual->grid_flip_height_.resize(steps);
+  }
+
+  A1Gait gait = GetGait();
+  for (int i = 0; i < steps; i++) {
+    double time = grid.time + i * grid.timestep;
+    FootStep(residual->grid_step_.data() + kNumFoot * i, GetPhase(time), gait);
+    if (current_mode_ == kModeWalk) {
+      Walk(residual->grid_walk_.data() + 2 * i, time - mode_start_time_);
+    } else if (current_mode_ == kModeFlip) {
+      FlipQuat(residual->grid_flip_quat_.data() + 4 * i,
+               time - mode_start_time_);
+      residual->grid_flip_height_[i] = FlipHeight(time - mode_start_time_);
+    }
+  }
+  return residual;
+}
+
 //  ============  transition  ============
 void QuadrupedFlat::TransitionLocked(mjModel* model, mjData* data) {
   // ---------- handle mjData reset ----------
@@ -252,7 +346,8 @@ void QuadrupedFlat::TransitionLocked(mjModel* model, mjData* data) {
 
 
   // ---------- automatic gait switching ----------
-  double* comvel = SensorByName(model, data, "torso_subtreelinvel");
+  double* comvel =
+      sensors.Data(model, data, ResidualFn::kTorsoSubtreelinvel);
   double beta = mju_exp(-(data->time - residual_.last_transition_time_) /
                         ResidualFn::kAutoGaitFilter);
   residual_.com_vel_[0] = beta * residual_.com_vel_[0] + (1 - beta) * comvel[0];
@@ -343,7 +438,7 @@ void QuadrupedFlat::TransitionLocked(mjModel* model, mjData* data) {
 
 
   // ---------- Flip ----------
-  double* compos = SensorByName(model, data, "torso_subtreecom");
+  double* compos = sensors.Data(model, data, ResidualFn::kTorsoSubtreecom);
   if (mode == ResidualFn::kModeFlip) {
     // switching into Flip, reset task state
     if (mode != residual_.current_mode_) {
@@ -482,8 +577,9 @@ void QuadrupedFlat::ModifyScene(const mjModel* model, const mjData* data,
       is_biped ? ResidualFn::kHeightBiped : ResidualFn::kHeightQuadruped;
   double fall_time = mju_sqrt(2*height_goal / residual_.gravity_);
   double capture[3];
-  double* compos = SensorByName(model, data, "torso_subtreecom");
-  double* comvel = SensorByName(model, data, "torso_subtreelinvel");
+  double* compos = sensors.Data(model, data, ResidualFn::kTorsoSubtreecom);
+  double* comvel =
+      sensors.Data(model, data, ResidualFn::kTorsoSubtreelinvel);
   mju_addScl3(capture, compos, comvel, fall_time);
 
   // ground under CoM
@@ -513,6 +609,8 @@ void QuadrupedFlat::ModifyScene(const mjModel* model, const mjData* data,
 //  ============  task-state utilities  ============
 // save task-related ids
 void QuadrupedFlat::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kFlatSensorNames);
+
   // ----------  task identifiers  ----------
   residual_.gait_param_id_ = ParameterIndex(model, "select_Gait");
   residual_.gait_switch_param_id_ = ParameterIndex(model, "select_Gait switch");
@@ -521,6 +619,7 @@ void QuadrupedFlat::ResetLocked(const mjModel* model) {
   residual_.cadence_param_id_ = ParameterIndex(model, "Cadence");
   residual_.amplitude_param_id_ = ParameterIndex(model, "Amplitude");
   residual_.duty_param_id_ = ParameterIndex(model, "Duty ratio");
+  residual_.heading_param_id_ = ParameterIndex(model, "Heading");
   residual_.balance_cost_id_ = CostTermByName(model, "Balance");
   residual_.upright_cost_id_ = CostTermByName(model, "Upright");
   residual_.height_cost_id_ = CostTermByName(model, "Height");
@@ -529,6 +628,9 @@ void QuadrupedFlat::ResetLocked(const mjModel* model) {
   residual_.torso_body_id_ = mj_name2id(model, mjOBJ_XBODY, "trunk");
   if (residual_.torso_body_id_ < 0) mju_error("body 'trunk' not found");
 
+  // rollouts stop once the torso turns over
+  termination = true;
+
   residual_.head_site_id_ = mj_name2id(model, mjOBJ_SITE, "head");
   if (residual_.head_site_id_ < 0) mju_error("site 'head' not found");
 
@@ -726,47 +828,52 @@ void QuadrupedFlat::ResidualFn::FlipQuat(double quat[4], double time) const {
 void QuadrupedHill::ResidualFn::Residual(const mjModel* model,
                                          const mjData* data,
                                          double* residual) const {
-  // ---------- Residual (0) ----------
+  ResidualBatch(model, &data, &residual, 1);
+}
+
+void QuadrupedHill::ResidualFn::ResidualBatch(const mjModel* model,
+                                              const mjData* const* data,
+                                              double* const* residual,
+                                              int n) const {
   // standing height goal
   double height_goal = parameters_[0];
 
-  // system's standing height
-  double standing_height = SensorByName(model, data, "position")[2];
-
-  // average foot height
-  double FRz = SensorByName(model, data, "FR")[2];
-  double FLz = SensorByName(model, data, "FL")[2];
-  double RRz = SensorByName(model, data, "RR")[2];
-  double RLz = SensorByName(model, data, "RL")[2];
-  double avg_foot_height = 0.25 * (FRz + FLz + RRz + RLz);
+  for (int i = 0; i < n; i++) {
+    const mjData* d = data[i];
+    double* r = residual[i];
 
-  residual[0] = (standing_height - avg_foot_height) - height_goal;
+    // ---------- Residual (0) ----------
+    // system's standing height
+    const double* position = sensors_.Data(model, d, kPosition);
+    double standing_height = position[2];
 
-  // ---------- Residual (1) ----------
-  // goal position
-  const double* goal_position = data->mocap_pos;
+    // average foot height
+    double foot_height = 0.0;
+    for (int j = 0; j < 4; j++) {
+      foot_height += sensors_.Data(model, d, kFoot + j)[2];
+    }
+    double avg_foot_height = 0.25 * foot_height;
 
-  // system's position
-  double* position = SensorByName(model, data, "position");
+    r[0] = (standing_height - avg_foot_height) - height_goal;
 
-  // position error
-  mju_sub3(residual + 1, position, goal_position);
+    // ---------- Residual (1) ----------
+    // position error
+    mju_sub3(r + 1, position, d->mocap_pos);
 
-  // ---------- Residual (2) ----------
-  // goal orientation
-  double goal_rotmat[9];
-  const double* goal_orientation = data->mocap_quat;
-  mju_quat2Mat(goal_rotmat, goal_orientation);
+    // ---------- Residual (2) ----------
+    // goal orientation
+    double goal_rotmat[9];
+    mju_quat2Mat(goal_rotmat, d->mocap_quat);
 
-  // system's orientation
-  double body_rotmat[9];
-  double* orientation = SensorByName(model, data, "orientation");
-  mju_quat2Mat(body_rotmat, orientation);
+    // system's orientation
+    double body_rotmat[9];
+    mju_quat2Mat(body_rotmat, sensors_.Data(model, d, kOrientation));
 
-  mju_sub(residual + 4, body_rotmat, goal_rotmat, 9);
+    mju_sub(r + 4, body_rotmat, goal_rotmat, 9);
 
-  // ---------- Residual (3) ----------
-  mju_copy(residual + 13, data->ctrl, model->nu);
+    // ---------- Residual (3) ----------
+    mju_copy(r + 13, d->ctrl, model->nu);
+  }
 }
 
 // -------- Transition for quadruped task --------
@@ -786,10 +893,10 @@ void QuadrupedHill::TransitionLocked(mjModel* model, mjData* data) {
     const double* goal_orientation = data->mocap_quat;
 
     // system's position
-    double* position = SensorByName(model, data, "position");
+    double* position = sensors.Data(model, data, ResidualFn::kPosition);
 
     // system's orientation
-    double* orientation = SensorByName(model, data, "orientation");
+    double* orientation = sensors.Data(model, data, ResidualFn::kOrientation);
 
     // position error
     double position_error[3];
@@ -816,4 +923,8 @@ void QuadrupedHill::TransitionLocked(mjModel* model, mjData* data) {
   mju_copy4(data->mocap_quat, model->key_mquat + 4 * residual_.current_mode_);
 }
 
+void QuadrupedHill::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kHillSensorNames);
+}
+
 }  // namespace mjpc
@@ -15,7 +15,9 @@
 #ifndef MJPC_TASKS_QUADRUPED_QUADRUPED_H_
 #define MJPC_TASKS_QUADRUPED_QUADRUPED_H_
 
+#include <memory>
 #include <string>
+#include <vector>
 #include <mujoco/mujoco.h>
 #include "mjpc/task.h"
 
@@ -32,9 +34,26 @@ class QuadrupedFlat : public Task {
     ResidualFn(const ResidualFn&) = default;
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+    void SelectMode() override;
+
+    // the torso has turned over in the quadruped and walk modes
+    bool Terminated(const mjModel* model, const mjData* data) const override;
+
+    // gait step heights and walk and flip targets on the grid
+    std::unique_ptr<mjpc::ResidualFn> PrecomputeTimeGrid(
+        const TimeGrid& grid) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kTorsoSubtreecom = 0,
+      kTorsoSubtreelinvel,
+      kTorsoAngmom,
+      kNumSensor,
+    };
 
    private:
     friend class QuadrupedFlat;
+    friend class BaseResidualFn;  // calls ModeResidual
     //  ============  enums  ============
     // modes
     enum A1Mode {
@@ -140,6 +159,14 @@ class QuadrupedFlat : public Task {
     constexpr static double kMaxHeight = 0.8;         // meter
 
     //  ============  methods  ============
+    // residual of one mode
+    template <int kMode>
+    void ModeResidual(const mjModel* model, const mjData* data,
+                      double* residual) const;
+
+    // ModeResidual of current_mode_
+    ModeResidualFn CurrentModeResidual() const;
+
     // return internal phase clock
     double GetPhase(double time) const;
 
@@ -192,6 +219,13 @@ class QuadrupedFlat : public Task {
     double com_vel_[2]        = {0};
     double gait_switch_time_  = 0;
 
+    // time-only terms on a planning time grid, set by PrecomputeTimeGrid
+    TimeGrid grid_;
+    std::vector<double> grid_step_;         // kNumFoot per time
+    std::vector<double> grid_walk_;         // 2 per time, in Walk
+    std::vector<double> grid_flip_quat_;    // 4 per time, in Flip
+    std::vector<double> grid_flip_height_;  // 1 per time, in Flip
+
     //  ============  constants, computed in Reset()  ============
     int torso_body_id_        = -1;
     int head_site_id_         = -1;
@@ -203,6 +237,7 @@ class QuadrupedFlat : public Task {
     int cadence_param_id_     = -1;
     int amplitude_param_id_   = -1;
     int duty_param_id_        = -1;
+    int heading_param_id_     = -1;
     int upright_cost_id_      = -1;
     int balance_cost_id_      = -1;
     int height_cost_id_       = -1;
@@ -268,6 +303,20 @@ class QuadrupedHill : public Task {
     // -----------------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // the residuals of n samples in one call
+    void ResidualBatch(const mjModel* model, const mjData* const* data,
+                       double* const* residual, int n) const override;
+
+    // sensors read by Residual, resolved in ResetLocked. kFoot + i is the
+    // position of foot i.
+    enum Sensor {
+      kPosition = 0,
+      kOrientation,
+      kFoot,
+      kNumSensor = kFoot + 4,
+    };
+
    private:
     friend class QuadrupedHill;
     int current_mode_;
@@ -276,6 +325,7 @@ class QuadrupedHill : public Task {
   void TransitionLocked(mjModel* model, mjData* data) override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this, residual_.current_mode_);
   }
@@ -14,14 +14,23 @@
 
 #include "mjpc/tasks/swimmer/swimmer.h"
 
+#include <iterator>
 #include <string>
 
-#include <absl/random/random.h>
+#include <absl/random/distributions.h>
 #include <mujoco/mujoco.h>
 #include "mjpc/task.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "target", "nose",
+};
+static_assert(std::size(kSensorNames) == Swimmer::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Swimmer::XmlPath() const {
   return GetModelPath("swimmer/task.xml");
 }
@@ -39,8 +48,8 @@ void Swimmer::ResidualFn::Residual(const mjModel* model, const mjData* data,
 
   // ---------- Residuals (5-6) ----------
   // nose to target XY displacement
-  double* target = SensorByName(model, data, "target");
-  double* nose = SensorByName(model, data, "nose");
+  double* target = sensors_.Data(model, data, kTarget);
+  double* nose = sensors_.Data(model, data, kNose);
   mju_sub(residual + model->nu, nose, target, 2);
 }
 
@@ -49,15 +58,18 @@ void Swimmer::ResidualFn::Residual(const mjModel* model, const mjData* data,
 //   move goal randomly.
 // ---------------------------------------------
 void Swimmer::TransitionLocked(mjModel* model, mjData* data) {
-  double* target = SensorByName(model, data, "target");
-  double* nose = SensorByName(model, data, "nose");
+  double* target = sensors.Data(model, data, ResidualFn::kTarget);
+  double* nose = sensors.Data(model, data, ResidualFn::kNose);
   double nose_to_target[2];
   mju_sub(nose_to_target, target, nose, 2);
   if (mju_norm(nose_to_target, 2) < 0.04) {
-    absl::BitGen gen_;
-    data->mocap_pos[0] = absl::Uniform<double>(gen_, -.8, .8);
-    data->mocap_pos[1] = absl::Uniform<double>(gen_, -.8, .8);
+    data->mocap_pos[0] = absl::Uniform<double>(rng_, -.8, .8);
+    data->mocap_pos[1] = absl::Uniform<double>(rng_, -.8, .8);
   }
 }
 
+void Swimmer::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc
@@ -17,6 +17,7 @@
 
 #include <string>
 #include <mujoco/mujoco.h>
+#include "mjpc/random.h"
 #include "mjpc/task.h"
 
 namespace mjpc {
@@ -35,6 +36,13 @@ class Swimmer : public Task {
 // -------------------------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kTarget = 0,
+      kNose,
+      kNumSensor,
+    };
   };
 
   Swimmer() : residual_(this) {}
@@ -45,6 +53,7 @@ class Swimmer : public Task {
   void TransitionLocked(mjModel* model, mjData* data) override;
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
@@ -52,6 +61,7 @@ class Swimmer : public Task {
 
  private:
   ResidualFn residual_;
+  RandomStream rng_;  // goal sampling
 };
 }  // namespace mjpc
 
@@ -15,6 +15,8 @@
 #include "mjpc/tasks/tasks.h"
 
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "mjpc/task.h"
@@ -38,27 +40,42 @@
 
 namespace mjpc {
 
-std::vector<std::shared_ptr<Task>> GetTasks() {
+namespace {
+template <typename T>
+RegisteredTask Register(std::string name) {
+  return {std::move(name), [] { return std::make_shared<T>(); }};
+}
+}  // namespace
+
+std::vector<RegisteredTask> GetRegisteredTasks() {
   return {
-    std::make_shared<Acrobot>(),
-    std::make_shared<CubeSolve>(),
-    std::make_shared<Cartpole>(),
-    std::make_shared<Fingers>(),
-    std::make_shared<Hand>(),
-    std::make_shared<humanoid::Stand>(),
-    std::make_shared<humanoid::Tracking>(),
-    std::make_shared<humanoid::Walk>(),
-    std::make_shared<manipulation::Bring>(),
+    Register<Acrobot>("Acrobot"),
+    Register<CubeSolve>("Cube Solving"),
+    Register<Cartpole>("Cartpole"),
+    Register<Fingers>("FreeFingers"),
+    Register<Hand>("Hand"),
+    Register<humanoid::Stand>("Humanoid Stand"),
+    Register<humanoid::Tracking>("Humanoid Track"),
+    Register<humanoid::Walk>("Humanoid Walk"),
+    Register<manipulation::Bring>("Panda Robotiq Bring"),
     // DEEPMIND INTERNAL TASKS
-    std::make_shared<OP3>(),
-    std::make_shared<Panda>(),
-    std::make_shared<Particle>(),
-    std::make_shared<ParticleFixed>(),
-    std::make_shared<Quadrotor>(),
-    std::make_shared<QuadrupedFlat>(),
-    std::make_shared<QuadrupedHill>(),
-    std::make_shared<Swimmer>(),
-    std::make_shared<Walker>(),
+    Register<OP3>("OP3"),
+    Register<Panda>("Panda"),
+    Register<Particle>("Particle"),
+    Register<ParticleFixed>("ParticleFixed"),
+    Register<Quadrotor>("Quadrotor"),
+    Register<QuadrupedFlat>("Quadruped Flat"),
+    Register<QuadrupedHill>("Quadruped Hill"),
+    Register<Swimmer>("Swimmer"),
+    Register<Walker>("Walker"),
   };
 }
+
+std::vector<std::shared_ptr<Task>> GetTasks() {
+  std::vector<std::shared_ptr<Task>> tasks;
+  for (const RegisteredTask& task : GetRegisteredTasks()) {
+    tasks.push_back(task.make());
+  }
+  return tasks;
+}
 }  // namespace mjpc
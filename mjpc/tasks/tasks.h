@@ -23,6 +23,10 @@
 #include "mjpc/task.h"
 
 namespace mjpc {
+// all built-in tasks, by name. none are constructed until make is called.
+std::vector<RegisteredTask> GetRegisteredTasks();
+
+// all built-in tasks, constructed
 std::vector<std::shared_ptr<Task>> GetTasks();
 }  // namespace mjpc
 
@@ -14,6 +14,7 @@
 
 #include "mjpc/tasks/walker/walker.h"
 
+#include <iterator>
 #include <string>
 
 #include <mujoco/mujoco.h>
@@ -21,6 +22,14 @@
 #include "mjpc/utilities.h"
 
 namespace mjpc {
+namespace {
+// names of ResidualFn::Sensor
+constexpr const char* kSensorNames[] = {
+    "torso_position", "torso_zaxis", "torso_subtreelinvel",
+};
+static_assert(std::size(kSensorNames) == Walker::ResidualFn::kNumSensor);
+}  // namespace
+
 std::string Walker::XmlPath() const {
   return GetModelPath("walker/task.xml");
 }
@@ -43,22 +52,22 @@ void Walker::ResidualFn::Residual(const mjModel* model, const mjData* data,
   counter += model->nu;
 
   // ---------- Residual (1) -----------
-  double height = SensorByName(model, data, "torso_position")[2];
+  double height = sensors_.Data(model, data, kTorsoPosition)[2];
   residual[counter++] = height - parameters_[0];
 
   // ---------- Residual (2) ----------
-  double torso_up = SensorByName(model, data, "torso_zaxis")[2];
+  double torso_up = sensors_.Data(model, data, kTorsoZaxis)[2];
   residual[counter++] = torso_up - 1.0;
 
   // ---------- Residual (3) ----------
-  double com_vel = SensorByName(model, data, "torso_subtreelinvel")[0];
+  double com_vel = sensors_.Data(model, data, kTorsoSubtreelinvel)[0];
   residual[counter++] = com_vel - parameters_[1];
 
   // sensor dim sanity check
   // TODO: use this pattern everywhere and make this a utility function
   int user_sensor_dim = 0;
   for (int i=0; i < model->nsensor; i++) {
-    if (model->sensor_type[i] == mjSENS_USER) {
+    if (model->sensor_type[i] == mjSENS_USER && !SkippedSensor(model, i)) {
       user_sensor_dim += model->sensor_dim[i];
     }
   }
@@ -67,4 +76,8 @@ void Walker::ResidualFn::Residual(const mjModel* model, const mjData* data,
                 "and actual length of residual %d", counter);
   }
 }
+void Walker::ResetLocked(const mjModel* model) {
+  sensors.Resolve(model, kSensorNames);
+}
+
 }  // namespace mjpc
@@ -40,10 +40,19 @@ class Walker : public Task {
 // --------------------------------------------
     void Residual(const mjModel* model, const mjData* data,
                   double* residual) const override;
+
+    // sensors read by Residual, resolved in ResetLocked
+    enum Sensor {
+      kTorsoPosition = 0,
+      kTorsoZaxis,
+      kTorsoSubtreelinvel,
+      kNumSensor,
+    };
   };
   Walker() : residual_(this) {}
 
  protected:
+  void ResetLocked(const mjModel* model) override;
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
     return std::make_unique<ResidualFn>(this);
   }
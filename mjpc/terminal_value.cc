@@ -0,0 +1,124 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/terminal_value.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+
+void TerminalValueFn::Values(double* values, const double* states,
+                             int dim_state, int n) const {
+  for (int i = 0; i < n; i++) {
+    values[i] = Value(states + i * dim_state);
+  }
+}
+
+QuadraticTerminalValue::QuadraticTerminalValue(std::vector<double> center,
+                                               std::vector<double> hessian,
+                                               double offset)
+    : center_(std::move(center)),
+      hessian_(std::move(hessian)),
+      offset_(offset) {
+  if (hessian_.size() != center_.size() * center_.size()) {
+    mju_error("QuadraticTerminalValue: hessian must be dim x dim");
+  }
+}
+
+double QuadraticTerminalValue::Value(const double* state) const {
+  int dim = center_.size();
+  double value = 0.0;
+  for (int i = 0; i < dim; i++) {
+    double di = state[i] - center_[i];
+    for (int j = 0; j < dim; j++) {
+      value += di * hessian_[i * dim + j] * (state[j] - center_[j]);
+    }
+  }
+  return 0.5 * value + offset_;
+}
+
+GridTerminalValue::GridTerminalValue(std::vector<int> coordinates,
+                                     std::vector<double> lower,
+                                     std::vector<double> upper,
+                                     std::vector<int> points,
+                                     std::vector<double> values)
+    : coordinates_(std::move(coordinates)),
+      lower_(std::move(lower)),
+      upper_(std::move(upper)),
+      points_(std::move(points)),
+      values_(std::move(values)) {
+  std::size_t dim = coordinates_.size();
+  if (dim > kMaxGridDim) {
+    mju_error("GridTerminalValue: at most %d coordinates", kMaxGridDim);
+  }
+  if (lower_.size() != dim || upper_.size() != dim || points_.size() != dim) {
+    mju_error("GridTerminalValue: one bound and size per coordinate");
+  }
+
+  // strides, last coordinate fastest
+  strides_.resize(dim);
+  std::size_t size = 1;
+  for (int i = static_cast<int>(dim) - 1; i >= 0; i--) {
+    if (points_[i] < 2 || upper_[i] <= lower_[i]) {
+      mju_error("GridTerminalValue: empty grid coordinate %d", i);
+    }
+    strides_[i] = size;
+    size *= points_[i];
+  }
+  if (values_.size() != size) {
+    mju_error("GridTerminalValue: %d values required",
+              static_cast<int>(size));
+  }
+}
+
+double GridTerminalValue::Value(const double* state) const {
+  int dim = coordinates_.size();
+
+  // cell and position within the cell of each coordinate
+  int base = 0;
+  double fraction[kMaxGridDim];
+  for (int i = 0; i < dim; i++) {
+    double cells = points_[i] - 1;
+    double x = (state[coordinates_[i]] - lower_[i]) / (upper_[i] - lower_[i]);
+    x = std::clamp(x, 0.0, 1.0) * cells;
+    int cell = std::min(static_cast<int>(std::floor(x)), points_[i] - 2);
+    fraction[i] = x - cell;
+    base += cell * strides_[i];
+  }
+
+  // weighted sum over the cell's corners
+  double value = 0.0;
+  for (int corner = 0; corner < (1 << dim); corner++) {
+    double weight = 1.0;
+    int index = base;
+    for (int i = 0; i < dim; i++) {
+      if (corner & (1 << i)) {
+        weight *= fraction[i];
+        index += strides_[i];
+      } else {
+        weight *= 1.0 - fraction[i];
+      }
+    }
+    if (weight > 0.0) value += weight * values_[index];
+  }
+  return value;
+}
+
+}  // namespace mjpc
@@ -0,0 +1,89 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Terminal values: approximations of the cost accrued after the planning
+// horizon, as a function of the final rollout state. A task with a terminal
+// value can plan over shorter horizons, since the value accounts for the
+// remainder of the motion.
+
+#ifndef MJPC_TERMINAL_VALUE_H_
+#define MJPC_TERMINAL_VALUE_H_
+
+#include <vector>
+
+namespace mjpc {
+
+// abstract terminal value of a state (qpos, qvel, act). values are in units
+// of the summed stage costs of the rollout, i.e., a value v counts as v / T
+// in the return of a T-step rollout. values must be nonnegative, like stage
+// costs, so that rollouts can be pruned against a bound.
+class TerminalValueFn {
+ public:
+  virtual ~TerminalValueFn() = default;
+
+  // value of state
+  virtual double Value(const double* state) const = 0;
+
+  // values of n states with stride dim_state, values[i] for state i. the
+  // default calls Value for each state; approximators that evaluate faster
+  // in batch (e.g., neural networks) can override this.
+  virtual void Values(double* values, const double* states, int dim_state,
+                      int n) const;
+};
+
+// 0.5 * (x - center)' * hessian * (x - center) + offset, on the first
+// center.size() coordinates of the state. quaternions are compared as plain
+// coordinates.
+class QuadraticTerminalValue : public TerminalValueFn {
+ public:
+  // hessian is (dim x dim), row-major, with dim = center.size()
+  QuadraticTerminalValue(std::vector<double> center,
+                         std::vector<double> hessian, double offset = 0.0);
+
+  double Value(const double* state) const override;
+
+ private:
+  std::vector<double> center_;
+  std::vector<double> hessian_;
+  double offset_;
+};
+
+// multilinear interpolation of values cached on a regular grid over some
+// state coordinates. states outside the grid are clamped to its bounds.
+class GridTerminalValue : public TerminalValueFn {
+ public:
+  // interpolation reads 2^dim values
+  static constexpr int kMaxGridDim = 16;
+
+  // grid over state[coordinates[i]] in [lower[i], upper[i]] with points[i]
+  // points (at least 2). values are row-major with the last coordinate
+  // varying fastest, prod(points) in total.
+  GridTerminalValue(std::vector<int> coordinates, std::vector<double> lower,
+                    std::vector<double> upper, std::vector<int> points,
+                    std::vector<double> values);
+
+  double Value(const double* state) const override;
+
+ private:
+  std::vector<int> coordinates_;
+  std::vector<double> lower_;
+  std::vector<double> upper_;
+  std::vector<int> points_;
+  std::vector<int> strides_;  // values stride of each coordinate
+  std::vector<double> values_;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_TERMINAL_VALUE_H_
@@ -16,17 +16,26 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include <absl/strings/str_cat.h>
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
 #include "mjpc/planners/ilqs/planner.h"
 #include "mjpc/planners/sampling/planner.h"
 #include "mjpc/task.h"
+#include "mjpc/test/allocation_counter.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/testdata/particle_residual.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace {
@@ -86,6 +95,24 @@ class AgentTest : public ::testing::Test {
     // test
     EXPECT_FALSE(agent->allocate_enabled);
 
+    // rollouts compute only the residual and trace sensors. sensordata
+    // addresses and the model itself are unchanged.
+    const mjModel* planning_model = agent->GetModel();
+    EXPECT_EQ(planning_model->sensor_type[2], mjSENS_FRAMEPOS);  // trace0
+    for (int i = 3; i < model->nsensor; i++) {
+      EXPECT_EQ(planning_model->sensor_type[i], mjSENS_USER);
+      EXPECT_NE(model->sensor_type[i], mjSENS_USER);
+      EXPECT_EQ(planning_model->sensor_adr[i], model->sensor_adr[i]);
+    }
+
+    // planners share the mjData of the pool's first lane
+    mjData* shared_data = agent->planners_[0]->data_[0];
+    for (const auto& planner : agent->planners_) {
+      if (planner && !planner->data_.empty()) {
+        EXPECT_EQ(planner->data_[0], shared_data);
+      }
+    }
+
     // delete data
     mj_deleteData(data);
 
@@ -93,6 +120,39 @@ class AgentTest : public ::testing::Test {
     mj_deleteModel(model);
   }
 
+  void TestResetStrippedTask() {
+    // with traces off, the planning model's trace0 next to the cost terms is
+    // stripped too
+    SetTracesEnabled(false);
+    model = LoadTestModel("particle_task.xml");
+    agent->Initialize(model);
+    const mjModel* planning_model = agent->GetModel();
+    EXPECT_TRUE(SkippedSensor(planning_model, 2));
+    EXPECT_FALSE(SkippedSensor(model, 2));
+
+    // task reset from the GUI or SetCostWeights keeps the cost terms
+    Task* task = agent->ActiveTask();
+    int num_term = task->num_term;
+    int num_residual = task->num_residual;
+    double weight = task->weight[0];
+    task->weight[0] = 0.0;
+    agent->ResetTask();
+    EXPECT_EQ(task->num_term, num_term);
+    EXPECT_EQ(task->num_residual, num_residual);
+    EXPECT_EQ(task->weight[0], weight);
+
+    // as does a reset from the planning model
+    task->Reset(planning_model);
+    EXPECT_EQ(task->num_term, num_term);
+    EXPECT_EQ(task->num_residual, num_residual);
+
+    // residual dimension checks skip stripped sensors
+    CheckSensorDim(planning_model, num_residual);
+
+    SetTracesEnabled(true);
+    mj_deleteModel(model);
+  }
+
   void TestPlan() {
     // load model
     model = LoadTestModel("particle_task.xml");
@@ -397,14 +457,415 @@ class AgentTest : public ::testing::Test {
     mj_deleteData(data);
     mj_deleteModel(model);
   }
+
+  void TestLoadOnDemand() {
+    model = LoadTestModel("particle_task.xml");
+    mjData* data = mj_makeData(model);
+    mjcb_sensor = &SensorCallback;
+
+    ThreadPool plan_pool(2);
+
+    // ----- initialize agent ----- //
+    agent->load_on_demand = true;
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->SetState(data);
+
+    // only the selected planner is loaded
+    EXPECT_EQ(agent->active_planner_, 0);
+    for (int i = 0; i < agent->planners_.size(); i++) {
+      EXPECT_EQ(agent->planners_[i] != nullptr, i == 0);
+    }
+    for (int i = 0; i < agent->estimators_.size(); i++) {
+      EXPECT_EQ(agent->estimators_[i] != nullptr, i == 0);
+    }
+
+    // ----- switch to iLQG planner ----- //
+    agent->planner_ = 2;
+    EXPECT_EQ(&agent->ActivePlanner(), agent->planners_[0].get());
+    agent->SwitchPlanner();
+    EXPECT_EQ(&agent->ActivePlanner(), agent->planners_[2].get());
+    EXPECT_EQ(agent->planners_[0], nullptr);
+    EXPECT_EQ(agent->retired_planners_.size(), 1);
+
+    // previous planner is released by the next iteration
+    agent->plan_enabled = true;
+    agent->PlanIteration(&plan_pool);
+    EXPECT_TRUE(agent->retired_planners_.empty());
+
+    // ----- switch twice between iterations ----- //
+    // an iteration in flight keeps using the planner it started with
+    Planner* in_flight = &agent->ActivePlanner();
+    agent->planner_ = 0;
+    agent->SwitchPlanner();
+    agent->planner_ = 3;
+    agent->SwitchPlanner();
+    EXPECT_EQ(&agent->ActivePlanner(), agent->planners_[3].get());
+    ASSERT_EQ(agent->retired_planners_.size(), 2);
+    EXPECT_EQ(agent->retired_planners_[0].get(), in_flight);
+    EXPECT_NE(in_flight->BestTrajectory(), nullptr);
+
+    // both are released by the next iteration, which plans with the last
+    agent->PlanIteration(&plan_pool);
+    EXPECT_TRUE(agent->retired_planners_.empty());
+    EXPECT_EQ(agent->planners_[0], nullptr);
+    EXPECT_EQ(agent->planners_[2], nullptr);
+
+    // ----- estimators, released by the next update ----- //
+    agent->estimator_ = 1;
+    agent->SwitchEstimator();
+    agent->estimator_ = 2;
+    agent->SwitchEstimator();
+    EXPECT_EQ(agent->retired_estimators_.size(), 2);
+    EXPECT_EQ(&agent->BeginEstimatorUpdate(), agent->estimators_[2].get());
+    EXPECT_TRUE(agent->retired_estimators_.empty());
+
+    mj_deleteData(data);
+    mj_deleteModel(model);
+  }
+
+  void TestPortfolio() {
+    model = LoadTestModel("particle_task.xml");
+    mjData* data = mj_makeData(model);
+    mjcb_sensor = &SensorCallback;
+
+    ThreadPool plan_pool(8);
+
+    // ----- initialize agent ----- //
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+
+    // sampling and iLQG, warm started from the winner
+    agent->portfolio_ = {0, 2};
+    agent->portfolio_winner_ = 0;
+    agent->portfolio_warm_start_ = 1;
+
+    data->mocap_pos[0] = 1;
+    data->mocap_pos[1] = 1;
+    agent->SetState(data);
+    for (int i = 0; i < 5; i++) {
+      agent->PlanIteration(&plan_pool);
+
+      // the active planner has the lowest total return
+      int winner = agent->portfolio_winner_.load();
+      EXPECT_TRUE(winner == 0 || winner == 2);
+      EXPECT_EQ(&agent->ActivePlanner(), agent->planners_[winner].get());
+      double best_return =
+          agent->ActivePlanner().BestTrajectory()->total_return;
+      for (int index : agent->portfolio_) {
+        EXPECT_LE(best_return,
+                  agent->planners_[index]->BestTrajectory()->total_return);
+      }
+    }
+
+    // portfolio planners run at the same time, on their own lanes
+    EXPECT_NE(agent->planners_[0]->data_[0], agent->planners_[2]->data_[0]);
+
+    mj_deleteData(data);
+    mj_deleteModel(model);
+  }
+
+  void TestLazyTasks() {
+    // only selected tasks are constructed
+    std::vector<int> made(3, 0);
+    std::vector<RegisteredTask> tasks;
+    for (int i = 0; i < 3; i++) {
+      tasks.push_back({absl::StrCat("Task", i), [&made, i] {
+                         made[i]++;
+                         return std::make_shared<ParticleTestTask>();
+                       }});
+    }
+    agent->SetTaskList(std::move(tasks));
+    EXPECT_EQ(agent->GetTaskNames(), "Task0\nTask1\nTask2\n");
+    EXPECT_EQ(agent->GetTaskIdByName("task2"), 2);
+    EXPECT_EQ(made, std::vector<int>({1, 0, 0}));
+
+    agent->SetTaskByIndex(2);
+    Task* task = agent->ActiveTask();
+    agent->SetTaskByIndex(2);
+    EXPECT_EQ(agent->ActiveTask(), task);
+    EXPECT_EQ(made, std::vector<int>({1, 0, 1}));
+  }
+
+  void TestLatencyCompensation() {
+    model = LoadTestModel("particle_task.xml");
+    mjData* data = mj_makeData(model);
+    mjcb_sensor = &SensorCallback;
+
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+    agent->SetLatencyCompensation(true);
+    ThreadPool plan_pool(2);
+
+    data->mocap_pos[0] = 1;
+    data->mocap_pos[1] = 1;
+    agent->SetState(data);
+
+    // no policy to predict with before the first iteration
+    agent->PlanIteration(&plan_pool);
+    EXPECT_FALSE(agent->has_prediction_);
+    EXPECT_GT(agent->LatencyEstimate(), 0.0);
+
+    // plan from the state three time steps ahead
+    agent->latency_estimate_ = 3 * agent->timestep_;
+    agent->PlanIteration(&plan_pool);
+    EXPECT_TRUE(agent->has_prediction_);
+    EXPECT_NEAR(agent->ActivePlanner().BestTrajectory()->times[0],
+                data->time + 3 * agent->timestep_, 1.0e-8);
+    EXPECT_NEAR(agent->predicted_state_.time(),
+                data->time + 3 * agent->timestep_, 1.0e-8);
+
+    // the state didn't advance: the prediction is ahead of it
+    agent->latency_estimate_ = 3 * agent->timestep_;
+    agent->PlanIteration(&plan_pool);
+    EXPECT_NEAR(agent->PredictionTimeError(), -3 * agent->timestep_, 1.0e-8);
+    EXPECT_GE(agent->PredictionError(), 0.0);
+
+    // disabled, plan from the state
+    agent->SetLatencyCompensation(false);
+    agent->PlanIteration(&plan_pool);
+    EXPECT_FALSE(agent->has_prediction_);
+    EXPECT_NEAR(agent->ActivePlanner().BestTrajectory()->times[0], data->time,
+                1.0e-8);
+
+    mj_deleteData(data);
+    mj_deleteModel(model);
+  }
+
+  void TestPlanTrigger() {
+    model = LoadTestModel("particle_task.xml");
+    mjData* data = mj_makeData(model);
+    mjcb_sensor = &SensorCallback;
+
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+    agent->SetPlanTrigger(PlanTrigger::kNewState);
+    agent->SetPlanStateTolerance(1.0e-6);
+    ThreadPool plan_pool(2);
+
+    std::atomic<bool> exitrequest = false;
+    std::atomic<int> uiloadrequest = 0;
+    std::thread plan_thread(
+        [&] { agent->Plan(exitrequest, uiloadrequest, &plan_pool); });
+
+    // publish the state until done
+    auto publish_until = [&](auto done) {
+      auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (!done() && std::chrono::steady_clock::now() < deadline) {
+        agent->SetState(data);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      return done();
+    };
+
+    // a new state is planned
+    EXPECT_TRUE(publish_until([] { return agent->count_.load() > 0; }));
+    int count = agent->count_.load();
+
+    // the same state again isn't
+    std::uint64_t skipped = agent->SkippedIterations();
+    EXPECT_TRUE(
+        publish_until([&] { return agent->SkippedIterations() > skipped; }));
+    EXPECT_EQ(agent->count_.load(), count);
+
+    // a changed state is
+    data->mocap_pos[0] = 1;
+    EXPECT_TRUE(publish_until([&] { return agent->count_.load() > count; }));
+
+    exitrequest = true;
+    plan_thread.join();
+
+    mj_deleteData(data);
+    mj_deleteModel(model);
+  }
+
+  void TestSnapshot() {
+    model = LoadTestModel("particle_task.xml");
+    mjData* data = mj_makeData(model);
+    mjcb_sensor = &SensorCallback;
+
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+    ThreadPool plan_pool(2);
+
+    // sampling and iLQG policies
+    data->mocap_pos[0] = 1;
+    data->mocap_pos[1] = 1;
+    agent->SetState(data);
+    for (int planner : {0, 2}) {
+      agent->planner_ = planner;
+      for (int i = 0; i < 5; i++) agent->PlanIteration(&plan_pool);
+    }
+    std::string snapshot = agent->Snapshot();
+
+    // a second agent continues from the policies
+    Agent standby;
+    std::vector<std::shared_ptr<Task>> tasks;
+    tasks.push_back(std::make_unique<ParticleTestTask>());
+    standby.SetTaskList(std::move(tasks));
+    standby.Initialize(model);
+    standby.Allocate();
+    standby.Reset();
+    EXPECT_TRUE(standby.Restore(snapshot));
+
+    const double* state = agent->state.state().data();
+    double time = agent->state.time() + 0.05;
+    for (int planner : {0, 2}) {
+      std::vector<double> action(model->nu), restored(model->nu);
+      agent->planners_[planner]->ActionFromPolicy(action.data(), state, time);
+      standby.planners_[planner]->ActionFromPolicy(restored.data(), state,
+                                                   time);
+      for (int i = 0; i < model->nu; i++) {
+        EXPECT_NEAR(restored[i], action[i], 1.0e-12);
+      }
+    }
+
+    // not a snapshot
+    EXPECT_FALSE(standby.Restore("snapshot"));
+
+    mj_deleteData(data);
+    mj_deleteModel(model);
+  }
+
+  void TestSteadyStateAllocations() {
+    model = LoadTestModel("particle_task.xml");
+    mjcb_sensor = &SensorCallback;
+
+    // sampling planner
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+    ThreadPool plan_pool(2);
+
+    // planning and action iterations
+    std::vector<double> action(model->nu);
+    auto iteration = [&]() {
+      agent->PlanIteration(&plan_pool);
+      agent->ActivePlanner().ActionFromPolicy(
+          action.data(), agent->state.state().data(), agent->state.time());
+    };
+
+    // warm up policies, trajectories, mjData and the pool
+    for (int k = 0; k < 20; k++) iteration();
+
+    // steady state
+    std::int64_t allocations;
+    {
+      AllocationCounter counter;
+      for (int k = 0; k < 10; k++) iteration();
+      allocations = counter.count();
+    }
+    EXPECT_EQ(allocations, 0);
+
+    mj_deleteModel(model);
+  }
+
+  void TestCompatibleReload() {
+    model = LoadTestModel("particle_task.xml");
+    mjcb_sensor = &SensorCallback;
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    EXPECT_FALSE(agent->CompatibleReload());
+
+    // a reload with other options has the same sizes
+    mjModel* reloaded = mj_copyModel(nullptr, model);
+    reloaded->opt.timestep *= 2.0;
+    agent->Initialize(reloaded);
+    agent->Allocate();
+    agent->Reset();
+    EXPECT_TRUE(agent->CompatibleReload());
+
+    // and plans
+    agent->plan_enabled = true;
+    ThreadPool plan_pool(2);
+    for (int k = 0; k < 3; k++) agent->PlanIteration(&plan_pool);
+    EXPECT_LT(agent->ActivePlanner().BestTrajectory()->total_return,
+              std::numeric_limits<double>::infinity());
+
+    mj_deleteModel(reloaded);
+    mj_deleteModel(model);
+  }
+
+  void TestMemoryReport() {
+    model = LoadTestModel("particle_task.xml");
+    mjcb_sensor = &SensorCallback;
+    agent->Initialize(model);
+    agent->Allocate();
+    agent->Reset();
+    agent->plan_enabled = true;
+    ThreadPool plan_pool(2);
+    agent->PlanIteration(&plan_pool);
+
+    // the planners' data and buffers are counted
+    MemoryReport report = agent->ReportMemory();
+    std::size_t data_pool = 0, planners = 0;
+    for (const MemoryReport::Entry& entry : report.Entries()) {
+      if (entry.name == "data_pool") data_pool = entry.bytes;
+      if (entry.name.starts_with("planner/")) planners += entry.bytes;
+    }
+    EXPECT_GT(data_pool, 0);
+    EXPECT_GT(planners, 0);
+    EXPECT_GE(report.Total(), data_pool + planners);
+
+    mj_deleteModel(model);
+  }
 };
 
+// test that the data of a model is kept for models with the same sizes
+TEST(MjDataPoolTest, SameSizes) {
+  mjModel* base = LoadTestModel("particle_task.xml");
+  MjDataPool pool;
+  std::vector<mjData*> data;
+  pool.Borrow(base, 0, 2, &data);
+  std::vector<mjData*> borrowed = data;
+  data[0]->qpos[0] = 1.0;
+
+  // the data is reset for the copy
+  mjModel* copy = mj_copyModel(nullptr, base);
+  pool.Borrow(copy, 0, 2, &data);
+  EXPECT_EQ(data, borrowed);
+  EXPECT_EQ(data[0]->qpos[0], copy->qpos0[0]);
+  EXPECT_EQ(pool.Size(), 2);
+
+  // and dropped for a model with other sizes
+  mjModel* other = LoadTestModel("cartpole.xml");
+  pool.Borrow(other, 0, 1, &data);
+  EXPECT_EQ(pool.Size(), 1);
+
+  mj_deleteModel(other);
+  mj_deleteModel(copy);
+  mj_deleteModel(base);
+}
+
 TEST_F(AgentTest, Initialization) { TestInitialization(); }
 
+TEST_F(AgentTest, ResetStrippedTask) { TestResetStrippedTask(); }
+
 TEST_F(AgentTest, Plan) { TestPlan(); }
 
 TEST_F(AgentTest, PreviousSamplingPolicy) { TestPreviousSamplingPolicy(); }
 TEST_F(AgentTest, PreviousILQGPolicy) { TestPreviousILQGPolicy(); }
 TEST_F(AgentTest, PreviousILQSPolicy) { TestPreviousILQSPolicy(); }
+TEST_F(AgentTest, LoadOnDemand) { TestLoadOnDemand(); }
+TEST_F(AgentTest, Portfolio) { TestPortfolio(); }
+TEST_F(AgentTest, LazyTasks) { TestLazyTasks(); }
+TEST_F(AgentTest, LatencyCompensation) { TestLatencyCompensation(); }
+TEST_F(AgentTest, PlanTrigger) { TestPlanTrigger(); }
+TEST_F(AgentTest, Snapshot) { TestSnapshot(); }
+TEST_F(AgentTest, SteadyStateAllocations) { TestSteadyStateAllocations(); }
+TEST_F(AgentTest, CompatibleReload) { TestCompatibleReload(); }
+TEST_F(AgentTest, MemoryReport) { TestMemoryReport(); }
 
 }  // namespace mjpc
@@ -0,0 +1,92 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/autotune.h"
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// iteration with rollout steps of constant cost on threads
+struct Planner {
+  double step_time;
+  int threads;
+  double ComputeTime(int rollouts, int steps) const {
+    return rollouts * steps * step_time / threads;
+  }
+};
+
+// test that rollouts converge to those fitting the period
+TEST(PlanningAutotunerTest, Rollouts) {
+  Planner planner = {1.0e-5, 4};
+  PlanningAutotuner autotuner;
+  autotuner.SetOptions({.period = 0.01});
+  int rollouts = 10, steps = 50;
+  int previous = rollouts;
+  for (int i = 0; i < 10; i++) {
+    const AutotuneDecision& decision = autotuner.Update(
+        planner.ComputeTime(rollouts, steps), rollouts * steps,
+        planner.threads, rollouts, steps);
+    // at most doubled per iteration
+    EXPECT_LE(decision.rollouts, 2 * previous);
+    EXPECT_EQ(decision.steps, steps);
+    previous = rollouts = decision.rollouts;
+  }
+  EXPECT_EQ(rollouts, 80);
+  EXPECT_NEAR(autotuner.decision().step_time, planner.step_time, 1.0e-12);
+
+  // slower host, fewer rollouts
+  planner.step_time *= 2;
+  for (int i = 0; i < 50; i++) {
+    rollouts = autotuner
+                   .Update(planner.ComputeTime(rollouts, steps),
+                           rollouts * steps, planner.threads, rollouts, steps)
+                   .rollouts;
+  }
+  EXPECT_NEAR(rollouts, 40, 1);
+}
+
+// test that the horizon shortens once the fewest rollouts don't fit
+TEST(PlanningAutotunerTest, Horizon) {
+  Planner planner = {1.0e-4, 1};
+  PlanningAutotuner autotuner;
+  autotuner.SetOptions({.period = 0.03, .min_rollouts = 8, .min_horizon = 0.5});
+  int rollouts = 8, steps = 50;
+  AutotuneDecision decision = autotuner.Update(
+      planner.ComputeTime(rollouts, steps), rollouts * steps, planner.threads,
+      rollouts, steps);
+  EXPECT_EQ(decision.rollouts, 8);
+  EXPECT_EQ(decision.steps, 37);
+
+  // no shorter than min_horizon
+  autotuner.SetOptions({.period = 0.01, .min_rollouts = 8, .min_horizon = 0.5});
+  decision = autotuner.Update(planner.ComputeTime(rollouts, decision.steps),
+                              rollouts * decision.steps, planner.threads,
+                              rollouts, steps);
+  EXPECT_EQ(decision.steps, 25);
+}
+
+// test that a disabled autotuner keeps the settings
+TEST(PlanningAutotunerTest, Disabled) {
+  PlanningAutotuner autotuner;
+  EXPECT_FALSE(autotuner.Enabled());
+  const AutotuneDecision& decision = autotuner.Update(1.0, 100, 2, 10, 20);
+  EXPECT_EQ(decision.rollouts, 10);
+  EXPECT_EQ(decision.steps, 20);
+  EXPECT_EQ(decision.step_time, 0.0);
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -12,11 +12,97 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "mjpc/planners/cost_derivatives.h"
+
+#include <vector>
+
 #include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/norm.h"
+#include "mjpc/threadpool.h"
 
 namespace mjpc {
 namespace {
 
+// test derivatives over sparse residual Jacobians match dense derivatives
+TEST(CostDerivativesTest, Sparse) {
+  // dimensions
+  const int nx = 4;
+  const int nu = 2;
+  const int nr = 3;
+  const int T = 2;
+  const int dim_max = 4;
+
+  // terms: quadratic on (x1, x3), smooth l2 on everything
+  int num_term = 2;
+  int dim_norm_residual[2] = {2, 1};
+  int num_norm_parameter[2] = {0, 1};
+  NormType norms[2] = {NormType::kQuadratic, NormType::kL2};
+  double weights[2] = {1.3, 0.7};
+  double parameters[1] = {0.1};
+
+  // residuals and Jacobians
+  double r[nr * T] = {0.2, -0.1, 0.4, -0.3, 0.5, 0.1};
+  double rx[nr * nx * T] = {0.0, 1.0, 0.0, 0.5,    // term 0
+                            0.0, -0.3, 0.0, 2.0,   //
+                            0.1, 0.2, -0.4, 0.3,   // term 1
+                            0.0, 0.7, 0.0, -1.0,   // term 0
+                            0.0, 0.2, 0.0, 0.0,    //
+                            -0.2, 0.6, 0.1, 0.5};  // term 1
+  double ru[nr * nu * T] = {0.0, 0.0, 0.0, 0.0, 0.3, -0.2,
+                            0.0, 0.0, 0.0, 0.0, 0.1, 0.4};
+
+  // cost derivatives
+  ThreadPool pool(1);
+  CostDerivatives cd;
+  cd.Allocate(nx, nu, nr, T, dim_max);
+  cd.Compute(r, rx, ru, nx, nu, dim_max, nr, nr, dim_norm_residual, num_term,
+             weights, norms, parameters, num_norm_parameter, 0.0, T, pool);
+
+  // dense reference
+  CostDerivatives ref;
+  ref.Allocate(nx, nu, nr, T, dim_max);
+  ref.Reset(nx, nu, nr, T);
+  std::vector<double> cr(nr), crr(nr * nr), c_scratch(dim_max * dim_max);
+  std::vector<double> cx_scratch(nx), cu_scratch(nu);
+  std::vector<double> cxx_scratch(nx * nx), cuu_scratch(nu * nu),
+      cxu_scratch(nx * nu);
+  for (int t = 0; t < T; t++) {
+    int f_shift = 0;
+    int p_shift = 0;
+    for (int i = 0; i < num_term; i++) {
+      ref.DerivativeStep(
+          ref.cx.data() + t * nx, ref.cu.data() + t * nu,
+          ref.cxx.data() + t * nx * nx, ref.cuu.data() + t * nu * nu,
+          ref.cxu.data() + t * nx * nu, cr.data(), crr.data(),
+          c_scratch.data(), cx_scratch.data(), cu_scratch.data(),
+          cxx_scratch.data(), cuu_scratch.data(), cxu_scratch.data(),
+          r + t * nr + f_shift, rx + t * nr * nx + f_shift * nx,
+          ru + t * nr * nu + f_shift * nu, dim_norm_residual[i], nx, nu,
+          weights[i] / T, parameters + p_shift, norms[i]);
+      f_shift += dim_norm_residual[i];
+      p_shift += num_norm_parameter[i];
+    }
+  }
+
+  // test
+  for (int i = 0; i < T * nx; i++) {
+    EXPECT_NEAR(cd.cx[i], ref.cx[i], 1.0e-12);
+  }
+  for (int i = 0; i < T * nu; i++) {
+    EXPECT_NEAR(cd.cu[i], ref.cu[i], 1.0e-12);
+  }
+  for (int i = 0; i < T * nx * nx; i++) {
+    EXPECT_NEAR(cd.cxx[i], ref.cxx[i], 1.0e-12);
+  }
+  for (int i = 0; i < T * nx * nu; i++) {
+    EXPECT_NEAR(cd.cxu[i], ref.cxu[i], 1.0e-12);
+  }
+  for (int i = 0; i < T * nu * nu; i++) {
+    EXPECT_NEAR(cd.cuu[i], ref.cuu[i], 1.0e-12);
+  }
+}
+
 // void R(double* r, const double* x, const double* u) {
 //   r[0] = 0.1 * x[0];
 //   r[1] = 0.2 * x[1];
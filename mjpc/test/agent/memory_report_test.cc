@@ -0,0 +1,68 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/memory_report.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// test that entries of the same name are merged and nested reports prefixed
+TEST(MemoryReportTest, Entries) {
+  MemoryReport report;
+  report.Add("a", 16);
+  report.Add("b", 8);
+  report.Add("a", 4);
+  ASSERT_EQ(report.Entries().size(), 2);
+  EXPECT_EQ(report.Entries()[0].name, "a");
+  EXPECT_EQ(report.Entries()[0].bytes, 20);
+  EXPECT_EQ(report.Total(), 28);
+
+  MemoryReport owner;
+  owner.Add("planner", report);
+  ASSERT_EQ(owner.Entries().size(), 2);
+  EXPECT_EQ(owner.Entries()[1].name, "planner/b");
+  EXPECT_EQ(owner.Total(), report.Total());
+}
+
+// test that vectors count their capacity
+TEST(MemoryReportTest, VectorBytes) {
+  std::vector<double> x(3);
+  std::vector<int> y;
+  y.reserve(5);
+  EXPECT_EQ(VectorBytes(x, y),
+            x.capacity() * sizeof(double) + y.capacity() * sizeof(int));
+  EXPECT_EQ(VectorBytes(), 0);
+
+  MemoryReport report;
+  report.Add("x", x);
+  EXPECT_EQ(report.Total(), x.capacity() * sizeof(double));
+}
+
+// test that the largest entry is printed first, then the total
+TEST(MemoryReportTest, ToString) {
+  MemoryReport report;
+  report.Add("small", 1);
+  report.Add("large", 100);
+  std::string text = report.ToString();
+  EXPECT_LT(text.find("large"), text.find("small"));
+  EXPECT_LT(text.find("small"), text.find("total"));
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -0,0 +1,59 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/metrics.h"
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// test that latencies are counted in their buckets
+TEST(LatencyHistogramTest, Buckets) {
+  LatencyHistogram histogram;
+  histogram.Record(0.5 * LatencyHistogram::kSmallestBound);
+  histogram.Record(LatencyHistogram::kSmallestBound);
+  histogram.Record(1.5 * LatencyHistogram::kSmallestBound);
+  histogram.Record(1.0e3);
+
+  LatencyHistogram::Snapshot snapshot = histogram.Read();
+  ASSERT_EQ(snapshot.upper_bounds.size(), LatencyHistogram::kNumBounds);
+  ASSERT_EQ(snapshot.counts.size(), LatencyHistogram::kNumBuckets);
+  EXPECT_EQ(snapshot.counts[0], 2);
+  EXPECT_EQ(snapshot.counts[1], 1);
+  EXPECT_EQ(snapshot.counts.back(), 1);
+  EXPECT_EQ(snapshot.count, 4);
+  EXPECT_NEAR(snapshot.sum, 1.0e3 + 3.0 * LatencyHistogram::kSmallestBound,
+              1.0e-9);
+
+  histogram.Reset();
+  EXPECT_EQ(histogram.Read().count, 0);
+}
+
+// test quantiles interpolated within buckets
+TEST(LatencyHistogramTest, Quantile) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Read().Quantile(0.5), 0.0);
+
+  // 1 ms latencies fall in (0.8 ms, 1.6 ms]
+  for (int i = 0; i < 100; i++) histogram.Record(1.0e-3);
+  LatencyHistogram::Snapshot snapshot = histogram.Read();
+  double median = snapshot.Quantile(0.5);
+  EXPECT_GT(median, 0.8e-3);
+  EXPECT_LE(median, 1.6e-3);
+  EXPECT_LE(snapshot.Quantile(0.5), snapshot.Quantile(0.99));
+}
+
+}  // namespace
+}  // namespace mjpc
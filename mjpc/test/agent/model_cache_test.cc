@@ -0,0 +1,115 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/model_cache.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+namespace {
+namespace fs = std::filesystem;
+
+void WriteFile(const fs::path& path, const std::string& contents) {
+  std::ofstream(path) << contents;
+}
+
+void SetCacheDir(const std::string& dir) {
+#if defined(_WIN32)
+  _putenv_s("MJPC_MODEL_CACHE_DIR", dir.c_str());
+#else
+  setenv("MJPC_MODEL_CACHE_DIR", dir.c_str(), 1);
+#endif
+}
+
+class ModelCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = fs::path(::testing::TempDir()) / "model_cache_test";
+    fs::remove_all(dir_);
+    fs::create_directories(dir_ / "model");
+    WriteFile(dir_ / "model" / "task.xml",
+              "<mujoco>\n"
+              "  <include file=\"body.xml\"/>\n"
+              "</mujoco>\n");
+    WriteFile(dir_ / "model" / "body.xml",
+              "<mujoco><worldbody><body><freejoint/><geom size=\"0.1\"/>"
+              "</body></worldbody></mujoco>\n");
+    SetCacheDir((dir_ / "cache").string());
+  }
+  void TearDown() override { fs::remove_all(dir_); }
+
+  std::string XmlPath() const { return (dir_ / "model" / "task.xml").string(); }
+
+  fs::path dir_;
+};
+
+TEST_F(ModelCacheTest, KeyFollowsReferencedFiles) {
+  std::string key = ModelCacheKey(XmlPath());
+  EXPECT_EQ(key.size(), 16u);
+  EXPECT_EQ(ModelCacheKey(XmlPath()), key);
+
+  // included file changes the key
+  WriteFile(dir_ / "model" / "body.xml",
+            "<mujoco><worldbody><body><freejoint/><geom size=\"0.2\"/>"
+            "</body></worldbody></mujoco>\n");
+  EXPECT_NE(ModelCacheKey(XmlPath()), key);
+
+  // unreadable model
+  EXPECT_EQ(ModelCacheKey((dir_ / "missing.xml").string()), "");
+}
+
+TEST_F(ModelCacheTest, LoadStoresAndReloads) {
+  char error[1024] = "";
+  mjModel* compiled = LoadCachedModel(XmlPath(), error, sizeof(error));
+  ASSERT_NE(compiled, nullptr) << error;
+
+  // one compiled model in the cache
+  int num_cached = 0;
+  for (const auto& entry : fs::directory_iterator(dir_ / "cache")) {
+    EXPECT_EQ(entry.path().extension(), ".mjb");
+    num_cached++;
+  }
+  EXPECT_EQ(num_cached, 1);
+
+  // reloaded from the cache
+  mjModel* cached = LoadCachedModel(XmlPath(), error, sizeof(error));
+  ASSERT_NE(cached, nullptr) << error;
+  EXPECT_EQ(cached->nq, compiled->nq);
+  EXPECT_EQ(cached->geom_size[0], compiled->geom_size[0]);
+  EXPECT_EQ(std::distance(fs::directory_iterator(dir_ / "cache"),
+                          fs::directory_iterator()),
+            1);
+
+  mj_deleteModel(cached);
+  mj_deleteModel(compiled);
+}
+
+TEST_F(ModelCacheTest, EmptyDirDisablesCache) {
+  SetCacheDir("");
+  char error[1024] = "";
+  mjModel* model = LoadCachedModel(XmlPath(), error, sizeof(error));
+  ASSERT_NE(model, nullptr) << error;
+  EXPECT_FALSE(fs::exists(dir_ / "cache"));
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -0,0 +1,119 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/mpsc_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+TEST(MpscQueueTest, Fifo) {
+  MpscQueue<int> queue(4);
+  EXPECT_FALSE(queue.Pop().has_value());
+
+  // nodes are reused over many more pushes than the capacity
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 3; i++) queue.Push(i);
+    for (int i = 0; i < 3; i++) {
+      std::optional<int> value = queue.Pop();
+      ASSERT_TRUE(value.has_value());
+      EXPECT_EQ(*value, i);
+    }
+    EXPECT_FALSE(queue.Pop().has_value());
+  }
+  EXPECT_EQ(queue.Overflows(), 0u);
+}
+
+TEST(MpscQueueTest, Overflow) {
+  auto counter = std::make_shared<int>(0);
+  {
+    MpscQueue<std::shared_ptr<int>> queue(2);
+
+    // more values than the arena, kept in order
+    for (int i = 0; i < 5; i++) queue.Push(counter);
+    EXPECT_EQ(queue.Overflows(), 3u);
+    EXPECT_EQ(counter.use_count(), 6);
+
+    // popped values are released
+    int count = 0;
+    queue.Drain([&](std::shared_ptr<int>& value) {
+      EXPECT_EQ(value, counter);
+      count++;
+    });
+    EXPECT_EQ(count, 5);
+    EXPECT_EQ(counter.use_count(), 1);
+
+    // pending values are destroyed with the queue
+    queue.Push(counter);
+    queue.Push(counter);
+  }
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(MpscQueueTest, DrainPushed) {
+  // values pushed while draining are drained too
+  MpscQueue<int> queue;
+  queue.Push(3);
+  std::vector<int> values;
+  int count = queue.Drain([&](int value) {
+    values.push_back(value);
+    if (value > 0) queue.Push(value - 1);
+  });
+  EXPECT_EQ(count, 4);
+  EXPECT_EQ(values, (std::vector<int>{3, 2, 1, 0}));
+}
+
+TEST(MpscQueueTest, Producers) {
+  constexpr int kProducers = 4;
+  constexpr int kValues = 20000;
+  MpscQueue<std::pair<int, int>> queue(64);
+
+  // producers push while the consumer drains
+  std::atomic<int> done = 0;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&, p] {
+      for (int i = 0; i < kValues; i++) queue.Push({p, i});
+      done++;
+    });
+  }
+
+  // values of each producer arrive in order, none are lost
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  bool ordered = true;
+  auto consume = [&](std::pair<int, int>& value) {
+    ordered = ordered && value.second == next[value.first];
+    next[value.first] = value.second + 1;
+    received++;
+  };
+  while (done.load() < kProducers) queue.Drain(consume);
+  for (std::thread& thread : producers) thread.join();
+  queue.Drain(consume);
+
+  EXPECT_TRUE(ordered);
+  EXPECT_EQ(received, kProducers * kValues);
+  for (int p = 0; p < kProducers; p++) EXPECT_EQ(next[p], kValues);
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -92,6 +92,51 @@ TEST_P(NormTest, Hessian) {
   }
 }
 
+TEST_P(NormTest, Batch) {
+  const double* params = GetParam().params;
+  const mjpc::NormType norm_type = GetParam().norm_type;
+
+  // points with stride kDims + 1
+  constexpr int kStride = kDims + 1;
+  double x[kNPoints * kStride];
+  for (int i = 0; i < kNPoints; ++i) {
+    for (int j = 0; j < kDims; ++j) {
+      x[i * kStride + j] = kPoints[i][j] + 0.1 * j;
+    }
+    x[i * kStride + kDims] = 100.0;
+  }
+
+  // values
+  double y[kNPoints];
+  mjpc::NormBatch(y, nullptr, nullptr, x, params, kDims, kNPoints, kStride, 0,
+                  0, norm_type);
+  for (int i = 0; i < kNPoints; ++i) {
+    EXPECT_NEAR(
+        y[i],
+        mjpc::Norm(nullptr, nullptr, x + i * kStride, params, kDims, norm_type),
+        1.0e-12);
+  }
+
+  // derivatives
+  double g[kNPoints * kStride];
+  double H[kNPoints * kDims * kDims];
+  mjpc::NormBatch(y, g, H, x, params, kDims, kNPoints, kStride, kStride,
+                  kDims * kDims, norm_type);
+  for (int i = 0; i < kNPoints; ++i) {
+    double gi[kDims];
+    double Hi[kDims * kDims];
+    double yi =
+        mjpc::Norm(gi, Hi, x + i * kStride, params, kDims, norm_type);
+    EXPECT_NEAR(y[i], yi, 1.0e-12);
+    for (int j = 0; j < kDims; ++j) {
+      EXPECT_NEAR(g[i * kStride + j], gi[j], 1.0e-12);
+    }
+    for (int j = 0; j < kDims * kDims; ++j) {
+      EXPECT_NEAR(H[i * kDims * kDims + j], Hi[j], 1.0e-12);
+    }
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
     NormTest, NormTest,
     testing::ValuesIn<NormTestCase>({
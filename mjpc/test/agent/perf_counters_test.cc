@@ -0,0 +1,80 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/perf_counters.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
+
+namespace mjpc {
+namespace {
+
+// work the counters see
+double Work(int n) {
+  volatile double sum = 0.0;
+  for (int i = 0; i < n; i++) sum = sum + 0.5 * i;
+  return sum;
+}
+
+// test that phases count their own thread and the pool tasks they schedule,
+// on the workers that run them
+TEST(PerfCountersTest, PhasesOfPoolTasks) {
+  if (!PerfCountersAvailable()) {
+    EXPECT_FALSE(StartPerfCounters());
+    EXPECT_TRUE(PerfCounterTotals().empty());
+    GTEST_SKIP() << "performance counters are unavailable";
+  }
+  ThreadPool pool(2);
+  ASSERT_TRUE(StartPerfCounters());
+  for (int k = 0; k < 3; k++) {
+    TraceSpan span("PerfCountersTest::parallel");
+    EXPECT_STREQ(CurrentPerfPhase(), "PerfCountersTest::parallel");
+    pool.ParallelFor(0, 16, 1, [](int i) { Work(100000); });
+    span.End();
+    EXPECT_EQ(CurrentPerfPhase(), nullptr);
+  }
+  {
+    // trace events only aren't phases
+    TraceSpan span("PerfCountersTest::trace", TraceEventOnly());
+    EXPECT_EQ(CurrentPerfPhase(), nullptr);
+  }
+  StopPerfCounters();
+  {
+    // not sampled after stopping
+    TraceSpan span("PerfCountersTest::stopped");
+    Work(1000);
+  }
+
+  std::vector<PerfPhaseCounts> totals = PerfCounterTotals();
+  int workers = 0;
+  for (const PerfPhaseCounts& phase : totals) {
+    EXPECT_EQ(phase.phase, "PerfCountersTest::parallel");
+    EXPECT_GT(phase.samples, 0);
+    if (phase.thread.rfind("ThreadPool worker", 0) == 0) {
+      workers++;
+      EXPECT_GT(phase.counts.cycles, 0);
+    } else {
+      EXPECT_EQ(phase.samples, 3);
+    }
+  }
+  EXPECT_GT(workers, 0);
+}
+
+}  // namespace
+}  // namespace mjpc
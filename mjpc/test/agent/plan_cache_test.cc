@@ -0,0 +1,111 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/plan_cache.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mjpc/snapshot.h"
+
+namespace mjpc {
+namespace {
+
+// snapshot of a policy with knots at times
+std::string PolicySnapshot(const std::vector<double>& times, double value) {
+  SnapshotWriter writer;
+  writer.Add("policy.times", times);
+  writer.Add("policy.value", value);
+  return writer.Bytes();
+}
+
+double Value(const std::string& snapshot) {
+  SnapshotReader reader;
+  return reader.Parse(snapshot) ? reader.Get("policy.value", -1.0) : -1.0;
+}
+
+// test that lookups find the nearest entry of the task and mode
+TEST(PlanCacheTest, Nearest) {
+  PlanCache cache(8, 0.1);
+  std::vector<double> a = {0.0, 0.0};
+  std::vector<double> b = {1.0, 1.0};
+  cache.Store(0, 0, a.data(), 2, 0.0, PolicySnapshot({0.0, 1.0}, 1.0));
+  cache.Store(0, 0, b.data(), 2, 0.0, PolicySnapshot({0.0, 1.0}, 2.0));
+  cache.Store(0, 1, a.data(), 2, 0.0, PolicySnapshot({0.0, 1.0}, 3.0));
+  EXPECT_EQ(cache.Size(), 3);
+
+  std::string snapshot;
+  std::vector<double> query = {0.8, 0.9};
+  ASSERT_TRUE(cache.Lookup(0, 0, query.data(), 2, 0.0, &snapshot));
+  EXPECT_EQ(Value(snapshot), 2.0);
+  ASSERT_TRUE(cache.Lookup(0, 1, query.data(), 2, 0.0, &snapshot));
+  EXPECT_EQ(Value(snapshot), 3.0);
+  EXPECT_FALSE(cache.Lookup(1, 0, query.data(), 2, 0.0, &snapshot));
+  EXPECT_FALSE(cache.Lookup(0, 2, query.data(), 2, 0.0, &snapshot));
+
+  // beyond the max distance
+  cache.SetMaxDistance(0.1);
+  EXPECT_FALSE(cache.Lookup(0, 0, query.data(), 2, 0.0, &snapshot));
+  EXPECT_EQ(cache.Hits(), 2);
+  EXPECT_EQ(cache.Misses(), 3);
+
+  // a store in the same cell replaces the entry
+  std::vector<double> c = {1.01, 1.02};
+  cache.Store(0, 0, c.data(), 2, 0.0, PolicySnapshot({0.0, 1.0}, 4.0));
+  EXPECT_EQ(cache.Size(), 3);
+  ASSERT_TRUE(cache.Lookup(0, 0, b.data(), 2, 0.0, &snapshot));
+  EXPECT_EQ(Value(snapshot), 4.0);
+}
+
+// test that the times of a snapshot are shifted to the lookup time
+TEST(PlanCacheTest, Times) {
+  PlanCache cache;
+  std::vector<double> features = {0.5};
+  cache.Store(0, 0, features.data(), 1, 2.0, PolicySnapshot({2.0, 2.5}, 1.0));
+
+  std::string snapshot;
+  ASSERT_TRUE(cache.Lookup(0, 0, features.data(), 1, 10.0, &snapshot));
+  SnapshotReader reader;
+  ASSERT_TRUE(reader.Parse(snapshot));
+  std::vector<double> times(2);
+  ASSERT_TRUE(reader.Read("policy.times", times.data(), 2));
+  EXPECT_EQ(times, (std::vector<double>{10.0, 10.5}));
+}
+
+// test that the least recently used entry is evicted
+TEST(PlanCacheTest, Capacity) {
+  PlanCache cache(2, 1.0);
+  std::vector<double> features[3] = {{0.5}, {1.5}, {2.5}};
+  cache.Store(0, 0, features[0].data(), 1, 0.0, PolicySnapshot({0.0}, 0.0));
+  cache.Store(0, 0, features[1].data(), 1, 0.0, PolicySnapshot({0.0}, 1.0));
+
+  // use the first entry, the second is evicted
+  std::string snapshot;
+  ASSERT_TRUE(cache.Lookup(0, 0, features[0].data(), 1, 0.0, &snapshot));
+  cache.Store(0, 0, features[2].data(), 1, 0.0, PolicySnapshot({0.0}, 2.0));
+  EXPECT_EQ(cache.Size(), 2);
+  cache.SetMaxDistance(0.1);
+  EXPECT_TRUE(cache.Lookup(0, 0, features[0].data(), 1, 0.0, &snapshot));
+  EXPECT_FALSE(cache.Lookup(0, 0, features[1].data(), 1, 0.0, &snapshot));
+  EXPECT_TRUE(cache.Lookup(0, 0, features[2].data(), 1, 0.0, &snapshot));
+
+  // a new resolution clears the cache
+  cache.SetResolution(0.5);
+  EXPECT_EQ(cache.Size(), 0);
+}
+
+}  // namespace
+}  // namespace mjpc
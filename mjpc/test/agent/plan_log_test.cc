@@ -0,0 +1,150 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/plan_log.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mjpc/test/allocation_counter.h"
+
+namespace mjpc {
+namespace {
+
+std::string TempPath(const std::string& name) {
+  return ::testing::TempDir() + name;
+}
+
+// fill a record of iteration i with num_samples samples
+void Fill(PlanLogRecord* record, int i, int num_samples, bool states) {
+  record->iteration = i;
+  record->time = 0.01 * i;
+  record->total_return = 2.0 * i;
+  record->state.assign({1.0 * i, -1.0 * i});
+  record->parameters.assign({0.5 * i, 0.25 * i, 0.125 * i});
+  record->returns.resize(num_samples);
+  for (int s = 0; s < num_samples; s++) record->returns[s] = i + s;
+  if (states) {
+    record->sample_horizon = 3;
+    record->dim_sample_state = 2;
+    record->sample_states.assign(num_samples * 3 * 2, 1.0 * i);
+  }
+}
+
+// test that records are read back as written, across chunks of different
+// sizes
+TEST(PlanLogTest, RoundTrip) {
+  std::string path = TempPath("plan_log_test_round_trip.bin");
+  PlanLogger logger;
+  PlanLogOptions options;
+  options.capacity = 64;
+  options.chunk_records = 4;
+  ASSERT_TRUE(logger.Open(path, options));
+
+  // sample counts change after 10 iterations, e.g., autotuned rollouts
+  for (int i = 0; i < 20; i++) {
+    PlanLogRecord* record = logger.Acquire();
+    ASSERT_NE(record, nullptr);
+    Fill(record, i, i < 10 ? 5 : 7, i % 2 == 0 && i >= 10);
+    logger.Commit();
+  }
+  logger.Close();
+  EXPECT_EQ(logger.Written(), 20);
+  EXPECT_EQ(logger.Dropped(), 0);
+
+  std::vector<PlanLogRecord> records;
+  ASSERT_TRUE(ReadPlanLog(path, &records));
+  ASSERT_EQ(records.size(), 20);
+  for (int i = 0; i < 20; i++) {
+    PlanLogRecord expected;
+    Fill(&expected, i, i < 10 ? 5 : 7, i % 2 == 0 && i >= 10);
+    const PlanLogRecord& record = records[i];
+    EXPECT_EQ(record.iteration, expected.iteration);
+    EXPECT_EQ(record.time, expected.time);
+    EXPECT_EQ(record.total_return, expected.total_return);
+    EXPECT_EQ(record.state, expected.state);
+    EXPECT_EQ(record.parameters, expected.parameters);
+    EXPECT_EQ(record.returns, expected.returns);
+    EXPECT_EQ(record.sample_horizon, expected.sample_horizon);
+    EXPECT_EQ(record.sample_states, expected.sample_states);
+  }
+}
+
+// test that a full ring drops records instead of blocking
+TEST(PlanLogTest, Drop) {
+  std::string path = TempPath("plan_log_test_drop.bin");
+  PlanLogger logger;
+  PlanLogOptions options;
+  options.capacity = 4;
+  ASSERT_TRUE(logger.Open(path, options));
+
+  int committed = 0;
+  for (int i = 0; i < 1000; i++) {
+    PlanLogRecord* record = logger.Acquire();
+    if (!record) continue;
+    Fill(record, i, 64, true);
+    logger.Commit();
+    committed++;
+  }
+  logger.Close();
+  EXPECT_EQ(committed + logger.Dropped(), 1000);
+  EXPECT_EQ(logger.Written(), committed);
+
+  std::vector<PlanLogRecord> records;
+  ASSERT_TRUE(ReadPlanLog(path, &records));
+  EXPECT_EQ(records.size(), committed);
+}
+
+// test that logging records of constant sizes doesn't allocate once every
+// slot was used
+TEST(PlanLogTest, NoAllocation) {
+  std::string path = TempPath("plan_log_test_allocation.bin");
+  PlanLogger logger;
+  PlanLogOptions options;
+  options.capacity = 8;
+  options.chunk_records = 2;
+  ASSERT_TRUE(logger.Open(path, options));
+
+  // the ring and chunk slots swap memory, use each of them
+  auto log = [&logger](int n) {
+    for (int i = 0; i < n; i++) {
+      PlanLogRecord* record;
+      while (!(record = logger.Acquire())) {
+      }
+      Fill(record, i, 16, true);
+      logger.Commit();
+    }
+  };
+  log(4 * (options.capacity + options.chunk_records));
+
+  std::int64_t allocations;
+  {
+    AllocationCounter counter;
+    log(100);
+    allocations = counter.count();
+  }
+  EXPECT_EQ(allocations, 0);
+  logger.Close();
+}
+
+// test that other files aren't read
+TEST(PlanLogTest, Invalid) {
+  std::vector<PlanLogRecord> records;
+  EXPECT_FALSE(ReadPlanLog(TempPath("plan_log_test_missing.bin"), &records));
+}
+
+}  // namespace
+}  // namespace mjpc
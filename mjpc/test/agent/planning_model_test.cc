@@ -0,0 +1,143 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planning_model.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+namespace {
+namespace fs = std::filesystem;
+
+TEST(PlanningModelTest, SolverAndTimestep) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  PlanningModelOptions options;
+  EXPECT_FALSE(options.Enabled());
+  options.solver_iterations = 7;
+  options.solver_tolerance = 1.0e-3;
+  options.integrator = mjINT_RK4;
+  options.timestep_scale = 2.0;
+  EXPECT_TRUE(options.Enabled());
+
+  UniqueMjModel simplified = SimplifyPlanningModel(model, options);
+  EXPECT_EQ(simplified->opt.iterations, 7);
+  EXPECT_EQ(simplified->opt.tolerance, 1.0e-3);
+  EXPECT_EQ(simplified->opt.integrator, mjINT_RK4);
+  EXPECT_NEAR(simplified->opt.timestep, 2.0 * model->opt.timestep, 1.0e-12);
+  EXPECT_NEAR(GetNumberOrDefault(0.0, simplified.get(), "agent_timestep"), 0.2,
+              1.0e-12);
+
+  // the task model is unchanged
+  EXPECT_NEAR(GetNumberOrDefault(0.0, model, "agent_timestep"), 0.1, 1.0e-12);
+
+  mj_deleteModel(model);
+}
+
+TEST(PlanningModelTest, MeshGeoms) {
+  fs::path path = fs::path(::testing::TempDir()) / "planning_model_test.xml";
+  std::ofstream(path)
+      << "<mujoco>\n"
+         "  <asset>\n"
+         "    <mesh name=\"brick\" vertex=\"0 0 0  2 0 0  0 1 0  2 1 0  "
+         "0 0 .5  2 0 .5  0 1 .5  2 1 .5\"/>\n"
+         "  </asset>\n"
+         "  <worldbody>\n"
+         "    <body>\n"
+         "      <freejoint/>\n"
+         "      <geom type=\"mesh\" mesh=\"brick\"/>\n"
+         "      <geom type=\"mesh\" mesh=\"brick\" group=\"2\"/>\n"
+         "    </body>\n"
+         "  </worldbody>\n"
+         "</mujoco>\n";
+  char error[1024] = "";
+  mjModel* model = mj_loadXML(path.string().c_str(), nullptr, error,
+                              sizeof(error));
+  ASSERT_NE(model, nullptr) << error;
+
+  PlanningModelOptions options;
+  options.mesh_geoms = PlanningModelOptions::kMeshBox;
+  options.drop_visual_geoms = 1;
+  UniqueMjModel simplified = SimplifyPlanningModel(model, options);
+
+  // colliding mesh is replaced by its bounding box, centered on the brick
+  EXPECT_EQ(simplified->geom_type[0], mjGEOM_BOX);
+  double size[3];
+  mju_copy3(size, simplified->geom_size);
+  std::sort(size, size + 3);
+  EXPECT_NEAR(size[0], 0.25, 1.0e-6);
+  EXPECT_NEAR(size[1], 0.5, 1.0e-6);
+  EXPECT_NEAR(size[2], 1.0, 1.0e-6);
+  EXPECT_NEAR(simplified->geom_pos[0], 1.0, 1.0e-6);
+  EXPECT_NEAR(simplified->geom_pos[1], 0.5, 1.0e-6);
+  EXPECT_NEAR(simplified->geom_pos[2], 0.25, 1.0e-6);
+
+  // visual geom no longer collides and keeps its mesh
+  EXPECT_EQ(simplified->geom_contype[1], 0);
+  EXPECT_EQ(simplified->geom_conaffinity[1], 0);
+  EXPECT_EQ(simplified->geom_type[1], mjGEOM_MESH);
+
+  mj_deleteModel(model);
+  fs::remove(path);
+}
+
+TEST(PlanningModelTest, Calibration) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  mj_resetDataKeyframe(model, data, mj_name2id(model, mjOBJ_KEY, "home"));
+
+  ParticleTestTask task;
+  task.Reset(model);
+  State state;
+  state.Allocate(model);
+  state.Set(model, data);
+  PlanningPolicy zero = [&](double* action, const double* x, double time) {
+    mju_zero(action, model->nu);
+  };
+
+  // identical models
+  UniqueMjModel copy = SimplifyPlanningModel(model, PlanningModelOptions());
+  PlanningModelReport report =
+      CalibratePlanningModel(model, copy.get(), task, state, zero, 1.0);
+  EXPECT_EQ(report.full_steps, 10);
+  EXPECT_EQ(report.simplified_steps, 10);
+  EXPECT_GT(report.full_cost, 0.0);
+  EXPECT_EQ(report.simplified_cost, report.full_cost);
+  EXPECT_EQ(report.cost_error, 0.0);
+  EXPECT_EQ(report.state_error, 0.0);
+
+  // coarser time step
+  PlanningModelOptions options;
+  options.timestep_scale = 2.0;
+  UniqueMjModel coarse = SimplifyPlanningModel(model, options);
+  report = CalibratePlanningModel(model, coarse.get(), task, state, zero, 1.0);
+  EXPECT_EQ(report.simplified_steps, 5);
+  EXPECT_GT(report.cost_error, 0.0);
+  EXPECT_FALSE(report.ToString().empty());
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
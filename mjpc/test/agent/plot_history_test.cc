@@ -0,0 +1,63 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/plot_history.h"
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+
+namespace mjpc {
+namespace {
+
+// test that the newest points are written first, after wrapping around
+TEST(PlotHistoryTest, WriteNewestFirst) {
+  PlotHistory history;
+  history.Allocate({2}, 3);
+  mjvFigure fig;
+  mjv_defaultFigure(&fig);
+
+  for (int i = 0; i < 5; i++) history.Add(0, i, 10 * i);
+  EXPECT_EQ(history.Size(0), 3);
+  history.Write(&fig);
+
+  EXPECT_EQ(fig.linepnt[2], 3);
+  float expected[6] = {4, 40, 3, 30, 2, 20};
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(fig.linedata[2][i], expected[i]);
+  }
+
+  history.Clear();
+  history.Write(&fig);
+  EXPECT_EQ(fig.linepnt[2], 0);
+}
+
+// test that bounds only include points after the lower bound
+TEST(PlotHistoryTest, Bounds) {
+  PlotHistory history;
+  history.Allocate({0}, 10);
+  history.Add(0, 0.0, -5.0);
+  history.Add(0, 1.0, 2.0);
+  history.Add(0, 2.0, 3.0);
+
+  double bounds[2] = {0.0, 1.0};
+  history.Bounds(0, 0.5, bounds);
+  EXPECT_EQ(bounds[0], 0.0);
+  EXPECT_EQ(bounds[1], 3.0);
+
+  history.Bounds(0, -1.0, bounds);
+  EXPECT_EQ(bounds[0], -5.0);
+}
+
+}  // namespace
+}  // namespace mjpc
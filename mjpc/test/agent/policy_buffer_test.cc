@@ -0,0 +1,85 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/policy_buffer.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// test published policies are not modified while held
+TEST(PolicyBufferTest, Publish) {
+  PolicyBuffer<std::vector<double>> buffer;
+  EXPECT_EQ(buffer.Latest(), nullptr);
+
+  // publish
+  buffer.Publish({1.0, 1.0}, {0.0, 0.0});
+  auto first = buffer.Latest();
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(first->policy[0], 1.0);
+  EXPECT_EQ(first->previous_policy[0], 0.0);
+  EXPECT_EQ(first->version, 1);
+
+  // publish into the back buffer while the front is held
+  buffer.Publish({2.0, 2.0}, {1.0, 1.0});
+  EXPECT_EQ(first->policy[0], 1.0);
+  auto second = buffer.Latest();
+  EXPECT_EQ(second->policy[0], 2.0);
+  EXPECT_EQ(second->previous_policy[0], 1.0);
+  EXPECT_EQ(second->version, 2);
+  EXPECT_EQ(first->version, 1);
+
+  // reuse the first buffer once released
+  first.reset();
+  second.reset();
+  buffer.Publish({3.0, 3.0}, {2.0, 2.0});
+  EXPECT_EQ(buffer.Latest()->policy[0], 3.0);
+  EXPECT_EQ(buffer.Latest()->version, 3);
+}
+
+// test readers see consistent pairs during publication
+TEST(PolicyBufferTest, Threads) {
+  PolicyBuffer<std::vector<double>> buffer;
+  buffer.Publish(std::vector<double>(100, 1.0), std::vector<double>(100, 0.0));
+
+  // reader
+  std::atomic<bool> done = false;
+  std::thread reader([&]() {
+    while (!done.load()) {
+      auto latest = buffer.Latest();
+      double value = latest->policy[0];
+      for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(latest->policy[i], value);
+        ASSERT_EQ(latest->previous_policy[i], value - 1.0);
+      }
+    }
+  });
+
+  // writer
+  for (int k = 2; k < 10000; k++) {
+    buffer.Publish(std::vector<double>(100, k),
+                   std::vector<double>(100, k - 1));
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(buffer.Latest()->policy[0], 9999.0);
+}
+
+}  // namespace
+}  // namespace mjpc
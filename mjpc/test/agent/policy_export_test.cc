@@ -0,0 +1,202 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/policy_export.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/ilqg/policy.h"
+#include "mjpc/planners/policy.h"
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+
+namespace mjpc {
+namespace {
+
+// evaluator of the parsed bytes of an exported policy
+PolicyEvaluator ParsedEvaluator(const ExportedPolicy& policy) {
+  ExportedPolicy parsed;
+  EXPECT_TRUE(ParsePolicy(SerializePolicy(policy), &parsed));
+  return PolicyEvaluator(parsed);
+}
+
+// evaluation times: within, between and outside the knots
+std::vector<double> QueryTimes() {
+  std::vector<double> times;
+  for (int k = 0; k < 100; k++) times.push_back(-0.05 + 0.013 * k);
+  for (double t : {0.3, 0.4, 0.1, -1.0, 5.0}) times.push_back(t);
+  return times;
+}
+
+// test that a policy is parsed as serialized, and invalid bytes aren't
+TEST(PolicyExportTest, Serialize) {
+  ExportedPolicy policy;
+  policy.version = 12;
+  policy.kind = ExportedPolicyKind::kFeedback;
+  policy.representation = 2;
+  policy.dim_action = 1;
+  policy.nq = 2;
+  policy.nv = 1;
+  policy.na = 0;
+  policy.times = {0.0, 0.1, 0.2};
+  policy.actions = {1.0, 2.0};
+  policy.states = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0};
+  policy.gains = {0.1, 0.2, 0.3, 0.4};
+  policy.ctrlrange = {-1.0, 1.0};
+  policy.joints = {3, 1, 0};
+  policy.feedback_scaling = 0.5;
+  std::string bytes = SerializePolicy(policy);
+
+  ExportedPolicy parsed;
+  ASSERT_TRUE(ParsePolicy(bytes, &parsed));
+  EXPECT_EQ(parsed.version, 12);
+  EXPECT_EQ(parsed.kind, ExportedPolicyKind::kFeedback);
+  EXPECT_EQ(parsed.representation, 2);
+  EXPECT_EQ(parsed.nq, 2);
+  EXPECT_EQ(parsed.times, policy.times);
+  EXPECT_EQ(parsed.states, policy.states);
+  EXPECT_EQ(parsed.gains, policy.gains);
+  EXPECT_EQ(parsed.joints, policy.joints);
+  EXPECT_EQ(parsed.feedback_scaling, 0.5);
+
+  // truncated, other magic and mismatched dimensions
+  EXPECT_FALSE(ParsePolicy(bytes.substr(0, bytes.size() - 1), &parsed));
+  std::string other = bytes;
+  other[0] = 'X';
+  EXPECT_FALSE(ParsePolicy(other, &parsed));
+  policy.gains.pop_back();
+  EXPECT_FALSE(ParsePolicy(SerializePolicy(policy), &parsed));
+  policy.gains.push_back(0.4);
+  policy.joints = {3, 2, 0};
+  EXPECT_FALSE(ParsePolicy(SerializePolicy(policy), &parsed));
+}
+
+// test that an exported sampling policy has the policy's actions
+TEST(PolicyExportTest, SamplingPolicy) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+
+  for (auto representation :
+       {PolicyRepresentation::kZeroSpline, PolicyRepresentation::kLinearSpline,
+        PolicyRepresentation::kCubicSpline}) {
+    for (int num_spline_points : {1, 2, 3, 6}) {
+      SamplingPolicy policy;
+      policy.Allocate(model, task, 10);
+      policy.representation = representation;
+      policy.num_spline_points = num_spline_points;
+      for (int i = 0; i < num_spline_points; i++) {
+        policy.times[i] = 0.1 + 0.19 * i;
+        for (int j = 0; j < nu; j++) {
+          policy.parameters[i * nu + j] = 1.2 * std::sin(1.3 * i + 2.1 * j);
+        }
+      }
+
+      ExportedPolicy exported;
+      policy.Export(exported);
+      EXPECT_EQ(exported.kind, ExportedPolicyKind::kSpline);
+      EXPECT_EQ(exported.times.size(), num_spline_points);
+      PolicyEvaluator evaluator = ParsedEvaluator(exported);
+
+      std::vector<double> action(nu), expected(nu);
+      for (double time : QueryTimes()) {
+        policy.Action(expected.data(), nullptr, time);
+        evaluator.Action(action.data(), nullptr, time);
+        for (int j = 0; j < nu; j++) {
+          EXPECT_NEAR(action[j], expected[j], 1.0e-12)
+              << representation << " " << num_spline_points << " " << time;
+        }
+      }
+    }
+  }
+
+  mj_deleteModel(model);
+}
+
+// test that an exported iLQG policy has the policy's actions, with
+// quaternions in the state
+TEST(PolicyExportTest, iLQGPolicy) {
+  mjModel* model = LoadTestModel("floating_arm.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+  int nq = model->nq, nv = model->nv;
+  int dim_state = nq + nv + model->na;
+  int horizon = 10;
+
+  std::mt19937 generator(3);
+  std::uniform_real_distribution<double> uniform(-0.1, 0.1);
+  auto random_state = [&](double* state) {
+    mju_copy(state, model->qpos0, nq);
+    for (int i = 0; i < dim_state; i++) state[i] += uniform(generator);
+    mj_normalizeQuat(model, state);
+  };
+
+  // states near the reference
+  std::vector<std::vector<double>> states(3, std::vector<double>(dim_state));
+  for (std::vector<double>& state : states) random_state(state.data());
+
+  for (int representation = 0; representation < 3; representation++) {
+    iLQGPolicy policy;
+    policy.Allocate(model, task, kMaxTrajectoryHorizon);
+    policy.Reset(kMaxTrajectoryHorizon);
+    policy.representation = representation;
+    policy.feedback_scaling = 0.7;
+    Trajectory& trajectory = policy.trajectory;
+    trajectory.horizon = horizon;
+    for (int t = 0; t < horizon; t++) {
+      trajectory.times[t] = 0.05 + 0.04 * t;
+      random_state(trajectory.states.data() + t * dim_state);
+      for (int i = 0; i < nu; i++) {
+        trajectory.actions[t * nu + i] = uniform(generator);
+      }
+    }
+    for (int i = 0; i < horizon * nu * (2 * nv + model->na); i++) {
+      policy.feedback_gain[i] = 5.0 * uniform(generator);
+    }
+
+    ExportedPolicy exported;
+    policy.Export(exported);
+    EXPECT_EQ(exported.kind, ExportedPolicyKind::kFeedback);
+    EXPECT_EQ(exported.actions.size(), (horizon - 1) * nu);
+    PolicyEvaluator evaluator = ParsedEvaluator(exported);
+
+    std::vector<double> action(nu), expected(nu);
+    for (double time : QueryTimes()) {
+      for (const std::vector<double>& state : states) {
+        for (const double* s :
+             {state.data(), static_cast<const double*>(nullptr)}) {
+          policy.Action(expected.data(), s, time);
+          evaluator.Action(action.data(), s, time);
+          for (int i = 0; i < nu; i++) {
+            EXPECT_NEAR(action[i], expected[i], 1.0e-10)
+                << representation << " " << time;
+          }
+        }
+      }
+    }
+  }
+
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
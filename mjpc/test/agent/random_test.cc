@@ -0,0 +1,204 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <absl/random/distributions.h>
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// test that equal seeds give equal sequences
+TEST(RandomStreamTest, Deterministic) {
+  RandomStream a(1, 2);
+  RandomStream b(1, 2);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(a(), b());
+  }
+  EXPECT_EQ(a.Counter(), 100);
+
+  // reseeding restarts the sequence
+  std::uint64_t first = a();
+  a.Seed(1, 2);
+  b.Seed(1, 2);
+  EXPECT_EQ(a(), b());
+  a.Seed(1, 2);
+  a.SetCounter(100);
+  EXPECT_EQ(a(), first);
+}
+
+// test that streams and seeds are distinct
+TEST(RandomStreamTest, Distinct) {
+  RandomStream a(0, 0);
+  RandomStream b(0, 1);
+  RandomStream c(1, 0);
+  int same_ab = 0;
+  int same_ac = 0;
+  for (int i = 0; i < 100; i++) {
+    std::uint64_t va = a();
+    same_ab += va == b();
+    same_ac += va == c();
+  }
+  EXPECT_EQ(same_ab, 0);
+  EXPECT_EQ(same_ac, 0);
+}
+
+// test sample moments with absl distributions
+TEST(RandomStreamTest, Gaussian) {
+  RandomStream stream(3, 7);
+  int n = 100000;
+  double mean = 0.0;
+  double variance = 0.0;
+  for (int i = 0; i < n; i++) {
+    double x = absl::Gaussian<double>(stream, 0.0, 2.0);
+    mean += x / n;
+    variance += x * x / n;
+  }
+  EXPECT_NEAR(mean, 0.0, 0.05);
+  EXPECT_NEAR(variance, 4.0, 0.1);
+}
+
+// test bulk samples: moments, odd lengths, and counter advance
+TEST(RandomStreamTest, BulkGaussian) {
+  RandomStream stream(3, 7);
+  int n = 100001;
+  std::vector<double> x(n);
+  stream.Gaussian(x.data(), n, 2.0);
+  EXPECT_EQ(stream.Counter(), n + 1);
+
+  double mean = 0.0;
+  double variance = 0.0;
+  for (int i = 0; i < n; i++) {
+    mean += x[i] / n;
+    variance += x[i] * x[i] / n;
+  }
+  EXPECT_NEAR(mean, 0.0, 0.05);
+  EXPECT_NEAR(variance, 4.0, 0.1);
+
+  // same samples regardless of block boundaries
+  RandomStream a(5, 1);
+  RandomStream b(5, 1);
+  std::vector<double> ya(300);
+  std::vector<double> yb(300);
+  a.Gaussian(ya.data(), 300);
+  b.Gaussian(yb.data(), 200);
+  b.Gaussian(yb.data() + 200, 100);
+  for (int i = 0; i < 300; i++) {
+    EXPECT_EQ(ya[i], yb[i]);
+  }
+}
+
+// test antithetic pairs and order independence of batch noise
+TEST(RandomStreamTest, Antithetic) {
+  RandomStream stream;
+  double a[7];
+  double b[7];
+  double c[7];
+  BatchGaussian(c, 7, 0.5, kAntitheticNoise, 3, 1, 4, stream);
+  BatchGaussian(b, 7, 0.5, kAntitheticNoise, 2, 1, 4, stream);
+  BatchGaussian(a, 7, 0.5, kAntitheticNoise, 1, 1, 4, stream);
+  for (int i = 0; i < 7; i++) {
+    EXPECT_EQ(a[i], -b[i]);
+    EXPECT_NE(a[i], c[i]);
+  }
+  EXPECT_EQ(stream.Counter(), 0);
+
+  // new iteration, new draws
+  BatchGaussian(b, 7, 0.5, kAntitheticNoise, 1, 1, 5, stream);
+  EXPECT_NE(a[0], b[0]);
+}
+
+// test that Sobol noise stratifies every coordinate
+TEST(RandomStreamTest, Sobol) {
+  int num_point = 64;
+  int n = 20;
+  std::vector<double> x(n);
+  std::vector<std::vector<int>> count(n, std::vector<int>(num_point));
+  double mean = 0.0;
+  for (int i = 0; i < num_point; i++) {
+    SobolGaussian(x.data(), n, i, 9);
+    for (int k = 0; k < n; k++) {
+      double u = 0.5 * std::erfc(-x[k] / std::sqrt(2.0));
+      count[k][std::min(static_cast<int>(u * num_point), num_point - 1)]++;
+      mean += x[k] / (num_point * n);
+    }
+  }
+
+  // one point per stratum, mean close to zero
+  for (int k = 0; k < n; k++) {
+    for (int j = 0; j < num_point; j++) {
+      EXPECT_EQ(count[k][j], 1);
+    }
+  }
+  EXPECT_NEAR(mean, 0.0, 1.0e-2);
+}
+
+// test AR(1) correlation across rows
+TEST(RandomStreamTest, CorrelateRows) {
+  RandomStream stream(2, 3);
+  int rows = 4;
+  int cols = 20000;
+  std::vector<double> x(rows * cols);
+  stream.Gaussian(x.data(), rows * cols);
+  CorrelateRows(x.data(), rows, cols, 0.8);
+
+  // marginal variance kept, neighbors correlated
+  double variance = 0.0;
+  double covariance = 0.0;
+  for (int j = 0; j < cols; j++) {
+    variance += x[3 * cols + j] * x[3 * cols + j] / cols;
+    covariance += x[3 * cols + j] * x[2 * cols + j] / cols;
+  }
+  EXPECT_NEAR(variance, 1.0, 0.05);
+  EXPECT_NEAR(covariance, 0.8, 0.05);
+}
+
+// test orthonormal bases and the expansion of their coordinates
+TEST(RandomStreamTest, Synergies) {
+  // the third row is the sum of the first two
+  std::vector<double> basis = {1.0, 1.0, 0.0, 0.0,  //
+                               0.0, 2.0, 0.0, 0.0,  //
+                               1.0, 3.0, 0.0, 0.0,  //
+                               0.0, 0.0, 0.0, 3.0};
+  int rank = OrthonormalizeRows(basis.data(), 4, 4);
+  ASSERT_EQ(rank, 3);
+  for (int i = 0; i < rank; i++) {
+    for (int k = 0; k < rank; k++) {
+      double dot = 0.0;
+      for (int j = 0; j < 4; j++) dot += basis[4 * i + j] * basis[4 * k + j];
+      EXPECT_NEAR(dot, i == k ? 1.0 : 0.0, 1.0e-12);
+    }
+  }
+  // the span has no third coordinate
+  for (int i = 0; i < rank; i++) EXPECT_EQ(basis[4 * i + 2], 0.0);
+
+  // coordinates map to combinations of the rows
+  std::vector<double> x = {1.0, 0.0, 0.0,  //
+                           0.0, 2.0, -1.0};
+  std::vector<double> y(2 * 4);
+  ExpandRows(y.data(), x.data(), basis.data(), 2, rank, 4);
+  for (int j = 0; j < 4; j++) {
+    EXPECT_NEAR(y[j], basis[j], 1.0e-12);
+    EXPECT_NEAR(y[4 + j], 2.0 * basis[4 + j] - basis[8 + j], 1.0e-12);
+  }
+}
+
+}  // namespace
+}  // namespace mjpc
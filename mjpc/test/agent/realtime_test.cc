@@ -0,0 +1,68 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/realtime.h"
+
+#include <chrono>
+
+#include "gtest/gtest.h"
+#include "mjpc/metrics.h"
+
+namespace mjpc {
+namespace {
+
+// test periods and missed ticks of a 1 kHz loop
+TEST(RealtimeTest, ControlPeriod) {
+  ControlPeriodMonitor monitor(1.0e-3, 0.5e-3);
+  std::chrono::steady_clock::time_point time;
+  time += std::chrono::seconds(1);
+
+  // 9 ticks on time, one 3 ms late
+  for (int i = 0; i < 10; i++) {
+    monitor.Tick(time);
+    time += std::chrono::microseconds(i == 4 ? 4000 : 1000);
+  }
+  LatencyHistogram::Snapshot periods = monitor.periods().Read();
+  EXPECT_EQ(periods.count, 9);
+  EXPECT_EQ(monitor.missed(), 1);
+  EXPECT_NEAR(monitor.max(), 4.0e-3, 1.0e-9);
+  EXPECT_NEAR(periods.sum, 12.0e-3, 1.0e-9);
+
+  // microsecond buckets
+  EXPECT_EQ(periods.upper_bounds[0], 1.0e-6);
+  EXPECT_GT(periods.Quantile(0.5), 0.5e-3);
+  EXPECT_LE(periods.Quantile(0.5), 1.1e-3);
+
+  // the first tick after a restart records nothing
+  monitor.Restart();
+  monitor.Tick(time + std::chrono::seconds(1));
+  EXPECT_EQ(monitor.periods().Read().count, 9);
+  EXPECT_FALSE(monitor.Summary().empty());
+
+  // reset
+  monitor.Reset(2.0e-3, 1.0e-3);
+  EXPECT_EQ(monitor.periods().Read().count, 0);
+  EXPECT_EQ(monitor.missed(), 0);
+  EXPECT_EQ(monitor.target(), 2.0e-3);
+}
+
+// test that the default options change nothing
+TEST(RealtimeTest, Defaults) {
+  EXPECT_FALSE(RealtimeOptions().Enabled());
+  ScopedRealtimePriority priority(0);
+  EXPECT_FALSE(priority.active());
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -0,0 +1,178 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/residual_dispatch.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/agent.h"
+#include "mjpc/task.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+
+namespace mjpc {
+namespace {
+
+// writes the value given as context to the first residual
+void ConstantResidual(const void* context, const mjModel* model,
+                      mjData* data) {
+  data->sensordata[0] = *static_cast<const double*>(context);
+}
+
+// first residual after a forward pass
+double ForwardResidual(const mjModel* model, mjData* data) {
+  data->sensordata[0] = -1.0;
+  mj_forward(model, data);
+  return data->sensordata[0];
+}
+
+TEST(ResidualDispatchTest, RegisterUnregister) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjModel* other = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  mjData* other_data = mj_makeData(other);
+  mjcb_sensor = ResidualSensorCallback;
+
+  // residuals by model
+  double value = 1.0, other_value = 2.0;
+  EXPECT_TRUE(RegisterResidual(model, ConstantResidual, &value));
+  EXPECT_TRUE(RegisterResidual(other, ConstantResidual, &other_value));
+  EXPECT_EQ(ForwardResidual(model, data), 1.0);
+  EXPECT_EQ(ForwardResidual(other, other_data), 2.0);
+
+  // replaced
+  double replaced = 3.0;
+  EXPECT_TRUE(RegisterResidual(model, ConstantResidual, &replaced));
+  EXPECT_EQ(ForwardResidual(model, data), 3.0);
+
+  // skipped on this thread
+  {
+    ScopedResidualSkip skip;
+    EXPECT_EQ(ForwardResidual(model, data), -1.0);
+  }
+
+  // alias of a copy with other options
+  mjModel copy = *model;
+  copy.opt.timestep *= 2;
+  EXPECT_FALSE(HasResidual(&copy));
+  EXPECT_TRUE(RegisterResidualAlias(&copy, model));
+  EXPECT_EQ(ForwardResidual(&copy, data), 3.0);
+  UnregisterResidual(&copy);
+
+  // unregistered models are unchanged
+  UnregisterResidual(model);
+  EXPECT_FALSE(HasResidual(model));
+  EXPECT_FALSE(DispatchResidual(model, data));
+  EXPECT_EQ(ForwardResidual(model, data), -1.0);
+  EXPECT_FALSE(RegisterResidualAlias(&copy, model));
+  EXPECT_EQ(ForwardResidual(other, other_data), 2.0);
+  UnregisterResidual(other);
+
+  mjcb_sensor = nullptr;
+  mj_deleteData(other_data);
+  mj_deleteData(data);
+  mj_deleteModel(other);
+  mj_deleteModel(model);
+}
+
+TEST(ResidualDispatchTest, ConcurrentModels) {
+  mjcb_sensor = ResidualSensorCallback;
+
+  // models stepped concurrently, while another model is registered and
+  // unregistered
+  constexpr int kNumModels = 4;
+  std::vector<mjModel*> models;
+  std::vector<double> values;
+  for (int i = 0; i < kNumModels; i++) {
+    models.push_back(LoadTestModel("particle_task.xml"));
+    values.push_back(i);
+  }
+  for (int i = 0; i < kNumModels; i++) {
+    ASSERT_TRUE(RegisterResidual(models[i], ConstantResidual, &values[i]));
+  }
+  mjModel* registered = LoadTestModel("particle_task.xml");
+  double registered_value = -2.0;
+
+  std::atomic<int> mismatches = 0;
+  std::atomic<bool> done = false;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumModels; i++) {
+    threads.emplace_back([&, i] {
+      mjData* data = mj_makeData(models[i]);
+      for (int k = 0; k < 100; k++) {
+        if (ForwardResidual(models[i], data) != values[i]) mismatches++;
+      }
+      mj_deleteData(data);
+    });
+  }
+  std::thread registration([&] {
+    while (!done.load()) {
+      RegisterResidual(registered, ConstantResidual, &registered_value);
+      UnregisterResidual(registered);
+    }
+  });
+  for (std::thread& thread : threads) thread.join();
+  done = true;
+  registration.join();
+  EXPECT_EQ(mismatches.load(), 0);
+
+  for (mjModel* model : models) {
+    UnregisterResidual(model);
+    mj_deleteModel(model);
+  }
+  mj_deleteModel(registered);
+  mjcb_sensor = nullptr;
+}
+
+TEST(ResidualDispatchTest, Agents) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  mjcb_sensor = ResidualSensorCallback;
+
+  // agents register their planning models
+  auto agent = std::make_unique<Agent>(model,
+                                       std::make_shared<ParticleTestTask>());
+  Agent other(model, std::make_shared<ParticleTestTask>());
+  const mjModel* planning_model = agent->GetModel();
+  EXPECT_TRUE(HasResidual(planning_model));
+  EXPECT_TRUE(HasResidual(other.GetModel()));
+
+  // physics model, with the goal error of the active task
+  EXPECT_FALSE(HasResidual(model));
+  agent->RegisterResidualModel(model);
+  data->qpos[0] = 0.5;
+  data->mocap_pos[0] = 0.25;
+  EXPECT_NEAR(ForwardResidual(model, data), 0.25, 1.0e-12);
+  agent->UnregisterResidualModel(model);
+  EXPECT_FALSE(HasResidual(model));
+
+  // destroyed agents unregister their models
+  agent->RegisterResidualModel(model);
+  agent.reset();
+  EXPECT_FALSE(HasResidual(planning_model));
+  EXPECT_FALSE(HasResidual(model));
+  EXPECT_TRUE(HasResidual(other.GetModel()));
+
+  mjcb_sensor = nullptr;
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
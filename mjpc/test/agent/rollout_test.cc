@@ -12,9 +12,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
+#include "mjpc/planners/policy.h"
+#include "mjpc/planners/sampling/policy.h"
 #include "mjpc/task.h"
+#include "mjpc/terminal_value.h"
 #include "mjpc/test/load.h"
 #include "mjpc/trajectory.h"
 #include "mjpc/utilities.h"
@@ -22,6 +29,9 @@
 namespace mjpc {
 namespace {
 
+// rollouts of tasks with termination stop past this x position
+double terminal_position = 0.0;
+
 class ParticleCopyTestTask : public mjpc::Task {
  public:
   ParticleCopyTestTask() : residual_(this) {}
@@ -39,6 +49,9 @@ class ParticleCopyTestTask : public mjpc::Task {
       mju_copy(residual, data->qpos, model->nq);
       mju_copy(residual + model->nq, data->qvel, model->nv);
     }
+    bool Terminated(const mjModel* model, const mjData* data) const override {
+      return data->qpos[0] > terminal_position;
+    }
   };
 
   std::unique_ptr<mjpc::ResidualFn> ResidualLocked() const override {
@@ -58,7 +71,7 @@ void sensor(const mjModel* m, mjData* d, int stage);
 
 // sensor callback
 void sensor(const mjModel* model, mjData* data, int stage) {
-  if (stage == mjSTAGE_ACC) {
+  if (stage == mjSTAGE_ACC && !ResidualSkipped()) {
     task.Residual(model, data, data->sensordata);
   }
 }
@@ -152,5 +165,603 @@ TEST(RolloutTest, Particle) {
   mjcb_sensor = nullptr;
 }
 
+// test branching rollouts from a shared prefix on particle task
+TEST(RolloutTest, SharedPrefix) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+  mjData* prefix_data = mj_makeData(model);
+
+  // set callback
+  mjcb_sensor = sensor;
+
+  // set data
+  mj_forward(model, data);
+
+  // policy
+  SamplingPolicy policy;
+  policy.Allocate(model, task, 4);
+  policy.representation = PolicyRepresentation::kZeroSpline;
+  policy.num_spline_points = 4;
+  double parameters[8] = {0.1, -0.2, 0.3, 0.1, -0.1, 0.2, 0.0, 0.1};
+  mju_copy(policy.parameters.data(), parameters, 8);
+  for (int i = 0; i < 4; i++) {
+    policy.times[i] = 0.1 * i;
+  }
+
+  // trajectories
+  int horizon = 100;
+  int dim_state = model->nq + model->nv + model->na;
+  Trajectory trajectory;
+  Trajectory prefix;
+  Trajectory branch;
+  for (Trajectory* t : {&trajectory, &prefix, &branch}) {
+    t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+    t->Allocate(horizon);
+  }
+
+  // initial state
+  double state[4] = {0.0, 0.0, 0.0, 0.0};
+  double time = 0.0;
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+
+  // full rollout
+  trajectory.Rollout(policy, &task, model, data, state, time, mocap, NULL,
+                     horizon);
+
+  // prefix, then branch
+  int prefix_steps = 25;
+  prefix.RolloutPrefix(policy, &task, model, prefix_data, state, time, mocap,
+                       NULL, horizon, prefix_steps);
+  branch.RolloutFrom(policy, prefix, prefix_steps, prefix_data, &task, model,
+                     data);
+
+  // test
+  for (int t = 0; t < horizon; t++) {
+    for (int i = 0; i < dim_state; i++) {
+      EXPECT_NEAR(branch.states[t * dim_state + i],
+                  trajectory.states[t * dim_state + i], 1.0e-10);
+    }
+    EXPECT_NEAR(branch.costs[t], trajectory.costs[t], 1.0e-10);
+  }
+  EXPECT_NEAR(branch.total_return, trajectory.total_return, 1.0e-10);
+
+  // delete model + data
+  mj_deleteData(prefix_data);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
+// test rollouts in segments from checkpoints on particle task
+TEST(RolloutTest, Segments) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+  mjData* other_data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // policy
+  SamplingPolicy policy;
+  policy.Allocate(model, task, 4);
+  policy.representation = PolicyRepresentation::kCubicSpline;
+  policy.num_spline_points = 4;
+  double parameters[8] = {0.1, -0.2, 0.3, 0.1, -0.1, 0.2, 0.0, 0.1};
+  mju_copy(policy.parameters.data(), parameters, 8);
+  for (int i = 0; i < 4; i++) {
+    policy.times[i] = 0.1 * i;
+  }
+
+  // trajectories
+  int horizon = 60;
+  int dim_state = model->nq + model->nv + model->na;
+  Trajectory trajectory;
+  Trajectory segments;
+  for (Trajectory* t : {&trajectory, &segments}) {
+    t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+    t->Allocate(horizon);
+  }
+  double state[4] = {0.1, -0.1, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+
+  // three segments, alternating mjData, with and without a bound
+  for (bool lean : {false, true}) {
+    segments.lean = lean;
+    ReturnBound bound;
+    bound.Reset(1);
+    for (ReturnBound* b : {static_cast<ReturnBound*>(nullptr), &bound}) {
+      std::vector<double> checkpoint;
+      segments.RolloutSegment(policy, &task, model, data, state, 0.0, mocap,
+                              NULL, horizon, 0, 20, checkpoint, b);
+      double partial_return = segments.PartialReturn();
+      EXPECT_GT(partial_return, 0.0);
+      segments.RolloutSegment(policy, &task, model, other_data, state, 0.0,
+                              mocap, NULL, horizon, 20, 40, checkpoint, b);
+      EXPECT_GT(segments.PartialReturn(), partial_return);
+      segments.RolloutSegment(policy, &task, model, data, state, 0.0, mocap,
+                              NULL, horizon, 40, horizon - 1, checkpoint, b);
+      EXPECT_FALSE(segments.pruned);
+      EXPECT_EQ(segments.num_steps, trajectory.num_steps);
+      EXPECT_NEAR(segments.total_return, trajectory.total_return, 1.0e-10);
+      if (!lean) {
+        for (int i = 0; i < horizon * dim_state; i++) {
+          EXPECT_NEAR(segments.states[i], trajectory.states[i], 1.0e-10);
+        }
+      }
+    }
+  }
+
+  mj_deleteData(other_data);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
+// test discrete-time rollout against a return bound on particle task
+TEST(RolloutTest, DiscreteBound) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // set callback
+  mjcb_sensor = sensor;
+
+  // set data
+  mj_forward(model, data);
+
+  // policy
+  auto policy = [](double* action, const double* state, int index) {
+    mju_scl(action, state, -1.0, 2);
+  };
+
+  // trajectories
+  int horizon = 50;
+  int dim_state = model->nq + model->nv + model->na;
+  Trajectory trajectory;
+  Trajectory bounded;
+  for (Trajectory* t : {&trajectory, &bounded}) {
+    t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+    t->Allocate(horizon);
+  }
+
+  // initial state
+  double state[4] = {0.2, -0.1, 0.0, 0.0};
+  double time = 0.0;
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+
+  // unbounded rollout
+  trajectory.RolloutDiscrete(policy, &task, model, data, state, time, mocap,
+                             NULL, horizon);
+
+  // no completed return, rollout matches and records its return
+  ReturnBound bound;
+  bound.Reset(1);
+  bounded.RolloutDiscrete(policy, &task, model, data, state, time, mocap, NULL,
+                          horizon, &bound);
+  EXPECT_FALSE(bounded.pruned);
+  EXPECT_NEAR(bounded.total_return, trajectory.total_return, 1.0e-10);
+  EXPECT_NEAR(bound.Get(), trajectory.total_return, 1.0e-10);
+
+  // zero bound, first positive cost stops the rollout
+  bound.Reset(1);
+  bound.Update(0.0);
+  bounded.RolloutDiscrete(policy, &task, model, data, state, time, mocap, NULL,
+                          horizon, &bound);
+  EXPECT_TRUE(bounded.pruned);
+  EXPECT_LT(bounded.total_return, trajectory.total_return);
+
+  // delete model + data
+  mj_deleteData(data);
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
+// test lockstep rollouts match independent rollouts on particle task
+TEST(RolloutTest, Lockstep) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // set callback
+  mjcb_sensor = sensor;
+
+  // samples
+  const int n = 3;
+  int horizon = 60;
+  int dim_state = model->nq + model->nv + model->na;
+  mjData* data[n];
+  SamplingPolicy policy[n];
+  Trajectory trajectory[n];
+  Trajectory lockstep[n];
+  Trajectory* lockstep_ptr[n];
+  const SamplingPolicy* policy_ptr[n];
+  for (int i = 0; i < n; i++) {
+    data[i] = mj_makeData(model);
+    mj_forward(model, data[i]);
+    policy[i].Allocate(model, task, 4);
+    policy[i].representation = PolicyRepresentation::kLinearSpline;
+    policy[i].num_spline_points = 4;
+    for (int j = 0; j < 4; j++) {
+      policy[i].times[j] = 0.1 * j;
+      policy[i].parameters[2 * j] = 0.1 * (i + 1);
+      policy[i].parameters[2 * j + 1] = -0.05 * j;
+    }
+    for (Trajectory* t : {&trajectory[i], &lockstep[i]}) {
+      t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+      t->Allocate(horizon);
+    }
+    lockstep_ptr[i] = &lockstep[i];
+    policy_ptr[i] = &policy[i];
+  }
+
+  // initial state
+  double state[4] = {0.1, 0.0, 0.0, 0.0};
+  double time = 0.0;
+  double mocap[7];
+  mju_copy(mocap, data[0]->mocap_pos, 3);
+  mju_copy(mocap + 3, data[0]->mocap_quat, 4);
+
+  // independent rollouts
+  for (int i = 0; i < n; i++) {
+    trajectory[i].Rollout(policy[i], &task, model, data[i], state, time,
+                          mocap, NULL, horizon);
+  }
+
+  // lockstep rollouts
+  Trajectory::RolloutLockstep(lockstep_ptr, policy_ptr, n, &task, model, data,
+                              state, time, mocap, NULL, horizon);
+
+  // test
+  for (int i = 0; i < n; i++) {
+    for (int t = 0; t < horizon; t++) {
+      for (int k = 0; k < dim_state; k++) {
+        EXPECT_NEAR(lockstep[i].states[t * dim_state + k],
+                    trajectory[i].states[t * dim_state + k], 1.0e-10);
+      }
+      EXPECT_NEAR(lockstep[i].costs[t], trajectory[i].costs[t], 1.0e-10);
+    }
+    EXPECT_NEAR(lockstep[i].total_return, trajectory[i].total_return,
+                1.0e-10);
+  }
+
+  // delete model + data
+  for (int i = 0; i < n; i++) {
+    mj_deleteData(data[i]);
+  }
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
+// test residual evaluation every residual_stride steps
+TEST(RolloutTest, ResidualStride) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  task.residual_stride = 3;
+  mjData* data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // trajectory
+  int dim_state = model->nq + model->nv;
+  int num_residual = task.num_residual;
+  Trajectory trajectory;
+  int horizon = 10;
+  trajectory.Initialize(dim_state, model->nu, num_residual, 1, horizon);
+  trajectory.Allocate(horizon);
+
+  // rollout
+  auto policy = [](double* action, const double* state, double time) {
+    action[0] = 1.0;
+    action[1] = -1.0;
+  };
+  double state[4] = {0.0, 0.0, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+
+  // evaluated at steps 0, 3, 6 and the final state, held in between
+  EXPECT_EQ(trajectory.num_steps, horizon - 1);
+  EXPECT_EQ(trajectory.num_residuals, 4);
+  for (int t = 0; t < horizon - 1; t++) {
+    int evaluated = t - t % task.residual_stride;
+    for (int i = 0; i < num_residual; i++) {
+      EXPECT_EQ(trajectory.residual[t * num_residual + i],
+                trajectory.residual[evaluated * num_residual + i]);
+      EXPECT_NEAR(trajectory.residual[evaluated * num_residual + i],
+                  trajectory.states[evaluated * dim_state + i], 1.0e-5);
+    }
+  }
+  EXPECT_FALSE(ResidualSkipped());
+
+  task.residual_stride = 1;
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
+// test the task's terminal value in the return
+TEST(RolloutTest, TerminalValue) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // trajectory
+  int dim_state = model->nq + model->nv;
+  Trajectory trajectory;
+  int horizon = 10;
+  trajectory.Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+  trajectory.Allocate(horizon);
+
+  // rollout without terminal value
+  auto policy = [](double* action, const double* state, double time) {
+    action[0] = 1.0;
+    action[1] = -1.0;
+  };
+  double state[4] = {0.0, 0.0, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+  double stage_return = trajectory.total_return;
+  EXPECT_EQ(trajectory.terminal_value, 0.0);
+
+  // the terminal value of the final state is added to the summed costs
+  task.SetTerminalValue(std::make_shared<QuadraticTerminalValue>(
+      std::vector<double>{0.0, 0.0},
+      std::vector<double>{2.0, 0.0, 0.0, 2.0}, 1.0));
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+  const double* final_state = trajectory.states.data() +
+                              (horizon - 1) * dim_state;
+  double value = mju_dot(final_state, final_state, 2) + 1.0;
+  EXPECT_NEAR(trajectory.terminal_value, value, 1.0e-12);
+  EXPECT_NEAR(trajectory.total_return, stage_return + value / horizon,
+              1.0e-12);
+
+  // same return with a bound
+  ReturnBound bound;
+  bound.Reset(1);
+  double unbounded_return = trajectory.total_return;
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon, &bound);
+  EXPECT_NEAR(trajectory.total_return, unbounded_return, 1.0e-12);
+
+  task.SetTerminalValue(nullptr);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
+// test lean rollouts, which only compute the return and final state
+TEST(RolloutTest, Lean) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  task.residual_stride = 2;
+  mjData* data = mj_makeData(model);
+  mjData* prefix_data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // policy
+  SamplingPolicy policy;
+  policy.Allocate(model, task, 4);
+  policy.representation = PolicyRepresentation::kZeroSpline;
+  policy.num_spline_points = 4;
+  double parameters[8] = {0.1, -0.2, 0.3, 0.1, -0.1, 0.2, 0.0, 0.1};
+  mju_copy(policy.parameters.data(), parameters, 8);
+  for (int i = 0; i < 4; i++) {
+    policy.times[i] = 0.1 * i;
+  }
+
+  // trajectories
+  int horizon = 50;
+  int dim_state = model->nq + model->nv + model->na;
+  Trajectory trajectory;
+  Trajectory lean;
+  Trajectory prefix;
+  for (Trajectory* t : {&trajectory, &lean, &prefix}) {
+    t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+    t->Allocate(horizon);
+  }
+  lean.lean = true;
+
+  // initial state
+  double state[4] = {0.1, -0.1, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+
+  // same return, final state and evaluations as a full rollout
+  task.SetTerminalValue(std::make_shared<QuadraticTerminalValue>(
+      std::vector<double>{0.0, 0.0},
+      std::vector<double>{2.0, 0.0, 0.0, 2.0}, 1.0));
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+  lean.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL, horizon);
+  EXPECT_NEAR(lean.total_return, trajectory.total_return, 1.0e-12);
+  EXPECT_NEAR(lean.terminal_value, trajectory.terminal_value, 1.0e-12);
+  EXPECT_EQ(lean.num_steps, trajectory.num_steps);
+  EXPECT_EQ(lean.num_residuals, trajectory.num_residuals);
+  for (int i = 0; i < dim_state; i++) {
+    EXPECT_NEAR(lean.states[(horizon - 1) * dim_state + i],
+                trajectory.states[(horizon - 1) * dim_state + i], 1.0e-12);
+  }
+
+  // and with a bound
+  ReturnBound bound;
+  bound.Reset(1);
+  lean.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL, horizon,
+               &bound);
+  EXPECT_FALSE(lean.pruned);
+  EXPECT_NEAR(lean.total_return, trajectory.total_return, 1.0e-12);
+
+  // branching from a shared prefix
+  int prefix_steps = 15;
+  prefix.RolloutPrefix(policy, &task, model, prefix_data, state, 0.0, mocap,
+                       NULL, horizon, prefix_steps);
+  lean.RolloutFrom(policy, prefix, prefix_steps, prefix_data, &task, model,
+                   data);
+  EXPECT_NEAR(lean.total_return, trajectory.total_return, 1.0e-10);
+
+  task.SetTerminalValue(nullptr);
+  task.residual_stride = 1;
+  mj_deleteData(prefix_data);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
+// test rollouts stopping at a terminal state of the task
+TEST(RolloutTest, Termination) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // trajectory
+  int dim_state = model->nq + model->nv;
+  Trajectory trajectory;
+  int horizon = 100;
+  trajectory.Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+  trajectory.Allocate(horizon);
+
+  // rollout
+  auto policy = [](double* action, const double* state, double time) {
+    action[0] = 1.0;
+    action[1] = 0.0;
+  };
+  double state[4] = {0.0, 0.0, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+
+  // terminal states are only checked with termination
+  terminal_position = 0.01;
+  trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                     horizon);
+  EXPECT_FALSE(trajectory.failure);
+  EXPECT_EQ(trajectory.num_steps, horizon - 1);
+
+  // stops at the first terminal state with the failure cost, lean or not
+  task.termination = true;
+  task.failure_cost = 123.0;
+  for (bool lean : {false, true}) {
+    trajectory.lean = lean;
+    trajectory.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                       horizon);
+    EXPECT_TRUE(trajectory.failure);
+    EXPECT_EQ(trajectory.total_return, 123.0);
+    EXPECT_LT(trajectory.num_steps, horizon - 1);
+    EXPECT_GT(data->qpos[0], terminal_position);
+  }
+
+  task.Reset(model);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
+// test recording and injecting constraint solver warm starts
+TEST(RolloutTest, WarmStart) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+  mjcb_sensor = sensor;
+  mj_forward(model, data);
+
+  // trajectories
+  int nv = model->nv;
+  int dim_state = model->nq + model->nv;
+  int horizon = 20;
+  Trajectory nominal;
+  Trajectory sample;
+  for (Trajectory* t : {&nominal, &sample}) {
+    t->Initialize(dim_state, model->nu, task.num_residual, 1, horizon);
+    t->Allocate(horizon);
+    t->record_warmstart = true;
+  }
+
+  auto policy = [](double* action, const double* state, double time) {
+    action[0] = 1.0;
+    action[1] = -1.0;
+  };
+  double state[4] = {0.0, 0.0, 0.0, 0.0};
+  double mocap[7];
+  mju_copy(mocap, data->mocap_pos, 3);
+  mju_copy(mocap + 3, data->mocap_quat, 4);
+
+  // the first row is the warm start in data
+  for (int i = 0; i < nv; i++) data->qacc_warmstart[i] = 0.5 * i;
+  nominal.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                  horizon);
+  ASSERT_EQ(static_cast<int>(nominal.warmstart.size()), horizon * nv);
+  for (int i = 0; i < nv; i++) {
+    EXPECT_EQ(nominal.warmstart[i], 0.5 * i);
+  }
+
+  // every step from the rows of the nominal shifted by 3
+  WarmStartSource source;
+  source.qacc = nominal.warmstart.data();
+  source.steps = horizon;
+  source.shift = 3;
+  source.every_step = true;
+  sample.warmstart_source = source;
+  mju_zero(data->qacc_warmstart, nv);
+  sample.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                 horizon);
+  for (int t = 0; t < horizon - 1; t++) {
+    int row = std::min(t + 3, horizon - 1);
+    for (int i = 0; i < nv; i++) {
+      EXPECT_EQ(sample.warmstart[t * nv + i], nominal.warmstart[row * nv + i]);
+    }
+  }
+
+  // only the first step
+  source.every_step = false;
+  sample.warmstart_source = source;
+  sample.Rollout(policy, &task, model, data, state, 0.0, mocap, NULL,
+                 horizon);
+  for (int i = 0; i < nv; i++) {
+    EXPECT_EQ(sample.warmstart[i], nominal.warmstart[3 * nv + i]);
+  }
+  EXPECT_EQ(source.Row(1, nv), nullptr);
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  mjcb_sensor = nullptr;
+}
+
 }  // namespace
 }  // namespace mjpc
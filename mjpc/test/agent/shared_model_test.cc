@@ -0,0 +1,84 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/shared_model.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/test/load.h"
+
+namespace mjpc {
+namespace {
+
+TEST(SharedModelTest, ShareModel) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjModel* other = LoadTestModel("particle_task.xml");
+
+  // one shared copy for the same model
+  std::shared_ptr<const mjModel> shared = ShareModel(model);
+  EXPECT_NE(shared.get(), model);
+  EXPECT_EQ(ShareModel(other), shared);
+
+  // a different model
+  other->body_mass[1] += 1.0;
+  EXPECT_NE(ShareModel(other), shared);
+
+  mj_deleteModel(other);
+  mj_deleteModel(model);
+}
+
+TEST(SharedModelTest, CopyOnWrite) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  std::shared_ptr<const mjModel> shared = ShareModel(model);
+  SharedModel copy(shared);
+
+  // header is private, arrays are shared
+  copy.get()->opt.timestep = 2 * shared->opt.timestep;
+  EXPECT_EQ(shared->opt.timestep, model->opt.timestep);
+  EXPECT_EQ(copy.get()->geom_size, shared->geom_size);
+  EXPECT_EQ(copy.MutableSize(), 0u);
+
+  // private array
+  double* mass =
+      static_cast<double*>(copy.MakeMutable(copy.get()->body_mass + 1));
+  ASSERT_NE(mass, nullptr);
+  EXPECT_EQ(mass, copy.get()->body_mass + 1);
+  EXPECT_NE(copy.get()->body_mass, shared->body_mass);
+  *mass += 1.0;
+  EXPECT_EQ(shared->body_mass[1], model->body_mass[1]);
+  EXPECT_EQ(copy.MakeMutable(mass), mass);
+  EXPECT_EQ(copy.MutableSize(), sizeof(double) * model->nbody);
+
+  // not a model array
+  double value;
+  EXPECT_EQ(copy.MakeMutable(&value), nullptr);
+
+  // private copies are shared with copies of the same content
+  SharedModel full(model);
+  full.MakeAllMutable();
+  EXPECT_NE(full.get()->geom_size, model->geom_size);
+  EXPECT_EQ(ShareModel(full.get()), shared);
+
+  // simulate
+  mjData* data = mj_makeData(copy.get());
+  mj_step(copy.get(), data);
+  mj_deleteData(data);
+
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
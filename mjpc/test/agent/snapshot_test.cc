@@ -0,0 +1,105 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+// test that sections are read back as written
+TEST(SnapshotTest, RoundTrip) {
+  SnapshotWriter writer;
+  std::vector<double> values = {1.0, -2.0, 3.5};
+  writer.Add("values", values);
+  writer.Add("a.longer.section.name", 7.0);
+  writer.Add("empty", values.data(), 0);
+
+  SnapshotReader reader;
+  ASSERT_TRUE(reader.Parse(writer.Bytes()));
+  EXPECT_EQ(reader.Size("values"), 3);
+  EXPECT_EQ(reader.Size("empty"), 0);
+  EXPECT_EQ(reader.Size("missing"), -1);
+
+  std::vector<double> read(3);
+  EXPECT_TRUE(reader.Read("values", read.data(), 3));
+  EXPECT_EQ(read, values);
+  EXPECT_FALSE(reader.Read("values", read.data(), 2));
+  EXPECT_EQ(reader.Get("a.longer.section.name", 0.0), 7.0);
+  EXPECT_EQ(reader.Get("missing", -1.0), -1.0);
+
+  // values are 8-byte aligned within the snapshot
+  const std::string& bytes = writer.Bytes();
+  EXPECT_EQ((reader.Data("values") - bytes.data()) % 8, 0);
+  EXPECT_EQ((reader.Data("a.longer.section.name") - bytes.data()) % 8, 0);
+}
+
+// test that only time sections are shifted
+TEST(SnapshotTest, ShiftTimes) {
+  SnapshotWriter writer;
+  writer.Add("policy.times", std::vector<double>{1.0, 2.0});
+  writer.Add("times", 3.0);
+  writer.Add("policy.parameters", std::vector<double>{1.0, 2.0});
+  writer.Add("lifetimes", 4.0);
+  std::string bytes = writer.Bytes();
+  ASSERT_TRUE(ShiftSnapshotTimes(bytes, 0.5));
+
+  SnapshotReader reader;
+  ASSERT_TRUE(reader.Parse(bytes));
+  std::vector<double> read(2);
+  reader.Read("policy.times", read.data(), 2);
+  EXPECT_EQ(read, (std::vector<double>{1.5, 2.5}));
+  EXPECT_EQ(reader.Get("times", 0.0), 3.5);
+  reader.Read("policy.parameters", read.data(), 2);
+  EXPECT_EQ(read, (std::vector<double>{1.0, 2.0}));
+  EXPECT_EQ(reader.Get("lifetimes", 0.0), 4.0);
+
+  std::string invalid = "not a snapshot";
+  EXPECT_FALSE(ShiftSnapshotTimes(invalid, 0.5));
+}
+
+// test that other data isn't parsed
+TEST(SnapshotTest, Invalid) {
+  SnapshotWriter writer;
+  writer.Add("values", 1.0);
+  std::string bytes = writer.Bytes();
+  SnapshotReader reader;
+
+  // truncated
+  EXPECT_FALSE(reader.Parse(bytes.substr(0, bytes.size() - 1)));
+  EXPECT_FALSE(reader.Parse(bytes.substr(0, 4)));
+
+  // other version
+  std::string version = bytes;
+  std::uint32_t other = kSnapshotVersion + 1;
+  std::memcpy(version.data() + 8, &other, sizeof(other));
+  EXPECT_FALSE(reader.Parse(version));
+
+  // not a snapshot
+  std::string magic = bytes;
+  magic[0] = 'X';
+  EXPECT_FALSE(reader.Parse(magic));
+  EXPECT_EQ(reader.Size("values"), -1);
+
+  EXPECT_TRUE(reader.Parse(bytes));
+}
+
+}  // namespace
+}  // namespace mjpc
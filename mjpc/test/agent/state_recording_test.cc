@@ -0,0 +1,101 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/state_recording.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/states/state.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+
+namespace mjpc {
+namespace {
+
+std::string TempPath(const std::string& name) {
+  return ::testing::TempDir() + name;
+}
+
+RecordedState Record(int i) {
+  RecordedState record;
+  record.time = 0.1 * i;
+  record.state = {1.0 * i, 2.0 * i, 3.0 * i, 4.0 * i};
+  record.mocap = {0.0, 0.0, 1.0 * i, 1.0, 0.0, 0.0, 0.0};
+  record.userdata = {-1.0 * i};
+  record.parameters = {0.5 * i, 0.25 * i};
+  return record;
+}
+
+// test that records are read back as written
+TEST(StateRecordingTest, RoundTrip) {
+  std::string path = TempPath("state_recording_test_round_trip.bin");
+  std::vector<RecordedState> records;
+  for (int i = 0; i < 5; i++) records.push_back(Record(i));
+  ASSERT_TRUE(WriteStateRecording(path, records));
+
+  std::vector<RecordedState> read;
+  ASSERT_TRUE(ReadStateRecording(path, &read));
+  ASSERT_EQ(read.size(), records.size());
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(read[i].time, records[i].time);
+    EXPECT_EQ(read[i].state, records[i].state);
+    EXPECT_EQ(read[i].mocap, records[i].mocap);
+    EXPECT_EQ(read[i].userdata, records[i].userdata);
+    EXPECT_EQ(read[i].parameters, records[i].parameters);
+  }
+
+  // records of different sizes aren't written, other files aren't read
+  records[2].userdata.push_back(0.0);
+  EXPECT_FALSE(WriteStateRecording(path, records));
+  std::string other = TempPath("state_recording_test_other.bin");
+  std::ofstream(other) << "not a recording";
+  EXPECT_FALSE(ReadStateRecording(other, &read));
+}
+
+// test that a recorded agent state is restored
+TEST(StateRecordingTest, Restore) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  ParticleTestTask task;
+  task.Reset(model);
+
+  for (int i = 0; i < model->nq; i++) data->qpos[i] = 0.1 * (i + 1);
+  for (int i = 0; i < model->nv; i++) data->qvel[i] = -0.2 * (i + 1);
+  data->time = 1.5;
+  State state;
+  state.Allocate(model);
+  state.Set(model, data);
+  RecordedState record = RecordedState::From(state, task);
+
+  State restored;
+  restored.Allocate(model);
+  ASSERT_TRUE(record.Restore(model, restored, task));
+  EXPECT_EQ(restored.state(), state.state());
+  EXPECT_EQ(restored.mocap(), state.mocap());
+  EXPECT_EQ(restored.time(), 1.5);
+
+  // a record of another model
+  record.state.push_back(0.0);
+  EXPECT_FALSE(record.Restore(model, restored, task));
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
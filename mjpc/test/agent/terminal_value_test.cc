@@ -0,0 +1,60 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/terminal_value.h"
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+TEST(TerminalValueTest, Quadratic) {
+  // 0.5 * (x - c)' [2 1; 1 4] (x - c) + 3
+  QuadraticTerminalValue value({1.0, -1.0}, {2.0, 1.0, 1.0, 4.0}, 3.0);
+  double center[2] = {1.0, -1.0};
+  EXPECT_EQ(value.Value(center), 3.0);
+
+  // trailing state coordinates are ignored
+  double state[3] = {2.0, 0.0, 100.0};
+  EXPECT_NEAR(value.Value(state), 0.5 * (2.0 + 2.0 + 4.0) + 3.0, 1.0e-12);
+
+  // batch
+  double states[6] = {1.0, -1.0, 0.0, 2.0, 0.0, 0.0};
+  double values[2];
+  value.Values(values, states, 3, 2);
+  EXPECT_EQ(values[0], 3.0);
+  EXPECT_NEAR(values[1], 7.0, 1.0e-12);
+}
+
+TEST(TerminalValueTest, Grid) {
+  // values state[2] + 10 * state[0] on a 3 x 2 grid over state[2] in
+  // [0, 2] and state[0] in [0, 1]
+  GridTerminalValue value({2, 0}, {0.0, 0.0}, {2.0, 1.0}, {3, 2},
+                          {0.0, 10.0, 1.0, 11.0, 2.0, 12.0});
+
+  // grid points
+  double point[3] = {1.0, 0.0, 2.0};
+  EXPECT_NEAR(value.Value(point), 12.0, 1.0e-12);
+
+  // multilinear functions are interpolated exactly
+  double state[3] = {0.25, 0.0, 1.5};
+  EXPECT_NEAR(value.Value(state), 1.5 + 2.5, 1.0e-12);
+
+  // clamped outside the grid
+  double outside[3] = {-1.0, 0.0, 5.0};
+  EXPECT_NEAR(value.Value(outside), 2.0, 1.0e-12);
+}
+
+}  // namespace
+}  // namespace mjpc
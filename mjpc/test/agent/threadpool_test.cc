@@ -14,8 +14,15 @@
 
 #include "mjpc/threadpool.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
+#include "mjpc/test/allocation_counter.h"
 
 namespace mjpc {
 namespace {
@@ -44,5 +51,373 @@ TEST(ThreadPoolTest, Count) {
   }
 }
 
+// test parallel for loop
+TEST(ThreadPoolTest, ParallelFor) {
+  // pool
+  ThreadPool pool(4);
+
+  // count
+  std::vector<int> count(103, 0);
+
+  // run
+  pool.ParallelFor(0, 103, 8, [&count](int i) { count[i] += i; });
+
+  // test
+  for (int i = 0; i < 103; i++) {
+    EXPECT_EQ(count[i], i);
+  }
+
+  // ParallelFor does not change the task count
+  EXPECT_EQ(pool.GetCount(), 0);
+}
+
+// test nested parallel for loops
+TEST(ThreadPoolTest, ParallelForNested) {
+  // pool
+  ThreadPool pool(2);
+
+  // count
+  std::atomic<int> count = 0;
+
+  // run
+  pool.ParallelFor(0, 4, 1, [&pool, &count](int i) {
+    EXPECT_GE(ThreadPool::WorkerId(), 0);
+    pool.ParallelFor(0, 10, 1, [&count](int j) { count += j; });
+  });
+
+  // test
+  EXPECT_EQ(count.load(), 4 * 45);
+}
+
+// test task groups sharing one pool
+TEST(ThreadPoolTest, TaskGroup) {
+  // pool
+  ThreadPool pool(2);
+
+  // count
+  std::atomic<int> count_a = 0;
+  std::atomic<int> count_b = 0;
+
+  // run two groups from separate threads
+  std::thread thread_a([&pool, &count_a]() {
+    TaskGroup group(pool);
+    for (int i = 0; i < 50; i++) {
+      group.Schedule([&count_a]() { count_a++; });
+    }
+    group.Wait();
+    EXPECT_EQ(count_a.load(), 50);
+  });
+  {
+    TaskGroup group(pool);
+    for (int i = 0; i < 30; i++) {
+      group.Schedule([&count_b]() { count_b++; });
+    }
+    group.Wait();
+    EXPECT_EQ(count_b.load(), 30);
+  }
+  thread_a.join();
+
+  // groups do not change the task count
+  EXPECT_EQ(pool.GetCount(), 0);
+}
+
+// test task group waited on from a worker
+TEST(ThreadPoolTest, TaskGroupNested) {
+  // pool
+  ThreadPool pool(1);
+
+  // count
+  int count = 0;
+
+  // run
+  TaskGroup outer(pool);
+  outer.Schedule([&pool, &count]() {
+    TaskGroup inner(pool);
+    for (int i = 0; i < 3; i++) {
+      inner.Schedule([&count]() { count++; });
+    }
+    inner.Wait();
+  });
+  outer.Wait();
+
+  // test
+  EXPECT_EQ(count, 3);
+}
+
+// test tasks pinned to a worker
+TEST(ThreadPoolTest, ScheduleOnWorker) {
+  // pool
+  ThreadPool pool(3);
+
+  // worker of each task
+  std::vector<int> worker(12, -1);
+
+  // run, with unpinned tasks that may be stolen
+  {
+    TaskGroup group(pool);
+    for (int i = 0; i < 12; i++) {
+      group.ScheduleOnWorker(
+          i, [&worker, i]() { worker[i] = ThreadPool::WorkerId(); });
+      group.Schedule([]() {});
+    }
+  }
+
+  // test
+  for (int i = 0; i < 12; i++) {
+    EXPECT_EQ(worker[i], i % 3);
+  }
+}
+
+// test that a warm pool schedules without allocating
+TEST(ThreadPoolTest, SteadyStateAllocations) {
+  // pool
+  ThreadPool pool(2);
+
+  // loops with more captures than a std::function stores inline, tasks
+  // with fewer, and loops nested in a worker
+  std::vector<int> count(64, 0);
+  int a = 1, b = 2, c = 3;
+  std::atomic<int> tasks = 0;
+  auto iteration = [&]() {
+    pool.ParallelFor(0, 64, 4, [&](int i) { count[i] += a + b + c; });
+    TaskGroup group(pool);
+    for (int i = 0; i < 8; i++) {
+      group.Schedule([&tasks]() { tasks++; });
+    }
+    group.Schedule([&pool, &count]() {
+      pool.ParallelFor(0, 8, 1, [&count](int i) { count[i]++; });
+    });
+    group.Wait();
+  };
+
+  // warm up queues and shared states
+  for (int k = 0; k < 1000; k++) iteration();
+
+  // steady state
+  std::int64_t allocations;
+  {
+    AllocationCounter counter;
+    for (int k = 0; k < 100; k++) iteration();
+    allocations = counter.count();
+  }
+
+  // test
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(tasks.load(), 8 * 1100);
+  EXPECT_EQ(count[0], 1100 * 7);
+  EXPECT_EQ(count[63], 1100 * 6);
+}
+
+// test that queued tasks of higher priority lanes run first
+TEST(ThreadPoolTest, Priority) {
+  ThreadPool pool(1);
+
+  // block the worker while tasks are queued
+  std::atomic<bool> started = false;
+  std::atomic<bool> release = false;
+  pool.Schedule([&]() {
+    started = true;
+    while (!release.load()) std::this_thread::yield();
+  });
+  while (!started.load()) std::this_thread::yield();
+
+  // queue tasks of each lane, lowest first
+  std::vector<int> order;
+  TaskGroup low(pool, TaskPriority::kLow);
+  TaskGroup normal(pool);
+  TaskGroup high(pool, TaskPriority::kHigh);
+  for (int i = 0; i < 3; i++) {
+    low.Schedule([&order]() { order.push_back(2); });
+    normal.Schedule([&order]() { order.push_back(1); });
+    high.Schedule([&order]() { order.push_back(0); });
+  }
+  EXPECT_EQ(pool.QueueDepth(TaskPriority::kHigh), 3);
+  EXPECT_EQ(pool.QueueDepth(TaskPriority::kLow), 3);
+  EXPECT_EQ(pool.QueueDepth(), 9);
+
+  // run
+  release = true;
+  low.Wait();
+  normal.Wait();
+  high.Wait();
+
+  // test
+  EXPECT_EQ(order, std::vector<int>({0, 0, 0, 1, 1, 1, 2, 2, 2}));
+  EXPECT_EQ(pool.QueueDepth(), 0);
+
+  // helpers of a high priority loop
+  std::vector<int> count(16, 0);
+  pool.ParallelFor(0, 16, 1, TaskPriority::kHigh,
+                   [&count](int i) { count[i]++; });
+  for (int c : count) EXPECT_EQ(c, 1);
+}
+
+// test waits with and without spinning before parking
+TEST(ThreadPoolTest, Spin) {
+  for (int spin : {0, kDefaultSpinMicroseconds, 10000}) {
+    ThreadPool pool(2);
+    pool.SetSpinMicroseconds(spin);
+    EXPECT_EQ(pool.SpinMicroseconds(), spin);
+
+    // loops, groups and counted tasks complete
+    std::vector<int> count(8, 0);
+    for (int k = 0; k < 100; k++) {
+      pool.ParallelFor(0, 8, 1, [&count](int i) { count[i]++; });
+      TaskGroup group(pool);
+      group.Schedule([&count]() { count[0]++; });
+      group.Wait();
+    }
+    int count_before = pool.GetCount();
+    pool.Schedule([&count]() { count[1]++; });
+    pool.WaitCount(count_before + 1);
+
+    // test
+    EXPECT_EQ(count[0], 200);
+    EXPECT_EQ(count[1], 101);
+    EXPECT_EQ(count[7], 100);
+  }
+}
+
+// test futures and their continuations
+TEST(ThreadPoolTest, Future) {
+  for (int num_threads : {0, 1, 4}) {
+    ThreadPool pool(num_threads);
+
+    // chains: a[t] -> b[t] -> c[t], each after its own predecessor only
+    constexpr int kSteps = 16;
+    std::vector<int> a(kSteps, 0), b(kSteps, 0), c(kSteps, 0);
+    std::vector<TaskFuture> futures;
+    for (int t = 0; t < kSteps; t++) {
+      TaskFuture first = pool.Async([&a, t]() { a[t] = t; });
+      TaskFuture second = first.Then([&a, &b, t]() { b[t] = a[t] + 1; });
+      futures.push_back(second.Then([&b, &c, t]() { c[t] = 2 * b[t]; }));
+    }
+
+    // join
+    int sum = 0;
+    TaskFuture all = pool.WhenAll(futures).Then([&]() {
+      for (int t = 0; t < kSteps; t++) sum += c[t];
+    });
+    all.Wait();
+
+    // test
+    EXPECT_TRUE(all.Ready());
+    for (const TaskFuture& future : futures) EXPECT_TRUE(future.Ready());
+    for (int t = 0; t < kSteps; t++) EXPECT_EQ(c[t], 2 * (t + 1));
+    EXPECT_EQ(sum, kSteps * (kSteps + 1));
+
+    // continuation of a completed future runs, empty joins are ready
+    int late = 0;
+    all.Then([&late]() { late = 1; }).Wait();
+    EXPECT_EQ(late, 1);
+    EXPECT_TRUE(pool.WhenAll({}).Ready());
+    EXPECT_FALSE(TaskFuture().Valid());
+  }
+}
+
+// test that futures don't allocate once the pool is warm
+TEST(ThreadPoolTest, FutureSteadyStateAllocations) {
+  ThreadPool pool(2);
+  std::vector<TaskFuture> futures;
+  futures.reserve(8);
+  std::atomic<int> count = 0;
+  auto iteration = [&]() {
+    futures.clear();
+    for (int i = 0; i < 8; i++) {
+      futures.push_back(pool.Async([&count]() { count++; }).Then([&count]() {
+        count++;
+      }));
+    }
+    pool.WhenAll(futures).Wait();
+  };
+
+  // warm up queues and shared states
+  for (int k = 0; k < 1000; k++) iteration();
+
+  // steady state
+  std::int64_t allocations;
+  {
+    AllocationCounter counter;
+    for (int k = 0; k < 100; k++) iteration();
+    allocations = counter.count();
+  }
+
+  // test
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(count.load(), 2 * 8 * 1100);
+}
+
+// test that thread quotas bound the threads of parallel loops
+TEST(ThreadPoolTest, Quota) {
+  ThreadPool pool(4);
+
+  // loop that records the largest number of concurrent iterations
+  std::atomic<int> active = 0;
+  std::atomic<int> max_active = 0;
+  auto loop = [&]() {
+    pool.ParallelFor(0, 32, 1, [&](int i) {
+      int current = ++active;
+      int previous = max_active.load();
+      while (current > previous &&
+             !max_active.compare_exchange_weak(previous, current)) {
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      --active;
+    });
+  };
+
+  // quotas of the calling thread, nested quotas take the smaller one
+  {
+    ThreadQuota quota(2);
+    EXPECT_EQ(ThreadQuota::Current(), 2);
+    {
+      ThreadQuota larger(3);
+      EXPECT_EQ(ThreadQuota::Current(), 2);
+    }
+    loop();
+  }
+  EXPECT_EQ(ThreadQuota::Current(), 0);
+  EXPECT_LE(max_active.load(), 2);
+
+  // tasks inherit the quota of the thread that scheduled them
+  max_active = 0;
+  {
+    ThreadQuota quota(1);
+    TaskGroup group(pool);
+    group.Schedule([&]() {
+      EXPECT_EQ(ThreadQuota::Current(), 1);
+      loop();
+    });
+  }
+  EXPECT_EQ(max_active.load(), 1);
+
+  // the shared pool is one pool
+  EXPECT_EQ(&SharedThreadPool(), &SharedThreadPool());
+  EXPECT_GE(SharedThreadPool().NumThreads(), 1);
+}
+
+// test cpu list parsing
+TEST(ThreadPoolTest, CpuList) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-3,8,2\n", &cpus));
+  EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 3, 8}));
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+
+  // options select nothing by default
+  EXPECT_TRUE(ThreadPoolAffinity().Cpus().empty());
+
+  // excluded cpus are not selected
+  ThreadPoolAffinity affinity;
+  affinity.cpus = "0-3";
+  affinity.exclude = "1";
+  for (int cpu : affinity.Cpus()) {
+    EXPECT_NE(cpu, 1);
+    EXPECT_LE(cpu, 3);
+  }
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -14,6 +14,8 @@
 
 #include "mjpc/trajectory.h"
 
+#include <limits>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
 
@@ -107,5 +109,133 @@ TEST(TrajectoryTest, Copy) {
               0.0, 1.0e-5);
 }
 
+// test copying the horizon of a trajectory
+TEST(TrajectoryTest, CopyFrom) {
+  // trajectory with a larger allocation than its horizon
+  Trajectory trajectory;
+  trajectory.Initialize(2, 2, 2, 1, 2);
+  trajectory.Allocate(4);
+  mju_fill(trajectory.states.data(), 1.0, 2 * 4);
+  mju_fill(trajectory.actions.data(), 1.0, 2 * 4);
+  mju_fill(trajectory.times.data(), 1.0, 4);
+  mju_fill(trajectory.costs.data(), 1.0, 4);
+  trajectory.total_return = 1.0;
+
+  // copy into an allocated trajectory: the steps after the horizon are kept
+  Trajectory allocated;
+  allocated.Initialize(2, 2, 2, 1, 4);
+  allocated.Allocate(4);
+  allocated.CopyFrom(trajectory);
+  EXPECT_EQ(allocated.horizon, 2);
+  EXPECT_EQ(allocated.states.size(), 2 * 4);
+  EXPECT_EQ(allocated.states[2 * 2 - 1], 1.0);
+  EXPECT_EQ(allocated.states[2 * 2], 0.0);
+  EXPECT_EQ(allocated.actions[2 * 2 - 1], 1.0);
+  EXPECT_EQ(allocated.times[1], 1.0);
+  EXPECT_EQ(allocated.times[2], 0.0);
+  EXPECT_EQ(allocated.costs[1], 1.0);
+  EXPECT_EQ(allocated.total_return, 1.0);
+
+  // copy into an empty trajectory: the horizon is allocated
+  Trajectory empty;
+  empty.CopyFrom(trajectory);
+  EXPECT_EQ(empty.dim_state, 2);
+  EXPECT_EQ(empty.states.size(), 2 * 2);
+  EXPECT_EQ(empty.trace.size(), 3 * 2);
+  EXPECT_EQ(empty.times[1], 1.0);
+  EXPECT_EQ(empty.total_return, 1.0);
+}
+
+// test ranking by total return
+TEST(TrajectoryTest, Rank) {
+  // trajectories
+  Trajectory trajectory[5];
+  double total_return[5] = {3.0, 1.0, 4.0, 0.5, 2.0};
+  for (int i = 0; i < 5; i++) {
+    trajectory[i].total_return = total_return[i];
+  }
+
+  // rank best two
+  int order[5];
+  double returns[5];
+  RankTrajectories(order, returns, trajectory, 5, 2);
+
+  // test
+  EXPECT_EQ(order[0], 3);
+  EXPECT_EQ(order[1], 1);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(returns[i], total_return[i]);
+  }
+
+  // rank all
+  RankTrajectories(order, returns, trajectory, 5, 5);
+  int expected[5] = {3, 1, 4, 0, 2};
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(order[i], expected[i]);
+  }
+}
+
+// test selection by total return
+TEST(TrajectoryTest, Select) {
+  // trajectories
+  Trajectory trajectory[5];
+  double total_return[5] = {3.0, 1.0, 4.0, 0.5, 2.0};
+  for (int i = 0; i < 5; i++) {
+    trajectory[i].total_return = total_return[i];
+  }
+
+  // select best three
+  int order[5];
+  double returns[5];
+  SelectTrajectories(order, returns, trajectory, 5, 3);
+
+  // best first, then the other selected in any order
+  EXPECT_EQ(order[0], 3);
+  EXPECT_TRUE((order[1] == 1 && order[2] == 4) ||
+              (order[1] == 4 && order[2] == 1));
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(returns[i], total_return[i]);
+  }
+
+  // select all
+  SelectTrajectories(order, returns, trajectory, 5, 5);
+  EXPECT_EQ(order[0], 3);
+}
+
+// test running bound on k-th best return
+TEST(TrajectoryTest, ReturnBound) {
+  ReturnBound bound;
+  bound.Reset(2);
+
+  // infinite until two returns are recorded
+  EXPECT_EQ(bound.Get(), std::numeric_limits<double>::infinity());
+  bound.Update(3.0);
+  EXPECT_EQ(bound.Get(), std::numeric_limits<double>::infinity());
+
+  // second best
+  bound.Update(5.0);
+  EXPECT_EQ(bound.Get(), 5.0);
+  bound.Update(1.0);
+  EXPECT_EQ(bound.Get(), 3.0);
+  bound.Update(4.0);
+  EXPECT_EQ(bound.Get(), 3.0);
+  bound.Update(2.0);
+  EXPECT_EQ(bound.Get(), 2.0);
+
+  // reset
+  bound.Reset(1);
+  EXPECT_EQ(bound.Get(), std::numeric_limits<double>::infinity());
+  bound.Update(6.0);
+  EXPECT_EQ(bound.Get(), 6.0);
+
+  // cancel, until the next reset
+  bound.Cancel();
+  EXPECT_EQ(bound.Get(), -std::numeric_limits<double>::infinity());
+  bound.Update(0.0);
+  EXPECT_EQ(bound.Get(), -std::numeric_limits<double>::infinity());
+  bound.Reset(1);
+  EXPECT_EQ(bound.Get(), std::numeric_limits<double>::infinity());
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -0,0 +1,42 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Heap allocation counting for tests of allocation-free code paths. Linking
+// the allocation_counter library replaces the global operator new and
+// delete of the test binary. MuJoCo's arena and mju_malloc are not counted.
+
+#ifndef MJPC_TEST_ALLOCATION_COUNTER_H_
+#define MJPC_TEST_ALLOCATION_COUNTER_H_
+
+#include <cstdint>
+
+namespace mjpc {
+
+// counts operator new calls on all threads, e.g., of pool workers, while in
+// scope. counters don't nest.
+class AllocationCounter {
+ public:
+  AllocationCounter();
+  ~AllocationCounter();
+
+  AllocationCounter(const AllocationCounter&) = delete;
+  AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+  // allocations since construction
+  std::int64_t count() const;
+};
+
+}  // namespace mjpc
+
+#endif  // MJPC_TEST_ALLOCATION_COUNTER_H_
@@ -0,0 +1,122 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/direct/offline.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+#include "gtest/gtest.h"
+#include "mjpc/direct/direct.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/simulation.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+namespace {
+
+// log of a rollout, configurations perturbed as initial guess
+DirectLog RolloutLog(const mjModel* model, const Simulation& sim, int T,
+                     int sensor_start, int ns) {
+  int nq = model->nq, nv = model->nv;
+  DirectLog log;
+  log.length = T;
+  log.configuration.resize(nq * T);
+  log.times.resize(T);
+  log.sensor_measurement.resize(ns * T);
+  log.force_measurement.resize(nv * T);
+  for (int t = 0; t < T; t++) {
+    mju_copy(log.configuration.data() + nq * t, sim.qpos.Get(t), nq);
+    log.configuration[nq * t] += 1.0e-3 * (t % 3 - 1);
+    log.times[t] = sim.time.Get(t)[0];
+    mju_copy(log.sensor_measurement.data() + ns * t,
+             sim.sensor.Get(t) + sensor_start, ns);
+    mju_copy(log.force_measurement.data() + nv * t, sim.qfrc_actuator.Get(t),
+             nv);
+  }
+  return log;
+}
+
+// test that windows solved concurrently recover shared parameters and the
+// configurations of a log longer than a window
+TEST(DirectOffline, ParticleFramePos) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task1D_framepos.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+  int nq = model->nq;
+
+  // ----- rollout ----- //
+  int T = 60;
+  Simulation sim(model, T);
+  double q[1] = {1.0};
+  sim.SetState(q, NULL);
+  auto controller = [](double* ctrl, double time) {};
+  sim.Rollout(controller);
+
+  // serial and on a pool
+  ThreadPool pool(2);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    DirectOffline offline;
+    offline.settings.window = 16;
+    offline.settings.overlap = 4;
+    offline.settings.consensus_iterations = 50;
+    offline.settings.consensus_penalty = 1.0e-2;
+    offline.Initialize(model, p);
+    for (int i = 0; i < offline.NumContexts(); i++) {
+      Direct& direct = offline.Context(i);
+      std::fill(direct.noise_process.begin(), direct.noise_process.end(),
+                1.0);
+      std::fill(direct.noise_sensor.begin(), direct.noise_sensor.end(),
+                1.0e-5);
+    }
+    Direct& direct = offline.Context(0);
+    DirectLog log = RolloutLog(model, sim, T, direct.SensorStartIndex(),
+                               direct.DimensionSensor());
+
+    // perturbed site z coordinates
+    ASSERT_EQ(offline.parameters.size(), 6);
+    mju_copy(offline.parameters.data(), model->site_pos, 6);
+    offline.parameters[2] += 0.1;
+    offline.parameters[5] -= 0.1;
+
+    // optimize
+    offline.Optimize(&log);
+
+    // windows cover the log with the requested overlap
+    ASSERT_GT(offline.NumWindows(), 3);
+    EXPECT_EQ(offline.WindowStart(0), 0);
+    EXPECT_EQ(offline.WindowStart(1), 12);
+    int last = offline.NumWindows() - 1;
+    EXPECT_EQ(offline.WindowStart(last) + offline.WindowLength(last), T);
+
+    // test parameter recovery
+    EXPECT_LT(offline.ConsensusResidual(), 1.0e-4);
+    for (int i = 0; i < 6; i++) {
+      EXPECT_NEAR(offline.parameters[i], model->site_pos[i], 1.0e-3);
+    }
+
+    // test stitched configurations
+    for (int t = 0; t < T; t++) {
+      EXPECT_NEAR(log.configuration[nq * t], sim.qpos.Get(t)[0], 1.0e-3);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
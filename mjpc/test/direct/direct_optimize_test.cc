@@ -13,6 +13,8 @@
 // limitations under the License.
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstdio>
 #include <vector>
 
@@ -20,9 +22,13 @@
 #include <mujoco/mujoco.h>
 
 #include "gtest/gtest.h"
+#include "mjpc/direct/band_cholesky.h"
 #include "mjpc/direct/direct.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/simulation.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace {
@@ -97,11 +103,614 @@ TEST(DirectOptimize, Particle2D) {
   EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
               1.0e-3);
 
+  // searches with exact derivatives fail instead of restoring configurations
+  EXPECT_EQ(optimizer.EvaluationsAvoided(), 0);
+
   // delete data + model
   mj_deleteData(data);
   mj_deleteModel(model);
 }
 
+TEST(DirectOptimize, Particle1DAnalyticAcceleration) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task1D.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+  model->opt.disableflags |= mjDSBL_CONTACT;
+  model->dof_damping[0] = 0.5;  // discrete Euler damping term
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // perturbed initial configurations
+  std::vector<double> configuration(sim.qpos.Data(), sim.qpos.Data() + nq * T);
+  absl::BitGen gen_;
+  for (int i = 0; i < nq * T; i++) {
+    configuration[i] += 0.001 * absl::Gaussian<double>(gen_, 0.0, 1.0);
+  }
+
+  // ----- optimizers: finite difference, analytic acceleration ----- //
+  Direct optimizer_fd(model, T);
+  Direct optimizer_analytic(model, T);
+  optimizer_analytic.settings.analytic_acceleration_derivatives = true;
+  for (Direct* optimizer : {&optimizer_fd, &optimizer_analytic}) {
+    mju_copy(optimizer->configuration.Data(), configuration.data(), nq * T);
+    mju_copy(optimizer->configuration_previous.Data(), sim.qpos.Data(),
+             nq * T);
+    mju_copy(optimizer->force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer->sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    std::fill(optimizer->noise_process.begin(), optimizer->noise_process.end(),
+              1.0);
+    std::fill(optimizer->noise_sensor.begin(), optimizer->noise_sensor.end(),
+              1.0);
+    optimizer->Optimize();
+  }
+
+  // test same solution
+  std::vector<double> configuration_error(nq * T);
+  mju_sub(configuration_error.data(), optimizer_analytic.configuration.Data(),
+          optimizer_fd.configuration.Data(), nq * T);
+  EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
+              1.0e-5);
+  EXPECT_NEAR(optimizer_analytic.GetCost(), optimizer_fd.GetCost(), 1.0e-5);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Particle2DFloatBlocks) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // perturbed initial configurations
+  std::vector<double> configuration(sim.qpos.Data(), sim.qpos.Data() + nq * T);
+  absl::BitGen gen_;
+  for (int i = 0; i < nq * T; i++) {
+    configuration[i] += 0.001 * absl::Gaussian<double>(gen_, 0.0, 1.0);
+  }
+
+  // ----- optimizers: double, single-precision Jacobian blocks ----- //
+  Direct optimizer_double(model, T);
+  Direct optimizer_float(model, T);
+  optimizer_float.settings.float_jacobian_blocks = true;
+  optimizer_float.Initialize(model);
+  optimizer_float.SetConfigurationLength(T);
+  optimizer_float.Reset();
+  for (Direct* optimizer : {&optimizer_double, &optimizer_float}) {
+    mju_copy(optimizer->configuration.Data(), configuration.data(), nq * T);
+    mju_copy(optimizer->configuration_previous.Data(), sim.qpos.Data(),
+             nq * T);
+    mju_copy(optimizer->force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer->sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    std::fill(optimizer->noise_process.begin(), optimizer->noise_process.end(),
+              1.0);
+    std::fill(optimizer->noise_sensor.begin(), optimizer->noise_sensor.end(),
+              1.0);
+    optimizer->Optimize();
+  }
+
+  // test same solution within single precision
+  std::vector<double> configuration_error(nq * T);
+  mju_sub(configuration_error.data(), optimizer_float.configuration.Data(),
+          optimizer_double.configuration.Data(), nq * T);
+  EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
+              1.0e-4);
+  EXPECT_NEAR(optimizer_float.GetCost(), optimizer_double.GetCost(), 1.0e-4);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Particle2DFused) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 11;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // perturbed initial configurations
+  std::vector<double> configuration(sim.qpos.Data(), sim.qpos.Data() + nq * T);
+  absl::BitGen gen_;
+  for (int i = 0; i < nq * T; i++) {
+    configuration[i] += 0.001 * absl::Gaussian<double>(gen_, 0.0, 1.0);
+  }
+
+  // ----- optimizers: separate, fused cost (partial last tile) ----- //
+  Direct optimizer_separate(model, T);
+  Direct optimizer_fused(model, T);
+  optimizer_fused.settings.fused_cost = true;
+  optimizer_fused.settings.fused_tile = 3;
+  for (Direct* optimizer : {&optimizer_separate, &optimizer_fused}) {
+    mju_copy(optimizer->configuration.Data(), configuration.data(), nq * T);
+    mju_copy(optimizer->configuration_previous.Data(), sim.qpos.Data(),
+             nq * T);
+    mju_copy(optimizer->force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer->sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    std::fill(optimizer->noise_process.begin(), optimizer->noise_process.end(),
+              1.0);
+    std::fill(optimizer->noise_sensor.begin(), optimizer->noise_sensor.end(),
+              1.0);
+    optimizer->Optimize();
+  }
+
+  // test same solution
+  std::vector<double> configuration_error(nq * T);
+  mju_sub(configuration_error.data(), optimizer_fused.configuration.Data(),
+          optimizer_separate.configuration.Data(), nq * T);
+  EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
+              1.0e-6);
+  EXPECT_NEAR(optimizer_fused.GetCost(), optimizer_separate.GetCost(), 1.0e-6);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Particle2DBroyden) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // perturbed initial configurations
+  std::vector<double> configuration(sim.qpos.Data(), sim.qpos.Data() + nq * T);
+  absl::BitGen gen_;
+  for (int i = 0; i < nq * T; i++) {
+    configuration[i] += 0.001 * absl::Gaussian<double>(gen_, 0.0, 1.0);
+  }
+
+  // ----- optimizers: derivatives every iteration, every third ----- //
+  Direct optimizer_exact(model, T);
+  Direct optimizer_broyden(model, T);
+  optimizer_broyden.settings.derivative_refresh = 3;
+  for (Direct* optimizer : {&optimizer_exact, &optimizer_broyden}) {
+    mju_copy(optimizer->configuration.Data(), configuration.data(), nq * T);
+    mju_copy(optimizer->configuration_previous.Data(), sim.qpos.Data(),
+             nq * T);
+    mju_copy(optimizer->force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer->sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    std::fill(optimizer->noise_process.begin(), optimizer->noise_process.end(),
+              1.0);
+    std::fill(optimizer->noise_sensor.begin(), optimizer->noise_sensor.end(),
+              1.0);
+    optimizer->Optimize();
+  }
+
+  // test same solution
+  std::vector<double> configuration_error(nq * T);
+  mju_sub(configuration_error.data(), optimizer_broyden.configuration.Data(),
+          optimizer_exact.configuration.Data(), nq * T);
+  EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
+              1.0e-4);
+  EXPECT_NEAR(optimizer_broyden.GetCost(), optimizer_exact.GetCost(), 1.0e-4);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Particle2DMatrixFree) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // perturbed initial configurations
+  std::vector<double> configuration(sim.qpos.Data(), sim.qpos.Data() + nq * T);
+  absl::BitGen gen_;
+  for (int i = 0; i < nq * T; i++) {
+    configuration[i] += 0.001 * absl::Gaussian<double>(gen_, 0.0, 1.0);
+  }
+
+  // ----- optimizers: band Cholesky, conjugate gradient ----- //
+  Direct optimizer_band(model, T);
+  Direct optimizer_matrix_free(model, T);
+  optimizer_matrix_free.settings.matrix_free = true;
+  for (Direct* optimizer : {&optimizer_band, &optimizer_matrix_free}) {
+    mju_copy(optimizer->configuration.Data(), configuration.data(), nq * T);
+    mju_copy(optimizer->configuration_previous.Data(), sim.qpos.Data(),
+             nq * T);
+    mju_copy(optimizer->force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer->sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    std::fill(optimizer->noise_process.begin(), optimizer->noise_process.end(),
+              1.0);
+    std::fill(optimizer->noise_sensor.begin(), optimizer->noise_sensor.end(),
+              1.0);
+    optimizer->Optimize();
+  }
+
+  // conjugate gradient is used
+  EXPECT_EQ(optimizer_band.IterationsConjugateGradient(), 0);
+  EXPECT_GT(optimizer_matrix_free.IterationsConjugateGradient(), 0);
+
+  // test same solution
+  std::vector<double> configuration_error(nq * T);
+  mju_sub(configuration_error.data(),
+          optimizer_matrix_free.configuration.Data(),
+          optimizer_band.configuration.Data(), nq * T);
+  EXPECT_NEAR(mju_norm(configuration_error.data(), nq * T) / (nq * T), 0.0,
+              1.0e-6);
+  EXPECT_NEAR(optimizer_matrix_free.GetCost(), optimizer_band.GetCost(),
+              1.0e-6);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Cancelled) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // ----- optimizer ----- //
+  Direct optimizer(model, T);
+  mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
+  for (int i = 0; i < nq * T; i++) optimizer.configuration.Data()[i] += 0.01;
+  mju_copy(optimizer.configuration_previous.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
+           nv * T);
+  mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+
+  // cancelled before the second iteration
+  int polls = 0;
+  optimizer.Optimize([&polls]() { return ++polls > 1; });
+
+  // test stopped
+  EXPECT_EQ(optimizer.SolveStatus(), kCancelled);
+  EXPECT_EQ(optimizer.IterationsSmoother(), 1);
+  EXPECT_EQ(polls, 2);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Append) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  int num_append = 5;
+  Simulation sim(model, T + num_append);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // ----- streaming optimizer ----- //
+  Direct optimizer(model, T);
+  mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.configuration_previous.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
+           nv * T);
+  mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+  mju_copy(optimizer.times.Data(), sim.time.Data(), T);
+  std::fill(optimizer.noise_process.begin(), optimizer.noise_process.end(),
+            1.0);
+  std::fill(optimizer.noise_sensor.begin(), optimizer.noise_sensor.end(), 1.0);
+  optimizer.Optimize();
+
+  // window optimizer, evaluates all time steps
+  Direct optimizer_window(model, T);
+  std::fill(optimizer_window.noise_process.begin(),
+            optimizer_window.noise_process.end(), 1.0);
+  std::fill(optimizer_window.noise_sensor.begin(),
+            optimizer_window.noise_sensor.end(), 1.0);
+
+  for (int k = 0; k < num_append; k++) {
+    // append sample
+    int index = T - 1 + k;
+    optimizer.Append(sim.ctrl.Get(index), sim.sensor.Get(index),
+                     sim.time.Get(index)[0]);
+
+    // copy window
+    for (int t = 0; t < T; t++) {
+      optimizer_window.configuration.Set(optimizer.configuration.Get(t), t);
+      optimizer_window.configuration_previous.Set(
+          optimizer.configuration_previous.Get(t), t);
+      optimizer_window.times.Set(optimizer.times.Get(t), t);
+      optimizer_window.sensor_measurement.Set(
+          optimizer.sensor_measurement.Get(t), t);
+      optimizer_window.force_measurement.Set(
+          optimizer.force_measurement.Get(t), t);
+      optimizer_window.sensor_mask.Set(optimizer.sensor_mask.Get(t), t);
+    }
+
+    // optimize
+    optimizer.Optimize();
+    optimizer_window.Optimize();
+
+    // test same solution
+    EXPECT_NEAR(optimizer.GetCost(), optimizer_window.GetCost(), 1.0e-8);
+    for (int t = 0; t < T; t++) {
+      std::vector<double> error(nq);
+      mju_sub(error.data(), optimizer.configuration.Get(t),
+              optimizer_window.configuration.Get(t), nq);
+      EXPECT_NEAR(mju_norm(error.data(), nq), 0.0, 1.0e-6);
+    }
+  }
+
+  // test newest sample
+  EXPECT_NEAR(optimizer.times.Get(T - 2)[0],
+              sim.time.Get(T + num_append - 2)[0], 1.0e-12);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(DirectOptimize, Snapshot) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  int num_append = 3;
+  Simulation sim(model, T + num_append);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // ----- optimizer with a shifted window ----- //
+  Direct optimizer(model, T);
+  mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.configuration_previous.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
+           nv * T);
+  mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+  mju_copy(optimizer.times.Data(), sim.time.Data(), T);
+  std::fill(optimizer.noise_process.begin(), optimizer.noise_process.end(),
+            1.0);
+  std::fill(optimizer.noise_sensor.begin(), optimizer.noise_sensor.end(), 1.0);
+  optimizer.Optimize();
+  for (int k = 0; k < num_append; k++) {
+    int index = T - 1 + k;
+    optimizer.Append(sim.ctrl.Get(index), sim.sensor.Get(index),
+                     sim.time.Get(index)[0]);
+  }
+
+  // ----- restore into a new optimizer ----- //
+  SnapshotWriter writer;
+  optimizer.Snapshot(writer);
+  SnapshotReader reader;
+  ASSERT_TRUE(reader.Parse(writer.Bytes()));
+
+  Direct restored(model, T);
+  std::fill(restored.noise_process.begin(), restored.noise_process.end(), 1.0);
+  std::fill(restored.noise_sensor.begin(), restored.noise_sensor.end(), 1.0);
+  ASSERT_TRUE(restored.Restore(reader));
+  EXPECT_EQ(restored.ConfigurationLength(), T);
+
+  // test same solution
+  optimizer.Optimize();
+  restored.Optimize();
+  EXPECT_NEAR(optimizer.GetCost(), restored.GetCost(), 1.0e-8);
+  for (int t = 0; t < T; t++) {
+    std::vector<double> error(nq);
+    mju_sub(error.data(), optimizer.configuration.Get(t),
+            restored.configuration.Get(t), nq);
+    EXPECT_NEAR(mju_norm(error.data(), nq), 0.0, 1.0e-6);
+  }
+
+  // a shorter history doesn't fit the window
+  Direct shorter(model, T);
+  shorter.SetMaxHistory(T - 1);
+  EXPECT_FALSE(shorter.Restore(reader));
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// sparse matrix to dense
+std::vector<double> Densify(const SparseMatrix& matrix) {
+  std::vector<double> dense(matrix.rows * matrix.cols, 0.0);
+  for (int i = 0; i < matrix.rows; i++) {
+    for (int k = matrix.row_start[i]; k < matrix.row_start[i + 1]; k++) {
+      dense[i * matrix.cols + matrix.column[k]] += matrix.value[k];
+    }
+  }
+  return dense;
+}
+
+TEST(DirectOptimize, SparseInternals) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task.xml");
+  model->opt.enableflags |= mjENBL_INVDISCRETE;
+
+  // dimensions
+  int nq = model->nq, nv = model->nv, ns = model->nsensordata;
+
+  // ----- simulate ----- //
+  int T = 10;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {
+    ctrl[0] = mju_sin(10 * time);
+    ctrl[1] = 10 * mju_cos(10 * time);
+  };
+  sim.Rollout(controller);
+
+  // ----- optimizer ----- //
+  Direct optimizer(model, T);
+  mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.configuration_previous.Data(), sim.qpos.Data(), nq * T);
+  mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
+           nv * T);
+  mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+  optimizer.configuration.Data()[nq] += 0.01;
+
+  // derivatives
+  optimizer.Cost(optimizer.GetCostGradient(), optimizer.GetCostHessianBand());
+
+  // sparse
+  std::vector<double> jacobian_sensor =
+      Densify(optimizer.GetJacobianSensorSparse());
+  std::vector<double> jacobian_force =
+      Densify(optimizer.GetJacobianForceSparse());
+  std::vector<double> norm_hessian_sensor =
+      Densify(optimizer.GetNormHessianSensorSparse());
+  std::vector<double> norm_hessian_force =
+      Densify(optimizer.GetNormHessianForceSparse());
+
+  // test against dense
+  const double* jacobian_sensor_dense = optimizer.GetJacobianSensor();
+  for (std::size_t i = 0; i < jacobian_sensor.size(); i++) {
+    EXPECT_NEAR(jacobian_sensor[i], jacobian_sensor_dense[i], 1.0e-8);
+  }
+  const double* jacobian_force_dense = optimizer.GetJacobianForce();
+  for (std::size_t i = 0; i < jacobian_force.size(); i++) {
+    EXPECT_NEAR(jacobian_force[i], jacobian_force_dense[i], 1.0e-8);
+  }
+  const double* norm_hessian_sensor_dense = optimizer.GetNormHessianSensor();
+  for (std::size_t i = 0; i < norm_hessian_sensor.size(); i++) {
+    EXPECT_NEAR(norm_hessian_sensor[i], norm_hessian_sensor_dense[i], 1.0e-8);
+  }
+  const double* norm_hessian_force_dense = optimizer.GetNormHessianForce();
+  for (std::size_t i = 0; i < norm_hessian_force.size(); i++) {
+    EXPECT_NEAR(norm_hessian_force[i], norm_hessian_force_dense[i], 1.0e-8);
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// partitioned band factorization vs. serial, window lengths 32 - 1024
+TEST(DirectOptimize, ParallelFactorization) {
+  // dimensions (nv = 6, cost Hessian band 3 * nv)
+  const int nv = 6;
+  const int nband = 3 * nv;
+  const double regularization = 1.0e-6;
+  ThreadPool pool(NumAvailableHardwareThreads());
+  absl::BitGen gen_;
+
+  for (int T = 32; T <= 1024; T *= 2) {
+    int ntotal = nv * T;
+
+    // random symmetric positive definite band matrix
+    std::vector<double> band(ntotal * nband, 0.0);
+    for (int i = 0; i < ntotal; i++) {
+      for (int j = std::max(0, i - nband + 1); j < i; j++) {
+        band[i * nband + nband - 1 - (i - j)] =
+            absl::Uniform<double>(gen_, -1.0, 1.0);
+      }
+      band[i * nband + nband - 1] = 2.0 * nband;
+    }
+    std::vector<double> vec(ntotal);
+    for (int i = 0; i < ntotal; i++) {
+      vec[i] = absl::Gaussian<double>(gen_, 0.0, 1.0);
+    }
+
+    // serial
+    auto serial_start = std::chrono::steady_clock::now();
+    std::vector<double> factor(band);
+    double min_diag = mju_cholFactorBand(factor.data(), ntotal, nband, 0,
+                                         regularization, 0.0);
+    std::vector<double> solution(ntotal);
+    mju_cholSolveBand(solution.data(), factor.data(), vec.data(), ntotal,
+                      nband, 0);
+    double serial_time = GetDuration(serial_start);
+
+    // partitioned
+    int num_partition =
+        ParallelBandCholesky::NumPartitions(ntotal, nband, pool.NumThreads());
+    ParallelBandCholesky cholesky;
+    cholesky.Allocate(ntotal, nband, std::max(num_partition, 2));
+    auto parallel_start = std::chrono::steady_clock::now();
+    double min_diag_parallel =
+        cholesky.Factor(band.data(), regularization, pool);
+    std::vector<double> res(ntotal);
+    cholesky.Solve(res.data(), vec.data(), pool);
+    double parallel_time = GetDuration(parallel_start);
+
+    // test
+    EXPECT_GT(min_diag, 0.0);
+    EXPECT_GT(min_diag_parallel, 0.0);
+    std::vector<double> error(ntotal);
+    mju_sub(error.data(), res.data(), solution.data(), ntotal);
+    EXPECT_NEAR(mju_norm(error.data(), ntotal) / ntotal, 0.0, 1.0e-10);
+
+    printf("T = %4i: serial %.3f ms, partitioned (%i) %.3f ms\n", T,
+           1.0e-3 * serial_time, cholesky.NumPartition(),
+           1.0e-3 * parallel_time);
+  }
+}
+
 TEST(DirectOptimize, Box3D) {
   // load model
   mjModel* model = LoadTestModel("estimator/box/task0.xml");
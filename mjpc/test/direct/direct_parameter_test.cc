@@ -21,6 +21,7 @@
 
 #include "gtest/gtest.h"
 #include "mjpc/direct/direct.h"
+#include "mjpc/direct/model_parameters.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/simulation.h"
 #include "mjpc/threadpool.h"
@@ -64,73 +65,108 @@ TEST(DirectParameter, ParticleFramePos) {
     }
   }
 
-  // ----- optimizer ----- //
-  Direct optimizer(model, T);
-
-  // set data
-  mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
-  mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
-  mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
-           nv * T);
-  mju_copy(optimizer.parameters.data(), model->site_pos, 6);
-  optimizer.parameters[2] += 0.25;  // perturb site0 z coordinate
-  optimizer.parameters[5] -= 0.25;  // perturb site1 z coordinate
-
-  // set process noise
-  std::fill(optimizer.noise_process.begin(), optimizer.noise_process.end(),
-            1.0);
+  // ----- optimizer (each parameter difference scheme) ----- //
+  for (ParameterDifference scheme :
+       {kForwardDifference, kCentralDifference, kCentralDifference4}) {
+    Direct optimizer(model, T);
+    optimizer.finite_difference.parameter_difference = scheme;
+
+    // set data
+    mju_copy(optimizer.configuration.Data(), sim.qpos.Data(), nq * T);
+    mju_copy(optimizer.sensor_measurement.Data(), sim.sensor.Data(), ns * T);
+    mju_copy(optimizer.force_measurement.Data(), sim.qfrc_actuator.Data(),
+             nv * T);
+    mju_copy(optimizer.parameters.data(), model->site_pos, 6);
+    optimizer.parameters[2] += 0.25;  // perturb site0 z coordinate
+    optimizer.parameters[5] -= 0.25;  // perturb site1 z coordinate
+
+    // set process noise
+    std::fill(optimizer.noise_process.begin(), optimizer.noise_process.end(),
+              1.0);
+
+    // set sensor noise
+    std::fill(optimizer.noise_sensor.begin(), optimizer.noise_sensor.end(),
+              1.0e-5);
+
+    // settings
+    optimizer.settings.verbose_optimize = true;
+    optimizer.settings.verbose_cost = true;
+
+    // prior
+    mju_copy(optimizer.parameters_previous.data(), model->site_pos, 6);
+    std::fill(optimizer.noise_parameter.begin(),
+              optimizer.noise_parameter.end(), 1.0);
+
+    if (verbose) {
+      // initial parameters
+      printf("parameters initial = \n");
+      mju_printMat(optimizer.parameters.data(), 1, 6);
+
+      printf("parameters previous = \n");
+      mju_printMat(optimizer.parameters_previous.data(), 1, 6);
+
+      printf("measurements initial = \n");
+      mju_printMat(optimizer.sensor_measurement.Data(), T, model->nsensordata);
+    }
 
-  // set sensor noise
-  std::fill(optimizer.noise_sensor.begin(), optimizer.noise_sensor.end(),
-            1.0e-5);
+    // optimize
+    optimizer.Optimize();
 
-  // settings
-  optimizer.settings.verbose_optimize = true;
-  optimizer.settings.verbose_cost = true;
+    // test parameter recovery
+    for (int i = 0; i < 6; i++) {
+      EXPECT_NEAR(optimizer.parameters[i], model->site_pos[i], 1.0e-5);
+    }
 
-  // prior
-  mju_copy(optimizer.parameters_previous.data(), model->site_pos, 6);
-  std::fill(optimizer.noise_parameter.begin(),
-            optimizer.noise_parameter.end(), 1.0);
+    if (verbose) {
+      // optimized configurations
+      printf("qpos optimized =\n");
+      mju_printMat(optimizer.configuration.Data(), T, model->nq);
 
-  if (verbose) {
-    // initial parameters
-    printf("parameters initial = \n");
-    mju_printMat(optimizer.parameters.data(), 1, 6);
+      printf("qvel optimized =\n");
+      mju_printMat(optimizer.velocity.Data(), T, model->nv);
 
-    printf("parameters previous = \n");
-    mju_printMat(optimizer.parameters_previous.data(), 1, 6);
+      printf("measurements optimized = \n");
+      mju_printMat(optimizer.sensor_prediction.Data(), T, model->nsensordata);
 
-    printf("measurements initial = \n");
-    mju_printMat(optimizer.sensor_measurement.Data(), T, model->nsensordata);
+      // optimized parameters
+      printf("parameters optimized = \n");
+      mju_printMat(optimizer.parameters.data(), 1, 6);
+    }
   }
 
-  // optimize
-  optimizer.Optimize();
+  // delete data + model
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
 
-  // test parameter recovery
+TEST(DirectParameter, Overlay) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task1D_framepos.xml");
+  double site_pos[6];
+  mju_copy(site_pos, model->site_pos, 6);
+  mjtByte sameframe[2] = {model->site_sameframe[0], model->site_sameframe[1]};
+
+  // overlay
+  Particle1DFramePosParameters parameters;
+  ModelParameterOverlay overlay;
+  overlay.Initialize(parameters, model);
+
+  // patch
+  double values[6] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+  overlay.Patch(parameters, values, 6);
   for (int i = 0; i < 6; i++) {
-    EXPECT_NEAR(optimizer.parameters[i], model->site_pos[i], 1.0e-5);
+    EXPECT_EQ(model->site_pos[i], values[i]);
   }
 
-  if (verbose) {
-    // optimized configurations
-    printf("qpos optimized =\n");
-    mju_printMat(optimizer.configuration.Data(), T, model->nq);
-
-    printf("qvel optimized =\n");
-    mju_printMat(optimizer.velocity.Data(), T, model->nv);
-
-    printf("measurements optimized = \n");
-    mju_printMat(optimizer.sensor_prediction.Data(), T, model->nsensordata);
-
-    // optimized parameters
-    printf("parameters optimized = \n");
-    mju_printMat(optimizer.parameters.data(), 1, 6);
+  // restore
+  EXPECT_TRUE(overlay.Restore());
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(model->site_pos[i], site_pos[i]);
   }
+  EXPECT_EQ(model->site_sameframe[0], sameframe[0]);
+  EXPECT_EQ(model->site_sameframe[1], sameframe[1]);
 
-  // delete data + model
-  mj_deleteData(data);
+  // delete model
   mj_deleteModel(model);
 }
 
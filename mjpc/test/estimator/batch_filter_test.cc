@@ -116,5 +116,141 @@ TEST(BatchFilter, Box3Drot) {
   mj_deleteModel(model);
 }
 
+TEST(BatchFilter, DelayedMeasurement) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/box/task3Drot2.xml");
+
+  // ----- rollout ----- //
+  int T = 100;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qvel[3] = {1.0, -0.75, 1.25};
+  sim.SetState(NULL, qvel);
+  sim.Rollout(controller);
+
+  // ----- Batch ----- //
+
+  // initialize batch
+  Batch batch(1);
+  batch.settings.time_scaling_force = false;
+  batch.settings.time_scaling_sensor = false;
+  batch.Initialize(model);
+  batch.Reset();
+
+  // set initial state
+  mju_copy(batch.state.data(), sim.qpos.Get(0), model->nq);
+  mju_copy(batch.state.data() + model->nq, sim.qvel.Get(0), model->nv);
+
+  // set initial configurations
+  double* q0 = batch.configuration.Get(0);
+  double* q1 = batch.configuration.Get(1);
+  mju_copy(q1, sim.qpos.Get(0), model->nq);
+  mju_copy(q0, q1, model->nq);
+  mj_integratePos(model, q0, sim.qvel.Get(0), -1.0 * model->opt.timestep);
+
+  // initialize covariance and noise
+  mju_eye(batch.covariance.data(), 2 * model->nv);
+  mju_scl(batch.covariance.data(), batch.covariance.data(), 1.0e-4,
+          (2 * model->nv) * (2 * model->nv));
+  mju_fill(batch.noise_process.data(), 1.0e-4, 2 * model->nv);
+  mju_fill(batch.noise_sensor.data(), 1.0e-4, model->nsensordata);
+
+  // measurements of odd time steps arrive one time step late
+  std::vector<int> missing(model->nsensor, 0);
+  double delayed_time = 0.0;
+  for (int t = 0; t < T - 1; t++) {
+    if (t % 2 == 0 && t > 0) {
+      EXPECT_TRUE(
+          batch.InsertMeasurement(sim.sensor.Get(t - 1), NULL, delayed_time));
+    }
+
+    // update, time of the measurement before the update
+    double time = batch.Time();
+    if (t % 2 == 1) {
+      batch.UpdateMasked(sim.ctrl.Get(t), sim.sensor.Get(t), missing.data(),
+                         NULL);
+      delayed_time = time;
+    } else {
+      batch.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    }
+
+    // test qpos
+    std::vector<double> pos_error(model->nv);
+    mju_subQuat(pos_error.data(), batch.state.data(), sim.qpos.Get(t + 1));
+    EXPECT_NEAR(mju_norm(pos_error.data(), model->nv), 0.0, 5.0e-3);
+
+    // test qvel
+    std::vector<double> vel_error(model->nv);
+    mju_sub(vel_error.data(), batch.state.data() + model->nq,
+            sim.qvel.Get(t + 1), model->nv);
+    EXPECT_NEAR(mju_norm(vel_error.data(), model->nv), 0.0, 5.0e-3);
+  }
+
+  // measurements of the current or future time steps aren't delayed
+  EXPECT_FALSE(batch.InsertMeasurement(sim.sensor.Get(T - 1), NULL,
+                                       batch.Time()));
+  EXPECT_FALSE(batch.InsertMeasurement(sim.sensor.Get(T - 1), NULL,
+                                       batch.Time() + 1.0));
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(BatchFilter, KalmanWarmStart) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/box/task3Drot2.xml");
+
+  // ----- rollout ----- //
+  int T = 50;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qvel[3] = {1.0, -0.75, 1.25};
+  sim.SetState(NULL, qvel);
+  sim.Rollout(controller);
+
+  // ----- Batch ----- //
+
+  // with and without warm start
+  Batch cold(1), warm(1);
+  for (Batch* batch : {&cold, &warm}) {
+    batch->settings.time_scaling_force = false;
+    batch->settings.time_scaling_sensor = false;
+    batch->Initialize(model);
+    batch->Reset();
+    mju_copy(batch->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(batch->state.data() + model->nq, sim.qvel.Get(0), model->nv);
+    double* q0 = batch->configuration.Get(0);
+    double* q1 = batch->configuration.Get(1);
+    mju_copy(q1, sim.qpos.Get(0), model->nq);
+    mju_copy(q0, q1, model->nq);
+    mj_integratePos(model, q0, sim.qvel.Get(0), -1.0 * model->opt.timestep);
+    mju_eye(batch->covariance.data(), 2 * model->nv);
+    mju_scl(batch->covariance.data(), batch->covariance.data(), 1.0e-4,
+            (2 * model->nv) * (2 * model->nv));
+    mju_fill(batch->noise_process.data(), 1.0e-4, 2 * model->nv);
+    mju_fill(batch->noise_sensor.data(), 1.0e-4, model->nsensordata);
+  }
+  warm.filter_settings.kalman_warm_start = true;
+
+  for (int t = 0; t < T - 1; t++) {
+    for (Batch* batch : {&cold, &warm}) {
+      batch->Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+
+      // test qpos
+      std::vector<double> pos_error(model->nv);
+      mju_subQuat(pos_error.data(), batch->state.data(), sim.qpos.Get(t + 1));
+      EXPECT_NEAR(mju_norm(pos_error.data(), model->nv), 0.0, 5.0e-3);
+    }
+  }
+
+  // iterations are reported
+  EXPECT_TRUE(warm.filter_settings.kalman_warm_start);
+  EXPECT_GT(cold.SmootherIterationsPerUpdate(), 0.0);
+  EXPECT_GT(warm.SmootherIterationsPerUpdate(), 0.0);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
 }  // namespace
 }  // namespace mjpc
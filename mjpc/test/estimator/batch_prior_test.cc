@@ -84,6 +84,13 @@ TEST(PriorCost, Particle) {
   // set prior weights
   estimator.SetPriorWeights(P.data(), 5.0);
 
+  // prior weights are stored in band form
+  std::vector<double> P_band(nvar * 3 * nv);
+  mju_dense2Band(P_band.data(), P.data(), nvar, 3 * nv, 0);
+  for (int i = 0; i < nvar * 3 * nv; i++) {
+    EXPECT_NEAR(estimator.PriorWeights()[i], P_band[i], 1.0e-12);
+  }
+
   // ----- cost ----- //
   auto cost_prior = [&estimator = estimator,
                      &model = model](const double* configuration) {
@@ -109,15 +116,10 @@ TEST(PriorCost, Particle) {
 
     // ----- 0.5 * w * r' * P * r ----- //
 
-    // weights band
-    std::vector<double> weight_band(nvar * nvar);
-    mju_dense2Band(weight_band.data(), estimator.PriorWeights(), nvar, 3 * nv,
-                   0);
-
     // scratch
     std::vector<double> scratch(nvar);
-    mju_bandMulMatVec(scratch.data(), weight_band.data(), residual.data(), nvar,
-                      3 * nv, 0, 1, true);
+    mju_bandMulMatVec(scratch.data(), estimator.PriorWeights(),
+                      residual.data(), nvar, 3 * nv, 0, 1, true);
 
     // weighted cost
     return 0.5 * estimator.scale_prior / nvar *
@@ -266,8 +268,8 @@ TEST(PriorCost, Box) {
 
     // scratch
     std::vector<double> scratch(nvar);
-    mju_mulMatVec(scratch.data(), estimator.PriorWeights(), residual.data(),
-                  nvar, nvar);
+    mju_bandMulMatVec(scratch.data(), estimator.PriorWeights(),
+                      residual.data(), nvar, 3 * nv, 0, 1, true);
 
     // weighted cost
     return 0.5 * estimator.scale_prior / nvar *
@@ -0,0 +1,103 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/estimators/group.h"
+
+#include <vector>
+
+#include <mujoco/mujoco.h>
+
+#include "gtest/gtest.h"
+#include "mjpc/estimators/estimator.h"
+#include "mjpc/estimators/kalman.h"
+#include "mjpc/estimators/unscented.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/simulation.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+namespace {
+
+// initial state, covariance and noise from the rollout
+void InitializeEstimator(Estimator* estimator, const mjModel* model,
+                         const Simulation& sim) {
+  int nq = model->nq, nv = model->nv;
+  double* state = estimator->State();
+  mju_copy(state, sim.qpos.Get(0), nq);
+  mju_copy(state + nq, sim.qvel.Get(0), nv);
+  std::vector<double> covariance(4 * nv * nv);
+  mju_eye(covariance.data(), 2 * nv);
+  mju_scl(covariance.data(), covariance.data(), 1.0e-5, 4 * nv * nv);
+  estimator->SetCovariance(covariance.data());
+  mju_fill(estimator->ProcessNoise(), 1.0e-5, 2 * nv);
+  mju_fill(estimator->SensorNoise(), 1.0e-5, model->nsensordata);
+}
+
+// test that a pooled group update matches updating each estimator alone
+TEST(EstimatorGroup, Update) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task_imu.xml");
+  int nq = model->nq, nv = model->nv;
+
+  // ----- rollout ----- //
+  int T = 20;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qpos0[1] = {0.25};
+  sim.SetState(qpos0, NULL);
+  sim.Rollout(controller);
+
+  // ----- estimators ----- //
+  Kalman kalman(model), kalman_alone(model);
+  Unscented unscented(model), unscented_alone(model);
+  for (Estimator* estimator :
+       std::vector<Estimator*>{&kalman, &kalman_alone, &unscented,
+                               &unscented_alone}) {
+    InitializeEstimator(estimator, model, sim);
+  }
+
+  ThreadPool pool(2);
+  EstimatorGroup group;
+  group.SetThreadPool(&pool);
+  EXPECT_EQ(group.Add(&kalman), 0);
+  EXPECT_EQ(group.Add(&unscented), 1);
+  group.SetPrimary(1);
+
+  for (int t = 0; t < T - 1; t++) {
+    group.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    kalman_alone.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    unscented_alone.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+
+    // test members
+    for (int i = 0; i < nq + nv; i++) {
+      EXPECT_NEAR(group.State(0)[i], kalman_alone.state[i], 1.0e-10);
+      EXPECT_NEAR(group.State(1)[i], unscented_alone.state[i], 1.0e-10);
+    }
+    EXPECT_GE(group.UpdateTime(0), 0.0);
+    EXPECT_GE(group.UpdateTime(1), 0.0);
+  }
+
+  // switch primary
+  EXPECT_EQ(&group.PrimaryEstimator(), &unscented);
+  group.SetPrimary(0);
+  EXPECT_EQ(&group.PrimaryEstimator(), &kalman);
+  group.SetPrimary(5);
+  EXPECT_EQ(group.Primary(), 1);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -14,6 +14,7 @@
 
 #include "mjpc/estimators/kalman.h"
 
+#include <cstdint>
 #include <vector>
 
 #include <absl/random/random.h>
@@ -21,8 +22,10 @@
 
 #include "gtest/gtest.h"
 #include "mjpc/direct/trajectory.h"
+#include "mjpc/test/allocation_counter.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/simulation.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -111,5 +114,245 @@ TEST(Estimator, Kalman) {
   mj_deleteModel(model);
 }
 
+TEST(Estimator, KalmanParallelJacobian) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task_imu.xml");
+
+  // ----- rollout ----- //
+  int T = 50;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qpos0[1] = {0.25};
+  sim.SetState(qpos0, NULL);
+  sim.Rollout(controller);
+
+  // ----- Kalman ----- //
+
+  // serial and parallel filters, reused dynamics Jacobian
+  Kalman serial(model);
+  Kalman parallel(model);
+  Kalman reuse(model);
+  ThreadPool pool(2);
+  parallel.SetThreadPool(&pool);
+  parallel.settings.parallel_jacobian = 1;
+  reuse.settings.reuse_tolerance = 1.0e-3;
+
+  int nv = model->nv;
+  for (Kalman* kalman : {&serial, &parallel, &reuse}) {
+    mju_copy(kalman->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(kalman->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(kalman->covariance.data(), 2 * nv);
+    mju_scl(kalman->covariance.data(), kalman->covariance.data(), 1.0e-5,
+            (2 * nv) * (2 * nv));
+    mju_fill(kalman->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(kalman->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  for (int t = 0; t < T; t++) {
+    for (Kalman* kalman : {&serial, &parallel, &reuse}) {
+      kalman->Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    }
+
+    // test state
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(parallel.state[i], serial.state[i], 1.0e-8);
+      EXPECT_NEAR(reuse.state[i], serial.state[i], 1.0e-4);
+    }
+
+    // test covariance
+    for (int i = 0; i < 4 * nv * nv; i++) {
+      EXPECT_NEAR(parallel.covariance[i], serial.covariance[i], 1.0e-8);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(Estimator, KalmanSequential) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task_imu.xml");
+
+  // ----- rollout ----- //
+  int T = 50;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qpos0[1] = {0.25};
+  sim.SetState(qpos0, NULL);
+  sim.Rollout(controller);
+
+  // ----- Kalman ----- //
+
+  // joint and sequential measurement updates
+  Kalman joint(model);
+  Kalman sequential(model);
+  sequential.settings.sequential = 1;
+
+  int nv = model->nv;
+  for (Kalman* kalman : {&joint, &sequential}) {
+    mju_copy(kalman->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(kalman->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(kalman->covariance.data(), 2 * nv);
+    mju_scl(kalman->covariance.data(), kalman->covariance.data(), 1.0e-5,
+            (2 * nv) * (2 * nv));
+    mju_fill(kalman->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(kalman->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  // perturbed sensor so that corrections are nonzero
+  std::vector<double> sensor(model->nsensordata);
+  for (int t = 0; t < T; t++) {
+    for (int i = 0; i < model->nsensordata; i++) {
+      sensor[i] = sim.sensor.Get(t)[i] + 1.0e-3 * ((i + t) % 3 - 1);
+    }
+    joint.UpdateMeasurement(sim.ctrl.Get(t), sensor.data());
+    sequential.UpdateMeasurement(sim.ctrl.Get(t), sensor.data());
+
+    // test state
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(sequential.state[i], joint.state[i], 1.0e-8);
+    }
+
+    // test covariance
+    for (int i = 0; i < 4 * nv * nv; i++) {
+      EXPECT_NEAR(sequential.covariance[i], joint.covariance[i], 1.0e-10);
+    }
+
+    joint.UpdatePrediction();
+    sequential.UpdatePrediction();
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(Estimator, KalmanMasked) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task_imu.xml");
+
+  // ----- rollout ----- //
+  int T = 50;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qpos0[1] = {0.25};
+  sim.SetState(qpos0, NULL);
+  sim.Rollout(controller);
+
+  // ----- Kalman ----- //
+
+  // joint and sequential measurement updates
+  Kalman joint(model);
+  Kalman sequential(model);
+  sequential.settings.sequential = 1;
+
+  int nv = model->nv;
+  for (Kalman* kalman : {&joint, &sequential}) {
+    mju_copy(kalman->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(kalman->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(kalman->covariance.data(), 2 * nv);
+    mju_scl(kalman->covariance.data(), kalman->covariance.data(), 1.0e-5,
+            (2 * nv) * (2 * nv));
+    mju_fill(kalman->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(kalman->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  // sensor i is measured every i + 1 steps, the first sensor drops out every
+  // fourth step
+  int nsensor = model->nsensor;
+  std::vector<int> available(nsensor, 1);
+  std::vector<double> times(nsensor);
+  std::vector<double> sensor(model->nsensordata);
+  for (int t = 0; t < T; t++) {
+    for (int i = 0; i < model->nsensordata; i++) {
+      sensor[i] = sim.sensor.Get(t)[i] + 1.0e-3 * ((i + t) % 3 - 1);
+    }
+    for (int i = 0; i < nsensor; i++) {
+      times[i] = (t / (i + 1)) * model->opt.timestep;
+    }
+    available[0] = t % 4 != 3;
+    joint.UpdateMeasurement(sim.ctrl.Get(t), sensor.data(), available.data(),
+                            times.data());
+    sequential.UpdateMeasurement(sim.ctrl.Get(t), sensor.data(),
+                                 available.data(), times.data());
+
+    // test state
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(sequential.state[i], joint.state[i], 1.0e-8);
+    }
+
+    // test covariance
+    for (int i = 0; i < 4 * nv * nv; i++) {
+      EXPECT_NEAR(sequential.covariance[i], joint.covariance[i], 1.0e-10);
+    }
+
+    // stale measurements don't correct the state
+    std::vector<double> state = joint.state;
+    joint.UpdateMeasurement(sim.ctrl.Get(t), sensor.data(), available.data(),
+                            times.data());
+    EXPECT_EQ(joint.state, state);
+
+    joint.UpdatePrediction();
+    sequential.UpdatePrediction();
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(Estimator, KalmanSteadyStateAllocations) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/particle/task_imu.xml");
+
+  // ----- rollout ----- //
+  int T = 20;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qpos0[1] = {0.25};
+  sim.SetState(qpos0, NULL);
+  sim.Rollout(controller);
+
+  // ----- Kalman ----- //
+
+  // serial and parallel Jacobians
+  Kalman serial(model);
+  Kalman parallel(model);
+  ThreadPool pool(2);
+  parallel.SetThreadPool(&pool);
+  parallel.settings.parallel_jacobian = 1;
+
+  int nv = model->nv;
+  for (Kalman* kalman : {&serial, &parallel}) {
+    mju_copy(kalman->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(kalman->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(kalman->covariance.data(), 2 * nv);
+    mju_scl(kalman->covariance.data(), kalman->covariance.data(), 1.0e-5,
+            (2 * nv) * (2 * nv));
+    mju_fill(kalman->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(kalman->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  // warm up worker data and the pool
+  int warmup = 5;
+  for (int t = 0; t < warmup; t++) {
+    serial.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    parallel.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+  }
+
+  // steady state
+  std::int64_t allocations;
+  {
+    AllocationCounter counter;
+    for (int t = warmup; t < T; t++) {
+      serial.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+      parallel.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    }
+    allocations = counter.count();
+  }
+  EXPECT_EQ(allocations, 0);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -0,0 +1,86 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "mjpc/estimators/measurement_log.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace mjpc {
+namespace {
+
+std::string TempPath(const std::string& name) {
+  return ::testing::TempDir() + name;
+}
+
+MeasurementLog Log(int nstate, int steps) {
+  MeasurementLog log;
+  log.nu = 2;
+  log.nsensordata = 3;
+  log.nstate = nstate;
+  for (int t = 0; t < steps; t++) {
+    std::vector<double> ctrl = {1.0 * t, -1.0 * t};
+    std::vector<double> sensor = {0.1 * t, 0.2 * t, 0.3 * t};
+    std::vector<double> state = {2.0 * t, 3.0 * t, 4.0 * t, 5.0 * t};
+    log.Append(0.01 * t, ctrl.data(), sensor.data(), state.data());
+  }
+  return log;
+}
+
+// test that logs, with and without ground truth, are read back as written
+TEST(MeasurementLogTest, RoundTrip) {
+  for (int nstate : {4, 0}) {
+    std::string path = TempPath("measurement_log_test_round_trip.bin");
+    MeasurementLog log = Log(nstate, 6);
+    EXPECT_EQ(log.state.size(), nstate * 6);
+    ASSERT_TRUE(WriteMeasurementLog(path, log));
+
+    MeasurementLog read;
+    ASSERT_TRUE(ReadMeasurementLog(path, &read));
+    EXPECT_EQ(read.nu, 2);
+    EXPECT_EQ(read.nsensordata, 3);
+    EXPECT_EQ(read.nstate, nstate);
+    EXPECT_EQ(read.Steps(), 6);
+    EXPECT_EQ(read.time, log.time);
+    EXPECT_EQ(read.ctrl, log.ctrl);
+    EXPECT_EQ(read.sensor, log.sensor);
+    EXPECT_EQ(read.state, log.state);
+    EXPECT_EQ(read.Sensor(4)[2], 0.3 * 4);
+  }
+}
+
+// test that other files and inconsistent logs are rejected
+TEST(MeasurementLogTest, Invalid) {
+  MeasurementLog read;
+  EXPECT_FALSE(ReadMeasurementLog(TempPath("measurement_log_missing.bin"),
+                                  &read));
+
+  std::string path = TempPath("measurement_log_test_invalid.bin");
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "MJPCSREC not a measurement log";
+  }
+  EXPECT_FALSE(ReadMeasurementLog(path, &read));
+
+  MeasurementLog log = Log(4, 3);
+  log.sensor.pop_back();
+  EXPECT_FALSE(WriteMeasurementLog(path, log));
+}
+
+}  // namespace
+}  // namespace mjpc
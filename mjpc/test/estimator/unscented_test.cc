@@ -23,6 +23,7 @@
 #include "mjpc/direct/trajectory.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/simulation.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -186,5 +187,180 @@ TEST(Unscented, Box3Drot) {
   mj_deleteModel(model);
 }
 
+TEST(Unscented, ThreadPool) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/box/task3Drot.xml");
+
+  // ----- rollout ----- //
+  int T = 20;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qvel[3] = {1.0, -0.75, 1.25};
+  sim.SetState(NULL, qvel);
+  sim.Rollout(controller);
+
+  // ----- Unscented ----- //
+
+  // serial and threaded filters
+  Unscented serial(model);
+  Unscented threaded(model);
+  ThreadPool pool(3);
+  threaded.SetThreadPool(&pool);
+
+  int nv = model->nv;
+  for (Unscented* unscented : {&serial, &threaded}) {
+    mju_copy(unscented->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(unscented->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(unscented->covariance.data(), 2 * nv);
+    mju_scl(unscented->covariance.data(), unscented->covariance.data(),
+            1.0e-5, (2 * nv) * (2 * nv));
+    mju_fill(unscented->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(unscented->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  for (int t = 0; t < T - 1; t++) {
+    serial.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    threaded.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+
+    // test state
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(threaded.state[i], serial.state[i], 1.0e-10);
+    }
+
+    // test covariance
+    for (int i = 0; i < 4 * nv * nv; i++) {
+      EXPECT_NEAR(threaded.covariance[i], serial.covariance[i], 1.0e-10);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(Unscented, SquareRoot) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/box/task3Drot.xml");
+
+  // ----- rollout ----- //
+  int T = 20;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qvel[3] = {1.0, -0.75, 1.25};
+  sim.SetState(NULL, qvel);
+  sim.Rollout(controller);
+
+  // ----- Unscented ----- //
+
+  // dense and square-root filters
+  Unscented dense(model);
+  Unscented square_root(model);
+  square_root.settings.square_root = 1;
+
+  int nv = model->nv;
+  for (Unscented* unscented : {&dense, &square_root}) {
+    mju_copy(unscented->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(unscented->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(unscented->covariance.data(), 2 * nv);
+    mju_scl(unscented->covariance.data(), unscented->covariance.data(),
+            1.0e-5, (2 * nv) * (2 * nv));
+    mju_fill(unscented->noise_process.data(), 1.0e-5, 2 * nv);
+    mju_fill(unscented->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  for (int t = 0; t < T - 1; t++) {
+    dense.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    square_root.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+
+    // test state
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(square_root.state[i], dense.state[i], 1.0e-8);
+    }
+
+    // test covariance
+    double* covariance = square_root.Covariance();
+    for (int i = 0; i < 4 * nv * nv; i++) {
+      EXPECT_NEAR(covariance[i], dense.covariance[i], 1.0e-10);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(Unscented, Simplex) {
+  // load model
+  mjModel* model = LoadTestModel("estimator/box/task3Drot.xml");
+
+  // ----- rollout ----- //
+  int T = 20;
+  Simulation sim(model, T);
+  auto controller = [](double* ctrl, double time) {};
+  double qvel[3] = {1.0, -0.75, 1.25};
+  sim.SetState(NULL, qvel);
+  sim.Rollout(controller);
+
+  // ----- Unscented ----- //
+
+  // symmetric, simplex and square-root simplex filters
+  Unscented symmetric(model);
+  Unscented simplex(model);
+  Unscented simplex_square_root(model);
+  simplex.settings.sigma_points = kSimplexSigmaPoints;
+  simplex_square_root.settings.sigma_points = kSimplexSigmaPoints;
+  simplex_square_root.settings.square_root = 1;
+
+  int nv = model->nv;
+  int ndstate = 2 * nv;
+  for (Unscented* unscented : {&symmetric, &simplex, &simplex_square_root}) {
+    mju_copy(unscented->state.data(), sim.qpos.Get(0), model->nq);
+    mju_copy(unscented->state.data() + model->nq, sim.qvel.Get(0), nv);
+    mju_eye(unscented->covariance.data(), ndstate);
+    mju_scl(unscented->covariance.data(), unscented->covariance.data(),
+            1.0e-5, ndstate * ndstate);
+    mju_fill(unscented->noise_process.data(), 1.0e-5, ndstate);
+    mju_fill(unscented->noise_sensor.data(), 1.0e-5, model->nsensordata);
+  }
+
+  for (int t = 0; t < T - 1; t++) {
+    symmetric.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    simplex.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+    simplex_square_root.Update(sim.ctrl.Get(t), sim.sensor.Get(t));
+
+    // sigma points
+    EXPECT_EQ(symmetric.NumSigmaPoints(), 2 * ndstate + 1);
+    EXPECT_EQ(simplex.NumSigmaPoints(), ndstate + 2);
+
+    // test accuracy of both sets
+    for (Unscented* unscented : {&symmetric, &simplex}) {
+      std::vector<double> pos_error(nv);
+      mju_subQuat(pos_error.data(), unscented->state.data(),
+                  sim.qpos.Get(t + 1));
+      EXPECT_NEAR(mju_norm(pos_error.data(), nv), 0.0, 1.0e-4);
+
+      std::vector<double> vel_error(nv);
+      mju_sub(vel_error.data(), unscented->state.data() + model->nq,
+              sim.qvel.Get(t + 1), nv);
+      EXPECT_NEAR(mju_norm(vel_error.data(), nv), 0.0, 1.0e-4);
+    }
+
+    // simplex covariance matches the symmetric set's
+    double trace_symmetric = Trace(symmetric.covariance.data(), ndstate);
+    double trace_simplex = Trace(simplex.covariance.data(), ndstate);
+    EXPECT_NEAR(trace_simplex / trace_symmetric, 1.0, 1.0e-2);
+
+    // square-root mode propagates the same simplex statistics
+    double* covariance = simplex_square_root.Covariance();
+    for (int i = 0; i < model->nq + nv; i++) {
+      EXPECT_NEAR(simplex_square_root.state[i], simplex.state[i], 1.0e-8);
+    }
+    for (int i = 0; i < ndstate * ndstate; i++) {
+      EXPECT_NEAR(covariance[i], simplex.covariance[i], 1.0e-10);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
 }  // namespace
 }  // namespace mjpc
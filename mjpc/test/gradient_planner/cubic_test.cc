@@ -150,9 +150,60 @@ TEST(GradientTest, CubicTest) {
   csm.Compute(x, S, t, T);
 
   // mapping error
+  double mapping[n * T * n * S];
+  csm.Dense(mapping);
   double map_error[n * T * n * S];
-  mju_sub(map_error, M, csm.mapping.data(), n * T * n * S);
+  mju_sub(map_error, M, mapping, n * T * n * S);
   EXPECT_NEAR(mju_L1(map_error, n * T * n * S), 0.0, 1.0e-5);
+
+  // structured application
+  double values[n * T];
+  csm.Apply(values, y);
+  double values_mat[n * T];
+  mju_mulMatVec(values_mat, M, y, n * T, n * S);
+  mju_sub(error, values, values_mat, n * T);
+  EXPECT_NEAR(mju_L1(error, n * T), 0.0, 1.0e-5);
+
+  double parameters[n * S];
+  csm.ApplyTranspose(parameters, values);
+  double parameters_mat[n * S];
+  mju_mulMatTVec(parameters_mat, M, values, n * T, n * S);
+  double parameter_error[n * S];
+  mju_sub(parameter_error, parameters, parameters_mat, n * S);
+  EXPECT_NEAR(mju_L1(parameter_error, n * S), 0.0, 1.0e-5);
+}
+
+// precomputed cubic spline matches CubicInterpolation
+TEST(GradientTest, CubicSpline) {
+  // spline points
+  const int S = 6;
+  std::vector<double> x = {0.1, 0.3, 0.7, 1.2, 1.21, 1.6};
+
+  // values
+  const int n = 2;
+  double y[n * S] = {-1.0, 0.2, 0.5, 0.7, 0.1,   0.34,
+                     -0.7, 0.9, 0.2, 0.1, -0.05, 1.0};
+
+  CubicSpline spline;
+  spline.Compute(x, y, n, S);
+
+  // inside, at and outside the knots
+  for (double t = 0.0; t < 1.8; t += 0.05) {
+    double expected[n];
+    CubicInterpolation(expected, t, x, y, n, S);
+    double output[n];
+    spline.Interpolate(output, t);
+    EXPECT_NEAR(output[0], expected[0], 1.0e-12);
+    EXPECT_NEAR(output[1], expected[1], 1.0e-12);
+  }
+  for (int k = 0; k < S; k++) {
+    double expected[n];
+    CubicInterpolation(expected, x[k], x, y, n, S);
+    double output[n];
+    spline.Interpolate(output, x[k]);
+    EXPECT_NEAR(output[0], expected[0], 1.0e-12);
+    EXPECT_NEAR(output[1], expected[1], 1.0e-12);
+  }
 }
 
 }  // namespace
@@ -46,8 +46,8 @@ void sensor(const mjModel* model, mjData* data, int stage) {
   }
 }
 
-// test gradient planner on particle task
-TEST(GradientPlannerTest, Particle) {
+// test gradient planner on particle task with a gradient mode
+void TestParticle(int gradient_mode) {
   // load model
   model = LoadTestModel("particle_task.xml");
   task.Reset(model);
@@ -69,6 +69,7 @@ TEST(GradientPlannerTest, Particle) {
   planner.Initialize(model, task);
   planner.Allocate();
   planner.Reset(kMaxTrajectoryHorizon);
+  planner.settings.gradient_mode = gradient_mode;
 
   // ----- settings ----- //
   int iterations = 50;
@@ -121,5 +122,11 @@ TEST(GradientPlannerTest, Particle) {
   mj_deleteModel(model);
 }
 
+TEST(GradientPlannerTest, Particle) { TestParticle(/*gradient_mode=*/1); }
+
+TEST(GradientPlannerTest, ParticleParameterGradient) {
+  TestParticle(/*gradient_mode=*/2);
+}
+
 }  // namespace
 }  // namespace mjpc
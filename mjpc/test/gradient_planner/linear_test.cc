@@ -94,9 +94,65 @@ TEST(GradientTest, LinearTest) {
   lsm.Compute(x, S, t, T);
 
   // mapping error
+  double mapping[n * T * n * S];
+  lsm.Dense(mapping);
   double map_error[n * T * n * S];
-  mju_sub(map_error, M, lsm.mapping.data(), n * T * n * S);
+  mju_sub(map_error, M, mapping, n * T * n * S);
   EXPECT_NEAR(mju_L1(map_error, n * T * n * S), 0.0, 1.0e-5);
+
+  // structured application
+  double values[n * T];
+  lsm.Apply(values, y);
+  double values_mat[n * T];
+  mju_mulMatVec(values_mat, M, y, n * T, n * S);
+  mju_sub(error, values, values_mat, n * T);
+  EXPECT_NEAR(mju_L1(error, n * T), 0.0, 1.0e-5);
+
+  double parameters[n * S];
+  lsm.ApplyTranspose(parameters, values);
+  double parameters_mat[n * S];
+  mju_mulMatTVec(parameters_mat, M, values, n * T, n * S);
+  double parameter_error[n * S];
+  mju_sub(parameter_error, parameters, parameters_mat, n * S);
+  EXPECT_NEAR(mju_L1(parameter_error, n * S), 0.0, 1.0e-5);
+}
+
+// test least-squares fit of linear-spline parameters
+TEST(GradientTest, LinearFitTest) {
+  // spline points
+  const int S = 6;
+
+  // domain
+  std::vector<double> x = {0.1, 0.3, 0.7, 1.2, 1.21, 1.6};
+
+  // values
+  const int n = 2;
+  double y[n * S] = {-1.0, 0.2, 0.5, 0.7, 0.1,   0.34,
+                     -0.7, 0.9, 0.2, 0.1, -0.05, 1.0};
+
+  // times
+  const int T = 10;
+  double t[T];
+  double dt = (x[S - 1] - x[0]) / (T - 1);
+  t[0] = x[0];
+  for (int i = 1; i < T; i++) {
+    t[i] = t[i - 1] + dt;
+  }
+
+  LinearSplineMapping lsm;
+  lsm.Allocate(n);
+  lsm.Compute(x, S, t, T);
+
+  // interpolated values
+  double values[n * T];
+  lsm.Apply(values, y);
+
+  // fit recovers spline parameters
+  double parameters[n * S];
+  lsm.Fit(parameters, values);
+  double error[n * S];
+  mju_sub(error, parameters, y, n * S);
+  EXPECT_NEAR(mju_L1(error, n * S), 0.0, 1.0e-5);
 }
 
 }  // namespace
@@ -81,9 +81,27 @@ TEST(GradientTest, ZeroTest) {
   zsm.Compute(x, S, t, T);
 
   // mapping error
+  double mapping[n * T * n * S];
+  zsm.Dense(mapping);
   double map_error[n * T * n * S];
-  mju_sub(map_error, M, zsm.mapping.data(), n * T * n * S);
+  mju_sub(map_error, M, mapping, n * T * n * S);
   EXPECT_NEAR(mju_L1(map_error, n * T * n * S), 0.0, 1.0e-5);
+
+  // structured application
+  double values[n * T];
+  zsm.Apply(values, y);
+  double values_mat[n * T];
+  mju_mulMatVec(values_mat, M, y, n * T, n * S);
+  mju_sub(error, values, values_mat, n * T);
+  EXPECT_NEAR(mju_L1(error, n * T), 0.0, 1.0e-5);
+
+  double parameters[n * S];
+  zsm.ApplyTranspose(parameters, values);
+  double parameters_mat[n * S];
+  mju_mulMatTVec(parameters_mat, M, values, n * T, n * S);
+  double parameter_error[n * S];
+  mju_sub(parameter_error, parameters, parameters_mat, n * S);
+  EXPECT_NEAR(mju_L1(parameter_error, n * S), 0.0, 1.0e-5);
 }
 
 }  // namespace
@@ -14,12 +14,18 @@
 
 #include "mjpc/planners/ilqg/backward_pass.h"
 
+#include <chrono>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
 #include <mujoco/mujoco.h>
 
 #include "gtest/gtest.h"
 #include "mjpc/planners/cost_derivatives.h"
 #include "mjpc/planners/model_derivatives.h"
 #include "mjpc/test/lqr.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
@@ -139,5 +145,306 @@ TEST(iLQGTest, BackwardPass) {
   }
 }
 
+// random time-varying problem with stable dynamics and convex costs
+void RandomRiccatiProblem(ModelDerivatives& md, CostDerivatives& cd, int n,
+                          int m, int T) {
+  md.Allocate(n, m, 0, T);
+  cd.Allocate(n, m, 0, T, n + m);
+  unsigned int seed = 3;
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) % 2001) / 1000.0 - 1.0;
+  };
+  for (int t = 0; t < T; t++) {
+    double* cxt = DataAt(cd.cx, t * n);
+    double* cxxt = DataAt(cd.cxx, t * n * n);
+    for (int i = 0; i < n; i++) {
+      cxt[i] = random();
+      cxxt[i * n + i] = 1.0 + 0.5 * random();
+    }
+    if (t == T - 1) continue;
+    double* At = DataAt(md.A, t * n * n);
+    double* Bt = DataAt(md.B, t * n * m);
+    double* cut = DataAt(cd.cu, t * m);
+    double* cuut = DataAt(cd.cuu, t * m * m);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        At[i * n + j] = (i == j ? 0.9 : 0.0) + 0.05 * random();
+      }
+      for (int j = 0; j < m; j++) Bt[i * m + j] = 0.1 * random();
+    }
+    for (int i = 0; i < m; i++) {
+      cut[i] = random();
+      cuut[i * m + i] = 0.1 + 0.05 * random();
+    }
+  }
+}
+
+// test that the partitioned backward pass matches the sequential one
+TEST(iLQGTest, PartitionedBackwardPass) {
+  const int n = 6;
+  const int m = 2;
+  const int T = 61;
+  ModelDerivatives md;
+  CostDerivatives cd;
+  RandomRiccatiProblem(md, cd, n, m, T);
+  double action_limits[2 * m] = {-1.0, 1.0, -1.0, 1.0};
+  std::vector<double> actions((T - 1) * m, 0.1);
+  ThreadPool pool(3);
+
+  for (int limits = 0; limits < 2; limits++) {
+    iLQGSettings settings;
+    settings.action_limits = limits;
+    iLQGPolicy sequential_policy, partitioned_policy;
+    for (iLQGPolicy* p : {&sequential_policy, &partitioned_policy}) {
+      p->feedback_gain.resize(m * n * T);
+      p->action_improvement.resize(m * T);
+    }
+
+    // sequential
+    iLQGBackwardPass sequential;
+    sequential.Allocate(n, m, T);
+    BoxQP boxqp;
+    boxqp.Allocate(m);
+    sequential.Riccati(&sequential_policy, &md, &cd, n, m, T, 1.0e-3, boxqp,
+                       actions.data(), action_limits, settings);
+
+    // partitioned, from zero and then from the solution
+    iLQGBackwardPass partitioned;
+    partitioned.Allocate(n, m, T);
+    for (int solve = 0; solve < 2; solve++) {
+      int sweeps = partitioned.RiccatiPartitioned(
+          &partitioned_policy, &md, &cd, n, m, T, 1.0e-3, actions.data(),
+          action_limits, settings.regularization_type, limits, 4, 1.0e-10,
+          pool);
+      EXPECT_GT(sweeps, 0);
+      if (solve == 1) EXPECT_EQ(sweeps, 1);
+
+      for (int i = 0; i < n * T; i++) {
+        EXPECT_NEAR(partitioned.Vx[i], sequential.Vx[i], 1.0e-6);
+      }
+      for (int i = 0; i < n * n * T; i++) {
+        EXPECT_NEAR(partitioned.Vxx[i], sequential.Vxx[i], 1.0e-6);
+      }
+      for (int i = 0; i < m * n * T; i++) {
+        EXPECT_NEAR(partitioned_policy.feedback_gain[i],
+                    sequential_policy.feedback_gain[i], 1.0e-6);
+      }
+      for (int i = 0; i < m * T; i++) {
+        EXPECT_NEAR(partitioned_policy.action_improvement[i],
+                    sequential_policy.action_improvement[i], 1.0e-6);
+      }
+      EXPECT_NEAR(partitioned.dV[0], sequential.dV[0], 1.0e-6);
+      EXPECT_NEAR(partitioned.dV[1], sequential.dV[1], 1.0e-6);
+    }
+  }
+}
+
+// test that a warm-started boxQP keeps the solution and active set of a
+// repeated backward pass
+TEST(iLQGTest, BoxQPWarmStart) {
+  const int n = 6;
+  const int m = 2;
+  const int T = 21;
+  ModelDerivatives md;
+  CostDerivatives cd;
+  RandomRiccatiProblem(md, cd, n, m, T);
+  double action_limits[2 * m] = {-0.2, 0.2, -0.2, 0.2};
+  std::vector<double> actions((T - 1) * m, 0.1);
+
+  iLQGBackwardPass bp;
+  bp.Allocate(n, m, T);
+  BoxQP boxqp;
+  boxqp.Allocate(m);
+  std::vector<double> Vx(n * T), Vxx(n * n * T), du(m * T), K(m * n * T);
+  std::vector<double> cold(m * T);
+
+  for (int pass = 0; pass < 2; pass++) {
+    mju_zero(bp.dV, 2);
+    mju_copy(DataAt(Vx, (T - 1) * n), DataAt(cd.cx, (T - 1) * n), n);
+    mju_copy(DataAt(Vxx, (T - 1) * n * n), DataAt(cd.cxx, (T - 1) * n * n),
+             n * n);
+    for (int t = T - 2; t >= 0; t--) {
+      int status = bp.RiccatiStep(
+          n, m, 1.0e-3, DataAt(Vx, (t + 1) * n), DataAt(Vxx, (t + 1) * n * n),
+          DataAt(md.A, t * n * n), DataAt(md.B, t * n * m),
+          DataAt(cd.cx, t * n), DataAt(cd.cu, t * m),
+          DataAt(cd.cxx, t * n * n), DataAt(cd.cxu, t * n * m),
+          DataAt(cd.cuu, t * m * m), DataAt(Vx, t * n),
+          DataAt(Vxx, t * n * n), DataAt(du, t * m), DataAt(K, t * m * n),
+          bp.dV, DataAt(bp.Qx, t * n), DataAt(bp.Qu, t * m),
+          DataAt(bp.Qxx, t * n * n), DataAt(bp.Qxu, t * n * m),
+          DataAt(bp.Quu, t * m * m), bp.Q_scratch.data(), boxqp,
+          DataAt(actions, t * m), action_limits, kControlRegularization, 1,
+          DataAt(bp.boxqp_solution, t * m), DataAt(bp.boxqp_free, t * m));
+      ASSERT_EQ(status, 1);
+    }
+    if (pass == 0) {
+      // cold start
+      EXPECT_EQ(boxqp.num_solve, 0);
+      cold = du;
+    }
+  }
+
+  // warm start at each time step, same active sets and solutions
+  EXPECT_EQ(boxqp.num_solve, T - 1);
+  EXPECT_EQ(boxqp.num_change, 0);
+  for (int i = 0; i < m * (T - 1); i++) {
+    EXPECT_NEAR(du[i], cold[i], 1.0e-8);
+    EXPECT_NEAR(bp.boxqp_solution[i], du[i], 1.0e-12);
+  }
+
+  // shifted solutions, new time steps aren't warm-started
+  bp.ShiftBoxQP(2, m);
+  EXPECT_NEAR(bp.boxqp_solution[0], du[2 * m], 1.0e-12);
+  EXPECT_EQ(bp.boxqp_free[(T - 2) * m], -1);
+  EXPECT_GE(bp.boxqp_free[(T - 4) * m], 0);
+  bp.ShiftBoxQP(-1, m);
+  EXPECT_EQ(bp.boxqp_free[0], -1);
+}
+
+// reference expansion with separate matrix products
+void ReferenceExpansion(double* Qxx, double* Qxu, double* Quu, double* Qx,
+                        double* Qu, const double* A, const double* B,
+                        const double* Wxx, const double* Wx, int n, int m,
+                        double* tmp) {
+  mju_mulMatTMat(tmp, A, Wxx, n, n, n);
+  mju_mulMatMat(Qxx, tmp, A, n, n, n);
+  mju_mulMatMat(Qxu, tmp, B, n, n, m);
+  mju_mulMatTMat(tmp, B, Wxx, n, m, n);
+  mju_mulMatMat(Quu, tmp, B, m, n, m);
+  mju_mulMatTVec(Qx, A, Wx, n, n);
+  mju_mulMatTVec(Qu, B, Wx, n, m);
+}
+
+// random problem of size n, m
+void RandomExpansionProblem(std::vector<double>& A, std::vector<double>& B,
+                            std::vector<double>& Wxx, std::vector<double>& Wx,
+                            int n, int m) {
+  A.resize(n * n);
+  B.resize(n * m);
+  Wxx.resize(n * n);
+  Wx.resize(n);
+  unsigned int seed = 1;
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) % 2001) / 1000.0 - 1.0;
+  };
+  for (double& a : A) a = random();
+  for (double& b : B) b = random();
+  for (double& w : Wx) w = random();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j <= i; j++) {
+      Wxx[i * n + j] = Wxx[j * n + i] = random();
+    }
+  }
+}
+
+// test fused value expansion against separate products
+TEST(iLQGTest, ValueExpansion) {
+  const int n = 7;
+  const int m = 3;
+  const int k = n + m;
+  std::vector<double> A, B, Wxx, Wx;
+  RandomExpansionProblem(A, B, Wxx, Wx, n, m);
+
+  // fused
+  std::vector<double> Q(k * k), q(k), scratch(2 * n * k);
+  ValueExpansion(Q.data(), q.data(), A.data(), B.data(), Wxx.data(), Wx.data(),
+                 n, m, scratch.data());
+
+  // reference
+  double Qxx[n * n], Qxu[n * m], Quu[m * m], Qx[n], Qu[m], tmp[n * n];
+  ReferenceExpansion(Qxx, Qxu, Quu, Qx, Qu, A.data(), B.data(), Wxx.data(),
+                     Wx.data(), n, m, tmp);
+
+  // test
+  for (int i = 0; i < n; i++) {
+    EXPECT_NEAR(q[i], Qx[i], 1.0e-10);
+    for (int j = 0; j < n; j++) {
+      EXPECT_NEAR(Q[i * k + j], Qxx[i * n + j], 1.0e-10);
+    }
+    for (int j = 0; j < m; j++) {
+      EXPECT_NEAR(Q[i * k + n + j], Qxu[i * m + j], 1.0e-10);
+      EXPECT_NEAR(Q[(n + j) * k + i], Qxu[i * m + j], 1.0e-10);
+    }
+  }
+  for (int i = 0; i < m; i++) {
+    EXPECT_NEAR(q[n + i], Qu[i], 1.0e-10);
+    for (int j = 0; j < m; j++) {
+      EXPECT_NEAR(Q[(n + i) * k + n + j], Quu[i * m + j], 1.0e-10);
+    }
+  }
+}
+
+// test compiled value expansions against the generic one
+TEST(iLQGTest, FixedValueExpansion) {
+  for (auto [n, m] : {std::pair{1, 1}, std::pair{4, 1}, std::pair{4, 2},
+                      std::pair{7, 3}, std::pair{16, 4}}) {
+    int k = n + m;
+    std::vector<double> A, B, Wxx, Wx;
+    RandomExpansionProblem(A, B, Wxx, Wx, n, m);
+    ValueExpansionFunction expansion = FixedValueExpansion(n, m);
+    EXPECT_NE(expansion, &ValueExpansion);
+
+    std::vector<double> Q(k * k), q(k), scratch(2 * n * k);
+    std::vector<double> fixed_Q(k * k), fixed_q(k);
+    ValueExpansion(Q.data(), q.data(), A.data(), B.data(), Wxx.data(),
+                   Wx.data(), n, m, scratch.data());
+    expansion(fixed_Q.data(), fixed_q.data(), A.data(), B.data(), Wxx.data(),
+              Wx.data(), n, m, nullptr);
+    for (int i = 0; i < k * k; i++) {
+      EXPECT_NEAR(fixed_Q[i], Q[i], 1.0e-12) << n << " " << m;
+    }
+    for (int i = 0; i < k; i++) {
+      EXPECT_NEAR(fixed_q[i], q[i], 1.0e-12) << n << " " << m;
+    }
+  }
+
+  // larger models use the generic expansion
+  EXPECT_EQ(FixedValueExpansion(kFixedExpansionMaxState + 1, 1),
+            &ValueExpansion);
+  EXPECT_EQ(FixedValueExpansion(4, kFixedExpansionMaxAction + 1),
+            &ValueExpansion);
+}
+
+// compare fused value expansion and separate products at humanoid size
+TEST(iLQGTest, ValueExpansionBenchmark) {
+  const int n = 56;
+  const int m = 21;
+  const int k = n + m;
+  const int iterations = 200;
+  std::vector<double> A, B, Wxx, Wx;
+  RandomExpansionProblem(A, B, Wxx, Wx, n, m);
+
+  // fused
+  std::vector<double> Q(k * k), q(k), scratch(2 * n * k);
+  auto fused_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    ValueExpansion(Q.data(), q.data(), A.data(), B.data(), Wxx.data(),
+                   Wx.data(), n, m, scratch.data());
+  }
+  double fused_time = GetDuration(fused_start);
+
+  // reference
+  std::vector<double> Qxx(n * n), Qxu(n * m), Quu(m * m), Qx(n), Qu(m);
+  std::vector<double> tmp(n * n);
+  auto reference_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    ReferenceExpansion(Qxx.data(), Qxu.data(), Quu.data(), Qx.data(),
+                       Qu.data(), A.data(), B.data(), Wxx.data(), Wx.data(), n,
+                       m, tmp.data());
+  }
+  double reference_time = GetDuration(reference_start);
+
+  std::printf("value expansion (n = %i, m = %i): fused %.2f us, separate "
+              "%.2f us\n",
+              n, m, fused_time / iterations, reference_time / iterations);
+
+  // test
+  EXPECT_NEAR(Q[(k - 1) * k + k - 1], Quu[m * m - 1],
+              1.0e-8 * mju_max(1.0, mju_abs(Quu[m * m - 1])));
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <vector>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
 #include "mjpc/planners/ilqg/planner.h"
@@ -125,5 +127,206 @@ TEST(iLQGTest, Particle) {
   mj_deleteModel(model);
 }
 
+// test iLQG planner with a multiple-shooting nominal on particle task
+TEST(iLQGTest, MultipleShooting) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // set data
+  mj_forward(model, data);
+
+  // state
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // settings
+  int iterations = 25;
+  double horizon = 2.5;
+  double timestep = 0.1;
+  int steps =
+      mju_max(mju_min(horizon / timestep + 1, kMaxTrajectoryHorizon), 1);
+  model->opt.timestep = timestep;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(3);
+
+  // planner, the nominal is split into three segments
+  iLQGPlanner planner;
+  planner.Initialize(model, task);
+  planner.settings.shooting_segments = 3;
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+
+  // optimize
+  for (int i = 0; i < iterations; i++) {
+    planner.OptimizePolicy(steps, pool);
+  }
+
+  // test final state of the (single-shooting) best rollout
+  int dim_state = model->nq + model->nv;
+  const Trajectory* best = planner.BestTrajectory();
+  EXPECT_NEAR(best->states[(steps - 1) * dim_state], state.mocap()[0],
+              1.0e-2);
+  EXPECT_NEAR(best->states[(steps - 1) * dim_state + 1], state.mocap()[1],
+              1.0e-2);
+
+  // the nominal starts at the current state
+  for (int i = 0; i < dim_state; i++) {
+    EXPECT_NEAR(planner.candidate_policy[0].trajectory.states[i],
+                state.state()[i], 1.0e-10);
+  }
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
+// test pipelined and streamed derivatives match the phased iteration
+TEST(iLQGTest, Pipeline) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // set data
+  mj_forward(model, data);
+
+  // state
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // settings
+  int iterations = 5;
+  double horizon = 2.5;
+  double timestep = 0.1;
+  int steps =
+      mju_max(mju_min(horizon / timestep + 1, kMaxTrajectoryHorizon), 1);
+  model->opt.timestep = timestep;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(2);
+
+  // planners
+  iLQGPlanner phased;
+  iLQGPlanner pipelined;
+  iLQGPlanner streamed;
+  streamed.settings.derivative_window = 4;
+  for (iLQGPlanner* planner : {&phased, &pipelined, &streamed}) {
+    planner->Initialize(model, task);
+    planner->Allocate();
+    planner->Reset(kMaxTrajectoryHorizon);
+    planner->SetState(state);
+  }
+  pipelined.settings.pipeline = 1;
+
+  // optimize
+  for (int i = 0; i < iterations; i++) {
+    phased.OptimizePolicy(steps, pool);
+    pipelined.OptimizePolicy(steps, pool);
+    streamed.OptimizePolicy(steps, pool);
+  }
+
+  // test
+  int dim_state = model->nq + model->nv;
+  for (int i = 0; i < steps * dim_state; i++) {
+    EXPECT_NEAR(pipelined.candidate_policy[0].trajectory.states[i],
+                phased.candidate_policy[0].trajectory.states[i], 1.0e-10);
+  }
+  EXPECT_NEAR(pipelined.candidate_policy[0].trajectory.total_return,
+              phased.candidate_policy[0].trajectory.total_return, 1.0e-10);
+  for (int i = 0; i < steps * dim_state; i++) {
+    EXPECT_NEAR(streamed.candidate_policy[0].trajectory.states[i],
+                phased.candidate_policy[0].trajectory.states[i], 1.0e-10);
+  }
+  EXPECT_NEAR(streamed.candidate_policy[0].trajectory.total_return,
+              phased.candidate_policy[0].trajectory.total_return, 1.0e-10);
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
+// test allocation and reset on a pool match the calling thread's
+TEST(iLQGTest, AllocationPool) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+  mj_forward(model, data);
+
+  // state
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // settings
+  int steps = 26;
+  model->opt.timestep = 0.1;
+  mjcb_sensor = sensor;
+
+  // planners, allocated and reset on the calling thread and on a pool
+  ThreadPool allocation_pool(4);
+  iLQGPlanner serial, parallel;
+  serial.Initialize(model, task);
+  serial.Allocate();
+  serial.Reset(kMaxTrajectoryHorizon);
+  parallel.Initialize(model, task);
+  parallel.SetAllocationPool(&allocation_pool);
+  parallel.Allocate();
+  parallel.Reset(kMaxTrajectoryHorizon);
+  parallel.SetAllocationPool(nullptr);
+
+  // optimize
+  ThreadPool pool(1);
+  for (iLQGPlanner* planner : {&serial, &parallel}) {
+    planner->SetState(state);
+    for (int i = 0; i < 5; i++) planner->OptimizePolicy(steps, pool);
+  }
+
+  // test same plans
+  const std::vector<double>& serial_actions =
+      serial.candidate_policy[0].trajectory.actions;
+  const std::vector<double>& parallel_actions =
+      parallel.candidate_policy[0].trajectory.actions;
+  for (int i = 0; i < (steps - 1) * model->nu; i++) {
+    EXPECT_EQ(serial_actions[i], parallel_actions[i]);
+  }
+
+  // delete data + model
+  mj_deleteData(data);
+  mj_deleteModel(model);
+
+  // unset callback
+  mjcb_sensor = nullptr;
+}
+
 }  // namespace
 }  // namespace mjpc
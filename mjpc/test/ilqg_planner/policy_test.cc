@@ -0,0 +1,210 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/ilqg/policy.h"
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+namespace {
+
+// the action of policy, interpolating the full gain matrix
+void ReferenceAction(const iLQGPolicy& policy, double* action,
+                     const double* state, double time) {
+  const mjModel* model = policy.model;
+  const Trajectory& trajectory = policy.trajectory;
+  int dim_state = model->nq + model->nv + model->na;
+  int dim_state_derivative = 2 * model->nv + model->na;
+  int dim_action = model->nu;
+  int dim_gain = dim_action * dim_state_derivative;
+  int horizon = trajectory.horizon;
+  std::vector<double> state_interp(dim_state);
+  std::vector<double> gain(dim_gain);
+
+  int bounds[2];
+  FindInterval(bounds, trajectory.times, time, horizon);
+  auto interpolation = policy.representation == 1 ? LinearInterpolation
+                                                  : CubicInterpolation;
+  if (bounds[0] == bounds[1] || policy.representation == 0) {
+    interpolation = ZeroInterpolation;
+  }
+  interpolation(action, time, trajectory.times, trajectory.actions.data(),
+                dim_action, horizon - 1);
+  if (state) {
+    interpolation(state_interp.data(), time, trajectory.times,
+                  trajectory.states.data(), dim_state, horizon);
+    interpolation(gain.data(), time, trajectory.times,
+                  policy.feedback_gain.data(), dim_gain, horizon - 1);
+    std::vector<double> error(dim_state_derivative);
+    std::vector<double> feedback(dim_action);
+    StateDiff(model, error.data(), state_interp.data(), state, 1.0);
+    mju_mulMatVec(feedback.data(), gain.data(), error.data(), dim_action,
+                  dim_state_derivative);
+    mju_addToScl(action, feedback.data(), policy.feedback_scaling,
+                 dim_action);
+  }
+  Clamp(action, model->actuator_ctrlrange, dim_action);
+}
+
+// random reference trajectory and gains of horizon knots from time 0.3
+void RandomPolicy(iLQGPolicy* policy, int horizon, unsigned seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> uniform(-0.1, 0.1);
+  auto fill = [&](std::vector<double>& values, int n) {
+    for (int i = 0; i < n; i++) values[i] = uniform(generator);
+  };
+  const mjModel* model = policy->model;
+  Trajectory& trajectory = policy->trajectory;
+  trajectory.horizon = horizon;
+  for (int t = 0; t < horizon; t++) trajectory.times[t] = 0.3 + 0.1 * t;
+  fill(trajectory.states, horizon * trajectory.dim_state);
+  fill(trajectory.actions, horizon * trajectory.dim_action);
+  fill(policy->feedback_gain,
+       horizon * model->nu * (2 * model->nv + model->na));
+  policy->feedback_scaling = 0.7;
+}
+
+// query times: forward in small steps, jumps back and out of range
+std::vector<double> QueryTimes() {
+  std::vector<double> times;
+  for (int i = 0; i < 140; i++) times.push_back(0.25 + 0.01 * i);
+  for (double time : {0.95, 0.35, 0.35, 0.0, 5.0, 1.2, 0.3, 1.1, 0.4}) {
+    times.push_back(time);
+  }
+  return times;
+}
+
+// test that Action and CachedAction match full gain interpolation
+TEST(iLQGPolicyTest, Action) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+  int dim_state = model->nq + model->nv + model->na;
+  std::vector<double> state(dim_state, 0.05);
+  std::vector<double> action(nu), cached(nu), expected(nu);
+
+  for (int representation = 0; representation < 3; representation++) {
+    iLQGPolicy policy;
+    policy.Allocate(model, task, kMaxTrajectoryHorizon);
+    policy.Reset(kMaxTrajectoryHorizon);
+    RandomPolicy(&policy, 10, representation);
+    policy.representation = representation;
+
+    for (double time : QueryTimes()) {
+      for (const double* s : {state.data(), static_cast<double*>(nullptr)}) {
+        ReferenceAction(policy, expected.data(), s, time);
+        policy.Action(action.data(), s, time);
+        policy.CachedAction(cached.data(), s, time);
+        for (int i = 0; i < nu; i++) {
+          EXPECT_NEAR(action[i], expected[i], 1.0e-12)
+              << representation << " " << time;
+          EXPECT_NEAR(cached[i], expected[i], 1.0e-12)
+              << representation << " " << time;
+        }
+      }
+    }
+  }
+  mj_deleteModel(model);
+}
+
+// test that a copied policy doesn't reuse the slopes it cached before
+TEST(iLQGPolicyTest, CacheAfterCopy) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+  std::vector<double> state(model->nq + model->nv + model->na, 0.05);
+  std::vector<double> cached(nu), expected(nu);
+
+  iLQGPolicy policy, other;
+  for (iLQGPolicy* p : {&policy, &other}) {
+    p->Allocate(model, task, kMaxTrajectoryHorizon);
+    p->Reset(kMaxTrajectoryHorizon);
+    p->representation = 2;
+  }
+  RandomPolicy(&policy, 10, 1);
+  RandomPolicy(&other, 10, 2);
+
+  policy.CachedAction(cached.data(), state.data(), 0.55);
+  policy = other;
+  policy.CachedAction(cached.data(), state.data(), 0.56);
+  ReferenceAction(other, expected.data(), state.data(), 0.56);
+  for (int i = 0; i < nu; i++) {
+    EXPECT_NEAR(cached[i], expected[i], 1.0e-12);
+  }
+  mj_deleteModel(model);
+}
+
+// test that published copies, compact or not, match the source policy
+TEST(iLQGPolicyTest, PublishFrom) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+  int dim_gain = nu * (2 * model->nv + model->na);
+  std::vector<double> state(model->nq + model->nv + model->na, 0.05);
+  std::vector<double> action(nu), expected(nu);
+
+  for (int representation = 0; representation < 3; representation++) {
+    iLQGPolicy policy;
+    policy.Allocate(model, task, kMaxTrajectoryHorizon);
+    policy.Reset(kMaxTrajectoryHorizon);
+    RandomPolicy(&policy, 10, representation);
+    policy.representation = representation;
+
+    for (bool compact : {false, true}) {
+      // published storage covers the horizon only
+      iLQGPolicy published;
+      published.PublishFrom(policy, compact);
+      EXPECT_EQ(published.compact, compact);
+      if (compact) {
+        EXPECT_EQ(published.compact_gain.size(), 10 * dim_gain);
+        EXPECT_TRUE(published.feedback_gain.empty());
+      } else {
+        EXPECT_EQ(published.feedback_gain.size(), 10 * dim_gain);
+      }
+
+      // float32 gains change the feedback by their rounding only
+      double tolerance = compact ? 1.0e-6 : 1.0e-12;
+      for (double time : QueryTimes()) {
+        policy.Action(expected.data(), state.data(), time);
+        published.CachedAction(action.data(), state.data(), time);
+        for (int i = 0; i < nu; i++) {
+          EXPECT_NEAR(action[i], expected[i], tolerance)
+              << representation << " " << compact << " " << time;
+        }
+      }
+
+      // exported gains
+      ExportedPolicy exported;
+      published.Export(exported);
+      ASSERT_EQ(exported.gains.size(), 9 * dim_gain);
+      for (int i = 0; i < 9 * dim_gain; i++) {
+        EXPECT_NEAR(exported.gains[i], policy.feedback_gain[i], tolerance);
+      }
+    }
+  }
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
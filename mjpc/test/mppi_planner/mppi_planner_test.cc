@@ -0,0 +1,145 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <limits>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/mppi/planner.h"
+#include "mjpc/states/state.h"
+#include "mjpc/task.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+#include "mjpc/threadpool.h"
+
+namespace mjpc {
+namespace {
+
+// load model
+mjModel* model;
+
+// state
+State state;
+
+// task
+ParticleTestTask task;
+
+// sensor callback
+void sensor(const mjModel* model, mjData* data, int stage) {
+  if (stage == mjSTAGE_ACC) {
+    task.Residual(model, data, data->sensordata);
+  }
+}
+
+// test exponential sample weights
+TEST(MPPIPlannerTest, SampleWeights) {
+  double inf = std::numeric_limits<double>::infinity();
+  double returns[4] = {2.0, 1.0, inf, 3.0};
+  double weights[4];
+
+  // weights relative to the best return, unfinished samples excluded
+  double effective =
+      MPPIPlanner::SampleWeights(weights, returns, 4, /*temperature=*/1.0);
+  double sum = 1.0 + std::exp(-1.0) + std::exp(-2.0);
+  EXPECT_NEAR(weights[0], std::exp(-1.0) / sum, 1.0e-12);
+  EXPECT_NEAR(weights[1], 1.0 / sum, 1.0e-12);
+  EXPECT_EQ(weights[2], 0.0);
+  EXPECT_NEAR(weights[3], std::exp(-2.0) / sum, 1.0e-12);
+  double sum_squares = weights[0] * weights[0] + weights[1] * weights[1] +
+                       weights[3] * weights[3];
+  EXPECT_NEAR(effective, 1.0 / sum_squares, 1.0e-12);
+
+  // high temperature: uniform over finished samples
+  effective = MPPIPlanner::SampleWeights(weights, returns, 4, 1.0e12);
+  EXPECT_NEAR(effective, 3.0, 1.0e-6);
+
+  // low temperature: best sample only
+  effective = MPPIPlanner::SampleWeights(weights, returns, 4, 1.0e-6);
+  EXPECT_NEAR(weights[1], 1.0, 1.0e-12);
+  EXPECT_NEAR(effective, 1.0, 1.0e-12);
+
+  // no finished samples: nominal
+  double unfinished[2] = {inf, inf};
+  effective = MPPIPlanner::SampleWeights(weights, unfinished, 2, 1.0);
+  EXPECT_EQ(weights[0], 1.0);
+  EXPECT_EQ(weights[1], 0.0);
+  EXPECT_EQ(effective, 1.0);
+}
+
+// test mppi planner on particle task
+TEST(MPPIPlannerTest, Particle) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- mppi planner ----- //
+  MPPIPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.noise_exploration = 0.01;
+
+  // ----- settings ----- //
+  int iterations = 1000;
+  double horizon = 2.5;
+  double timestep = 0.1;
+  int steps =
+      mju_max(mju_min(horizon / timestep + 1, kMaxTrajectoryHorizon), 1);
+  model->opt.timestep = timestep;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(1);
+
+  // ----- initial state ----- //
+  planner.SetState(state);
+
+  // ---- optimize w/ weighted samples ----- //
+  for (int i = 0; i < iterations; i++) {
+    planner.OptimizePolicy(steps, pool);
+  }
+
+  // test final state
+  int final_state_index = (steps - 1) * (model->nq + model->nv);
+  ASSERT_GE(planner.BestTrajectory()->states.size(), final_state_index);
+  EXPECT_NEAR(planner.BestTrajectory()->states[final_state_index],
+              state.mocap()[0], 1.0e-1);
+  EXPECT_NEAR(planner.BestTrajectory()->states[final_state_index + 1],
+              state.mocap()[1], 1.0e-1);
+
+  // test temperature bounds
+  EXPECT_GE(planner.temperature, MinMPPITemperature);
+  EXPECT_LE(planner.temperature, MaxMPPITemperature);
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
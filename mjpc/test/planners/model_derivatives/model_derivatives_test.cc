@@ -0,0 +1,393 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/model_derivatives.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/test/load.h"
+#include "mjpc/threadpool.h"
+#include "mjpc/utilities.h"
+
+namespace mjpc {
+namespace {
+
+// compare colored and standard finite differences on independent bodies
+void TestColored(int mode) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int T = 3;
+
+  // states, actions, times
+  std::vector<double> x(T * nx);
+  std::vector<double> u(T * nu);
+  std::vector<double> h(T);
+  for (int i = 0; i < T * nx; i++) x[i] = 0.01 * (i % 5) - 0.02;
+  for (int i = 0; i < T * nu; i++) u[i] = 0.1 * (i % 3) - 0.1;
+  for (int t = 0; t < T; t++) h[t] = 0.01 * t;
+
+  // derivatives
+  ModelDerivatives standard;
+  ModelDerivatives colored;
+  standard.Allocate(ndx, nu, ns, T);
+  colored.Allocate(ndx, nu, ns, T);
+  standard.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns,
+                   T, 1.0e-6, mode, pool);
+  colored.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns,
+                  T, 1.0e-6, mode, pool, /*colored=*/true);
+
+  // test
+  for (int i = 0; i < (T - 1) * ndx * ndx; i++) {
+    EXPECT_NEAR(colored.A[i], standard.A[i], 1.0e-5);
+  }
+  for (int i = 0; i < (T - 1) * ndx * nu; i++) {
+    EXPECT_NEAR(colored.B[i], standard.B[i], 1.0e-5);
+  }
+  for (int i = 0; i < T * ns * ndx; i++) {
+    EXPECT_NEAR(colored.C[i], standard.C[i], 1.0e-5);
+  }
+  for (int i = 0; i < (T - 1) * ns * nu; i++) {
+    EXPECT_NEAR(colored.D[i], standard.D[i], 1.0e-5);
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(ModelDerivativesTest, ColoredForward) { TestColored(0); }
+
+TEST(ModelDerivativesTest, ColoredCentered) { TestColored(1); }
+
+// compare smooth and finite-difference action Jacobians without contacts
+void TestSmooth(int backend, int mode) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int T = 3;
+
+  // states, actions (one at its limit), times
+  std::vector<double> x(T * nx);
+  std::vector<double> u(T * nu);
+  std::vector<double> h(T);
+  for (int i = 0; i < T * nx; i++) x[i] = 0.01 * (i % 5) - 0.02;
+  for (int i = 0; i < T * nu; i++) u[i] = 0.1 * (i % 3) - 0.1;
+  u[1] = 1.0;
+  for (int t = 0; t < T; t++) h[t] = 0.01 * t;
+
+  // derivatives
+  ModelDerivatives standard;
+  ModelDerivatives smooth;
+  smooth.backend = backend;
+  standard.Allocate(ndx, nu, ns, T);
+  smooth.Allocate(ndx, nu, ns, T);
+  standard.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns,
+                   T, 1.0e-6, mode, pool);
+  smooth.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns,
+                 T, 1.0e-6, mode, pool);
+
+  // test
+  for (int i = 0; i < (T - 1) * ndx * ndx; i++) {
+    EXPECT_NEAR(smooth.A[i], standard.A[i], 1.0e-8);
+  }
+  for (int i = 0; i < (T - 1) * ndx * nu; i++) {
+    EXPECT_NEAR(smooth.B[i], standard.B[i], 1.0e-5);
+  }
+  for (int i = 0; i < T * ns * ndx; i++) {
+    EXPECT_NEAR(smooth.C[i], standard.C[i], 1.0e-8);
+  }
+  for (int i = 0; i < (T - 1) * ns * nu; i++) {
+    EXPECT_NEAR(smooth.D[i], standard.D[i], 1.0e-5);
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+TEST(ModelDerivativesTest, SmoothForward) {
+  TestSmooth(kSmoothDerivatives, 0);
+}
+
+TEST(ModelDerivativesTest, SmoothCentered) {
+  TestSmooth(kSmoothDerivatives, 1);
+}
+
+TEST(ModelDerivativesTest, HybridCentered) {
+  TestSmooth(kHybridDerivatives, 1);
+}
+
+// recorded warm starts are set at each step and don't change the Jacobians
+TEST(ModelDerivativesTest, WarmStart) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int nv = model->nv;
+  int T = 3;
+
+  // states, actions, times, warm starts
+  std::vector<double> x(T * nx);
+  std::vector<double> u(T * nu);
+  std::vector<double> h(T);
+  std::vector<double> warmstart(T * nv);
+  for (int i = 0; i < T * nx; i++) x[i] = 0.01 * (i % 5) - 0.02;
+  for (int i = 0; i < T * nu; i++) u[i] = 0.1 * (i % 3) - 0.1;
+  for (int t = 0; t < T; t++) h[t] = 0.01 * t;
+  for (int i = 0; i < T * nv; i++) warmstart[i] = 0.5 * i;
+
+  // derivatives
+  ModelDerivatives standard;
+  ModelDerivatives warm;
+  warm.warmstart = warmstart.data();
+  standard.Allocate(ndx, nu, ns, T);
+  warm.Allocate(ndx, nu, ns, T);
+  standard.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns,
+                   T, 1.0e-6, 0, pool);
+
+  // steps in order, each leaves its warm start in data
+  warm.Prepare(model, data.size(), x.data(), u.data(), nx, nu, ns, T);
+  for (int t = 0; t < T; t++) {
+    warm.ComputeStep(model, data[0].get(), 0, x.data(), u.data(), h.data(),
+                     nx, ndx, nu, ns, T, 1.0e-6, 0, t);
+    for (int i = 0; i < nv; i++) {
+      EXPECT_EQ(data[0]->qacc_warmstart[i], warmstart[t * nv + i]);
+    }
+  }
+
+  // without constraints, the warm start doesn't change the Jacobians
+  for (int i = 0; i < (T - 1) * ndx * ndx; i++) {
+    EXPECT_NEAR(warm.A[i], standard.A[i], 1.0e-8);
+  }
+  for (int i = 0; i < (T - 1) * ndx * nu; i++) {
+    EXPECT_NEAR(warm.B[i], standard.B[i], 1.0e-8);
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test Jacobians of the leading sensors only
+TEST(ModelDerivativesTest, LeadingSensors) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions, the leading jointpos and jointvel sensors
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int nr = model->sensor_dim[0] + model->sensor_dim[1];
+  int T = 3;
+
+  // states, actions, times
+  std::vector<double> x(T * nx);
+  std::vector<double> u(T * nu);
+  std::vector<double> h(T);
+  for (int i = 0; i < T * nx; i++) x[i] = 0.01 * (i % 5) - 0.02;
+  for (int i = 0; i < T * nu; i++) u[i] = 0.1 * (i % 3) - 0.1;
+  for (int t = 0; t < T; t++) h[t] = 0.01 * t;
+
+  // derivatives
+  ModelDerivatives full;
+  ModelDerivatives leading;
+  full.Allocate(ndx, nu, ns, T);
+  leading.Allocate(ndx, nu, nr, T);
+  full.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+               1.0e-6, 0, pool);
+  leading.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, nr,
+                  T, 1.0e-6, 0, pool);
+
+  // test, leading rows match
+  EXPECT_EQ(static_cast<int>(leading.C.size()), T * nr * ndx);
+  for (int i = 0; i < (T - 1) * ndx * ndx; i++) {
+    EXPECT_NEAR(leading.A[i], full.A[i], 1.0e-8);
+  }
+  for (int t = 0; t < T; t++) {
+    for (int i = 0; i < nr * ndx; i++) {
+      EXPECT_NEAR(leading.C[t * nr * ndx + i], full.C[t * ns * ndx + i],
+                  1.0e-8);
+    }
+  }
+  for (int t = 0; t < T - 1; t++) {
+    for (int i = 0; i < nr * nu; i++) {
+      EXPECT_NEAR(leading.D[t * nr * nu + i], full.D[t * ns * nu + i],
+                  1.0e-8);
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test reuse of derivatives at time steps that did not move
+TEST(ModelDerivativesTest, Skip) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int T = 4;
+
+  // states, actions, times
+  std::vector<double> x(T * nx, 0.01);
+  std::vector<double> u(T * nu, 0.1);
+  std::vector<double> h(T, 0.0);
+
+  // derivatives
+  ModelDerivatives md;
+  md.Allocate(ndx, nu, ns, T);
+  md.Reset(ndx, nu, ns, T);
+
+  // first evaluation computes all time steps
+  md.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+             1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_EQ(md.skip_ratio, 0.0);
+  std::vector<double> A = md.A;
+
+  // unchanged trajectory reuses all time steps
+  md.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+             1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_EQ(md.skip_ratio, 1.0);
+  for (int i = 0; i < (T - 1) * ndx * ndx; i++) {
+    EXPECT_EQ(md.A[i], A[i]);
+  }
+
+  // moving one time step recomputes it only
+  x[nx] += 1.0e-2;
+  md.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+             1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_NEAR(md.skip_ratio, 0.75, 1.0e-12);
+
+  // disabled
+  md.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+             1.0e-6, 0, pool);
+  EXPECT_EQ(md.skip_ratio, 0.0);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test reuse of shifted derivatives on an advanced horizon
+TEST(ModelDerivativesTest, Shift) {
+  // load model
+  mjModel* model = LoadTestModel("two_particles.xml");
+
+  // threadpool and data
+  ThreadPool pool(1);
+  std::vector<UniqueMjData> data;
+  data.push_back(MakeUniqueMjData(mj_makeData(model)));
+
+  // dimensions
+  int nx = model->nq + model->nv + model->na;
+  int ndx = 2 * model->nv + model->na;
+  int nu = model->nu;
+  int ns = model->nsensordata;
+  int T = 4;
+
+  // states, actions, times, distinct at each time step
+  std::vector<double> x(T * nx);
+  std::vector<double> u(T * nu, 0.1);
+  std::vector<double> h(T);
+  for (int t = 0; t < T; t++) {
+    for (int i = 0; i < nx; i++) x[t * nx + i] = 0.01 * t;
+    h[t] = 0.01 * t;
+  }
+
+  // derivatives
+  ModelDerivatives md;
+  md.Allocate(ndx, nu, ns, T);
+  md.Reset(ndx, nu, ns, T);
+  md.Compute(model, data, x.data(), u.data(), h.data(), nx, ndx, nu, ns, T,
+             1.0e-6, 0, pool, false, 1.0e-3);
+  std::vector<double> A = md.A;
+
+  // advance the horizon by one step
+  std::vector<double> x_next(T * nx);
+  std::vector<double> h_next(T);
+  for (int t = 0; t < T; t++) {
+    for (int i = 0; i < nx; i++) x_next[t * nx + i] = 0.01 * (t + 1);
+    h_next[t] = 0.01 * (t + 1);
+  }
+
+  // without shifting, no time step matches
+  ModelDerivatives unshifted = md;
+  unshifted.Compute(model, data, x_next.data(), u.data(), h_next.data(), nx,
+                    ndx, nu, ns, T, 1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_EQ(unshifted.skip_ratio, 0.0);
+
+  // shifted, the overlapping steps with transition Jacobians are reused
+  md.Shift(1, nx, ndx, nu, ns);
+  md.Compute(model, data, x_next.data(), u.data(), h_next.data(), nx, ndx, nu,
+             ns, T, 1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_NEAR(md.skip_ratio, 0.5, 1.0e-12);
+  for (int i = 0; i < 2 * ndx * ndx; i++) {
+    EXPECT_EQ(md.A[i], A[ndx * ndx + i]);
+  }
+
+  // negative shift drops all stored points
+  md.Shift(-1, nx, ndx, nu, ns);
+  md.Compute(model, data, x_next.data(), u.data(), h_next.data(), nx, ndx, nu,
+             ns, T, 1.0e-6, 0, pool, false, 1.0e-3);
+  EXPECT_EQ(md.skip_ratio, 0.0);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
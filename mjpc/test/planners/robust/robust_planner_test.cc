@@ -126,7 +126,53 @@ TEST(RobustPlannerTest, RandomSearch) {
   mj_deleteModel(model);
 }
 
+// test racing of the candidates on particle task
+TEST(RobustPlannerTest, Racing) {
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  mjData* data = mj_makeData(model);
+  int home_id = mj_name2id(model, mjOBJ_KEY, "ctrl_test");
+  mj_resetDataKeyframe(model, data, home_id);
+
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  RobustPlanner planner(std::make_unique<SamplingPlanner>());
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon, data->ctrl);
+  planner.SetRacing(true);
+  EXPECT_TRUE(planner.Racing());
+
+  int iterations = 1000;
+  double horizon = 2.5;
+  double timestep = 0.1;
+  int steps =
+      mju_max(mju_min(horizon / timestep + 1, kMaxTrajectoryHorizon), 1);
+  model->opt.timestep = timestep;
+  mjcb_sensor = sensor;
+  ThreadPool pool(1);
+  planner.SetState(state);
+
+  for (int i = 0; i < iterations; i++) {
+    planner.OptimizePolicy(steps, pool);
+  }
 
+  // racing still finds a policy that reaches the target
+  int final_state_index = (steps - 1) * (model->nq + model->nv);
+  ASSERT_GE(planner.BestTrajectory()->states.size(), final_state_index);
+  EXPECT_NEAR(planner.BestTrajectory()->states[final_state_index],
+              state.mocap()[0], 1.0e-1);
+  EXPECT_NEAR(planner.BestTrajectory()->states[final_state_index + 1],
+              state.mocap()[1], 1.0e-1);
+
+  mjcb_sensor = nullptr;
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
 
 }  // namespace
 }  // namespace mjpc
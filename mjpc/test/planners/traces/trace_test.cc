@@ -0,0 +1,92 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/planner.h"
+#include "mjpc/trajectory.h"
+
+namespace mjpc {
+namespace {
+
+// trajectory with num_trace traces along the x axis, x = step
+Trajectory MakeTrajectory(int num_trace, int horizon) {
+  Trajectory trajectory;
+  trajectory.Initialize(1, 1, 1, num_trace, horizon);
+  trajectory.Allocate(horizon);
+  for (int t = 0; t < horizon; t++) {
+    for (int j = 0; j < num_trace; j++) {
+      double* point = trajectory.trace.data() + 3 * (num_trace * t + j);
+      point[0] = t;
+      point[1] = j;
+      point[2] = 0.0;
+    }
+  }
+  return trajectory;
+}
+
+TEST(TraceTest, StrideDecimatesSegments) {
+  Trajectory trajectory = MakeTrajectory(2, 11);
+  std::vector<mjvGeom> geoms(100);
+  mjvScene scn = {};
+  scn.geoms = geoms.data();
+  scn.maxgeom = geoms.size();
+  float rgba[4] = {1, 1, 1, 1};
+
+  // every step: 10 segments per trace
+  EXPECT_TRUE(AddTraceLines(&scn, trajectory, 2, 11, 1, 3.0, rgba));
+  EXPECT_EQ(scn.ngeom, 20);
+
+  // every 3rd step: 0-3, 3-6, 6-9, 9-10
+  scn.ngeom = 0;
+  EXPECT_TRUE(AddTraceLines(&scn, trajectory, 2, 11, 3, 3.0, rgba));
+  EXPECT_EQ(scn.ngeom, 8);
+  for (int i = 0; i < scn.ngeom; i++) {
+    EXPECT_EQ(scn.geoms[i].type, mjGEOM_LINE);
+  }
+}
+
+TEST(TraceTest, SkipsTrajectoryThatDoesNotFit) {
+  Trajectory trajectory = MakeTrajectory(1, 11);
+  std::vector<mjvGeom> geoms(15);
+  mjvScene scn = {};
+  scn.geoms = geoms.data();
+  scn.maxgeom = geoms.size();
+  float rgba[4] = {1, 1, 1, 1};
+
+  EXPECT_TRUE(AddTraceLines(&scn, trajectory, 1, 11, 1, 3.0, rgba));
+  EXPECT_EQ(scn.ngeom, 10);
+  EXPECT_FALSE(AddTraceLines(&scn, trajectory, 1, 11, 1, 3.0, rgba));
+  EXPECT_EQ(scn.ngeom, 10);
+}
+
+TEST(TraceTest, SelectsLowestReturns) {
+  Trajectory trajectory[4];
+  double returns[4] = {3.0, 1.0, 4.0, 2.0};
+  for (int i = 0; i < 4; i++) trajectory[i].total_return = returns[i];
+
+  std::vector<int> samples = {0, 1, 2, 3};
+  SelectTraceSamples(samples, trajectory, 2);
+  EXPECT_THAT(samples, testing::ElementsAre(1, 3));
+
+  samples = {0, 2};
+  SelectTraceSamples(samples, trajectory, 10);
+  EXPECT_THAT(samples, testing::ElementsAre(0, 2));
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -12,14 +12,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+
 #include "gtest/gtest.h"
+#include <absl/functional/function_ref.h>
 #include <mujoco/mujoco.h>
+#include "mjpc/planners/rollout_backend.h"
 #include "mjpc/planners/sampling/planner.h"
+#include "mjpc/planners/sampling/remote.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/test/load.h"
 #include "mjpc/test/testdata/particle_residual.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trajectory.h"
 
 namespace mjpc {
 namespace {
@@ -40,6 +49,47 @@ void sensor(const mjModel* model, mjData* data, int stage) {
   }
 }
 
+// evaluates remote samples in process, on a worker planner
+class LocalRemoteRollouts : public RemoteRollouts {
+ public:
+  LocalRemoteRollouts(SamplingPlanner* worker, ThreadPool* pool, int samples)
+      : worker_(worker), pool_(pool), samples_(samples) {}
+
+  int NumSamples() const override { return samples_; }
+  void Start(const RemoteSampleBatch& batch,
+             std::chrono::steady_clock::time_point deadline) override {
+    batch_ = batch;
+  }
+  bool Wait(RemoteSampleResult* result) override {
+    worker_->EvaluateRemoteSamples(batch_, *pool_, result);
+    best_return = result->best_return;
+    return result->best >= 0;
+  }
+
+  RemoteSampleBatch batch_;
+  double best_return = 0.0;
+
+ private:
+  SamplingPlanner* worker_;
+  ThreadPool* pool_;
+  int samples_;
+};
+
+// pool rollouts that count the batches and rollouts
+class CountingRolloutBackend : public PoolRolloutBackend {
+ public:
+  void Rollouts(const RolloutBatch& batch,
+                absl::FunctionRef<bool(int)> prepare,
+                ThreadPool& pool) override {
+    batches++;
+    rollouts += batch.num_rollouts;
+    PoolRolloutBackend::Rollouts(batch, prepare, pool);
+  }
+
+  int batches = 0;
+  int rollouts = 0;
+};
+
 // test sampling planner on particle task
 TEST(SamplingPlannerTest, RandomSearch) {
   // load model
@@ -114,5 +164,457 @@ TEST(SamplingPlannerTest, RandomSearch) {
   mj_deleteModel(model);
 }
 
+// test that samples are skipped once the deadline has passed
+TEST(SamplingPlannerTest, Deadline) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planner ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(2);
+
+  // deadline in the past, only the nominal sample runs
+  planner.SetDeadline(std::chrono::steady_clock::now() -
+                      std::chrono::seconds(1));
+  planner.OptimizePolicy(10, pool);
+  EXPECT_EQ(planner.winner, 0);
+  EXPECT_FALSE(planner.trajectory[0].pruned);
+  for (int i = 1; i < planner.num_trajectory_; i++) {
+    EXPECT_TRUE(planner.trajectory[i].pruned);
+  }
+
+  // no deadline, all samples run
+  planner.SetDeadline(std::chrono::steady_clock::time_point());
+  planner.OptimizePolicy(10, pool);
+  for (int i = 0; i < planner.num_trajectory_; i++) {
+    EXPECT_FALSE(planner.trajectory[i].pruned);
+  }
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test that the counters cover the rollouts of the last iteration
+TEST(SamplingPlannerTest, Counters) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planner ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(2);
+
+  // each rollout of a horizon takes horizon - 1 steps and evaluates the
+  // residual at every time step, the counters restart every iteration
+  int horizon = 10;
+  for (int i = 0; i < 2; i++) {
+    planner.OptimizePolicy(horizon, pool);
+    PlannerCounters counters = planner.Counters();
+    EXPECT_EQ(counters.rollouts, planner.num_trajectory_);
+    EXPECT_EQ(counters.steps, planner.num_trajectory_ * (horizon - 1));
+    EXPECT_EQ(counters.residuals, planner.num_trajectory_ * horizon);
+    EXPECT_EQ(counters.derivatives, 0);
+  }
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test rollouts with coarse time steps after the first steps
+TEST(SamplingPlannerTest, Schedule) {
+  // schedule
+  RolloutSchedule schedule;
+  schedule.fine_steps = 4;
+  schedule.coarse_factor = 3;
+  EXPECT_EQ(schedule.Steps(4), 4);
+  EXPECT_EQ(schedule.Steps(10), 7);
+  EXPECT_EQ(schedule.StepsBefore(4), 4);
+  EXPECT_EQ(schedule.StepsBefore(9), 5);
+  EXPECT_EQ(schedule.TotalWeight(7), 13.0);
+  EXPECT_EQ(RolloutSchedule().TotalWeight(7), 7.0);
+
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planner ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+  planner.schedule.fine_steps = schedule.fine_steps;
+  planner.schedule.coarse_factor = schedule.coarse_factor;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(1);
+
+  // 10 uniform steps are covered by 4 fine and 2 coarse steps
+  planner.OptimizePolicy(10, pool);
+  const Trajectory& nominal = *planner.BestTrajectory();
+  double timestep = model->opt.timestep;
+  ASSERT_EQ(nominal.horizon, 7);
+  EXPECT_NEAR(nominal.times[4] - nominal.times[0], 4 * timestep, 1.0e-12);
+  EXPECT_NEAR(nominal.times[6] - nominal.times[4], 6 * timestep, 1.0e-12);
+
+  // return is the time-weighted cost
+  double total = 0.0;
+  for (int t = 0; t < nominal.horizon; t++) {
+    total += nominal.costs[t] * schedule.Weight(t, nominal.horizon);
+  }
+  EXPECT_NEAR(nominal.total_return, total / 13.0, 1.0e-12);
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test rollouts with reduced solver fidelity after the first steps
+TEST(SamplingPlannerTest, SolverFidelity) {
+  // schedule
+  RolloutSchedule schedule;
+  schedule.full_solver_steps = 3;
+  schedule.solver_level_steps = 2;
+  schedule.num_solver_levels = 2;
+  EXPECT_EQ(schedule.SolverLevel(2), -1);
+  EXPECT_EQ(schedule.SolverLevel(3), 0);
+  EXPECT_EQ(schedule.SolverLevel(5), 1);
+  EXPECT_EQ(schedule.SolverLevel(9), 1);
+  EXPECT_EQ(RolloutSchedule().SolverLevel(9), -1);
+
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planner ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+  planner.schedule.full_solver_steps = schedule.full_solver_steps;
+  planner.schedule.solver_level_steps = schedule.solver_level_steps;
+  planner.schedule.num_solver_levels = schedule.num_solver_levels;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(1);
+
+  // levels halve the iterations and loosen the tolerance
+  planner.OptimizePolicy(10, pool);
+  const mjModel* const* levels = planner.schedule.solver_models;
+  EXPECT_EQ(levels[0]->opt.iterations,
+            std::max(model->opt.iterations / 2, 1));
+  EXPECT_EQ(levels[1]->opt.iterations,
+            std::max(model->opt.iterations / 4, 1));
+  EXPECT_NEAR(levels[1]->opt.tolerance, 100.0 * model->opt.tolerance,
+              1.0e-12);
+  EXPECT_EQ(levels[1]->opt.timestep, model->opt.timestep);
+
+  // without constraints, the fidelity doesn't change the return
+  EXPECT_NEAR(planner.solver_fidelity_error, 0.0, 1.0e-10);
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test that remote winners are adopted with a reproducible policy
+TEST(SamplingPlannerTest, RemoteRollouts) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planners ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+  planner.num_trajectory_ = 2;
+
+  SamplingPlanner worker;
+  worker.Initialize(model, task);
+  worker.Allocate();
+  worker.Reset(kMaxTrajectoryHorizon);
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(2);
+
+  auto remote = std::make_shared<LocalRemoteRollouts>(&worker, &pool, 64);
+  planner.SetRemoteRollouts(remote);
+
+  int horizon = 10;
+  for (int i = 0; i < 3; i++) {
+    planner.OptimizePolicy(horizon, pool);
+
+    // remote samples follow the local ones
+    EXPECT_EQ(remote->batch_.begin, 2);
+    EXPECT_EQ(remote->batch_.end, 66);
+
+    // the winner is at least as good as the best remote sample, and its
+    // trajectory is the rollout of its policy
+    const Trajectory& best = *planner.BestTrajectory();
+    EXPECT_LE(best.total_return, remote->best_return);
+    Trajectory rollout;
+    rollout.Initialize(model->nq + model->nv + model->na, model->nu,
+                       task.num_residual, task.num_trace,
+                       kMaxTrajectoryHorizon);
+    rollout.Allocate(horizon);
+    rollout.Rollout(planner.candidate_policy[planner.winner], &task, model,
+                    data, planner.state.data(), planner.time,
+                    planner.mocap.data(), planner.userdata.data(), horizon);
+    EXPECT_NEAR(rollout.total_return, best.total_return, 1.0e-9);
+  }
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test noise sampled in the span of action synergies
+TEST(SamplingPlannerTest, Synergies) {
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+  mjData* data = mj_makeData(model);
+
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+
+  // a full-rank basis samples every actuator
+  double full[4] = {1.0, 0.0, 0.0, 1.0};
+  planner.SetSynergies(full, 2);
+  EXPECT_EQ(planner.NumSynergies(), 0);
+
+  // both actuators move together
+  double together[2] = {2.0, 2.0};
+  planner.SetSynergies(together, 1);
+  EXPECT_EQ(planner.NumSynergies(), 1);
+
+  mjcb_sensor = sensor;
+  ThreadPool pool(2);
+  planner.OptimizePolicy(10, pool);
+
+  // the noise of every sample is along the synergy
+  double squared_norm = 0.0;
+  int nu = model->nu;
+  for (int i = 1; i < planner.num_trajectory_; i++) {
+    const double* noise =
+        planner.noise.data() + i * (nu * kMaxTrajectoryHorizon);
+    for (int t = 0; t < planner.candidate_policy[i].num_spline_points; t++) {
+      EXPECT_NEAR(noise[t * nu], noise[t * nu + 1], 1.0e-12);
+      squared_norm += noise[t * nu] * noise[t * nu];
+    }
+  }
+  EXPECT_GT(squared_norm, 0.0);
+
+  mjcb_sensor = nullptr;
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+// test that a rollout backend runs the samples of an iteration
+TEST(SamplingPlannerTest, RolloutBackend) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planners ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+
+  SamplingPlanner reference;
+  reference.Initialize(model, task);
+  reference.Allocate();
+  reference.Reset(kMaxTrajectoryHorizon);
+  reference.SetState(state);
+
+  auto backend = std::make_shared<CountingRolloutBackend>();
+  planner.SetRolloutBackend(backend);
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(2);
+
+  // the backend's rollouts match the default's
+  int horizon = 10;
+  for (int i = 0; i < 2; i++) {
+    planner.OptimizePolicy(horizon, pool);
+    reference.OptimizePolicy(horizon, pool);
+    EXPECT_EQ(planner.winner, reference.winner);
+    EXPECT_EQ(planner.BestTrajectory()->total_return,
+              reference.BestTrajectory()->total_return);
+  }
+  EXPECT_EQ(backend->batches, 2);
+  EXPECT_EQ(backend->rollouts, 2 * planner.num_trajectory_);
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test that streaming iterations discard the samples after the quota
+TEST(SamplingPlannerTest, Streaming) {
+  // load model
+  model = LoadTestModel("particle_task.xml");
+  task.Reset(model);
+
+  // create data
+  mjData* data = mj_makeData(model);
+
+  // ----- state ----- //
+  state.Initialize(model);
+  state.Allocate(model);
+  state.Reset();
+  state.Set(model, data);
+
+  // ----- sampling planner ----- //
+  SamplingPlanner planner;
+  planner.Initialize(model, task);
+  planner.Allocate();
+  planner.Reset(kMaxTrajectoryHorizon);
+  planner.SetState(state);
+  planner.num_trajectory_ = 32;
+  planner.streaming_ = 0.5;
+
+  // sensor callback
+  mjcb_sensor = sensor;
+
+  // threadpool
+  ThreadPool pool(4);
+
+  int horizon = 10;
+  for (int i = 0; i < 3; i++) {
+    planner.OptimizePolicy(horizon, pool);
+
+    // at least the quota completed, the nominal always does
+    int completed = 0;
+    for (int k = 0; k < planner.num_trajectory_; k++) {
+      if (!planner.trajectory[k].pruned) completed++;
+    }
+    EXPECT_GE(completed, 16);
+    EXPECT_FALSE(planner.trajectory[0].pruned);
+
+    // the winner is a completed sample
+    const Trajectory* best = planner.BestTrajectory();
+    EXPECT_FALSE(best->pruned);
+    EXPECT_LT(best->total_return, std::numeric_limits<double>::infinity());
+  }
+
+  // delete data
+  mj_deleteData(data);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -0,0 +1,84 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/planners/sampling/policy.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/planners/policy.h"
+#include "mjpc/test/load.h"
+#include "mjpc/test/testdata/particle_residual.h"
+
+namespace mjpc {
+namespace {
+
+// evaluator and batched actions match Action for each representation
+TEST(SamplingPolicyTest, Evaluator) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  ParticleTestTask task;
+  task.Reset(model);
+  int nu = model->nu;
+
+  // evaluation times: nondecreasing, then steps back and past the end
+  std::vector<double> times;
+  for (int k = 0; k < 100; k++) {
+    times.push_back(-0.05 + 0.013 * k);
+  }
+  for (double t : {0.4, 0.1, 0.1, -1.0, 0.25, 5.0}) {
+    times.push_back(t);
+  }
+  int num_times = times.size();
+
+  for (auto representation :
+       {PolicyRepresentation::kZeroSpline, PolicyRepresentation::kLinearSpline,
+        PolicyRepresentation::kCubicSpline}) {
+    for (int num_spline_points : {1, 2, 3, 6}) {
+      // policy
+      SamplingPolicy policy;
+      policy.Allocate(model, task, 10);
+      policy.representation = representation;
+      policy.num_spline_points = num_spline_points;
+      for (int i = 0; i < num_spline_points; i++) {
+        policy.times[i] = 0.1 + 0.19 * i;
+        for (int j = 0; j < nu; j++) {
+          policy.parameters[i * nu + j] = 0.6 * std::sin(1.3 * i + 2.1 * j);
+        }
+      }
+
+      // evaluator
+      SamplingPolicyEvaluator evaluator(policy);
+      std::vector<double> batch(num_times * nu);
+      policy.Actions(batch.data(), times.data(), num_times);
+      std::vector<double> action(nu), incremental(nu);
+      for (int k = 0; k < num_times; k++) {
+        policy.Action(action.data(), nullptr, times[k]);
+        evaluator.Action(incremental.data(), times[k]);
+        for (int j = 0; j < nu; j++) {
+          EXPECT_EQ(incremental[j], action[j]);
+          EXPECT_EQ(batch[k * nu + j], action[j]);
+        }
+      }
+    }
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
@@ -0,0 +1,112 @@
+// Copyright 2022 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/states/measurement.h"
+
+#include <cstdint>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include <mujoco/mujoco.h>
+#include "mjpc/test/load.h"
+
+namespace mjpc {
+namespace {
+
+// test latest measurement and counters
+TEST(MeasurementBuffer, Latest) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+
+  // buffer
+  MeasurementBuffer buffer;
+  buffer.Allocate(model);
+
+  // nothing published
+  EXPECT_EQ(buffer.Latest(), nullptr);
+  EXPECT_EQ(buffer.dropped(), 1u);
+
+  // publish twice, first is overwritten
+  data->time = 1.0;
+  mju_fill(data->ctrl, 1.0, model->nu);
+  buffer.Publish(model, data);
+  data->time = 2.0;
+  mju_fill(data->ctrl, 2.0, model->nu);
+  buffer.Publish(model, data);
+  EXPECT_EQ(buffer.overwritten(), 1u);
+
+  // latest
+  const Measurement* measurement = buffer.Latest();
+  ASSERT_NE(measurement, nullptr);
+  EXPECT_EQ(measurement->time, 2.0);
+  for (int i = 0; i < model->nu; i++) {
+    EXPECT_EQ(measurement->ctrl[i], 2.0);
+  }
+
+  // read once
+  EXPECT_EQ(buffer.Latest(), nullptr);
+  EXPECT_EQ(buffer.dropped(), 2u);
+
+  // delete data + model
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+// test consistent measurements across threads
+TEST(MeasurementBuffer, Threads) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+
+  // buffer
+  MeasurementBuffer buffer;
+  buffer.Allocate(model);
+
+  // producer
+  const int num_publish = 10000;
+  std::thread producer([&]() {
+    for (int i = 1; i <= num_publish; i++) {
+      data->time = i;
+      mju_fill(data->ctrl, i, model->nu);
+      buffer.Publish(model, data);
+    }
+  });
+
+  // consumer, measurements increase and are not torn
+  double time = 0.0;
+  int received = 0;
+  while (time < num_publish) {
+    const Measurement* measurement = buffer.Latest();
+    if (!measurement) continue;
+    EXPECT_GT(measurement->time, time);
+    for (int i = 0; i < model->nu; i++) {
+      EXPECT_EQ(measurement->ctrl[i], measurement->time);
+    }
+    time = measurement->time;
+    received++;
+  }
+  producer.join();
+
+  // every publication was either read or overwritten
+  EXPECT_EQ(received + buffer.overwritten(),
+            static_cast<std::uint64_t>(num_publish));
+
+  // delete data + model
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+}  // namespace
+}  // namespace mjpc
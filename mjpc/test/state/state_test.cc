@@ -14,6 +14,10 @@
 
 #include "mjpc/states/state.h"
 
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
 #include "mjpc/test/load.h"
@@ -71,6 +75,16 @@ class StateTest : public ::testing::Test {
     EXPECT_NEAR(mju_L1(state.state_.data(), 4), 0.0, 1.0e-5);
     EXPECT_NEAR(mju_L1(state.mocap_.data(), 7), 0.0, 1.0e-5);
 
+    // versions of the updates
+    std::uint64_t version = state.Version();
+    EXPECT_FALSE(
+        state.WaitForUpdate(version, std::chrono::steady_clock::now()));
+    std::thread publisher([&] { state.Set(model, data); });
+    EXPECT_TRUE(state.WaitForUpdate(
+        version, std::chrono::steady_clock::now() + std::chrono::seconds(10)));
+    publisher.join();
+    EXPECT_EQ(state.Version(), version + 1);
+
     // delete model + data
     mj_deleteData(data);
     mj_deleteModel(model);
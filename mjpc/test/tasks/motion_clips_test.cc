@@ -0,0 +1,107 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/tasks/humanoid/tracking/motion_clips.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace mjpc::humanoid {
+namespace {
+
+std::string TempPath(const std::string& name) {
+  return ::testing::TempDir() + name;
+}
+
+// two clips of one marker: x = frame index, offset by 100 in clip 1
+MotionClipsData TestData() {
+  MotionClipsData data;
+  data.num_marker = 1;
+  data.nq = 2;
+  data.nv = 1;
+  data.fps = 10.0;
+  data.clip_length = {3, 2};
+  data.initial_state = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+  for (int i = 0; i < 3; i++) {
+    data.frames.insert(data.frames.end(), {1.0f * i, 0, 0});
+  }
+  for (int i = 0; i < 2; i++) {
+    data.frames.insert(data.frames.end(), {100.0f + i, 0, 0});
+  }
+  return data;
+}
+
+TEST(MotionClipsTest, OpenAndSample) {
+  std::string path = TempPath("motion_clips_test.bin");
+  ASSERT_TRUE(WriteMotionClips(path, TestData()));
+
+  std::string error;
+  auto clips = MotionClips::Open(path, &error);
+  ASSERT_NE(clips, nullptr) << error;
+  EXPECT_EQ(clips->NumClips(), 2);
+  EXPECT_EQ(clips->NumMarkers(), 1);
+  EXPECT_EQ(clips->ClipLength(0), 3);
+  EXPECT_EQ(clips->InitialState(1)[0], 4.0);
+
+  // shared while in use
+  EXPECT_EQ(MotionClips::Open(path, &error), clips);
+
+  // interpolation
+  MotionClips::Sample sample = clips->At(0, 0.15);
+  EXPECT_EQ(sample.frame_0[0], 1.0f);
+  EXPECT_EQ(sample.frame_1[0], 2.0f);
+  EXPECT_NEAR(sample.weight_1, 0.5, 1.0e-12);
+
+  // clamped to the clip
+  sample = clips->At(1, 10.0);
+  EXPECT_EQ(sample.frame_0[0], 101.0f);
+  EXPECT_EQ(sample.frame_1[0], 101.0f);
+  sample = clips->At(1, -1.0);
+  EXPECT_EQ(sample.frame_0[0], 100.0f);
+  EXPECT_EQ(sample.weight_0, 1.0);
+
+  clips.reset();
+  std::remove(path.c_str());
+}
+
+TEST(MotionClipsTest, Malformed) {
+  std::string error;
+  EXPECT_EQ(MotionClips::Open(TempPath("missing.bin"), &error), nullptr);
+  EXPECT_FALSE(error.empty());
+
+  // truncated file
+  std::string path = TempPath("motion_clips_truncated.bin");
+  ASSERT_TRUE(WriteMotionClips(path, TestData()));
+  std::string contents;
+  {
+    std::ifstream file(path, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size() - 4);
+  }
+  error.clear();
+  EXPECT_EQ(MotionClips::Open(path, &error), nullptr);
+  EXPECT_FALSE(error.empty());
+  std::remove(path.c_str());
+}
+
+}  // namespace
+}  // namespace mjpc::humanoid
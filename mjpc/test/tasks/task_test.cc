@@ -14,9 +14,13 @@
 
 #include "mjpc/task.h"
 
+#include <cstdint>
+#include <memory>
+
 #include "gtest/gtest.h"
 #include <mujoco/mujoco.h>
 #include "mjpc/test/load.h"
+#include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace {
@@ -93,5 +97,284 @@ TEST(TasksTest, Task) {
   mj_deleteModel(model);
 }
 
+// test residual snapshots are shared until the residual changes
+TEST(TasksTest, ResidualSnapshot) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+
+  // task
+  TestTask task;
+  task.Reset(model);
+  std::uint64_t version = task.ResidualVersion();
+
+  // repeated snapshots share one copy
+  std::shared_ptr<const ResidualFn> first = task.ResidualSnapshot();
+  std::shared_ptr<const ResidualFn> second = task.ResidualSnapshot();
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_NE(first.get(), task.InternalResidual());
+  EXPECT_EQ(task.ResidualVersion(), version);
+
+  // update invalidates the snapshot, old copy remains valid
+  task.UpdateResidual();
+  EXPECT_EQ(task.ResidualVersion(), version + 1);
+  std::shared_ptr<const ResidualFn> third = task.ResidualSnapshot();
+  EXPECT_NE(third.get(), first.get());
+  EXPECT_EQ(third.get(), task.ResidualSnapshot().get());
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test parameters and weights are found by name and applied as one version
+TEST(TasksTest, ResidualUpdate) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+
+  // task
+  TestTask task;
+  task.Reset(model);
+
+  // case-insensitive names
+  EXPECT_EQ(task.ParameterIndexByName("dummy1"), 0);
+  EXPECT_EQ(task.ParameterIndexByName("DUMMY2"), 1);
+  EXPECT_EQ(task.ParameterIndexByName("missing"), -1);
+  EXPECT_EQ(task.SelectionIndexByName("dummy1"), -1);
+  EXPECT_EQ(task.WeightIndexByName("position"), 0);
+  EXPECT_EQ(task.WeightIndexByName("Velocity"), 1);
+  EXPECT_EQ(task.WeightIndexByName("dummy1"), -1);
+
+  // one version for all values
+  std::uint64_t version = task.ResidualVersion();
+  ResidualUpdate update;
+  update.parameters.emplace_back(task.ParameterIndexByName("dummy2"), 0.5);
+  update.weights.emplace_back(task.WeightIndexByName("Position"), 2.0);
+  update.weights.emplace_back(task.WeightIndexByName("Velocity"), 3.0);
+  update.weights.emplace_back(kMaxCostTerms, 1.0);  // ignored
+  task.UpdateResidual(update);
+  EXPECT_EQ(task.ResidualVersion(), version + 1);
+  EXPECT_EQ(task.parameters[0], 0.05);
+  EXPECT_EQ(task.parameters[1], 0.5);
+  EXPECT_EQ(task.weight[0], 2.0);
+  EXPECT_EQ(task.weight[1], 3.0);
+
+  // snapshots use the new weights
+  double terms[2];
+  double residual[] = {1.0, 0.0, 1.0, 0.0};
+  task.ResidualSnapshot()->CostTerms(terms, residual, /*weighted=*/true);
+  EXPECT_NEAR(terms[0], 2.0 * 0.5, 1.0e-10);
+  EXPECT_NEAR(terms[1], 3.0 * 0.5, 1.0e-10);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test zero-weight terms are skipped by the weighted costs
+TEST(TasksTest, InactiveTerm) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+
+  // task
+  TestTask task;
+  task.Reset(model);
+  ResidualUpdate update;
+  update.weights.emplace_back(task.WeightIndexByName("Position"), 0.0);
+  task.UpdateResidual(update);
+  std::shared_ptr<const ResidualFn> residual_fn = task.ResidualSnapshot();
+  EXPECT_FALSE(residual_fn->TermActive(0));
+  EXPECT_TRUE(residual_fn->TermActive(1));
+
+  // the inactive term's norm overflows, 0 * inf would be nan
+  double terms[2];
+  double residual[] = {1.0e300, 1.0e300, 1.0, 0.0};
+  residual_fn->CostTerms(terms, residual, /*weighted=*/true);
+  EXPECT_EQ(terms[0], 0.0);
+  EXPECT_NEAR(terms[1], 0.1 * 0.5, 1.0e-10);
+  EXPECT_NEAR(residual_fn->CostValue(residual),
+              (mju_exp(task.risk * 0.1 * 0.5) - 1.0) / task.risk, 1.0e-10);
+
+  // unweighted terms are still evaluated
+  residual_fn->CostTerms(terms, residual, /*weighted=*/false);
+  EXPECT_GT(terms[0], 1.0);
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// residual that copies the configuration
+class QposResidual : public BaseResidualFn {
+ public:
+  explicit QposResidual(const Task* task) : BaseResidualFn(task) {}
+  void Residual(const mjModel* model, const mjData* data,
+                double* residual) const override {
+    mju_copy(residual, data->qpos, model->nq);
+  }
+};
+
+// test default batched residual matches per-sample evaluation
+TEST(TasksTest, ResidualBatch) {
+  // load model
+  mjModel* model = LoadTestModel("particle_task.xml");
+
+  // task
+  TestTask task;
+  task.Reset(model);
+  QposResidual residual_fn(&task);
+
+  // samples with different configurations
+  const int n = 3;
+  mjData* data[n];
+  double residual[n][8];
+  double* residual_ptr[n];
+  for (int i = 0; i < n; i++) {
+    data[i] = mj_makeData(model);
+    mju_fill(data[i]->qpos, 0.1 * (i + 1), model->nq);
+    residual_ptr[i] = residual[i];
+  }
+  residual_fn.ResidualBatch(model, data, residual_ptr, n);
+
+  // test
+  double expected[8];
+  for (int i = 0; i < n; i++) {
+    residual_fn.Residual(model, data[i], expected);
+    for (int j = 0; j < model->nq; j++) {
+      EXPECT_EQ(residual[i][j], expected[j]);
+    }
+    mj_deleteData(data[i]);
+  }
+
+  // delete model
+  mj_deleteModel(model);
+}
+
+// test sensor handles resolved from names
+TEST(TasksTest, SensorTable) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+
+  SensorTable sensors;
+  sensors.Resolve(model, {"Velocity", "Position", "missing"});
+  EXPECT_EQ(sensors.size(), 3);
+
+  // handles follow the order of the names
+  EXPECT_EQ(sensors.Data(model, data, 0),
+            SensorByName(model, data, "Velocity"));
+  EXPECT_EQ(sensors.Data(model, data, 1),
+            SensorByName(model, data, "Position"));
+  EXPECT_EQ(sensors.Dim(0), 2);
+  EXPECT_EQ(sensors.Dim(1), 2);
+
+  // missing sensors and out-of-range handles have no dimension
+  EXPECT_EQ(sensors.Dim(2), -1);
+  EXPECT_EQ(sensors.Dim(3), -1);
+
+  // resolving again replaces the handles
+  constexpr const char* kNames[] = {"Position"};
+  sensors.Resolve(model, kNames);
+  EXPECT_EQ(sensors.size(), 1);
+  EXPECT_EQ(sensors.Data(model, data, 0),
+            SensorByName(model, data, "Position"));
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+// residual that writes its mode, dispatched on the mode
+class ModeTestResidual : public BaseResidualFn {
+ public:
+  ModeTestResidual(const Task* task, int mode)
+      : BaseResidualFn(task), mode_(mode) {}
+  void Residual(const mjModel* model, const mjData* data,
+                double* residual) const override {
+    (mode_residual_ ? mode_residual_ : CurrentModeResidual())(this, model, data,
+                                                             residual);
+  }
+  void SelectMode() override { mode_residual_ = CurrentModeResidual(); }
+  bool Selected() const { return mode_residual_ != nullptr; }
+
+  template <int kMode>
+  void ModeResidual(const mjModel*, const mjData*, double* residual) const {
+    residual[0] = kMode;
+  }
+
+ private:
+  ModeResidualFn CurrentModeResidual() const {
+    static constexpr auto kModeResiduals =
+        ModeResidualTable<ModeTestResidual, 3>();
+    return kModeResiduals[mode_];
+  }
+  int mode_;
+};
+
+// test mode residuals match with and without selection
+TEST(TasksTest, ModeResidual) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  TestTask task;
+  task.Reset(model);
+
+  for (int mode = 0; mode < 3; mode++) {
+    ModeTestResidual residual_fn(&task, mode);
+    double residual = -1.0;
+    residual_fn.Residual(model, data, &residual);
+    EXPECT_EQ(residual, mode);
+    EXPECT_FALSE(residual_fn.Selected());
+
+    residual_fn.SelectMode();
+    EXPECT_TRUE(residual_fn.Selected());
+    residual = -1.0;
+    residual_fn.Residual(model, data, &residual);
+    EXPECT_EQ(residual, mode);
+  }
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
+// test time grid lookup
+TEST(TasksTest, TimeGrid) {
+  TimeGrid grid = {1.0, 0.01, 10};
+  EXPECT_EQ(grid.Index(1.0), 0);
+  EXPECT_EQ(grid.Index(1.0 + 3 * 0.01), 3);
+  EXPECT_EQ(grid.Index(1.0 + 9 * 0.01), 9);
+
+  // times off the grid
+  EXPECT_EQ(grid.Index(1.0 + 10 * 0.01), -1);
+  EXPECT_EQ(grid.Index(0.99), -1);
+  EXPECT_EQ(grid.Index(1.005), -1);
+  EXPECT_EQ(TimeGrid().Index(0.0), -1);
+}
+
+// test trace sensors are looked up once, and not at all with traces disabled
+TEST(TasksTest, Traces) {
+  mjModel* model = LoadTestModel("particle_task.xml");
+  mjData* data = mj_makeData(model);
+  mj_forward(model, data);
+
+  TestTask task;
+  task.Reset(model);
+  ASSERT_EQ(task.num_trace, 1);
+  ASSERT_EQ(task.trace_sensor_adr.size(), 1);
+
+  double table[3];
+  double named[3];
+  GetTraces(table, data, task.trace_sensor_adr);
+  GetTraces(named, model, data, task.num_trace);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(table[i], named[i]);
+  }
+
+  // disabled: no traces until re-enabled and reset
+  SetTracesEnabled(false);
+  task.Reset(model);
+  EXPECT_EQ(task.num_trace, 0);
+  EXPECT_TRUE(task.trace_sensor_adr.empty());
+  SetTracesEnabled(true);
+  task.Reset(model);
+  EXPECT_EQ(task.num_trace, 1);
+
+  mj_deleteData(data);
+  mj_deleteModel(model);
+}
+
 }  // namespace
 }  // namespace mjpc
@@ -14,6 +14,7 @@
 
 #include "mjpc/utilities.h"
 
+#include <algorithm>
 #include <vector>
 #include <array>
 
@@ -628,6 +629,68 @@ TEST(Trace, Mat123) {
   EXPECT_NEAR(trace, 6.0, 1.0e-5);
 }
 
+TEST(SymmetricUpdate, Dense) {
+  // dimensions
+  const int n = 4;
+  const int k = 2;
+
+  // matrices
+  double mat[n * n] = {1.0, 0.5,  0.0, -1.0, 0.2, 2.0, 0.3, 0.0,
+                       0.0, -0.4, 1.5, 0.1,  0.7, 0.0, 0.2, 1.2};
+  double sym[n * n] = {2.0, 0.3, 0.1, 0.0, 0.3, 1.5, 0.2, 0.1,
+                       0.1, 0.2, 1.0, 0.4, 0.0, 0.1, 0.4, 3.0};
+  double rect[k * n] = {1.0, 0.0, 0.5, 0.2, 0.0, 1.0, -0.3, 0.4};
+
+  // mat * sym * mat'
+  double tmp[n * n];
+  double dense[n * n];
+  mju_mulMatMat(tmp, mat, sym, n, n, n);
+  mju_mulMatMatT(dense, tmp, mat, n, n, n);
+
+  double res[n * n];
+  mju_copy(res, sym, n * n);
+  SymmetricTransform(res, mat, res, tmp, n);
+  for (int i = 0; i < n * n; i++) {
+    EXPECT_NEAR(res[i], dense[i], 1.0e-12);
+  }
+
+  // sym - rect' * rect
+  double gram[n * n];
+  mju_mulMatTMat(gram, rect, rect, k, n, n);
+  mju_sub(dense, sym, gram, n * n);
+
+  mju_copy(res, sym, n * n);
+  SubLowerGram(res, rect, k, n);
+  MirrorLower(res, n);
+  for (int i = 0; i < n * n; i++) {
+    EXPECT_NEAR(res[i], dense[i], 1.0e-12);
+  }
+
+  // L * x = rect, L * L' = S
+  double S[k * k] = {4.0, 1.0, 1.0, 3.0};
+  double factor[k * k];
+  mju_copy(factor, S, k * k);
+  mju_cholFactor(factor, k, 0.0);
+
+  double x[k * n];
+  CholForwardSubstitution(x, factor, rect, k, n);
+
+  // x' * x = rect' * S^-1 * rect
+  double solve[k * n];
+  for (int j = 0; j < n; j++) {
+    double column[k] = {rect[j], rect[n + j]};
+    double sol[k];
+    mju_cholSolve(sol, factor, column, k);
+    solve[j] = sol[0];
+    solve[n + j] = sol[1];
+  }
+  mju_mulMatTMat(dense, rect, solve, k, n, n);
+  mju_mulMatTMat(res, x, x, k, n, n);
+  for (int i = 0; i < n * n; i++) {
+    EXPECT_NEAR(res[i], dense[i], 1.0e-12);
+  }
+}
+
 TEST(Determinant, Mat3) {
   // matrix
   double mat[9] = {1.0, 0.1, 0.01, 0.1, 1.0, 0.1, 0.01, 0.1, 1.0};
@@ -727,6 +790,180 @@ TEST(ConditionMatrixBand, Mat4Band) {
   EXPECT_NEAR(mju_norm(error, n1 * n1), 0.0, 1.0e-4);
 }
 
+TEST(ConditionBand, Mat8Band) {
+  // dimensions
+  const int n = 8;
+  const int n0 = 2;
+  const int n1 = n - n0;
+  const int nband = 3;
+
+  // symmetric band matrix
+  double mat[n * n] = {0};
+  for (int i = 0; i < n; i++) {
+    mat[i * n + i] = 2.0 + 0.1 * i;
+    for (int j = std::max(0, i - nband + 1); j < i; j++) {
+      mat[i * n + j] = mat[j * n + i] = 0.1 * (i + j) - 0.4;
+    }
+  }
+  double band[n * nband];
+  mju_dense2Band(band, mat, n, nband, 0);
+
+  // scratch
+  double mat00[n * n];
+  double mat10[n * n];
+  double mat11[n * n];
+  double tmp0[n * n];
+  double tmp1[n * n];
+  double scratch[n * n];
+
+  // dense solution
+  double solution[n1 * n1];
+  ConditionMatrix(solution, mat, mat00, mat10, mat11, tmp0, tmp1, n, n0, n1);
+
+  // condition band
+  double res[n1 * n1];
+  ConditionBand(res, band, scratch, mat00, mat10, mat11, tmp0, tmp1, nband, n0,
+                n1);
+
+  // test
+  double error[n1 * n1];
+  mju_sub(error, res, solution, n1 * n1);
+  EXPECT_NEAR(mju_norm(error, n1 * n1), 0.0, 1.0e-8);
+}
+
+TEST(ConditionBand, Mat8BandToBand) {
+  // dimensions
+  const int n = 8;
+  const int n0 = 2;
+  const int n1 = n - n0;
+  const int nband = 3;
+
+  // symmetric band matrix
+  double mat[n * n] = {0};
+  for (int i = 0; i < n; i++) {
+    mat[i * n + i] = 2.0 + 0.1 * i;
+    for (int j = std::max(0, i - nband + 1); j < i; j++) {
+      mat[i * n + j] = mat[j * n + i] = 0.1 * (i + j) - 0.4;
+    }
+  }
+  double band[n * nband];
+  mju_dense2Band(band, mat, n, nband, 0);
+
+  // scratch
+  double mat00[n * n];
+  double mat10[n * n];
+  double mat11[n * n];
+  double tmp0[n * n];
+  double tmp1[n * n];
+  double scratch[n * n];
+
+  // dense solution, in band storage
+  double solution[n1 * n1];
+  ConditionMatrix(solution, mat, mat00, mat10, mat11, tmp0, tmp1, n, n0, n1);
+  double solution_band[n1 * nband];
+  mju_dense2Band(solution_band, solution, n1, nband, 0);
+
+  // condition band
+  double res[n1 * nband];
+  ConditionBandToBand(res, band, scratch, mat00, mat10, mat11, tmp0, tmp1,
+                      nband, n0, n1);
+
+  // test
+  double error[n1 * nband];
+  mju_sub(error, res, solution_band, n1 * nband);
+  EXPECT_NEAR(mju_norm(error, n1 * nband), 0.0, 1.0e-8);
+}
+
+TEST(BlockFromBand, BlockBand) {
+  // dimensions
+  const int n = 6;
+  const int nband = 4;
+
+  // symmetric block band matrix, 2 x 2 blocks within one block of the
+  // diagonal
+  double mat[n * n] = {0};
+  for (int i = 0; i < n; i++) {
+    for (int j = std::max(0, i - nband + 1); j <= i; j++) {
+      mat[i * n + j] = mat[j * n + i] = 1.0 + i + 0.1 * j;
+    }
+  }
+  DenseToBlockBand(mat, n, 2, 2);
+  double band[n * nband];
+  for (int i = 0; i < n; i++) {
+    for (int j = std::max(0, i - nband + 1); j <= i; j++) {
+      band[i * nband + nband - 1 - (i - j)] = 1.0 + i + 0.1 * j;
+    }
+  }
+  BandToBlockBand(band, n, nband, 2, 2);
+
+  // band matches the dense matrix
+  double dense_band[n * nband];
+  mju_dense2Band(dense_band, mat, n, nband, 0);
+  for (int i = 0; i < n * nband; i++) {
+    EXPECT_EQ(band[i], dense_band[i]);
+  }
+
+  // blocks, including upper triangle and out-of-band entries
+  for (int ri = 0; ri < n - 1; ri++) {
+    for (int ci = 0; ci < n - 2; ci++) {
+      double block[2 * 3];
+      double block_dense[2 * 3];
+      BlockFromBand(block, band, nband, 2, 3, ri, ci);
+      BlockFromMatrix(block_dense, mat, 2, 3, n, n, ri, ci);
+      for (int i = 0; i < 6; i++) {
+        EXPECT_EQ(block[i], block_dense[i]);
+      }
+    }
+  }
+}
+
+TEST(CholArrowhead, Solve) {
+  // dimensions
+  const int n = 8;
+  const int ndense = 2;
+  const int ntotal = n + ndense;
+  const int nband = 3;
+
+  // symmetric positive definite band-arrowhead matrix
+  double mat[ntotal * ntotal] = {0};
+  for (int i = 0; i < ntotal; i++) {
+    mat[i * ntotal + i] = 4.0 + 0.1 * i;
+    for (int j = 0; j < i; j++) {
+      if (i >= n || i - j < nband) {
+        mat[i * ntotal + j] = mat[j * ntotal + i] = 0.02 * (i + j) - 0.1;
+      }
+    }
+  }
+  const int nnz = n * nband + ndense * ntotal;
+  double band[nnz];
+  mju_dense2Band(band, mat, ntotal, nband, ndense);
+  double vec[ntotal];
+  for (int i = 0; i < ntotal; i++) vec[i] = 0.3 * i - 1.0;
+
+  // band-dense solution
+  double factor[nnz];
+  mju_copy(factor, band, nnz);
+  double min_diag = mju_cholFactorBand(factor, ntotal, nband, ndense, 0.1, 0.0);
+  double solution[ntotal];
+  mju_cholSolveBand(solution, factor, vec, ntotal, nband, ndense);
+
+  // arrowhead solution
+  double schur[ndense * ndense];
+  double scratch[ndense];
+  mju_copy(factor, band, nnz);
+  double min_diag_arrow =
+      CholFactorArrowhead(factor, schur, ntotal, nband, ndense, 0.1, 0.0);
+  double res[ntotal];
+  CholSolveArrowhead(res, factor, schur, vec, scratch, ntotal, nband, ndense);
+
+  // test
+  EXPECT_GT(min_diag_arrow, 0.0);
+  EXPECT_NEAR(min_diag_arrow, min_diag, 1.0e-8);
+  double error[ntotal];
+  mju_sub(error, res, solution, ntotal);
+  EXPECT_NEAR(mju_norm(error, ntotal), 0.0, 1.0e-8);
+}
+
 TEST(BlockInBand, Set) {
   // set up (0)
   double block0[9] = {1, 2, 3, 2, 4, 5, 3, 5, 6};
@@ -14,51 +14,212 @@
 
 #include "mjpc/testspeed.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
 #include <mujoco/mujoco.h>
 
 #include "mjpc/agent.h"
+#include "mjpc/memory_report.h"
+#include "mjpc/perf_counters.h"
+#include "mjpc/planners/include.h"
+#include "mjpc/planners/planner.h"
+#include "mjpc/planning_model.h"
+#include "mjpc/residual_dispatch.h"
+#include "mjpc/state_recording.h"
 #include "mjpc/states/state.h"
 #include "mjpc/task.h"
 #include "mjpc/threadpool.h"
+#include "mjpc/trace.h"
 #include "mjpc/utilities.h"
 #include "mjpc/tasks/tasks.h"
 
 namespace mjpc {
 
 namespace {
-Task* task;
-void residual_callback(const mjModel* model, mjData* data, int stage) {
-  if (stage == mjSTAGE_ACC) {
-    task->Residual(model, data, data->sensordata);
+// timing of a planning iteration
+struct IterationRecord {
+  double time;     // simulation time
+  double latency;  // PlanIteration wall time (microseconds)
+  int rollouts;
+  PlannerCounters counters;  // simulation work of the iteration
+  std::vector<PhaseTime> phases;
+};
+
+// wall times of the startup phases of a run (microseconds)
+struct StartupTimes {
+  double task = 0.0;        // task construction
+  double model = 0.0;       // model load and planning model simplification
+  double initialize = 0.0;  // agent initialization
+  double allocate = 0.0;
+  double reset = 0.0;
+  double first_plan = 0.0;  // first planning iteration
+};
+
+// JSON number, null if not finite
+std::string JsonNumber(double value) {
+  return std::isfinite(value) ? absl::StrFormat("%.9g", value) : "null";
+}
+
+// nearest-rank percentile of sorted values
+double Percentile(const std::vector<double>& sorted, double percent) {
+  if (sorted.empty()) return 0.0;
+  int rank = std::ceil(percent / 100.0 * sorted.size());
+  return sorted[std::clamp(rank - 1, 0, static_cast<int>(sorted.size()) - 1)];
+}
+
+// write the run summary, iteration timings and cost trajectory as JSON
+bool WriteJson(const std::string& path, const std::string& task_name,
+               int planner_thread_count, int steps_per_planning_iteration,
+               double total_time, double wall_run_time, double average_cost,
+               const std::vector<IterationRecord>& iterations,
+               const std::vector<double>& costs,
+               const std::vector<PerfPhaseCounts>& perf_counters,
+               const StartupTimes& startup) {
+  std::vector<double> latency;
+  for (const IterationRecord& iteration : iterations) {
+    latency.push_back(iteration.latency);
   }
+  std::sort(latency.begin(), latency.end());
+
+  std::vector<std::string> records;
+  for (const IterationRecord& iteration : iterations) {
+    std::vector<std::string> phases;
+    for (const PhaseTime& phase : iteration.phases) {
+      phases.push_back(
+          absl::StrCat("\"", phase.name, "\": ", JsonNumber(phase.time)));
+    }
+    records.push_back(absl::StrCat(
+        "    {\"time\": ", JsonNumber(iteration.time),
+        ", \"latency_us\": ", JsonNumber(iteration.latency),
+        ", \"rollouts\": ", iteration.rollouts,
+        ", \"steps\": ", iteration.counters.steps,
+        ", \"residuals\": ", iteration.counters.residuals,
+        ", \"derivatives\": ", iteration.counters.derivatives,
+        ", \"aborted\": ", iteration.counters.aborted,
+        ", \"solver_iterations\": ", iteration.counters.solver_iterations,
+        ", \"phases_us\": {",
+        absl::StrJoin(phases, ", "), "}}"));
+  }
+  std::vector<std::string> cost_values;
+  for (double cost : costs) cost_values.push_back(JsonNumber(cost));
+  std::vector<std::string> counters;
+  for (const PerfPhaseCounts& phase : perf_counters) {
+    counters.push_back(absl::StrCat(
+        "    {\"phase\": \"", phase.phase, "\", \"thread\": \"", phase.thread,
+        "\", \"thread_id\": ", phase.thread_id,
+        ", \"samples\": ", phase.samples,
+        ", \"cycles\": ", phase.counts.cycles,
+        ", \"instructions\": ", phase.counts.instructions,
+        ", \"llc_misses\": ", phase.counts.llc_misses,
+        ", \"branch_misses\": ", phase.counts.branch_misses, "}"));
+  }
+
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\n"
+       << "  \"task\": \"" << task_name << "\",\n"
+       << "  \"planner_threads\": " << planner_thread_count << ",\n"
+       << "  \"steps_per_planning_iteration\": "
+       << steps_per_planning_iteration << ",\n"
+       << "  \"total_time\": " << JsonNumber(total_time) << ",\n"
+       << "  \"wall_time\": " << JsonNumber(wall_run_time) << ",\n"
+       << "  \"realtime_factor\": " << JsonNumber(total_time / wall_run_time)
+       << ",\n"
+       << "  \"average_cost\": " << JsonNumber(average_cost) << ",\n"
+       << "  \"plan_iteration_latency_us\": {\"p50\": "
+       << JsonNumber(Percentile(latency, 50)) << ", \"p99\": "
+       << JsonNumber(Percentile(latency, 99)) << ", \"max\": "
+       << JsonNumber(latency.empty() ? 0.0 : latency.back()) << "},\n"
+       << "  \"startup_us\": {\"task\": " << JsonNumber(startup.task)
+       << ", \"model\": " << JsonNumber(startup.model)
+       << ", \"initialize\": " << JsonNumber(startup.initialize)
+       << ", \"allocate\": " << JsonNumber(startup.allocate)
+       << ", \"reset\": " << JsonNumber(startup.reset)
+       << ", \"first_plan\": " << JsonNumber(startup.first_plan) << "},\n"
+       << "  \"iterations\": [\n"
+       << absl::StrJoin(records, ",\n") << "\n  ],\n"
+       << "  \"cost\": [" << absl::StrJoin(cost_values, ", ") << "],\n"
+       << "  \"perf_counters\": ["
+       << (counters.empty() ? ""
+                            : "\n" + absl::StrJoin(counters, ",\n") + "\n  ")
+       << "]\n"
+       << "}\n";
+  return static_cast<bool>(file);
 }
-}  // namespace
 
-// Run synchronous planning, print timing info,return 0 if nothing failed.
-int TestSpeed(std::string task_name, int planner_thread_count,
-              int steps_per_planning_iteration, double total_time) {
-  std::cout << "Test MJPC Speed\n";
-  std::cout << " MuJoCo version " << mj_versionString() << "\n";
-  if (mjVERSION_HEADER != mj_version()) {
-    mju_error("Headers and library have Different versions");
+// print the counts of each phase, summed over threads
+void PrintPerfCounters(const std::vector<PerfPhaseCounts>& perf_counters) {
+  std::vector<std::pair<std::string, PerfCounts>> phases;
+  for (const PerfPhaseCounts& phase : perf_counters) {
+    if (phases.empty() || phases.back().first != phase.phase) {
+      phases.push_back({phase.phase, PerfCounts()});
+    }
+    phases.back().second += phase.counts;
   }
-  std::cout << " Hardware threads:  " << NumAvailableHardwareThreads() << "\n";
+  std::cout << "Performance counters (per 1000 instructions: LLC misses, "
+               "branch misses):\n";
+  for (const auto& [phase, counts] : phases) {
+    double kilo_instructions =
+        1.0e-3 * std::max<double>(counts.instructions, 1);
+    std::cout << absl::StrFormat(
+        "  %-36s %14d cycles  IPC %5.2f  LLC %7.3f  branch %7.3f\n", phase,
+        counts.cycles,
+        static_cast<double>(counts.instructions) /
+            std::max<double>(counts.cycles, 1),
+        counts.llc_misses / kilo_instructions,
+        counts.branch_misses / kilo_instructions);
+  }
+}
 
+// result of a speed test run
+struct RunResult {
+  double wall_time = 0.0;  // seconds
+  double average_cost = 0.0;
+  int planning_steps = 0;
+  double planning_time = 0.0;  // in PlanIteration (seconds)
+  PlannerCounters counters;    // of all planning iterations
+  std::vector<IterationRecord> iterations;  // if recorded
+  std::vector<double> costs;                // if recorded
+  std::vector<RecordedState> states;        // planning states, if recorded
+  bool simplified = false;  // planned with a simplified model
+  PlanningModelReport planning_report;  // if simplified
+  MemoryReport memory;  // agent buffers after the last iteration
+  StartupTimes startup;
+};
+
+// simulate task task_id with synchronous planning for total_time. planner -1
+// uses the planner set in the model's XML. verbose prints progress, record
+// keeps per-iteration timings and per-step costs, record_states the states
+// planning iterations start from. the agent plans with a
+// model simplified by planning_model, or by the model's planning_*
+// numerics if planning_model changes nothing. planning threads are pinned
+// by affinity, and the agent is allocated and reset on their pool. returns 0
+// on success.
+int Run(int task_id, int planner, int planner_thread_count,
+        int steps_per_planning_iteration, double total_time, bool verbose,
+        bool record, bool record_states,
+        const PlanningModelOptions& planning_model,
+        const ThreadPoolAffinity& affinity, RunResult* result) {
+  StartupTimes& startup = result->startup;
+  auto phase_start = std::chrono::steady_clock::now();
   Agent agent;
-  agent.SetTaskList(GetTasks());
-  agent.gui_task_id = agent.GetTaskIdByName(task_name);
-  if (agent.gui_task_id == -1) {
-    std::cerr << "Invalid --task flag: '" << task_name
-              << "'. Valid values:\n";
-    std::cerr << agent.GetTaskNames();
-    return -1;
-  }
+  agent.SetTaskList(GetRegisteredTasks());
+  agent.gui_task_id = task_id;
+  startup.task = GetDuration(phase_start);
+
+  phase_start = std::chrono::steady_clock::now();
   auto load_model = agent.LoadModel();
   mjModel* model = load_model.model.release();
   if (!model) {
@@ -70,27 +231,50 @@ int TestSpeed(std::string task_name, int planner_thread_count,
 
   int home_id = mj_name2id(model, mjOBJ_KEY, "home");
   if (home_id >= 0) {
-    std::cout << "home_id: " << home_id << "\n";
+    if (verbose) std::cout << "home_id: " << home_id << "\n";
     mj_resetDataKeyframe(model, data, home_id);
   }
 
-  // the planner and its initial configuration is set in the XML
+  // the planner and its initial configuration is set in the XML. planners
+  // are seeded by the model (sampling_seed), the same for every run.
+  // planning model, the task model is simulated
+  PlanningModelOptions planning_options = planning_model;
+  if (!planning_options.Enabled()) {
+    planning_options = PlanningModelOptionsFromModel(model);
+  }
+  UniqueMjModel simplified = {nullptr, mj_deleteModel};
+  if (planning_options.Enabled()) {
+    simplified = SimplifyPlanningModel(model, planning_options);
+  }
+  startup.model = GetDuration(phase_start);
+
+  ThreadPool pool(planner_thread_count, affinity);
+  if (verbose && !pool.Cpus().empty()) {
+    std::cout << " Pinned to CPUs:    " << pool.Cpus().size() << "\n";
+  }
+
+  phase_start = std::chrono::steady_clock::now();
   agent.estimator_enabled = false;
-  agent.Initialize(model);
-  agent.Allocate();
-  agent.Reset(data->ctrl);
+  SetTracesEnabled(false);  // rollouts are not drawn
+  agent.Initialize(simplified ? simplified.get() : model);
+  if (planner >= 0) agent.SetPlanner(planner);
+  startup.initialize = GetDuration(phase_start);
+  phase_start = std::chrono::steady_clock::now();
+  agent.Allocate(&pool);
+  startup.allocate = GetDuration(phase_start);
+  phase_start = std::chrono::steady_clock::now();
+  agent.Reset(data->ctrl, &pool);
+  startup.reset = GetDuration(phase_start);
   agent.plan_enabled = true;
 
-  // make task available for global callback:
-  task = agent.ActiveTask();
-  mjcb_sensor = &residual_callback;
-
-  std::cout << " Planning threads:  " << planner_thread_count << "\n";
-  ThreadPool pool(planner_thread_count);
+  // residuals of the planning and physics models are dispatched to the agent
+  agent.RegisterResidualModel(model);
+  mjcb_sensor = &ResidualSensorCallback;
 
   int total_steps = ceil(total_time / model->opt.timestep);
   int current_time = 0;
   double total_cost = 0;
+  if (record) result->costs.reserve(total_steps);
   auto loop_start = std::chrono::steady_clock::now();
   for (int i = 0; i < total_steps; i++) {
     agent.ActiveTask()->Transition(model, data);
@@ -102,27 +286,247 @@ int TestSpeed(std::string task_name, int planner_thread_count,
     mj_step(model, data);
     double cost = agent.ActiveTask()->CostValue(data->sensordata);
     total_cost += cost;
+    if (record) result->costs.push_back(cost);
 
-    if (i % steps_per_planning_iteration == 0) { agent.PlanIteration(&pool); }
+    if (i % steps_per_planning_iteration == 0) {
+      if (record_states) {
+        result->states.push_back(
+            RecordedState::From(agent.state, *agent.ActiveTask()));
+      }
+      auto plan_start = std::chrono::steady_clock::now();
+      agent.PlanIteration(&pool);
+      double latency = GetDuration(plan_start);
+      if (i == 0) startup.first_plan = latency;
+      result->planning_time += 1.0e-6 * latency;
+      if (record) {
+        const Planner& active = agent.ActivePlanner();
+        result->iterations.push_back({data->time, latency,
+                                      active.NumRollouts(), active.Counters(),
+                                      active.PhaseTimes()});
+      }
+    }
 
-    if (floor(data->time) > current_time) {
+    if (verbose && floor(data->time) > current_time) {
       current_time++;
       std::cout << "sim time: " << current_time << ", cost: " << cost << "\n";
     }
   }
-  auto wall_run_time = std::chrono::duration_cast<std::chrono::microseconds>(
-                            std::chrono::steady_clock::now() - loop_start)
-                            .count() /
-                        1e6;
-  std::cout << "Total wall time ("
-            << (int)ceil(total_steps / steps_per_planning_iteration)
+  result->wall_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - loop_start)
+                          .count() /
+                      1e6;
+  result->average_cost = total_cost / total_steps;
+  result->planning_steps = ceil(total_steps / steps_per_planning_iteration);
+  result->counters = agent.Counters();
+  result->memory = agent.ReportMemory();
+
+  // compare the models with the final policy
+  if (simplified) {
+    result->simplified = true;
+    result->planning_report = CalibratePlanningModel(
+        model, simplified.get(), *agent.ActiveTask(), agent.state,
+        [&agent](double* action, const double* state, double time) {
+          agent.ActivePlanner().ActionFromPolicy(action, state, time);
+        },
+        agent.Horizon(), /*num_repeat=*/10);
+  }
+
+  mjcb_sensor = nullptr;
+  agent.UnregisterResidualModel(model);
+  mj_deleteData(data);
+  mj_deleteModel(model);
+  return 0;
+}
+
+// prints the MuJoCo version and hardware threads
+void PrintHeader() {
+  std::cout << "Test MJPC Speed\n";
+  std::cout << " MuJoCo version " << mj_versionString() << "\n";
+  if (mjVERSION_HEADER != mj_version()) {
+    mju_error("Headers and library have Different versions");
+  }
+  std::cout << " Hardware threads:  " << NumAvailableHardwareThreads() << "\n";
+}
+}  // namespace
+
+// Run synchronous planning, print timing info,return 0 if nothing failed.
+int TestSpeed(std::string task_name, int planner_thread_count,
+              int steps_per_planning_iteration, double total_time,
+              const std::string& output_json,
+              const std::string& trace_json,
+              const PlanningModelOptions& planning_model,
+              const ThreadPoolAffinity& affinity,
+              const std::string& record_states, bool perf_counters) {
+  PrintHeader();
+
+  Agent agent;
+  agent.SetTaskList(GetRegisteredTasks());
+  int task_id = agent.GetTaskIdByName(task_name);
+  if (task_id == -1) {
+    std::cerr << "Invalid --task flag: '" << task_name
+              << "'. Valid values:\n";
+    std::cerr << agent.GetTaskNames();
+    return -1;
+  }
+
+  std::cout << " Planning threads:  " << planner_thread_count << "\n";
+  if (!trace_json.empty()) {
+#ifndef MJPC_TRACE
+    std::cerr << "Warning: built without MJPC_ENABLE_TRACE, the trace will "
+                 "be empty\n";
+#endif
+    StartTrace();
+  }
+  if (perf_counters && !StartPerfCounters()) {
+    std::cerr << "Warning: performance counters are unavailable, build with "
+                 "MJPC_ENABLE_PERF_COUNTERS on Linux and check "
+                 "/proc/sys/kernel/perf_event_paranoid\n";
+  }
+  RunResult result;
+  int status = Run(task_id, /*planner=*/-1, planner_thread_count,
+                   steps_per_planning_iteration, total_time,
+                   /*verbose=*/true, !output_json.empty(),
+                   !record_states.empty(), planning_model, affinity, &result);
+  if (!trace_json.empty()) StopTrace();
+  std::vector<PerfPhaseCounts> perf_totals;
+  if (perf_counters) {
+    StopPerfCounters();
+    perf_totals = PerfCounterTotals();
+  }
+  if (status) return status;
+  double wall_run_time = result.wall_time;
+  std::cout << "Total wall time (" << result.planning_steps
             << " planning steps): " << wall_run_time << " s ("
             << total_time / wall_run_time << "x realtime)\n";
   std::cout << "Average cost per step (lower is better): "
-            << total_cost / total_steps << "\n";
+            << result.average_cost << "\n";
+  const PlannerCounters& counters = result.counters;
+  std::cout << "Planning work: " << counters.rollouts << " rollouts, "
+            << counters.steps << " steps, " << counters.residuals
+            << " residuals, " << counters.derivatives << " derivatives, "
+            << counters.aborted << " aborted rollouts\n";
+  if (counters.steps > 0) {
+    std::cout << "Solver iterations per rollout step: "
+              << static_cast<double>(counters.solver_iterations) /
+                     counters.steps
+              << "\n";
+  }
+  if (result.planning_time > 0.0) {
+    std::cout << "Rollout throughput: "
+              << counters.steps / result.planning_time << " steps/s\n";
+  }
+  const StartupTimes& startup = result.startup;
+  std::cout << absl::StrFormat(
+      "Startup (ms): task %.3f, model load %.3f, initialize %.3f, allocate "
+      "%.3f, reset %.3f, first plan %.3f\n",
+      1.0e-3 * startup.task, 1.0e-3 * startup.model,
+      1.0e-3 * startup.initialize, 1.0e-3 * startup.allocate,
+      1.0e-3 * startup.reset, 1.0e-3 * startup.first_plan);
+  std::cout << "Agent memory (bytes):\n" << result.memory.ToString();
+  if (result.simplified) {
+    std::cout << "Simplified planning model, final policy rolled out with "
+                 "both models:\n"
+              << result.planning_report.ToString();
+  }
+  if (!perf_totals.empty()) PrintPerfCounters(perf_totals);
 
-  mj_deleteData(data);
-  mj_deleteModel(model);
+  if (!output_json.empty()) {
+    if (!WriteJson(output_json, task_name, planner_thread_count,
+                   steps_per_planning_iteration, total_time, wall_run_time,
+                   result.average_cost, result.iterations, result.costs,
+                   perf_totals, result.startup)) {
+      std::cerr << "Failed to write " << output_json << "\n";
+      return 1;
+    }
+    std::cout << "Timing written to " << output_json << "\n";
+  }
+  if (!record_states.empty()) {
+    if (!WriteStateRecording(record_states, result.states)) {
+      std::cerr << "Failed to write " << record_states << "\n";
+      return 1;
+    }
+    std::cout << result.states.size() << " planning states written to "
+              << record_states << "\n";
+  }
+  if (!trace_json.empty()) {
+    if (!WriteTrace(trace_json)) {
+      std::cerr << "Failed to write " << trace_json << "\n";
+      return 1;
+    }
+    std::cout << "Trace written to " << trace_json << "\n";
+  }
   return 0;
 }
+
+// Run every task with every planner, thread count and planning interval and
+// print realtime factor and average cost, marking each task's Pareto front.
+int TestSpeedSweep(const std::vector<int>& planner_thread_counts,
+                   const std::vector<int>& steps_per_planning_iterations,
+                   double total_time) {
+  PrintHeader();
+
+  std::vector<std::shared_ptr<Task>> tasks = GetTasks();
+  int num_tasks = tasks.size();
+  std::vector<std::string> planner_names =
+      absl::StrSplit(kPlannerNames, '\n');
+  int num_planners = LoadPlanners().size();
+
+  // one row per run
+  struct Row {
+    int task;
+    int planner;
+    int threads;
+    int steps;
+    double realtime_factor;
+    double average_cost;
+  };
+  std::vector<Row> rows;
+  int status = 0;
+  for (int task_id = 0; task_id < num_tasks; task_id++) {
+    for (int planner = 0; planner < num_planners; planner++) {
+      for (int threads : planner_thread_counts) {
+        for (int steps : steps_per_planning_iterations) {
+          std::cout << tasks[task_id]->Name() << " / "
+                    << planner_names[planner] << " / " << threads
+                    << " threads / " << steps << " steps\n";
+          RunResult result;
+          if (Run(task_id, planner, threads, steps, total_time,
+                  /*verbose=*/false, /*record=*/false,
+                  /*record_states=*/false,
+                  PlanningModelOptions(), ThreadPoolAffinity(), &result)) {
+            status = 1;
+            continue;
+          }
+          rows.push_back({task_id, planner, threads, steps,
+                          total_time / result.wall_time,
+                          result.average_cost});
+        }
+      }
+    }
+  }
+
+  // a run is on its task's Pareto front if no other run of the task is at
+  // least as fast and as good, and better in one
+  auto dominates = [](const Row& a, const Row& b) {
+    return a.task == b.task && a.realtime_factor >= b.realtime_factor &&
+           a.average_cost <= b.average_cost &&
+           (a.realtime_factor > b.realtime_factor ||
+            a.average_cost < b.average_cost);
+  };
+
+  std::cout << "\n"
+            << absl::StrFormat("%-24s %-16s %7s %5s %10s %14s %s\n", "task",
+                               "planner", "threads", "steps", "realtime",
+                               "average cost", "pareto");
+  for (const Row& row : rows) {
+    bool pareto = std::none_of(rows.begin(), rows.end(), [&](const Row& other) {
+      return dominates(other, row);
+    });
+    std::cout << absl::StrFormat(
+        "%-24s %-16s %7d %5d %9.3gx %14.6g %s\n", tasks[row.task]->Name(),
+        planner_names[row.planner], row.threads, row.steps,
+        row.realtime_factor, row.average_cost, pareto ? "*" : "");
+  }
+  return status;
+}
 }  // namespace mjpc
@@ -16,10 +16,41 @@
 #define MJPC_MJPC_TESTSPEED_H_
 
 #include <string>
+#include <vector>
+
+#include "mjpc/planning_model.h"
+#include "mjpc/threadpool.h"
 
 namespace mjpc {
+// run synchronous planning and print timing. if output_json is not empty,
+// per-iteration phase timings, PlanIteration latency percentiles and the
+// cost trajectory are also written to that file as JSON. if trace_json is not
+// empty, trace events of the run are written to that file in Chrome trace
+// format (requires building with MJPC_ENABLE_TRACE). the agent plans with
+// the task model simplified by planning_model, or by the model's planning_*
+// numerics if planning_model changes nothing, and a calibration report
+// compares the final policy's cost on both models. planning threads are
+// pinned to the cpus of affinity. if record_states is not empty, the states
+// planning iterations start from are written to that file, see
+// state_recording.h, for benchmark/replay_benchmark.cc. if perf_counters,
+// hardware performance counters of the planner and estimator phases are
+// sampled (requires building with MJPC_ENABLE_PERF_COUNTERS), printed and
+// written to output_json per phase and thread.
 int TestSpeed(std::string task_name, int planner_thread_count,
-              int steps_per_planning_iteration, double total_time);
+              int steps_per_planning_iteration, double total_time,
+              const std::string& output_json = "",
+              const std::string& trace_json = "",
+              const PlanningModelOptions& planning_model = {},
+              const ThreadPoolAffinity& affinity = {},
+              const std::string& record_states = "",
+              bool perf_counters = false);
+
+// run every task of GetTasks() with every planner, thread count and planning
+// interval, and print a table of realtime factor vs. average cost with
+// each task's Pareto-optimal configurations marked.
+int TestSpeedSweep(const std::vector<int>& planner_thread_counts,
+                   const std::vector<int>& steps_per_planning_iterations,
+                   double total_time);
 }  // namespace mjpc
 
 #endif  // MJPC_MJPC_TESTSPEED_H_
@@ -12,12 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <iostream>
 #include <string>
+#include <vector>
 
 #include <absl/flags/parse.h>
 #include <absl/flags/flag.h>
+#include <absl/strings/numbers.h>
 
+#include "mjpc/planning_model.h"
 #include "mjpc/testspeed.h"
+#include "mjpc/threadpool.h"
 #include "mjpc/utilities.h"
 
 ABSL_FLAG(std::string, task, "Cube Solving", "Which model to load on startup.");
@@ -26,6 +31,68 @@ ABSL_FLAG(int, planner_thread, mjpc::NumAvailableHardwareThreads() - 5,
 ABSL_FLAG(int, steps_per_planning_iteration, 4,
           "How many physics steps to take between planning iterations.");
 ABSL_FLAG(double, total_time, 10, "Total time to simulate (seconds).");
+ABSL_FLAG(std::string, output_json, "",
+          "If set, write per-iteration timing and costs to this JSON file.");
+ABSL_FLAG(std::string, trace_json, "",
+          "If set, write trace events of the run to this file in Chrome "
+          "trace format (chrome://tracing, ui.perfetto.dev).");
+ABSL_FLAG(std::string, record_states, "",
+          "If set, write the states planning iterations start from to this "
+          "file, for mjpc_replay_benchmark.");
+ABSL_FLAG(bool, perf_counters, false,
+          "Sample hardware performance counters of the planner phases, "
+          "requires building with MJPC_ENABLE_PERF_COUNTERS.");
+ABSL_FLAG(bool, sweep, false,
+          "Run all tasks with all planners and print realtime factor vs. "
+          "average cost.");
+ABSL_FLAG(std::vector<std::string>, sweep_planner_threads, {},
+          "Comma-separated planner thread counts of the sweep, "
+          "--planner_thread if empty.");
+ABSL_FLAG(std::vector<std::string>, sweep_steps_per_planning_iteration, {},
+          "Comma-separated planning intervals of the sweep, "
+          "--steps_per_planning_iteration if empty.");
+ABSL_FLAG(int, planning_mesh_geoms, 0,
+          "Planning model collision geometry of meshes: 0 convex hull, 1 "
+          "bounding box.");
+ABSL_FLAG(bool, planning_drop_visual_geoms, false,
+          "Exclude geoms of --planning_visual_group from planning model "
+          "collisions.");
+ABSL_FLAG(int, planning_visual_group, 2, "Geom group of visual geoms.");
+ABSL_FLAG(int, planning_solver_iterations, 0,
+          "Planning model solver iterations, 0 keeps the model's.");
+ABSL_FLAG(double, planning_solver_tolerance, 0,
+          "Planning model solver tolerance, 0 keeps the model's.");
+ABSL_FLAG(int, planning_integrator, -1,
+          "Planning model integrator, -1 keeps the model's.");
+ABSL_FLAG(double, planning_timestep_scale, 1,
+          "Scale of the planning model time step and agent_timestep.");
+ABSL_FLAG(std::string, planner_cpus, "",
+          "CPUs the planning threads are pinned to, e.g., \"0-15,32-47\". "
+          "Empty means all available CPUs, if other pinning flags are set.");
+ABSL_FLAG(int, planner_numa_node, -1,
+          "If not -1, pin the planning threads to the CPUs of this NUMA node.");
+ABSL_FLAG(std::string, planner_exclude_cpus, "",
+          "CPUs the planning threads are not pinned to.");
+
+namespace {
+// parse a list of positive integers, default_value if empty
+bool ParseIntList(const std::vector<std::string>& values, int default_value,
+                  std::vector<int>* result) {
+  if (values.empty()) {
+    result->push_back(default_value);
+    return true;
+  }
+  for (const std::string& value : values) {
+    int number;
+    if (!absl::SimpleAtoi(value, &number) || number < 1) {
+      std::cerr << "Invalid list value: '" << value << "'\n";
+      return false;
+    }
+    result->push_back(number);
+  }
+  return true;
+}
+}  // namespace
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
@@ -34,6 +101,35 @@ int main(int argc, char** argv) {
   int steps_per_planning_iteration =
       absl::GetFlag(FLAGS_steps_per_planning_iteration);
   double total_time = absl::GetFlag(FLAGS_total_time);
+  if (absl::GetFlag(FLAGS_sweep)) {
+    std::vector<int> thread_counts, intervals;
+    if (!ParseIntList(absl::GetFlag(FLAGS_sweep_planner_threads),
+                      planner_thread_count, &thread_counts) ||
+        !ParseIntList(absl::GetFlag(FLAGS_sweep_steps_per_planning_iteration),
+                      steps_per_planning_iteration, &intervals)) {
+      return 1;
+    }
+    return mjpc::TestSpeedSweep(thread_counts, intervals, total_time);
+  }
+  mjpc::PlanningModelOptions planning_model;
+  planning_model.mesh_geoms = absl::GetFlag(FLAGS_planning_mesh_geoms);
+  planning_model.drop_visual_geoms =
+      absl::GetFlag(FLAGS_planning_drop_visual_geoms);
+  planning_model.visual_group = absl::GetFlag(FLAGS_planning_visual_group);
+  planning_model.solver_iterations =
+      absl::GetFlag(FLAGS_planning_solver_iterations);
+  planning_model.solver_tolerance =
+      absl::GetFlag(FLAGS_planning_solver_tolerance);
+  planning_model.integrator = absl::GetFlag(FLAGS_planning_integrator);
+  planning_model.timestep_scale = absl::GetFlag(FLAGS_planning_timestep_scale);
+  mjpc::ThreadPoolAffinity affinity;
+  affinity.cpus = absl::GetFlag(FLAGS_planner_cpus);
+  affinity.numa_node = absl::GetFlag(FLAGS_planner_numa_node);
+  affinity.exclude = absl::GetFlag(FLAGS_planner_exclude_cpus);
   return mjpc::TestSpeed(task_name, planner_thread_count,
-                         steps_per_planning_iteration, total_time);
+                         steps_per_planning_iteration, total_time,
+                         absl::GetFlag(FLAGS_output_json),
+                         absl::GetFlag(FLAGS_trace_json), planning_model,
+                         affinity, absl::GetFlag(FLAGS_record_states),
+                         absl::GetFlag(FLAGS_perf_counters));
 }
@@ -14,20 +14,215 @@
 
 #include "mjpc/threadpool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <absl/base/attributes.h>
+#include <absl/functional/function_ref.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "mjpc/perf_counters.h"
+#include "mjpc/trace.h"
 
 namespace mjpc {
 
+namespace {
+
+// values of a that are not in b, both sorted
+std::vector<int> Difference(const std::vector<int>& a,
+                            const std::vector<int>& b) {
+  std::vector<int> difference;
+  std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                      std::back_inserter(difference));
+  return difference;
+}
+
+// values in both a and b, both sorted
+std::vector<int> Intersection(const std::vector<int>& a,
+                              const std::vector<int>& b) {
+  std::vector<int> intersection;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(intersection));
+  return intersection;
+}
+
+// pin the calling thread to cpu
+void PinThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    std::fprintf(stderr, "ThreadPool: failed to pin thread to cpu %d\n", cpu);
+  }
+#endif
+}
+
+// hint to the cpu that the caller is spinning
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// thread quota of the calling thread, 0: none
+ABSL_CONST_INIT thread_local int thread_quota = 0;
+
+}  // namespace
+
+bool ParseCpuList(std::string_view list, std::vector<int>* cpus) {
+  cpus->clear();
+  std::size_t pos = 0;
+  while (pos < list.size()) {
+    std::size_t end = list.find(',', pos);
+    if (end == std::string_view::npos) end = list.size();
+    std::string_view range = list.substr(pos, end - pos);
+    while (!range.empty() && range.back() == '\n') range.remove_suffix(1);
+    pos = end + 1;
+    if (range.empty()) continue;
+
+    // first[-last]
+    int first = 0, last = 0;
+    std::size_t dash = range.find('-');
+    std::string head(range.substr(0, dash));
+    std::string tail(dash == std::string_view::npos ? head
+                                                    : range.substr(dash + 1));
+    char extra;
+    if (std::sscanf(head.c_str(), "%d%c", &first, &extra) != 1 ||
+        std::sscanf(tail.c_str(), "%d%c", &last, &extra) != 1 ||
+        first < 0 || last < first) {
+      cpus->clear();
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) cpus->push_back(cpu);
+  }
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return true;
+}
+
+std::vector<int> AvailableCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+std::vector<int> NumaNodeCpus(int node) {
+  std::vector<int> cpus;
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  std::string list;
+  if (!file || !std::getline(file, list) || !ParseCpuList(list, &cpus)) {
+    cpus.clear();
+  }
+  return cpus;
+}
+
+std::vector<int> ThreadPoolAffinity::Cpus() const {
+  if (!Enabled()) return {};
+  std::vector<int> selected = AvailableCpus();
+  if (!cpus.empty()) {
+    std::vector<int> listed;
+    if (!ParseCpuList(cpus, &listed)) {
+      std::fprintf(stderr, "ThreadPoolAffinity: malformed cpus \"%s\"\n",
+                   cpus.c_str());
+    }
+    // listed cpus outside the process's affinity are dropped
+    selected = selected.empty() ? listed : Intersection(listed, selected);
+  }
+  if (numa_node >= 0) {
+    std::vector<int> node = NumaNodeCpus(numa_node);
+    selected = Intersection(selected, node);
+  }
+  if (!exclude.empty()) {
+    std::vector<int> excluded;
+    if (!ParseCpuList(exclude, &excluded)) {
+      std::fprintf(stderr, "ThreadPoolAffinity: malformed exclude \"%s\"\n",
+                   exclude.c_str());
+    }
+    selected = Difference(selected, excluded);
+  }
+  if (selected.empty()) {
+    std::fprintf(stderr, "ThreadPoolAffinity: no cpus selected, unpinned\n");
+  }
+  return selected;
+}
+
+ThreadPool& SharedThreadPool() {
+  static ThreadPool* pool = [] {
+    int num_threads = AvailableCpus().size();
+    if (num_threads == 0) {
+      num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    }
+    return new ThreadPool(num_threads);
+  }();
+  return *pool;
+}
+
+ThreadQuota::ThreadQuota(int threads) : previous_(thread_quota) {
+  if (threads > 0 && (thread_quota == 0 || threads < thread_quota)) {
+    thread_quota = threads;
+  }
+}
+
+ThreadQuota::~ThreadQuota() { thread_quota = previous_; }
+
+int ThreadQuota::Current() { return thread_quota; }
+
 ABSL_CONST_INIT thread_local int ThreadPool::worker_id_ = -1;
+ABSL_CONST_INIT thread_local const ThreadPool* ThreadPool::worker_pool_ =
+    nullptr;
 
 // ThreadPool constructor
-ThreadPool::ThreadPool(int num_threads) : ctr_(0) {
+ThreadPool::ThreadPool(int num_threads)
+    : ThreadPool(num_threads, std::vector<int>()) {}
+
+ThreadPool::ThreadPool(int num_threads, std::vector<int> cpus)
+    : cpus_(std::move(cpus)),
+      pending_(0),
+      pinned_(0),
+      sleeping_(0),
+      next_worker_(0),
+      stop_(false),
+      ctr_(0),
+      busy_ns_(0),
+      spin_ns_(1000 * kDefaultSpinMicroseconds) {
+  for (auto& queued : queued_) queued = 0;
+  for (int i = 0; i < num_threads; i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
   for (int i = 0; i < num_threads; i++) {
     threads_.push_back(std::thread(&ThreadPool::WorkerThread, this, i));
   }
@@ -37,9 +232,7 @@ ThreadPool::ThreadPool(int num_threads) : ctr_(0) {
 ThreadPool::~ThreadPool() {
   {
     std::unique_lock<std::mutex> lock(m_);
-    for (int i = 0; i < threads_.size(); i++) {
-      queue_.push(nullptr);
-    }
+    stop_ = true;
     cv_in_.notify_all();
   }
   for (auto& thread : threads_) {
@@ -48,40 +241,457 @@ ThreadPool::~ThreadPool() {
 }
 
 // ThreadPool scheduler
-void ThreadPool::Schedule(std::function<void()> task) {
-  std::unique_lock<std::mutex> lock(m_);
-  queue_.push(std::move(task));
-  cv_in_.notify_one();
+void ThreadPool::Schedule(std::function<void()> task,
+                          TaskPriority priority) {
+  Task queued{std::move(task), /*counted=*/true};
+  queued.priority = priority;
+  Push(std::move(queued));
 }
 
-// ThreadPool worker
-void ThreadPool::WorkerThread(int i) {
-  worker_id_ = i;
+// ThreadPool parallel loop
+void ThreadPool::ParallelFor(int begin, int end, int grain,
+                             TaskPriority priority,
+                             absl::FunctionRef<void(int)> fn) {
+  int n = end - begin;
+  if (n <= 0) return;
+  MJPC_TRACE_SCOPE("ThreadPool::ParallelFor");
+  grain = std::max(grain, 1);
+  int num_chunks = (n + grain - 1) / grain;
+
+  // no workers, run on calling thread
+  if (threads_.empty()) {
+    for (int i = begin; i < end; i++) fn(i);
+    return;
+  }
+
+  // shared loop state, outlives this call if a helper starts late. fn is
+  // only dereferenced after a chunk is claimed, at which point this call is
+  // still waiting.
+  SharedState* loop = AcquireState();
+  loop->fn = &fn;
+  loop->begin = begin;
+  loop->end = end;
+  loop->grain = grain;
+  loop->num_chunks = num_chunks;
+  loop->remaining = num_chunks;
+
+  // helpers, each holding a reference, at most the thread quota
+  bool is_worker = worker_pool_ == this;
+  int max_threads = NumThreads();
+  if (thread_quota > 0) max_threads = std::min(max_threads, thread_quota);
+  int num_helpers = std::min(num_chunks, max_threads) - is_worker;
+  loop->refs.fetch_add(num_helpers);
+  for (int i = 0; i < num_helpers; i++) {
+    Task helper{[this, loop]() {
+                  RunChunks(loop);
+                  ReleaseState(loop);
+                },
+                /*counted=*/false};
+    helper.priority = priority;
+    Push(std::move(helper));
+  }
+
+  // calling worker participates
+  if (is_worker) RunChunks(loop);
+
+  // wait for claimed chunks to finish, spinning first
+  if (!Spin([loop]() { return loop->remaining.load() == 0; })) {
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->cv.wait(lock, [&]() { return loop->remaining.load() == 0; });
+  }
+  ReleaseState(loop);
+}
+
+// claim and run chunks until none are left
+void ThreadPool::RunChunks(SharedState* loop) {
   while (true) {
-    auto task = [&]() {
-      std::unique_lock<std::mutex> lock(m_);
-      cv_in_.wait(lock, [&]() { return !queue_.empty(); });
-      std::function<void()> task = std::move(queue_.front());
-      queue_.pop();
+    int chunk = loop->next.fetch_add(1);
+    if (chunk >= loop->num_chunks) return;
+    int chunk_begin = loop->begin + chunk * loop->grain;
+    int chunk_end = std::min(chunk_begin + loop->grain, loop->end);
+    for (int i = chunk_begin; i < chunk_end; i++) {
+      (*loop->fn)(i);
+    }
+    if (loop->remaining.fetch_sub(1) == 1) {
+      std::unique_lock<std::mutex> lock(loop->mutex);
+      loop->cv.notify_all();
+    }
+  }
+}
+
+// shared state, recycled if one is unused
+ThreadPool::SharedState* ThreadPool::AcquireState() {
+  SharedState* state;
+  {
+    std::lock_guard<std::mutex> lock(states_mutex_);
+    if (free_states_.empty()) {
+      states_.push_back(std::make_unique<SharedState>());
+      // releasing never grows the free list
+      free_states_.reserve(states_.size());
+      state = states_.back().get();
+    } else {
+      state = free_states_.back();
+      free_states_.pop_back();
+    }
+  }
+  state->refs = 1;
+  state->pending = 0;
+  state->next = 0;
+  state->remaining = 0;
+  state->fn = nullptr;
+  return state;
+}
+
+// drop a reference to a shared state
+void ThreadPool::ReleaseState(SharedState* state) {
+  if (state->refs.fetch_sub(1) != 1) return;
+  std::lock_guard<std::mutex> lock(states_mutex_);
+  free_states_.push_back(state);
+}
+
+// append task, growing the ring buffer if it is full
+void ThreadPool::TaskQueue::push_back(Task task) {
+  if (size_ == tasks_.size()) {
+    std::vector<Task> tasks(std::max<std::size_t>(2 * tasks_.size(), 16));
+    for (std::size_t k = 0; k < size_; k++) {
+      tasks[k] = std::move(tasks_[(head_ + k) % tasks_.size()]);
+    }
+    tasks_ = std::move(tasks);
+    head_ = 0;
+  }
+  tasks_[(head_ + size_) % tasks_.size()] = std::move(task);
+  size_++;
+}
+
+// remove first task, after it was moved from
+void ThreadPool::TaskQueue::pop_front() {
+  tasks_[head_].function = nullptr;
+  head_ = (head_ + 1) % tasks_.size();
+  size_--;
+}
+
+// remove last task, after it was moved from
+void ThreadPool::TaskQueue::pop_back() {
+  back().function = nullptr;
+  size_--;
+}
+
+// add task to a worker queue
+void ThreadPool::Push(Task task) {
+  // the task's worker, own deque for worker threads, round-robin otherwise
+  bool pinned = task.worker >= 0;
+#ifdef MJPC_PERF_COUNTERS
+  task.perf_phase = CurrentPerfPhase();
+#endif
+  task.quota = thread_quota;
+  int i = pinned                 ? task.worker
+          : worker_pool_ == this ? worker_id_
+                                 : next_worker_.fetch_add(1) % workers_.size();
+  int lane = static_cast<int>(task.priority);
+  {
+    std::unique_lock<std::mutex> lock(workers_[i]->mutex);
+    workers_[i]->tasks[lane].push_back(std::move(task));
+    // pending before pinned, so that HasTask errs toward true
+    queued_[lane].fetch_add(1);
+    pending_.fetch_add(1);
+    if (pinned) {
+      pinned_.fetch_add(1);
+      workers_[i]->pinned.fetch_add(1);
+    }
+  }
+
+  // wake a worker if any are sleeping, all of them for a pinned task since
+  // only its worker can run it
+  if (sleeping_.load() > 0) {
+    std::unique_lock<std::mutex> lock(m_);
+    if (pinned) {
+      cv_in_.notify_all();
+    } else {
       cv_in_.notify_one();
-      return task;
-    }();
-    if (task == nullptr) {
-      {
-        std::unique_lock<std::mutex> lock(m_);
-        ++ctr_;
-        cv_ext_.notify_one();
+    }
+  }
+}
+
+// take a task from the highest priority lane with queued tasks, own deque
+// first (front), then steal (back)
+bool ThreadPool::Pop(int i, Task* task) {
+  int num_workers = workers_.size();
+  for (int lane = 0; lane < kNumTaskPriorities; lane++) {
+    // empty lanes are skipped without taking the workers' locks
+    if (queued_[lane].load() == 0) continue;
+    for (int k = 0; k < num_workers; k++) {
+      Worker& worker = *workers_[(i + k) % num_workers];
+      std::unique_lock<std::mutex> lock(worker.mutex);
+      TaskQueue& tasks = worker.tasks[lane];
+      if (tasks.empty()) continue;
+      if (k == 0) {
+        *task = std::move(tasks.front());
+        tasks.pop_front();
+      } else {
+        if (tasks.back().worker >= 0) continue;
+        *task = std::move(tasks.back());
+        tasks.pop_back();
       }
-      break;
+      // pinned before pending, so that HasTask errs toward true
+      if (task->worker >= 0) {
+        worker.pinned.fetch_sub(1);
+        pinned_.fetch_sub(1);
+      }
+      pending_.fetch_sub(1);
+      queued_[lane].fetch_sub(1);
+      return true;
     }
-    task();
+  }
+  return false;
+}
+
+// spin on done for at most the spin time
+bool ThreadPool::Spin(absl::FunctionRef<bool()> done) const {
+  if (done()) return true;
+  int spin_ns = spin_ns_.load(std::memory_order_relaxed);
+  if (spin_ns <= 0) return false;
+  auto end =
+      std::chrono::steady_clock::now() + std::chrono::nanoseconds(spin_ns);
+  while (true) {
+    // the clock is read every few checks, and the cpu is yielded to threads
+    // that may be oversubscribing it, e.g., the one that completes done
+    for (int k = 0; k < 64; k++) {
+      CpuRelax();
+      if (done()) return true;
+    }
+    if (std::chrono::steady_clock::now() >= end) return false;
+    std::this_thread::yield();
+  }
+}
+
+// task future, completes when its task has run
+TaskFuture ThreadPool::Async(std::function<void()> task,
+                             TaskPriority priority) {
+  SharedState* state = AcquireState();
+  state->pending = 1;
+  state->refs.fetch_add(1);
+  Task async{std::move(task), /*counted=*/false, /*worker=*/-1, state,
+             /*perf_phase=*/nullptr, priority};
+  if (threads_.empty()) {
+    Execute(async);
+  } else {
+    Push(std::move(async));
+  }
+  return TaskFuture(this, state);
+}
+
+// future of futures, each completion is an empty task of the joint state
+TaskFuture ThreadPool::WhenAll(const std::vector<TaskFuture>& futures) {
+  SharedState* state = AcquireState();
+  int num_futures = 0;
+  for (const TaskFuture& future : futures) num_futures += future.Valid();
+  state->pending = num_futures;
+  state->refs.fetch_add(num_futures);
+  for (const TaskFuture& future : futures) {
+    if (!future.Valid()) continue;
+    Continue({nullptr, /*counted=*/false, /*worker=*/-1, state},
+             future.state_);
+  }
+  return TaskFuture(this, state);
+}
+
+// schedule task now, or after the pending tasks of after
+void ThreadPool::Continue(Task task, SharedState* after) {
+  {
+    std::unique_lock<std::mutex> lock(after->mutex);
+    if (after->pending > 0) {
+      after->continuations.push_back(std::move(task));
+      return;
+    }
+  }
+  if (threads_.empty()) {
+    Execute(task);
+  } else {
+    Push(std::move(task));
+  }
+}
+
+// wait on a state's pending tasks, helping from inside the pool
+void ThreadPool::WaitState(SharedState* state) {
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (state->pending > 0) {
+    // help from inside the pool instead of blocking a worker
+    lock.unlock();
+    bool ran = RunPendingTask();
+    lock.lock();
+    if (!ran && state->pending > 0) {
+      // spin before parking
+      lock.unlock();
+      bool done = Spin([state]() { return state->pending.load() == 0; });
+      lock.lock();
+      if (!done && state->pending > 0) state->cv.wait(lock);
+    }
+  }
+}
 
+// run one queued task on the calling worker
+bool ThreadPool::RunPendingTask() {
+  if (worker_pool_ != this) return false;
+  Task task;
+  if (!Pop(worker_id_, &task)) return false;
+  Execute(task);
+  return true;
+}
+
+// run task and update count
+void ThreadPool::Execute(Task& task) {
+  auto start = std::chrono::steady_clock::now();
+  {
+#ifdef MJPC_PERF_COUNTERS
+    // counted on this worker as the phase that scheduled it
+    PerfPhase perf_phase;
+    perf_phase.Begin(task.perf_phase);
+#endif
+    MJPC_TRACE_SCOPE("ThreadPool::Task");
+    // the task's loops are limited by the quota of the thread that
+    // scheduled it
+    int quota = thread_quota;
+    thread_quota = task.quota;
+    if (task.function) task.function();
+    thread_quota = quota;
+  }
+  if (task.group) {
     {
+      std::unique_lock<std::mutex> lock(task.group->mutex);
+      if (--task.group->pending == 0) {
+        task.group->cv.notify_all();
+
+        // continuations of a future
+        for (Task& continuation : task.group->continuations) {
+          if (threads_.empty()) {
+            Execute(continuation);
+          } else {
+            Push(std::move(continuation));
+          }
+        }
+        task.group->continuations.clear();
+      }
+    }
+    ReleaseState(task.group);
+  }
+  busy_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count(),
+                     std::memory_order_relaxed);
+  if (task.counted) {
+    std::unique_lock<std::mutex> lock(m_);
+    ++ctr_;
+    cv_ext_.notify_all();
+  }
+}
+
+// ThreadPool worker
+void ThreadPool::WorkerThread(int i) {
+  worker_id_ = i;
+  worker_pool_ = this;
+  if (!cpus_.empty()) PinThread(cpus_[i % cpus_.size()]);
+#ifdef MJPC_TRACE
+  SetTraceThreadName("ThreadPool worker " + std::to_string(i));
+#endif
+#ifdef MJPC_PERF_COUNTERS
+  SetPerfThreadName("ThreadPool worker " + std::to_string(i));
+#endif
+  while (true) {
+    Task task;
+    if (!Pop(i, &task)) {
+      // spin before parking, tasks pushed meanwhile are taken without a
+      // wakeup. a stop during the spin is seen by the wait below.
+      if (Spin([this, i]() { return HasTask(i); })) continue;
       std::unique_lock<std::mutex> lock(m_);
-      ++ctr_;
-      cv_ext_.notify_one();
+      sleeping_.fetch_add(1);
+      cv_in_.wait(lock, [&]() { return HasTask(i) || stop_; });
+      sleeping_.fetch_sub(1);
+      if (pending_.load() == 0 && stop_) break;
+      continue;
     }
+    Execute(task);
+  }
+}
+
+// TaskGroup constructor
+TaskGroup::TaskGroup(ThreadPool& pool, TaskPriority priority)
+    : pool_(pool), state_(pool.AcquireState()), priority_(priority) {}
+
+// TaskGroup destructor
+TaskGroup::~TaskGroup() {
+  Wait();
+  pool_.ReleaseState(state_);
+}
+
+// TaskGroup scheduler
+void TaskGroup::Schedule(std::function<void()> task) {
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    ++state_->pending;
   }
+  state_->refs.fetch_add(1);
+  pool_.Push({std::move(task), /*counted=*/false, /*worker=*/-1, state_,
+              /*perf_phase=*/nullptr, priority_});
+}
+
+// TaskGroup scheduler, pinned to a worker
+void TaskGroup::ScheduleOnWorker(int worker, std::function<void()> task) {
+  if (pool_.NumThreads() == 0) {
+    task();
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    ++state_->pending;
+  }
+  state_->refs.fetch_add(1);
+  pool_.Push({std::move(task), /*counted=*/false,
+              worker % pool_.NumThreads(), state_, /*perf_phase=*/nullptr,
+              priority_});
+}
+
+// TaskGroup wait
+void TaskGroup::Wait() { pool_.WaitState(state_); }
+
+// TaskFuture handles, each holding a reference
+TaskFuture::TaskFuture(const TaskFuture& other)
+    : pool_(other.pool_), state_(other.state_) {
+  if (state_) state_->refs.fetch_add(1);
+}
+
+TaskFuture::TaskFuture(TaskFuture&& other) noexcept
+    : pool_(other.pool_), state_(other.state_) {
+  other.state_ = nullptr;
+}
+
+TaskFuture& TaskFuture::operator=(TaskFuture other) noexcept {
+  std::swap(pool_, other.pool_);
+  std::swap(state_, other.state_);
+  return *this;
+}
+
+TaskFuture::~TaskFuture() {
+  if (state_) pool_->ReleaseState(state_);
+}
+
+bool TaskFuture::Ready() const {
+  return !state_ || state_->pending.load() == 0;
+}
+
+void TaskFuture::Wait() const {
+  if (state_) pool_->WaitState(state_);
+}
+
+// continuation of a future
+TaskFuture TaskFuture::Then(std::function<void()> task,
+                            TaskPriority priority) const {
+  ThreadPool::SharedState* state = pool_->AcquireState();
+  state->pending = 1;
+  state->refs.fetch_add(1);
+  ThreadPool::Task next{std::move(task), /*counted=*/false, /*worker=*/-1,
+                        state, /*perf_phase=*/nullptr, priority};
+  pool_->Continue(std::move(next), state_);
+  return TaskFuture(pool_, state);
 }
 
 }  // namespace mjpc
@@ -15,25 +15,83 @@
 #ifndef MJPC_THREADPOOL_H_
 #define MJPC_THREADPOOL_H_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
-#include <iostream>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 #include <absl/base/attributes.h>
+#include <absl/functional/function_ref.h>
 
 namespace mjpc {
 
+class TaskFuture;
+class TaskGroup;
+
+// cpu ids in a list like "0-15,32-47" (the format of taskset and sysfs
+// cpulist files). false if list is malformed.
+bool ParseCpuList(std::string_view list, std::vector<int>* cpus);
+
+// cpus the process may run on, empty if unknown (e.g., not on Linux)
+std::vector<int> AvailableCpus();
+
+// cpus of NUMA node node, empty if unknown
+std::vector<int> NumaNodeCpus(int node);
+
+// cpus to pin the workers of a pool to. the defaults leave workers unpinned.
+struct ThreadPoolAffinity {
+  std::string cpus;     // cpu list, empty: all available cpus
+  int numa_node = -1;   // only cpus of this NUMA node, -1: any node
+  std::string exclude;  // cpu list left free, e.g., physics and estimator
+
+  bool Enabled() const {
+    return !cpus.empty() || numa_node >= 0 || !exclude.empty();
+  }
+
+  // cpus selected by the options, in increasing order. empty if not enabled,
+  // or if no cpu is selected (reported on stderr).
+  std::vector<int> Cpus() const;
+};
+
+// priority lanes of a pool. workers run queued tasks of a higher lane first,
+// e.g., the serial-critical work of a planning iteration before bulk rollouts
+// and background work. tasks already running are not preempted.
+enum class TaskPriority : int {
+  kHigh = 0,
+  kNormal,
+  kLow,
+};
+inline constexpr int kNumTaskPriorities = 3;
+
+// time (microseconds) idle workers and waiters spin before they park on a
+// condition variable. tasks scheduled and completed within it don't pay the
+// OS wakeup latency.
+inline constexpr int kDefaultSpinMicroseconds = 50;
+
 // ThreadPool class
+// each worker owns a task deque per priority lane. tasks scheduled from a
+// worker thread are pushed to that worker's deques, external tasks are
+// distributed round-robin. idle workers steal from the back of other workers'
+// deques, higher lanes first.
 class ThreadPool {
  public:
   // constructor
   explicit ThreadPool(int num_threads);
 
+  // worker i is pinned to cpus[i % cpus.size()], unpinned if cpus is empty
+  ThreadPool(int num_threads, std::vector<int> cpus);
+  ThreadPool(int num_threads, const ThreadPoolAffinity& affinity)
+      : ThreadPool(num_threads, affinity.Cpus()) {}
+
   // destructor
   ~ThreadPool();
 
@@ -43,37 +101,303 @@ class ThreadPool {
   // worker thread (returns -1 if not).
   static int WorkerId() { return worker_id_; }
 
+  // true if called within a worker thread of this pool
+  bool IsWorker() const { return worker_pool_ == this; }
+
+  // cpus workers are pinned to, empty if unpinned
+  const std::vector<int>& Cpus() const { return cpus_; }
+
+  // spin time (microseconds) of idle workers and of waits on the pool before
+  // parking, 0: park immediately. can be set at any time.
+  void SetSpinMicroseconds(int microseconds) {
+    spin_ns_.store(1000 * std::max(microseconds, 0));
+  }
+  int SpinMicroseconds() const { return spin_ns_.load() / 1000; }
+
   // ----- methods ----- //
-  // set task for threadpool
-  void Schedule(std::function<void()> task);
+  // set task for threadpool. scheduling doesn't allocate once the queues
+  // have grown, if the task's captures fit in two pointers.
+  void Schedule(std::function<void()> task,
+                TaskPriority priority = TaskPriority::kNormal);
+
+  // schedule task and return its future, see TaskFuture. like Schedule, it
+  // doesn't allocate once the pool is warm. the task isn't counted.
+  TaskFuture Async(std::function<void()> task,
+                   TaskPriority priority = TaskPriority::kNormal);
+
+  // future that completes when all futures have completed
+  TaskFuture WhenAll(const std::vector<TaskFuture>& futures);
+
+  // run fn(i) for i in [begin, end) on the pool and return when all calls
+  // have completed. indices are claimed in chunks of grain. when called from
+  // a worker of this pool, the calling worker also processes chunks. fn is
+  // not copied, and the loop doesn't allocate once the pool is warm.
+  void ParallelFor(int begin, int end, int grain,
+                   absl::FunctionRef<void(int)> fn) {
+    ParallelFor(begin, end, grain, TaskPriority::kNormal, fn);
+  }
+
+  // parallel loop whose helper tasks are queued at priority
+  void ParallelFor(int begin, int end, int grain, TaskPriority priority,
+                   absl::FunctionRef<void(int)> fn);
 
   // return number of tasks completed
-  std::uint64_t GetCount() { return ctr_; }
+  std::uint64_t GetCount() { return ctr_.load(); }
 
   // reset count to zero
   void ResetCount() { ctr_ = 0; }
 
+  // tasks queued and not yet started
+  int QueueDepth() const { return pending_.load(); }
+
+  // tasks of a priority lane queued and not yet started
+  int QueueDepth(TaskPriority priority) const {
+    return queued_[static_cast<int>(priority)].load();
+  }
+
+  // total time workers spent running tasks since construction (seconds)
+  double BusyTime() const { return 1.0e-9 * busy_ns_.load(); }
+
   // wait for count, then return
   void WaitCount(int value) {
+    if (Spin([&]() { return this->GetCount() >= value; })) return;
     std::unique_lock<std::mutex> lock(m_);
     cv_ext_.wait(lock, [&]() { return this->GetCount() >= value; });
   }
 
  private:
+  friend class TaskFuture;
+  friend class TaskGroup;
+
+  struct Task;
+
+  // state shared by a caller and its tasks: the pending count of a task
+  // group or future, or the chunk counters of a parallel loop. states are
+  // reference counted and recycled by the pool instead of freed, so that
+  // steady-state scheduling doesn't allocate.
+  struct SharedState {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<int> refs{0};
+
+    // task group, modified under mutex and read without it by spinning
+    // waiters
+    std::atomic<int> pending{0};
+
+    // future, tasks scheduled when pending reaches zero (guarded by mutex).
+    // the capacity is kept when the state is recycled.
+    std::vector<Task> continuations;
+
+    // parallel loop
+    std::atomic<int> next{0};       // next chunk to claim
+    std::atomic<int> remaining{0};  // chunks not yet finished
+    const absl::FunctionRef<void(int)>* fn = nullptr;
+    int begin = 0;
+    int end = 0;
+    int grain = 1;
+    int num_chunks = 0;
+  };
+
+  // task with completion accounting flag
+  struct Task {
+    std::function<void()> function;
+    bool counted = false;              // increment ctr_ on completion
+    int worker = -1;                   // only this worker runs it, -1: any
+    SharedState* group = nullptr;      // task group notified on completion
+    const char* perf_phase = nullptr;  // phase that scheduled it, counters
+    TaskPriority priority = TaskPriority::kNormal;  // lane of the task
+    int quota = 0;  // thread quota of the scheduling thread, 0: none
+  };
+
+  // double-ended task queue, a ring buffer that grows and never shrinks
+  class TaskQueue {
+   public:
+    bool empty() const { return size_ == 0; }
+    Task& front() { return tasks_[head_]; }
+    Task& back() { return tasks_[(head_ + size_ - 1) % tasks_.size()]; }
+    void push_back(Task task);
+    void pop_front();
+    void pop_back();
+
+   private:
+    std::vector<Task> tasks_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+  };
+
+  // per-worker task queues, one per priority lane
+  struct Worker {
+    std::mutex mutex;
+    std::array<TaskQueue, kNumTaskPriorities> tasks;
+    std::atomic<int> pinned{0};  // queued tasks only this worker runs
+  };
+
   // ----- methods ----- //
 
+  // shared state with one reference, unused or recycled
+  SharedState* AcquireState();
+
+  // drop a reference, the last one returns the state to the pool
+  void ReleaseState(SharedState* state);
+
+  // claim and run chunks of a parallel loop until none are left
+  static void RunChunks(SharedState* loop);
+
+  // add task to a worker deque and wake a sleeping worker
+  void Push(Task task);
+
+  // take a task from worker i's deque or steal from another worker, from the
+  // highest priority lane with queued tasks. tasks pinned to a worker are not
+  // stolen.
+  bool Pop(int i, Task* task);
+
+  // true if worker i has a task it can run
+  bool HasTask(int i) const {
+    return pending_.load() > pinned_.load() || workers_[i]->pinned.load() > 0;
+  }
+
+  // run one queued task if called from a worker of this pool. returns false
+  // if no task was run.
+  bool RunPendingTask();
+
+  // wait for the pending tasks of state to complete. when called from a
+  // worker, the worker runs queued tasks while waiting.
+  void WaitState(SharedState* state);
+
+  // schedule task once the pending tasks of after have completed
+  void Continue(Task task, SharedState* after);
+
+  // run task and update count
+  void Execute(Task& task);
+
+  // spin until done returns true or the spin time elapses, returns whether
+  // done returned true
+  bool Spin(absl::FunctionRef<bool()> done) const;
+
   // execute task with available thread
   void WorkerThread(int i);
 
   ABSL_CONST_INIT static thread_local int worker_id_;
+  ABSL_CONST_INIT static thread_local const ThreadPool* worker_pool_;
 
   // ----- members ----- //
   std::vector<std::thread> threads_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<int> cpus_;
+  std::atomic<int> pending_;   // tasks pushed but not yet popped
+  std::array<std::atomic<int>, kNumTaskPriorities> queued_;  // per lane
+  std::atomic<int> pinned_;    // pending tasks pinned to a worker
+  std::atomic<int> sleeping_;  // workers waiting on cv_in_
+  std::atomic<unsigned int> next_worker_;
+  bool stop_;  // (guarded by m_)
   std::mutex m_;
   std::condition_variable cv_in_;
   std::condition_variable cv_ext_;
-  std::queue<std::function<void()>> queue_;
-  std::uint64_t ctr_;
+  std::atomic<std::uint64_t> ctr_;
+  std::atomic<std::uint64_t> busy_ns_;
+  std::atomic<int> spin_ns_;
+
+  // shared states, all allocated and unused (guarded by states_mutex_)
+  std::mutex states_mutex_;
+  std::vector<std::unique_ptr<SharedState>> states_;
+  std::vector<SharedState*> free_states_;
+};
+
+// process-wide pool for components that don't bring their own, e.g., the
+// agent's planning and the direct optimizer's parallel work, so that a
+// process doesn't run more compute threads than cpus. it has one worker per
+// available cpu, is created on first use and is never destroyed. components
+// bound their share with a ThreadQuota.
+ThreadPool& SharedThreadPool();
+
+// thread quota of a component on a pool: while in scope, parallel loops run
+// by the calling thread, and by the tasks it schedules, use at most threads
+// threads, a calling worker included. nested quotas take the smaller one,
+// threads <= 0: no quota. task groups are not limited.
+class ThreadQuota {
+ public:
+  explicit ThreadQuota(int threads);
+  ~ThreadQuota();
+
+  ThreadQuota(const ThreadQuota&) = delete;
+  ThreadQuota& operator=(const ThreadQuota&) = delete;
+
+  // quota of the calling thread, 0: none
+  static int Current();
+
+ private:
+  int previous_;
+};
+
+// TaskFuture class
+// completion of a task scheduled with ThreadPool::Async, Then or WhenAll.
+// continuations are scheduled when the task completes, so that dependent
+// phases can form a graph instead of a sequence of barriers, e.g., a time
+// step's Jacobian blocks only wait on its own derivatives. futures are
+// copyable handles to a state recycled by the pool.
+class TaskFuture {
+ public:
+  TaskFuture() = default;
+  TaskFuture(const TaskFuture& other);
+  TaskFuture(TaskFuture&& other) noexcept;
+  TaskFuture& operator=(TaskFuture other) noexcept;
+  ~TaskFuture();
+
+  // false for a default-constructed future
+  bool Valid() const { return state_ != nullptr; }
+
+  // true if the task has completed
+  bool Ready() const;
+
+  // wait for the task to complete. when called from a worker of the pool,
+  // the worker runs queued tasks while waiting.
+  void Wait() const;
+
+  // schedule task when this future's task has completed, returns its future
+  TaskFuture Then(std::function<void()> task,
+                  TaskPriority priority = TaskPriority::kNormal) const;
+
+ private:
+  friend class ThreadPool;
+
+  // adopts a reference to state
+  TaskFuture(ThreadPool* pool, ThreadPool::SharedState* state)
+      : pool_(pool), state_(state) {}
+
+  ThreadPool* pool_ = nullptr;
+  ThreadPool::SharedState* state_ = nullptr;
+};
+
+// TaskGroup class
+// schedules tasks on a ThreadPool and waits only on its own tasks, so several
+// clients can share one pool concurrently. the destructor waits.
+class TaskGroup {
+ public:
+  // constructor, the group's tasks are queued at priority
+  explicit TaskGroup(ThreadPool& pool,
+                     TaskPriority priority = TaskPriority::kNormal);
+
+  // destructor
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // set task for group
+  void Schedule(std::function<void()> task);
+
+  // set task for group, run by worker worker % NumThreads() only, e.g., to
+  // allocate memory that the worker touches first
+  void ScheduleOnWorker(int worker, std::function<void()> task);
+
+  // wait for all scheduled tasks to complete. when called from a worker of
+  // the pool, the worker runs queued tasks while waiting.
+  void Wait();
+
+ private:
+  ThreadPool& pool_;
+  ThreadPool::SharedState* state_;  // completion state, shared with tasks
+  TaskPriority priority_;
 };
 
 }  // namespace mjpc
@@ -0,0 +1,152 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mjpc/trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mjpc {
+
+namespace internal {
+std::atomic<bool> trace_recording = false;
+}  // namespace internal
+
+namespace {
+// events per thread, later events are dropped
+constexpr std::size_t kMaxThreadEvents = 1 << 20;
+
+// nanoseconds since the start of the trace
+struct TraceEvent {
+  const char* name;
+  std::int64_t start;
+  std::int64_t duration;
+};
+
+// events of one thread, kept after the thread exits
+struct ThreadTrace {
+  int id;
+  std::mutex mutex;  // uncontended, except while starting or writing
+  std::string name;
+  std::vector<TraceEvent> events;
+};
+
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadTrace>> threads;
+  std::atomic<std::int64_t> origin = 0;  // steady clock (nanoseconds)
+};
+
+TraceRegistry& Registry() {
+  static auto* registry = new TraceRegistry();
+  return *registry;
+}
+
+std::int64_t Nanoseconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+// trace of the calling thread, registered on first use
+ThreadTrace& CurrentThread() {
+  thread_local std::shared_ptr<ThreadTrace> thread = [] {
+    auto trace = std::make_shared<ThreadTrace>();
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    trace->id = registry.threads.size();
+    registry.threads.push_back(trace);
+    return trace;
+  }();
+  return *thread;
+}
+}  // namespace
+
+namespace internal {
+void RecordTraceEvent(const char* name,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end) {
+  std::int64_t origin = Registry().origin.load(std::memory_order_relaxed);
+  std::int64_t start_ns = Nanoseconds(start);
+  ThreadTrace& thread = CurrentThread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  if (thread.events.size() < kMaxThreadEvents) {
+    thread.events.push_back(
+        {name, start_ns - origin, Nanoseconds(end) - start_ns});
+  }
+}
+}  // namespace internal
+
+void StartTrace() {
+  TraceRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    thread->events.clear();
+  }
+  registry.origin = Nanoseconds(std::chrono::steady_clock::now());
+  internal::trace_recording = true;
+}
+
+void StopTrace() { internal::trace_recording = false; }
+
+bool WriteTrace(const std::string& path) {
+  std::ofstream file(path);
+  if (!file) return false;
+  file << std::fixed << std::setprecision(3);
+  file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+  TraceRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) file << ",\n";
+    first = false;
+  };
+  for (auto& thread : registry.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    if (!thread->name.empty()) {
+      separator();
+      file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+           << "\"tid\": " << thread->id << ", \"args\": {\"name\": \""
+           << thread->name << "\"}}";
+    }
+    // complete events, microseconds
+    for (const TraceEvent& event : thread->events) {
+      separator();
+      file << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", "
+           << "\"pid\": 0, \"tid\": " << thread->id
+           << ", \"ts\": " << 1.0e-3 * event.start
+           << ", \"dur\": " << 1.0e-3 * event.duration << "}";
+    }
+  }
+  file << "\n]}\n";
+  return static_cast<bool>(file);
+}
+
+void SetTraceThreadName(const std::string& name) {
+  ThreadTrace& thread = CurrentThread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  thread.name = name;
+}
+
+}  // namespace mjpc
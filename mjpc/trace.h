@@ -0,0 +1,120 @@
+// Copyright 2023 DeepMind Technologies Limited
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Scoped trace events of the agent, planners, estimators and thread pool,
+// exported as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+// events are recorded only if MJPC_TRACE is defined (CMake option
+// MJPC_ENABLE_TRACE) and between StartTrace and StopTrace; otherwise
+// MJPC_TRACE_SCOPE compiles to nothing and TraceSpan is a plain timer.
+// TraceSpans are also the phases of the hardware performance counters, see
+// perf_counters.h.
+
+#ifndef MJPC_TRACE_H_
+#define MJPC_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "mjpc/perf_counters.h"
+
+namespace mjpc {
+
+// start recording trace events, discarding previously recorded ones
+void StartTrace();
+
+// stop recording trace events
+void StopTrace();
+
+// write recorded events as Chrome trace JSON, returns false on failure
+bool WriteTrace(const std::string& path);
+
+// name the calling thread in the trace
+void SetTraceThreadName(const std::string& name);
+
+namespace internal {
+extern std::atomic<bool> trace_recording;
+void RecordTraceEvent(const char* name,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end);
+}  // namespace internal
+
+// tag of spans that are only trace events, not performance counter phases
+struct TraceEventOnly {};
+
+// timed span of a phase. End returns the elapsed time in microseconds, like
+// GetDuration, and records a trace event named name (a string literal) once.
+// spans that are not ended are recorded when they go out of scope.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(name), start_(std::chrono::steady_clock::now()) {
+#ifdef MJPC_PERF_COUNTERS
+    perf_phase_.Begin(name);
+#endif
+  }
+  TraceSpan(const char* name, TraceEventOnly)
+      : name_(name), start_(std::chrono::steady_clock::now()) {}
+  ~TraceSpan() {
+#ifdef MJPC_TRACE
+    if (!recorded_) Record(std::chrono::steady_clock::now());
+#endif
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  double End() {
+    auto end = std::chrono::steady_clock::now();
+#ifdef MJPC_PERF_COUNTERS
+    perf_phase_.End();
+#endif
+#ifdef MJPC_TRACE
+    if (!recorded_) Record(end);
+#endif
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start_)
+        .count();
+  }
+
+ private:
+#ifdef MJPC_TRACE
+  void Record(std::chrono::steady_clock::time_point end) {
+    recorded_ = true;
+    if (internal::trace_recording.load(std::memory_order_relaxed)) {
+      internal::RecordTraceEvent(name_, start_, end);
+    }
+  }
+  bool recorded_ = false;
+#endif
+#ifdef MJPC_PERF_COUNTERS
+  PerfPhase perf_phase_;
+#endif
+  [[maybe_unused]] const char* name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace mjpc
+
+#ifdef MJPC_TRACE
+#define MJPC_TRACE_CONCAT_(a, b) a##b
+#define MJPC_TRACE_CONCAT(a, b) MJPC_TRACE_CONCAT_(a, b)
+// trace event spanning the enclosing scope
+#define MJPC_TRACE_SCOPE(name)                                     \
+  ::mjpc::TraceSpan MJPC_TRACE_CONCAT(mjpc_trace_span_, __LINE__)( \
+      name, ::mjpc::TraceEventOnly())
+#else
+#define MJPC_TRACE_SCOPE(name) static_cast<void>(0)
+#endif
+
+#endif  // MJPC_TRACE_H_
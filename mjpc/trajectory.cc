@@ -15,18 +15,54 @@
 #include "mjpc/trajectory.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <functional>
-#include <iostream>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
 
+#include <absl/container/inlined_vector.h>
+#include <absl/functional/function_ref.h>
 #include <absl/random/distributions.h>
-#include <absl/random/random.h>
+#include <absl/strings/str_cat.h>
 #include <mujoco/mujoco.h>
+#include "mjpc/memory_report.h"
+#include "mjpc/planners/sampling/policy.h"
+#include "mjpc/random.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/utilities.h"
 
 namespace mjpc {
 namespace {
-// maximum return value
-inline constexpr double kMaxReturnValue = 1.0e6;
+
+// copy the first n elements of source to destination, growing it if needed
+void CopyPrefix(std::vector<double>& destination,
+                const std::vector<double>& source, int n) {
+  if (static_cast<int>(destination.size()) < n) destination.resize(n);
+  std::copy_n(source.begin(), n, destination.begin());
+}
+
+}  // namespace
+
+// rollout steps covering uniform_steps uniform steps
+int RolloutSchedule::Steps(int uniform_steps) const {
+  int duration = uniform_steps - 1;
+  if (Uniform() || duration <= fine_steps) return uniform_steps;
+  int coarse = (duration - fine_steps + coarse_factor - 1) / coarse_factor;
+  return fine_steps + coarse + 1;
+}
+
+// rollout steps ending at or before a uniform step
+int RolloutSchedule::StepsBefore(int uniform_step) const {
+  if (Uniform() || uniform_step <= fine_steps) return uniform_step;
+  return fine_steps + (uniform_step - fine_steps) / coarse_factor;
+}
+
+// sum of cost weights
+double RolloutSchedule::TotalWeight(int steps) const {
+  if (Uniform() || steps <= fine_steps + 1) return steps;
+  return fine_steps + (steps - fine_steps) * coarse_factor;
 }
 
 // initialize dimensions
@@ -61,6 +97,41 @@ void Trajectory::Allocate(int T) {
   trace.resize(dim_trace * T);
 }
 
+std::size_t Trajectory::Bytes() const {
+  return VectorBytes(states, actions, times, residual, costs, trace,
+                     warmstart);
+}
+
+void Trajectory::Snapshot(SnapshotWriter& writer,
+                          std::string_view name) const {
+  writer.Add(absl::StrCat(name, ".horizon"), horizon);
+  writer.Add(absl::StrCat(name, ".states"), states.data(),
+             horizon * dim_state);
+  writer.Add(absl::StrCat(name, ".actions"), actions.data(),
+             horizon * dim_action);
+  writer.Add(absl::StrCat(name, ".times"), times.data(), horizon);
+  writer.Add(absl::StrCat(name, ".total_return"), total_return);
+}
+
+bool Trajectory::Restore(const SnapshotReader& reader,
+                         std::string_view name) {
+  int T = reader.Get(absl::StrCat(name, ".horizon"), -1);
+  if (T < 1 || T > static_cast<int>(times.size()) ||
+      reader.Size(absl::StrCat(name, ".states")) != T * dim_state ||
+      reader.Size(absl::StrCat(name, ".actions")) != T * dim_action ||
+      reader.Size(absl::StrCat(name, ".times")) != T) {
+    return false;
+  }
+  horizon = T;
+  reader.Read(absl::StrCat(name, ".states"), states.data(), T * dim_state);
+  reader.Read(absl::StrCat(name, ".actions"), actions.data(), T * dim_action);
+  reader.Read(absl::StrCat(name, ".times"), times.data(), T);
+  total_return = reader.Get(absl::StrCat(name, ".total_return"), total_return);
+  failure = false;
+  pruned = false;
+  return true;
+}
+
 // reset memory to zeros
 void Trajectory::Reset(int T, const double* initial_repeated_action) {
   // states
@@ -88,34 +159,68 @@ void Trajectory::Reset(int T, const double* initial_repeated_action) {
   std::fill(trace.begin(), trace.begin() + dim_trace * T, 0.0);
 }
 
-// simulate model forward in time with continuous-time indexed policy
-void Trajectory::Rollout(
-    std::function<void(double* action, const double* state, double time)>
-        policy,
-    const Task* task, const mjModel* model, mjData* data, const double* state,
-    double time, const double* mocap, const double* userdata, int steps) {
-  NoisyRollout(policy, task, model, data, state, time, mocap, userdata,
-               /*xfrc_std=*/0, /*xfrc_rate=*/1, steps);
+void Trajectory::CopyFrom(const Trajectory& other) {
+  // dimensions
+  horizon = other.horizon;
+  dim_state = other.dim_state;
+  dim_action = other.dim_action;
+  dim_residual = other.dim_residual;
+  dim_trace = other.dim_trace;
+
+  // time series of the horizon
+  int T = horizon;
+  CopyPrefix(states, other.states, dim_state * T);
+  CopyPrefix(actions, other.actions, dim_action * T);
+  CopyPrefix(times, other.times, T);
+  CopyPrefix(residual, other.residual, dim_residual * T);
+  CopyPrefix(costs, other.costs, T);
+  CopyPrefix(trace, other.trace, dim_trace * T);
+
+  // return and flags
+  total_return = other.total_return;
+  terminal_value = other.terminal_value;
+  failure = other.failure;
+  pruned = other.pruned;
+  num_steps = other.num_steps;
+  num_residuals = other.num_residuals;
+  num_solver_iterations = other.num_solver_iterations;
+  partial_return_ = other.partial_return_;
+  lean_cost_ = other.lean_cost_;
+  return_weight_ = other.return_weight_;
+
+  // settings
+  noise_stream = other.noise_stream;
+  schedule = other.schedule;
+  lean = other.lean;
+  record_warmstart = other.record_warmstart;
+  if (record_warmstart) warmstart = other.warmstart;
+  warmstart_source = other.warmstart_source;
 }
-void Trajectory::NoisyRollout(
-    std::function<void(double* action, const double* state, double time)>
-        policy,
-    const Task* task, const mjModel* model, mjData* data, const double* state,
-    double time, const double* mocap, const double* userdata, double xfrc_std,
-    double xfrc_rate, int steps) {
-  // reset failure flag
+
+// set horizon, mocap, userdata, initial state, and time
+void Trajectory::RolloutBegin(const mjModel* model, mjData* data,
+                              const double* state, double time,
+                              const double* mocap, const double* userdata,
+                              int steps) {
+  // reset flags and counters
   failure = false;
+  pruned = false;
+  num_steps = 0;
+  num_residuals = 0;
+  num_solver_iterations = 0;
+  terminal_value = 0.0;
 
   // model sizes
   int nq = model->nq;
   int nv = model->nv;
   int na = model->na;
-  int nu = model->nu;
   int nmocap = model->nmocap;
   int nuserdata = model->nuserdata;
 
   // horizon
   horizon = steps;
+  BeginSchedule();
+  if (record_warmstart) warmstart.resize(horizon * nv);
 
   // set mocap
   for (int i = 0; i < nmocap; i++) {
@@ -135,54 +240,170 @@ void Trajectory::NoisyRollout(
   // set initial time
   times[0] = time;
   data->time = time;
+}
 
-  absl::BitGen gen;
+// return normalization of the schedule
+void Trajectory::BeginSchedule() {
+  if (!schedule.Uniform() && !schedule.coarse_model) {
+    mju_error("RolloutSchedule: coarse_model required");
+  }
+  if (schedule.num_solver_levels > 0 && !schedule.solver_models) {
+    mju_error("RolloutSchedule: solver_models required");
+  }
+  return_weight_ = mju_max(schedule.TotalWeight(horizon), 1);
+}
 
-  for (int t = 0; t < horizon - 1; t++) {
-    // set action
+// simulate step t, returns false if the rollout stopped (failure or pruned)
+template <typename PolicyFn>
+bool Trajectory::RolloutStep(const PolicyFn& policy, const Task* task,
+                             const mjModel* model, mjData* data,
+                             double xfrc_std, double xfrc_rate, int t,
+                             ReturnBound* bound) {
+  // model sizes
+  int nq = model->nq;
+  int nv = model->nv;
+  int na = model->na;
+  int nu = model->nu;
+
+  // time step of the schedule
+  model = StepModel(model, t);
+
+  // set action
+  if (lean) {
+    policy(data->ctrl, nullptr, data->time);
+  } else {
     policy(DataAt(actions, t * nu), DataAt(states, t * dim_state), data->time);
     mju_copy(data->ctrl, DataAt(actions, t * nu), nu);
+  }
 
-    // apply perturbation
-    if (xfrc_std > 0) {
-      // convert rate and scale to discrete time (Ornstein–Uhlenbeck)
-      mjtNum rate = mju_exp(-model->opt.timestep / xfrc_rate);
-      mjtNum scale = xfrc_std * mju_sqrt(1 - rate * rate);
-      for (int i = 0; i < 6*model->nbody; i++) {
-        data->xfrc_applied[i] = rate * data->xfrc_applied[i] +
-                                absl::Gaussian<mjtNum>(gen, 0, scale);
-      }
+  // apply perturbation
+  if (xfrc_std > 0) {
+    // convert rate and scale to discrete time (Ornstein–Uhlenbeck)
+    mjtNum rate = mju_exp(-model->opt.timestep / xfrc_rate);
+    mjtNum scale = xfrc_std * mju_sqrt(1 - rate * rate);
+    for (int i = 0; i < 6*model->nbody; i++) {
+      data->xfrc_applied[i] =
+          rate * data->xfrc_applied[i] +
+          absl::Gaussian<mjtNum>(noise_stream, 0, scale);
     }
+  }
 
-    // step
+  // constraint solver warm start
+  if (const double* qacc = warmstart_source.Row(t, nv)) {
+    mju_copy(data->qacc_warmstart, qacc, nv);
+  }
+  if (record_warmstart) {
+    mju_copy(DataAt(warmstart, t * nv), data->qacc_warmstart, nv);
+  }
+
+  // step, evaluating the residual every residual_stride steps
+  bool evaluate = t == 0 || t % task->residual_stride == 0;
+  {
+    ScopedResidualSkip skip(!evaluate);
     mj_step(model, data);
+  }
+  num_steps++;
+  num_solver_iterations += SolverIterations(data);
+
+  // stop at warnings, bad residuals and terminal states
+  if (evaluate) num_residuals++;
+  if (Abort(task, model, data, evaluate)) return false;
+
+  // lean rollouts only accumulate the return
+  if (lean) {
+    if (evaluate) lean_cost_ = task->CostValue(data->sensordata);
+    partial_return_ += lean_cost_ * schedule.Weight(t, horizon);
+    if (bound && partial_return_ / return_weight_ > bound->Get()) {
+      Prune(t, partial_return_);
+      return false;
+    }
+    return true;
+  }
 
-    // record residual
+  // record residual, held between evaluations
+  if (evaluate) {
     mju_copy(DataAt(residual, t * dim_residual), data->sensordata,
              dim_residual);
+  } else {
+    mju_copy(DataAt(residual, t * dim_residual),
+             DataAt(residual, (t - 1) * dim_residual), dim_residual);
+  }
 
-    // record trace
-    GetTraces(DataAt(trace, t * 3 * task->num_trace), model, data,
-              task->num_trace);
+  // record trace
+  if (dim_trace) {
+    GetTraces(DataAt(trace, t * dim_trace), data, task->trace_sensor_adr);
+  }
 
-    // check for step warnings
-    if ((failure |= CheckWarnings(data))) {
-      total_return = kMaxReturnValue;
-      std::cerr << "Rollout divergence at step\n";
-      return;
+  // stop if the remaining steps cannot bring the return under the bound
+  if (bound) {
+    costs[t] = task->CostValue(DataAt(residual, t * dim_residual));
+    partial_return_ += costs[t] * schedule.Weight(t, horizon);
+    if (partial_return_ / return_weight_ > bound->Get()) {
+      Prune(t, partial_return_);
+      return false;
     }
+  }
 
-    // record state
-    mju_copy(DataAt(states, (t + 1) * dim_state), data->qpos, nq);
-    mju_copy(DataAt(states, (t + 1) * dim_state + nq), data->qvel, nv);
-    mju_copy(DataAt(states, (t + 1) * dim_state + nq + nv), data->act, na);
-    times[t + 1] = data->time;
+  // record state
+  mju_copy(DataAt(states, (t + 1) * dim_state), data->qpos, nq);
+  mju_copy(DataAt(states, (t + 1) * dim_state + nq), data->qvel, nv);
+  mju_copy(DataAt(states, (t + 1) * dim_state + nq + nv), data->act, na);
+  times[t + 1] = data->time;
+  return true;
+}
+
+// simulate steps [begin, end) with callable policy, finish the rollout if
+// end is the last step
+template <typename PolicyFn>
+void Trajectory::RolloutLoop(const PolicyFn& policy, const Task* task,
+                             const mjModel* model, mjData* data,
+                             double xfrc_std, double xfrc_rate, int begin,
+                             int end, ReturnBound* bound) {
+  // running (unnormalized) return, only tracked with a bound or when lean
+  partial_return_ = 0.0;
+  if ((bound || lean) && begin > 0) {
+    task->CostValues(costs.data(), residual.data(), begin);
+    for (int t = 0; t < begin; t++) {
+      partial_return_ += costs[t] * schedule.Weight(t, horizon);
+    }
+    lean_cost_ = costs[begin - 1];
+  }
+
+  for (int t = begin; t < end; t++) {
+    if (!RolloutStep(policy, task, model, data, xfrc_std, xfrc_rate, t,
+                     bound)) {
+      return;
+    }
   }
 
-  // check for step warnings
-  if ((failure |= CheckWarnings(data))) {
-    total_return = kMaxReturnValue;
-    std::cerr << "Rollout divergence at step\n";
+  // prefix only
+  if (end < horizon - 1) return;
+
+  RolloutEnd(task, model, data, bound);
+}
+
+// final action, residual, trace, and return after the last step
+void Trajectory::RolloutEnd(const Task* task, const mjModel* model,
+                            mjData* data, ReturnBound* bound) {
+  // final forward
+  mj_forward(model, data);
+  num_residuals++;
+  if (Abort(task, model, data, /*evaluated=*/true)) return;
+
+  // lean rollouts record the final state, for the terminal value, and the
+  // return
+  if (lean) {
+    double* final_state = DataAt(states, (horizon - 1) * dim_state);
+    mju_copy(final_state, data->qpos, model->nq);
+    mju_copy(final_state + model->nq, data->qvel, model->nv);
+    mju_copy(final_state + model->nq + model->nv, data->act, model->na);
+    times[horizon - 1] = data->time;
+    double weight = schedule.Weight(horizon - 1, horizon);
+    total_return = (partial_return_ +
+                    task->CostValue(data->sensordata) * weight +
+                    TerminalValue(task)) /
+                   return_weight_;
+    if (bound) bound->Update(total_return);
     return;
   }
 
@@ -194,19 +415,235 @@ void Trajectory::NoisyRollout(
     mju_zero(DataAt(actions, (horizon - 1) * dim_action), dim_action);
   }
 
-  // final forward
-  mj_forward(model, data);
-
   // final residual
   mju_copy(DataAt(residual, (horizon - 1) * dim_residual), data->sensordata,
            dim_residual);
 
   // final trace
-  GetTraces(DataAt(trace, (horizon - 1) * 3 * task->num_trace), model, data,
-            task->num_trace);
+  if (dim_trace) {
+    GetTraces(DataAt(trace, (horizon - 1) * dim_trace), data,
+              task->trace_sensor_adr);
+  }
 
   // compute return
-  UpdateReturn(task);
+  if (bound) {
+    costs[horizon - 1] =
+        task->CostValue(DataAt(residual, (horizon - 1) * dim_residual));
+    double weight = schedule.Weight(horizon - 1, horizon);
+    total_return = (partial_return_ + costs[horizon - 1] * weight +
+                    TerminalValue(task)) /
+                   return_weight_;
+    bound->Update(total_return);
+  } else {
+    UpdateReturn(task);
+  }
+}
+
+// simulate model forward in time with continuous-time indexed policy
+void Trajectory::Rollout(
+    std::function<void(double* action, const double* state, double time)>
+        policy,
+    const Task* task, const mjModel* model, mjData* data, const double* state,
+    double time, const double* mocap, const double* userdata, int steps,
+    ReturnBound* bound) {
+  NoisyRollout(policy, task, model, data, state, time, mocap, userdata,
+               /*xfrc_std=*/0, /*xfrc_rate=*/1, steps, bound);
+}
+void Trajectory::NoisyRollout(
+    std::function<void(double* action, const double* state, double time)>
+        policy,
+    const Task* task, const mjModel* model, mjData* data, const double* state,
+    double time, const double* mocap, const double* userdata, double xfrc_std,
+    double xfrc_rate, int steps, ReturnBound* bound) {
+  RolloutBegin(model, data, state, time, mocap, userdata, steps);
+  RolloutLoop(policy, task, model, data, xfrc_std, xfrc_rate, 0, horizon - 1,
+              bound);
+}
+void Trajectory::Rollout(const SamplingPolicy& policy, const Task* task,
+                         const mjModel* model, mjData* data,
+                         const double* state, double time, const double* mocap,
+                         const double* userdata, int steps,
+                         ReturnBound* bound) {
+  RolloutBegin(model, data, state, time, mocap, userdata, steps);
+  SamplingPolicyEvaluator evaluator(policy);
+  RolloutLoop(
+      [&evaluator](double* action, const double* x, double t) {
+        evaluator.Action(action, t);
+      },
+      task, model, data, /*xfrc_std=*/0, /*xfrc_rate=*/1, 0, horizon - 1,
+      bound);
+}
+
+// simulate the first prefix steps of a rollout, data is left at the state
+// after the prefix
+void Trajectory::RolloutPrefix(const SamplingPolicy& policy, const Task* task,
+                               const mjModel* model, mjData* data,
+                               const double* state, double time,
+                               const double* mocap, const double* userdata,
+                               int steps, int prefix) {
+  RolloutBegin(model, data, state, time, mocap, userdata, steps);
+  SamplingPolicyEvaluator evaluator(policy);
+  RolloutLoop(
+      [&evaluator](double* action, const double* x, double t) {
+        evaluator.Action(action, t);
+      },
+      task, model, data, /*xfrc_std=*/0, /*xfrc_rate=*/1, 0,
+      mju_min(prefix, horizon - 1), /*bound=*/nullptr);
+}
+
+// continue a rollout from a shared prefix
+void Trajectory::RolloutFrom(const SamplingPolicy& policy,
+                             const Trajectory& prefix, int prefix_steps,
+                             const mjData* prefix_data, const Task* task,
+                             const mjModel* model, mjData* data,
+                             ReturnBound* bound) {
+  // reset flags and counters, the prefix steps are counted by prefix
+  failure = prefix.failure;
+  pruned = false;
+  num_steps = 0;
+  num_residuals = 0;
+  num_solver_iterations = 0;
+  terminal_value = 0.0;
+  horizon = prefix.horizon;
+  BeginSchedule();
+  if (failure) {
+    total_return = task->failure_cost;
+    return;
+  }
+
+  // copy prefix, only the residuals of its costs and times if lean
+  int p = mju_min(prefix_steps, horizon - 1);
+  mju_copy(residual.data(), prefix.residual.data(), p * dim_residual);
+  mju_copy(times.data(), prefix.times.data(), p + 1);
+  if (!lean) {
+    mju_copy(states.data(), prefix.states.data(), (p + 1) * dim_state);
+    mju_copy(actions.data(), prefix.actions.data(), p * dim_action);
+    mju_copy(trace.data(), prefix.trace.data(), p * dim_trace);
+  }
+  if (record_warmstart) {
+    warmstart.resize(horizon * model->nv);
+    if (prefix.record_warmstart) {
+      mju_copy(warmstart.data(), prefix.warmstart.data(), p * model->nv);
+    }
+  }
+
+  // branch from prefix state
+  mj_copyData(data, model, prefix_data);
+
+  SamplingPolicyEvaluator evaluator(policy);
+  RolloutLoop(
+      [&evaluator](double* action, const double* x, double t) {
+        evaluator.Action(action, t);
+      },
+      task, model, data, /*xfrc_std=*/0, /*xfrc_rate=*/1, p, horizon - 1,
+      bound);
+}
+
+// simulation state of rollout checkpoints
+constexpr int kCheckpointState = mjSTATE_INTEGRATION;
+
+// simulate steps [begin, end) of a rollout, continuing from checkpoint
+void Trajectory::RolloutSegment(const SamplingPolicy& policy, const Task* task,
+                                const mjModel* model, mjData* data,
+                                const double* state, double time,
+                                const double* mocap, const double* userdata,
+                                int steps, int begin, int end,
+                                std::vector<double>& checkpoint,
+                                ReturnBound* bound) {
+  if (begin == 0) {
+    RolloutBegin(model, data, state, time, mocap, userdata, steps);
+    partial_return_ = 0.0;
+  } else {
+    mj_setState(model, data, checkpoint.data(), kCheckpointState);
+  }
+  end = mju_min(end, horizon - 1);
+
+  SamplingPolicyEvaluator evaluator(policy);
+  auto action = [&evaluator](double* action, const double* x, double t) {
+    evaluator.Action(action, t);
+  };
+  for (int t = begin; t < end; t++) {
+    if (!RolloutStep(action, task, model, data, /*xfrc_std=*/0,
+                     /*xfrc_rate=*/1, t, bound)) {
+      return;
+    }
+  }
+  if (end == horizon - 1) {
+    RolloutEnd(task, model, data, bound);
+    return;
+  }
+
+  // the steps accumulate the return with a bound or when lean
+  if (!bound && !lean) {
+    task->CostValues(costs.data() + begin,
+                     residual.data() + begin * dim_residual, end - begin);
+    for (int t = begin; t < end; t++) {
+      partial_return_ += costs[t] * schedule.Weight(t, horizon);
+    }
+  }
+
+  checkpoint.resize(mj_stateSize(model, kCheckpointState));
+  mj_getState(model, data, checkpoint.data(), kCheckpointState);
+}
+
+// simulate n samples in lockstep, one time step across all samples at a
+// time
+void Trajectory::RolloutLockstep(Trajectory* const* trajectories,
+                                 const SamplingPolicy* const* policies, int n,
+                                 const Task* task, const mjModel* model,
+                                 mjData* const* data, const double* state,
+                                 double time, const double* mocap,
+                                 const double* userdata, int steps,
+                                 ReturnBound* bound) {
+  // inline up to the sampling planner's largest lockstep group
+  absl::InlinedVector<SamplingPolicyEvaluator, 16> evaluators;
+  evaluators.reserve(n);
+  for (int i = 0; i < n; i++) {
+    trajectories[i]->RolloutBegin(model, data[i], state, time, mocap,
+                                  userdata, steps);
+    trajectories[i]->partial_return_ = 0.0;
+    evaluators.emplace_back(*policies[i]);
+  }
+
+  for (int t = 0; t < steps - 1; t++) {
+    for (int i = 0; i < n; i++) {
+      Trajectory* trajectory = trajectories[i];
+
+      // skip samples that stopped
+      if (trajectory->failure || trajectory->pruned) continue;
+
+      SamplingPolicyEvaluator* evaluator = &evaluators[i];
+      trajectory->RolloutStep(
+          [evaluator](double* action, const double* x, double now) {
+            evaluator->Action(action, now);
+          },
+          task, model, data[i], /*xfrc_std=*/0, /*xfrc_rate=*/1, t, bound);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    Trajectory* trajectory = trajectories[i];
+    if (trajectory->failure || trajectory->pruned) continue;
+    trajectory->RolloutEnd(task, model, data[i], bound);
+  }
+}
+
+// stop rollout after step t with a lower bound on the return
+void Trajectory::Prune(int t, double partial_return) {
+  pruned = true;
+  total_return = partial_return / return_weight_;
+  if (lean) return;
+
+  // hold the last recorded values so visualization stays continuous
+  for (int s = t + 1; s < horizon; s++) {
+    mju_copy(DataAt(states, s * dim_state), DataAt(states, t * dim_state),
+             dim_state);
+    mju_copy(DataAt(actions, s * dim_action), DataAt(actions, t * dim_action),
+             dim_action);
+    mju_copy(DataAt(trace, s * dim_trace), DataAt(trace, t * dim_trace),
+             dim_trace);
+    costs[s] = 0.0;
+  }
 }
 
 // simulate model forward in time with discrete-time indexed policy
@@ -214,9 +651,15 @@ void Trajectory::RolloutDiscrete(
     std::function<void(double* action, const double* state, int index)>
         policy,
     const Task* task, const mjModel* model, mjData* data, const double* state,
-    double time, const double* mocap, const double* userdata, int steps) {
-  // reset failure flag
+    double time, const double* mocap, const double* userdata, int steps,
+    ReturnBound* bound) {
+  // reset flags and counters
   failure = false;
+  pruned = false;
+  num_steps = 0;
+  num_residuals = 0;
+  num_solver_iterations = 0;
+  terminal_value = 0.0;
 
   // model sizes
   int nq = model->nq;
@@ -228,6 +671,7 @@ void Trajectory::RolloutDiscrete(
 
   // horizon
   horizon = steps;
+  BeginSchedule();
 
   // set mocap
   for (int i = 0; i < nmocap; i++) {
@@ -248,27 +692,40 @@ void Trajectory::RolloutDiscrete(
   times[0] = time;
   data->time = time;
 
+  // running return, only tracked against a bound
+  double partial_return = 0.0;
+
   for (int t = 0; t < horizon - 1; t++) {
     // set action
     policy(DataAt(actions, t * nu), DataAt(states, t * dim_state), t);
     mju_copy(data->ctrl, DataAt(actions, t * nu), nu);
 
     // step
-    mj_step(model, data);
+    mj_step(StepModel(model, t), data);
+    num_steps++;
+    num_residuals++;
+    num_solver_iterations += SolverIterations(data);
+
+    // stop at warnings, bad residuals and terminal states
+    if (Abort(task, model, data, /*evaluated=*/true)) return;
 
     // record residual
     mju_copy(DataAt(residual, t * dim_residual), data->sensordata,
              dim_residual);
 
     // record trace
-    GetTraces(DataAt(trace, t * 3 * task->num_trace), model, data,
-              task->num_trace);
+    if (dim_trace) {
+      GetTraces(DataAt(trace, t * dim_trace), data, task->trace_sensor_adr);
+    }
 
-    // check for step warnings
-    if ((failure |= CheckWarnings(data))) {
-      total_return = kMaxReturnValue;
-      std::cerr << "Rollout divergence at step\n";
-      return;
+    // stop if the remaining steps cannot bring the return under the bound
+    if (bound) {
+      costs[t] = task->CostValue(DataAt(residual, t * dim_residual));
+      partial_return += costs[t] * schedule.Weight(t, horizon);
+      if (partial_return / return_weight_ > bound->Get()) {
+        Prune(t, partial_return);
+        return;
+      }
     }
 
     // record state
@@ -278,12 +735,10 @@ void Trajectory::RolloutDiscrete(
     times[t + 1] = data->time;
   }
 
-  // check for step warnings
-  if ((failure |= CheckWarnings(data))) {
-    total_return = kMaxReturnValue;
-    std::cerr << "Rollout divergence at step\n";
-    return;
-  }
+  // final forward
+  mj_forward(model, data);
+  num_residuals++;
+  if (Abort(task, model, data, /*evaluated=*/true)) return;
 
   // copy final action
   if (horizon > 1) {
@@ -293,36 +748,165 @@ void Trajectory::RolloutDiscrete(
     mju_zero(DataAt(actions, (horizon - 1) * dim_action), dim_action);
   }
 
-  // final forward
-  mj_forward(model, data);
-
   // final residual
   mju_copy(DataAt(residual, (horizon - 1) * dim_residual), data->sensordata,
            dim_residual);
 
   // final trace
-  GetTraces(DataAt(trace, (horizon - 1) * 3 * task->num_trace), model, data,
-            task->num_trace);
+  if (dim_trace) {
+    GetTraces(DataAt(trace, (horizon - 1) * dim_trace), data,
+              task->trace_sensor_adr);
+  }
 
   // compute return
+  if (bound) {
+    costs[horizon - 1] =
+        task->CostValue(DataAt(residual, (horizon - 1) * dim_residual));
+    double weight = schedule.Weight(horizon - 1, horizon);
+    total_return = (partial_return + costs[horizon - 1] * weight +
+                    TerminalValue(task)) /
+                   return_weight_;
+    bound->Update(total_return);
+  } else {
+    UpdateReturn(task);
+  }
+}
+
+// stop at simulation warnings, bad residual values and terminal states of the
+// task, with the task's failure cost
+bool Trajectory::Abort(const Task* task, const mjModel* model, mjData* data,
+                       bool evaluated) {
+  bool stop = CheckWarnings(data);
+  if (!stop && evaluated) {
+    for (int i = 0; i < dim_residual && !stop; i++) {
+      stop = mju_isBad(data->sensordata[i]);
+    }
+    stop = stop || (task->termination && task->Terminated(model, data));
+  }
+  if (!stop) return false;
+  failure = true;
+  total_return = task->failure_cost;
+  return true;
+}
+
+// terminal value of the final state
+double Trajectory::TerminalValue(const Task* task) {
+  terminal_value =
+      task->TerminalValue(DataAt(states, (horizon - 1) * dim_state));
+  return terminal_value;
+}
+
+// costs and total return of the recorded residuals
+void Trajectory::Evaluate(const Task* task, int steps) {
+  horizon = steps;
+  BeginSchedule();
+  terminal_value = 0.0;
   UpdateReturn(task);
 }
 
 // calculates total_return and costs
 void Trajectory::UpdateReturn(const Task* task) {
-  // reset
-  total_return = 0;
+  // stage costs
+  task->CostValues(costs.data(), residual.data(), horizon);
 
+  // total return, stage costs weighted by the duration of their step
+  total_return = 0;
   for (int t = 0; t < horizon; t++) {
-    // compute stage cost
-    costs[t] = task->CostValue(DataAt(residual, t * task->num_residual));
+    total_return += costs[t] * schedule.Weight(t, horizon);
+  }
+
+  // cost after the horizon
+  total_return += TerminalValue(task);
+
+  // normalize return by trajectory duration
+  total_return /= return_weight_;
+}
+
+// track k best returns
+void ReturnBound::Reset(int k) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  k_ = std::max(k, 1);
+  best_.clear();
+  best_.reserve(k_ + 1);
+  cancelled_ = false;
+  bound_.store(std::numeric_limits<double>::infinity(),
+               std::memory_order_relaxed);
+}
+
+// record completed return, tighten bound once k are known
+void ReturnBound::Update(double total_return) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cancelled_) return;
+  int n = best_.size();
+  if (n == k_ && total_return >= best_.back()) return;
+  best_.insert(std::upper_bound(best_.begin(), best_.end(), total_return),
+               total_return);
+  if (n == k_) best_.pop_back();
+  if (best_.size() == static_cast<size_t>(k_)) {
+    bound_.store(best_.back(), std::memory_order_relaxed);
+  }
+}
+
+// any partial return exceeds the bound
+void ReturnBound::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  bound_.store(-std::numeric_limits<double>::infinity(),
+               std::memory_order_relaxed);
+}
 
-    // update total return
-    total_return += costs[t];
+// rank trajectories by total return
+void RankTrajectories(int* order, double* returns, const Trajectory* trajectory,
+                      int num_trajectory, int num_ranked) {
+  for (int i = 0; i < num_trajectory; i++) {
+    order[i] = i;
+    returns[i] = trajectory[i].total_return;
   }
+  std::partial_sort(order, order + num_ranked, order + num_trajectory,
+                    [returns](int a, int b) { return returns[a] < returns[b]; });
+}
 
-  // normalize return by trajectory horizon
-  total_return /= mju_max(horizon, 1);
+// select best trajectories by total return
+void SelectTrajectories(int* order, double* returns,
+                        const Trajectory* trajectory, int num_trajectory,
+                        int num_selected) {
+  for (int i = 0; i < num_trajectory; i++) {
+    order[i] = i;
+    returns[i] = trajectory[i].total_return;
+  }
+  num_selected = std::min(num_selected, num_trajectory);
+  if (num_selected <= 0) return;
+  auto compare = [returns](int a, int b) { return returns[a] < returns[b]; };
+  std::nth_element(order, order + num_selected - 1, order + num_trajectory,
+                   compare);
+  std::iter_swap(order, std::min_element(order, order + num_selected, compare));
+}
+
+// grow sampling planner trajectory storage
+void GrowSampledTrajectories(
+    const mjModel* model, const Task& task, int num_trajectory, int horizon,
+    Trajectory* trajectory, SamplingPolicy* candidate_policy,
+    std::vector<double>* noise, int* num_allocated, int* allocated_horizon,
+    std::shared_mutex& mutex, absl::FunctionRef<void(int)> resize) {
+  if (num_trajectory <= *num_allocated && horizon <= *allocated_horizon) {
+    return;
+  }
+  const std::unique_lock<std::shared_mutex> lock(mutex);
+  int num_state = model->nq + model->nv + model->na;
+  int num_grown = std::max(num_trajectory, *num_allocated);
+  int grown_horizon = std::max(horizon, *allocated_horizon);
+  for (int i = 0; i < num_grown; i++) {
+    if (i >= *num_allocated) {
+      trajectory[i].Initialize(num_state, model->nu, task.num_residual,
+                               task.num_trace, grown_horizon);
+      candidate_policy[i].Allocate(model, task, kMaxTrajectoryHorizon);
+    }
+    trajectory[i].Allocate(grown_horizon);
+  }
+  noise->resize(num_grown * (model->nu * kMaxTrajectoryHorizon));
+  resize(num_grown);
+  *num_allocated = num_grown;
+  *allocated_horizon = grown_horizon;
 }
 
 }  // namespace mjpc
@@ -15,10 +15,19 @@
 #ifndef MJPC_TRAJECTORY_H_
 #define MJPC_TRAJECTORY_H_
 
+#include <atomic>
+#include <cstddef>
 #include <functional>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
 #include <vector>
 
+#include <absl/functional/function_ref.h>
 #include <mujoco/mujoco.h>
+#include "mjpc/random.h"
+#include "mjpc/snapshot.h"
 #include "mjpc/task.h"
 
 namespace mjpc {
@@ -26,6 +35,106 @@ namespace mjpc {
 // maximum trajectory length
 inline constexpr int kMaxTrajectoryHorizon = 512;
 
+// maximum reduced constraint solver fidelity levels of a rollout schedule
+inline constexpr int kMaxSolverLevels = 4;
+
+class SamplingPolicy;
+
+// time steps of a rollout: the first fine_steps steps use the model's time
+// step, later steps coarse_factor times the model's time step, simulated
+// with coarse_model. costs are weighted by the duration of their step.
+struct RolloutSchedule {
+  int fine_steps = 0;     // 0: uniform
+  int coarse_factor = 1;  // 1: uniform
+
+  // the rollout model with coarse_factor times its time step, e.g., a header
+  // copy (required if not uniform)
+  const mjModel* coarse_model = nullptr;
+
+  bool Uniform() const { return fine_steps <= 0 || coarse_factor <= 1; }
+
+  // time step multiple of step t
+  int Scale(int t) const {
+    return Uniform() || t < fine_steps ? 1 : coarse_factor;
+  }
+
+  // reduced constraint solver fidelity: steps from full_solver_steps on are
+  // simulated with solver_models[level], one level per solver_level_steps
+  // steps up to num_solver_levels - 1, e.g., header copies with fewer solver
+  // iterations and a looser tolerance (of coarse_model if the steps are
+  // coarse). num_solver_levels = 0: full fidelity.
+  int full_solver_steps = 0;
+  int solver_level_steps = 1;
+  int num_solver_levels = 0;  // <= kMaxSolverLevels
+  const mjModel* const* solver_models = nullptr;
+
+  // solver fidelity level of step t, -1 for full fidelity
+  int SolverLevel(int t) const {
+    if (num_solver_levels <= 0 || t < full_solver_steps) return -1;
+    int level = (t - full_solver_steps) / mju_max(solver_level_steps, 1);
+    return level < num_solver_levels ? level : num_solver_levels - 1;
+  }
+
+  // rollout steps that cover the duration of uniform_steps uniform steps
+  int Steps(int uniform_steps) const;
+
+  // rollout steps that end at or before uniform step uniform_step
+  int StepsBefore(int uniform_step) const;
+
+  // cost weight of time index t of a steps-long rollout, the final time is
+  // weighted as the last step. 1 for uniform schedules.
+  double Weight(int t, int steps) const {
+    return Scale(t < steps - 1 ? t : steps - 2);
+  }
+
+  // sum of the weights of a steps-long rollout, steps for uniform schedules
+  double TotalWeight(int steps) const;
+};
+
+// running bound on the k-th best total return among completed rollouts.
+// shared by concurrent rollouts so that samples which cannot reach the top k
+// stop early. assumes nonnegative stage costs.
+class ReturnBound {
+ public:
+  // constructor
+  ReturnBound() = default;
+
+  // clear recorded returns and track the k best
+  void Reset(int k);
+
+  // record the total return of a completed rollout
+  void Update(double total_return);
+
+  // stop all rollouts against the bound at their next step, until Reset
+  void Cancel();
+
+  // current bound, infinite until k rollouts have completed
+  double Get() const { return bound_.load(std::memory_order_relaxed); }
+
+ private:
+  std::mutex mutex_;
+  std::vector<double> best_;  // k lowest returns, sorted (guarded by mutex_)
+  int k_ = 1;
+  bool cancelled_ = false;  // (guarded by mutex_)
+  std::atomic<double> bound_{std::numeric_limits<double>::infinity()};
+};
+
+// constraint solver warm starts (qacc_warmstart before each step) of a
+// recorded rollout, for rollouts that start shift steps after it
+struct WarmStartSource {
+  const double* qacc = nullptr;  // (steps x nv)
+  int steps = 0;
+  int shift = 0;
+  bool every_step = false;  // false: only the first step
+
+  // warm start of step t, nullptr for none
+  const double* Row(int t, int nv) const {
+    if (!qacc || (t > 0 && !every_step)) return nullptr;
+    int row = t + shift < steps ? t + shift : steps - 1;
+    return qacc + row * nv;
+  }
+};
+
 // time series of states, actions, costs, residual, times, parameters, noise,
 // traces
 class Trajectory {
@@ -46,29 +155,108 @@ class Trajectory {
   // allocate memory
   void Allocate(int T);
 
+  // allocated bytes
+  std::size_t Bytes() const;
+
   // reset memory to zeros (and perhaps a non-zero action)
   void Reset(int T, const double* initial_repeated_action = nullptr);
 
-  // simulate model forward in time with continuous-time indexed policy
+  // copy the dimensions, return, flags and settings of other and the first
+  // other.horizon steps of its time series, without reallocating unless this
+  // trajectory's allocation is smaller
+  void CopyFrom(const Trajectory& other);
+
+  // write the horizon, states, actions, times and total return as sections
+  // name.*. Restore returns false, leaving the trajectory unchanged, if the
+  // sections don't match its dimensions or allocation.
+  void Snapshot(SnapshotWriter& writer, std::string_view name) const;
+  bool Restore(const SnapshotReader& reader, std::string_view name);
+
+  // simulate model forward in time with continuous-time indexed policy.
+  // if bound is given, the rollout stops once its running return exceeds the
+  // bound (pruned) and completed returns are recorded in the bound.
   void Rollout(
       std::function<void(double* action, const double* state, double time)>
           policy,
       const Task* task, const mjModel* model, mjData* data, const double* state,
-      double time, const double* mocap, const double* userdata, int steps);
+      double time, const double* mocap, const double* userdata, int steps,
+      ReturnBound* bound = nullptr);
+
+  // simulate model forward in time with a sampling policy. the policy is
+  // evaluated directly instead of through std::function, so the spline
+  // evaluation is inlined into the step loop, and incrementally with a
+  // SamplingPolicyEvaluator.
+  void Rollout(const SamplingPolicy& policy, const Task* task,
+               const mjModel* model, mjData* data, const double* state,
+               double time, const double* mocap, const double* userdata,
+               int steps, ReturnBound* bound = nullptr);
+
+  // simulate the first prefix steps of a steps-long rollout. data is left at
+  // the state after the prefix so that rollouts can branch from it with
+  // RolloutFrom.
+  void RolloutPrefix(const SamplingPolicy& policy, const Task* task,
+                     const mjModel* model, mjData* data, const double* state,
+                     double time, const double* mocap, const double* userdata,
+                     int steps, int prefix);
+
+  // continue a rollout from prefix_steps steps of a shared prefix, where
+  // prefix_data holds the simulation state after the prefix. the policy must
+  // match the prefix policy on those steps.
+  void RolloutFrom(const SamplingPolicy& policy, const Trajectory& prefix,
+                   int prefix_steps, const mjData* prefix_data,
+                   const Task* task, const mjModel* model, mjData* data,
+                   ReturnBound* bound = nullptr);
+
+  // simulate steps [begin, end) of a steps-long rollout, e.g., to stop
+  // some samples at a checkpoint and continue the others. a rollout starts
+  // from state with begin == 0, later segments continue from the simulation
+  // state saved in checkpoint (mj_getState) at the end of the previous
+  // segment, on any mjData. the rollout is finished if end is the last step,
+  // otherwise PartialReturn is the running return of its steps.
+  void RolloutSegment(const SamplingPolicy& policy, const Task* task,
+                      const mjModel* model, mjData* data, const double* state,
+                      double time, const double* mocap,
+                      const double* userdata, int steps, int begin, int end,
+                      std::vector<double>& checkpoint,
+                      ReturnBound* bound = nullptr);
+
+  // unnormalized return of the steps of the last segment and the segments
+  // before it
+  double PartialReturn() const { return partial_return_; }
+
+  // simulate n samples with sampling policies in lockstep: every sample is
+  // advanced by one time step before any sample takes the next, so the
+  // policies, task, and model are revisited while still in cache.
+  // trajectories[i] is simulated with policies[i] on data[i], results match
+  // n calls to Rollout.
+  static void RolloutLockstep(Trajectory* const* trajectories,
+                              const SamplingPolicy* const* policies, int n,
+                              const Task* task, const mjModel* model,
+                              mjData* const* data, const double* state,
+                              double time, const double* mocap,
+                              const double* userdata, int steps,
+                              ReturnBound* bound = nullptr);
 
   void NoisyRollout(
       std::function<void(double* action, const double* state, double time)>
           policy,
       const Task* task, const mjModel* model, mjData* data, const double* state,
       double time, const double* mocap, const double* userdata, double xfrc_std,
-      double xfrc_rate, int steps);
+      double xfrc_rate, int steps, ReturnBound* bound = nullptr);
 
-  // simulate model forward in time with discrete-time indexed policy
+  // simulate model forward in time with discrete-time indexed policy. bound
+  // is used as in Rollout.
   void RolloutDiscrete(
       std::function<void(double* action, const double* state, int index)>
           policy,
       const Task* task, const mjModel* model, mjData* data, const double* state,
-      double time, const double* mocap, const double* userdata, int steps);
+      double time, const double* mocap, const double* userdata, int steps,
+      ReturnBound* bound = nullptr);
+
+  // set the horizon and compute the costs and total return of the recorded
+  // residuals and final state, e.g., of a trajectory assembled from the
+  // segments of a multiple-shooting rollout
+  void Evaluate(const Task* task, int steps);
 
   // ----- members ----- //
   int horizon;                   // trajectory length
@@ -83,13 +271,116 @@ class Trajectory {
   std::vector<double> costs;     // horizon
   std::vector<double> trace;     // (horizon   x 3)
   double total_return;           // (1)
-  bool failure;                  // true if last rollout had a warning
+  double terminal_value = 0.0;   // task terminal value of the final state
+  bool failure;                  // true if last rollout stopped early
+  bool pruned = false;           // true if last rollout stopped at bound
+  int num_steps = 0;             // mj_step calls of the last rollout
+  int num_residuals = 0;         // residual evaluations of the last rollout
+  int num_solver_iterations = 0;  // constraint solver iterations of the last
+                                  // rollout
+  RandomStream noise_stream;     // perturbation noise, seeded by owner
+  RolloutSchedule schedule;      // time steps of rollouts, set by owner
+
+  // lean continuous-time rollouts only compute the return, failure flag and
+  // final state: the states, actions, residuals, costs and traces of the
+  // steps aren't recorded. for policies that don't read the state (e.g.,
+  // sampling policies), which are passed a null state.
+  bool lean = false;
+
+  // with record_warmstart, the solver warm start before each step is recorded
+  // in warmstart (horizon x nv). steps of rollouts with a warmstart_source
+  // start the solver from its rows instead of the accelerations in data.
+  bool record_warmstart = false;
+  std::vector<double> warmstart;
+  WarmStartSource warmstart_source;
 
  private:
+  // running unnormalized return of the current rollout, tracked with a bound
+  double partial_return_ = 0.0;
+
+  // stage cost of the last residual evaluation of a lean rollout
+  double lean_cost_ = 0.0;
+
+  // normalization of the return, schedule.TotalWeight(horizon)
+  double return_weight_ = 1.0;
+
+  // set up the schedule for a rollout of horizon steps
+  void BeginSchedule();
+
+  // returns true and records the failure if the rollout stops at the state
+  // in data: simulation warnings, or if the residual is evaluated, bad
+  // residual values or a terminal state of the task
+  bool Abort(const Task* task, const mjModel* model, mjData* data,
+             bool evaluated);
+
+  // record and return the task's terminal value of the final state
+  double TerminalValue(const Task* task);
+
+  // model of step t
+  const mjModel* StepModel(const mjModel* model, int t) const {
+    int level = schedule.SolverLevel(t);
+    if (level >= 0) return schedule.solver_models[level];
+    return schedule.Scale(t) == 1 ? model : schedule.coarse_model;
+  }
+
+  // set horizon and the initial state, mocap, userdata, and time
+  void RolloutBegin(const mjModel* model, mjData* data, const double* state,
+                    double time, const double* mocap, const double* userdata,
+                    int steps);
+
+  // simulate steps [begin, end) from the state in data, policy is any
+  // callable with the signature of Policy::Action. the rollout is finished
+  // (final residual and return) if end is horizon - 1.
+  template <typename PolicyFn>
+  void RolloutLoop(const PolicyFn& policy, const Task* task,
+                   const mjModel* model, mjData* data, double xfrc_std,
+                   double xfrc_rate, int begin, int end, ReturnBound* bound);
+
+  // simulate step t from the state in data. returns false if the rollout
+  // stopped at this step (failure or pruned).
+  template <typename PolicyFn>
+  bool RolloutStep(const PolicyFn& policy, const Task* task,
+                   const mjModel* model, mjData* data, double xfrc_std,
+                   double xfrc_rate, int t, ReturnBound* bound);
+
+  // record the final action, residual, and trace, and compute the return
+  void RolloutEnd(const Task* task, const mjModel* model, mjData* data,
+                  ReturnBound* bound);
+
   // calculates total_return and costs
   void UpdateReturn(const Task* task);
+
+  // stop rollout after step t, partial_return is a lower bound on the return
+  void Prune(int t, double partial_return);
 };
 
+// rank trajectories by total return (lowest first). order[0, num_ranked)
+// holds the best indices, the rest of order[0, num_trajectory) is in
+// unspecified order. returns are gathered into the packed scratch
+// (num_trajectory) so comparisons do not stride over Trajectory objects.
+void RankTrajectories(int* order, double* returns, const Trajectory* trajectory,
+                      int num_trajectory, int num_ranked);
+
+// select the num_selected best trajectories by total return, without ranking
+// them. order[0] is the best index, the rest of order[0, num_selected) holds
+// the other selected indices in unspecified order.
+void SelectTrajectories(int* order, double* returns,
+                        const Trajectory* trajectory, int num_trajectory,
+                        int num_selected);
+
+// grow the trajectories, candidate policies and noise (nu x
+// kMaxTrajectoryHorizon per trajectory) of a sampling planner to cover
+// num_trajectory rollouts of horizon steps, under an exclusive lock of mutex.
+// storage is never shrunk: *num_allocated and *allocated_horizon hold the
+// allocated sizes. resize(num_allocated) grows the planner's other
+// per-trajectory buffers.
+void GrowSampledTrajectories(
+    const mjModel* model, const Task& task, int num_trajectory, int horizon,
+    Trajectory* trajectory, SamplingPolicy* candidate_policy,
+    std::vector<double>* noise, int* num_allocated, int* allocated_horizon,
+    std::shared_mutex& mutex,
+    absl::FunctionRef<void(int)> resize = [](int) {});
+
 }  // namespace mjpc
 
 #endif  // MJPC_TRAJECTORY_H_
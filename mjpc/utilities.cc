@@ -14,6 +14,7 @@
 
 #include "mjpc/utilities.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cmath>
 #include <cstdint>
@@ -35,6 +36,7 @@
 #include <mujoco/mujoco.h>
 
 #include "mjpc/array_safety.h"
+#include "mjpc/policy_export.h"
 
 #if defined(__APPLE__) || defined(_WIN32)
 #include <thread>
@@ -218,10 +220,16 @@ int CostTermByName(const mjModel* m, const std::string& name) {
   }
 }
 
+bool SkippedSensor(const mjModel* model, int id) {
+  return model->sensor_type[id] == mjSENS_USER &&
+         model->sensor_needstage[id] == mjSTAGE_NONE;
+}
+
 void CheckSensorDim(const mjModel* model, int residual_size) {
   int user_sensor_dim = 0;
   bool encountered_nonuser_sensor = false;
   for (int i = 0; i < model->nsensor; i++) {
+    if (SkippedSensor(model, i)) continue;
     if (model->sensor_type[i] == mjSENS_USER) {
       user_sensor_dim += model->sensor_dim[i];
       if (encountered_nonuser_sensor) {
@@ -259,6 +267,15 @@ void GetTraces(double* traces, const mjModel* m, const mjData* d,
   }
 }
 
+void GetTraces(double* traces, const mjData* d,
+               const std::vector<int>& sensor_adr) {
+  for (int i = 0; i < static_cast<int>(sensor_adr.size()); i++) {
+    if (sensor_adr[i] != -1) {
+      mju_copy3(traces + 3 * i, d->sensordata + sensor_adr[i]);
+    }
+  }
+}
+
 // get keyframe `qpos` data using string
 double* KeyQPosByName(const mjModel* m, const mjData* d,
                       const std::string& name) {
@@ -441,6 +458,119 @@ void CubicInterpolation(double* output, double x, const std::vector<double>& xs,
   }
 }
 
+namespace {
+template <typename T>
+void KnotSlopesOf(double* slopes, const std::vector<double>& xs, const T* ys,
+                  int dim, int length, int k) {
+  // the branches of FiniteDifferenceSlope for x = xs[k]
+  if (length < 2 || (k == length - 1 && length == 2)) {
+    mju_zero(slopes, dim);
+  } else if (k == length - 1) {
+    for (int i = 0; i < dim; i++) {
+      slopes[i] = (ys[dim * k + i] - ys[dim * (k - 1) + i]) /
+                  (xs[k] - xs[k - 1]);
+    }
+  } else if (k == 0) {
+    for (int i = 0; i < dim; i++) {
+      slopes[i] = (ys[dim * (k + 1) + i] - ys[dim * k + i]) /
+                  (xs[k + 1] - xs[k]);
+    }
+  } else {
+    for (int i = 0; i < dim; i++) {
+      slopes[i] = 0.5 * (ys[dim * (k + 1) + i] - ys[dim * k + i]) /
+                      (xs[k + 1] - xs[k]) +
+                  0.5 * (ys[dim * k + i] - ys[dim * (k - 1) + i]) /
+                      (xs[k] - xs[k - 1]);
+    }
+  }
+}
+}  // namespace
+
+void KnotSlopes(double* slopes, const std::vector<double>& xs,
+                const double* ys, int dim, int length, int k) {
+  KnotSlopesOf(slopes, xs, ys, dim, length, k);
+}
+
+void KnotSlopes(double* slopes, const std::vector<double>& xs,
+                const float* ys, int dim, int length, int k) {
+  KnotSlopesOf(slopes, xs, ys, dim, length, k);
+}
+
+// slopes of the dim values at length knots
+void CubicSpline::Compute(const std::vector<double>& xs, const double* ys,
+                          int dim, int length) {
+  xs_ = &xs;
+  ys_ = ys;
+  dim_ = dim;
+  length_ = length;
+  if (slopes_.size() < static_cast<size_t>(length * dim)) {
+    slopes_.resize(length * dim);
+  }
+  for (int k = 0; k < length; k++) {
+    KnotSlopes(slopes_.data() + k * dim, xs, ys, dim, length, k);
+  }
+}
+
+// spline at x, as CubicInterpolation
+void CubicSpline::Interpolate(double* output, double x) const {
+  const std::vector<double>& xs = *xs_;
+
+  // find interval
+  int bounds[2];
+  FindInterval(bounds, xs, x, length_);
+
+  // bound
+  if (bounds[0] == bounds[1]) {
+    mju_copy(output, ys_ + dim_ * bounds[0], dim_);
+    return;
+  }
+
+  // coefficients, as in CubicCoefficients
+  double dx = xs[bounds[1]] - xs[bounds[0]];
+  double t = (x - xs[bounds[0]]) / dx;
+  double c0 = 2.0 * t * t * t - 3.0 * t * t + 1.0;
+  double c1 = (t * t * t - 2.0 * t * t + t) * dx;
+  double c2 = -2.0 * t * t * t + 3 * t * t;
+  double c3 = (t * t * t - t * t) * dx;
+
+  // points and slopes
+  const double* p0 = ys_ + bounds[0] * dim_;
+  const double* p1 = ys_ + bounds[1] * dim_;
+  const double* m0 = Slopes(bounds[0]);
+  const double* m1 = Slopes(bounds[1]);
+  for (int i = 0; i < dim_; i++) {
+    output[i] = c0 * p0[i] + c1 * m0[i] + c2 * p1[i] + c3 * m1[i];
+  }
+}
+
+namespace {
+// dot product with independent partial sums, which compilers vectorize
+double UnrolledDot(const double* a, const double* b, int n) {
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for (; i < n; i++) s0 += a[i] * b[i];
+  return (s0 + s1) + (s2 + s3);
+}
+}  // namespace
+
+void MulMatVecSum(double* res, const double* const* mats,
+                  const double* weights, int num, const double* vec, int rows,
+                  int cols) {
+  for (int r = 0; r < rows; r++) {
+    double sum = 0.0;
+    for (int i = 0; i < num; i++) {
+      sum += weights[i] * UnrolledDot(mats[i] + r * cols, vec, cols);
+    }
+    res[r] = sum;
+  }
+}
+
 // returns the path to the directory containing the current executable
 std::string GetExecutableDir() {
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -572,6 +702,21 @@ void StateDiff(const mjModel* m, mjtNum* ds, const mjtNum* s1, const mjtNum* s2,
   }
 }
 
+void SetExportedModel(ExportedPolicy& policy, const mjModel* m) {
+  policy.dim_action = m->nu;
+  policy.nq = m->nq;
+  policy.nv = m->nv;
+  policy.na = m->na;
+  policy.ctrlrange.assign(m->actuator_ctrlrange,
+                          m->actuator_ctrlrange + 2 * m->nu);
+  policy.joints.resize(3 * m->njnt);
+  for (int i = 0; i < m->njnt; i++) {
+    policy.joints[3 * i] = m->jnt_type[i];
+    policy.joints[3 * i + 1] = m->jnt_qposadr[i];
+    policy.joints[3 * i + 2] = m->jnt_dofadr[i];
+  }
+}
+
 // return global height of nearest group 0 geom under given position
 mjtNum Ground(const mjModel* model, const mjData* data, const mjtNum pos[3],
               const mjtByte* geomgroup) {
@@ -836,6 +981,16 @@ bool CheckWarnings(mjData* data) {
   return warnings_found;
 }
 
+// constraint solver iterations of the last step
+int SolverIterations(const mjData* data) {
+  int iterations = 0;
+  int nisland = mjMIN(mjMAX(data->solver_nisland, 1), mjNISLAND);
+  for (int i = 0; i < nisland; i++) {
+    iterations += data->solver_niter[i];
+  }
+  return iterations;
+}
+
 // compute vector with log-based scaling between min and max values
 void LogScale(double* values, double max_value, double min_value, int steps) {
   double step =
@@ -1151,12 +1306,9 @@ void FiniteDifferenceHessian::Compute(
 // and left column indices (ri, ci)
 void SetBlockInMatrix(double* mat, const double* block, double scale, int rm,
                       int cm, int rb, int cb, int ri, int ci) {
-  // loop over block rows
+  // loop over block rows, scale contiguous row segments
   for (int i = 0; i < rb; i++) {
-    // loop over block columns
-    for (int j = 0; j < cb; j++) {
-      mat[(ri + i) * cm + ci + j] = scale * block[i * cb + j];
-    }
+    mju_scl(mat + (ri + i) * cm + ci, block + i * cb, scale, cb);
   }
 }
 
@@ -1164,12 +1316,9 @@ void SetBlockInMatrix(double* mat, const double* block, double scale, int rm,
 // and left column indices (ri, ci)
 void AddBlockInMatrix(double* mat, const double* block, double scale, int rm,
                       int cm, int rb, int cb, int ri, int ci) {
-  // loop over block rows
+  // loop over block rows, add contiguous row segments
   for (int i = 0; i < rb; i++) {
-    // loop over block columns
-    for (int j = 0; j < cb; j++) {
-      mat[(ri + i) * cm + ci + j] += scale * block[i * cb + j];
-    }
+    mju_addToScl(mat + (ri + i) * cm + ci, block + i * cb, scale, cb);
   }
 }
 
@@ -1331,31 +1480,31 @@ void SymmetricBandMatrixCopy(double* res, const double* mat, int dblock,
   // check for no blocks to copy
   if (num_blocks == 0) return;
 
-  // tmp: block from mat
-  double* tmp1 = scratch;
-  double* tmp2 = scratch + dblock * dblock;
+  // blocks are added in place, scratch is unused
+  (void)scratch;
 
   // loop over upper band
   for (int i = 0; i < num_blocks; i++) {
     // number of columns to loop over for row
     int num_cols = mju_min(nblock, num_blocks - i);
 
-    for (int j = i; j < i + num_cols; j++) {
-      // get block from A
-      BlockFromMatrix(tmp1, mat, dblock, dblock, ntotal, ntotal,
-                      (i + mat_start_row) * dblock,
-                      (j + mat_start_col) * dblock);
-
-      // set block in matrix
-      AddBlockInMatrix(res, tmp1, 1.0, ntotal, ntotal, dblock, dblock,
-                       (i + res_start_row) * dblock,
-                       (j + res_start_col) * dblock);
-
-      if (j > i) {
-        mju_transpose(tmp2, tmp1, dblock, dblock);
-        AddBlockInMatrix(res, tmp2, 1.0, ntotal, ntotal, dblock, dblock,
-                         (j + res_start_col) * dblock,
-                         (i + res_start_row) * dblock);
+    // the block row's upper band is contiguous in each matrix row
+    for (int r = 0; r < dblock; r++) {
+      const double* mat_row = mat +
+                              ((i + mat_start_row) * dblock + r) * ntotal +
+                              (i + mat_start_col) * dblock;
+      double* res_row = res + ((i + res_start_row) * dblock + r) * ntotal +
+                        (i + res_start_col) * dblock;
+      mju_addTo(res_row, mat_row, num_cols * dblock);
+
+      // transposed off-diagonal blocks, row r of mat is column r of res
+      for (int j = i + 1; j < i + num_cols; j++) {
+        int mat_col = (j - i) * dblock;
+        double* res_col = res + (j + res_start_col) * dblock * ntotal +
+                          (i + res_start_row) * dblock + r;
+        for (int c = 0; c < dblock; c++) {
+          res_col[c * ntotal] += mat_row[mat_col + c];
+        }
       }
     }
   }
@@ -1365,12 +1514,9 @@ void SymmetricBandMatrixCopy(double* res, const double* mat, int dblock,
 // and left column indices (ri, ci)
 void ZeroBlockInMatrix(double* mat, int rm, int cm, int rb, int cb, int ri,
                        int ci) {
-  // loop over block rows
+  // loop over block rows, zero contiguous row segments
   for (int i = 0; i < rb; i++) {
-    // loop over block columns
-    for (int j = 0; j < cb; j++) {
-      mat[(ri + i) * cm + ci + j] = 0.0;
-    }
+    mju_zero(mat + (ri + i) * cm + ci, cb);
   }
 }
 
@@ -1379,13 +1525,16 @@ void DenseToBlockBand(double* res, int dim, int dblock, int nblock) {
   // number of block rows / columns
   int num_blocks = dim / dblock;
 
-  // zero off-band blocks
+  int nblocked = num_blocks * dblock;
+
+  // zero off-band blocks, contiguous in the rows of each block row: columns
+  // left of block i - nblock + 1 and right of block i + nblock - 1
   for (int i = 0; i < num_blocks; i++) {
-    for (int j = i + nblock; j < num_blocks; j++) {
-      ZeroBlockInMatrix(res, dim, dim, dblock, dblock, i * dblock, j * dblock);
-      if (j > i)
-        ZeroBlockInMatrix(res, dim, dim, dblock, dblock, j * dblock,
-                          i * dblock);
+    int left = mju_max(i - nblock + 1, 0) * dblock;
+    int right = mju_min(i + nblock, num_blocks) * dblock;
+    for (int r = i * dblock; r < (i + 1) * dblock; r++) {
+      mju_zero(res + r * dim, left);
+      mju_zero(res + r * dim + right, nblocked - right);
     }
   }
 }
@@ -1403,6 +1552,58 @@ double Trace(const double* mat, int n) {
   return trace;
 }
 
+// copy lower triangle to upper triangle
+void MirrorLower(double* mat, int n) {
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < i; j++) {
+      mat[j * n + i] = mat[i * n + j];
+    }
+  }
+}
+
+// res = mat * sym * mat', lower triangle mirrored
+void SymmetricTransform(double* res, const double* mat, const double* sym,
+                        double* scratch, int n) {
+  // scratch = mat * sym
+  mju_mulMatMat(scratch, mat, sym, n, n, n);
+
+  // res = scratch * mat', lower triangle
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j <= i; j++) {
+      res[i * n + j] = mju_dot(scratch + i * n, mat + j * n, n);
+    }
+  }
+  MirrorLower(res, n);
+}
+
+// lower triangle of res -= mat' * mat
+void SubLowerGram(double* res, const double* mat, int k, int n) {
+  for (int r = 0; r < k; r++) {
+    const double* row = mat + r * n;
+    for (int i = 0; i < n; i++) {
+      double a = row[i];
+      if (a == 0.0) continue;
+      double* res_row = res + i * n;
+      for (int j = 0; j <= i; j++) {
+        res_row[j] -= a * row[j];
+      }
+    }
+  }
+}
+
+// solve L * res = mat by rows of mat
+void CholForwardSubstitution(double* res, const double* factor,
+                             const double* mat, int k, int n) {
+  if (res != mat) mju_copy(res, mat, k * n);
+  for (int i = 0; i < k; i++) {
+    double* row = res + i * n;
+    for (int j = 0; j < i; j++) {
+      mju_addToScl(row, res + j * n, -factor[i * k + j], n);
+    }
+    mju_scl(row, row, 1.0 / factor[i * k + i], n);
+  }
+}
+
 // determinant of 3x3 matrix
 double Determinant3(const double* mat) {
   // unpack
@@ -1491,6 +1692,182 @@ void ConditionMatrix(double* res, const double* mat, double* mat00,
   mju_sub(res, mat11, tmp1, n1 * n1);
 }
 
+// condition band matrix on its leading block
+void ConditionBand(double* res, const double* band, double* mat, double* mat00,
+                   double* mat10, double* mat11, double* tmp0, double* tmp1,
+                   int nband, int n0, int n1) {
+  // symmetric band element (r, j), j <= r
+  auto element = [band, nband](int r, int j) {
+    return band[r * nband + nband - 1 - (r - j)];
+  };
+
+  // res = mat11
+  mju_zero(res, n1 * n1);
+  for (int i = 0; i < n1; i++) {
+    int r = n0 + i;
+    for (int j = std::max(n0, r - nband + 1); j <= r; j++) {
+      res[i * n1 + j - n0] = res[(j - n0) * n1 + i] = element(r, j);
+    }
+  }
+
+  // rows of mat11 coupled to mat00
+  int k = std::min(nband - 1, n1);
+  if (k <= 0) return;
+
+  // dense leading block
+  int m = n0 + k;
+  mju_zero(mat, m * m);
+  for (int r = 0; r < m; r++) {
+    for (int j = std::max(0, r - nband + 1); j <= r; j++) {
+      mat[r * m + j] = mat[j * m + r] = element(r, j);
+    }
+  }
+
+  // Schur complement of the coupled rows
+  ConditionMatrix(tmp1, mat, mat00, mat10, mat11, tmp0, tmp1, m, n0, k);
+  SetBlockInMatrix(res, tmp1, 1.0, n1, n1, k, k, 0, 0);
+}
+
+// condition band matrix on its leading block, result in band storage
+void ConditionBandToBand(double* res, const double* band, double* mat,
+                         double* mat00, double* mat10, double* mat11,
+                         double* tmp0, double* tmp1, int nband, int n0,
+                         int n1) {
+  // res = mat11: band rows after n0, without their columns before n0
+  mju_copy(res, band + n0 * nband, n1 * nband);
+  int k = std::min(nband - 1, n1);
+  for (int i = 0; i < k; i++) {
+    mju_zero(res + i * nband, nband - 1 - i);
+  }
+  if (k <= 0) return;
+
+  // dense leading block
+  int m = n0 + k;
+  mju_zero(mat, m * m);
+  for (int r = 0; r < m; r++) {
+    for (int j = std::max(0, r - nband + 1); j <= r; j++) {
+      mat[r * m + j] = mat[j * m + r] = band[r * nband + nband - 1 - (r - j)];
+    }
+  }
+
+  // Schur complement of the coupled rows, lower triangle in band
+  ConditionMatrix(tmp1, mat, mat00, mat10, mat11, tmp0, tmp1, m, n0, k);
+  for (int r = 0; r < k; r++) {
+    for (int j = 0; j <= r; j++) {
+      res[r * nband + nband - 1 - (r - j)] = tmp1[r * k + j];
+    }
+  }
+}
+
+// zero band entries outside the block band
+void BandToBlockBand(double* band, int n, int nband, int dblock, int nblock) {
+  for (int r = 0; r < n; r++) {
+    for (int j = std::max(0, r - nband + 1); j <= r; j++) {
+      if (r / dblock - j / dblock >= nblock) {
+        band[r * nband + nband - 1 - (r - j)] = 0.0;
+      }
+    }
+  }
+}
+
+// get block from symmetric band matrix
+void BlockFromBand(double* block, const double* band, int nband, int rb,
+                   int cb, int ri, int ci) {
+  for (int i = 0; i < rb; i++) {
+    for (int j = 0; j < cb; j++) {
+      int r = std::max(ri + i, ci + j);
+      int c = std::min(ri + i, ci + j);
+      block[i * cb + j] =
+          r - c < nband ? band[r * nband + nband - 1 - (r - c)] : 0.0;
+    }
+  }
+}
+
+// band forward substitution
+void BandForwardSubstitution(double* res, const double* factor,
+                             const double* vec, int n, int nband) {
+  for (int j = 0; j < n; j++) {
+    int width = std::min(j, nband - 1);
+    const double* lj = factor + (j + 1) * nband - 1;
+    res[j] = (vec[j] - mju_dot(lj - width, res + j - width, width)) / lj[0];
+  }
+}
+
+// band backward substitution
+void BandBackwardSubstitution(double* res, const double* factor,
+                              const double* vec, int n, int nband) {
+  if (res != vec) mju_copy(res, vec, n);
+  for (int j = n - 1; j >= 0; j--) {
+    res[j] /= factor[(j + 1) * nband - 1];
+    int width = std::min(j, nband - 1);
+    mju_addToScl(res + j - width, factor + (j + 1) * nband - 1 - width,
+                 -res[j], width);
+  }
+}
+
+// factorize band-arrowhead matrix
+double CholFactorArrowhead(double* mat, double* schur, int ntotal, int nband,
+                           int ndense, double diagadd, double diagmul) {
+  // band part
+  int n = ntotal - ndense;
+  double min_diag = mju_cholFactorBand(mat, n, nband, 0, diagadd, diagmul);
+  if (min_diag <= 0.0) return 0.0;
+
+  // W = B * L^-T, row-wise forward substitution
+  double* dense = mat + n * nband;
+  for (int i = 0; i < ndense; i++) {
+    double* w = dense + i * ntotal;
+    BandForwardSubstitution(w, mat, w, n, nband);
+  }
+
+  // Schur complement: C - W * W'
+  for (int i = 0; i < ndense; i++) {
+    const double* wi = dense + i * ntotal;
+    for (int j = 0; j <= i; j++) {
+      const double* wj = dense + j * ntotal;
+      double cij = wi[n + j];
+      if (i == j) cij += diagadd + diagmul * cij;
+      schur[i * ndense + ndense - 1 - (i - j)] = cij - mju_dot(wi, wj, n);
+    }
+  }
+
+  // factorize Schur complement
+  if (ndense > 0) {
+    double min_schur = mju_cholFactorBand(schur, ndense, ndense, 0, 0.0, 0.0);
+    if (min_schur <= 0.0) return 0.0;
+    min_diag = std::min(min_diag, min_schur);
+  }
+
+  return min_diag;
+}
+
+// solve with band-arrowhead factors
+void CholSolveArrowhead(double* res, const double* mat, const double* schur,
+                        const double* vec, double* scratch, int ntotal,
+                        int nband, int ndense) {
+  int n = ntotal - ndense;
+  const double* dense = mat + n * nband;
+
+  // z = L \ vec[0:n]
+  BandForwardSubstitution(res, mat, vec, n, nband);
+
+  // res[n:] = S \ (vec[n:] - W * z)
+  for (int i = 0; i < ndense; i++) {
+    scratch[i] = vec[n + i] - mju_dot(dense + i * ntotal, res, n);
+  }
+  if (ndense > 0) {
+    mju_cholSolveBand(res + n, schur, scratch, ndense, ndense, 0);
+  }
+
+  // z -= W' * res[n:]
+  for (int i = 0; i < ndense; i++) {
+    mju_addToScl(res, dense + i * ntotal, -res[n + i], n);
+  }
+
+  // res[0:n] = L' \ z
+  BandBackwardSubstitution(res, mat, res, n, nband);
+}
+
 // principal eigenvector of 4x4 matrix
 // QUEST algorithm from "Three-Axis Attitude Determination from Vector
 // Observations"
@@ -27,6 +27,7 @@
 
 #include <absl/container/flat_hash_map.h>
 #include <mujoco/mujoco.h>
+#include "mjpc/policy_export.h"
 
 namespace mjpc {
 
@@ -100,13 +101,22 @@ int ParameterIndex(const mjModel* model, std::string_view name);
 
 int CostTermByName(const mjModel* m, const std::string& name);
 
-// sanity check that residual size equals total user-sensor dimension
+// user sensor that MuJoCo never computes (needstage mjSTAGE_NONE), e.g., a
+// planning model's sensor that no residual or trace reads. not a cost term.
+bool SkippedSensor(const mjModel* model, int id);
+
+// sanity check that residual size equals total user-sensor dimension,
+// skipped sensors excluded
 void CheckSensorDim(const mjModel* model, int residual_size);
 
 // get traces from sensors
 void GetTraces(double* traces, const mjModel* m, const mjData* d,
                int num_trace);
 
+// get traces from the sensordata addresses of the trace sensors (-1: skip)
+void GetTraces(double* traces, const mjData* d,
+               const std::vector<int>& sensor_adr);
+
 // get keyframe `qpos` data using string
 double* KeyQPosByName(const mjModel* m, const mjData* d,
                       const std::string& name);
@@ -147,6 +157,44 @@ double FiniteDifferenceSlope(double x, const std::vector<double>& xs,
 void CubicInterpolation(double* output, double x, const std::vector<double>& xs,
                         const double* ys, int dim, int length);
 
+// slopes of the dim values of ys at knot k, like FiniteDifferenceSlope at
+// xs[k] for each value
+void KnotSlopes(double* slopes, const std::vector<double>& xs,
+                const double* ys, int dim, int length, int k);
+void KnotSlopes(double* slopes, const std::vector<double>& xs,
+                const float* ys, int dim, int length, int k);
+
+// cubic spline through the knots (xs, ys) of CubicInterpolation. the slopes
+// at all knots are computed once by Compute, so that an evaluation is an
+// interval search and O(dim) work. xs and ys are referenced, not copied, and
+// must not change between Compute and Interpolate.
+class CubicSpline {
+ public:
+  // slopes of the dim values at length knots
+  void Compute(const std::vector<double>& xs, const double* ys, int dim,
+               int length);
+
+  // spline at x, as CubicInterpolation
+  void Interpolate(double* output, double x) const;
+
+  // slopes (dim) at knot k
+  const double* Slopes(int k) const { return slopes_.data() + k * dim_; }
+
+ private:
+  const std::vector<double>* xs_ = nullptr;
+  const double* ys_ = nullptr;
+  int dim_ = 0;
+  int length_ = 0;
+  std::vector<double> slopes_;  // length x dim
+};
+
+// res = sum_i weights[i] * mats[i] * vec for num (rows x cols) matrices,
+// e.g., an interpolated gain times a state error without forming the gain.
+// the dot products are unrolled for vectorization.
+void MulMatVecSum(double* res, const double* const* mats,
+                  const double* weights, int num, const double* vec, int rows,
+                  int cols);
+
 // returns the path to the directory containing the current executable
 std::string GetExecutableDir();
 
@@ -160,6 +208,10 @@ void Diff(mjtNum* dx, const mjtNum* x1, const mjtNum* x2, mjtNum h, int n);
 void StateDiff(const mjModel* m, mjtNum* ds, const mjtNum* s1, const mjtNum* s2,
                mjtNum h);
 
+// set the action and state dimensions, control range and joints of an
+// exported policy from the model
+void SetExportedModel(ExportedPolicy& policy, const mjModel* m);
+
 // return global height of nearest geom in geomgroup under given position
 mjtNum Ground(const mjModel* model, const mjData* data, const mjtNum pos[3],
              const mjtByte* geomgroup = nullptr);
@@ -213,6 +265,9 @@ int NumAvailableHardwareThreads();
 // check mjData for warnings, return true if any warnings
 bool CheckWarnings(mjData* data);
 
+// constraint solver iterations of the last step, summed over islands
+int SolverIterations(const mjData* data);
+
 // compute vector with log-based scaling between min and max values
 void LogScale(double* values, double max_value, double min_value, int steps);
 
@@ -384,6 +439,24 @@ T InfinityNorm(T* x, int n) {
 // trace of square matrix
 double Trace(const double* mat, int n);
 
+// copy the lower triangle of square matrix (n x n) to its upper triangle
+void MirrorLower(double* mat, int n);
+
+// res = mat * sym * mat', sym: symmetric n x n. only the lower triangle of
+// the product is computed and then mirrored. scratch: n x n. res can alias
+// sym.
+void SymmetricTransform(double* res, const double* mat, const double* sym,
+                        double* scratch, int n);
+
+// lower triangle of res (n x n) -= mat' * mat, mat: k x n. the upper
+// triangle is unchanged.
+void SubLowerGram(double* res, const double* mat, int k, int n);
+
+// solve L * res = mat, L: k x k Cholesky factor from mju_cholFactor, mat:
+// k x n. res and mat can alias.
+void CholForwardSubstitution(double* res, const double* factor,
+                             const double* mat, int k, int n);
+
 // determinant of 3x3 matrix
 double Determinant3(const double* mat);
 
@@ -397,6 +470,60 @@ void ConditionMatrix(double* res, const double* mat, double* mat00,
                      int n, int n0, int n1, double* bandfactor = NULL,
                      int nband = 0);
 
+// condition band matrix (band storage with nband diagonals, rows after
+// n0 + n1 are ignored): res = mat11 - mat10 * mat00 \ mat10^T. only the
+// first nband - 1 rows of mat11 couple to mat00, so the Schur complement is
+// formed on the leading (n0 + nband - 1) block (dense scratch mat) and the
+// rest of res is copied from the band. scratch as in ConditionMatrix for the
+// leading block.
+void ConditionBand(double* res, const double* band, double* mat, double* mat00,
+                   double* mat10, double* mat11, double* tmp0, double* tmp1,
+                   int nband, int n0, int n1);
+
+// condition band matrix as in ConditionBand, with res (n1 x n1) in band
+// storage with nband diagonals: the band rows after n0, with the leading
+// (nband - 1) block replaced by the Schur complement. scratch as in
+// ConditionBand for the leading block, no n1 x n1 memory.
+void ConditionBandToBand(double* res, const double* band, double* mat,
+                         double* mat00, double* mat10, double* mat11,
+                         double* tmp0, double* tmp1, int nband, int n0,
+                         int n1);
+
+// zero the entries of band matrix (n x n, band storage with nband diagonals)
+// outside the block band, as DenseToBlockBand for dense matrices
+void BandToBlockBand(double* band, int n, int nband, int dblock, int nblock);
+
+// get block (size: rb x cb) from symmetric band matrix (band storage with
+// nband diagonals) given upper row and left column indices (ri, ci). entries
+// outside the band are zero.
+void BlockFromBand(double* block, const double* band, int nband, int rb,
+                   int cb, int ri, int ci);
+
+// solve L * res = vec, L: n x n band Cholesky factor from mju_cholFactorBand
+// (no dense rows). res and vec can alias.
+void BandForwardSubstitution(double* res, const double* factor,
+                             const double* vec, int n, int nband);
+
+// solve L' * res = vec, L as in BandForwardSubstitution. res and vec can
+// alias.
+void BandBackwardSubstitution(double* res, const double* factor,
+                              const double* vec, int n, int nband);
+
+// factorize band-arrowhead matrix [A B'; B C] in band-dense storage, A: n x n
+// band (n = ntotal - ndense), [B C]: ndense dense rows. the band part is
+// factorized in place (A = L * L'), the B rows are overwritten with
+// W = B * L^-T and the Schur complement C - W * W' is factorized into schur
+// (ndense x ndense band storage with nband = ndense). diagadd/diagmul as in
+// mju_cholFactorBand. returns minimum factor diagonal, 0 if not positive
+// definite.
+double CholFactorArrowhead(double* mat, double* schur, int ntotal, int nband,
+                           int ndense, double diagadd, double diagmul);
+
+// solve mat * res = vec with CholFactorArrowhead factors, scratch: ndense
+void CholSolveArrowhead(double* res, const double* mat, const double* schur,
+                        const double* vec, double* scratch, int ntotal,
+                        int nband, int ndense);
+
 // principal eigenvector of 4x4 matrix
 // QUEST algorithm from "Three-Axis Attitude Determination from Vector
 // Observations"
@@ -17,16 +17,19 @@
 
 import atexit
 import contextlib
+from multiprocessing import resource_tracker
+from multiprocessing import shared_memory as mp_shared_memory
 import pathlib
 import re
 import socket
 import subprocess
 import tempfile
-from typing import Any, Literal, Mapping, Optional, Sequence
+from typing import Any, Iterable, Iterator, Literal, Mapping, Optional, Sequence
 
 import grpc
 import mujoco
 from mujoco_mpc import mjpc_parameters
+from mujoco_mpc import policy as policy_lib
 import numpy as np
 from numpy import typing as npt
 
@@ -65,6 +68,260 @@ def parse_port(server_addr: str) -> int:
   return int(match.group(1))
 
 
+def start_server(
+    port: int,
+    server_binary_path: Optional[str] = None,
+    extra_flags: Sequence[str] = (),
+    subprocess_kwargs: Optional[Mapping[str, Any]] = None,
+) -> subprocess.Popen:
+  """Start an agent server process listening on port, killed at exit."""
+  if server_binary_path is None:
+    binary_name = "agent_server"
+    server_binary_path = pathlib.Path(__file__).parent / "mjpc" / binary_name
+  server_process = subprocess.Popen(
+      [str(server_binary_path), f"--mjpc_port={port}"] + list(extra_flags),
+      **(subprocess_kwargs or {}),
+  )
+  atexit.register(server_process.kill)
+  return server_process
+
+
+def init_request(
+    task_id: str,
+    model: Optional[mujoco.MjModel] = None,
+    send_as: Literal["mjb", "xml"] = "xml",
+    real_time_speed: float = 1.0,
+    shared_memory: bool = False,
+) -> agent_pb2.InitRequest:
+  """InitRequest of `Agent.init`."""
+
+  def model_to_mjb(model: mujoco.MjModel) -> bytes:
+    buffer_size = mujoco.mj_sizeModel(model)
+    buffer = np.empty(shape=buffer_size, dtype=np.uint8)
+    mujoco.mj_saveModel(model, None, buffer)
+    return buffer.tobytes()
+
+  def model_to_xml(model: mujoco.MjModel) -> str:
+    tmp = tempfile.NamedTemporaryFile()
+    mujoco.mj_saveLastXML(tmp.name, model)
+    with pathlib.Path(tmp.name).open("rt") as f:
+      xml_string = f.read()
+    return xml_string
+
+  if model is not None:
+    if send_as == "mjb":
+      model_message = agent_pb2.MjModel(mjb=model_to_mjb(model))
+    else:
+      model_message = agent_pb2.MjModel(xml=model_to_xml(model))
+  else:
+    model_message = None
+
+  return agent_pb2.InitRequest(
+      task_id=task_id,
+      model=model_message,
+      real_time_speed=real_time_speed,
+      shared_memory=shared_memory,
+  )
+
+
+def set_state_request(
+    time: Optional[float] = None,
+    qpos: Optional[npt.ArrayLike] = None,
+    qvel: Optional[npt.ArrayLike] = None,
+    act: Optional[npt.ArrayLike] = None,
+    mocap_pos: Optional[npt.ArrayLike] = None,
+    mocap_quat: Optional[npt.ArrayLike] = None,
+    userdata: Optional[npt.ArrayLike] = None,
+) -> agent_pb2.SetStateRequest:
+  """SetStateRequest of `Agent.set_state`, without shared memory."""
+  # if mocap_pos is an ndarray rather than a list, flatten it
+  if hasattr(mocap_pos, "flatten"):
+    mocap_pos = mocap_pos.flatten()
+  if hasattr(mocap_quat, "flatten"):
+    mocap_quat = mocap_quat.flatten()
+
+  state = agent_pb2.State(
+      time=time if time is not None else None,
+      qpos=qpos if qpos is not None else [],
+      qvel=qvel if qvel is not None else [],
+      act=act if act is not None else [],
+      mocap_pos=mocap_pos if mocap_pos is not None else [],
+      mocap_quat=mocap_quat if mocap_quat is not None else [],
+      userdata=userdata if userdata is not None else [],
+  )
+  return agent_pb2.SetStateRequest(state=state)
+
+
+class TrajectoryDecoder:
+  """Requests and decodes GetBestTrajectory responses of one agent.
+
+  Keeps the last trajectory as the base of delta-encoded responses.
+  """
+
+  def __init__(self):
+    self._base = None
+
+  def request(
+      self,
+      float32: bool = False,
+      stride: int = 1,
+      state_components: Optional[Sequence[str]] = None,
+      delta: bool = False,
+      compress: bool = False,
+  ) -> agent_pb2.GetBestTrajectoryRequest:
+    """Request of `Agent.best_trajectory`."""
+    request = agent_pb2.GetBestTrajectoryRequest(
+        float32=float32,
+        stride=stride,
+        state_components=state_components or [],
+        compress=compress,
+    )
+    if delta and self._base is not None:
+      request.delta_base = self._base[0]
+    return request
+
+  def decode(
+      self,
+      response: agent_pb2.GetBestTrajectoryResponse,
+      nu: int,
+      float32: bool = False,
+  ) -> dict[str, np.ndarray]:
+    """Returns the "states", "actions" and "times" of a response."""
+    # differences are added in double precision, as on the server
+    if float32:
+      states = np.array(response.states_float, dtype=np.float64)
+      actions = np.array(response.actions_float, dtype=np.float64)
+    else:
+      states = np.array(response.states)
+      actions = np.array(response.actions)
+    if response.delta:
+      states += self._base[1]
+      actions += self._base[2]
+    self._base = (response.sequence, states, actions)
+
+    return {
+        "states": states.reshape(response.steps, response.state_dim),
+        "actions": actions.reshape(-1, nu),
+        "times": np.array(response.times),
+    }
+
+
+class SceneDecoder:
+  """Decodes the frames of a StreamScene stream.
+
+  Keeps the values of the last frame as the base of delta-encoded frames, and
+  the last policy trace.
+  """
+
+  def __init__(self, float32: bool = False):
+    self._float32 = float32
+    self._values = None
+    self._nq = 0
+    self._nmocap = 0
+    self._trace = None
+
+  def decode(self, frame: agent_pb2.SceneFrame) -> dict[str, Any]:
+    """Returns the "time", "qpos", "mocap_pos", "mocap_quat" and "trace"."""
+    # differences are added in double precision, as on the server
+    if self._float32:
+      values = np.array(frame.values_float, dtype=np.float64)
+    else:
+      values = np.array(frame.values)
+    if frame.delta:
+      values += self._values
+    else:
+      self._nq, self._nmocap = frame.nq, frame.nmocap
+    self._values = values
+    if frame.trace_updated:
+      self._trace = np.array(frame.trace).reshape(-1, frame.num_trace, 3)
+
+    nq, nmocap = self._nq, self._nmocap
+    return {
+        "time": frame.time,
+        "qpos": values[:nq],
+        "mocap_pos": values[nq : nq + 3 * nmocap].reshape(nmocap, 3),
+        "mocap_quat": values[nq + 3 * nmocap :].reshape(nmocap, 4),
+        "trace": self._trace,
+    }
+
+
+# state slot fields of the shared-memory segment, in order. bit i of the header
+# field mask marks field i as set.
+_SHARED_STATE_FIELDS = (
+    "time",
+    "qpos",
+    "qvel",
+    "act",
+    "mocap_pos",
+    "mocap_quat",
+    "userdata",
+)
+
+
+class _SharedMemory:
+  """Client side of the agent's shared-memory state and action exchange.
+
+  The layout is documented on `InitResponse` in agent.proto.
+  """
+
+  def __init__(self, name: str):
+    self._segment = mp_shared_memory.SharedMemory(name=name)
+    # the server owns and unlinks the segment
+    # pylint: disable-next=protected-access
+    resource_tracker.unregister(self._segment._name, "shared_memory")
+    buffer = self._segment.buf
+
+    # header: sequences, field mask, dimensions
+    self._header = np.ndarray((3,), dtype=np.uint64, buffer=buffer)
+    nq, nv, na, nmocap, nuserdata, nu = np.ndarray(
+        (6,), dtype=np.int32, buffer=buffer, offset=24
+    ).tolist()
+
+    # state slot views
+    sizes = (1, nq, nv, na, 3 * nmocap, 4 * nmocap, nuserdata)
+    offset = 64
+    self._state = {}
+    for field, size in zip(_SHARED_STATE_FIELDS, sizes):
+      self._state[field] = np.ndarray(
+          (size,), dtype=np.float64, buffer=buffer, offset=offset
+      )
+      offset += 8 * size
+
+    # action slot view
+    self._action = np.ndarray(
+        (1 + nu,), dtype=np.float64, buffer=buffer, offset=offset
+    )
+
+  def write_state(self, **fields):
+    """Writes the given state fields, the others are left unchanged."""
+    sequence = int(self._header[0])
+    self._header[0] = sequence + 1
+    mask = 0
+    for i, field in enumerate(_SHARED_STATE_FIELDS):
+      value = fields.get(field)
+      if value is None:
+        continue
+      self._state[field][:] = np.ravel(value)
+      mask |= 1 << i
+    self._header[2] = mask
+    self._header[0] = sequence + 2
+
+  def read_action(self) -> np.ndarray:
+    """Returns a consistent copy of the action slot."""
+    while True:
+      sequence = int(self._header[1])
+      if sequence % 2:
+        continue
+      action = self._action[1:].copy()
+      if int(self._header[1]) == sequence:
+        return action
+
+  def close(self):
+    # views must be released before the segment is closed
+    self._header = self._state = self._action = None
+    self._segment.close()
+
+
 class Agent(contextlib.AbstractContextManager):
   """`Agent` class to interface with MuJoCo MPC agents.
 
@@ -88,25 +345,21 @@ class Agent(contextlib.AbstractContextManager):
       subprocess_kwargs: Optional[Mapping[str, Any]] = None,
       connect_to: Optional[str] = None,
       run_init: bool = True,
+      shared_memory: bool = False,
   ):
     self.task_id = task_id
+    self._shared_memory = None
+    self._trajectory = TrajectoryDecoder()
     self.model = model
     self.port = (
         find_free_port() if connect_to is None else parse_port(connect_to)
     )
 
-    if server_binary_path is None:
-      binary_name = "agent_server"
-      server_binary_path = pathlib.Path(__file__).parent / "mjpc" / binary_name
-
     self.server_process = None
     if connect_to is None:
-      self.server_process = subprocess.Popen(
-          [str(server_binary_path), f"--mjpc_port={self.port}"]
-          + list(extra_flags),
-          **(subprocess_kwargs or {}),
+      self.server_process = start_server(
+          self.port, server_binary_path, extra_flags, subprocess_kwargs
       )
-      atexit.register(self.server_process.kill)
 
     self.server_addr = connect_to or f"localhost:{self.port}"
     credentials = grpc.local_channel_credentials(grpc.LocalConnectionType.LOCAL_TCP)
@@ -120,12 +373,16 @@ class Agent(contextlib.AbstractContextManager):
           model,
           send_as="mjb",
           real_time_speed=real_time_speed,
+          shared_memory=shared_memory,
       )
 
   def __exit__(self, exc_type, exc_value, traceback):
     self.close()
 
   def close(self):
+    if self._shared_memory is not None:
+      self._shared_memory.close()
+      self._shared_memory = None
     self.channel.close()
 
     if self.server_process is not None:
@@ -138,6 +395,7 @@ class Agent(contextlib.AbstractContextManager):
       model: Optional[mujoco.MjModel] = None,
       send_as: Literal["mjb", "xml"] = "xml",
       real_time_speed: float = 1.0,
+      shared_memory: bool = False,
   ):
     """Initialize the agent for task `task_id`.
 
@@ -152,33 +410,19 @@ class Agent(contextlib.AbstractContextManager):
       real_time_speed: ratio of running speed to wall clock, from 0 to 1. Only
         affects async (UI) binaries, and not ones where planning is
         synchronous.
+      shared_memory: if True, `set_state` and `get_action` exchange states and
+        actions with the server through shared memory, and gRPC only carries
+        the calls. The server must be on the same machine.
     """
-
-    def model_to_mjb(model: mujoco.MjModel) -> bytes:
-      buffer_size = mujoco.mj_sizeModel(model)
-      buffer = np.empty(shape=buffer_size, dtype=np.uint8)
-      mujoco.mj_saveModel(model, None, buffer)
-      return buffer.tobytes()
-
-    def model_to_xml(model: mujoco.MjModel) -> str:
-      tmp = tempfile.NamedTemporaryFile()
-      mujoco.mj_saveLastXML(tmp.name, model)
-      with pathlib.Path(tmp.name).open("rt") as f:
-        xml_string = f.read()
-      return xml_string
-
-    if model is not None:
-      if send_as == "mjb":
-        model_message = agent_pb2.MjModel(mjb=model_to_mjb(model))
-      else:
-        model_message = agent_pb2.MjModel(xml=model_to_xml(model))
-    else:
-      model_message = None
-
-    init_request = agent_pb2.InitRequest(
-        task_id=task_id, model=model_message, real_time_speed=real_time_speed
+    init_response = self.stub.Init(
+        init_request(task_id, model, send_as, real_time_speed, shared_memory)
     )
-    self.stub.Init(init_request)
+
+    if self._shared_memory is not None:
+      self._shared_memory.close()
+      self._shared_memory = None
+    if shared_memory:
+      self._shared_memory = _SharedMemory(init_response.shared_memory_name)
 
   def set_state(
       self,
@@ -201,24 +445,25 @@ class Agent(contextlib.AbstractContextManager):
       mocap_quat: `data.mocap_quat`.
       userdata: `data.userdata`.
     """
-    # if mocap_pos is an ndarray rather than a list, flatten it
-    if hasattr(mocap_pos, "flatten"):
-      mocap_pos = mocap_pos.flatten()
-    if hasattr(mocap_quat, "flatten"):
-      mocap_quat = mocap_quat.flatten()
-
-    state = agent_pb2.State(
-        time=time if time is not None else None,
-        qpos=qpos if qpos is not None else [],
-        qvel=qvel if qvel is not None else [],
-        act=act if act is not None else [],
-        mocap_pos=mocap_pos if mocap_pos is not None else [],
-        mocap_quat=mocap_quat if mocap_quat is not None else [],
-        userdata=userdata if userdata is not None else [],
-    )
+    # write to shared memory, the server reads the state on SetState
+    if self._shared_memory is not None:
+      self._shared_memory.write_state(
+          time=time,
+          qpos=qpos,
+          qvel=qvel,
+          act=act,
+          mocap_pos=mocap_pos,
+          mocap_quat=mocap_quat,
+          userdata=userdata,
+      )
+      self.stub.SetState(agent_pb2.SetStateRequest(shared_memory=True))
+      return
 
-    set_state_request = agent_pb2.SetStateRequest(state=state)
-    self.stub.SetState(set_state_request)
+    self.stub.SetState(
+        set_state_request(
+            time, qpos, qvel, act, mocap_pos, mocap_quat, userdata
+        )
+    )
 
   def get_state(self) -> agent_pb2.State:
     return self.stub.GetState(agent_pb2.GetStateRequest()).state
@@ -244,8 +489,11 @@ class Agent(contextlib.AbstractContextManager):
         time=time,
         averaging_duration=averaging_duration,
         nominal_action=nominal_action,
+        shared_memory=self._shared_memory is not None,
     )
     get_action_response = self.stub.GetAction(get_action_request)
+    if self._shared_memory is not None:
+      return self._shared_memory.read_action()
     return np.array(get_action_response.action)
 
   def get_total_cost(self) -> float:
@@ -266,10 +514,21 @@ class Agent(contextlib.AbstractContextManager):
         for name, value_weight in terms.values_weights.items()
     }
 
-  def planner_step(self):
-    """Send a planner request."""
-    planner_step_request = agent_pb2.PlannerStepRequest()
-    self.stub.PlannerStep(planner_step_request)
+  def planner_step(self, planning_budget: Optional[float] = None) -> bool:
+    """Send a planner request.
+
+    Args:
+      planning_budget: planning budget per iteration in seconds, kept for
+        later requests. Zero disables the deadline.
+
+    Returns:
+      True if the planning iteration overran the budget.
+    """
+    planner_step_request = agent_pb2.PlannerStepRequest(
+        planning_budget=planning_budget
+    )
+    planner_step_response = self.stub.PlannerStep(planner_step_request)
+    return planner_step_response.deadline_missed
 
   def step(self):
     """Step the physics on the agent side."""
@@ -360,22 +619,178 @@ class Agent(contextlib.AbstractContextManager):
     if parameters.cost_weights:
       self.set_cost_weights(parameters.cost_weights)
 
-  def best_trajectory(self):
-    request = agent_pb2.GetBestTrajectoryRequest()
-    response = self.stub.GetBestTrajectory(request)
+  def best_trajectory(
+      self,
+      float32: bool = False,
+      stride: int = 1,
+      state_components: Optional[Sequence[str]] = None,
+      delta: bool = False,
+      compress: bool = False,
+  ):
+    """Returns the planner's best trajectory.
+
+    Args:
+      float32: transfer states and actions as float32.
+      stride: return every `stride`-th plan step.
+      state_components: state components to return, any of "qpos", "qvel"
+        and "act". All if None.
+      delta: transfer states and actions as differences from the previous
+        call. Differences compress well, so use it with `compress`.
+      compress: ask the server to compress the response.
+
+    Returns:
+      A dict with the "states", "actions" and "times" of the trajectory.
+    """
     if self.model is None:
       raise ValueError("model is None")
-    else:
-      return {
-          "states": np.array(response.states).reshape(
-              response.steps,
-              self.model.nq + self.model.nv + self.model.na,
-          ),
-          "actions": np.array(response.actions).reshape(
-              response.steps - 1, self.model.nu
-          ),
-          "times": np.array(response.times),
-      }
+    request = self._trajectory.request(
+        float32, stride, state_components, delta, compress
+    )
+    response = self.stub.GetBestTrajectory(request)
+    return self._trajectory.decode(response, self.model.nu, float32)
+
+  def stream_scene(
+      self,
+      rate: float = 30,
+      float32: bool = True,
+      traces: bool = True,
+      keyframe_interval: int = 60,
+      compress: bool = False,
+  ) -> Iterator[dict[str, Any]]:
+    """Yields the scene of a ui_agent_server at `rate` frames per second.
+
+    A frame's "qpos", "mocap_pos" and "mocap_quat" are set on an MjData of
+    the task's model and rendered with mj_forward, e.g., in a passive viewer.
+
+    Args:
+      rate: frames per second.
+      float32: transfer values as float32.
+      traces: include the planner's policy trace, (steps, num_trace, 3)
+        positions, or None before the first planning iteration.
+      keyframe_interval: full values every `keyframe_interval` frames, the
+        others are differences from the previous frame.
+      compress: ask the server to compress the frames.
+
+    Yields:
+      A dict with the "time", "qpos", "mocap_pos", "mocap_quat" and "trace" of
+      each frame, until the iterator is closed.
+    """
+    decoder = SceneDecoder(float32)
+    frames = self.stub.StreamScene(
+        agent_pb2.StreamSceneRequest(
+            rate=rate,
+            float32=float32,
+            traces=traces,
+            keyframe_interval=keyframe_interval,
+            compress=compress,
+        )
+    )
+    try:
+      for frame in frames:
+        yield decoder.decode(frame)
+    finally:
+      frames.cancel()
+
+  def get_metrics(
+      self, prometheus_text: bool = False
+  ) -> agent_pb2.GetMetricsResponse:
+    """Returns planning health metrics of the agent.
+
+    Args:
+      prometheus_text: also return the metrics in the Prometheus text format,
+        in the response's `prometheus_text` field.
+
+    Returns:
+      Planning latency histogram and rates, thread pool utilization, policy
+      staleness, the planner's phase timers and, if the server samples them
+      (--mjpc_perf_counters), hardware performance counters per phase and
+      thread.
+    """
+    return self.stub.GetMetrics(
+        agent_pb2.GetMetricsRequest(prometheus_text=prometheus_text)
+    )
+
+  def get_policy(
+      self, version: Optional[int] = None
+  ) -> Optional[policy_lib.ExportedPolicy]:
+    """Returns the planner's latest published policy.
+
+    The policy is evaluated without the model by `policy.PolicyEvaluator`,
+    e.g., at a control rate higher than the rate of `get_action` calls.
+
+    Args:
+      version: version of the caller's policy.
+
+    Returns:
+      The policy, or None if version is still the latest.
+    """
+    request = agent_pb2.GetPolicyRequest()
+    if version is not None:
+      request.version = version
+    response = self.stub.GetPolicy(request)
+    if not response.policy:
+      return None
+    return policy_lib.parse_policy(response.policy)
+
+  def evaluate_rollouts(
+      self,
+      states: npt.ArrayLike,
+      spline_times: npt.ArrayLike,
+      parameters: npt.ArrayLike,
+      times: Optional[npt.ArrayLike] = None,
+      steps: int = 0,
+      representation: int = 2,
+      cost_terms: bool = False,
+  ) -> tuple[np.ndarray, Optional[np.ndarray], np.ndarray]:
+    """Returns of open-loop rollouts under the task's costs, without planning.
+
+    Args:
+      states: (rollouts, nq + nv + na) initial states.
+      spline_times: (knots,) knot times, relative to the start times.
+      parameters: (rollouts, knots, nu) knot actions.
+      times: (rollouts,) start times, the agent's time if None.
+      steps: rollout time steps, the agent's planning steps if 0.
+      representation: 0: zero, 1: linear, 2: cubic interpolation.
+      cost_terms: also return the cost terms.
+
+    Returns:
+      (rollouts,) total returns, (rollouts, terms) weighted cost terms
+      averaged over each rollout if requested, and (rollouts,) failures.
+    """
+    states = np.asarray(states, dtype=np.float64)
+    request = agent_pb2.EvaluateRolloutsRequest(
+        states=states.ravel(),
+        spline_times=np.asarray(spline_times, dtype=np.float64).ravel(),
+        parameters=np.asarray(parameters, dtype=np.float64).ravel(),
+        times=[] if times is None else np.asarray(times).ravel(),
+        steps=steps,
+        representation=representation,
+        cost_terms=cost_terms,
+    )
+    response = self.stub.EvaluateRollouts(request)
+    total_return = np.array(response.total_return)
+    terms = None
+    if cost_terms:
+      terms = np.array(response.cost_terms).reshape(len(total_return), -1)
+    return total_return, terms, np.array(response.failure)
+
+  def control(
+      self, requests: Iterable[agent_pb2.ControlRequest]
+  ) -> Iterator[np.ndarray]:
+    """Stream states to the `Agent` and receive actions.
+
+    The planner runs on the server between messages, so no `planner_step`
+    calls are needed while the stream is open.
+
+    Args:
+      requests: control requests, each with the current state and optionally
+        task parameters, cost weights, mocap poses and action options.
+
+    Yields:
+      action: the planner's action for each request.
+    """
+    for response in self.stub.Control(iter(requests)):
+      yield np.array(response.action)
 
   def set_mocap(self, mocap_map: Mapping[str, mjpc_parameters.Pose]):
     request = agent_pb2.SetAnythingRequest()
@@ -0,0 +1,338 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""asyncio interface to MuJoCo MPC agents.
+
+`AsyncAgent` has the API of `agent.Agent` with coroutine methods, over a
+grpc.aio channel, so that one thread drives many agents. `AgentPool` sends
+the requests of a control tick to many agents concurrently: its wall time is
+that of the slowest agent rather than the sum.
+
+  async with agent_async.AgentPool.create("Cartpole", 64) as pool:
+    actions = await pool.step(states)
+"""
+
+import asyncio
+from typing import Any, Mapping, Optional, Sequence
+
+import grpc
+import mujoco
+from mujoco_mpc import agent as agent_lib
+import numpy as np
+from numpy import typing as npt
+
+# INTERNAL IMPORT
+from mujoco_mpc.proto import agent_pb2
+from mujoco_mpc.proto import agent_pb2_grpc
+
+
+class AsyncAgent:
+  """`Agent` with coroutine methods, see `agent.Agent`.
+
+  The server is started in the constructor, and connected to and
+  initialized in `start`, or on entering `async with`. Shared memory isn't
+  supported.
+
+  Attributes:
+    task_id:
+    model:
+    port:
+    channel:
+    stub:
+    server_process:
+    server_addr:
+  """
+
+  def __init__(
+      self,
+      task_id: str,
+      model: Optional[mujoco.MjModel] = None,
+      server_binary_path: Optional[str] = None,
+      extra_flags: Sequence[str] = (),
+      real_time_speed: float = 1.0,
+      subprocess_kwargs: Optional[Mapping[str, Any]] = None,
+      connect_to: Optional[str] = None,
+      run_init: bool = True,
+  ):
+    self.task_id = task_id
+    self.model = model
+    self._real_time_speed = real_time_speed
+    self._run_init = run_init
+    self._trajectory = agent_lib.TrajectoryDecoder()
+    self.port = (
+        agent_lib.find_free_port()
+        if connect_to is None
+        else agent_lib.parse_port(connect_to)
+    )
+
+    self.server_process = None
+    if connect_to is None:
+      self.server_process = agent_lib.start_server(
+          self.port, server_binary_path, extra_flags, subprocess_kwargs
+      )
+
+    self.server_addr = connect_to or f"localhost:{self.port}"
+    self.channel = None
+    self.stub = None
+
+  async def start(self, timeout: float = 30):
+    """Connect to the server, and initialize the agent if run_init."""
+    # aio channels belong to the event loop they are created in
+    credentials = grpc.local_channel_credentials(
+        grpc.LocalConnectionType.LOCAL_TCP
+    )
+    self.channel = grpc.aio.secure_channel(self.server_addr, credentials)
+    self.stub = agent_pb2_grpc.AgentStub(self.channel)
+    await asyncio.wait_for(self.channel.channel_ready(), timeout)
+    if self._run_init:
+      await self.init(
+          self.task_id,
+          self.model,
+          send_as="mjb",
+          real_time_speed=self._real_time_speed,
+      )
+
+  async def __aenter__(self):
+    await self.start()
+    return self
+
+  async def __aexit__(self, exc_type, exc_value, traceback):
+    await self.close()
+
+  async def close(self):
+    if self.channel is not None:
+      await self.channel.close()
+    if self.server_process is not None:
+      self.server_process.kill()
+      self.server_process.wait()
+
+  async def init(
+      self,
+      task_id: str,
+      model: Optional[mujoco.MjModel] = None,
+      send_as: str = "xml",
+      real_time_speed: float = 1.0,
+  ):
+    """Initialize the agent for task `task_id`, see `Agent.init`."""
+    await self.stub.Init(
+        agent_lib.init_request(task_id, model, send_as, real_time_speed)
+    )
+
+  async def set_state(
+      self,
+      time: Optional[float] = None,
+      qpos: Optional[npt.ArrayLike] = None,
+      qvel: Optional[npt.ArrayLike] = None,
+      act: Optional[npt.ArrayLike] = None,
+      mocap_pos: Optional[npt.ArrayLike] = None,
+      mocap_quat: Optional[npt.ArrayLike] = None,
+      userdata: Optional[npt.ArrayLike] = None,
+  ):
+    """Set `Agent`'s MuJoCo `data` state, see `Agent.set_state`."""
+    await self.stub.SetState(
+        agent_lib.set_state_request(
+            time, qpos, qvel, act, mocap_pos, mocap_quat, userdata
+        )
+    )
+
+  async def get_state(self) -> agent_pb2.State:
+    return (await self.stub.GetState(agent_pb2.GetStateRequest())).state
+
+  async def get_action(
+      self,
+      time: Optional[float] = None,
+      averaging_duration: float = 0,
+      nominal_action: bool = False,
+  ) -> np.ndarray:
+    """Return latest `action` from the planner, see `Agent.get_action`."""
+    response = await self.stub.GetAction(
+        agent_pb2.GetActionRequest(
+            time=time,
+            averaging_duration=averaging_duration,
+            nominal_action=nominal_action,
+        )
+    )
+    return np.array(response.action)
+
+  async def planner_step(self, planning_budget: Optional[float] = None) -> bool:
+    """Send a planner request, see `Agent.planner_step`."""
+    response = await self.stub.PlannerStep(
+        agent_pb2.PlannerStepRequest(planning_budget=planning_budget)
+    )
+    return response.deadline_missed
+
+  async def step(self):
+    """Step the physics on the agent side."""
+    await self.stub.Step(agent_pb2.StepRequest())
+
+  async def reset(self):
+    """Reset the `Agent`'s data, settings, planner, and states."""
+    await self.stub.Reset(agent_pb2.ResetRequest())
+
+  async def set_task_parameters(self, parameters: dict[str, float | str]):
+    request = agent_pb2.SetTaskParametersRequest()
+    for name, value in parameters.items():
+      if isinstance(value, str):
+        request.parameters[name].selection = value
+      else:
+        request.parameters[name].numeric = value
+    await self.stub.SetTaskParameters(request)
+
+  async def set_cost_weights(
+      self, weights: dict[str, float], reset_to_defaults: bool = False
+  ):
+    request = agent_pb2.SetCostWeightsRequest(
+        cost_weights=weights, reset_to_defaults=reset_to_defaults
+    )
+    await self.stub.SetCostWeights(request)
+
+  async def best_trajectory(
+      self,
+      float32: bool = False,
+      stride: int = 1,
+      state_components: Optional[Sequence[str]] = None,
+      delta: bool = False,
+      compress: bool = False,
+  ) -> dict[str, np.ndarray]:
+    """Returns the planner's best trajectory, see `Agent.best_trajectory`."""
+    if self.model is None:
+      raise ValueError("model is None")
+    request = self._trajectory.request(
+        float32, stride, state_components, delta, compress
+    )
+    response = await self.stub.GetBestTrajectory(request)
+    return self._trajectory.decode(response, self.model.nu, float32)
+
+
+class AgentPool:
+  """Agents whose requests are sent concurrently.
+
+  Every method sends one request per agent and waits for all responses, so a
+  call takes as long as the slowest agent. Per-agent arguments are sequences
+  with one entry per agent.
+
+  Attributes:
+    agents: the pool's agents.
+  """
+
+  def __init__(self, agents: Sequence[AsyncAgent]):
+    self.agents = list(agents)
+
+  @classmethod
+  def create(
+      cls,
+      task_id: str,
+      num_agents: int,
+      model: Optional[mujoco.MjModel] = None,
+      **kwargs,
+  ) -> "AgentPool":
+    """A pool of num_agents agents, each with its own server process.
+
+    Args:
+      task_id: the task of every agent.
+      num_agents: number of agents.
+      model: optional model of every agent.
+      **kwargs: other `AsyncAgent` arguments.
+
+    Returns:
+      The pool, started on entering `async with` or with `start`.
+    """
+    return cls(
+        [AsyncAgent(task_id, model, **kwargs) for _ in range(num_agents)]
+    )
+
+  def __len__(self) -> int:
+    return len(self.agents)
+
+  async def _gather(self, coroutines):
+    return await asyncio.gather(*coroutines)
+
+  async def start(self, timeout: float = 30):
+    await self._gather(agent.start(timeout) for agent in self.agents)
+
+  async def __aenter__(self):
+    await self.start()
+    return self
+
+  async def __aexit__(self, exc_type, exc_value, traceback):
+    await self.close()
+
+  async def close(self):
+    await self._gather(agent.close() for agent in self.agents)
+
+  async def set_state(self, states: Sequence[Mapping[str, Any]]):
+    """Set the state of each agent.
+
+    Args:
+      states: `AsyncAgent.set_state` keyword arguments of each agent, e.g.,
+        {"time": t, "qpos": qpos, "qvel": qvel}.
+    """
+    await self._gather(
+        agent.set_state(**state) for agent, state in zip(self.agents, states)
+    )
+
+  async def planner_step(
+      self, planning_budget: Optional[float] = None
+  ) -> list[bool]:
+    """Plan an iteration on every agent, returns the deadline misses."""
+    return await self._gather(
+        agent.planner_step(planning_budget) for agent in self.agents
+    )
+
+  async def get_action(
+      self, times: Optional[Sequence[Optional[float]]] = None, **kwargs
+  ) -> np.ndarray:
+    """Returns the (agents, nu) actions at times, see `Agent.get_action`."""
+    times = times if times is not None else [None] * len(self.agents)
+    return np.stack(
+        await self._gather(
+            agent.get_action(time, **kwargs)
+            for agent, time in zip(self.agents, times)
+        )
+    )
+
+  async def best_trajectory(self, **kwargs) -> list[dict[str, np.ndarray]]:
+    """Returns the best trajectory of every agent."""
+    return await self._gather(
+        agent.best_trajectory(**kwargs) for agent in self.agents
+    )
+
+  async def step(
+      self,
+      states: Sequence[Mapping[str, Any]],
+      planning_budget: Optional[float] = None,
+  ) -> np.ndarray:
+    """A control tick: set state, plan and get the action of every agent.
+
+    The requests of each agent are pipelined, and agents run concurrently.
+
+    Args:
+      states: `AsyncAgent.set_state` keyword arguments of each agent.
+      planning_budget: planning budget per iteration in seconds.
+
+    Returns:
+      The (agents, nu) actions at the states' times.
+    """
+
+    async def tick(agent: AsyncAgent, state: Mapping[str, Any]):
+      await agent.set_state(**state)
+      await agent.planner_step(planning_budget)
+      return await agent.get_action(state.get("time"))
+
+    return np.stack(
+        await self._gather(
+            tick(agent, state) for agent, state in zip(self.agents, states)
+        )
+    )
@@ -0,0 +1,80 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import asyncio
+import pathlib
+
+from absl.testing import absltest
+import mujoco
+from mujoco_mpc import agent_async
+import numpy as np
+
+
+def _particle_model():
+  model_path = (
+      pathlib.Path(__file__).parent.parent.parent
+      / "mjpc/tasks/particle/task_timevarying.xml"
+  )
+  return mujoco.MjModel.from_xml_path(str(model_path))
+
+
+class AgentAsyncTest(absltest.TestCase):
+
+  def test_agent(self):
+    model = _particle_model()
+    data = mujoco.MjData(model)
+
+    async def run():
+      agent = agent_async.AsyncAgent(task_id="Particle", model=model)
+      async with agent:
+        await agent.set_state(time=data.time, qpos=data.qpos, qvel=data.qvel)
+        await agent.planner_step()
+        action = await agent.get_action()
+        trajectory = await agent.best_trajectory()
+        return action, trajectory
+
+    action, trajectory = asyncio.run(run())
+    self.assertEqual(action.shape, (model.nu,))
+    self.assertEqual(trajectory["actions"].shape[1], model.nu)
+
+  def test_pool(self):
+    model = _particle_model()
+    data = mujoco.MjData(model)
+    num_agents = 3
+
+    async def run():
+      async with agent_async.AgentPool.create(
+          "Particle", num_agents, model=model
+      ) as pool:
+        states = [
+            {"time": data.time, "qpos": data.qpos + 0.1 * i, "qvel": data.qvel}
+            for i in range(num_agents)
+        ]
+        actions = await pool.step(states)
+        misses = await pool.planner_step()
+        trajectories = await pool.best_trajectory()
+        return actions, misses, trajectories
+
+    actions, misses, trajectories = asyncio.run(run())
+    self.assertEqual(actions.shape, (num_agents, model.nu))
+    self.assertLen(misses, num_agents)
+    self.assertLen(trajectories, num_agents)
+
+    # agents at different states plan different actions
+    self.assertFalse(np.allclose(actions[0], actions[1]))
+
+
+if __name__ == "__main__":
+  absltest.main()
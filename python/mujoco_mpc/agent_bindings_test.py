@@ -0,0 +1,56 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+from absl.testing import absltest
+import mujoco
+from mujoco_mpc import agent_bindings
+import numpy as np
+
+import pathlib
+
+
+class AgentBindingsTest(absltest.TestCase):
+
+  def test_plan_and_set_ctrl(self):
+    model_path = (
+        pathlib.Path(__file__).parent.parent.parent
+        / "mjpc/tasks/particle/task_timevarying.xml"
+    )
+    model = mujoco.MjModel.from_xml_path(str(model_path))
+    data = mujoco.MjData(model)
+    agent = agent_bindings.Agent(task_id="Particle", model=model)
+
+    agent.set_state(data)
+    for _ in range(10):
+      agent.plan_iteration()
+    action = agent.get_action()
+    self.assertEqual(action.shape, (model.nu,))
+
+    agent.set_ctrl(data)
+    np.testing.assert_allclose(data.ctrl, action)
+
+    trajectory = agent.best_trajectory()
+    self.assertEqual(trajectory["actions"].shape[1], model.nu)
+    self.assertEqual(
+        trajectory["states"].shape[0], trajectory["times"].shape[0]
+    )
+
+  def test_invalid_task_id(self):
+    with self.assertRaises(ValueError):
+      agent_bindings.Agent(task_id="NotATask")
+
+
+if __name__ == "__main__":
+  absltest.main()
@@ -19,6 +19,7 @@ from absl.testing import parameterized
 import grpc
 import mujoco
 from mujoco_mpc import agent as agent_lib
+from mujoco_mpc import policy as policy_lib
 import numpy as np
 
 import pathlib
@@ -411,6 +412,58 @@ class AgentTest(parameterized.TestCase):
     self.assertEqual(best_traj["actions"].shape, (50, 2))
     self.assertEqual(best_traj["times"].shape, (51,))
 
+  def test_get_policy(self):
+    model_path = (
+        pathlib.Path(__file__).parent.parent.parent
+        / "mjpc/tasks/particle/task_timevarying.xml"
+    )
+    model = mujoco.MjModel.from_xml_path(str(model_path))
+    data = mujoco.MjData(model)
+
+    agent = agent_lib.Agent(task_id="Particle", model=model)
+    agent.set_state(time=data.time, qpos=data.qpos, qvel=data.qvel)
+    agent.planner_step()
+    policy = agent.get_policy()
+    self.assertIsNotNone(policy)
+
+    # actions match the server's
+    evaluator = policy_lib.PolicyEvaluator(policy)
+    for time in [0.0, 0.013, 0.1]:
+      np.testing.assert_allclose(
+          evaluator.action(time, np.concatenate([data.qpos, data.qvel])),
+          agent.get_action(time=time),
+          atol=1.0e-8,
+      )
+
+    # unchanged policy
+    self.assertIsNone(agent.get_policy(version=policy.version))
+
+  def test_evaluate_rollouts(self):
+    model_path = (
+        pathlib.Path(__file__).parent.parent.parent
+        / "mjpc/tasks/particle/task_timevarying.xml"
+    )
+    model = mujoco.MjModel.from_xml_path(str(model_path))
+    data = mujoco.MjData(model)
+
+    agent = agent_lib.Agent(task_id="Particle", model=model)
+    state = np.concatenate([data.qpos, data.qvel])
+    parameters = np.zeros((3, 2, model.nu))
+    parameters[2] = 1.0
+    total_return, terms, failure = agent.evaluate_rollouts(
+        states=np.tile(state, (3, 1)),
+        spline_times=[0.0, 0.5],
+        parameters=parameters,
+        steps=20,
+        cost_terms=True,
+    )
+    self.assertEqual(total_return.shape, (3,))
+    self.assertEqual(terms.shape[0], 3)
+    self.assertFalse(failure.any())
+    self.assertEqual(total_return[0], total_return[1])
+    self.assertNotEqual(total_return[0], total_return[2])
+    np.testing.assert_allclose(terms.sum(axis=1), total_return)
+
   def test_set_mocap(self):
     model_path = (
         pathlib.Path(__file__).parent.parent.parent
@@ -22,7 +22,7 @@ import socket
 import subprocess
 import sys
 import tempfile
-from typing import Literal, Optional
+from typing import Iterable, Iterator, Literal, Optional
 
 import grpc
 import mujoco
@@ -49,6 +49,40 @@ def find_free_port() -> int:
     return s.getsockname()[1]
 
 
+def packed_array(field, shape=None, dtype=np.float64) -> np.ndarray:
+  """Decode a packed repeated field into a preallocated array.
+
+  Args:
+    field: repeated numeric message field.
+    shape: optional shape of the returned array.
+    dtype: array type.
+
+  Returns:
+    array with the field's values.
+  """
+  array = np.fromiter(field, dtype=dtype, count=len(field))
+  return array if shape is None else array.reshape(shape)
+
+
+def sparse_matrix(matrix: direct_pb2.SparseMatrix) -> dict[str, np.ndarray]:
+  """Convert a compressed sparse row matrix message to arrays.
+
+  The keys match `scipy.sparse.csr_matrix((data, indices, indptr), shape)`.
+
+  Args:
+    matrix: SparseMatrix message.
+
+  Returns:
+    dict with data, indices, indptr, and shape.
+  """
+  return {
+      "data": packed_array(matrix.value),
+      "indices": packed_array(matrix.column, dtype=np.int32),
+      "indptr": packed_array(matrix.row_start, dtype=np.int32),
+      "shape": (matrix.rows, matrix.cols),
+  }
+
+
 class Direct:
   """`Direct` class to interface with MuJoCo MPC direct estimator.
 
@@ -319,15 +353,55 @@ class Direct:
       self,
       derivatives: Optional[bool] = False,
       internals: Optional[bool] = False,
-  ) -> dict[str, float | np.ndarray | int | list]:
-    # cost request
+      sparse: Optional[bool] = False,
+      band: Optional[bool] = False,
+  ) -> dict[str, float | np.ndarray | int | list | dict]:
+    # cost request, with band Hessian the dense Hessian is not computed
     request = direct_pb2.CostRequest(
-        derivatives=derivatives, internals=internals
+        derivatives=derivatives, internals=internals, sparse=sparse, band=band
     )
 
     # cost response
     cost = self._wait(self.stub.Cost.future(request))
 
+    # sparse internals
+    if internals and sparse:
+      jacobian_sensor = sparse_matrix(cost.jacobian_sensor_sparse)
+      jacobian_force = sparse_matrix(cost.jacobian_force_sparse)
+      norm_hessian_sensor = sparse_matrix(cost.norm_hessian_sensor_sparse)
+      norm_hessian_force = sparse_matrix(cost.norm_hessian_force_sparse)
+    elif internals:
+      jacobian_sensor = packed_array(
+          cost.jacobian_sensor, (cost.nsensor, cost.nvar)
+      )
+      jacobian_force = packed_array(
+          cost.jacobian_force, (cost.nforce, cost.nvar)
+      )
+      norm_hessian_sensor = packed_array(
+          cost.norm_hessian_sensor, (cost.nsensor, cost.nsensor)
+      )
+      norm_hessian_force = packed_array(
+          cost.norm_hessian_force, (cost.nforce, cost.nforce)
+      )
+    else:
+      jacobian_sensor = []
+      jacobian_force = []
+      norm_hessian_sensor = []
+      norm_hessian_force = []
+
+    # band Hessian: band rows and dense parameter rows
+    if derivatives and band:
+      hessian_band = packed_array(cost.hessian_band)
+      nband_total = cost.nvar * cost.nband
+      hessian_band = {
+          "band": hessian_band[:nband_total].reshape(cost.nvar, cost.nband),
+          "dense": hessian_band[nband_total:].reshape(
+              cost.nparam, cost.nvar + cost.nparam
+          ),
+      }
+    else:
+      hessian_band = []
+
     # return all costs
     return {
         "total": cost.total,
@@ -335,42 +409,29 @@ class Direct:
         "force": cost.force,
         "parameters": cost.parameter,
         "initial": cost.initial,
-        "gradient": np.array(cost.gradient) if derivatives else [],
+        "gradient": packed_array(cost.gradient) if derivatives else [],
         "hessian": (
-            np.array(cost.hessian).reshape(cost.nvar, cost.nvar)
-            if derivatives
+            packed_array(cost.hessian, (cost.nvar, cost.nvar))
+            if derivatives and not band
             else []
         ),
-        "residual_sensor": np.array(cost.residual_sensor) if internals else [],
-        "residual_force": np.array(cost.residual_force) if internals else [],
-        "jacobian_sensor": (
-            np.array(cost.jacobian_sensor).reshape(cost.nsensor, cost.nvar)
-            if internals
-            else []
+        "hessian_band": hessian_band,
+        "residual_sensor": (
+            packed_array(cost.residual_sensor) if internals else []
         ),
-        "jacobian_force": (
-            np.array(cost.jacobian_force).reshape(cost.nforce, cost.nvar)
-            if internals
-            else []
+        "residual_force": (
+            packed_array(cost.residual_force) if internals else []
         ),
+        "jacobian_sensor": jacobian_sensor,
+        "jacobian_force": jacobian_force,
         "norm_gradient_sensor": (
-            np.array(cost.norm_gradient_sensor) if internals else []
+            packed_array(cost.norm_gradient_sensor) if internals else []
         ),
         "norm_gradient_force": (
-            np.array(cost.norm_gradient_force) if internals else []
-        ),
-        "norm_hessian_sensor": (
-            np.array(cost.norm_hessian_sensor).reshape(
-                cost.nsensor, cost.nsensor
-            )
-            if internals
-            else []
-        ),
-        "norm_hessian_force": (
-            np.array(cost.norm_hessian_force).reshape(cost.nforce, cost.nforce)
-            if internals
-            else []
+            packed_array(cost.norm_gradient_force) if internals else []
         ),
+        "norm_hessian_sensor": norm_hessian_sensor,
+        "norm_hessian_force": norm_hessian_force,
         "nvar": cost.nvar,
         "nsensor": cost.nsensor,
         "nforce": cost.nforce,
@@ -412,6 +473,32 @@ class Direct:
     # optimize response
     self._wait(self.stub.Optimize.future(request))
 
+  def stream(
+      self,
+      samples: Iterable[tuple[npt.ArrayLike, npt.ArrayLike, float]],
+      optimize: bool = True,
+  ) -> Iterator[dict[str, np.ndarray]]:
+    """Appends (ctrl, sensor_measurement, time) samples, yields estimates."""
+    # stream requests
+    def requests():
+      for ctrl, sensor_measurement, time in samples:
+        yield direct_pb2.StreamRequest(
+            ctrl=ctrl,
+            sensor_measurement=sensor_measurement,
+            time=time,
+            optimize=optimize,
+        )
+
+    # stream responses
+    for response in self.stub.Stream(requests()):
+      yield {
+          "configuration": np.array(response.configuration),
+          "velocity": np.array(response.velocity),
+          "time": response.time,
+          "cost": response.cost,
+          "solve_status": response.status.solve_status,
+      }
+
   def sensor_info(self) -> dict[str, int]:
     # info request
     request = direct_pb2.SensorInfoRequest()
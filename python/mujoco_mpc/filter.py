@@ -22,7 +22,7 @@ import socket
 import subprocess
 import sys
 import tempfile
-from typing import Literal, Optional
+from typing import Literal, Optional, Sequence
 
 import grpc
 import mujoco
@@ -34,6 +34,44 @@ from mujoco_mpc.proto import filter_pb2
 from mujoco_mpc.proto import filter_pb2_grpc
 
 
+def _packed_array(field, shape=None) -> np.ndarray:
+  """Decodes a packed repeated field into a preallocated array."""
+  array = np.fromiter(field, dtype=np.float64, count=len(field))
+  return array if shape is None else array.reshape(shape)
+
+
+def _model_message(
+    model: Optional[mujoco.MjModel], send_as: Literal["mjb", "xml"]
+) -> Optional[filter_pb2.MjModel]:
+  """Returns the model message, serialized as `send_as`."""
+  if model is None:
+    return None
+  if send_as == "mjb":
+    buffer_size = mujoco.mj_sizeModel(model)
+    buffer = np.empty(shape=buffer_size, dtype=np.uint8)
+    mujoco.mj_saveModel(model, None, buffer)
+    return filter_pb2.MjModel(mjb=buffer.tobytes())
+  tmp = tempfile.NamedTemporaryFile()
+  mujoco.mj_saveLastXML(tmp.name, model)
+  with pathlib.Path(tmp.name).open("rt") as f:
+    return filter_pb2.MjModel(xml=f.read())
+
+
+def _sigma_points(
+    sigma_points: Optional[Literal["symmetric", "simplex"]],
+) -> int:
+  """Returns the `SigmaPoints` enum value of `sigma_points`."""
+  if sigma_points is None:
+    return filter_pb2.SIGMA_POINTS_MODEL
+  values = {
+      "symmetric": filter_pb2.SIGMA_POINTS_SYMMETRIC,
+      "simplex": filter_pb2.SIGMA_POINTS_SIMPLEX,
+  }
+  if sigma_points not in values:
+    raise ValueError(f"Unknown sigma point set: {sigma_points}")
+  return values[sigma_points]
+
+
 def find_free_port() -> int:
   """Find an available TCP port on the system.
 
@@ -99,6 +137,7 @@ class Filter:
       self,
       model: mujoco.MjModel,
       send_as: Literal["mjb", "xml"] = "xml",
+      sigma_points: Optional[Literal["symmetric", "simplex"]] = None,
   ):
     """
     Args:
@@ -107,38 +146,81 @@ class Filter:
         task xml will be used.
       configuration_length: estimation horizon.
       send_as: The serialization format for sending the model over gRPC; "xml".
+      sigma_points: sigma point set of the unscented filter, the model's
+        `unscented_sigma_points` numeric if None. "simplex" evaluates
+        ndstate + 2 points instead of 2 * ndstate + 1.
     """
 
-    # setup model
-    def model_to_mjb(model: mujoco.MjModel) -> bytes:
-      buffer_size = mujoco.mj_sizeModel(model)
-      buffer = np.empty(shape=buffer_size, dtype=np.uint8)
-      mujoco.mj_saveModel(model, None, buffer)
-      return buffer.tobytes()
-
-    def model_to_xml(model: mujoco.MjModel) -> str:
-      tmp = tempfile.NamedTemporaryFile()
-      mujoco.mj_saveLastXML(tmp.name, model)
-      with pathlib.Path(tmp.name).open("rt") as f:
-        xml_string = f.read()
-      return xml_string
-
-    if model is not None:
-      if send_as == "mjb":
-        model_message = filter_pb2.MjModel(mjb=model_to_mjb(model))
-      else:
-        model_message = filter_pb2.MjModel(xml=model_to_xml(model))
-    else:
-      model_message = None
-
     # initialize request
     init_request = filter_pb2.InitRequest(
-        model=model_message,
+        model=_model_message(model, send_as),
+        sigma_points=_sigma_points(sigma_points),
     )
 
     # initialize response
     self._wait(self.stub.Init.future(init_request))
 
+  def batch_init(
+      self,
+      model: mujoco.MjModel,
+      num_filters: int,
+      send_as: Literal["mjb", "xml"] = "xml",
+      sigma_points: Optional[Literal["symmetric", "simplex"]] = None,
+  ):
+    """Initializes a batch of filters for `model`, updated in parallel.
+
+    Args:
+      model: `MjModel` instance of all filters in the batch.
+      num_filters: number of filters.
+      send_as: The serialization format for sending the model over gRPC.
+      sigma_points: sigma point set of unscented filters, see `init`.
+    """
+    request = filter_pb2.BatchInitRequest(
+        model=_model_message(model, send_as),
+        num_filters=num_filters,
+        sigma_points=_sigma_points(sigma_points),
+    )
+    self._wait(self.stub.BatchInit.future(request))
+
+  def batch_update(
+      self,
+      ctrl: npt.ArrayLike,
+      sensor: npt.ArrayLike,
+      reset: Optional[Sequence[int]] = None,
+      covariance: bool = False,
+  ) -> dict[str, np.ndarray]:
+    """Updates all filters in the batch.
+
+    Args:
+      ctrl: (num_filters, nu) controls.
+      sensor: (num_filters, nsensordata) sensor measurements.
+      reset: filters to reset before the update.
+      covariance: also return the covariances.
+
+    Returns:
+      "state" (num_filters, nq + nv + na), "time" (num_filters,) and, if
+      requested, "covariance" (num_filters, dimension, dimension).
+    """
+    request = filter_pb2.BatchUpdateRequest(
+        ctrl=np.ravel(ctrl),
+        sensor=np.ravel(sensor),
+        reset=reset or [],
+        covariance=covariance,
+    )
+    response = self._wait(self.stub.BatchUpdate.future(request))
+    result = {
+        "state": _packed_array(
+            response.state, (-1, response.state_dimension)
+        ),
+        "time": _packed_array(response.time),
+    }
+    if covariance:
+      dimension = response.covariance_dimension
+      result["covariance"] = _packed_array(
+          response.covariance, (-1, dimension, dimension)
+      )
+    return result
+
   def available_filters(self):
     return {
         "ground truth",
@@ -206,8 +288,8 @@ class Filter:
     response = self._wait(self.stub.Covariance.future(request)).covariance
 
     # return covariance
-    return np.array(response.covariance).reshape(
-        response.dimension, response.dimension
+    return _packed_array(
+        response.covariance, (response.dimension, response.dimension)
     )
 
   def noise(
@@ -69,5 +69,35 @@ class FilterTest(absltest.TestCase):
 
     # TODO(etom): more tests
 
+  def test_batch_updates(self):
+    # load model
+    model_path = (
+        pathlib.Path(__file__).parent.parent.parent
+        / "mjpc/test/testdata/estimator/particle/task1D.xml"
+    )
+    model = mujoco.MjModel.from_xml_path(str(model_path))
+
+    # initialize batch
+    num_filters = 4
+    filter = filter_lib.Filter(model=model)
+    filter.batch_init(model, num_filters)
+
+    # identical measurements give identical estimates
+    ctrl = np.tile(np.random.normal(scale=1.0, size=model.nu), (num_filters, 1))
+    sensor = np.tile(
+        np.random.normal(scale=1.0, size=model.nsensordata), (num_filters, 1)
+    )
+    response = filter.batch_update(ctrl, sensor, covariance=True)
+
+    # test shapes and estimates
+    nstate = model.nq + model.nv + model.na
+    self.assertEqual(response["state"].shape, (num_filters, nstate))
+    self.assertEqual(response["time"].shape, (num_filters,))
+    self.assertEqual(response["covariance"].shape[0], num_filters)
+    for i in range(1, num_filters):
+      self.assertLess(
+          np.linalg.norm(response["state"][i] - response["state"][0]), 1.0e-8
+      )
+
 if __name__ == "__main__":
   absltest.main()
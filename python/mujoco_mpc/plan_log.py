@@ -0,0 +1,173 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Reader of plan logs, the binary logs of planning iterations.
+
+A log, written by mjpc/plan_log.h (e.g., agent_server --mjpc_plan_log), is a
+header followed by chunks of records with the same sizes, stored by column.
+The arrays of a chunk are views into the memory-mapped file.
+"""
+
+import dataclasses
+from typing import List
+
+import numpy as np
+
+_MAGIC = b"MJPCPLOG"
+_CHUNK_MAGIC = b"CHNK"
+_VERSION = 1
+_HEADER_SIZE = 16
+_CHUNK_HEADER_SIZE = 32
+
+
+@dataclasses.dataclass(frozen=True)
+class PlanLogChunk:
+  """Consecutive planning iterations with the same sizes.
+
+  Attributes:
+    iteration: (records,) planning iteration counter.
+    time: (records,) planning start time.
+    total_return: (records,) total return of the best trajectory.
+    state: (records, nq + nv + na) planning start state.
+    parameters: (records, num_parameters) nominal policy after the iteration.
+    returns: (records, num_samples) total return of each sample.
+    sample_states: (records, num_samples, horizon, dim_state) sample states,
+      with horizon 0 if they weren't logged.
+  """
+
+  iteration: np.ndarray
+  time: np.ndarray
+  total_return: np.ndarray
+  state: np.ndarray
+  parameters: np.ndarray
+  returns: np.ndarray
+  sample_states: np.ndarray
+
+
+def read_plan_log(path: str) -> List[PlanLogChunk]:
+  """Read the complete chunks of a plan log.
+
+  A truncated last chunk, e.g., of a log that is still being written, is
+  skipped.
+
+  Args:
+    path: plan log file.
+
+  Returns:
+    The chunks of the log, in order.
+
+  Raises:
+    ValueError: if path isn't a plan log of a supported version.
+  """
+  data = np.memmap(path, dtype=np.uint8, mode="r")
+  if data.size < _HEADER_SIZE or bytes(data[:8]) != _MAGIC:
+    raise ValueError(f"{path} is not a plan log")
+  version = int(data[8:12].view(np.uint32)[0])
+  if version != _VERSION:
+    raise ValueError(f"unsupported plan log version {version}")
+
+  chunks = []
+  offset = _HEADER_SIZE
+  while offset + _CHUNK_HEADER_SIZE <= data.size:
+    if bytes(data[offset : offset + 4]) != _CHUNK_MAGIC:
+      raise ValueError(f"invalid chunk at byte {offset}")
+    (
+        records,
+        dim_state,
+        num_parameters,
+        num_samples,
+        horizon,
+        dim_sample_state,
+        _,
+    ) = (int(v) for v in data[offset + 4 : offset + 32].view(np.uint32))
+    sample_size = num_samples * horizon * dim_sample_state
+    size = 3 + dim_state + num_parameters + num_samples + sample_size
+    end = offset + _CHUNK_HEADER_SIZE + 8 * records * size
+    if end > data.size:
+      break
+
+    column = offset + _CHUNK_HEADER_SIZE
+
+    def take(count, dtype=np.float64):
+      nonlocal column
+      values = data[column : column + 8 * records * count].view(dtype)
+      column += 8 * records * count
+      return values.reshape(records, count)
+
+    iteration = take(1, np.int64)[:, 0]
+    time = take(1)[:, 0]
+    total_return = take(1)[:, 0]
+    state = take(dim_state)
+    parameters = take(num_parameters)
+    returns = take(num_samples)
+    sample_states = take(sample_size).reshape(
+        records, num_samples, horizon, dim_sample_state
+    )
+    chunks.append(
+        PlanLogChunk(
+            iteration=iteration,
+            time=time,
+            total_return=total_return,
+            state=state,
+            parameters=parameters,
+            returns=returns,
+            sample_states=sample_states,
+        )
+    )
+    offset = end
+  return chunks
+
+
+def action_synergies(
+    chunks: List[PlanLogChunk],
+    nu: int,
+    num_synergies: int,
+    quantile: float = 1.0,
+) -> np.ndarray:
+  """Principal directions of the spline points of logged nominal policies.
+
+  The rows are a basis for sampling_synergies, e.g.,
+  <numeric name="sampling_synergies" data="..."/> with the flattened basis,
+  so that sampling planners perturb the policies of the task in their span.
+
+  Args:
+    chunks: chunks of plan logs of a sampling planner.
+    nu: number of actuators.
+    num_synergies: number of directions.
+    quantile: only the iterations with a total return up to this quantile
+      of all returns are used, e.g., 0.5 for the better half.
+
+  Returns:
+    (num_synergies, nu) orthonormal directions, in decreasing variance.
+
+  Raises:
+    ValueError: if the logs have no policies of nu actuators.
+  """
+  returns = np.concatenate([chunk.total_return for chunk in chunks])
+  if not returns.size:
+    raise ValueError("no logged iterations")
+  threshold = np.quantile(returns, quantile)
+  actions = [
+      chunk.parameters[chunk.total_return <= threshold].reshape(-1, nu)
+      for chunk in chunks
+      if chunk.parameters.shape[1] and chunk.parameters.shape[1] % nu == 0
+  ]
+  if not actions:
+    raise ValueError(f"no logged policies of {nu} actuators")
+  actions = np.concatenate(actions)
+  _, _, directions = np.linalg.svd(
+      actions - actions.mean(axis=0), full_matrices=False
+  )
+  return directions[:num_synergies]
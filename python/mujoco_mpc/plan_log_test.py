@@ -0,0 +1,110 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import os
+import struct
+
+from absl.testing import absltest
+from mujoco_mpc import plan_log as plan_log_lib
+import numpy as np
+
+
+def _chunk(iteration, num_samples, horizon, dim_state=2, num_parameters=3):
+  """A chunk of records in the layout of mjpc/plan_log.h."""
+  records = len(iteration)
+  header = b"CHNK" + struct.pack(
+      "=7I",
+      records,
+      dim_state,
+      num_parameters,
+      num_samples,
+      horizon,
+      dim_state,
+      0,
+  )
+  iteration = np.asarray(iteration, dtype=np.int64)
+  columns = [
+      iteration,
+      0.01 * iteration,
+      2.0 * iteration,
+      np.outer(iteration, np.ones(dim_state)),
+      np.outer(iteration, np.ones(num_parameters)),
+      np.outer(iteration, np.arange(num_samples)),
+      np.outer(iteration, np.ones(num_samples * horizon * dim_state)),
+  ]
+  return header + b"".join(
+      np.ascontiguousarray(c, dtype=c.dtype if c is iteration else np.float64)
+      .tobytes()
+      for c in columns
+  )
+
+
+class PlanLogTest(absltest.TestCase):
+
+  def test_read(self):
+    path = os.path.join(absltest.get_default_test_tmpdir(), "plan_log.bin")
+    header = b"MJPCPLOG" + struct.pack("=2I", 1, 0)
+    first = _chunk([0, 1, 2], num_samples=4, horizon=0)
+    second = _chunk([3, 4], num_samples=5, horizon=2)
+    # a truncated chunk of a log that is being written
+    with open(path, "wb") as f:
+      f.write(header + first + second + second[:40])
+
+    chunks = plan_log_lib.read_plan_log(path)
+    self.assertLen(chunks, 2)
+    np.testing.assert_array_equal(chunks[0].iteration, [0, 1, 2])
+    np.testing.assert_allclose(chunks[0].time, [0.0, 0.01, 0.02])
+    self.assertEqual(chunks[0].state.shape, (3, 2))
+    self.assertEqual(chunks[0].returns.shape, (3, 4))
+    self.assertEqual(chunks[0].sample_states.shape, (3, 4, 0, 2))
+    np.testing.assert_array_equal(chunks[1].iteration, [3, 4])
+    np.testing.assert_allclose(chunks[1].returns[1], 4.0 * np.arange(5))
+    self.assertEqual(chunks[1].sample_states.shape, (2, 5, 2, 2))
+    np.testing.assert_allclose(chunks[1].sample_states[0], 3.0)
+
+  def test_invalid(self):
+    path = os.path.join(absltest.get_default_test_tmpdir(), "invalid.bin")
+    with open(path, "wb") as f:
+      f.write(b"not a plan log")
+    with self.assertRaises(ValueError):
+      plan_log_lib.read_plan_log(path)
+
+  def test_action_synergies(self):
+    # spline points of 3 actuators along (1, 1, 0), plus small noise
+    rng = np.random.default_rng(0)
+    records, num_spline_points, nu = 20, 4, 3
+    amplitude = rng.normal(size=(records, num_spline_points, 1))
+    actions = amplitude * np.array([1.0, 1.0, 0.0]) + 1.0e-3 * rng.normal(
+        size=(records, num_spline_points, nu)
+    )
+    empty = np.zeros((records, 0))
+    chunk = plan_log_lib.PlanLogChunk(
+        iteration=np.arange(records),
+        time=np.zeros(records),
+        total_return=np.arange(records, dtype=np.float64),
+        state=empty,
+        parameters=actions.reshape(records, -1),
+        returns=empty,
+        sample_states=np.zeros((records, 0, 0, 0)),
+    )
+    synergies = plan_log_lib.action_synergies([chunk], nu, 1, quantile=0.5)
+    self.assertEqual(synergies.shape, (1, nu))
+    np.testing.assert_allclose(
+        np.abs(synergies[0]), [np.sqrt(0.5), np.sqrt(0.5), 0.0], atol=1.0e-2
+    )
+
+
+if __name__ == "__main__":
+  absltest.main()
@@ -0,0 +1,294 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Evaluator of exported policies, from the Agent's GetPolicy.
+
+A policy, written by mjpc/policy_export.h, is an action spline or a nominal
+trajectory with feedback gains. PolicyEvaluator computes the actions of the
+planner's policy without the model, like PolicyEvaluator in the header.
+"""
+
+import dataclasses
+import enum
+from typing import Optional
+
+import numpy as np
+import numpy.typing as npt
+
+_MAGIC = b"MJPCPLCY"
+_VERSION = 1
+_FREE_JOINT = 0
+_BALL_JOINT = 1
+
+
+class PolicyKind(enum.IntEnum):
+  SPLINE = 0
+  FEEDBACK = 1
+
+
+@dataclasses.dataclass(frozen=True)
+class ExportedPolicy:
+  """Parameters of a policy.
+
+  Attributes:
+    version: increases with every published policy.
+    kind: action spline, or nominal trajectory with feedback.
+    representation: 0: zero, 1: linear, 2: cubic interpolation.
+    nq: configuration dimension, for feedback.
+    nv: velocity dimension, for feedback.
+    na: activation dimension, for feedback.
+    times: (knots,) knot times.
+    actions: (knots, nu) actions, at the first horizon - 1 times for feedback.
+    states: (horizon, nq + nv + na) nominal states, for feedback.
+    gains: (horizon - 1, nu, 2 nv + na) feedback gains.
+    ctrlrange: (nu, 2) control limits.
+    joints: (joints, 3) type, qpos and dof address, for feedback.
+    feedback_scaling: scale of the feedback term.
+  """
+
+  version: int
+  kind: PolicyKind
+  representation: int
+  nq: int
+  nv: int
+  na: int
+  times: np.ndarray
+  actions: np.ndarray
+  states: np.ndarray
+  gains: np.ndarray
+  ctrlrange: np.ndarray
+  joints: np.ndarray
+  feedback_scaling: float
+
+
+def parse_policy(data: bytes) -> ExportedPolicy:
+  """Parse an exported policy.
+
+  Args:
+    data: policy bytes, e.g., GetPolicyResponse.policy.
+
+  Returns:
+    The policy.
+
+  Raises:
+    ValueError: if data isn't a policy of a supported version.
+  """
+  if len(data) < 72 or data[:8] != _MAGIC:
+    raise ValueError("not an exported policy")
+  header = np.frombuffer(data, dtype=np.uint64, count=8, offset=8)
+  if int(header[0]) != _VERSION:
+    raise ValueError(f"unsupported policy version {int(header[0])}")
+  version, kind, representation, nu, nq, nv, na = (int(v) for v in header[1:])
+  offset = 72
+
+  def take(dtype=np.float64):
+    nonlocal offset
+    if offset + 8 > len(data):
+      raise ValueError("truncated policy")
+    size = int(np.frombuffer(data, dtype=np.uint64, count=1, offset=offset)[0])
+    if offset + 8 + 8 * size > len(data):
+      raise ValueError("truncated policy")
+    values = np.frombuffer(data, dtype=dtype, count=size, offset=offset + 8)
+    offset += 8 + 8 * size
+    return values
+
+  times = take()
+  actions = take()
+  states = take()
+  gains = take()
+  ctrlrange = take()
+  joints = take(np.int64)
+  if offset + 8 > len(data):
+    raise ValueError("truncated policy")
+  feedback_scaling = float(np.frombuffer(data, count=1, offset=offset)[0])
+  return ExportedPolicy(
+      version=version,
+      kind=PolicyKind(kind),
+      representation=representation,
+      nq=nq,
+      nv=nv,
+      na=na,
+      times=times,
+      actions=actions.reshape(-1, nu),
+      states=states.reshape(-1, nq + nv + na),
+      gains=gains.reshape(-1, nu, 2 * nv + na),
+      ctrlrange=ctrlrange.reshape(nu, 2),
+      joints=joints.reshape(-1, 3),
+      feedback_scaling=feedback_scaling,
+  )
+
+
+def _interval(times: np.ndarray, time: float, length: int) -> tuple[int, int]:
+  """Knot interval of time in the first length times, like FindInterval."""
+  upper = int(np.searchsorted(times[: max(length, 0)], time, side="right"))
+  if upper < 1:
+    return 0, 0
+  return upper - 1, min(upper, length - 1)
+
+
+def _slope(times: np.ndarray, values: np.ndarray, length: int, k: int):
+  """Slope of values at knot k, like KnotSlopes."""
+  if length < 2 or (k == length - 1 and length == 2):
+    return np.zeros_like(values[0])
+  if k == length - 1:
+    return (values[k] - values[k - 1]) / (times[k] - times[k - 1])
+  if k == 0:
+    return (values[1] - values[0]) / (times[1] - times[0])
+  return 0.5 * (values[k + 1] - values[k]) / (times[k + 1] - times[k]) + (
+      0.5 * (values[k] - values[k - 1]) / (times[k] - times[k - 1])
+  )
+
+
+def _interpolate(
+    times: np.ndarray,
+    values: np.ndarray,
+    time: float,
+    length: int,
+    representation: int,
+) -> np.ndarray:
+  """Interpolate values at time, like the policies' interpolation."""
+  k0, k1 = _interval(times, time, length)
+  if k0 == k1 or representation == 0:
+    return values[k0].copy()
+  dt = times[k1] - times[k0]
+  t = (time - times[k0]) / dt
+  if representation == 1:
+    return (1.0 - t) * values[k0] + t * values[k1]
+  c0 = 2.0 * t**3 - 3.0 * t**2 + 1.0
+  c1 = (t**3 - 2.0 * t**2 + t) * dt
+  c2 = -2.0 * t**3 + 3.0 * t**2
+  c3 = (t**3 - t**2) * dt
+  return (
+      c0 * values[k0]
+      + c1 * _slope(times, values, length, k0)
+      + c2 * values[k1]
+      + c3 * _slope(times, values, length, k1)
+  )
+
+
+def _normalize_quat(quat: np.ndarray) -> np.ndarray:
+  norm = np.linalg.norm(quat)
+  if norm < 1.0e-15:
+    return np.array([1.0, 0.0, 0.0, 0.0])
+  return quat / norm
+
+
+def _sub_quat(qa: np.ndarray, qb: np.ndarray) -> np.ndarray:
+  """3D velocity v with qb * quat(v) = qa, like mju_subQuat."""
+  q = np.array([
+      qb[0] * qa[0] + qb[1] * qa[1] + qb[2] * qa[2] + qb[3] * qa[3],
+      qb[0] * qa[1] - qb[1] * qa[0] - qb[2] * qa[3] + qb[3] * qa[2],
+      qb[0] * qa[2] + qb[1] * qa[3] - qb[2] * qa[0] - qb[3] * qa[1],
+      qb[0] * qa[3] - qb[1] * qa[2] + qb[2] * qa[1] - qb[3] * qa[0],
+  ])
+  sin_a_2 = np.linalg.norm(q[1:])
+  axis = q[1:] / sin_a_2 if sin_a_2 >= 1.0e-15 else np.array([1.0, 0.0, 0.0])
+  speed = 2.0 * np.arctan2(sin_a_2, q[0])
+  if speed > np.pi:
+    speed -= 2.0 * np.pi
+  return axis * speed
+
+
+class PolicyEvaluator:
+  """Actions of an exported policy, like the policy it was exported from."""
+
+  def __init__(self, policy: ExportedPolicy):
+    self.policy = policy
+
+  def action(
+      self, time: float, state: Optional[npt.ArrayLike] = None
+  ) -> np.ndarray:
+    """Returns the action at time.
+
+    Args:
+      time: policy time, e.g., the planner's simulation time.
+      state: (nq + nv + na) state for the feedback term of feedback policies.
+        Without a state, the nominal action is returned.
+    """
+    policy = self.policy
+    if policy.kind == PolicyKind.SPLINE:
+      action = _interpolate(
+          policy.times,
+          policy.actions,
+          time,
+          len(policy.times),
+          policy.representation,
+      )
+    else:
+      action = self._feedback(time, state)
+    return np.clip(action, policy.ctrlrange[:, 0], policy.ctrlrange[:, 1])
+
+  def _feedback(self, time: float, state: Optional[npt.ArrayLike]):
+    """Nominal action plus feedback, like iLQGPolicy::Action."""
+    policy = self.policy
+    nq, nv = policy.nq, policy.nv
+    horizon = len(policy.times)
+    representation = policy.representation
+    bounds = _interval(policy.times, time, horizon)
+    action_bounds = _interval(policy.times, time, horizon - 1)
+    if bounds[0] == bounds[1]:
+      representation = 0
+
+    # nominal action
+    action = _interpolate(
+        policy.times, policy.actions, time, horizon - 1, representation
+    )
+    if state is None:
+      return action
+    state = np.asarray(state, dtype=np.float64)
+
+    # reference state and gain
+    if representation == 0:
+      reference = policy.states[bounds[0]]
+    else:
+      reference = _interpolate(
+          policy.times, policy.states, time, horizon, representation
+      )
+      for joint_type, adr, _ in policy.joints:
+        if joint_type == _FREE_JOINT:
+          reference[adr + 3 : adr + 7] = _normalize_quat(
+              reference[adr + 3 : adr + 7]
+          )
+        elif joint_type == _BALL_JOINT:
+          reference[adr : adr + 4] = _normalize_quat(reference[adr : adr + 4])
+    gain = _interpolate(
+        policy.times,
+        policy.gains,
+        time,
+        horizon - 1,
+        representation,
+    )
+
+    # state difference, like StateDiff
+    ds = np.empty(2 * nv + policy.na)
+    if nq == nv:
+      ds[:nv] = state[:nv] - reference[:nv]
+    else:
+      for joint_type, qadr, dadr in policy.joints:
+        if joint_type == _FREE_JOINT:
+          ds[dadr : dadr + 3] = (
+              state[qadr : qadr + 3] - reference[qadr : qadr + 3]
+          )
+          ds[dadr + 3 : dadr + 6] = _sub_quat(
+              state[qadr + 3 : qadr + 7], reference[qadr + 3 : qadr + 7]
+          )
+        elif joint_type == _BALL_JOINT:
+          ds[dadr : dadr + 3] = _sub_quat(
+              state[qadr : qadr + 4], reference[qadr : qadr + 4]
+          )
+        else:
+          ds[dadr] = state[qadr] - reference[qadr]
+    ds[nv:] = state[nq:] - reference[nq:]
+    return action + policy.feedback_scaling * gain @ ds
@@ -0,0 +1,135 @@
+# Copyright 2023 DeepMind Technologies Limited
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import struct
+
+from absl.testing import absltest
+from mujoco_mpc import policy as policy_lib
+import numpy as np
+
+
+def _policy(
+    kind,
+    representation,
+    times,
+    actions,
+    states=(),
+    gains=(),
+    ctrlrange=(),
+    joints=(),
+    nq=0,
+    nv=0,
+    na=0,
+    feedback_scaling=1.0,
+):
+  """A policy in the layout of mjpc/policy_export.h."""
+  nu = np.shape(actions)[1]
+  header = b"MJPCPLCY" + struct.pack(
+      "=8Q", 1, 7, kind, representation, nu, nq, nv, na
+  )
+
+  def array(values, dtype=np.float64):
+    values = np.ascontiguousarray(values, dtype=dtype).ravel()
+    return struct.pack("=Q", values.size) + values.tobytes()
+
+  return (
+      header
+      + array(times)
+      + array(actions)
+      + array(states)
+      + array(gains)
+      + array(ctrlrange)
+      + array(joints, np.int64)
+      + struct.pack("=d", feedback_scaling)
+  )
+
+
+class PolicyTest(absltest.TestCase):
+
+  def test_spline(self):
+    times = [0.0, 1.0, 2.0]
+    actions = [[0.0, 0.0], [1.0, -1.0], [3.0, 0.0]]
+    ctrlrange = [[-10.0, 10.0], [-0.5, 0.5]]
+    policy = policy_lib.parse_policy(
+        _policy(0, 1, times, actions, ctrlrange=ctrlrange)
+    )
+    self.assertEqual(policy.version, 7)
+    self.assertEqual(policy.kind, policy_lib.PolicyKind.SPLINE)
+    self.assertEqual(policy.actions.shape, (3, 2))
+
+    # linear, clamped to the control range
+    evaluator = policy_lib.PolicyEvaluator(policy)
+    np.testing.assert_allclose(evaluator.action(0.5), [0.5, -0.5])
+    np.testing.assert_allclose(evaluator.action(1.5), [2.0, -0.5])
+    np.testing.assert_allclose(evaluator.action(-1.0), [0.0, 0.0])
+    np.testing.assert_allclose(evaluator.action(5.0), [3.0, 0.0])
+
+    # zero-order hold
+    policy = policy_lib.parse_policy(
+        _policy(0, 0, times, actions, ctrlrange=ctrlrange)
+    )
+    evaluator = policy_lib.PolicyEvaluator(policy)
+    np.testing.assert_allclose(evaluator.action(1.5), [1.0, -0.5])
+
+    # cubic through the knots
+    policy = policy_lib.parse_policy(
+        _policy(0, 2, times, actions, ctrlrange=ctrlrange)
+    )
+    evaluator = policy_lib.PolicyEvaluator(policy)
+    np.testing.assert_allclose(evaluator.action(1.0), [1.0, -0.5])
+
+  def test_feedback(self):
+    # one hinge, states (qpos, qvel), two actions
+    times = [0.0, 1.0, 2.0]
+    states = [[0.0, 0.0], [1.0, 1.0], [2.0, 1.0]]
+    actions = [[0.0], [1.0]]
+    gains = [[[-2.0, -1.0]], [[-4.0, -1.0]]]
+    policy = policy_lib.parse_policy(
+        _policy(
+            1,
+            1,
+            times,
+            actions,
+            states=states,
+            gains=gains,
+            ctrlrange=[[-10.0, 10.0]],
+            joints=[[3, 0, 0]],
+            nq=1,
+            nv=1,
+            feedback_scaling=0.5,
+        )
+    )
+    self.assertEqual(policy.kind, policy_lib.PolicyKind.FEEDBACK)
+    self.assertEqual(policy.gains.shape, (2, 1, 2))
+    evaluator = policy_lib.PolicyEvaluator(policy)
+
+    # nominal, actions at the first horizon - 1 times
+    np.testing.assert_allclose(evaluator.action(0.5), [0.5])
+    np.testing.assert_allclose(evaluator.action(1.5), [1.0])
+
+    # feedback of the state offset, with interpolated gains
+    state = np.array([0.5 + 0.1, 0.5])
+    np.testing.assert_allclose(evaluator.action(0.5, state), [0.5 - 0.15])
+
+  def test_invalid(self):
+    with self.assertRaises(ValueError):
+      policy_lib.parse_policy(b"not a policy")
+    data = _policy(0, 1, [0.0], [[1.0]], ctrlrange=[[-1.0, 1.0]])
+    with self.assertRaises(ValueError):
+      policy_lib.parse_policy(data[:-12])
+
+
+if __name__ == "__main__":
+  absltest.main()
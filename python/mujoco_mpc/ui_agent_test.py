@@ -154,6 +154,25 @@ class UiAgentTest(absltest.TestCase):
       )
       agent.planner_step()
 
+  def test_stream_scene(self):
+    model_path = (
+        pathlib.Path(__file__).parent.parent.parent / "mjpc/tasks/cartpole/task.xml"
+    )
+    model = mujoco.MjModel.from_xml_path(str(model_path))
+    with self.get_agent(task_id="Cartpole", model=model) as agent:
+      frames = agent.stream_scene(rate=100, float32=False, keyframe_interval=3)
+      times = []
+      for _ in range(5):
+        frame = next(frames)
+        self.assertEqual(frame["qpos"].shape, (model.nq,))
+        self.assertEqual(frame["mocap_pos"].shape, (model.nmocap, 3))
+        times.append(frame["time"])
+      frames.close()
+
+      # key and delta frames decode to the simulation's advancing state
+      self.assertEqual(sorted(times), times)
+      self.assertTrue(np.all(np.isfinite(frame["qpos"])))
+
   def test_set_get_mode(self):
     model_path = (
         pathlib.Path(__file__).parent.parent.parent / "mjpc/tasks/cartpole/task.xml"
@@ -111,6 +111,23 @@ class CopyAgentServerBinaryCommand(setuptools.Command):
   def run(self):
     self._copy_binary("agent_server")
     self._copy_binary("ui_agent_server")
+    self._copy_extension("agent_bindings")
+
+  def _copy_extension(self, module_name):
+    source_paths = tuple(Path("../build/python").glob(f"{module_name}.*"))
+    if not source_paths:
+      raise ValueError(
+          f"Cannot find the `{module_name}` extension module in"
+          " ../build/python. Please build the `{module_name}` target."
+      )
+    assert self.build_lib is not None
+    build_lib_path = Path(self.build_lib).resolve()
+    for source_path in source_paths:
+      destination_path = Path(build_lib_path, "mujoco_mpc", source_path.name)
+      self.announce(f"{source_path.resolve()=}")
+      self.announce(f"{destination_path.resolve()=}")
+      destination_path.parent.mkdir(exist_ok=True, parents=True)
+      shutil.copy(source_path, destination_path)
 
   def _copy_binary(self, binary_name):
     source_path = Path(f"../build/bin/{binary_name}")
@@ -215,6 +232,7 @@ class BuildCMakeExtension(build_ext.build_ext):
         f"-DCMAKE_BUILD_TYPE:STRING={build_cfg}",
         "-DBUILD_TESTING:BOOL=OFF",
         "-DMJPC_BUILD_GRPC_SERVICE:BOOL=ON",
+        "-DMJPC_BUILD_PYTHON_BINDINGS:BOOL=ON",
     ]
 
     if platform.system() == "Darwin" and "ARCHFLAGS" in os.environ:
@@ -241,7 +259,10 @@ class BuildCMakeExtension(build_ext.build_ext):
         cwd=mujoco_mpc_root,
     )
 
-    print("Building `agent_server` and `ui_agent_server` with CMake")
+    print(
+        "Building `agent_server`, `ui_agent_server` and `agent_bindings` with"
+        " CMake"
+    )
     subprocess.check_call(
         [
             cmake_command,
@@ -250,6 +271,7 @@ class BuildCMakeExtension(build_ext.build_ext):
             "--target",
             "agent_server",
             "ui_agent_server",
+            "agent_bindings",
             f"-j{os.cpu_count()}",
             "--config",
             build_cfg,